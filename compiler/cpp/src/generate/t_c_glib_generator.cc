@@ -56,8 +56,12 @@ class t_c_glib_generator : public t_oop_generator {
                      const map<string, string> &parsed_options,
                      const string &option_string) : t_oop_generator(program)
   {
-    (void) parsed_options;
     (void) option_string;
+    map<string, string>::const_iterator iter;
+
+    iter = parsed_options.find("plain_structs");
+    plain_structs_ = (iter != parsed_options.end());
+
     /* set the output directory */
     this->out_dir_base_ = "gen-c_glib";
 
@@ -109,6 +113,9 @@ class t_c_glib_generator : public t_oop_generator {
 
  private:
 
+  /* generate plain C structs instead of GObjects */
+  bool plain_structs_;
+
   /* file streams */
   ofstream f_types_;
   ofstream f_types_impl_;
@@ -123,6 +130,8 @@ class t_c_glib_generator : public t_oop_generator {
 
   /* helper functions */
   bool is_complex_type(t_type *ttype);
+  bool is_inline_array_elem(t_type *etype);
+  string struct_function(t_type *ttype, string suffix);
   string type_name(t_type* ttype, bool in_typedef=false, bool is_const=false);
   string base_type_name(t_base_type *type);
   string type_to_enum(t_type *type);
@@ -138,6 +147,7 @@ class t_c_glib_generator : public t_oop_generator {
   void generate_service_client(t_service *tservice);
   void generate_service_server(t_service *tservice);
   void generate_object(t_struct *tstruct);
+  void generate_plain_object(t_struct *tstruct);
   void generate_struct_writer(ofstream &out, t_struct *tstruct, string this_name, string this_get="", bool is_function=true);
   void generate_struct_reader(ofstream &out, t_struct *tstruct, string this_name, string this_get="", bool is_function=true);
 
@@ -496,6 +506,26 @@ bool t_c_glib_generator::is_complex_type(t_type *ttype) {
                   == t_base_type::TYPE_STRING));
 }
 
+/**
+ * Returns true if a list of etype is a GArray holding its elements by
+ * value.  With plain_structs this is also the case for structs and enums.
+ */
+bool t_c_glib_generator::is_inline_array_elem(t_type *etype) {
+  etype = get_true_type (etype);
+
+  return plain_structs_
+         && (etype->is_struct() || etype->is_xception() || etype->is_enum());
+}
+
+/**
+ * Returns the name of a plain struct's function, e.g. thrift_bonk_read.
+ */
+string t_c_glib_generator::struct_function(t_type *ttype, string suffix) {
+  return this->nspace_lc
+         + initial_caps_to_underscores(get_true_type (ttype)->get_name())
+         + "_" + suffix;
+}
+
 
 /**
  * Maps a Thrift t_type to a C type.
@@ -530,7 +560,9 @@ string t_c_glib_generator::type_name (t_type* ttype, bool in_typedef, bool is_co
       // TODO: investigate other implementations besides GPtrArray
       cname = "GPtrArray *";
       t_type *etype = ((t_list *) ttype)->get_elem_type();
-      if (etype->is_base_type()) {
+      if (is_inline_array_elem (etype)) {
+        cname = "GArray *";
+      } else if (etype->is_base_type()) {
         t_base_type::t_base tbase = ((t_base_type *) etype)->get_base();
         switch (tbase) {
           case t_base_type::TYPE_VOID:
@@ -862,10 +894,17 @@ void t_c_glib_generator::generate_const_initializer(string name, t_type *type, t
       }
       field_name = tmp (field_name);
 
+      // plain structs hold struct fields by value
+      string deref = "";
+      if (plain_structs_ && (get_true_type (field_type)->is_struct()
+                             || get_true_type (field_type)->is_xception())) {
+        deref = "*";
+      }
+
       generate_const_initializer (name + "_constant_" + field_name,
                                   field_type, v_iter->second);
       initializers <<
-        "    constant->" << v_iter->first->get_string() << " = " <<
+        "    constant->" << v_iter->first->get_string() << " = " << deref <<
         constant_value (name + "_constant_" + field_name,
                         field_type, v_iter->second) << ";" << endl <<
         "    constant->__isset_" << v_iter->first->get_string() <<
@@ -881,8 +920,9 @@ void t_c_glib_generator::generate_const_initializer(string name, t_type *type, t
           " *constant = NULL;" << endl <<
       "  if (constant == NULL)" << endl <<
       "  {" << endl <<
-      "    constant = g_object_new (" << this->nspace_uc << "TYPE_" <<
-          type_uc << ", NULL);" << endl <<
+      "    constant = " << (plain_structs_ ? struct_function (type, "new") + " ();" :
+                            "g_object_new (" + this->nspace_uc + "TYPE_" +
+                            type_uc + ", NULL);") << endl <<
       initializers.str() << endl <<
       "  }" << endl <<
       "  return constant;" << endl <<
@@ -901,7 +941,15 @@ void t_c_glib_generator::generate_const_initializer(string name, t_type *type, t
     ostringstream initializers;
 
     list_initializer = generate_new_array_from_type (etype);
-    if (etype->is_base_type()) {
+    if (is_inline_array_elem (etype)) {
+      list_type = "GArray *";
+      if (get_true_type (etype)->is_enum()) {
+        list_appender = "g_array_append_val";
+        list_variable = true;
+      } else {
+        list_appender = "g_array_append_vals";
+      }
+    } else if (etype->is_base_type()) {
       t_base_type::t_base tbase = ((t_base_type *) etype)->get_base();
       switch (tbase) {
         case t_base_type::TYPE_VOID:
@@ -933,6 +981,10 @@ void t_c_glib_generator::generate_const_initializer(string name, t_type *type, t
             constant_value (fname, (t_type *) etype, (*v_iter)) << ";" <<
                 endl <<
           "    " << list_appender << "(constant, " << fname << ");" << endl;
+      } else if (list_appender == "g_array_append_vals") {
+        initializers <<
+          "    " << list_appender << "(constant, " <<
+          constant_value (fname, (t_type *) etype, (*v_iter)) << ", 1);" << endl;
       } else {
         initializers <<
           "    " << list_appender << "(constant, " <<
@@ -1667,6 +1719,11 @@ void t_c_glib_generator::generate_service_server (t_service *tservice) {
  * Generates C code to represent a THrift structure as a GObject.
  */
 void t_c_glib_generator::generate_object(t_struct *tstruct) {
+  if (plain_structs_) {
+    generate_plain_object (tstruct);
+    return;
+  }
+
   string name = tstruct->get_name();
   string name_u = initial_caps_to_underscores(name);
   string name_uc = to_upper_case(name_u);
@@ -1937,6 +1994,213 @@ void t_c_glib_generator::generate_object(t_struct *tstruct) {
     endl;
 }
 
+/**
+ * Generates C code to represent a Thrift structure as a plain C struct.
+ * Nested structs are stored by value and lists of structs are GArrays of
+ * them, so reading a message costs far fewer allocations than a tree of
+ * GObjects.  For example:
+ *
+ * struct _ThriftBonk
+ * {
+ *   gchar * message;
+ *   gboolean __isset_message;
+ *   ThriftInner inner;
+ * };
+ *
+ * ThriftBonk * thrift_bonk_new (void);
+ * void thrift_bonk_free (ThriftBonk *object);
+ * gint32 thrift_bonk_read (ThriftBonk *object, ThriftProtocol *protocol, GError **error);
+ * ...
+ */
+void t_c_glib_generator::generate_plain_object(t_struct *tstruct) {
+  string name = tstruct->get_name();
+  string name_u = initial_caps_to_underscores(name);
+  string full_name = this->nspace + name;
+  string func_prefix = this->nspace_lc + name_u;
+
+  // write the instance definition
+  f_types_ <<
+    "struct _" << full_name << endl <<
+    "{" << endl <<
+    "  /* public */" << endl;
+
+  vector<t_field *>::const_iterator m_iter;
+  const vector<t_field *> &members = tstruct->get_members();
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    t_type *t = get_true_type ((*m_iter)->get_type());
+    if (t->is_struct() || t->is_xception()) {
+      f_types_ <<
+        "  " << this->nspace << t->get_name() << " " << (*m_iter)->get_name() << ";" << endl;
+    } else {
+      f_types_ <<
+        "  " << type_name (t) << " " << (*m_iter)->get_name() << ";" << endl;
+    }
+    if ((*m_iter)->get_req() != t_field::T_REQUIRED) {
+      f_types_ <<
+        "  gboolean __isset_" << (*m_iter)->get_name() << ";" << endl;
+    }
+  }
+  if (members.empty()) {
+    // C does not allow a struct without members
+    f_types_ <<
+      "  gchar __unused;" << endl;
+  }
+
+  f_types_ <<
+    "};" << endl <<
+    "typedef struct _" << full_name << " " << full_name << ";" << endl <<
+    endl;
+
+  f_types_ <<
+    "void " << func_prefix << "_init (" << full_name << " *object);" << endl <<
+    "void " << func_prefix << "_clear (" << full_name << " *object);" << endl <<
+    full_name << " * " << func_prefix << "_new (void);" << endl <<
+    "void " << func_prefix << "_free (" << full_name << " *object);" << endl <<
+    "void " << func_prefix << "_free_array (GArray *array);" << endl <<
+    "gint32 " << func_prefix << "_read (" << full_name << " *object, ThriftProtocol *protocol, GError **error);" << endl <<
+    "gint32 " << func_prefix << "_write (" << full_name << " *object, ThriftProtocol *protocol, GError **error);" << endl <<
+    endl;
+
+  // generate struct I/O methods
+  string this_get = full_name + " * this_object = object;";
+  generate_struct_reader (f_types_impl_, tstruct, "this_object->", this_get);
+  generate_struct_writer (f_types_impl_, tstruct, "this_object->", this_get);
+
+  // generate the init function, which sets the defaults in place
+  f_types_impl_ <<
+    "void" << endl <<
+    func_prefix << "_init (" << full_name << " *object)" << endl <<
+    "{" << endl;
+  indent_up();
+  indent(f_types_impl_) << "/* satisfy -Wall */" << endl <<
+               indent() << "THRIFT_UNUSED_VAR (object);" << endl;
+
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    t_type* t = get_true_type ((*m_iter)->get_type());
+    string name = (*m_iter)->get_name();
+    if (t->is_base_type() || t->is_enum()) {
+      string dval = " = ";
+      if (t->is_enum()) {
+        dval += "(" + type_name (t) + ")";
+      }
+      t_const_value* cv = (*m_iter)->get_value();
+      if (cv != NULL) {
+        dval += constant_value ("", t, cv);
+      } else {
+        dval += t->is_string() ? "NULL" : "0";
+      }
+      indent(f_types_impl_) << "object->" << name << dval << ";" << endl;
+    } else if (t->is_struct() || t->is_xception()) {
+      indent(f_types_impl_) << struct_function (t, "init") << " (&object->" << name << ");" << endl;
+    } else if (t->is_container()) {
+      string init_function;
+
+      if (t->is_map()) {
+        t_type *key = ((t_map *) t)->get_key_type();
+        t_type *value = ((t_map *) t)->get_val_type();
+        init_function = generate_new_hash_from_type (key, value);
+      } else if (t->is_set()) {
+        t_type *etype = ((t_set *) t)->get_elem_type();
+        init_function = generate_new_hash_from_type (etype, NULL);
+      } else if (t->is_list()) {
+        t_type *etype = ((t_list *) t)->get_elem_type();
+        init_function = generate_new_array_from_type (etype);
+      }
+
+      indent(f_types_impl_) << "object->" << name << " = " <<
+                                  init_function << endl;
+    }
+
+    if ((*m_iter)->get_req() != t_field::T_REQUIRED) {
+      indent(f_types_impl_) << "object->__isset_" << name << " = FALSE;" << endl;
+    }
+  }
+
+  indent_down();
+  f_types_impl_ << "}" << endl <<
+    endl;
+
+  // generate the clear function, which frees whatever the fields own
+  f_types_impl_ <<
+    "void" << endl <<
+    func_prefix << "_clear (" << full_name << " *object)" << endl <<
+    "{" << endl;
+  indent_up();
+  indent(f_types_impl_) << "/* satisfy -Wall in case we don't use object */" << endl <<
+               indent() << "THRIFT_UNUSED_VAR (object);" << endl;
+
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    t_type* t = get_true_type ((*m_iter)->get_type());
+    string name = (*m_iter)->get_name();
+    string destructor;
+
+    if (t->is_struct() || t->is_xception()) {
+      indent(f_types_impl_) << struct_function (t, "clear") << " (&object->" << name << ");" << endl;
+      continue;
+    } else if (t->is_map() || t->is_set()) {
+      destructor = "g_hash_table_destroy (object->" + name + ");";
+    } else if (t->is_list()) {
+      t_type *etype = ((t_list *) t)->get_elem_type();
+      if (is_inline_array_elem (etype) && !get_true_type (etype)->is_enum()) {
+        destructor = struct_function (etype, "free_array") + " (object->" + name + ");";
+      } else if (type_name (t) == "GArray *") {
+        destructor = "g_array_free (object->" + name + ", TRUE);";
+      } else {
+        destructor = "g_ptr_array_free (object->" + name + ", TRUE);";
+      }
+    } else if (t->is_string()) {
+      if (((t_base_type *) t)->is_binary()) {
+        destructor = "g_byte_array_free (object->" + name + ", TRUE);";
+      } else {
+        destructor = "g_free (object->" + name + ");";
+      }
+    } else {
+      continue;
+    }
+
+    f_types_impl_ <<
+      indent() << "if (object->" << name << " != NULL)" << endl <<
+      indent() << "{" << endl <<
+      indent() << "  " << destructor << endl <<
+      indent() << "  object->" << name << " = NULL;" << endl <<
+      indent() << "}" << endl;
+  }
+
+  indent_down();
+  f_types_impl_ << "}" << endl <<
+    endl;
+
+  // allocation goes through g_slice, which keeps per-thread caches of
+  // blocks of each struct size
+  f_types_impl_ <<
+    full_name << " *" << endl <<
+    func_prefix << "_new (void)" << endl <<
+    "{" << endl <<
+    "  " << full_name << " *object = g_slice_new0 (" << full_name << ");" << endl <<
+    "  " << func_prefix << "_init (object);" << endl <<
+    "  return object;" << endl <<
+    "}" << endl <<
+    endl <<
+    "void" << endl <<
+    func_prefix << "_free (" << full_name << " *object)" << endl <<
+    "{" << endl <<
+    "  if (object == NULL)" << endl <<
+    "    return;" << endl <<
+    "  " << func_prefix << "_clear (object);" << endl <<
+    "  g_slice_free (" << full_name << ", object);" << endl <<
+    "}" << endl <<
+    endl <<
+    "void" << endl <<
+    func_prefix << "_free_array (GArray *array)" << endl <<
+    "{" << endl <<
+    "  guint i;" << endl <<
+    "  for (i = 0; i < array->len; i++)" << endl <<
+    "    " << func_prefix << "_clear (&g_array_index (array, " << full_name << ", i));" << endl <<
+    "  g_array_free (array, TRUE);" << endl <<
+    "}" << endl <<
+    endl;
+}
+
 /**
  * Generates functions to write Thrift structures to a stream.
  */
@@ -1953,7 +2217,13 @@ void t_c_glib_generator::generate_struct_writer (ofstream &out,
   vector <t_field *>::const_iterator f_iter;
   int error_ret = 0;
 
-  if (is_function) {
+  if (is_function && plain_structs_) {
+    error_ret = -1;
+    indent(out) <<
+      "gint32" << endl <<
+      this->nspace_lc << name_u <<
+      "_write (" << this->nspace << name << " *object, ThriftProtocol *protocol, GError **error)" << endl;
+  } else if (is_function) {
     error_ret = -1;
     indent(out) <<
       "static gint32" << endl <<
@@ -2039,7 +2309,14 @@ void t_c_glib_generator::generate_struct_reader(ofstream &out,
   const vector<t_field *> &fields = tstruct->get_members();
   vector <t_field *>::const_iterator f_iter;
 
-  if (is_function) {
+  if (is_function && plain_structs_) {
+    error_ret = -1;
+    indent(out) <<
+      "/* reads a " << name_u << " struct */" << endl <<
+      "gint32" << endl <<
+      this->nspace_lc << name_u <<
+          "_read (" << this->nspace << name << " *object, ThriftProtocol *protocol, GError **error)" << endl;
+  } else if (is_function) {
     error_ret = -1;
     indent(out) <<
       "/* reads a " << name_u << " object */" << endl <<
@@ -2223,6 +2500,10 @@ void t_c_glib_generator::generate_serialize_field(ofstream &out,
   }
 
   if (type->is_struct() || type->is_xception()) {
+    // plain structs hold their struct fields by value
+    if (plain_structs_ && prefix != "") {
+      name = "&" + name;
+    }
     generate_serialize_struct (out, (t_struct *) type, name, error_ret);
   } else if (type->is_container()) {
     generate_serialize_container (out, type, name, error_ret);
@@ -2283,7 +2564,15 @@ void t_c_glib_generator::generate_serialize_struct(ofstream &out,
                                                    t_struct *tstruct,
                                                    string prefix,
                                                    int error_ret) {
-  (void) tstruct;
+  if (plain_structs_) {
+    out <<
+      indent() << "if ((ret = " << struct_function (tstruct, "write") << " (" << prefix << ", protocol, error)) < 0)" << endl <<
+      indent() << "  return " << error_ret << ";" << endl <<
+      indent() << "xfer += ret;" << endl <<
+      endl;
+    return;
+  }
+
   out <<
     indent() << "if ((ret = thrift_struct_write (THRIFT_STRUCT (" << prefix << "), protocol, error)) < 0)" << endl <<
     indent() << "  return " << error_ret << ";" << endl <<
@@ -2454,7 +2743,14 @@ void t_c_glib_generator::generate_serialize_list_element(ofstream &out,
   string name = "g_ptr_array_index ((GPtrArray *) " + list + ", "
                 + index + ")";
 
-  if (ttype->is_base_type()) {
+  if (is_inline_array_elem (ttype)) {
+    if (get_true_type (ttype)->is_enum()) {
+      name = "g_array_index (" + list + ", gint32, " + index + ")";
+    } else {
+      name = "&g_array_index (" + list + ", " + this->nspace
+             + get_true_type (ttype)->get_name() + ", " + index + ")";
+    }
+  } else if (ttype->is_base_type()) {
     t_base_type::t_base tbase = ((t_base_type *) ttype)->get_base(); 
     switch (tbase) {
       case t_base_type::TYPE_VOID:
@@ -2488,7 +2784,9 @@ void t_c_glib_generator::generate_serialize_list_element(ofstream &out,
     cast = "(GHashTable*)";
   } else if (ttype->is_list()) {
     t_type *base = ((t_list *)ttype)->get_elem_type();
-    if (base->is_base_type()) {
+    if (is_inline_array_elem (base)) {
+      cast = "(GArray*)";
+    } else if (base->is_base_type()) {
       switch (((t_base_type *) base)->get_base()) {
         case t_base_type::TYPE_VOID:
           throw "compiler error: cannot determine array type";
@@ -2533,7 +2831,15 @@ void t_c_glib_generator::generate_deserialize_field(ofstream &out,
   string name = prefix + tfield->get_name() + suffix;
 
   if (type->is_struct() || type->is_xception()) {
-    generate_deserialize_struct (out, (t_struct *) type, name, error_ret, allocate);
+    if (plain_structs_ && prefix != "") {
+      // plain structs hold their struct fields by value
+      out <<
+        indent() << "if ((ret = " << struct_function (type, "read") << " (&" << name << ", protocol, error)) < 0)" << endl <<
+        indent() << "  return " << error_ret << ";" << endl <<
+        indent() << "xfer += ret;" << endl;
+    } else {
+      generate_deserialize_struct (out, (t_struct *) type, name, error_ret, allocate);
+    }
   } else if (type->is_container()) {
     generate_deserialize_container (out, type, name, error_ret);
   } else if (type->is_base_type()) {
@@ -2629,6 +2935,27 @@ void t_c_glib_generator::generate_deserialize_struct(ofstream &out,
     allocate = true;
   }
 
+  if (plain_structs_) {
+    if (allocate) {
+      out <<
+        indent() << struct_function (tstruct, "free") << " (" << prefix << ");" << endl <<
+        indent() << prefix << " = " << struct_function (tstruct, "new") << " ();" << endl;
+    }
+    out <<
+      indent() << "if ((ret = " << struct_function (tstruct, "read") << " (" << prefix << ", protocol, error)) < 0)" << endl <<
+      indent() << "{" << endl;
+    if (allocate) {
+      out <<
+        indent() << "  " << struct_function (tstruct, "free") << " (" << prefix << ");" << endl <<
+        indent() << "  " << prefix << " = NULL;" << endl;
+    }
+    out <<
+      indent() << "  return " << error_ret << ";" << endl <<
+      indent() << "}" << endl <<
+      indent() << "xfer += ret;" << endl;
+    return;
+  }
+
   if (allocate) {
     out <<
       indent() << "if ( " << prefix << " != NULL)" << endl <<
@@ -2749,6 +3076,14 @@ void t_c_glib_generator::declare_local_variable(ofstream &out, t_type *ttype, st
   if (ttype->is_map()) {
     out <<
     indent() << tname << ptr << " " << name << " = g_hash_table_new (NULL, NULL);" << endl;
+  } else if (ttype->is_list()) {
+    out <<
+    indent() << tname << ptr << " " << name << " = " <<
+      generate_new_array_from_type (((t_list *) ttype)->get_elem_type()) << endl;
+  } else if (ttype->is_set()) {
+    out <<
+    indent() << tname << ptr << " " << name << " = " <<
+      generate_new_hash_from_type (((t_set *) ttype)->get_elem_type(), NULL) << endl;
   } else if (ttype->is_enum()) {
     out <<
     indent() << tname << ptr << " " << name << ";" << endl;
@@ -2811,6 +3146,31 @@ void t_c_glib_generator::generate_deserialize_list_element(ofstream &out,
   string elem = tmp ("_elem");
   string telem_ptr = ttype->is_string() || !ttype->is_base_type() ? "" : "*";
 
+  if (plain_structs_) {
+    t_type *etype = get_true_type (ttype);
+    if (etype->is_struct() || etype->is_xception()) {
+      // read the struct in place at the end of the array
+      string full_name = this->nspace + etype->get_name();
+      out <<
+        indent() << "g_array_set_size (" << prefix << ", (" << prefix << ")->len + 1);" << endl <<
+        indent() << full_name << " * " << elem << " = &g_array_index (" << prefix << ", " << full_name << ", (" << prefix << ")->len - 1);" << endl <<
+        indent() << struct_function (etype, "init") << " (" << elem << ");" << endl <<
+        indent() << "if ((ret = " << struct_function (etype, "read") << " (" << elem << ", protocol, error)) < 0)" << endl <<
+        indent() << "  return " << error_ret << ";" << endl <<
+        indent() << "xfer += ret;" << endl;
+      return;
+    } else if (etype->is_enum()
+               || (etype->is_base_type() && !etype->is_string())) {
+      // read into a local rather than a fresh allocation
+      out <<
+        indent() << type_name (etype) << " " << elem << ";" << endl;
+      t_field felem (etype, elem);
+      generate_deserialize_field (out, &felem, "", "", error_ret);
+      indent(out) << "g_array_append_vals (" << prefix << ", &" << elem << ", 1);" << endl;
+      return;
+    }
+  }
+
   declare_local_variable(out, ttype, elem);
 
   t_field felem (ttype, telem_ptr + elem);
@@ -2867,11 +3227,15 @@ string t_c_glib_generator::generate_free_func_from_type (t_type * ttype) {
     return "NULL";
   } else if (ttype->is_map() || ttype->is_set()) {
     return "(GDestroyNotify) g_hash_table_destroy";
+  } else if (ttype->is_struct() && plain_structs_) {
+    return "(GDestroyNotify) " + struct_function (ttype, "free");
   } else if (ttype->is_struct()) {
     return "g_object_unref";
   } else if (ttype->is_list()) {
     t_type *etype = ((t_list *) ttype)->get_elem_type();
-    if (etype->is_base_type()) {
+    if (is_inline_array_elem (etype) && !get_true_type (etype)->is_enum()) {
+      return "(GDestroyNotify) " + struct_function (etype, "free_array");
+    } else if (etype->is_base_type()) {
       t_base_type::t_base tbase = ((t_base_type *) etype)->get_base();
       switch (tbase) {
         case t_base_type::TYPE_VOID:
@@ -2984,7 +3348,10 @@ string t_c_glib_generator::generate_new_hash_from_type (t_type * key, t_type *va
 }
 
 string t_c_glib_generator::generate_new_array_from_type(t_type * ttype) {
-  if (ttype->is_base_type()) {
+  if (is_inline_array_elem (ttype) && !get_true_type (ttype)->is_enum()) {
+    return "g_array_new (0, 1, sizeof (" + this->nspace +
+           get_true_type (ttype)->get_name() + "));";
+  } else if (ttype->is_base_type()) {
     t_base_type::t_base tbase = ((t_base_type *) ttype)->get_base();
     switch (tbase) {
       case t_base_type::TYPE_VOID:
@@ -3069,4 +3436,6 @@ string initial_caps_to_underscores(string name) {
 }
 
 /* register this generator with the main program */
-THRIFT_REGISTER_GENERATOR(c_glib, "C, using GLib", "")
+THRIFT_REGISTER_GENERATOR(c_glib, "C, using GLib",
+"    plain_structs:   Generate structs as plain C structs allocated with g_slice,\n"
+"                     with nested structs stored inline, instead of GObjects.\n")
@@ -21,7 +21,9 @@
  * details.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
 
 #include <fstream>
 #include <iostream>
@@ -69,15 +71,103 @@ class t_cpp_generator : public t_oop_generator {
     iter = parsed_options.find("cob_style");
     gen_cob_style_ = (iter != parsed_options.end());
 
+    iter = parsed_options.find("coroutines");
+    gen_coroutines_ = (iter != parsed_options.end());
+    // Built on the cob-style classes
+    gen_cob_style_ = gen_cob_style_ || gen_coroutines_;
+
+    iter = parsed_options.find("cpp11");
+    gen_cpp11_ = (iter != parsed_options.end()) || gen_coroutines_;
+
     iter = parsed_options.find("no_client_completion");
     gen_no_client_completion_ = (iter != parsed_options.end());
 
+    iter = parsed_options.find("concurrent");
+    gen_concurrent_client_ = (iter != parsed_options.end());
+
     iter = parsed_options.find("templates");
     gen_templates_ = (iter != parsed_options.end());
 
     gen_templates_only_ =
       (iter != parsed_options.end() && iter->second == "only");
 
+    iter = parsed_options.find("string_view");
+    gen_string_view_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("arena");
+    gen_arena_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("simple_json");
+    gen_simple_json_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("ordered_read");
+    gen_ordered_read_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("method_ids");
+    gen_method_ids_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("unordered");
+    gen_unordered_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("flat");
+    gen_flat_ = (iter != parsed_options.end());
+    if (gen_flat_ && gen_unordered_) {
+      throw "the flat option cannot be used with unordered";
+    }
+    if (gen_flat_ && !gen_cpp11_) {
+      // Under C++03 move emulation boost::container's copy assignment takes
+      // a non-const reference, and so would that of every struct holding one
+      throw "the flat option needs cpp11";
+    }
+
+    iter = parsed_options.find("reuse");
+    gen_reuse_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("compact");
+    gen_compact_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("packed");
+    gen_packed_ = (iter != parsed_options.end());
+    if (gen_packed_ && gen_string_view_) {
+      throw "the packed option cannot be used with string_view";
+    }
+
+    iter = parsed_options.find("frozen");
+    gen_frozen_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("visit");
+    gen_visit_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("delta");
+    gen_delta_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("split");
+    gen_split_ = (iter != parsed_options.end());
+    if (gen_split_ && gen_dense_) {
+      throw "the split option cannot be used with dense";
+    }
+
+    iter = parsed_options.find("no_static_init");
+    gen_no_static_init_ = (iter != parsed_options.end());
+
+    iter = parsed_options.find("instantiate");
+    if (iter != parsed_options.end()) {
+      if (!gen_templates_) {
+        throw "the instantiate option needs templates";
+      }
+      string::size_type pos = 0;
+      while (pos <= iter->second.size()) {
+        string::size_type end = iter->second.find(';', pos);
+        if (end == string::npos) {
+          end = iter->second.size();
+        }
+        if (end > pos) {
+          add_instantiated_protocol(iter->second.substr(pos, end - pos));
+        }
+        pos = end + 1;
+      }
+    }
+
     out_dir_base_ = "gen-cpp";
   }
 
@@ -96,6 +186,9 @@ class t_cpp_generator : public t_oop_generator {
 
   void generate_typedef(t_typedef* ttypedef);
   void generate_enum(t_enum* tenum);
+  void generate_enum_lookup(t_enum* tenum);
+  void generate_enum_name_table(t_enum* tenum, const std::string& suffix,
+                                const std::vector<t_enum_value*>& values);
   void generate_struct(t_struct* tstruct) {
     generate_cpp_struct(tstruct, false);
   }
@@ -103,6 +196,14 @@ class t_cpp_generator : public t_oop_generator {
     generate_cpp_struct(txception, true);
   }
   void generate_cpp_struct(t_struct* tstruct, bool is_exception);
+  void open_split_struct(t_struct* tstruct, std::ofstream& f_header,
+                         std::ofstream& f_impl, std::ofstream& f_tcc);
+  void close_split_struct(t_struct* tstruct, std::ofstream& f_header,
+                          std::ofstream& f_impl, std::ofstream& f_tcc);
+  void split_dependencies(t_type* ttype, std::set<t_struct*>& deps);
+  void add_instantiated_protocol(std::string name);
+  void generate_struct_instantiations(std::ofstream& out, t_struct* tstruct, bool is_extern);
+  void generate_service_instantiations(std::ofstream& out, t_service* tservice, bool is_extern);
 
   void generate_service(t_service* tservice);
 
@@ -114,12 +215,34 @@ class t_cpp_generator : public t_oop_generator {
                                       bool pointers=false,
                                       bool read=true,
                                       bool write=true,
-                                      bool swap=false);
+                                      bool swap=false,
+                                      bool packed=false,
+                                      bool frozen=false,
+                                      bool delta=false);
   void generate_struct_fingerprint   (std::ofstream& out, t_struct* tstruct, bool is_definition);
-  void generate_struct_reader        (std::ofstream& out, t_struct* tstruct, bool pointers=false);
-  void generate_struct_writer        (std::ofstream& out, t_struct* tstruct, bool pointers=false);
+  void generate_struct_reader        (std::ofstream& out, t_struct* tstruct, bool pointers=false,
+                                      bool delta=false);
+  void generate_struct_member_reader (std::ofstream& out, t_field* tfield, bool pointers);
+  void generate_field_header         (std::ofstream& out, t_field* tfield, std::string type_enum);
+  void generate_columnar_writer      (std::ofstream& out, t_field* tfield, std::string name);
+  void generate_columnar_reader      (std::ofstream& out, t_field* tfield, bool pointers);
+  void generate_packed_writer        (std::ofstream& out, t_struct* tstruct);
+  void generate_packed_reader        (std::ofstream& out, t_struct* tstruct);
+  void generate_packed_write_value   (std::ofstream& out, t_type* ttype, std::string name);
+  void generate_packed_read_value    (std::ofstream& out, t_type* ttype, std::string name);
+  void generate_frozen_writer        (std::ofstream& out, t_struct* tstruct);
+  void generate_frozen_view          (std::ofstream& out, t_struct* tstruct);
+  std::string generate_frozen_write_value(std::ofstream& out, t_type* ttype, std::string name);
+  void generate_frozen_put_element   (std::ofstream& out, t_type* ttype, std::string name,
+                                      std::string at);
+  void generate_struct_writer        (std::ofstream& out, t_struct* tstruct, bool pointers=false,
+                                      bool delta=false);
   void generate_struct_result_writer (std::ofstream& out, t_struct* tstruct, bool pointers=false);
   void generate_struct_swap          (std::ofstream& out, t_struct* tstruct);
+  void generate_struct_hash          (std::ofstream& out, t_struct* tstruct);
+  void generate_std_hash             (std::ofstream& out);
+  void generate_struct_clear         (std::ofstream& out, t_struct* tstruct);
+  void generate_field_reset          (std::ofstream& out, t_field* tfield);
 
   /**
    * Service-level generation functions
@@ -131,12 +254,24 @@ class t_cpp_generator : public t_oop_generator {
   void generate_service_multiface (t_service* tservice);
   void generate_service_helpers   (t_service* tservice);
   void generate_service_client    (t_service* tservice, string style);
+  void generate_concurrent_recv_function(std::ofstream& out,
+                                         t_service* tservice,
+                                         t_function* tfunction,
+                                         const string& scope,
+                                         const string& template_header,
+                                         const string& _this);
   void generate_service_processor (t_service* tservice, string style);
   void generate_service_skeleton  (t_service* tservice);
   void generate_process_function  (t_service* tservice, t_function* tfunction,
                                    string style, bool specialized=false);
   void generate_function_helpers  (t_service* tservice, t_function* tfunction);
   void generate_service_async_skeleton (t_service* tservice);
+  void generate_service_coro_adapter (t_service* tservice);
+  void generate_coro_client_functions(std::ofstream& out,
+                                      t_function* tfunction,
+                                      const string& scope,
+                                      const string& template_header,
+                                      const string& _this);
 
   /**
    * Serialization constructs
@@ -155,6 +290,11 @@ class t_cpp_generator : public t_oop_generator {
                                           t_type*     ttype,
                                           std::string prefix="");
 
+  void generate_deserialize_flat_container(std::ofstream& out,
+                                          t_type*     ttype,
+                                          std::string prefix,
+                                          std::string size);
+
   void generate_deserialize_set_element  (std::ofstream& out,
                                           t_set*      tset,
                                           std::string prefix="");
@@ -194,6 +334,39 @@ class t_cpp_generator : public t_oop_generator {
                                           t_list*     tlist,
                                           std::string iter);
 
+  std::string bulk_list_suffix           (t_type*     ttype);
+  std::string frozen_type_name           (t_type*     ttype, bool element);
+  std::string frozen_number_suffix       (t_type*     ttype);
+  int frozen_width                       (t_type*     ttype);
+
+  bool is_string_view                    (t_type*     ttype);
+  bool is_lazy                           (t_field*    tfield);
+  bool is_columnar                       (t_field*    tfield);
+  bool has_columnar_fields               ();
+  bool has_lazy_fields                   ();
+  int storage_alignment                  (t_field*    tfield);
+  bool is_hashable                       (t_type*     ttype);
+  void program_types                     (std::vector<t_type*>& types);
+  bool is_flat                           (t_type*     ttype);
+  bool is_overwritten_by_read            (t_type*     ttype);
+  bool has_flat_containers               ();
+  bool has_flat_containers               (t_type*     ttype);
+  void mark_ordered_containers           ();
+  void mark_ordered_containers           (t_type*     ttype, bool ordered);
+  std::vector<t_field*> storage_order    (t_struct*   tstruct);
+  std::string method_id                  (t_function* tfunction);
+  void check_method_ids                  (t_service*  tservice);
+  bool is_cached                         (t_typedef*  ttypedef);
+  bool has_cached_typedefs               ();
+  bool is_streamed                       (t_type*     ttype);
+  bool has_streamed_typedefs             (bool lists);
+  std::string arena_allocator            (std::string elem_type);
+  std::string template_arg               (const std::string& name);
+  void generate_struct_visit             (std::ofstream& out, t_struct* tstruct);
+  void generate_struct_visit_definitions (std::ofstream& out, t_struct* tstruct);
+  void generate_struct_spec              (std::ofstream& out,
+                                          t_struct*   tstruct);
+
   void generate_function_call            (ostream& out,
                                           t_function* tfunction,
                                           string target,
@@ -211,7 +384,8 @@ class t_cpp_generator : public t_oop_generator {
   std::string declare_field(t_field* tfield, bool init=false, bool pointer=false, bool constant=false, bool reference=false);
   std::string function_signature(t_function* tfunction, std::string style, std::string prefix="", bool name_params=true);
   std::string cob_function_signature(t_function* tfunction, std::string prefix="", bool name_params=true);
-  std::string argument_list(t_struct* tstruct, bool name_params=true, bool start_comma=false);
+  std::string argument_list(t_struct* tstruct, bool name_params=true, bool start_comma=false, bool by_value=false);
+  std::string task_type(t_type* ttype);
   std::string type_to_enum(t_type* ttype);
   std::string local_reflection_name(const char*, t_type* ttype, bool external=false);
 
@@ -225,6 +399,21 @@ class t_cpp_generator : public t_oop_generator {
   void generate_local_reflection(std::ofstream& out, t_type* ttype, bool is_definition);
   void generate_local_reflection_pointer(std::ofstream& out, t_type* ttype);
 
+  /**
+   * Whether a map or set is a hash table, under the unordered option and
+   * not marked cpp.ordered.
+   */
+  bool is_unordered(t_type* ttype) {
+    return gen_unordered_ && ttype->annotations_.count("cpp.ordered") == 0;
+  }
+
+  /**
+   * Where unordered_map and unordered_set come from for the unordered option.
+   */
+  std::string unordered_prefix() {
+    return gen_cpp11_ ? "std::" : "boost::";
+  }
+
   bool is_complex_type(t_type* ttype) {
     ttype = get_true_type(ttype);
 
@@ -278,11 +467,133 @@ class t_cpp_generator : public t_oop_generator {
    */
   bool gen_cob_style_;
 
+  /**
+   * True if the CobClient should get awaitable co_ methods, and handlers a
+   * CoroSvIf of coroutines to implement instead of the CobSvIf.
+   */
+  bool gen_coroutines_;
+
+  /**
+   * True if structs should have move constructors and move assignment, and
+   * rvalue setters for their non-scalar fields.  The output needs C++11.
+   */
+  bool gen_cpp11_;
+
   /**
    * True if we should omit calls to completion__() in CobClient class.
    */
   bool gen_no_client_completion_;
 
+  /**
+   * True if we should generate a ConcurrentClient class as well.
+   */
+  bool gen_concurrent_client_;
+
+  /**
+   * True if string and binary fields should be TStringViews, which can
+   * point into the buffer they were read from, rather than std::strings.
+   */
+  bool gen_string_view_;
+
+  /**
+   * True if containers should allocate through a TArenaAllocator, so a
+   * struct read inside a TArenaScope lives in that arena.
+   */
+  bool gen_arena_;
+
+  /**
+   * True if structs should carry a TStructSpec, so TSimpleJSONProtocol can
+   * look their fields up by name.
+   */
+  bool gen_simple_json_;
+
+  /**
+   * True if struct readers should expect fields in the order they are
+   * written, only switching on the field id when one turns up out of turn.
+   */
+  bool gen_ordered_read_;
+
+  /**
+   * True if structs should have readPacked() and writePacked(), for the
+   * tagless encoding of TPackedEncoding.h.
+   */
+  bool gen_packed_;
+
+  /**
+   * True if structs should have writeFrozen() and a <name>_view class
+   * reading them in place, for the format of TFrozen.h.
+   */
+  bool gen_frozen_;
+
+  /**
+   * True if we should give structs compile-time field descriptors and
+   * visit_fields()
+   */
+  bool gen_visit_;
+
+  /**
+   * True if structs should track which fields changed, in __dirty, and have
+   * writeDelta() and mergeDelta() to send just those.
+   */
+  bool gen_delta_;
+
+  /**
+   * True if struct fields should be stored widest first rather than in
+   * declaration order, and __isset flags as bit-fields, to save padding.
+   */
+  bool gen_compact_;
+
+  /**
+   * True if maps and sets should be hash tables rather than trees, and
+   * structs should have a hash_value() so they can be their keys.
+   */
+  bool gen_unordered_;
+
+  /**
+   * True if maps and sets should be boost::container flat_maps and
+   * flat_sets, sorted vectors, as those annotated cpp.flat are anyway.
+   */
+  bool gen_flat_;
+
+  /**
+   * True if struct readers should reset a struct with __clear(), keeping
+   * the storage of its strings and containers, before reading into it.
+   */
+  bool gen_reuse_;
+
+  /**
+   * The qualified names of the structs given a hash_value(), for the
+   * std::hash specializations at the end of the types header.
+   */
+  std::vector<std::string> hashed_structs_;
+
+  /**
+   * True if each struct should get its own header and implementation, so
+   * changing one only rebuilds the code using it.
+   */
+  bool gen_split_;
+
+  /**
+   * True if nothing generated should be built by a static initializer:
+   * enums skip their _VALUES_TO_NAMES maps, and the constants are built on
+   * first use.
+   */
+  bool gen_no_static_init_;
+
+  /**
+   * The protocols, fully qualified, to instantiate the templated readers,
+   * writers, clients and processors for in the generated .cpp files, and
+   * the headers declaring them.
+   */
+  std::vector<std::string> instantiated_protocols_;
+  std::vector<std::string> instantiated_headers_;
+
+  /**
+   * True if clients should call methods with a cpp.method_id by that id
+   * rather than by name.
+   */
+  bool gen_method_ids_;
+
   /**
    * Strings for namespace, computed once up front then used directly
    */
@@ -324,8 +635,16 @@ void t_cpp_generator::init_generator() {
   // Make output directory
   MKDIR(get_out_dir().c_str());
 
+  if (gen_unordered_) {
+    mark_ordered_containers();
+  }
+
+  // With split, the structs have headers of their own, and this one only
+  // declares them, for <program>_types.h to include along with those
+  string types_header = program_name_ + (gen_split_ ? "_fwd.h" : "_types.h");
+
   // Make output file
-  string f_types_name = get_out_dir()+program_name_+"_types.h";
+  string f_types_name = get_out_dir()+types_header;
   f_types_.open(f_types_name.c_str());
 
   string f_types_impl_name = get_out_dir()+program_name_+"_types.cpp";
@@ -348,8 +667,8 @@ void t_cpp_generator::init_generator() {
 
   // Start ifndef
   f_types_ <<
-    "#ifndef " << program_name_ << "_TYPES_H" << endl <<
-    "#define " << program_name_ << "_TYPES_H" << endl <<
+    "#ifndef " << program_name_ << (gen_split_ ? "_FWD_H" : "_TYPES_H") << endl <<
+    "#define " << program_name_ << (gen_split_ ? "_FWD_H" : "_TYPES_H") << endl <<
     endl;
   f_types_tcc_ <<
     "#ifndef " << program_name_ << "_TYPES_TCC" << endl <<
@@ -361,8 +680,65 @@ void t_cpp_generator::init_generator() {
     "#include <thrift/Thrift.h>" << endl <<
     "#include <thrift/TApplicationException.h>" << endl <<
     "#include <thrift/protocol/TProtocol.h>" << endl <<
+    "#include <thrift/protocol/TSerializedSize.h>" << endl <<
     "#include <thrift/transport/TTransport.h>" << endl <<
     endl;
+  if (gen_simple_json_) {
+    f_types_ << "#include <thrift/protocol/TStructSpec.h>" << endl << endl;
+  }
+  if (gen_packed_) {
+    f_types_ << "#include <thrift/protocol/TPackedEncoding.h>" << endl << endl;
+  }
+  if (gen_frozen_) {
+    f_types_ << "#include <thrift/protocol/TFrozen.h>" << endl << endl;
+  }
+  if (has_columnar_fields()) {
+    f_types_ << "#include <thrift/protocol/TColumnar.h>" << endl << endl;
+  }
+  if (gen_arena_) {
+    f_types_ << "#include <thrift/TArena.h>" << endl << endl;
+  }
+  if (has_lazy_fields()) {
+    f_types_ << "#include <thrift/TLazy.h>" << endl << endl;
+  }
+  if (has_cached_typedefs()) {
+    f_types_ << "#include <thrift/TCached.h>" << endl << endl;
+  }
+  if (has_streamed_typedefs(false)) {
+    f_types_ << "#include <thrift/TStreamedBinary.h>" << endl << endl;
+  }
+  if (has_streamed_typedefs(true)) {
+    f_types_ << "#include <thrift/TStream.h>" << endl << endl;
+  }
+  if (gen_cpp11_) {
+    f_types_ << "#include <utility>" << endl << endl;
+  }
+  if (gen_unordered_) {
+    if (gen_cpp11_) {
+      f_types_ <<
+        "#include <unordered_map>" << endl <<
+        "#include <unordered_set>" << endl;
+    } else {
+      f_types_ <<
+        "#include <boost/unordered_map.hpp>" << endl <<
+        "#include <boost/unordered_set.hpp>" << endl;
+    }
+    f_types_ << "#include <boost/functional/hash.hpp>" << endl << endl;
+  }
+  if (has_flat_containers()) {
+    if (!gen_cpp11_) {
+      throw "cpp.flat maps and sets need the cpp11 option";
+    }
+    f_types_ <<
+      "#include <boost/container/flat_map.hpp>" << endl <<
+      "#include <boost/container/flat_set.hpp>" << endl << endl;
+  }
+  if (!instantiated_headers_.empty()) {
+    for (size_t i = 0; i < instantiated_headers_.size(); ++i) {
+      f_types_ << "#include <" << instantiated_headers_[i] << ">" << endl;
+    }
+    f_types_ << endl;
+  }
   // Include C++xx compatibility header
   f_types_ << "#include <thrift/cxxfunctional.h>" << endl;
 
@@ -397,12 +773,12 @@ void t_cpp_generator::init_generator() {
 
   // Include the types file
   f_types_impl_ <<
-    "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
-    "_types.h\"" << endl <<
+    "#include \"" << get_include_prefix(*get_program()) << types_header <<
+    "\"" << endl <<
     endl;
   f_types_tcc_ <<
-    "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
-    "_types.h\"" << endl <<
+    "#include \"" << get_include_prefix(*get_program()) << types_header <<
+    "\"" << endl <<
     endl;
 
   // If we are generating local reflection metadata, we need to include
@@ -424,6 +800,15 @@ void t_cpp_generator::init_generator() {
     ns_open_ << endl <<
     endl;
 
+  // Declare the structs up front, for the typedefs and each other
+  if (gen_split_) {
+    const vector<t_struct*>& objects = program_->get_objects();
+    for (size_t i = 0; i < objects.size(); ++i) {
+      f_types_ << "class " << objects[i]->get_name() << ";" << endl;
+    }
+    f_types_ << endl;
+  }
+
   f_types_impl_ <<
     ns_open_ << endl <<
     endl;
@@ -441,6 +826,8 @@ void t_cpp_generator::close_generator() {
   f_types_ <<
     ns_close_ << endl <<
     endl;
+
+  generate_std_hash(f_types_);
   f_types_impl_ <<
     ns_close_ << endl;
   f_types_tcc_ <<
@@ -467,6 +854,49 @@ void t_cpp_generator::close_generator() {
   f_types_.close();
   f_types_impl_.close();
   f_types_tcc_.close();
+
+  // Then <program>_types.h is just everything there is
+  if (gen_split_) {
+    string f_all_name = get_out_dir()+program_name_+"_types.h";
+    ofstream f_all(f_all_name.c_str());
+    f_all <<
+      autogen_comment() <<
+      "#ifndef " << program_name_ << "_TYPES_H" << endl <<
+      "#define " << program_name_ << "_TYPES_H" << endl <<
+      endl <<
+      "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
+      "_fwd.h\"" << endl;
+    const vector<t_struct*>& objects = program_->get_objects();
+    for (size_t i = 0; i < objects.size(); ++i) {
+      f_all <<
+        "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
+        "_types_" << objects[i]->get_name() << ".h\"" << endl;
+    }
+    f_all <<
+      endl <<
+      "#endif" << endl;
+  }
+}
+
+/**
+ * Lets the std containers find the hash_value() of the structs hashed since
+ * the last call too, when generating for C++11.
+ */
+void t_cpp_generator::generate_std_hash(ofstream& out) {
+  if (gen_cpp11_ && !hashed_structs_.empty()) {
+    out << "namespace std {" << endl << endl;
+    vector<string>::const_iterator h_iter;
+    for (h_iter = hashed_structs_.begin(); h_iter != hashed_structs_.end(); ++h_iter) {
+      out <<
+        "template <> struct hash<" << *h_iter << "> {" << endl <<
+        "  size_t operator()(const " << *h_iter << "& v) const {" << endl <<
+        "    return hash_value(v);" << endl <<
+        "  }" << endl <<
+        "};" << endl << endl;
+    }
+    out << "} // namespace std" << endl << endl;
+  }
+  hashed_structs_.clear();
 }
 
 /**
@@ -475,6 +905,32 @@ void t_cpp_generator::close_generator() {
  * @param ttypedef The type definition
  */
 void t_cpp_generator::generate_typedef(t_typedef* ttypedef) {
+  if (ttypedef->annotations_.count("cpp.streamed") != 0) {
+    if (!is_streamed(ttypedef)) {
+      throw "cpp.streamed on " + ttypedef->get_symbolic() +
+        ", which is neither binary nor a list of structs";
+    }
+    t_type* type = get_true_type(ttypedef);
+    if (type->is_list()) {
+      f_types_ <<
+        indent() << "typedef ::apache::thrift::TStream<" <<
+        template_arg(type_name(((t_list*)type)->get_elem_type(), true)) << " > " << ttypedef->get_symbolic() << ";" << endl <<
+        endl;
+    } else {
+      f_types_ <<
+        indent() << "typedef ::apache::thrift::TStreamedBinary " << ttypedef->get_symbolic() << ";" << endl <<
+        endl;
+    }
+    return;
+  }
+  if (is_cached(ttypedef)) {
+    f_types_ <<
+      indent() << "typedef ::apache::thrift::TCached<" <<
+      template_arg(type_name(ttypedef->get_type(), true)) <<
+      " > " << ttypedef->get_symbolic() << ";" << endl <<
+      endl;
+    return;
+  }
   f_types_ <<
     indent() << "typedef " << type_name(ttypedef->get_type(), true) << " " << ttypedef->get_symbolic() << ";" << endl <<
     endl;
@@ -553,21 +1009,95 @@ void t_cpp_generator::generate_enum(t_enum* tenum) {
     indent() << "const char* _k" << tenum->get_name() << "Names[] =";
   generate_enum_constant_list(f_types_impl_, constants, "\"", "\"", false);
 
-  f_types_ <<
-    indent() << "extern const std::map<int, const char*> _" <<
-    tenum->get_name() << "_VALUES_TO_NAMES;" << endl << endl;
+  if (!gen_no_static_init_) {
+    f_types_ <<
+      indent() << "extern const std::map<int, const char*> _" <<
+      tenum->get_name() << "_VALUES_TO_NAMES;" << endl << endl;
 
-  f_types_impl_ <<
-    indent() << "const std::map<int, const char*> _" << tenum->get_name() <<
-    "_VALUES_TO_NAMES(::apache::thrift::TEnumIterator(" << constants.size() <<
-    ", _k" << tenum->get_name() << "Values" <<
-    ", _k" << tenum->get_name() << "Names), " <<
-    "::apache::thrift::TEnumIterator(-1, NULL, NULL));" << endl << endl;
+    f_types_impl_ <<
+      indent() << "const std::map<int, const char*> _" << tenum->get_name() <<
+      "_VALUES_TO_NAMES(::apache::thrift::TEnumIterator(" << constants.size() <<
+      ", _k" << tenum->get_name() << "Values" <<
+      ", _k" << tenum->get_name() << "Names), " <<
+      "::apache::thrift::TEnumIterator(-1, NULL, NULL));" << endl << endl;
+  }
+
+  generate_enum_lookup(tenum);
 
   generate_local_reflection(f_types_, tenum, false);
   generate_local_reflection(f_types_impl_, tenum, true);
 }
 
+static bool enum_value_less(t_enum_value* a, t_enum_value* b) {
+  return a->get_value() < b->get_value();
+}
+
+static bool enum_name_less(t_enum_value* a, t_enum_value* b) {
+  return a->get_name() < b->get_name();
+}
+
+/**
+ * Generates name lookups for an enum that search tables sorted by value and
+ * by name.  The tables are aggregates, so unlike _VALUES_TO_NAMES they need
+ * no static initializer.
+ */
+void t_cpp_generator::generate_enum_lookup(t_enum* tenum) {
+  string name = tenum->get_name();
+  vector<t_enum_value*> by_value = tenum->get_constants();
+  std::stable_sort(by_value.begin(), by_value.end(), enum_value_less);
+  vector<t_enum_value*> by_name = tenum->get_constants();
+  std::sort(by_name.begin(), by_name.end(), enum_name_less);
+
+  f_types_ <<
+    indent() << "// The name of a value of " << name << ", or NULL if it has none" << endl <<
+    indent() << "const char* _" << name << "_VALUE_TO_NAME(int value);" << endl <<
+    indent() << "// Looks up a value of " << name << " by its name" << endl <<
+    indent() << "bool _" << name << "_NAME_TO_VALUE(const char* name, int* value);" <<
+    endl << endl;
+
+  if (by_value.empty()) {
+    f_types_impl_ <<
+      indent() << "const char* _" << name << "_VALUE_TO_NAME(int /* value */) {" << endl <<
+      indent() << "  return NULL;" << endl <<
+      indent() << "}" << endl << endl <<
+      indent() << "bool _" << name << "_NAME_TO_VALUE(const char* /* name */, " <<
+      "int* /* value */) {" << endl <<
+      indent() << "  return false;" << endl <<
+      indent() << "}" << endl << endl;
+    return;
+  }
+
+  generate_enum_name_table(tenum, "ByValue", by_value);
+  generate_enum_name_table(tenum, "ByName", by_name);
+
+  f_types_impl_ <<
+    indent() << "const char* _" << name << "_VALUE_TO_NAME(int value) {" << endl <<
+    indent() << "  return ::apache::thrift::TEnumNameOf(_k" << name << "ByValue, " <<
+    by_value.size() << ", value);" << endl <<
+    indent() << "}" << endl << endl <<
+    indent() << "bool _" << name << "_NAME_TO_VALUE(const char* name, int* value) {" << endl <<
+    indent() << "  return ::apache::thrift::TEnumValueOf(_k" << name << "ByName, " <<
+    by_name.size() << ", name, value);" << endl <<
+    indent() << "}" << endl << endl;
+}
+
+void t_cpp_generator::generate_enum_name_table(t_enum* tenum,
+                                               const string& suffix,
+                                               const vector<t_enum_value*>& values) {
+  f_types_impl_ <<
+    indent() << "static const ::apache::thrift::TEnumName _k" << tenum->get_name() <<
+    suffix << "[] = {" << endl;
+  indent_up();
+  vector<t_enum_value*>::const_iterator v_iter;
+  for (v_iter = values.begin(); v_iter != values.end(); ++v_iter) {
+    indent(f_types_impl_) << "{ " << (*v_iter)->get_value() << ", \"" <<
+      (*v_iter)->get_name() << "\" }," << endl;
+  }
+  indent_down();
+  f_types_impl_ <<
+    indent() << "};" << endl << endl;
+}
+
 /**
  * Generates a class that holds all the constants.
  */
@@ -621,8 +1151,17 @@ void t_cpp_generator::generate_consts(std::vector<t_const*> consts) {
   f_consts <<
     "};" << endl;
 
+  if (gen_no_static_init_) {
+    f_consts_impl <<
+      "const " << program_name_ << "Constants& g_" << program_name_ << "_constants() {" << endl <<
+      "  static const " << program_name_ << "Constants constants;" << endl <<
+      "  return constants;" << endl <<
+      "}" << endl;
+  } else {
+    f_consts_impl <<
+      "const " << program_name_ << "Constants g_" << program_name_ << "_constants;" << endl;
+  }
   f_consts_impl <<
-    "const " << program_name_ << "Constants g_" << program_name_ << "_constants;" << endl <<
     endl <<
     program_name_ << "Constants::" << program_name_ << "Constants() {" << endl;
   indent_up();
@@ -636,9 +1175,16 @@ void t_cpp_generator::generate_consts(std::vector<t_const*> consts) {
   indent(f_consts_impl) <<
     "}" << endl;
 
+  f_consts << endl;
+  if (gen_no_static_init_) {
+    f_consts <<
+      "// Built on first use" << endl <<
+      "const " << program_name_ << "Constants& g_" << program_name_ << "_constants();" << endl;
+  } else {
+    f_consts <<
+      "extern const " << program_name_ << "Constants g_" << program_name_ << "_constants;" << endl;
+  }
   f_consts <<
-    endl <<
-    "extern const " << program_name_ << "Constants g_" << program_name_ << "_constants;" << endl <<
     endl <<
     ns_close_ << endl <<
     endl <<
@@ -698,7 +1244,14 @@ void t_cpp_generator::print_const_value(ofstream& out, string name, t_type* type
     for (v_iter = val.begin(); v_iter != val.end(); ++v_iter) {
       string key = render_const_value(out, name, ktype, v_iter->first);
       string val = render_const_value(out, name, vtype, v_iter->second);
-      indent(out) << name << ".insert(std::make_pair(" << key << ", " << val << "));" << endl;
+      if (is_flat(type)) {
+        // A make_pair() of literals is a pair<int, int>, which matches more
+        // than one of flat_map's insert()s
+        indent(out) << name << ".insert(std::pair<" << type_name(ktype) << ", "
+                    << type_name(vtype) << " >(" << key << ", " << val << "));" << endl;
+      } else {
+        indent(out) << name << ".insert(std::make_pair(" << key << ", " << val << "));" << endl;
+      }
     }
     out << endl;
   } else if (type->is_list()) {
@@ -778,60 +1331,344 @@ string t_cpp_generator::render_const_value(ofstream& out, string name, t_type* t
  * @param tstruct The struct definition
  */
 void t_cpp_generator::generate_cpp_struct(t_struct* tstruct, bool is_exception) {
-  generate_struct_definition(f_types_, tstruct, is_exception,
-                             false, true, true, true);
-  generate_struct_fingerprint(f_types_impl_, tstruct, true);
-  generate_local_reflection(f_types_, tstruct, false);
-  generate_local_reflection(f_types_impl_, tstruct, true);
-  generate_local_reflection_pointer(f_types_impl_, tstruct);
-
-  std::ofstream& out = (gen_templates_ ? f_types_tcc_ : f_types_impl_);
+  // With split, the struct goes in files of its own
+  std::ofstream f_header;
+  std::ofstream f_impl;
+  std::ofstream f_tcc;
+  if (gen_split_) {
+    open_split_struct(tstruct, f_header, f_impl, f_tcc);
+  }
+  std::ofstream& types = (gen_split_ ? f_header : f_types_);
+  std::ofstream& impl = (gen_split_ ? f_impl : f_types_impl_);
+  std::ofstream& tcc = (gen_split_ ? f_tcc : f_types_tcc_);
+
+  generate_struct_definition(types, tstruct, is_exception,
+                             false, true, true, true, gen_packed_, gen_frozen_, gen_delta_);
+  if (gen_frozen_) {
+    generate_frozen_view(types, tstruct);
+  }
+  generate_struct_fingerprint(impl, tstruct, true);
+  generate_local_reflection(types, tstruct, false);
+  generate_local_reflection(impl, tstruct, true);
+  generate_local_reflection_pointer(impl, tstruct);
+
+  std::ofstream& out = (gen_templates_ ? tcc : impl);
   generate_struct_reader(out, tstruct);
   generate_struct_writer(out, tstruct);
-  generate_struct_swap(f_types_impl_, tstruct);
+  if (gen_delta_) {
+    generate_struct_reader(out, tstruct, false, true);
+    generate_struct_writer(out, tstruct, false, true);
+  }
+  if (gen_cpp11_) {
+    generate_struct_instantiations(types, tstruct, true);
+  }
+  generate_struct_instantiations(impl, tstruct, false);
+  if (gen_packed_) {
+    generate_packed_reader(impl, tstruct);
+    generate_packed_writer(impl, tstruct);
+  }
+  if (gen_frozen_) {
+    generate_frozen_writer(impl, tstruct);
+  }
+  generate_struct_swap(impl, tstruct);
+  if (gen_visit_) {
+    generate_struct_visit_definitions(impl, tstruct);
+  }
+  if (gen_unordered_) {
+    generate_struct_hash(impl, tstruct);
+  }
+
+  if (gen_split_) {
+    close_split_struct(tstruct, f_header, f_impl, f_tcc);
+  }
 }
 
 /**
- * Writes the struct definition into the header file
- *
- * @param out Output stream
- * @param tstruct The struct
+ * Opens the header, implementation and, with templates, .tcc file of a
+ * struct of its own, <program>_types_<struct>. The header includes those of
+ * the structs in this program it holds, and the declarations of the rest.
  */
-void t_cpp_generator::generate_struct_definition(ofstream& out,
-                                                 t_struct* tstruct,
-                                                 bool is_exception,
-                                                 bool pointers,
-                                                 bool read,
-                                                 bool write,
-                                                 bool swap) {
-  string extends = "";
-  if (is_exception) {
-    extends = " : public ::apache::thrift::TException";
-  }
-
-  // Get members
-  vector<t_field*>::const_iterator m_iter;
+void t_cpp_generator::open_split_struct(t_struct* tstruct,
+                                        ofstream& f_header,
+                                        ofstream& f_impl,
+                                        ofstream& f_tcc) {
+  string name = program_name_ + "_types_" + tstruct->get_name();
+  string prefix = get_include_prefix(*get_program());
+
+  f_header.open((get_out_dir() + name + ".h").c_str());
+  f_header <<
+    autogen_comment() <<
+    "#ifndef " << name << "_H" << endl <<
+    "#define " << name << "_H" << endl <<
+    endl <<
+    "#include \"" << prefix << program_name_ << "_fwd.h\"" << endl;
+  std::set<t_struct*> deps;
   const vector<t_field*>& members = tstruct->get_members();
+  for (size_t i = 0; i < members.size(); ++i) {
+    split_dependencies(members[i]->get_type(), deps);
+  }
+  deps.erase(tstruct);
+  // In declared order, which is the order they can be defined in
+  const vector<t_struct*>& objects = program_->get_objects();
+  for (size_t i = 0; i < objects.size(); ++i) {
+    if (deps.count(objects[i]) != 0) {
+      f_header <<
+        "#include \"" << prefix << program_name_ << "_types_" <<
+        objects[i]->get_name() << ".h\"" << endl;
+    }
+  }
+  f_header <<
+    endl <<
+    ns_open_ << endl <<
+    endl;
 
-  // Write the isset structure declaration outside the class. This makes
-  // the generated code amenable to processing by SWIG.
-  // We only declare the struct if it gets used in the class.
+  f_impl.open((get_out_dir() + name + ".cpp").c_str());
+  f_impl <<
+    autogen_comment() <<
+    "#include \"" << prefix << name << ".h\"" << endl <<
+    endl <<
+    "#include <algorithm>" << endl <<
+    endl <<
+    ns_open_ << endl <<
+    endl;
 
-  // Isset struct has boolean fields, but only for non-required fields.
-  bool has_nonrequired_fields = false;
-  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
-    if ((*m_iter)->get_req() != t_field::T_REQUIRED)
-      has_nonrequired_fields = true;
+  if (gen_templates_) {
+    f_tcc.open((get_out_dir() + name + ".tcc").c_str());
+    f_tcc <<
+      autogen_comment() <<
+      "#ifndef " << name << "_TCC" << endl <<
+      "#define " << name << "_TCC" << endl <<
+      endl <<
+      "#include \"" << prefix << name << ".h\"" << endl <<
+      endl <<
+      ns_open_ << endl <<
+      endl;
   }
+}
 
-  if (has_nonrequired_fields && (!pointers || read)) {
-
-    out <<
-      indent() << "typedef struct _" << tstruct->get_name() << "__isset {" << endl;
-    indent_up();
+/**
+ * Finishes the files open_split_struct() opened.
+ */
+void t_cpp_generator::close_split_struct(t_struct* tstruct,
+                                         ofstream& f_header,
+                                         ofstream& f_impl,
+                                         ofstream& f_tcc) {
+  string name = program_name_ + "_types_" + tstruct->get_name();
 
-    indent(out) <<
-      "_" << tstruct->get_name() << "__isset() ";
+  f_header <<
+    ns_close_ << endl <<
+    endl;
+  generate_std_hash(f_header);
+  if (gen_templates_) {
+    f_header <<
+      "#include \"" << get_include_prefix(*get_program()) << name << ".tcc\"" << endl <<
+      endl;
+  }
+  f_header <<
+    "#endif" << endl;
+
+  f_impl <<
+    ns_close_ << endl;
+
+  f_tcc <<
+    ns_close_ << endl <<
+    endl <<
+    "#endif" << endl;
+}
+
+/**
+ * Adds a protocol to instantiate the templates for. Names without a
+ * namespace are taken to be Thrift's own, in ::apache::thrift::protocol if
+ * they end in Protocol or ProtocolT and ::apache::thrift::transport if not,
+ * and their headers are included.
+ */
+void t_cpp_generator::add_instantiated_protocol(string name) {
+  string qualified;
+  string::size_type pos = 0;
+  while (pos < name.size()) {
+    char c = name[pos];
+    if (!isalpha(c) && c != '_') {
+      if (c != ' ' || (qualified.size() > 0 && qualified[qualified.size() - 1] != '<')) {
+        qualified += c;
+      }
+      ++pos;
+      continue;
+    }
+    string::size_type end = pos;
+    while (end < name.size() && (isalnum(name[end]) || name[end] == '_')) {
+      ++end;
+    }
+    string id = name.substr(pos, end - pos);
+    bool scoped =
+      (pos >= 2 && name.compare(pos - 2, 2, "::") == 0) ||
+      name.compare(end, 2, "::") == 0;
+    if (!scoped && id.size() > 1 && id[0] == 'T' && isupper(id[1])) {
+      string base = id;
+      if (base.size() > 9 && base.compare(base.size() - 9, 9, "ProtocolT") == 0) {
+        base.erase(base.size() - 1);
+      }
+      string header;
+      if (base.size() > 8 && base.compare(base.size() - 8, 8, "Protocol") == 0) {
+        id = "::apache::thrift::protocol::" + id;
+        header = "thrift/protocol/" + base + ".h";
+      } else {
+        if (base == "TBufferBase" || base == "TBufferedTransport" ||
+            base == "TFramedTransport" || base == "TMemoryBuffer") {
+          base = "TBufferTransports";
+        }
+        id = "::apache::thrift::transport::" + id;
+        header = "thrift/transport/" + base + ".h";
+      }
+      if (std::find(instantiated_headers_.begin(), instantiated_headers_.end(), header) ==
+          instantiated_headers_.end()) {
+        instantiated_headers_.push_back(header);
+      }
+    }
+    // No <: digraph
+    if (qualified.size() > 0 && qualified[qualified.size() - 1] == '<' && id[0] == ':') {
+      qualified += ' ';
+    }
+    qualified += id;
+    pos = end;
+  }
+  instantiated_protocols_.push_back(qualified);
+}
+
+/**
+ * Instantiates a struct's templated reader and writer for each protocol
+ * given to instantiate, or with is_extern, declares that they are, so the
+ * code including the header does not instantiate them again. With split,
+ * they are instantiated for a plain TProtocol too.
+ */
+void t_cpp_generator::generate_struct_instantiations(ofstream& out,
+                                                     t_struct* tstruct,
+                                                     bool is_extern) {
+  if (!gen_templates_) {
+    return;
+  }
+  vector<string> protocols = instantiated_protocols_;
+  string tprotocol = "::apache::thrift::protocol::TProtocol";
+  if (gen_split_ && std::find(protocols.begin(), protocols.end(), tprotocol) == protocols.end()) {
+    protocols.insert(protocols.begin(), tprotocol);
+  }
+  if (protocols.empty()) {
+    return;
+  }
+
+  string prefix = is_extern ? "extern template " : "template ";
+  for (size_t i = 0; i < protocols.size(); ++i) {
+    out <<
+      indent() << prefix << "uint32_t " << tstruct->get_name() << "::read< " <<
+        protocols[i] << " >(" << protocols[i] << "*);" << endl <<
+      indent() << prefix << "uint32_t " << tstruct->get_name() << "::write< " <<
+        protocols[i] << " >(" << protocols[i] << "*) const;" << endl;
+    if (gen_delta_) {
+      out <<
+        indent() << prefix << "uint32_t " << tstruct->get_name() << "::mergeDelta< " <<
+          protocols[i] << " >(" << protocols[i] << "*);" << endl <<
+        indent() << prefix << "uint32_t " << tstruct->get_name() << "::writeDelta< " <<
+          protocols[i] << " >(" << protocols[i] << "*) const;" << endl;
+    }
+  }
+  out << endl;
+}
+
+/**
+ * Instantiates, or with is_extern declares the instantiations of, a
+ * service's client and processor templates for each protocol given to
+ * instantiate. A processor for a plain TProtocol cannot be instantiated.
+ */
+void t_cpp_generator::generate_service_instantiations(ofstream& out,
+                                                      t_service* tservice,
+                                                      bool is_extern) {
+  if (instantiated_protocols_.empty()) {
+    return;
+  }
+
+  string prefix = is_extern ? "extern template class " : "template class ";
+  string svcname = tservice->get_name();
+  for (size_t i = 0; i < instantiated_protocols_.size(); ++i) {
+    const string& protocol = instantiated_protocols_[i];
+    out <<
+      indent() << prefix << svcname << "ClientT< " << protocol << " >;" << endl;
+    if (gen_concurrent_client_) {
+      out <<
+        indent() << prefix << svcname << "ConcurrentClientT< " << protocol << " >;" << endl;
+    }
+    if (protocol != "::apache::thrift::protocol::TProtocol") {
+      out <<
+        indent() << prefix << svcname << "ProcessorT< " << protocol << " >;" << endl;
+    }
+  }
+  out << endl;
+}
+
+/**
+ * Adds the structs of this program a field of the given type holds, so
+ * must be defined before it, looking through typedefs and containers.
+ */
+void t_cpp_generator::split_dependencies(t_type* ttype, std::set<t_struct*>& deps) {
+  ttype = get_true_type(ttype);
+  if (ttype->is_struct() || ttype->is_xception()) {
+    if (ttype->get_program() == program_) {
+      deps.insert((t_struct*)ttype);
+    }
+  } else if (ttype->is_map()) {
+    split_dependencies(((t_map*)ttype)->get_key_type(), deps);
+    split_dependencies(((t_map*)ttype)->get_val_type(), deps);
+  } else if (ttype->is_list()) {
+    split_dependencies(((t_list*)ttype)->get_elem_type(), deps);
+  } else if (ttype->is_set()) {
+    split_dependencies(((t_set*)ttype)->get_elem_type(), deps);
+  }
+}
+
+/**
+ * Writes the struct definition into the header file
+ *
+ * @param out Output stream
+ * @param tstruct The struct
+ */
+void t_cpp_generator::generate_struct_definition(ofstream& out,
+                                                 t_struct* tstruct,
+                                                 bool is_exception,
+                                                 bool pointers,
+                                                 bool read,
+                                                 bool write,
+                                                 bool swap,
+                                                 bool packed,
+                                                 bool frozen,
+                                                 bool delta) {
+  string extends = "";
+  if (is_exception) {
+    extends = " : public ::apache::thrift::TException";
+  }
+
+  // Get members
+  vector<t_field*>::const_iterator m_iter;
+  const vector<t_field*>& members = tstruct->get_members();
+  // Fields are declared, and so initialized, in this order
+  const vector<t_field*> stored = pointers ? members : storage_order(tstruct);
+
+  // Write the isset structure declaration outside the class. This makes
+  // the generated code amenable to processing by SWIG.
+  // We only declare the struct if it gets used in the class.
+
+  // Isset struct has boolean fields, but only for non-required fields.
+  bool has_nonrequired_fields = false;
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    if ((*m_iter)->get_req() != t_field::T_REQUIRED)
+      has_nonrequired_fields = true;
+  }
+
+  if (has_nonrequired_fields && (!pointers || read)) {
+
+    out <<
+      indent() << "typedef struct _" << tstruct->get_name() << "__isset {" << endl;
+    indent_up();
+
+    indent(out) <<
+      "_" << tstruct->get_name() << "__isset() ";
     bool first = true;
     for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
       if ((*m_iter)->get_req() == t_field::T_REQUIRED) {
@@ -852,7 +1689,7 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
     for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
       if ((*m_iter)->get_req() != t_field::T_REQUIRED) {
         indent(out) <<
-          "bool " << (*m_iter)->get_name() << ";" << endl;
+          "bool " << (*m_iter)->get_name() << (gen_compact_ ? " : 1;" : ";") << endl;
         }
       }
 
@@ -861,6 +1698,27 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
         "} _" << tstruct->get_name() << "__isset;" << endl;
     }
 
+  // With delta, a flag per field, set by __set_<field>(), for the fields
+  // changed since clearDirty()
+  if (delta) {
+    out <<
+      endl <<
+      indent() << "typedef struct _" << tstruct->get_name() << "__dirty {" << endl;
+    indent_up();
+    indent(out) << "_" << tstruct->get_name() << "__dirty()";
+    for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+      out << (m_iter == members.begin() ? " : " : ", ") << (*m_iter)->get_name() << "(false)";
+    }
+    out << " {}" << endl;
+    for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+      indent(out) <<
+        "bool " << (*m_iter)->get_name() << (gen_compact_ ? " : 1;" : ";") << endl;
+    }
+    indent_down();
+    indent(out) <<
+      "} _" << tstruct->get_name() << "__dirty;" << endl;
+  }
+
   out << endl;
 
   // Open struct def
@@ -880,7 +1738,7 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
 
     bool init_ctor = false;
 
-    for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    for (m_iter = stored.begin(); m_iter != stored.end(); ++m_iter) {
       t_type* t = get_true_type((*m_iter)->get_type());
       if (t->is_base_type() || t->is_enum()) {
         string dval;
@@ -924,6 +1782,16 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
       indent() << "virtual ~" << tstruct->get_name() << "() throw() {}" << endl << endl;
   }
 
+  if (!pointers && gen_cpp11_) {
+    // The destructor above keeps the compiler from adding the moves itself
+    const string& name = tstruct->get_name();
+    out <<
+      indent() << name << "(const " << name << "&) = default;" << endl <<
+      indent() << name << "(" << name << "&&) = default;" << endl <<
+      indent() << name << "& operator=(const " << name << "&) = default;" << endl <<
+      indent() << name << "& operator=(" << name << "&&) = default;" << endl << endl;
+  }
+
   // Pointer to this structure's reflection local typespec.
   if (gen_dense_) {
     indent(out) <<
@@ -932,7 +1800,18 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
   }
 
   // Declare all fields
-  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+  for (m_iter = stored.begin(); m_iter != stored.end(); ++m_iter) {
+    if (!pointers && is_lazy(*m_iter)) {
+      indent(out) <<
+        "::apache::thrift::TLazy<" << template_arg(type_name((*m_iter)->get_type())) << " > " <<
+        (*m_iter)->get_name() << ";" << endl;
+      continue;
+    }
+    if (!pointers &&
+        (*m_iter)->annotations_.find("cpp.lazy") != (*m_iter)->annotations_.end()) {
+      pwarning(1, "cpp.lazy only applies to struct fields, not %s.%s\n",
+               tstruct->get_name().c_str(), (*m_iter)->get_name().c_str());
+    }
     indent(out) <<
       declare_field(*m_iter, false, pointers && !(*m_iter)->get_type()->is_xception(), !read) << endl;
   }
@@ -943,6 +1822,11 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
       endl <<
       indent() << "_" << tstruct->get_name() << "__isset __isset;" << endl;
   }
+  if (delta) {
+    out <<
+      endl <<
+      indent() << "_" << tstruct->get_name() << "__dirty __dirty;" << endl;
+  }
 
   // Create a setter function for each field
   for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
@@ -964,11 +1848,40 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
         indent() <<
         indent() << "__isset." << (*m_iter)->get_name() << " = true;" << endl;
     }
+    if (delta) {
+      out <<
+        indent() <<
+        indent() << "__dirty." << (*m_iter)->get_name() << " = true;" << endl;
+    }
     out <<
       indent()<< "}" << endl;
+
+    if (gen_cpp11_ && is_complex_type((*m_iter)->get_type())) {
+      out <<
+        endl <<
+        indent() << "void __set_" << (*m_iter)->get_name() <<
+          "(" << type_name((*m_iter)->get_type()) << "&& val) {" << endl <<
+        indent() << indent() << (*m_iter)->get_name() << " = std::move(val);" << endl;
+      if (is_optional) {
+        out <<
+          indent() <<
+          indent() << "__isset." << (*m_iter)->get_name() << " = true;" << endl;
+      }
+      if (delta) {
+        out <<
+          indent() <<
+          indent() << "__dirty." << (*m_iter)->get_name() << " = true;" << endl;
+      }
+      out <<
+        indent()<< "}" << endl;
+    }
   }
   out << endl;
 
+  if (!pointers && read && gen_reuse_) {
+    generate_struct_clear(out, tstruct);
+  }
+
   if (!pointers) {
     // Generate an equality testing operator.  Make it inline since the compiler
     // will do a better job than we would when deciding whether to inline it.
@@ -1020,6 +1933,10 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
         indent() << "uint32_t read(" <<
         "::apache::thrift::protocol::TProtocol* iprot);" << endl;
     }
+    if (gen_simple_json_) {
+      out << endl;
+      generate_struct_spec(out, tstruct);
+    }
   }
   if (write) {
     if (gen_templates_) {
@@ -1031,6 +1948,50 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
         indent() << "uint32_t write(" <<
         "::apache::thrift::protocol::TProtocol* oprot) const;" << endl;
     }
+    if (!pointers) {
+      // The encoded size, found by writing to a counting transport
+      out <<
+        endl <<
+        indent() << "template <template <class> class Protocol_>" << endl <<
+        indent() << "uint32_t serializedSize() const {" << endl <<
+        indent() << "  return ::apache::thrift::protocol::serializedSize<Protocol_>(*this);" << endl <<
+        indent() << "}" << endl;
+    }
+  }
+  if (packed) {
+    out <<
+      endl <<
+      indent() << "uint32_t readPacked(::apache::thrift::protocol::TPackedReader& reader);" << endl <<
+      indent() << "uint32_t writePacked(::apache::thrift::protocol::TPackedWriter& writer) const;" << endl;
+  }
+  if (frozen) {
+    out <<
+      endl <<
+      indent() << "uint32_t writeFrozen(::apache::thrift::protocol::TFrozenWriter& writer) const;" << endl;
+  }
+  if (delta) {
+    // mergeDelta() reads the fields writeDelta() wrote over this struct's,
+    // leaving the others and __dirty as they are
+    out << endl;
+    if (gen_templates_) {
+      out <<
+        indent() << "template <class Protocol_>" << endl <<
+        indent() << "uint32_t mergeDelta(Protocol_* iprot);" << endl <<
+        indent() << "template <class Protocol_>" << endl <<
+        indent() << "uint32_t writeDelta(Protocol_* oprot) const;" << endl;
+    } else {
+      out <<
+        indent() << "uint32_t mergeDelta(::apache::thrift::protocol::TProtocol* iprot);" << endl <<
+        indent() << "uint32_t writeDelta(::apache::thrift::protocol::TProtocol* oprot) const;" << endl;
+    }
+    out <<
+      indent() << "void clearDirty() {" << endl <<
+      indent() << "  __dirty = _" << tstruct->get_name() << "__dirty();" << endl <<
+      indent() << "}" << endl;
+  }
+  if (!pointers && gen_visit_) {
+    out << endl;
+    generate_struct_visit(out, tstruct);
   }
   out << endl;
 
@@ -1046,6 +2007,12 @@ void t_cpp_generator::generate_struct_definition(ofstream& out,
       tstruct->get_name() << " &b);" << endl <<
       endl;
   }
+
+  if (swap && gen_unordered_) {
+    out <<
+      indent() << "std::size_t hash_value(const " << tstruct->get_name() << "& v);" << endl <<
+      endl;
+  }
 }
 
 /**
@@ -1224,16 +2191,19 @@ void t_cpp_generator::generate_local_reflection_pointer(std::ofstream& out,
  */
 void t_cpp_generator::generate_struct_reader(ofstream& out,
                                              t_struct* tstruct,
-                                             bool pointers) {
+                                             bool pointers,
+                                             bool delta) {
+  // mergeDelta() is read() without the checks a whole struct needs
+  string fn = delta ? "mergeDelta" : "read";
   if (gen_templates_) {
     out <<
       indent() << "template <class Protocol_>" << endl <<
       indent() << "uint32_t " << tstruct->get_name() <<
-      "::read(Protocol_* iprot) {" << endl;
+      "::" << fn << "(Protocol_* iprot) {" << endl;
   } else {
     indent(out) <<
       "uint32_t " << tstruct->get_name() <<
-      "::read(::apache::thrift::protocol::TProtocol* iprot) {" << endl;
+      "::" << fn << "(::apache::thrift::protocol::TProtocol* iprot) {" << endl;
   }
   indent_up();
 
@@ -1248,11 +2218,21 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
     indent() << "::apache::thrift::protocol::TType ftype;" << endl <<
     indent() << "int16_t fid;" << endl <<
     endl <<
-    indent() << "xfer += iprot->readStructBegin(fname);" << endl <<
+    indent() << (gen_simple_json_ ? "xfer += iprot->readStructBeginSpec(fname, structSpec());"
+                                  : "xfer += iprot->readStructBegin(fname);") << endl <<
     endl <<
     indent() << "using ::apache::thrift::protocol::TProtocolException;" << endl <<
     endl;
 
+  // With reuse, fields the input leaves out are reset after the loop,
+  // those it has read over what is there
+  bool reuse = !pointers && gen_reuse_ && !delta;
+  for (f_iter = fields.begin(); f_iter != fields.end() && reuse; ++f_iter) {
+    if ((*f_iter)->get_req() != t_field::T_REQUIRED) {
+      indent(out) << "this->__isset." << (*f_iter)->get_name() << " = false;" << endl;
+    }
+  }
+
   // Required variables aren't in __isset, so we need tmp vars to check them.
   for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
     if ((*f_iter)->get_req() == t_field::T_REQUIRED)
@@ -1261,20 +2241,50 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
   out << endl;
 
 
+  // With ordered_read, fields are first taken in the order they are
+  // written, each header checked against the one expected next; whatever
+  // is left after the first surprise goes through the switch below.
+  bool ordered = gen_ordered_read_ && !fields.empty();
+  if (ordered) {
+    indent(out) <<
+      "xfer += iprot->readFieldBegin(fname, ftype, fid);" << endl;
+    const vector<t_field*>& sorted_fields = tstruct->get_sorted_members();
+    for (f_iter = sorted_fields.begin(); f_iter != sorted_fields.end(); ++f_iter) {
+      bool columnar = is_columnar(*f_iter);
+      indent(out) <<
+        "if (fid == " << (*f_iter)->get_key() << " && ftype == " <<
+        (columnar ? "::apache::thrift::protocol::T_STRING" : type_to_enum((*f_iter)->get_type())) <<
+        ") {" << endl;
+      indent_up();
+      if (columnar) {
+        generate_columnar_reader(out, *f_iter, pointers);
+      } else {
+        generate_struct_member_reader(out, *f_iter, pointers);
+      }
+      out <<
+        indent() << "xfer += iprot->readFieldEnd();" << endl <<
+        indent() << "xfer += iprot->readFieldBegin(fname, ftype, fid);" << endl;
+      indent_down();
+      indent(out) << "}" << endl;
+    }
+  }
+
   // Loop over reading in fields
   indent(out) <<
-    "while (true)" << endl;
+    (ordered ? "while (ftype != ::apache::thrift::protocol::T_STOP)" : "while (true)") << endl;
     scope_up(out);
 
-    // Read beginning field marker
-    indent(out) <<
-      "xfer += iprot->readFieldBegin(fname, ftype, fid);" << endl;
+    if (!ordered) {
+      // Read beginning field marker
+      indent(out) <<
+        "xfer += iprot->readFieldBegin(fname, ftype, fid);" << endl;
 
-    // Check for field STOP marker
-    out <<
-      indent() << "if (ftype == ::apache::thrift::protocol::T_STOP) {" << endl <<
-      indent() << "  break;" << endl <<
-      indent() << "}" << endl;
+      // Check for field STOP marker
+      out <<
+        indent() << "if (ftype == ::apache::thrift::protocol::T_STOP) {" << endl <<
+        indent() << "  break;" << endl <<
+        indent() << "}" << endl;
+    }
 
     if(fields.empty()) {
       out <<
@@ -1295,28 +2305,15 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
           indent(out) <<
             "if (ftype == " << type_to_enum((*f_iter)->get_type()) << ") {" << endl;
           indent_up();
-
-          const char *isset_prefix =
-            ((*f_iter)->get_req() != t_field::T_REQUIRED) ? "this->__isset." : "isset_";
-
-#if 0
-          // This code throws an exception if the same field is encountered twice.
-          // We've decided to leave it out for performance reasons.
-          // TODO(dreiss): Generate this code and "if" it out to make it easier
-          // for people recompiling thrift to include it.
-          out <<
-            indent() << "if (" << isset_prefix << (*f_iter)->get_name() << ")" << endl <<
-            indent() << "  throw TProtocolException(TProtocolException::INVALID_DATA);" << endl;
-#endif
-
-          if (pointers && !(*f_iter)->get_type()->is_xception()) {
-            generate_deserialize_field(out, *f_iter, "(*(this->", "))");
-          } else {
-            generate_deserialize_field(out, *f_iter, "this->");
-          }
-          out <<
-            indent() << isset_prefix << (*f_iter)->get_name() << " = true;" << endl;
+          generate_struct_member_reader(out, *f_iter, pointers);
           indent_down();
+          if (is_columnar(*f_iter)) {
+            // Written as columns, though a plain list is still accepted
+            indent(out) << "} else if (ftype == ::apache::thrift::protocol::T_STRING) {" << endl;
+            indent_up();
+            generate_columnar_reader(out, *f_iter, pointers);
+            indent_down();
+          }
           out <<
             indent() << "} else {" << endl <<
             indent() << "  xfer += iprot->skip(ftype);" << endl <<
@@ -1339,6 +2336,10 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
     // Read field end marker
     indent(out) <<
       "xfer += iprot->readFieldEnd();" << endl;
+    if (ordered) {
+      indent(out) <<
+        "xfer += iprot->readFieldBegin(fname, ftype, fid);" << endl;
+    }
 
     scope_down(out);
 
@@ -1346,15 +2347,32 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
     endl <<
     indent() << "xfer += iprot->readStructEnd();" << endl;
 
+  for (f_iter = fields.begin(); f_iter != fields.end() && reuse; ++f_iter) {
+    if ((*f_iter)->get_req() != t_field::T_REQUIRED) {
+      indent(out) << "if (!this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+      indent_up();
+      generate_field_reset(out, *f_iter);
+      indent_down();
+      indent(out) << "}" << endl;
+    }
+  }
+
   // Throw if any required fields are missing.
   // We do this after reading the struct end so that
   // there might possibly be a chance of continuing.
   out << endl;
   for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
-    if ((*f_iter)->get_req() == t_field::T_REQUIRED)
+    if ((*f_iter)->get_req() != t_field::T_REQUIRED) {
+      continue;
+    }
+    if (delta) {
+      // A delta leaves out whatever didn't change
+      indent(out) << "(void) isset_" << (*f_iter)->get_name() << ";" << endl;
+    } else {
       out <<
         indent() << "if (!isset_" << (*f_iter)->get_name() << ')' << endl <<
         indent() << "  throw TProtocolException(TProtocolException::INVALID_DATA);" << endl;
+    }
   }
 
   indent(out) << "return xfer;" << endl;
@@ -1365,259 +2383,1243 @@ void t_cpp_generator::generate_struct_reader(ofstream& out,
 }
 
 /**
- * Generates the write function.
- *
- * @param out Stream to write to
- * @param tstruct The struct
+ * Generates the reading of one field of a struct, its header already read
+ * and matched, and the marking of it as set.
  */
-void t_cpp_generator::generate_struct_writer(ofstream& out,
-                                             t_struct* tstruct,
-                                             bool pointers) {
-  string name = tstruct->get_name();
-  const vector<t_field*>& fields = tstruct->get_sorted_members();
-  vector<t_field*>::const_iterator f_iter;
+void t_cpp_generator::generate_struct_member_reader(ofstream& out,
+                                                    t_field* tfield,
+                                                    bool pointers) {
+  const char *isset_prefix =
+    (tfield->get_req() != t_field::T_REQUIRED) ? "this->__isset." : "isset_";
 
-  if (gen_templates_) {
-    out <<
-      indent() << "template <class Protocol_>" << endl <<
-      indent() << "uint32_t " << tstruct->get_name() <<
-      "::write(Protocol_* oprot) const {" << endl;
+#if 0
+  // This code throws an exception if the same field is encountered twice.
+  // We've decided to leave it out for performance reasons.
+  // TODO(dreiss): Generate this code and "if" it out to make it easier
+  // for people recompiling thrift to include it.
+  out <<
+    indent() << "if (" << isset_prefix << tfield->get_name() << ")" << endl <<
+    indent() << "  throw TProtocolException(TProtocolException::INVALID_DATA);" << endl;
+#endif
+
+  if (pointers && !tfield->get_type()->is_xception()) {
+    generate_deserialize_field(out, tfield, "(*(this->", "))");
   } else {
+    generate_deserialize_field(out, tfield, "this->");
+  }
+  out <<
+    indent() << isset_prefix << tfield->get_name() << " = true;" << endl;
+}
+
+/**
+ * Generates the writing of a field header.  With templates it is also
+ * given as the bytes TBinaryProtocol would write, worked out here so that
+ * the protocol need only copy them.
+ */
+void t_cpp_generator::generate_field_header(ofstream& out,
+                                            t_field* tfield,
+                                            string type_enum) {
+  if (!gen_templates_) {
     indent(out) <<
-      "uint32_t " << tstruct->get_name() <<
-      "::write(::apache::thrift::protocol::TProtocol* oprot) const {" << endl;
+      "xfer += oprot->writeFieldBegin(\"" << tfield->get_name() << "\", " <<
+      type_enum << ", " << tfield->get_key() << ");" << endl;
+    return;
   }
-  indent_up();
 
-  out <<
-    indent() << "uint32_t xfer = 0;" << endl;
+  static const char* types[] = {
+    "T_STOP", "T_VOID", "T_BOOL", "T_BYTE", "T_DOUBLE", "", "T_I16", "",
+    "T_I32", "", "T_I64", "T_STRING", "T_STRUCT", "T_MAP", "T_SET", "T_LIST"
+  };
+  string tname = type_enum.substr(type_enum.rfind(':') + 1);
+  int tvalue = 0;
+  while (tvalue < 16 && tname != types[tvalue]) {
+    ++tvalue;
+  }
+  if (tvalue == 16) {
+    throw "no binary header for field type " + type_enum;
+  }
 
+  static const char hex[] = "0123456789abcdef";
+  uint16_t key = (uint16_t)tfield->get_key();
+  int bytes[3] = { tvalue, key >> 8, key & 0xff };
+  string header;
+  for (int i = 0; i < 3; ++i) {
+    header += "\\x";
+    header += hex[bytes[i] >> 4];
+    header += hex[bytes[i] & 0xf];
+  }
   indent(out) <<
-    "xfer += oprot->writeStructBegin(\"" << name << "\");" << endl;
+    "xfer += oprot->writeFieldHeader(\"" << tfield->get_name() << "\", " <<
+    type_enum << ", " << tfield->get_key() << ", \"" << header << "\");" << endl;
+}
 
-  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
-    bool check_if_set = (*f_iter)->get_req() == t_field::T_OPTIONAL ||
-                        (*f_iter)->get_type()->is_xception();
-    if (check_if_set) {
-      out << endl << indent() << "if (this->__isset." << (*f_iter)->get_name() << ") {" << endl;
-      indent_up();
-    } else {
-      out << endl;
+/**
+ * Whether a field is a list of structs annotated cpp.columnar, written as
+ * columns by TColumnarWriter.  Only rows made of base types and enums
+ * can be.
+ */
+bool t_cpp_generator::is_columnar(t_field* tfield) {
+  if (tfield->annotations_.find("cpp.columnar") == tfield->annotations_.end()) {
+    return false;
+  }
+  t_type* type = get_true_type(tfield->get_type());
+  t_type* etype = type->is_list() ? get_true_type(((t_list*)type)->get_elem_type()) : NULL;
+  if (etype == NULL || !etype->is_struct()) {
+    throw "cpp.columnar on " + tfield->get_name() + ", which is not a list of structs";
+  }
+  const vector<t_field*>& members = ((t_struct*)etype)->get_members();
+  if (members.empty()) {
+    throw "cpp.columnar on " + tfield->get_name() + ", whose rows have no fields";
+  }
+  vector<t_field*>::const_iterator m_iter;
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    t_type* mtype = get_true_type((*m_iter)->get_type());
+    if (!(mtype->is_base_type() || mtype->is_enum()) || is_string_view(mtype) ||
+        is_streamed((*m_iter)->get_type()) || mtype->annotations_.count("cpp.type") != 0) {
+      throw "cpp.columnar on " + tfield->get_name() + ", whose rows have field " +
+        (*m_iter)->get_name() + " of a type that cannot be a column";
     }
+  }
+  return true;
+}
 
-    // Write field header
-    out <<
-      indent() << "xfer += oprot->writeFieldBegin(" <<
-      "\"" << (*f_iter)->get_name() << "\", " <<
-      type_to_enum((*f_iter)->get_type()) << ", " <<
-      (*f_iter)->get_key() << ");" << endl;
-    // Write field contents
-    if (pointers && !(*f_iter)->get_type()->is_xception()) {
-      generate_serialize_field(out, *f_iter, "(*(this->", "))");
-    } else {
-      generate_serialize_field(out, *f_iter, "this->");
-    }
-    // Write field closer
-    indent(out) <<
-      "xfer += oprot->writeFieldEnd();" << endl;
-    if (check_if_set) {
-      indent_down();
-      indent(out) << '}';
+/**
+ * Whether any struct in the program has a columnar field.
+ */
+bool t_cpp_generator::has_columnar_fields() {
+  const vector<t_struct*>& objects = program_->get_objects();
+  vector<t_struct*>::const_iterator o_iter;
+  for (o_iter = objects.begin(); o_iter != objects.end(); ++o_iter) {
+    const vector<t_field*>& members = (*o_iter)->get_members();
+    vector<t_field*>::const_iterator m_iter;
+    for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+      if (is_columnar(*m_iter)) {
+        return true;
+      }
     }
   }
-
-  out << endl;
-
-  // Write the struct map
-  out <<
-    indent() << "xfer += oprot->writeFieldStop();" << endl <<
-    indent() << "xfer += oprot->writeStructEnd();" << endl <<
-    indent() << "return xfer;" << endl;
-
-  indent_down();
-  indent(out) <<
-    "}" << endl <<
-    endl;
+  return false;
 }
 
 /**
- * Struct writer for result of a function, which can have only one of its
- * fields set and does a conditional if else look up into the __isset field
- * of the struct.
- *
- * @param out Output stream
- * @param tstruct The result struct
+ * Generates the writing of a columnar list, name, as a binary value:
+ * the row count, then a column for each field of the rows.
  */
-void t_cpp_generator::generate_struct_result_writer(ofstream& out,
-                                                    t_struct* tstruct,
-                                                    bool pointers) {
-  string name = tstruct->get_name();
-  const vector<t_field*>& fields = tstruct->get_sorted_members();
+void t_cpp_generator::generate_columnar_writer(ofstream& out,
+                                               t_field* tfield,
+                                               string name) {
+  t_type* ltype = get_true_type(tfield->get_type());
+  t_struct* row = (t_struct*)get_true_type(((t_list*)ltype)->get_elem_type());
+  const vector<t_field*>& fields = row->get_sorted_members();
   vector<t_field*>::const_iterator f_iter;
 
-  if (gen_templates_) {
-    out <<
-      indent() << "template <class Protocol_>" << endl <<
-      indent() << "uint32_t " << tstruct->get_name() <<
-      "::write(Protocol_* oprot) const {" << endl;
-  } else {
-    indent(out) <<
-      "uint32_t " << tstruct->get_name() <<
-      "::write(::apache::thrift::protocol::TProtocol* oprot) const {" << endl;
-  }
-  indent_up();
-
-  out <<
-    endl <<
-    indent() << "uint32_t xfer = 0;" << endl <<
-    endl;
+  string columns = tmp("_columns");
+  string it = tmp("_row");
+  string loop = "for (" + it + " = " + name + ".begin(); " + it + " != " + name +
+    ".end(); ++" + it + ")";
 
+  scope_up(out);
+  indent(out) << "::apache::thrift::protocol::TColumnarWriter " << columns << ";" << endl;
   indent(out) <<
-    "xfer += oprot->writeStructBegin(\"" << name << "\");" << endl;
+    columns << ".writeCount(static_cast<uint32_t>(" << name << ".size()));" << endl;
+  indent(out) << type_name(tfield->get_type()) << "::const_iterator " << it << ";" << endl;
 
-  bool first = true;
   for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
-    if (first) {
-      first = false;
-      out <<
-        endl <<
-        indent() << "if ";
-    } else {
-      out <<
-        " else if ";
+    string value = it + "->" + (*f_iter)->get_name();
+    string when = "";
+    if ((*f_iter)->get_req() == t_field::T_OPTIONAL) {
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << columns << ".writeBit(" << it << "->__isset." <<
+        (*f_iter)->get_name() << ");" << endl;
+      indent(out) << "}" << endl;
+      indent(out) << columns << ".endBits();" << endl;
+      when = "if (" + it + "->__isset." + (*f_iter)->get_name() + ") ";
     }
 
-    out << "(this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+    t_type* type = get_true_type((*f_iter)->get_type());
+    t_base_type::t_base tbase = type->is_enum()
+      ? t_base_type::TYPE_I32 : ((t_base_type*)type)->get_base();
+    switch (tbase) {
+    case t_base_type::TYPE_BOOL:
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << when << columns << ".writeBit(" << value << ");" << endl;
+      indent(out) << "}" << endl;
+      indent(out) << columns << ".endBits();" << endl;
+      break;
+    case t_base_type::TYPE_BYTE:
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << when << columns << ".writeByte(" << value << ");" << endl;
+      indent(out) << "}" << endl;
+      break;
+    case t_base_type::TYPE_DOUBLE:
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << when << columns << ".writeDouble(" << value << ");" << endl;
+      indent(out) << "}" << endl;
+      break;
+    case t_base_type::TYPE_STRING:
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << when << columns << ".writeLength(" << value << ".size());" << endl;
+      indent(out) << "}" << endl;
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << when << columns << ".writeBytes(" << value << ");" << endl;
+      indent(out) << "}" << endl;
+      break;
+    default:
+      {
+        string prev = tmp("_prev");
+        indent(out) << "int64_t " << prev << " = 0;" << endl;
+        indent(out) << loop << " {" << endl;
+        indent(out) << "  " << when << columns << ".writeDelta((int64_t)" << value << ", " <<
+          prev << ");" << endl;
+        indent(out) << "}" << endl;
+      }
+      break;
+    }
+  }
 
-    indent_up();
+  indent(out) << "xfer += oprot->writeBinary(" << columns << ".getBuffer());" << endl;
+  scope_down(out);
+}
 
-    // Write field header
-    out <<
-      indent() << "xfer += oprot->writeFieldBegin(" <<
-      "\"" << (*f_iter)->get_name() << "\", " <<
-      type_to_enum((*f_iter)->get_type()) << ", " <<
-      (*f_iter)->get_key() << ");" << endl;
-    // Write field contents
-    if (pointers) {
-      generate_serialize_field(out, *f_iter, "(*(this->", "))");
-    } else {
-      generate_serialize_field(out, *f_iter, "this->");
+/**
+ * Generates the reading of a columnar list, its header already read and
+ * found to be binary, straight into the vector of rows.
+ */
+void t_cpp_generator::generate_columnar_reader(ofstream& out,
+                                               t_field* tfield,
+                                               bool pointers) {
+  string name = pointers
+    ? "(*(this->" + tfield->get_name() + "))"
+    : "this->" + tfield->get_name();
+  t_type* ltype = get_true_type(tfield->get_type());
+  t_struct* row = (t_struct*)get_true_type(((t_list*)ltype)->get_elem_type());
+  const vector<t_field*>& fields = row->get_sorted_members();
+  vector<t_field*>::const_iterator f_iter;
+
+  string blob = tmp("_blob");
+  string columns = tmp("_columns");
+  string it = tmp("_row");
+  string loop = "for (" + it + " = " + name + ".begin(); " + it + " != " + name +
+    ".end(); ++" + it + ")";
+
+  scope_up(out);
+  indent(out) << "std::string " << blob << ";" << endl;
+  indent(out) << "xfer += iprot->readBinary(" << blob << ");" << endl;
+  indent(out) << "::apache::thrift::protocol::TColumnarReader " << columns << "(" << blob << ");" << endl;
+  indent(out) << name << ".clear();" << endl;
+  indent(out) << name << ".resize(" << columns << ".readCount());" << endl;
+  indent(out) << type_name(tfield->get_type()) << "::iterator " << it << ";" << endl;
+
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    string value = it + "->" + (*f_iter)->get_name();
+    string isset = it + "->__isset." + (*f_iter)->get_name();
+    string when = "";
+    string mark = "";
+    switch ((*f_iter)->get_req()) {
+    case t_field::T_OPTIONAL:
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << isset << " = " << columns << ".readBit();" << endl;
+      indent(out) << "}" << endl;
+      indent(out) << columns << ".endBits();" << endl;
+      when = "if (" + isset + ") ";
+      break;
+    case t_field::T_REQUIRED:
+      break;
+    default:
+      mark = " " + isset + " = true;";
+      break;
     }
-    // Write field closer
-    indent(out) << "xfer += oprot->writeFieldEnd();" << endl;
 
-    indent_down();
-    indent(out) << "}";
+    t_type* type = get_true_type((*f_iter)->get_type());
+    t_base_type::t_base tbase = type->is_enum()
+      ? t_base_type::TYPE_I32 : ((t_base_type*)type)->get_base();
+    switch (tbase) {
+    case t_base_type::TYPE_BOOL:
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << when << value << " = " << columns << ".readBit();" << mark << endl;
+      indent(out) << "}" << endl;
+      indent(out) << columns << ".endBits();" << endl;
+      break;
+    case t_base_type::TYPE_BYTE:
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << when << value << " = " << columns << ".readByte();" << mark << endl;
+      indent(out) << "}" << endl;
+      break;
+    case t_base_type::TYPE_DOUBLE:
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << when << value << " = " << columns << ".readDouble();" << mark << endl;
+      indent(out) << "}" << endl;
+      break;
+    case t_base_type::TYPE_STRING:
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << when << value << ".resize(" << columns << ".readLength());" << mark <<
+        endl;
+      indent(out) << "}" << endl;
+      indent(out) << loop << " {" << endl;
+      indent(out) << "  " << when << columns << ".readBytes(" << value << ");" << endl;
+      indent(out) << "}" << endl;
+      break;
+    default:
+      {
+        string prev = tmp("_prev");
+        indent(out) << "int64_t " << prev << " = 0;" << endl;
+        indent(out) << loop << " {" << endl;
+        indent(out) << "  " << when << value << " = (" << type_name((*f_iter)->get_type()) <<
+          ")" << columns << ".readDelta(" << prev << ");" << mark << endl;
+        indent(out) << "}" << endl;
+      }
+      break;
+    }
   }
 
-  // Write the struct map
-  out <<
-    endl <<
-    indent() << "xfer += oprot->writeFieldStop();" << endl <<
-    indent() << "xfer += oprot->writeStructEnd();" << endl <<
-    indent() << "return xfer;" << endl;
-
-  indent_down();
+  indent(out) << columns << ".finish();" << endl;
   indent(out) <<
-    "}" << endl <<
-    endl;
+    (tfield->get_req() != t_field::T_REQUIRED ? "this->__isset." : "isset_") <<
+    tfield->get_name() << " = true;" << endl;
+  scope_down(out);
 }
 
 /**
- * Generates the swap function.
- *
- * @param out Stream to write to
- * @param tstruct The struct
+ * Generates writePacked(), for the packed option: a bitmap of which
+ * optional fields are set, then the fields present, in id order.
  */
-void t_cpp_generator::generate_struct_swap(ofstream& out, t_struct* tstruct) {
-  out <<
-    indent() << "void swap(" << tstruct->get_name() << " &a, " <<
-    tstruct->get_name() << " &b) {" << endl;
-  indent_up();
-
-  // Let argument-dependent name lookup find the correct swap() function to
-  // use based on the argument types.  If none is found in the arguments'
-  // namespaces, fall back to ::std::swap().
-  out <<
-    indent() << "using ::std::swap;" << endl;
+void t_cpp_generator::generate_packed_writer(ofstream& out, t_struct* tstruct) {
+  const vector<t_field*>& fields = tstruct->get_sorted_members();
+  vector<t_field*>::const_iterator f_iter;
 
-  bool has_nonrequired_fields = false;
-  const vector<t_field*>& fields = tstruct->get_members();
-  for (vector<t_field*>::const_iterator f_iter = fields.begin();
-       f_iter != fields.end();
-       ++f_iter) {
-    t_field *tfield = *f_iter;
+  indent(out) <<
+    "uint32_t " << tstruct->get_name() <<
+    "::writePacked(::apache::thrift::protocol::TPackedWriter& writer) const {" << endl;
+  indent_up();
+  indent(out) << "uint32_t xfer = 0;" << endl;
 
-    if (tfield->get_req() != t_field::T_REQUIRED) {
-      has_nonrequired_fields = true;
+  int num_optional = 0;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    if ((*f_iter)->get_req() == t_field::T_OPTIONAL) {
+      ++num_optional;
     }
-
-    out <<
-      indent() << "swap(a." << tfield->get_name() <<
-      ", b." << tfield->get_name() << ");" << endl;
   }
-
-  if (has_nonrequired_fields) {
-    out <<
-      indent() << "swap(a.__isset, b.__isset);" << endl;
+  if (num_optional > 0) {
+    int bytes = (num_optional + 7) / 8;
+    indent(out) << "uint8_t present[" << bytes << "] = {0};" << endl;
+    int bit = 0;
+    for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+      if ((*f_iter)->get_req() == t_field::T_OPTIONAL) {
+        indent(out) <<
+          "if (this->__isset." << (*f_iter)->get_name() << ") present[" << bit / 8 <<
+          "] |= " << (1 << (bit % 8)) << ";" << endl;
+        ++bit;
+      }
+    }
+    indent(out) << "xfer += writer.writeBitmap(present, " << bytes << ");" << endl;
   }
 
-  // handle empty structs
-  if (fields.size() == 0) {
-    out <<
-      indent() << "(void) a;" << endl;
-    out <<
-      indent() << "(void) b;" << endl;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    string name = "this->" + (*f_iter)->get_name();
+    if (is_lazy(*f_iter)) {
+      name += ".get()";
+    }
+    if ((*f_iter)->get_req() == t_field::T_OPTIONAL) {
+      indent(out) << "if (this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+      indent_up();
+      generate_packed_write_value(out, (*f_iter)->get_type(), name);
+      indent_down();
+      indent(out) << "}" << endl;
+    } else {
+      generate_packed_write_value(out, (*f_iter)->get_type(), name);
+    }
   }
 
-  scope_down(out);
-  out << endl;
+  indent(out) << "return xfer;" << endl;
+  indent_down();
+  indent(out) << "}" << endl << endl;
 }
 
 /**
- * Generates a thrift service. In C++, this comprises an entirely separate
- * header and source file. The header file defines the methods and includes
- * the data types defined in the main header file, and the implementation
- * file contains implementations of the basic printer and default interfaces.
- *
- * @param tservice The service definition
+ * Generates readPacked(), the inverse of writePacked().
  */
-void t_cpp_generator::generate_service(t_service* tservice) {
-  string svcname = tservice->get_name();
+void t_cpp_generator::generate_packed_reader(ofstream& out, t_struct* tstruct) {
+  const vector<t_field*>& fields = tstruct->get_sorted_members();
+  vector<t_field*>::const_iterator f_iter;
 
-  // Make output files
-  string f_header_name = get_out_dir()+svcname+".h";
-  f_header_.open(f_header_name.c_str());
+  indent(out) <<
+    "uint32_t " << tstruct->get_name() <<
+    "::readPacked(::apache::thrift::protocol::TPackedReader& reader) {" << endl;
+  indent_up();
+  indent(out) << "uint32_t xfer = 0;" << endl;
 
-  // Print header file includes
-  f_header_ <<
-    autogen_comment();
-  f_header_ <<
-    "#ifndef " << svcname << "_H" << endl <<
-    "#define " << svcname << "_H" << endl <<
-    endl;
-  if (gen_cob_style_) {
-    f_header_ <<
-      "#include <thrift/transport/TBufferTransports.h>" << endl << // TMemoryBuffer
-      "#include <thrift/cxxfunctional.h>" << endl <<
-      "namespace apache { namespace thrift { namespace async {" << endl <<
-      "class TAsyncChannel;" << endl <<
-      "}}}" << endl;
+  int num_optional = 0;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    if ((*f_iter)->get_req() == t_field::T_OPTIONAL) {
+      ++num_optional;
+    }
   }
-  f_header_ <<
-    "#include <thrift/TDispatchProcessor.h>" << endl;
-  if (gen_cob_style_) {
-    f_header_ <<
-      "#include <thrift/async/TAsyncDispatchProcessor.h>" << endl;
+  if (num_optional > 0) {
+    int bytes = (num_optional + 7) / 8;
+    indent(out) << "uint8_t present[" << bytes << "];" << endl;
+    indent(out) << "xfer += reader.readBitmap(present, " << bytes << ");" << endl;
   }
-  f_header_ <<
-    "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
-    "_types.h\"" << endl;
 
-  t_service* extends_service = tservice->get_extends();
-  if (extends_service != NULL) {
-    f_header_ <<
-      "#include \"" << get_include_prefix(*(extends_service->get_program())) <<
+  int bit = 0;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    string name = "this->" + (*f_iter)->get_name();
+    if (is_lazy(*f_iter)) {
+      name += ".mutate()";
+    }
+    switch ((*f_iter)->get_req()) {
+    case t_field::T_OPTIONAL:
+      indent(out) <<
+        "this->__isset." << (*f_iter)->get_name() << " = (present[" << bit / 8 <<
+        "] & " << (1 << (bit % 8)) << ") != 0;" << endl;
+      indent(out) << "if (this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+      indent_up();
+      generate_packed_read_value(out, (*f_iter)->get_type(), name);
+      indent_down();
+      indent(out) << "}" << endl;
+      ++bit;
+      break;
+    case t_field::T_REQUIRED:
+      generate_packed_read_value(out, (*f_iter)->get_type(), name);
+      break;
+    default:
+      generate_packed_read_value(out, (*f_iter)->get_type(), name);
+      indent(out) << "this->__isset." << (*f_iter)->get_name() << " = true;" << endl;
+      break;
+    }
+  }
+
+  indent(out) << "return xfer;" << endl;
+  indent_down();
+  indent(out) << "}" << endl << endl;
+}
+
+/**
+ * Generates the packed writing of the value name, of type ttype.
+ */
+void t_cpp_generator::generate_packed_write_value(ofstream& out,
+                                                  t_type* ttype,
+                                                  string name) {
+  if (is_streamed(ttype)) {
+    throw "cannot pack " + name + ", which is streamed";
+  }
+  t_type* type = get_true_type(ttype);
+
+  if (type->is_struct() || type->is_xception()) {
+    indent(out) << "xfer += " << name << ".writePacked(writer);" << endl;
+  } else if (type->is_enum()) {
+    indent(out) << "xfer += writer.writeI32((int32_t)" << name << ");" << endl;
+  } else if (type->is_base_type()) {
+    t_base_type::t_base tbase = ((t_base_type*)type)->get_base();
+    indent(out) << "xfer += writer.";
+    switch (tbase) {
+    case t_base_type::TYPE_STRING:
+      out << "writeString(";
+      break;
+    case t_base_type::TYPE_BOOL:
+      out << "writeBool(";
+      break;
+    case t_base_type::TYPE_BYTE:
+      out << "writeByte(";
+      break;
+    case t_base_type::TYPE_I16:
+      out << "writeI16(";
+      break;
+    case t_base_type::TYPE_I32:
+      out << "writeI32(";
+      break;
+    case t_base_type::TYPE_I64:
+      out << "writeI64(";
+      break;
+    case t_base_type::TYPE_DOUBLE:
+      out << "writeDouble(";
+      break;
+    default:
+      throw "compiler error: no packed writer for base type " + t_base_type::t_base_name(tbase);
+    }
+    out << name << ");" << endl;
+  } else if (type->is_container()) {
+    indent(out) <<
+      "xfer += writer.writeSize(static_cast<uint32_t>(" << name << ".size()));" << endl;
+    // Lists of plain numbers go as one run, unless a cpp.template
+    // annotation has made them something other than a vector
+    string suffix = ((t_container*)type)->has_cpp_name() ? "" : bulk_list_suffix(type);
+    if (!suffix.empty()) {
+      indent(out) << "if (!" << name << ".empty()) {" << endl;
+      indent(out) <<
+        "  xfer += writer.write" << suffix << "(&" << name << "[0], " <<
+        "static_cast<uint32_t>(" << name << ".size()));" << endl;
+      indent(out) << "}" << endl;
+      return;
+    }
+    string iter = tmp("_iter");
+    indent(out) <<
+      type_name(ttype) << "::const_iterator " << iter << ";" << endl;
+    indent(out) <<
+      "for (" << iter << " = " << name << ".begin(); " << iter << " != " << name <<
+      ".end(); ++" << iter << ")" << endl;
+    scope_up(out);
+    if (type->is_map()) {
+      generate_packed_write_value(out, ((t_map*)type)->get_key_type(), iter + "->first");
+      generate_packed_write_value(out, ((t_map*)type)->get_val_type(), iter + "->second");
+    } else if (type->is_set()) {
+      generate_packed_write_value(out, ((t_set*)type)->get_elem_type(), "(*" + iter + ")");
+    } else {
+      generate_packed_write_value(out, ((t_list*)type)->get_elem_type(), "(*" + iter + ")");
+    }
+    scope_down(out);
+  } else {
+    throw "compiler error: no packed writer for type " + type->get_name();
+  }
+}
+
+/**
+ * Generates the packed reading of the value name, of type ttype.
+ */
+void t_cpp_generator::generate_packed_read_value(ofstream& out,
+                                                 t_type* ttype,
+                                                 string name) {
+  if (is_streamed(ttype)) {
+    throw "cannot pack " + name + ", which is streamed";
+  }
+  t_type* type = get_true_type(ttype);
+
+  if (type->is_struct() || type->is_xception()) {
+    indent(out) << "xfer += " << name << ".readPacked(reader);" << endl;
+  } else if (type->is_enum()) {
+    string ecast = tmp("ecast");
+    indent(out) << "int32_t " << ecast << ";" << endl;
+    indent(out) << "xfer += reader.readI32(" << ecast << ");" << endl;
+    indent(out) << name << " = (" << type_name(type) << ")" << ecast << ";" << endl;
+  } else if (type->is_base_type()) {
+    t_base_type::t_base tbase = ((t_base_type*)type)->get_base();
+    indent(out) << "xfer += reader.";
+    switch (tbase) {
+    case t_base_type::TYPE_STRING:
+      out << "readString(";
+      break;
+    case t_base_type::TYPE_BOOL:
+      out << "readBool(";
+      break;
+    case t_base_type::TYPE_BYTE:
+      out << "readByte(";
+      break;
+    case t_base_type::TYPE_I16:
+      out << "readI16(";
+      break;
+    case t_base_type::TYPE_I32:
+      out << "readI32(";
+      break;
+    case t_base_type::TYPE_I64:
+      out << "readI64(";
+      break;
+    case t_base_type::TYPE_DOUBLE:
+      out << "readDouble(";
+      break;
+    default:
+      throw "compiler error: no packed reader for base type " + t_base_type::t_base_name(tbase);
+    }
+    out << name << ");" << endl;
+  } else if (type->is_container()) {
+    string size = tmp("_size");
+    string i = tmp("_i");
+    scope_up(out);
+    indent(out) << "uint32_t " << size << ";" << endl;
+    indent(out) << "xfer += reader.readSize(" << size << ");" << endl;
+    indent(out) << name << ".clear();" << endl;
+    if (type->is_list() && ((t_container*)type)->has_cpp_name()) {
+      t_type* etype = ((t_list*)type)->get_elem_type();
+      string elem = tmp("_elem");
+      indent(out) <<
+        "for (uint32_t " << i << " = 0; " << i << " < " << size << "; ++" << i << ")" << endl;
+      scope_up(out);
+      indent(out) << declare_field(new t_field(etype, elem)) << endl;
+      generate_packed_read_value(out, etype, elem);
+      indent(out) << name << ".push_back(" << elem << ");" << endl;
+      scope_down(out);
+    } else if (type->is_list()) {
+      t_type* etype = ((t_list*)type)->get_elem_type();
+      indent(out) << name << ".resize(" << size << ");" << endl;
+      string suffix = bulk_list_suffix(type);
+      if (!suffix.empty()) {
+        indent(out) << "if (" << size << " > 0) {" << endl;
+        indent(out) <<
+          "  xfer += reader.read" << suffix << "(&" << name << "[0], " << size << ");" << endl;
+        indent(out) << "}" << endl;
+        scope_down(out);
+        return;
+      }
+      indent(out) <<
+        "for (uint32_t " << i << " = 0; " << i << " < " << size << "; ++" << i << ")" << endl;
+      scope_up(out);
+      t_type* tetype = get_true_type(etype);
+      if (tetype->is_base_type() &&
+          ((t_base_type*)tetype)->get_base() == t_base_type::TYPE_BOOL) {
+        // vector<bool> hands out proxies, not bool&
+        string elem = tmp("_elem");
+        indent(out) << "bool " << elem << ";" << endl;
+        generate_packed_read_value(out, etype, elem);
+        indent(out) << name << "[" << i << "] = " << elem << ";" << endl;
+      } else {
+        generate_packed_read_value(out, etype, name + "[" + i + "]");
+      }
+      scope_down(out);
+    } else {
+      indent(out) <<
+        "for (uint32_t " << i << " = 0; " << i << " < " << size << "; ++" << i << ")" << endl;
+      scope_up(out);
+      if (type->is_map()) {
+        t_type* ktype = ((t_map*)type)->get_key_type();
+        t_type* vtype = ((t_map*)type)->get_val_type();
+        string key = tmp("_key");
+        string val = tmp("_val");
+        indent(out) << declare_field(new t_field(ktype, key)) << endl;
+        generate_packed_read_value(out, ktype, key);
+        indent(out) << type_name(vtype) << "& " << val << " = " << name << "[" << key << "];" << endl;
+        generate_packed_read_value(out, vtype, val);
+      } else {
+        t_type* etype = ((t_set*)type)->get_elem_type();
+        string elem = tmp("_elem");
+        indent(out) << declare_field(new t_field(etype, elem)) << endl;
+        generate_packed_read_value(out, etype, elem);
+        indent(out) << name << ".insert(" << elem << ");" << endl;
+      }
+      scope_down(out);
+    }
+    scope_down(out);
+  } else {
+    throw "compiler error: no packed reader for type " + type->get_name();
+  }
+}
+
+/**
+ * Generates writeFrozen(), for the frozen option: a slot for each field,
+ * in id order, pointing at its value, which is appended after.
+ */
+void t_cpp_generator::generate_frozen_writer(ofstream& out, t_struct* tstruct) {
+  const vector<t_field*>& fields = tstruct->get_sorted_members();
+  vector<t_field*>::const_iterator f_iter;
+
+  indent(out) <<
+    "uint32_t " << tstruct->get_name() <<
+    "::writeFrozen(::apache::thrift::protocol::TFrozenWriter& writer) const {" << endl;
+  indent_up();
+  indent(out) << "uint32_t table = writer.beginStruct(" << fields.size() << ");" << endl;
+
+  int slot = 0;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter, ++slot) {
+    string name = "this->" + (*f_iter)->get_name();
+    if (is_lazy(*f_iter)) {
+      name += ".get()";
+    }
+    bool optional = (*f_iter)->get_req() == t_field::T_OPTIONAL;
+    if (optional) {
+      indent(out) << "if (this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+      indent_up();
+    }
+    t_type* type = get_true_type((*f_iter)->get_type());
+    if (type->is_container()) {
+      scope_up(out);
+    }
+    string value = generate_frozen_write_value(out, (*f_iter)->get_type(), name);
+    indent(out) << "writer.setSlot(table, " << slot << ", " << value << ");" << endl;
+    if (type->is_container()) {
+      scope_down(out);
+    }
+    if (optional) {
+      indent_down();
+      indent(out) << "}" << endl;
+    }
+  }
+
+  indent(out) << "return table;" << endl;
+  indent_down();
+  indent(out) << "}" << endl << endl;
+}
+
+/**
+ * Generates the <name>_view class of a struct, for the frozen option, with
+ * an accessor and a has_ for each field.  Unset fields read as their
+ * defaults, and unset strings, containers and structs as empty.
+ */
+void t_cpp_generator::generate_frozen_view(ofstream& out, t_struct* tstruct) {
+  const vector<t_field*>& fields = tstruct->get_sorted_members();
+  vector<t_field*>::const_iterator f_iter;
+  string view = tstruct->get_name() + "_view";
+
+  indent(out) <<
+    "class " << view << " : public ::apache::thrift::protocol::TFrozenStruct {" << endl;
+  indent(out) << " public:" << endl;
+  indent_up();
+  // The base by a name no field can hide
+  indent(out) << "typedef ::apache::thrift::protocol::TFrozenStruct Frozen_;" << endl << endl;
+  indent(out) << view << "() {}" << endl;
+  indent(out) << view << "(const uint8_t* data, size_t size, uint32_t table)" << endl;
+  indent(out) << "  : Frozen_(data, size, table) {}" << endl << endl;
+
+  int slot = 0;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter, ++slot) {
+    if (is_streamed((*f_iter)->get_type())) {
+      throw "cannot freeze " + (*f_iter)->get_name() + ", which is streamed";
+    }
+    t_type* type = get_true_type((*f_iter)->get_type());
+    string name = (*f_iter)->get_name();
+    t_const_value* dflt = (*f_iter)->get_value();
+
+    if (type->is_base_type() && ((t_base_type*)type)->get_base() == t_base_type::TYPE_STRING) {
+      indent(out) << frozen_type_name(type, false) << " " << name << "() const {" << endl;
+      if (dflt != NULL) {
+        indent(out) <<
+          "  return Frozen_::isSet(" << slot << ") ? Frozen_::loadView< " <<
+          frozen_type_name(type, false) << " >(" << slot << ") : " <<
+          frozen_type_name(type, false) << "(" << render_const_value(out, name, type, dflt) <<
+          ");" << endl;
+      } else {
+        indent(out) <<
+          "  return Frozen_::loadView< " << frozen_type_name(type, false) << " >(" << slot <<
+          ");" << endl;
+      }
+      indent(out) << "}" << endl;
+    } else if (type->is_base_type() || type->is_enum()) {
+      string number = frozen_type_name(type, true);
+      string value = dflt != NULL ? render_const_value(out, name, type, dflt) : "0";
+      if (type->is_enum()) {
+        value = "(int32_t)" + value;
+      }
+      indent(out) << frozen_type_name(type, false) << " " << name << "() const {" << endl;
+      if (type->is_enum()) {
+        indent(out) <<
+          "  return (" << type_name(type) << ")Frozen_::load<int32_t>(" << slot << ", " <<
+          value << ");" << endl;
+      } else {
+        indent(out) <<
+          "  return Frozen_::load<" << number << ">(" << slot << ", " << value << ");" << endl;
+      }
+      indent(out) << "}" << endl;
+    } else {
+      indent(out) << frozen_type_name(type, false) << " " << name << "() const {" << endl;
+      indent(out) <<
+        "  return Frozen_::loadView< " << frozen_type_name(type, false) << " >(" << slot <<
+        ");" << endl;
+      indent(out) << "}" << endl;
+    }
+    indent(out) <<
+      "bool has_" << name << "() const { return Frozen_::isSet(" << slot << "); }" << endl << endl;
+  }
+
+  indent_down();
+  indent(out) << "};" << endl << endl;
+}
+
+/**
+ * Generates the writing of the value name, of type ttype, to a frozen
+ * buffer, and returns an expression for its offset.
+ */
+string t_cpp_generator::generate_frozen_write_value(ofstream& out,
+                                                    t_type* ttype,
+                                                    string name) {
+  if (is_streamed(ttype)) {
+    throw "cannot freeze " + name + ", which is streamed";
+  }
+  t_type* type = get_true_type(ttype);
+
+  if (type->is_struct() || type->is_xception()) {
+    return name + ".writeFrozen(writer)";
+  } else if (type->is_enum()) {
+    return "writer.writeI32((int32_t)" + name + ")";
+  } else if (type->is_base_type()) {
+    if (((t_base_type*)type)->get_base() == t_base_type::TYPE_STRING) {
+      return "writer.writeString(" + name + ".data(), " + name + ".size())";
+    }
+    return "writer.write" + frozen_number_suffix(type) + "(" + name + ")";
+  } else if (!type->is_container()) {
+    throw "compiler error: no frozen writer for type " + type->get_name();
+  }
+
+  string container = tmp("_frozen");
+  string size = "static_cast<uint32_t>(" + name + ".size())";
+  t_type* etype;
+  if (type->is_map()) {
+    etype = get_true_type(((t_map*)type)->get_key_type());
+  } else if (type->is_set()) {
+    etype = get_true_type(((t_set*)type)->get_elem_type());
+  } else {
+    etype = get_true_type(((t_list*)type)->get_elem_type());
+  }
+  // Ordered sets and maps of numbers and strings can be binary searched
+  bool sorted = !type->is_list() && !((t_container*)type)->has_cpp_name() &&
+    !is_unordered(type) && (etype->is_base_type() || etype->is_enum());
+
+  if (type->is_map()) {
+    t_type* ktype = ((t_map*)type)->get_key_type();
+    t_type* vtype = ((t_map*)type)->get_val_type();
+    string key = tmp("_key");
+    string val = tmp("_val");
+    indent(out) <<
+      "uint32_t " << container << " = writer.beginMap(" << size << ", " << frozen_width(ktype) <<
+      ", " << frozen_width(vtype) << (sorted ? ", true" : "") << ");" << endl;
+    indent(out) <<
+      "uint32_t " << key << " = ::apache::thrift::protocol::TFrozenWriter::elements(" <<
+      container << ");" << endl;
+    indent(out) <<
+      "uint32_t " << val << " = " << key << " + " << frozen_width(ktype) << " * " << size <<
+      ";" << endl;
+    string iter = tmp("_iter");
+    indent(out) << type_name(ttype) << "::const_iterator " << iter << ";" << endl;
+    indent(out) <<
+      "for (" << iter << " = " << name << ".begin(); " << iter << " != " << name <<
+      ".end(); ++" << iter << ")" << endl;
+    scope_up(out);
+    generate_frozen_put_element(out, ktype, iter + "->first", key);
+    generate_frozen_put_element(out, vtype, iter + "->second", val);
+    indent(out) << key << " += " << frozen_width(ktype) << ";" << endl;
+    indent(out) << val << " += " << frozen_width(vtype) << ";" << endl;
+    scope_down(out);
+    return container;
+  }
+
+  t_type* elem = type->is_set() ? ((t_set*)type)->get_elem_type()
+                                : ((t_list*)type)->get_elem_type();
+  string at = tmp("_at");
+  indent(out) <<
+    "uint32_t " << container << " = writer.beginList(" << size << ", " << frozen_width(elem) <<
+    (sorted ? ", true" : "") << ");" << endl;
+  indent(out) <<
+    "uint32_t " << at << " = ::apache::thrift::protocol::TFrozenWriter::elements(" <<
+    container << ");" << endl;
+  // Lists of plain numbers go as one run, unless a cpp.template annotation
+  // has made them something other than a vector
+  string suffix = ((t_container*)type)->has_cpp_name() ? "" : bulk_list_suffix(type);
+  if (!suffix.empty()) {
+    indent(out) << "if (!" << name << ".empty()) {" << endl;
+    indent(out) <<
+      "  writer.put" << suffix << "(" << at << ", &" << name << "[0], " << size << ");" << endl;
+    indent(out) << "}" << endl;
+    return container;
+  }
+  string iter = tmp("_iter");
+  indent(out) << type_name(ttype) << "::const_iterator " << iter << ";" << endl;
+  indent(out) <<
+    "for (" << iter << " = " << name << ".begin(); " << iter << " != " << name <<
+    ".end(); ++" << iter << ")" << endl;
+  scope_up(out);
+  generate_frozen_put_element(out, elem, "(*" + iter + ")", at);
+  indent(out) << at << " += " << frozen_width(elem) << ";" << endl;
+  scope_down(out);
+  return container;
+}
+
+/**
+ * Generates the filling in of the list or map element at at with the value
+ * name: numbers in place, anything else as the offset of its value.
+ */
+void t_cpp_generator::generate_frozen_put_element(ofstream& out,
+                                                  t_type* ttype,
+                                                  string name,
+                                                  string at) {
+  t_type* type = get_true_type(ttype);
+  if (type->is_enum()) {
+    indent(out) << "writer.putI32(" << at << ", (int32_t)" << name << ");" << endl;
+    return;
+  }
+  string suffix = frozen_number_suffix(type);
+  if (!suffix.empty()) {
+    indent(out) << "writer.put" << suffix << "(" << at << ", " << name << ");" << endl;
+    return;
+  }
+  if (type->is_container()) {
+    scope_up(out);
+    string value = generate_frozen_write_value(out, ttype, name);
+    indent(out) << "writer.putOffset(" << at << ", " << value << ");" << endl;
+    scope_down(out);
+  } else {
+    indent(out) <<
+      "writer.putOffset(" << at << ", " << generate_frozen_write_value(out, ttype, name) <<
+      ");" << endl;
+  }
+}
+
+/**
+ * Generates the write function.
+ *
+ * @param out Stream to write to
+ * @param tstruct The struct
+ */
+void t_cpp_generator::generate_struct_writer(ofstream& out,
+                                             t_struct* tstruct,
+                                             bool pointers,
+                                             bool delta) {
+  string name = tstruct->get_name();
+  const vector<t_field*>& fields = tstruct->get_sorted_members();
+  vector<t_field*>::const_iterator f_iter;
+
+  // writeDelta() is write() of just the fields marked in __dirty
+  string fn = delta ? "writeDelta" : "write";
+  if (gen_templates_) {
+    out <<
+      indent() << "template <class Protocol_>" << endl <<
+      indent() << "uint32_t " << tstruct->get_name() <<
+      "::" << fn << "(Protocol_* oprot) const {" << endl;
+  } else {
+    indent(out) <<
+      "uint32_t " << tstruct->get_name() <<
+      "::" << fn << "(::apache::thrift::protocol::TProtocol* oprot) const {" << endl;
+  }
+  indent_up();
+
+  out <<
+    indent() << "uint32_t xfer = 0;" << endl;
+
+  indent(out) <<
+    "xfer += oprot->writeStructBegin(\"" << name << "\");" << endl;
+
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    bool check_if_set = (*f_iter)->get_req() == t_field::T_OPTIONAL ||
+                        (*f_iter)->get_type()->is_xception();
+    if (delta) {
+      out << endl << indent() << "if (this->__dirty." << (*f_iter)->get_name();
+      if (check_if_set) {
+        out << " && this->__isset." << (*f_iter)->get_name();
+      }
+      out << ") {" << endl;
+      indent_up();
+      check_if_set = true;
+    } else if (check_if_set) {
+      out << endl << indent() << "if (this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+      indent_up();
+    } else {
+      out << endl;
+    }
+
+    // Write field header
+    bool columnar = is_columnar(*f_iter);
+    generate_field_header(out, *f_iter, columnar
+                          ? "::apache::thrift::protocol::T_STRING"
+                          : type_to_enum((*f_iter)->get_type()));
+    // Write field contents
+    if (columnar) {
+      generate_columnar_writer(out, *f_iter, pointers
+                               ? "(*(this->" + (*f_iter)->get_name() + "))"
+                               : "this->" + (*f_iter)->get_name());
+    } else if (pointers && !(*f_iter)->get_type()->is_xception()) {
+      generate_serialize_field(out, *f_iter, "(*(this->", "))");
+    } else {
+      generate_serialize_field(out, *f_iter, "this->");
+    }
+    // Write field closer
+    indent(out) <<
+      "xfer += oprot->writeFieldEnd();" << endl;
+    if (check_if_set) {
+      indent_down();
+      indent(out) << '}';
+    }
+  }
+
+  out << endl;
+
+  // Write the struct map
+  out <<
+    indent() << "xfer += oprot->writeFieldStop();" << endl <<
+    indent() << "xfer += oprot->writeStructEnd();" << endl <<
+    indent() << "return xfer;" << endl;
+
+  indent_down();
+  indent(out) <<
+    "}" << endl <<
+    endl;
+}
+
+/**
+ * Struct writer for result of a function, which can have only one of its
+ * fields set and does a conditional if else look up into the __isset field
+ * of the struct.
+ *
+ * @param out Output stream
+ * @param tstruct The result struct
+ */
+void t_cpp_generator::generate_struct_result_writer(ofstream& out,
+                                                    t_struct* tstruct,
+                                                    bool pointers) {
+  string name = tstruct->get_name();
+  const vector<t_field*>& fields = tstruct->get_sorted_members();
+  vector<t_field*>::const_iterator f_iter;
+
+  if (gen_templates_) {
+    out <<
+      indent() << "template <class Protocol_>" << endl <<
+      indent() << "uint32_t " << tstruct->get_name() <<
+      "::write(Protocol_* oprot) const {" << endl;
+  } else {
+    indent(out) <<
+      "uint32_t " << tstruct->get_name() <<
+      "::write(::apache::thrift::protocol::TProtocol* oprot) const {" << endl;
+  }
+  indent_up();
+
+  out <<
+    endl <<
+    indent() << "uint32_t xfer = 0;" << endl <<
+    endl;
+
+  indent(out) <<
+    "xfer += oprot->writeStructBegin(\"" << name << "\");" << endl;
+
+  bool first = true;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    if (first) {
+      first = false;
+      out <<
+        endl <<
+        indent() << "if ";
+    } else {
+      out <<
+        " else if ";
+    }
+
+    out << "(this->__isset." << (*f_iter)->get_name() << ") {" << endl;
+
+    indent_up();
+
+    // Write field header
+    generate_field_header(out, *f_iter, type_to_enum((*f_iter)->get_type()));
+    // Write field contents
+    if (pointers) {
+      generate_serialize_field(out, *f_iter, "(*(this->", "))");
+    } else {
+      generate_serialize_field(out, *f_iter, "this->");
+    }
+    // Write field closer
+    indent(out) << "xfer += oprot->writeFieldEnd();" << endl;
+
+    indent_down();
+    indent(out) << "}";
+  }
+
+  // Write the struct map
+  out <<
+    endl <<
+    indent() << "xfer += oprot->writeFieldStop();" << endl <<
+    indent() << "xfer += oprot->writeStructEnd();" << endl <<
+    indent() << "return xfer;" << endl;
+
+  indent_down();
+  indent(out) <<
+    "}" << endl <<
+    endl;
+}
+
+/**
+ * Generates the swap function.
+ *
+ * @param out Stream to write to
+ * @param tstruct The struct
+ */
+void t_cpp_generator::generate_struct_swap(ofstream& out, t_struct* tstruct) {
+  out <<
+    indent() << "void swap(" << tstruct->get_name() << " &a, " <<
+    tstruct->get_name() << " &b) {" << endl;
+  indent_up();
+
+  // Let argument-dependent name lookup find the correct swap() function to
+  // use based on the argument types.  If none is found in the arguments'
+  // namespaces, fall back to ::std::swap().
+  out <<
+    indent() << "using ::std::swap;" << endl;
+
+  bool has_nonrequired_fields = false;
+  const vector<t_field*>& fields = tstruct->get_members();
+  for (vector<t_field*>::const_iterator f_iter = fields.begin();
+       f_iter != fields.end();
+       ++f_iter) {
+    t_field *tfield = *f_iter;
+
+    if (tfield->get_req() != t_field::T_REQUIRED) {
+      has_nonrequired_fields = true;
+    }
+
+    out <<
+      indent() << "swap(a." << tfield->get_name() <<
+      ", b." << tfield->get_name() << ");" << endl;
+  }
+
+  if (has_nonrequired_fields) {
+    out <<
+      indent() << "swap(a.__isset, b.__isset);" << endl;
+  }
+  if (gen_delta_) {
+    out <<
+      indent() << "swap(a.__dirty, b.__dirty);" << endl;
+  }
+
+  // handle empty structs
+  if (fields.size() == 0) {
+    out <<
+      indent() << "(void) a;" << endl;
+    out <<
+      indent() << "(void) b;" << endl;
+  }
+
+  scope_down(out);
+  out << endl;
+}
+
+/**
+ * Generates __clear() for the reuse option, inline in the struct: it puts
+ * every field back as a fresh struct has it, but clears strings,
+ * containers and structs in place so they keep their storage.
+ */
+void t_cpp_generator::generate_struct_clear(ofstream& out, t_struct* tstruct) {
+  const vector<t_field*>& members = tstruct->get_members();
+  vector<t_field*>::const_iterator m_iter;
+
+  indent(out) << "void __clear() {" << endl;
+  indent_up();
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    generate_field_reset(out, *m_iter);
+  }
+  indent_down();
+  indent(out) << "}" << endl << endl;
+}
+
+/**
+ * Puts one field, and its __isset flag, back to its default, in place
+ * where it has a clear().
+ */
+void t_cpp_generator::generate_field_reset(ofstream& out, t_field* tfield) {
+  string name = "this->" + tfield->get_name();
+  t_type* t = get_true_type(tfield->get_type());
+  t_const_value* cv = tfield->get_value();
+
+  if (is_lazy(tfield)) {
+    indent(out) << name << " = ::apache::thrift::TLazy<" <<
+      template_arg(type_name(tfield->get_type())) << " >();" << endl;
+  } else if (!is_overwritten_by_read(tfield->get_type()) ||
+             (t->is_base_type() && t->annotations_.count("cpp.type") != 0) ||
+             is_string_view(t)) {
+    // Nothing of it to keep, or no clear() to keep it with
+    indent(out) << name << " = " << type_name(tfield->get_type()) << "();" << endl;
+    if (cv != NULL) {
+      print_const_value(out, name, t, cv);
+    }
+  } else if (t->is_string() || t->is_container()) {
+    indent(out) << name << ".clear();" << endl;
+    if (cv != NULL) {
+      print_const_value(out, name, t, cv);
+    }
+  } else if (t->is_struct() || t->is_xception()) {
+    indent(out) << name << ".__clear();" << endl;
+    if (cv != NULL) {
+      print_const_value(out, name, t, cv);
+    }
+  } else {
+    string dval = t->is_enum() ? "(" + type_name(t) + ")0" : "0";
+    if (cv != NULL) {
+      dval = render_const_value(out, tfield->get_name(), t, cv);
+    }
+    indent(out) << name << " = " << dval << ";" << endl;
+  }
+
+  if (tfield->get_req() != t_field::T_REQUIRED) {
+    indent(out) << "this->__isset." << tfield->get_name() << " = " <<
+      (cv != NULL ? "true" : "false") << ";" << endl;
+  }
+}
+
+/**
+ * Generates the hash_value() of a struct for the unordered option, which
+ * boost::hash finds.  It takes in only what operator== compares, so that
+ * equal structs hash alike: optional fields only when set, and no maps or
+ * sets, whose order is their own.
+ */
+void t_cpp_generator::generate_struct_hash(ofstream& out, t_struct* tstruct) {
+  const vector<t_field*>& fields = tstruct->get_members();
+  vector<t_field*>::const_iterator f_iter;
+  bool hashed = false;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    hashed = hashed || (is_hashable((*f_iter)->get_type()) && !is_lazy(*f_iter));
+  }
+
+  out <<
+    indent() << "std::size_t hash_value(const " << tstruct->get_name() << "& " <<
+      (hashed ? "v" : "/* v */") << ") {" << endl;
+  indent_up();
+  indent(out) << "std::size_t seed = 0;" << endl;
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    if (!is_hashable((*f_iter)->get_type()) || is_lazy(*f_iter)) {
+      continue;
+    }
+    string name = "v." + (*f_iter)->get_name();
+    if ((*f_iter)->get_req() == t_field::T_OPTIONAL) {
+      indent(out) << "if (v.__isset." << (*f_iter)->get_name() << ") ";
+    } else {
+      indent(out);
+    }
+    if (get_true_type((*f_iter)->get_type())->is_list()) {
+      out << "::boost::hash_range(seed, " << name << ".begin(), " << name << ".end());" << endl;
+    } else {
+      out << "::boost::hash_combine(seed, " << name << ");" << endl;
+    }
+  }
+  indent(out) << "return seed;" << endl;
+  scope_down(out);
+  out << endl;
+
+  hashed_structs_.push_back(namespace_prefix(program_->get_namespace("cpp")) +
+                            tstruct->get_name());
+}
+
+/**
+ * Generates a thrift service. In C++, this comprises an entirely separate
+ * header and source file. The header file defines the methods and includes
+ * the data types defined in the main header file, and the implementation
+ * file contains implementations of the basic printer and default interfaces.
+ *
+ * @param tservice The service definition
+ */
+void t_cpp_generator::generate_service(t_service* tservice) {
+  string svcname = tservice->get_name();
+  check_method_ids(tservice);
+
+  // Make output files
+  string f_header_name = get_out_dir()+svcname+".h";
+  f_header_.open(f_header_name.c_str());
+
+  // Print header file includes
+  f_header_ <<
+    autogen_comment();
+  f_header_ <<
+    "#ifndef " << svcname << "_H" << endl <<
+    "#define " << svcname << "_H" << endl <<
+    endl;
+  if (gen_cob_style_) {
+    f_header_ <<
+      "#include <thrift/transport/TBufferTransports.h>" << endl << // TMemoryBuffer
+      "#include <thrift/cxxfunctional.h>" << endl <<
+      "namespace apache { namespace thrift { namespace async {" << endl <<
+      "class TAsyncChannel;" << endl <<
+      "}}}" << endl;
+  }
+  f_header_ <<
+    "#include <thrift/TDispatchProcessor.h>" << endl;
+  if (gen_concurrent_client_) {
+    f_header_ <<
+      "#include <thrift/async/TConcurrentClientSyncInfo.h>" << endl;
+  }
+  if (gen_cob_style_) {
+    f_header_ <<
+      "#include <thrift/async/TAsyncDispatchProcessor.h>" << endl;
+  }
+  if (gen_coroutines_) {
+    f_header_ <<
+      "#include <thrift/async/TCoroutine.h>" << endl;
+  }
+  f_header_ <<
+    "#include \"" << get_include_prefix(*get_program()) << program_name_ <<
+    "_types.h\"" << endl;
+
+  t_service* extends_service = tservice->get_extends();
+  if (extends_service != NULL) {
+    f_header_ <<
+      "#include \"" << get_include_prefix(*(extends_service->get_program())) <<
       extends_service->get_name() << ".h\"" << endl;
   }
 
@@ -1672,6 +3674,9 @@ void t_cpp_generator::generate_service(t_service* tservice) {
   generate_service_null(tservice, "");
   generate_service_helpers(tservice);
   generate_service_client(tservice, "");
+  if (gen_concurrent_client_) {
+    generate_service_client(tservice, "Concurrent");
+  }
   generate_service_processor(tservice, "");
   generate_service_multiface(tservice);
   generate_service_skeleton(tservice);
@@ -1686,6 +3691,17 @@ void t_cpp_generator::generate_service(t_service* tservice) {
     generate_service_processor(tservice, "Cob");
     generate_service_async_skeleton(tservice);
   }
+  if (gen_coroutines_) {
+    generate_service_interface(tservice, "CoroSv");
+    generate_service_coro_adapter(tservice);
+  }
+
+  if (gen_templates_) {
+    if (gen_cpp11_) {
+      generate_service_instantiations(f_header_, tservice, true);
+    }
+    generate_service_instantiations(f_service_, tservice, false);
+  }
 
   // Close the namespace
   f_service_ <<
@@ -2037,29 +4053,130 @@ void t_cpp_generator::generate_service_async_skeleton(t_service* tservice) {
   vector<t_function*> functions = tservice->get_functions();
   vector<t_function*>::iterator f_iter;
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
-    f_skeleton <<
-      endl <<
-      indent() << function_signature(*f_iter, "CobSv", "", true) << " {" << endl;
-    indent_up();
-
-    t_type* returntype = (*f_iter)->get_returntype();
-    t_field returnfield(returntype, "_return");
+    f_skeleton <<
+      endl <<
+      indent() << function_signature(*f_iter, "CobSv", "", true) << " {" << endl;
+    indent_up();
+
+    t_type* returntype = (*f_iter)->get_returntype();
+    t_field returnfield(returntype, "_return");
+
+    string target = returntype->is_void() ? "" : "_return";
+    if (!returntype->is_void()) {
+      f_skeleton <<
+        indent() << declare_field(&returnfield, true) << endl;
+    }
+    generate_function_call(f_skeleton, *f_iter, target, "syncHandler_", "");
+    f_skeleton << indent() << "return cob(" << target << ");" << endl;
+
+    scope_down(f_skeleton);
+  }
+  f_skeleton << endl <<
+    " protected:" << endl <<
+    indent() << "std::auto_ptr<" << svcname << "Handler> syncHandler_;" << endl;
+  indent_down();
+  f_skeleton <<
+    "};" << endl << endl;
+}
+
+/**
+ * Generates the CoroSvAdapter, a CobSvIf that runs the coroutines of a
+ * CoroSvIf, so coroutine handlers can be served by the AsyncProcessor.
+ *
+ * @param tservice The service to generate an adapter for.
+ */
+void t_cpp_generator::generate_service_coro_adapter(t_service* tservice) {
+  string adapter_name = service_name_ + "CoroSvAdapter";
+  string iface_name = service_name_ + "CoroSvIf";
+
+  string extends = "";
+  if (tservice->get_extends() != NULL) {
+    extends = type_name(tservice->get_extends()) + "CoroSvAdapter";
+  }
+
+  f_header_ <<
+    "class " << adapter_name << " : virtual public " << service_name_ << "CobSvIf";
+  if (!extends.empty()) {
+    f_header_ << ", public " << extends;
+  }
+  f_header_ <<
+    " {" << endl <<
+    " public:" << endl;
+  indent_up();
+  f_header_ <<
+    indent() << adapter_name << "(const boost::shared_ptr<" << iface_name << ">& iface) :" << endl;
+  if (!extends.empty()) {
+    f_header_ <<
+      indent() << "  " << extends << "(iface)," << endl;
+  }
+  f_header_ <<
+    indent() << "  iface_(iface) {}" << endl <<
+    indent() << "virtual ~" << adapter_name << "() {}" << endl;
+
+  vector<t_function*> functions = tservice->get_functions();
+  vector<t_function*>::iterator f_iter;
+  for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+    const vector<t_field*>& xceptions = (*f_iter)->get_xceptions()->get_members();
+    vector<t_field*>::const_iterator x_iter;
+
+    // The exception callback goes unnamed in CobSv signatures
+    string signature = function_signature(*f_iter, "CobSv");
+    string::size_type exn_cob = signature.find("/* exn_cob */");
+    if (exn_cob != string::npos) {
+      signature.replace(exn_cob, strlen("/* exn_cob */"), "exn_cob");
+    }
 
-    string target = returntype->is_void() ? "" : "_return";
-    if (!returntype->is_void()) {
-      f_skeleton <<
-        indent() << declare_field(&returnfield, true) << endl;
+    f_header_ <<
+      indent() << signature << " {" << endl;
+    indent_up();
+    f_header_ <<
+      indent() << "::apache::thrift::async::startTask(iface_->" <<
+        (*f_iter)->get_name() << "(";
+    const vector<t_field*>& fields = (*f_iter)->get_arglist()->get_members();
+    vector<t_field*>::const_iterator fld_iter;
+    for (fld_iter = fields.begin(); fld_iter != fields.end(); ++fld_iter) {
+      if (fld_iter != fields.begin()) {
+        f_header_ << ", ";
+      }
+      f_header_ << (*fld_iter)->get_name();
     }
-    generate_function_call(f_skeleton, *f_iter, target, "syncHandler_", "");
-    f_skeleton << indent() << "return cob(" << target << ");" << endl;
+    f_header_ << "), cob";
 
-    scope_down(f_skeleton);
+    if (xceptions.empty()) {
+      // Nothing to tell the client with, so startTask logs the exception
+      f_header_ << ");" << endl;
+    } else {
+      f_header_ <<
+        ", [exn_cob](std::exception_ptr _error) {" << endl;
+      indent_up();
+      f_header_ <<
+        indent() << "try {" << endl <<
+        indent() << "  std::rethrow_exception(_error);" << endl <<
+        indent() << "}";
+      for (x_iter = xceptions.begin(); x_iter != xceptions.end(); ++x_iter) {
+        f_header_ <<
+          " catch (const " << type_name((*x_iter)->get_type()) << "& _x) {" << endl <<
+          indent() << "  exn_cob(::apache::thrift::TDelayedException::delayException(_x));" << endl <<
+          indent() << "}";
+      }
+      f_header_ <<
+        " catch (const std::exception& _x) {" << endl <<
+        indent() << "  exn_cob(::apache::thrift::TDelayedException::delayException(" <<
+          "::apache::thrift::TApplicationException(_x.what())));" << endl <<
+        indent() << "}" << endl;
+      indent_down();
+      f_header_ <<
+        indent() << "});" << endl;
+    }
+    indent_down();
+    f_header_ <<
+      indent() << "}" << endl;
   }
-  f_skeleton << endl <<
-    " protected:" << endl <<
-    indent() << "std::auto_ptr<" << svcname << "Handler> syncHandler_;" << endl;
   indent_down();
-  f_skeleton <<
+
+  f_header_ <<
+    " protected:" << endl <<
+    "  boost::shared_ptr<" << iface_name << "> iface_;" << endl <<
     "};" << endl << endl;
 }
 
@@ -2344,17 +4461,32 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
     indent(f_header_) << function_signature(*f_iter, ifstyle) << ";" << endl;
     // TODO(dreiss): Use private inheritance to avoid generating thise in cob-style.
-    t_function send_function(g_type_void,
+    // The concurrent client's send_ returns the seqid its recv_ waits for.
+    t_function send_function(style == "Concurrent" ? g_type_i32 : g_type_void,
         string("send_") + (*f_iter)->get_name(),
         (*f_iter)->get_arglist());
     indent(f_header_) << function_signature(&send_function, "") << ";" << endl;
     if (!(*f_iter)->is_oneway()) {
       t_struct noargs(program_);
+      t_field seqid_arg(g_type_i32, "seqid");
+      if (style == "Concurrent") {
+        noargs.append(&seqid_arg);
+      }
       t_function recv_function((*f_iter)->get_returntype(),
           string("recv_") + (*f_iter)->get_name(),
           &noargs);
       indent(f_header_) << function_signature(&recv_function, "") << ";" << endl;
     }
+    if (style == "Cob" && gen_coroutines_) {
+      // Awaitable versions; co_recv_ is the coroutine co_ sends and returns
+      t_type* returntype = (*f_iter)->get_returntype();
+      indent(f_header_) << task_type(returntype) << " co_" << (*f_iter)->get_name() <<
+        "(" << argument_list((*f_iter)->get_arglist()) << ");" << endl;
+      if (!(*f_iter)->is_oneway()) {
+        indent(f_header_) << task_type(returntype) << " co_recv_" <<
+          (*f_iter)->get_name() << "();" << endl;
+      }
+    }
   }
   indent_down();
 
@@ -2368,12 +4500,20 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
         indent() << "boost::shared_ptr< ::apache::thrift::async::TAsyncChannel> channel_;"  << endl <<
         indent() << "boost::shared_ptr< ::apache::thrift::transport::TMemoryBuffer> itrans_;"  << endl <<
         indent() << "boost::shared_ptr< ::apache::thrift::transport::TMemoryBuffer> otrans_;"  << endl;
+      if (gen_coroutines_) {
+        f_header_ <<
+          indent() << "::apache::thrift::async::TCoroutineFramePool framePool_;" << endl;
+      }
     }
     f_header_ <<
       indent() << prot_ptr << " piprot_;"  << endl <<
       indent() << prot_ptr << " poprot_;"  << endl <<
       indent() << protocol_type << "* iprot_;"  << endl <<
       indent() << protocol_type << "* oprot_;"  << endl;
+    if (style == "Concurrent") {
+      f_header_ <<
+        indent() << "::apache::thrift::async::TConcurrentClientSyncInfo sync_;" << endl;
+    }
 
     indent_down();
   }
@@ -2405,7 +4545,11 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
     indent(out) <<
       function_signature(*f_iter, ifstyle, scope) << endl;
     scope_up(out);
-    indent(out) <<
+    indent(out);
+    if (style == "Concurrent" && !(*f_iter)->is_oneway()) {
+      out << "int32_t seqid = ";
+    }
+    out <<
       "send_" << funname << "(";
 
     // Get the struct of function call params
@@ -2427,16 +4571,18 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
     if (style != "Cob") {
       if (!(*f_iter)->is_oneway()) {
+        string seqid_param = (style == "Concurrent") ? "seqid" : "";
         out << indent();
         if (!(*f_iter)->get_returntype()->is_void()) {
           if (is_complex_type((*f_iter)->get_returntype())) {
-            out << "recv_" << funname << "(_return);" << endl;
+            out << "recv_" << funname << "(_return" <<
+              (seqid_param.empty() ? "" : ", ") << seqid_param << ");" << endl;
           } else {
-            out << "return recv_" << funname << "();" << endl;
+            out << "return recv_" << funname << "(" << seqid_param << ");" << endl;
           }
         } else {
           out <<
-            "recv_" << funname << "();" << endl;
+            "recv_" << funname << "(" << seqid_param << ");" << endl;
         }
       }
     } else {
@@ -2454,10 +4600,14 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
     scope_down(out);
     out << endl;
 
+    if (style == "Cob" && gen_coroutines_) {
+      generate_coro_client_functions(out, *f_iter, scope, template_header, _this);
+    }
+
     //if (style != "Cob") // TODO(dreiss): Libify the client and don't generate this for cob-style
     if (true) {
       // Function for sending
-      t_function send_function(g_type_void,
+      t_function send_function(style == "Concurrent" ? g_type_i32 : g_type_void,
                                string("send_") + (*f_iter)->get_name(),
                                (*f_iter)->get_arglist());
 
@@ -2473,11 +4623,27 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       string argsname = tservice->get_name() + "_" + (*f_iter)->get_name() + "_pargs";
       string resultname = tservice->get_name() + "_" + (*f_iter)->get_name() + "_presult";
 
-      // Serialize the request
+      // Serialize the request.  Oneway calls get no reply, so the
+      // concurrent client doesn't register a seqid for them.
+      if (style == "Concurrent" && !(*f_iter)->is_oneway()) {
+        out <<
+          indent() << "int32_t cseqid = " << _this << "sync_.generateSeqId();" << endl;
+      } else {
+        out <<
+          indent() << "int32_t cseqid = 0;" << endl;
+      }
+      if (style == "Concurrent") {
+        out <<
+          indent() << "::apache::thrift::async::TConcurrentSendSentry sentry(&" <<
+          _this << "sync_);" << endl;
+      }
+      string wire_name = (*f_iter)->get_name();
+      if (gen_method_ids_ && !method_id(*f_iter).empty()) {
+        wire_name = method_id(*f_iter);
+      }
       out <<
-        indent() << "int32_t cseqid = 0;" << endl <<
         indent() << _this << "oprot_->writeMessageBegin(\"" <<
-        (*f_iter)->get_name() <<
+        wire_name <<
         "\", ::apache::thrift::protocol::T_CALL, cseqid);" << endl <<
         endl <<
         indent() << argsname << " args;" << endl;
@@ -2494,11 +4660,21 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
         indent() << _this << "oprot_->getTransport()->writeEnd();" << endl <<
         indent() << _this << "oprot_->getTransport()->flush();" << endl;
 
+      if (style == "Concurrent") {
+        out <<
+          endl <<
+          indent() << "sentry.commit();" << endl <<
+          indent() << "return cseqid;" << endl;
+      }
+
       scope_down(out);
       out << endl;
 
       // Generate recv function only if not an oneway function
-      if (!(*f_iter)->is_oneway()) {
+      if (!(*f_iter)->is_oneway() && style == "Concurrent") {
+        generate_concurrent_recv_function(out, tservice, *f_iter, scope,
+                                          template_header, _this);
+      } else if (!(*f_iter)->is_oneway()) {
         t_struct noargs(program_);
         t_function recv_function((*f_iter)->get_returntype(),
                                  string("recv_") + (*f_iter)->get_name(),
@@ -2666,6 +4842,153 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
   }
 }
 
+/**
+ * Generates the recv_ function of the concurrent client.  The caller holds
+ * the read side of the connection until it has read its own reply, handing
+ * replies that belong to other calls to their owners.
+ */
+void t_cpp_generator::generate_concurrent_recv_function(std::ofstream& out,
+                                                        t_service* tservice,
+                                                        t_function* tfunction,
+                                                        const string& scope,
+                                                        const string& template_header,
+                                                        const string& _this) {
+  string resultname = tservice->get_name() + "_" + tfunction->get_name() + "_presult";
+
+  t_struct seqid_args(program_);
+  t_field seqid_arg(g_type_i32, "seqid");
+  seqid_args.append(&seqid_arg);
+  t_function recv_function(tfunction->get_returntype(),
+                           string("recv_") + tfunction->get_name(),
+                           &seqid_args);
+  if (gen_templates_) {
+    indent(out) << template_header;
+  }
+  indent(out) <<
+    function_signature(&recv_function, "", scope) << endl;
+  scope_up(out);
+
+  out <<
+    endl <<
+    indent() << "int32_t rseqid = 0;" << endl <<
+    indent() << "std::string fname;" << endl <<
+    indent() << "::apache::thrift::protocol::TMessageType mtype;" << endl <<
+    endl <<
+    indent() << "// the read mutex gets dropped and reacquired as part of waitForWork()" << endl <<
+    indent() << "// The destructor of this sentry wakes up other clients" << endl <<
+    indent() << "::apache::thrift::async::TConcurrentRecvSentry sentry(&" <<
+    _this << "sync_, seqid);" << endl <<
+    endl <<
+    indent() << "while (true) {" << endl;
+  indent_up();
+
+  out <<
+    indent() << "if (!" << _this << "sync_.getPending(fname, mtype, rseqid)) {" << endl <<
+    indent() << "  " << _this << "iprot_->readMessageBegin(fname, mtype, rseqid);" << endl <<
+    indent() << "}" << endl <<
+    indent() << "if (seqid == rseqid) {" << endl;
+  indent_up();
+
+  out <<
+    indent() << "if (mtype == ::apache::thrift::protocol::T_EXCEPTION) {" << endl <<
+    indent() << "  ::apache::thrift::TApplicationException x;" << endl <<
+    indent() << "  x.read(" << _this << "iprot_);" << endl <<
+    indent() << "  " << _this << "iprot_->readMessageEnd();" << endl <<
+    indent() << "  " << _this << "iprot_->getTransport()->readEnd();" << endl <<
+    indent() << "  sentry.commit();" << endl <<
+    indent() << "  throw x;" << endl <<
+    indent() << "}" << endl <<
+    indent() << "if (mtype != ::apache::thrift::protocol::T_REPLY) {" << endl <<
+    indent() << "  " << _this << "iprot_->skip(::apache::thrift::protocol::T_STRUCT);" << endl <<
+    indent() << "  " << _this << "iprot_->readMessageEnd();" << endl <<
+    indent() << "  " << _this << "iprot_->getTransport()->readEnd();" << endl <<
+    indent() << "}" << endl <<
+    indent() << "if (fname.compare(\"" << tfunction->get_name() << "\") != 0) {" << endl <<
+    indent() << "  " << _this << "iprot_->skip(::apache::thrift::protocol::T_STRUCT);" << endl <<
+    indent() << "  " << _this << "iprot_->readMessageEnd();" << endl <<
+    indent() << "  " << _this << "iprot_->getTransport()->readEnd();" << endl <<
+    endl <<
+    indent() << "  // in a bad state, don't commit" << endl <<
+    indent() << "  throw ::apache::thrift::protocol::TProtocolException(" <<
+    "::apache::thrift::protocol::TProtocolException::INVALID_DATA);" << endl <<
+    indent() << "}" << endl;
+
+  if (!tfunction->get_returntype()->is_void() &&
+      !is_complex_type(tfunction->get_returntype())) {
+    t_field returnfield(tfunction->get_returntype(), "_return");
+    out <<
+      indent() << declare_field(&returnfield) << endl;
+  }
+
+  out <<
+    indent() << resultname << " result;" << endl;
+
+  if (!tfunction->get_returntype()->is_void()) {
+    out <<
+      indent() << "result.success = &_return;" << endl;
+  }
+
+  out <<
+    indent() << "result.read(" << _this << "iprot_);" << endl <<
+    indent() << _this << "iprot_->readMessageEnd();" << endl <<
+    indent() << _this << "iprot_->getTransport()->readEnd();" << endl <<
+    endl;
+
+  // Careful, only look for _result if not a void function
+  if (!tfunction->get_returntype()->is_void()) {
+    out <<
+      indent() << "if (result.__isset.success) {" << endl;
+    if (is_complex_type(tfunction->get_returntype())) {
+      out <<
+        indent() << "  // _return pointer has now been filled" << endl <<
+        indent() << "  sentry.commit();" << endl <<
+        indent() << "  return;" << endl;
+    } else {
+      out <<
+        indent() << "  sentry.commit();" << endl <<
+        indent() << "  return _return;" << endl;
+    }
+    out <<
+      indent() << "}" << endl;
+  }
+
+  const std::vector<t_field*>& xceptions = tfunction->get_xceptions()->get_members();
+  vector<t_field*>::const_iterator x_iter;
+  for (x_iter = xceptions.begin(); x_iter != xceptions.end(); ++x_iter) {
+    out <<
+      indent() << "if (result.__isset." << (*x_iter)->get_name() << ") {" << endl <<
+      indent() << "  sentry.commit();" << endl <<
+      indent() << "  throw result." << (*x_iter)->get_name() << ";" << endl <<
+      indent() << "}" << endl;
+  }
+
+  // We only get here if we are a void function
+  if (tfunction->get_returntype()->is_void()) {
+    out <<
+      indent() << "sentry.commit();" << endl <<
+      indent() << "return;" << endl;
+  } else {
+    out <<
+      indent() << "// in a bad state, don't commit" << endl <<
+      indent() << "throw ::apache::thrift::TApplicationException(::apache::thrift::TApplicationException::MISSING_RESULT, \"" << tfunction->get_name() << " failed: unknown result\");" << endl;
+  }
+
+  indent_down();
+  out <<
+    indent() << "}" << endl <<
+    indent() << "// seqid != rseqid" << endl <<
+    indent() << _this << "sync_.updatePending(fname, mtype, rseqid);" << endl <<
+    endl <<
+    indent() << "// this will temporarily unlock the readMutex, and let other clients get work done" << endl <<
+    indent() << _this << "sync_.waitForWork(seqid);" << endl;
+  indent_down();
+  out <<
+    indent() << "} // end while(true)" << endl;
+
+  scope_down(out);
+  out << endl;
+}
+
 class ProcessorGenerator {
  public:
   ProcessorGenerator(t_cpp_generator* generator, t_service* service,
@@ -2688,6 +5011,8 @@ class ProcessorGenerator {
 
   void generate_class_definition();
   void generate_dispatch_call(bool template_protocol);
+  void generate_dispatch_compares(const vector<std::pair<string, t_function*> >& names,
+                                  const string& call_return);
   void generate_process_functions();
   void generate_factory();
 
@@ -2835,39 +5160,6 @@ void ProcessorGenerator::generate_class_definition() {
     " private:" << endl;
   indent_up();
 
-  // Declare processMap_
-  f_header_ <<
-    indent() << "typedef  void (" << class_name_ << "::*" <<
-      "ProcessFunction)(" << finish_cob_decl_ << "int32_t, " <<
-      "::apache::thrift::protocol::TProtocol*, " <<
-      "::apache::thrift::protocol::TProtocol*" << call_context_decl_ << ");" <<
-      endl;
-  if (generator_->gen_templates_) {
-    f_header_ <<
-      indent() << "typedef void (" << class_name_ << "::*" <<
-        "SpecializedProcessFunction)(" << finish_cob_decl_ << "int32_t, " <<
-        "Protocol_*, Protocol_*" << call_context_decl_ << ");" <<
-        endl <<
-      indent() << "struct ProcessFunctions {" << endl <<
-      indent() << "  ProcessFunction generic;" << endl <<
-      indent() << "  SpecializedProcessFunction specialized;" << endl <<
-      indent() << "  ProcessFunctions(ProcessFunction g, " <<
-        "SpecializedProcessFunction s) :" << endl <<
-      indent() << "    generic(g)," << endl <<
-      indent() << "    specialized(s) {}" << endl <<
-      indent() << "  ProcessFunctions() : generic(NULL), specialized(NULL) " <<
-        "{}" << endl <<
-      indent() << "};" << endl <<
-      indent() << "typedef std::map<std::string, ProcessFunctions> " <<
-        "ProcessMap;" << endl;
-  } else {
-    f_header_ <<
-      indent() << "typedef std::map<std::string, ProcessFunction> " <<
-        "ProcessMap;" << endl;
-  }
-  f_header_ <<
-    indent() << "ProcessMap processMap_;" << endl;
-
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
     indent(f_header_) <<
       "void process_" << (*f_iter)->get_name() << "(" << finish_cob_ << "int32_t seqid, ::apache::thrift::protocol::TProtocol* iprot, ::apache::thrift::protocol::TProtocol* oprot" << call_context_ << ");" << endl;
@@ -2918,32 +5210,7 @@ void ProcessorGenerator::generate_class_definition() {
       indent() << "  " << extends_ << "(iface)," << endl;
   }
   f_header_ <<
-    indent() << "  iface_(iface) {" << endl;
-  indent_up();
-
-  for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
-    f_header_ <<
-      indent() << "processMap_[\"" << (*f_iter)->get_name() << "\"] = ";
-    if (generator_->gen_templates_) {
-      f_header_ << "ProcessFunctions(" << endl;
-      if (generator_->gen_templates_only_) {
-        indent(f_header_) << "  NULL," << endl;
-      } else {
-        indent(f_header_) << "  &" << class_name_ << "::process_" <<
-          (*f_iter)->get_name() << "," << endl;
-      }
-      indent(f_header_) << "  &" << class_name_ << "::process_" <<
-        (*f_iter)->get_name() << ")";
-    } else {
-      f_header_ << "&" << class_name_ << "::process_" << (*f_iter)->get_name();
-    }
-    f_header_ <<
-      ";" << endl;
-  }
-
-  indent_down();
-  f_header_ <<
-    indent() << "}" << endl <<
+    indent() << "  iface_(iface) {}" << endl <<
     endl <<
     indent() << "virtual ~" << class_name_ << "() {}" << endl;
   indent_down();
@@ -2991,59 +5258,111 @@ void ProcessorGenerator::generate_dispatch_call(bool template_protocol) {
     endl;
   indent_up();
 
-  // HOT: member function pointer map
-  f_out_ <<
-    indent() << typename_str_ << "ProcessMap::iterator pfn;" << endl <<
-    indent() << "pfn = processMap_.find(fname);" << endl <<
-    indent() << "if (pfn == processMap_.end()) {" << endl;
-  if (extends_.empty()) {
+  string call_return = (style_ == "Cob" ? "return;" : "return true;");
+  if (generator_->gen_templates_only_ && !template_protocol) {
+    // Only the specialized process functions are instantiated
     f_out_ <<
-      indent() << "  iprot->skip(::apache::thrift::protocol::T_STRUCT);" << endl <<
-      indent() << "  iprot->readMessageEnd();" << endl <<
-      indent() << "  iprot->getTransport()->readEnd();" << endl <<
-      indent() << "  ::apache::thrift::TApplicationException x(::apache::thrift::TApplicationException::UNKNOWN_METHOD, \"Invalid method name: '\"+fname+\"'\");" << endl <<
-      indent() << "  oprot->writeMessageBegin(fname, ::apache::thrift::protocol::T_EXCEPTION, seqid);" << endl <<
-      indent() << "  x.write(oprot);" << endl <<
-      indent() << "  oprot->writeMessageEnd();" << endl <<
-      indent() << "  oprot->getTransport()->writeEnd();" << endl <<
-      indent() << "  oprot->getTransport()->flush();" << endl <<
-      indent() << (style_ == "Cob" ? "  return cob(true);" : "  return true;") << endl;
-  } else {
+      indent() << "(void) " << (style_ == "Cob" ? "cob; (void) " : "") <<
+        "iprot; (void) oprot; (void) fname; (void) seqid;" << endl;
+    if (style_ != "Cob") {
+      f_out_ <<
+        indent() << "(void) callContext;" << endl;
+    }
     f_out_ <<
-      indent() << "  return "
-               << extends_ << "::dispatchCall("
-               << (style_ == "Cob" ? "cob, " : "")
-               << "iprot, oprot, fname, seqid" << call_context_arg_ << ");" << endl;
+      indent() << "throw ::apache::thrift::TApplicationException(" <<
+        "::apache::thrift::TApplicationException::INVALID_PROTOCOL, " <<
+        "\"" << class_name_ << " was generated for templated protocols only\");" << endl;
+    indent_down();
+    f_out_ <<
+      "}" << endl <<
+      endl;
+    return;
   }
-  f_out_ <<
-    indent() << "}" << endl;
-  if (template_protocol) {
+
+  // HOT: switch on the name's length and then its most telling character,
+  // laid out here, so that a call costs one string comparison
+  std::map<size_t, vector<std::pair<string, t_function*> > > by_length;
+  vector<t_function*> functions = service_->get_functions();
+  vector<t_function*>::iterator f_iter;
+  for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+    string name = (*f_iter)->get_name();
+    by_length[name.size()].push_back(std::make_pair(name, *f_iter));
+    string id = generator_->method_id(*f_iter);
+    if (!id.empty()) {
+      by_length[id.size()].push_back(std::make_pair(id, *f_iter));
+    }
+  }
+
+  if (!by_length.empty()) {
     f_out_ <<
-      indent() << "(this->*(pfn->second.specialized))";
-  } else {
-    if (generator_->gen_templates_only_) {
-      // TODO: This is a null pointer, so nothing good will come from calling
-      // it.  Throw an exception instead.
-      f_out_ <<
-        indent() << "(this->*(pfn->second.generic))";
-    } else if (generator_->gen_templates_) {
+      indent() << "switch (fname.size()) {" << endl;
+    std::map<size_t, vector<std::pair<string, t_function*> > >::iterator l_iter;
+    for (l_iter = by_length.begin(); l_iter != by_length.end(); ++l_iter) {
+      vector<std::pair<string, t_function*> >& names = l_iter->second;
       f_out_ <<
-        indent() << "(this->*(pfn->second.generic))";
-    } else {
+        indent() << "case " << l_iter->first << ":" << endl;
+      indent_up();
+      if (names.size() <= 2) {
+        generate_dispatch_compares(names, call_return);
+      } else {
+        // The position where the names differ most
+        size_t best = 0;
+        size_t best_count = 0;
+        for (size_t pos = 0; pos < l_iter->first; ++pos) {
+          std::set<char> chars;
+          for (size_t i = 0; i < names.size(); ++i) {
+            chars.insert(names[i].first[pos]);
+          }
+          if (chars.size() > best_count) {
+            best = pos;
+            best_count = chars.size();
+          }
+        }
+        std::map<char, vector<std::pair<string, t_function*> > > by_char;
+        for (size_t i = 0; i < names.size(); ++i) {
+          by_char[names[i].first[best]].push_back(names[i]);
+        }
+        f_out_ <<
+          indent() << "switch (fname[" << best << "]) {" << endl;
+        std::map<char, vector<std::pair<string, t_function*> > >::iterator c_iter;
+        for (c_iter = by_char.begin(); c_iter != by_char.end(); ++c_iter) {
+          f_out_ <<
+            indent() << "case '" << c_iter->first << "':" << endl;
+          indent_up();
+          generate_dispatch_compares(c_iter->second, call_return);
+          f_out_ <<
+            indent() << "break;" << endl;
+          indent_down();
+        }
+        f_out_ <<
+          indent() << "}" << endl;
+      }
       f_out_ <<
-        indent() << "(this->*(pfn->second))";
+        indent() << "break;" << endl;
+      indent_down();
     }
+    f_out_ <<
+      indent() << "}" << endl;
   }
-  f_out_ << "(" << cob_arg_ << "seqid, iprot, oprot" <<
-    call_context_arg_ << ");" << endl;
 
-  // TODO(dreiss): return pfn ret?
-  if (style_ == "Cob") {
+  if (extends_.empty()) {
     f_out_ <<
-      indent() << "return;" << endl;
+      indent() << "iprot->skip(::apache::thrift::protocol::T_STRUCT);" << endl <<
+      indent() << "iprot->readMessageEnd();" << endl <<
+      indent() << "iprot->getTransport()->readEnd();" << endl <<
+      indent() << "::apache::thrift::TApplicationException x(::apache::thrift::TApplicationException::UNKNOWN_METHOD, \"Invalid method name: '\"+fname+\"'\");" << endl <<
+      indent() << "oprot->writeMessageBegin(fname, ::apache::thrift::protocol::T_EXCEPTION, seqid);" << endl <<
+      indent() << "x.write(oprot);" << endl <<
+      indent() << "oprot->writeMessageEnd();" << endl <<
+      indent() << "oprot->getTransport()->writeEnd();" << endl <<
+      indent() << "oprot->getTransport()->flush();" << endl <<
+      indent() << (style_ == "Cob" ? "return cob(true);" : "return true;") << endl;
   } else {
     f_out_ <<
-      indent() << "return true;" << endl;
+      indent() << "return "
+               << extends_ << "::dispatchCall" << function_suffix << "("
+               << (style_ == "Cob" ? "cob, " : "")
+               << "iprot, oprot, fname, seqid" << call_context_arg_ << ");" << endl;
   }
 
   indent_down();
@@ -3052,6 +5371,23 @@ void ProcessorGenerator::generate_dispatch_call(bool template_protocol) {
     endl;
 }
 
+/**
+ * Generates the comparisons of fname against each of names, calling the
+ * process function of the one it matches.
+ */
+void ProcessorGenerator::generate_dispatch_compares(
+    const vector<std::pair<string, t_function*> >& names,
+    const string& call_return) {
+  for (size_t i = 0; i < names.size(); ++i) {
+    f_out_ <<
+      indent() << "if (fname == \"" << names[i].first << "\") {" << endl <<
+      indent() << "  process_" << names[i].second->get_name() << "(" << cob_arg_ <<
+        "seqid, iprot, oprot" << call_context_arg_ << ");" << endl <<
+      indent() << "  " << call_return << endl <<
+      indent() << "}" << endl;
+  }
+}
+
 void ProcessorGenerator::generate_process_functions() {
   vector<t_function*> functions = service_->get_functions();
   vector<t_function*>::iterator f_iter;
@@ -3132,6 +5468,84 @@ void ProcessorGenerator::generate_factory() {
     indent() << "}" << endl;
 }
 
+/**
+ * Generates the awaitable co_ function of a cob-style client, which sends
+ * the call right away, and the co_recv_ coroutine it returns, which hands
+ * the request to the channel and reads the response once it is back.
+ */
+void t_cpp_generator::generate_coro_client_functions(std::ofstream& out,
+                                                     t_function* tfunction,
+                                                     const string& scope,
+                                                     const string& template_header,
+                                                     const string& _this) {
+  string funname = tfunction->get_name();
+  t_type* returntype = tfunction->get_returntype();
+
+  if (gen_templates_) {
+    indent(out) << template_header;
+  }
+  indent(out) <<
+    task_type(returntype) << " " << scope << "co_" << funname << "(" <<
+    argument_list(tfunction->get_arglist()) << ")" << endl;
+  scope_up(out);
+  out <<
+    indent() << "// The call's coroutine frames come from the client's pool" << endl <<
+    indent() << "::apache::thrift::async::TCoroutineFramePoolScope scope(" <<
+      _this << "framePool_);" << endl <<
+    indent() << "// Drop the previous call's request, still in the buffer" << endl <<
+    indent() << _this << "otrans_->resetBuffer();" << endl <<
+    indent() << "send_" << funname << "(";
+  const vector<t_field*>& fields = tfunction->get_arglist()->get_members();
+  vector<t_field*>::const_iterator fld_iter;
+  for (fld_iter = fields.begin(); fld_iter != fields.end(); ++fld_iter) {
+    if (fld_iter != fields.begin()) {
+      out << ", ";
+    }
+    out << (*fld_iter)->get_name();
+  }
+  out << ");" << endl;
+  if (tfunction->is_oneway()) {
+    out <<
+      indent() << "return ::apache::thrift::async::sendOneway(" <<
+        _this << "channel_.get(), " << _this << "otrans_.get());" << endl;
+  } else {
+    out <<
+      indent() << "return co_recv_" << funname << "();" << endl;
+  }
+  scope_down(out);
+  out << endl;
+
+  if (tfunction->is_oneway()) {
+    return;
+  }
+
+  if (gen_templates_) {
+    indent(out) << template_header;
+  }
+  indent(out) <<
+    task_type(returntype) << " " << scope << "co_recv_" << funname << "()" << endl;
+  scope_up(out);
+  out <<
+    indent() << "co_await ::apache::thrift::async::TChannelCall(" <<
+      _this << "channel_.get(), " << _this << "otrans_.get(), " <<
+      _this << "itrans_.get());" << endl;
+  if (returntype->is_void()) {
+    out <<
+      indent() << "recv_" << funname << "();" << endl;
+  } else if (is_complex_type(returntype)) {
+    t_field returnfield(returntype, "_return");
+    out <<
+      indent() << declare_field(&returnfield) << endl <<
+      indent() << "recv_" << funname << "(_return);" << endl <<
+      indent() << "co_return _return;" << endl;
+  } else {
+    out <<
+      indent() << "co_return recv_" << funname << "();" << endl;
+  }
+  scope_down(out);
+  out << endl;
+}
+
 /**
  * Generates a service processor definition.
  *
@@ -3577,7 +5991,7 @@ void t_cpp_generator::generate_process_function(t_service* tservice,
         // and we only do a write with this struct, which is const-safe.
         out <<
           indent() << "result.success = const_cast<" <<
-            type_name(tfunction->get_returntype()) << "*>(&_return);" <<
+            template_arg(type_name(tfunction->get_returntype())) << "*>(&_return);" <<
             endl <<
           indent() << "result.__isset.success = true;" << endl;
       }
@@ -3819,6 +6233,11 @@ void t_cpp_generator::generate_deserialize_field(ofstream& out,
                                                  t_field* tfield,
                                                  string prefix,
                                                  string suffix) {
+  if (is_streamed(tfield->get_type())) {
+    indent(out) << "xfer += " << prefix << tfield->get_name() << suffix << ".read(iprot);" << endl;
+    return;
+  }
+
   t_type* type = get_true_type(tfield->get_type());
 
   if (type->is_void()) {
@@ -3842,10 +6261,10 @@ void t_cpp_generator::generate_deserialize_field(ofstream& out,
       break;
     case t_base_type::TYPE_STRING:
       if (((t_base_type*)type)->is_binary()) {
-        out << "readBinary(" << name << ");";
+        out << (is_string_view(type) ? "readBinaryView(" : "readBinary(") << name << ");";
       }
       else {
-        out << "readString(" << name << ");";
+        out << (is_string_view(type) ? "readStringView(" : "readString(") << name << ");";
       }
       break;
     case t_base_type::TYPE_BOOL:
@@ -3897,308 +6316,1032 @@ void t_cpp_generator::generate_deserialize_struct(ofstream& out,
     "xfer += " << prefix << ".read(iprot);" << endl;
 }
 
-void t_cpp_generator::generate_deserialize_container(ofstream& out,
-                                                     t_type* ttype,
-                                                     string prefix) {
+void t_cpp_generator::generate_deserialize_container(ofstream& out,
+                                                     t_type* ttype,
+                                                     string prefix) {
+  scope_up(out);
+
+  string size = tmp("_size");
+  string ktype = tmp("_ktype");
+  string vtype = tmp("_vtype");
+  string etype = tmp("_etype");
+
+  t_container* tcontainer = (t_container*)ttype;
+  bool use_push = tcontainer->has_cpp_name();
+
+  // A vector read into a reused object keeps the elements it can, which
+  // hold on to their strings' and containers' storage
+  bool reuse = false;
+  if (ttype->is_list()) {
+    reuse = !use_push && is_overwritten_by_read(((t_list*)ttype)->get_elem_type());
+  } else if (is_flat(ttype) && ttype->is_map()) {
+    reuse = is_overwritten_by_read(((t_map*)ttype)->get_key_type()) &&
+      is_overwritten_by_read(((t_map*)ttype)->get_val_type());
+  } else if (is_flat(ttype)) {
+    reuse = is_overwritten_by_read(((t_set*)ttype)->get_elem_type());
+  }
+  if (!reuse) {
+    indent(out) << prefix << ".clear();" << endl;
+  }
+  indent(out) << "uint32_t " << size << ";" << endl;
+
+  if (is_flat(ttype)) {
+    generate_deserialize_flat_container(out, ttype, prefix, size);
+    scope_down(out);
+    return;
+  }
+
+  // Declare variables, read header
+  if (ttype->is_map()) {
+    out <<
+      indent() << "::apache::thrift::protocol::TType " << ktype << ";" << endl <<
+      indent() << "::apache::thrift::protocol::TType " << vtype << ";" << endl <<
+      indent() << "xfer += iprot->readMapBegin(" <<
+                   ktype << ", " << vtype << ", " << size << ");" << endl;
+  } else if (ttype->is_set()) {
+    out <<
+      indent() << "::apache::thrift::protocol::TType " << etype << ";" << endl <<
+      indent() << "xfer += iprot->readSetBegin(" <<
+                   etype << ", " << size << ");" << endl;
+  } else if (ttype->is_list()) {
+    out <<
+      indent() << "::apache::thrift::protocol::TType " << etype << ";" << endl <<
+      indent() << "xfer += iprot->readListBegin(" <<
+      etype << ", " << size << ");" << endl;
+    if (!use_push) {
+      indent(out) << prefix << ".resize(" << size << ");" << endl;
+    }
+  }
+  if (!ttype->is_list() && !use_push && is_unordered(ttype)) {
+    // The protocol has already held the size to its container limit
+    indent(out) << prefix << ".reserve(" << size << ");" << endl;
+  }
+
+  // Lists of plain numbers are read as one run
+  string bulk = bulk_list_suffix(ttype);
+  if (!use_push && !bulk.empty()) {
+    out <<
+      indent() << "if (" << size << " > 0) {" << endl <<
+      indent() << "  xfer += iprot->read" << bulk << "(&" << prefix << "[0], " << size << ");" << endl <<
+      indent() << "}" << endl <<
+      indent() << "xfer += iprot->readListEnd();" << endl;
+    scope_down(out);
+    return;
+  }
+
+  // For loop iterates over elements
+  string i = tmp("_i");
+  out <<
+    indent() << "uint32_t " << i << ";" << endl <<
+    indent() << "for (" << i << " = 0; " << i << " < " << size << "; ++" << i << ")" << endl;
+
+    scope_up(out);
+
+    if (ttype->is_map()) {
+      generate_deserialize_map_element(out, (t_map*)ttype, prefix);
+    } else if (ttype->is_set()) {
+      generate_deserialize_set_element(out, (t_set*)ttype, prefix);
+    } else if (ttype->is_list()) {
+      generate_deserialize_list_element(out, (t_list*)ttype, prefix, use_push, i);
+    }
+
+    scope_down(out);
+
+  // Read container end
+  if (ttype->is_map()) {
+    indent(out) << "xfer += iprot->readMapEnd();" << endl;
+  } else if (ttype->is_set()) {
+    indent(out) << "xfer += iprot->readSetEnd();" << endl;
+  } else if (ttype->is_list()) {
+    indent(out) << "xfer += iprot->readListEnd();" << endl;
+  }
+
+  scope_down(out);
+}
+
+
+/**
+ * Reads a flat map or set into its vector, sized from the header, then
+ * hands that over to be sorted once, rather than inserting in order.
+ */
+void t_cpp_generator::generate_deserialize_flat_container(ofstream& out,
+                                                          t_type* ttype,
+                                                          string prefix,
+                                                          string size) {
+  string seq = tmp("_seq");
+  string i = tmp("_i");
+  string type = tmp("_type");
+  string vtype = tmp("_vtype");
+  string begin = ttype->is_map() ? "readMapBegin(" + type + ", " + vtype + ", "
+                                 : "readSetBegin(" + type + ", ";
+
+  indent(out) << "::apache::thrift::protocol::TType " << type << ";" << endl;
+  if (ttype->is_map()) {
+    indent(out) << "::apache::thrift::protocol::TType " << vtype << ";" << endl;
+  }
+  out <<
+    indent() << "xfer += iprot->" << begin << size << ");" << endl <<
+    indent() << "// Reuses the storage, and elements, of what was there" << endl <<
+    indent() << type_name(ttype) << "::sequence_type " << seq << "(" <<
+      prefix << ".extract_sequence());" << endl <<
+    indent() << seq << ".resize(" << size << ");" << endl <<
+    indent() << "for (uint32_t " << i << " = 0; " << i << " < " << size << "; ++" << i << ")" << endl;
+  scope_up(out);
+  if (ttype->is_map()) {
+    t_field fkey(((t_map*)ttype)->get_key_type(), seq + "[" + i + "].first");
+    t_field fval(((t_map*)ttype)->get_val_type(), seq + "[" + i + "].second");
+    generate_deserialize_field(out, &fkey);
+    generate_deserialize_field(out, &fval);
+  } else {
+    t_field felem(((t_set*)ttype)->get_elem_type(), seq + "[" + i + "]");
+    generate_deserialize_field(out, &felem);
+  }
+  scope_down(out);
+  out <<
+    indent() << "xfer += iprot->" << (ttype->is_map() ? "readMapEnd();" : "readSetEnd();") << endl <<
+    indent() << prefix << ".adopt_sequence(::boost::move(" << seq << "));" << endl;
+}
+
+/**
+ * Generates code to deserialize a map
+ */
+void t_cpp_generator::generate_deserialize_map_element(ofstream& out,
+                                                       t_map* tmap,
+                                                       string prefix) {
+  string key = tmp("_key");
+  string val = tmp("_val");
+  t_field fkey(tmap->get_key_type(), key);
+  t_field fval(tmap->get_val_type(), val);
+
+  out <<
+    indent() << declare_field(&fkey) << endl;
+
+  generate_deserialize_field(out, &fkey);
+  indent(out) <<
+    declare_field(&fval, false, false, false, true) << " = " <<
+    prefix << "[" << key << "];" << endl;
+
+  generate_deserialize_field(out, &fval);
+}
+
+void t_cpp_generator::generate_deserialize_set_element(ofstream& out,
+                                                       t_set* tset,
+                                                       string prefix) {
+  string elem = tmp("_elem");
+  t_field felem(tset->get_elem_type(), elem);
+
+  indent(out) <<
+    declare_field(&felem) << endl;
+
+  generate_deserialize_field(out, &felem);
+
+  indent(out) <<
+    prefix << ".insert(" << elem << ");" << endl;
+}
+
+void t_cpp_generator::generate_deserialize_list_element(ofstream& out,
+                                                        t_list* tlist,
+                                                        string prefix,
+                                                        bool use_push,
+                                                        string index) {
+  if (use_push) {
+    string elem = tmp("_elem");
+    t_field felem(tlist->get_elem_type(), elem);
+    indent(out) << declare_field(&felem) << endl;
+    generate_deserialize_field(out, &felem);
+    indent(out) << prefix << ".push_back(" << elem << ");" << endl;
+  } else {
+    t_field felem(tlist->get_elem_type(), prefix + "[" + index + "]");
+    generate_deserialize_field(out, &felem);
+  }
+}
+
+
+/**
+ * Serializes a field of any type.
+ *
+ * @param tfield The field to serialize
+ * @param prefix Name to prepend to field name
+ */
+void t_cpp_generator::generate_serialize_field(ofstream& out,
+                                               t_field* tfield,
+                                               string prefix,
+                                               string suffix) {
+  if (is_streamed(tfield->get_type())) {
+    indent(out) << "xfer += " << prefix << tfield->get_name() << suffix << ".write(oprot);" << endl;
+    return;
+  }
+
+  t_type* type = get_true_type(tfield->get_type());
+
+  string name = prefix + tfield->get_name() + suffix;
+
+  // Do nothing for void types
+  if (type->is_void()) {
+    throw "CANNOT GENERATE SERIALIZE CODE FOR void TYPE: " + name;
+  }
+
+
+
+  if (type->is_struct() || type->is_xception()) {
+    generate_serialize_struct(out,
+                              (t_struct*)type,
+                              name);
+  } else if (type->is_container()) {
+    generate_serialize_container(out, type, name);
+  } else if (type->is_base_type() || type->is_enum()) {
+
+    indent(out) <<
+      "xfer += oprot->";
+
+    if (type->is_base_type()) {
+      t_base_type::t_base tbase = ((t_base_type*)type)->get_base();
+      switch (tbase) {
+      case t_base_type::TYPE_VOID:
+        throw
+          "compiler error: cannot serialize void field in a struct: " + name;
+        break;
+      case t_base_type::TYPE_STRING:
+        if (((t_base_type*)type)->is_binary()) {
+          out << (is_string_view(type) ? "writeBinaryView(" : "writeBinary(") << name << ");";
+        }
+        else {
+          out << (is_string_view(type) ? "writeStringView(" : "writeString(") << name << ");";
+        }
+        break;
+      case t_base_type::TYPE_BOOL:
+        out << "writeBool(" << name << ");";
+        break;
+      case t_base_type::TYPE_BYTE:
+        out << "writeByte(" << name << ");";
+        break;
+      case t_base_type::TYPE_I16:
+        out << "writeI16(" << name << ");";
+        break;
+      case t_base_type::TYPE_I32:
+        out << "writeI32(" << name << ");";
+        break;
+      case t_base_type::TYPE_I64:
+        out << "writeI64(" << name << ");";
+        break;
+      case t_base_type::TYPE_DOUBLE:
+        out << "writeDouble(" << name << ");";
+        break;
+      default:
+        throw "compiler error: no C++ writer for base type " + t_base_type::t_base_name(tbase) + name;
+      }
+    } else if (type->is_enum()) {
+      out << "writeI32((int32_t)" << name << ");";
+    }
+    out << endl;
+  } else {
+    printf("DO NOT KNOW HOW TO SERIALIZE FIELD '%s' TYPE '%s'\n",
+           name.c_str(),
+           type_name(type).c_str());
+  }
+}
+
+/**
+ * Serializes all the members of a struct.
+ *
+ * @param tstruct The struct to serialize
+ * @param prefix  String prefix to attach to all fields
+ */
+void t_cpp_generator::generate_serialize_struct(ofstream& out,
+                                                t_struct* tstruct,
+                                                string prefix) {
+  (void) tstruct;
+  indent(out) <<
+    "xfer += " << prefix << ".write(oprot);" << endl;
+}
+
+void t_cpp_generator::generate_serialize_container(ofstream& out,
+                                                   t_type* ttype,
+                                                   string prefix) {
   scope_up(out);
 
-  string size = tmp("_size");
-  string ktype = tmp("_ktype");
-  string vtype = tmp("_vtype");
-  string etype = tmp("_etype");
-
-  t_container* tcontainer = (t_container*)ttype;
-  bool use_push = tcontainer->has_cpp_name();
-
-  indent(out) <<
-    prefix << ".clear();" << endl <<
-    indent() << "uint32_t " << size << ";" << endl;
-
-  // Declare variables, read header
   if (ttype->is_map()) {
-    out <<
-      indent() << "::apache::thrift::protocol::TType " << ktype << ";" << endl <<
-      indent() << "::apache::thrift::protocol::TType " << vtype << ";" << endl <<
-      indent() << "xfer += iprot->readMapBegin(" <<
-                   ktype << ", " << vtype << ", " << size << ");" << endl;
+    indent(out) <<
+      "xfer += oprot->writeMapBegin(" <<
+      type_to_enum(((t_map*)ttype)->get_key_type()) << ", " <<
+      type_to_enum(((t_map*)ttype)->get_val_type()) << ", " <<
+      "static_cast<uint32_t>(" << prefix << ".size()));" << endl;
   } else if (ttype->is_set()) {
-    out <<
-      indent() << "::apache::thrift::protocol::TType " << etype << ";" << endl <<
-      indent() << "xfer += iprot->readSetBegin(" <<
-                   etype << ", " << size << ");" << endl;
+    indent(out) <<
+      "xfer += oprot->writeSetBegin(" <<
+      type_to_enum(((t_set*)ttype)->get_elem_type()) << ", " <<
+      "static_cast<uint32_t>(" << prefix << ".size()));" << endl;
   } else if (ttype->is_list()) {
-    out <<
-      indent() << "::apache::thrift::protocol::TType " << etype << ";" << endl <<
-      indent() << "xfer += iprot->readListBegin(" <<
-      etype << ", " << size << ");" << endl;
-    if (!use_push) {
-      indent(out) << prefix << ".resize(" << size << ");" << endl;
-    }
+    indent(out) <<
+      "xfer += oprot->writeListBegin(" <<
+      type_to_enum(((t_list*)ttype)->get_elem_type()) << ", " <<
+      "static_cast<uint32_t>(" << prefix << ".size()));" << endl;
   }
 
+  string bulk = bulk_list_suffix(ttype);
+  if (!((t_container*)ttype)->has_cpp_name() && !bulk.empty()) {
+    out <<
+      indent() << "if (!" << prefix << ".empty()) {" << endl <<
+      indent() << "  xfer += oprot->write" << bulk << "(&" << prefix << "[0], " <<
+        "static_cast<uint32_t>(" << prefix << ".size()));" << endl <<
+      indent() << "}" << endl <<
+      indent() << "xfer += oprot->writeListEnd();" << endl;
+    scope_down(out);
+    return;
+  }
 
-  // For loop iterates over elements
-  string i = tmp("_i");
+  string iter = tmp("_iter");
   out <<
-    indent() << "uint32_t " << i << ";" << endl <<
-    indent() << "for (" << i << " = 0; " << i << " < " << size << "; ++" << i << ")" << endl;
-
-    scope_up(out);
-
+    indent() << type_name(ttype) << "::const_iterator " << iter << ";" << endl <<
+    indent() << "for (" << iter << " = " << prefix  << ".begin(); " << iter << " != " << prefix << ".end(); ++" << iter << ")" << endl;
+  scope_up(out);
     if (ttype->is_map()) {
-      generate_deserialize_map_element(out, (t_map*)ttype, prefix);
+      generate_serialize_map_element(out, (t_map*)ttype, iter);
     } else if (ttype->is_set()) {
-      generate_deserialize_set_element(out, (t_set*)ttype, prefix);
+      generate_serialize_set_element(out, (t_set*)ttype, iter);
     } else if (ttype->is_list()) {
-      generate_deserialize_list_element(out, (t_list*)ttype, prefix, use_push, i);
+      generate_serialize_list_element(out, (t_list*)ttype, iter);
     }
+  scope_down(out);
 
-    scope_down(out);
-
-  // Read container end
   if (ttype->is_map()) {
-    indent(out) << "xfer += iprot->readMapEnd();" << endl;
+    indent(out) <<
+      "xfer += oprot->writeMapEnd();" << endl;
   } else if (ttype->is_set()) {
-    indent(out) << "xfer += iprot->readSetEnd();" << endl;
+    indent(out) <<
+      "xfer += oprot->writeSetEnd();" << endl;
   } else if (ttype->is_list()) {
-    indent(out) << "xfer += iprot->readListEnd();" << endl;
+    indent(out) <<
+      "xfer += oprot->writeListEnd();" << endl;
   }
 
   scope_down(out);
 }
 
+/**
+ * Serializes the members of a map.
+ *
+ */
+void t_cpp_generator::generate_serialize_map_element(ofstream& out,
+                                                     t_map* tmap,
+                                                     string iter) {
+  t_field kfield(tmap->get_key_type(), iter + "->first");
+  generate_serialize_field(out, &kfield, "");
+
+  t_field vfield(tmap->get_val_type(), iter + "->second");
+  generate_serialize_field(out, &vfield, "");
+}
 
 /**
- * Generates code to deserialize a map
+ * Serializes the members of a set.
  */
-void t_cpp_generator::generate_deserialize_map_element(ofstream& out,
-                                                       t_map* tmap,
-                                                       string prefix) {
-  string key = tmp("_key");
-  string val = tmp("_val");
-  t_field fkey(tmap->get_key_type(), key);
-  t_field fval(tmap->get_val_type(), val);
+void t_cpp_generator::generate_serialize_set_element(ofstream& out,
+                                                     t_set* tset,
+                                                     string iter) {
+  t_field efield(tset->get_elem_type(), "(*" + iter + ")");
+  generate_serialize_field(out, &efield, "");
+}
 
-  out <<
-    indent() << declare_field(&fkey) << endl;
+/**
+ * Serializes the members of a list.
+ */
+void t_cpp_generator::generate_serialize_list_element(ofstream& out,
+                                                      t_list* tlist,
+                                                      string iter) {
+  t_field efield(tlist->get_elem_type(), "(*" + iter + ")");
+  generate_serialize_field(out, &efield, "");
+}
 
-  generate_deserialize_field(out, &fkey);
-  indent(out) <<
-    declare_field(&fval, false, false, false, true) << " = " <<
-    prefix << "[" << key << "];" << endl;
+/**
+ * For a list of i32s, i64s or doubles kept in a std::vector, the suffix of
+ * the protocol methods that read and write the whole run at once ("I32s",
+ * "I64s" or "Doubles").  Empty for anything else.
+ */
+string t_cpp_generator::bulk_list_suffix(t_type* ttype) {
+  if (!ttype->is_list()) {
+    return "";
+  }
+  t_type* etype = get_true_type(((t_list*)ttype)->get_elem_type());
+  if (!etype->is_base_type()) {
+    return "";
+  }
+  switch (((t_base_type*)etype)->get_base()) {
+  case t_base_type::TYPE_I32:
+    return "I32s";
+  case t_base_type::TYPE_I64:
+    return "I64s";
+  case t_base_type::TYPE_DOUBLE:
+    return "Doubles";
+  default:
+    return "";
+  }
+}
 
-  generate_deserialize_field(out, &fval);
+/**
+ * The type a frozen view reads a value of type ttype as.  Enums are
+ * themselves as fields, and int32_t as elements of lists and maps.
+ */
+string t_cpp_generator::frozen_type_name(t_type* ttype, bool element) {
+  t_type* type = get_true_type(ttype);
+  if (type->is_enum()) {
+    return element ? "int32_t" : type_name(type);
+  } else if (type->is_base_type()) {
+    t_base_type::t_base tbase = ((t_base_type*)type)->get_base();
+    if (tbase == t_base_type::TYPE_STRING) {
+      return "::apache::thrift::protocol::TFrozenString";
+    }
+    return base_type_name(tbase);
+  } else if (type->is_struct() || type->is_xception()) {
+    return type_name(type) + "_view";
+  } else if (type->is_map()) {
+    return "::apache::thrift::protocol::TFrozenMap< " +
+      frozen_type_name(((t_map*)type)->get_key_type(), true) + ", " +
+      frozen_type_name(((t_map*)type)->get_val_type(), true) + " >";
+  } else if (type->is_set()) {
+    return "::apache::thrift::protocol::TFrozenList< " +
+      frozen_type_name(((t_set*)type)->get_elem_type(), true) + " >";
+  } else if (type->is_list()) {
+    return "::apache::thrift::protocol::TFrozenList< " +
+      frozen_type_name(((t_list*)type)->get_elem_type(), true) + " >";
+  }
+  throw "compiler error: no frozen view for type " + type->get_name();
 }
 
-void t_cpp_generator::generate_deserialize_set_element(ofstream& out,
-                                                       t_set* tset,
-                                                       string prefix) {
-  string elem = tmp("_elem");
-  t_field felem(tset->get_elem_type(), elem);
+/**
+ * The suffix of the TFrozenWriter methods for a number type, or "" for a
+ * type stored through an offset.
+ */
+string t_cpp_generator::frozen_number_suffix(t_type* ttype) {
+  t_type* type = get_true_type(ttype);
+  if (type->is_enum()) {
+    return "I32";
+  }
+  if (!type->is_base_type()) {
+    return "";
+  }
+  switch (((t_base_type*)type)->get_base()) {
+  case t_base_type::TYPE_BOOL:
+    return "Bool";
+  case t_base_type::TYPE_BYTE:
+    return "Byte";
+  case t_base_type::TYPE_I16:
+    return "I16";
+  case t_base_type::TYPE_I32:
+    return "I32";
+  case t_base_type::TYPE_I64:
+    return "I64";
+  case t_base_type::TYPE_DOUBLE:
+    return "Double";
+  default:
+    return "";
+  }
+}
 
-  indent(out) <<
-    declare_field(&felem) << endl;
+/**
+ * The width of an element of type ttype in a frozen list or map.
+ */
+int t_cpp_generator::frozen_width(t_type* ttype) {
+  string suffix = frozen_number_suffix(ttype);
+  if (suffix == "Bool" || suffix == "Byte") {
+    return 1;
+  } else if (suffix == "I16") {
+    return 2;
+  } else if (suffix == "I64" || suffix == "Double") {
+    return 8;
+  }
+  return 4;
+}
 
-  generate_deserialize_field(out, &felem);
+/**
+ * Whether a string or binary type is held in a TStringView, which it is
+ * with the string_view option unless a cpp.type annotation says otherwise.
+ */
+bool t_cpp_generator::is_string_view(t_type* ttype) {
+  ttype = get_true_type(ttype);
+  return gen_string_view_ &&
+    ttype->is_base_type() &&
+    ((t_base_type*)ttype)->get_base() == t_base_type::TYPE_STRING &&
+    ttype->annotations_.find("cpp.type") == ttype->annotations_.end();
+}
 
-  indent(out) <<
-    prefix << ".insert(" << elem << ");" << endl;
+/**
+ * Whether a field is held in a TLazy, to be decoded on first use, which a
+ * struct field is if it has the cpp.lazy annotation.
+ */
+bool t_cpp_generator::is_lazy(t_field* tfield) {
+  t_type* type = get_true_type(tfield->get_type());
+  return (type->is_struct() || type->is_xception()) &&
+    tfield->annotations_.find("cpp.lazy") != tfield->annotations_.end();
 }
 
-void t_cpp_generator::generate_deserialize_list_element(ofstream& out,
-                                                        t_list* tlist,
-                                                        string prefix,
-                                                        bool use_push,
-                                                        string index) {
-  if (use_push) {
-    string elem = tmp("_elem");
-    t_field felem(tlist->get_elem_type(), elem);
-    indent(out) << declare_field(&felem) << endl;
-    generate_deserialize_field(out, &felem);
-    indent(out) << prefix << ".push_back(" << elem << ");" << endl;
-  } else {
-    t_field felem(tlist->get_elem_type(), prefix + "[" + index + "]");
-    generate_deserialize_field(out, &felem);
+/**
+ * Whether any struct in the program has a lazy field.
+ */
+bool t_cpp_generator::has_lazy_fields() {
+  const vector<t_struct*>& objects = program_->get_objects();
+  vector<t_struct*>::const_iterator o_iter;
+  for (o_iter = objects.begin(); o_iter != objects.end(); ++o_iter) {
+    const vector<t_field*>& members = (*o_iter)->get_members();
+    vector<t_field*>::const_iterator m_iter;
+    for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+      if (is_lazy(*m_iter)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * Roughly how a field is aligned in a struct: the size of a scalar, or a
+ * pointer's for anything that holds one.  Only the order matters.
+ */
+int t_cpp_generator::storage_alignment(t_field* tfield) {
+  t_type* type = get_true_type(tfield->get_type());
+  if (type->annotations_.count("cpp.type") != 0 || is_lazy(tfield)) {
+    return 8;
+  }
+  if (type->is_enum()) {
+    return 4;
+  }
+  if (!type->is_base_type()) {
+    return 8;
+  }
+  switch (((t_base_type*)type)->get_base()) {
+  case t_base_type::TYPE_BOOL:
+  case t_base_type::TYPE_BYTE:
+    return 1;
+  case t_base_type::TYPE_I16:
+    return 2;
+  case t_base_type::TYPE_I32:
+    return 4;
+  default:
+    return 8;
+  }
+}
+
+/**
+ * The order a struct's fields are stored in: declaration order, or with
+ * the compact option widest first, which leaves no padding between them.
+ */
+vector<t_field*> t_cpp_generator::storage_order(t_struct* tstruct) {
+  const vector<t_field*>& members = tstruct->get_members();
+  if (!gen_compact_) {
+    return members;
+  }
+  // Sort on (-alignment, position) so equal alignments keep their order
+  vector<std::pair<int, size_t> > keys;
+  for (size_t i = 0; i < members.size(); ++i) {
+    keys.push_back(std::make_pair(-storage_alignment(members[i]), i));
+  }
+  std::sort(keys.begin(), keys.end());
+  vector<t_field*> ordered;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    ordered.push_back(members[keys[i].second]);
+  }
+  return ordered;
+}
+
+/**
+ * Whether boost::hash can take a field of this type, for the unordered
+ * option: scalars, strings, enums, structs and lists of them.
+ */
+bool t_cpp_generator::is_hashable(t_type* ttype) {
+  for (t_type* type = ttype; type->is_typedef(); type = ((t_typedef*)type)->get_type()) {
+    if (type->annotations_.count("cpp.cached") != 0 ||
+        type->annotations_.count("cpp.streamed") != 0) {
+      return false;
+    }
+  }
+  ttype = get_true_type(ttype);
+  if (ttype->annotations_.count("cpp.type") != 0 || is_string_view(ttype)) {
+    return false;
+  }
+  if (ttype->is_list()) {
+    return !((t_container*)ttype)->has_cpp_name() &&
+      is_hashable(((t_list*)ttype)->get_elem_type());
+  }
+  return ttype->is_base_type() || ttype->is_enum() ||
+    ttype->is_struct() || ttype->is_xception();
+}
+
+/**
+ * Collects the types the program writes out: those of its typedefs,
+ * struct fields and constants, and its functions' arguments and returns.
+ */
+void t_cpp_generator::program_types(vector<t_type*>& types) {
+  const vector<t_typedef*>& typedefs = program_->get_typedefs();
+  vector<t_typedef*>::const_iterator t_iter;
+  for (t_iter = typedefs.begin(); t_iter != typedefs.end(); ++t_iter) {
+    types.push_back((*t_iter)->get_type());
+  }
+
+  const vector<t_struct*>& objects = program_->get_objects();
+  vector<t_struct*>::const_iterator o_iter;
+  for (o_iter = objects.begin(); o_iter != objects.end(); ++o_iter) {
+    const vector<t_field*>& members = (*o_iter)->get_members();
+    vector<t_field*>::const_iterator m_iter;
+    for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+      types.push_back((*m_iter)->get_type());
+    }
+  }
+
+  const vector<t_const*>& consts = program_->get_consts();
+  vector<t_const*>::const_iterator c_iter;
+  for (c_iter = consts.begin(); c_iter != consts.end(); ++c_iter) {
+    types.push_back((*c_iter)->get_type());
+  }
+
+  const vector<t_service*>& services = program_->get_services();
+  vector<t_service*>::const_iterator s_iter;
+  for (s_iter = services.begin(); s_iter != services.end(); ++s_iter) {
+    const vector<t_function*>& functions = (*s_iter)->get_functions();
+    vector<t_function*>::const_iterator f_iter;
+    for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+      types.push_back((*f_iter)->get_returntype());
+      const vector<t_field*>& args = (*f_iter)->get_arglist()->get_members();
+      vector<t_field*>::const_iterator a_iter;
+      for (a_iter = args.begin(); a_iter != args.end(); ++a_iter) {
+        types.push_back((*a_iter)->get_type());
+      }
+    }
+  }
+}
+
+/**
+ * Whether reading a value of this type into an old one leaves nothing of
+ * the old behind, so a reader can reuse it: true of scalars, strings and
+ * containers, which readers clear, but of structs only under the reuse
+ * option, as otherwise they keep fields the input leaves out.
+ */
+bool t_cpp_generator::is_overwritten_by_read(t_type* ttype) {
+  for (t_type* type = ttype; type->is_typedef(); type = ((t_typedef*)type)->get_type()) {
+    if (type->annotations_.count("cpp.cached") != 0 || is_streamed(type)) {
+      return false;
+    }
   }
+  ttype = get_true_type(ttype);
+  return ttype->is_base_type() || ttype->is_enum() || ttype->is_container() ||
+    (gen_reuse_ && (ttype->is_struct() || ttype->is_xception()));
 }
 
+/**
+ * Whether a map or set is a sorted vector, a boost::container flat_map or
+ * flat_set: under the flat option unless annotated cpp.ordered, or when
+ * annotated cpp.flat.
+ */
+bool t_cpp_generator::is_flat(t_type* ttype) {
+  if (!(ttype->is_map() || ttype->is_set()) || ((t_container*)ttype)->has_cpp_name()) {
+    return false;
+  }
+  if (ttype->annotations_.count("cpp.flat") != 0) {
+    return true;
+  }
+  return gen_flat_ && ttype->annotations_.count("cpp.ordered") == 0;
+}
 
 /**
- * Serializes a field of any type.
- *
- * @param tfield The field to serialize
- * @param prefix Name to prepend to field name
+ * Whether the program has any flat map or set, and so needs their headers.
  */
-void t_cpp_generator::generate_serialize_field(ofstream& out,
-                                               t_field* tfield,
-                                               string prefix,
-                                               string suffix) {
-  t_type* type = get_true_type(tfield->get_type());
+bool t_cpp_generator::has_flat_containers() {
+  vector<t_type*> types;
+  program_types(types);
+  vector<t_type*>::const_iterator t_iter;
+  for (t_iter = types.begin(); t_iter != types.end(); ++t_iter) {
+    if (has_flat_containers(*t_iter)) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  string name = prefix + tfield->get_name() + suffix;
+bool t_cpp_generator::has_flat_containers(t_type* ttype) {
+  while (ttype->is_typedef()) {
+    ttype = ((t_typedef*)ttype)->get_type();
+  }
+  if (is_flat(ttype)) {
+    return true;
+  }
+  if (ttype->is_list()) {
+    return has_flat_containers(((t_list*)ttype)->get_elem_type());
+  } else if (ttype->is_set()) {
+    return has_flat_containers(((t_set*)ttype)->get_elem_type());
+  } else if (ttype->is_map()) {
+    return has_flat_containers(((t_map*)ttype)->get_key_type()) ||
+      has_flat_containers(((t_map*)ttype)->get_val_type());
+  }
+  return false;
+}
 
-  // Do nothing for void types
-  if (type->is_void()) {
-    throw "CANNOT GENERATE SERIALIZE CODE FOR void TYPE: " + name;
+/**
+ * Marks with cpp.ordered the maps and sets that must stay trees under the
+ * unordered option: those whose keys cannot be hashed, and any inside a
+ * key of one of those, which needs operator<.  Marking the types before
+ * anything is written keeps every use of each type named the same.
+ */
+void t_cpp_generator::mark_ordered_containers() {
+  vector<t_type*> types;
+  program_types(types);
+  vector<t_type*>::const_iterator t_iter;
+  for (t_iter = types.begin(); t_iter != types.end(); ++t_iter) {
+    mark_ordered_containers(*t_iter, false);
   }
+}
 
+void t_cpp_generator::mark_ordered_containers(t_type* ttype, bool ordered) {
+  while (ttype->is_typedef()) {
+    ttype = ((t_typedef*)ttype)->get_type();
+  }
+  if (ttype->is_list()) {
+    mark_ordered_containers(((t_list*)ttype)->get_elem_type(), ordered);
+  } else if (ttype->is_set() || ttype->is_map()) {
+    t_type* key = ttype->is_set() ? ((t_set*)ttype)->get_elem_type()
+                                  : ((t_map*)ttype)->get_key_type();
+    bool tree = ordered || !is_hashable(key);
+    if (tree) {
+      ttype->annotations_["cpp.ordered"] = "";
+    }
+    mark_ordered_containers(key, tree);
+    if (ttype->is_map()) {
+      mark_ordered_containers(((t_map*)ttype)->get_val_type(), ordered);
+    }
+  }
+}
 
+/**
+ * The name a method annotated cpp.method_id goes by on the wire, "#"
+ * followed by its id, or "" for one without.  Processors accept either
+ * name, and clients generated with method_ids send this one, which is
+ * shorter to send and to look up.
+ */
+string t_cpp_generator::method_id(t_function* tfunction) {
+  std::map<string, string>::const_iterator it =
+    tfunction->annotations_.find("cpp.method_id");
+  if (it == tfunction->annotations_.end()) {
+    return "";
+  }
+  const string& id = it->second;
+  if (id.empty() || id.size() > 9 || id.find_first_not_of("0123456789") != string::npos) {
+    throw "cpp.method_id of " + tfunction->get_name() + " is not a number: " + id;
+  }
+  return "#" + id;
+}
 
-  if (type->is_struct() || type->is_xception()) {
-    generate_serialize_struct(out,
-                              (t_struct*)type,
-                              name);
-  } else if (type->is_container()) {
-    generate_serialize_container(out, type, name);
-  } else if (type->is_base_type() || type->is_enum()) {
+/**
+ * Checks that no two methods of a service or the services it extends
+ * share a method id.
+ */
+void t_cpp_generator::check_method_ids(t_service* tservice) {
+  std::map<string, string> seen;
+  for (t_service* service = tservice; service != NULL; service = service->get_extends()) {
+    const vector<t_function*>& functions = service->get_functions();
+    vector<t_function*>::const_iterator f_iter;
+    for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+      string id = method_id(*f_iter);
+      if (id.empty()) {
+        continue;
+      }
+      if (seen.find(id) != seen.end()) {
+        throw "cpp.method_id " + id.substr(1) + " is used by both " + seen[id] + " and " +
+          (*f_iter)->get_name();
+      }
+      seen[id] = (*f_iter)->get_name();
+    }
+  }
+}
 
-    indent(out) <<
-      "xfer += oprot->";
+/**
+ * Whether a typedef is held in a TCached, which keeps its serialized
+ * bytes, as a typedef of a struct is if it has the cpp.cached annotation.
+ */
+bool t_cpp_generator::is_cached(t_typedef* ttypedef) {
+  if (ttypedef->annotations_.find("cpp.cached") == ttypedef->annotations_.end()) {
+    return false;
+  }
+  t_type* type = get_true_type(ttypedef->get_type());
+  if (!type->is_struct()) {
+    pwarning(1, "cpp.cached only applies to typedefs of structs, not %s\n",
+             ttypedef->get_symbolic().c_str());
+    return false;
+  }
+  return true;
+}
 
-    if (type->is_base_type()) {
-      t_base_type::t_base tbase = ((t_base_type*)type)->get_base();
-      switch (tbase) {
-      case t_base_type::TYPE_VOID:
-        throw
-          "compiler error: cannot serialize void field in a struct: " + name;
-        break;
-      case t_base_type::TYPE_STRING:
-        if (((t_base_type*)type)->is_binary()) {
-          out << "writeBinary(" << name << ");";
-        }
-        else {
-          out << "writeString(" << name << ");";
-        }
-        break;
-      case t_base_type::TYPE_BOOL:
-        out << "writeBool(" << name << ");";
-        break;
-      case t_base_type::TYPE_BYTE:
-        out << "writeByte(" << name << ");";
-        break;
-      case t_base_type::TYPE_I16:
-        out << "writeI16(" << name << ");";
-        break;
-      case t_base_type::TYPE_I32:
-        out << "writeI32(" << name << ");";
-        break;
-      case t_base_type::TYPE_I64:
-        out << "writeI64(" << name << ");";
-        break;
-      case t_base_type::TYPE_DOUBLE:
-        out << "writeDouble(" << name << ");";
-        break;
-      default:
-        throw "compiler error: no C++ writer for base type " + t_base_type::t_base_name(tbase) + name;
+/**
+ * Whether a type is a typedef of binary or of a list of structs, or of
+ * another such typedef, with the cpp.streamed annotation, and so held in a
+ * TStreamedBinary or TStream that goes on the wire as a struct of chunks
+ * or items.
+ */
+bool t_cpp_generator::is_streamed(t_type* ttype) {
+  while (ttype->is_typedef()) {
+    if (ttype->annotations_.count("cpp.streamed") != 0) {
+      t_type* type = get_true_type(ttype);
+      if (type->is_list()) {
+        t_type* elem_type = get_true_type(((t_list*)type)->get_elem_type());
+        return elem_type->is_struct() || elem_type->is_xception();
       }
-    } else if (type->is_enum()) {
-      out << "writeI32((int32_t)" << name << ");";
+      return type->is_base_type() && ((t_base_type*)type)->is_binary();
     }
-    out << endl;
-  } else {
-    printf("DO NOT KNOW HOW TO SERIALIZE FIELD '%s' TYPE '%s'\n",
-           name.c_str(),
-           type_name(type).c_str());
+    ttype = ((t_typedef*)ttype)->get_type();
   }
+  return false;
 }
 
 /**
- * Serializes all the members of a struct.
- *
- * @param tstruct The struct to serialize
- * @param prefix  String prefix to attach to all fields
+ * Whether the program has a streamed typedef of a list, or of binary.
  */
-void t_cpp_generator::generate_serialize_struct(ofstream& out,
-                                                t_struct* tstruct,
-                                                string prefix) {
-  (void) tstruct;
-  indent(out) <<
-    "xfer += " << prefix << ".write(oprot);" << endl;
+bool t_cpp_generator::has_streamed_typedefs(bool lists) {
+  const vector<t_typedef*>& typedefs = program_->get_typedefs();
+  vector<t_typedef*>::const_iterator t_iter;
+  for (t_iter = typedefs.begin(); t_iter != typedefs.end(); ++t_iter) {
+    if ((*t_iter)->annotations_.count("cpp.streamed") != 0 &&
+        get_true_type(*t_iter)->is_list() == lists) {
+      return true;
+    }
+  }
+  return false;
 }
 
-void t_cpp_generator::generate_serialize_container(ofstream& out,
-                                                   t_type* ttype,
-                                                   string prefix) {
-  scope_up(out);
+/**
+ * Whether the program has a cached typedef.
+ */
+bool t_cpp_generator::has_cached_typedefs() {
+  const vector<t_typedef*>& typedefs = program_->get_typedefs();
+  vector<t_typedef*>::const_iterator t_iter;
+  for (t_iter = typedefs.begin(); t_iter != typedefs.end(); ++t_iter) {
+    if ((*t_iter)->annotations_.find("cpp.cached") != (*t_iter)->annotations_.end()) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  if (ttype->is_map()) {
-    indent(out) <<
-      "xfer += oprot->writeMapBegin(" <<
-      type_to_enum(((t_map*)ttype)->get_key_type()) << ", " <<
-      type_to_enum(((t_map*)ttype)->get_val_type()) << ", " <<
-      "static_cast<uint32_t>(" << prefix << ".size()));" << endl;
-  } else if (ttype->is_set()) {
-    indent(out) <<
-      "xfer += oprot->writeSetBegin(" <<
-      type_to_enum(((t_set*)ttype)->get_elem_type()) << ", " <<
-      "static_cast<uint32_t>(" << prefix << ".size()));" << endl;
-  } else if (ttype->is_list()) {
-    indent(out) <<
-      "xfer += oprot->writeListBegin(" <<
-      type_to_enum(((t_list*)ttype)->get_elem_type()) << ", " <<
-      "static_cast<uint32_t>(" << prefix << ".size()));" << endl;
+/**
+ * TStructSpec::hashFieldName(), which the generated tables are laid out
+ * with; the two must agree.
+ */
+static uint32_t hash_field_name(const string& name, uint32_t seed) {
+  uint32_t hash = 2166136261U ^ seed;
+  for (size_t i = 0; i < name.size(); ++i) {
+    hash ^= static_cast<uint8_t>(name[i]);
+    hash *= 16777619U;
   }
+  return hash ^ (hash >> 16);
+}
 
-  string iter = tmp("_iter");
-  out <<
-    indent() << type_name(ttype) << "::const_iterator " << iter << ";" << endl <<
-    indent() << "for (" << iter << " = " << prefix  << ".begin(); " << iter << " != " << prefix << ".end(); ++" << iter << ")" << endl;
-  scope_up(out);
-    if (ttype->is_map()) {
-      generate_serialize_map_element(out, (t_map*)ttype, iter);
-    } else if (ttype->is_set()) {
-      generate_serialize_set_element(out, (t_set*)ttype, iter);
-    } else if (ttype->is_list()) {
-      generate_serialize_list_element(out, (t_list*)ttype, iter);
-    }
-  scope_down(out);
+/**
+ * Generates the visit option's __fields struct, which has a descriptor
+ * struct for each field holding its id, type, optionality and name as
+ * compile-time constants, and visit_fields(), which calls a visitor with
+ * each field's descriptor and a reference to the field in turn.  Generic
+ * code such as hashers and columnar encoders can overload or specialize on
+ * the descriptors and have it all inlined.
+ */
+void t_cpp_generator::generate_struct_visit(ofstream& out, t_struct* tstruct) {
+  const vector<t_field*>& members = tstruct->get_members();
+  vector<t_field*>::const_iterator m_iter;
+  string konst = gen_cpp11_ ? "static constexpr " : "static const ";
 
-  if (ttype->is_map()) {
-    indent(out) <<
-      "xfer += oprot->writeMapEnd();" << endl;
-  } else if (ttype->is_set()) {
-    indent(out) <<
-      "xfer += oprot->writeSetEnd();" << endl;
-  } else if (ttype->is_list()) {
-    indent(out) <<
-      "xfer += oprot->writeListEnd();" << endl;
+  indent(out) << "struct __fields {" << endl;
+  indent_up();
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    indent(out) << "struct " << (*m_iter)->get_name() << "_field {" << endl;
+    indent_up();
+    out <<
+      indent() << konst << "int16_t id = " << (*m_iter)->get_key() << ";" << endl <<
+      indent() << konst << "::apache::thrift::protocol::TType type = " <<
+        type_to_enum((*m_iter)->get_type()) << ";" << endl <<
+      indent() << konst << "bool optional = " <<
+        ((*m_iter)->get_req() == t_field::T_OPTIONAL ? "true" : "false") << ";" << endl <<
+      indent() << (gen_cpp11_ ? "static constexpr const char* " : "static const char* ") <<
+        "name() { return \"" << (*m_iter)->get_name() << "\"; }" << endl;
+    indent_down();
+    indent(out) << "};" << endl;
   }
+  indent(out) << konst << "uint32_t count = " << members.size() << ";" << endl;
+  indent_down();
+  indent(out) << "};" << endl;
 
-  scope_down(out);
+  for (int is_const = 0; is_const < 2; ++is_const) {
+    out <<
+      endl <<
+      indent() << "template <class Visitor_>" << endl <<
+      indent() << "void visit_fields(Visitor_& " << (members.empty() ? "/* visitor */" : "visitor") << ")" <<
+        (is_const ? " const" : "") << " {" << endl;
+    indent_up();
+    for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+      indent(out) << "visitor(__fields::" << (*m_iter)->get_name() << "_field(), " <<
+        (*m_iter)->get_name() << ");" << endl;
+    }
+    indent_down();
+    indent(out) << "}" << endl;
+  }
 }
 
 /**
- * Serializes the members of a map.
- *
+ * Defines the constants of the visit option's descriptors at namespace
+ * scope, so that binding one to a reference, as containers and test
+ * macros do, links.
  */
-void t_cpp_generator::generate_serialize_map_element(ofstream& out,
-                                                     t_map* tmap,
-                                                     string iter) {
-  t_field kfield(tmap->get_key_type(), iter + "->first");
-  generate_serialize_field(out, &kfield, "");
+void t_cpp_generator::generate_struct_visit_definitions(ofstream& out, t_struct* tstruct) {
+  const vector<t_field*>& members = tstruct->get_members();
+  vector<t_field*>::const_iterator m_iter;
+  string konst = gen_cpp11_ ? "constexpr " : "const ";
+  string fields = tstruct->get_name() + "::__fields::";
 
-  t_field vfield(tmap->get_val_type(), iter + "->second");
-  generate_serialize_field(out, &vfield, "");
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    string field = fields + (*m_iter)->get_name() + "_field::";
+    out <<
+      indent() << konst << "int16_t " << field << "id;" << endl <<
+      indent() << konst << "::apache::thrift::protocol::TType " << field << "type;" << endl <<
+      indent() << konst << "bool " << field << "optional;" << endl;
+  }
+  out <<
+    indent() << konst << "uint32_t " << fields << "count;" << endl <<
+    endl;
 }
 
 /**
- * Serializes the members of a set.
+ * Generates the static structSpec() method of a struct, for the
+ * simple_json option.  The field table is a perfect hash on the field
+ * names: starting at twice as many slots as fields, seeds are tried until
+ * no two names collide, and the table doubles if none is found.
  */
-void t_cpp_generator::generate_serialize_set_element(ofstream& out,
-                                                     t_set* tset,
-                                                     string iter) {
-  t_field efield(tset->get_elem_type(), "(*" + iter + ")");
-  generate_serialize_field(out, &efield, "");
+void t_cpp_generator::generate_struct_spec(ofstream& out, t_struct* tstruct) {
+  const vector<t_field*>& members = tstruct->get_members();
+  uint32_t num_fields = static_cast<uint32_t>(members.size());
+
+  uint32_t size = 1;
+  while (size < 2 * num_fields) {
+    size *= 2;
+  }
+  uint32_t seed = 0;
+  vector<int> slots;
+  while (true) {
+    bool found = false;
+    for (seed = 0; seed < 1000 && !found; ++seed) {
+      slots.assign(size, -1);
+      found = true;
+      for (uint32_t i = 0; i < num_fields && found; ++i) {
+        uint32_t slot = hash_field_name(members[i]->get_name(), seed) & (size - 1);
+        if (slots[slot] >= 0) {
+          found = false;
+        } else {
+          slots[slot] = static_cast<int>(i);
+        }
+      }
+    }
+    if (found) {
+      --seed;
+      break;
+    }
+    size *= 2;
+  }
+
+  indent(out) << "static const ::apache::thrift::protocol::TStructSpec& structSpec() {" << endl;
+  indent_up();
+  indent(out) << "static const ::apache::thrift::protocol::TFieldSpec fields[] = {" << endl;
+  indent_up();
+  if (members.empty()) {
+    indent(out) << "{ NULL, 0, ::apache::thrift::protocol::T_STOP }" << endl;
+  }
+  vector<t_field*>::const_iterator m_iter;
+  for (m_iter = members.begin(); m_iter != members.end(); ++m_iter) {
+    indent(out) << "{ \"" << (*m_iter)->get_name() << "\", " << (*m_iter)->get_key() << ", "
+                << type_to_enum((*m_iter)->get_type()) << " }"
+                << (m_iter + 1 != members.end() ? "," : "") << endl;
+  }
+  indent_down();
+  indent(out) << "};" << endl;
+  indent(out) << "static const int16_t slots[] = {";
+  for (uint32_t i = 0; i < size; ++i) {
+    out << (i == 0 ? " " : ", ") << slots[i];
+  }
+  out << " };" << endl;
+  indent(out) << "static const ::apache::thrift::protocol::TStructSpec spec = {" << endl;
+  indent(out) << "  \"" << tstruct->get_name() << "\", fields, " << num_fields << ", slots, "
+              << (size - 1) << ", " << seed << "U" << endl;
+  indent(out) << "};" << endl;
+  indent(out) << "return spec;" << endl;
+  indent_down();
+  indent(out) << "}" << endl;
 }
 
 /**
- * Serializes the members of a list.
+ * The TArenaAllocator for a container of elem_type, used with the arena
+ * option.
  */
-void t_cpp_generator::generate_serialize_list_element(ofstream& out,
-                                                      t_list* tlist,
-                                                      string iter) {
-  t_field efield(tlist->get_elem_type(), "(*" + iter + ")");
-  generate_serialize_field(out, &efield, "");
+string t_cpp_generator::arena_allocator(string elem_type) {
+  return "::apache::thrift::TArenaAllocator<" + template_arg(elem_type) + " >";
+}
+
+/**
+ * A type name to follow a < in a template argument list.  Before C++11
+ * <: is a digraph for [, so a name starting with :: gets a space first.
+ */
+string t_cpp_generator::template_arg(const string& name) {
+  return name.compare(0, 2, "::") == 0 ? " " + name : name;
 }
 
 /**
@@ -4312,15 +7455,63 @@ string t_cpp_generator::type_name(t_type* ttype, bool in_typedef, bool arg) {
       cname = tcontainer->get_cpp_name();
     } else if (ttype->is_map()) {
       t_map* tmap = (t_map*) ttype;
-      cname = "std::map<" +
-        type_name(tmap->get_key_type(), in_typedef) + ", " +
-        type_name(tmap->get_val_type(), in_typedef) + "> ";
+      string kname = template_arg(type_name(tmap->get_key_type(), in_typedef));
+      string vname = type_name(tmap->get_val_type(), in_typedef);
+      if (is_flat(ttype)) {
+        cname = "boost::container::flat_map<" + kname + ", " + vname;
+        if (gen_arena_) {
+          cname += ", std::less<" + kname + " >, " +
+            arena_allocator("std::pair<" + kname + ", " + vname + " >");
+        }
+        cname += " > ";
+      } else if (is_unordered(ttype)) {
+        cname = unordered_prefix() + "unordered_map<" + kname + ", " + vname +
+          ", ::boost::hash<" + kname + " >";
+        if (gen_arena_) {
+          cname += ", std::equal_to<" + kname + " >, " +
+            arena_allocator("std::pair<const " + kname + ", " + vname + " >");
+        }
+        cname += " > ";
+      } else if (gen_arena_) {
+        cname = "std::map<" + kname + ", " + vname + ", std::less<" + kname + " >, " +
+          arena_allocator("std::pair<const " + kname + ", " + vname + " >") + " > ";
+      } else {
+        cname = "std::map<" + kname + ", " + vname + "> ";
+      }
     } else if (ttype->is_set()) {
       t_set* tset = (t_set*) ttype;
-      cname = "std::set<" + type_name(tset->get_elem_type(), in_typedef) + "> ";
+      string ename = template_arg(type_name(tset->get_elem_type(), in_typedef));
+      if (is_flat(ttype)) {
+        cname = "boost::container::flat_set<" + ename;
+        if (gen_arena_) {
+          cname += ", std::less<" + ename + " >, " + arena_allocator(ename);
+        }
+        cname += " > ";
+      } else if (is_unordered(ttype)) {
+        cname = unordered_prefix() + "unordered_set<" + ename +
+          ", ::boost::hash<" + ename + " >";
+        if (gen_arena_) {
+          cname += ", std::equal_to<" + ename + " >, " + arena_allocator(ename);
+        }
+        cname += " > ";
+      } else if (gen_arena_) {
+        cname = "std::set<" + ename + ", std::less<" + ename + " >, " +
+          arena_allocator(ename) + " > ";
+      } else {
+        cname = "std::set<" + ename + "> ";
+      }
     } else if (ttype->is_list()) {
       t_list* tlist = (t_list*) ttype;
-      cname = "std::vector<" + type_name(tlist->get_elem_type(), in_typedef) + "> ";
+      string ename = template_arg(type_name(tlist->get_elem_type(), in_typedef));
+      // vector<bool> stays as it is: readBool() takes its reference type
+      t_type* etype = get_true_type(tlist->get_elem_type());
+      bool is_bool = etype->is_base_type() &&
+        ((t_base_type*)etype)->get_base() == t_base_type::TYPE_BOOL;
+      if (gen_arena_ && !is_bool) {
+        cname = "std::vector<" + ename + ", " + arena_allocator(ename) + " > ";
+      } else {
+        cname = "std::vector<" + ename + "> ";
+      }
     }
 
     if (arg) {
@@ -4373,7 +7564,7 @@ string t_cpp_generator::base_type_name(t_base_type::t_base tbase) {
   case t_base_type::TYPE_VOID:
     return "void";
   case t_base_type::TYPE_STRING:
-    return "std::string";
+    return gen_string_view_ ? "::apache::thrift::TStringView" : "std::string";
   case t_base_type::TYPE_BOOL:
     return "bool";
   case t_base_type::TYPE_BYTE:
@@ -4494,6 +7685,11 @@ string t_cpp_generator::function_signature(t_function* tfunction,
       "void " + prefix + tfunction->get_name() +
       "(tcxx::function<void" + cob_type + "> cob" + exn_cob +
       argument_list(arglist, name_params, true) + ")";
+  } else if (style == "CoroSv") {
+    // The arguments are copied into the coroutine, which outlives the call
+    return
+      task_type(ttype) + " " + prefix + tfunction->get_name() +
+      "(" + argument_list(arglist, name_params, false, true) + ")";
   } else {
     throw "UNKNOWN STYLE";
   }
@@ -4505,7 +7701,7 @@ string t_cpp_generator::function_signature(t_function* tfunction,
  * @param tstruct The struct definition
  * @return Comma sepearated list of all field names in that struct
  */
-string t_cpp_generator::argument_list(t_struct* tstruct, bool name_params, bool start_comma) {
+string t_cpp_generator::argument_list(t_struct* tstruct, bool name_params, bool start_comma, bool by_value) {
   string result = "";
 
   const vector<t_field*>& fields = tstruct->get_members();
@@ -4517,12 +7713,19 @@ string t_cpp_generator::argument_list(t_struct* tstruct, bool name_params, bool
     } else {
       result += ", ";
     }
-    result += type_name((*f_iter)->get_type(), false, true) + " " +
+    result += type_name((*f_iter)->get_type(), false, !by_value) + " " +
       (name_params ? (*f_iter)->get_name() : "/* " + (*f_iter)->get_name() + " */");
   }
   return result;
 }
 
+/**
+ * Renders the type of a coroutine returning ttype
+ */
+string t_cpp_generator::task_type(t_type* ttype) {
+  return "::apache::thrift::async::TTask<" + type_name(ttype) + ">";
+}
+
 /**
  * Converts the parse type to a C++ enum string for the given type.
  *
@@ -4530,6 +7733,9 @@ string t_cpp_generator::argument_list(t_struct* tstruct, bool name_params, bool
  * @return String of C++ code to definition of that type constant
  */
 string t_cpp_generator::type_to_enum(t_type* type) {
+  if (is_streamed(type)) {
+    return "::apache::thrift::protocol::T_STRUCT";
+  }
   type = get_true_type(type);
 
   if (type->is_base_type()) {
@@ -4633,11 +7839,67 @@ string t_cpp_generator::get_include_prefix(const t_program& program) const {
 
 THRIFT_REGISTER_GENERATOR(cpp, "C++",
 "    cob_style:       Generate \"Continuation OBject\"-style classes.\n"
+"    coroutines:      Also give the CobClient awaitable co_ methods, and generate\n"
+"                     a CoroSvIf of C++20 coroutines for handlers to implement.\n"
+"    cpp11:           Give structs move constructors, move assignment and rvalue\n"
+"                     setters, so large results can be moved rather than copied.\n"
 "    no_client_completion:\n"
 "                     Omit calls to completion__() in CobClient class.\n"
+"    concurrent:      Generate a ConcurrentClient class that many threads can\n"
+"                     share, matching replies to calls by seqid.\n"
 "    templates:       Generate templatized reader/writer methods.\n"
 "    pure_enums:      Generate pure enums instead of wrapper classes.\n"
 "    dense:           Generate type specifications for the dense protocol.\n"
 "    include_prefix:  Use full include paths in generated files.\n"
+"    string_view:     Use TStringView for strings and binaries, so fields read\n"
+"                     from a shared TMemoryBuffer point into it, uncopied.\n"
+"    arena:           Allocate lists, sets and maps from the TArena of the\n"
+"                     enclosing TArenaScope, to be freed in one go.\n"
+"    simple_json:     Give structs a field table so TSimpleJSONProtocol can\n"
+"                     read them by field name.\n"
+"    ordered_read:    Generate readers that expect fields in id order and only\n"
+"                     switch on the field id when that guess misses.\n"
+"    unordered:       Make maps and sets unordered_map and unordered_set (std::\n"
+"                     with cpp11, else boost::), and give structs a hash_value().\n"
+"                     Annotate a map or set cpp.ordered to keep it a tree.\n"
+"    flat:            Make maps and sets boost::container flat_maps and\n"
+"                     flat_sets, which are sorted vectors.  Annotate one\n"
+"                     cpp.flat to get that alone, or cpp.ordered to opt out.\n"
+"                     Needs cpp11.\n"
+"    reuse:           Have read() reset fields the input leaves out in place,\n"
+"                     and read the rest over what is there, so a struct read\n"
+"                     again and again keeps its strings' and containers'\n"
+"                     storage.  Structs also get __clear().\n"
+"    compact:         Store struct fields widest first and __isset flags as\n"
+"                     bit-fields, so structs take less memory.\n"
+"    packed:          Generate readPacked() and writePacked() for a compact\n"
+"                     tagless encoding, laid out at compile time.\n"
+"    visit:           Give structs a __fields struct of compile-time descriptors\n"
+"                     of their fields (id, type, optional, name()) and\n"
+"                     visit_fields(), which calls a visitor with each field's\n"
+"                     descriptor and a reference to the field.\n"
+"    frozen:          Generate writeFrozen() and a <struct>_view class for each\n"
+"                     struct, which reads the frozen format of TFrozen.h in\n"
+"                     place, e.g. from a mapped file, with no decoding.\n"
+"    delta:           Give structs __dirty flags, set by __set_<field>() (set\n"
+"                     them by hand when assigning fields directly), and\n"
+"                     writeDelta(), which writes only the dirty fields, and\n"
+"                     mergeDelta(), which reads such a delta over an existing\n"
+"                     struct.  clearDirty() starts the next delta.\n"
+"    method_ids:      Have clients call methods annotated cpp.method_id by\n"
+"                     that number instead of by name.\n"
+"    split:           Give each struct its own header and implementation file,\n"
+"                     <program>_types_<struct>.h and .cpp, so changing one only\n"
+"                     rebuilds what uses it.  <program>_types.h includes them all.\n"
+"    no_static_init:  Build nothing before main(): leave out enums'\n"
+"                     _VALUES_TO_NAMES maps (_<enum>_VALUE_TO_NAME() and\n"
+"                     _<enum>_NAME_TO_VALUE() search static tables instead), and\n"
+"                     make g_<program>_constants() a function building the\n"
+"                     constants on first use.\n"
+"    instantiate=P1;P2:\n"
+"                     With templates, instantiate the readers, writers, clients\n"
+"                     and processors for these protocols in the generated .cpp\n"
+"                     files (and with cpp11, declare them extern in the headers),\n"
+"                     e.g. instantiate=TBinaryProtocolT<TBufferBase>.\n"
 )
 
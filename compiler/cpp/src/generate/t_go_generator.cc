@@ -80,6 +80,9 @@ public:
         if (iter != parsed_options.end()) {
             gen_thrift_import_ = (iter->second);
         }
+
+        iter = parsed_options.find("fast");
+        gen_fast_ = (iter != parsed_options.end());
     }
 
     /**
@@ -111,6 +114,9 @@ public:
     void generate_isset_helpers(std::ofstream& out, t_struct* tstruct, const string& tstruct_name, bool is_result = false);
     void generate_go_struct_reader(std::ofstream& out, t_struct* tstruct, const string& tstruct_name, bool is_result = false);
     void generate_go_struct_writer(std::ofstream& out, t_struct* tstruct, const string& tstruct_name, bool is_result = false);
+    void generate_go_struct_fast_reader(std::ofstream& out, t_struct* tstruct, const string& tstruct_name, const string& format);
+    void generate_go_struct_fast_writer(std::ofstream& out, t_struct* tstruct, const string& tstruct_name, const string& format, bool is_result = false);
+    void generate_go_struct_fast_field_writer(std::ofstream& out, t_field* tfield, const string& format);
     void generate_go_function_helpers(t_function* tfunction);
 
     /**
@@ -185,6 +191,17 @@ public:
                                          t_list*     tlist,
                                          std::string iter);
 
+    void generate_fast_deserialize_field(std::ofstream &out,
+                                         t_field*    tfield,
+                                         bool        declare,
+                                         std::string prefix,
+                                         const std::string& format);
+
+    void generate_fast_serialize_field(std::ofstream &out,
+                                       t_field*    tfield,
+                                       std::string prefix,
+                                       const std::string& format);
+
     void generate_go_docstring(std::ofstream& out,
                                t_struct* tstruct);
 
@@ -217,6 +234,7 @@ public:
     std::string function_signature_if(t_function* tfunction, std::string prefix = "", bool addError = false);
     std::string argument_list(t_struct* tstruct);
     std::string type_to_enum(t_type* ttype);
+    std::string type_to_fast_enum(t_type* ttype);
     std::string type_to_go_type(t_type* ttype);
     std::string type_to_go_key_type(t_type* ttype);
     std::string type_to_spec_args(t_type* ttype);
@@ -235,6 +253,7 @@ private:
 
     std::string gen_package_prefix_;
     std::string gen_thrift_import_;
+    bool gen_fast_;
 
     /**
      * File streams
@@ -1010,6 +1029,13 @@ void t_go_generator::generate_go_struct_definition(ofstream& out,
     generate_go_struct_reader(out, tstruct, tstruct_name, is_result);
     generate_go_struct_writer(out, tstruct, tstruct_name, is_result);
 
+    if (gen_fast_) {
+        generate_go_struct_fast_reader(out, tstruct, tstruct_name, "Binary");
+        generate_go_struct_fast_reader(out, tstruct, tstruct_name, "Compact");
+        generate_go_struct_fast_writer(out, tstruct, tstruct_name, "Binary", is_result);
+        generate_go_struct_fast_writer(out, tstruct, tstruct_name, "Compact", is_result);
+    }
+
     out <<
         indent() << "func (p *" << tstruct_name << ") String() string {" << endl <<
         indent() << "  if p == nil {" << endl <<
@@ -1133,6 +1159,14 @@ void t_go_generator::generate_go_struct_reader(ofstream& out,
     out <<
         indent() << "func (p *" << tstruct_name << ") Read(iprot thrift.TProtocol) error {" << endl;
     indent_up();
+
+    if (gen_fast_) {
+        out <<
+            indent() << "if ok, err := thrift.FastRead(iprot, p); ok {" << endl <<
+            indent() << "  return err" << endl <<
+            indent() << "}" << endl;
+    }
+
     out <<
         indent() << "if _, err := iprot.ReadStructBegin(); err != nil {" << endl <<
         indent() << "  return fmt.Errorf(\"%T read error\", p)" << endl <<
@@ -1245,6 +1279,14 @@ void t_go_generator::generate_go_struct_writer(ofstream& out,
     indent(out) <<
                 "func (p *" << tstruct_name << ") Write(oprot thrift.TProtocol) error {" << endl;
     indent_up();
+
+    if (gen_fast_) {
+        out <<
+            indent() << "if ok, err := thrift.FastWrite(oprot, p); ok {" << endl <<
+            indent() << "  return err" << endl <<
+            indent() << "}" << endl;
+    }
+
     out <<
         indent() << "if err := oprot.WriteStructBegin(\"" << name << "\"); err != nil {" << endl <<
         indent() << "  return fmt.Errorf(\"%T write struct begin error: %s\", p, err) }" << endl;
@@ -1379,6 +1421,156 @@ void t_go_generator::generate_go_struct_writer(ofstream& out,
     }
 }
 
+/**
+ * Generates the FastRead<format> method for a struct, the go:fast
+ * counterpart of Read decoding straight from the reader's byte slice.
+ * Field ids are matched the same way Read matches them.
+ */
+void t_go_generator::generate_go_struct_fast_reader(ofstream& out,
+        t_struct* tstruct,
+        const string& tstruct_name,
+        const string& format)
+{
+    const vector<t_field*>& fields = tstruct->get_members();
+    vector<t_field*>::const_iterator f_iter;
+    out <<
+        indent() << "func (p *" << tstruct_name << ") FastRead" << format << "(r *thrift.TFast" << format << "Reader) {" << endl;
+    indent_up();
+    out <<
+        indent() << "r.ReadStructBegin()" << endl <<
+        indent() << "for {" << endl;
+    indent_up();
+
+    if (fields.empty()) {
+        out <<
+            indent() << "fieldTypeId, _ := r.ReadFieldBegin()" << endl <<
+            indent() << "if fieldTypeId == thrift.STOP { break; }" << endl <<
+            indent() << "r.Skip(fieldTypeId)" << endl;
+    } else {
+        out <<
+            indent() << "fieldTypeId, fieldId := r.ReadFieldBegin()" << endl <<
+            indent() << "if fieldTypeId == thrift.STOP { break; }" << endl <<
+            indent() << "switch fieldId {" << endl;
+
+        for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+            int32_t field_id = (*f_iter)->get_key();
+
+            if (field_id < 0) {
+                field_id *= -1;
+            }
+
+            indent(out) << "case " << field_id << ":" << endl;
+            indent_up();
+            generate_fast_deserialize_field(out, *f_iter, false, "p.", format);
+            indent_down();
+        }
+
+        out <<
+            indent() << "default:" << endl <<
+            indent() << "  r.Skip(fieldTypeId)" << endl <<
+            indent() << "}" << endl;
+    }
+
+    indent_down();
+    out <<
+        indent() << "}" << endl <<
+        indent() << "r.ReadStructEnd()" << endl;
+    indent_down();
+    out <<
+        indent() << "}" << endl << endl;
+}
+
+/**
+ * Generates the FastWrite<format> method for a struct, writing the same
+ * fields in the same order as Write.
+ */
+void t_go_generator::generate_go_struct_fast_writer(ofstream& out,
+        t_struct* tstruct,
+        const string& tstruct_name,
+        const string& format,
+        bool is_result)
+{
+    const vector<t_field*>& fields = tstruct->get_sorted_members();
+    vector<t_field*>::const_iterator f_iter;
+    out <<
+        indent() << "func (p *" << tstruct_name << ") FastWrite" << format << "(w *thrift.TFast" << format << "Writer) {" << endl;
+    indent_up();
+    indent(out) << "w.WriteStructBegin()" << endl;
+
+    if (is_result && fields.size()) {
+        out <<
+            indent() << "switch {" << endl;
+        vector<t_field*>::const_reverse_iterator fr_iter;
+
+        for (fr_iter = fields.rbegin(); fr_iter != fields.rend(); ++fr_iter) {
+            if (can_be_nil((*fr_iter)->get_type()) && (*fr_iter)->get_key() != 0) {
+                indent(out) << "case p." << publicize(variable_name_to_go_name((*fr_iter)->get_name())) << " != nil:" << endl;
+            } else {
+                indent(out) << "default:" << endl;
+            }
+
+            indent_up();
+            generate_go_struct_fast_field_writer(out, *fr_iter, format);
+            indent_down();
+        }
+
+        out <<
+            indent() << "}" << endl;
+    } else {
+        for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+            generate_go_struct_fast_field_writer(out, *f_iter, format);
+        }
+    }
+
+    out <<
+        indent() << "w.WriteFieldStop()" << endl <<
+        indent() << "w.WriteStructEnd()" << endl;
+    indent_down();
+    out <<
+        indent() << "}" << endl << endl;
+}
+
+/**
+ * Writes one field of a struct, skipping it when unset as the field's
+ * writeField method does.
+ */
+void t_go_generator::generate_go_struct_fast_field_writer(ofstream& out,
+        t_field* tfield,
+        const string& format)
+{
+    string field_name(publicize(variable_name_to_go_name(tfield->get_name())));
+    bool field_can_be_nil = can_be_nil(tfield->get_type());
+    bool field_check_isset = tfield->get_req() == t_field::T_OPTIONAL || tfield->get_type()->is_enum();
+    int32_t field_id = tfield->get_key();
+
+    if (field_id < 0) {
+        field_id *= -1;
+    }
+
+    if (field_can_be_nil) {
+        indent(out) << "if p." << field_name << " != nil {" << endl;
+        indent_up();
+    }
+
+    if (field_check_isset) {
+        indent(out) << "if p.IsSet" << field_name << "() {" << endl;
+        indent_up();
+    }
+
+    indent(out) << "w.WriteFieldBegin(" << type_to_fast_enum(tfield->get_type()) << ", " << field_id << ")" << endl;
+    generate_fast_serialize_field(out, tfield, "p.", format);
+
+    if (field_check_isset) {
+        indent_down();
+        indent(out) << "}" << endl;
+    }
+
+    if (field_can_be_nil) {
+        indent_down();
+        indent(out) << "}" << endl;
+    }
+}
+
 /**
  * Generates a thrift service.
  *
@@ -2952,6 +3144,234 @@ void t_go_generator::generate_serialize_list_element(ofstream &out,
     generate_serialize_field(out, &efield, prefix);
 }
 
+/**
+ * Decodes a field with a go:fast reader. Errors are left in the reader, so
+ * nothing is checked here.
+ */
+void t_go_generator::generate_fast_deserialize_field(ofstream &out,
+        t_field* tfield,
+        bool declare,
+        string prefix,
+        const string& format)
+{
+    t_type* orig_type = tfield->get_type();
+    t_type* type = get_true_type(orig_type);
+    string name(declare ? tfield->get_name() : prefix + publicize(variable_name_to_go_name(tfield->get_name())));
+    string eq(declare ? " := " : " = ");
+
+    if (type->is_void()) {
+        throw "CANNOT GENERATE DESERIALIZE CODE FOR void TYPE: " + name;
+    }
+
+    if (type->is_struct() || type->is_xception()) {
+        indent(out) << name << eq << new_prefix(type_name(type)) << "()" << endl;
+
+        if (type->get_program() == program_) {
+            indent(out) << name << ".FastRead" << format << "(r)" << endl;
+        } else {
+            indent(out) << "r.ReadStruct(" << name << ")" << endl;
+        }
+    } else if (type->is_map()) {
+        t_map* tmap = (t_map*)type;
+        string key = tmp("_key");
+        string val = tmp("_val");
+        t_field fkey(tmap->get_key_type(), key);
+        t_field fval(tmap->get_val_type(), val);
+        out <<
+            indent() << "_, _, size := r.ReadMapBegin()" << endl <<
+            indent() << name << eq << "make(map[" << type_to_go_type(tmap->get_key_type()) << "]" << type_to_go_type(tmap->get_val_type()) << ", size)" << endl <<
+            indent() << "for i := 0; i < size; i ++ {" << endl;
+        indent_up();
+        generate_fast_deserialize_field(out, &fkey, true, "", format);
+        generate_fast_deserialize_field(out, &fval, true, "", format);
+        indent(out) << name << "[" << key << "] = " << val << endl;
+        indent_down();
+        indent(out) << "}" << endl;
+    } else if (type->is_set()) {
+        t_set* tset = (t_set*)type;
+        string elem = tmp("_elem");
+        t_field felem(tset->get_elem_type(), elem);
+        out <<
+            indent() << "_, size := r.ReadSetBegin()" << endl <<
+            indent() << name << eq << "make(map[" << type_to_go_type(tset->get_elem_type()) << "]bool, size)" << endl <<
+            indent() << "for i := 0; i < size; i ++ {" << endl;
+        indent_up();
+        generate_fast_deserialize_field(out, &felem, true, "", format);
+        indent(out) << name << "[" << elem << "] = true" << endl;
+        indent_down();
+        indent(out) << "}" << endl;
+    } else if (type->is_list()) {
+        t_list* tlist = (t_list*)type;
+        string elem = tmp("_elem");
+        t_field felem(tlist->get_elem_type(), elem);
+        out <<
+            indent() << "_, size := r.ReadListBegin()" << endl <<
+            indent() << name << eq << "make(" << type_to_go_type(tlist) << ", 0, size)" << endl <<
+            indent() << "for i := 0; i < size; i ++ {" << endl;
+        indent_up();
+        generate_fast_deserialize_field(out, &felem, true, "", format);
+        indent(out) << name << " = append(" << name << ", " << elem << ")" << endl;
+        indent_down();
+        indent(out) << "}" << endl;
+    } else if (type->is_base_type() || type->is_enum()) {
+        string read;
+
+        if (type->is_enum()) {
+            read = "r.ReadI32()";
+        } else {
+            t_base_type::t_base tbase = ((t_base_type*)type)->get_base();
+
+            switch (tbase) {
+            case t_base_type::TYPE_STRING:
+                read = ((t_base_type*)type)->is_binary() ? "r.ReadBinary()" : "r.ReadString()";
+                break;
+
+            case t_base_type::TYPE_BOOL:
+                read = "r.ReadBool()";
+                break;
+
+            case t_base_type::TYPE_BYTE:
+                read = "r.ReadByte()";
+                break;
+
+            case t_base_type::TYPE_I16:
+                read = "r.ReadI16()";
+                break;
+
+            case t_base_type::TYPE_I32:
+                read = "r.ReadI32()";
+                break;
+
+            case t_base_type::TYPE_I64:
+                read = "r.ReadI64()";
+                break;
+
+            case t_base_type::TYPE_DOUBLE:
+                read = "r.ReadDouble()";
+                break;
+
+            default:
+                throw "compiler error: no Go name for base type " + t_base_type::t_base_name(tbase);
+            }
+        }
+
+        string wrap;
+
+        if (type->is_enum() || orig_type->is_typedef()) {
+            wrap = publicize(type_name(orig_type));
+        } else if (((t_base_type*)type)->get_base() == t_base_type::TYPE_BYTE) {
+            wrap = "int8";
+        }
+
+        if (wrap == "") {
+            indent(out) << name << eq << read << endl;
+        } else {
+            indent(out) << name << eq << wrap << "(" << read << ")" << endl;
+        }
+    } else {
+        throw "INVALID TYPE IN generate_fast_deserialize_field '" + type->get_name() + "' for field '" + tfield->get_name() + "'";
+    }
+}
+
+/**
+ * Encodes a field with a go:fast writer.
+ */
+void t_go_generator::generate_fast_serialize_field(ofstream &out,
+        t_field* tfield,
+        string prefix,
+        const string& format)
+{
+    t_type* type = get_true_type(tfield->get_type());
+    string name(prefix + publicize(variable_name_to_go_name(tfield->get_name())));
+
+    if (type->is_void()) {
+        throw "compiler error: cannot generate serialize for void type: " + name;
+    }
+
+    if (type->is_struct() || type->is_xception()) {
+        if (type->get_program() == program_) {
+            indent(out) << name << ".FastWrite" << format << "(w)" << endl;
+        } else {
+            indent(out) << "w.WriteStruct(" << name << ")" << endl;
+        }
+    } else if (type->is_map()) {
+        t_map* tmap = (t_map*)type;
+        t_field kfield(tmap->get_key_type(), "");
+        t_field vfield(tmap->get_val_type(), "");
+        out <<
+            indent() << "w.WriteMapBegin(" << type_to_fast_enum(tmap->get_key_type()) << ", " <<
+            type_to_fast_enum(tmap->get_val_type()) << ", len(" << name << "))" << endl <<
+            indent() << "for k, v := range " << name << " {" << endl;
+        indent_up();
+        generate_fast_serialize_field(out, &kfield, "k", format);
+        generate_fast_serialize_field(out, &vfield, "v", format);
+        indent_down();
+        indent(out) << "}" << endl;
+    } else if (type->is_set()) {
+        t_field efield(((t_set*)type)->get_elem_type(), "");
+        out <<
+            indent() << "w.WriteSetBegin(" << type_to_fast_enum(((t_set*)type)->get_elem_type()) << ", len(" << name << "))" << endl <<
+            indent() << "for v := range " << name << " {" << endl;
+        indent_up();
+        generate_fast_serialize_field(out, &efield, "v", format);
+        indent_down();
+        indent(out) << "}" << endl;
+    } else if (type->is_list()) {
+        t_field efield(((t_list*)type)->get_elem_type(), "");
+        out <<
+            indent() << "w.WriteListBegin(" << type_to_fast_enum(((t_list*)type)->get_elem_type()) << ", len(" << name << "))" << endl <<
+            indent() << "for _, v := range " << name << " {" << endl;
+        indent_up();
+        generate_fast_serialize_field(out, &efield, "v", format);
+        indent_down();
+        indent(out) << "}" << endl;
+    } else if (type->is_enum()) {
+        indent(out) << "w.WriteI32(int32(" << name << "))" << endl;
+    } else if (type->is_base_type()) {
+        t_base_type::t_base tbase = ((t_base_type*)type)->get_base();
+
+        switch (tbase) {
+        case t_base_type::TYPE_STRING:
+            if (((t_base_type*)type)->is_binary()) {
+                indent(out) << "w.WriteBinary(" << name << ")" << endl;
+            } else {
+                indent(out) << "w.WriteString(string(" << name << "))" << endl;
+            }
+
+            break;
+
+        case t_base_type::TYPE_BOOL:
+            indent(out) << "w.WriteBool(bool(" << name << "))" << endl;
+            break;
+
+        case t_base_type::TYPE_BYTE:
+            indent(out) << "w.WriteByte(byte(" << name << "))" << endl;
+            break;
+
+        case t_base_type::TYPE_I16:
+            indent(out) << "w.WriteI16(int16(" << name << "))" << endl;
+            break;
+
+        case t_base_type::TYPE_I32:
+            indent(out) << "w.WriteI32(int32(" << name << "))" << endl;
+            break;
+
+        case t_base_type::TYPE_I64:
+            indent(out) << "w.WriteI64(int64(" << name << "))" << endl;
+            break;
+
+        case t_base_type::TYPE_DOUBLE:
+            indent(out) << "w.WriteDouble(float64(" << name << "))" << endl;
+            break;
+
+        default:
+            throw "compiler error: no Go name for base type " + t_base_type::t_base_name(tbase);
+        }
+    } else {
+        throw "compiler error: Invalid type in generate_fast_serialize_field '" + type->get_name() + "' for field '" + name + "'";
+    }
+}
+
 /**
  * Generates the docstring for a given struct.
  */
@@ -3218,6 +3638,21 @@ string t_go_generator::type_to_enum(t_type* type)
     throw "INVALID TYPE IN type_to_enum: " + type->get_name();
 }
 
+/**
+ * Like type_to_enum, but with binary as the STRING it goes on the wire as,
+ * for the go:fast writers which take the type straight to the wire.
+ */
+string t_go_generator::type_to_fast_enum(t_type* type)
+{
+    string ttype = type_to_enum(type);
+
+    if (ttype == "thrift.BINARY") {
+        return "thrift.STRING";
+    }
+
+    return ttype;
+}
+
 
 /**
  * Converts the parse type to a go map type, will throw an exception if it will
@@ -3391,4 +3826,6 @@ bool format_go_output(const string &file_path)
 
 THRIFT_REGISTER_GENERATOR(go, "Go",
                           "    package_prefix= Package prefix for generated files.\n" \
-                          "    thrift_import=  Override thrift package import path (default:" + default_thrift_import + ")\n")
+                          "    thrift_import=  Override thrift package import path (default:" + default_thrift_import + ")\n" \
+                          "    fast:           Also generate binary and compact serializers working directly on\n" \
+                          "                    byte slices, used in place of the TProtocol calls when possible.\n")
@@ -80,6 +80,10 @@ public:
       android_legacy_ = true;
     }
 
+    iter = parsed_options.find("direct");
+    direct_ = (iter != parsed_options.end());
+    in_direct_ = false;
+
     out_dir_base_ = (bean_style_ ? "gen-javabean" : "gen-java");
   }
 
@@ -174,6 +178,8 @@ public:
   void generate_java_struct_standard_scheme(ofstream& out, t_struct* tstruct, bool is_result);
 
   void generate_java_struct_tuple_scheme(ofstream& out, t_struct* tstruct);
+  void generate_java_struct_direct_reader(ofstream& out, t_struct* tstruct);
+  void generate_java_struct_direct_writer(ofstream& out, t_struct* tstruct, bool is_result);
   void generate_java_struct_tuple_reader(ofstream& out, t_struct* tstruct);
   void generate_java_struct_tuple_writer(ofstream& out, t_struct* tstruct);
 
@@ -311,6 +317,8 @@ public:
   bool android_legacy_;
   bool java5_;
   bool sorted_containers_;
+  bool direct_;
+  bool in_direct_;
 };
 
 
@@ -1289,6 +1297,9 @@ void t_java_generator::generate_java_struct_definition(ofstream &out,
     out << "extends TException ";
   }
   out << "implements org.apache.thrift.TBase<" << tstruct->get_name() << ", " << tstruct->get_name() << "._Fields>, java.io.Serializable, Cloneable, Comparable<" << tstruct->get_name() << ">";
+  if (direct_) {
+    out << ", org.apache.thrift.protocol.TDirectStruct";
+  }
 
   out << " ";
 
@@ -1488,6 +1499,10 @@ void t_java_generator::generate_java_struct_definition(ofstream &out,
   } else {
     generate_java_struct_writer(out, tstruct);
   }
+  if (direct_) {
+    generate_java_struct_direct_reader(out, tstruct);
+    generate_java_struct_direct_writer(out, tstruct, is_result);
+  }
   generate_java_struct_tostring(out, tstruct);
   generate_java_validator(out, tstruct);
 
@@ -1665,6 +1680,11 @@ void t_java_generator::generate_java_struct_reader(ofstream& out,
   (void) tstruct;
   indent(out) << "public void read(org.apache.thrift.protocol.TProtocol iprot) throws org.apache.thrift.TException {" << endl;
   indent_up();
+  if (direct_) {
+    indent(out) << "if (org.apache.thrift.protocol.TDirectReader.read(iprot, this)) {" << endl;
+    indent(out) << "  return;" << endl;
+    indent(out) << "}" << endl;
+  }
   indent(out) << "schemes.get(iprot.getScheme()).getScheme().read(iprot, this);" << endl; 
   indent_down();
   indent(out) << "}" << endl <<
@@ -1725,6 +1745,11 @@ void t_java_generator::generate_java_struct_writer(ofstream& out,
   (void) tstruct;
   indent(out) << "public void write(org.apache.thrift.protocol.TProtocol oprot) throws org.apache.thrift.TException {" << endl;
   indent_up();
+  if (direct_) {
+    indent(out) << "if (org.apache.thrift.protocol.TDirectWriter.write(oprot, this)) {" << endl;
+    indent(out) << "  return;" << endl;
+    indent(out) << "}" << endl;
+  }
   indent(out) << "schemes.get(oprot.getScheme()).getScheme().write(oprot, this);" << endl;
 
   indent_down();
@@ -1744,6 +1769,11 @@ void t_java_generator::generate_java_struct_result_writer(ofstream& out,
   (void) tstruct;
   indent(out) << "public void write(org.apache.thrift.protocol.TProtocol oprot) throws org.apache.thrift.TException {" << endl;
   indent_up();
+  if (direct_) {
+    indent(out) << "if (org.apache.thrift.protocol.TDirectWriter.write(oprot, this)) {" << endl;
+    indent(out) << "  return;" << endl;
+    indent(out) << "}" << endl;
+  }
   indent(out) << "schemes.get(oprot.getScheme()).getScheme().write(oprot, this);" << endl;
   
   indent_down();
@@ -3083,9 +3113,12 @@ void t_java_generator::generate_deserialize_field(ofstream& out,
 void t_java_generator::generate_deserialize_struct(ofstream& out,
                                                    t_struct* tstruct,
                                                    string prefix) {
-  out <<
-    indent() << prefix << " = new " << type_name(tstruct) << "();" << endl <<
-    indent() << prefix << ".read(iprot);" << endl;
+  out << indent() << prefix << " = new " << type_name(tstruct) << "();" << endl;
+  if (in_direct_) {
+    out << indent() << "iprot.readStruct(" << prefix << ");" << endl;
+  } else {
+    out << indent() << prefix << ".read(iprot);" << endl;
+  }
 }
 
 /**
@@ -3107,7 +3140,18 @@ void t_java_generator::generate_deserialize_container(ofstream& out,
     obj = tmp("_list");
   }
 
-  if (has_metadata) {
+  // The direct reader returns just the size
+  string size = in_direct_ ? obj : obj + ".size";
+
+  if (in_direct_) {
+    if (ttype->is_map()) {
+      indent(out) << "int " << obj << " = iprot.readMapBegin();" << endl;
+    } else if (ttype->is_set()) {
+      indent(out) << "int " << obj << " = iprot.readSetBegin();" << endl;
+    } else if (ttype->is_list()) {
+      indent(out) << "int " << obj << " = iprot.readListBegin();" << endl;
+    }
+  } else if (has_metadata) {
     // Declare variables, read header
     if (ttype->is_map()) {
       indent(out) << "org.apache.thrift.protocol.TMap " << obj << " = iprot.readMapBegin();" << endl;
@@ -3138,7 +3182,7 @@ void t_java_generator::generate_deserialize_container(ofstream& out,
   } else {
     out << "("
       << (ttype->is_list() ? "" : "2*" )
-      << obj << ".size"
+      << size
       << ");" << endl;
   }
 
@@ -3146,7 +3190,7 @@ void t_java_generator::generate_deserialize_container(ofstream& out,
   string i = tmp("_i");
   indent(out) <<
     "for (int " << i << " = 0; " <<
-    i << " < " << obj << ".size" << "; " <<
+    i << " < " << size << "; " <<
     "++" << i << ")" << endl;
 
   scope_up(out);
@@ -3313,7 +3357,11 @@ void t_java_generator::generate_serialize_struct(ofstream& out,
                                                  t_struct* tstruct,
                                                  string prefix) {
   (void) tstruct;
-  out << indent() << prefix << ".write(oprot);" << endl;
+  if (in_direct_) {
+    out << indent() << "oprot.writeStruct(" << prefix << ");" << endl;
+  } else {
+    out << indent() << prefix << ".write(oprot);" << endl;
+  }
 }
 
 /**
@@ -3327,7 +3375,25 @@ void t_java_generator::generate_serialize_container(ofstream& out,
                                                     string prefix, bool has_metadata) {
   scope_up(out);
 
-  if (has_metadata) {
+  if (in_direct_) {
+    if (ttype->is_map()) {
+      indent(out) <<
+        "oprot.writeMapBegin(" <<
+        type_to_enum(((t_map*)ttype)->get_key_type()) << ", " <<
+        type_to_enum(((t_map*)ttype)->get_val_type()) << ", " <<
+        prefix << ".size());" << endl;
+    } else if (ttype->is_set()) {
+      indent(out) <<
+        "oprot.writeSetBegin(" <<
+        type_to_enum(((t_set*)ttype)->get_elem_type()) << ", " <<
+        prefix << ".size());" << endl;
+    } else if (ttype->is_list()) {
+      indent(out) <<
+        "oprot.writeListBegin(" <<
+        type_to_enum(((t_list*)ttype)->get_elem_type()) << ", " <<
+        prefix << ".size());" << endl;
+    }
+  } else if (has_metadata) {
     if (ttype->is_map()) {
       indent(out) <<
         "oprot.writeMapBegin(new org.apache.thrift.protocol.TMap(" <<
@@ -4390,6 +4456,129 @@ void t_java_generator::generate_standard_writer(ofstream& out, t_struct* tstruct
   indent_down();
 }
 
+/**
+ * Generates the TDirectStruct reader, which mirrors the standard scheme's
+ * but reads from a TDirectReader into this.
+ */
+void t_java_generator::generate_java_struct_direct_reader(ofstream& out, t_struct* tstruct) {
+  indent(out) << "public void directRead(org.apache.thrift.protocol.TDirectReader iprot) throws org.apache.thrift.TException {" << endl;
+  indent_up();
+
+  const vector<t_field*>& fields = tstruct->get_members();
+  vector<t_field*>::const_iterator f_iter;
+
+  in_direct_ = true;
+
+  indent(out) << "iprot.readStructBegin();" << endl;
+  indent(out) << "while (true)" << endl;
+  scope_up(out);
+
+  indent(out) << "byte fieldType = iprot.readFieldBegin();" << endl;
+  indent(out) << "if (fieldType == org.apache.thrift.protocol.TType.STOP) {" << endl;
+  indent(out) << "  break;" << endl;
+  indent(out) << "}" << endl;
+
+  indent(out) << "switch (iprot.fieldId()) {" << endl;
+  indent_up();
+
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    indent(out) <<
+      "case " << (*f_iter)->get_key() << ": // " << constant_name((*f_iter)->get_name()) << endl;
+    indent_up();
+    indent(out) <<
+      "if (fieldType == " << type_to_enum((*f_iter)->get_type()) << ") {" << endl;
+    indent_up();
+
+    generate_deserialize_field(out, *f_iter, "this.", true);
+    indent(out) << "set" << get_cap_name((*f_iter)->get_name()) << get_cap_name("isSet") << "(true);" << endl;
+    indent_down();
+    out <<
+      indent() << "} else {" << endl <<
+      indent() << "  iprot.skip(fieldType);" << endl <<
+      indent() << "}" << endl <<
+      indent() << "break;" << endl;
+    indent_down();
+  }
+
+  indent(out) << "default:" << endl;
+  indent(out) << "  iprot.skip(fieldType);" << endl;
+
+  indent_down();
+  indent(out) << "}" << endl;
+
+  scope_down(out);
+  indent(out) << "iprot.readStructEnd();" << endl;
+
+  in_direct_ = false;
+
+  if (!bean_style_){
+    out << endl << indent() << "// check for required fields of primitive type, which can't be checked in the validate method" << endl;
+    for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+      if ((*f_iter)->get_req() == t_field::T_REQUIRED && !type_can_be_null((*f_iter)->get_type())) {
+        out <<
+        indent() << "if (!"  << generate_isset_check(*f_iter) << ") {" << endl <<
+        indent() << "  throw new org.apache.thrift.protocol.TProtocolException(\"Required field '" << (*f_iter)->get_name() << "' was not found in serialized data! Struct: \" + toString());" << endl <<
+        indent() << "}" << endl;
+      }
+    }
+  }
+
+  indent(out) << "validate();" << endl;
+
+  indent_down();
+  indent(out) << "}" << endl << endl;
+}
+
+/**
+ * Generates the TDirectStruct writer, which mirrors the standard scheme's.
+ */
+void t_java_generator::generate_java_struct_direct_writer(ofstream& out, t_struct* tstruct, bool is_result) {
+  indent(out) << "public void directWrite(org.apache.thrift.protocol.TDirectWriter oprot) throws org.apache.thrift.TException {" << endl;
+  indent_up();
+
+  const vector<t_field*>& fields = tstruct->get_sorted_members();
+  vector<t_field*>::const_iterator f_iter;
+
+  in_direct_ = true;
+
+  indent(out) << "validate();" << endl << endl;
+  indent(out) << "oprot.writeStructBegin(STRUCT_DESC);" << endl;
+
+  for (f_iter = fields.begin(); f_iter != fields.end(); ++f_iter) {
+    bool null_allowed = type_can_be_null((*f_iter)->get_type());
+    if (null_allowed) {
+      indent(out) << "if (this." << (*f_iter)->get_name() << " != null) {" << endl;
+      indent_up();
+    }
+    bool optional = ((*f_iter)->get_req() == t_field::T_OPTIONAL) || (is_result && !null_allowed);
+    if (optional) {
+      indent(out) << "if (" << generate_isset_check((*f_iter)) << ") {" << endl;
+      indent_up();
+    }
+
+    indent(out) << "oprot.writeFieldBegin(" << constant_name((*f_iter)->get_name()) << "_FIELD_DESC);" << endl;
+    generate_serialize_field(out, *f_iter, "this.", true);
+    indent(out) << "oprot.writeFieldEnd();" << endl;
+
+    if (optional) {
+      indent_down();
+      indent(out) << "}" << endl;
+    }
+    if (null_allowed) {
+      indent_down();
+      indent(out) << "}" << endl;
+    }
+  }
+  out <<
+    indent() << "oprot.writeFieldStop();" << endl <<
+    indent() << "oprot.writeStructEnd();" << endl;
+
+  in_direct_ = false;
+
+  indent_down();
+  indent(out) << "}" << endl << endl;
+}
+
 void t_java_generator::generate_java_struct_standard_scheme(ofstream& out, t_struct* tstruct, bool is_result){
   indent(out) << "private static class " << tstruct->get_name() << "StandardSchemeFactory implements SchemeFactory {" << endl;
   indent_up();
@@ -4527,5 +4716,7 @@ THRIFT_REGISTER_GENERATOR(java, "Java",
 "    java5:           Generate Java 1.5 compliant code (includes android_legacy flag).\n"
 "    sorted_containers:\n"
 "                     Use TreeSet/TreeMap instead of HashSet/HashMap as a implementation of set/map.\n"
+"    direct:          Structs also read and write themselves straight from and to byte arrays\n"
+"                     when used with TBinaryProtocol or TCompactProtocol over a buffered transport.\n"
 )
 
@@ -404,9 +404,10 @@ string t_php_generator::php_includes() {
   string TProtocolException = "use Thrift\\Exception\\TProtocolException;\n";
   string TProtocol = "use Thrift\\Protocol\\TProtocol;\n";
   string TBinaryProtocolAccelerated = "use Thrift\\Protocol\\TBinaryProtocolAccelerated;\n";
+  string TCompactProtocolAccelerated = "use Thrift\\Protocol\\TCompactProtocolAccelerated;\n";
   string TApplicationException = "use Thrift\\Exception\\TApplicationException;\n\n";
 
-  return TBase + TType + TMessageType + TException + TProtocolException + TProtocol + TBinaryProtocolAccelerated + TApplicationException;
+  return TBase + TType + TMessageType + TException + TProtocolException + TProtocol + TBinaryProtocolAccelerated + TCompactProtocolAccelerated + TApplicationException;
 }
 
 /**
@@ -1206,7 +1207,8 @@ void t_php_generator::generate_process_function(t_service* tservice,
   }
 
   f_service_ <<
-    indent() << "$bin_accel = ($output instanceof " << "TBinaryProtocolAccelerated) && function_exists('thrift_protocol_write_binary');" << endl;
+    indent() << "$bin_accel = ($output instanceof " << "TBinaryProtocolAccelerated) && function_exists('thrift_protocol_write_binary');" << endl <<
+    indent() << "$compact_accel = ($output instanceof " << "TCompactProtocolAccelerated) && function_exists('thrift_protocol_write_compact');" << endl;
 
   f_service_ <<
     indent() << "if ($bin_accel)" << endl;
@@ -1215,6 +1217,14 @@ void t_php_generator::generate_process_function(t_service* tservice,
   f_service_ <<
     indent() << "thrift_protocol_write_binary($output, '" << tfunction->get_name() << "', " << "TMessageType::REPLY, $result, $seqid, $output->isStrictWrite());" << endl;
 
+  scope_down(f_service_);
+  f_service_ <<
+    indent() << "else if ($compact_accel)" << endl;
+  scope_up(f_service_);
+
+  f_service_ <<
+    indent() << "thrift_protocol_write_compact($output, '" << tfunction->get_name() << "', " << "TMessageType::REPLY, $result, $seqid);" << endl;
+
   scope_down(f_service_);
   f_service_ <<
     indent() << "else" << endl;
@@ -1487,7 +1497,8 @@ void t_php_generator::generate_service_client(t_service* tservice) {
       }
 
       f_service_ <<
-        indent() << "$bin_accel = ($this->output_ instanceof " << "TBinaryProtocolAccelerated) && function_exists('thrift_protocol_write_binary');" << endl;
+        indent() << "$bin_accel = ($this->output_ instanceof " << "TBinaryProtocolAccelerated) && function_exists('thrift_protocol_write_binary');" << endl <<
+        indent() << "$compact_accel = ($this->output_ instanceof " << "TCompactProtocolAccelerated) && function_exists('thrift_protocol_write_compact');" << endl;
 
       f_service_ <<
         indent() << "if ($bin_accel)" << endl;
@@ -1496,6 +1507,14 @@ void t_php_generator::generate_service_client(t_service* tservice) {
       f_service_ <<
         indent() << "thrift_protocol_write_binary($this->output_, '" << (*f_iter)->get_name() << "', " << "TMessageType::CALL, $args, $this->seqid_, $this->output_->isStrictWrite());" << endl;
 
+      scope_down(f_service_);
+      f_service_ <<
+        indent() << "else if ($compact_accel)" << endl;
+      scope_up(f_service_);
+
+      f_service_ <<
+        indent() << "thrift_protocol_write_compact($this->output_, '" << (*f_iter)->get_name() << "', " << "TMessageType::CALL, $args, $this->seqid_);" << endl;
+
       scope_down(f_service_);
       f_service_ <<
         indent() << "else" << endl;
@@ -1546,10 +1565,14 @@ void t_php_generator::generate_service_client(t_service* tservice) {
 
       f_service_ <<
         indent() << "$bin_accel = ($this->input_ instanceof " << "TBinaryProtocolAccelerated)"
-                 << " && function_exists('thrift_protocol_read_binary');" << endl;
+                 << " && function_exists('thrift_protocol_read_binary');" << endl <<
+        indent() << "$compact_accel = ($this->input_ instanceof " << "TCompactProtocolAccelerated)"
+                 << " && function_exists('thrift_protocol_read_compact');" << endl;
 
       f_service_ <<
         indent() << "if ($bin_accel) $result = thrift_protocol_read_binary($this->input_, '" << resultname << "', $this->input_->isStrictRead());" << endl;
+      f_service_ <<
+        indent() << "else if ($compact_accel) $result = thrift_protocol_read_compact($this->input_, '" << resultname << "');" << endl;
       f_service_ <<
         indent() << "else" << endl;
       scope_up(f_service_);
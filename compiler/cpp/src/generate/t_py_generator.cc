@@ -436,6 +436,7 @@ string t_py_generator::render_includes() {
 
 /**
  * Renders all the imports necessary to use the accelerated TBinaryProtocol
+ * and TCompactProtocol
  */
 string t_py_generator::render_fastbinary_includes() {
   string hdr = "";
@@ -444,7 +445,7 @@ string t_py_generator::render_fastbinary_includes() {
   } else {
     hdr +=
       "from thrift.transport import TTransport\n"
-      "from thrift.protocol import TBinaryProtocol, TProtocol\n"
+      "from thrift.protocol import TBinaryProtocol, TCompactProtocol, TProtocol\n"
       "try:\n"
       "  from thrift.protocol import fastbinary\n"
       "except:\n"
@@ -910,6 +911,19 @@ void t_py_generator::generate_py_struct_reader(ofstream& out,
     "return" << endl;
   indent_down();
 
+  indent(out) <<
+    "if iprot.__class__ == TCompactProtocol.TCompactProtocolAccelerated "
+    "and isinstance(iprot.trans, TTransport.CReadableTransport) "
+    "and self.thrift_spec is not None "
+    "and fastbinary is not None:" << endl;
+  indent_up();
+
+  indent(out) <<
+    "fastbinary.decode_compact(self, iprot.trans, (self.__class__, self.thrift_spec))" << endl;
+  indent(out) <<
+    "return" << endl;
+  indent_down();
+
   indent(out) <<
     "iprot.readStructBegin()" << endl;
 
@@ -995,6 +1009,18 @@ void t_py_generator::generate_py_struct_writer(ofstream& out,
     "return" << endl;
   indent_down();
 
+  indent(out) <<
+    "if oprot.__class__ == TCompactProtocol.TCompactProtocolAccelerated "
+    "and self.thrift_spec is not None "
+    "and fastbinary is not None:" << endl;
+  indent_up();
+
+  indent(out) <<
+    "oprot.trans.write(fastbinary.encode_compact(self, (self.__class__, self.thrift_spec)))" << endl;
+  indent(out) <<
+    "return" << endl;
+  indent_down();
+
   indent(out) <<
     "oprot.writeStructBegin('" << name << "')" << endl;
 
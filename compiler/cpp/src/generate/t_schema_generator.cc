@@ -0,0 +1,271 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <set>
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sstream>
+#include "t_generator.h"
+#include "platform.h"
+
+using std::ofstream;
+using std::set;
+using std::string;
+using std::vector;
+
+static const string endl = "\n";  // avoid ostream << std::endl flushes
+
+/**
+ * Schema generator.  Writes gen-schema/<program>.tschema, the types and
+ * services of a program and everything it includes, in the plain text
+ * form that apache::thrift::protocol::TSchema loads at run time, so tools
+ * that don't link generated code can still decode its messages.
+ *
+ * The file starts with "thrift-schema 1", then has one declaration a line:
+ *
+ *   enum <name>
+ *   value <name> <number>             (a value of the last enum)
+ *   struct|union|exception <name>
+ *   field <id> <req|opt|def> <type> <name>   (a field of the last struct)
+ *   service <name> [<extends>]
+ *   function <name> <oneway 0|1> <args struct> <result struct>
+ *
+ * Names are qualified with the program, as in tutorial.Work.  A type is
+ * one of bool, byte, i16, i32, i64, double, string, binary, enum:<name>,
+ * struct:<name>, list<type>, set<type> or map<type,type>, with no spaces.
+ * Each function's arguments and result are declared as the structs
+ * <service>_<function>_args and _result, the way they go on the wire; the
+ * result's field 0 is success, unless the function is void.
+ */
+class t_schema_generator : public t_generator {
+ public:
+  t_schema_generator(t_program* program,
+                     const std::map<std::string, std::string>& parsed_options,
+                     const std::string& option_string)
+    : t_generator(program) {
+    (void) parsed_options;
+    (void) option_string;
+    out_dir_base_ = "gen-schema";
+  }
+
+  void init_generator();
+  void close_generator();
+
+  void generate_typedef(t_typedef* ttypedef) { (void) ttypedef; }
+  void generate_enum(t_enum* tenum);
+  void generate_struct(t_struct* tstruct);
+  void generate_xception(t_struct* txception);
+  void generate_service(t_service* tservice);
+
+ private:
+  void generate_included(t_program* program);
+  void generate_schema_struct(const string& kind, const string& name, t_struct* tstruct);
+
+  string qualified_name(t_type* ttype);
+  string schema_type(t_type* ttype);
+  string schema_req(t_field* tfield);
+
+  std::ofstream f_out_;
+  set<t_program*> done_;
+};
+
+/**
+ * Opens the file, and writes the programs included, which come first.
+ */
+void t_schema_generator::init_generator() {
+  MKDIR(get_out_dir().c_str());
+  string fname = get_out_dir() + program_->get_name() + ".tschema";
+  f_out_.open(fname.c_str());
+  f_out_ << "thrift-schema 1" << endl;
+
+  done_.insert(program_);
+  const vector<t_program*>& includes = program_->get_includes();
+  for (size_t i = 0; i < includes.size(); ++i) {
+    generate_included(includes[i]);
+  }
+}
+
+void t_schema_generator::close_generator() {
+  f_out_.close();
+}
+
+/**
+ * Writes the declarations of an included program, after those of what it
+ * includes in turn.
+ */
+void t_schema_generator::generate_included(t_program* program) {
+  if (!done_.insert(program).second) {
+    return;
+  }
+  const vector<t_program*>& includes = program->get_includes();
+  for (size_t i = 0; i < includes.size(); ++i) {
+    generate_included(includes[i]);
+  }
+
+  const vector<t_enum*>& enums = program->get_enums();
+  for (size_t i = 0; i < enums.size(); ++i) {
+    generate_enum(enums[i]);
+  }
+  const vector<t_struct*>& objects = program->get_objects();
+  for (size_t i = 0; i < objects.size(); ++i) {
+    if (objects[i]->is_xception()) {
+      generate_xception(objects[i]);
+    } else {
+      generate_struct(objects[i]);
+    }
+  }
+  const vector<t_service*>& services = program->get_services();
+  for (size_t i = 0; i < services.size(); ++i) {
+    generate_service(services[i]);
+  }
+}
+
+void t_schema_generator::generate_enum(t_enum* tenum) {
+  f_out_ << "enum " << qualified_name(tenum) << endl;
+  vector<t_enum_value*> values = tenum->get_constants();
+  for (size_t i = 0; i < values.size(); ++i) {
+    f_out_ << "value " << values[i]->get_name() << " " << values[i]->get_value() << endl;
+  }
+}
+
+void t_schema_generator::generate_struct(t_struct* tstruct) {
+  generate_schema_struct(tstruct->is_union() ? "union" : "struct",
+                         qualified_name(tstruct),
+                         tstruct);
+}
+
+void t_schema_generator::generate_xception(t_struct* txception) {
+  generate_schema_struct("exception", qualified_name(txception), txception);
+}
+
+void t_schema_generator::generate_schema_struct(const string& kind,
+                                                const string& name,
+                                                t_struct* tstruct) {
+  f_out_ << kind << " " << name << endl;
+  const vector<t_field*>& fields = tstruct->get_sorted_members();
+  for (size_t i = 0; i < fields.size(); ++i) {
+    f_out_ <<
+      "field " << fields[i]->get_key() << " " << schema_req(fields[i]) << " " <<
+      schema_type(fields[i]->get_type()) << " " << fields[i]->get_name() << endl;
+  }
+}
+
+/**
+ * Writes a service, then the args and result structs of its functions.
+ */
+void t_schema_generator::generate_service(t_service* tservice) {
+  string name = qualified_name(tservice);
+  f_out_ << "service " << name;
+  if (tservice->get_extends() != NULL) {
+    f_out_ << " " << qualified_name(tservice->get_extends());
+  }
+  f_out_ << endl;
+
+  const vector<t_function*>& functions = tservice->get_functions();
+  for (size_t i = 0; i < functions.size(); ++i) {
+    string prefix = name + "_" + functions[i]->get_name();
+    f_out_ <<
+      "function " << functions[i]->get_name() << " " << (functions[i]->is_oneway() ? 1 : 0) <<
+      " " << prefix << "_args " << prefix << "_result" << endl;
+  }
+
+  for (size_t i = 0; i < functions.size(); ++i) {
+    t_function* tfunction = functions[i];
+    string prefix = name + "_" + tfunction->get_name();
+    generate_schema_struct("struct", prefix + "_args", tfunction->get_arglist());
+
+    f_out_ << "struct " << prefix << "_result" << endl;
+    if (!tfunction->get_returntype()->is_void()) {
+      f_out_ << "field 0 opt " << schema_type(tfunction->get_returntype()) << " success" << endl;
+    }
+    const vector<t_field*>& xceptions = tfunction->get_xceptions()->get_members();
+    for (size_t j = 0; j < xceptions.size(); ++j) {
+      f_out_ <<
+        "field " << xceptions[j]->get_key() << " opt " <<
+        schema_type(xceptions[j]->get_type()) << " " << xceptions[j]->get_name() << endl;
+    }
+  }
+}
+
+/**
+ * The name of a type, service or enum, after its program's name.
+ */
+string t_schema_generator::qualified_name(t_type* ttype) {
+  t_program* program = ttype->get_program();
+  if (program == NULL) {
+    program = program_;
+  }
+  return program->get_name() + "." + ttype->get_name();
+}
+
+string t_schema_generator::schema_type(t_type* ttype) {
+  t_type* type = get_true_type(ttype);
+  if (type->is_base_type()) {
+    t_base_type* tbase = (t_base_type*)type;
+    switch (tbase->get_base()) {
+    case t_base_type::TYPE_STRING:
+      return tbase->is_binary() ? "binary" : "string";
+    case t_base_type::TYPE_BOOL:
+      return "bool";
+    case t_base_type::TYPE_BYTE:
+      return "byte";
+    case t_base_type::TYPE_I16:
+      return "i16";
+    case t_base_type::TYPE_I32:
+      return "i32";
+    case t_base_type::TYPE_I64:
+      return "i64";
+    case t_base_type::TYPE_DOUBLE:
+      return "double";
+    default:
+      throw "compiler error: no schema type for base type " +
+        t_base_type::t_base_name(tbase->get_base());
+    }
+  } else if (type->is_enum()) {
+    return "enum:" + qualified_name(type);
+  } else if (type->is_struct() || type->is_xception()) {
+    return "struct:" + qualified_name(type);
+  } else if (type->is_map()) {
+    return "map<" + schema_type(((t_map*)type)->get_key_type()) + "," +
+      schema_type(((t_map*)type)->get_val_type()) + ">";
+  } else if (type->is_set()) {
+    return "set<" + schema_type(((t_set*)type)->get_elem_type()) + ">";
+  } else if (type->is_list()) {
+    return "list<" + schema_type(((t_list*)type)->get_elem_type()) + ">";
+  }
+  throw "compiler error: no schema type for " + type->get_name();
+}
+
+string t_schema_generator::schema_req(t_field* tfield) {
+  switch (tfield->get_req()) {
+  case t_field::T_REQUIRED:
+    return "req";
+  case t_field::T_OPTIONAL:
+    return "opt";
+  default:
+    return "def";
+  }
+}
+
+THRIFT_REGISTER_GENERATOR(schema, "Schema for dynamic decoding (TSchema)", "")
@@ -34,13 +34,19 @@
 #include <time.h>
 #include <string>
 #include <algorithm>
+#include <map>
+#include <set>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
 
 #ifdef MINGW
 # include <windows.h> /* for GetFullPathName */
+#else
+# include <sys/wait.h>
 #endif
 
 // Careful: must include globals first for extern definitions
@@ -50,6 +56,7 @@
 #include "parse/t_program.h"
 #include "parse/t_scope.h"
 #include "generate/t_generator.h"
+#include "platform.h"
 
 #include "version.h"
 
@@ -160,6 +167,29 @@ int g_allow_64bit_consts = 0;
  */
 bool gen_recurse = false;
 
+/**
+ * Number of processes to generate code with
+ */
+int gen_jobs = 1;
+
+/**
+ * Whether generated files whose contents did not change are left untouched
+ */
+bool gen_keep_unchanged = false;
+
+/**
+ * Whether to report performance problems in the IDL, and the protocol
+ * ("binary" or "compact") to estimate struct sizes for, if any
+ */
+bool lint_perf = false;
+string lint_perf_protocol;
+
+/**
+ * Programs parsed so far, keyed by path and include prefix, so that a file
+ * included from many others is only parsed once per run
+ */
+map<string, t_program*> g_parsed_programs;
+
 /**
  * MinGW doesn't have realpath, so use fallback implementation in that case,
  * otherwise this just calls through to realpath
@@ -622,6 +652,209 @@ void generate_all_fingerprints(t_program* program) {
   */
 }
 
+/**
+ * How deep optional struct fields may nest before lint_program_perf() says so
+ */
+const int LINT_PERF_MAX_OPTIONAL_DEPTH = 4;
+
+/**
+ * How many string keys a constant map may have before lint_program_perf() says so
+ */
+const size_t LINT_PERF_MAX_STRING_KEYS = 32;
+
+/**
+ * Prints one of lint_program_perf()'s findings
+ */
+void lint_perf_report(t_program* program, const string& where, const char* fmt, ...) {
+  va_list args;
+  printf("[PERF:%s] %s: ", program->get_path().c_str(), where.c_str());
+  va_start(args, fmt);
+  vprintf(fmt, args);
+  va_end(args);
+  printf("\n");
+}
+
+/**
+ * Looks for containers that are costly to encode or compare in a field's
+ * type, including containers of containers
+ */
+void lint_perf_type(t_program* program, const string& where, t_type* type) {
+  type = type->get_true_type();
+  if (type->is_list()) {
+    t_type* elem = ((t_list*)type)->get_elem_type()->get_true_type();
+    if (elem->is_base_type() && ((t_base_type*)elem)->get_base() == t_base_type::TYPE_BYTE) {
+      lint_perf_report(program, where,
+                       "list<byte> is read and written a byte at a time; "
+                       "binary is one length and one copy");
+    }
+    lint_perf_type(program, where, elem);
+  } else if (type->is_set() || type->is_map()) {
+    t_type* key = type->is_set()
+      ? ((t_set*)type)->get_elem_type()->get_true_type()
+      : ((t_map*)type)->get_key_type()->get_true_type();
+    if (key->is_struct() || key->is_xception()) {
+      lint_perf_report(program, where,
+                       "%s keyed by struct %s is ordered with a hand-written operator<; "
+                       "key it by a scalar, or generate C++ with the unordered option "
+                       "to hash the structs instead",
+                       type->is_set() ? "set" : "map", key->get_name().c_str());
+    }
+    lint_perf_type(program, where, key);
+    if (type->is_map()) {
+      lint_perf_type(program, where, ((t_map*)type)->get_val_type());
+    }
+  }
+}
+
+/**
+ * How many optional struct fields deep a struct goes at most
+ */
+int lint_perf_optional_depth(t_struct* tstruct, set<t_struct*>& active) {
+  if (!active.insert(tstruct).second) {
+    return 0;
+  }
+  int depth = 0;
+  const vector<t_field*>& members = tstruct->get_members();
+  for (size_t i = 0; i < members.size(); ++i) {
+    t_type* type = members[i]->get_type()->get_true_type();
+    if (members[i]->get_req() == t_field::T_OPTIONAL && type->is_struct()) {
+      depth = max(depth, 1 + lint_perf_optional_depth((t_struct*)type, active));
+    }
+  }
+  active.erase(tstruct);
+  return depth;
+}
+
+/**
+ * The bytes a varint takes
+ */
+int lint_perf_varint_size(uint32_t value) {
+  int size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+/**
+ * The fewest bytes a value of the given type encodes to with
+ * lint_perf_protocol, with optional fields unset and containers empty
+ */
+int lint_perf_min_size(t_type* type, set<t_struct*>& active) {
+  bool compact = lint_perf_protocol == "compact";
+  type = type->get_true_type();
+  if (type->is_enum()) {
+    return compact ? 1 : 4;
+  } else if (type->is_base_type()) {
+    switch (((t_base_type*)type)->get_base()) {
+    case t_base_type::TYPE_STRING:
+      return compact ? 1 : 4;
+    case t_base_type::TYPE_BOOL:
+    case t_base_type::TYPE_BYTE:
+      return 1;
+    case t_base_type::TYPE_I16:
+      return compact ? 1 : 2;
+    case t_base_type::TYPE_I32:
+      return compact ? 1 : 4;
+    case t_base_type::TYPE_I64:
+      return compact ? 1 : 8;
+    case t_base_type::TYPE_DOUBLE:
+      return 8;
+    default:
+      return 0;
+    }
+  } else if (type->is_list() || type->is_set()) {
+    return compact ? 1 : 5;
+  } else if (type->is_map()) {
+    return compact ? 1 : 6;
+  } else if (type->is_struct() || type->is_xception()) {
+    t_struct* tstruct = (t_struct*)type;
+    if (!active.insert(tstruct).second) {
+      return 0;
+    }
+    int size = 1;  // field stop
+    int last_id = 0;
+    const vector<t_field*>& members = tstruct->get_sorted_members();
+    for (size_t i = 0; i < members.size(); ++i) {
+      if (members[i]->get_req() == t_field::T_OPTIONAL) {
+        continue;
+      }
+      int id = members[i]->get_key();
+      if (!compact) {
+        size += 3;
+      } else if (id > last_id && id - last_id <= 15) {
+        size += 1;
+      } else {
+        size += 1 + lint_perf_varint_size((uint32_t)((id << 1) ^ (id >> 31)));
+      }
+      last_id = id;
+      t_type* ftype = members[i]->get_type()->get_true_type();
+      bool in_header = compact && ftype->is_base_type() &&
+        ((t_base_type*)ftype)->get_base() == t_base_type::TYPE_BOOL;
+      if (!in_header) {
+        size += lint_perf_min_size(ftype, active);
+      }
+    }
+    active.erase(tstruct);
+    return size;
+  }
+  return 0;
+}
+
+/**
+ * Reports the parts of a program likely to be slow to encode, decode or
+ * compare, with what to use instead, and if a protocol was given, the
+ * smallest each struct can encode to with it
+ */
+void lint_program_perf(t_program* program) {
+  const vector<t_struct*>& objects = program->get_objects();
+  for (size_t i = 0; i < objects.size(); ++i) {
+    t_struct* tstruct = objects[i];
+    const vector<t_field*>& members = tstruct->get_members();
+    for (size_t j = 0; j < members.size(); ++j) {
+      lint_perf_type(program, tstruct->get_name() + "." + members[j]->get_name(),
+                     members[j]->get_type());
+    }
+
+    set<t_struct*> active;
+    int depth = lint_perf_optional_depth(tstruct, active);
+    if (depth >= LINT_PERF_MAX_OPTIONAL_DEPTH) {
+      lint_perf_report(program, tstruct->get_name(),
+                       "optional structs nest %d deep, and each level is a nested "
+                       "read, write and __isset check; flatten the rarely set levels",
+                       depth);
+    }
+
+    if (!lint_perf_protocol.empty()) {
+      lint_perf_report(program, tstruct->get_name(),
+                       "at least %d bytes in %s, with optional fields unset",
+                       lint_perf_min_size(tstruct, active), lint_perf_protocol.c_str());
+    }
+  }
+
+  const vector<t_typedef*>& typedefs = program->get_typedefs();
+  for (size_t i = 0; i < typedefs.size(); ++i) {
+    lint_perf_type(program, typedefs[i]->get_symbolic(), typedefs[i]->get_type());
+  }
+
+  const vector<t_const*>& consts = program->get_consts();
+  for (size_t i = 0; i < consts.size(); ++i) {
+    t_type* type = consts[i]->get_type()->get_true_type();
+    if (!type->is_map()) {
+      continue;
+    }
+    t_type* key = ((t_map*)type)->get_key_type()->get_true_type();
+    size_t entries = consts[i]->get_value()->get_map().size();
+    if (key->is_string() && entries > LINT_PERF_MAX_STRING_KEYS) {
+      lint_perf_report(program, consts[i]->get_name(),
+                       "map of %lu string keys; if they are a fixed set, an enum "
+                       "key is smaller to send and cheaper to look up",
+                       (unsigned long)entries);
+    }
+  }
+}
+
 /**
  * Prints the version number
  */
@@ -633,7 +866,7 @@ void version() {
  * Display the usage message and then exit with an error code.
  */
 void usage() {
-  fprintf(stderr, "Usage: thrift [options] file\n\n");
+  fprintf(stderr, "Usage: thrift [options] file...\n\n");
   fprintf(stderr, "Use thrift -help for a list of options\n");
   exit(1);
 }
@@ -642,7 +875,7 @@ void usage() {
  * Diplays the help message and then exits with an error code.
  */
 void help() {
-  fprintf(stderr, "Usage: thrift [options] file\n");
+  fprintf(stderr, "Usage: thrift [options] file...\n");
   fprintf(stderr, "Options:\n");
   fprintf(stderr, "  -version    Print the compiler version\n");
   fprintf(stderr, "  -o dir      Set the output directory for gen-* packages\n");
@@ -655,6 +888,12 @@ void help() {
   fprintf(stderr, "  -strict     Strict compiler warnings on\n");
   fprintf(stderr, "  -v[erbose]  Verbose mode\n");
   fprintf(stderr, "  -r[ecurse]  Also generate included files\n");
+  fprintf(stderr, "  -j[obs] N   Generate with N processes\n");
+  fprintf(stderr, "  -keep-unchanged  Do not rewrite generated files whose contents\n");
+  fprintf(stderr, "                are unchanged, so their timestamps are kept\n");
+  fprintf(stderr, "  -lint-perf[=binary|compact]  Report types likely to be slow to\n");
+  fprintf(stderr, "                encode or compare, and with a protocol, the smallest\n");
+  fprintf(stderr, "                each struct encodes to\n");
   fprintf(stderr, "  -debug      Parse debug trace to stdout\n");
   fprintf(stderr, "  --allow-neg-keys  Allow negative field keys (Used to "
           "preserve protocol\n");
@@ -833,6 +1072,14 @@ bool validate_throws(t_struct* throws) {
   return true;
 }
 
+/**
+ * Key under which a program is kept in g_parsed_programs. The include prefix
+ * is part of it since generated code refers to includes through it.
+ */
+string parsed_key(t_program* program) {
+  return program->get_path() + "\n" + program->get_include_prefix();
+}
+
 /**
  * Parses a program
  */
@@ -869,7 +1116,15 @@ void parse(t_program* program, t_program* parent_program) {
   vector<t_program*>& includes = program->get_includes();
   vector<t_program*>::iterator iter;
   for (iter = includes.begin(); iter != includes.end(); ++iter) {
-    parse(*iter, program);
+    map<string, t_program*>::iterator parsed = g_parsed_programs.find(parsed_key(*iter));
+    if (parsed != g_parsed_programs.end()) {
+      // Already parsed through another include, so share it
+      delete *iter;
+      *iter = parsed->second;
+      program->scope()->add_scope((*iter)->scope(), (*iter)->get_name() + ".");
+    } else {
+      parse(*iter, program);
+    }
   }
 
   // Parse the program file
@@ -893,23 +1148,36 @@ void parse(t_program* program, t_program* parent_program) {
     failure(x.c_str());
   }
   fclose(yyin);
+
+  g_parsed_programs[parsed_key(program)] = program;
 }
 
 /**
- * Generate code
+ * Lists the programs to generate code for, included programs ahead of the
+ * programs including them. seen holds the file and output path of those
+ * already listed, so no output is generated twice.
  */
-void generate(t_program* program, const vector<string>& generator_strings) {
+void schedule(t_program* program, set<string>& seen, vector<t_program*>& programs) {
   // Oooohh, recursive code generation, hot!!
   if (gen_recurse) {
     const vector<t_program*>& includes = program->get_includes();
     for (size_t i = 0; i < includes.size(); ++i) {
-      // Propogate output path from parent to child programs
-      includes[i]->set_out_path(program->get_out_path(), program->is_out_path_absolute());
+      if (seen.insert(includes[i]->get_path() + "\n" + program->get_out_path()).second) {
+        // Propogate output path from parent to child programs
+        includes[i]->set_out_path(program->get_out_path(), program->is_out_path_absolute());
 
-      generate(includes[i], generator_strings);
+        schedule(includes[i], seen, programs);
+      }
     }
   }
 
+  programs.push_back(program);
+}
+
+/**
+ * Generate code
+ */
+void generate(t_program* program, const vector<string>& generator_strings) {
   // Generate code!
   try {
     pverbose("Program: %s\n", program->get_path().c_str());
@@ -942,6 +1210,134 @@ void generate(t_program* program, const vector<string>& generator_strings) {
 
 }
 
+/**
+ * Generates code for each of the programs, spread over up to gen_jobs
+ * processes. The generators keep global state and so cannot share a process
+ * between threads; forking once the tree is parsed gives each worker its own
+ * copy of it instead. Returns false if a worker failed.
+ */
+bool generate_all(const vector<t_program*>& programs, const vector<string>& generator_strings) {
+  size_t jobs = gen_jobs > 1 ? min((size_t)gen_jobs, programs.size()) : 1;
+#ifdef MINGW
+  if (jobs > 1) {
+    pwarning(1, "-j is not supported on this platform, generating serially\n");
+    jobs = 1;
+  }
+#endif
+  if (jobs <= 1) {
+    for (size_t i = 0; i < programs.size(); ++i) {
+      generate(programs[i], generator_strings);
+    }
+    return true;
+  }
+
+#ifdef MINGW
+  return true;
+#else
+  fflush(stdout);
+  fflush(stderr);
+  vector<pid_t> workers;
+  for (size_t job = 0; job < jobs; ++job) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "Could not start a generator process: %s\n", strerror(errno));
+      break;
+    }
+    if (pid == 0) {
+      for (size_t i = job; i < programs.size(); i += jobs) {
+        generate(programs[i], generator_strings);
+      }
+      fflush(stdout);
+      fflush(stderr);
+      _exit(0);
+    }
+    workers.push_back(pid);
+  }
+
+  bool ok = workers.size() == jobs;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    int status;
+    if (waitpid(workers[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      ok = false;
+    }
+  }
+  return ok;
+#endif
+}
+
+/**
+ * Reads a whole file, returning false if it could not be opened
+ */
+bool read_file(const string& path, string& contents) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+  contents.clear();
+  char buf[8192];
+  size_t got;
+  while ((got = fread(buf, 1, sizeof(buf), file)) > 0) {
+    contents.append(buf, got);
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * Moves each file under the staging directory to the same place under the
+ * output directory, except where the output already has the same contents,
+ * then removes the staging directory. Leaving unchanged files alone keeps
+ * their timestamps, so builds do not recompile everything including them.
+ */
+bool move_changed_files(const string& staging, const string& out) {
+  DIR* dir = opendir(staging.c_str());
+  if (dir == NULL) {
+    fprintf(stderr, "Could not read %s: %s\n", staging.c_str(), strerror(errno));
+    return false;
+  }
+
+  bool ok = true;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    string from = staging + "/" + name;
+    string to = out + "/" + name;
+
+    struct stat sb;
+    if (stat(from.c_str(), &sb) < 0) {
+      ok = false;
+      continue;
+    }
+    if (S_ISDIR(sb.st_mode)) {
+      MKDIR(to.c_str());
+      ok = move_changed_files(from, to) && ok;
+      continue;
+    }
+
+    string generated;
+    string existing;
+    if (read_file(from, generated) && read_file(to, existing) && generated == existing) {
+      remove(from.c_str());
+      continue;
+    }
+#ifdef MINGW
+    // rename does not replace an existing file here
+    remove(to.c_str());
+#endif
+    if (rename(from.c_str(), to.c_str()) != 0) {
+      fprintf(stderr, "Could not write %s: %s\n", to.c_str(), strerror(errno));
+      ok = false;
+    }
+  }
+  closedir(dir);
+
+  rmdir(staging.c_str());
+  return ok;
+}
+
 /**
  * Parse it up.. then spit it back out, in pretty much every language. Alright
  * not that many languages, but the cool ones that we care about.
@@ -967,7 +1363,8 @@ int main(int argc, char** argv) {
   g_curpath = "arguments";
 
   // Hacky parameter handling... I didn't feel like using a library sorry!
-  for (i = 1; i < argc-1; i++) {
+  // Options end at the first argument that is not one; the rest are files.
+  for (i = 1; i < argc-1 && argv[i][0] == '-'; i++) {
     char* arg;
 
     arg = strtok(argv[i], " ");
@@ -993,6 +1390,24 @@ int main(int argc, char** argv) {
         g_verbose = 1;
       } else if (strcmp(arg, "-r") == 0 || strcmp(arg, "-recurse") == 0 ) {
         gen_recurse = true;
+      } else if (strcmp(arg, "-j") == 0 || strcmp(arg, "-jobs") == 0) {
+        arg = argv[++i];
+        if (arg == NULL || atoi(arg) < 1) {
+          fprintf(stderr, "-j: missing number of processes\n");
+          usage();
+        }
+        gen_jobs = atoi(arg);
+      } else if (strcmp(arg, "-keep-unchanged") == 0) {
+        gen_keep_unchanged = true;
+      } else if (strcmp(arg, "-lint-perf") == 0) {
+        lint_perf = true;
+      } else if (strncmp(arg, "-lint-perf=", 11) == 0) {
+        lint_perf = true;
+        lint_perf_protocol = arg + 11;
+        if (lint_perf_protocol != "binary" && lint_perf_protocol != "compact") {
+          fprintf(stderr, "-lint-perf: unknown protocol %s\n", arg + 11);
+          usage();
+        }
       } else if (strcmp(arg, "-allow-neg-keys") == 0) {
         g_allow_neg_field_keys = true;
       } else if (strcmp(arg, "-allow-64bit-consts") == 0) {
@@ -1053,40 +1468,16 @@ int main(int argc, char** argv) {
     exit(1);
   }
 
-  // You gotta generate something!
-  if (generator_strings.empty()) {
+  // You gotta generate something! Or at least lint it.
+  if (generator_strings.empty() && !lint_perf) {
     fprintf(stderr, "No output language(s) specified\n");
     usage();
   }
 
-  // Real-pathify it
-  char rp[PATH_MAX];
   if (argv[i] == NULL) {
     fprintf(stderr, "Missing file name\n");
     usage();
   }
-  if (saferealpath(argv[i], rp) == NULL) {
-    failure("Could not open input file with realpath: %s", argv[i]);
-  }
-  string input_file(rp);
-
-  // Instance of the global parse tree
-  t_program* program = new t_program(input_file);
-  if (out_path.size()) {
-    program->set_out_path(out_path, out_path_is_absolute);
-  }
-
-  // Compute the cpp include prefix.
-  // infer this from the filename passed in
-  string input_filename = argv[i];
-  string include_prefix;
-
-  string::size_type last_slash = string::npos;
-  if ((last_slash = input_filename.rfind("/")) != string::npos) {
-    include_prefix = input_filename.substr(0, last_slash);
-  }
-
-  program->set_include_prefix(include_prefix);
 
   // Initialize global types
   g_type_void   = new t_base_type("void",   t_base_type::TYPE_VOID);
@@ -1102,8 +1493,59 @@ int main(int argc, char** argv) {
   g_type_i64    = new t_base_type("i64",    t_base_type::TYPE_I64);
   g_type_double = new t_base_type("double", t_base_type::TYPE_DOUBLE);
 
-  // Parse it!
-  parse(program, NULL);
+  // With -keep-unchanged, everything is generated into a staging directory
+  // next to the real output and only changed files are moved over after
+  string staging_path;
+  if (gen_keep_unchanged) {
+    char pid[32];
+    sprintf(pid, "%d", (int)getpid());
+    staging_path = (out_path.size() ? out_path : string(".")) + "/.thrift-staging-" + pid;
+    MKDIR(staging_path.c_str());
+    if (!check_is_directory(staging_path.c_str())) {
+      return -1;
+    }
+  }
+
+  // Parse each input file, sharing whatever they include
+  vector<t_program*> programs;
+  for (; i < argc; i++) {
+    // Real-pathify it
+    char rp[PATH_MAX];
+    if (saferealpath(argv[i], rp) == NULL) {
+      failure("Could not open input file with realpath: %s", argv[i]);
+    }
+    string input_file(rp);
+
+    // Compute the cpp include prefix.
+    // infer this from the filename passed in
+    string input_filename = argv[i];
+    string include_prefix;
+
+    string::size_type last_slash = string::npos;
+    if ((last_slash = input_filename.rfind("/")) != string::npos) {
+      include_prefix = input_filename.substr(0, last_slash);
+    }
+
+    // Instance of the global parse tree
+    t_program* program = new t_program(input_file);
+    program->set_include_prefix(include_prefix);
+
+    map<string, t_program*>::iterator parsed = g_parsed_programs.find(parsed_key(program));
+    if (parsed != g_parsed_programs.end()) {
+      delete program;
+      program = parsed->second;
+    } else {
+      // Parse it!
+      parse(program, NULL);
+    }
+
+    if (staging_path.size()) {
+      program->set_out_path(staging_path, out_path_is_absolute);
+    } else if (out_path.size()) {
+      program->set_out_path(out_path, out_path_is_absolute);
+    }
+    programs.push_back(program);
+  }
 
   // The current path is not really relevant when we are doing generation.
   // Reset the variable to make warning messages clearer.
@@ -1112,14 +1554,37 @@ int main(int argc, char** argv) {
   // That is what shows up during argument parsing.
   yylineno = 1;
 
-  // Generate it!
-  generate(program, generator_strings);
+  // Generate it! Files named on the command line are generated as given
+  // there rather than as some other file includes them.
+  set<string> seen;
+  vector<t_program*> named;
+  for (size_t p = 0; p < programs.size(); ++p) {
+    if (seen.insert(programs[p]->get_path() + "\n" + programs[p]->get_out_path()).second) {
+      named.push_back(programs[p]);
+    }
+  }
+  vector<t_program*> scheduled;
+  for (size_t p = 0; p < named.size(); ++p) {
+    schedule(named[p], seen, scheduled);
+  }
+  if (lint_perf) {
+    for (size_t p = 0; p < scheduled.size(); ++p) {
+      lint_program_perf(scheduled[p]);
+    }
+  }
+  bool generated = generate_all(scheduled, generator_strings);
+
+  if (staging_path.size()) {
+    string out = out_path.size() ? out_path : string(".");
+    if (!move_changed_files(staging_path, out)) {
+      generated = false;
+    }
+  }
 
   // Clean up. Who am I kidding... this program probably orphans heap memory
   // all over the place, but who cares because it is about to exit and it is
   // all referenced and used by this wacky parse tree up until now anyways.
 
-  delete program;
   delete g_type_void;
   delete g_type_string;
   delete g_type_bool;
@@ -1130,5 +1595,5 @@ int main(int argc, char** argv) {
   delete g_type_double;
 
   // Finished
-  return 0;
+  return generated ? 0 : 1;
 }
@@ -72,6 +72,31 @@ class t_scope {
     return constants_[name];
   }
 
+  /**
+   * Adds everything defined in another scope under the given prefix, as
+   * parsing an included program does for the program including it.
+   */
+  void add_scope(const t_scope* scope, const std::string& prefix) {
+    std::map<std::string, t_type*>::const_iterator t_iter;
+    for (t_iter = scope->types_.begin(); t_iter != scope->types_.end(); ++t_iter) {
+      if (t_iter->second != NULL) {
+        types_[prefix + t_iter->first] = t_iter->second;
+      }
+    }
+    std::map<std::string, t_service*>::const_iterator s_iter;
+    for (s_iter = scope->services_.begin(); s_iter != scope->services_.end(); ++s_iter) {
+      if (s_iter->second != NULL) {
+        services_[prefix + s_iter->first] = s_iter->second;
+      }
+    }
+    std::map<std::string, t_const*>::const_iterator c_iter;
+    for (c_iter = scope->constants_.begin(); c_iter != scope->constants_.end(); ++c_iter) {
+      if (c_iter->second != NULL) {
+        constants_[prefix + c_iter->first] = c_iter->second;
+      }
+    }
+  }
+
   void print() {
     std::map<std::string, t_type*>::iterator iter;
     for (iter = types_.begin(); iter != types_.end(); ++iter) {
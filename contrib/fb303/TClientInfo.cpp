@@ -24,15 +24,50 @@ namespace apache { namespace thrift { namespace server {
 using namespace apache::thrift;
 using namespace apache::thrift::transport;
 
-TClientInfoConnection::TClientInfoConnection() {
+TClientInfoConnection::TClientInfoConnection()
+  : seq_(0) {
   call_[kNameLen - 1] = '\0';    // insure NUL terminator is there
   eraseAddr();
   eraseCall();
 }
 
+void TClientInfoConnection::beginWrite() {
+  // only a connection's own thread normally writes, but a closing one
+  // may still be clearing its call when the descriptor is reused
+  uint32_t seq = __atomic_load_n(&seq_, __ATOMIC_RELAXED);
+  while ((seq & 1) ||
+         !__atomic_compare_exchange_n(&seq_, &seq, seq + 1, true,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    seq = __atomic_load_n(&seq_, __ATOMIC_RELAXED);
+  }
+  // keep the field writes after the sequence number turns odd
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void TClientInfoConnection::endWrite() {
+  __atomic_store_n(&seq_, seq_ + 1, __ATOMIC_RELEASE);
+}
+
+void TClientInfoConnection::snapshot(TClientInfoConnection* out) const {
+  uint32_t before;
+  uint32_t after;
+  do {
+    before = __atomic_load_n(&seq_, __ATOMIC_ACQUIRE);
+    memcpy(out->call_, call_, sizeof(call_));
+    memcpy((void*)&out->addr_, (const void*)&addr_, sizeof(addr_));
+    out->time_ = time_;
+    out->ncalls_ = ncalls_;
+    // keep the field reads before the second look at the number
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&seq_, __ATOMIC_RELAXED);
+  } while ((before & 1) || before != after);
+  out->seq_ = 0;
+}
+
 void TClientInfoConnection::recordAddr(const sockaddr* addr) {
-  eraseAddr();
-  initTime();
+  beginWrite();
+  addr_.ipv4.sin_family = AF_UNSPEC;
+  clock_gettime(CLOCK_REALTIME, &time_);
   ncalls_ = 0;
   if (addr != NULL) {
     if (addr->sa_family == AF_INET) {
@@ -42,10 +77,13 @@ void TClientInfoConnection::recordAddr(const sockaddr* addr) {
       memcpy((void*)&addr_.ipv6, (const void *)addr, sizeof(sockaddr_in6));
     }
   }
+  endWrite();
 }
 
 void TClientInfoConnection::eraseAddr() {
+  beginWrite();
   addr_.ipv4.sin_family = AF_UNSPEC;
+  endWrite();
 }
 
 const char* TClientInfoConnection::getAddr(char* buf, int len) const {
@@ -60,12 +98,16 @@ const char* TClientInfoConnection::getAddr(char* buf, int len) const {
 }
 
 void TClientInfoConnection::recordCall(const char* name) {
+  beginWrite();
   strncpy(call_, name, kNameLen - 1);   // NUL terminator set in constructor
   ncalls_++;
+  endWrite();
 }
 
 void TClientInfoConnection::eraseCall() {
+  beginWrite();
   call_[0] = '\0';
+  endWrite();
 }
 
 const char* TClientInfoConnection::getCall() const {
@@ -83,10 +125,6 @@ uint64_t TClientInfoConnection::getNCalls() const {
   return ncalls_;
 }
 
-void TClientInfoConnection::initTime() {
-  clock_gettime(CLOCK_REALTIME, &time_);
-}
-
 
 TClientInfoConnection* TClientInfo::getConnection(int fd, bool grow) {
   if (fd < 0 || (!grow && fd >= info_.size())) {
@@ -140,7 +178,10 @@ void TClientInfoServerHandler::getStatsStrings(vector<string>& result) {
   clock_gettime(CLOCK_REALTIME, &now);
 
   for (int i = 0; i < clientInfo_.size(); ++i) {
-    TClientInfoConnection* info = clientInfo_.getConnection(i, false);
+    TClientInfoConnection* live = clientInfo_.getConnection(i, false);
+    TClientInfoConnection snapshot;
+    live->snapshot(&snapshot);
+    TClientInfoConnection* info = &snapshot;
     const char* callStr = info->getCall();
     if (callStr == NULL) {
       continue;
@@ -22,6 +22,7 @@
 
 // for inet_ntop --
 #include <arpa/inet.h>
+#include <climits>
 #include <thrift/server/TServer.h>
 #include <thrift/transport/TSocket.h>
 #include <thrift/concurrency/Mutex.h>
@@ -40,10 +41,10 @@ using std::vector;
  * vector elements never move as the vector grows.  Allocates new space
  * as needed, but does not copy old values.
  *
- * A level vector stores a list of storage vectors containing the actual
- * elements.  Levels are added as needed, doubling in size each time.
- * Locking is only done when a level is added.  Access is amortized
- * constant time.
+ * The elements are kept in levels, each twice the size of the one
+ * before.  No lock is taken: a level is published with a compare and
+ * swap, and a thread that loses the race to add one frees its own and
+ * uses the winner's.  Access is constant time.
  */
 template <typename T>
 class StableVector {
@@ -51,57 +52,58 @@ class StableVector {
   static const uint32_t kInitialSizePowOf2 = 10;
   /// The initial allocation size
   static const uint32_t kInitialVectorSize = 1 << kInitialSizePowOf2;
-  /// This bound is guaranteed not to be exceeded on 64-bit archs
-  static const int kMaxLevels = 64;
+  /// Enough levels for any 32-bit index
+  static const int kMaxLevels = 32 - kInitialSizePowOf2 + 1;
 
-  /// Values are kept in one or more of these
-  typedef vector<T> Vect;
-  /// One or more value vectors are kept in one of these
-  typedef vector<Vect*> LevelVector;
-
-  Mutex mutex_;
-  /// current size
+  /// The levels allocated so far, NULL past them
+  T* levels_[kMaxLevels];
+  /// current size, only ever raised
   size_t size_;
-  _Atomic_word vectLvl_;
-  LevelVector vects_;
 
  public:
   /**
-   * Constructor -- initialize the level vector and allocate the
-   * initial storage vector
+   * Constructor -- allocate the initial storage level
    */
   StableVector()
-    : size_(0) 
-    , vectLvl_(0) {
-    vects_.reserve(kMaxLevels);
-    Vect* storageVector(new Vect(1 << kInitialSizePowOf2));
-    vects_.push_back(storageVector);
+    : size_(0) {
+    for (int i = 0; i < kMaxLevels; ++i) {
+      levels_[i] = NULL;
+    }
+    levels_[0] = new T[kInitialVectorSize];
+  }
+
+  ~StableVector() {
+    for (int i = 0; i < kMaxLevels; ++i) {
+      delete[] levels_[i];
+    }
   }
 
  private:
+  StableVector(const StableVector&);
+  StableVector& operator=(const StableVector&);
+
   /**
-   * make sure the requested number of storage levels have been allocated.
+   * Return the given storage level, allocating it if no thread has yet.
    */
-  void expand(uint32_t level) {
-    // we need the guard to insure that we only allocate once.
-    Guard g(mutex_);
-    while (level > vectLvl_) {
-      Vect* levelVect(new Vect(1 << (vectLvl_ + kInitialSizePowOf2)));
-      vects_.push_back(levelVect);
-      // we need to make sure this is done after levelVect is inserted
-      // (what we want is effectively a memory barrier here).
-      __gnu_cxx::__atomic_add(&vectLvl_, 1);
+  T* level(uint32_t vno) {
+    T* lv = __atomic_load_n(&levels_[vno], __ATOMIC_ACQUIRE);
+    if (lv == NULL) {
+      T* fresh = new T[(size_t)1 << (vno + kInitialSizePowOf2 - 1)];
+      if (__atomic_compare_exchange_n(&levels_[vno], &lv, fresh, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        lv = fresh;
+      } else {
+        delete[] fresh;
+      }
     }
+    return lv;
   }
 
   /**
    * Given an index, determine which level and element of that level is
-   * required.  Grows if needed.
+   * required.
    */
-  void which(uint32_t n, uint32_t* vno, uint32_t* idx) {
-    if (n >= size_) {
-      size_ = n + 1;
-    }
+  void which(uint32_t n, uint32_t* vno, uint32_t* idx) const {
     if (n < kInitialVectorSize) {
       *idx = n;
       *vno = 0;
@@ -109,9 +111,6 @@ class StableVector {
       uint32_t upper = n >> kInitialSizePowOf2;
       *vno = CHAR_BIT*sizeof(upper) - __builtin_clz(upper);
       *idx = n - (1 << (*vno + kInitialSizePowOf2 - 1));
-      if (*vno > vectLvl_) {
-        expand(*vno);
-      }
     }
   }
 
@@ -126,19 +125,31 @@ class StableVector {
     uint32_t vno;
     uint32_t idx;
     which(n, &vno, &idx);
-    return (*vects_[vno])[idx];
+    T* lv = level(vno);
+    // raise the size only once the element's level is there to be read
+    size_t size = __atomic_load_n(&size_, __ATOMIC_RELAXED);
+    while (n >= size &&
+           !__atomic_compare_exchange_n(&size_, &size, (size_t)n + 1, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    return lv[idx];
   }
 
   /**
    * Return the present size of the vector.
    */
-  size_t size() const { return size_; }
+  size_t size() const { return __atomic_load_n(&size_, __ATOMIC_ACQUIRE); }
 };
 
 
 /**
  * This class embodies the representation of a single connection during
  * processing.  We'll keep one of these per file descriptor in TClientInfo.
+ *
+ * The fields are guarded by a seqlock: a writer makes the sequence number
+ * odd while it changes them, and a reader copies them with snapshot(),
+ * trying again if the number changed meanwhile.  Readers never hold up
+ * the request threads writing.
  */
 class TClientInfoConnection {
  public:
@@ -150,6 +161,7 @@ class TClientInfoConnection {
     sockaddr_in6 ipv6;
   };
 
+  uint32_t seq_;                   ///< Odd while the fields are changing
   char call_[kNameLen];            ///< The name of the thrift call
   IPAddrUnion addr_;               ///< The client's IP address
   timespec time_;                  ///< Time processing started
@@ -162,6 +174,13 @@ class TClientInfoConnection {
    */
   TClientInfoConnection();
 
+  /**
+   * Copy a consistent view of this connection into "out", whose getters
+   * can then be used.  The getters below read the live fields as they
+   * are, which is only safe from the thread writing them.
+   */
+  void snapshot(TClientInfoConnection* out) const;
+
   /**
    * A connection has been made; record its address.  Since this is the
    * first we'll know of a connection we start the timer here as well.
@@ -210,7 +229,8 @@ class TClientInfoConnection {
   uint64_t getNCalls() const;
 
  private:
-  void initTime();
+  void beginWrite();
+  void endWrite();
 };
 
 
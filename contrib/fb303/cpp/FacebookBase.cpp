@@ -19,9 +19,16 @@
 
 #include "FacebookBase.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 using namespace facebook::fb303;
 using apache::thrift::concurrency::Guard;
 
+const char* const FacebookBase::VIRTUAL_CALL_SAMPLE_RATE_OPTION =
+  "thrift.virtual_call_sample_rate";
+
 FacebookBase::FacebookBase(std::string name) :
   name_(name) {
   aliveSince_ = (int64_t) time(NULL);
@@ -34,6 +41,11 @@ inline void FacebookBase::getName(std::string& _return) {
 void FacebookBase::setOption(const std::string& key, const std::string& value) {
   Guard g(optionsLock_);
   options_[key] = value;
+#ifndef THRIFT_NO_VIRTUAL_PROFILING
+  if (key == VIRTUAL_CALL_SAMPLE_RATE_OPTION) {
+    apache::thrift::profile_set_sample_rate(atoi(value.c_str()));
+  }
+#endif
 }
 
 void FacebookBase::getOption(std::string& _return, const std::string& key) {
@@ -47,78 +59,64 @@ void FacebookBase::getOptions(std::map<std::string, std::string> & _return) {
 }
 
 int64_t FacebookBase::incrementCounter(const std::string& key, int64_t amount) {
-  counters_.acquireRead();
-
-  // if we didn't find the key, we need to write lock the whole map to create it
-  ReadWriteCounterMap::iterator it = counters_.find(key);
-  if (it == counters_.end()) {
-    counters_.release();
-    counters_.acquireWrite();
-
-    // we need to check again to make sure someone didn't create this key
-    // already while we released the lock
-    it = counters_.find(key);
-    if(it == counters_.end()){
-      counters_[key].value = amount;
-      counters_.release();
-      return amount;
-    }
-  }
-
-  it->second.acquireWrite();
-  int64_t count = it->second.value + amount;
-  it->second.value = count;
-  it->second.release();
-  counters_.release();
-  return count;
+  return counters_.increment(key, amount);
 }
 
 int64_t FacebookBase::setCounter(const std::string& key, int64_t value) {
-  counters_.acquireRead();
-
-  // if we didn't find the key, we need to write lock the whole map to create it
-  ReadWriteCounterMap::iterator it = counters_.find(key);
-  if (it == counters_.end()) {
-    counters_.release();
-    counters_.acquireWrite();
-    counters_[key].value = value;
-    counters_.release();
-    return value;
-  }
-
-  it->second.acquireWrite();
-  it->second.value = value;
-  it->second.release();
-  counters_.release();
+  counters_.set(key, value);
   return value;
 }
 
 void FacebookBase::getCounters(std::map<std::string, int64_t>& _return) {
-  // we need to lock the whole thing and actually build the map since we don't
-  // want our read/write structure to go over the wire
-  counters_.acquireRead();
-  for(ReadWriteCounterMap::iterator it = counters_.begin();
-      it != counters_.end(); it++)
-  {
-    _return[it->first] = it->second.value;
+  counters_.getAll(_return);
+
+  if (latencyStats_.get() != NULL) {
+    latencyStats_->getCounters(_return);
+  }
+
+  if (introspection_.get() != NULL) {
+    introspection_->getCounters(_return);
   }
-  counters_.release();
 }
 
 int64_t FacebookBase::getCounter(const std::string& key) {
-  int64_t rv = 0;
-  counters_.acquireRead();
-  ReadWriteCounterMap::iterator it = counters_.find(key);
-  if (it != counters_.end()) {
-    it->second.acquireRead();
-    rv = it->second.value;
-    it->second.release();
-  }
-  counters_.release();
-  return rv;
+  return counters_.get(key);
 }
 
 inline int64_t FacebookBase::aliveSince() {
   return aliveSince_;
 }
 
+void FacebookBase::getCpuProfile(std::string& _return, int32_t durSecs) {
+  _return = "";
+#ifndef THRIFT_NO_VIRTUAL_PROFILING
+  Guard g(profileLock_);
+
+  if (durSecs > 0) {
+    std::string rate;
+    getOption(rate, VIRTUAL_CALL_SAMPLE_RATE_OPTION);
+    int32_t sampleRate = atoi(rate.c_str());
+    int32_t previousRate = apache::thrift::profile_sampling();
+
+    apache::thrift::profile_reset();
+    apache::thrift::profile_set_sample_rate(sampleRate > 0 ? sampleRate : 100);
+    sleep(durSecs);
+    apache::thrift::profile_set_sample_rate(previousRate);
+  }
+
+  FILE* f = tmpfile();
+  if (f == NULL) {
+    return;
+  }
+  apache::thrift::profile_print_info(f);
+  rewind(f);
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    _return.append(buf, n);
+  }
+  fclose(f);
+#else
+  (void) durSecs;
+#endif
+}
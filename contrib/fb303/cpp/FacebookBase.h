@@ -24,6 +24,9 @@
 
 #include <thrift/server/TServer.h>
 #include <thrift/concurrency/Mutex.h>
+#include <thrift/concurrency/ShardedCounters.h>
+#include <thrift/processor/TLatencyStatsHandler.h>
+#include <thrift/server/TServerIntrospection.h>
 
 #include <time.h>
 #include <string>
@@ -33,7 +36,10 @@ namespace facebook { namespace fb303 {
 
 using apache::thrift::concurrency::Mutex;
 using apache::thrift::concurrency::ReadWriteMutex;
+using apache::thrift::concurrency::ShardedCounters;
+using apache::thrift::processor::TLatencyStatsHandler;
 using apache::thrift::server::TServer;
+using apache::thrift::server::TServerIntrospection;
 
 struct ReadWriteInt : ReadWriteMutex {int64_t value;};
 struct ReadWriteCounterMap : ReadWriteMutex,
@@ -53,7 +59,12 @@ class FacebookBase : virtual public FacebookServiceIf {
   virtual void getVersion(std::string& _return) { _return = ""; }
 
   virtual fb_status getStatus() = 0;
-  virtual void getStatusDetails(std::string& _return) { _return = ""; }
+  virtual void getStatusDetails(std::string& _return) {
+    _return = latencyStats_.get() != NULL ? latencyStats_->getStatsText() : "";
+    if (introspection_.get() != NULL) {
+      _return += introspection_->getStatsText();
+    }
+  }
 
   void setOption(const std::string& key, const std::string& value);
   void getOption(std::string& _return, const std::string& key);
@@ -69,6 +80,11 @@ class FacebookBase : virtual public FacebookServiceIf {
     }
   }
 
+  /**
+   * Counters are sharded by thread, so incrementing takes no lock; the
+   * return value is what the calling thread has added in all, as the total
+   * would need one.  getCounter() and getCounters() sum the threads'.
+   */
   int64_t incrementCounter(const std::string& key, int64_t amount = 1);
   int64_t setCounter(const std::string& key, int64_t value);
 
@@ -82,7 +98,37 @@ class FacebookBase : virtual public FacebookServiceIf {
     server_ = server;
   }
 
-  void getCpuProfile(std::string& _return, int32_t durSecs) { _return = ""; }
+  /**
+   * Report the per-method latencies of a TLatencyStatsHandler, installed
+   * on the service's processor, in getCounters() and getStatusDetails()
+   */
+  void setLatencyStats(boost::shared_ptr<TLatencyStatsHandler> stats) {
+    latencyStats_ = stats;
+  }
+
+  /**
+   * Returns the library's profile of avoidable virtual calls, as
+   * apache::thrift::profile_print_info() prints it, to find hot paths that
+   * run through the generic TProtocol and TTransport.
+   *
+   * Given a duration, discards what was recorded, samples one in every
+   * VIRTUAL_CALL_SAMPLE_RATE_OPTION calls (100 if unset) for that long, and
+   * puts sampling back as it was.  Given 0, returns what has been recorded
+   * while sampling was on from setting that option.  Empty if the library
+   * was built with THRIFT_NO_VIRTUAL_PROFILING.
+   */
+  /**
+   * Report the server's IO threads, connections, task queues and buffer
+   * pools in getCounters() and getStatusDetails()
+   */
+  void setIntrospection(boost::shared_ptr<TServerIntrospection> introspection) {
+    introspection_ = introspection;
+  }
+
+  void getCpuProfile(std::string& _return, int32_t durSecs);
+
+  /// Setting this option to N samples one in every N virtual calls; 0 stops
+  static const char* const VIRTUAL_CALL_SAMPLE_RATE_OPTION;
 
  private:
 
@@ -92,10 +138,17 @@ class FacebookBase : virtual public FacebookServiceIf {
   std::map<std::string, std::string> options_;
   Mutex optionsLock_;
 
-  ReadWriteCounterMap counters_;
+  /// Held for a timed getCpuProfile(), so two don't overlap
+  Mutex profileLock_;
+
+  ShardedCounters counters_;
 
   boost::shared_ptr<TServer> server_;
 
+  boost::shared_ptr<TLatencyStatsHandler> latencyStats_;
+
+  boost::shared_ptr<TServerIntrospection> introspection_;
+
 };
 
 }} // facebook::tb303
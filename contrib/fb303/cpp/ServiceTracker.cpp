@@ -18,14 +18,72 @@
  */
 
 #include <sys/time.h>
+#include <cstring>
 
 #include "FacebookBase.h"
 #include "ServiceTracker.h"
+#include <thrift/concurrency/Atomic.h>
 #include <thrift/concurrency/ThreadManager.h>
+#include <thrift/processor/TLatencyStatsHandler.h>
 
 using namespace std;
 using namespace facebook::fb303;
 using namespace apache::thrift::concurrency;
+using apache::thrift::processor::TLatencyStatsHandler;
+
+namespace {
+
+// Durations go in the same log-linear buckets as TLatencyStatsHandler's
+const int NUM_BUCKETS = TLatencyStatsHandler::NUM_BUCKETS;
+
+// Where each number is in a method's row of statistics_
+enum {
+  ROW_COUNT,
+  ROW_DURATION,
+  ROW_BUCKETS,
+  ROW_WIDTH = ROW_BUCKETS + NUM_BUCKETS
+};
+
+}
+
+// The numbers of a method summed over the threads
+struct ServiceTracker::Totals {
+  uint64_t count;
+  uint64_t duration;
+  uint64_t buckets[NUM_BUCKETS];
+
+  Totals() : count(0), duration(0) {
+    memset(buckets, 0, sizeof(buckets));
+  }
+
+  explicit Totals(const vector<int64_t> &row)
+    : count(static_cast<uint64_t>(row[ROW_COUNT])),
+      duration(static_cast<uint64_t>(row[ROW_DURATION])) {
+    for (int b = 0; b < NUM_BUCKETS; ++b) {
+      buckets[b] = static_cast<uint64_t>(row[ROW_BUCKETS + b]);
+    }
+  }
+
+  // The most the duration ranked q of the way up can be
+  uint64_t percentile(double q) const {
+    if (count == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count) + 0.5);
+    if (rank == 0) {
+      rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+      seen += buckets[i];
+      if (seen >= rank) {
+        return i + 1 < NUM_BUCKETS ? TLatencyStatsHandler::bucketFloor(i + 1) - 1
+                                   : TLatencyStatsHandler::bucketFloor(i);
+      }
+    }
+    return TLatencyStatsHandler::bucketFloor(NUM_BUCKETS - 1);
+  }
+};
 
 
 uint64_t ServiceTracker::CHECKPOINT_MINIMUM_INTERVAL_SECONDS = 60;
@@ -42,8 +100,7 @@ ServiceTracker::ServiceTracker(facebook::fb303::FacebookBase *handler,
     featureCheckpoint_(featureCheckpoint),
     featureStatusCheck_(featureStatusCheck),
     featureThreadCheck_(featureThreadCheck),
-    stopwatchUnit_(stopwatchUnit),
-    checkpointServices_(0)
+    stopwatchUnit_(stopwatchUnit)
 {
   if (featureCheckpoint_) {
     time_t now = time(NULL);
@@ -53,6 +110,10 @@ ServiceTracker::ServiceTracker(facebook::fb303::FacebookBase *handler,
   }
 }
 
+ServiceTracker::~ServiceTracker()
+{
+}
+
 /**
  * Registers the beginning of a "service method": basically, any of
  * the implementations of Thrift remote procedure calls that a
@@ -165,63 +226,37 @@ ServiceTracker::finishService(const ServiceMethod &serviceMethod)
   // count, record, and maybe report service statistics
   if (!serviceMethod.featureLogOnly_) {
 
-    if (!featureCheckpoint_) {
-
-      // lifetime counters
-      // (note: No need to lock statisticsMutex_ if not doing checkpoint;
-      // FacebookService::incrementCounter() is already thread-safe.)
-      handler_->incrementCounter("lifetime_services");
-
-    } else {
-
-      statisticsMutex_.lock();
-      // note: No exceptions expected from this code block.  Wrap in a try
-      // just to be safe.
-      try {
-
-        // lifetime counters
-        // note: Good to synchronize this with the increment of
-        // checkpoint services, even though incrementCounter() is
-        // already thread-safe, for the sake of checkpoint reporting
-        // consistency (i.e.  since the last checkpoint,
-        // lifetime_services has incremented by checkpointServices_).
-        handler_->incrementCounter("lifetime_services");
-
-        // checkpoint counters
-        checkpointServices_++;
-        checkpointDuration_ += duration;
-
-        // per-service timing
-        // note kjv: According to my tests it is very slightly faster to
-        // call insert() once (and detect not-found) than calling find()
-        // and then maybe insert (if not-found).  However, the difference
-        // is tiny for small maps like this one, and the code for the
-        // faster solution is slightly less readable.  Also, I wonder if
-        // the instantiation of the (often unused) pair to insert makes
-        // the first algorithm slower after all.
-        map<string, pair<uint64_t, uint64_t> >::iterator iter;
-        iter = checkpointServiceDuration_.find(serviceMethod.name_);
-        if (iter != checkpointServiceDuration_.end()) {
-          iter->second.first++;
-          iter->second.second += duration;
-        } else {
-          checkpointServiceDuration_.insert(make_pair(serviceMethod.name_,
-                                                      make_pair(1, duration)));
-        }
-
-        // maybe report checkpoint
-        // note: ...if it's been long enough since the last report.
-        time_t now = time(NULL);
-        uint64_t check_interval = now - checkpointTime_;
-        if (check_interval >= CHECKPOINT_MINIMUM_INTERVAL_SECONDS) {
-          reportCheckpoint();
+    // lifetime counters
+    // (note: FacebookService::incrementCounter() is already thread-safe.)
+    handler_->incrementCounter("lifetime_services");
+
+    if (featureCheckpoint_) {
+
+      // per-service timing, in this thread's own row
+      int64_t *stats = statistics_.slots(serviceMethod.name_, ROW_WIDTH);
+      uint64_t units = duration > 0 ? static_cast<uint64_t>(duration) : 0;
+      ShardedCounters::add(&stats[ROW_COUNT], 1);
+      ShardedCounters::add(&stats[ROW_DURATION], static_cast<int64_t>(units));
+      ShardedCounters::add(&stats[ROW_BUCKETS + TLatencyStatsHandler::bucketOf(units)], 1);
+
+      // maybe report checkpoint
+      // note: ...if it's been long enough since the last report, and no
+      // other thread is reporting it already.
+      time_t now = time(NULL);
+      if (now - atomicLoad<ATOMIC_RELAXED>(&checkpointTime_)
+            >= static_cast<int64_t>(CHECKPOINT_MINIMUM_INTERVAL_SECONDS)
+          && statisticsMutex_.trylock()) {
+        try {
+          if (now - checkpointTime_
+                >= static_cast<int64_t>(CHECKPOINT_MINIMUM_INTERVAL_SECONDS)) {
+            reportCheckpoint();
+          }
+        } catch (...) {
+          statisticsMutex_.unlock();
+          throw;
         }
-
-      } catch (...) {
         statisticsMutex_.unlock();
-        throw;
       }
-      statisticsMutex_.unlock();
 
     }
   }
@@ -230,10 +265,9 @@ ServiceTracker::finishService(const ServiceMethod &serviceMethod)
 /**
  * Logs some statistics gathered since the last call to this method.
  *
- * note: Thread race conditions on this method could cause
- * misreporting and/or undefined behavior; the caller must protect
- * uses of the object variables (and calls to this method) with a
- * mutex.
+ * The threads' numbers are never reset; what they added up to at the
+ * last checkpoint is taken away from what they add up to now.  The
+ * caller must hold statisticsMutex_.
  *
  */
 void
@@ -241,35 +275,42 @@ ServiceTracker::reportCheckpoint()
 {
   time_t now = time(NULL);
 
-  uint64_t check_count = checkpointServices_;
+  uint64_t check_count = 0;
   uint64_t check_interval = now - checkpointTime_;
-  uint64_t check_duration = checkpointDuration_;
+  uint64_t check_duration = 0;
+
+  // sum the threads' numbers by service name
+  map<string, vector<int64_t> > rows;
+  statistics_.getRows(rows);
 
   // export counters for timing of service methods (by service name)
+  // note: Percentiles are in stopwatchUnit_, good to within 12.5%.
   handler_->setCounter("checkpoint_time", check_interval);
-  map<string, pair<uint64_t, uint64_t> >::iterator iter;
-  uint64_t count;
-  for (iter = checkpointServiceDuration_.begin();
-       iter != checkpointServiceDuration_.end();
-       iter++) {
-    count = iter->second.first;
-    handler_->setCounter(string("checkpoint_count_") + iter->first, count);
-    if (count == 0) {
-      handler_->setCounter(string("checkpoint_speed_") + iter->first,
-                           0);
-    } else {
-      handler_->setCounter(string("checkpoint_speed_") + iter->first,
-                           iter->second.second / count);
+  map<string, vector<int64_t> >::iterator iter;
+  for (iter = rows.begin(); iter != rows.end(); iter++) {
+    Totals total(iter->second);
+    Totals &last = lastCheckpoint_[iter->first];
+    Totals since;
+    since.count = total.count - last.count;
+    since.duration = total.duration - last.duration;
+    for (int b = 0; b < NUM_BUCKETS; ++b) {
+      since.buckets[b] = total.buckets[b] - last.buckets[b];
     }
+    last = total;
+
+    check_count += since.count;
+    check_duration += since.duration;
+    handler_->setCounter(string("checkpoint_count_") + iter->first,
+                         since.count);
+    handler_->setCounter(string("checkpoint_p50_") + iter->first,
+                         since.percentile(0.5));
+    handler_->setCounter(string("checkpoint_p99_") + iter->first,
+                         since.percentile(0.99));
+    handler_->setCounter(string("checkpoint_p999_") + iter->first,
+                         since.percentile(0.999));
   }
 
-  // reset checkpoint variables
-  // note: Clearing the map while other threads are using it might
-  // cause undefined behavior.
-  checkpointServiceDuration_.clear();
-  checkpointTime_ = now;
-  checkpointServices_ = 0;
-  checkpointDuration_ = 0;
+  atomicStore<ATOMIC_RELAXED>(&checkpointTime_, now);
 
   // get lifetime variables
   uint64_t life_count = handler_->getCounter("lifetime_services");
@@ -17,75 +17,469 @@
  * under the License.
  */
 
+/**
+ * Dumps a capture of Thrift traffic in human-readable form.
+ *
+ * The input is mapped into memory and cut into messages on the main thread,
+ * which only has to skip over each one.  Printing them through
+ * TDebugProtocol is the expensive part, so that is spread across a pool of
+ * threads; a bounded window of pending messages puts the output back in
+ * input order and keeps memory use flat on large captures.
+ */
+
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ThreadManager.h>
 #include <thrift/transport/TBufferTransports.h>
-#include <thrift/transport/TFDTransport.h>
 #include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
 #include <thrift/protocol/TDebugProtocol.h>
 #include <thrift/protocol/TProtocolTap.h>
 
-using namespace std;
 using boost::shared_ptr;
+using namespace apache::thrift;
+using namespace apache::thrift::concurrency;
 using namespace apache::thrift::transport;
 using namespace apache::thrift::protocol;
 
+enum Mode {
+  MODE_DETECT,
+  MODE_UNFRAMED,
+  MODE_FRAMED,
+  MODE_STRUCTS
+};
+
 void usage() {
   fprintf(stderr,
-      "usage: thrift_dump {-b|-f|-s} < input > ouput\n"
+      "usage: thrift_dump [-b|-f|-s] [-c] [-j threads] [-m method]... [-S] [file]\n"
       "  -b TBufferedTransport messages\n"
       "  -f TFramedTransport messages\n"
-      "  -s Raw structures\n");
+      "  -s Raw structures\n"
+      "  -c Compact protocol instead of binary\n"
+      "  -j Number of decoding threads (default: one per CPU)\n"
+      "  -m Only dump calls to this method; may be repeated\n"
+      "  -S Print per-method statistics instead of the messages\n"
+      "Without -b, -f or -s the transport and protocol are detected from\n"
+      "the start of the input.  Reads standard input if no file is given.\n");
   exit(EXIT_FAILURE);
 }
 
+shared_ptr<TProtocol> makeProtocol(shared_ptr<TMemoryBuffer> trans,
+                                   bool compact) {
+  if (compact) {
+    return shared_ptr<TProtocol>(new TCompactProtocolT<TMemoryBuffer>(trans));
+  }
+  return shared_ptr<TProtocol>(new TBinaryProtocolT<TMemoryBuffer>(trans));
+}
+
+uint32_t readFrameSize(const uint8_t* buf) {
+  return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+         ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
+/**
+ * Whether buf starts with a strict binary or a compact message header.
+ */
+bool isMessageBegin(const uint8_t* buf, size_t size, bool* compact) {
+  if (size < 2) {
+    return false;
+  }
+  if (buf[0] == 0x80 && buf[1] == 0x01) {
+    *compact = false;
+    return true;
+  }
+  if (buf[0] == 0x82 && (buf[1] & 0x1f) == 0x01) {
+    *compact = true;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Works out the transport and protocol from the first message.  A frame
+ * header cannot be mistaken for a message header, since that would mean a
+ * frame of over 2GB.
+ */
+bool detect(const uint8_t* buf, size_t size, Mode* mode, bool* compact) {
+  if (isMessageBegin(buf, size, compact)) {
+    *mode = MODE_UNFRAMED;
+    return true;
+  }
+  if (size >= 4 && readFrameSize(buf) <= size - 4 &&
+      isMessageBegin(buf + 4, size - 4, compact)) {
+    *mode = MODE_FRAMED;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * One message waiting to be printed.
+ */
+struct Chunk {
+  Chunk(const uint8_t* d, uint32_t s) : data(d), size(s), done(false) {}
+
+  const uint8_t* data;
+  uint32_t size;
+  std::string text;
+  bool done;
+};
+
+/**
+ * Prints messages through TDebugProtocol on a pool of threads, writing the
+ * results out in the order the messages were submitted.
+ */
+class Printer {
+ public:
+  Printer(bool compact, bool structs, size_t threads)
+    : compact_(compact)
+    , structs_(structs)
+    , window_(threads * 64)
+  {
+    if (threads > 1) {
+      threadManager_ = ThreadManager::newSimpleThreadManager(threads);
+      threadManager_->threadFactory(
+          shared_ptr<ThreadFactory>(new PlatformThreadFactory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+            PlatformThreadFactory::OTHER
+#endif
+            )));
+      threadManager_->start();
+    }
+  }
+
+  ~Printer() {
+    if (threadManager_) {
+      threadManager_->stop();
+    }
+  }
+
+  void submit(const uint8_t* data, uint32_t size) {
+    shared_ptr<Chunk> chunk(new Chunk(data, size));
+    if (!threadManager_) {
+      print(*chunk);
+      write(*chunk);
+      return;
+    }
+
+    std::vector<shared_ptr<Chunk> > ready;
+    {
+      Synchronized s(monitor_);
+      while (pending_.size() >= window_ && !pending_.front()->done) {
+        monitor_.wait();
+      }
+      takeReady(ready);
+      pending_.push_back(chunk);
+    }
+    for (size_t i = 0; i < ready.size(); ++i) {
+      write(*ready[i]);
+    }
+    threadManager_->add(shared_ptr<Runnable>(new Task(*this, chunk)));
+  }
+
+  /**
+   * Writes out everything still pending.
+   */
+  void finish() {
+    for (;;) {
+      std::vector<shared_ptr<Chunk> > ready;
+      {
+        Synchronized s(monitor_);
+        if (pending_.empty()) {
+          break;
+        }
+        while (!pending_.front()->done) {
+          monitor_.wait();
+        }
+        takeReady(ready);
+      }
+      for (size_t i = 0; i < ready.size(); ++i) {
+        write(*ready[i]);
+      }
+    }
+    fflush(stdout);
+  }
+
+ private:
+  class Task : public Runnable {
+   public:
+    Task(Printer& printer, shared_ptr<Chunk> chunk)
+      : printer_(printer)
+      , chunk_(chunk)
+    {}
+
+    void run() {
+      printer_.print(*chunk_);
+      Synchronized s(printer_.monitor_);
+      chunk_->done = true;
+      printer_.monitor_.notify();
+    }
+
+   private:
+    Printer& printer_;
+    shared_ptr<Chunk> chunk_;
+  };
+
+  void print(Chunk& chunk) {
+    shared_ptr<TMemoryBuffer> itrans(
+        new TMemoryBuffer(const_cast<uint8_t*>(chunk.data), chunk.size));
+    shared_ptr<TMemoryBuffer> otrans(new TMemoryBuffer());
+    shared_ptr<TProtocol> iprot(makeProtocol(itrans, compact_));
+    shared_ptr<TProtocol> oprot(new TDebugProtocol(otrans));
+    TProtocolTap tap(iprot, oprot);
+
+    try {
+      if (structs_) {
+        tap.skip(T_STRUCT);
+      } else {
+        std::string name;
+        TMessageType messageType;
+        int32_t seqid;
+        tap.readMessageBegin(name, messageType, seqid);
+        tap.skip(T_STRUCT);
+        tap.readMessageEnd();
+      }
+      chunk.text = otrans->getBufferAsString();
+    } catch (const TException& exn) {
+      chunk.text = otrans->getBufferAsString();
+      chunk.text += "\nProtocol Exception: ";
+      chunk.text += exn.what();
+      chunk.text += "\n";
+    }
+  }
+
+  void write(const Chunk& chunk) {
+    fwrite(chunk.text.data(), 1, chunk.text.size(), stdout);
+  }
+
+  // Moves the finished chunks at the head of the window into ready
+  void takeReady(std::vector<shared_ptr<Chunk> >& ready) {
+    while (!pending_.empty() && pending_.front()->done) {
+      ready.push_back(pending_.front());
+      pending_.pop_front();
+    }
+  }
+
+  bool compact_;
+  bool structs_;
+  size_t window_;
+  shared_ptr<ThreadManager> threadManager_;
+  Monitor monitor_;
+  std::deque<shared_ptr<Chunk> > pending_;
+};
+
+/**
+ * Message counts and sizes for one method.
+ */
+struct MethodStats {
+  MethodStats() : messages(0), bytes(0), maxBytes(0) {
+    memset(count, 0, sizeof(count));
+  }
+
+  void add(TMessageType type, uint32_t size) {
+    if (type >= T_CALL && type <= T_ONEWAY) {
+      ++count[type];
+    }
+    ++messages;
+    bytes += size;
+    if (size > maxBytes) {
+      maxBytes = size;
+    }
+  }
+
+  uint64_t count[T_ONEWAY + 1];
+  uint64_t messages;
+  uint64_t bytes;
+  uint32_t maxBytes;
+};
+
+void printStats(const std::map<std::string, MethodStats>& stats) {
+  MethodStats all;
+  printf("%-32s %10s %10s %10s %10s %14s %10s\n", "method", "calls",
+         "replies", "exns", "oneways", "bytes", "max");
+  std::map<std::string, MethodStats>::const_iterator it;
+  for (it = stats.begin(); it != stats.end(); ++it) {
+    const MethodStats& m = it->second;
+    printf("%-32s %10llu %10llu %10llu %10llu %14llu %10u\n",
+           it->first.c_str(),
+           (unsigned long long)m.count[T_CALL],
+           (unsigned long long)m.count[T_REPLY],
+           (unsigned long long)m.count[T_EXCEPTION],
+           (unsigned long long)m.count[T_ONEWAY],
+           (unsigned long long)m.bytes, m.maxBytes);
+    for (int t = T_CALL; t <= T_ONEWAY; ++t) {
+      all.count[t] += m.count[t];
+    }
+    all.messages += m.messages;
+    all.bytes += m.bytes;
+    if (m.maxBytes > all.maxBytes) {
+      all.maxBytes = m.maxBytes;
+    }
+  }
+  printf("%llu messages, %llu bytes, largest %u bytes\n",
+         (unsigned long long)all.messages, (unsigned long long)all.bytes,
+         all.maxBytes);
+}
+
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
+  Mode mode = MODE_DETECT;
+  bool compact = false;
+  bool summary = false;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  std::set<std::string> methods;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "bfscj:m:S")) != -1) {
+    switch (opt) {
+      case 'b': mode = MODE_UNFRAMED; break;
+      case 'f': mode = MODE_FRAMED; break;
+      case 's': mode = MODE_STRUCTS; break;
+      case 'c': compact = true; break;
+      case 'j': threads = atol(optarg); break;
+      case 'm': methods.insert(optarg); break;
+      case 'S': summary = true; break;
+      default: usage();
+    }
+  }
+  if (optind < argc - 1 || threads < 1) {
     usage();
   }
+  if (mode == MODE_STRUCTS && (summary || !methods.empty())) {
+    fprintf(stderr, "thrift_dump: -m and -S need messages, not -s\n");
+    exit(EXIT_FAILURE);
+  }
 
-  shared_ptr<TTransport> stdin_trans(new TFDTransport(STDIN_FILENO));
-  shared_ptr<TTransport> itrans;
+  int fd = STDIN_FILENO;
+  if (optind < argc) {
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0) {
+      perror(argv[optind]);
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  if (argv[1] == std::string("-b") || argv[1] == std::string("-s")) {
-    itrans.reset(new TBufferedTransport(stdin_trans));
-  } else if (argv[1] == std::string("-f")) {
-    itrans.reset(new TFramedTransport(stdin_trans));
+  // Map regular files; anything else (a pipe, say) is read into memory
+  const uint8_t* input = NULL;
+  size_t size = 0;
+  std::vector<uint8_t> contents;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      perror("mmap");
+      exit(EXIT_FAILURE);
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    input = (const uint8_t*)map;
   } else {
-    usage();
+    uint8_t buf[65536];
+    ssize_t got;
+    while ((got = read(fd, buf, sizeof(buf))) > 0) {
+      contents.insert(contents.end(), buf, buf + got);
+    }
+    if (got < 0) {
+      perror("read");
+      exit(EXIT_FAILURE);
+    }
+    size = contents.size();
+    input = contents.empty() ? NULL : &contents[0];
+  }
+
+  if (size == 0) {
+    return 0;
+  }
+  if (mode == MODE_DETECT && !detect(input, size, &mode, &compact)) {
+    fprintf(stderr, "thrift_dump: cannot tell the encoding, use -b, -f or -s\n");
+    exit(EXIT_FAILURE);
   }
 
-  shared_ptr<TProtocol> iprot(new TBinaryProtocol(itrans));
-  shared_ptr<TProtocol> oprot(
-      new TDebugProtocol(
-        shared_ptr<TTransport>(new TBufferedTransport(
-          shared_ptr<TTransport>(new TFDTransport(STDOUT_FILENO))))));
+  // The scanner only finds where each message ends, plus its name when
+  // filtering or counting
+  shared_ptr<TMemoryBuffer> scanTrans(new TMemoryBuffer());
+  shared_ptr<TProtocol> scanProt(makeProtocol(scanTrans, compact));
+  bool needName = summary || !methods.empty();
 
-  TProtocolTap tap(iprot, oprot);
+  Printer printer(compact, mode == MODE_STRUCTS, summary ? 1 : threads);
+  std::map<std::string, MethodStats> stats;
 
+  size_t offset = 0;
   try {
-    if (argv[1] == std::string("-s")) {
-      for (;;) {
-        tap.skip(T_STRUCT);
-      }
-    } else {
+    while (offset < size) {
+      uint8_t* start = const_cast<uint8_t*>(input) + offset;
+      size_t remaining = size - offset;
+      uint8_t* message;
+      uint32_t messageSize;
       std::string name;
-      TMessageType messageType;
+      TMessageType messageType = T_CALL;
       int32_t seqid;
-      for (;;) {
-        tap.readMessageBegin(name, messageType, seqid);
-        tap.skip(T_STRUCT);
-        tap.readMessageEnd();
+
+      if (mode == MODE_FRAMED) {
+        if (remaining < 4 || readFrameSize(start) > remaining - 4) {
+          throw TTransportException(TTransportException::END_OF_FILE);
+        }
+        message = start + 4;
+        messageSize = readFrameSize(start);
+        if (needName) {
+          scanTrans->resetBuffer(message, messageSize);
+          scanProt->readMessageBegin(name, messageType, seqid);
+        }
+        offset += 4 + messageSize;
+      } else {
+        uint32_t window = remaining > 0x7fffffff ? 0x7fffffff : (uint32_t)remaining;
+        scanTrans->resetBuffer(start, window);
+        if (mode == MODE_STRUCTS) {
+          scanProt->skip(T_STRUCT);
+        } else {
+          scanProt->readMessageBegin(name, messageType, seqid);
+          scanProt->skip(T_STRUCT);
+          scanProt->readMessageEnd();
+        }
+        message = start;
+        messageSize = window - scanTrans->available_read();
+        offset += messageSize;
+      }
+
+      if (!methods.empty() && methods.find(name) == methods.end()) {
+        continue;
+      }
+      if (summary) {
+        stats[name].add(messageType, messageSize);
+      } else {
+        printer.submit(message, messageSize);
       }
     }
-  } catch (TProtocolException exn) {
-    cout << "Protocol Exception: " << exn.what() << endl;
-  } catch (...) {
-    oprot->getTransport()->flush();
+  } catch (const TTransportException&) {
+    printer.finish();
+    std::cout << std::endl << "Truncated message at offset " << offset << std::endl;
+  } catch (const TProtocolException& exn) {
+    printer.finish();
+    std::cout << std::endl << "Protocol Exception at offset " << offset << ": "
+         << exn.what() << std::endl;
   }
 
-  cout << endl;
+  if (summary) {
+    printStats(stats);
+  } else {
+    printer.finish();
+    std::cout << std::endl;
+  }
 
   return 0;
 }
@@ -20,9 +20,17 @@
 #include "TZmqServer.h"
 #include <thrift/transport/TBufferTransports.h>
 #include <boost/scoped_ptr.hpp>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
 
 using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::ThreadManager;
 using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
 using apache::thrift::protocol::TProtocol;
 
 namespace apache { namespace thrift { namespace server {
@@ -41,7 +49,8 @@ bool TZmqServer::serveOne(int recv_flags) {
   shared_ptr<TProtocol> outputProtocol(
       outputProtocolFactory_->getProtocol(outputTransport));
 
-  processor_->process(inputProtocol, outputProtocol);
+  getProcessor(inputProtocol, outputProtocol, inputTransport)->process(
+      inputProtocol, outputProtocol, NULL);
 
   if (zmq_type_ == ZMQ_REP) {
     uint8_t* buf;
@@ -93,4 +102,185 @@ void TZmqMultiServer::serveActive(zmq::pollitem_t* items, long timeout) {
 }
 
 
+namespace {
+
+void freeReply(void* data, void* /*hint*/) {
+  std::free(data);
+}
+
+} // namespace
+
+
+/**
+ * Runs one call on a worker thread and queues its reply.
+ */
+class TZmqRouterServer::Task : public Runnable {
+ public:
+  Task(TZmqRouterServer& server, shared_ptr<Call> call)
+    : server_(server)
+    , call_(call)
+  {}
+
+  void run() {
+    try {
+      zmq::message_t& body = *call_->body;
+      // Reads straight out of the message, which the buffer keeps alive
+      shared_ptr<TMemoryBuffer> inputTransport(new TMemoryBuffer(
+          (uint8_t*)body.data(), (uint32_t)body.size(), call_->body));
+      shared_ptr<TMemoryBuffer> outputTransport(new TMemoryBuffer());
+      shared_ptr<TProtocol> inputProtocol(
+          server_.inputProtocolFactory_->getProtocol(inputTransport));
+      shared_ptr<TProtocol> outputProtocol(
+          server_.outputProtocolFactory_->getProtocol(outputTransport));
+
+      server_.getProcessor(inputProtocol, outputProtocol, inputTransport)
+          ->process(inputProtocol, outputProtocol, NULL);
+
+      uint8_t* buf;
+      uint32_t size;
+      outputTransport->getBuffer(&buf, &size);
+      if (size == 0) {
+        // Oneway; nothing goes back
+        return;
+      }
+      uint32_t capacity;
+      buf = outputTransport->releaseBuffer(&capacity);
+      call_->body.reset(new zmq::message_t(buf, size, freeReply));
+      server_.replyDone(call_);
+    } catch (const TTransportException&) {
+      // The request was truncated; drop it
+    } catch (const std::exception& x) {
+      GlobalOutput.printf("TZmqRouterServer call failed: %s", x.what());
+    } catch (...) {
+      GlobalOutput("TZmqRouterServer uncaught exception.");
+    }
+  }
+
+ private:
+  TZmqRouterServer& server_;
+  shared_ptr<Call> call_;
+};
+
+
+TZmqRouterServer::TZmqRouterServer(
+    shared_ptr<TProcessor> processor,
+    zmq::context_t& ctx, const std::string& endpoint,
+    shared_ptr<ThreadManager> threadManager)
+  : TServer(processor)
+  , sock_(ctx, ZMQ_ROUTER)
+  , threadManager_(threadManager)
+  , stop_(false)
+{
+  if (pipe(wakeFds_) != 0) {
+    throw TException("TZmqRouterServer: pipe() failed");
+  }
+  for (int i = 0; i < 2; ++i) {
+    int flags = fcntl(wakeFds_[i], F_GETFL, 0);
+    fcntl(wakeFds_[i], F_SETFL, flags | O_NONBLOCK);
+  }
+  sock_.bind(endpoint.c_str());
+}
+
+
+TZmqRouterServer::~TZmqRouterServer() {
+  close(wakeFds_[0]);
+  close(wakeFds_[1]);
+}
+
+
+void TZmqRouterServer::serve() {
+  zmq::pollitem_t items[2];
+  items[0].socket = sock_;
+  items[0].fd = 0;
+  items[0].events = ZMQ_POLLIN;
+  items[1].socket = NULL;
+  items[1].fd = wakeFds_[0];
+  items[1].events = ZMQ_POLLIN;
+
+  while (!stop_) {
+    items[0].revents = items[1].revents = 0;
+    zmq::poll(items, 2, -1);
+
+    if ((items[1].revents & ZMQ_POLLIN) != 0) {
+      char drain[64];
+      while (read(wakeFds_[0], drain, sizeof(drain)) > 0) {
+      }
+      sendReplies();
+    }
+    if ((items[0].revents & ZMQ_POLLIN) != 0) {
+      while (receiveCall()) {
+      }
+    }
+  }
+}
+
+
+void TZmqRouterServer::stop() {
+  stop_ = true;
+  wake();
+}
+
+
+bool TZmqRouterServer::receiveCall() {
+  shared_ptr<Call> call(new Call());
+  int64_t more;
+  size_t moreSize = sizeof(more);
+  do {
+    shared_ptr<zmq::message_t> part(new zmq::message_t());
+    if (!sock_.recv(part.get(), ZMQ_NOBLOCK)) {
+      // Only possible before the first part; the rest arrive with it
+      return false;
+    }
+    sock_.getsockopt(ZMQ_RCVMORE, &more, &moreSize);
+    if (more) {
+      call->envelope.push_back(part);
+    } else {
+      call->body = part;
+    }
+  } while (more);
+
+  threadManager_->add(shared_ptr<Runnable>(new Task(*this, call)));
+  return true;
+}
+
+
+void TZmqRouterServer::replyDone(shared_ptr<Call> call) {
+  bool wasEmpty;
+  {
+    Guard g(repliesMutex_);
+    wasEmpty = replies_.empty();
+    replies_.push_back(call);
+  }
+  // serve() sends everything queued once woken, so one byte per batch
+  if (wasEmpty) {
+    wake();
+  }
+}
+
+
+void TZmqRouterServer::sendReplies() {
+  std::deque<shared_ptr<Call> > replies;
+  {
+    Guard g(repliesMutex_);
+    replies.swap(replies_);
+  }
+  std::deque<shared_ptr<Call> >::iterator it;
+  for (it = replies.begin(); it != replies.end(); ++it) {
+    Call& call = **it;
+    for (size_t i = 0; i < call.envelope.size(); ++i) {
+      sock_.send(*call.envelope[i], ZMQ_SNDMORE);
+    }
+    sock_.send(*call.body);
+  }
+}
+
+
+void TZmqRouterServer::wake() {
+  char c = 0;
+  // A full pipe already means a wakeup is pending
+  ssize_t rv = write(wakeFds_[1], &c, 1);
+  (void)rv;
+}
+
+
 }}} // apache::thrift::server
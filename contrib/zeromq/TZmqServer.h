@@ -20,7 +20,11 @@
 #ifndef _THRIFT_SERVER_TZMQSERVER_H_
 #define _THRIFT_SERVER_TZMQSERVER_H_ 1
 
+#include <deque>
+#include <vector>
 #include <zmq.hpp>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/concurrency/ThreadManager.h>
 #include <thrift/server/TServer.h>
 
 namespace apache { namespace thrift { namespace server {
@@ -76,6 +80,71 @@ class TZmqMultiServer {
 };
 
 
+/**
+ * Serves a ZMQ_ROUTER socket from a ThreadManager's worker pool.
+ *
+ * One thread (the one calling serve()) owns the socket.  Each poll cycle
+ * it takes every request waiting on the socket and hands it to the pool,
+ * then sends every reply the workers have finished since the last cycle.
+ * Request bodies are read in place from the zmq message, and replies are
+ * handed to zmq without a copy.
+ *
+ * REQ and DEALER clients can both connect.  A call that produces no reply,
+ * such as a oneway, sends nothing back, so DEALER clients can mix normal
+ * and oneway calls on one socket.
+ *
+ * The ThreadManager must be started, and must be stopped before the server
+ * is destroyed.
+ */
+class TZmqRouterServer : public TServer {
+ public:
+  TZmqRouterServer(
+      boost::shared_ptr<TProcessor> processor,
+      zmq::context_t& ctx, const std::string& endpoint,
+      boost::shared_ptr<concurrency::ThreadManager> threadManager);
+
+  ~TZmqRouterServer();
+
+  void serve();
+
+  /**
+   * Makes serve() return after its current poll cycle.  May be called from
+   * any thread.
+   */
+  void stop();
+
+  zmq::socket_t& getSocket() {
+    return sock_;
+  }
+
+ private:
+  class Task;
+
+  // One request: its routing envelope, and the body, which is replaced by
+  // the reply once the call has run.
+  struct Call {
+    std::vector<boost::shared_ptr<zmq::message_t> > envelope;
+    boost::shared_ptr<zmq::message_t> body;
+  };
+
+  bool receiveCall();
+  void replyDone(boost::shared_ptr<Call> call);
+  void sendReplies();
+  void wake();
+
+  zmq::socket_t sock_;
+  boost::shared_ptr<concurrency::ThreadManager> threadManager_;
+
+  // Replies finished by the workers and not yet sent
+  concurrency::Mutex repliesMutex_;
+  std::deque<boost::shared_ptr<Call> > replies_;
+
+  // Written by the workers and stop() to wake up the poll
+  int wakeFds_[2];
+  volatile bool stop_;
+};
+
+
 }}} // apache::thrift::server
 
 #endif // #ifndef _THRIFT_SERVER_TZMQSERVER_H_
@@ -0,0 +1,1226 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include <thrift/c_glib/thrift.h>
+#include <thrift/c_glib/protocol/thrift_protocol.h>
+#include <thrift/c_glib/protocol/thrift_compact_protocol.h>
+
+/* the types as they appear on the wire */
+typedef enum
+{
+  CT_STOP          = 0x00,
+  CT_BOOLEAN_TRUE  = 0x01,
+  CT_BOOLEAN_FALSE = 0x02,
+  CT_BYTE          = 0x03,
+  CT_I16           = 0x04,
+  CT_I32           = 0x05,
+  CT_I64           = 0x06,
+  CT_DOUBLE        = 0x07,
+  CT_BINARY        = 0x08,
+  CT_LIST          = 0x09,
+  CT_SET           = 0x0a,
+  CT_MAP           = 0x0b,
+  CT_STRUCT        = 0x0c
+} ThriftCompactType;
+
+/* the longest a 64 bit varint can get */
+#define THRIFT_COMPACT_MAX_VARINT_BYTES 10
+
+G_DEFINE_TYPE(ThriftCompactProtocol, thrift_compact_protocol, THRIFT_TYPE_PROTOCOL)
+
+static guint64
+thrift_bitwise_cast_guint64 (gdouble v)
+{
+  union {
+    gdouble from;
+    guint64 to;
+  } u;
+  u.from = v;
+  return u.to;
+}
+
+static gdouble
+thrift_bitwise_cast_gdouble (guint64 v)
+{
+  union {
+    guint64 from;
+    gdouble to;
+  } u;
+  u.from = v;
+  return u.to;
+}
+
+static guint32
+thrift_compact_i32_to_zigzag (const gint32 n)
+{
+  return (((guint32) n) << 1) ^ (guint32) (n >> 31);
+}
+
+static guint64
+thrift_compact_i64_to_zigzag (const gint64 n)
+{
+  return (((guint64) n) << 1) ^ (guint64) (n >> 63);
+}
+
+static gint32
+thrift_compact_zigzag_to_i32 (guint32 n)
+{
+  return (gint32) ((n >> 1) ^ (guint32) (-(gint32) (n & 1)));
+}
+
+static gint64
+thrift_compact_zigzag_to_i64 (guint64 n)
+{
+  return (gint64) ((n >> 1) ^ (guint64) (-(gint64) (n & 1)));
+}
+
+/* encodes n into buf and returns the number of bytes used */
+static guint32
+thrift_compact_encode_varint64 (guint64 n, guint8 *buf)
+{
+  guint32 i = 0;
+
+  while (n > 0x7f)
+  {
+    buf[i++] = (guint8) ((n & 0x7f) | 0x80);
+    n >>= 7;
+  }
+  buf[i++] = (guint8) n;
+  return i;
+}
+
+static guint32
+thrift_compact_encode_varint32 (guint32 n, guint8 *buf)
+{
+  return thrift_compact_encode_varint64 (n, buf);
+}
+
+static gint32
+thrift_compact_get_compact_type (const ThriftType type, GError **error)
+{
+  switch (type)
+  {
+    case T_STOP:
+      return CT_STOP;
+    case T_BOOL:
+      return CT_BOOLEAN_TRUE;
+    case T_BYTE:
+      return CT_BYTE;
+    case T_I16:
+      return CT_I16;
+    case T_I32:
+      return CT_I32;
+    case T_I64:
+      return CT_I64;
+    case T_DOUBLE:
+      return CT_DOUBLE;
+    case T_STRING:
+      return CT_BINARY;
+    case T_LIST:
+      return CT_LIST;
+    case T_SET:
+      return CT_SET;
+    case T_MAP:
+      return CT_MAP;
+    case T_STRUCT:
+      return CT_STRUCT;
+    default:
+      g_set_error (error, THRIFT_PROTOCOL_ERROR,
+                   THRIFT_PROTOCOL_ERROR_INVALID_DATA,
+                   "no compact type for %d", type);
+      return -1;
+  }
+}
+
+static gboolean
+thrift_compact_get_ttype (const guint8 type, ThriftType *ttype,
+                          GError **error)
+{
+  switch (type)
+  {
+    case CT_STOP:
+      *ttype = T_STOP;
+      return TRUE;
+    case CT_BOOLEAN_TRUE:
+    case CT_BOOLEAN_FALSE:
+      *ttype = T_BOOL;
+      return TRUE;
+    case CT_BYTE:
+      *ttype = T_BYTE;
+      return TRUE;
+    case CT_I16:
+      *ttype = T_I16;
+      return TRUE;
+    case CT_I32:
+      *ttype = T_I32;
+      return TRUE;
+    case CT_I64:
+      *ttype = T_I64;
+      return TRUE;
+    case CT_DOUBLE:
+      *ttype = T_DOUBLE;
+      return TRUE;
+    case CT_BINARY:
+      *ttype = T_STRING;
+      return TRUE;
+    case CT_LIST:
+      *ttype = T_LIST;
+      return TRUE;
+    case CT_SET:
+      *ttype = T_SET;
+      return TRUE;
+    case CT_MAP:
+      *ttype = T_MAP;
+      return TRUE;
+    case CT_STRUCT:
+      *ttype = T_STRUCT;
+      return TRUE;
+    default:
+      g_set_error (error, THRIFT_PROTOCOL_ERROR,
+                   THRIFT_PROTOCOL_ERROR_INVALID_DATA,
+                   "unknown compact type %d", type);
+      return FALSE;
+  }
+}
+
+static gint32
+thrift_compact_write_raw (ThriftProtocol *protocol, const guint8 *buf,
+                          const guint32 len, GError **error)
+{
+  if (thrift_transport_write (protocol->transport, (const gpointer) buf, len,
+                              error))
+  {
+    return len;
+  } else {
+    return -1;
+  }
+}
+
+static gint32
+thrift_compact_write_varint32 (ThriftProtocol *protocol, const guint32 n,
+                               GError **error)
+{
+  guint8 buf[5];
+  return thrift_compact_write_raw (protocol, buf,
+                                   thrift_compact_encode_varint32 (n, buf),
+                                   error);
+}
+
+static gint32
+thrift_compact_read_raw_byte (ThriftProtocol *protocol, guint8 *value,
+                              GError **error)
+{
+  gint32 ret;
+
+  if ((ret = thrift_transport_read (protocol->transport, value, 1,
+                                    error)) < 0)
+  {
+    return -1;
+  }
+  if (ret != 1)
+  {
+    g_set_error (error, THRIFT_PROTOCOL_ERROR,
+                 THRIFT_PROTOCOL_ERROR_INVALID_DATA,
+                 "unexpected end of data");
+    return -1;
+  }
+  return 1;
+}
+
+/* reads a varint, decoding it in place when the transport has it buffered */
+static gint32
+thrift_compact_read_varint64 (ThriftProtocol *protocol, guint64 *value,
+                              GError **error)
+{
+  const guint8 *buf;
+  guint32 have = 1;
+  guint32 i;
+  guint32 shift = 0;
+  guint64 result = 0;
+  guint8 byte;
+
+  buf = thrift_transport_borrow (protocol->transport, &have);
+  if (buf != NULL)
+  {
+    for (i = 0; i < have && i < THRIFT_COMPACT_MAX_VARINT_BYTES; i++)
+    {
+      result |= (guint64) (buf[i] & 0x7f) << shift;
+      shift += 7;
+      if ((buf[i] & 0x80) == 0)
+      {
+        thrift_transport_consume (protocol->transport, i + 1);
+        *value = result;
+        return i + 1;
+      }
+    }
+    if (i == THRIFT_COMPACT_MAX_VARINT_BYTES)
+    {
+      g_set_error (error, THRIFT_PROTOCOL_ERROR,
+                   THRIFT_PROTOCOL_ERROR_INVALID_DATA,
+                   "variable-length int over %d bytes",
+                   THRIFT_COMPACT_MAX_VARINT_BYTES);
+      return -1;
+    }
+
+    /* runs past what is buffered, take it a byte at a time */
+    result = 0;
+    shift = 0;
+  }
+
+  for (i = 0; i < THRIFT_COMPACT_MAX_VARINT_BYTES; i++)
+  {
+    if (thrift_compact_read_raw_byte (protocol, &byte, error) < 0)
+    {
+      return -1;
+    }
+    result |= (guint64) (byte & 0x7f) << shift;
+    shift += 7;
+    if ((byte & 0x80) == 0)
+    {
+      *value = result;
+      return i + 1;
+    }
+  }
+
+  g_set_error (error, THRIFT_PROTOCOL_ERROR,
+               THRIFT_PROTOCOL_ERROR_INVALID_DATA,
+               "variable-length int over %d bytes",
+               THRIFT_COMPACT_MAX_VARINT_BYTES);
+  return -1;
+}
+
+static gint32
+thrift_compact_read_varint32 (ThriftProtocol *protocol, guint32 *value,
+                              GError **error)
+{
+  guint64 result;
+  gint32 ret;
+
+  if ((ret = thrift_compact_read_varint64 (protocol, &result, error)) < 0)
+  {
+    return -1;
+  }
+  *value = (guint32) result;
+  return ret;
+}
+
+/* reads a length that has to fit in a gint32 */
+static gint32
+thrift_compact_read_size (ThriftProtocol *protocol, guint32 *size,
+                          GError **error)
+{
+  gint32 ret;
+
+  if ((ret = thrift_compact_read_varint32 (protocol, size, error)) < 0)
+  {
+    return -1;
+  }
+  if ((gint32) *size < 0)
+  {
+    g_set_error (error, THRIFT_PROTOCOL_ERROR,
+                 THRIFT_PROTOCOL_ERROR_NEGATIVE_SIZE,
+                 "got negative size of %d", (gint32) *size);
+    return -1;
+  }
+  return ret;
+}
+
+/* writes a field header, folding the id into a delta when it fits */
+static gint32
+thrift_compact_write_field_header (ThriftProtocol *protocol,
+                                   const guint8 type, const gint16 field_id,
+                                   GError **error)
+{
+  ThriftCompactProtocol *cp = THRIFT_COMPACT_PROTOCOL (protocol);
+  guint8 buf[6];
+  guint32 len = 1;
+
+  if (field_id > cp->last_field_id && field_id - cp->last_field_id <= 15)
+  {
+    buf[0] = (guint8) (((field_id - cp->last_field_id) << 4) | type);
+  } else {
+    buf[0] = type;
+    len += thrift_compact_encode_varint32 (
+        thrift_compact_i32_to_zigzag (field_id), buf + 1);
+  }
+  cp->last_field_id = field_id;
+
+  return thrift_compact_write_raw (protocol, buf, len, error);
+}
+
+gint32
+thrift_compact_protocol_write_message_begin (ThriftProtocol *protocol,
+    const gchar *name, const ThriftMessageType message_type,
+    const gint32 seqid, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  guint8 buf[7];
+  guint32 len = 2;
+  gint32 ret;
+  gint32 xfer = 0;
+
+  buf[0] = THRIFT_COMPACT_PROTOCOL_PROTOCOL_ID;
+  buf[1] = (THRIFT_COMPACT_PROTOCOL_VERSION_N
+            & THRIFT_COMPACT_PROTOCOL_VERSION_MASK)
+           | ((((guint32) message_type)
+               << THRIFT_COMPACT_PROTOCOL_TYPE_SHIFT_AMOUNT)
+              & THRIFT_COMPACT_PROTOCOL_TYPE_MASK);
+  len += thrift_compact_encode_varint32 ((guint32) seqid, buf + 2);
+
+  if ((ret = thrift_compact_write_raw (protocol, buf, len, error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+  if ((ret = thrift_protocol_write_string (protocol, name, error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+  return xfer;
+}
+
+gint32
+thrift_compact_protocol_write_message_end (ThriftProtocol *protocol,
+                                           GError **error)
+{
+  /* satisfy -Wall */
+  THRIFT_UNUSED_VAR (protocol);
+  THRIFT_UNUSED_VAR (error);
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_write_struct_begin (ThriftProtocol *protocol,
+                                            const gchar *name,
+                                            GError **error)
+{
+  THRIFT_UNUSED_VAR (name);
+  THRIFT_UNUSED_VAR (error);
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  ThriftCompactProtocol *cp = THRIFT_COMPACT_PROTOCOL (protocol);
+
+  /* field ids are delta encoded within each struct */
+  g_queue_push_tail (cp->last_field_ids,
+                     GINT_TO_POINTER ((gint) cp->last_field_id));
+  cp->last_field_id = 0;
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_write_struct_end (ThriftProtocol *protocol,
+                                          GError **error)
+{
+  THRIFT_UNUSED_VAR (error);
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  ThriftCompactProtocol *cp = THRIFT_COMPACT_PROTOCOL (protocol);
+
+  cp->last_field_id =
+      (gint16) GPOINTER_TO_INT (g_queue_pop_tail (cp->last_field_ids));
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_write_field_begin (ThriftProtocol *protocol,
+                                           const gchar *name,
+                                           const ThriftType field_type,
+                                           const gint16 field_id,
+                                           GError **error)
+{
+  THRIFT_UNUSED_VAR (name);
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  ThriftCompactProtocol *cp = THRIFT_COMPACT_PROTOCOL (protocol);
+  gint32 type;
+
+  if (field_type == T_BOOL)
+  {
+    /* the header carries the value, so wait for write_bool */
+    cp->bool_field_pending = TRUE;
+    cp->bool_field_id = field_id;
+    return 0;
+  }
+
+  if ((type = thrift_compact_get_compact_type (field_type, error)) < 0)
+  {
+    return -1;
+  }
+  return thrift_compact_write_field_header (protocol, (guint8) type,
+                                            field_id, error);
+}
+
+gint32
+thrift_compact_protocol_write_field_end (ThriftProtocol *protocol,
+                                         GError **error)
+{
+  /* satisfy -Wall */
+  THRIFT_UNUSED_VAR (protocol);
+  THRIFT_UNUSED_VAR (error);
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_write_field_stop (ThriftProtocol *protocol,
+                                          GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  guint8 stop = CT_STOP;
+  return thrift_compact_write_raw (protocol, &stop, 1, error);
+}
+
+gint32
+thrift_compact_protocol_write_map_begin (ThriftProtocol *protocol,
+                                         const ThriftType key_type,
+                                         const ThriftType value_type,
+                                         const guint32 size,
+                                         GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  guint8 buf[6];
+  guint32 len = 0;
+  gint32 key, value;
+
+  if (size == 0)
+  {
+    buf[len++] = 0;
+  } else {
+    if ((key = thrift_compact_get_compact_type (key_type, error)) < 0
+        || (value = thrift_compact_get_compact_type (value_type, error)) < 0)
+    {
+      return -1;
+    }
+    len += thrift_compact_encode_varint32 (size, buf);
+    buf[len++] = (guint8) ((key << 4) | value);
+  }
+
+  return thrift_compact_write_raw (protocol, buf, len, error);
+}
+
+gint32
+thrift_compact_protocol_write_map_end (ThriftProtocol *protocol,
+                                       GError **error)
+{
+  THRIFT_UNUSED_VAR (protocol);
+  THRIFT_UNUSED_VAR (error);
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_write_list_begin (ThriftProtocol *protocol,
+                                          const ThriftType element_type,
+                                          const guint32 size,
+                                          GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  guint8 buf[6];
+  guint32 len = 1;
+  gint32 type;
+
+  if ((type = thrift_compact_get_compact_type (element_type, error)) < 0)
+  {
+    return -1;
+  }
+
+  if (size <= 14)
+  {
+    buf[0] = (guint8) ((size << 4) | type);
+  } else {
+    buf[0] = (guint8) (0xf0 | type);
+    len += thrift_compact_encode_varint32 (size, buf + 1);
+  }
+
+  return thrift_compact_write_raw (protocol, buf, len, error);
+}
+
+gint32
+thrift_compact_protocol_write_list_end (ThriftProtocol *protocol,
+                                        GError **error)
+{
+  THRIFT_UNUSED_VAR (protocol);
+  THRIFT_UNUSED_VAR (error);
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_write_set_begin (ThriftProtocol *protocol,
+                                         const ThriftType element_type,
+                                         const guint32 size,
+                                         GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  return thrift_protocol_write_list_begin (protocol, element_type,
+                                           size, error);
+}
+
+gint32
+thrift_compact_protocol_write_set_end (ThriftProtocol *protocol,
+                                       GError **error)
+{
+  THRIFT_UNUSED_VAR (protocol);
+  THRIFT_UNUSED_VAR (error);
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_write_bool (ThriftProtocol *protocol,
+                                    const gboolean value, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  ThriftCompactProtocol *cp = THRIFT_COMPACT_PROTOCOL (protocol);
+  guint8 type = value ? CT_BOOLEAN_TRUE : CT_BOOLEAN_FALSE;
+
+  if (cp->bool_field_pending)
+  {
+    cp->bool_field_pending = FALSE;
+    return thrift_compact_write_field_header (protocol, type,
+                                              cp->bool_field_id, error);
+  }
+  /* not a field, e.g. a list element */
+  return thrift_compact_write_raw (protocol, &type, 1, error);
+}
+
+gint32
+thrift_compact_protocol_write_byte (ThriftProtocol *protocol,
+                                    const gint8 value, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  return thrift_compact_write_raw (protocol, (const guint8 *) &value, 1,
+                                   error);
+}
+
+gint32
+thrift_compact_protocol_write_i16 (ThriftProtocol *protocol,
+                                   const gint16 value, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  return thrift_compact_write_varint32 (
+      protocol, thrift_compact_i32_to_zigzag (value), error);
+}
+
+gint32
+thrift_compact_protocol_write_i32 (ThriftProtocol *protocol,
+                                   const gint32 value, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  return thrift_compact_write_varint32 (
+      protocol, thrift_compact_i32_to_zigzag (value), error);
+}
+
+gint32
+thrift_compact_protocol_write_i64 (ThriftProtocol *protocol,
+                                   const gint64 value, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  guint8 buf[THRIFT_COMPACT_MAX_VARINT_BYTES];
+  return thrift_compact_write_raw (
+      protocol, buf,
+      thrift_compact_encode_varint64 (thrift_compact_i64_to_zigzag (value),
+                                      buf),
+      error);
+}
+
+gint32
+thrift_compact_protocol_write_double (ThriftProtocol *protocol,
+                                      const gdouble value, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  /* unlike the binary protocol, doubles go out little-endian */
+  guint64 bits = GUINT64_TO_LE (thrift_bitwise_cast_guint64 (value));
+  return thrift_compact_write_raw (protocol, (const guint8 *) &bits, 8,
+                                   error);
+}
+
+gint32
+thrift_compact_protocol_write_string (ThriftProtocol *protocol,
+                                      const gchar *str, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  guint32 len = str != NULL ? strlen (str) : 0;
+  return thrift_protocol_write_binary (protocol, (const gpointer) str,
+                                       len, error);
+}
+
+gint32
+thrift_compact_protocol_write_binary (ThriftProtocol *protocol,
+                                      const gpointer buf,
+                                      const guint32 len, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+  gint32 ret;
+  gint32 xfer = 0;
+
+  if ((ret = thrift_compact_write_varint32 (protocol, len, error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+
+  if (len > 0)
+  {
+    if (thrift_transport_write (protocol->transport,
+                                (const gpointer) buf, len, error) == FALSE)
+    {
+      return -1;
+    }
+    xfer += len;
+  }
+
+  return xfer;
+}
+
+gint32
+thrift_compact_protocol_read_message_begin (ThriftProtocol *protocol,
+                                            gchar **name,
+                                            ThriftMessageType *message_type,
+                                            gint32 *seqid, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  gint32 ret;
+  gint32 xfer = 0;
+  guint8 protocol_id, version_and_type, version;
+  guint32 id;
+
+  if ((ret = thrift_compact_read_raw_byte (protocol, &protocol_id,
+                                           error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+  if (protocol_id != THRIFT_COMPACT_PROTOCOL_PROTOCOL_ID)
+  {
+    g_set_error (error, THRIFT_PROTOCOL_ERROR,
+                 THRIFT_PROTOCOL_ERROR_BAD_VERSION,
+                 "expected protocol id %d, got %d",
+                 THRIFT_COMPACT_PROTOCOL_PROTOCOL_ID, protocol_id);
+    return -1;
+  }
+
+  if ((ret = thrift_compact_read_raw_byte (protocol, &version_and_type,
+                                           error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+  version = version_and_type & THRIFT_COMPACT_PROTOCOL_VERSION_MASK;
+  if (version != THRIFT_COMPACT_PROTOCOL_VERSION_N)
+  {
+    g_set_error (error, THRIFT_PROTOCOL_ERROR,
+                 THRIFT_PROTOCOL_ERROR_BAD_VERSION,
+                 "expected version %d, got %d",
+                 THRIFT_COMPACT_PROTOCOL_VERSION_N, version);
+    return -1;
+  }
+  *message_type = (ThriftMessageType)
+      ((version_and_type >> THRIFT_COMPACT_PROTOCOL_TYPE_SHIFT_AMOUNT) & 0x07);
+
+  if ((ret = thrift_compact_read_varint32 (protocol, &id, error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+  *seqid = (gint32) id;
+
+  if ((ret = thrift_protocol_read_string (protocol, name, error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+
+  return xfer;
+}
+
+gint32
+thrift_compact_protocol_read_message_end (ThriftProtocol *protocol,
+                                          GError **error)
+{
+  THRIFT_UNUSED_VAR (protocol);
+  THRIFT_UNUSED_VAR (error);
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_read_struct_begin (ThriftProtocol *protocol,
+                                           gchar **name,
+                                           GError **error)
+{
+  THRIFT_UNUSED_VAR (error);
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  ThriftCompactProtocol *cp = THRIFT_COMPACT_PROTOCOL (protocol);
+
+  g_queue_push_tail (cp->last_field_ids,
+                     GINT_TO_POINTER ((gint) cp->last_field_id));
+  cp->last_field_id = 0;
+  *name = NULL;
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_read_struct_end (ThriftProtocol *protocol,
+                                         GError **error)
+{
+  THRIFT_UNUSED_VAR (error);
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  ThriftCompactProtocol *cp = THRIFT_COMPACT_PROTOCOL (protocol);
+
+  cp->last_field_id =
+      (gint16) GPOINTER_TO_INT (g_queue_pop_tail (cp->last_field_ids));
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_read_field_begin (ThriftProtocol *protocol,
+                                          gchar **name,
+                                          ThriftType *field_type,
+                                          gint16 *field_id,
+                                          GError **error)
+{
+  THRIFT_UNUSED_VAR (name);
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  ThriftCompactProtocol *cp = THRIFT_COMPACT_PROTOCOL (protocol);
+  gint32 ret;
+  gint32 xfer = 0;
+  guint8 byte, type, modifier;
+
+  if ((ret = thrift_compact_read_raw_byte (protocol, &byte, error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+
+  type = byte & 0x0f;
+  if (type == CT_STOP)
+  {
+    *field_type = T_STOP;
+    *field_id = 0;
+    return xfer;
+  }
+
+  /* a non-zero high nibble is the delta from the previous field id */
+  modifier = (byte & 0xf0) >> 4;
+  if (modifier == 0)
+  {
+    if ((ret = thrift_protocol_read_i16 (protocol, field_id, error)) < 0)
+    {
+      return -1;
+    }
+    xfer += ret;
+  } else {
+    *field_id = (gint16) (cp->last_field_id + modifier);
+  }
+
+  if (!thrift_compact_get_ttype (type, field_type, error))
+  {
+    return -1;
+  }
+
+  if (type == CT_BOOLEAN_TRUE || type == CT_BOOLEAN_FALSE)
+  {
+    cp->bool_value_pending = TRUE;
+    cp->bool_value = type == CT_BOOLEAN_TRUE;
+  }
+
+  cp->last_field_id = *field_id;
+  return xfer;
+}
+
+gint32
+thrift_compact_protocol_read_field_end (ThriftProtocol *protocol,
+                                        GError **error)
+{
+  THRIFT_UNUSED_VAR (protocol);
+  THRIFT_UNUSED_VAR (error);
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_read_map_begin (ThriftProtocol *protocol,
+                                        ThriftType *key_type,
+                                        ThriftType *value_type,
+                                        guint32 *size,
+                                        GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  gint32 ret;
+  gint32 xfer = 0;
+  guint8 kv = 0;
+
+  if ((ret = thrift_compact_read_size (protocol, size, error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+
+  /* empty maps leave the types off entirely */
+  if (*size != 0)
+  {
+    if ((ret = thrift_compact_read_raw_byte (protocol, &kv, error)) < 0)
+    {
+      return -1;
+    }
+    xfer += ret;
+  }
+
+  if (!thrift_compact_get_ttype (kv >> 4, key_type, error)
+      || !thrift_compact_get_ttype (kv & 0x0f, value_type, error))
+  {
+    return -1;
+  }
+  return xfer;
+}
+
+gint32
+thrift_compact_protocol_read_map_end (ThriftProtocol *protocol,
+                                      GError **error)
+{
+  THRIFT_UNUSED_VAR (protocol);
+  THRIFT_UNUSED_VAR (error);
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_read_list_begin (ThriftProtocol *protocol,
+                                         ThriftType *element_type,
+                                         guint32 *size, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  gint32 ret;
+  gint32 xfer = 0;
+  guint8 size_and_type;
+
+  if ((ret = thrift_compact_read_raw_byte (protocol, &size_and_type,
+                                           error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+
+  /* short lists keep their size in the high nibble */
+  *size = (size_and_type >> 4) & 0x0f;
+  if (*size == 15)
+  {
+    if ((ret = thrift_compact_read_size (protocol, size, error)) < 0)
+    {
+      return -1;
+    }
+    xfer += ret;
+  }
+
+  if (!thrift_compact_get_ttype (size_and_type & 0x0f, element_type, error))
+  {
+    return -1;
+  }
+  return xfer;
+}
+
+gint32
+thrift_compact_protocol_read_list_end (ThriftProtocol *protocol,
+                                       GError **error)
+{
+  THRIFT_UNUSED_VAR (protocol);
+  THRIFT_UNUSED_VAR (error);
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_read_set_begin (ThriftProtocol *protocol,
+                                        ThriftType *element_type,
+                                        guint32 *size, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  return thrift_protocol_read_list_begin (protocol, element_type, size, error);
+}
+
+gint32
+thrift_compact_protocol_read_set_end (ThriftProtocol *protocol,
+                                      GError **error)
+{
+  THRIFT_UNUSED_VAR (protocol);
+  THRIFT_UNUSED_VAR (error);
+  return 0;
+}
+
+gint32
+thrift_compact_protocol_read_bool (ThriftProtocol *protocol, gboolean *value,
+                                   GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  ThriftCompactProtocol *cp = THRIFT_COMPACT_PROTOCOL (protocol);
+  guint8 byte;
+
+  if (cp->bool_value_pending)
+  {
+    /* already read as part of the field header */
+    cp->bool_value_pending = FALSE;
+    *value = cp->bool_value;
+    return 0;
+  }
+
+  if (thrift_compact_read_raw_byte (protocol, &byte, error) < 0)
+  {
+    return -1;
+  }
+  *value = byte == CT_BOOLEAN_TRUE;
+  return 1;
+}
+
+gint32
+thrift_compact_protocol_read_byte (ThriftProtocol *protocol, gint8 *value,
+                                   GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+
+  return thrift_compact_read_raw_byte (protocol, (guint8 *) value, error);
+}
+
+gint32
+thrift_compact_protocol_read_i16 (ThriftProtocol *protocol, gint16 *value,
+                                  GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+  gint32 ret;
+  guint32 n;
+
+  if ((ret = thrift_compact_read_varint32 (protocol, &n, error)) < 0)
+  {
+    return -1;
+  }
+  *value = (gint16) thrift_compact_zigzag_to_i32 (n);
+  return ret;
+}
+
+gint32
+thrift_compact_protocol_read_i32 (ThriftProtocol *protocol, gint32 *value,
+                                  GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+  gint32 ret;
+  guint32 n;
+
+  if ((ret = thrift_compact_read_varint32 (protocol, &n, error)) < 0)
+  {
+    return -1;
+  }
+  *value = thrift_compact_zigzag_to_i32 (n);
+  return ret;
+}
+
+gint32
+thrift_compact_protocol_read_i64 (ThriftProtocol *protocol, gint64 *value,
+                                  GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+  gint32 ret;
+  guint64 n;
+
+  if ((ret = thrift_compact_read_varint64 (protocol, &n, error)) < 0)
+  {
+    return -1;
+  }
+  *value = thrift_compact_zigzag_to_i64 (n);
+  return ret;
+}
+
+gint32
+thrift_compact_protocol_read_double (ThriftProtocol *protocol,
+                                     gdouble *value, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+  gint32 ret;
+  guint64 bits;
+
+  if ((ret = thrift_transport_read (protocol->transport, &bits, 8,
+                                    error)) < 0)
+  {
+    return -1;
+  }
+  *value = thrift_bitwise_cast_gdouble (GUINT64_FROM_LE (bits));
+  return ret;
+}
+
+gint32
+thrift_compact_protocol_read_string (ThriftProtocol *protocol,
+                                     gchar **str, GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+  gint32 ret;
+  gint32 xfer = 0;
+  guint32 read_len = 0;
+
+  if ((ret = thrift_compact_read_size (protocol, &read_len, error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+
+  if (read_len > 0)
+  {
+    /* allocate the memory for the string, plus the null terminator */
+    *str = g_new0 (gchar, read_len + 1);
+    if ((ret =
+         thrift_transport_read (protocol->transport,
+                                *str, read_len, error)) < 0)
+    {
+      g_free (*str);
+      *str = NULL;
+      return -1;
+    }
+    xfer += ret;
+  } else {
+    *str = NULL;
+  }
+
+  return xfer;
+}
+
+gint32
+thrift_compact_protocol_read_binary (ThriftProtocol *protocol,
+                                     gpointer *buf, guint32 *len,
+                                     GError **error)
+{
+  g_return_val_if_fail (THRIFT_IS_COMPACT_PROTOCOL (protocol), -1);
+  gint32 ret;
+  gint32 xfer = 0;
+  guint32 read_len = 0;
+
+  if ((ret = thrift_compact_read_size (protocol, &read_len, error)) < 0)
+  {
+    return -1;
+  }
+  xfer += ret;
+
+  if (read_len > 0)
+  {
+    *len = read_len;
+    *buf = g_new (guchar, *len);
+    if ((ret =
+         thrift_transport_read (protocol->transport,
+                                *buf, *len, error)) < 0)
+    {
+      g_free (*buf);
+      *buf = NULL;
+      *len = 0;
+      return -1;
+    }
+    xfer += ret;
+  } else {
+    *buf = NULL;
+    *len = 0;
+  }
+
+  return xfer;
+}
+
+static void
+thrift_compact_protocol_init (ThriftCompactProtocol *protocol)
+{
+  protocol->last_field_id = 0;
+  protocol->last_field_ids = g_queue_new ();
+  protocol->bool_field_pending = FALSE;
+  protocol->bool_field_id = 0;
+  protocol->bool_value_pending = FALSE;
+  protocol->bool_value = FALSE;
+}
+
+static void
+thrift_compact_protocol_finalize (GObject *object)
+{
+  ThriftCompactProtocol *protocol = THRIFT_COMPACT_PROTOCOL (object);
+
+  g_queue_free (protocol->last_field_ids);
+  protocol->last_field_ids = NULL;
+
+  G_OBJECT_CLASS (thrift_compact_protocol_parent_class)->finalize (object);
+}
+
+/* initialize the class */
+static void
+thrift_compact_protocol_class_init (ThriftCompactProtocolClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  ThriftProtocolClass *cls = THRIFT_PROTOCOL_CLASS (klass);
+
+  gobject_class->finalize = thrift_compact_protocol_finalize;
+
+  cls->write_message_begin = thrift_compact_protocol_write_message_begin;
+  cls->write_message_end = thrift_compact_protocol_write_message_end;
+  cls->write_struct_begin = thrift_compact_protocol_write_struct_begin;
+  cls->write_struct_end = thrift_compact_protocol_write_struct_end;
+  cls->write_field_begin = thrift_compact_protocol_write_field_begin;
+  cls->write_field_end = thrift_compact_protocol_write_field_end;
+  cls->write_field_stop = thrift_compact_protocol_write_field_stop;
+  cls->write_map_begin = thrift_compact_protocol_write_map_begin;
+  cls->write_map_end = thrift_compact_protocol_write_map_end;
+  cls->write_list_begin = thrift_compact_protocol_write_list_begin;
+  cls->write_list_end = thrift_compact_protocol_write_list_end;
+  cls->write_set_begin = thrift_compact_protocol_write_set_begin;
+  cls->write_set_end = thrift_compact_protocol_write_set_end;
+  cls->write_bool = thrift_compact_protocol_write_bool;
+  cls->write_byte = thrift_compact_protocol_write_byte;
+  cls->write_i16 = thrift_compact_protocol_write_i16;
+  cls->write_i32 = thrift_compact_protocol_write_i32;
+  cls->write_i64 = thrift_compact_protocol_write_i64;
+  cls->write_double = thrift_compact_protocol_write_double;
+  cls->write_string = thrift_compact_protocol_write_string;
+  cls->write_binary = thrift_compact_protocol_write_binary;
+  cls->read_message_begin = thrift_compact_protocol_read_message_begin;
+  cls->read_message_end = thrift_compact_protocol_read_message_end;
+  cls->read_struct_begin = thrift_compact_protocol_read_struct_begin;
+  cls->read_struct_end = thrift_compact_protocol_read_struct_end;
+  cls->read_field_begin = thrift_compact_protocol_read_field_begin;
+  cls->read_field_end = thrift_compact_protocol_read_field_end;
+  cls->read_map_begin = thrift_compact_protocol_read_map_begin;
+  cls->read_map_end = thrift_compact_protocol_read_map_end;
+  cls->read_list_begin = thrift_compact_protocol_read_list_begin;
+  cls->read_list_end = thrift_compact_protocol_read_list_end;
+  cls->read_set_begin = thrift_compact_protocol_read_set_begin;
+  cls->read_set_end = thrift_compact_protocol_read_set_end;
+  cls->read_bool = thrift_compact_protocol_read_bool;
+  cls->read_byte = thrift_compact_protocol_read_byte;
+  cls->read_i16 = thrift_compact_protocol_read_i16;
+  cls->read_i32 = thrift_compact_protocol_read_i32;
+  cls->read_i64 = thrift_compact_protocol_read_i64;
+  cls->read_double = thrift_compact_protocol_read_double;
+  cls->read_string = thrift_compact_protocol_read_string;
+  cls->read_binary = thrift_compact_protocol_read_binary;
+}
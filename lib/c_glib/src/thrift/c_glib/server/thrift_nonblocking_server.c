@@ -0,0 +1,613 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <thrift/c_glib/thrift.h>
+#include <thrift/c_glib/server/thrift_nonblocking_server.h>
+#include <thrift/c_glib/transport/thrift_memory_buffer.h>
+#include <thrift/c_glib/transport/thrift_server_socket.h>
+#include <thrift/c_glib/transport/thrift_socket.h>
+#include <thrift/c_glib/transport/thrift_transport_factory.h>
+#include <thrift/c_glib/protocol/thrift_protocol_factory.h>
+#include <thrift/c_glib/protocol/thrift_binary_protocol_factory.h>
+
+#ifdef MSG_NOSIGNAL
+#define THRIFT_NONBLOCKING_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define THRIFT_NONBLOCKING_SEND_FLAGS 0
+#endif
+
+/* GIOFunc watch callbacks are registered through the GSourceFunc slot */
+#define THRIFT_NONBLOCKING_IO_FUNC(f) ((GSourceFunc) (void (*) (void)) (f))
+
+/* object properties */
+enum _ThriftNonblockingServerProperties
+{
+  PROP_0,
+  PROP_THRIFT_NONBLOCKING_SERVER_NUM_THREADS,
+  PROP_THRIFT_NONBLOCKING_SERVER_MAX_FRAME_SIZE
+};
+
+/* where a connection is in its request/response cycle */
+typedef enum
+{
+  CONNECTION_READ_HEADER,
+  CONNECTION_READ_FRAME,
+  CONNECTION_PROCESSING,
+  CONNECTION_WRITE_REPLY
+} ThriftNonblockingConnectionState;
+
+/* per-client state, only touched by the loop unless PROCESSING */
+typedef struct
+{
+  ThriftNonblockingServer *server;
+  ThriftTransport *transport;
+  int sd;
+  GIOChannel *channel;
+  GSource *source;
+  ThriftNonblockingConnectionState state;
+  guchar header[4];
+  guint32 got;
+  guint32 frame_size;
+  GByteArray *frame;
+  GByteArray *reply;
+  guint32 sent;
+  gboolean failed;
+} ThriftNonblockingConnection;
+
+G_DEFINE_TYPE(ThriftNonblockingServer, thrift_nonblocking_server, THRIFT_TYPE_SERVER)
+
+static gboolean thrift_nonblocking_connection_io (GIOChannel *channel,
+                                                  GIOCondition condition,
+                                                  gpointer data);
+
+static gboolean
+thrift_nonblocking_set_nonblocking (int sd)
+{
+  int flags = fcntl (sd, F_GETFL, 0);
+  return flags != -1 && fcntl (sd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static void
+thrift_nonblocking_connection_unwatch (ThriftNonblockingConnection *conn)
+{
+  if (conn->source != NULL)
+  {
+    g_source_destroy (conn->source);
+    g_source_unref (conn->source);
+    conn->source = NULL;
+  }
+}
+
+/* replaces whatever source the connection had with an fd watch */
+static void
+thrift_nonblocking_connection_watch (ThriftNonblockingConnection *conn,
+                                     GIOCondition condition)
+{
+  thrift_nonblocking_connection_unwatch (conn);
+  conn->source = g_io_create_watch (conn->channel,
+                                    condition | G_IO_HUP | G_IO_ERR);
+  g_source_set_callback (conn->source,
+                         THRIFT_NONBLOCKING_IO_FUNC (thrift_nonblocking_connection_io),
+                         conn, NULL);
+  g_source_attach (conn->source, conn->server->context);
+}
+
+static void
+thrift_nonblocking_connection_free (ThriftNonblockingConnection *conn)
+{
+  ThriftNonblockingServer *tns = conn->server;
+
+  thrift_nonblocking_connection_unwatch (conn);
+  tns->connections = g_list_remove (tns->connections, conn);
+
+  g_io_channel_unref (conn->channel);
+  thrift_transport_close (conn->transport, NULL);
+  g_object_unref (conn->transport);
+  g_byte_array_free (conn->frame, TRUE);
+  g_byte_array_free (conn->reply, TRUE);
+  g_free (conn);
+}
+
+/* runs one frame through the processor and frames up the reply */
+static void
+thrift_nonblocking_connection_process (ThriftNonblockingConnection *conn)
+{
+  ThriftServer *server = THRIFT_SERVER (conn->server);
+  ThriftMemoryBuffer *in_buf = NULL, *out_buf = NULL;
+  ThriftTransport *input_transport = NULL, *output_transport = NULL;
+  ThriftProtocol *input_protocol = NULL, *output_protocol = NULL;
+  guint32 size = 0;
+
+  in_buf = g_object_new (THRIFT_TYPE_MEMORY_BUFFER, NULL);
+  g_byte_array_append (in_buf->buf, conn->frame->data, conn->frame->len);
+  out_buf = g_object_new (THRIFT_TYPE_MEMORY_BUFFER,
+                          "buf_size", conn->server->max_frame_size, NULL);
+
+  input_transport =
+      THRIFT_TRANSPORT_FACTORY_GET_CLASS (server->input_transport_factory)
+          ->get_transport (server->input_transport_factory,
+                           THRIFT_TRANSPORT (in_buf));
+  output_transport =
+      THRIFT_TRANSPORT_FACTORY_GET_CLASS (server->output_transport_factory)
+          ->get_transport (server->output_transport_factory,
+                           THRIFT_TRANSPORT (out_buf));
+  input_protocol =
+      THRIFT_PROTOCOL_FACTORY_GET_CLASS (server->input_protocol_factory)
+          ->get_protocol (server->input_protocol_factory, input_transport);
+  output_protocol =
+      THRIFT_PROTOCOL_FACTORY_GET_CLASS (server->output_protocol_factory)
+          ->get_protocol (server->output_protocol_factory, output_transport);
+
+  conn->failed = !THRIFT_PROCESSOR_GET_CLASS (server->processor)
+                      ->process (server->processor, input_protocol,
+                                 output_protocol);
+
+  g_byte_array_set_size (conn->reply, 0);
+  if (!conn->failed && out_buf->buf->len > 0)
+  {
+    /* oneway calls leave nothing to send back */
+    size = htonl (out_buf->buf->len);
+    g_byte_array_append (conn->reply, (guint8 *) &size, sizeof (size));
+    g_byte_array_append (conn->reply, out_buf->buf->data, out_buf->buf->len);
+  }
+  g_byte_array_set_size (conn->frame, 0);
+
+  g_object_unref (input_protocol);
+  g_object_unref (output_protocol);
+  if (input_transport != THRIFT_TRANSPORT (in_buf))
+  {
+    g_object_unref (input_transport);
+  }
+  if (output_transport != THRIFT_TRANSPORT (out_buf))
+  {
+    g_object_unref (output_transport);
+  }
+  g_object_unref (in_buf);
+  g_object_unref (out_buf);
+}
+
+/* sends as much of the reply as the socket takes: -1 error, 0 partial,
+ * 1 done */
+static gint
+thrift_nonblocking_connection_write (ThriftNonblockingConnection *conn)
+{
+  ssize_t ret = 0;
+
+  while (conn->sent < conn->reply->len)
+  {
+    ret = send (conn->sd, conn->reply->data + conn->sent,
+                conn->reply->len - conn->sent, THRIFT_NONBLOCKING_SEND_FLAGS);
+    if (ret < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    conn->sent += ret;
+  }
+  return 1;
+}
+
+static void
+thrift_nonblocking_connection_read_next (ThriftNonblockingConnection *conn)
+{
+  conn->state = CONNECTION_READ_HEADER;
+  conn->got = 0;
+  conn->sent = 0;
+  g_byte_array_set_size (conn->reply, 0);
+  thrift_nonblocking_connection_watch (conn, G_IO_IN);
+}
+
+/* back on the loop once a frame has been processed */
+static void
+thrift_nonblocking_connection_finish (ThriftNonblockingConnection *conn)
+{
+  gint ret = 0;
+
+  if (conn->failed)
+  {
+    thrift_nonblocking_connection_free (conn);
+    return;
+  }
+
+  conn->state = CONNECTION_WRITE_REPLY;
+  conn->sent = 0;
+  ret = thrift_nonblocking_connection_write (conn);
+  if (ret < 0)
+  {
+    thrift_nonblocking_connection_free (conn);
+  } else if (ret == 0) {
+    thrift_nonblocking_connection_watch (conn, G_IO_OUT);
+  } else {
+    thrift_nonblocking_connection_read_next (conn);
+  }
+}
+
+static gboolean
+thrift_nonblocking_connection_resume (gpointer data)
+{
+  thrift_nonblocking_connection_finish (data);
+  return FALSE;
+}
+
+/* pool worker: process off the loop, then queue the reply back onto it */
+static void
+thrift_nonblocking_server_work (gpointer data, gpointer user_data)
+{
+  ThriftNonblockingConnection *conn = data;
+  THRIFT_UNUSED_VAR (user_data);
+
+  thrift_nonblocking_connection_process (conn);
+
+  conn->source = g_idle_source_new ();
+  g_source_set_callback (conn->source, thrift_nonblocking_connection_resume,
+                         conn, NULL);
+  g_source_attach (conn->source, conn->server->context);
+}
+
+static void
+thrift_nonblocking_connection_dispatch (ThriftNonblockingConnection *conn)
+{
+  conn->state = CONNECTION_PROCESSING;
+  if (conn->server->pool != NULL)
+  {
+    thrift_nonblocking_connection_unwatch (conn);
+    g_thread_pool_push (conn->server->pool, conn, NULL);
+  } else {
+    thrift_nonblocking_connection_process (conn);
+    thrift_nonblocking_connection_finish (conn);
+  }
+}
+
+/* reads the frame header and body; returns FALSE once the watch is gone */
+static gboolean
+thrift_nonblocking_connection_read (ThriftNonblockingConnection *conn)
+{
+  ssize_t ret = 0;
+
+  while (TRUE)
+  {
+    if (conn->state == CONNECTION_READ_HEADER)
+    {
+      ret = recv (conn->sd, conn->header + conn->got,
+                  sizeof (conn->header) - conn->got, 0);
+    } else {
+      ret = recv (conn->sd, conn->frame->data + conn->got,
+                  conn->frame_size - conn->got, 0);
+    }
+
+    if (ret < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      return TRUE;
+    }
+    if (ret <= 0)
+    {
+      thrift_nonblocking_connection_free (conn);
+      return FALSE;
+    }
+    conn->got += ret;
+
+    if (conn->state == CONNECTION_READ_HEADER
+        && conn->got == sizeof (conn->header))
+    {
+      memcpy (&conn->frame_size, conn->header, sizeof (conn->frame_size));
+      conn->frame_size = ntohl (conn->frame_size);
+      if (conn->frame_size == 0
+          || conn->frame_size > conn->server->max_frame_size)
+      {
+        g_warning ("dropping client: frame size %u is out of range",
+                   conn->frame_size);
+        thrift_nonblocking_connection_free (conn);
+        return FALSE;
+      }
+      g_byte_array_set_size (conn->frame, conn->frame_size);
+      conn->state = CONNECTION_READ_FRAME;
+      conn->got = 0;
+    } else if (conn->state == CONNECTION_READ_FRAME
+               && conn->got == conn->frame_size) {
+      thrift_nonblocking_connection_dispatch (conn);
+      return FALSE;
+    }
+  }
+}
+
+static gboolean
+thrift_nonblocking_connection_io (GIOChannel *channel, GIOCondition condition,
+                                  gpointer data)
+{
+  ThriftNonblockingConnection *conn = data;
+  gint ret = 0;
+  THRIFT_UNUSED_VAR (channel);
+  THRIFT_UNUSED_VAR (condition);
+
+  if (conn->state != CONNECTION_WRITE_REPLY)
+  {
+    return thrift_nonblocking_connection_read (conn);
+  }
+
+  ret = thrift_nonblocking_connection_write (conn);
+  if (ret < 0)
+  {
+    thrift_nonblocking_connection_free (conn);
+    return FALSE;
+  }
+  if (ret == 0)
+  {
+    return TRUE;
+  }
+  thrift_nonblocking_connection_read_next (conn);
+  return FALSE;
+}
+
+static gboolean
+thrift_nonblocking_server_accept (GIOChannel *channel, GIOCondition condition,
+                                  gpointer data)
+{
+  ThriftServer *server = THRIFT_SERVER (data);
+  ThriftNonblockingServer *tns = THRIFT_NONBLOCKING_SERVER (data);
+  ThriftNonblockingConnection *conn = NULL;
+  ThriftTransport *t = NULL;
+  GError *error = NULL;
+  THRIFT_UNUSED_VAR (channel);
+  THRIFT_UNUSED_VAR (condition);
+
+  t = thrift_server_transport_accept (server->server_transport, &error);
+  if (t == NULL)
+  {
+    /* another wakeup will follow if a client is still pending */
+    g_error_free (error);
+    return TRUE;
+  }
+
+  conn = g_new0 (ThriftNonblockingConnection, 1);
+  conn->server = tns;
+  conn->transport = t;
+  conn->sd = THRIFT_SOCKET (t)->sd;
+  conn->frame = g_byte_array_new ();
+  conn->reply = g_byte_array_new ();
+  conn->channel = g_io_channel_unix_new (conn->sd);
+  tns->connections = g_list_prepend (tns->connections, conn);
+
+  if (!thrift_nonblocking_set_nonblocking (conn->sd))
+  {
+    thrift_nonblocking_connection_free (conn);
+    return TRUE;
+  }
+
+  thrift_nonblocking_connection_read_next (conn);
+  return TRUE;
+}
+
+void
+thrift_nonblocking_server_serve (ThriftServer *server)
+{
+  g_return_if_fail (THRIFT_IS_NONBLOCKING_SERVER (server));
+  g_return_if_fail (THRIFT_IS_SERVER_SOCKET (server->server_transport));
+
+  GIOChannel *channel = NULL;
+  GError *error = NULL;
+  ThriftNonblockingServer *tns = THRIFT_NONBLOCKING_SERVER (server);
+  int sd = 0;
+
+#if !GLIB_CHECK_VERSION (2, 32, 0)
+  if (!g_thread_supported ())
+  {
+    g_thread_init (NULL);
+  }
+#endif
+
+  if (tns->num_threads > 0)
+  {
+    tns->pool = g_thread_pool_new (thrift_nonblocking_server_work, tns,
+                                   (gint) tns->num_threads, FALSE, &error);
+    if (tns->pool == NULL)
+    {
+      g_warning ("unable to create thread pool: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+  }
+
+  if (!THRIFT_SERVER_TRANSPORT_GET_CLASS (server->server_transport)
+          ->listen (server->server_transport, &error))
+  {
+    g_warning ("unable to listen: %s", error->message);
+    g_error_free (error);
+  } else {
+    sd = THRIFT_SERVER_SOCKET (server->server_transport)->sd;
+    thrift_nonblocking_set_nonblocking (sd);
+
+    channel = g_io_channel_unix_new (sd);
+    tns->listen_source = g_io_create_watch (channel, G_IO_IN);
+    g_source_set_callback (tns->listen_source,
+                           THRIFT_NONBLOCKING_IO_FUNC (thrift_nonblocking_server_accept),
+                           tns, NULL);
+    g_source_attach (tns->listen_source, tns->context);
+    g_io_channel_unref (channel);
+
+    g_main_loop_run (tns->loop);
+
+    g_source_destroy (tns->listen_source);
+    g_source_unref (tns->listen_source);
+    tns->listen_source = NULL;
+  }
+
+  // let in-flight requests finish before their connections go away
+  if (tns->pool != NULL)
+  {
+    g_thread_pool_free (tns->pool, FALSE, TRUE);
+    tns->pool = NULL;
+  }
+  while (tns->connections != NULL)
+  {
+    thrift_nonblocking_connection_free (tns->connections->data);
+  }
+
+  // attempt to shutdown
+  THRIFT_SERVER_TRANSPORT_GET_CLASS (server->server_transport)
+      ->close (server->server_transport, NULL);
+}
+
+void
+thrift_nonblocking_server_stop (ThriftServer *server)
+{
+  g_return_if_fail (THRIFT_IS_NONBLOCKING_SERVER (server));
+  g_main_loop_quit (THRIFT_NONBLOCKING_SERVER (server)->loop);
+}
+
+static void
+thrift_nonblocking_server_init (ThriftNonblockingServer *tns)
+{
+  tns->pool = NULL;
+  tns->listen_source = NULL;
+  tns->connections = NULL;
+  tns->context = g_main_context_new ();
+  tns->loop = g_main_loop_new (tns->context, FALSE);
+
+  ThriftServer *server = THRIFT_SERVER(tns);
+
+  if (server->input_transport_factory == NULL)
+  {
+    server->input_transport_factory =
+        g_object_new (THRIFT_TYPE_TRANSPORT_FACTORY, NULL);
+  }
+  if (server->output_transport_factory == NULL)
+  {
+    server->output_transport_factory =
+        g_object_new (THRIFT_TYPE_TRANSPORT_FACTORY, NULL);
+  }
+  if (server->input_protocol_factory == NULL)
+  {
+    server->input_protocol_factory =
+        g_object_new (THRIFT_TYPE_BINARY_PROTOCOL_FACTORY, NULL);
+  }
+  if (server->output_protocol_factory == NULL)
+  {
+    server->output_protocol_factory =
+        g_object_new (THRIFT_TYPE_BINARY_PROTOCOL_FACTORY, NULL);
+  }
+}
+
+static void
+thrift_nonblocking_server_finalize (GObject *object)
+{
+  ThriftNonblockingServer *tns = THRIFT_NONBLOCKING_SERVER (object);
+
+  g_main_loop_unref (tns->loop);
+  g_main_context_unref (tns->context);
+
+  G_OBJECT_CLASS (thrift_nonblocking_server_parent_class)->finalize (object);
+}
+
+/* property accessor */
+void
+thrift_nonblocking_server_get_property (GObject *object, guint property_id,
+                                        GValue *value, GParamSpec *pspec)
+{
+  ThriftNonblockingServer *tns = THRIFT_NONBLOCKING_SERVER (object);
+
+  switch (property_id)
+  {
+    case PROP_THRIFT_NONBLOCKING_SERVER_NUM_THREADS:
+      g_value_set_uint (value, tns->num_threads);
+      break;
+    case PROP_THRIFT_NONBLOCKING_SERVER_MAX_FRAME_SIZE:
+      g_value_set_uint (value, tns->max_frame_size);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+/* property mutator */
+void
+thrift_nonblocking_server_set_property (GObject *object, guint property_id,
+                                        const GValue *value, GParamSpec *pspec)
+{
+  ThriftNonblockingServer *tns = THRIFT_NONBLOCKING_SERVER (object);
+
+  switch (property_id)
+  {
+    case PROP_THRIFT_NONBLOCKING_SERVER_NUM_THREADS:
+      tns->num_threads = g_value_get_uint (value);
+      break;
+    case PROP_THRIFT_NONBLOCKING_SERVER_MAX_FRAME_SIZE:
+      tns->max_frame_size = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+/* initialize the class */
+static void
+thrift_nonblocking_server_class_init (ThriftNonblockingServerClass *class)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (class);
+  ThriftServerClass *cls = THRIFT_SERVER_CLASS(class);
+  GParamSpec *param_spec = NULL;
+
+  gobject_class->get_property = thrift_nonblocking_server_get_property;
+  gobject_class->set_property = thrift_nonblocking_server_set_property;
+  gobject_class->finalize = thrift_nonblocking_server_finalize;
+
+  param_spec = g_param_spec_uint ("num_threads",
+                                  "number of threads (construct)",
+                                  "Process frames on this many worker "
+                                  "threads, 0 to process on the loop",
+                                  0, /* min */
+                                  G_MAXINT, /* max */
+                                  0, /* default value */
+                                  G_PARAM_CONSTRUCT_ONLY |
+                                  G_PARAM_READWRITE);
+  g_object_class_install_property (gobject_class,
+                                   PROP_THRIFT_NONBLOCKING_SERVER_NUM_THREADS,
+                                   param_spec);
+
+  /* replies are built in a ThriftMemoryBuffer, which caps out at 1MB */
+  param_spec = g_param_spec_uint ("max_frame_size",
+                                  "max frame size (construct)",
+                                  "Largest request or reply frame accepted",
+                                  1, /* min */
+                                  1048576, /* max, 1024*1024 */
+                                  1048576, /* default value */
+                                  G_PARAM_CONSTRUCT_ONLY |
+                                  G_PARAM_READWRITE);
+  g_object_class_install_property (gobject_class,
+                                   PROP_THRIFT_NONBLOCKING_SERVER_MAX_FRAME_SIZE,
+                                   param_spec);
+
+  cls->serve = thrift_nonblocking_server_serve;
+  cls->stop = thrift_nonblocking_server_stop;
+}
@@ -0,0 +1,80 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_NONBLOCKING_SERVER_H
+#define _THRIFT_NONBLOCKING_SERVER_H
+
+#include <glib-object.h>
+
+#include <thrift/c_glib/server/thrift_server.h>
+
+G_BEGIN_DECLS
+
+/*! \file thrift_nonblocking_server.h
+ *  \brief A non-blocking Thrift server driven by a GLib main loop.
+ *
+ * Clients must use framed transport.  Every connection is watched from a
+ * single GMainContext; complete frames are either processed on the loop
+ * or, when num_threads is non-zero, on a GThreadPool.  The server
+ * transport must be a ThriftServerSocket.
+ */
+
+/* type macros */
+#define THRIFT_TYPE_NONBLOCKING_SERVER (thrift_nonblocking_server_get_type ())
+#define THRIFT_NONBLOCKING_SERVER(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), THRIFT_TYPE_NONBLOCKING_SERVER, ThriftNonblockingServer))
+#define THRIFT_IS_NONBLOCKING_SERVER(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), THRIFT_TYPE_NONBLOCKING_SERVER))
+#define THRIFT_NONBLOCKING_SERVER_CLASS(c) (G_TYPE_CHECK_CLASS_CAST ((c), THRIFT_TYPE_NONBLOCKING_SERVER, ThriftNonblockingServerClass))
+#define THRIFT_IS_NONBLOCKING_SERVER_CLASS(c) (G_TYPE_CHECK_CLASS_TYPE ((c), THRIFT_TYPE_NONBLOCKING_SERVER))
+#define THRIFT_NONBLOCKING_SERVER_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), THRIFT_TYPE_NONBLOCKING_SERVER, ThriftNonblockingServerClass))
+
+typedef struct _ThriftNonblockingServer ThriftNonblockingServer;
+
+/**
+ * Thrift Nonblocking Server instance.
+ */
+struct _ThriftNonblockingServer
+{
+  ThriftServer parent;
+
+  /* private */
+  guint num_threads;
+  guint32 max_frame_size;
+  GMainContext *context;
+  GMainLoop *loop;
+  GThreadPool *pool;
+  GSource *listen_source;
+  GList *connections;
+};
+
+typedef struct _ThriftNonblockingServerClass ThriftNonblockingServerClass;
+
+/**
+ * Thrift Nonblocking Server class.
+ */
+struct _ThriftNonblockingServerClass
+{
+  ThriftServerClass parent;
+};
+
+/* used by THRIFT_TYPE_NONBLOCKING_SERVER */
+GType thrift_nonblocking_server_get_type (void);
+
+G_END_DECLS
+
+#endif /* _THRIFT_NONBLOCKING_SERVER_H */
@@ -0,0 +1,228 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/c_glib/thrift.h>
+#include <thrift/c_glib/server/thrift_thread_pool_server.h>
+#include <thrift/c_glib/transport/thrift_transport_factory.h>
+#include <thrift/c_glib/protocol/thrift_protocol_factory.h>
+#include <thrift/c_glib/protocol/thrift_binary_protocol_factory.h>
+
+/* object properties */
+enum _ThriftThreadPoolServerProperties
+{
+  PROP_0,
+  PROP_THRIFT_THREAD_POOL_SERVER_NUM_THREADS
+};
+
+G_DEFINE_TYPE(ThriftThreadPoolServer, thrift_thread_pool_server, THRIFT_TYPE_SERVER)
+
+/* serves a single client connection on a pool thread */
+static void
+thrift_thread_pool_server_handle (gpointer data, gpointer user_data)
+{
+  ThriftTransport *t = THRIFT_TRANSPORT (data);
+  ThriftServer *server = THRIFT_SERVER (user_data);
+  ThriftTransport *input_transport = NULL, *output_transport = NULL;
+  ThriftProtocol *input_protocol = NULL, *output_protocol = NULL;
+
+  input_transport =
+      THRIFT_TRANSPORT_FACTORY_GET_CLASS (server->input_transport_factory)
+          ->get_transport (server->input_transport_factory, t);
+  output_transport =
+      THRIFT_TRANSPORT_FACTORY_GET_CLASS (server->output_transport_factory)
+          ->get_transport (server->output_transport_factory, t);
+  input_protocol =
+      THRIFT_PROTOCOL_FACTORY_GET_CLASS (server->input_protocol_factory)
+          ->get_protocol (server->input_protocol_factory, input_transport);
+  output_protocol =
+      THRIFT_PROTOCOL_FACTORY_GET_CLASS (server->output_protocol_factory)
+          ->get_protocol (server->output_protocol_factory, output_transport);
+
+  while (THRIFT_PROCESSOR_GET_CLASS (server->processor)
+             ->process (server->processor, input_protocol, output_protocol))
+  {
+    // TODO: implement transport peek ()
+  }
+
+  THRIFT_TRANSPORT_GET_CLASS (input_transport)->close (input_transport, NULL);
+  THRIFT_TRANSPORT_GET_CLASS (output_transport)->close (output_transport,
+                                                        NULL);
+
+  g_object_unref (input_protocol);
+  g_object_unref (output_protocol);
+  if (input_transport != t)
+  {
+    g_object_unref (input_transport);
+  }
+  if (output_transport != t && output_transport != input_transport)
+  {
+    g_object_unref (output_transport);
+  }
+  g_object_unref (t);
+}
+
+void
+thrift_thread_pool_server_serve (ThriftServer *server)
+{
+  g_return_if_fail (THRIFT_IS_THREAD_POOL_SERVER (server));
+
+  ThriftTransport *t = NULL;
+  GError *error = NULL;
+  ThriftThreadPoolServer *tps = THRIFT_THREAD_POOL_SERVER (server);
+
+#if !GLIB_CHECK_VERSION (2, 32, 0)
+  if (!g_thread_supported ())
+  {
+    g_thread_init (NULL);
+  }
+#endif
+
+  tps->pool = g_thread_pool_new (thrift_thread_pool_server_handle, server,
+                                 (gint) tps->num_threads, FALSE, &error);
+  if (tps->pool == NULL)
+  {
+    g_warning ("unable to create thread pool: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  THRIFT_SERVER_TRANSPORT_GET_CLASS (server->server_transport)
+      ->listen (server->server_transport, NULL);
+
+  tps->running = TRUE;
+  while (tps->running == TRUE)
+  {
+    t = thrift_server_transport_accept (server->server_transport, NULL);
+    if (t == NULL)
+    {
+      continue;
+    }
+
+    /* connections queue up once every worker is busy */
+    g_thread_pool_push (tps->pool, t, NULL);
+  }
+
+  // wait for the connections already handed out to finish
+  g_thread_pool_free (tps->pool, FALSE, TRUE);
+  tps->pool = NULL;
+
+  // attempt to shutdown
+  THRIFT_SERVER_TRANSPORT_GET_CLASS (server->server_transport)
+      ->close (server->server_transport, NULL);
+}
+
+void
+thrift_thread_pool_server_stop (ThriftServer *server)
+{
+  g_return_if_fail (THRIFT_IS_THREAD_POOL_SERVER (server));
+  (THRIFT_THREAD_POOL_SERVER (server))->running = FALSE;
+}
+
+static void
+thrift_thread_pool_server_init (ThriftThreadPoolServer *tps)
+{
+  tps->running = FALSE;
+  tps->pool = NULL;
+
+  ThriftServer *server = THRIFT_SERVER(tps);
+
+  if (server->input_transport_factory == NULL)
+  {
+    server->input_transport_factory =
+        g_object_new (THRIFT_TYPE_TRANSPORT_FACTORY, NULL);
+  }
+  if (server->output_transport_factory == NULL)
+  {
+    server->output_transport_factory =
+        g_object_new (THRIFT_TYPE_TRANSPORT_FACTORY, NULL);
+  }
+  if (server->input_protocol_factory == NULL)
+  {
+    server->input_protocol_factory =
+        g_object_new (THRIFT_TYPE_BINARY_PROTOCOL_FACTORY, NULL);
+  }
+  if (server->output_protocol_factory == NULL)
+  {
+    server->output_protocol_factory =
+        g_object_new (THRIFT_TYPE_BINARY_PROTOCOL_FACTORY, NULL);
+  }
+}
+
+/* property accessor */
+void
+thrift_thread_pool_server_get_property (GObject *object, guint property_id,
+                                        GValue *value, GParamSpec *pspec)
+{
+  ThriftThreadPoolServer *tps = THRIFT_THREAD_POOL_SERVER (object);
+
+  switch (property_id)
+  {
+    case PROP_THRIFT_THREAD_POOL_SERVER_NUM_THREADS:
+      g_value_set_uint (value, tps->num_threads);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+/* property mutator */
+void
+thrift_thread_pool_server_set_property (GObject *object, guint property_id,
+                                        const GValue *value, GParamSpec *pspec)
+{
+  ThriftThreadPoolServer *tps = THRIFT_THREAD_POOL_SERVER (object);
+
+  switch (property_id)
+  {
+    case PROP_THRIFT_THREAD_POOL_SERVER_NUM_THREADS:
+      tps->num_threads = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+/* initialize the class */
+static void
+thrift_thread_pool_server_class_init (ThriftThreadPoolServerClass *class)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (class);
+  ThriftServerClass *cls = THRIFT_SERVER_CLASS(class);
+  GParamSpec *param_spec = NULL;
+
+  gobject_class->get_property = thrift_thread_pool_server_get_property;
+  gobject_class->set_property = thrift_thread_pool_server_set_property;
+
+  param_spec = g_param_spec_uint ("num_threads",
+                                  "number of threads (construct)",
+                                  "Set the number of worker threads",
+                                  1, /* min */
+                                  G_MAXINT, /* max */
+                                  10, /* default value */
+                                  G_PARAM_CONSTRUCT_ONLY |
+                                  G_PARAM_READWRITE);
+  g_object_class_install_property (gobject_class,
+                                   PROP_THRIFT_THREAD_POOL_SERVER_NUM_THREADS,
+                                   param_spec);
+
+  cls->serve = thrift_thread_pool_server_serve;
+  cls->stop = thrift_thread_pool_server_stop;
+}
@@ -0,0 +1,72 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_THREAD_POOL_SERVER_H
+#define _THRIFT_THREAD_POOL_SERVER_H
+
+#include <glib-object.h>
+
+#include <thrift/c_glib/server/thrift_server.h>
+
+G_BEGIN_DECLS
+
+/*! \file thrift_thread_pool_server.h
+ *  \brief A Thrift server that hands each accepted connection to a
+ *         GThreadPool worker.
+ */
+
+/* type macros */
+#define THRIFT_TYPE_THREAD_POOL_SERVER (thrift_thread_pool_server_get_type ())
+#define THRIFT_THREAD_POOL_SERVER(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), THRIFT_TYPE_THREAD_POOL_SERVER, ThriftThreadPoolServer))
+#define THRIFT_IS_THREAD_POOL_SERVER(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), THRIFT_TYPE_THREAD_POOL_SERVER))
+#define THRIFT_THREAD_POOL_SERVER_CLASS(c) (G_TYPE_CHECK_CLASS_CAST ((c), THRIFT_TYPE_THREAD_POOL_SERVER, ThriftThreadPoolServerClass))
+#define THRIFT_IS_THREAD_POOL_SERVER_CLASS(c) (G_TYPE_CHECK_CLASS_TYPE ((c), THRIFT_TYPE_THREAD_POOL_SERVER))
+#define THRIFT_THREAD_POOL_SERVER_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), THRIFT_TYPE_THREAD_POOL_SERVER, ThriftThreadPoolServerClass))
+
+typedef struct _ThriftThreadPoolServer ThriftThreadPoolServer;
+
+/**
+ * Thrift Thread Pool Server instance.
+ */
+struct _ThriftThreadPoolServer
+{
+  ThriftServer parent;
+
+  /* private */
+  volatile gboolean running;
+  guint num_threads;
+  GThreadPool *pool;
+};
+
+typedef struct _ThriftThreadPoolServerClass ThriftThreadPoolServerClass;
+
+/**
+ * Thrift Thread Pool Server class.
+ */
+struct _ThriftThreadPoolServerClass
+{
+  ThriftServerClass parent;
+};
+
+/* used by THRIFT_TYPE_THREAD_POOL_SERVER */
+GType thrift_thread_pool_server_get_type (void);
+
+G_END_DECLS
+
+#endif /* _THRIFT_THREAD_POOL_SERVER_H */
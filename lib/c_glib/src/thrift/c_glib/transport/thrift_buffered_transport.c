@@ -63,58 +63,66 @@ thrift_buffered_transport_close (ThriftTransport *transport, GError **error)
   return THRIFT_TRANSPORT_GET_CLASS (t->transport)->close (t->transport, error);
 }
 
+/* implements thrift_transport_borrow */
+const guint8 *
+thrift_buffered_transport_borrow (ThriftTransport *transport, guint32 *len)
+{
+  ThriftBufferedTransport *t = THRIFT_BUFFERED_TRANSPORT (transport);
+  guint32 have = t->r_buf->len - t->r_buf_pos;
+
+  if (have < *len)
+  {
+    return NULL;
+  }
+  *len = have;
+  return t->r_buf->data + t->r_buf_pos;
+}
+
+/* implements thrift_transport_consume */
+void
+thrift_buffered_transport_consume (ThriftTransport *transport, guint32 len)
+{
+  ThriftBufferedTransport *t = THRIFT_BUFFERED_TRANSPORT (transport);
+
+  t->r_buf_pos += len;
+  if (t->r_buf_pos >= t->r_buf->len)
+  {
+    g_byte_array_set_size (t->r_buf, 0);
+    t->r_buf_pos = 0;
+  }
+}
+
 /* the actual read is "slow" because it calls the underlying transport */
 gint32
 thrift_buffered_transport_read_slow (ThriftTransport *transport, gpointer buf,
                                      guint32 len, GError **error)
 {
   ThriftBufferedTransport *t = THRIFT_BUFFERED_TRANSPORT (transport);
-  guint32 want = len;
-  guint32 got = 0;
-  guchar tmpdata[len];
-  guint32 have = t->r_buf->len;
+  guint32 have = t->r_buf->len - t->r_buf_pos;
+  gint32 got = 0;
 
   // we shouldn't hit this unless the buffer doesn't have enough to read
-  assert (t->r_buf->len < want);
+  assert (have < len);
 
   // first copy what we have in our buffer.
   if (have > 0)
   {
-    memcpy (buf, t->r_buf, t->r_buf->len);
-    want -= t->r_buf->len;
-    t->r_buf = g_byte_array_remove_range (t->r_buf, 0, t->r_buf->len);
+    memcpy (buf, t->r_buf->data + t->r_buf_pos, have);
+    thrift_buffered_transport_consume (transport, have);
   }
 
-  // if the buffer is still smaller than what we want to read, then just
-  // read it directly.  otherwise, fill the buffer and then give out
-  // enough to satisfy the read.
-  if (t->r_buf_size < want)
+  // the underlying transport reads exactly what it is asked for, so
+  // reading ahead into our buffer could block; read the rest straight
+  // into the caller's memory instead of bouncing it through r_buf.
+  got = THRIFT_TRANSPORT_GET_CLASS (t->transport)->read (t->transport,
+                                                         (guchar *) buf + have,
+                                                         len - have,
+                                                         error);
+  if (got < 0)
   {
-    got += THRIFT_TRANSPORT_GET_CLASS (t->transport)->read (t->transport,
-                                                            tmpdata,
-                                                            want,
-                                                            error);
-
-    // copy the data starting from where we left off
-    memcpy (buf + have, tmpdata, got);
-    return got + have; 
-  } else {
-    got += THRIFT_TRANSPORT_GET_CLASS (t->transport)->read (t->transport,
-                                                            tmpdata,
-                                                            want,
-                                                            error);
-    t->r_buf = g_byte_array_append (t->r_buf, tmpdata, got);
-    
-    // hand over what we have up to what the caller wants
-    guint32 give = want < t->r_buf->len ? want : t->r_buf->len;
-
-
-    memcpy (buf + len - want, t->r_buf->data, give);
-    t->r_buf = g_byte_array_remove_range (t->r_buf, 0, give);
-    want -= give;
-
-    return (len - want);
+    return -1;
   }
+  return have + got;
 }
 
 /* implements thrift_transport_read */
@@ -126,10 +134,10 @@ thrift_buffered_transport_read (ThriftTransport *transport, gpointer buf,
 
   /* if we have enough buffer data to fulfill the read, just use
    * a memcpy */
-  if (len <= t->r_buf->len)
+  if (len <= t->r_buf->len - t->r_buf_pos)
   {
-    memcpy (buf, t->r_buf->data, len);
-    g_byte_array_remove_range (t->r_buf, 0, len);
+    memcpy (buf, t->r_buf->data + t->r_buf_pos, len);
+    thrift_buffered_transport_consume (transport, len);
     return len;
   }
 
@@ -245,6 +253,7 @@ thrift_buffered_transport_init (ThriftBufferedTransport *transport)
   transport->transport = NULL;
   transport->r_buf = g_byte_array_new ();
   transport->w_buf = g_byte_array_new ();
+  transport->r_buf_pos = 0;
 }
 
 /* destructor */
@@ -365,4 +374,6 @@ thrift_buffered_transport_class_init (ThriftBufferedTransportClass *cls)
   ttc->write = thrift_buffered_transport_write;
   ttc->write_end = thrift_buffered_transport_write_end;
   ttc->flush = thrift_buffered_transport_flush;
+  ttc->borrow = thrift_buffered_transport_borrow;
+  ttc->consume = thrift_buffered_transport_consume;
 }
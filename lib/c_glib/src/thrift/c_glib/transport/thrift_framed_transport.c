@@ -73,25 +73,82 @@ thrift_framed_transport_read_frame (ThriftTransport *transport,
   ThriftFramedTransport *t = THRIFT_FRAMED_TRANSPORT (transport);
   gint32 sz, bytes;
 
+  /* only called once everything buffered has been handed out */
+  g_byte_array_set_size (t->r_buf, 0);
+  t->r_buf_pos = 0;
+
   /* read the size */
-  THRIFT_TRANSPORT_GET_CLASS (t->transport)->read (t->transport,
-                                                   (guint32 *) &sz,
-                                                   sizeof (sz), error);
+  bytes = THRIFT_TRANSPORT_GET_CLASS (t->transport)->read (t->transport,
+                                                           (guint32 *) &sz,
+                                                           sizeof (sz), error);
+  if (bytes != sizeof (sz))
+  {
+    return FALSE;
+  }
   sz = ntohl (sz);
+  if (sz < 0)
+  {
+    g_set_error (error, THRIFT_TRANSPORT_ERROR,
+                 THRIFT_TRANSPORT_ERROR_RECEIVE,
+                 "got negative frame size %d", sz);
+    return FALSE;
+  }
 
-  /* create a buffer to hold the data and read that much data */
-  guchar tmpdata[sz];
+  /* read the frame straight into the buffer */
+  g_byte_array_set_size (t->r_buf, sz);
   bytes = THRIFT_TRANSPORT_GET_CLASS (t->transport)->read (t->transport,
-                                                           tmpdata,
+                                                           t->r_buf->data,
                                                            sz,
                                                            error);
-
-  /* add the data to the buffer */
-  g_byte_array_append (t->r_buf, tmpdata, bytes);
+  if (bytes < 0)
+  {
+    g_byte_array_set_size (t->r_buf, 0);
+    return FALSE;
+  }
+  g_byte_array_set_size (t->r_buf, bytes);
 
   return TRUE;
 }
 
+/* implements thrift_transport_borrow */
+const guint8 *
+thrift_framed_transport_borrow (ThriftTransport *transport, guint32 *len)
+{
+  ThriftFramedTransport *t = THRIFT_FRAMED_TRANSPORT (transport);
+  guint32 have = t->r_buf->len - t->r_buf_pos;
+
+  /* whole frames are buffered, so start the next one when this is empty */
+  if (have == 0 && *len > 0)
+  {
+    if (!thrift_framed_transport_read_frame (transport, NULL))
+    {
+      return NULL;
+    }
+    have = t->r_buf->len;
+  }
+
+  if (have < *len)
+  {
+    return NULL;
+  }
+  *len = have;
+  return t->r_buf->data + t->r_buf_pos;
+}
+
+/* implements thrift_transport_consume */
+void
+thrift_framed_transport_consume (ThriftTransport *transport, guint32 len)
+{
+  ThriftFramedTransport *t = THRIFT_FRAMED_TRANSPORT (transport);
+
+  t->r_buf_pos += len;
+  if (t->r_buf_pos >= t->r_buf->len)
+  {
+    g_byte_array_set_size (t->r_buf, 0);
+    t->r_buf_pos = 0;
+  }
+}
+
 /* the actual read is "slow" because it calls the underlying transport */
 gint32
 thrift_framed_transport_read_slow (ThriftTransport *transport, gpointer buf,
@@ -99,31 +156,36 @@ thrift_framed_transport_read_slow (ThriftTransport *transport, gpointer buf,
 {
   ThriftFramedTransport *t = THRIFT_FRAMED_TRANSPORT (transport);
   guint32 want = len;
-  guint32 have = t->r_buf->len;
+  guint32 have = t->r_buf->len - t->r_buf_pos;
+  guint32 give = 0;
 
   // we shouldn't hit this unless the buffer doesn't have enough to read
-  assert (t->r_buf->len < want);
+  assert (have < want);
 
   // first copy what we have in our buffer, if there is anything left
   if (have > 0)
   {
-    memcpy (buf, t->r_buf, t->r_buf->len);
-    want -= t->r_buf->len;
-    t->r_buf = g_byte_array_remove_range (t->r_buf, 0, t->r_buf->len);
+    memcpy (buf, t->r_buf->data + t->r_buf_pos, have);
+    want -= have;
+    thrift_framed_transport_consume (transport, have);
   }
 
-  // read a frame of input and buffer it
-  thrift_framed_transport_read_frame (transport, error);
-
-  // hand over what we have up to what the caller wants
-  guint32 give = want < t->r_buf->len ? want : t->r_buf->len;
-
-  // copy the data into the buffer
-  memcpy (buf + len - want, t->r_buf->data, give);
-  t->r_buf = g_byte_array_remove_range (t->r_buf, 0, give);
-  want -= give;
+  // read frames of input until the caller has what it asked for
+  while (want > 0)
+  {
+    if (!thrift_framed_transport_read_frame (transport, error))
+    {
+      return -1;
+    }
+
+    // hand over what we have up to what the caller wants
+    give = want < t->r_buf->len ? want : t->r_buf->len;
+    memcpy ((guchar *) buf + len - want, t->r_buf->data, give);
+    thrift_framed_transport_consume (transport, give);
+    want -= give;
+  }
 
-  return (len - want);
+  return len;
 }
 
 /* implements thrift_transport_read */
@@ -135,10 +197,10 @@ thrift_framed_transport_read (ThriftTransport *transport, gpointer buf,
 
   /* if we have enough buffer data to fulfill the read, just use
    * a memcpy from the buffer */
-  if (len <= t->r_buf->len)
+  if (len <= t->r_buf->len - t->r_buf_pos)
   {
-    memcpy (buf, t->r_buf->data, len);
-    g_byte_array_remove_range (t->r_buf, 0, len);
+    memcpy (buf, t->r_buf->data + t->r_buf_pos, len);
+    thrift_framed_transport_consume (transport, len);
     return len;
   }
 
@@ -237,6 +299,7 @@ thrift_framed_transport_init (ThriftFramedTransport *transport)
   transport->transport = NULL;
   transport->r_buf = g_byte_array_new ();
   transport->w_buf = g_byte_array_new ();
+  transport->r_buf_pos = 0;
 }
 
 /* destructor */
@@ -357,4 +420,6 @@ thrift_framed_transport_class_init (ThriftFramedTransportClass *cls)
   ttc->write = thrift_framed_transport_write;
   ttc->write_end = thrift_framed_transport_write_end;
   ttc->flush = thrift_framed_transport_flush;
+  ttc->borrow = thrift_framed_transport_borrow;
+  ttc->consume = thrift_framed_transport_consume;
 }
@@ -57,6 +57,7 @@ struct _ThriftFramedTransport
   GByteArray *w_buf;
   guint32 r_buf_size;
   guint32 w_buf_size;
+  guint32 r_buf_pos;
 };
 
 typedef struct _ThriftFramedTransportClass ThriftFramedTransportClass;
@@ -63,6 +63,36 @@ thrift_memory_buffer_close (ThriftTransport *transport, GError **error)
   return TRUE;
 }
 
+/* implements thrift_transport_borrow */
+const guint8 *
+thrift_memory_buffer_borrow (ThriftTransport *transport, guint32 *len)
+{
+  ThriftMemoryBuffer *t = THRIFT_MEMORY_BUFFER (transport);
+  guint32 have = t->buf->len - t->buf_pos;
+
+  if (have < *len)
+  {
+    return NULL;
+  }
+  *len = have;
+  return t->buf->data + t->buf_pos;
+}
+
+/* implements thrift_transport_consume */
+void
+thrift_memory_buffer_consume (ThriftTransport *transport, guint32 len)
+{
+  ThriftMemoryBuffer *t = THRIFT_MEMORY_BUFFER (transport);
+
+  /* advance instead of shifting the remaining bytes down on every read */
+  t->buf_pos += len;
+  if (t->buf_pos >= t->buf->len)
+  {
+    g_byte_array_set_size (t->buf, 0);
+    t->buf_pos = 0;
+  }
+}
+
 /* implements thrift_transport_read */
 gint32
 thrift_memory_buffer_read (ThriftTransport *transport, gpointer buf,
@@ -74,13 +104,13 @@ thrift_memory_buffer_read (ThriftTransport *transport, gpointer buf,
 
   /* if the requested bytes are more than what we have available,
    * just give all that we have the buffer */
-  if (t->buf->len < len)
+  if (t->buf->len - t->buf_pos < len)
   {
-    give = t->buf->len;
+    give = t->buf->len - t->buf_pos;
   }
 
-  memcpy (buf, t->buf->data, give);
-  g_byte_array_remove_range (t->buf, 0, give);
+  memcpy (buf, t->buf->data + t->buf_pos, give);
+  thrift_memory_buffer_consume (transport, give);
 
   return give;
 }
@@ -106,6 +136,13 @@ thrift_memory_buffer_write (ThriftTransport *transport,
 
   ThriftMemoryBuffer *t = THRIFT_MEMORY_BUFFER (transport);
 
+  /* reclaim the space already read before giving up on the write */
+  if (len > t->buf_size - t->buf->len && t->buf_pos > 0)
+  {
+    g_byte_array_remove_range (t->buf, 0, t->buf_pos);
+    t->buf_pos = 0;
+  }
+
   /* return an exception if the buffer doesn't have enough space. */
   if (len > t->buf_size - t->buf->len)
   {
@@ -145,6 +182,7 @@ static void
 thrift_memory_buffer_init (ThriftMemoryBuffer *transport)
 {
   transport->buf = g_byte_array_new ();
+  transport->buf_pos = 0;
 }
 
 /* destructor */
@@ -226,4 +264,6 @@ thrift_memory_buffer_class_init (ThriftMemoryBufferClass *cls)
   ttc->write = thrift_memory_buffer_write;
   ttc->write_end = thrift_memory_buffer_write_end;
   ttc->flush = thrift_memory_buffer_flush;
+  ttc->borrow = thrift_memory_buffer_borrow;
+  ttc->consume = thrift_memory_buffer_consume;
 }
@@ -79,6 +79,34 @@ thrift_transport_flush (ThriftTransport *transport, GError **error)
   return THRIFT_TRANSPORT_GET_CLASS (transport)->flush (transport, error);
 }
 
+const guint8 *
+thrift_transport_borrow (ThriftTransport *transport, guint32 *len)
+{
+  return THRIFT_TRANSPORT_GET_CLASS (transport)->borrow (transport, len);
+}
+
+void
+thrift_transport_consume (ThriftTransport *transport, guint32 len)
+{
+  THRIFT_TRANSPORT_GET_CLASS (transport)->consume (transport, len);
+}
+
+/* unbuffered transports have nothing to lend */
+static const guint8 *
+thrift_transport_real_borrow (ThriftTransport *transport, guint32 *len)
+{
+  THRIFT_UNUSED_VAR (transport);
+  THRIFT_UNUSED_VAR (len);
+  return NULL;
+}
+
+static void
+thrift_transport_real_consume (ThriftTransport *transport, guint32 len)
+{
+  THRIFT_UNUSED_VAR (transport);
+  THRIFT_UNUSED_VAR (len);
+}
+
 /* define the GError domain for Thrift transports */
 GQuark
 thrift_transport_error_quark (void)
@@ -99,6 +127,8 @@ thrift_transport_class_init (ThriftTransportClass *cls)
   cls->write = thrift_transport_write;
   cls->write_end = thrift_transport_write_end;
   cls->flush = thrift_transport_flush;
+  cls->borrow = thrift_transport_real_borrow;
+  cls->consume = thrift_transport_real_consume;
 }
 
 static void
@@ -72,6 +72,8 @@ struct _ThriftTransportClass
                    const guint32 len, GError **error);
   gboolean (*write_end) (ThriftTransport *transport, GError **error);
   gboolean (*flush) (ThriftTransport *transport, GError **error);
+  const guint8 *(*borrow) (ThriftTransport *transport, guint32 *len);
+  void (*consume) (ThriftTransport *transport, guint32 len);
 };
 
 /* used by THRIFT_TYPE_TRANSPORT */
@@ -131,6 +133,22 @@ gboolean thrift_transport_write_end (ThriftTransport *transport,
  */
 gboolean thrift_transport_flush (ThriftTransport *transport, GError **error);
 
+/*!
+ * Returns a pointer to at least *len bytes already buffered by the
+ * transport without copying them, and sets *len to how many are there.
+ * Returns NULL when fewer than *len bytes are available; callers then
+ * fall back to thrift_transport_read ().  Nothing is consumed.
+ * \public \memberof ThriftTransportInterface
+ */
+const guint8 *thrift_transport_borrow (ThriftTransport *transport,
+                                       guint32 *len);
+
+/*!
+ * Skips len bytes previously returned by thrift_transport_borrow ().
+ * \public \memberof ThriftTransportInterface
+ */
+void thrift_transport_consume (ThriftTransport *transport, guint32 len);
+
 /* define error/exception types */
 typedef enum
 {
@@ -0,0 +1,238 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include <thrift/c_glib/protocol/thrift_protocol.h>
+#include <thrift/c_glib/transport/thrift_memory_buffer.h>
+
+#include "../src/thrift/c_glib/protocol/thrift_compact_protocol.c"
+
+#define TEST_STRING "this is a test string 1234567890!@#$%^&*()"
+
+static ThriftProtocol *
+new_protocol (ThriftMemoryBuffer **tbuffer)
+{
+  *tbuffer = g_object_new (THRIFT_TYPE_MEMORY_BUFFER, "buf_size", 1024,
+                           NULL);
+  return g_object_new (THRIFT_TYPE_COMPACT_PROTOCOL, "transport",
+                       THRIFT_TRANSPORT (*tbuffer), NULL);
+}
+
+static void
+test_create_and_destroy (void)
+{
+  GObject *object = NULL;
+
+  object = g_object_new (THRIFT_TYPE_COMPACT_PROTOCOL, NULL);
+  assert (object != NULL);
+  g_object_unref (object);
+}
+
+static void
+test_varints (void)
+{
+  ThriftMemoryBuffer *tbuffer = NULL;
+  ThriftProtocol *protocol = new_protocol (&tbuffer);
+  /* zigzag(-1) = 1, zigzag(150) = 300 = 0xac 0x02 */
+  const guint8 expected[] = { 0x01, 0xac, 0x02, 0x01 };
+  gint16 v16 = 0;
+  gint32 v32 = 0;
+  gint64 v64 = 0;
+
+  assert (thrift_protocol_write_i32 (protocol, -1, NULL) == 1);
+  assert (thrift_protocol_write_i16 (protocol, 150, NULL) == 2);
+  assert (thrift_protocol_write_i64 (protocol, -1, NULL) == 1);
+  assert (tbuffer->buf->len == sizeof (expected));
+  assert (memcmp (tbuffer->buf->data, expected, sizeof (expected)) == 0);
+
+  assert (thrift_protocol_read_i32 (protocol, &v32, NULL) == 1);
+  assert (v32 == -1);
+  assert (thrift_protocol_read_i16 (protocol, &v16, NULL) == 2);
+  assert (v16 == 150);
+  assert (thrift_protocol_read_i64 (protocol, &v64, NULL) == 1);
+  assert (v64 == -1);
+
+  assert (thrift_protocol_write_i32 (protocol, G_MININT32, NULL) == 5);
+  assert (thrift_protocol_write_i64 (protocol, G_MAXINT64, NULL) == 10);
+  assert (thrift_protocol_read_i32 (protocol, &v32, NULL) == 5);
+  assert (v32 == G_MININT32);
+  assert (thrift_protocol_read_i64 (protocol, &v64, NULL) == 10);
+  assert (v64 == G_MAXINT64);
+
+  g_object_unref (protocol);
+  g_object_unref (tbuffer);
+}
+
+static void
+test_primitives (void)
+{
+  ThriftMemoryBuffer *tbuffer = NULL;
+  ThriftProtocol *protocol = new_protocol (&tbuffer);
+  gboolean b = FALSE;
+  gint8 byte = 0;
+  gdouble d = 0;
+  gchar *str = NULL;
+  gpointer binary = NULL;
+  guint32 len = 0;
+
+  assert (thrift_protocol_write_bool (protocol, TRUE, NULL) == 1);
+  assert (thrift_protocol_write_byte (protocol, -5, NULL) == 1);
+  assert (thrift_protocol_write_double (protocol, 1234567890.123, NULL) == 8);
+  assert (thrift_protocol_write_string (protocol, TEST_STRING, NULL) > 0);
+  assert (thrift_protocol_write_binary (protocol, NULL, 0, NULL) == 1);
+
+  assert (thrift_protocol_read_bool (protocol, &b, NULL) == 1);
+  assert (b == TRUE);
+  assert (thrift_protocol_read_byte (protocol, &byte, NULL) == 1);
+  assert (byte == -5);
+  assert (thrift_protocol_read_double (protocol, &d, NULL) == 8);
+  assert (d == 1234567890.123);
+  assert (thrift_protocol_read_string (protocol, &str, NULL) > 0);
+  assert (strcmp (str, TEST_STRING) == 0);
+  g_free (str);
+  assert (thrift_protocol_read_binary (protocol, &binary, &len, NULL) == 1);
+  assert (binary == NULL && len == 0);
+
+  g_object_unref (protocol);
+  g_object_unref (tbuffer);
+}
+
+static void
+test_struct (void)
+{
+  ThriftMemoryBuffer *tbuffer = NULL;
+  ThriftProtocol *protocol = new_protocol (&tbuffer);
+  ThriftType type, key_type, value_type;
+  gint16 id = 0;
+  gboolean b = FALSE;
+  gint32 v32 = 0;
+  guint32 size = 0;
+  gchar *name = NULL;
+
+  thrift_protocol_write_struct_begin (protocol, "outer", NULL);
+  /* a bool field is a single byte: delta 1, type true */
+  thrift_protocol_write_field_begin (protocol, "b", T_BOOL, 1, NULL);
+  assert (tbuffer->buf->len == 0);
+  assert (thrift_protocol_write_bool (protocol, TRUE, NULL) == 1);
+  assert (tbuffer->buf->data[0] == 0x11);
+  /* too far from the last id to be a delta */
+  thrift_protocol_write_field_begin (protocol, "i", T_I32, 100, NULL);
+  thrift_protocol_write_i32 (protocol, 7, NULL);
+  thrift_protocol_write_field_begin (protocol, "s", T_STRUCT, 101, NULL);
+  thrift_protocol_write_struct_begin (protocol, "inner", NULL);
+  thrift_protocol_write_field_begin (protocol, "f", T_BOOL, 2, NULL);
+  thrift_protocol_write_bool (protocol, FALSE, NULL);
+  thrift_protocol_write_field_stop (protocol, NULL);
+  thrift_protocol_write_struct_end (protocol, NULL);
+  thrift_protocol_write_field_begin (protocol, "m", T_MAP, 102, NULL);
+  assert (thrift_protocol_write_map_begin (protocol, T_STRING, T_I32, 0,
+                                           NULL) == 1);
+  thrift_protocol_write_field_begin (protocol, "l", T_LIST, 103, NULL);
+  assert (thrift_protocol_write_list_begin (protocol, T_BOOL, 20,
+                                            NULL) == 2);
+  thrift_protocol_write_field_stop (protocol, NULL);
+  thrift_protocol_write_struct_end (protocol, NULL);
+
+  thrift_protocol_read_struct_begin (protocol, &name, NULL);
+  thrift_protocol_read_field_begin (protocol, &name, &type, &id, NULL);
+  assert (type == T_BOOL && id == 1);
+  assert (thrift_protocol_read_bool (protocol, &b, NULL) == 0);
+  assert (b == TRUE);
+  thrift_protocol_read_field_begin (protocol, &name, &type, &id, NULL);
+  assert (type == T_I32 && id == 100);
+  thrift_protocol_read_i32 (protocol, &v32, NULL);
+  assert (v32 == 7);
+  thrift_protocol_read_field_begin (protocol, &name, &type, &id, NULL);
+  assert (type == T_STRUCT && id == 101);
+  thrift_protocol_read_struct_begin (protocol, &name, NULL);
+  thrift_protocol_read_field_begin (protocol, &name, &type, &id, NULL);
+  assert (type == T_BOOL && id == 2);
+  thrift_protocol_read_bool (protocol, &b, NULL);
+  assert (b == FALSE);
+  thrift_protocol_read_field_begin (protocol, &name, &type, &id, NULL);
+  assert (type == T_STOP);
+  thrift_protocol_read_struct_end (protocol, NULL);
+  /* deltas pick up from the outer struct again */
+  thrift_protocol_read_field_begin (protocol, &name, &type, &id, NULL);
+  assert (type == T_MAP && id == 102);
+  thrift_protocol_read_map_begin (protocol, &key_type, &value_type, &size,
+                                  NULL);
+  assert (size == 0);
+  thrift_protocol_read_field_begin (protocol, &name, &type, &id, NULL);
+  assert (type == T_LIST && id == 103);
+  thrift_protocol_read_list_begin (protocol, &type, &size, NULL);
+  assert (type == T_BOOL && size == 20);
+  thrift_protocol_read_field_begin (protocol, &name, &type, &id, NULL);
+  assert (type == T_STOP);
+  thrift_protocol_read_struct_end (protocol, NULL);
+
+  g_object_unref (protocol);
+  g_object_unref (tbuffer);
+}
+
+static void
+test_message (void)
+{
+  ThriftMemoryBuffer *tbuffer = NULL;
+  ThriftProtocol *protocol = new_protocol (&tbuffer);
+  ThriftMessageType message_type;
+  gint32 seqid = 0;
+  gchar *name = NULL;
+  GError *error = NULL;
+  guint8 bad = 0x80;
+
+  assert (thrift_protocol_write_message_begin (protocol, "ping", T_REPLY,
+                                               42, NULL) == 8);
+  assert (tbuffer->buf->data[0] == THRIFT_COMPACT_PROTOCOL_PROTOCOL_ID);
+  assert (tbuffer->buf->data[1] == 0x41);
+
+  assert (thrift_protocol_read_message_begin (protocol, &name, &message_type,
+                                              &seqid, NULL) == 8);
+  assert (strcmp (name, "ping") == 0);
+  assert (message_type == T_REPLY);
+  assert (seqid == 42);
+  g_free (name);
+
+  /* a binary protocol header is rejected */
+  thrift_transport_write (THRIFT_TRANSPORT (tbuffer), &bad, 1, NULL);
+  assert (thrift_protocol_read_message_begin (protocol, &name, &message_type,
+                                              &seqid, &error) == -1);
+  assert (error != NULL);
+  g_error_free (error);
+
+  g_object_unref (protocol);
+  g_object_unref (tbuffer);
+}
+
+int
+main(int argc, char *argv[])
+{
+  g_type_init();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/testcompactprotocol/CreateAndDestroy", test_create_and_destroy);
+  g_test_add_func ("/testcompactprotocol/Varints", test_varints);
+  g_test_add_func ("/testcompactprotocol/Primitives", test_primitives);
+  g_test_add_func ("/testcompactprotocol/Struct", test_struct);
+  g_test_add_func ("/testcompactprotocol/Message", test_message);
+
+  return g_test_run ();
+}
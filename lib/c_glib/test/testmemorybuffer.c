@@ -19,6 +19,7 @@
 
 #include <assert.h>
 #include <netdb.h>
+#include <string.h>
 
 #include <thrift/c_glib/transport/thrift_transport.h>
 #include <thrift/c_glib/transport/thrift_socket.h>
@@ -81,6 +82,42 @@ test_read_and_write(void)
   assert (error == NULL);
 }
 
+static void
+test_borrow_and_consume(void)
+{
+  ThriftMemoryBuffer *tbuffer = NULL;
+  ThriftTransport *transport = NULL;
+  guchar buf[10] = TEST_DATA;
+  guchar read[10];
+  const guint8 *borrowed = NULL;
+  guint32 len = 0;
+
+  tbuffer = g_object_new (THRIFT_TYPE_MEMORY_BUFFER, "buf_size", 15, NULL);
+  transport = THRIFT_TRANSPORT (tbuffer);
+  assert (thrift_memory_buffer_write (transport, (gpointer) buf,
+                                      10, NULL) == TRUE);
+
+  /* borrowing more than is buffered fails and leaves everything alone */
+  len = 11;
+  assert (thrift_transport_borrow (transport, &len) == NULL);
+
+  len = 4;
+  borrowed = thrift_transport_borrow (transport, &len);
+  assert (borrowed != NULL);
+  assert (len == 10);
+  assert (memcmp (borrowed, buf, 10) == 0);
+
+  thrift_transport_consume (transport, 4);
+  assert (thrift_memory_buffer_read (transport, &read, 6, NULL) == 6);
+  assert (memcmp (read, buf + 4, 6) == 0);
+
+  /* draining the buffer frees up its whole capacity again */
+  assert (thrift_memory_buffer_write (transport, (gpointer) buf,
+                                      10, NULL) == TRUE);
+  assert (thrift_memory_buffer_read (transport, &read, 10, NULL) == 10);
+  g_object_unref (tbuffer);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -90,6 +127,7 @@ main(int argc, char *argv[])
   g_test_add_func ("/testmemorybuffer/CreateAndDestroy", test_create_and_destroy);
   g_test_add_func ("/testmemorybuffer/OpenAndClose", test_open_and_close);
   g_test_add_func ("/testmemorybuffer/ReadAndWrite", test_read_and_write);
+  g_test_add_func ("/testmemorybuffer/BorrowAndConsume", test_borrow_and_consume);
 
   return g_test_run ();
 }
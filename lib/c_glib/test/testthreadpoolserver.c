@@ -0,0 +1,182 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <assert.h>
+#include <glib.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <thrift/c_glib/thrift.h>
+#include <thrift/c_glib/processor/thrift_processor.h>
+#include <thrift/c_glib/protocol/thrift_binary_protocol.h>
+#include <thrift/c_glib/transport/thrift_server_socket.h>
+#include <thrift/c_glib/transport/thrift_socket.h>
+
+#define TEST_PORT 51198
+
+#include <thrift/c_glib/server/thrift_thread_pool_server.c>
+
+/* a processor that answers every i32 with the next one */
+#define TEST_PROCESSOR_TYPE (test_processor_get_type ())
+
+struct _TestProcessor
+{
+  ThriftProcessor parent;
+};
+typedef struct _TestProcessor TestProcessor;
+
+struct _TestProcessorClass
+{
+  ThriftProcessorClass parent;
+};
+typedef struct _TestProcessorClass TestProcessorClass;
+
+G_DEFINE_TYPE(TestProcessor, test_processor, THRIFT_TYPE_PROCESSOR)
+
+gboolean
+test_processor_process (ThriftProcessor *processor, ThriftProtocol *in,
+                        ThriftProtocol *out)
+{
+  gint32 value = 0;
+  THRIFT_UNUSED_VAR (processor);
+
+  if (thrift_protocol_read_i32 (in, &value, NULL) < 0
+      || thrift_protocol_write_i32 (out, value + 1, NULL) < 0)
+  {
+    return FALSE;
+  }
+  return thrift_transport_flush (out->transport, NULL);
+}
+
+static void
+test_processor_init (TestProcessor *p)
+{
+  THRIFT_UNUSED_VAR (p);
+}
+
+static void
+test_processor_class_init (TestProcessorClass *proc)
+{
+  (THRIFT_PROCESSOR_CLASS(proc))->process = test_processor_process;
+}
+
+static ThriftProtocol *
+test_client_open (void)
+{
+  ThriftSocket *tsocket = NULL;
+  ThriftTransport *transport = NULL;
+
+  tsocket = g_object_new (THRIFT_TYPE_SOCKET, "hostname", "localhost",
+                          "port", TEST_PORT, NULL);
+  transport = THRIFT_TRANSPORT (tsocket);
+  assert (thrift_transport_open (transport, NULL) == TRUE);
+
+  return g_object_new (THRIFT_TYPE_BINARY_PROTOCOL, "transport", transport,
+                       NULL);
+}
+
+static void
+test_client_close (ThriftProtocol *protocol)
+{
+  ThriftTransport *transport = protocol->transport;
+
+  thrift_transport_close (transport, NULL);
+  g_object_unref (protocol);
+  g_object_unref (transport);
+}
+
+static void
+test_client_send (ThriftProtocol *protocol, gint32 value)
+{
+  assert (thrift_protocol_write_i32 (protocol, value, NULL) > 0);
+  assert (thrift_transport_flush (protocol->transport, NULL) == TRUE);
+}
+
+static void
+test_client_recv (ThriftProtocol *protocol, gint32 expected)
+{
+  gint32 value = 0;
+
+  assert (thrift_protocol_read_i32 (protocol, &value, NULL) > 0);
+  assert (value == expected);
+}
+
+static void
+test_server (void)
+{
+  int status;
+  pid_t pid;
+  TestProcessor *p = NULL;
+  ThriftServerSocket *tss = NULL;
+  ThriftThreadPoolServer *server = NULL;
+  ThriftProtocol *first = NULL, *second = NULL;
+
+  p = g_object_new (TEST_PROCESSOR_TYPE, NULL);
+  tss = g_object_new (THRIFT_TYPE_SERVER_SOCKET, "port", TEST_PORT, NULL);
+  server = g_object_new (THRIFT_TYPE_THREAD_POOL_SERVER, "processor", p,
+                         "server_transport", THRIFT_SERVER_TRANSPORT (tss),
+                         "num_threads", 2, NULL);
+
+  /* run the server in a child process */
+  pid = fork ();
+  assert (pid >= 0);
+
+  if (pid == 0)
+  {
+    THRIFT_SERVER_GET_CLASS (THRIFT_SERVER (server))
+        ->serve (THRIFT_SERVER (server));
+    exit (0);
+  } else {
+    sleep (1);
+
+    /* both clients stay connected while the other is served */
+    first = test_client_open ();
+    second = test_client_open ();
+    test_client_send (first, 1);
+    test_client_send (second, 10);
+    test_client_recv (second, 11);
+    test_client_recv (first, 2);
+    test_client_send (first, 41);
+    test_client_recv (first, 42);
+    test_client_close (first);
+    test_client_close (second);
+
+    kill (pid, SIGINT);
+
+    g_object_unref (server);
+    g_object_unref (tss);
+    g_object_unref (p);
+    assert (wait (&status) == pid);
+    assert (status == SIGINT);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  g_type_init();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/testthreadpoolserver/Server", test_server);
+
+  return g_test_run ();
+}
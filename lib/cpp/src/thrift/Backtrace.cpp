@@ -0,0 +1,116 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/Backtrace.h>
+
+#include <stdlib.h>
+
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
+
+namespace apache { namespace thrift {
+
+// Define the constructors non-inline, so they consistently add a single
+// frame to the stack trace, regardless of whether optimization is enabled
+Backtrace::Backtrace(int skip)
+  : skip_(skip + 1) // ignore the constructor itself
+{
+#ifdef __GLIBC__
+  numCallers_ = backtrace(callers_, MAX_STACK_DEPTH);
+#else
+  numCallers_ = 0;
+#endif
+  if (skip_ > numCallers_) {
+    skip_ = numCallers_;
+  }
+}
+
+Backtrace::Backtrace(Backtrace const &bt)
+  : numCallers_(bt.numCallers_)
+  , skip_(bt.skip_) {
+  if (numCallers_ >= 0) {
+    memcpy(callers_, bt.callers_, numCallers_ * sizeof(void*));
+  }
+}
+
+void Backtrace::print(FILE *f, int indent, int start) const {
+#ifdef __GLIBC__
+  char **strings = backtrace_symbols(callers_, numCallers_);
+#else
+  char **strings = NULL;
+#endif
+  if (strings) {
+    start += skip_;
+    if (start < 0) {
+      start = 0;
+    }
+    for (int n = start; n < numCallers_; ++n) {
+      fprintf(f, "%*s#%-2d %s\n", indent, "", n, strings[n]);
+    }
+    free(strings);
+  } else {
+    fprintf(f, "%*s<failed to determine symbols>\n", indent, "");
+  }
+}
+
+void profile_write_pprof_samples(
+    FILE* f,
+    std::vector<std::pair<const Backtrace*, uintptr_t> > const& samples,
+    uintptr_t samplingPeriod) {
+  // Write the header
+  uintptr_t header[5] = { 0, 3, 0, samplingPeriod, 0 };
+  fwrite(&header, sizeof(header), 1, f);
+
+  // Write the profile records
+  for (size_t i = 0; i < samples.size(); ++i) {
+    uintptr_t count = samples[i].second;
+    fwrite(&count, sizeof(count), 1, f);
+
+    Backtrace const* bt = samples[i].first;
+    uintptr_t num_pcs = bt->getDepth();
+    fwrite(&num_pcs, sizeof(num_pcs), 1, f);
+
+    for (uintptr_t n = 0; n < num_pcs; ++n) {
+      void* pc = bt->getFrame(n);
+      fwrite(&pc, sizeof(pc), 1, f);
+    }
+  }
+
+  // Write the trailer
+  uintptr_t trailer[3] = { 0, 1, 0 };
+  fwrite(&trailer, sizeof(trailer), 1, f);
+
+  // Write /proc/self/maps
+  // TODO(simpkins): This only works on linux
+  FILE *proc_maps = fopen("/proc/self/maps", "r");
+  if (proc_maps) {
+    uint8_t buf[4096];
+    while (true) {
+      size_t bytes_read = fread(buf, 1, sizeof(buf), proc_maps);
+      if (bytes_read == 0) {
+        break;
+      }
+      fwrite(buf, 1, bytes_read, f);
+    }
+    fclose(proc_maps);
+  }
+}
+
+}} // apache::thrift
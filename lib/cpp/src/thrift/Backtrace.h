@@ -0,0 +1,120 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_BACKTRACE_H_
+#define _THRIFT_BACKTRACE_H_ 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+namespace apache { namespace thrift {
+
+/**
+ * A stack trace, as used by the profiling code.
+ *
+ * Stacks are captured with backtrace() and so are only available with
+ * glibc; elsewhere every Backtrace is empty.
+ */
+class Backtrace {
+ public:
+  static const int MAX_STACK_DEPTH = 15;
+
+  Backtrace(int skip = 0);
+  Backtrace(Backtrace const &bt);
+
+  void operator=(Backtrace const &bt) {
+    numCallers_ = bt.numCallers_;
+    skip_ = bt.skip_;
+    if (numCallers_ >= 0) {
+      memcpy(callers_, bt.callers_, numCallers_ * sizeof(void*));
+    }
+  }
+
+  bool operator==(Backtrace const &bt) const {
+    return (cmp(bt) == 0);
+  }
+
+  bool operator<(Backtrace const &bt) const {
+    return (cmp(bt) < 0);
+  }
+
+  size_t hash() const {
+    intptr_t ret = 0;
+    for (int n = 0; n < numCallers_; ++n) {
+      ret ^= reinterpret_cast<intptr_t>(callers_[n]);
+    }
+    return static_cast<size_t>(ret);
+  }
+
+  int cmp(Backtrace const& bt) const {
+    int depth_diff = (numCallers_ - bt.numCallers_);
+    if (depth_diff != 0) {
+      return depth_diff;
+    }
+
+    for (int n = 0; n < numCallers_; ++n) {
+      uintptr_t a = reinterpret_cast<uintptr_t>(callers_[n]);
+      uintptr_t b = reinterpret_cast<uintptr_t>(bt.callers_[n]);
+      if (a != b) {
+        return a < b ? -1 : 1;
+      }
+    }
+
+    return 0;
+  }
+
+  void print(FILE *f, int indent=0, int start=0) const;
+
+  int getDepth() const {
+    return numCallers_ - skip_;
+  }
+
+  void *getFrame(int index) const {
+    int adjusted_index = index + skip_;
+    if (adjusted_index < 0 || adjusted_index >= numCallers_) {
+      return NULL;
+    }
+    return callers_[adjusted_index];
+  }
+
+ private:
+  void *callers_[MAX_STACK_DEPTH];
+  int numCallers_;
+  int skip_;
+};
+
+/**
+ * Writes stack traces and their counts as Google CPU profiler binary data,
+ * followed by the process's memory map, so they can be analyzed with pprof.
+ *
+ * See http://code.google.com/p/google-perftools/ for more details.
+ *
+ * @param samplingPeriod The period, in microseconds, recorded in the header
+ */
+void profile_write_pprof_samples(
+    FILE* f,
+    std::vector<std::pair<const Backtrace*, uintptr_t> > const& samples,
+    uintptr_t samplingPeriod = 0);
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_BACKTRACE_H_
@@ -0,0 +1,99 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/TAllocTracking.h>
+#include <thrift/concurrency/Atomic.h>
+
+#if defined(_MSC_VER)
+# define THRIFT_THREAD_LOCAL __declspec(thread)
+#else
+# define THRIFT_THREAD_LOCAL __thread
+#endif
+
+namespace apache { namespace thrift {
+
+namespace {
+
+THRIFT_THREAD_LOCAL int currentCategory = TAllocTracking::OTHER;
+
+// record() runs inside malloc, so it must not allocate, nor take a lock
+// that something allocating might hold: the counts are only added to
+uint64_t allocations[TAllocTracking::NUM_CATEGORIES];
+uint64_t bytes[TAllocTracking::NUM_CATEGORIES];
+bool recorded = false;
+
+const char* const names[TAllocTracking::NUM_CATEGORIES] = {
+  "other", "transport", "protocol", "struct", "task"
+};
+
+}
+
+uint64_t TAllocTracking::Counts::totalAllocations() const {
+  uint64_t total = 0;
+  for (int i = 0; i < NUM_CATEGORIES; ++i) {
+    total += allocations[i];
+  }
+  return total;
+}
+
+uint64_t TAllocTracking::Counts::totalBytes() const {
+  uint64_t total = 0;
+  for (int i = 0; i < NUM_CATEGORIES; ++i) {
+    total += bytes[i];
+  }
+  return total;
+}
+
+TAllocTracking::Category TAllocTracking::current() {
+  return static_cast<Category>(currentCategory);
+}
+
+TAllocTracking::Category TAllocTracking::exchange(Category category) {
+  Category old = static_cast<Category>(currentCategory);
+  currentCategory = category;
+  return old;
+}
+
+void TAllocTracking::record(size_t size) {
+  int category = currentCategory;
+  concurrency::atomicAdd(&allocations[category], 1);
+  concurrency::atomicAdd(&bytes[category], size);
+  if (!recorded) {
+    recorded = true;
+  }
+}
+
+bool TAllocTracking::active() {
+  return recorded;
+}
+
+void TAllocTracking::getCounts(Counts& counts) {
+  for (int i = 0; i < NUM_CATEGORIES; ++i) {
+    counts.allocations[i] = concurrency::atomicLoad<concurrency::ATOMIC_RELAXED>(&allocations[i]);
+    counts.bytes[i] = concurrency::atomicLoad<concurrency::ATOMIC_RELAXED>(&bytes[i]);
+  }
+}
+
+const char* TAllocTracking::name(Category category) {
+  return category >= 0 && category < NUM_CATEGORIES ? names[category] : "unknown";
+}
+
+}} // apache::thrift
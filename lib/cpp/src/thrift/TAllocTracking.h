@@ -0,0 +1,101 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TALLOCTRACKING_H_
+#define _THRIFT_TALLOCTRACKING_H_ 1
+
+#include <thrift/Thrift.h>
+
+#include <boost/noncopyable.hpp>
+
+namespace apache { namespace thrift {
+
+/**
+ * Counts heap allocations by the part of the library that makes them, for
+ * benchmarks and stress tests.
+ *
+ * The library marks where it allocates transport buffers, protocol string
+ * buffers and ThreadManager tasks with a TAllocScope, which notes on the
+ * thread what is allocating; a caller can mark its own code the same way,
+ * as a benchmark does around reading a struct so that its members are
+ * counted as STRUCT.  The innermost scope wins.
+ *
+ * Nothing is counted until an allocator hook calls record() for every
+ * allocation.  lib/cpp/test/AllocInterposer.cpp is one: linked into a
+ * program, it replaces malloc, calloc and realloc on glibc.  Without it
+ * a scope costs a thread-local store, and only where the library grows a
+ * buffer or makes a task.
+ */
+class TAllocTracking {
+ public:
+  enum Category {
+    OTHER,
+    TRANSPORT,
+    PROTOCOL,
+    STRUCT,
+    TASK,
+    NUM_CATEGORIES
+  };
+
+  /// Allocations and bytes asked for in each category, since the start
+  struct Counts {
+    uint64_t allocations[NUM_CATEGORIES];
+    uint64_t bytes[NUM_CATEGORIES];
+
+    uint64_t totalAllocations() const;
+    uint64_t totalBytes() const;
+  };
+
+  /// What the calling thread is allocating for
+  static Category current();
+
+  /// Sets what the calling thread is allocating for, and returns what it was
+  static Category exchange(Category category);
+
+  /// Counts an allocation of size bytes, for the calling thread's category
+  static void record(size_t size);
+
+  /// Whether anything has called record(), that is, whether counts are kept
+  static bool active();
+
+  static void getCounts(Counts& counts);
+
+  /// "other", "transport", "protocol", "struct" or "task"
+  static const char* name(Category category);
+};
+
+/**
+ * Makes category the calling thread's while it lasts.
+ */
+class TAllocScope : boost::noncopyable {
+ public:
+  explicit TAllocScope(TAllocTracking::Category category)
+    : saved_(TAllocTracking::exchange(category)) {}
+
+  ~TAllocScope() {
+    TAllocTracking::exchange(saved_);
+  }
+
+ private:
+  TAllocTracking::Category saved_;
+};
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TALLOCTRACKING_H_
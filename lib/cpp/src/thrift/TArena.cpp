@@ -0,0 +1,121 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/TArena.h>
+
+#if defined(_MSC_VER)
+# define THRIFT_THREAD_LOCAL __declspec(thread)
+#else
+# define THRIFT_THREAD_LOCAL __thread
+#endif
+
+namespace apache { namespace thrift {
+
+namespace {
+
+THRIFT_THREAD_LOCAL TArena* currentArena = NULL;
+
+// Where a block's memory starts, past its header
+const size_t BLOCK_HEADER_SIZE = (sizeof(void*) + sizeof(size_t) + TArena::ALIGNMENT - 1)
+                                 & ~(TArena::ALIGNMENT - 1);
+
+}
+
+const size_t TArena::DEFAULT_BLOCK_SIZE;
+const size_t TArena::ALIGNMENT;
+
+TArena::TArena(size_t blockSize)
+  : blockSize_(blockSize < 1024 ? 1024 : blockSize),
+    blocks_(NULL),
+    large_(NULL),
+    pos_(NULL),
+    end_(NULL),
+    used_(0),
+    reserved_(0) {
+}
+
+TArena::~TArena() {
+  freeBlocks(blocks_);
+  freeBlocks(large_);
+}
+
+void TArena::release() {
+  freeBlocks(large_);
+  large_ = NULL;
+  used_ = 0;
+  reserved_ = 0;
+  if (blocks_ == NULL) {
+    return;
+  }
+  // Keep the oldest block, at the end of the list
+  Block* first = blocks_;
+  while (first->next != NULL) {
+    Block* next = first->next;
+    ::operator delete(first);
+    first = next;
+  }
+  blocks_ = first;
+  pos_ = reinterpret_cast<char*>(first) + BLOCK_HEADER_SIZE;
+  end_ = pos_ + first->size;
+  reserved_ = first->size;
+}
+
+void* TArena::allocateSlow(size_t size) {
+  if (size > blockSize_ / 4) {
+    Block* block = newBlock(size);
+    block->next = large_;
+    large_ = block;
+    used_ += size;
+    reserved_ += size;
+    return reinterpret_cast<char*>(block) + BLOCK_HEADER_SIZE;
+  }
+
+  Block* block = newBlock(blockSize_);
+  block->next = blocks_;
+  blocks_ = block;
+  reserved_ += blockSize_;
+  pos_ = reinterpret_cast<char*>(block) + BLOCK_HEADER_SIZE;
+  end_ = pos_ + blockSize_;
+  return allocate(size);
+}
+
+TArena::Block* TArena::newBlock(size_t size) {
+  Block* block = static_cast<Block*>(::operator new(BLOCK_HEADER_SIZE + size));
+  block->next = NULL;
+  block->size = size;
+  return block;
+}
+
+void TArena::freeBlocks(Block* block) {
+  while (block != NULL) {
+    Block* next = block->next;
+    ::operator delete(block);
+    block = next;
+  }
+}
+
+TArena* TArena::current() {
+  return currentArena;
+}
+
+void TArena::setCurrent(TArena* arena) {
+  currentArena = arena;
+}
+
+}} // apache::thrift
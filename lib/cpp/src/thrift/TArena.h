@@ -0,0 +1,235 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TARENA_H_
+#define _THRIFT_TARENA_H_ 1
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <boost/noncopyable.hpp>
+
+#if __cplusplus >= 201103L
+#include <type_traits>
+#include <utility>
+#endif
+
+namespace apache { namespace thrift {
+
+/**
+ * A monotonic allocator: memory is carved off the end of large blocks and
+ * never given back one piece at a time, only all at once by release() or
+ * the destructor.
+ *
+ * Code generated with the arena option allocates its containers through a
+ * TArenaAllocator, which uses the arena current on the thread when the
+ * container is made.  Deserializing inside a TArenaScope therefore puts
+ * the whole request in the arena, and it is freed in one go afterwards:
+ *
+ *   TArena arena;
+ *   {
+ *     TArenaScope scope(arena);
+ *     Request request;
+ *     request.read(iprot);
+ *     ...
+ *   }
+ *   arena.release();
+ *
+ * Everything allocated in the arena must be destroyed before it is
+ * released.  An arena is not thread safe; use one per thread.
+ */
+class TArena : boost::noncopyable {
+ public:
+  static const size_t DEFAULT_BLOCK_SIZE = 16384;
+
+  /// Every allocation is aligned at least this well
+  static const size_t ALIGNMENT = 16;
+
+  explicit TArena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+  ~TArena();
+
+  /**
+   * Returns size bytes, aligned to ALIGNMENT.  Requests bigger than a
+   * quarter of the block size get a block of their own.
+   */
+  void* allocate(size_t size) {
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size <= static_cast<size_t>(end_ - pos_)) {
+      void* result = pos_;
+      pos_ += size;
+      used_ += size;
+      return result;
+    }
+    return allocateSlow(size);
+  }
+
+  /**
+   * Frees everything allocated so far.  The oldest block is kept for reuse,
+   * so an arena used for one request after another settles down to not
+   * touching the heap at all.
+   */
+  void release();
+
+  /// Bytes handed out since the last release()
+  size_t getBytesUsed() const { return used_; }
+
+  /// Bytes held in blocks, used or not
+  size_t getBytesReserved() const { return reserved_; }
+
+  /// The arena of the innermost TArenaScope on this thread, or NULL
+  static TArena* current();
+
+ private:
+  friend class TArenaScope;
+
+  struct Block {
+    Block* next;
+    size_t size;
+  };
+
+  void* allocateSlow(size_t size);
+  static Block* newBlock(size_t size);
+  static void freeBlocks(Block* block);
+  static void setCurrent(TArena* arena);
+
+  size_t blockSize_;
+
+  // Newest first; the current one is at the head
+  Block* blocks_;
+
+  // Requests too big to share a block
+  Block* large_;
+
+  char* pos_;
+  char* end_;
+  size_t used_;
+  size_t reserved_;
+};
+
+/**
+ * Makes arena the current one on this thread for the life of the scope,
+ * restoring whichever was current before.  Scopes nest.
+ */
+class TArenaScope : boost::noncopyable {
+ public:
+  explicit TArenaScope(TArena& arena) : previous_(TArena::current()) {
+    TArena::setCurrent(&arena);
+  }
+
+  ~TArenaScope() { TArena::setCurrent(previous_); }
+
+ private:
+  TArena* previous_;
+};
+
+/**
+ * A standard allocator drawing from a TArena, or from the heap when it has
+ * none.  A default constructed allocator, which is what a container gets
+ * unless it is given one, picks up TArena::current().
+ *
+ * Containers keep their own allocator when assigned to, and from C++11 on
+ * a copy takes the current arena rather than the original's, so a struct
+ * assigned to outside a request's scope does not point into its arena.
+ */
+template <typename T>
+class TArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+#if __cplusplus >= 201103L
+  typedef std::false_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+#endif
+
+  template <typename U>
+  struct rebind {
+    typedef TArenaAllocator<U> other;
+  };
+
+  TArenaAllocator() : arena_(TArena::current()) {}
+
+  explicit TArenaAllocator(TArena* arena) : arena_(arena) {}
+
+  template <typename U>
+  TArenaAllocator(const TArenaAllocator<U>& that) : arena_(that.arena()) {}
+
+  TArena* arena() const { return arena_; }
+
+  pointer allocate(size_type n, const void* = 0) {
+    if (n > max_size()) {
+      throw std::bad_alloc();
+    }
+    if (arena_ != NULL) {
+      return static_cast<pointer>(arena_->allocate(n * sizeof(T)));
+    }
+    return static_cast<pointer>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(pointer p, size_type) {
+    if (arena_ == NULL) {
+      ::operator delete(p);
+    }
+  }
+
+  size_type max_size() const { return (std::numeric_limits<size_type>::max)() / sizeof(T); }
+
+  pointer address(reference x) const { return &x; }
+  const_pointer address(const_reference x) const { return &x; }
+
+  void construct(pointer p, const T& value) { new (static_cast<void*>(p)) T(value); }
+  void destroy(pointer p) { p->~T(); }
+
+#if __cplusplus >= 201103L
+  template <typename U, typename... Args>
+  void construct(U* p, Args&&... args) {
+    new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  void destroy(U* p) { p->~U(); }
+#endif
+
+  TArenaAllocator select_on_container_copy_construction() const {
+    return TArenaAllocator();
+  }
+
+ private:
+  TArena* arena_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const TArenaAllocator<T>& a, const TArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const TArenaAllocator<T>& a, const TArenaAllocator<U>& b) {
+  return a.arena() != b.arena();
+}
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TARENA_H_
@@ -0,0 +1,122 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/TAsyncOutput.h>
+#include <thrift/concurrency/FunctionRunner.h>
+
+#include <cstring>
+
+using apache::thrift::concurrency::FunctionRunner;
+using apache::thrift::concurrency::Synchronized;
+
+namespace apache { namespace thrift {
+
+const size_t TAsyncOutput::DEFAULT_CAPACITY;
+const size_t TAsyncOutput::MAX_MESSAGE;
+
+TAsyncOutput::TAsyncOutput(size_t capacity, void (*sink)(const char*))
+  : sink_(sink),
+    ring_((capacity > 0 ? capacity : 1) * MAX_MESSAGE),
+    capacity_(capacity > 0 ? capacity : 1),
+    head_(0),
+    size_(0),
+    writing_(false),
+    unreported_(0),
+    dropped_(0),
+    stopping_(false) {
+  threadFactory_.setDetached(false);
+  drainer_ = threadFactory_.newThread(FunctionRunner::create(
+    apache::thrift::stdcxx::bind(&TAsyncOutput::drain, this)));
+  drainer_->start();
+}
+
+TAsyncOutput::~TAsyncOutput() {
+  {
+    Synchronized s(monitor_);
+    stopping_ = true;
+    monitor_.notifyAll();
+  }
+  drainer_->join();
+}
+
+void TAsyncOutput::output(TOutputLevel level, const char* message) {
+  (void)level;
+  Synchronized s(monitor_);
+  if (size_ == capacity_) {
+    ++unreported_;
+    ++dropped_;
+    return;
+  }
+  char* slot = &ring_[((head_ + size_) % capacity_) * MAX_MESSAGE];
+  std::strncpy(slot, message, MAX_MESSAGE - 1);
+  slot[MAX_MESSAGE - 1] = '\0';
+  if (size_++ == 0) {
+    monitor_.notifyAll();
+  }
+}
+
+void TAsyncOutput::flush() {
+  Synchronized s(monitor_);
+  while (size_ > 0 || writing_) {
+    monitor_.wait();
+  }
+}
+
+uint64_t TAsyncOutput::getNumDropped() const {
+  Synchronized s(monitor_);
+  return dropped_;
+}
+
+void TAsyncOutput::drain() {
+  char message[MAX_MESSAGE];
+  Synchronized s(monitor_);
+  for (;;) {
+    if (size_ == 0) {
+      if (stopping_) {
+        return;
+      }
+      monitor_.wait();
+      continue;
+    }
+    std::memcpy(message, &ring_[head_ * MAX_MESSAGE], MAX_MESSAGE);
+    head_ = (head_ + 1) % capacity_;
+    --size_;
+    uint64_t dropped = unreported_;
+    unreported_ = 0;
+    writing_ = true;
+
+    // The sink is called without the lock, so loggers never wait on it
+    monitor_.unlock();
+    sink_(message);
+    if (dropped > 0) {
+      char notice[64];
+      snprintf(notice, sizeof(notice), "TAsyncOutput: %llu messages dropped",
+               static_cast<unsigned long long>(dropped));
+      sink_(notice);
+    }
+    monitor_.lock();
+
+    writing_ = false;
+    if (size_ == 0) {
+      monitor_.notifyAll();
+    }
+  }
+}
+
+}} // apache::thrift
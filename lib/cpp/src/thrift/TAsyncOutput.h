@@ -0,0 +1,95 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TASYNCOUTPUT_H_
+#define _THRIFT_TASYNCOUTPUT_H_ 1
+
+#include <thrift/Thrift.h>
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+
+namespace apache { namespace thrift {
+
+/**
+ * A TOutputBackend that takes messages off the calling thread.
+ *
+ * output() copies a message into a ring of capacity slots and returns; a
+ * thread of the backend's own hands them, in order, to sink, such as
+ * TOutput::errorTimeWrapper, which writes them to stderr.  A thread that
+ * logs so never waits on the sink, only briefly on the ring.  When the
+ * ring is full, messages are dropped and counted, and the sink told how
+ * many once there is room.  Messages longer than MAX_MESSAGE bytes are cut
+ * short.
+ *
+ *   TAsyncOutput async;
+ *   GlobalOutput.setBackend(&async);
+ *
+ * Destroying the backend writes out what is in the ring; take it out of
+ * any TOutput first.
+ */
+class TAsyncOutput : public TOutputBackend, boost::noncopyable {
+ public:
+  static const size_t DEFAULT_CAPACITY = 4096;
+  static const size_t MAX_MESSAGE = 512;
+
+  TAsyncOutput(size_t capacity = DEFAULT_CAPACITY,
+               void (*sink)(const char*) = &TOutput::errorTimeWrapper);
+
+  ~TAsyncOutput();
+
+  void output(TOutputLevel level, const char* message);
+
+  /// Waits for the messages in the ring to be written
+  void flush();
+
+  /// Messages dropped for want of room
+  uint64_t getNumDropped() const;
+
+ private:
+  /// Hand messages to the sink, until stopped with the ring empty
+  void drain();
+
+  void (*sink_)(const char*);
+
+  /// Guards what follows; notified as the ring stops being empty, as it
+  /// empties, and on stopping
+  apache::thrift::concurrency::Monitor monitor_;
+  /// capacity slots of MAX_MESSAGE bytes, each a NUL terminated message
+  std::vector<char> ring_;
+  size_t capacity_;
+  size_t head_;
+  size_t size_;
+  /// Whether the drain thread is in the sink
+  bool writing_;
+  /// Dropped since the sink was last told
+  uint64_t unreported_;
+  uint64_t dropped_;
+  bool stopping_;
+
+  apache::thrift::concurrency::PlatformThreadFactory threadFactory_;
+  boost::shared_ptr<apache::thrift::concurrency::Thread> drainer_;
+};
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TASYNCOUTPUT_H_
@@ -0,0 +1,165 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TCACHED_H_
+#define _THRIFT_TCACHED_H_ 1
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+namespace apache { namespace thrift {
+
+/**
+ * An immutable struct that remembers how it was serialized.
+ *
+ * A typedef of a struct annotated cpp.cached, as in
+ *
+ *   typedef CatalogEntry CachedCatalogEntry (cpp.cached = "")
+ *
+ * is generated as one of these, so a service returning it, or a struct
+ * holding it, writes it through TCached::write().  The first time the
+ * value is written to a protocol with raw value support (binary and
+ * compact) its bytes are kept, and every later write to that kind of
+ * protocol copies them straight to the transport without walking the
+ * fields.  Copies share the value and its bytes, so a handler can keep a
+ * table of them and hand the same one back call after call:
+ *
+ *   void getEntry(CachedCatalogEntry& _return, const std::string& id) {
+ *     _return = entries_[id];
+ *   }
+ *
+ * The value cannot be changed in place, which is what keeps the bytes
+ * right; assigning a new value starts a new cache.  Encoding is safe from
+ * any number of threads at once.
+ */
+template <typename T>
+class TCached {
+ public:
+  TCached() : holder_(new Holder(boost::shared_ptr<const T>(new T()))) {}
+
+  TCached(const T& value) : holder_(new Holder(boost::shared_ptr<const T>(new T(value)))) {}
+
+  explicit TCached(const boost::shared_ptr<const T>& value) : holder_(new Holder(value)) {}
+
+  TCached& operator=(const T& value) {
+    holder_.reset(new Holder(boost::shared_ptr<const T>(new T(value))));
+    return *this;
+  }
+
+  const T& get() const { return *holder_->value; }
+
+  operator const T&() const { return get(); }
+
+  boost::shared_ptr<const T> getShared() const { return holder_->value; }
+
+  /// Whether the bytes for format have been kept yet
+  bool isEncoded(protocol::TRawFormat format) const {
+    concurrency::Guard g(holder_->mutex);
+    return holder_->raw[format].get() != NULL;
+  }
+
+  template <class Protocol_>
+  uint32_t read(Protocol_* iprot) {
+    boost::shared_ptr<T> value(new T());
+    uint32_t rsize = value->read(iprot);
+    holder_.reset(new Holder(value));
+    return rsize;
+  }
+
+  template <class Protocol_>
+  uint32_t write(Protocol_* oprot) const {
+    protocol::TRawFormat format = oprot->getRawFormat();
+    if (format == protocol::T_RAW_NONE) {
+      return get().write(oprot);
+    }
+    return oprot->writeRaw(*encoded(format));
+  }
+
+  template <class Reader_>
+  uint32_t readPacked(Reader_& reader) {
+    boost::shared_ptr<T> value(new T());
+    uint32_t rsize = value->readPacked(reader);
+    holder_.reset(new Holder(value));
+    return rsize;
+  }
+
+  template <class Writer_>
+  uint32_t writePacked(Writer_& writer) const {
+    return get().writePacked(writer);
+  }
+
+  bool operator==(const TCached& that) const { return get() == that.get(); }
+  bool operator!=(const TCached& that) const { return !(*this == that); }
+  bool operator<(const TCached& that) const { return get() < that.get(); }
+
+  void swap(TCached& that) { holder_.swap(that.holder_); }
+
+ private:
+  struct Holder {
+    explicit Holder(const boost::shared_ptr<const T>& v) : value(v) {}
+
+    boost::shared_ptr<const T> value;
+
+    // The encoding in each raw format, once it has been made
+    concurrency::Mutex mutex;
+    boost::shared_ptr<const std::string> raw[protocol::T_RAW_COMPACT + 1];
+  };
+
+  // The bytes for format, made outside the lock the first time; if two
+  // threads race, both encode and the first to finish is kept
+  boost::shared_ptr<const std::string> encoded(protocol::TRawFormat format) const {
+    {
+      concurrency::Guard g(holder_->mutex);
+      if (holder_->raw[format]) {
+        return holder_->raw[format];
+      }
+    }
+
+    boost::shared_ptr<transport::TMemoryBuffer> buf(new transport::TMemoryBuffer());
+    if (format == protocol::T_RAW_BINARY) {
+      protocol::TBinaryProtocolT<transport::TMemoryBuffer> prot(buf);
+      get().write(&prot);
+    } else {
+      protocol::TCompactProtocolT<transport::TMemoryBuffer> prot(buf);
+      get().write(&prot);
+    }
+    boost::shared_ptr<const std::string> raw(new std::string(buf->getBufferAsString()));
+
+    concurrency::Guard g(holder_->mutex);
+    if (!holder_->raw[format]) {
+      holder_->raw[format] = raw;
+    }
+    return holder_->raw[format];
+  }
+
+  boost::shared_ptr<Holder> holder_;
+};
+
+template <typename T>
+inline void swap(TCached<T>& a, TCached<T>& b) {
+  a.swap(b);
+}
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TCACHED_H_
@@ -0,0 +1,80 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/TDeadline.h>
+#include <thrift/concurrency/Util.h>
+
+#if defined(_MSC_VER)
+# define THRIFT_THREAD_LOCAL __declspec(thread)
+#else
+# define THRIFT_THREAD_LOCAL __thread
+#endif
+
+namespace apache { namespace thrift {
+
+namespace {
+
+THRIFT_THREAD_LOCAL int64_t currentDeadline = 0;
+
+}
+
+const uint8_t TDeadline::PREFIX_MAGIC;
+const uint8_t TDeadline::PREFIX_VERSION;
+const uint32_t TDeadline::PREFIX_SIZE;
+
+int64_t TDeadline::current() {
+  return currentDeadline;
+}
+
+int64_t TDeadline::remaining() {
+  int64_t deadline = currentDeadline;
+  if (deadline == 0) {
+    return -1;
+  }
+  int64_t left = deadline - concurrency::Util::monotonicTime();
+  return left > 0 ? left : 0;
+}
+
+void TDeadline::setCurrent(int64_t deadline) {
+  currentDeadline = deadline;
+}
+
+void TDeadline::writePrefix(uint8_t* buf, uint32_t budgetMs) {
+  buf[0] = PREFIX_MAGIC;
+  buf[1] = PREFIX_VERSION;
+  buf[2] = static_cast<uint8_t>(budgetMs >> 24);
+  buf[3] = static_cast<uint8_t>(budgetMs >> 16);
+  buf[4] = static_cast<uint8_t>(budgetMs >> 8);
+  buf[5] = static_cast<uint8_t>(budgetMs);
+}
+
+uint32_t TDeadline::readPrefix(const uint8_t* buf, uint32_t size, int64_t& deadline) {
+  deadline = 0;
+  if (size < PREFIX_SIZE || buf[0] != PREFIX_MAGIC || buf[1] != PREFIX_VERSION) {
+    return 0;
+  }
+  uint32_t budgetMs = (static_cast<uint32_t>(buf[2]) << 24) |
+                      (static_cast<uint32_t>(buf[3]) << 16) |
+                      (static_cast<uint32_t>(buf[4]) << 8) |
+                      static_cast<uint32_t>(buf[5]);
+  deadline = concurrency::Util::monotonicTime() + budgetMs;
+  return PREFIX_SIZE;
+}
+
+}} // apache::thrift
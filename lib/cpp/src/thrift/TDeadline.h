@@ -0,0 +1,105 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TDEADLINE_H_
+#define _THRIFT_TDEADLINE_H_ 1
+
+#include <thrift/Thrift.h>
+
+#include <boost/noncopyable.hpp>
+
+namespace apache { namespace thrift {
+
+/**
+ * The time by which the client of the call being served wants its answer.
+ *
+ * A client sends its budget, the milliseconds it is still willing to wait,
+ * in a prefix at the start of a frame (see transport::TDeadlineTransport).
+ * TNonblockingServer turns the budget into a deadline on arrival, drops the
+ * call if it is still queued for the thread manager when the deadline
+ * passes, and otherwise serves it inside a TDeadlineScope, so a handler
+ * can check remaining() and give up on work nobody is waiting for:
+ *
+ *     if (TDeadline::expired()) {
+ *       throw TApplicationException("deadline passed");
+ *     }
+ *
+ * The budget is relative so that the two ends' clocks need not agree;
+ * time spent in the network is not counted against it.
+ */
+class TDeadline {
+ public:
+  /**
+   * The prefix: a magic byte, a version and the budget as a big-endian
+   * 32 bit count of milliseconds.  No message of the binary, compact or
+   * JSON protocols starts with the magic byte.
+   */
+  static const uint8_t PREFIX_MAGIC = 0x7e;
+  static const uint8_t PREFIX_VERSION = 1;
+  static const uint32_t PREFIX_SIZE = 6;
+
+  /// The deadline of the call being served on this thread, in ms as
+  /// concurrency::Util::monotonicTime(), or 0 for none
+  static int64_t current();
+
+  /// Milliseconds until current(), at least 0, or -1 without a deadline
+  static int64_t remaining();
+
+  /// Whether the call being served has a deadline that has passed
+  static bool expired() {
+    return remaining() == 0;
+  }
+
+  /// Writes a prefix carrying budgetMs into buf, which holds PREFIX_SIZE
+  static void writePrefix(uint8_t* buf, uint32_t budgetMs);
+
+  /**
+   * Reads a prefix from the start of a frame of size bytes, if it has one.
+   *
+   * @param deadline set to the deadline the prefix gives, counted from
+   *                 now, or to 0 without a prefix.
+   * @return the size of the prefix, or 0 without one.
+   */
+  static uint32_t readPrefix(const uint8_t* buf, uint32_t size, int64_t& deadline);
+
+ private:
+  friend class TDeadlineScope;
+
+  static void setCurrent(int64_t deadline);
+};
+
+/**
+ * Makes deadline that of the call being served on this thread for the life
+ * of the scope, restoring the one before.  Scopes nest.
+ */
+class TDeadlineScope : boost::noncopyable {
+ public:
+  explicit TDeadlineScope(int64_t deadline) : previous_(TDeadline::current()) {
+    TDeadline::setCurrent(deadline);
+  }
+
+  ~TDeadlineScope() { TDeadline::setCurrent(previous_); }
+
+ private:
+  int64_t previous_;
+};
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TDEADLINE_H_
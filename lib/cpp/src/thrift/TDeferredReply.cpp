@@ -0,0 +1,92 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/TDeferredReply.h>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/transport/TTransport.h>
+
+#if defined(_MSC_VER)
+# define THRIFT_THREAD_LOCAL __declspec(thread)
+#else
+# define THRIFT_THREAD_LOCAL __thread
+#endif
+
+namespace apache { namespace thrift {
+
+namespace {
+
+THRIFT_THREAD_LOCAL TDeferredReplyScope* currentScope = NULL;
+
+}
+
+struct TDeferredReplyScope::State {
+  concurrency::Mutex mutex;
+  /// Until release()
+  bool held;
+  /// Whether the completion was called while held
+  bool completed;
+  TDeferredReply::Completion complete;
+};
+
+TDeferredReply::Completion TDeferredReply::defer() {
+  TDeferredReplyScope* scope = currentScope;
+  if (scope == NULL || scope->state_ ||
+      (scope->input_ != NULL && scope->input_->peek())) {
+    return Completion();
+  }
+  scope->state_.reset(new TDeferredReplyScope::State());
+  scope->state_->held = true;
+  scope->state_->completed = false;
+  scope->state_->complete = scope->complete_;
+  return apache::thrift::stdcxx::bind(&TDeferredReplyScope::finish, scope->state_);
+}
+
+TDeferredReplyScope::TDeferredReplyScope(const TDeferredReply::Completion& complete,
+                                         transport::TTransport* input)
+  : complete_(complete),
+    input_(input),
+    previous_(currentScope) {
+  currentScope = this;
+}
+
+TDeferredReplyScope::~TDeferredReplyScope() {
+  currentScope = previous_;
+}
+
+bool TDeferredReplyScope::release() {
+  if (!state_) {
+    return false;
+  }
+  concurrency::Guard g(state_->mutex);
+  state_->held = false;
+  return !state_->completed;
+}
+
+void TDeferredReplyScope::finish(const boost::shared_ptr<State>& state) {
+  {
+    concurrency::Guard g(state->mutex);
+    if (state->held) {
+      state->completed = true;
+      return;
+    }
+  }
+  state->complete();
+}
+
+}} // apache::thrift
@@ -0,0 +1,118 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TDEFERREDREPLY_H_
+#define _THRIFT_TDEFERREDREPLY_H_ 1
+
+#include <thrift/Thrift.h>
+#include <thrift/cxxfunctional.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace apache { namespace thrift {
+
+namespace transport {
+class TTransport;
+}
+
+/**
+ * Lets the processor of the call being served on this thread finish it
+ * later, from any thread, rather than by the time process() returns, when
+ * the server serving it allows that.
+ *
+ * A processor that defers a reply returns from process() with nothing
+ * written, keeps its output protocol, writes the reply there later, and
+ * then calls the completion defer() gave it, once.  Until then the server
+ * leaves the connection be and the output where it is, and the thread
+ * that called process() goes on to other work:
+ *
+ *     TDeferredReply::Completion complete = TDeferredReply::defer();
+ *     if (complete) {
+ *       waiting.push_back(Waiter(out, seqid, complete));
+ *       return true;
+ *     }
+ *     // Not deferrable here; wait for the answer on this thread
+ *
+ * TNonblockingServer allows it for calls its thread manager serves that
+ * are the last message in their frame.
+ */
+class TDeferredReply {
+ public:
+  typedef apache::thrift::stdcxx::function<void()> Completion;
+
+  /**
+   * Defer the reply to the call being served on this thread.
+   *
+   * @return the completion to call once the reply is written, or an empty
+   *         function if the reply can't be deferred, and has to be written
+   *         before process() returns as usual.
+   */
+  static Completion defer();
+
+ private:
+  friend class TDeferredReplyScope;
+};
+
+/**
+ * Makes the reply to the call being served on this thread deferrable for
+ * the life of the scope, by a server able to finish the call with
+ * complete.  Scopes nest.
+ *
+ * The server calls release() once process() has returned.  A completion
+ * called before then only marks the call done, so complete never runs
+ * while the server's thread is still in the call.
+ */
+class TDeferredReplyScope : boost::noncopyable {
+ public:
+  /**
+   * @param complete finishes the call, from any thread.
+   * @param input the call's input; a reply is not deferrable while there
+   *              is more to read from it.  NULL if that needn't be checked.
+   */
+  TDeferredReplyScope(const TDeferredReply::Completion& complete,
+                      transport::TTransport* input);
+  ~TDeferredReplyScope();
+
+  /**
+   * Hands the call over to the processor's completion.
+   *
+   * @return true if the reply was deferred and is still to come, and
+   *         complete will be called for it; false if the server has to
+   *         finish the call itself, now.
+   */
+  bool release();
+
+ private:
+  friend class TDeferredReply;
+
+  struct State;
+
+  static void finish(const boost::shared_ptr<State>& state);
+
+  TDeferredReply::Completion complete_;
+  transport::TTransport* input_;
+  /// Made when the reply is deferred
+  boost::shared_ptr<State> state_;
+  TDeferredReplyScope* previous_;
+};
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TDEFERREDREPLY_H_
@@ -20,14 +20,57 @@
 #define _THRIFT_TDISPATCHPROCESSOR_H_ 1
 
 #include <thrift/TProcessor.h>
+#include <thrift/TProbe.h>
+#include <typeinfo>
 
 namespace apache { namespace thrift {
 
+/**
+ * Fires the dispatch_start probe (see TProbe.h) when made and dispatch_end
+ * when it goes out of scope, however the handler returns.
+ */
+class TDispatchProbe {
+ public:
+  TDispatchProbe(const std::string& fname, int32_t seqid) :
+    fname_(fname), seqid_(seqid) {
+    THRIFT_PROBE2(dispatch_start, fname_.c_str(), seqid_);
+  }
+
+  ~TDispatchProbe() {
+    THRIFT_PROBE2(dispatch_end, fname_.c_str(), seqid_);
+  }
+
+ private:
+  const std::string& fname_;
+  int32_t seqid_;
+};
+
+/**
+ * Returns p as a Protocol_, or NULL if it isn't one.  A protocol is almost
+ * always exactly the type a templated processor was instantiated over,
+ * which comparing type_info confirms for much less than a dynamic_cast
+ * costs on every call; anything else, a subclass say, falls back to one.
+ */
+template <class Protocol_>
+inline Protocol_* specificProtocol(protocol::TProtocol* p) {
+  if (p != NULL && typeid(*p) == typeid(Protocol_)) {
+    return static_cast<Protocol_*>(p);
+  }
+  return dynamic_cast<Protocol_*>(p);
+}
+
 /**
  * TDispatchProcessor is a helper class to parse the message header then call
  * another function to dispatch based on the function name.
  *
  * Subclasses must implement dispatchCall() to dispatch on the function name.
+ *
+ * When both protocols are a Protocol_, the call goes to
+ * dispatchCallTemplated() and every field is read and written without a
+ * virtual call.  Under TNonblockingServer, whose connections read from a
+ * TMemoryBuffer and may write to a TSegmentedMemoryBuffer, instantiate over
+ * TBinaryProtocolT<TBufferBase> (with a matching protocol factory), which
+ * both sides share.
  */
 template <class Protocol_>
 class TDispatchProcessorT : public TProcessor {
@@ -38,9 +81,9 @@ class TDispatchProcessorT : public TProcessor {
     protocol::TProtocol* inRaw = in.get();
     protocol::TProtocol* outRaw = out.get();
 
-    // Try to dynamic cast to the template protocol type
-    Protocol_* specificIn = dynamic_cast<Protocol_*>(inRaw);
-    Protocol_* specificOut = dynamic_cast<Protocol_*>(outRaw);
+    // Try to cast to the template protocol type
+    Protocol_* specificIn = specificProtocol<Protocol_>(inRaw);
+    Protocol_* specificOut = specificProtocol<Protocol_>(outRaw);
     if (specificIn && specificOut) {
       return processFast(specificIn, specificOut, connectionContext);
     }
@@ -65,9 +108,38 @@ class TDispatchProcessorT : public TProcessor {
       return false;
     }
 
+    TDispatchProbe probe(fname, seqid);
     return this->dispatchCall(inRaw, outRaw, fname, seqid, connectionContext);
   }
 
+  virtual bool processMessage(boost::shared_ptr<protocol::TProtocol> in,
+                              boost::shared_ptr<protocol::TProtocol> out,
+                              const std::string& name,
+                              protocol::TMessageType type,
+                              int32_t seqid,
+                              void* connectionContext) {
+    if (type != protocol::T_CALL && type != protocol::T_ONEWAY) {
+      GlobalOutput.printf("received invalid message type %d from client",
+                          type);
+      return false;
+    }
+
+    protocol::TProtocol* inRaw = in.get();
+    protocol::TProtocol* outRaw = out.get();
+    Protocol_* specificIn = specificProtocol<Protocol_>(inRaw);
+    Protocol_* specificOut = specificProtocol<Protocol_>(outRaw);
+    if (specificIn && specificOut) {
+      TDispatchProbe probe(name, seqid);
+      return this->dispatchCallTemplated(specificIn, specificOut, name,
+                                         seqid, connectionContext);
+    }
+
+    T_GENERIC_PROTOCOL(this, inRaw, specificIn);
+    T_GENERIC_PROTOCOL(this, outRaw, specificOut);
+    TDispatchProbe probe(name, seqid);
+    return this->dispatchCall(inRaw, outRaw, name, seqid, connectionContext);
+  }
+
  protected:
   bool processFast(Protocol_* in, Protocol_* out, void* connectionContext) {
     std::string fname;
@@ -81,6 +153,7 @@ class TDispatchProcessorT : public TProcessor {
       return false;
     }
 
+    TDispatchProbe probe(fname, seqid);
     return this->dispatchCallTemplated(in, out, fname,
                                        seqid, connectionContext);
   }
@@ -118,9 +191,26 @@ class TDispatchProcessor : public TProcessor {
       return false;
     }
 
+    TDispatchProbe probe(fname, seqid);
     return dispatchCall(in.get(), out.get(), fname, seqid, connectionContext);
   }
 
+  virtual bool processMessage(boost::shared_ptr<protocol::TProtocol> in,
+                              boost::shared_ptr<protocol::TProtocol> out,
+                              const std::string& name,
+                              protocol::TMessageType type,
+                              int32_t seqid,
+                              void* connectionContext) {
+    if (type != protocol::T_CALL && type != protocol::T_ONEWAY) {
+      GlobalOutput.printf("received invalid message type %d from client",
+                          type);
+      return false;
+    }
+
+    TDispatchProbe probe(name, seqid);
+    return dispatchCall(in.get(), out.get(), name, seqid, connectionContext);
+  }
+
  protected:
   virtual bool dispatchCall(apache::thrift::protocol::TProtocol* in,
                             apache::thrift::protocol::TProtocol* out,
@@ -0,0 +1,153 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TLAZY_H_
+#define _THRIFT_TLAZY_H_ 1
+
+#include <algorithm>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+namespace apache { namespace thrift {
+
+/**
+ * A struct that is only decoded when it is first used.
+ *
+ * Fields annotated cpp.lazy are held in one of these.  Reading one from a
+ * protocol with raw value support (binary and compact) only copies its
+ * encoded bytes, which are decoded the first time the value is looked at.
+ * Written back unchanged to a protocol of the same kind, the bytes go out
+ * as they came in without ever being decoded, so a proxy that looks at a
+ * couple of fields of a large message and passes it on only pays for what
+ * it touched.  Other protocols read and write the value as usual.
+ */
+template <typename T>
+class TLazy {
+ public:
+  TLazy() : format_(protocol::T_RAW_NONE), decoded_(false) {}
+
+  TLazy(const T& value) : value_(value), format_(protocol::T_RAW_NONE), decoded_(false) {}
+
+  TLazy& operator=(const T& value) {
+    value_ = value;
+    clearRaw();
+    return *this;
+  }
+
+  /// The value, decoded now if it has not been yet
+  const T& get() const {
+    if (!isDecoded()) {
+      decode();
+    }
+    return value_;
+  }
+
+  operator const T&() const { return get(); }
+
+  /**
+   * The value, to be changed.  The raw bytes are dropped, so it is encoded
+   * afresh when written.
+   */
+  T& mutate() {
+    get();
+    clearRaw();
+    return value_;
+  }
+
+  /// Whether the value has been decoded, or never needed to be
+  bool isDecoded() const { return format_ == protocol::T_RAW_NONE || decoded_; }
+
+  template <class Protocol_>
+  uint32_t read(Protocol_* iprot) {
+    protocol::TRawFormat format = iprot->getRawFormat();
+    if (format == protocol::T_RAW_NONE) {
+      clearRaw();
+      return value_.read(iprot);
+    }
+    raw_.clear();
+    uint32_t rsize = iprot->readRaw(protocol::T_STRUCT, raw_);
+    format_ = format;
+    decoded_ = false;
+    return rsize;
+  }
+
+  template <class Protocol_>
+  uint32_t write(Protocol_* oprot) const {
+    if (format_ != protocol::T_RAW_NONE && oprot->getRawFormat() == format_) {
+      return oprot->writeRaw(raw_);
+    }
+    return get().write(oprot);
+  }
+
+  bool operator==(const TLazy& that) const { return get() == that.get(); }
+  bool operator!=(const TLazy& that) const { return !(*this == that); }
+  bool operator<(const TLazy& that) const { return get() < that.get(); }
+
+  void swap(TLazy& that) {
+    using std::swap;
+    swap(value_, that.value_);
+    raw_.swap(that.raw_);
+    swap(format_, that.format_);
+    swap(decoded_, that.decoded_);
+  }
+
+ private:
+  void decode() const {
+    T value;
+    boost::shared_ptr<transport::TMemoryBuffer> buf(
+      new transport::TMemoryBuffer((uint8_t*)raw_.data(), (uint32_t)raw_.size()));
+    if (format_ == protocol::T_RAW_BINARY) {
+      protocol::TBinaryProtocolT<transport::TMemoryBuffer> prot(buf);
+      value.read(&prot);
+    } else {
+      protocol::TCompactProtocolT<transport::TMemoryBuffer> prot(buf);
+      value.read(&prot);
+    }
+    using std::swap;
+    swap(value_, value);
+    decoded_ = true;
+  }
+
+  void clearRaw() {
+    raw_.clear();
+    format_ = protocol::T_RAW_NONE;
+    decoded_ = false;
+  }
+
+  mutable T value_;
+
+  // The encoded value, in format_; T_RAW_NONE when value_ is all there is
+  std::string raw_;
+  protocol::TRawFormat format_;
+
+  // Whether value_ has been decoded from raw_
+  mutable bool decoded_;
+};
+
+template <typename T>
+inline void swap(TLazy<T>& a, TLazy<T>& b) {
+  a.swap(b);
+}
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TLAZY_H_
@@ -163,7 +163,15 @@
  * T_GLOBAL_DEBUG_VIRTUAL = 2:          record detailed info that can be
  *                                      printed by calling
  *                                      apache::thrift::profile_print_info()
+ *
+ * At 0 or unset, calls are only recorded, as at 2, while sampling has been
+ * turned on with apache::thrift::profile_set_sample_rate(), unless built
+ * with THRIFT_NO_VIRTUAL_PROFILING.
  */
+#if defined(_MSC_VER) && !defined(THRIFT_NO_VIRTUAL_PROFILING)
+  // VirtualProfiling.cpp keeps its buffers with pthreads
+  #define THRIFT_NO_VIRTUAL_PROFILING
+#endif
 #if T_GLOBAL_DEBUG_VIRTUAL > 1
   #define T_VIRTUAL_CALL()                                                \
     ::apache::thrift::profile_virtual_call(typeid(*this))
@@ -185,6 +193,20 @@
                 __FILE__, __LINE__);                                      \
       }                                                                   \
     } while (0)
+#elif !defined(THRIFT_NO_VIRTUAL_PROFILING)
+  #define T_VIRTUAL_CALL()                                                \
+    do {                                                                  \
+      if (::apache::thrift::profile_sampling()) {                         \
+        ::apache::thrift::profile_sample_virtual_call(typeid(*this));     \
+      }                                                                   \
+    } while (0)
+  #define T_GENERIC_PROTOCOL(template_class, generic_prot, specific_prot) \
+    do {                                                                  \
+      if (!(specific_prot) && ::apache::thrift::profile_sampling()) {     \
+        ::apache::thrift::profile_sample_generic_protocol(                \
+            typeid(*template_class), typeid(*generic_prot));              \
+      }                                                                   \
+    } while (0)
 #else
   #define T_VIRTUAL_CALL()
   #define T_GENERIC_PROTOCOL(template_class, generic_prot, specific_prot)
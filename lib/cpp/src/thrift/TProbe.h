@@ -0,0 +1,68 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TPROBE_H_
+#define _THRIFT_TPROBE_H_ 1
+
+#include <thrift/thrift-config.h>
+
+/**
+ * Static tracepoints of the "thrift" provider, for tracers that attach to
+ * a running process such as bpftrace, bcc, perf and SystemTap:
+ *
+ *     bpftrace -e 'usdt:/usr/lib/libthrift.so:thrift:dispatch_start
+ *                  { printf("%s\n", str(arg0)); }'
+ *
+ * Where <sys/sdt.h> is found (systemtap-sdt-dev or systemtap-sdt-devel)
+ * each probe compiles to a single nop plus a note in the binary telling
+ * tracers where it is, so one that nothing is attached to costs next to
+ * nothing.  Elsewhere the probes are left out altogether.
+ *
+ * The probes and their arguments:
+ *
+ *  - connection_transition(conn, appState, socketState): a
+ *    TNonblockingServer connection is leaving the states given
+ *  - frame_read(conn, size): a connection has read a whole request
+ *  - response_written(conn, size): a connection has sent a whole response
+ *  - task_enqueue(runnable, priority, pending): a ThreadManager has queued
+ *    a task, with pending tasks counting it
+ *  - task_dequeue(runnable, pending): a worker has taken the task to run it
+ *  - dispatch_start(name, seqid) and dispatch_end(name, seqid): a
+ *    processor is calling the handler of the method named
+ *  - socket_write(fd, size): a TSocket has written a whole buffer
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define THRIFT_PROBE(name) DTRACE_PROBE(thrift, name)
+#define THRIFT_PROBE1(name, a1) DTRACE_PROBE1(thrift, name, a1)
+#define THRIFT_PROBE2(name, a1, a2) DTRACE_PROBE2(thrift, name, a1, a2)
+#define THRIFT_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(thrift, name, a1, a2, a3)
+
+#else
+
+#define THRIFT_PROBE(name)
+#define THRIFT_PROBE1(name, a1)
+#define THRIFT_PROBE2(name, a1, a2)
+#define THRIFT_PROBE3(name, a1, a2, a3)
+
+#endif
+
+#endif // #ifndef _THRIFT_TPROBE_H_
@@ -22,6 +22,7 @@
 
 #include <string>
 #include <thrift/protocol/TProtocol.h>
+#include <thrift/protocol/TProtocolDecorator.h>
 #include <boost/shared_ptr.hpp>
 
 namespace apache { namespace thrift {
@@ -147,6 +148,25 @@ class TProcessor {
     return process(io, io, connectionContext);
   }
 
+  /**
+   * Processes a message whose header has already been read from in, as
+   * TMultiplexedProcessor does to find the service.  By default in is
+   * wrapped so that it hands the header back to process(); dispatch
+   * processors override this to go straight to the call, which keeps their
+   * specialized protocol path.  The wrapper lives on the stack, sharing
+   * in's ownership, so process() must not hold on to it once it returns.
+   */
+  virtual bool processMessage(boost::shared_ptr<protocol::TProtocol> in,
+                              boost::shared_ptr<protocol::TProtocol> out,
+                              const std::string& name,
+                              protocol::TMessageType type,
+                              int32_t seqid,
+                              void* connectionContext) {
+    protocol::StoredMessageProtocol stored(in, name, type, seqid);
+    return process(boost::shared_ptr<protocol::TProtocol>(in, &stored), out,
+                   connectionContext);
+  }
+
   boost::shared_ptr<TProcessorEventHandler> getEventHandler() {
     return eventHandler_;
   }
@@ -0,0 +1,105 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRECYCLEBIN_H_
+#define _THRIFT_TRECYCLEBIN_H_ 1
+
+#include <boost/shared_ptr.hpp>
+#include <thrift/concurrency/Mutex.h>
+#include <vector>
+#include <cstddef>
+
+namespace apache { namespace thrift {
+
+/**
+ * Objects a factory made and got back once they were done with, kept for
+ * it to hand out again rather than make new ones.  This is what lets the
+ * transport and protocol factories recycle what a server made for each
+ * connection, buffers and all.  Safe to share between threads.
+ *
+ * An object is only kept if nothing else still holds it, and only up to
+ * the limit, which is 0, keep nothing, by default.
+ */
+template <class T>
+class TRecycleBin {
+ public:
+  TRecycleBin() : limit_(0) {}
+
+  /// Sets how many objects are kept, dropping any over the new limit
+  void setLimit(size_t limit) {
+    std::vector<boost::shared_ptr<T> > dropped;
+    concurrency::Guard g(mutex_);
+    limit_ = limit;
+    while (objects_.size() > limit_) {
+      dropped.push_back(objects_.back());
+      objects_.pop_back();
+    }
+  }
+
+  size_t getLimit() const {
+    concurrency::Guard g(mutex_);
+    return limit_;
+  }
+
+  /// How many objects are waiting to be taken
+  size_t size() const {
+    concurrency::Guard g(mutex_);
+    return objects_.size();
+  }
+
+  /// The object put back most recently, or an empty pointer if there is none
+  boost::shared_ptr<T> take() {
+    boost::shared_ptr<T> obj;
+    concurrency::Guard g(mutex_);
+    if (!objects_.empty()) {
+      obj.swap(objects_.back());
+      objects_.pop_back();
+    }
+    return obj;
+  }
+
+  /**
+   * Keeps obj for take(), unless the bin is full or obj is still held
+   * elsewhere.  obj is left empty either way.
+   *
+   * @return whether obj was kept
+   */
+  bool put(boost::shared_ptr<T>& obj) {
+    boost::shared_ptr<T> mine;
+    mine.swap(obj);
+    if (!mine || !mine.unique()) {
+      return false;
+    }
+    concurrency::Guard g(mutex_);
+    if (objects_.size() >= limit_) {
+      return false;
+    }
+    objects_.push_back(mine);
+    return true;
+  }
+
+ private:
+  mutable concurrency::Mutex mutex_;
+  std::vector<boost::shared_ptr<T> > objects_;
+  size_t limit_;
+};
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TRECYCLEBIN_H_
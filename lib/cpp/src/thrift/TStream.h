@@ -0,0 +1,224 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TSTREAM_H_
+#define _THRIFT_TSTREAM_H_ 1
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/protocol/TProtocol.h>
+
+namespace apache { namespace thrift {
+
+/**
+ * Hands out the items of a stream as it is written.
+ */
+template <typename T>
+class TStreamSource {
+ public:
+  virtual ~TStreamSource() {}
+
+  /// Sets item to the next item, returning false at the end
+  virtual bool next(T& item) = 0;
+
+  /// Called instead of next() once writing the stream has failed, as it
+  /// does when the peer has gone away
+  virtual void cancel() {}
+};
+
+/**
+ * Takes the items of a stream as it is read.
+ */
+template <typename T>
+class TStreamSink {
+ public:
+  virtual ~TStreamSink() {}
+
+  /// Takes the next item, returning false to skip the rest of the stream
+  virtual bool write(const T& item) = 0;
+};
+
+/**
+ * A sequence of structs that goes over the wire an item at a time, so a
+ * handler can send a result set of any length in one call without
+ * building it first.
+ *
+ * A typedef of a list of structs annotated cpp.streamed, as in
+ *
+ *   typedef list<Row> Rows (cpp.streamed = "")
+ *
+ * is generated as one of these.  On the wire it is a struct holding the
+ * items in turn as field 1, so peers must be generated with the annotation
+ * too.  A handler gives it a source, which is pulled from as the result is
+ * written:
+ *
+ *   void scan(Rows& _return, const std::string& from) {
+ *     _return.setSource(openScan(from));
+ *     _return.setFlushItems(100);
+ *   }
+ *
+ * A client sets a sink on the value it passes for the result, and gets the
+ * items as they arrive; without one they are kept, to be had from
+ * getItems().  Arguments work the same way, from the client's source to
+ * the handler's items.
+ *
+ * With setFlushItems(n), the transport is flushed every n items, so over
+ * a TFramedTransport each batch goes in its own frame: the writer holds
+ * one batch at a time, and runs no further ahead of the reader than the
+ * socket buffers let it, which is the stream's flow control.  As with
+ * TStreamedBinary, that needs a server that reads a message a frame at a
+ * time, which TNonblockingServer does not.
+ *
+ * Copies share the stream, and a source can only be read once, so a
+ * stream is written at most once.
+ */
+template <typename T>
+class TStream {
+ public:
+  TStream() : state_(new State()) {}
+
+  /// Has the stream written from source
+  void setSource(const boost::shared_ptr<TStreamSource<T> >& source) {
+    state_->source = source;
+    state_->items.clear();
+  }
+
+  /// Has the stream read into sink
+  void setSink(const boost::shared_ptr<TStreamSink<T> >& sink) {
+    state_->sink = sink;
+  }
+
+  /// The items read without a sink, or to be written without a source
+  std::vector<T>& getItems() { return state_->items; }
+  const std::vector<T>& getItems() const { return state_->items; }
+
+  /// How many items have been read or written
+  uint32_t size() const { return state_->size; }
+
+  void setFlushItems(uint32_t flushItems) { state_->flushItems = flushItems; }
+
+  template <class Protocol_>
+  uint32_t read(Protocol_* iprot) {
+    uint32_t xfer = 0;
+    std::string fname;
+    protocol::TType ftype;
+    int16_t fid;
+
+    boost::shared_ptr<TStreamSink<T> > sink = state_->sink;
+    bool skipping = false;
+    state_->items.clear();
+    state_->size = 0;
+
+    T item;
+    xfer += iprot->readStructBegin(fname);
+    while (true) {
+      xfer += iprot->readFieldBegin(fname, ftype, fid);
+      if (ftype == protocol::T_STOP) {
+        break;
+      }
+      if (fid == 1 && ftype == protocol::T_STRUCT && !skipping) {
+        if (sink) {
+          xfer += item.read(iprot);
+          skipping = !sink->write(item);
+        } else {
+          state_->items.push_back(T());
+          xfer += state_->items.back().read(iprot);
+        }
+        ++state_->size;
+      } else {
+        xfer += iprot->skip(ftype);
+      }
+      xfer += iprot->readFieldEnd();
+    }
+    xfer += iprot->readStructEnd();
+    return xfer;
+  }
+
+  template <class Protocol_>
+  uint32_t write(Protocol_* oprot) const {
+    uint32_t xfer = 0;
+    xfer += oprot->writeStructBegin("TStream");
+    state_->size = 0;
+
+    boost::shared_ptr<TStreamSource<T> > source = state_->source;
+    if (source) {
+      try {
+        T item;
+        while (source->next(item)) {
+          xfer += writeItem(oprot, item);
+        }
+      } catch (...) {
+        source->cancel();
+        throw;
+      }
+    } else {
+      typename std::vector<T>::const_iterator it;
+      for (it = state_->items.begin(); it != state_->items.end(); ++it) {
+        xfer += writeItem(oprot, *it);
+      }
+    }
+
+    xfer += oprot->writeFieldStop();
+    xfer += oprot->writeStructEnd();
+    return xfer;
+  }
+
+  /// Copies of the same stream are equal; no two others are
+  bool operator==(const TStream& that) const { return state_ == that.state_; }
+  bool operator!=(const TStream& that) const { return !(*this == that); }
+  bool operator<(const TStream& that) const { return state_ < that.state_; }
+
+  void swap(TStream& that) { state_.swap(that.state_); }
+
+ private:
+  struct State {
+    State() : flushItems(0), size(0) {}
+
+    boost::shared_ptr<TStreamSource<T> > source;
+    boost::shared_ptr<TStreamSink<T> > sink;
+    std::vector<T> items;
+    uint32_t flushItems;
+    uint32_t size;
+  };
+
+  template <class Protocol_>
+  uint32_t writeItem(Protocol_* oprot, const T& item) const {
+    uint32_t xfer = 0;
+    xfer += oprot->writeFieldBegin("item", protocol::T_STRUCT, 1);
+    xfer += item.write(oprot);
+    xfer += oprot->writeFieldEnd();
+    ++state_->size;
+    if (state_->flushItems != 0 && state_->size % state_->flushItems == 0) {
+      oprot->getTransport()->flush();
+    }
+    return xfer;
+  }
+
+  boost::shared_ptr<State> state_;
+};
+
+template <typename T>
+inline void swap(TStream<T>& a, TStream<T>& b) {
+  a.swap(b);
+}
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TSTREAM_H_
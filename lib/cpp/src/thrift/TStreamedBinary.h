@@ -0,0 +1,302 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TSTREAMEDBINARY_H_
+#define _THRIFT_TSTREAMEDBINARY_H_ 1
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <thrift/protocol/TProtocol.h>
+
+namespace apache { namespace thrift {
+
+/**
+ * Hands out the bytes of a streamed binary value as it is written.
+ */
+class TBinarySource {
+ public:
+  virtual ~TBinarySource() {}
+
+  /// Copies up to len more bytes to buf, returning how many; 0 at the end
+  virtual uint32_t read(uint8_t* buf, uint32_t len) = 0;
+};
+
+/**
+ * Takes the bytes of a streamed binary value as it is read.
+ */
+class TBinarySink {
+ public:
+  virtual ~TBinarySink() {}
+
+  virtual void write(const uint8_t* buf, uint32_t len) = 0;
+};
+
+/**
+ * Where a streamed value read without a sink of its own is kept, to be
+ * read back through getSource().  The first maxMemory bytes are kept in
+ * memory and the rest in a temporary file, so holding a large value costs
+ * a bounded amount of memory.
+ */
+class TBinarySpool : public TBinarySink,
+                     public boost::enable_shared_from_this<TBinarySpool> {
+ public:
+  static const uint32_t DEFAULT_MAX_MEMORY = 1024 * 1024;
+
+  explicit TBinarySpool(uint32_t maxMemory = DEFAULT_MAX_MEMORY)
+    : maxMemory_(maxMemory), file_(NULL), size_(0) {}
+
+  ~TBinarySpool() {
+    if (file_ != NULL) {
+      fclose(file_);
+    }
+  }
+
+  void write(const uint8_t* buf, uint32_t len) {
+    size_ += len;
+    uint32_t keep = 0;
+    if (file_ == NULL && memory_.size() < maxMemory_) {
+      keep = (std::min)(len, static_cast<uint32_t>(maxMemory_ - memory_.size()));
+      memory_.append((const char*)buf, keep);
+    }
+    if (keep < len) {
+      if (file_ == NULL && (file_ = tmpfile()) == NULL) {
+        throw TException("TBinarySpool: cannot create a temporary file");
+      }
+      if (fwrite(buf + keep, 1, len - keep, file_) != len - keep) {
+        throw TException("TBinarySpool: cannot write the temporary file");
+      }
+    }
+  }
+
+  /// How many bytes have been written
+  uint64_t size() const { return size_; }
+
+  /**
+   * The bytes written so far, from the start.  Each source returned
+   * reads from the start again.  The spool must be held by a shared_ptr.
+   */
+  boost::shared_ptr<TBinarySource> getSource() {
+    if (file_ != NULL) {
+      fflush(file_);
+    }
+    return boost::shared_ptr<TBinarySource>(new Source(shared_from_this()));
+  }
+
+ private:
+  class Source : public TBinarySource {
+   public:
+    explicit Source(const boost::shared_ptr<TBinarySpool>& spool) : spool_(spool), pos_(0) {}
+
+    uint32_t read(uint8_t* buf, uint32_t len) {
+      const std::string& memory = spool_->memory_;
+      if (pos_ < memory.size()) {
+        uint32_t n = (std::min)(len, static_cast<uint32_t>(memory.size() - pos_));
+        memcpy(buf, memory.data() + pos_, n);
+        pos_ += n;
+        return n;
+      }
+      if (spool_->file_ == NULL || pos_ >= spool_->size_) {
+        return 0;
+      }
+      if (fseek(spool_->file_, static_cast<long>(pos_ - memory.size()), SEEK_SET) != 0) {
+        throw TException("TBinarySpool: cannot seek the temporary file");
+      }
+      uint32_t n = static_cast<uint32_t>(fread(buf, 1, len, spool_->file_));
+      pos_ += n;
+      return n;
+    }
+
+   private:
+    boost::shared_ptr<TBinarySpool> spool_;
+    uint64_t pos_;
+  };
+
+  uint32_t maxMemory_;
+  std::string memory_;
+  FILE* file_;
+  uint64_t size_;
+};
+
+/**
+ * A binary value that goes over the wire a chunk at a time, so neither
+ * end has to hold all of it.
+ *
+ * A typedef of binary annotated cpp.streamed, as in
+ *
+ *   typedef binary Blob (cpp.streamed = "")
+ *
+ * is generated as one of these.  On the wire it is a struct holding the
+ * value's chunks in turn as field 1, so peers must be generated with the
+ * annotation too.  To send one, give it a source:
+ *
+ *   void getBlob(Blob& _return, const std::string& id) {
+ *     _return.setSource(openBlob(id));
+ *   }
+ *
+ * A value read with a sink set is handed to the sink chunk by chunk; a
+ * client sets one on the value it passes for the result.  Without one,
+ * as in a handler's arguments, it is kept in a TBinarySpool and read back
+ * through getSource().
+ *
+ * With setFlushChunks(), the transport is flushed after every chunk, so
+ * over a TFramedTransport each chunk goes in its own frame and the
+ * writer's buffer stays one chunk long; servers that read a message a
+ * frame at a time (TSimpleServer, TThreadedServer, TThreadPoolServer)
+ * then never hold more than a chunk of it, but TNonblockingServer, which
+ * needs whole messages in single frames, cannot take it, nor can HTTP
+ * transports, which send a request per flush.
+ *
+ * Copies share the value, and a source can only be read once, so a value
+ * is written at most once; serializedSize() counts it by writing it.
+ */
+class TStreamedBinary {
+ public:
+  static const uint32_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+  TStreamedBinary() : state_(new State()) {}
+
+  /// Has the value written from source
+  void setSource(const boost::shared_ptr<TBinarySource>& source) {
+    state_->source = source;
+    state_->spool.reset();
+  }
+
+  /// Has the value read into sink
+  void setSink(const boost::shared_ptr<TBinarySink>& sink) {
+    state_->sink = sink;
+  }
+
+  /**
+   * The value, as read into the spool or as set to be written.  Empty for
+   * a value read into a sink of its own.
+   */
+  boost::shared_ptr<TBinarySource> getSource() const {
+    if (state_->spool) {
+      return state_->spool->getSource();
+    }
+    return state_->source;
+  }
+
+  /// How many bytes of the value have been read or written
+  uint64_t size() const { return state_->size; }
+
+  void setChunkSize(uint32_t chunkSize) { state_->chunkSize = chunkSize; }
+
+  void setFlushChunks(bool flushChunks) { state_->flushChunks = flushChunks; }
+
+  template <class Protocol_>
+  uint32_t read(Protocol_* iprot) {
+    uint32_t xfer = 0;
+    std::string fname;
+    protocol::TType ftype;
+    int16_t fid;
+
+    boost::shared_ptr<TBinarySink> sink = state_->sink;
+    if (!sink) {
+      state_->spool.reset(new TBinarySpool());
+      sink = state_->spool;
+    }
+    state_->size = 0;
+
+    std::string chunk;
+    xfer += iprot->readStructBegin(fname);
+    while (true) {
+      xfer += iprot->readFieldBegin(fname, ftype, fid);
+      if (ftype == protocol::T_STOP) {
+        break;
+      }
+      if (fid == 1 && ftype == protocol::T_STRING) {
+        xfer += iprot->readBinary(chunk);
+        if (!chunk.empty()) {
+          sink->write((const uint8_t*)chunk.data(), static_cast<uint32_t>(chunk.size()));
+          state_->size += chunk.size();
+        }
+      } else {
+        xfer += iprot->skip(ftype);
+      }
+      xfer += iprot->readFieldEnd();
+    }
+    xfer += iprot->readStructEnd();
+    return xfer;
+  }
+
+  template <class Protocol_>
+  uint32_t write(Protocol_* oprot) const {
+    uint32_t xfer = 0;
+    xfer += oprot->writeStructBegin("TStreamedBinary");
+
+    boost::shared_ptr<TBinarySource> source = getSource();
+    if (source) {
+      state_->size = 0;
+      std::string chunk;
+      while (true) {
+        chunk.resize(state_->chunkSize);
+        uint32_t got = source->read((uint8_t*)&chunk[0], state_->chunkSize);
+        if (got == 0) {
+          break;
+        }
+        chunk.resize(got);
+        xfer += oprot->writeFieldBegin("chunk", protocol::T_STRING, 1);
+        xfer += oprot->writeBinary(chunk);
+        xfer += oprot->writeFieldEnd();
+        state_->size += got;
+        if (state_->flushChunks) {
+          oprot->getTransport()->flush();
+        }
+      }
+    }
+
+    xfer += oprot->writeFieldStop();
+    xfer += oprot->writeStructEnd();
+    return xfer;
+  }
+
+  /// Copies of the same value are equal; no two others are
+  bool operator==(const TStreamedBinary& that) const { return state_ == that.state_; }
+  bool operator!=(const TStreamedBinary& that) const { return !(*this == that); }
+  bool operator<(const TStreamedBinary& that) const { return state_ < that.state_; }
+
+  void swap(TStreamedBinary& that) { state_.swap(that.state_); }
+
+ private:
+  struct State {
+    State() : chunkSize(DEFAULT_CHUNK_SIZE), flushChunks(false), size(0) {}
+
+    boost::shared_ptr<TBinarySource> source;
+    boost::shared_ptr<TBinarySink> sink;
+    boost::shared_ptr<TBinarySpool> spool;
+    uint32_t chunkSize;
+    bool flushChunks;
+    uint64_t size;
+  };
+
+  boost::shared_ptr<State> state_;
+};
+
+inline void swap(TStreamedBinary& a, TStreamedBinary& b) {
+  a.swap(b);
+}
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TSTREAMEDBINARY_H_
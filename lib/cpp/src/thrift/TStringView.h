@@ -0,0 +1,129 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TSTRINGVIEW_H_
+#define _THRIFT_TSTRINGVIEW_H_ 1
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+namespace apache { namespace thrift {
+
+/**
+ * An immutable string or binary value that may point into memory it does
+ * not own, such as the buffer a message was read from.
+ *
+ * A view holds a reference to whatever keeps its bytes alive, so it stays
+ * valid however long it is kept.  Code generated with the string_view
+ * option uses it for string and binary fields: a protocol reading from a
+ * transport that can share its buffer (a TMemoryBuffer given an owner)
+ * points each field into that buffer instead of copying it.  Everything
+ * else makes the view own a copy.
+ */
+class TStringView {
+ public:
+  typedef const char* const_iterator;
+  typedef size_t size_type;
+
+  TStringView() : data_(NULL), size_(0) {}
+
+  /// Owns a copy of str
+  TStringView(const std::string& str) : data_(NULL), size_(0) {
+    assign(str.data(), str.size());
+  }
+
+  /// Owns a copy of the NUL-terminated str
+  TStringView(const char* str) : data_(NULL), size_(0) {
+    assign(str, std::strlen(str));
+  }
+
+  /**
+   * Points at size bytes at data, which owner keeps alive.
+   */
+  TStringView(const char* data, size_t size, boost::shared_ptr<const void> owner)
+    : data_(data), size_(size), owner_(owner) {}
+
+  const char* data() const { return size_ == 0 ? "" : data_; }
+  size_t size() const { return size_; }
+  size_t length() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+
+  char operator[](size_t i) const { return data_[i]; }
+
+  /// A std::string with a copy of the bytes
+  std::string str() const { return std::string(data(), size_); }
+
+  /// Whatever keeps the bytes alive
+  const boost::shared_ptr<const void>& owner() const { return owner_; }
+
+  void clear() {
+    data_ = NULL;
+    size_ = 0;
+    owner_.reset();
+  }
+
+  /// Owns a copy of the size bytes at data
+  void assign(const char* data, size_t size) {
+    std::memcpy(allocate(size), data, size);
+  }
+
+  /**
+   * Owns size new bytes, returned to be filled in before the view is used.
+   */
+  char* allocate(size_t size) {
+    boost::shared_ptr<std::string> copy(new std::string(size, '\0'));
+    data_ = size == 0 ? NULL : &(*copy)[0];
+    size_ = size;
+    owner_ = copy;
+    return const_cast<char*>(data_);
+  }
+
+  int compare(const TStringView& that) const {
+    int result = std::memcmp(data(), that.data(), (std::min)(size_, that.size_));
+    if (result != 0) {
+      return result;
+    }
+    return size_ < that.size_ ? -1 : (size_ > that.size_ ? 1 : 0);
+  }
+
+  bool operator==(const TStringView& that) const {
+    return size_ == that.size_ && std::memcmp(data(), that.data(), size_) == 0;
+  }
+  bool operator!=(const TStringView& that) const { return !(*this == that); }
+  bool operator<(const TStringView& that) const { return compare(that) < 0; }
+
+ private:
+  const char* data_;
+  size_t size_;
+  boost::shared_ptr<const void> owner_;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const TStringView& str) {
+  return out.write(str.data(), static_cast<std::streamsize>(str.size()));
+}
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TSTRINGVIEW_H_
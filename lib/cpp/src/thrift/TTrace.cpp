@@ -0,0 +1,173 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/TTrace.h>
+#include <thrift/concurrency/Util.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(_MSC_VER)
+# define THRIFT_THREAD_LOCAL __declspec(thread)
+#else
+# define THRIFT_THREAD_LOCAL __thread
+#endif
+
+namespace apache { namespace thrift {
+
+namespace {
+
+// Thread locals can't have constructors, so the contexts are kept as ids
+struct Ids {
+  uint64_t traceId;
+  uint64_t spanId;
+  uint64_t parentSpanId;
+  bool sampled;
+};
+
+THRIFT_THREAD_LOCAL Ids currentIds;
+THRIFT_THREAD_LOCAL Ids receivedIds;
+THRIFT_THREAD_LOCAL uint64_t randomState = 0;
+
+TTraceContext toContext(const Ids& ids) {
+  TTraceContext context;
+  context.traceId = ids.traceId;
+  context.spanId = ids.spanId;
+  context.parentSpanId = ids.parentSpanId;
+  context.sampled = ids.sampled;
+  return context;
+}
+
+void toIds(const TTraceContext& context, Ids& ids) {
+  ids.traceId = context.traceId;
+  ids.spanId = context.spanId;
+  ids.parentSpanId = context.parentSpanId;
+  ids.sampled = context.sampled;
+}
+
+std::string toHex(uint64_t id) {
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(id));
+  return buf;
+}
+
+// 0 if value isn't a hex id
+uint64_t fromHex(const std::string& value) {
+  if (value.empty() || value.size() > 16) {
+    return 0;
+  }
+  uint64_t id = 0;
+  for (size_t i = 0; i < value.size(); ++i) {
+    char c = value[i];
+    int digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return 0;
+    }
+    id = (id << 4) | static_cast<uint64_t>(digit);
+  }
+  return id;
+}
+
+}
+
+const char* const TTraceContext::TRACE_ID_HEADER = "trace_id";
+const char* const TTraceContext::SPAN_ID_HEADER = "span_id";
+const char* const TTraceContext::SAMPLED_HEADER = "sampled";
+
+TTraceContext TTraceContext::current() {
+  return toContext(currentIds);
+}
+
+void TTraceContext::setCurrent(const TTraceContext& context) {
+  toIds(context, currentIds);
+}
+
+void TTraceContext::writeHeaders(HeaderMap& headers) const {
+  if (!valid()) {
+    return;
+  }
+  headers[TRACE_ID_HEADER] = toHex(traceId);
+  headers[SPAN_ID_HEADER] = toHex(spanId);
+  headers[SAMPLED_HEADER] = sampled ? "1" : "0";
+}
+
+bool TTraceContext::readHeaders(const HeaderMap& headers) {
+  *this = TTraceContext();
+  HeaderMap::const_iterator it = headers.find(TRACE_ID_HEADER);
+  if (it == headers.end()) {
+    return false;
+  }
+  uint64_t trace = fromHex(it->second);
+  if (trace == 0) {
+    return false;
+  }
+  traceId = trace;
+  it = headers.find(SPAN_ID_HEADER);
+  parentSpanId = it != headers.end() ? fromHex(it->second) : 0;
+  it = headers.find(SAMPLED_HEADER);
+  sampled = it != headers.end() && it->second == "1";
+  return true;
+}
+
+void TTraceContext::received(const HeaderMap& headers) {
+  TTraceContext context;
+  context.readHeaders(headers);
+  toIds(context, receivedIds);
+}
+
+TTraceContext TTraceContext::takeReceived() {
+  TTraceContext context = toContext(receivedIds);
+  toIds(TTraceContext(), receivedIds);
+  return context;
+}
+
+uint64_t TTraceContext::newId() {
+  // xorshift64*, seeded per thread from the clock and the thread's state
+  uint64_t x = randomState;
+  if (x == 0) {
+    x = static_cast<uint64_t>(concurrency::Util::currentTimeUsec()) ^
+        (static_cast<uint64_t>(reinterpret_cast<uintptr_t>(&randomState)) << 16) ^
+        0x9e3779b97f4a7c15ULL;
+  }
+  uint64_t id;
+  do {
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    id = x * 0x2545f4914f6cdd1dULL;
+  } while (id == 0);
+  randomState = x;
+  return id;
+}
+
+TTraceContext TTraceScope::newTrace(bool sampled) {
+  TTraceContext context;
+  context.traceId = TTraceContext::newId();
+  context.spanId = TTraceContext::newId();
+  context.sampled = sampled;
+  return context;
+}
+
+}} // apache::thrift
@@ -0,0 +1,153 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TTRACE_H_
+#define _THRIFT_TTRACE_H_ 1
+
+#include <thrift/Thrift.h>
+
+#include <map>
+#include <string>
+#include <boost/noncopyable.hpp>
+
+namespace apache { namespace thrift {
+
+/**
+ * The trace the call being served on this thread belongs to, and the span
+ * that stands for serving it.
+ *
+ * A trace follows a request across services.  Each call served is a span
+ * of it, whose parent is the span of the caller.  The ids travel in the
+ * key/value headers of a THeaderTransport, so no IDL has to change: when
+ * THeaderProtocol writes a call it adds the current context's ids, and when
+ * it reads one it keeps what came for processor::TTraceEventHandler, which
+ * starts the span, makes it current for the handler and hands it to a sink
+ * once the call is done.
+ *
+ * A handler can read current() to log with the trace id, and any client
+ * it calls over a THeaderProtocol on the same thread carries the trace on.
+ * To carry it over to another thread, copy current() and put it in a
+ * TTraceScope there.
+ */
+class TTraceContext {
+ public:
+  /// Header names, with the ids in hex and sampled "1" or "0"
+  static const char* const TRACE_ID_HEADER;
+  static const char* const SPAN_ID_HEADER;
+  static const char* const SAMPLED_HEADER;
+
+  typedef std::map<std::string, std::string> HeaderMap;
+
+  TTraceContext() : traceId(0), spanId(0), parentSpanId(0), sampled(false) {}
+
+  /// 0 when there is no trace
+  uint64_t traceId;
+  uint64_t spanId;
+  /// The caller's span, or 0 for the first span of a trace
+  uint64_t parentSpanId;
+  /// Whether the trace's spans are to be kept; decided where it started
+  bool sampled;
+
+  bool valid() const { return traceId != 0; }
+
+  /// The context of the call being served on this thread
+  static TTraceContext current();
+
+  /// Adds the ids a callee needs to headers, if this is a trace
+  void writeHeaders(HeaderMap& headers) const;
+
+  /**
+   * Reads what a caller sent.  The context gets the caller's trace and
+   * sampling, with the caller's span as parent and no span of its own.
+   *
+   * @return false, leaving the context empty, if headers carry no trace.
+   */
+  bool readHeaders(const HeaderMap& headers);
+
+  /**
+   * Keeps what the call just read on this thread carried, for whatever
+   * starts its span to takeReceived().
+   */
+  static void received(const HeaderMap& headers);
+
+  /// What the last received() kept, which is then forgotten
+  static TTraceContext takeReceived();
+
+  /// A random id, never 0
+  static uint64_t newId();
+
+  /**
+   * Makes context this thread's, for code that can't hold a TTraceScope
+   * for the length of a call, such as an event handler.
+   */
+  static void setCurrent(const TTraceContext& context);
+};
+
+/**
+ * Makes context that of this thread for the life of the scope, restoring
+ * the one before.  Scopes nest.
+ */
+class TTraceScope : boost::noncopyable {
+ public:
+  explicit TTraceScope(const TTraceContext& context)
+    : previous_(TTraceContext::current()) {
+    TTraceContext::setCurrent(context);
+  }
+
+  ~TTraceScope() { TTraceContext::setCurrent(previous_); }
+
+  /**
+   * Starts a trace here, as a client does for a request of its own: a
+   * span with no parent, sampled if sampled.
+   */
+  static TTraceContext newTrace(bool sampled);
+
+ private:
+  TTraceContext previous_;
+};
+
+/// A finished span
+struct TTraceSpan {
+  TTraceContext context;
+  /// The method called
+  std::string name;
+  /// When serving began, in microseconds since the epoch, and how long it took
+  int64_t startUsec;
+  int64_t durationUsec;
+  uint32_t bytesIn;
+  uint32_t bytesOut;
+  /// Whether the handler threw an undeclared exception
+  bool error;
+};
+
+/**
+ * Where sampled spans go: a collector's client, a log.  emit() is called on
+ * the thread that served the call, as it finishes, so it should not block;
+ * queue the span and send it from elsewhere.
+ */
+class TTraceSink {
+ public:
+  virtual ~TTraceSink() {}
+
+  virtual void emit(const TTraceSpan& span) = 0;
+};
+
+}} // apache::thrift
+
+#endif // #ifndef _THRIFT_TTRACE_H_
@@ -28,32 +28,112 @@ namespace apache { namespace thrift {
 
 TOutput GlobalOutput;
 
+const char* TEnumNameOf(const TEnumName* table, size_t n, int value) {
+  size_t lo = 0;
+  size_t hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (table[mid].value < value) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < n && table[lo].value == value) {
+    return table[lo].name;
+  }
+  return NULL;
+}
+
+bool TEnumValueOf(const TEnumName* table, size_t n, const char* name,
+                  int* value) {
+  size_t lo = 0;
+  size_t hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = std::strcmp(table[mid].name, name);
+    if (cmp == 0) {
+      *value = table[mid].value;
+      return true;
+    } else if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return false;
+}
+
+void TOutput::output(TOutputLevel level, const char* message) {
+  if (!enabled(level)) {
+    return;
+  }
+  if (backend_ != NULL) {
+    backend_->output(level, message);
+  } else {
+    f_(message);
+  }
+}
+
 void TOutput::printf(const char *message, ...) {
+  va_list ap;
+  va_start(ap, message);
+  vprintf(T_OUTPUT_ERROR, message, ap);
+  va_end(ap);
+}
+
+void TOutput::printf(TOutputLevel level, const char *message, ...) {
+  va_list ap;
+  va_start(ap, message);
+  vprintf(level, message, ap);
+  va_end(ap);
+}
+
+void TOutput::printf(TOutputRateLimit* limit, TOutputLevel level, const char *message, ...) {
+  uint32_t suppressed;
+  if (!admit(limit, &suppressed)) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, message);
+  vprintf(level, message, ap);
+  va_end(ap);
+  if (suppressed > 0) {
+    printf(level, "(%u messages like the last were suppressed)", suppressed);
+  }
+}
+
+void TOutput::vprintf(TOutputLevel level, const char *message, va_list ap) {
 #ifndef THRIFT_SQUELCH_CONSOLE_OUTPUT
+  // Disabled levels are dropped before any formatting
+  if (!enabled(level)) {
+    return;
+  }
+
   // Try to reduce heap usage, even if printf is called rarely.
   static const int STACK_BUF_SIZE = 256;
   char stack_buf[STACK_BUF_SIZE];
-  va_list ap;
+  va_list aq;
 
 #ifdef _MSC_VER
-  va_start(ap, message);
-  int need = _vscprintf(message, ap);
-  va_end(ap);
+  va_copy(aq, ap);
+  int need = _vscprintf(message, aq);
+  va_end(aq);
 
   if (need < STACK_BUF_SIZE) {
-    va_start(ap, message);
-    vsnprintf_s(stack_buf, STACK_BUF_SIZE, _TRUNCATE, message, ap);
-    va_end(ap);
-    f_(stack_buf);
+    va_copy(aq, ap);
+    vsnprintf_s(stack_buf, STACK_BUF_SIZE, _TRUNCATE, message, aq);
+    va_end(aq);
+    output(level, stack_buf);
     return;
   }
 #else
-  va_start(ap, message);
-  int need = vsnprintf(stack_buf, STACK_BUF_SIZE, message, ap);
-  va_end(ap);
+  va_copy(aq, ap);
+  int need = vsnprintf(stack_buf, STACK_BUF_SIZE, message, aq);
+  va_end(aq);
 
   if (need < STACK_BUF_SIZE) {
-    f_(stack_buf);
+    output(level, stack_buf);
     return;
   }
 #endif
@@ -61,26 +141,50 @@ void TOutput::printf(const char *message, ...) {
   char *heap_buf = (char*)malloc((need+1) * sizeof(char));
   if (heap_buf == NULL) {
 #ifdef _MSC_VER
-    va_start(ap, message);
-    vsnprintf_s(stack_buf, STACK_BUF_SIZE, _TRUNCATE, message, ap);
-    va_end(ap);
+    va_copy(aq, ap);
+    vsnprintf_s(stack_buf, STACK_BUF_SIZE, _TRUNCATE, message, aq);
+    va_end(aq);
 #endif
     // Malloc failed.  We might as well print the stack buffer.
-    f_(stack_buf);
+    output(level, stack_buf);
     return;
   }
 
-  va_start(ap, message);
-  int rval = vsnprintf(heap_buf, need+1, message, ap);
-  va_end(ap);
+  va_copy(aq, ap);
+  int rval = vsnprintf(heap_buf, need+1, message, aq);
+  va_end(aq);
   // TODO(shigin): inform user
   if (rval != -1) {
-    f_(heap_buf);
+    output(level, heap_buf);
   }
   free(heap_buf);
 #endif
 }
 
+bool TOutput::admit(TOutputRateLimit* limit, uint32_t* suppressed) {
+  int64_t now = static_cast<int64_t>(time(NULL));
+  bool admitted = false;
+
+  // Held only for a few loads and stores, so spun on
+  while (concurrency::atomicExchange(&limit->lock, 1) != 0) {
+    concurrency::cpuRelax();
+  }
+  if (limit->second != now) {
+    limit->second = now;
+    limit->count = 0;
+  }
+  if (limit->count < limit->perSecond) {
+    ++limit->count;
+    *suppressed = limit->suppressed;
+    limit->suppressed = 0;
+    admitted = true;
+  } else {
+    ++limit->suppressed;
+  }
+  concurrency::atomicStore<concurrency::ATOMIC_RELEASE>(&limit->lock, 0);
+  return admitted;
+}
+
 void TOutput::errorTimeWrapper(const char* msg) {
 #ifndef THRIFT_SQUELCH_CONSOLE_OUTPUT
   time_t now;
@@ -93,8 +197,28 @@ void TOutput::errorTimeWrapper(const char* msg) {
 }
 
 void TOutput::perror(const char *message, int errno_copy) {
+  perror(T_OUTPUT_ERROR, message, errno_copy);
+}
+
+void TOutput::perror(TOutputLevel level, const char *message, int errno_copy) {
+  // Nor is strerror_r() called for a disabled level
+  if (!enabled(level)) {
+    return;
+  }
   std::string out = message + strerror_s(errno_copy);
-  f_(out.c_str());
+  output(level, out.c_str());
+}
+
+void TOutput::perror(TOutputRateLimit* limit, TOutputLevel level, const char *message,
+                     int errno_copy) {
+  uint32_t suppressed;
+  if (!admit(limit, &suppressed)) {
+    return;
+  }
+  perror(level, message, errno_copy);
+  if (suppressed > 0) {
+    printf(level, "(%u messages like the last were suppressed)", suppressed);
+  }
 }
 
 std::string TOutput::strerror_s(int errno_copy) {
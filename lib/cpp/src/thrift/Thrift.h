@@ -25,6 +25,7 @@
 #include <thrift/thrift-config.h>
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <assert.h>
 
 #include <sys/types.h>
@@ -46,6 +47,7 @@
 #include <boost/type_traits/is_convertible.hpp>
 
 #include <thrift/TLogging.h>
+#include <thrift/concurrency/Atomic.h>
 
 /**
  * Helper macros to allow function overloading even when using
@@ -101,18 +103,104 @@ class TEnumIterator : public std::iterator<std::forward_iterator_tag, std::pair<
   const char** names_;
 };
 
+/**
+ * One entry of the name tables generated for an enum.  Being an aggregate,
+ * a table of these is filled in at compile time rather than by a static
+ * initializer.
+ */
+struct TEnumName {
+  int value;
+  const char* name;
+};
+
+/**
+ * Looks value up in a table of n entries sorted by value, returning its
+ * name, or NULL if it has none.  When several names share a value, the
+ * first in the table wins.
+ */
+const char* TEnumNameOf(const TEnumName* table, size_t n, int value);
+
+/**
+ * Looks name up in a table of n entries sorted by name (in strcmp order),
+ * storing its value in *value.  Returns false if there is no such name.
+ */
+bool TEnumValueOf(const TEnumName* table, size_t n, const char* name,
+                  int* value);
+
+/// Severities of the messages given to a TOutput, least severe first
+enum TOutputLevel {
+  T_OUTPUT_DEBUG = 0,
+  T_OUTPUT_INFO = 1,
+  T_OUTPUT_WARNING = 2,
+  T_OUTPUT_ERROR = 3,
+  /// As a level to show from, shows nothing
+  T_OUTPUT_NONE = 4
+};
+
+/**
+ * Where a TOutput's messages go in place of its output function, such as a
+ * TAsyncOutput.  output() may be called by many threads at once.
+ */
+class TOutputBackend {
+ public:
+  virtual ~TOutputBackend() {}
+  virtual void output(TOutputLevel level, const char* message) = 0;
+};
+
+/**
+ * The state of one call site of T_OUTPUT_LIMITED or T_PERROR_LIMITED, which
+ * let perSecond messages through each second and count the rest.  An
+ * aggregate so that each site's is set up at compile time.
+ */
+struct TOutputRateLimit {
+  uint32_t perSecond;
+  int32_t lock;
+  int64_t second;
+  /// Messages let through this second
+  uint32_t count;
+  /// Messages dropped since one was last let through
+  uint32_t suppressed;
+};
+
 class TOutput {
  public:
-  TOutput() : f_(&errorTimeWrapper) {}
+  TOutput() : f_(&errorTimeWrapper), backend_(NULL), level_(T_OUTPUT_DEBUG) {}
 
   inline void setOutputFunction(void (*function)(const char *)){
     f_ = function;
   }
 
+  /**
+   * Sends messages to backend rather than the output function; NULL goes
+   * back to the function.  The backend must outlive its use.
+   */
+  inline void setBackend(TOutputBackend* backend) {
+    backend_ = backend;
+  }
+
+  /**
+   * Drops messages less severe than level, before they are formatted.
+   * Messages given without a level are errors.  May be changed while
+   * running.
+   */
+  inline void setLevel(TOutputLevel level) {
+    concurrency::atomicStore<concurrency::ATOMIC_RELAXED>(&level_, static_cast<int32_t>(level));
+  }
+
+  inline TOutputLevel getLevel() const {
+    return static_cast<TOutputLevel>(concurrency::atomicLoad<concurrency::ATOMIC_RELAXED>(&level_));
+  }
+
+  inline bool enabled(TOutputLevel level) const {
+    return level >= getLevel();
+  }
+
   inline void operator()(const char *message){
-    f_(message);
+    output(T_OUTPUT_ERROR, message);
   }
 
+  void output(TOutputLevel level, const char* message);
+
   // It is important to have a const char* overload here instead of
   // just the string version, otherwise errno could be corrupted
   // if there is some problem allocating memory when constructing
@@ -121,8 +209,18 @@ class TOutput {
   inline void perror(const std::string &message, int errno_copy) {
     perror(message.c_str(), errno_copy);
   }
+  void perror(TOutputLevel level, const char *message, int errno_copy);
 
   void printf(const char *message, ...);
+  void printf(TOutputLevel level, const char *message, ...);
+
+  /**
+   * As the above, once limit lets the message through, noting how many it
+   * dropped before.  Used by T_OUTPUT_LIMITED and T_PERROR_LIMITED.
+   */
+  void printf(TOutputRateLimit* limit, TOutputLevel level, const char *message, ...);
+  void perror(TOutputRateLimit* limit, TOutputLevel level, const char *message,
+              int errno_copy);
 
   static void errorTimeWrapper(const char* msg);
 
@@ -130,11 +228,43 @@ class TOutput {
   static std::string strerror_s(int errno_copy);
 
  private:
+  void vprintf(TOutputLevel level, const char *message, va_list ap);
+
+  /// Whether limit lets a message through; if so, also after how many dropped
+  static bool admit(TOutputRateLimit* limit, uint32_t* suppressed);
+
   void (*f_)(const char *);
+  TOutputBackend* backend_;
+  int32_t level_;
 };
 
 extern TOutput GlobalOutput;
 
+/**
+ * GlobalOutput.printf() at a level, from a call site letting through at
+ * most perSecond messages a second, such as one logging a failure per
+ * connection.  Costs a load and a branch when the level is off.
+ */
+#define T_OUTPUT_LIMITED(level, perSecond, ...)                             \
+  do {                                                                      \
+    if (::apache::thrift::GlobalOutput.enabled(level)) {                    \
+      static ::apache::thrift::TOutputRateLimit t_output_limit_ =           \
+        { (perSecond), 0, 0, 0, 0 };                                        \
+      ::apache::thrift::GlobalOutput.printf(&t_output_limit_, (level), __VA_ARGS__); \
+    }                                                                       \
+  } while (0)
+
+/// GlobalOutput.perror(), limited as by T_OUTPUT_LIMITED
+#define T_PERROR_LIMITED(level, perSecond, message, errno_copy)             \
+  do {                                                                      \
+    if (::apache::thrift::GlobalOutput.enabled(level)) {                    \
+      static ::apache::thrift::TOutputRateLimit t_output_limit_ =           \
+        { (perSecond), 0, 0, 0, 0 };                                        \
+      ::apache::thrift::GlobalOutput.perror(&t_output_limit_, (level),      \
+                                            (message), (errno_copy));       \
+    }                                                                       \
+  } while (0)
+
 class TException : public std::exception {
  public:
   TException():
@@ -188,13 +318,45 @@ TDelayedException* TDelayedException::delayException(const E& e) {
   return new TExceptionWrapper<E>(e);
 }
 
-#if T_GLOBAL_DEBUG_VIRTUAL > 1
+#if T_GLOBAL_DEBUG_VIRTUAL > 1 || !defined(THRIFT_NO_VIRTUAL_PROFILING)
+/**
+ * Profiling of T_VIRTUAL_CALL() and T_GENERIC_PROTOCOL(), the calls that a
+ * fully templated protocol and transport would have avoided.
+ *
+ * Each thread records into a buffer of its own, so recording only takes a
+ * lock that the printing code may also want.  Calls are filed under their
+ * stack and types; at most 4096 stacks are kept per thread, and calls from
+ * further stacks are counted as dropped.
+ *
+ * With T_GLOBAL_DEBUG_VIRTUAL = 2 every call is recorded.  Otherwise the
+ * macros cost a load and a branch until profile_set_sample_rate() turns
+ * sampling on, after which each thread records one in every sampleRate of
+ * its calls, counted as sampleRate calls.  Build with
+ * THRIFT_NO_VIRTUAL_PROFILING to compile it out.
+ */
 void profile_virtual_call(const std::type_info& info);
 void profile_generic_protocol(const std::type_info& template_type,
                               const std::type_info& prot_type);
+void profile_sample_virtual_call(const std::type_info& info);
+void profile_sample_generic_protocol(const std::type_info& template_type,
+                                     const std::type_info& prot_type);
+
+/// Samples one in every sampleRate calls per thread; 0 stops sampling
+void profile_set_sample_rate(int32_t sampleRate);
+
+/// Discards everything recorded so far
+void profile_reset();
+
 void profile_print_info(FILE *f);
 void profile_print_info();
 void profile_write_pprof(FILE* gen_calls_f, FILE* virtual_calls_f);
+
+extern int32_t profile_sample_rate;
+
+/// The sample rate, or 0 while sampling is off
+inline int32_t profile_sampling() {
+  return concurrency::atomicLoad<concurrency::ATOMIC_RELAXED>(&profile_sample_rate);
+}
 #endif
 
 }} // apache::thrift
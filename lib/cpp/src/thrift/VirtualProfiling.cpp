@@ -19,279 +19,250 @@
 
 #include <thrift/Thrift.h>
 
-// Do nothing if virtual call profiling is not enabled
-#if T_GLOBAL_DEBUG_VIRTUAL > 1
+// Do nothing if virtual call profiling is compiled out
+#if T_GLOBAL_DEBUG_VIRTUAL > 1 || !defined(THRIFT_NO_VIRTUAL_PROFILING)
 
-// TODO: This code only works with g++ (since we rely on the fact
-// that all std::type_info instances referring to a particular type
-// always return the exact same pointer value from name().)
-#ifndef __GNUG__
-#error "Thrift virtual function profiling currently only works with gcc"
-#endif // !__GNUG__
+#include <thrift/Backtrace.h>
 
-// TODO: We also require glibc for the backtrace() and backtrace_symbols()
-// functions.
-#ifndef __GLIBC__
-#error "Thrift virtual function profiling currently requires glibc"
-#endif // !__GLIBC__
-
-
-#include <thrift/concurrency/Mutex.h>
-
-#include <ext/hash_map>
-#include <execinfo.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <pthread.h>
 #include <stdio.h>
 
+#if defined(_MSC_VER)
+# define THRIFT_THREAD_LOCAL __declspec(thread)
+#else
+# define THRIFT_THREAD_LOCAL __thread
+#endif
+
 namespace apache { namespace thrift {
 
-using ::apache::thrift::concurrency::Mutex;
-using ::apache::thrift::concurrency::Guard;
+namespace {
 
-static const unsigned int MAX_STACK_DEPTH = 15;
+const size_t MAX_SITES = 4096;
 
 /**
- * A stack trace
+ * A backtrace, plus one or two types
+ *
+ * Types are ordered with type_info::before(), so this works on any
+ * compiler, not just with libstdc++'s unique type names.
  */
-class Backtrace {
+class Key {
  public:
-  Backtrace(int skip = 0);
-  Backtrace(Backtrace const &bt);
-
-  void operator=(Backtrace const &bt) {
-    numCallers_ = bt.numCallers_;
-    if (numCallers_ >= 0) {
-      memcpy(callers_, bt.callers_, numCallers_ * sizeof(void*));
-    }
-  }
-
-  bool operator==(Backtrace const &bt) const {
-    return (cmp(bt) == 0);
+  Key(const Backtrace& bt, const std::type_info& type_info)
+    : backtrace_(bt)
+    , type1_(&type_info)
+    , type2_(NULL) {
   }
 
-  size_t hash() const {
-    intptr_t ret = 0;
-    for (int n = 0; n < numCallers_; ++n) {
-      ret ^= reinterpret_cast<intptr_t>(callers_[n]);
-    }
-    return static_cast<size_t>(ret);
+  Key(const Backtrace& bt, const std::type_info& type_info1,
+      const std::type_info& type_info2)
+    : backtrace_(bt)
+    , type1_(&type_info1)
+    , type2_(&type_info2) {
   }
 
-  int cmp(Backtrace const& bt) const {
-    int depth_diff = (numCallers_ - bt.numCallers_);
-    if (depth_diff != 0) {
-      return depth_diff;
-    }
-
-    for (int n = 0; n < numCallers_; ++n) {
-      int diff = reinterpret_cast<intptr_t>(callers_[n]) -
-        reinterpret_cast<intptr_t>(bt.callers_[n]);
-      if (diff != 0) {
-        return diff;
-      }
-    }
-
-    return 0;
+  const Backtrace& getBacktrace() const {
+    return backtrace_;
   }
 
-  void print(FILE *f, int indent=0, int start=0) const {
-    char **strings = backtrace_symbols(callers_, numCallers_);
-    if (strings) {
-      start += skip_;
-      if (start < 0) {
-        start = 0;
-      }
-      for (int n = start; n < numCallers_; ++n) {
-        fprintf(f, "%*s#%-2d %s\n", indent, "", n, strings[n]);
-      }
-      free(strings);
-    } else {
-      fprintf(f, "%*s<failed to determine symbols>\n", indent, "");
-    }
+  const char* getTypeName() const {
+    return type1_->name();
   }
 
-  int getDepth() const {
-    return numCallers_ - skip_;
+  const char* getTypeName2() const {
+    return type2_ != NULL ? type2_->name() : "";
   }
 
-  void *getFrame(int index) const {
-    int adjusted_index = index + skip_;
-    if (adjusted_index < 0 || adjusted_index >= numCallers_) {
-      return NULL;
+  bool operator<(const Key& k) const {
+    int ret = backtrace_.cmp(k.backtrace_);
+    if (ret != 0) {
+      return ret < 0;
+    }
+    if (*type1_ != *k.type1_) {
+      return type1_->before(*k.type1_);
+    }
+    if (type2_ == NULL || k.type2_ == NULL) {
+      return type2_ == NULL && k.type2_ != NULL;
     }
-    return callers_[adjusted_index];
+    return type2_->before(*k.type2_);
   }
 
  private:
-  void *callers_[MAX_STACK_DEPTH];
-  int numCallers_;
-  int skip_;
+  Backtrace backtrace_;
+  const std::type_info* type1_;
+  const std::type_info* type2_;
 };
 
-// Define the constructors non-inline, so they consistently add a single
-// frame to the stack trace, regardless of whether optimization is enabled
-Backtrace::Backtrace(int skip)
-  : skip_(skip + 1) // ignore the constructor itself
-{
-  numCallers_ = backtrace(callers_, MAX_STACK_DEPTH);
-  if (skip_ > numCallers_) {
-    skip_ = numCallers_;
-  }
-}
-
-Backtrace::Backtrace(Backtrace const &bt)
-  : numCallers_(bt.numCallers_)
-  , skip_(bt.skip_) {
-  if (numCallers_ >= 0) {
-    memcpy(callers_, bt.callers_, numCallers_ * sizeof(void*));
-  }
-}
+typedef std::map<Key, int64_t> BacktraceMap;
 
 /**
- * A backtrace, plus one or two type names
+ * What one thread has recorded.
+ *
+ * Only its own thread adds to a shard, so its lock is only contended while
+ * a profile is printed or reset.  A shard outlives its thread, there being
+ * no portable hook for a thread's exit; server threads live as long as the
+ * server, so this costs little.
  */
-class Key {
- public:
-  class Hash {
-   public:
-    size_t operator()(Key const& k) const {
-      return k.hash();
-    }
-  };
-
-  Key(const Backtrace* bt, const std::type_info& type_info)
-    : backtrace_(bt)
-    , typeName1_(type_info.name())
-    , typeName2_(NULL) {
+struct Shard {
+  Shard() : dropped(0) {
+    pthread_mutex_init(&mutex, NULL);
   }
 
-  Key(const Backtrace* bt, const std::type_info& type_info1,
-      const std::type_info& type_info2)
-    : backtrace_(bt)
-    , typeName1_(type_info1.name())
-    , typeName2_(type_info2.name()) {
-  }
+  pthread_mutex_t mutex;
 
-  Key(const Key& k)
-    : backtrace_(k.backtrace_)
-    , typeName1_(k.typeName1_)
-    , typeName2_(k.typeName2_) {
-  }
+  /// Calls from T_VIRTUAL_CALL()
+  BacktraceMap virtualCalls;
 
-  void operator=(const Key& k) {
-    backtrace_ = k.backtrace_;
-    typeName1_ = k.typeName1_;
-    typeName2_ = k.typeName2_;
-  }
+  /// Calls from T_GENERIC_PROTOCOL()
+  BacktraceMap genericCalls;
 
-  const Backtrace* getBacktrace() const {
-    return backtrace_;
-  }
+  int64_t dropped;
+};
 
-  const char* getTypeName() const {
-    return typeName1_;
+class PthreadGuard {
+ public:
+  explicit PthreadGuard(pthread_mutex_t* mutex) : mutex_(mutex) {
+    pthread_mutex_lock(mutex_);
   }
+  ~PthreadGuard() { pthread_mutex_unlock(mutex_); }
 
-  const char* getTypeName2() const {
-    return typeName2_;
-  }
+ private:
+  pthread_mutex_t* mutex_;
+};
 
-  void makePersistent() {
-    // Copy the Backtrace object
-    backtrace_ = new Backtrace(*backtrace_);
+// Plain pthread mutexes, so that taking them is never profiled itself
+pthread_mutex_t shardsMutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<Shard*> shards;
 
-    // NOTE: We don't copy the type name.
-    // The GNU libstdc++ implementation of type_info::name() returns a value
-    // that will be valid for the lifetime of the program.  (Although the C++
-    // standard doesn't guarantee this will be true on all implementations.)
-  }
+THRIFT_THREAD_LOCAL Shard* threadShard = NULL;
 
-  /**
-   * Clean up memory allocated by makePersistent()
-   *
-   * Should only be invoked if makePersistent() has previously been called.
-   * The Key should no longer be used after cleanup() is called.
-   */
-  void cleanup() {
-    delete backtrace_;
-    backtrace_ = NULL;
+/// Calls left until this thread next takes a sample
+THRIFT_THREAD_LOCAL int32_t sampleCountdown = 0;
+
+Shard* shard() {
+  if (threadShard == NULL) {
+    Shard* s = new Shard;
+    PthreadGuard g(&shardsMutex);
+    shards.push_back(s);
+    threadShard = s;
   }
+  return threadShard;
+}
 
-  int cmp(const Key& k) const {
-    int ret = backtrace_->cmp(*k.backtrace_);
-    if (ret != 0) {
-      return ret;
-    }
+void record(BacktraceMap Shard::*map, const Key& k, int64_t calls) {
+  Shard* s = shard();
+  PthreadGuard g(&s->mutex);
 
-    // NOTE: We compare just the name pointers.
-    // With GNU libstdc++, every type_info object for the same type points to
-    // exactly the same name string.  (Although this isn't guaranteed by the
-    // C++ standard.)
-    ret = k.typeName1_ - typeName1_;
-    if (ret != 0) {
-      return ret;
+  BacktraceMap& entries = s->*map;
+  BacktraceMap::iterator it = entries.find(k);
+  if (it == entries.end()) {
+    if (entries.size() >= MAX_SITES) {
+      s->dropped += calls;
+      return;
     }
-    return k.typeName2_ - typeName2_;
+    it = entries.insert(std::make_pair(k, 0)).first;
   }
+  it->second += calls;
+}
+
+/// Every thread's shard merged into one, taken under all of their locks
+struct Snapshot {
+  Snapshot() : dropped(0) {}
+
+  BacktraceMap virtualCalls;
+  BacktraceMap genericCalls;
+  int64_t dropped;
+};
 
-  bool operator==(const Key& k) const {
-    return cmp(k) == 0;
+void merge(BacktraceMap& into, const BacktraceMap& from) {
+  for (BacktraceMap::const_iterator it = from.begin(); it != from.end(); ++it) {
+    into[it->first] += it->second;
   }
+}
 
-  size_t hash() const {
-    // NOTE: As above, we just use the name pointer value.
-    // Works with GNU libstdc++, but not guaranteed to be correct on all
-    // implementations.
-    return backtrace_->hash() ^
-      reinterpret_cast<size_t>(typeName1_) ^
-      reinterpret_cast<size_t>(typeName2_);
+void takeSnapshot(Snapshot& snapshot) {
+  PthreadGuard g(&shardsMutex);
+  for (size_t i = 0; i < shards.size(); ++i) {
+    PthreadGuard sg(&shards[i]->mutex);
+    merge(snapshot.virtualCalls, shards[i]->virtualCalls);
+    merge(snapshot.genericCalls, shards[i]->genericCalls);
+    snapshot.dropped += shards[i]->dropped;
   }
+}
 
- private:
-  const Backtrace* backtrace_;
-  const char* typeName1_;
-  const char* typeName2_;
-};
+typedef std::vector< std::pair<Key, int64_t> > BacktraceVector;
+
+bool countGreater(const std::pair<Key, int64_t>& bt1,
+                  const std::pair<Key, int64_t>& bt2) {
+  return bt1.second > bt2.second;
+}
 
 /**
- * A functor that determines which of two BacktraceMap entries
- * has a higher count.
+ * Write a BacktraceMap as Google CPU profiler binary data.
  */
-class CountGreater {
- public:
-  bool operator()(std::pair<Key, size_t> bt1,
-                  std::pair<Key, size_t> bt2) const {
-    return bt1.second > bt2.second;
+void writePprofFile(FILE* f, BacktraceMap const& map) {
+  std::vector< std::pair<const Backtrace*, uintptr_t> > samples;
+  samples.reserve(map.size());
+  for (BacktraceMap::const_iterator it = map.begin(); it != map.end(); ++it) {
+    samples.push_back(std::make_pair(&it->first.getBacktrace(),
+                                     static_cast<uintptr_t>(it->second)));
   }
-};
+  profile_write_pprof_samples(f, samples);
+}
+
+}
 
-typedef __gnu_cxx::hash_map<Key, size_t, Key::Hash> BacktraceMap;
+int32_t profile_sample_rate = 0;
+
+void profile_set_sample_rate(int32_t sampleRate) {
+  int32_t rate = sampleRate > 0 ? sampleRate : 0;
+  concurrency::atomicStore<concurrency::ATOMIC_RELAXED>(&profile_sample_rate, rate);
+}
 
 /**
- * A map describing how many times T_VIRTUAL_CALL() has been invoked.
+ * Record one in every profile_sample_rate of this thread's avoidable
+ * virtual calls, as that many calls.
+ *
+ * This method is invoked by the T_VIRTUAL_CALL() macro while sampling.
  */
-BacktraceMap virtual_calls;
-Mutex virtual_calls_mutex;
+void profile_sample_virtual_call(const std::type_info& type) {
+  if (--sampleCountdown > 0) {
+    return;
+  }
+  int32_t rate = profile_sampling();
+  sampleCountdown = rate;
+  if (rate == 0) {
+    return; // turned off since the macro looked
+  }
+
+  int const skip = 1; // ignore this frame
+  Backtrace bt(skip);
+  record(&Shard::virtualCalls, Key(bt, type), rate);
+}
 
 /**
- * A map describing how many times T_GENERIC_PROTOCOL() has been invoked.
+ * Record one in every profile_sample_rate of this thread's calls to a
+ * template processor with a protocol other than its template parameter, as
+ * that many calls.
+ *
+ * This method is invoked by the T_GENERIC_PROTOCOL() macro while sampling.
  */
-BacktraceMap generic_calls;
-Mutex generic_calls_mutex;
-
-
-void _record_backtrace(BacktraceMap* map, const Mutex& mutex, Key *k) {
-  Guard guard(mutex);
-
-  BacktraceMap::iterator it = map->find(*k);
-  if (it == map->end()) {
-    k->makePersistent();
-    map->insert(std::make_pair(*k, 1));
-  } else {
-    // increment the count
-    // NOTE: we could assert if it->second is 0 afterwards, since that would
-    // mean we've wrapped.
-    ++(it->second);
+void profile_sample_generic_protocol(const std::type_info& template_type,
+                                     const std::type_info& prot_type) {
+  if (--sampleCountdown > 0) {
+    return;
+  }
+  int32_t rate = profile_sampling();
+  sampleCountdown = rate;
+  if (rate == 0) {
+    return; // turned off since the macro looked
   }
+
+  int const skip = 1; // ignore this frame
+  Backtrace bt(skip);
+  record(&Shard::genericCalls, Key(bt, template_type, prot_type), rate);
 }
 
 /**
@@ -302,8 +273,7 @@ void _record_backtrace(BacktraceMap* map, const Mutex& mutex, Key *k) {
 void profile_virtual_call(const std::type_info& type) {
   int const skip = 1; // ignore this frame
   Backtrace bt(skip);
-  Key k(&bt, type);
-  _record_backtrace(&virtual_calls, virtual_calls_mutex, &k);
+  record(&Shard::virtualCalls, Key(bt, type), 1);
 }
 
 /**
@@ -316,22 +286,29 @@ void profile_generic_protocol(const std::type_info& template_type,
                               const std::type_info& prot_type) {
   int const skip = 1; // ignore this frame
   Backtrace bt(skip);
-  Key k(&bt, template_type, prot_type);
-  _record_backtrace(&generic_calls, generic_calls_mutex, &k);
+  record(&Shard::genericCalls, Key(bt, template_type, prot_type), 1);
+}
+
+/**
+ * Discard everything recorded so far.
+ */
+void profile_reset() {
+  PthreadGuard g(&shardsMutex);
+  for (size_t i = 0; i < shards.size(); ++i) {
+    PthreadGuard sg(&shards[i]->mutex);
+    shards[i]->virtualCalls.clear();
+    shards[i]->genericCalls.clear();
+    shards[i]->dropped = 0;
+  }
 }
 
 /**
  * Print the recorded profiling information to the specified file.
  */
 void profile_print_info(FILE* f) {
-  typedef std::vector< std::pair<Key, size_t> > BacktraceVector;
-
-  CountGreater is_greater;
-
-  // Grab both locks for the duration of the print operation,
-  // to ensure the output is a consistent snapshot of a single point in time
-  Guard generic_calls_guard(generic_calls_mutex);
-  Guard virtual_calls_guard(virtual_calls_mutex);
+  // Snapshot every thread at once, so the output is consistent
+  Snapshot snapshot;
+  takeSnapshot(snapshot);
 
   // print the info from generic_calls, sorted by frequency
   //
@@ -339,33 +316,39 @@ void profile_print_info(FILE* f) {
   // useful in some cases.  All T_GENERIC_PROTOCOL calls can be eliminated
   // from most programs.  Not all T_VIRTUAL_CALLs will be eliminated by
   // converting to templates.
-  BacktraceVector gp_sorted(generic_calls.begin(), generic_calls.end());
-  std::sort(gp_sorted.begin(), gp_sorted.end(), is_greater);
+  BacktraceVector gp_sorted(snapshot.genericCalls.begin(),
+                            snapshot.genericCalls.end());
+  std::sort(gp_sorted.begin(), gp_sorted.end(), countGreater);
 
   for (BacktraceVector::const_iterator it = gp_sorted.begin();
        it != gp_sorted.end();
        ++it) {
     Key const &key = it->first;
-    size_t const count = it->second;
-    fprintf(f, "T_GENERIC_PROTOCOL: %zu calls to %s with a %s:\n",
-            count, key.getTypeName(), key.getTypeName2());
-    key.getBacktrace()->print(f, 2);
+    fprintf(f, "T_GENERIC_PROTOCOL: %lld calls to %s with a %s:\n",
+            (long long) it->second, key.getTypeName(), key.getTypeName2());
+    key.getBacktrace().print(f, 2);
     fprintf(f, "\n");
   }
 
   // print the info from virtual_calls, sorted by frequency
-  BacktraceVector vc_sorted(virtual_calls.begin(), virtual_calls.end());
-  std::sort(vc_sorted.begin(), vc_sorted.end(), is_greater);
+  BacktraceVector vc_sorted(snapshot.virtualCalls.begin(),
+                            snapshot.virtualCalls.end());
+  std::sort(vc_sorted.begin(), vc_sorted.end(), countGreater);
 
   for (BacktraceVector::const_iterator it = vc_sorted.begin();
        it != vc_sorted.end();
        ++it) {
     Key const &key = it->first;
-    size_t const count = it->second;
-    fprintf(f, "T_VIRTUAL_CALL: %zu calls on %s:\n", count, key.getTypeName());
-    key.getBacktrace()->print(f, 2);
+    fprintf(f, "T_VIRTUAL_CALL: %lld calls on %s:\n",
+            (long long) it->second, key.getTypeName());
+    key.getBacktrace().print(f, 2);
     fprintf(f, "\n");
   }
+
+  if (snapshot.dropped > 0) {
+    fprintf(f, "%lld calls dropped past %lu stacks in a thread\n",
+            (long long) snapshot.dropped, (unsigned long) MAX_SITES);
+  }
 }
 
 /**
@@ -375,49 +358,6 @@ void profile_print_info() {
   profile_print_info(stdout);
 }
 
-/**
- * Write a BacktraceMap as Google CPU profiler binary data.
- */
-static void profile_write_pprof_file(FILE* f, BacktraceMap const& map) {
-  // Write the header
-  uintptr_t header[5] = { 0, 3, 0, 0, 0 };
-  fwrite(&header, sizeof(header), 1, f);
-
-  // Write the profile records
-  for (BacktraceMap::const_iterator it = map.begin(); it != map.end(); ++it) {
-    uintptr_t count = it->second;
-    fwrite(&count, sizeof(count), 1, f);
-
-    Backtrace const* bt = it->first.getBacktrace();
-    uintptr_t num_pcs = bt->getDepth();
-    fwrite(&num_pcs, sizeof(num_pcs), 1, f);
-
-    for (uintptr_t n = 0; n < num_pcs; ++n) {
-      void* pc = bt->getFrame(n);
-      fwrite(&pc, sizeof(pc), 1, f);
-    }
-  }
-
-  // Write the trailer
-  uintptr_t trailer[3] = { 0, 1, 0 };
-  fwrite(&trailer, sizeof(trailer), 1, f);
-
-  // Write /proc/self/maps
-  // TODO(simpkins): This only works on linux
-  FILE *proc_maps = fopen("/proc/self/maps", "r");
-  if (proc_maps) {
-    uint8_t buf[4096];
-    while (true) {
-      size_t bytes_read = fread(buf, 1, sizeof(buf), proc_maps);
-      if (bytes_read == 0) {
-        break;
-      }
-      fwrite(buf, 1, bytes_read, f);
-    }
-    fclose(proc_maps);
-  }
-}
-
 /**
  * Write the recorded profiling information as pprof files.
  *
@@ -434,22 +374,16 @@ static void profile_write_pprof_file(FILE* f, BacktraceMap const& map) {
  *                        profile_virtual_call() will be written to this file.
  */
 void profile_write_pprof(FILE* gen_calls_f, FILE* virtual_calls_f) {
-  typedef std::vector< std::pair<Key, size_t> > BacktraceVector;
-
-  CountGreater is_greater;
-
-  // Grab both locks for the duration of the print operation,
-  // to ensure the output is a consistent snapshot of a single point in time
-  Guard generic_calls_guard(generic_calls_mutex);
-  Guard virtual_calls_guard(virtual_calls_mutex);
+  Snapshot snapshot;
+  takeSnapshot(snapshot);
 
   // write the info from generic_calls
-  profile_write_pprof_file(gen_calls_f, generic_calls);
+  writePprofFile(gen_calls_f, snapshot.genericCalls);
 
   // write the info from virtual_calls
-  profile_write_pprof_file(virtual_calls_f, virtual_calls);
+  writePprofFile(virtual_calls_f, snapshot.virtualCalls);
 }
 
 }} // apache::thrift
 
-#endif // T_GLOBAL_PROFILE_VIRTUAL > 0
+#endif // T_GLOBAL_DEBUG_VIRTUAL > 1 || !THRIFT_NO_VIRTUAL_PROFILING
@@ -19,6 +19,7 @@
 #ifndef _THRIFT_ASYNC_TASYNCDISPATCHPROCESSOR_H_
 #define _THRIFT_ASYNC_TASYNCDISPATCHPROCESSOR_H_ 1
 
+#include <thrift/TDispatchProcessor.h>
 #include <thrift/async/TAsyncProcessor.h>
 
 namespace apache { namespace thrift { namespace async {
@@ -38,9 +39,9 @@ class TAsyncDispatchProcessorT : public TAsyncProcessor {
     protocol::TProtocol* inRaw = in.get();
     protocol::TProtocol* outRaw = out.get();
 
-    // Try to dynamic cast to the template protocol type
-    Protocol_* specificIn = dynamic_cast<Protocol_*>(inRaw);
-    Protocol_* specificOut = dynamic_cast<Protocol_*>(outRaw);
+    // Try to cast to the template protocol type
+    Protocol_* specificIn = specificProtocol<Protocol_>(inRaw);
+    Protocol_* specificOut = specificProtocol<Protocol_>(outRaw);
     if (specificIn && specificOut) {
       return processFast(_return, specificIn, specificOut);
     }
@@ -85,6 +85,19 @@ class TAsyncProcessorFactory {
       const TConnectionInfo& connInfo) = 0;
 };
 
+class TSingletonAsyncProcessorFactory : public TAsyncProcessorFactory {
+ public:
+  TSingletonAsyncProcessorFactory(boost::shared_ptr<TAsyncProcessor> processor) :
+      processor_(processor) {}
+
+  boost::shared_ptr<TAsyncProcessor> getProcessor(const TConnectionInfo&) {
+    return processor_;
+  }
+
+ private:
+  boost::shared_ptr<TAsyncProcessor> processor_;
+};
+
 
 
 }}} // apache::thrift::async
@@ -0,0 +1,150 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_ASYNC_TCONCURRENTCLIENTSYNCINFO_H_
+#define _THRIFT_ASYNC_TCONCURRENTCLIENTSYNCINFO_H_ 1
+
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/concurrency/Monitor.h>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <string>
+#include <map>
+
+namespace apache { namespace thrift { namespace async {
+
+class TConcurrentClientSyncInfo;
+
+/**
+ * Holds the write mutex of a TConcurrentClientSyncInfo while a request is
+ * written.  If the sentry goes away without commit() having been called the
+ * connection is left in an unknown state, so every caller is failed.
+ */
+class TConcurrentSendSentry {
+ public:
+  explicit TConcurrentSendSentry(TConcurrentClientSyncInfo* sync);
+  ~TConcurrentSendSentry();
+
+  void commit();
+
+ private:
+  TConcurrentClientSyncInfo& sync_;
+  bool committed_;
+};
+
+/**
+ * Holds the read mutex of a TConcurrentClientSyncInfo while a caller waits
+ * for, and reads, the reply with its seqid.  Destroying it hands the
+ * connection to another waiting caller, or fails all of them if commit()
+ * wasn't called.
+ */
+class TConcurrentRecvSentry {
+ public:
+  TConcurrentRecvSentry(TConcurrentClientSyncInfo* sync, int32_t seqid);
+  ~TConcurrentRecvSentry();
+
+  void commit();
+
+ private:
+  TConcurrentClientSyncInfo& sync_;
+  int32_t seqid_;
+  bool committed_;
+};
+
+/**
+ * Synchronization state shared by the threads using one generated
+ * ConcurrentClient.
+ *
+ * Each call gets a unique seqid.  Writers serialize on the write mutex.
+ * Readers take turns on the read mutex: whoever holds it reads the next
+ * message header, and if the reply belongs to somebody else it is parked
+ * as "pending" and its owner is woken up to read the body.
+ */
+class TConcurrentClientSyncInfo {
+ private:
+  typedef boost::shared_ptr<apache::thrift::concurrency::Monitor> MonitorPtr;
+  typedef std::map<int32_t, MonitorPtr> MonitorMap;
+
+ public:
+  TConcurrentClientSyncInfo();
+
+  /// Allocate the seqid for a new call.
+  int32_t generateSeqId();
+
+  /**
+   * Take the message header another caller parked for us, if any.
+   *
+   * @return true if fname, mtype and rseqid were filled in.
+   */
+  bool getPending(std::string& fname,
+                  apache::thrift::protocol::TMessageType& mtype,
+                  int32_t& rseqid); /* requires readMutex_ */
+
+  /// Park a message header for its owner and wake the owner up.
+  void updatePending(const std::string& fname,
+                     apache::thrift::protocol::TMessageType mtype,
+                     int32_t rseqid); /* requires readMutex_ */
+
+  /// Wait until the reply for seqid is pending, or somebody must read.
+  void waitForWork(int32_t seqid); /* requires readMutex_ */
+
+  apache::thrift::concurrency::Mutex& getReadMutex() { return readMutex_; }
+  apache::thrift::concurrency::Mutex& getWriteMutex() { return writeMutex_; }
+
+ private:
+  // Free monitors kept for reuse
+  enum { MONITOR_CACHE_SIZE = 10 };
+
+  friend class TConcurrentSendSentry;
+  friend class TConcurrentRecvSentry;
+
+  void throwBadSeqId_();
+  void throwDeadConnection_();
+
+  void wakeupAnyone_(const apache::thrift::concurrency::Guard& seqidGuard);
+  void markBad_(const apache::thrift::concurrency::Guard& seqidGuard);
+  MonitorPtr newMonitor_(const apache::thrift::concurrency::Guard& seqidGuard);
+  void deleteMonitor_(const apache::thrift::concurrency::Guard& seqidGuard,
+                      MonitorPtr& m);
+
+  bool stop_;
+
+  apache::thrift::concurrency::Mutex seqidMutex_;
+  // begin seqidMutex_ protected members
+  int32_t nextseqid_;
+  MonitorMap seqidToMonitorMap_;
+  std::vector<MonitorPtr> freeMonitors_;
+  // end seqidMutex_ protected members
+
+  apache::thrift::concurrency::Mutex writeMutex_;
+
+  apache::thrift::concurrency::Mutex readMutex_;
+  // begin readMutex_ protected members
+  bool recvPending_;
+  bool wakeupSomeone_;
+  int32_t seqidPending_;
+  std::string fnamePending_;
+  apache::thrift::protocol::TMessageType mtypePending_;
+  // end readMutex_ protected members
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_ASYNC_TCONCURRENTCLIENTSYNCINFO_H_
@@ -0,0 +1,426 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_ASYNC_TCOROUTINE_H_
+#define _THRIFT_ASYNC_TCOROUTINE_H_ 1
+
+#if !defined(__cpp_impl_coroutine)
+#error "thrift/async/TCoroutine.h needs C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <boost/noncopyable.hpp>
+#include <thrift/Thrift.h>
+#include <thrift/async/TAsyncChannel.h>
+
+/**
+ * Coroutine support for code generated with the coroutines option, which
+ * needs C++20.  Nothing in the library is built with it; this header is all
+ * there is.
+ *
+ * Client methods co_foo() return a TTask that sends the call when awaited
+ * and gives back the result, or throws what recv_foo() would.  Handlers
+ * implement FooCoroSvIf, whose methods are coroutines returning TTasks, and
+ * FooCoroSvAdapter runs them under the FooAsyncProcessor.
+ */
+
+namespace apache { namespace thrift { namespace async {
+
+/**
+ * Free lists of coroutine frames by size, so that a call's frames are
+ * recycled rather than taken from the heap.  Frames come from the pool of
+ * the innermost TCoroutineFramePoolScope on the thread, or else from the
+ * thread's own pool, and go back to the pool they came from.
+ *
+ * A generated client has a pool of its own, used for the frames of its
+ * calls.  Servers driving handlers from one event loop thread per
+ * connection get the thread's pool.  A pool is not thread safe, and must
+ * outlive the frames taken from it.
+ */
+class TCoroutineFramePool : boost::noncopyable {
+ public:
+  /// Frames are kept in free lists of sizes rounded up to this
+  static const size_t GRANULARITY = 64;
+  /// Larger frames come from the heap every time
+  static const size_t MAX_POOLED_SIZE = 4096;
+  /// Frames kept of each size, beyond which they are freed
+  static const size_t MAX_FREE_PER_SIZE = 64;
+
+  TCoroutineFramePool() : numAllocated_(0) {
+    for (size_t i = 0; i < NUM_SIZES; ++i) {
+      free_[i] = NULL;
+      numFree_[i] = 0;
+    }
+  }
+
+  ~TCoroutineFramePool() {
+    for (size_t i = 0; i < NUM_SIZES; ++i) {
+      while (free_[i] != NULL) {
+        Header* header = free_[i];
+        free_[i] = header->next;
+        std::free(header);
+      }
+    }
+  }
+
+  void* allocate(size_t size) {
+    size_t index = sizeIndex(size);
+    Header* header;
+    if (index < NUM_SIZES && free_[index] != NULL) {
+      header = free_[index];
+      free_[index] = header->next;
+      --numFree_[index];
+    } else {
+      size_t total = index < NUM_SIZES ? (index + 1) * GRANULARITY : sizeof(Header) + size;
+      header = static_cast<Header*>(std::malloc(total));
+      if (header == NULL) {
+        throw std::bad_alloc();
+      }
+    }
+    header->pool = this;
+    ++numAllocated_;
+    return header + 1;
+  }
+
+  /// Give a frame of this size back to the pool it came from
+  static void deallocate(void* frame, size_t size) {
+    Header* header = static_cast<Header*>(frame) - 1;
+    TCoroutineFramePool* pool = header->pool;
+    --pool->numAllocated_;
+    size_t index = sizeIndex(size);
+    if (index < NUM_SIZES && pool->numFree_[index] < MAX_FREE_PER_SIZE) {
+      header->next = pool->free_[index];
+      pool->free_[index] = header;
+      ++pool->numFree_[index];
+      return;
+    }
+    std::free(header);
+  }
+
+  /// Frames taken and not yet given back
+  size_t getNumAllocated() const { return numAllocated_; }
+
+  /// Frames kept for reuse
+  size_t getNumFree() const {
+    size_t total = 0;
+    for (size_t i = 0; i < NUM_SIZES; ++i) {
+      total += numFree_[i];
+    }
+    return total;
+  }
+
+  /// The pool of the innermost TCoroutineFramePoolScope, or the thread's
+  static TCoroutineFramePool* current() {
+    if (current_ != NULL) {
+      return current_;
+    }
+    static thread_local TCoroutineFramePool threadPool;
+    return &threadPool;
+  }
+
+ private:
+  friend class TCoroutineFramePoolScope;
+
+  // Put in front of each frame; keeps it aligned for anything
+  union alignas(std::max_align_t) Header {
+    TCoroutineFramePool* pool;
+    Header* next;
+  };
+
+  static const size_t NUM_SIZES = MAX_POOLED_SIZE / GRANULARITY;
+
+  static size_t sizeIndex(size_t size) {
+    return (sizeof(Header) + size - 1) / GRANULARITY;
+  }
+
+  static inline thread_local TCoroutineFramePool* current_ = NULL;
+
+  Header* free_[NUM_SIZES];
+  size_t numFree_[NUM_SIZES];
+  size_t numAllocated_;
+};
+
+/**
+ * Makes pool the one coroutine frames come from on this thread for the
+ * life of the scope, restoring whichever was current before.  Scopes nest.
+ */
+class TCoroutineFramePoolScope : boost::noncopyable {
+ public:
+  explicit TCoroutineFramePoolScope(TCoroutineFramePool& pool)
+    : previous_(TCoroutineFramePool::current_) {
+    TCoroutineFramePool::current_ = &pool;
+  }
+
+  ~TCoroutineFramePoolScope() { TCoroutineFramePool::current_ = previous_; }
+
+ private:
+  TCoroutineFramePool* previous_;
+};
+
+template <class T = void>
+class TTask;
+
+namespace detail {
+
+// What every promise here shares: frames from the pool, and the coroutine
+// to go back to once done
+struct TPooledPromise {
+  static void* operator new(size_t size) {
+    return TCoroutineFramePool::current()->allocate(size);
+  }
+
+  static void operator delete(void* frame, size_t size) {
+    TCoroutineFramePool::deallocate(frame, size);
+  }
+};
+
+struct TTaskPromiseBase : TPooledPromise {
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> task) noexcept {
+      std::coroutine_handle<> continuation = task.promise().continuation;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return std::suspend_always(); }
+  FinalAwaiter final_suspend() const noexcept { return FinalAwaiter(); }
+
+  void unhandled_exception() { exception = std::current_exception(); }
+
+  std::coroutine_handle<> continuation;
+  std::exception_ptr exception;
+};
+
+template <class T>
+struct TTaskPromise : TTaskPromiseBase {
+  TTask<T> get_return_object();
+
+  template <class U>
+  void return_value(U&& result) {
+    value.emplace(std::forward<U>(result));
+  }
+
+  T result() {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+    return std::move(*value);
+  }
+
+  std::optional<T> value;
+};
+
+template <>
+struct TTaskPromise<void> : TTaskPromiseBase {
+  TTask<void> get_return_object();
+
+  void return_void() {}
+
+  void result() {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+};
+
+} // detail
+
+/**
+ * A coroutine producing a T.  It starts when first awaited, and resumes the
+ * awaiting coroutine with its result or exception when done.  A task is
+ * awaited once.
+ */
+template <class T>
+class TTask {
+ public:
+  typedef detail::TTaskPromise<T> promise_type;
+
+  TTask(TTask&& that) noexcept : coroutine_(that.coroutine_) {
+    that.coroutine_ = nullptr;
+  }
+
+  TTask& operator=(TTask&& that) noexcept {
+    std::swap(coroutine_, that.coroutine_);
+    return *this;
+  }
+
+  ~TTask() {
+    if (coroutine_) {
+      coroutine_.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    coroutine_.promise().continuation = awaiting;
+    return coroutine_;
+  }
+
+  T await_resume() { return coroutine_.promise().result(); }
+
+ private:
+  friend struct detail::TTaskPromise<T>;
+
+  explicit TTask(std::coroutine_handle<promise_type> coroutine) : coroutine_(coroutine) {}
+
+  TTask(const TTask&) = delete;
+  TTask& operator=(const TTask&) = delete;
+
+  std::coroutine_handle<promise_type> coroutine_;
+};
+
+namespace detail {
+
+template <class T>
+TTask<T> TTaskPromise<T>::get_return_object() {
+  return TTask<T>(std::coroutine_handle<TTaskPromise<T> >::from_promise(*this));
+}
+
+inline TTask<void> TTaskPromise<void>::get_return_object() {
+  return TTask<void>(std::coroutine_handle<TTaskPromise<void> >::from_promise(*this));
+}
+
+inline void logTaskError(std::exception_ptr error) {
+  try {
+    std::rethrow_exception(error);
+  } catch (const std::exception& e) {
+    GlobalOutput.printf("TCoroutine: exception in a detached task: %s", e.what());
+  } catch (...) {
+    GlobalOutput.printf("TCoroutine: unknown exception in a detached task");
+  }
+}
+
+// A coroutine nobody awaits: runs as soon as called and frees itself
+struct TDetachedTask {
+  struct promise_type : TPooledPromise {
+    TDetachedTask get_return_object() const noexcept { return TDetachedTask(); }
+    std::suspend_never initial_suspend() const noexcept { return std::suspend_never(); }
+    std::suspend_never final_suspend() const noexcept { return std::suspend_never(); }
+    void return_void() const noexcept {}
+
+    void unhandled_exception() const noexcept {
+      logTaskError(std::current_exception());
+    }
+  };
+};
+
+template <class T, class Cob, class OnError>
+TDetachedTask runTask(TTask<T> task, Cob cob, OnError onError) {
+  std::exception_ptr error;
+  if constexpr (std::is_void<T>::value) {
+    try {
+      co_await task;
+    } catch (...) {
+      error = std::current_exception();
+    }
+    if (error) {
+      onError(error);
+    } else {
+      cob();
+    }
+  } else {
+    std::optional<T> result;
+    try {
+      result.emplace(co_await task);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    if (error) {
+      onError(error);
+    } else {
+      cob(*result);
+    }
+  }
+}
+
+} // detail
+
+/**
+ * Run task without awaiting it, calling cob with its result, or onError
+ * with the exception it ended with.  What cob or onError throw is logged.
+ */
+template <class T, class Cob, class OnError>
+void startTask(TTask<T> task, Cob cob, OnError onError) {
+  detail::runTask(std::move(task), std::move(cob), std::move(onError));
+}
+
+/**
+ * Run task without awaiting it, calling cob with its result.  An exception
+ * it ends with is logged.
+ */
+template <class T, class Cob>
+void startTask(TTask<T> task, Cob cob) {
+  detail::runTask(std::move(task), std::move(cob), detail::logTaskError);
+}
+
+/**
+ * Awaits a sendAndRecvMessage() on channel, or a sendMessage() if recvBuf
+ * is NULL, resuming from the channel's callback.
+ */
+class TChannelCall {
+ public:
+  TChannelCall(TAsyncChannel* channel,
+               apache::thrift::transport::TMemoryBuffer* sendBuf,
+               apache::thrift::transport::TMemoryBuffer* recvBuf)
+    : channel_(channel), sendBuf_(sendBuf), recvBuf_(recvBuf) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> awaiting) {
+    // The callback may run before this returns, and free us
+    TAsyncChannel::VoidCallback cob = [awaiting]() { awaiting.resume(); };
+    if (recvBuf_ != NULL) {
+      channel_->sendAndRecvMessage(cob, sendBuf_, recvBuf_);
+    } else {
+      channel_->sendMessage(cob, sendBuf_);
+    }
+  }
+
+  void await_resume() const noexcept {}
+
+ private:
+  TAsyncChannel* channel_;
+  apache::thrift::transport::TMemoryBuffer* sendBuf_;
+  apache::thrift::transport::TMemoryBuffer* recvBuf_;
+};
+
+/**
+ * Send a oneway call already written to sendBuf.
+ */
+inline TTask<void> sendOneway(TAsyncChannel* channel,
+                              apache::thrift::transport::TMemoryBuffer* sendBuf) {
+  co_await TChannelCall(channel, sendBuf, NULL);
+}
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_ASYNC_TCOROUTINE_H_
@@ -0,0 +1,260 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/async/TEvhttpPooledClientChannel.h>
+#include <evhttp.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/protocol/TProtocolException.h>
+
+#include <iostream>
+#include <sstream>
+
+using namespace apache::thrift::protocol;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
+
+namespace apache { namespace thrift { namespace async {
+
+
+TEvhttpPooledClientChannel::TEvhttpPooledClientChannel(
+    const std::string& host,
+    const std::string& path,
+    const char* address,
+    int port,
+    struct event_base* eb,
+    size_t maxConnections,
+    size_t maxInFlight)
+  : host_(host)
+  , path_(path)
+  , address_(address)
+  , port_(port)
+  , eb_(eb)
+  , maxConnections_(maxConnections > 0 ? maxConnections : 1)
+  , maxInFlight_(maxInFlight > 0 ? maxInFlight : 1)
+  , inFlight_(0)
+{}
+
+
+TEvhttpPooledClientChannel::~TEvhttpPooledClientChannel() {
+  // evhttp drops the requests still on a connection without calling back
+  for (size_t i = 0; i < conns_.size(); ++i) {
+    evhttp_connection_free(conns_[i]->conn);
+  }
+}
+
+
+void TEvhttpPooledClientChannel::sendAndRecvMessage(
+    const VoidCallback& cob,
+    apache::thrift::transport::TMemoryBuffer* sendBuf,
+    apache::thrift::transport::TMemoryBuffer* recvBuf) {
+  uint8_t* obuf;
+  uint32_t sz;
+  sendBuf->getBuffer(&obuf, &sz);
+
+  Call* call = newCall();
+  call->cob = cob;
+  call->recvBuf = recvBuf;
+
+  Connection* connection = queued_.empty() ? pickConnection() : NULL;
+  if (connection == NULL) {
+    call->request.assign(reinterpret_cast<const char*>(obuf), sz);
+    queued_.push_back(call);
+    return;
+  }
+  if (!send(call, connection, obuf, sz)) {
+    call->cob = VoidCallback();
+    spareCalls_.push_back(call);
+    throw TException("evhttp_make_request failed");
+  }
+}
+
+
+void TEvhttpPooledClientChannel::sendMessage(
+    const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message) {
+  (void) cob;
+  (void) message;
+  throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+			   "Unexpected call to TEvhttpPooledClientChannel::sendMessage");
+}
+
+
+void TEvhttpPooledClientChannel::recvMessage(
+    const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message) {
+  (void) cob;
+  (void) message;
+  throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+			   "Unexpected call to TEvhttpPooledClientChannel::recvMessage");
+}
+
+
+TEvhttpPooledClientChannel::Connection* TEvhttpPooledClientChannel::pickConnection() {
+  Connection* best = NULL;
+  for (size_t i = 0; i < conns_.size(); ++i) {
+    Connection* c = conns_[i].get();
+    if (c->inFlight < maxInFlight_ && (best == NULL || c->inFlight < best->inFlight)) {
+      best = c;
+    }
+  }
+  if (best != NULL && best->inFlight == 0) {
+    return best;
+  }
+
+  // Rather than wait behind another call, open one more
+  if (conns_.size() < maxConnections_) {
+#if defined(LIBEVENT_VERSION_NUMBER) && LIBEVENT_VERSION_NUMBER >= 0x02000000
+    // Before it is given a base, a libevent 2 connection would use the
+    // global one, which event_init() may never have made
+    struct evhttp_connection* conn =
+      evhttp_connection_base_new(eb_, NULL, address_.c_str(), static_cast<unsigned short>(port_));
+#else
+    struct evhttp_connection* conn = evhttp_connection_new(address_.c_str(), port_);
+    if (conn != NULL) {
+      evhttp_connection_set_base(conn, eb_);
+    }
+#endif
+    if (conn == NULL) {
+      throw TException("evhttp_connection_new failed");
+    }
+    boost::shared_ptr<Connection> c(new Connection);
+    c->conn = conn;
+    c->inFlight = 0;
+    conns_.push_back(c);
+    return c.get();
+  }
+  return best;
+}
+
+
+bool TEvhttpPooledClientChannel::send(Call* call, Connection* connection,
+                                      const uint8_t* body, uint32_t size) {
+  struct evhttp_request* req = evhttp_request_new(response, call);
+  if (req == NULL) {
+    return false;
+  }
+
+  if (evhttp_add_header(req->output_headers, "Host", host_.c_str()) != 0 ||
+      evhttp_add_header(req->output_headers, "Content-Type", "application/x-thrift") != 0 ||
+      evbuffer_add(req->output_buffer, body, size) != 0) {
+    evhttp_request_free(req);
+    return false;
+  }
+
+  if (evhttp_make_request(connection->conn, req, EVHTTP_REQ_POST, path_.c_str()) != 0) {
+    return false;
+  }
+  call->connection = connection;
+  ++connection->inFlight;
+  ++inFlight_;
+  return true;
+}
+
+
+void TEvhttpPooledClientChannel::sendQueued() {
+  while (!queued_.empty()) {
+    Connection* connection = pickConnection();
+    if (connection == NULL) {
+      return;
+    }
+    Call* call = queued_.front();
+    queued_.pop_front();
+    if (!send(call, connection,
+              reinterpret_cast<const uint8_t*>(call->request.data()),
+              static_cast<uint32_t>(call->request.size()))) {
+      finish(call, NULL);
+    }
+  }
+}
+
+
+TEvhttpPooledClientChannel::Call* TEvhttpPooledClientChannel::newCall() {
+  if (!spareCalls_.empty()) {
+    Call* call = spareCalls_.back();
+    spareCalls_.pop_back();
+    return call;
+  }
+  boost::shared_ptr<Call> call(new Call);
+  call->channel = this;
+  call->connection = NULL;
+  call->recvBuf = NULL;
+  calls_.push_back(call);
+  return call.get();
+}
+
+
+void TEvhttpPooledClientChannel::finish(Call* call, struct evhttp_request* req) {
+  if (call->connection != NULL) {
+    --call->connection->inFlight;
+    --inFlight_;
+    call->connection = NULL;
+  }
+
+  // The Call may be reused by the callback, so take what it needs first
+  VoidCallback cob = call->cob;
+  call->cob = VoidCallback();
+  TMemoryBuffer* recvBuf = call->recvBuf;
+  call->request.clear();
+  spareCalls_.push_back(call);
+
+  // Calls waiting go ahead of any the callback makes
+  sendQueued();
+
+  if (req != NULL && req->response_code == 200) {
+    recvBuf->resetBuffer(
+        EVBUFFER_DATA(req->input_buffer),
+        static_cast<uint32_t>(EVBUFFER_LENGTH(req->input_buffer)));
+    cob();
+    return;
+  }
+
+  std::string error("connect failed");
+  if (req != NULL && req->response_code != 0) {
+    std::stringstream ss;
+    ss << "server returned code " << req->response_code;
+    if (req->response_code_line) {
+      ss << ": " << req->response_code_line;
+    }
+    error = ss.str();
+  }
+
+  // With nothing to read, the client's recv_ throws END_OF_FILE; make
+  // that say what actually happened
+  recvBuf->resetBuffer();
+  try {
+    cob();
+  } catch(const TTransportException& e) {
+    if (e.getType() == TTransportException::END_OF_FILE) {
+      throw TException(error);
+    }
+    throw;
+  }
+}
+
+
+/* static */ void TEvhttpPooledClientChannel::response(struct evhttp_request* req, void* arg) {
+  Call* call = (Call*)arg;
+  try {
+    call->channel->finish(call, req);
+  } catch(std::exception& e) {
+    // don't propagate a C++ exception in C code (e.g. libevent)
+    std::cerr << "TEvhttpPooledClientChannel::response exception thrown (ignored): " << e.what() << std::endl;
+  }
+}
+
+
+}}} // apache::thrift::async
@@ -0,0 +1,139 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TEVHTTP_POOLED_CLIENT_CHANNEL_H_
+#define _THRIFT_TEVHTTP_POOLED_CLIENT_CHANNEL_H_ 1
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/async/TAsyncChannel.h>
+
+struct event_base;
+struct evhttp_connection;
+struct evhttp_request;
+
+namespace apache { namespace thrift { namespace transport {
+class TMemoryBuffer;
+}}}
+
+namespace apache { namespace thrift { namespace async {
+
+/**
+ * TAsyncChannel that spreads calls over a pool of keep-alive HTTP/1.1
+ * connections to one server.
+ *
+ * Like THttp2ClientChannel, and unlike TEvhttpClientChannel, any number of
+ * sendAndRecvMessage() calls may be outstanding, each callback running when
+ * its own response arrives.  evhttp sends one request at a time on a
+ * connection, so a call goes to the connection with the fewest calls on
+ * it, and a new connection is opened, up to the pool size, rather than
+ * queue behind another call.  A connection holds at most the in-flight
+ * limit of calls; beyond that calls wait in the channel, their requests
+ * kept in buffers reused from call to call.  Connections are opened as
+ * needed and reopened by evhttp after they drop.
+ */
+class TEvhttpPooledClientChannel : public TAsyncChannel {
+ public:
+  using TAsyncChannel::VoidCallback;
+
+  /// Default number of connections in the pool
+  static const size_t DEFAULT_MAX_CONNECTIONS = 8;
+
+  /**
+   * @param maxConnections the most connections opened to the server.
+   * @param maxInFlight the most calls given to one connection at a time,
+   *                    the rest being queued by evhttp behind the first.
+   */
+  TEvhttpPooledClientChannel(
+      const std::string& host,
+      const std::string& path,
+      const char* address,
+      int port,
+      struct event_base* eb,
+      size_t maxConnections = DEFAULT_MAX_CONNECTIONS,
+      size_t maxInFlight = 1);
+  ~TEvhttpPooledClientChannel();
+
+  virtual void sendAndRecvMessage(const VoidCallback& cob,
+                                  apache::thrift::transport::TMemoryBuffer* sendBuf,
+                                  apache::thrift::transport::TMemoryBuffer* recvBuf);
+
+  virtual void sendMessage(const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message);
+  virtual void recvMessage(const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message);
+
+  virtual bool good() const { return true; }
+  virtual bool error() const { return false; }
+  virtual bool timedOut() const { return false; }
+
+  // Connections opened so far, calls given to them and calls waiting for one
+  size_t getNumConnections() const { return conns_.size(); }
+  size_t getNumInFlight() const { return inFlight_; }
+  size_t getNumQueued() const { return queued_.size(); }
+
+ private:
+  struct Connection {
+    struct evhttp_connection* conn;
+    size_t inFlight;
+  };
+
+  struct Call {
+    TEvhttpPooledClientChannel* channel;
+    Connection* connection;
+    VoidCallback cob;
+    apache::thrift::transport::TMemoryBuffer* recvBuf;
+    /// The request while the call is queued; its capacity is kept for reuse
+    std::string request;
+  };
+
+  /// The connection to give the next call, or NULL if all are full
+  Connection* pickConnection();
+
+  /// Make the HTTP request for call on connection; false if evhttp failed
+  bool send(Call* call, Connection* connection, const uint8_t* body, uint32_t size);
+
+  /// Send queued calls while there are connections to take them
+  void sendQueued();
+
+  Call* newCall();
+  void finish(Call* call, struct evhttp_request* req);
+
+  static void response(struct evhttp_request* req, void* arg);
+
+  std::string host_;
+  std::string path_;
+  std::string address_;
+  int port_;
+  struct event_base* eb_;
+  size_t maxConnections_;
+  size_t maxInFlight_;
+
+  std::vector<boost::shared_ptr<Connection> > conns_;
+  size_t inFlight_;
+  std::deque<Call*> queued_;
+
+  /// Every Call made, and the ones not in use, for reuse
+  std::vector<boost::shared_ptr<Call> > calls_;
+  std::vector<Call*> spareCalls_;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_TEVHTTP_POOLED_CLIENT_CHANNEL_H_
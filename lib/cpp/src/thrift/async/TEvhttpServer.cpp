@@ -17,35 +17,200 @@
  * under the License.
  */
 
+#include <thrift/thrift-config.h>
+
 #include <thrift/async/TEvhttpServer.h>
 #include <thrift/async/TAsyncBufferProcessor.h>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/transport/PlatformSocket.h>
 #include <thrift/transport/TBufferTransports.h>
 #include <evhttp.h>
 
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #ifndef HTTP_INTERNAL // libevent < 2
 #define HTTP_INTERNAL 500
 #endif
 
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Mutex;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
 using apache::thrift::transport::TMemoryBuffer;
 
 namespace apache { namespace thrift { namespace async {
 
+namespace {
+
+const int LISTEN_BACKLOG = 1024;
+
+/// Response buffers each base keeps for reuse
+const size_t SPARE_BUFFERS = 64;
+
+/// Response buffers bigger than this are not kept
+const uint32_t SPARE_BUFFER_LIMIT = 1024 * 1024;
+
+}
+
 
 struct TEvhttpServer::RequestContext {
   struct evhttp_request* req;
   boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> ibuf;
   boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> obuf;
+  /// The embedded base the request came in on, if any
+  Base* base;
+  bool success;
+
+  RequestContext(struct evhttp_request* req, Base* base);
+};
+
+
+/**
+ * An embedded event base and its evhttp.  Completions made on another
+ * thread are queued here and picked up by the base's own thread.
+ */
+struct TEvhttpServer::Base {
+  TEvhttpServer* server;
+  struct event_base* eb;
+  struct evhttp* eh;
+  Thread::id_t threadId;
+  boost::shared_ptr<Thread> thread;
+
+  THRIFT_SOCKET notifyFds[2];
+  struct event* notifyEvent;
+
+  Mutex mutex;
+  std::vector<RequestContext*> completed;
+
+  /// Response buffers, reused from one request to the next
+  std::vector<boost::shared_ptr<TMemoryBuffer> > spareBuffers;
+  /// Hands each reply body to evhttp, which drains it
+  struct evbuffer* reply;
+
+  Base(TEvhttpServer* s)
+    : server(s)
+    , eb(NULL)
+    , eh(NULL)
+    , threadId(Thread::get_current())
+    , notifyEvent(NULL)
+    , reply(NULL) {
+    notifyFds[0] = THRIFT_INVALID_SOCKET;
+    notifyFds[1] = THRIFT_INVALID_SOCKET;
+  }
+
+  ~Base() {
+    if (notifyEvent != NULL) {
+      event_del(notifyEvent);
+      delete notifyEvent;
+    }
+    for (int i = 0; i < 2; ++i) {
+      if (notifyFds[i] != THRIFT_INVALID_SOCKET) {
+        ::THRIFT_CLOSESOCKET(notifyFds[i]);
+      }
+    }
+    for (size_t i = 0; i < completed.size(); ++i) {
+      delete completed[i];
+    }
+    if (reply != NULL) {
+      evbuffer_free(reply);
+    }
+    if (eh != NULL) {
+      evhttp_free(eh);
+    }
+    if (eb != NULL) {
+      event_base_free(eb);
+    }
+  }
+
+  void notify() {
+    char byte = 0;
+    if (send(notifyFds[1], &byte, 1, 0) < 0 && THRIFT_GET_SOCKET_ERROR != THRIFT_EAGAIN) {
+      GlobalOutput.perror("TEvhttpServer: notify send() ", THRIFT_GET_SOCKET_ERROR);
+    }
+  }
+};
+
+
+class TEvhttpServer::BaseRunner : public Runnable {
+ public:
+  BaseRunner(Base* base) : base_(base) {}
+
+  void run() {
+    base_->threadId = Thread::get_current();
+    event_base_dispatch(base_->eb);
+  }
 
-  RequestContext(struct evhttp_request* req);
+ private:
+  Base* base_;
 };
 
 
+#ifndef _WIN32
+/**
+ * Open a listen socket on port, with SO_REUSEPORT if reusePort so more
+ * can be bound to the same port.
+ */
+static THRIFT_SOCKET listenOn(int port, bool reusePort) {
+  struct addrinfo hints, *res;
+  char portStr[sizeof("65536") + 1];
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
+  sprintf(portStr, "%d", port);
+
+  int error = getaddrinfo(NULL, portStr, &hints, &res);
+  if (error) {
+    throw TException("TEvhttpServer: getaddrinfo " + std::string(THRIFT_GAI_STRERROR(error)));
+  }
+
+  THRIFT_SOCKET s = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (s == THRIFT_INVALID_SOCKET) {
+    freeaddrinfo(res);
+    throw TException("TEvhttpServer: socket() failed");
+  }
+  int one = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+  if (reusePort) {
+    setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  }
+#else
+  (void) reusePort;
+#endif
+  if (::bind(s, res->ai_addr, static_cast<int>(res->ai_addrlen)) == -1 ||
+      listen(s, LISTEN_BACKLOG) == -1 ||
+      evutil_make_socket_nonblocking(s) < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    ::THRIFT_CLOSESOCKET(s);
+    freeaddrinfo(res);
+    throw TException("TEvhttpServer: can't listen on port: " +
+                     TOutput::strerror_s(errno_copy));
+  }
+  freeaddrinfo(res);
+  return s;
+}
+#endif // !_WIN32
+
+
 TEvhttpServer::TEvhttpServer(boost::shared_ptr<TAsyncBufferProcessor> processor)
   : processor_(processor)
   , eb_(NULL)
   , eh_(NULL)
+  , stop_(false)
 {}
 
 
@@ -53,68 +218,204 @@ TEvhttpServer::TEvhttpServer(boost::shared_ptr<TAsyncBufferProcessor> processor,
   : processor_(processor)
   , eb_(NULL)
   , eh_(NULL)
+  , stop_(false)
 {
-  // Create event_base and evhttp.
-  eb_ = event_base_new();
-  if (eb_ == NULL) {
-    throw TException("event_base_new failed");
-  }
-  eh_ = evhttp_new(eb_);
-  if (eh_ == NULL) {
-    event_base_free(eb_);
-    throw TException("evhttp_new failed");
+  init(port, 1);
+}
+
+
+TEvhttpServer::TEvhttpServer(boost::shared_ptr<TAsyncBufferProcessor> processor, int port,
+                             size_t numBases)
+  : processor_(processor)
+  , eb_(NULL)
+  , eh_(NULL)
+  , stop_(false)
+{
+  init(port, numBases);
+}
+
+
+void TEvhttpServer::init(int port, size_t numBases) {
+  if (numBases == 0) {
+    numBases = 1;
   }
 
-  // Bind to port.
-  int ret = evhttp_bind_socket(eh_, NULL, port);
-  if (ret < 0) {
-    evhttp_free(eh_);
-    event_base_free(eb_);
-	throw TException("evhttp_bind_socket failed");
+  try {
+    for (size_t i = 0; i < numBases; ++i) {
+      Base* base = new Base(this);
+      bases_.push_back(base);
+
+      // Create event_base and evhttp.
+      base->eb = event_base_new();
+      if (base->eb == NULL) {
+        throw TException("event_base_new failed");
+      }
+      base->eh = evhttp_new(base->eb);
+      if (base->eh == NULL) {
+        throw TException("evhttp_new failed");
+      }
+      base->reply = evbuffer_new();
+      if (base->reply == NULL) {
+        throw TException("evbuffer_new failed");
+      }
+
+      if (evutil_socketpair(AF_LOCAL, SOCK_STREAM, 0, base->notifyFds) == -1) {
+        base->notifyFds[0] = base->notifyFds[1] = THRIFT_INVALID_SOCKET;
+        throw TException("TEvhttpServer: can't create notification pipe");
+      }
+      if (evutil_make_socket_nonblocking(base->notifyFds[0]) < 0 ||
+          evutil_make_socket_nonblocking(base->notifyFds[1]) < 0) {
+        throw TException("TEvhttpServer: can't make notification pipe nonblocking");
+      }
+      base->notifyEvent = new struct event;
+      event_set(base->notifyEvent, base->notifyFds[0], EV_READ | EV_PERSIST,
+                notifyHandler, base);
+      event_base_set(base->eb, base->notifyEvent);
+      if (event_add(base->notifyEvent, 0) == -1) {
+        delete base->notifyEvent;
+        base->notifyEvent = NULL;
+        throw TException("TEvhttpServer: event_add failed");
+      }
+
+      // Register a handler.  If you use the other constructor,
+      // you will want to do this yourself.
+      evhttp_set_cb(base->eh, "/", requestOnBase, base);
+    }
+
+    if (numBases == 1) {
+      // Bind to port.
+      if (evhttp_bind_socket(bases_[0]->eh, NULL, port) < 0) {
+        throw TException("evhttp_bind_socket failed");
+      }
+    } else {
+#ifdef _WIN32
+      throw TException("TEvhttpServer: more than one event base is not supported on Windows");
+#else
+      // Each evhttp closes the sockets it accepts on, so every base gets
+      // one of its own: a socket per base bound with SO_REUSEPORT where
+      // that exists, otherwise copies of a single one
+#ifdef SO_REUSEPORT
+      const bool reusePort = true;
+#else
+      const bool reusePort = false;
+#endif
+      THRIFT_SOCKET first = listenOn(port, reusePort);
+      if (port == 0) {
+        sockaddr_storage addr;
+        socklen_t addrLen = sizeof(addr);
+        if (getsockname(first, (sockaddr*)&addr, &addrLen) == 0) {
+          port = ntohs(addr.ss_family == AF_INET6 ? ((sockaddr_in6*)&addr)->sin6_port
+                                                  : ((sockaddr_in*)&addr)->sin_port);
+        }
+      }
+      for (size_t i = 0; i < numBases; ++i) {
+        THRIFT_SOCKET s = first;
+        if (i > 0) {
+          s = reusePort ? listenOn(port, true) : dup(first);
+        }
+        if (s == THRIFT_INVALID_SOCKET || evhttp_accept_socket(bases_[i]->eh, s) < 0) {
+          if (s != THRIFT_INVALID_SOCKET) {
+            ::THRIFT_CLOSESOCKET(s);
+          }
+          throw TException("evhttp_accept_socket failed");
+        }
+      }
+#endif
+    }
+  } catch (...) {
+    for (size_t i = 0; i < bases_.size(); ++i) {
+      delete bases_[i];
+    }
+    bases_.clear();
+    throw;
   }
 
-  // Register a handler.  If you use the other constructor,
-  // you will want to do this yourself.
-  // Don't forget to unregister before destorying this TEvhttpServer.
-  evhttp_set_cb(eh_, "/", request, (void*)this);
+  eb_ = bases_[0]->eb;
+  eh_ = bases_[0]->eh;
 }
 
 
 TEvhttpServer::~TEvhttpServer() {
-  if (eh_ != NULL) {
-    evhttp_free(eh_);
-  }
-  if (eb_ != NULL) {
-    event_base_free(eb_);
+  for (size_t i = 0; i < bases_.size(); ++i) {
+    delete bases_[i];
   }
 }
 
 
 int TEvhttpServer::serve() {
-  if (eb_ == NULL) {
+  if (bases_.empty()) {
     throw TException("Unexpected call to TEvhttpServer::serve");
   }
-  return event_base_dispatch(eb_);
+  stop_ = false;
+
+  PlatformThreadFactory factory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+    PlatformThreadFactory::OTHER,  // scheduler
+    PlatformThreadFactory::NORMAL, // priority
+    1,                             // stack size (MB)
+#endif
+    false                          // detached
+  );
+  for (size_t i = 1; i < bases_.size(); ++i) {
+    bases_[i]->thread = factory.newThread(
+      boost::shared_ptr<Runnable>(new BaseRunner(bases_[i])));
+    bases_[i]->thread->start();
+  }
+
+  bases_[0]->threadId = Thread::get_current();
+  int ret = event_base_dispatch(bases_[0]->eb);
+
+  // The other bases keep going unless stop() ended this one
+  for (size_t i = 1; i < bases_.size(); ++i) {
+    bases_[i]->thread->join();
+    bases_[i]->thread.reset();
+  }
+  return ret;
+}
+
+
+void TEvhttpServer::stop() {
+  stop_ = true;
+  for (size_t i = 0; i < bases_.size(); ++i) {
+    bases_[i]->notify();
+  }
 }
 
 
-TEvhttpServer::RequestContext::RequestContext(struct evhttp_request* req) : req(req)
+TEvhttpServer::RequestContext::RequestContext(struct evhttp_request* req, Base* base) : req(req)
   , ibuf(new TMemoryBuffer(EVBUFFER_DATA(req->input_buffer), static_cast<uint32_t>(EVBUFFER_LENGTH(req->input_buffer))))
-  , obuf(new TMemoryBuffer())
-{}
+  , base(base)
+  , success(false)
+{
+  if (base != NULL && !base->spareBuffers.empty()) {
+    obuf = base->spareBuffers.back();
+    base->spareBuffers.pop_back();
+  } else {
+    obuf.reset(new TMemoryBuffer());
+  }
+}
 
 
 void TEvhttpServer::request(struct evhttp_request* req, void* self) {
   try {
-    static_cast<TEvhttpServer*>(self)->process(req);
+    static_cast<TEvhttpServer*>(self)->process(req, NULL);
   } catch(std::exception& e) {
     evhttp_send_reply(req, HTTP_INTERNAL, e.what(), 0);
   }
 }
 
 
-void TEvhttpServer::process(struct evhttp_request* req) {
-  RequestContext* ctx = new RequestContext(req);
+void TEvhttpServer::requestOnBase(struct evhttp_request* req, void* base) {
+  try {
+    static_cast<Base*>(base)->server->process(req, static_cast<Base*>(base));
+  } catch(std::exception& e) {
+    evhttp_send_reply(req, HTTP_INTERNAL, e.what(), 0);
+  }
+}
+
+
+void TEvhttpServer::process(struct evhttp_request* req, Base* base) {
+  RequestContext* ctx = new RequestContext(req, base);
   return processor_->process(
       apache::thrift::stdcxx::bind(
         &TEvhttpServer::complete,
@@ -127,7 +428,55 @@ void TEvhttpServer::process(struct evhttp_request* req) {
 
 
 void TEvhttpServer::complete(RequestContext* ctx, bool success) {
-  (void) success;
+  Base* base = ctx->base;
+  if (base != NULL && !Thread::is_current(base->threadId)) {
+    // evhttp may only be used from the thread running its base
+    ctx->success = success;
+    bool wasEmpty;
+    {
+      Guard g(base->mutex);
+      wasEmpty = base->completed.empty();
+      base->completed.push_back(ctx);
+    }
+    // Completions queued behind the first are picked up by the same wakeup
+    if (wasEmpty) {
+      base->notify();
+    }
+    return;
+  }
+  reply(ctx, success);
+}
+
+
+/* static */ void TEvhttpServer::notifyHandler(THRIFT_SOCKET fd, short which, void* arg) {
+  (void) which;
+  Base* base = static_cast<Base*>(arg);
+  char drain[64];
+  while (recv(fd, drain, sizeof(drain), 0) > 0) {
+  }
+
+  std::vector<RequestContext*> completed;
+  {
+    Guard g(base->mutex);
+    completed.swap(base->completed);
+  }
+  for (size_t i = 0; i < completed.size(); ++i) {
+    try {
+      base->server->reply(completed[i], completed[i]->success);
+    } catch (std::exception& e) {
+      // don't propagate a C++ exception in C code (e.g. libevent)
+      std::cerr << "TEvhttpServer::notifyHandler exception thrown (ignored): "
+                << e.what() << std::endl;
+    }
+  }
+
+  if (base->server->stop_) {
+    event_base_loopbreak(base->eb);
+  }
+}
+
+
+void TEvhttpServer::reply(RequestContext* ctx, bool success) {
   std::auto_ptr<RequestContext> ptr(ctx);
 
   int code = success ? 200 : 400;
@@ -139,7 +488,7 @@ void TEvhttpServer::complete(RequestContext* ctx, bool success) {
     std::cerr << "evhttp_add_header failed " << __FILE__ << ":" << __LINE__ << std::endl;
   }
 
-  struct evbuffer* buf = evbuffer_new();
+  struct evbuffer* buf = ctx->base != NULL ? ctx->base->reply : evbuffer_new();
   if (buf == NULL) {
     // TODO: Log an error.
       std::cerr << "evbuffer_new failed " << __FILE__ << ":" <<  __LINE__ << std::endl;
@@ -155,7 +504,14 @@ void TEvhttpServer::complete(RequestContext* ctx, bool success) {
   }
 
   evhttp_send_reply(ctx->req, code, reason, buf);
-  if (buf != NULL) {
+  if (ctx->base != NULL) {
+    // evhttp_send_reply() took what was in the base's buffer
+    ctx->obuf->resetBuffer();
+    if (ctx->base->spareBuffers.size() < SPARE_BUFFERS &&
+        ctx->obuf.unique() && ctx->obuf->available_write() <= SPARE_BUFFER_LIMIT) {
+      ctx->base->spareBuffers.push_back(ctx->obuf);
+    }
+  } else if (buf != NULL) {
     evbuffer_free(buf);
   }
 }
@@ -20,6 +20,7 @@
 #ifndef _THRIFT_TEVHTTP_SERVER_H_
 #define _THRIFT_TEVHTTP_SERVER_H_ 1
 
+#include <vector>
 #include <boost/shared_ptr.hpp>
 
 struct event_base;
@@ -48,22 +49,65 @@ class TEvhttpServer {
    */
   TEvhttpServer(boost::shared_ptr<TAsyncBufferProcessor> processor, int port);
 
+  /**
+   * Create a TEvhttpServer with numBases embedded event_bases and evhttps,
+   * all accepting on port and responding on the endpoint "/".  serve()
+   * runs each base on a thread of its own, so requests are parsed and
+   * answered on as many cores.
+   *
+   * Where SO_REUSEPORT is available every base has its own listen socket
+   * and the kernel spreads connections over them; elsewhere the bases
+   * share one.  The processor is called on the thread of the base the
+   * request came in on and must be safe to call from all of them.  The
+   * reply is always sent on that thread, whichever thread completes it.
+   */
+  TEvhttpServer(boost::shared_ptr<TAsyncBufferProcessor> processor, int port,
+                size_t numBases);
+
   ~TEvhttpServer();
 
   static void request(struct evhttp_request* req, void* self);
+
+  /**
+   * Run the embedded event bases until they run out of events or stop()
+   * is called.  The first runs on the calling thread.
+   */
   int serve();
 
+  /**
+   * Make serve() return.  May be called from any thread.
+   */
+  void stop();
+
+  /**
+   * The first embedded event base; the only one unless numBases was given.
+   */
   struct event_base* getEventBase();
 
+  size_t getNumBases() const {
+    return bases_.size();
+  }
+
  private:
   struct RequestContext;
+  struct Base;
+  class BaseRunner;
 
-  void process(struct evhttp_request* req);
+  void init(int port, size_t numBases);
+  void process(struct evhttp_request* req, Base* base);
   void complete(RequestContext* ctx, bool success);
+  void reply(RequestContext* ctx, bool success);
+
+  static void requestOnBase(struct evhttp_request* req, void* base);
+  static void notifyHandler(int fd, short which, void* base);
 
   boost::shared_ptr<TAsyncBufferProcessor> processor_;
   struct event_base* eb_;
   struct evhttp* eh_;
+
+  /// The embedded bases; eb_ and eh_ are those of the first
+  std::vector<Base*> bases_;
+  volatile bool stop_;
 };
 
 }}} // apache::thrift::async
@@ -0,0 +1,700 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/async/TFramedClientChannel.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/protocol/TProtocolException.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+#include <event.h>
+
+#include <iostream>
+
+using namespace apache::thrift::protocol;
+using apache::thrift::concurrency::Util;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
+
+namespace apache { namespace thrift { namespace async {
+
+namespace {
+
+const uint32_t READ_SIZE = 64 * 1024;
+
+/**
+ * Where the sequence id sits in a message, and how it is written: an i32
+ * (binary), a varint (compact) or decimal digits (JSON).
+ */
+struct SeqIdField {
+  enum Encoding { FIXED, VARINT, DECIMAL };
+  Encoding encoding;
+  uint32_t offset;
+  uint32_t length;
+};
+
+int32_t readInt32(const uint8_t* buf) {
+  return static_cast<int32_t>((static_cast<uint32_t>(buf[0]) << 24) |
+                              (static_cast<uint32_t>(buf[1]) << 16) |
+                              (static_cast<uint32_t>(buf[2]) << 8) |
+                              static_cast<uint32_t>(buf[3]));
+}
+
+void writeInt32(uint8_t* buf, int32_t value) {
+  uint32_t v = static_cast<uint32_t>(value);
+  buf[0] = static_cast<uint8_t>(v >> 24);
+  buf[1] = static_cast<uint8_t>(v >> 16);
+  buf[2] = static_cast<uint8_t>(v >> 8);
+  buf[3] = static_cast<uint8_t>(v);
+}
+
+bool isDigit(uint8_t c) {
+  return c >= '0' && c <= '9';
+}
+
+/**
+ * Find the sequence id in the header of a message written by
+ * TBinaryProtocol (strict or not), TCompactProtocol or TJSONProtocol.
+ */
+bool findSeqId(const uint8_t* buf, uint32_t sz, SeqIdField& field) {
+  if (sz == 0) {
+    return false;
+  }
+
+  if (buf[0] == '[') {
+    // [1,"name",type,seqid,...  Method names need no escapes, but skip them
+    uint32_t i = 1;
+    while (i < sz && isDigit(buf[i])) {
+      ++i;
+    }
+    if (i + 1 >= sz || buf[i] != ',' || buf[i + 1] != '"') {
+      return false;
+    }
+    for (i += 2; i < sz && buf[i] != '"'; ++i) {
+      if (buf[i] == '\\') {
+        ++i;
+      }
+    }
+    if (i + 1 >= sz || buf[i + 1] != ',') {
+      return false;
+    }
+    for (i += 2; i < sz && isDigit(buf[i]); ++i) {
+    }
+    if (i >= sz || buf[i] != ',') {
+      return false;
+    }
+    uint32_t start = ++i;
+    if (i < sz && buf[i] == '-') {
+      ++i;
+    }
+    while (i < sz && isDigit(buf[i])) {
+      ++i;
+    }
+    if (i == start || i >= sz || (buf[i] != ',' && buf[i] != ']')) {
+      return false;
+    }
+    field.encoding = SeqIdField::DECIMAL;
+    field.offset = start;
+    field.length = i - start;
+    return true;
+  }
+
+  if (buf[0] == 0x82) {
+    // Protocol id, version and type, then the id as a varint
+    uint32_t i = 2;
+    while (i < sz && i < 2 + 5 && (buf[i] & 0x80)) {
+      ++i;
+    }
+    if (i >= sz || (buf[i] & 0x80)) {
+      return false;
+    }
+    field.encoding = SeqIdField::VARINT;
+    field.offset = 2;
+    field.length = i + 1 - 2;
+    return true;
+  }
+
+  if (sz < 4) {
+    return false;
+  }
+  int32_t first = readInt32(buf);
+  uint64_t offset;
+  if (first < 0) {
+    // Strict: version and type, the name, then the id
+    if (buf[0] != 0x80 || buf[1] != 0x01 || sz < 8) {
+      return false;
+    }
+    int32_t nameLen = readInt32(buf + 4);
+    if (nameLen < 0) {
+      return false;
+    }
+    offset = 8 + static_cast<uint64_t>(nameLen);
+  } else {
+    // Old style: the name, the type byte, then the id
+    offset = 4 + static_cast<uint64_t>(first) + 1;
+  }
+  if (offset + 4 > sz) {
+    return false;
+  }
+  field.encoding = SeqIdField::FIXED;
+  field.offset = static_cast<uint32_t>(offset);
+  field.length = 4;
+  return true;
+}
+
+int32_t readSeqId(const uint8_t* buf, const SeqIdField& field) {
+  const uint8_t* p = buf + field.offset;
+  switch (field.encoding) {
+  case SeqIdField::FIXED:
+    return readInt32(p);
+  case SeqIdField::VARINT: {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < field.length; ++i) {
+      value |= static_cast<uint32_t>(p[i] & 0x7f) << (7 * i);
+    }
+    return static_cast<int32_t>(value);
+  }
+  default: {
+    char digits[sizeof("-2147483648")];
+    uint32_t len = field.length < sizeof(digits) ? field.length : sizeof(digits) - 1;
+    memcpy(digits, p, len);
+    digits[len] = '\0';
+    return static_cast<int32_t>(strtol(digits, NULL, 10));
+  }
+  }
+}
+
+/// Write id in the field's encoding; returns its length
+uint32_t encodeSeqId(SeqIdField::Encoding encoding, int32_t id, uint8_t* out) {
+  switch (encoding) {
+  case SeqIdField::FIXED:
+    writeInt32(out, id);
+    return 4;
+  case SeqIdField::VARINT: {
+    uint32_t value = static_cast<uint32_t>(id);
+    uint32_t len = 0;
+    while (value & ~0x7fU) {
+      out[len++] = static_cast<uint8_t>((value & 0x7f) | 0x80);
+      value >>= 7;
+    }
+    out[len++] = static_cast<uint8_t>(value);
+    return len;
+  }
+  default:
+    return static_cast<uint32_t>(sprintf(reinterpret_cast<char*>(out), "%d", id));
+  }
+}
+
+}
+
+
+TFramedClientChannel::TFramedClientChannel(
+    const char* address,
+    int port,
+    struct event_base* eb,
+    int64_t timeout)
+  : address_(address)
+  , port_(port)
+  , eb_(eb)
+  , timeout_(timeout)
+  , maxFrameSize_(DEFAULT_MAX_FRAME_SIZE)
+  , error_(false)
+  , timedOut_(false)
+  , fd_(THRIFT_INVALID_SOCKET)
+  , connecting_(false)
+  , writeInterest_(false)
+  , readEvent_(new struct event)
+  , writeEvent_(new struct event)
+  , closes_(0)
+  , writeOffset_(0)
+  , nextId_(1)
+  , nextNumber_(0)
+  , timer_(new struct event)
+  , timerArmed_(false)
+{
+  evtimer_set(timer_, timerHandler, this);
+  event_base_set(eb_, timer_);
+}
+
+
+TFramedClientChannel::~TFramedClientChannel() {
+  // Whoever would want to hear about them is the one destroying us
+  inFlight_.clear();
+  close();
+  delete readEvent_;
+  delete writeEvent_;
+  delete timer_;
+}
+
+
+void TFramedClientChannel::sendAndRecvMessage(
+    const VoidCallback& cob,
+    apache::thrift::transport::TMemoryBuffer* sendBuf,
+    apache::thrift::transport::TMemoryBuffer* recvBuf) {
+  uint8_t* obuf;
+  uint32_t sz;
+  sendBuf->getBuffer(&obuf, &sz);
+
+  SeqIdField field;
+  if (!findSeqId(obuf, sz, field)) {
+    throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+                             "TFramedClientChannel: no sequence id found in request");
+  }
+
+  // Ids wrap after a couple of billion calls; skip any still in use
+  int32_t id;
+  do {
+    id = nextId_;
+    nextId_ = nextId_ == INT32_MAX ? 1 : nextId_ + 1;
+  } while (inFlight_.find(id) != inFlight_.end());
+
+  Call& call = inFlight_[id];
+  call.cob = cob;
+  call.recvBuf = recvBuf;
+  call.seqid = readSeqId(obuf, field);
+  call.number = nextNumber_++;
+
+  if (timeout_ > 0) {
+    Deadline deadline;
+    deadline.when = Util::monotonicTime() + timeout_;
+    deadline.id = id;
+    deadline.number = call.number;
+    deadlines_.push_back(deadline);
+    armTimer();
+  }
+
+  uint8_t newId[sizeof("-2147483648")];
+  uint32_t newIdLength = encodeSeqId(field.encoding, id, newId);
+  queueMessage(obuf, sz, field.offset, field.length, newId, newIdLength);
+  if (fd_ == THRIFT_INVALID_SOCKET) {
+    connect();
+  } else {
+    flush();
+  }
+}
+
+
+void TFramedClientChannel::sendMessage(
+    const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message) {
+  uint8_t* obuf;
+  uint32_t sz;
+  message->getBuffer(&obuf, &sz);
+
+  queueMessage(obuf, sz, 0, 0, NULL, 0);
+  if (fd_ == THRIFT_INVALID_SOCKET) {
+    connect();
+  } else {
+    flush();
+  }
+  cob();
+}
+
+
+void TFramedClientChannel::recvMessage(
+    const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message) {
+  (void) cob;
+  (void) message;
+  throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+			   "Unexpected call to TFramedClientChannel::recvMessage");
+}
+
+
+void TFramedClientChannel::queueMessage(const uint8_t* buf, uint32_t sz,
+                                        uint32_t idOffset, uint32_t idLength,
+                                        const uint8_t* newId, uint32_t newIdLength) {
+  uint8_t frameSize[4];
+  writeInt32(frameSize, static_cast<int32_t>(sz - idLength + newIdLength));
+
+  const char* p = reinterpret_cast<const char*>(buf);
+  writeBuf_.append(reinterpret_cast<const char*>(frameSize), sizeof(frameSize));
+  writeBuf_.append(p, idOffset);
+  writeBuf_.append(reinterpret_cast<const char*>(newId), newIdLength);
+  writeBuf_.append(p + idOffset + idLength, sz - idOffset - idLength);
+}
+
+
+void TFramedClientChannel::connect() {
+  char portStr[sizeof("65535")];
+  sprintf(portStr, "%d", port_);
+  struct addrinfo hints;
+  struct addrinfo* res0;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int error = getaddrinfo(address_.c_str(), portStr, &hints, &res0);
+  if (error) {
+    GlobalOutput.printf("TFramedClientChannel: getaddrinfo %s: %s",
+                        address_.c_str(), THRIFT_GAI_STRERROR(error));
+    connecting_ = true;
+    close();
+    return;
+  }
+
+  THRIFT_SOCKET fd = socket(res0->ai_family, res0->ai_socktype, res0->ai_protocol);
+  int rv = -1;
+  int errno_copy = 0;
+  if (fd != THRIFT_INVALID_SOCKET && evutil_make_socket_nonblocking(fd) == 0) {
+    rv = ::connect(fd, res0->ai_addr, static_cast<int>(res0->ai_addrlen));
+    errno_copy = THRIFT_GET_SOCKET_ERROR;
+  } else {
+    errno_copy = THRIFT_GET_SOCKET_ERROR;
+  }
+  freeaddrinfo(res0);
+  if (rv != 0 && errno_copy != THRIFT_EINPROGRESS && errno_copy != THRIFT_EWOULDBLOCK) {
+    GlobalOutput.perror("TFramedClientChannel: connect() ", errno_copy);
+    if (fd != THRIFT_INVALID_SOCKET) {
+      ::THRIFT_CLOSESOCKET(fd);
+    }
+    connecting_ = true;
+    close();
+    return;
+  }
+
+  fd_ = fd;
+  event_set(readEvent_, fd_, EV_READ | EV_PERSIST, eventHandler, this);
+  event_base_set(eb_, readEvent_);
+  event_set(writeEvent_, fd_, EV_WRITE | EV_PERSIST, eventHandler, this);
+  event_base_set(eb_, writeEvent_);
+
+  connecting_ = rv != 0;
+  if (connecting_) {
+    // Writable once connected
+    setWriteInterest(true);
+    return;
+  }
+  if (event_add(readEvent_, 0) == -1) {
+    throw TException("TFramedClientChannel: event_add failed");
+  }
+  flush();
+}
+
+
+void TFramedClientChannel::close() {
+  bool wasConnecting = connecting_;
+  if (fd_ != THRIFT_INVALID_SOCKET) {
+    event_del(readEvent_);
+    if (writeInterest_) {
+      event_del(writeEvent_);
+      writeInterest_ = false;
+    }
+    ::THRIFT_CLOSESOCKET(fd_);
+    fd_ = THRIFT_INVALID_SOCKET;
+  }
+  connecting_ = false;
+  ++closes_;
+  writeBuf_.clear();
+  writeOffset_ = 0;
+  readBuf_.clear();
+
+  deadlines_.clear();
+  if (timerArmed_) {
+    event_del(timer_);
+    timerArmed_ = false;
+  }
+
+  // Whatever was sent may or may not have been processed
+  std::map<int32_t, Call> inFlight;
+  inFlight.swap(inFlight_);
+  if (inFlight.empty()) {
+    return;
+  }
+  error_ = true;
+  std::string error(wasConnecting ? "connect failed" : "connection closed");
+  for (std::map<int32_t, Call>::iterator it = inFlight.begin(); it != inFlight.end(); ++it) {
+    if (it->second.recvBuf != NULL) {
+      finish(it->second, NULL, 0, error);
+    }
+  }
+}
+
+
+void TFramedClientChannel::setWriteInterest(bool want) {
+  if (want == writeInterest_) {
+    return;
+  }
+  if (want) {
+    if (event_add(writeEvent_, 0) == -1) {
+      throw TException("TFramedClientChannel: event_add failed");
+    }
+  } else {
+    event_del(writeEvent_);
+  }
+  writeInterest_ = want;
+}
+
+
+void TFramedClientChannel::flush() {
+  if (fd_ == THRIFT_INVALID_SOCKET || connecting_) {
+    return;
+  }
+
+  int flags = 0;
+#ifdef MSG_NOSIGNAL
+  flags |= MSG_NOSIGNAL;
+#endif // ifdef MSG_NOSIGNAL
+
+  while (writeOffset_ < writeBuf_.size()) {
+    int sent = static_cast<int>(send(fd_, writeBuf_.data() + writeOffset_,
+                                     writeBuf_.size() - writeOffset_, flags));
+    if (sent < 0) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy == THRIFT_EAGAIN || errno_copy == THRIFT_EWOULDBLOCK) {
+        setWriteInterest(true);
+        return;
+      }
+      if (errno_copy == THRIFT_EINTR) {
+        continue;
+      }
+      GlobalOutput.perror("TFramedClientChannel::flush() send() ", errno_copy);
+      close();
+      return;
+    }
+    writeOffset_ += static_cast<size_t>(sent);
+  }
+  // Keeps its capacity for the next requests
+  writeBuf_.clear();
+  writeOffset_ = 0;
+  setWriteInterest(false);
+}
+
+
+void TFramedClientChannel::handleRead() {
+  uint64_t closes = closes_;
+  uint8_t buf[READ_SIZE];
+  for (;;) {
+    int got = static_cast<int>(recv(fd_, reinterpret_cast<char*>(buf), READ_SIZE, 0));
+    if (got == 0) {
+      close();
+      return;
+    }
+    if (got < 0) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy == THRIFT_EAGAIN || errno_copy == THRIFT_EWOULDBLOCK) {
+        return;
+      }
+      if (errno_copy == THRIFT_EINTR) {
+        continue;
+      }
+      if (errno_copy != THRIFT_ECONNRESET) {
+        GlobalOutput.perror("TFramedClientChannel::handleRead() recv() ", errno_copy);
+      }
+      close();
+      return;
+    }
+    readBuf_.append(reinterpret_cast<const char*>(buf), static_cast<size_t>(got));
+
+    // Hand out every whole response; a callback may close the connection
+    size_t pos = 0;
+    while (readBuf_.size() - pos >= 4) {
+      uint32_t frameSize = static_cast<uint32_t>(
+          readInt32(reinterpret_cast<const uint8_t*>(readBuf_.data() + pos)));
+      if (frameSize > maxFrameSize_) {
+        GlobalOutput.printf("TFramedClientChannel: frame size %u too large", frameSize);
+        close();
+        return;
+      }
+      if (readBuf_.size() - pos - 4 < frameSize) {
+        break;
+      }
+      handleResponse(reinterpret_cast<uint8_t*>(&readBuf_[pos + 4]), frameSize);
+      if (closes_ != closes) {
+        return;
+      }
+      pos += 4 + frameSize;
+    }
+    readBuf_.erase(0, pos);
+  }
+}
+
+
+void TFramedClientChannel::handleWrite() {
+  if (connecting_) {
+    int error = 0;
+    socklen_t errorLen = sizeof(error);
+    if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &errorLen) < 0) {
+      error = THRIFT_GET_SOCKET_ERROR;
+    }
+    if (error != 0) {
+      GlobalOutput.perror("TFramedClientChannel: connect() ", error);
+      close();
+      return;
+    }
+    connecting_ = false;
+    if (event_add(readEvent_, 0) == -1) {
+      close();
+      return;
+    }
+  }
+  flush();
+}
+
+
+void TFramedClientChannel::handleResponse(uint8_t* buf, uint32_t sz) {
+  SeqIdField field;
+  if (!findSeqId(buf, sz, field)) {
+    GlobalOutput.printf("TFramedClientChannel: no sequence id found in response");
+    close();
+    return;
+  }
+
+  std::map<int32_t, Call>::iterator it = inFlight_.find(readSeqId(buf, field));
+  if (it == inFlight_.end()) {
+    return;
+  }
+  Call call = it->second;
+  inFlight_.erase(it);
+  if (call.recvBuf == NULL) {
+    // Timed out, and the id free again
+    return;
+  }
+  error_ = false;
+
+  // Give the client back the id it sent
+  uint8_t seqid[sizeof("-2147483648")];
+  uint32_t seqidLength = encodeSeqId(field.encoding, call.seqid, seqid);
+  if (seqidLength == field.length) {
+    memcpy(buf + field.offset, seqid, seqidLength);
+  } else {
+    response_.assign(reinterpret_cast<const char*>(buf), field.offset);
+    response_.append(reinterpret_cast<const char*>(seqid), seqidLength);
+    response_.append(reinterpret_cast<const char*>(buf) + field.offset + field.length,
+                     sz - field.offset - field.length);
+    buf = reinterpret_cast<uint8_t*>(&response_[0]);
+    sz = static_cast<uint32_t>(response_.size());
+  }
+  finish(call, buf, sz, "");
+}
+
+
+void TFramedClientChannel::armTimer() {
+  // Drop the deadlines of calls already answered
+  while (!deadlines_.empty()) {
+    const Deadline& front = deadlines_.front();
+    std::map<int32_t, Call>::iterator it = inFlight_.find(front.id);
+    if (it != inFlight_.end() && it->second.number == front.number) {
+      break;
+    }
+    deadlines_.pop_front();
+  }
+  if (timerArmed_ || deadlines_.empty()) {
+    return;
+  }
+
+  int64_t delay = deadlines_.front().when - Util::monotonicTime();
+  struct timeval tv;
+  Util::toTimeval(tv, delay > 0 ? delay : 0);
+  if (evtimer_add(timer_, &tv) == -1) {
+    throw TException("TFramedClientChannel: evtimer_add failed");
+  }
+  timerArmed_ = true;
+}
+
+
+void TFramedClientChannel::handleTimeout() {
+  timerArmed_ = false;
+  int64_t now = Util::monotonicTime();
+  while (!deadlines_.empty() && deadlines_.front().when <= now) {
+    Deadline deadline = deadlines_.front();
+    deadlines_.pop_front();
+    std::map<int32_t, Call>::iterator it = inFlight_.find(deadline.id);
+    if (it == inFlight_.end() || it->second.number != deadline.number) {
+      continue;
+    }
+    // The id stays taken until the late response is dropped
+    Call call = it->second;
+    it->second.cob = VoidCallback();
+    it->second.recvBuf = NULL;
+    timedOut_ = true;
+    finish(call, NULL, 0, "timed out");
+  }
+  armTimer();
+}
+
+
+void TFramedClientChannel::finish(Call& call, const uint8_t* buf, uint32_t sz,
+                                  const std::string& error) {
+  try {
+    if (buf != NULL) {
+      // Only read by the callback, while the buffer is still ours
+      call.recvBuf->resetBuffer(const_cast<uint8_t*>(buf), sz);
+      call.cob();
+      return;
+    }
+
+    // With nothing to read, the client's recv_ throws END_OF_FILE; make
+    // that say what actually happened
+    call.recvBuf->resetBuffer();
+    try {
+      call.cob();
+    } catch(const TTransportException& e) {
+      if(e.getType() == TTransportException::END_OF_FILE)
+        throw TException(error);
+      else
+        throw;
+    }
+  } catch(std::exception& e) {
+    // don't propagate a C++ exception in C code (e.g. libevent)
+    std::cerr << "TFramedClientChannel::finish exception thrown (ignored): " << e.what() << std::endl;
+  }
+}
+
+
+/* static */ void TFramedClientChannel::eventHandler(THRIFT_SOCKET fd, short which, void* self) {
+  (void) fd;
+  TFramedClientChannel* channel = static_cast<TFramedClientChannel*>(self);
+  try {
+    if (which & EV_READ) {
+      channel->handleRead();
+    } else if (which & EV_WRITE) {
+      channel->handleWrite();
+    }
+  } catch (std::exception& e) {
+    // don't propagate a C++ exception in C code (e.g. libevent)
+    std::cerr << "TFramedClientChannel::eventHandler exception thrown (ignored): "
+              << e.what() << std::endl;
+    channel->close();
+  }
+}
+
+
+/* static */ void TFramedClientChannel::timerHandler(THRIFT_SOCKET fd, short which, void* self) {
+  (void) fd;
+  (void) which;
+  try {
+    static_cast<TFramedClientChannel*>(self)->handleTimeout();
+  } catch (std::exception& e) {
+    // don't propagate a C++ exception in C code (e.g. libevent)
+    std::cerr << "TFramedClientChannel::timerHandler exception thrown (ignored): "
+              << e.what() << std::endl;
+  }
+}
+
+
+}}} // apache::thrift::async
@@ -0,0 +1,173 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TFRAMED_CLIENT_CHANNEL_H_
+#define _THRIFT_TFRAMED_CLIENT_CHANNEL_H_ 1
+
+#include <deque>
+#include <map>
+#include <string>
+#include <thrift/async/TAsyncChannel.h>
+#include <thrift/transport/PlatformSocket.h>
+
+struct event_base;
+struct event;
+
+namespace apache { namespace thrift { namespace transport {
+class TMemoryBuffer;
+}}}
+
+namespace apache { namespace thrift { namespace async {
+
+/**
+ * TAsyncChannel that speaks framed Thrift straight over TCP, as
+ * TNonblockingServer and TFramedTransport servers expect, on a libevent
+ * event_base.
+ *
+ * Any number of sendAndRecvMessage() calls may be outstanding at once on
+ * the one connection.  Cob-style clients number every call 0, so each
+ * request is given a sequence id of the channel's own on the way out, and
+ * its response is matched by that id and handed back with the client's id
+ * restored.  The ids of binary, compact and JSON messages are found;
+ * other protocols can't be used.  Oneway calls go out through
+ * sendMessage().
+ *
+ * With a timeout set, a call not answered in time fails with an error
+ * and its late response is dropped; the connection is kept.  The
+ * connection is made on first use and remade by the next call after it
+ * drops, failing the calls it had in flight.
+ */
+class TFramedClientChannel : public TAsyncChannel {
+ public:
+  using TAsyncChannel::VoidCallback;
+
+  /// Default largest response accepted, as TNonblockingServer's requests
+  static const uint32_t DEFAULT_MAX_FRAME_SIZE = 256 * 1024 * 1024;
+
+  /**
+   * @param timeout milliseconds to wait for each response, or 0 to wait
+   *                as long as the connection lasts.
+   */
+  TFramedClientChannel(
+      const char* address,
+      int port,
+      struct event_base* eb,
+      int64_t timeout = 0);
+  ~TFramedClientChannel();
+
+  virtual void sendAndRecvMessage(const VoidCallback& cob,
+                                  apache::thrift::transport::TMemoryBuffer* sendBuf,
+                                  apache::thrift::transport::TMemoryBuffer* recvBuf);
+
+  /// Queues a oneway call, running cob once it is queued
+  virtual void sendMessage(const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message);
+  virtual void recvMessage(const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message);
+
+  virtual bool good() const { return !error_ && !timedOut_; }
+  virtual bool error() const { return error_; }
+  virtual bool timedOut() const { return timedOut_; }
+
+  /// Milliseconds to wait for a response; applies to calls made after
+  void setTimeout(int64_t timeout) { timeout_ = timeout; }
+  int64_t getTimeout() const { return timeout_; }
+
+  void setMaxFrameSize(uint32_t maxFrameSize) { maxFrameSize_ = maxFrameSize; }
+  uint32_t getMaxFrameSize() const { return maxFrameSize_; }
+
+  /// Calls sent and waiting for a response, timed out ones included
+  size_t getNumInFlight() const { return inFlight_.size(); }
+
+ private:
+  struct Call {
+    VoidCallback cob;
+    /// NULL once the call has timed out
+    apache::thrift::transport::TMemoryBuffer* recvBuf;
+    /// The sequence id the client gave the call
+    int32_t seqid;
+    /// Tells the call apart from a later one given the same id
+    uint64_t number;
+  };
+
+  struct Deadline {
+    int64_t when;
+    int32_t id;
+    uint64_t number;
+  };
+
+  void connect();
+  void close();
+
+  /**
+   * Frame a message into the write buffer, with the idLength bytes at
+   * idOffset, its sequence id, replaced by the newIdLength of newId.
+   */
+  void queueMessage(const uint8_t* buf, uint32_t sz,
+                    uint32_t idOffset, uint32_t idLength,
+                    const uint8_t* newId, uint32_t newIdLength);
+
+  void flush();
+  void setWriteInterest(bool want);
+  void handleRead();
+  void handleWrite();
+  void handleResponse(uint8_t* buf, uint32_t sz);
+  void handleTimeout();
+  void armTimer();
+
+  void finish(Call& call, const uint8_t* buf, uint32_t sz, const std::string& error);
+
+  static void eventHandler(THRIFT_SOCKET fd, short which, void* self);
+  static void timerHandler(THRIFT_SOCKET fd, short which, void* self);
+
+  std::string address_;
+  int port_;
+  struct event_base* eb_;
+  int64_t timeout_;
+  uint32_t maxFrameSize_;
+  bool error_;
+  bool timedOut_;
+
+  THRIFT_SOCKET fd_;
+  bool connecting_;
+  bool writeInterest_;
+  struct event* readEvent_;
+  struct event* writeEvent_;
+  /// Counts connections closed, so a callback can tell ours went away
+  uint64_t closes_;
+
+  /// Framed requests not yet written, from writeOffset_ on
+  std::string writeBuf_;
+  size_t writeOffset_;
+  /// Received bytes not yet making up a whole response
+  std::string readBuf_;
+  /// A response whose sequence id had to be re-encoded
+  std::string response_;
+
+  std::map<int32_t, Call> inFlight_;
+  int32_t nextId_;
+  uint64_t nextNumber_;
+
+  /// Deadlines in the order the calls were made, answered ones included
+  std::deque<Deadline> deadlines_;
+  struct event* timer_;
+  bool timerArmed_;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_TFRAMED_CLIENT_CHANNEL_H_
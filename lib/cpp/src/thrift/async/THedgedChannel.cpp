@@ -0,0 +1,362 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/async/THedgedChannel.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/protocol/TProtocolException.h>
+#include <algorithm>
+#include <event.h>
+
+using namespace apache::thrift::protocol;
+using apache::thrift::concurrency::Util;
+using apache::thrift::transport::TMemoryBuffer;
+
+namespace apache { namespace thrift { namespace async {
+
+
+THedgedChannel::THedgedChannel(
+    const std::vector<boost::shared_ptr<TAsyncChannel> >& replicas,
+    struct event_base* eb,
+    size_t maxHedges)
+  : replicas_(replicas)
+  , eb_(eb)
+  , maxHedges_(maxHedges)
+  , nextReplica_(0)
+  , percentile_(DEFAULT_PERCENTILE)
+  , initialDelay_(DEFAULT_INITIAL_DELAY)
+  , minDelay_(0)
+  , maxDelay_(0)
+  , nextLatency_(0)
+  , newLatencies_(0)
+  , hedgeDelay_(-1)
+  , numCalls_(0)
+  , numHedged_(0)
+  , numHedgeWins_(0)
+{
+  if (replicas_.empty()) {
+    throw TException("THedgedChannel: no replicas");
+  }
+  latencies_.reserve(LATENCY_WINDOW);
+}
+
+
+THedgedChannel::~THedgedChannel() {
+  for (size_t i = 0; i < calls_.size(); ++i) {
+    if (calls_[i]->timerArmed) {
+      event_del(calls_[i]->timer);
+    }
+    delete calls_[i]->timer;
+  }
+}
+
+
+void THedgedChannel::sendAndRecvMessage(
+    const VoidCallback& cob,
+    apache::thrift::transport::TMemoryBuffer* sendBuf,
+    apache::thrift::transport::TMemoryBuffer* recvBuf) {
+  uint8_t* obuf;
+  uint32_t sz;
+  sendBuf->getBuffer(&obuf, &sz);
+
+  Call* call = newCall();
+  call->cob = cob;
+  call->recvBuf = recvBuf;
+  call->request.assign(reinterpret_cast<const char*>(obuf), sz);
+  call->firstReplica = nextReplica_;
+  nextReplica_ = (nextReplica_ + 1) % replicas_.size();
+  ++numCalls_;
+
+  call->sending = true;
+  hedge(call);
+  sent(call);
+}
+
+
+void THedgedChannel::sendMessage(
+    const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message) {
+  size_t replica = nextReplica_;
+  nextReplica_ = (nextReplica_ + 1) % replicas_.size();
+  replicas_[replica]->sendMessage(cob, message);
+}
+
+
+void THedgedChannel::recvMessage(
+    const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message) {
+  (void) cob;
+  (void) message;
+  throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+			   "Unexpected call to THedgedChannel::recvMessage");
+}
+
+
+bool THedgedChannel::good() const {
+  for (size_t i = 0; i < replicas_.size(); ++i) {
+    if (replicas_[i]->good()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool THedgedChannel::error() const {
+  for (size_t i = 0; i < replicas_.size(); ++i) {
+    if (!replicas_[i]->error()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+bool THedgedChannel::timedOut() const {
+  for (size_t i = 0; i < replicas_.size(); ++i) {
+    if (!replicas_[i]->timedOut()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+void THedgedChannel::setPercentile(int percentile) {
+  percentile_ = std::min(std::max(percentile, 1), 100);
+  // Work it out again with the next latency
+  newLatencies_ = LATENCY_WINDOW;
+}
+
+
+int64_t THedgedChannel::getHedgeDelay() const {
+  int64_t delay = hedgeDelay_ >= 0 ? hedgeDelay_ : initialDelay_ * 1000;
+  delay = std::max(delay, minDelay_ * 1000);
+  if (maxDelay_ > 0) {
+    delay = std::min(delay, maxDelay_ * 1000);
+  }
+  return delay;
+}
+
+
+THedgedChannel::Call* THedgedChannel::newCall() {
+  Call* call;
+  if (!spareCalls_.empty()) {
+    call = spareCalls_.back();
+    spareCalls_.pop_back();
+  } else {
+    boost::shared_ptr<Call> c(new Call);
+    c->channel = this;
+    c->timer = new struct event;
+    evtimer_set(c->timer, timerHandler, c.get());
+    event_base_set(eb_, c->timer);
+    c->timerArmed = false;
+    calls_.push_back(c);
+    call = c.get();
+  }
+  call->sent = 0;
+  call->outstanding = 0;
+  call->sending = false;
+  call->answered = false;
+  return call;
+}
+
+
+void THedgedChannel::maybeReleaseCall(Call* call) {
+  if (!call->answered || call->outstanding > 0 || call->sending) {
+    return;
+  }
+  call->cob = VoidCallback();
+  call->recvBuf = NULL;
+  call->request.clear();
+  spareCalls_.push_back(call);
+}
+
+
+bool THedgedChannel::hedge(Call* call) {
+  TMemoryBuffer request(
+      reinterpret_cast<uint8_t*>(const_cast<char*>(call->request.data())),
+      static_cast<uint32_t>(call->request.size()));
+
+  while (call->sent < replicas_.size()) {
+    size_t n = call->sent++;
+    if (n == call->attempts.size()) {
+      call->attempts.push_back(Attempt());
+      call->attempts.back().recvBuf.reset(new TMemoryBuffer());
+    }
+    Attempt& attempt = call->attempts[n];
+    attempt.replica = (call->firstReplica + n) % replicas_.size();
+    attempt.sentAt = Util::monotonicTimeUsec();
+    attempt.recvBuf->resetBuffer();
+    if (n == 1) {
+      ++numHedged_;
+    }
+
+    ++call->outstanding;
+    try {
+      replicas_[attempt.replica]->sendAndRecvMessage(
+          apache::thrift::stdcxx::bind(&THedgedChannel::attemptDone, this, call, n),
+          &request, attempt.recvBuf.get());
+      return true;
+    } catch (const std::exception& e) {
+      if (call->answered) {
+        // Thrown by the client's callback, run by the replica right away
+        throw;
+      }
+      // Much as if the replica had failed the call; try the next
+      --call->outstanding;
+      GlobalOutput.printf("THedgedChannel: replica %d failed to send: %s",
+                          static_cast<int>(attempt.replica), e.what());
+    }
+  }
+  return false;
+}
+
+
+void THedgedChannel::sent(Call* call) {
+  // A replica that failed the call as it was sent is passed over too
+  while (!call->answered && call->outstanding == 0 && hedge(call)) {
+  }
+  call->sending = false;
+
+  if (call->answered) {
+    maybeReleaseCall(call);
+  } else if (call->outstanding == 0) {
+    // Every replica has failed or refused it
+    answer(call, NULL);
+  } else if (!call->timerArmed &&
+             call->sent < std::min(replicas_.size(), maxHedges_ + 1)) {
+    armTimer(call);
+  }
+}
+
+
+void THedgedChannel::armTimer(Call* call) {
+  struct timeval tv;
+  int64_t delay = getHedgeDelay();
+  tv.tv_sec = static_cast<long>(delay / 1000000);
+  tv.tv_usec = static_cast<long>(delay % 1000000);
+  if (evtimer_add(call->timer, &tv) == -1) {
+    throw TException("THedgedChannel: evtimer_add failed");
+  }
+  call->timerArmed = true;
+}
+
+
+void THedgedChannel::answer(Call* call, TMemoryBuffer* buf) {
+  call->answered = true;
+  if (call->timerArmed) {
+    event_del(call->timer);
+    call->timerArmed = false;
+  }
+
+  VoidCallback cob = call->cob;
+  call->cob = VoidCallback();
+  if (buf != NULL) {
+    // The replica's buffer is good until its callback returns, which is
+    // after the client has read it
+    uint8_t* data;
+    uint32_t sz;
+    buf->getBuffer(&data, &sz);
+    call->recvBuf->resetBuffer(data, sz);
+  } else {
+    call->recvBuf->resetBuffer();
+  }
+  maybeReleaseCall(call);
+  cob();
+}
+
+
+void THedgedChannel::attemptDone(Call* call, size_t n) {
+  --call->outstanding;
+  if (call->answered) {
+    // The loser; whoever sent it has had its response
+    maybeReleaseCall(call);
+    return;
+  }
+
+  Attempt& attempt = call->attempts[n];
+  if (attempt.recvBuf->available_read() > 0) {
+    recordLatency(Util::monotonicTimeUsec() - attempt.sentAt);
+    if (n > 0) {
+      ++numHedgeWins_;
+    }
+    answer(call, attempt.recvBuf.get());
+    return;
+  }
+
+  // The replica failed; rather than wait, go to the next one
+  if (call->sending) {
+    return;
+  }
+  call->sending = true;
+  if (call->timerArmed) {
+    event_del(call->timer);
+    call->timerArmed = false;
+  }
+  hedge(call);
+  sent(call);
+}
+
+
+void THedgedChannel::handleTimeout(Call* call) {
+  call->timerArmed = false;
+  if (call->answered) {
+    return;
+  }
+  call->sending = true;
+  hedge(call);
+  sent(call);
+}
+
+
+void THedgedChannel::recordLatency(int64_t latency) {
+  if (latencies_.size() < LATENCY_WINDOW) {
+    latencies_.push_back(latency);
+  } else {
+    latencies_[nextLatency_] = latency;
+    nextLatency_ = (nextLatency_ + 1) % LATENCY_WINDOW;
+  }
+
+  // Sorting the window for every call would cost more than it is worth
+  if (++newLatencies_ < LATENCY_WINDOW / 8) {
+    return;
+  }
+  newLatencies_ = 0;
+  scratch_.assign(latencies_.begin(), latencies_.end());
+  size_t k = (scratch_.size() * percentile_ + 99) / 100;
+  k = k > 0 ? k - 1 : 0;
+  std::nth_element(scratch_.begin(), scratch_.begin() + k, scratch_.end());
+  hedgeDelay_ = scratch_[k];
+}
+
+
+/* static */ void THedgedChannel::timerHandler(THRIFT_SOCKET fd, short which, void* arg) {
+  (void) fd;
+  (void) which;
+  Call* call = static_cast<Call*>(arg);
+  try {
+    call->channel->handleTimeout(call);
+  } catch(const std::exception& e) {
+    // don't propagate a C++ exception in C code (e.g. libevent)
+    GlobalOutput.printf("THedgedChannel::timerHandler exception thrown (ignored): %s",
+                        e.what());
+  }
+}
+
+
+}}} // apache::thrift::async
@@ -0,0 +1,193 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_THEDGED_CHANNEL_H_
+#define _THRIFT_THEDGED_CHANNEL_H_ 1
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/async/TAsyncChannel.h>
+#include <thrift/transport/PlatformSocket.h>
+
+struct event_base;
+struct event;
+
+namespace apache { namespace thrift { namespace transport {
+class TMemoryBuffer;
+}}}
+
+namespace apache { namespace thrift { namespace async {
+
+/**
+ * TAsyncChannel that sends each call to one of several replicas and, if
+ * no response has come by the time most calls have been answered, sends
+ * it again to the next replica.  Whichever response comes first is the
+ * one the client gets; the other is dropped when it arrives, as a
+ * TAsyncChannel has no way to take back a request.
+ *
+ * The delay before hedging is the chosen percentile of the latencies of
+ * recent responses, kept within the minimum and maximum delays; until
+ * enough responses have been seen, the initial delay is used.  A replica
+ * that fails, answering with nothing, is hedged at once.  Calls start at
+ * the replicas in turn.
+ *
+ * The replicas have to take calls while others are outstanding, as
+ * TEvhttpPooledClientChannel, TFramedClientChannel and
+ * THttp2ClientChannel do, and run their callbacks on eb.  Oneway calls go
+ * to one replica without hedging.
+ */
+class THedgedChannel : public TAsyncChannel {
+ public:
+  using TAsyncChannel::VoidCallback;
+
+  /// Default percentile of latencies to wait before hedging
+  static const int DEFAULT_PERCENTILE = 95;
+
+  /// Default milliseconds to wait before hedging, until latencies are known
+  static const int DEFAULT_INITIAL_DELAY = 10;
+
+  /// Latencies the delay is worked out from
+  static const size_t LATENCY_WINDOW = 256;
+
+  /**
+   * @param replicas the channels a call can go to; at least one.
+   * @param maxHedges the most extra replicas a call is sent to.
+   */
+  THedgedChannel(const std::vector<boost::shared_ptr<TAsyncChannel> >& replicas,
+                 struct event_base* eb,
+                 size_t maxHedges = 1);
+  ~THedgedChannel();
+
+  virtual void sendAndRecvMessage(const VoidCallback& cob,
+                                  apache::thrift::transport::TMemoryBuffer* sendBuf,
+                                  apache::thrift::transport::TMemoryBuffer* recvBuf);
+
+  virtual void sendMessage(const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message);
+  virtual void recvMessage(const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message);
+
+  /// Good while any replica is
+  virtual bool good() const;
+  virtual bool error() const;
+  virtual bool timedOut() const;
+
+  /// Percentile, from 1 to 100, of the latencies to wait before hedging
+  void setPercentile(int percentile);
+  int getPercentile() const { return percentile_; }
+
+  /// Milliseconds to wait before hedging while latencies are not yet known
+  void setInitialDelay(int64_t delay) { initialDelay_ = delay; }
+  int64_t getInitialDelay() const { return initialDelay_; }
+
+  /// Bounds on the wait before hedging, in milliseconds; 0 for no maximum
+  void setMinDelay(int64_t delay) { minDelay_ = delay; }
+  int64_t getMinDelay() const { return minDelay_; }
+  void setMaxDelay(int64_t delay) { maxDelay_ = delay; }
+  int64_t getMaxDelay() const { return maxDelay_; }
+
+  /// Microseconds the next call will wait before it is hedged
+  int64_t getHedgeDelay() const;
+
+  // Calls made, calls that were hedged, and hedges that answered first
+  uint64_t getNumCalls() const { return numCalls_; }
+  uint64_t getNumHedged() const { return numHedged_; }
+  uint64_t getNumHedgeWins() const { return numHedgeWins_; }
+
+ private:
+  struct Attempt {
+    size_t replica;
+    int64_t sentAt;
+    boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> recvBuf;
+  };
+
+  struct Call {
+    THedgedChannel* channel;
+    VoidCallback cob;
+    apache::thrift::transport::TMemoryBuffer* recvBuf;
+    /// The request, kept for the hedges
+    std::string request;
+    /// The replica the call went to first
+    size_t firstReplica;
+    /// attempts[0, sent) have been made; the rest are kept for reuse
+    std::vector<Attempt> attempts;
+    size_t sent;
+    /// Attempts whose replica has yet to call back
+    size_t outstanding;
+    /// Set while the channel is sending the call, for it to finish up after
+    bool sending;
+    /// Set once the client has had its response
+    bool answered;
+    struct event* timer;
+    bool timerArmed;
+  };
+
+  Call* newCall();
+  /// Put call back for reuse once it is answered and nothing is outstanding
+  void maybeReleaseCall(Call* call);
+
+  /**
+   * Send call to the next replica that takes it.
+   *
+   * @return false if the call has been to every replica.
+   */
+  bool hedge(Call* call);
+
+  /// After sending: wait for a response, or give up if none can come
+  void sent(Call* call);
+  void armTimer(Call* call);
+
+  /// Give the client the response in buf, or nothing if buf is NULL
+  void answer(Call* call, apache::thrift::transport::TMemoryBuffer* buf);
+
+  void attemptDone(Call* call, size_t attempt);
+  void handleTimeout(Call* call);
+  void recordLatency(int64_t latency);
+
+  static void timerHandler(THRIFT_SOCKET fd, short which, void* arg);
+
+  std::vector<boost::shared_ptr<TAsyncChannel> > replicas_;
+  struct event_base* eb_;
+  size_t maxHedges_;
+  size_t nextReplica_;
+
+  int percentile_;
+  int64_t initialDelay_;
+  int64_t minDelay_;
+  int64_t maxDelay_;
+
+  /// The last LATENCY_WINDOW latencies in microseconds, oldest at next
+  std::vector<int64_t> latencies_;
+  size_t nextLatency_;
+  /// Latencies recorded since hedgeDelay_ was worked out
+  size_t newLatencies_;
+  int64_t hedgeDelay_;
+  std::vector<int64_t> scratch_;
+
+  uint64_t numCalls_;
+  uint64_t numHedged_;
+  uint64_t numHedgeWins_;
+
+  /// Every Call made, and the ones not in use, for reuse
+  std::vector<boost::shared_ptr<Call> > calls_;
+  std::vector<Call*> spareCalls_;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_THEDGED_CHANNEL_H_
@@ -0,0 +1,308 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/async/THttp2ClientChannel.h>
+#include <thrift/async/THttp2Connection.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/protocol/TProtocolException.h>
+
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+#include <event.h>
+
+#include <iostream>
+#include <sstream>
+
+using namespace apache::thrift::protocol;
+using apache::thrift::transport::THpackHeader;
+using apache::thrift::transport::THpackHeaders;
+using apache::thrift::transport::THttp2Session;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
+
+namespace apache { namespace thrift { namespace async {
+
+
+THttp2ClientChannel::THttp2ClientChannel(
+    const std::string& host,
+    const std::string& path,
+    const char* address,
+    int port,
+    struct event_base* eb)
+  : host_(host)
+  , path_(path.empty() ? "/" : path)
+  , address_(address)
+  , port_(port)
+  , eb_(eb)
+  , error_(false)
+{}
+
+
+THttp2ClientChannel::~THttp2ClientChannel() {
+  if (conn_) {
+    conn_->setCloseCallback(THttp2Connection::CloseCallback());
+    conn_->close();
+  }
+}
+
+
+void THttp2ClientChannel::sendAndRecvMessage(
+    const VoidCallback& cob,
+    apache::thrift::transport::TMemoryBuffer* sendBuf,
+    apache::thrift::transport::TMemoryBuffer* recvBuf) {
+  uint8_t* obuf;
+  uint32_t sz;
+  sendBuf->getBuffer(&obuf, &sz);
+
+  queued_.push_back(Call());
+  Call& call = queued_.back();
+  call.cob = cob;
+  call.recvBuf = recvBuf;
+  call.request.assign(reinterpret_cast<const char*>(obuf), sz);
+
+  if (!conn_ || !conn_->isOpen()) {
+    connect();
+  }
+  sendQueued();
+}
+
+
+void THttp2ClientChannel::sendMessage(
+    const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message) {
+  (void) cob;
+  (void) message;
+  throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+			   "Unexpected call to THttp2ClientChannel::sendMessage");
+}
+
+
+void THttp2ClientChannel::recvMessage(
+    const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message) {
+  (void) cob;
+  (void) message;
+  throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+			   "Unexpected call to THttp2ClientChannel::recvMessage");
+}
+
+
+void THttp2ClientChannel::connect() {
+  conn_.reset();
+
+  char portStr[sizeof("65535")];
+  sprintf(portStr, "%d", port_);
+  struct addrinfo hints;
+  struct addrinfo* res0;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int error = getaddrinfo(address_.c_str(), portStr, &hints, &res0);
+  if (error) {
+    GlobalOutput.printf("THttp2ClientChannel: getaddrinfo %s: %s",
+                        address_.c_str(), THRIFT_GAI_STRERROR(error));
+    closed(false);
+    return;
+  }
+
+  THRIFT_SOCKET fd = socket(res0->ai_family, res0->ai_socktype, res0->ai_protocol);
+  int rv = -1;
+  int errno_copy = 0;
+  if (fd != THRIFT_INVALID_SOCKET && evutil_make_socket_nonblocking(fd) == 0) {
+    rv = ::connect(fd, res0->ai_addr, static_cast<int>(res0->ai_addrlen));
+    errno_copy = THRIFT_GET_SOCKET_ERROR;
+  } else {
+    errno_copy = THRIFT_GET_SOCKET_ERROR;
+  }
+  freeaddrinfo(res0);
+  if (rv != 0 && errno_copy != THRIFT_EINPROGRESS && errno_copy != THRIFT_EWOULDBLOCK) {
+    GlobalOutput.perror("THttp2ClientChannel: connect() ", errno_copy);
+    if (fd != THRIFT_INVALID_SOCKET) {
+      THRIFT_CLOSESOCKET(fd);
+    }
+    closed(false);
+    return;
+  }
+
+  conn_.reset(new THttp2Connection(eb_, fd, THttp2Session::CLIENT));
+  THttp2Session& session = conn_->getSession();
+  session.setMessageCallback(
+    apache::thrift::stdcxx::bind(
+      &THttp2ClientChannel::response,
+      this,
+      apache::thrift::stdcxx::placeholders::_1,
+      apache::thrift::stdcxx::placeholders::_2,
+      apache::thrift::stdcxx::placeholders::_3));
+  session.setStreamErrorCallback(
+    apache::thrift::stdcxx::bind(
+      &THttp2ClientChannel::streamError,
+      this,
+      apache::thrift::stdcxx::placeholders::_1,
+      apache::thrift::stdcxx::placeholders::_2));
+  conn_->setCloseCallback(
+    apache::thrift::stdcxx::bind(&THttp2ClientChannel::connectionClosed, this));
+  conn_->start(rv != 0);
+}
+
+
+void THttp2ClientChannel::sendQueued() {
+  // Closing the connection below may drop our reference to it
+  boost::shared_ptr<THttp2Connection> conn(conn_);
+  if (!conn || !conn->isOpen()) {
+    return;
+  }
+
+  THttp2Session& session = conn->getSession();
+  while (!queued_.empty() && session.canSubmitRequest()) {
+    THpackHeaders headers;
+    headers.push_back(THpackHeader(":method", "POST"));
+    headers.push_back(THpackHeader(":scheme", "http"));
+    headers.push_back(THpackHeader(":authority", host_));
+    headers.push_back(THpackHeader(":path", path_));
+    headers.push_back(THpackHeader("content-type", "application/x-thrift"));
+    headers.push_back(THpackHeader("accept", "application/x-thrift"));
+    headers.push_back(THpackHeader("user-agent", std::string("Thrift/") + VERSION + " (C++/THttp2ClientChannel)"));
+
+    Call& call = queued_.front();
+    uint32_t streamId = session.submitRequest(
+        headers, reinterpret_cast<const uint8_t*>(call.request.data()),
+        static_cast<uint32_t>(call.request.size()));
+    // The request is kept in case the server refuses the stream
+    Call& sent = inFlight_[streamId];
+    sent.cob.swap(call.cob);
+    sent.recvBuf = call.recvBuf;
+    sent.request.swap(call.request);
+    queued_.pop_front();
+  }
+  conn->flush();
+}
+
+
+void THttp2ClientChannel::response(uint32_t streamId, const THpackHeaders& headers,
+                                   const std::string& body) {
+  std::map<uint32_t, Call>::iterator it = inFlight_.find(streamId);
+  if (it == inFlight_.end()) {
+    return;
+  }
+  Call call = it->second;
+  inFlight_.erase(it);
+  error_ = false;
+
+  std::string status;
+  for (THpackHeaders::const_iterator h = headers.begin(); h != headers.end(); ++h) {
+    if (h->first == ":status") {
+      status = h->second;
+      break;
+    }
+  }
+  if (status == "200") {
+    finish(call, &body, "");
+  } else {
+    finish(call, NULL, "server returned code " + status);
+  }
+  sendQueued();
+}
+
+
+void THttp2ClientChannel::streamError(uint32_t streamId, uint32_t errorCode) {
+  std::map<uint32_t, Call>::iterator it = inFlight_.find(streamId);
+  if (it == inFlight_.end()) {
+    return;
+  }
+  Call call = it->second;
+  inFlight_.erase(it);
+
+  if (errorCode == THttp2Session::H2_REFUSED_STREAM) {
+    // Never processed, so safe to send again
+    queued_.push_front(call);
+  } else {
+    std::ostringstream ss;
+    ss << "stream reset with error code " << errorCode;
+    finish(call, NULL, ss.str());
+  }
+  sendQueued();
+}
+
+
+void THttp2ClientChannel::connectionClosed() {
+  closed(conn_ && !conn_->isConnecting());
+}
+
+
+void THttp2ClientChannel::closed(bool wasConnected) {
+  // Whatever was sent may or may not have been processed
+  std::map<uint32_t, Call> inFlight;
+  inFlight.swap(inFlight_);
+  conn_.reset();
+
+  if (!wasConnected) {
+    error_ = true;
+    std::deque<Call> queued;
+    queued.swap(queued_);
+    for (std::deque<Call>::iterator it = queued.begin(); it != queued.end(); ++it) {
+      finish(*it, NULL, "connect failed");
+    }
+  }
+  for (std::map<uint32_t, Call>::iterator it = inFlight.begin(); it != inFlight.end(); ++it) {
+    finish(it->second, NULL, "connection closed");
+  }
+
+  // Calls refused by a GOAWAY, or made while the connection was going away
+  if (!queued_.empty()) {
+    connect();
+    sendQueued();
+  }
+}
+
+
+void THttp2ClientChannel::finish(Call& call, const std::string* body, const std::string& error) {
+  try {
+    if (body != NULL) {
+      call.recvBuf->resetBuffer(reinterpret_cast<uint8_t*>(const_cast<char*>(body->data())),
+                                static_cast<uint32_t>(body->size()), TMemoryBuffer::COPY);
+      call.cob();
+      return;
+    }
+
+    // With nothing to read, the client's recv_ throws END_OF_FILE; make
+    // that say what actually happened
+    call.recvBuf->resetBuffer();
+    try {
+      call.cob();
+    } catch(const TTransportException& e) {
+      if(e.getType() == TTransportException::END_OF_FILE)
+        throw TException(error);
+      else
+        throw;
+    }
+  } catch(std::exception& e) {
+    // don't propagate a C++ exception in C code (e.g. libevent)
+    std::cerr << "THttp2ClientChannel::finish exception thrown (ignored): " << e.what() << std::endl;
+  }
+}
+
+
+}}} // apache::thrift::async
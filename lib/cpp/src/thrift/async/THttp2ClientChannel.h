@@ -0,0 +1,109 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_THTTP2_CLIENT_CHANNEL_H_
+#define _THRIFT_THTTP2_CLIENT_CHANNEL_H_ 1
+
+#include <deque>
+#include <map>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/async/TAsyncChannel.h>
+#include <thrift/transport/THpack.h>
+
+struct event_base;
+
+namespace apache { namespace thrift { namespace transport {
+class TMemoryBuffer;
+}}}
+
+namespace apache { namespace thrift { namespace async {
+
+class THttp2Connection;
+
+/**
+ * TAsyncChannel that sends each call as a stream of one HTTP/2 connection.
+ *
+ * Unlike TEvhttpClientChannel, any number of sendAndRecvMessage() calls may
+ * be outstanding at once: they are multiplexed over the one connection, up
+ * to the server's concurrency limit and queued beyond it, and each
+ * callback runs when its own response arrives.  Request headers are
+ * compressed against the ones sent before, so a call costs a few bytes of
+ * headers.  The connection is made on first use and remade after it drops;
+ * calls the server refused with GOAWAY are retried on the new connection.
+ */
+class THttp2ClientChannel : public TAsyncChannel {
+ public:
+  using TAsyncChannel::VoidCallback;
+
+  THttp2ClientChannel(
+      const std::string& host,
+      const std::string& path,
+      const char* address,
+      int port,
+      struct event_base* eb);
+  ~THttp2ClientChannel();
+
+  virtual void sendAndRecvMessage(const VoidCallback& cob,
+                                  apache::thrift::transport::TMemoryBuffer* sendBuf,
+                                  apache::thrift::transport::TMemoryBuffer* recvBuf);
+
+  virtual void sendMessage(const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message);
+  virtual void recvMessage(const VoidCallback& cob, apache::thrift::transport::TMemoryBuffer* message);
+
+  virtual bool good() const { return !error_; }
+  virtual bool error() const { return error_; }
+  virtual bool timedOut() const { return false; }
+
+  // Calls sent and waiting for a response, and calls waiting for a stream
+  size_t getNumInFlight() const { return inFlight_.size(); }
+  size_t getNumQueued() const { return queued_.size(); }
+
+ private:
+  struct Call {
+    VoidCallback cob;
+    apache::thrift::transport::TMemoryBuffer* recvBuf;
+    std::string request;
+  };
+
+  void connect();
+  void sendQueued();
+  void response(uint32_t streamId,
+                const apache::thrift::transport::THpackHeaders& headers,
+                const std::string& body);
+  void streamError(uint32_t streamId, uint32_t errorCode);
+  void connectionClosed();
+  void closed(bool wasConnected);
+  void finish(Call& call, const std::string* body, const std::string& error);
+
+  std::string host_;
+  std::string path_;
+  std::string address_;
+  int port_;
+  struct event_base* eb_;
+  bool error_;
+
+  boost::shared_ptr<THttp2Connection> conn_;
+  std::deque<Call> queued_;
+  std::map<uint32_t, Call> inFlight_;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_THTTP2_CLIENT_CHANNEL_H_
@@ -0,0 +1,243 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/async/THttp2Connection.h>
+#include <thrift/transport/TTransportException.h>
+
+#include <sys/types.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#include <event.h>
+
+#include <iostream>
+
+using apache::thrift::transport::THttp2Session;
+using apache::thrift::transport::TTransportException;
+
+namespace apache { namespace thrift { namespace async {
+
+namespace {
+
+const uint32_t READ_SIZE = 64 * 1024;
+
+}
+
+THttp2Connection::THttp2Connection(struct event_base* eb, THRIFT_SOCKET fd,
+                                   THttp2Session::Role role)
+  : eb_(eb)
+  , fd_(fd)
+  , session_(role)
+  , readEvent_(new struct event)
+  , writeEvent_(new struct event)
+  , writeInterest_(false)
+  , connecting_(false)
+{}
+
+
+THttp2Connection::~THttp2Connection() {
+  // Whoever would want to hear about it is the one destroying us
+  closeCallback_ = CloseCallback();
+  close();
+  delete readEvent_;
+  delete writeEvent_;
+}
+
+
+void THttp2Connection::start(bool connecting) {
+  if (evutil_make_socket_nonblocking(fd_) < 0) {
+    throw TException("THttp2Connection: evutil_make_socket_nonblocking failed");
+  }
+
+  event_set(readEvent_, fd_, EV_READ | EV_PERSIST, eventHandler, this);
+  event_base_set(eb_, readEvent_);
+  event_set(writeEvent_, fd_, EV_WRITE | EV_PERSIST, eventHandler, this);
+  event_base_set(eb_, writeEvent_);
+
+  // Anything submitted while connecting goes out behind the preface
+  session_.start();
+
+  connecting_ = connecting;
+  if (connecting_) {
+    // Writable once connected
+    setWriteInterest(true);
+    return;
+  }
+
+  if (event_add(readEvent_, 0) == -1) {
+    throw TException("THttp2Connection: event_add failed");
+  }
+  flush();
+}
+
+
+void THttp2Connection::close() {
+  if (fd_ == THRIFT_INVALID_SOCKET) {
+    return;
+  }
+  event_del(readEvent_);
+  if (writeInterest_) {
+    event_del(writeEvent_);
+    writeInterest_ = false;
+  }
+  ::THRIFT_CLOSESOCKET(fd_);
+  fd_ = THRIFT_INVALID_SOCKET;
+
+  CloseCallback cob = closeCallback_;
+  closeCallback_ = CloseCallback();
+  if (cob) {
+    cob();
+  }
+}
+
+
+void THttp2Connection::setWriteInterest(bool want) {
+  if (want == writeInterest_) {
+    return;
+  }
+  if (want) {
+    if (event_add(writeEvent_, 0) == -1) {
+      throw TException("THttp2Connection: event_add failed");
+    }
+  } else {
+    event_del(writeEvent_);
+  }
+  writeInterest_ = want;
+}
+
+
+void THttp2Connection::flush() {
+  if (fd_ == THRIFT_INVALID_SOCKET || connecting_) {
+    return;
+  }
+
+  int flags = 0;
+#ifdef MSG_NOSIGNAL
+  flags |= MSG_NOSIGNAL;
+#endif // ifdef MSG_NOSIGNAL
+
+  uint32_t len;
+  const uint8_t* buf;
+  while ((buf = session_.getOutput(&len)) != NULL) {
+    int sent = static_cast<int>(send(fd_, reinterpret_cast<const char*>(buf), len, flags));
+    if (sent < 0) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy == THRIFT_EAGAIN || errno_copy == THRIFT_EWOULDBLOCK) {
+        setWriteInterest(true);
+        return;
+      }
+      if (errno_copy == THRIFT_EINTR) {
+        continue;
+      }
+      GlobalOutput.perror("THttp2Connection::flush() send() ", errno_copy);
+      close();
+      return;
+    }
+    session_.consumeOutput(static_cast<uint32_t>(sent));
+  }
+  setWriteInterest(false);
+
+  if (session_.isGoingAway() && session_.getNumStreams() == 0) {
+    close();
+  }
+}
+
+
+void THttp2Connection::handleRead() {
+  uint8_t buf[READ_SIZE];
+  while (fd_ != THRIFT_INVALID_SOCKET) {
+    int got = static_cast<int>(recv(fd_, reinterpret_cast<char*>(buf), READ_SIZE, 0));
+    if (got == 0) {
+      close();
+      return;
+    }
+    if (got < 0) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy == THRIFT_EAGAIN || errno_copy == THRIFT_EWOULDBLOCK) {
+        break;
+      }
+      if (errno_copy == THRIFT_EINTR) {
+        continue;
+      }
+      if (errno_copy != THRIFT_ECONNRESET) {
+        GlobalOutput.perror("THttp2Connection::handleRead() recv() ", errno_copy);
+      }
+      close();
+      return;
+    }
+
+    try {
+      session_.receive(buf, static_cast<uint32_t>(got));
+    } catch (const TTransportException& e) {
+      // The session has queued a GOAWAY; get it out if we can, then quit
+      GlobalOutput.printf("THttp2Connection: %s", e.what());
+      flush();
+      close();
+      return;
+    }
+  }
+  flush();
+}
+
+
+void THttp2Connection::handleWrite() {
+  if (connecting_) {
+    int error = 0;
+    socklen_t errorLen = sizeof(error);
+    if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &errorLen) < 0) {
+      error = THRIFT_GET_SOCKET_ERROR;
+    }
+    if (error != 0) {
+      GlobalOutput.perror("THttp2Connection: connect() ", error);
+      close();
+      return;
+    }
+    connecting_ = false;
+    if (event_add(readEvent_, 0) == -1) {
+      close();
+      return;
+    }
+  }
+  flush();
+}
+
+
+/* static */ void THttp2Connection::eventHandler(THRIFT_SOCKET fd, short which, void* self) {
+  (void) fd;
+  // Callbacks run below may drop the last other reference to us
+  boost::shared_ptr<THttp2Connection> conn(
+      static_cast<THttp2Connection*>(self)->shared_from_this());
+  try {
+    if (which & EV_READ) {
+      conn->handleRead();
+    } else if (which & EV_WRITE) {
+      conn->handleWrite();
+    }
+  } catch (std::exception& e) {
+    // don't propagate a C++ exception in C code (e.g. libevent)
+    std::cerr << "THttp2Connection::eventHandler exception thrown (ignored): "
+              << e.what() << std::endl;
+    conn->close();
+  }
+}
+
+
+}}} // apache::thrift::async
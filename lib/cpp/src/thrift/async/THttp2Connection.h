@@ -0,0 +1,105 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_THTTP2_CONNECTION_H_
+#define _THRIFT_THTTP2_CONNECTION_H_ 1
+
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <thrift/cxxfunctional.h>
+#include <thrift/transport/PlatformSocket.h>
+#include <thrift/transport/THttp2Session.h>
+
+struct event_base;
+struct event;
+
+namespace apache { namespace thrift { namespace async {
+
+/**
+ * Runs a THttp2Session over a non-blocking socket on a libevent event_base:
+ * whatever arrives is fed to the session, and whatever the session queues
+ * is written out.  Shared by THttp2Server and THttp2ClientChannel.
+ *
+ * Must be owned by a shared_ptr, and only used from the event loop thread.
+ */
+class THttp2Connection : public boost::enable_shared_from_this<THttp2Connection> {
+ public:
+  typedef apache::thrift::stdcxx::function<void()> CloseCallback;
+
+  /**
+   * Takes ownership of fd, which may still be connecting.
+   */
+  THttp2Connection(struct event_base* eb, THRIFT_SOCKET fd,
+                   apache::thrift::transport::THttp2Session::Role role);
+  ~THttp2Connection();
+
+  apache::thrift::transport::THttp2Session& getSession() {
+    return session_;
+  }
+
+  /**
+   * Called once the connection is gone, from the event loop.  May be run
+   * from inside any call on the connection.
+   */
+  void setCloseCallback(const CloseCallback& cob) {
+    closeCallback_ = cob;
+  }
+
+  /**
+   * Start the session and the IO.  If connecting, nothing is written until
+   * the socket turns out to be connected.
+   */
+  void start(bool connecting);
+
+  /**
+   * Write what the session has queued, waiting for the socket to become
+   * writable if it has to.  Closes the connection if the session has
+   * nothing left to do.
+   */
+  void flush();
+
+  void close();
+
+  bool isOpen() const {
+    return fd_ != THRIFT_INVALID_SOCKET;
+  }
+  // Still true after close() if the connection was never made
+  bool isConnecting() const {
+    return connecting_;
+  }
+
+ private:
+  static void eventHandler(THRIFT_SOCKET fd, short which, void* self);
+  void handleRead();
+  void handleWrite();
+  void setWriteInterest(bool want);
+
+  struct event_base* eb_;
+  THRIFT_SOCKET fd_;
+  apache::thrift::transport::THttp2Session session_;
+  struct event* readEvent_;
+  struct event* writeEvent_;
+  bool writeInterest_;
+  bool connecting_;
+  CloseCallback closeCallback_;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_THTTP2_CONNECTION_H_
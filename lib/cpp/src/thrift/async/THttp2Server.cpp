@@ -0,0 +1,317 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/async/THttp2Server.h>
+#include <thrift/async/THttp2Connection.h>
+#include <thrift/async/TAsyncBufferProcessor.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+#include <event.h>
+
+#include <iostream>
+#include <boost/scoped_ptr.hpp>
+
+using apache::thrift::transport::THpackHeader;
+using apache::thrift::transport::THpackHeaders;
+using apache::thrift::transport::THttp2Session;
+using apache::thrift::transport::TMemoryBuffer;
+
+namespace apache { namespace thrift { namespace async {
+
+
+struct THttp2Server::RequestContext {
+  boost::shared_ptr<THttp2Connection> conn;
+  uint32_t streamId;
+  boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> ibuf;
+  boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> obuf;
+
+  RequestContext(boost::shared_ptr<THttp2Connection> conn, uint32_t streamId, const std::string& body);
+};
+
+
+namespace {
+
+void respond(THttp2Session& session, uint32_t streamId, const char* status,
+             const uint8_t* body, uint32_t len) {
+  THpackHeaders headers;
+  headers.push_back(THpackHeader(":status", status));
+  if (len > 0) {
+    headers.push_back(THpackHeader("content-type", "application/x-thrift"));
+  }
+  session.submitResponse(streamId, headers, body, len);
+}
+
+}
+
+
+THttp2Server::THttp2Server(boost::shared_ptr<TAsyncBufferProcessor> processor, int port)
+  : processor_(processor)
+  , eb_(NULL)
+  , ownEventBase_(true)
+  , listenSocket_(THRIFT_INVALID_SOCKET)
+  , listenEvent_(NULL)
+  , maxConcurrentStreams_(THttp2Session::DEFAULT_MAX_CONCURRENT_STREAMS)
+{
+  eb_ = event_base_new();
+  if (eb_ == NULL) {
+    throw TException("event_base_new failed");
+  }
+  try {
+    listen(port);
+  } catch (...) {
+    event_base_free(eb_);
+    throw;
+  }
+}
+
+
+THttp2Server::THttp2Server(boost::shared_ptr<TAsyncBufferProcessor> processor,
+                           struct event_base* eb, int port)
+  : processor_(processor)
+  , eb_(eb)
+  , ownEventBase_(false)
+  , listenSocket_(THRIFT_INVALID_SOCKET)
+  , listenEvent_(NULL)
+  , maxConcurrentStreams_(THttp2Session::DEFAULT_MAX_CONCURRENT_STREAMS)
+{
+  if (port != 0) {
+    listen(port);
+  }
+}
+
+
+THttp2Server::~THttp2Server() {
+  if (listenEvent_ != NULL) {
+    event_del(listenEvent_);
+    delete listenEvent_;
+  }
+  if (listenSocket_ != THRIFT_INVALID_SOCKET) {
+    THRIFT_CLOSESOCKET(listenSocket_);
+  }
+  // Requests still in the processor keep their connection alive, but it
+  // must not outlive the event_base
+  for (std::set<boost::shared_ptr<THttp2Connection> >::iterator it = connections_.begin();
+       it != connections_.end(); ++it) {
+    (*it)->setCloseCallback(THttp2Connection::CloseCallback());
+    (*it)->close();
+  }
+  connections_.clear();
+  if (ownEventBase_) {
+    event_base_free(eb_);
+  }
+}
+
+
+void THttp2Server::listen(int port) {
+  char portStr[sizeof("65535")];
+  sprintf(portStr, "%d", port);
+
+  struct addrinfo hints;
+  struct addrinfo* res0;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
+  int error = getaddrinfo(NULL, portStr, &hints, &res0);
+  if (error) {
+    throw TException(std::string("THttp2Server: getaddrinfo failed: ") +
+                     THRIFT_GAI_STRERROR(error));
+  }
+
+  // Prefer IPv6, which normally takes IPv4 connections too
+  struct addrinfo* res = res0;
+  for (struct addrinfo* r = res0; r != NULL; r = r->ai_next) {
+    if (r->ai_family == AF_INET6) {
+      res = r;
+      break;
+    }
+  }
+
+  THRIFT_SOCKET fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd == THRIFT_INVALID_SOCKET) {
+    freeaddrinfo(res0);
+    throw TException("THttp2Server: socket failed");
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, THRIFT_NO_SOCKET_CACHING, reinterpret_cast<const char*>(&one), sizeof(one));
+  if (bind(fd, res->ai_addr, static_cast<int>(res->ai_addrlen)) == -1 ||
+      ::listen(fd, 1024) == -1 ||
+      evutil_make_socket_nonblocking(fd) < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    THRIFT_CLOSESOCKET(fd);
+    freeaddrinfo(res0);
+    GlobalOutput.perror("THttp2Server::listen() ", errno_copy);
+    throw TException("THttp2Server: could not listen");
+  }
+  freeaddrinfo(res0);
+
+  listenSocket_ = fd;
+  listenEvent_ = new struct event;
+  event_set(listenEvent_, listenSocket_, EV_READ | EV_PERSIST, listenHandler, this);
+  event_base_set(eb_, listenEvent_);
+  if (event_add(listenEvent_, 0) == -1) {
+    throw TException("THttp2Server: event_add failed");
+  }
+}
+
+
+int THttp2Server::serve() {
+  if (!ownEventBase_) {
+    throw TException("Unexpected call to THttp2Server::serve");
+  }
+  return event_base_dispatch(eb_);
+}
+
+
+struct event_base* THttp2Server::getEventBase() {
+  return eb_;
+}
+
+
+/* static */ void THttp2Server::listenHandler(THRIFT_SOCKET fd, short which, void* self) {
+  (void) fd;
+  (void) which;
+  try {
+    static_cast<THttp2Server*>(self)->acceptConnections();
+  } catch(std::exception& e) {
+    // don't propagate a C++ exception in C code (e.g. libevent)
+    std::cerr << "THttp2Server::listenHandler exception thrown (ignored): " << e.what() << std::endl;
+  }
+}
+
+
+void THttp2Server::acceptConnections() {
+  while (true) {
+    THRIFT_SOCKET fd = accept(listenSocket_, NULL, NULL);
+    if (fd == THRIFT_INVALID_SOCKET) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy != THRIFT_EAGAIN && errno_copy != THRIFT_EWOULDBLOCK &&
+          errno_copy != THRIFT_EINTR) {
+        GlobalOutput.perror("THttp2Server::acceptConnections() accept() ", errno_copy);
+      }
+      return;
+    }
+    addConnection(fd);
+  }
+}
+
+
+void THttp2Server::addConnection(THRIFT_SOCKET fd) {
+  boost::shared_ptr<THttp2Connection> conn(
+      new THttp2Connection(eb_, fd, THttp2Session::SERVER));
+  THttp2Session& session = conn->getSession();
+  session.setMaxConcurrentStreams(maxConcurrentStreams_);
+
+  // The connection is kept by connections_ until it closes, so the
+  // callbacks don't hold a reference of their own
+  THttp2Connection* raw = conn.get();
+  session.setMessageCallback(
+    apache::thrift::stdcxx::bind(
+      &THttp2Server::process,
+      this,
+      raw,
+      apache::thrift::stdcxx::placeholders::_1,
+      apache::thrift::stdcxx::placeholders::_2,
+      apache::thrift::stdcxx::placeholders::_3));
+  conn->setCloseCallback(
+    apache::thrift::stdcxx::bind(&THttp2Server::closed, this, raw));
+
+  connections_.insert(conn);
+  conn->start(false);
+}
+
+
+void THttp2Server::closed(THttp2Connection* conn) {
+  connections_.erase(conn->shared_from_this());
+}
+
+
+THttp2Server::RequestContext::RequestContext(boost::shared_ptr<THttp2Connection> conn,
+                                             uint32_t streamId, const std::string& body)
+  : conn(conn)
+  , streamId(streamId)
+  , ibuf(new TMemoryBuffer(reinterpret_cast<uint8_t*>(const_cast<char*>(body.data())),
+                           static_cast<uint32_t>(body.size()), TMemoryBuffer::COPY))
+  , obuf(new TMemoryBuffer())
+{}
+
+
+void THttp2Server::process(THttp2Connection* conn, uint32_t streamId,
+                           const THpackHeaders& headers, const std::string& body) {
+  std::string method;
+  for (THpackHeaders::const_iterator it = headers.begin(); it != headers.end(); ++it) {
+    if (it->first == ":method") {
+      method = it->second;
+      break;
+    }
+  }
+  if (method != "POST") {
+    respond(conn->getSession(), streamId, "405", NULL, 0);
+    return;
+  }
+
+  RequestContext* ctx = new RequestContext(conn->shared_from_this(), streamId, body);
+  try {
+    processor_->process(
+        apache::thrift::stdcxx::bind(
+          &THttp2Server::complete,
+          this,
+          ctx,
+          apache::thrift::stdcxx::placeholders::_1),
+        ctx->ibuf,
+        ctx->obuf);
+  } catch(std::exception& e) {
+    GlobalOutput.printf("THttp2Server: processor threw: %s", e.what());
+    respond(conn->getSession(), streamId, "500", NULL, 0);
+  }
+}
+
+
+void THttp2Server::complete(RequestContext* ctx, bool success) {
+  boost::scoped_ptr<RequestContext> ptr(ctx);
+  if (!ctx->conn->isOpen()) {
+    return;
+  }
+
+  uint8_t* obuf;
+  uint32_t sz;
+  ctx->obuf->getBuffer(&obuf, &sz);
+  respond(ctx->conn->getSession(), ctx->streamId, success ? "200" : "400", obuf, sz);
+
+  // Completions run outside of the connection's own event handling when
+  // the processor is asynchronous, so nothing else would write this out
+  ctx->conn->flush();
+}
+
+
+}}} // apache::thrift::async
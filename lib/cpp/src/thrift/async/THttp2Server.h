@@ -0,0 +1,106 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_THTTP2_SERVER_H_
+#define _THRIFT_THTTP2_SERVER_H_ 1
+
+#include <set>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/transport/PlatformSocket.h>
+#include <thrift/transport/THpack.h>
+
+struct event_base;
+struct event;
+
+namespace apache { namespace thrift { namespace async {
+
+class TAsyncBufferProcessor;
+class THttp2Connection;
+
+/**
+ * The HTTP/2 counterpart of TEvhttpServer: serves a TAsyncBufferProcessor
+ * on a libevent event_base, with every connection carrying any number of
+ * concurrent calls as separate streams.  Each POST is one call, whatever
+ * its path, and responses go out as soon as the processor completes them,
+ * in any order.
+ *
+ * Clients have to speak HTTP/2 from the start (h2c with prior knowledge),
+ * as THttp2ClientChannel and proxies configured for HTTP/2 backends do.
+ */
+class THttp2Server {
+ public:
+  /**
+   * Create a THttp2Server with an embedded event_base, listening on port.
+   * Call "serve" on this server to serve forever.
+   */
+  THttp2Server(boost::shared_ptr<TAsyncBufferProcessor> processor, int port);
+
+  /**
+   * Create a THttp2Server listening on port from an external event_base.
+   * Pass a port of 0 to only serve sockets handed to addConnection().
+   * Do not call "serve" on this server.
+   */
+  THttp2Server(boost::shared_ptr<TAsyncBufferProcessor> processor,
+               struct event_base* eb, int port);
+
+  ~THttp2Server();
+
+  /**
+   * Serve a socket accepted elsewhere.  The server takes ownership.
+   */
+  void addConnection(THRIFT_SOCKET fd);
+
+  /**
+   * How many calls each client may have in flight on one connection.
+   * Applies to connections accepted from then on.
+   */
+  void setMaxConcurrentStreams(uint32_t maxConcurrentStreams) {
+    maxConcurrentStreams_ = maxConcurrentStreams;
+  }
+
+  int serve();
+
+  struct event_base* getEventBase();
+
+ private:
+  struct RequestContext;
+
+  void listen(int port);
+  static void listenHandler(THRIFT_SOCKET fd, short which, void* self);
+  void acceptConnections();
+
+  void process(THttp2Connection* conn, uint32_t streamId,
+               const apache::thrift::transport::THpackHeaders& headers,
+               const std::string& body);
+  void complete(RequestContext* ctx, bool success);
+  void closed(THttp2Connection* conn);
+
+  boost::shared_ptr<TAsyncBufferProcessor> processor_;
+  struct event_base* eb_;
+  bool ownEventBase_;
+  THRIFT_SOCKET listenSocket_;
+  struct event* listenEvent_;
+  uint32_t maxConcurrentStreams_;
+  std::set<boost::shared_ptr<THttp2Connection> > connections_;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_THTTP2_SERVER_H_
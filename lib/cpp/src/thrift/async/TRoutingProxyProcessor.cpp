@@ -0,0 +1,385 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/async/TRoutingProxyProcessor.h>
+#include <thrift/TApplicationException.h>
+#include <thrift/async/TFramedClientChannel.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#include <cerrno>
+#include <sys/types.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#include <event.h>
+
+#include <iostream>
+
+using namespace apache::thrift::protocol;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+namespace apache { namespace thrift { namespace async {
+
+/**
+ * A request on its way to a backend.  The request is the frame still in
+ * the connection's read buffer, which TNonblockingServer keeps until the
+ * call is answered.
+ */
+class TRoutingProxyProcessor::Call {
+ public:
+  Call(const uint8_t* frame, uint32_t size)
+    : request(const_cast<uint8_t*>(frame), size)
+    , response(NULL, 0) {}
+
+  apache::thrift::stdcxx::function<void(bool success)> cob;
+  shared_ptr<TProtocol> out;
+  Route* route;
+  std::string name;
+  int32_t seqid;
+  bool oneway;
+  TMemoryBuffer request;
+  /// Observes the backend's response while finish() runs
+  TMemoryBuffer response;
+};
+
+class TRoutingProxyProcessor::LoopRunner : public Runnable {
+ public:
+  LoopRunner(struct event_base* eb) : eb_(eb) {}
+
+  void run() {
+    event_base_loop(eb_, 0);
+  }
+
+ private:
+  struct event_base* eb_;
+};
+
+
+TRoutingProxyProcessor::TRoutingProxyProcessor()
+  : eb_(event_base_new())
+  , notifyEvent_(new struct event)
+  , stopping_(false) {
+  if (eb_ == NULL) {
+    delete notifyEvent_;
+    throw TException("TRoutingProxyProcessor: event_base_new failed");
+  }
+  if (evutil_socketpair(AF_LOCAL, SOCK_STREAM, 0, notifyFds_) == -1) {
+    GlobalOutput.perror("TRoutingProxyProcessor: socketpair() ", EVUTIL_SOCKET_ERROR());
+    event_base_free(eb_);
+    delete notifyEvent_;
+    throw TException("TRoutingProxyProcessor: can't create notification pipe");
+  }
+  if (evutil_make_socket_nonblocking(notifyFds_[0]) < 0 ||
+      evutil_make_socket_nonblocking(notifyFds_[1]) < 0) {
+    ::THRIFT_CLOSESOCKET(notifyFds_[0]);
+    ::THRIFT_CLOSESOCKET(notifyFds_[1]);
+    event_base_free(eb_);
+    delete notifyEvent_;
+    throw TException("TRoutingProxyProcessor: can't make notification pipe nonblocking");
+  }
+
+  event_set(notifyEvent_, notifyFds_[0], EV_READ | EV_PERSIST, notifyHandler, this);
+  event_base_set(eb_, notifyEvent_);
+  if (event_add(notifyEvent_, 0) == -1) {
+    ::THRIFT_CLOSESOCKET(notifyFds_[0]);
+    ::THRIFT_CLOSESOCKET(notifyFds_[1]);
+    event_base_free(eb_);
+    delete notifyEvent_;
+    throw TException("TRoutingProxyProcessor: event_add failed");
+  }
+}
+
+
+TRoutingProxyProcessor::~TRoutingProxyProcessor() {
+  stop();
+
+  // The server is gone, so there is nobody left to answer
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    delete pending_[i];
+  }
+  pending_.clear();
+
+  // Backends take their events off eb_ as they go
+  routes_.clear();
+  event_del(notifyEvent_);
+  delete notifyEvent_;
+  ::THRIFT_CLOSESOCKET(notifyFds_[0]);
+  ::THRIFT_CLOSESOCKET(notifyFds_[1]);
+  event_base_free(eb_);
+}
+
+
+void TRoutingProxyProcessor::addRoute(const std::string& name,
+                                      const shared_ptr<TAsyncChannel>& backend) {
+  routes_[name].backends.push_back(backend);
+}
+
+
+void TRoutingProxyProcessor::addRoute(const std::string& name,
+                                      const std::string& host,
+                                      int port,
+                                      int64_t timeout) {
+  addRoute(name, shared_ptr<TAsyncChannel>(
+                   new TFramedClientChannel(host.c_str(), port, eb_, timeout)));
+}
+
+
+void TRoutingProxyProcessor::addOnewayMethod(const std::string& name) {
+  onewayMethods_.insert(name);
+}
+
+
+void TRoutingProxyProcessor::start() {
+  if (thread_) {
+    return;
+  }
+  {
+    Guard g(mutex_);
+    stopping_ = false;
+  }
+
+  PlatformThreadFactory factory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+    PlatformThreadFactory::OTHER,  // scheduler
+    PlatformThreadFactory::NORMAL, // priority
+    1,                             // stack size (MB)
+#endif
+    false                          // detached
+  );
+  thread_ = factory.newThread(shared_ptr<Runnable>(new LoopRunner(eb_)));
+  thread_->start();
+}
+
+
+void TRoutingProxyProcessor::stop() {
+  if (!thread_) {
+    return;
+  }
+  {
+    Guard g(mutex_);
+    stopping_ = true;
+  }
+  notify();
+  thread_->join();
+  thread_.reset();
+}
+
+
+void TRoutingProxyProcessor::process(
+    apache::thrift::stdcxx::function<void(bool success)> _return,
+    shared_ptr<TProtocol> in,
+    shared_ptr<TProtocol> out) {
+  TMemoryBuffer* ibuf = dynamic_cast<TMemoryBuffer*>(in->getTransport().get());
+  if (ibuf == NULL) {
+    throw TException("TRoutingProxyProcessor: the request is not in a TMemoryBuffer");
+  }
+
+  // Take the frame as it is before reading the header out of it
+  uint32_t size = ibuf->available_read();
+  const uint8_t* frame = ibuf->borrow(NULL, &size);
+
+  std::string name;
+  TMessageType type;
+  int32_t seqid;
+  in->readMessageBegin(name, type, seqid);
+  if (size >= 2 && frame[0] == 0x82) {
+    // TCompactProtocol reads a oneway call back as a call
+    type = static_cast<TMessageType>((frame[1] >> 5) & 0x07);
+  }
+  bool oneway = type == T_ONEWAY || onewayMethods_.count(name) != 0;
+
+  Route* route = findRoute(name);
+  if (route == NULL) {
+    if (!oneway) {
+      answerWithError(out.get(), name, seqid, TApplicationException::UNKNOWN_METHOD,
+                      "No route for method " + name);
+    }
+    _return(true);
+    return;
+  }
+
+  Call* call = new Call(frame, size);
+  call->cob = _return;
+  call->out = out;
+  call->route = route;
+  call->name.swap(name);
+  call->seqid = seqid;
+  call->oneway = oneway;
+  enqueue(call);
+}
+
+
+TRoutingProxyProcessor::Route* TRoutingProxyProcessor::findRoute(const std::string& name) {
+  std::map<std::string, Route>::iterator it = routes_.find(name);
+  if (it != routes_.end()) {
+    return &it->second;
+  }
+
+  std::string::size_type separator = name.find(':');
+  if (separator != std::string::npos) {
+    it = routes_.find(name.substr(0, separator));
+    if (it != routes_.end()) {
+      return &it->second;
+    }
+  }
+
+  it = routes_.find(std::string());
+  return it != routes_.end() ? &it->second : NULL;
+}
+
+
+void TRoutingProxyProcessor::answerWithError(TProtocol* out,
+                                             const std::string& name,
+                                             int32_t seqid,
+                                             int type,
+                                             const std::string& message) {
+  TApplicationException x(static_cast<TApplicationException::TApplicationExceptionType>(type),
+                          message);
+  out->writeMessageBegin(name, T_EXCEPTION, seqid);
+  x.write(out);
+  out->writeMessageEnd();
+  out->getTransport()->writeEnd();
+  out->getTransport()->flush();
+}
+
+
+void TRoutingProxyProcessor::enqueue(Call* call) {
+  bool wasEmpty;
+  {
+    Guard g(mutex_);
+    wasEmpty = pending_.empty();
+    pending_.push_back(call);
+  }
+  // Calls queued behind the first are picked up by the same wakeup
+  if (wasEmpty) {
+    notify();
+  }
+}
+
+
+void TRoutingProxyProcessor::notify() {
+  char byte = 0;
+  if (send(notifyFds_[1], &byte, 1, 0) < 0 && THRIFT_GET_SOCKET_ERROR != THRIFT_EAGAIN) {
+    GlobalOutput.perror("TRoutingProxyProcessor: notify send() ", THRIFT_GET_SOCKET_ERROR);
+  }
+}
+
+
+void TRoutingProxyProcessor::handleNotify() {
+  char drain[64];
+  while (recv(notifyFds_[0], drain, sizeof(drain), 0) > 0) {
+  }
+
+  bool stopping;
+  {
+    Guard g(mutex_);
+    dispatching_.swap(pending_);
+    stopping = stopping_;
+  }
+  for (size_t i = 0; i < dispatching_.size(); ++i) {
+    dispatch(dispatching_[i]);
+  }
+  dispatching_.clear();
+
+  if (stopping) {
+    event_base_loopbreak(eb_);
+  }
+}
+
+
+void TRoutingProxyProcessor::dispatch(Call* call) {
+  // In turn, passing over backends in trouble while there are others
+  Route& route = *call->route;
+  size_t count = route.backends.size();
+  size_t chosen = route.next % count;
+  for (size_t i = 0; i < count; ++i) {
+    size_t candidate = (route.next + i) % count;
+    if (route.backends[candidate]->good()) {
+      chosen = candidate;
+      break;
+    }
+  }
+  route.next = chosen + 1;
+  TAsyncChannel* backend = route.backends[chosen].get();
+
+  try {
+    if (call->oneway) {
+      // Finished once the backend has taken it
+      backend->sendMessage(
+        apache::thrift::stdcxx::bind(&TRoutingProxyProcessor::finish, this, call),
+        &call->request);
+    } else {
+      backend->sendAndRecvMessage(
+        apache::thrift::stdcxx::bind(&TRoutingProxyProcessor::finish, this, call),
+        &call->request, &call->response);
+    }
+  } catch (const std::exception& x) {
+    GlobalOutput.printf("TRoutingProxyProcessor: forwarding %s failed: %s",
+                        call->name.c_str(), x.what());
+    finish(call);
+  }
+}
+
+
+void TRoutingProxyProcessor::finish(Call* call) {
+  bool success = true;
+  try {
+    if (!call->oneway) {
+      uint32_t size = call->response.available_read();
+      if (size > 0) {
+        const uint8_t* response = call->response.borrow(NULL, &size);
+        call->out->getTransport()->write(response, size);
+      } else {
+        answerWithError(call->out.get(), call->name, call->seqid,
+                        TApplicationException::INTERNAL_ERROR,
+                        "Backend failed to answer " + call->name);
+      }
+    }
+  } catch (const std::exception& x) {
+    GlobalOutput.printf("TRoutingProxyProcessor: answering %s failed: %s",
+                        call->name.c_str(), x.what());
+    success = false;
+  }
+
+  apache::thrift::stdcxx::function<void(bool success)> cob = call->cob;
+  delete call;
+  cob(success);
+}
+
+
+/* static */ void TRoutingProxyProcessor::notifyHandler(THRIFT_SOCKET fd, short which, void* self) {
+  (void) fd;
+  (void) which;
+  try {
+    static_cast<TRoutingProxyProcessor*>(self)->handleNotify();
+  } catch (std::exception& e) {
+    // don't propagate a C++ exception in C code (e.g. libevent)
+    std::cerr << "TRoutingProxyProcessor::notifyHandler exception thrown (ignored): "
+              << e.what() << std::endl;
+  }
+}
+
+}}} // apache::thrift::async
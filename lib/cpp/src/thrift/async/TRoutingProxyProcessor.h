@@ -0,0 +1,171 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TROUTING_PROXY_PROCESSOR_H_
+#define _THRIFT_TROUTING_PROXY_PROCESSOR_H_ 1
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/async/TAsyncChannel.h>
+#include <thrift/async/TAsyncProcessor.h>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/concurrency/Thread.h>
+#include <thrift/transport/PlatformSocket.h>
+
+struct event_base;
+struct event;
+
+namespace apache { namespace thrift { namespace async {
+
+/**
+ * TAsyncProcessor that makes TNonblockingServer a routing proxy.  Only the
+ * message header of each request is read, for the method name; the frame
+ * itself goes to a backend as it came, without being decoded or written
+ * out again, and the backend's response goes back to the client the same
+ * way.
+ *
+ * A request goes to the route named by its method name, failing that to
+ * the route named by the service in front of the ':' of a name sent
+ * through TMultiplexedProtocol, and failing that to the route named "".
+ * A request with no route is answered with an UNKNOWN_METHOD exception.
+ * Each route is a pool of backends, TAsyncChannels that take calls while
+ * others are outstanding, used in turn; backends that are not good() are
+ * passed over while any other is.
+ *
+ * The backends run on an event_base of the proxy's own, in a thread that
+ * start() launches.  Backends added by host and port are
+ * TFramedClientChannels, which give each request a sequence id of their
+ * own on the way out and the client's back on the response, so any number
+ * of clients share one backend connection.  A call the backend fails is
+ * answered with an INTERNAL_ERROR exception.  Requests have to be framed
+ * binary, compact or JSON, with no input transport factory in between.
+ *
+ * Oneway calls are passed on with nothing sent back.  Clients that send
+ * them as T_CALL, as the generated C++ clients do, need their names given
+ * to addOnewayMethod(), or the proxy waits for a response that never comes.
+ *
+ * Add routes before start(), and stop the server before the proxy.
+ *
+ * <blockquote><code>
+ *     shared_ptr<TRoutingProxyProcessor> proxy(new TRoutingProxyProcessor());
+ *     proxy->addRoute("Calculator", "calc1", 9090);
+ *     proxy->addRoute("Calculator", "calc2", 9090);
+ *     proxy->addRoute("", "fallback", 9090);
+ *     proxy->start();
+ *
+ *     TNonblockingServer server(proxy, protocolFactory, port);
+ *     server.serve();
+ * </code></blockquote>
+ */
+class TRoutingProxyProcessor : public TAsyncProcessor {
+ public:
+  TRoutingProxyProcessor();
+  ~TRoutingProxyProcessor();
+
+  /**
+   * Add a backend to the route, making it if need be.
+   *
+   * @param backend takes calls on getEventBase().
+   */
+  void addRoute(const std::string& name,
+                const boost::shared_ptr<TAsyncChannel>& backend);
+
+  /**
+   * Add a TFramedClientChannel to host:port to the route.
+   *
+   * @param timeout milliseconds to wait for each response, or 0 to wait
+   *                as long as the connection lasts.
+   */
+  void addRoute(const std::string& name,
+                const std::string& host,
+                int port,
+                int64_t timeout = 0);
+
+  /**
+   * Treat calls to the method as oneway whatever their message type.
+   *
+   * @param name as the client sends it, service prefix and all.
+   */
+  void addOnewayMethod(const std::string& name);
+
+  /// Where backends have to run
+  struct event_base* getEventBase() const { return eb_; }
+
+  /// Launch the thread running the backends
+  void start();
+
+  /// Stop that thread; calls in flight are never answered
+  void stop();
+
+  virtual void process(apache::thrift::stdcxx::function<void(bool success)> _return,
+                       boost::shared_ptr<protocol::TProtocol> in,
+                       boost::shared_ptr<protocol::TProtocol> out);
+
+ private:
+  struct Route {
+    std::vector<boost::shared_ptr<TAsyncChannel> > backends;
+    size_t next;
+
+    Route() : next(0) {}
+  };
+
+  class Call;
+  class LoopRunner;
+
+  Route* findRoute(const std::string& name);
+
+  void answerWithError(protocol::TProtocol* out,
+                       const std::string& name,
+                       int32_t seqid,
+                       int type,
+                       const std::string& message);
+
+  /// Hand a call over to the backend thread
+  void enqueue(Call* call);
+  void notify();
+
+  /// The backend thread's side
+  void handleNotify();
+  void dispatch(Call* call);
+  void finish(Call* call);
+
+  static void notifyHandler(THRIFT_SOCKET fd, short which, void* self);
+
+  std::map<std::string, Route> routes_;
+  std::set<std::string> onewayMethods_;
+
+  struct event_base* eb_;
+  THRIFT_SOCKET notifyFds_[2];
+  struct event* notifyEvent_;
+  boost::shared_ptr<apache::thrift::concurrency::Thread> thread_;
+
+  apache::thrift::concurrency::Mutex mutex_;
+  /// Calls waiting for the backend thread, and whether to stop it
+  std::vector<Call*> pending_;
+  bool stopping_;
+  /// Calls taken from pending_, only touched by the backend thread
+  std::vector<Call*> dispatching_;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_TROUTING_PROXY_PROCESSOR_H_
@@ -0,0 +1,148 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/async/TScatterGather.h>
+#include <thrift/Thrift.h>
+#include <thrift/concurrency/Util.h>
+#include <event.h>
+
+using apache::thrift::concurrency::Util;
+
+namespace apache { namespace thrift { namespace async {
+
+
+TScatterGather::TScatterGather(struct event_base* eb, size_t numShards,
+                               size_t quorum, const DoneCallback& done)
+  : eb_(eb)
+  , quorum_(quorum)
+  , doneCob_(done)
+  , shards_(numShards)
+  , numSucceeded_(0)
+  , numFailed_(0)
+  , done_(false)
+{
+  if (quorum_ > numShards) {
+    throw TException("TScatterGather: quorum larger than the shards");
+  }
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    shards_[i].gather = this;
+    shards_[i].index = i;
+    shards_[i].state = SHARD_PENDING;
+    shards_[i].timer = NULL;
+    shards_[i].timerArmed = false;
+  }
+}
+
+
+TScatterGather::~TScatterGather() {
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    if (shards_[i].timerArmed) {
+      event_del(shards_[i].timer);
+    }
+    delete shards_[i].timer;
+  }
+}
+
+
+TScatterGather::ShardCallback TScatterGather::start(size_t shard, int64_t timeout) {
+  if (!done_ && !self_) {
+    self_ = shared_from_this();
+  }
+
+  Shard& s = shards_.at(shard);
+  if (timeout > 0 && !done_) {
+    if (s.timer == NULL) {
+      s.timer = new struct event;
+      evtimer_set(s.timer, timerHandler, &s);
+      event_base_set(eb_, s.timer);
+    }
+    struct timeval tv;
+    Util::toTimeval(tv, timeout);
+    if (evtimer_add(s.timer, &tv) == -1) {
+      throw TException("TScatterGather: evtimer_add failed");
+    }
+    s.timerArmed = true;
+  }
+
+  return apache::thrift::stdcxx::bind(&TScatterGather::shardDone, shared_from_this(),
+                                      shard, apache::thrift::stdcxx::placeholders::_1);
+}
+
+
+void TScatterGather::shardDone(size_t shard, bool succeeded) {
+  Shard& s = shards_.at(shard);
+  if (s.state != SHARD_PENDING) {
+    // Answered after its deadline
+    return;
+  }
+  finish(s, succeeded ? SHARD_SUCCEEDED : SHARD_FAILED);
+}
+
+
+void TScatterGather::finish(Shard& shard, ShardState state) {
+  shard.state = state;
+  if (shard.timerArmed) {
+    event_del(shard.timer);
+    shard.timerArmed = false;
+  }
+  if (state == SHARD_SUCCEEDED) {
+    ++numSucceeded_;
+  } else {
+    ++numFailed_;
+  }
+
+  if (done_ ||
+      (numSucceeded_ < quorum_ && shards_.size() - numFailed_ >= quorum_)) {
+    return;
+  }
+
+  // The outcome is known; the shards still out no longer matter
+  done_ = true;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    if (shards_[i].timerArmed) {
+      event_del(shards_[i].timer);
+      shards_[i].timerArmed = false;
+    }
+  }
+
+  // Let go of ourselves only once the callback is through with us
+  boost::shared_ptr<TScatterGather> self;
+  self.swap(self_);
+  DoneCallback cob = doneCob_;
+  doneCob_ = DoneCallback();
+  cob(this);
+}
+
+
+/* static */ void TScatterGather::timerHandler(THRIFT_SOCKET fd, short which, void* arg) {
+  (void) fd;
+  (void) which;
+  Shard* shard = static_cast<Shard*>(arg);
+  shard->timerArmed = false;
+  try {
+    shard->gather->finish(*shard, SHARD_TIMED_OUT);
+  } catch(const std::exception& e) {
+    // don't propagate a C++ exception in C code (e.g. libevent)
+    GlobalOutput.printf("TScatterGather::timerHandler exception thrown (ignored): %s",
+                        e.what());
+  }
+}
+
+
+}}} // apache::thrift::async
@@ -0,0 +1,127 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TSCATTER_GATHER_H_
+#define _THRIFT_TSCATTER_GATHER_H_ 1
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <thrift/cxxfunctional.h>
+#include <thrift/transport/PlatformSocket.h>
+
+struct event_base;
+struct event;
+
+namespace apache { namespace thrift { namespace async {
+
+/**
+ * Waits on a call fanned out to several shards, as cob-style clients make
+ * them, until a quorum of them have answered.
+ *
+ * start() gives back the callback a shard's call is to run once the
+ * client has read its response, saying whether it succeeded.  A shard not
+ * heard from by its deadline counts as failed.  The done callback runs,
+ * on eb, as soon as the quorum has succeeded or enough shards have failed
+ * that it can't; shards answering later are ignored, there being no way
+ * to take back a request.  For example:
+ *
+ *   boost::shared_ptr<TScatterGather> gather(
+ *       new TScatterGather(eb, shards.size(), quorum, done));
+ *   for (size_t i = 0; i < shards.size(); ++i) {
+ *     shards[i]->get(tcxx::bind(onGet, _1, &results[i], gather->start(i, 50)), key);
+ *   }
+ *
+ * where onGet() calls recv_get() and the callback with whether it threw.
+ * The gather has to be held by a shared_ptr; it keeps itself, and the
+ * callbacks keep it, alive as long as they are needed.
+ */
+class TScatterGather : public boost::enable_shared_from_this<TScatterGather> {
+ public:
+  enum ShardState {
+    SHARD_PENDING,
+    SHARD_SUCCEEDED,
+    SHARD_FAILED,
+    SHARD_TIMED_OUT
+  };
+
+  typedef apache::thrift::stdcxx::function<void(TScatterGather* gather)> DoneCallback;
+  typedef apache::thrift::stdcxx::function<void(bool succeeded)> ShardCallback;
+
+  /**
+   * @param numShards the shards the call goes to.
+   * @param quorum the shards that have to succeed; at most numShards.
+   * @param done run once, when the outcome is known.
+   */
+  TScatterGather(struct event_base* eb, size_t numShards, size_t quorum,
+                 const DoneCallback& done);
+  ~TScatterGather();
+
+  /**
+   * Start waiting on a shard.
+   *
+   * @param timeout milliseconds before giving up on it, or 0 to wait.
+   * @return the callback its call is to run when it is answered.
+   */
+  ShardCallback start(size_t shard, int64_t timeout = 0);
+
+  /// What start()'s callback does
+  void shardDone(size_t shard, bool succeeded);
+
+  ShardState getState(size_t shard) const { return shards_[shard].state; }
+
+  size_t getNumShards() const { return shards_.size(); }
+  size_t getQuorum() const { return quorum_; }
+  size_t getNumSucceeded() const { return numSucceeded_; }
+  size_t getNumFailed() const { return numFailed_; }
+
+  /// Whether the done callback has run, or is running
+  bool isDone() const { return done_; }
+
+  /// Whether the quorum succeeded, once done
+  bool reachedQuorum() const { return numSucceeded_ >= quorum_; }
+
+ private:
+  struct Shard {
+    TScatterGather* gather;
+    size_t index;
+    ShardState state;
+    struct event* timer;
+    bool timerArmed;
+  };
+
+  void finish(Shard& shard, ShardState state);
+
+  static void timerHandler(THRIFT_SOCKET fd, short which, void* arg);
+
+  struct event_base* eb_;
+  size_t quorum_;
+  DoneCallback doneCob_;
+  std::vector<Shard> shards_;
+  size_t numSucceeded_;
+  /// Failed and timed out
+  size_t numFailed_;
+  bool done_;
+  /// Holds on to the gather until it is done, for its timers
+  boost::shared_ptr<TScatterGather> self_;
+};
+
+}}} // apache::thrift::async
+
+#endif // #ifndef _THRIFT_TSCATTER_GATHER_H_
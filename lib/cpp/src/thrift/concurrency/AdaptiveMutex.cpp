@@ -0,0 +1,67 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/concurrency/AdaptiveMutex.h>
+#include <thrift/concurrency/Atomic.h>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+AdaptiveMutex::AdaptiveMutex(int maxSpins)
+  : Mutex(Mutex::DEFAULT_INITIALIZER),
+    maxSpins_(maxSpins),
+    spins_(0) {}
+
+bool AdaptiveMutex::spin() const {
+  if (Mutex::trylock()) {
+    return true;
+  }
+
+  // Spin up to twice as long as lockers have lately, as glibc's adaptive
+  // mutexes do, and move the estimate an eighth of the way to this spin
+  int64_t estimate = atomicLoad<ATOMIC_RELAXED>(&spins_);
+  int64_t limit = estimate * 2 + 10;
+  if (limit > maxSpins_) {
+    limit = maxSpins_;
+  }
+
+  for (int64_t count = 0; count < limit; ++count) {
+    cpuRelax();
+    if (Mutex::trylock()) {
+      atomicStore<ATOMIC_RELAXED>(&spins_, estimate + (count - estimate) / 8);
+      return true;
+    }
+  }
+
+  atomicStore<ATOMIC_RELAXED>(&spins_, estimate + (limit - estimate) / 8);
+  return false;
+}
+
+void AdaptiveMutex::lock() const {
+  if (!spin()) {
+    Mutex::lock();
+  }
+}
+
+bool AdaptiveMutex::timedlock(int64_t milliseconds) const {
+  return spin() || Mutex::timedlock(milliseconds);
+}
+
+}}} // apache::thrift::concurrency
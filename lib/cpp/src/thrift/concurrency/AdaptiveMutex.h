@@ -0,0 +1,54 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_ADAPTIVEMUTEX_H_
+#define _THRIFT_CONCURRENCY_ADAPTIVEMUTEX_H_ 1
+
+#include <thrift/concurrency/Mutex.h>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+/**
+ * A mutex for very short critical sections, such as a few counters.
+ *
+ * A locker that finds the mutex held spins on it for a while before
+ * parking in the underlying Mutex, so a lock that is released within a
+ * few hundred nanoseconds costs no sleep and wake-up.  How long it spins
+ * adapts to how long recent lockers had to spin, up to maxSpins, so a
+ * mutex that is held for long soon stops wasting CPU on it.
+ *
+ * It is a Mutex, so it can be used with Guard and Monitor as any other.
+ */
+class AdaptiveMutex : public Mutex {
+ public:
+  AdaptiveMutex(int maxSpins = 1000);
+
+  virtual void lock() const;
+  virtual bool timedlock(int64_t milliseconds) const;
+
+ private:
+  bool spin() const;
+
+  const int maxSpins_;
+  mutable volatile int64_t spins_;
+};
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_ADAPTIVEMUTEX_H_
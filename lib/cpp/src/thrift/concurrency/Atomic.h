@@ -0,0 +1,217 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_ATOMIC_H_
+#define _THRIFT_CONCURRENCY_ATOMIC_H_ 1
+
+#include <thrift/thrift-config.h>
+
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#define THRIFT_ATOMIC_INTERLOCKED 1
+#endif
+
+/**
+ * Atomic operations on plain integers and pointers, for the places that
+ * count or hand off without a lock, until the library can rely on C++11's
+ * <atomic>.  GCC and clang use their __atomic builtins; MSVC, or any build
+ * defining THRIFT_ATOMIC_INTERLOCKED and supplying the Interlocked
+ * functions as the tests do, uses the Interlocked family.
+ *
+ * The variables are only ever touched through these, and must be naturally
+ * aligned.  Loads and stores take their memory order as a template
+ * argument, as in atomicLoad<ATOMIC_ACQUIRE>(&head); the read-modify-write
+ * operations are sequentially consistent.
+ */
+
+namespace apache { namespace thrift { namespace concurrency {
+
+/// As C++11's memory orders; the values are GCC's __ATOMIC_ constants
+enum AtomicOrder {
+  ATOMIC_RELAXED = 0,
+  ATOMIC_ACQUIRE = 2,
+  ATOMIC_RELEASE = 3,
+  ATOMIC_SEQ_CST = 5
+};
+
+/// Keeps an argument from taking part in deducing T
+template <typename T>
+struct AtomicValue {
+  typedef T type;
+};
+
+#if defined(THRIFT_ATOMIC_INTERLOCKED)
+
+// In a namespace of its own, so a test built with this branch doesn't
+// share instantiations with a library built with the other
+namespace interlocked {
+
+template <size_t Size>
+struct InterlockedWord;
+
+template <>
+struct InterlockedWord<4> {
+  typedef LONG type;
+  static LONG compareExchange(volatile void* p, LONG v, LONG expected) {
+    return InterlockedCompareExchange(static_cast<volatile LONG*>(p), v, expected);
+  }
+  static LONG exchange(volatile void* p, LONG v) {
+    return InterlockedExchange(static_cast<volatile LONG*>(p), v);
+  }
+  static LONG exchangeAdd(volatile void* p, LONG v) {
+    return InterlockedExchangeAdd(static_cast<volatile LONG*>(p), v);
+  }
+};
+
+template <>
+struct InterlockedWord<8> {
+  typedef LONGLONG type;
+  static LONGLONG compareExchange(volatile void* p, LONGLONG v, LONGLONG expected) {
+    return InterlockedCompareExchange64(static_cast<volatile LONGLONG*>(p), v, expected);
+  }
+  static LONGLONG exchange(volatile void* p, LONGLONG v) {
+    return InterlockedExchange64(static_cast<volatile LONGLONG*>(p), v);
+  }
+  static LONGLONG exchangeAdd(volatile void* p, LONGLONG v) {
+    return InterlockedExchangeAdd64(static_cast<volatile LONGLONG*>(p), v);
+  }
+};
+
+template <typename T>
+inline typename InterlockedWord<sizeof(T)>::type toWord(T v) {
+  typename InterlockedWord<sizeof(T)>::type w;
+  memcpy(&w, &v, sizeof(v));
+  return w;
+}
+
+template <typename T>
+inline T fromWord(typename InterlockedWord<sizeof(T)>::type w) {
+  T v;
+  memcpy(&v, &w, sizeof(v));
+  return v;
+}
+
+template <AtomicOrder Order, typename T>
+inline T atomicLoad(const volatile T* p) {
+  // An aligned load no wider than a pointer is whole; ordering it, or a
+  // wider one, takes a locked instruction
+  if (Order == ATOMIC_RELAXED && sizeof(T) <= sizeof(void*)) {
+    return *p;
+  }
+  return fromWord<T>(InterlockedWord<sizeof(T)>::compareExchange(const_cast<volatile T*>(p),
+                                                                 0, 0));
+}
+
+template <AtomicOrder Order, typename T>
+inline void atomicStore(volatile T* p, typename AtomicValue<T>::type v) {
+  if (Order == ATOMIC_RELAXED && sizeof(T) <= sizeof(void*)) {
+    *p = v;
+  } else {
+    InterlockedWord<sizeof(T)>::exchange(p, toWord(v));
+  }
+}
+
+template <typename T>
+inline T atomicAdd(volatile T* p, typename AtomicValue<T>::type v) {
+  return fromWord<T>(InterlockedWord<sizeof(T)>::exchangeAdd(p, toWord(v))) + v;
+}
+
+template <typename T>
+inline T atomicExchange(volatile T* p, typename AtomicValue<T>::type v) {
+  return fromWord<T>(InterlockedWord<sizeof(T)>::exchange(p, toWord(v)));
+}
+
+template <typename T>
+inline bool atomicCompareAndSwap(volatile T* p,
+                                 typename AtomicValue<T>::type expected,
+                                 typename AtomicValue<T>::type v) {
+  return InterlockedWord<sizeof(T)>::compareExchange(p, toWord(v), toWord(expected))
+         == toWord(expected);
+}
+
+inline void atomicFence() {
+  MemoryBarrier();
+}
+
+inline void cpuRelax() {
+  YieldProcessor();
+}
+
+}
+
+using namespace interlocked;
+
+#elif defined(__GNUC__)
+
+/// The value at p
+template <AtomicOrder Order, typename T>
+inline T atomicLoad(const volatile T* p) {
+  return __atomic_load_n(p, Order);
+}
+
+/// Set the value at p to v
+template <AtomicOrder Order, typename T>
+inline void atomicStore(volatile T* p, typename AtomicValue<T>::type v) {
+  __atomic_store_n(p, v, Order);
+}
+
+/// Add v to the value at p, returning the sum
+template <typename T>
+inline T atomicAdd(volatile T* p, typename AtomicValue<T>::type v) {
+  return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+/// Set the value at p to v, returning what it was
+template <typename T>
+inline T atomicExchange(volatile T* p, typename AtomicValue<T>::type v) {
+  return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+/// Set the value at p to v if it is expected, returning whether it was
+template <typename T>
+inline bool atomicCompareAndSwap(volatile T* p,
+                                 typename AtomicValue<T>::type expected,
+                                 typename AtomicValue<T>::type v) {
+  return __atomic_compare_exchange_n(p, &expected, v, false, __ATOMIC_SEQ_CST,
+                                     __ATOMIC_RELAXED);
+}
+
+/// Orders every load and store before it with every one after it
+inline void atomicFence() {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/// Tells the processor it is in a spin loop
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+#else
+#error "Atomic.h needs atomic operations for this compiler"
+#endif
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_ATOMIC_H_
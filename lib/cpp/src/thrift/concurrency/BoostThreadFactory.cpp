@@ -55,6 +55,7 @@ class BoostThread: public Thread {
   STATE state_;
   weak_ptr<BoostThread> self_;
   bool detached_;
+  ThreadPlacement placement_;
 
  public:
 
@@ -105,6 +106,8 @@ class BoostThread: public Thread {
 
   void runnable(shared_ptr<Runnable> value) { Thread::runnable(value); }
 
+  void placement(const ThreadPlacement& value) { placement_ = value; }
+
   void weakRef(shared_ptr<BoostThread> self) {
     assert(self.get() == this);
     self_ = weak_ptr<BoostThread>(self);
@@ -123,6 +126,11 @@ void* BoostThread::threadMain(void* arg) {
     return (void*)0;
   }
 
+  if (!thread->placement_.empty() && !thread->placement_.apply()) {
+    GlobalOutput.printf("BoostThread: could not fully apply placement of thread %s",
+                        thread->placement_.name.c_str());
+  }
+
   thread->state_ = started;
   thread->runnable()->run();
 
@@ -139,6 +147,7 @@ class BoostThreadFactory::Impl {
 
  private:
   bool detached_;
+  ThreadPlacement placement_;
 
  public:
 
@@ -153,6 +162,7 @@ class BoostThreadFactory::Impl {
   shared_ptr<Thread> newThread(shared_ptr<Runnable> runnable) const {
     shared_ptr<BoostThread> result = shared_ptr<BoostThread>(new BoostThread(detached_, runnable));
     result->weakRef(result);
+    result->placement(placement_);
     runnable->thread(result);
     return result;
   }
@@ -161,6 +171,10 @@ class BoostThreadFactory::Impl {
 
   void setDetached(bool value) { detached_ = value; }
 
+  const ThreadPlacement& getPlacement() const { return placement_; }
+
+  void setPlacement(const ThreadPlacement& value) { placement_ = value; }
+
   Thread::id_t getCurrentThreadId() const {
     return boost::this_thread::get_id();
   }
@@ -175,6 +189,10 @@ bool BoostThreadFactory::isDetached() const { return impl_->isDetached(); }
 
 void BoostThreadFactory::setDetached(bool value) { impl_->setDetached(value); }
 
+ThreadPlacement BoostThreadFactory::getPlacement() const { return impl_->getPlacement(); }
+
+void BoostThreadFactory::setPlacement(const ThreadPlacement& value) { impl_->setPlacement(value); }
+
 Thread::id_t BoostThreadFactory::getCurrentThreadId() const { return impl_->getCurrentThreadId(); }
 
 }}} // apache::thrift::concurrency
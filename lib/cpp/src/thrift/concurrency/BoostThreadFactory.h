@@ -21,6 +21,7 @@
 #define _THRIFT_CONCURRENCY_BOOSTTHREADFACTORY_H_ 1
 
 #include <thrift/concurrency/Thread.h>
+#include <thrift/concurrency/ThreadPlacement.h>
 
 #include <boost/shared_ptr.hpp>
 
@@ -65,6 +66,17 @@ class BoostThreadFactory : public ThreadFactory {
    */
   virtual bool isDetached() const;
 
+  /**
+   * Sets where created threads run and what they are called.  By default
+   * they run anywhere, under the name they inherit.
+   */
+  virtual void setPlacement(const ThreadPlacement& placement);
+
+  /**
+   * Gets the placement of created threads
+   */
+  virtual ThreadPlacement getPlacement() const;
+
 private:
   class Impl;
   boost::shared_ptr<Impl> impl_;
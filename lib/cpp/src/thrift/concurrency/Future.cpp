@@ -0,0 +1,135 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/concurrency/Future.h>
+#include <thrift/concurrency/Util.h>
+
+#include <exception>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+Future::Future() :
+  done_(false),
+  failed_(false) {}
+
+bool Future::isDone() const {
+  Synchronized s(monitor_);
+  return done_;
+}
+
+void Future::wait() const {
+  Synchronized s(monitor_);
+  while (!done_) {
+    monitor_.waitForever();
+  }
+}
+
+bool Future::wait(int64_t timeout) const {
+  if (timeout <= 0LL) {
+    return isDone();
+  }
+  int64_t deadline = Util::monotonicTime() + timeout;
+  Synchronized s(monitor_);
+  while (!done_) {
+    int64_t left = deadline - Util::monotonicTime();
+    if (left <= 0LL) {
+      break;
+    }
+    monitor_.waitForTimeRelative(left);
+  }
+  return done_;
+}
+
+bool Future::failed() const {
+  Synchronized s(monitor_);
+  return failed_;
+}
+
+std::string Future::error() const {
+  Synchronized s(monitor_);
+  return error_;
+}
+
+void Future::then(const Continuation& f) {
+  {
+    Synchronized s(monitor_);
+    if (!done_) {
+      continuations_.push_back(f);
+      return;
+    }
+  }
+  try {
+    f();
+  } catch (...) {
+  }
+}
+
+void Future::complete() {
+  finish(false, std::string());
+}
+
+void Future::fail(const std::string& error) {
+  finish(true, error);
+}
+
+void Future::finish(bool failed, const std::string& error) {
+  std::vector<Continuation> continuations;
+  {
+    Synchronized s(monitor_);
+    if (done_) {
+      return;
+    }
+    done_ = true;
+    failed_ = failed;
+    error_ = error;
+    continuations.swap(continuations_);
+    monitor_.notifyAll();
+  }
+  for (size_t i = 0; i < continuations.size(); ++i) {
+    try {
+      continuations[i]();
+    } catch (...) {
+    }
+  }
+}
+
+FutureTask::FutureTask(boost::shared_ptr<Runnable> runnable) :
+  runnable_(runnable),
+  future_(new Future()) {}
+
+FutureTask::~FutureTask() {
+  future_->fail("task was not run");
+}
+
+void FutureTask::run() {
+  try {
+    runnable_->run();
+  } catch (const std::exception& e) {
+    future_->fail(e.what());
+    return;
+  } catch (...) {
+    future_->fail("unknown exception");
+    return;
+  }
+  future_->complete();
+}
+
+}}} // apache::thrift::concurrency
@@ -0,0 +1,119 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_FUTURE_H_
+#define _THRIFT_CONCURRENCY_FUTURE_H_ 1
+
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+#include <thrift/cxxfunctional.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/Thread.h>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+/**
+ * The outcome of a task given to ThreadManager::submit(): whether it has
+ * run yet, and whether it threw.
+ *
+ * Continuations added with then() run once the task has, on the thread
+ * that ran it, or right away on the caller's if it already has.  To have
+ * a continuation run as a task of its own, it can add one.
+ */
+class Future {
+ public:
+  typedef apache::thrift::stdcxx::function<void()> Continuation;
+
+  Future();
+
+  /**
+   * Whether the task has run, or been dropped without running.
+   */
+  bool isDone() const;
+
+  /**
+   * Blocks until the task is done.
+   */
+  void wait() const;
+
+  /**
+   * Blocks until the task is done, or timeout ms have passed.
+   *
+   * @return Whether the task is done.
+   */
+  bool wait(int64_t timeout) const;
+
+  /**
+   * Whether the task threw, or was dropped, as by expiring or by its
+   * manager stopping, before it could run.  Only meaningful once done.
+   */
+  bool failed() const;
+
+  /**
+   * What the task threw, or why it did not run, if it failed.
+   */
+  std::string error() const;
+
+  /**
+   * Runs f once the task is done.  Whatever f throws is ignored.
+   */
+  void then(const Continuation& f);
+
+  /**
+   * Marks the task done, waking those waiting and running the
+   * continuations; only the first call counts.
+   */
+  void complete();
+  void fail(const std::string& error);
+
+ private:
+  void finish(bool failed, const std::string& error);
+
+  Monitor monitor_;
+  bool done_;
+  bool failed_;
+  std::string error_;
+  std::vector<Continuation> continuations_;
+};
+
+/**
+ * A task that completes a Future once its runnable has run, and fails it
+ * if it is destroyed without running, so a dropped task does not leave
+ * its future waiting forever.  ThreadManager::submit() adds one of these;
+ * it can also be made directly, to be given to ThreadManager::addBatch().
+ */
+class FutureTask : public Runnable {
+ public:
+  explicit FutureTask(boost::shared_ptr<Runnable> runnable);
+
+  ~FutureTask();
+
+  void run();
+
+  boost::shared_ptr<Future> future() const { return future_; }
+
+ private:
+  boost::shared_ptr<Runnable> runnable_;
+  boost::shared_ptr<Future> future_;
+};
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_FUTURE_H_
@@ -30,6 +30,11 @@
 
 #include <pthread.h>
 
+// Whether a condition variable can wait on the monotonic clock
+#if defined(CLOCK_MONOTONIC) && !defined(_WIN32) && !defined(__APPLE__)
+#define THRIFT_MONITOR_MONOTONIC 1
+#endif
+
 namespace apache { namespace thrift { namespace concurrency {
 
 using boost::scoped_ptr;
@@ -100,12 +105,13 @@ class Monitor::Impl {
     }
 
     struct THRIFT_TIMESPEC abstime;
-    Util::toTimespec(abstime, Util::currentTime() + timeout_ms);
+    Util::toTimespec(abstime, Util::monotonicTime() + timeout_ms);
     return waitForTime(&abstime);
   }
 
   /**
-   * Waits until the absolute time specified using struct THRIFT_TIMESPEC.
+   * Waits until the absolute time specified using struct THRIFT_TIMESPEC,
+   * on the clock of Util::monotonicTime().
    * Returns 0 if condition occurs, THRIFT_ETIMEDOUT on timeout, or an error code.
    */
   int waitForTime(const THRIFT_TIMESPEC* abstime) const {
@@ -114,6 +120,17 @@ class Monitor::Impl {
       reinterpret_cast<pthread_mutex_t*>(mutex_->getUnderlyingImpl());
     assert(mutexImpl);
 
+#ifndef THRIFT_MONITOR_MONOTONIC
+    // The condition waits on the wall clock; move the deadline onto it
+    int64_t deadline;
+    Util::toUsec(deadline, *abstime);
+    struct THRIFT_TIMESPEC wallAbstime;
+    int64_t wallDeadline = Util::currentTimeUsec() + (deadline - Util::monotonicTimeUsec());
+    wallAbstime.tv_sec = wallDeadline / (1000 * 1000);
+    wallAbstime.tv_nsec = (wallDeadline % (1000 * 1000)) * 1000;
+    abstime = &wallAbstime;
+#endif
+
     // XXX Need to assert that caller owns mutex
     return pthread_cond_timedwait(&pthread_cond_,
                                   mutexImpl,
@@ -158,8 +175,17 @@ class Monitor::Impl {
   void init(Mutex* mutex) {
     mutex_ = mutex;
 
-    if (pthread_cond_init(&pthread_cond_, NULL) == 0) {
-      condInitialized_ = true;
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr) == 0) {
+#ifdef THRIFT_MONITOR_MONOTONIC
+      // So that timed waits aren't cut short or drawn out by the wall clock
+      // being set
+      pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+      if (pthread_cond_init(&pthread_cond_, &attr) == 0) {
+        condInitialized_ = true;
+      }
+      pthread_condattr_destroy(&attr);
     }
 
     if (!condInitialized_) {
@@ -75,13 +75,15 @@ class Monitor : boost::noncopyable {
   int waitForTimeRelative(int64_t timeout_ms) const;
 
   /**
-   * Waits until the absolute time specified using struct THRIFT_TIMESPEC.
+   * Waits until the absolute time specified using struct THRIFT_TIMESPEC,
+   * on the clock of Util::monotonicTime(), which is never set back.
    * Returns 0 if condition occurs, THRIFT_ETIMEDOUT on timeout, or an error code.
    */
   int waitForTime(const THRIFT_TIMESPEC* abstime) const;
 
   /**
-   * Waits until the absolute time specified using struct timeval.
+   * Waits until the absolute time specified using struct timeval, on the
+   * clock of Util::monotonicTime().
    * Returns 0 if condition occurs, THRIFT_ETIMEDOUT on timeout, or an error code.
    */
   int waitForTime(const struct timeval* abstime) const;
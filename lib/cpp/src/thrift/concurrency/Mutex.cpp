@@ -52,7 +52,7 @@ void enableMutexProfiling(int32_t profilingSampleRate,
 #define PROFILE_MUTEX_NOT_LOCKED() \
   do { \
     if (_lock_startTime > 0) { \
-      int64_t endTime = Util::currentTimeUsec(); \
+      int64_t endTime = Util::monotonicTimeUsec(); \
       (*mutexProfilingCallback)(this, endTime - _lock_startTime); \
     } \
   } while (0)
@@ -61,7 +61,7 @@ void enableMutexProfiling(int32_t profilingSampleRate,
   do { \
     profileTime_ = _lock_startTime; \
     if (profileTime_ > 0) { \
-      profileTime_ = Util::currentTimeUsec() - profileTime_; \
+      profileTime_ = Util::monotonicTimeUsec() - profileTime_; \
     } \
   } while (0)
 
@@ -93,7 +93,7 @@ static inline int64_t maybeGetProfilingStartTime() {
     sig_atomic_t localValue = --mutexProfilingCounter;
     if (localValue <= 0) {
       mutexProfilingCounter = mutexProfilingSampleRate;
-      return Util::currentTimeUsec();
+      return Util::monotonicTimeUsec();
     }
   }
 
@@ -144,6 +144,7 @@ class Mutex::impl {
 #if defined(_POSIX_TIMEOUTS) && _POSIX_TIMEOUTS >= 200112L
     PROFILE_MUTEX_START_LOCK();
 
+    // pthread_mutex_timedlock() only takes a wall clock deadline
     struct THRIFT_TIMESPEC ts;
     Util::toTimespec(ts, milliseconds + Util::currentTime());
     int ret = pthread_mutex_timedlock(&pthread_mutex_, &ts);
@@ -162,10 +163,10 @@ class Mutex::impl {
     sleepytime.tv_sec = 0;
     sleepytime.tv_nsec = 10000000L; /* 10ms */
 
-    Util::toTimespec(to, milliseconds + Util::currentTime());
+    Util::toTimespec(to, milliseconds + Util::monotonicTime());
 
     while ((trylock()) == false) {
-      Util::toTimespec(now, Util::currentTime());
+      Util::toTimespec(now, Util::monotonicTime());
       if (now.tv_sec >= to.tv_sec && now.tv_nsec >= to.tv_nsec) {
         return false;
       }
@@ -0,0 +1,162 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/concurrency/MutexProfiler.h>
+#include <thrift/Backtrace.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <pthread.h>
+
+#ifndef THRIFT_NO_CONTENTION_PROFILING
+
+namespace apache { namespace thrift { namespace concurrency {
+
+namespace {
+
+const size_t MAX_SITES = 4096;
+
+/// Bucket 0 is under 1us, bucket n is [2^(n-1), 2^n) us, the last is open
+const int BUCKETS = 32;
+
+struct SiteStats {
+  SiteStats() : count(0), totalWait(0), maxWait(0) {
+    std::fill(histogram, histogram + BUCKETS, 0);
+  }
+
+  int64_t count;
+  int64_t totalWait;
+  int64_t maxWait;
+  int64_t histogram[BUCKETS];
+};
+
+typedef std::map<Backtrace, SiteStats> SiteMap;
+
+// A plain pthread mutex, so that taking it is never profiled itself
+pthread_mutex_t sitesMutex = PTHREAD_MUTEX_INITIALIZER;
+SiteMap sites;
+int64_t droppedSamples = 0;
+
+class SitesGuard {
+ public:
+  SitesGuard() { pthread_mutex_lock(&sitesMutex); }
+  ~SitesGuard() { pthread_mutex_unlock(&sitesMutex); }
+};
+
+int bucketFor(int64_t waitTimeMicros) {
+  int bucket = 0;
+  while (waitTimeMicros > 0 && bucket < BUCKETS - 1) {
+    waitTimeMicros >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void recordContention(const void* id, int64_t waitTimeMicros) {
+  (void) id;
+
+  int const skip = 1; // ignore this frame
+  Backtrace bt(skip);
+
+  SitesGuard g;
+
+  SiteMap::iterator it = sites.find(bt);
+  if (it == sites.end()) {
+    if (sites.size() >= MAX_SITES) {
+      droppedSamples++;
+      return;
+    }
+    it = sites.insert(std::make_pair(bt, SiteStats())).first;
+  }
+
+  SiteStats& stats = it->second;
+  stats.count++;
+  stats.totalWait += waitTimeMicros;
+  stats.maxWait = std::max(stats.maxWait, waitTimeMicros);
+  stats.histogram[bucketFor(waitTimeMicros)]++;
+}
+
+bool waitedLonger(SiteMap::const_iterator a, SiteMap::const_iterator b) {
+  return a->second.totalWait > b->second.totalWait;
+}
+
+}
+
+void enableMutexContentionProfiling(int32_t profilingSampleRate) {
+  if (profilingSampleRate > 0) {
+    enableMutexProfiling(profilingSampleRate, &recordContention);
+  } else {
+    enableMutexProfiling(0, NULL);
+  }
+}
+
+void resetMutexContentionProfile() {
+  SitesGuard g;
+  sites.clear();
+  droppedSamples = 0;
+}
+
+void printMutexContentionProfile(FILE* f) {
+  SitesGuard g;
+
+  std::vector<SiteMap::const_iterator> sorted;
+  sorted.reserve(sites.size());
+  for (SiteMap::const_iterator it = sites.begin(); it != sites.end(); ++it) {
+    sorted.push_back(it);
+  }
+  std::sort(sorted.begin(), sorted.end(), waitedLonger);
+
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    SiteStats const& stats = sorted[i]->second;
+    fprintf(f, "Mutex contention: %lld samples, %lldus total, %lldus max, at:\n",
+            (long long) stats.count, (long long) stats.totalWait,
+            (long long) stats.maxWait);
+    sorted[i]->first.print(f, 2);
+    for (int b = 0; b < BUCKETS; ++b) {
+      if (stats.histogram[b] > 0) {
+        fprintf(f, "  < %lldus: %lld\n", 1LL << b, (long long) stats.histogram[b]);
+      }
+    }
+    fprintf(f, "\n");
+  }
+
+  if (droppedSamples > 0) {
+    fprintf(f, "Mutex contention: %lld samples dropped past %lu stacks\n",
+            (long long) droppedSamples, (unsigned long) MAX_SITES);
+  }
+}
+
+void writeMutexContentionPprof(FILE* f) {
+  SitesGuard g;
+
+  std::vector< std::pair<const Backtrace*, uintptr_t> > samples;
+  samples.reserve(sites.size());
+  for (SiteMap::const_iterator it = sites.begin(); it != sites.end(); ++it) {
+    samples.push_back(std::make_pair(&it->first,
+                                     static_cast<uintptr_t>(it->second.totalWait)));
+  }
+  profile_write_pprof_samples(f, samples, 1);
+}
+
+}}} // apache::thrift::concurrency
+
+#endif // THRIFT_NO_CONTENTION_PROFILING
@@ -0,0 +1,65 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_MUTEXPROFILER_H_
+#define _THRIFT_CONCURRENCY_MUTEXPROFILER_H_ 1
+
+#include <thrift/concurrency/Mutex.h>
+
+#include <stdio.h>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+#ifndef THRIFT_NO_CONTENTION_PROFILING
+
+/**
+ * Lock contention profiler for Mutex and ReadWriteMutex.
+ *
+ * Installs itself as the enableMutexProfiling() callback, so it sees about
+ * one in every profilingSampleRate blocking acquires.  Each sample is filed
+ * under the call stack it was taken from, with a count, a total and a
+ * histogram of wait times in power-of-two microsecond buckets.  Exclusive
+ * acquires are reported on release, so their stacks end in unlock() called
+ * from the same frame that locked; shared acquires are reported at once.
+ *
+ * Stacks are only captured with glibc; elsewhere all samples fall under a
+ * single empty stack.  At most 4096 stacks are kept, and samples from
+ * further stacks are counted as dropped.  A profilingSampleRate of 0 stops
+ * profiling and leaves what has been recorded.
+ */
+void enableMutexContentionProfiling(int32_t profilingSampleRate);
+
+/// Discards everything recorded so far
+void resetMutexContentionProfile();
+
+/// Prints each stack with its samples and histogram, most waited first
+void printMutexContentionProfile(FILE* f);
+
+/**
+ * Writes the profile as Google CPU profiler binary data, weighting each
+ * stack by its total wait in microseconds, so it can be analyzed with
+ * pprof like the output of profile_write_pprof().
+ */
+void writeMutexContentionPprof(FILE* f);
+
+#endif
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_MUTEXPROFILER_H_
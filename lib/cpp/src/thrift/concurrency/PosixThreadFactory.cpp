@@ -66,6 +66,7 @@ class PthreadThread: public Thread {
   int stackSize_;
   weak_ptr<PthreadThread> self_;
   bool detached_;
+  ThreadPlacement placement_;
 
  public:
 
@@ -181,6 +182,8 @@ class PthreadThread: public Thread {
 
   void runnable(shared_ptr<Runnable> value) { Thread::runnable(value); }
 
+  void placement(const ThreadPlacement& value) { placement_ = value; }
+
   void weakRef(shared_ptr<PthreadThread> self) {
     assert(self.get() == this);
     self_ = weak_ptr<PthreadThread>(self);
@@ -203,6 +206,11 @@ void* PthreadThread::threadMain(void* arg) {
   ProfilerRegisterThread();
 #endif
 
+  if (!thread->placement_.empty() && !thread->placement_.apply()) {
+    GlobalOutput.printf("PthreadThread: could not fully apply placement of thread %s",
+                        thread->placement_.name.c_str());
+  }
+
   thread->state_ = started;
   thread->runnable()->run();
   if (thread->state_ != stopping && thread->state_ != stopped) {
@@ -222,6 +230,7 @@ class PosixThreadFactory::Impl {
   PRIORITY priority_;
   int stackSize_;
   bool detached_;
+  ThreadPlacement placement_;
 
   /**
    * Converts generic posix thread schedule policy enums into pthread
@@ -285,6 +294,7 @@ class PosixThreadFactory::Impl {
   shared_ptr<Thread> newThread(shared_ptr<Runnable> runnable) const {
     shared_ptr<PthreadThread> result = shared_ptr<PthreadThread>(new PthreadThread(toPthreadPolicy(policy_), toPthreadPriority(policy_, priority_), stackSize_, detached_, runnable));
     result->weakRef(result);
+    result->placement(placement_);
     runnable->thread(result);
     return result;
   }
@@ -307,6 +317,10 @@ class PosixThreadFactory::Impl {
 
   void setDetached(bool value) { detached_ = value; }
 
+  const ThreadPlacement& getPlacement() const { return placement_; }
+
+  void setPlacement(const ThreadPlacement& value) { placement_ = value; }
+
   Thread::id_t getCurrentThreadId() const {
 
 #ifndef _WIN32
@@ -336,6 +350,10 @@ bool PosixThreadFactory::isDetached() const { return impl_->isDetached(); }
 
 void PosixThreadFactory::setDetached(bool value) { impl_->setDetached(value); }
 
+ThreadPlacement PosixThreadFactory::getPlacement() const { return impl_->getPlacement(); }
+
+void PosixThreadFactory::setPlacement(const ThreadPlacement& value) { impl_->setPlacement(value); }
+
 Thread::id_t PosixThreadFactory::getCurrentThreadId() const { return impl_->getCurrentThreadId(); }
 
 }}} // apache::thrift::concurrency
@@ -0,0 +1,157 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/concurrency/ReadMostly.h>
+#include <thrift/concurrency/Atomic.h>
+#include <thrift/transport/PlatformSocket.h>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+namespace {
+
+const size_t SLOTS = 64;
+const int WRITER_SPINS = 1000;
+
+// No writer, a writer waiting for readers to leave, and a writer holding
+const int64_t FREE = 0;
+const int64_t DRAINING = 1;
+const int64_t WRITING = 2;
+
+}
+
+/**
+ * A reader adds one to a counter on the way in and takes one from a
+ * counter on the way out, not necessarily the same one, so a counter may
+ * go negative; only the sum over all of them counts readers.  Every
+ * reader's increment comes before the writer's flag or is undone, so a
+ * sum of zero read after the flag is set means no reader is left.
+ */
+class ReadMostlyMutex::impl {
+ public:
+  impl() : writer_(FREE) {
+    for (size_t i = 0; i < SLOTS; ++i) {
+      slots_[i].readers = 0;
+    }
+  }
+
+  void acquireRead() const {
+    volatile int64_t* readers = slot();
+    for (;;) {
+      atomicAdd(readers, 1);
+      if (atomicLoad<ATOMIC_SEQ_CST>(&writer_) == FREE) {
+        return;
+      }
+      atomicAdd(readers, -1);
+
+      // Wait out the writer on its mutex rather than spinning
+      writerMutex_.lock();
+      writerMutex_.unlock();
+    }
+  }
+
+  bool attemptRead() const {
+    volatile int64_t* readers = slot();
+    atomicAdd(readers, 1);
+    if (atomicLoad<ATOMIC_SEQ_CST>(&writer_) == FREE) {
+      return true;
+    }
+    atomicAdd(readers, -1);
+    return false;
+  }
+
+  void acquireWrite() const {
+    writerMutex_.lock();
+    atomicStore<ATOMIC_SEQ_CST>(&writer_, DRAINING);
+    for (int spins = 0; readerCount() != 0; ++spins) {
+      if (spins < WRITER_SPINS) {
+        cpuRelax();
+      } else {
+        THRIFT_SLEEP_USEC(50);
+      }
+    }
+    atomicStore<ATOMIC_SEQ_CST>(&writer_, WRITING);
+  }
+
+  bool attemptWrite() const {
+    if (!writerMutex_.trylock()) {
+      return false;
+    }
+    atomicStore<ATOMIC_SEQ_CST>(&writer_, DRAINING);
+    if (readerCount() != 0) {
+      atomicStore<ATOMIC_SEQ_CST>(&writer_, FREE);
+      writerMutex_.unlock();
+      return false;
+    }
+    atomicStore<ATOMIC_SEQ_CST>(&writer_, WRITING);
+    return true;
+  }
+
+  void release() const {
+    // While a writer holds the mutex no reader can, so a release then is
+    // the writer's
+    if (atomicLoad<ATOMIC_SEQ_CST>(&writer_) == WRITING) {
+      atomicStore<ATOMIC_SEQ_CST>(&writer_, FREE);
+      writerMutex_.unlock();
+    } else {
+      atomicAdd(slot(), -1);
+    }
+  }
+
+ private:
+  volatile int64_t* slot() const {
+    // Threads have stacks of their own, so the stack page of a local picks
+    // a counter that no other thread is likely to be using
+    int local = 0;
+    uintptr_t page = reinterpret_cast<uintptr_t>(&local) >> 12;
+    return &slots_[(page ^ (page >> 6)) % SLOTS].readers;
+  }
+
+  int64_t readerCount() const {
+    int64_t count = 0;
+    for (size_t i = 0; i < SLOTS; ++i) {
+      count += atomicLoad<ATOMIC_SEQ_CST>(&slots_[i].readers);
+    }
+    return count;
+  }
+
+  struct Slot {
+    volatile int64_t readers;
+    char pad[128 - sizeof(int64_t)];
+  };
+
+  mutable Slot slots_[SLOTS];
+  mutable volatile int64_t writer_;
+  Mutex writerMutex_;
+};
+
+ReadMostlyMutex::ReadMostlyMutex() : impl_(new ReadMostlyMutex::impl()) {}
+
+void ReadMostlyMutex::acquireRead() const { impl_->acquireRead(); }
+
+void ReadMostlyMutex::acquireWrite() const { impl_->acquireWrite(); }
+
+bool ReadMostlyMutex::attemptRead() const { return impl_->attemptRead(); }
+
+bool ReadMostlyMutex::attemptWrite() const { return impl_->attemptWrite(); }
+
+void ReadMostlyMutex::release() const { impl_->release(); }
+
+}}} // apache::thrift::concurrency
@@ -0,0 +1,99 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_READMOSTLY_H_
+#define _THRIFT_CONCURRENCY_READMOSTLY_H_ 1
+
+#include <thrift/concurrency/Mutex.h>
+
+#include <boost/shared_ptr.hpp>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+/**
+ * A ReadWriteMutex for state that is read on every call and written
+ * rarely, such as a processor map or server configuration.
+ *
+ * Readers count themselves in one of several counters, each on a cache
+ * line of its own, picked by the reader's stack, so readers on different
+ * threads do not write the same line and take no lock.  A writer holds
+ * out new readers, then waits, spinning and sleeping, until the counters
+ * show no reader left.  Writers are preferred: readers that arrive while
+ * one waits block until it is done.
+ *
+ * It is a ReadWriteMutex, so it can be used with RWGuard as any other.  It
+ * is not recursive for readers or writers.
+ */
+class ReadMostlyMutex : public ReadWriteMutex {
+ public:
+  ReadMostlyMutex();
+
+  virtual void acquireRead() const;
+  virtual void acquireWrite() const;
+
+  virtual bool attemptRead() const;
+  virtual bool attemptWrite() const;
+
+  virtual void release() const;
+
+ private:
+  class impl;
+  boost::shared_ptr<impl> impl_;
+};
+
+/**
+ * A value of type T that is read far more often than it is replaced, in
+ * the manner of RCU: get() hands out the current version, which stays
+ * valid for as long as the caller holds it, and set() publishes a new
+ * version without disturbing readers of the old one.
+ *
+ * T should be treated as immutable once published; to change a value, copy
+ * it, change the copy and set() that.
+ */
+template <class T>
+class ReadMostly : boost::noncopyable {
+ public:
+  ReadMostly() {}
+
+  explicit ReadMostly(const boost::shared_ptr<const T>& value) : value_(value) {}
+
+  boost::shared_ptr<const T> get() const {
+    RWGuard g(mutex_, RW_READ);
+    return value_;
+  }
+
+  void set(const boost::shared_ptr<const T>& value) {
+    boost::shared_ptr<const T> old;
+    {
+      RWGuard g(mutex_, RW_WRITE);
+      old = value_;
+      value_ = value;
+    }
+    // The old version, if this held its last reference, is freed here
+    // rather than while readers are held out
+  }
+
+ private:
+  ReadMostlyMutex mutex_;
+  boost::shared_ptr<const T> value_;
+};
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_READMOSTLY_H_
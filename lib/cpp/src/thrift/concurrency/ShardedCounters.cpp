@@ -0,0 +1,177 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/concurrency/ShardedCounters.h>
+#include <thrift/concurrency/Atomic.h>
+
+#if defined(_MSC_VER)
+# define THRIFT_THREAD_LOCAL __declspec(thread)
+#else
+# define THRIFT_THREAD_LOCAL __thread
+#endif
+
+namespace apache { namespace thrift { namespace concurrency {
+
+namespace {
+
+Mutex idMutex;
+uint64_t nextId = 1;
+
+/// The threads' shards for each ShardedCounters they have added to.  An
+/// entry outlives its thread, there being no portable hook for a thread's
+/// exit; server threads live as long as the server, so this costs little
+struct ThreadEntry {
+  uint64_t countersId;
+  void* shard;
+  ThreadEntry* next;
+};
+
+THRIFT_THREAD_LOCAL ThreadEntry* threadEntries = NULL;
+
+/// Values in a row are padded out to whole 128 byte lines, so no two
+/// threads' rows share one
+const size_t LINE_VALUES = 128 / sizeof(int64_t);
+
+}
+
+struct ShardedCounters::Counter {
+  size_t width;
+  /// Taken from the rows' sums on set(), so the total comes out right
+  int64_t base;
+  std::vector<const int64_t*> rows;
+};
+
+struct ShardedCounters::Shard {
+  std::map<std::string, int64_t*> rows;
+};
+
+ShardedCounters::ShardedCounters() {
+  Guard g(idMutex);
+  id_ = nextId++;
+}
+
+ShardedCounters::~ShardedCounters() {
+  // A thread's entry for us stays behind, but our id is never used again
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    delete shards_[i];
+  }
+  for (size_t i = 0; i < rows_.size(); ++i) {
+    delete[] rows_[i];
+  }
+}
+
+ShardedCounters::Shard* ShardedCounters::shard() {
+  for (ThreadEntry* e = threadEntries; e != NULL; e = e->next) {
+    if (e->countersId == id_) {
+      return static_cast<Shard*>(e->shard);
+    }
+  }
+
+  Shard* shard = new Shard;
+  {
+    Guard g(mutex_);
+    shards_.push_back(shard);
+  }
+  ThreadEntry* e = new ThreadEntry;
+  e->countersId = id_;
+  e->shard = shard;
+  e->next = threadEntries;
+  threadEntries = e;
+  return shard;
+}
+
+ShardedCounters::Counter& ShardedCounters::counter(const std::string& key, size_t width) {
+  std::map<std::string, Counter>::iterator it = counters_.find(key);
+  if (it == counters_.end()) {
+    it = counters_.insert(std::make_pair(key, Counter())).first;
+    it->second.width = width;
+    it->second.base = 0;
+  }
+  return it->second;
+}
+
+int64_t ShardedCounters::total(const Counter& counter, size_t index) {
+  int64_t sum = index == 0 ? counter.base : 0;
+  for (size_t i = 0; i < counter.rows.size(); ++i) {
+    sum += atomicLoad<ATOMIC_RELAXED>(&counter.rows[i][index]);
+  }
+  return sum;
+}
+
+int64_t* ShardedCounters::slots(const std::string& key, size_t width) {
+  Shard* s = shard();
+  int64_t*& row = s->rows[key];
+  if (row == NULL) {
+    Guard g(mutex_);
+    Counter& c = counter(key, width);
+    size_t size = (c.width + LINE_VALUES - 1) / LINE_VALUES * LINE_VALUES;
+    int64_t* fresh = new int64_t[size]();
+    rows_.push_back(fresh);
+    c.rows.push_back(fresh);
+    row = fresh;
+  }
+  return row;
+}
+
+void ShardedCounters::add(int64_t* slot, int64_t amount) {
+  atomicStore<ATOMIC_RELAXED>(slot, *slot + amount);
+}
+
+int64_t ShardedCounters::increment(const std::string& key, int64_t amount) {
+  int64_t* slot = slots(key, 1);
+  int64_t value = *slot + amount;
+  atomicStore<ATOMIC_RELAXED>(slot, value);
+  return value;
+}
+
+void ShardedCounters::set(const std::string& key, int64_t value) {
+  Guard g(mutex_);
+  Counter& c = counter(key, 1);
+  c.base += value - total(c, 0);
+}
+
+int64_t ShardedCounters::get(const std::string& key) const {
+  Guard g(mutex_);
+  std::map<std::string, Counter>::const_iterator it = counters_.find(key);
+  return it == counters_.end() ? 0 : total(it->second, 0);
+}
+
+void ShardedCounters::getAll(std::map<std::string, int64_t>& _return) const {
+  Guard g(mutex_);
+  for (std::map<std::string, Counter>::const_iterator it = counters_.begin();
+       it != counters_.end(); ++it) {
+    _return[it->first] = total(it->second, 0);
+  }
+}
+
+void ShardedCounters::getRows(std::map<std::string, std::vector<int64_t> >& _return) const {
+  Guard g(mutex_);
+  for (std::map<std::string, Counter>::const_iterator it = counters_.begin();
+       it != counters_.end(); ++it) {
+    std::vector<int64_t>& row = _return[it->first];
+    row.resize(it->second.width);
+    for (size_t i = 0; i < it->second.width; ++i) {
+      row[i] = total(it->second, i);
+    }
+  }
+}
+
+}}} // apache::thrift::concurrency
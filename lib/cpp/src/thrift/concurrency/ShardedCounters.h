@@ -0,0 +1,108 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_SHARDEDCOUNTERS_H_
+#define _THRIFT_CONCURRENCY_SHARDEDCOUNTERS_H_ 1
+
+#include <thrift/concurrency/Mutex.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+/**
+ * Named counters that are cheap to add to from many threads, such as
+ * per-method call counts.
+ *
+ * Every thread adds to a slot of its own for each counter, on a cache line
+ * of its own, so an increment is a lookup in a map private to the thread
+ * and a store: no lock, no atomic read-modify-write, no line shared with
+ * another thread.  A lock is only taken the first time a thread adds to a
+ * counter.  Reading a counter sums the threads' slots under the lock.
+ *
+ * A counter may also be a row of values kept together, such as a
+ * histogram's buckets: slots() gives the calling thread its own row, to add
+ * to through the pointer without looking the counter up again.
+ *
+ * Reads are exact only once writers are quiet; a read while threads add
+ * sees each slot as it was at some moment during the read.
+ */
+class ShardedCounters : boost::noncopyable {
+ public:
+  ShardedCounters();
+  ~ShardedCounters();
+
+  /**
+   * Add amount to a counter, which starts at 0.
+   *
+   * @return what the calling thread has added to the counter in all, as
+   *         the total would cost a lock.
+   */
+  int64_t increment(const std::string& key, int64_t amount = 1);
+
+  /**
+   * Set a counter.  This takes the lock; increments made while it runs may
+   * or may not be counted.
+   */
+  void set(const std::string& key, int64_t value);
+
+  /**
+   * The calling thread's row of width values for a counter, zero the first
+   * time.  Only the calling thread may add() to it, but it lasts as long as
+   * these counters do.  A counter keeps the width it is first used with.
+   */
+  int64_t* slots(const std::string& key, size_t width);
+
+  /// Add amount to a value of a row from slots()
+  static void add(int64_t* slot, int64_t amount);
+
+  /// A counter's total, or 0 if it has never been touched
+  int64_t get(const std::string& key) const;
+
+  /// Add every counter's total, or first total for rows, to _return
+  void getAll(std::map<std::string, int64_t>& _return) const;
+
+  /// Set _return to every counter's totals, one for each value of its row
+  void getRows(std::map<std::string, std::vector<int64_t> >& _return) const;
+
+ private:
+  struct Counter;
+  struct Shard;
+
+  Shard* shard();
+  Counter& counter(const std::string& key, size_t width);
+  static int64_t total(const Counter& counter, size_t index);
+
+  /// A unique id, so threads can't mistake these counters for deleted ones
+  uint64_t id_;
+
+  /// Guards the counters and the lists below, not the slots' values
+  mutable Mutex mutex_;
+  std::map<std::string, Counter> counters_;
+  std::vector<Shard*> shards_;
+  std::vector<int64_t*> rows_;
+};
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_SHARDEDCOUNTERS_H_
@@ -117,7 +117,8 @@ class Monitor::Impl {
   }
 
   /**
-   * Waits until the absolute time specified using struct timeval.
+   * Waits until the absolute time specified using struct timeval, on the
+   * clock of Util::monotonicTime().
    * Returns 0 if condition occurs, THRIFT_ETIMEDOUT on timeout, or an error code.
    */
   int waitForTime(const struct timeval* abstime) {
@@ -127,7 +128,7 @@ class Monitor::Impl {
     assert(mutexImpl);
 
     struct timeval currenttime;
-    Util::toTimeval(currenttime, Util::currentTime());
+    Util::toTimeval(currenttime, Util::monotonicTime());
 
     long tv_sec  = static_cast<long>(abstime->tv_sec  - currenttime.tv_sec);
     long tv_usec = static_cast<long>(abstime->tv_usec - currenttime.tv_usec);
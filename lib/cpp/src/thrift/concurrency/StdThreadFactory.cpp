@@ -56,6 +56,7 @@ class StdThread: public Thread, public boost::enable_shared_from_this<StdThread>
   std::unique_ptr<std::thread> thread_;
   STATE state_;
   bool detached_;
+  ThreadPlacement placement_;
 
  public:
 
@@ -101,6 +102,8 @@ class StdThread: public Thread, public boost::enable_shared_from_this<StdThread>
 
   boost::shared_ptr<Runnable> runnable() const { return Thread::runnable(); }
 
+  void placement(const ThreadPlacement& value) { placement_ = value; }
+
   void runnable(boost::shared_ptr<Runnable> value) { Thread::runnable(value); }
 };
 
@@ -113,6 +116,11 @@ void StdThread::threadMain(boost::shared_ptr<StdThread> thread) {
     return;
   }
 
+  if (!thread->placement_.empty() && !thread->placement_.apply()) {
+    GlobalOutput.printf("StdThread: could not fully apply placement of thread %s",
+                        thread->placement_.name.c_str());
+  }
+
   thread->state_ = started;
   thread->runnable()->run();
 
@@ -130,6 +138,7 @@ class StdThreadFactory::Impl {
 
  private:
   bool detached_;
+  ThreadPlacement placement_;
 
  public:
 
@@ -143,6 +152,7 @@ class StdThreadFactory::Impl {
    */
   boost::shared_ptr<Thread> newThread(boost::shared_ptr<Runnable> runnable) const {
     boost::shared_ptr<StdThread> result = boost::shared_ptr<StdThread>(new StdThread(detached_, runnable));
+    result->placement(placement_);
     runnable->thread(result);
     return result;
   }
@@ -151,6 +161,10 @@ class StdThreadFactory::Impl {
 
   void setDetached(bool value) { detached_ = value; }
 
+  const ThreadPlacement& getPlacement() const { return placement_; }
+
+  void setPlacement(const ThreadPlacement& value) { placement_ = value; }
+
   Thread::id_t getCurrentThreadId() const {
     return std::this_thread::get_id();
   }
@@ -166,6 +180,10 @@ bool StdThreadFactory::isDetached() const { return impl_->isDetached(); }
 
 void StdThreadFactory::setDetached(bool value) { impl_->setDetached(value); }
 
+ThreadPlacement StdThreadFactory::getPlacement() const { return impl_->getPlacement(); }
+
+void StdThreadFactory::setPlacement(const ThreadPlacement& value) { impl_->setPlacement(value); }
+
 Thread::id_t StdThreadFactory::getCurrentThreadId() const { return impl_->getCurrentThreadId(); }
 
 }}} // apache::thrift::concurrency
@@ -21,6 +21,7 @@
 #define _THRIFT_CONCURRENCY_STDTHREADFACTORY_H_ 1
 
 #include <thrift/concurrency/Thread.h>
+#include <thrift/concurrency/ThreadPlacement.h>
 
 #include <boost/shared_ptr.hpp>
 
@@ -62,6 +63,17 @@ class StdThreadFactory : public ThreadFactory {
    */
   virtual bool isDetached() const;
 
+  /**
+   * Sets where created threads run and what they are called.  By default
+   * they run anywhere, under the name they inherit.
+   */
+  virtual void setPlacement(const ThreadPlacement& placement);
+
+  /**
+   * Gets the placement of created threads
+   */
+  virtual ThreadPlacement getPlacement() const;
+
 private:
   class Impl;
   boost::shared_ptr<Impl> impl_;
@@ -20,15 +20,28 @@
 #include <thrift/thrift-config.h>
 
 #include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/Atomic.h>
+#include <thrift/TAllocTracking.h>
+#include <thrift/TProbe.h>
 #include <thrift/concurrency/Exception.h>
+#include <thrift/concurrency/Future.h>
 #include <thrift/concurrency/Monitor.h>
 #include <thrift/concurrency/Util.h>
 
 #include <boost/shared_ptr.hpp>
 
 #include <assert.h>
-#include <queue>
+#include <algorithm>
+#include <functional>
+#include <map>
 #include <set>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
 
 #if defined(DEBUG)
 #include <iostream>
@@ -39,6 +52,18 @@ namespace apache { namespace thrift { namespace concurrency {
 using boost::shared_ptr;
 using boost::dynamic_pointer_cast;
 
+namespace {
+
+inline void yieldThread() {
+#if defined(_MSC_VER)
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+}
+
 /**
  * ThreadManager class
  *
@@ -47,6 +72,16 @@ using boost::dynamic_pointer_cast;
  * it maintains statistics on number of idle threads, number of active threads,
  * task backlog, and average wait and service times.
  *
+ * Pending tasks are kept in a heap per priority class, ordered by expiration
+ * and then by when they were added, so the next task to run and every
+ * expired one are always at the top of a heap.
+ *
+ * Idle workers sleep on a monitor each, on a stack, so a new task wakes
+ * just the one idle the shortest time, whose cache is likeliest to still
+ * be warm.  With idleSpin(), a few of them first spin a while, watching
+ * for a task without the mutex, and a task that one of them will see
+ * wakes no other.
+ *
  * @version $Id:$
  */
 class ThreadManager::Impl : public ThreadManager  {
@@ -58,6 +93,16 @@ class ThreadManager::Impl : public ThreadManager  {
     idleCount_(0),
     pendingTaskCountMax_(0),
     expiredCount_(0),
+    taskCount_(0),
+    taskSequence_(0),
+    workerLimit_(0),
+    workerMinCount_(0),
+    growLatency_(0LL),
+    idleTimeout_(0LL),
+    lastDispatch_(0LL),
+    spinLimit_(0),
+    spinTime_(0LL),
+    spinningCount_(0),
     state_(ThreadManager::UNINITIALIZED),
     monitor_(&mutex_),
     maxMonitor_(&mutex_) {}
@@ -99,12 +144,12 @@ class ThreadManager::Impl : public ThreadManager  {
 
   size_t pendingTaskCount() const {
     Synchronized s(monitor_);
-    return tasks_.size();
+    return taskCount_;
   }
 
   size_t totalTaskCount() const {
     Synchronized s(monitor_);
-    return tasks_.size() + workerCount_ - idleCount_;
+    return taskCount_ + workerCount_ - idleCount_;
   }
 
   size_t pendingTaskCountMax() const {
@@ -126,7 +171,15 @@ class ThreadManager::Impl : public ThreadManager  {
 
   bool canSleep();
 
-  void add(shared_ptr<Runnable> value, int64_t timeout, int64_t expiration);
+  void add(shared_ptr<Runnable> value, int64_t timeout, int64_t expiration) {
+    addWithPriority(value, 0, timeout, expiration);
+  }
+
+  void addWithPriority(shared_ptr<Runnable> value, int priority, int64_t timeout,
+                       int64_t expiration);
+
+  void addBatch(const std::vector<shared_ptr<Runnable> >& values, int64_t timeout,
+                int64_t expiration);
 
   void remove(shared_ptr<Runnable> task);
 
@@ -136,28 +189,102 @@ class ThreadManager::Impl : public ThreadManager  {
 
   void setExpireCallback(ExpireCallback expireCallback);
 
+  void idleSpin(size_t count, int64_t spinTime) {
+    Synchronized s(monitor_);
+    spinLimit_ = count;
+    spinTime_ = spinTime;
+  }
+
+protected:
+  /**
+   * Lets the pool grow to maxCount workers when a task has waited
+   * growLatency ms with none idle, and shrink to minCount as workers go
+   * idleTimeout ms without a task.
+   */
+  void adaptive(size_t minCount, size_t maxCount, int64_t growLatency,
+                int64_t idleTimeout) {
+    Synchronized s(monitor_);
+    workerMinCount_ = minCount;
+    workerLimit_ = maxCount;
+    growLatency_ = growLatency;
+    idleTimeout_ = idleTimeout;
+    lastDispatch_ = Util::monotonicTime();
+  }
+
 private:
+  // Orders a heap of tasks so that the one to run next is on top
+  struct TaskOrder {
+    bool operator()(const shared_ptr<Task>& a, const shared_ptr<Task>& b) const;
+  };
+
+  typedef std::vector<shared_ptr<Task> > TaskHeap;
+
   void stopImpl(bool join);
 
+  // Takes the next task to run; there must be one
+  shared_ptr<Task> popTask();
+
+  // Makes a task for a runnable, reusing a spare one if there is any
+  shared_ptr<Task> newTask(shared_ptr<Runnable> value, int64_t expiration);
+
+  // Keeps a task that has been run, once its worker no longer needs it
+  void recycleTask(shared_ptr<Task>& task);
+
+  // Wakes a sleeping worker for each of count new tasks, but for those the
+  // spinning workers will take, most recently idle first
+  void wakeWorkers(size_t count);
+
+  // Waits up to spinTime_ for a task without the mutex, which must be held
+  // on entry and is again on return
+  void spinForTask();
+
+  // Whether to add a worker, now that a task has waited that long; if so,
+  // the worker is counted, and must be started with growWorker() once the
+  // mutex is released
+  bool needWorker(int64_t waited);
+
+  void growWorker();
+
+  // Whether an idle worker should go; if so, it is no longer counted
+  bool retireWorker();
+
+  // Drops the threads of workers that have exited; workerMonitor_ is held
+  void reapDeadWorkers();
+
   size_t workerCount_;
   size_t workerMaxCount_;
   size_t idleCount_;
   size_t pendingTaskCountMax_;
   size_t expiredCount_;
+  size_t taskCount_;
+  uint64_t taskSequence_;
+  size_t workerLimit_;        // 0 unless adaptive
+  size_t workerMinCount_;
+  int64_t growLatency_;
+  int64_t idleTimeout_;       // 0 waits for tasks forever
+  int64_t lastDispatch_;
+  size_t spinLimit_;          // 0 never spins
+  int64_t spinTime_;          // microseconds
+  size_t spinningCount_;
   ExpireCallback expireCallback_;
+  // Tasks that have run, kept to spare an allocation on the next add()
+  std::vector<shared_ptr<Task> > spareTasks_;
 
   ThreadManager::STATE state_;
   shared_ptr<ThreadFactory> threadFactory_;
 
 
   friend class ThreadManager::Task;
-  std::queue<shared_ptr<Task> > tasks_;
+  // Highest priority first; heaps are kept once made, even if emptied
+  std::map<int, TaskHeap, std::greater<int> > tasks_;
   Mutex mutex_;
   Monitor monitor_;
   Monitor maxMonitor_;
   Monitor workerMonitor_;
 
   friend class ThreadManager::Worker;
+  // Sleeping idle workers, the one idle the shortest time last
+  std::vector<Worker*> idleWorkers_;
   std::set<shared_ptr<Thread> > workers_;
   std::set<shared_ptr<Thread> > deadWorkers_;
   std::map<const Thread::id_t, shared_ptr<Thread> > idMap_;
@@ -173,13 +300,24 @@ class ThreadManager::Task : public Runnable {
     COMPLETE
   };
 
-  Task(shared_ptr<Runnable> runnable, int64_t expiration=0LL)  :
+  Task(shared_ptr<Runnable> runnable, int64_t expiration=0LL, uint64_t sequence=0)  :
     runnable_(runnable),
     state_(WAITING),
-    expireTime_(expiration != 0LL ? Util::currentTime() + expiration : 0LL) {}
+    expireTime_(expiration != 0LL ? Util::monotonicTime() + expiration : 0LL),
+    sequence_(sequence),
+    addTime_(0LL) {}
 
   ~Task() {}
 
+  // Readies a task that has been run to be added again
+  void reset(shared_ptr<Runnable> runnable, int64_t expiration, uint64_t sequence) {
+    runnable_ = runnable;
+    state_ = WAITING;
+    expireTime_ = expiration != 0LL ? Util::monotonicTime() + expiration : 0LL;
+    sequence_ = sequence;
+    addTime_ = 0LL;
+  }
+
   void run() {
     if (state_ == EXECUTING) {
       runnable_->run();
@@ -195,13 +333,44 @@ class ThreadManager::Task : public Runnable {
     return expireTime_;
   }
 
+  uint64_t getSequence() const {
+    return sequence_;
+  }
+
  private:
   shared_ptr<Runnable> runnable_;
   friend class ThreadManager::Worker;
   STATE state_;
   int64_t expireTime_;
+  uint64_t sequence_;
+  friend class ThreadManager::Impl;
+  int64_t addTime_;           // only kept by adaptive managers
 };
 
+bool ThreadManager::Impl::TaskOrder::operator()(const shared_ptr<Task>& a,
+                                                const shared_ptr<Task>& b) const {
+  // Whether a runs after b; tasks that never expire go after those that do
+  uint64_t aExpire = static_cast<uint64_t>(a->getExpireTime()) - 1;
+  uint64_t bExpire = static_cast<uint64_t>(b->getExpireTime()) - 1;
+  if (aExpire != bExpire) {
+    return aExpire > bExpire;
+  }
+  return a->getSequence() > b->getSequence();
+}
+
+shared_ptr<ThreadManager::Task> ThreadManager::Impl::popTask() {
+  std::map<int, TaskHeap, std::greater<int> >::iterator it = tasks_.begin();
+  while (it->second.empty()) {
+    ++it;
+  }
+  TaskHeap& heap = it->second;
+  std::pop_heap(heap.begin(), heap.end(), TaskOrder());
+  shared_ptr<Task> task = heap.back();
+  heap.pop_back();
+  taskCount_--;
+  return task;
+}
+
 class ThreadManager::Worker: public Runnable {
   enum STATE {
     UNINITIALIZED,
@@ -215,7 +384,8 @@ class ThreadManager::Worker: public Runnable {
   Worker(ThreadManager::Impl* manager) :
     manager_(manager),
     state_(UNINITIALIZED),
-    idle_(false) {}
+    idle_(false),
+    wakeup_(&manager->mutex_) {}
 
   ~Worker() {}
 
@@ -223,7 +393,7 @@ class ThreadManager::Worker: public Runnable {
   bool isActive() const {
     return
       (manager_->workerCount_ <= manager_->workerMaxCount_) ||
-      (manager_->state_ == JOINING && !manager_->tasks_.empty());
+      (manager_->state_ == JOINING && manager_->taskCount_ != 0);
   }
 
  public:
@@ -259,8 +429,10 @@ class ThreadManager::Worker: public Runnable {
       notifyManager = false;
     }
 
+    shared_ptr<ThreadManager::Task> task;
+
     while (active) {
-      shared_ptr<ThreadManager::Task> task;
+      bool grow = false;
 
       /**
        * While holding manager monitor block for non-empty task queue (Also
@@ -273,12 +445,34 @@ class ThreadManager::Worker: public Runnable {
        */
       {
         Guard g(manager_->mutex_);
+        if (task) {
+          manager_->recycleTask(task);
+        }
         active = isActive();
 
-        while (active && manager_->tasks_.empty()) {
+        bool spun = false;
+        while (active && manager_->taskCount_ == 0) {
           manager_->idleCount_++;
           idle_ = true;
-          manager_->monitor_.wait();
+          if (!spun && manager_->spinningCount_ < manager_->spinLimit_) {
+            spun = true;
+            manager_->spinForTask();
+          } else {
+            manager_->idleWorkers_.push_back(this);
+            int result = wakeup_.waitForTimeRelative(manager_->idleTimeout_);
+            // Whoever woke us took us off the stack already
+            std::vector<Worker*>::iterator it = std::find(manager_->idleWorkers_.begin(),
+                                                          manager_->idleWorkers_.end(),
+                                                          this);
+            if (it != manager_->idleWorkers_.end()) {
+              manager_->idleWorkers_.erase(it);
+            }
+            if (result == THRIFT_ETIMEDOUT) {
+              manager_->retireWorker();
+            } else if (result != 0) {
+              throw TException("pthread_cond_wait() or pthread_cond_timedwait() failed");
+            }
+          }
           active = isActive();
           idle_ = false;
           manager_->idleCount_--;
@@ -287,27 +481,35 @@ class ThreadManager::Worker: public Runnable {
         if (active) {
           manager_->removeExpiredTasks();
 
-          if (!manager_->tasks_.empty()) {
-            task = manager_->tasks_.front();
-            manager_->tasks_.pop();
+          if (manager_->taskCount_ != 0) {
+            task = manager_->popTask();
+            THRIFT_PROBE2(task_dequeue, task->runnable_.get(),
+                          manager_->taskCount_);
             if (task->state_ == ThreadManager::Task::WAITING) {
               task->state_ = ThreadManager::Task::EXECUTING;
             }
 
+            if (manager_->workerLimit_ != 0) {
+              manager_->lastDispatch_ = Util::monotonicTime();
+              grow = manager_->needWorker(manager_->lastDispatch_ - task->addTime_);
+            }
+
             /* If we have a pending task max and we just dropped below it, wakeup any
                thread that might be blocked on add. */
             if (manager_->pendingTaskCountMax_ != 0 &&
-                manager_->tasks_.size() <= manager_->pendingTaskCountMax_ - 1) {
+                manager_->taskCount_ <= manager_->pendingTaskCountMax_ - 1) {
               manager_->maxMonitor_.notify();
             }
           }
         } else {
           idle_ = true;
-          manager_->workerCount_--;
-          notifyManager = (manager_->workerCount_ == manager_->workerMaxCount_);
         }
       }
 
+      if (grow) {
+        manager_->growWorker();
+      }
+
       if (task) {
         if (task->state_ == ThreadManager::Task::EXECUTING) {
           try {
@@ -316,12 +518,24 @@ class ThreadManager::Worker: public Runnable {
             // XXX need to log this
           }
         }
+        // Let go of the runnable now, rather than when the task is reused
+        task->runnable_.reset();
       }
     }
 
     {
       Synchronized s(manager_->workerMonitor_);
+      if (manager_->workerLimit_ != 0) {
+        manager_->reapDeadWorkers();
+      }
       manager_->deadWorkers_.insert(this->thread());
+      // Counted out only now, so that stop() can't return, and the manager
+      // go, while this worker still has the manager's monitors to touch
+      {
+        Guard g(manager_->mutex_);
+        manager_->workerCount_--;
+        notifyManager = (manager_->workerCount_ == manager_->workerMaxCount_);
+      }
       if (notifyManager) {
         manager_->workerMonitor_.notify();
       }
@@ -335,6 +549,7 @@ class ThreadManager::Worker: public Runnable {
     friend class ThreadManager::Impl;
     STATE state_;
     bool idle_;
+    Monitor wakeup_;
 };
 
 
@@ -390,6 +605,7 @@ void ThreadManager::Impl::start() {
 
 void ThreadManager::Impl::stopImpl(bool join) {
   bool doStop = false;
+  size_t count = 0;
   if (state_ == ThreadManager::STOPPED) {
     return;
   }
@@ -401,11 +617,13 @@ void ThreadManager::Impl::stopImpl(bool join) {
         state_ != ThreadManager::STOPPED) {
       doStop = true;
       state_ = join ? ThreadManager::JOINING : ThreadManager::STOPPING;
+      // Including any worker an adaptive manager is still starting
+      count = workerMaxCount_;
     }
   }
 
   if (doStop) {
-    removeWorker(workerCount_);
+    removeWorker(count);
   }
 
   // XXX
@@ -429,13 +647,12 @@ void ThreadManager::Impl::removeWorker(size_t value) {
 
     workerMaxCount_ -= value;
 
-    if (idleCount_ < value) {
-      for (size_t ix = 0; ix < idleCount_; ix++) {
-        monitor_.notify();
-      }
-    } else {
-      monitor_.notifyAll();
+    // The workers idle longest go; spinning ones look again soon enough
+    size_t wake = std::min(value, idleWorkers_.size());
+    for (size_t ix = 0; ix < wake; ix++) {
+      idleWorkers_[ix]->wakeup_.notify();
     }
+    idleWorkers_.erase(idleWorkers_.begin(), idleWorkers_.begin() + wake);
   }
 
   {
@@ -459,9 +676,12 @@ void ThreadManager::Impl::removeWorker(size_t value) {
     return idMap_.find(id) == idMap_.end();
   }
 
-  void ThreadManager::Impl::add(shared_ptr<Runnable> value,
-                                int64_t timeout,
-                                int64_t expiration) {
+  void ThreadManager::Impl::addWithPriority(shared_ptr<Runnable> value,
+                                            int priority,
+                                            int64_t timeout,
+                                            int64_t expiration) {
+    bool grow = false;
+    {
     Guard g(mutex_, timeout);
 
     if (!g) {
@@ -474,9 +694,9 @@ void ThreadManager::Impl::removeWorker(size_t value) {
     }
 
     removeExpiredTasks();
-    if (pendingTaskCountMax_ > 0 && (tasks_.size() >= pendingTaskCountMax_)) {
+    if (pendingTaskCountMax_ > 0 && (taskCount_ >= pendingTaskCountMax_)) {
       if (canSleep() && timeout >= 0) {
-        while (pendingTaskCountMax_ > 0 && tasks_.size() >= pendingTaskCountMax_) {
+        while (pendingTaskCountMax_ > 0 && taskCount_ >= pendingTaskCountMax_) {
           // This is thread safe because the mutex is shared between monitors.
           maxMonitor_.wait(timeout);
         }
@@ -485,14 +705,194 @@ void ThreadManager::Impl::removeWorker(size_t value) {
       }
     }
 
-    tasks_.push(shared_ptr<ThreadManager::Task>(new ThreadManager::Task(value, expiration)));
+    TAllocScope scope(TAllocTracking::TASK);
+    shared_ptr<ThreadManager::Task> task = newTask(value, expiration);
+    int64_t now = 0LL;
+    if (workerLimit_ != 0) {
+      now = Util::monotonicTime();
+      task->addTime_ = now;
+    }
+
+    TaskHeap& heap = tasks_[priority];
+    heap.push_back(task);
+    std::push_heap(heap.begin(), heap.end(), TaskOrder());
+    taskCount_++;
+    THRIFT_PROBE3(task_enqueue, value.get(), priority, taskCount_);
 
     // If idle thread is available notify it, otherwise all worker threads are
-    // running and will get around to this task in time.
+    // running and will get around to this task in time, unless none has
+    // taken one for long enough that another is called for.
     if (idleCount_ > 0) {
-      monitor_.notify();
+      wakeWorkers(1);
+    } else if (workerLimit_ != 0) {
+      grow = needWorker(now - lastDispatch_);
+    }
+    }
+
+    if (grow) {
+      growWorker();
+    }
+  }
+
+void ThreadManager::Impl::addBatch(const std::vector<shared_ptr<Runnable> >& values,
+                                   int64_t timeout,
+                                   int64_t expiration) {
+  bool grow = false;
+  {
+    Guard g(mutex_, timeout);
+
+    if (!g) {
+      throw TimedOutException();
+    }
+
+    if (state_ != ThreadManager::STARTED) {
+      throw IllegalStateException("ThreadManager::Impl::addBatch ThreadManager "
+                                  "not started");
+    }
+
+    removeExpiredTasks();
+
+    TAllocScope scope(TAllocTracking::TASK);
+    int64_t now = 0LL;
+    if (workerLimit_ != 0) {
+      now = Util::monotonicTime();
+    }
+    // Heaps are never erased, so this stays good while waiting for room
+    TaskHeap& heap = tasks_[0];
+    size_t unwoken = 0;
+    for (size_t ix = 0; ix < values.size(); ix++) {
+      if (pendingTaskCountMax_ > 0 && (taskCount_ >= pendingTaskCountMax_)) {
+        // The workers must know of the tasks already added to make room
+        wakeWorkers(unwoken);
+        unwoken = 0;
+        if (canSleep() && timeout >= 0) {
+          while (pendingTaskCountMax_ > 0 && taskCount_ >= pendingTaskCountMax_) {
+            maxMonitor_.wait(timeout);
+          }
+        } else {
+          throw TooManyPendingTasksException();
+        }
+      }
+
+      shared_ptr<ThreadManager::Task> task = newTask(values[ix], expiration);
+      task->addTime_ = now;
+      heap.push_back(task);
+      std::push_heap(heap.begin(), heap.end(), TaskOrder());
+      taskCount_++;
+      THRIFT_PROBE3(task_enqueue, values[ix].get(), 0, taskCount_);
+      unwoken++;
+    }
+
+    if (unwoken > idleCount_ && workerLimit_ != 0) {
+      grow = needWorker(now - lastDispatch_);
+    }
+    wakeWorkers(unwoken);
+  }
+
+  if (grow) {
+    growWorker();
+  }
+}
+
+void ThreadManager::Impl::wakeWorkers(size_t count) {
+  size_t untaken = taskCount_ > spinningCount_ ? taskCount_ - spinningCount_ : 0;
+  for (count = std::min(count, untaken); count > 0 && !idleWorkers_.empty(); count--) {
+    Worker* worker = idleWorkers_.back();
+    idleWorkers_.pop_back();
+    worker->wakeup_.notify();
+  }
+}
+
+void ThreadManager::Impl::spinForTask() {
+  int64_t deadline = Util::monotonicTimeUsec() + spinTime_;
+  spinningCount_++;
+  mutex_.unlock();
+  for (unsigned spins = 1; atomicLoad<ATOMIC_RELAXED>(&taskCount_) == 0; spins++) {
+    if (spins % 64 != 0) {
+      cpuRelax();
+    } else if (Util::monotonicTimeUsec() < deadline) {
+      yieldThread();
+    } else {
+      break;
     }
   }
+  mutex_.lock();
+  spinningCount_--;
+}
+
+shared_ptr<ThreadManager::Task> ThreadManager::Impl::newTask(shared_ptr<Runnable> value,
+                                                             int64_t expiration) {
+  if (spareTasks_.empty()) {
+    return shared_ptr<ThreadManager::Task>(
+      new ThreadManager::Task(value, expiration, taskSequence_++));
+  }
+  shared_ptr<ThreadManager::Task> task;
+  task.swap(spareTasks_.back());
+  spareTasks_.pop_back();
+  task->reset(value, expiration, taskSequence_++);
+  return task;
+}
+
+void ThreadManager::Impl::recycleTask(shared_ptr<Task>& task) {
+  // Enough spares for every worker to finish a task at once; a task held
+  // elsewhere, as by a caller of removeNextPending(), is left alone
+  if (task.unique() && spareTasks_.size() < workerMaxCount_) {
+    spareTasks_.push_back(task);
+  }
+  task.reset();
+}
+
+bool ThreadManager::Impl::needWorker(int64_t waited) {
+  if (state_ != ThreadManager::STARTED || idleCount_ != 0 || taskCount_ == 0 ||
+      waited < growLatency_ || workerMaxCount_ >= workerLimit_ ||
+      workerCount_ != workerMaxCount_) {
+    return false;
+  }
+  // Counting the worker now keeps others from being added until it starts
+  workerMaxCount_++;
+  return true;
+}
+
+void ThreadManager::Impl::growWorker() {
+  shared_ptr<Thread> thread;
+  try {
+    thread = threadFactory_->newThread(
+      shared_ptr<ThreadManager::Worker>(new ThreadManager::Worker(this)));
+    thread->start();
+  } catch (...) {
+    {
+      Synchronized s(monitor_);
+      workerMaxCount_--;
+    }
+    Synchronized s(workerMonitor_);
+    workerMonitor_.notify();
+    return;
+  }
+
+  Synchronized s(workerMonitor_);
+  reapDeadWorkers();
+  Synchronized m(monitor_);
+  workers_.insert(thread);
+  idMap_.insert(std::pair<const Thread::id_t, shared_ptr<Thread> >(thread->getId(), thread));
+}
+
+bool ThreadManager::Impl::retireWorker() {
+  if (workerLimit_ == 0 || state_ != ThreadManager::STARTED || taskCount_ != 0 ||
+      workerMaxCount_ <= workerMinCount_ || workerCount_ != workerMaxCount_) {
+    return false;
+  }
+  workerMaxCount_--;
+  return true;
+}
+
+void ThreadManager::Impl::reapDeadWorkers() {
+  Synchronized s(monitor_);
+  for (std::set<shared_ptr<Thread> >::iterator ix = deadWorkers_.begin(); ix != deadWorkers_.end(); ix++) {
+    idMap_.erase((*ix)->getId());
+    workers_.erase(*ix);
+  }
+  deadWorkers_.clear();
+}
 
 void ThreadManager::Impl::remove(shared_ptr<Runnable> task) {
   (void) task;
@@ -510,36 +910,42 @@ boost::shared_ptr<Runnable> ThreadManager::Impl::removeNextPending() {
                                 "ThreadManager not started");
   }
 
-  if (tasks_.empty()) {
+  if (taskCount_ == 0) {
     return boost::shared_ptr<Runnable>();
   }
 
-  shared_ptr<ThreadManager::Task> task = tasks_.front();
-  tasks_.pop();
-  
+  shared_ptr<ThreadManager::Task> task = popTask();
+
   return task->getRunnable();
 }
 
 void ThreadManager::Impl::removeExpiredTasks() {
   int64_t now = 0LL; // we won't ask for the time untile we need it
 
-  // note that this loop breaks at the first non-expiring task
-  while (!tasks_.empty()) {
-    shared_ptr<ThreadManager::Task> task = tasks_.front();
-    if (task->getExpireTime() == 0LL) {
-      break;
-    }
-    if (now == 0LL) {
-      now = Util::currentTime();
-    }
-    if (task->getExpireTime() > now) {
-      break;
-    }
-    if (expireCallback_) {
-      expireCallback_(task->getRunnable());
+  // note that this loop breaks at the first non-expiring task of each heap,
+  // which holds its tasks soonest to expire first
+  std::map<int, TaskHeap, std::greater<int> >::iterator it;
+  for (it = tasks_.begin(); it != tasks_.end(); ++it) {
+    TaskHeap& heap = it->second;
+    while (!heap.empty()) {
+      shared_ptr<ThreadManager::Task> task = heap.front();
+      if (task->getExpireTime() == 0LL) {
+        break;
+      }
+      if (now == 0LL) {
+        now = Util::monotonicTime();
+      }
+      if (task->getExpireTime() > now) {
+        break;
+      }
+      if (expireCallback_) {
+        expireCallback_(task->getRunnable());
+      }
+      std::pop_heap(heap.begin(), heap.end(), TaskOrder());
+      heap.pop_back();
+      taskCount_--;
+      expiredCount_++;
     }
-    tasks_.pop();
-    expiredCount_++;
   }
 }
 
@@ -571,6 +977,52 @@ class SimpleThreadManager : public ThreadManager::Impl {
 };
 
 
+class AdaptiveThreadManager : public ThreadManager::Impl {
+
+ public:
+  AdaptiveThreadManager(size_t minCount, size_t maxCount, size_t pendingTaskCountMax,
+                        int64_t growLatency, int64_t idleTimeout) :
+    minCount_(minCount),
+    pendingTaskCountMax_(pendingTaskCountMax) {
+    adaptive(minCount, maxCount, growLatency, idleTimeout);
+  }
+
+  void start() {
+    ThreadManager::Impl::pendingTaskCountMax(pendingTaskCountMax_);
+    ThreadManager::Impl::start();
+    addWorker(minCount_);
+  }
+
+ private:
+  const size_t minCount_;
+  const size_t pendingTaskCountMax_;
+};
+
+
+shared_ptr<Future> ThreadManager::submit(shared_ptr<Runnable> task,
+                                         int64_t timeout,
+                                         int64_t expiration) {
+  shared_ptr<FutureTask> futureTask(new FutureTask(task));
+  shared_ptr<Future> future = futureTask->future();
+  add(futureTask, timeout, expiration);
+  return future;
+}
+
+void ThreadManager::submitBatch(const std::vector<shared_ptr<Runnable> >& tasks,
+                                std::vector<shared_ptr<Future> >& futures,
+                                int64_t timeout,
+                                int64_t expiration) {
+  std::vector<shared_ptr<Runnable> > futureTasks;
+  futureTasks.reserve(tasks.size());
+  futures.reserve(futures.size() + tasks.size());
+  for (size_t ix = 0; ix < tasks.size(); ix++) {
+    shared_ptr<FutureTask> futureTask(new FutureTask(tasks[ix]));
+    futures.push_back(futureTask->future());
+    futureTasks.push_back(futureTask);
+  }
+  addBatch(futureTasks, timeout, expiration);
+}
+
 shared_ptr<ThreadManager> ThreadManager::newThreadManager() {
   return shared_ptr<ThreadManager>(new ThreadManager::Impl());
 }
@@ -579,5 +1031,17 @@ shared_ptr<ThreadManager> ThreadManager::newSimpleThreadManager(size_t count, si
   return shared_ptr<ThreadManager>(new SimpleThreadManager(count, pendingTaskCountMax));
 }
 
-}}} // apache::thrift::concurrency
+shared_ptr<ThreadManager> ThreadManager::newAdaptiveThreadManager(size_t minCount,
+                                                                  size_t maxCount,
+                                                                  size_t pendingTaskCountMax,
+                                                                  int64_t growLatency,
+                                                                  int64_t idleTimeout) {
+  if (minCount > maxCount || maxCount == 0) {
+    throw InvalidArgumentException();
+  }
+  return shared_ptr<ThreadManager>(new AdaptiveThreadManager(minCount, maxCount,
+                                                             pendingTaskCountMax,
+                                                             growLatency, idleTimeout));
+}
 
+}}} // apache::thrift::concurrency
@@ -23,10 +23,13 @@
 #include <boost/shared_ptr.hpp>
 #include <thrift/cxxfunctional.h>
 #include <sys/types.h>
+#include <vector>
 #include <thrift/concurrency/Thread.h>
 
 namespace apache { namespace thrift { namespace concurrency {
 
+class Future;
+
 /**
  * Thread Pool Manager and related classes
  *
@@ -156,6 +159,65 @@ class ThreadManager {
                    int64_t timeout=0LL,
                    int64_t expiration=0LL) = 0;
 
+  /**
+   * Adds a task in a priority class.  Pending tasks in a higher class run
+   * before any in a lower one, and within a class, tasks with the earliest
+   * expiration run first, then those without one, in the order they were
+   * added.  add() uses class 0.  Otherwise as add(); managers that do not
+   * order their tasks ignore priority.
+   */
+  virtual void addWithPriority(boost::shared_ptr<Runnable> task,
+                               int priority,
+                               int64_t timeout=0LL,
+                               int64_t expiration=0LL) {
+    (void) priority;
+    add(task, timeout, expiration);
+  }
+
+  /**
+   * Adds several tasks at once, as add() would each in turn, but taking
+   * the manager's lock once and waking no more idle workers than there
+   * are tasks.  If a task cannot be added, those before it stay added.
+   * Managers that cannot do better add them one at a time.
+   */
+  virtual void addBatch(const std::vector<boost::shared_ptr<Runnable> >& tasks,
+                        int64_t timeout=0LL,
+                        int64_t expiration=0LL) {
+    for (size_t ix = 0; ix < tasks.size(); ix++) {
+      add(tasks[ix], timeout, expiration);
+    }
+  }
+
+  /**
+   * Adds a task as add() does, returning a Future to wait on it, or to
+   * run something once it is done.  A task dropped without running, as by
+   * expiring, fails its future.
+   */
+  boost::shared_ptr<Future> submit(boost::shared_ptr<Runnable> task,
+                                   int64_t timeout=0LL,
+                                   int64_t expiration=0LL);
+
+  /**
+   * Adds tasks as addBatch() does, appending a Future for each to futures.
+   */
+  void submitBatch(const std::vector<boost::shared_ptr<Runnable> >& tasks,
+                   std::vector<boost::shared_ptr<Future> >& futures,
+                   int64_t timeout=0LL,
+                   int64_t expiration=0LL);
+
+  /**
+   * Lets up to count idle workers at a time spin for up to spinTime
+   * microseconds, yielding the processor as they go, before they sleep, so
+   * that a task added meanwhile starts without a worker being woken.  This
+   * trades processor time for latency, for handlers that take only
+   * microseconds.  0, the default, never spins.  Managers that do not spin
+   * ignore it.
+   */
+  virtual void idleSpin(size_t count, int64_t spinTime) {
+    (void) count;
+    (void) spinTime;
+  }
+
   /**
    * Removes a pending task
    */
@@ -169,7 +231,8 @@ class ThreadManager {
   virtual boost::shared_ptr<Runnable> removeNextPending() = 0;
 
   /**
-   * Remove tasks from front of task queue that have expired.
+   * Remove tasks from front of task queue that have expired.  A manager that
+   * orders its tasks by expiration removes every expired one.
    */
   virtual void removeExpiredTasks() = 0;
 
@@ -190,6 +253,32 @@ class ThreadManager {
    */
   static boost::shared_ptr<ThreadManager> newSimpleThreadManager(size_t count=4, size_t pendingTaskCountMax=0);
 
+  /**
+   * Creates a thread manager like newSimpleThreadManager that sizes its own
+   * pool.  It starts minCount workers, and adds one, up to maxCount, when
+   * none is idle and a task has waited growLatency ms to be run.  A worker
+   * that goes idleTimeout ms without a task exits, down to minCount, so the
+   * pool can be sized for peak load without idle threads the rest of the
+   * time.  The pool is only grown as tasks are added and taken, so tasks
+   * already waiting behind blocked workers get no new one until then.
+   */
+  static boost::shared_ptr<ThreadManager> newAdaptiveThreadManager(size_t minCount=1,
+                                                                   size_t maxCount=64,
+                                                                   size_t pendingTaskCountMax=0,
+                                                                   int64_t growLatency=10LL,
+                                                                   int64_t idleTimeout=60000LL);
+
+  /**
+   * Creates a thread manager like newSimpleThreadManager, whose workers each
+   * keep a queue of their own and steal from each other's when theirs is
+   * empty.  Tasks added from outside the pool still go through one shared
+   * queue, but workers take them from it in batches, and tasks added by the
+   * workers themselves take no lock at all, so it scales better to large
+   * pools.  Tasks do not run in the order they were added, and their
+   * priorities are ignored.
+   */
+  static boost::shared_ptr<ThreadManager> newWorkStealingThreadManager(size_t count=4, size_t pendingTaskCountMax=0);
+
   class Task;
 
   class Worker;
@@ -0,0 +1,171 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/concurrency/ThreadPlacement.h>
+
+#include <stdio.h>
+
+#if defined(__linux__)
+#  include <pthread.h>
+#  include <sched.h>
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#elif defined(_WIN32)
+#  include <windows.h>
+#endif
+
+namespace apache { namespace thrift { namespace concurrency {
+
+#if defined(__linux__)
+
+namespace {
+
+// From <linux/mempolicy.h>, which is not always installed
+const int THRIFT_MPOL_PREFERRED = 1;
+
+bool setCpus(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (std::vector<int>::const_iterator it = cpus.begin(); it != cpus.end(); ++it) {
+    if (*it >= 0 && *it < CPU_SETSIZE) {
+      CPU_SET(*it, &set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+bool preferNode(int node) {
+#ifdef SYS_set_mempolicy
+  const int bits = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(node / bits + 1, 0);
+  mask[node / bits] = 1UL << (node % bits);
+  return syscall(SYS_set_mempolicy, THRIFT_MPOL_PREFERRED, &mask[0],
+                 static_cast<unsigned long>(mask.size() * bits + 1)) == 0;
+#else
+  (void) node;
+  return false;
+#endif
+}
+
+}
+
+bool ThreadPlacement::apply() const {
+  bool ok = true;
+
+  if (!cpus.empty()) {
+    ok = setCpus(cpus) && ok;
+  } else if (numaNode >= 0) {
+    std::vector<int> nodeCpus = numaNodeCpus(numaNode);
+    ok = !nodeCpus.empty() && setCpus(nodeCpus) && ok;
+  }
+
+  if (numaNode >= 0) {
+    ok = preferNode(numaNode) && ok;
+  }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 12))
+  if (!name.empty()) {
+    ok = pthread_setname_np(pthread_self(), name.substr(0, 15).c_str()) == 0 && ok;
+  }
+#endif
+
+  return ok;
+}
+
+int ThreadPlacement::numaNodeCount() {
+  int count = 0;
+  char path[64];
+  for (;;) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", count);
+    if (access(path, F_OK) != 0) {
+      break;
+    }
+    count++;
+  }
+  return count > 0 ? count : 1;
+}
+
+std::vector<int> ThreadPlacement::numaNodeCpus(int node) {
+  std::vector<int> cpus;
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    return cpus;
+  }
+
+  // A list of CPUs and ranges of them, as in "0-3,8-11"
+  int first;
+  while (fscanf(file, "%d", &first) == 1) {
+    int last = first;
+    int c = fgetc(file);
+    if (c == '-') {
+      if (fscanf(file, "%d", &last) != 1) {
+        break;
+      }
+      c = fgetc(file);
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+    if (c != ',') {
+      break;
+    }
+  }
+
+  fclose(file);
+  return cpus;
+}
+
+#else
+
+bool ThreadPlacement::apply() const {
+  bool ok = numaNode < 0;
+
+#if defined(_WIN32)
+  if (!cpus.empty()) {
+    DWORD_PTR mask = 0;
+    for (std::vector<int>::const_iterator it = cpus.begin(); it != cpus.end(); ++it) {
+      if (*it >= 0 && *it < static_cast<int>(8 * sizeof(mask))) {
+        mask |= static_cast<DWORD_PTR>(1) << *it;
+      }
+    }
+    ok = SetThreadAffinityMask(GetCurrentThread(), mask) != 0 && ok;
+  }
+#else
+  ok = cpus.empty() && ok;
+#endif
+
+  return ok;
+}
+
+int ThreadPlacement::numaNodeCount() {
+  return 1;
+}
+
+std::vector<int> ThreadPlacement::numaNodeCpus(int node) {
+  (void) node;
+  return std::vector<int>();
+}
+
+#endif
+
+}}} // apache::thrift::concurrency
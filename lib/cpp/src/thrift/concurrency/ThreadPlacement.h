@@ -0,0 +1,75 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_THREADPLACEMENT_H_
+#define _THRIFT_CONCURRENCY_THREADPLACEMENT_H_ 1
+
+#include <string>
+#include <vector>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+/**
+ * Where a thread runs and what it is called: the CPUs it may run on, the
+ * NUMA node its memory is taken from, and the name it shows under in
+ * debuggers and top.  The thread factories apply it in each thread they
+ * create before its Runnable runs.
+ *
+ * A thread given a node but no CPUs runs on the node's CPUs.  Memory is
+ * preferred from the node rather than bound to it, so a thread whose node
+ * runs out falls back to others instead of failing.  Affinity and NUMA
+ * placement are Linux only, and names are cut to 15 characters; parts a
+ * platform cannot apply are ignored.
+ */
+class ThreadPlacement {
+
+ public:
+
+  ThreadPlacement() : numaNode(-1) {}
+
+  /// CPUs the thread may run on; empty for any
+  std::vector<int> cpus;
+
+  /// NUMA node to take memory from, and run on without cpus; -1 for any
+  int numaNode;
+
+  /// Name of the thread; empty to leave it as is
+  std::string name;
+
+  bool empty() const {
+    return cpus.empty() && numaNode < 0 && name.empty();
+  }
+
+  /**
+   * Applies the placement to the calling thread.
+   *
+   * @return false if any part of it failed.
+   */
+  bool apply() const;
+
+  /// The number of NUMA nodes; 1 where that is unknown
+  static int numaNodeCount();
+
+  /// The CPUs of a NUMA node; empty where that is unknown
+  static std::vector<int> numaNodeCpus(int node);
+};
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_THREADPLACEMENT_H_
@@ -92,7 +92,7 @@ class TimerManager::Dispatcher: public Runnable {
       {
         Synchronized s(manager_->monitor_);
         task_iterator expiredTaskEnd;
-        int64_t now = Util::currentTime();
+        int64_t now = Util::monotonicTime();
         while (manager_->state_ == TimerManager::STARTED &&
                (expiredTaskEnd = manager_->taskMap_.upper_bound(now)) == manager_->taskMap_.begin()) {
           int64_t timeout = 0LL;
@@ -103,7 +103,7 @@ class TimerManager::Dispatcher: public Runnable {
           try {
             manager_->monitor_.wait(timeout);
           } catch (TimedOutException &) {}
-          now = Util::currentTime();
+          now = Util::monotonicTime();
         }
 
         if (manager_->state_ == TimerManager::STARTED) {
@@ -237,7 +237,7 @@ size_t TimerManager::taskCount() const {
 }
 
 void TimerManager::add(shared_ptr<Runnable> task, int64_t timeout) {
-  int64_t now = Util::currentTime();
+  int64_t now = Util::monotonicTime();
   timeout += now;
 
   {
@@ -268,6 +268,7 @@ void TimerManager::add(shared_ptr<Runnable> task, const struct THRIFT_TIMESPEC&
   int64_t expiration;
   Util::toMilliseconds(expiration, value);
 
+  // A date, so on the wall clock; only the delay is kept
   int64_t now = Util::currentTime();
 
   if (expiration < now) {
@@ -282,6 +283,7 @@ void TimerManager::add(shared_ptr<Runnable> task, const struct timeval& value) {
   int64_t expiration;
   Util::toMilliseconds(expiration, value);
 
+  // A date, so on the wall clock; only the delay is kept
   int64_t now = Util::currentTime();
 
   if (expiration < now) {
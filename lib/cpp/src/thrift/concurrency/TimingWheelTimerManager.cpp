@@ -0,0 +1,453 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/concurrency/TimingWheelTimerManager.h>
+#include <thrift/concurrency/Atomic.h>
+#include <thrift/concurrency/Exception.h>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/concurrency/Util.h>
+
+#include <algorithm>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+using boost::shared_ptr;
+
+namespace {
+
+inline size_t hashOf(const Runnable* task) {
+  return reinterpret_cast<size_t>(task) >> 4;
+}
+
+}
+
+/**
+ * One wheel, with a table from each task's Runnable to its record so it
+ * can be found to be removed.  Records are linked into their slot's list
+ * and their hash bucket's chain, and recycled once unlinked.  All but the
+ * constructor are called with mutex held.
+ */
+class TimingWheelTimerManager::Shard {
+
+ public:
+
+  Shard(size_t slotCount, int64_t now) :
+    running(false),
+    wheel_(slotCount),
+    mask_(slotCount - 1),
+    buckets_(16, static_cast<Entry*>(NULL)),
+    count_(0),
+    current_(now),
+    free_(NULL),
+    freeCount_(0) {
+    for (size_t ix = 0; ix < wheel_.size(); ix++) {
+      wheel_[ix].prev = wheel_[ix].next = &wheel_[ix];
+    }
+  }
+
+  ~Shard() {
+    clear();
+    while (free_ != NULL) {
+      Entry* entry = free_;
+      free_ = entry->next;
+      delete entry;
+    }
+  }
+
+  /// Adds task to run at tick due, or at the next tick if that has passed
+  void add(const shared_ptr<Runnable>& task, int64_t due) {
+    if (count_ >= buckets_.size()) {
+      rehash(buckets_.size() * 2);
+    }
+
+    Entry* entry = allocate();
+    entry->due = (std::max)(due, current_ + 1);
+    entry->task = task;
+
+    Entry* head = &wheel_[static_cast<size_t>(entry->due) & mask_];
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+
+    Entry*& bucket = buckets_[bucketOf(task.get())];
+    entry->hashNext = bucket;
+    bucket = entry;
+    count_++;
+  }
+
+  /// Removes the first record of task, returning whether there was one
+  bool remove(const Runnable* task) {
+    Entry** link = &buckets_[bucketOf(task)];
+    while (*link != NULL && (*link)->task.get() != task) {
+      link = &(*link)->hashNext;
+    }
+    if (*link == NULL) {
+      return false;
+    }
+    Entry* entry = *link;
+    *link = entry->hashNext;
+    release(entry);
+    return true;
+  }
+
+  /// Moves the tasks due by tick now to due, and the wheel on to now
+  void advance(int64_t now, std::vector<shared_ptr<Runnable> >& due) {
+    // A full turn visits every slot, however many ticks have passed
+    int64_t end = (std::min)(now, current_ + static_cast<int64_t>(wheel_.size()));
+    for (int64_t tick = current_ + 1; tick <= end; tick++) {
+      Entry* head = &wheel_[static_cast<size_t>(tick) & mask_];
+      for (Entry* entry = head->next; entry != head;) {
+        Entry* next = entry->next;
+        if (entry->due <= now) {
+          due.push_back(entry->task);
+          unhash(entry);
+          release(entry);
+        }
+        entry = next;
+      }
+    }
+    current_ = (std::max)(current_, now);
+  }
+
+  /// Drops every task
+  void clear() {
+    for (size_t ix = 0; ix < wheel_.size(); ix++) {
+      Entry* head = &wheel_[ix];
+      while (head->next != head) {
+        release(head->next);
+      }
+    }
+    std::fill(buckets_.begin(), buckets_.end(), static_cast<Entry*>(NULL));
+  }
+
+  size_t count() const {
+    return count_;
+  }
+
+  Mutex mutex;
+
+  /// Whether tasks may be added
+  bool running;
+
+ private:
+  struct Entry {
+    Entry() : prev(NULL), next(NULL), hashNext(NULL), due(0) {}
+
+    Entry* prev;
+    Entry* next;
+    Entry* hashNext;
+    int64_t due;
+    shared_ptr<Runnable> task;
+  };
+
+  static const size_t FREE_MAX = 1024;
+
+  size_t bucketOf(const Runnable* task) const {
+    // Mix in the high bits, as the low ones pick the shard
+    size_t hash = hashOf(task);
+    return (hash ^ (hash >> 7) ^ (hash >> 17)) & (buckets_.size() - 1);
+  }
+
+  void rehash(size_t size) {
+    std::vector<Entry*> old(size, static_cast<Entry*>(NULL));
+    old.swap(buckets_);
+    for (size_t ix = 0; ix < old.size(); ix++) {
+      for (Entry* entry = old[ix]; entry != NULL;) {
+        Entry* next = entry->hashNext;
+        Entry*& bucket = buckets_[bucketOf(entry->task.get())];
+        entry->hashNext = bucket;
+        bucket = entry;
+        entry = next;
+      }
+    }
+  }
+
+  void unhash(Entry* entry) {
+    Entry** link = &buckets_[bucketOf(entry->task.get())];
+    while (*link != entry) {
+      link = &(*link)->hashNext;
+    }
+    *link = entry->hashNext;
+  }
+
+  Entry* allocate() {
+    if (free_ == NULL) {
+      return new Entry();
+    }
+    Entry* entry = free_;
+    free_ = entry->next;
+    freeCount_--;
+    return entry;
+  }
+
+  // Unlinks an entry from its slot and recycles it; it must be unhashed
+  void release(Entry* entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->task.reset();
+    count_--;
+    if (freeCount_ < FREE_MAX) {
+      entry->next = free_;
+      free_ = entry;
+      freeCount_++;
+    } else {
+      delete entry;
+    }
+  }
+
+  std::vector<Entry> wheel_;
+  const size_t mask_;
+  std::vector<Entry*> buckets_;
+  size_t count_;
+  int64_t current_;
+  Entry* free_;
+  size_t freeCount_;
+};
+
+const size_t TimingWheelTimerManager::Shard::FREE_MAX;
+
+class TimingWheelTimerManager::Dispatcher : public Runnable {
+
+ public:
+  Dispatcher(TimingWheelTimerManager* manager) :
+    manager_(manager) {}
+
+  /**
+   * Dispatcher entry point
+   *
+   * While there are tasks, turn every wheel on a tick at a time, running
+   * the tasks that fall due; otherwise sleep until one is added.
+   */
+  void run() {
+    {
+      Synchronized s(manager_->monitor_);
+      if (manager_->state_ == TimerManager::STARTING) {
+        manager_->state_ = TimerManager::STARTED;
+        manager_->monitor_.notifyAll();
+      }
+    }
+
+    std::vector<shared_ptr<Runnable> > due;
+    for (;;) {
+      {
+        Synchronized s(manager_->monitor_);
+        while (manager_->state_ == TimerManager::STARTED && atomicLoad<ATOMIC_ACQUIRE>(&manager_->pending_) == 0) {
+          manager_->monitor_.wait();
+        }
+        if (manager_->state_ != TimerManager::STARTED) {
+          break;
+        }
+      }
+
+      int64_t now = Util::monotonicTime() / manager_->tick_;
+      for (size_t ix = 0; ix < manager_->shards_.size(); ix++) {
+        Shard* shard = manager_->shards_[ix];
+        Guard g(shard->mutex);
+        shard->advance(now, due);
+      }
+
+      if (!due.empty()) {
+        atomicAdd(&manager_->pending_, -static_cast<int64_t>(due.size()));
+        for (std::vector<shared_ptr<Runnable> >::iterator ix = due.begin(); ix != due.end(); ix++) {
+          (*ix)->run();
+        }
+        due.clear();
+      }
+
+      {
+        Synchronized s(manager_->monitor_);
+        int64_t timeout = (now + 1) * manager_->tick_ - Util::monotonicTime();
+        if (manager_->state_ == TimerManager::STARTED && timeout > 0) {
+          manager_->monitor_.waitForTimeRelative(timeout);
+        }
+      }
+    }
+
+    {
+      Synchronized s(manager_->monitor_);
+      if (manager_->state_ == TimerManager::STOPPING) {
+        manager_->state_ = TimerManager::STOPPED;
+        manager_->monitor_.notify();
+      }
+    }
+  }
+
+ private:
+  TimingWheelTimerManager* manager_;
+  friend class TimingWheelTimerManager;
+};
+
+#if defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable: 4355) // 'this' used in base member initializer list
+#endif
+
+TimingWheelTimerManager::TimingWheelTimerManager(int64_t tickMs, size_t slotCount, size_t shardCount) :
+  tick_(tickMs),
+  pending_(0),
+  state_(TimerManager::UNINITIALIZED),
+  dispatcher_(shared_ptr<Dispatcher>(new Dispatcher(this))) {
+  if (tickMs <= 0 || slotCount == 0 || shardCount == 0) {
+    throw InvalidArgumentException();
+  }
+
+  // Slots are picked by masking, so round up to a power of two
+  size_t slots = 1;
+  while (slots < slotCount) {
+    slots <<= 1;
+  }
+
+  int64_t now = Util::monotonicTime() / tick_;
+  for (size_t ix = 0; ix < shardCount; ix++) {
+    shards_.push_back(new Shard(slots, now));
+  }
+}
+
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#endif
+
+TimingWheelTimerManager::~TimingWheelTimerManager() {
+  if (state_ != STOPPED) {
+    stop();
+  }
+  for (size_t ix = 0; ix < shards_.size(); ix++) {
+    delete shards_[ix];
+  }
+}
+
+void TimingWheelTimerManager::start() {
+  bool doStart = false;
+  {
+    Synchronized s(monitor_);
+    if (!threadFactory()) {
+      throw InvalidArgumentException();
+    }
+    if (state_ == TimerManager::UNINITIALIZED) {
+      state_ = TimerManager::STARTING;
+      doStart = true;
+    }
+  }
+
+  if (doStart) {
+    for (size_t ix = 0; ix < shards_.size(); ix++) {
+      Guard g(shards_[ix]->mutex);
+      shards_[ix]->running = true;
+    }
+    dispatcherThread_ = threadFactory()->newThread(dispatcher_);
+    dispatcherThread_->start();
+  }
+
+  {
+    Synchronized s(monitor_);
+    while (state_ == TimerManager::STARTING) {
+      monitor_.wait();
+    }
+  }
+}
+
+void TimingWheelTimerManager::stop() {
+  bool doStop = false;
+  {
+    Synchronized s(monitor_);
+    if (state_ == TimerManager::UNINITIALIZED) {
+      state_ = TimerManager::STOPPED;
+    } else if (state_ != STOPPING && state_ != STOPPED) {
+      doStop = true;
+      state_ = STOPPING;
+      monitor_.notifyAll();
+    }
+    while (state_ != STOPPED) {
+      monitor_.wait();
+    }
+  }
+
+  if (doStop) {
+    // Clean up any outstanding tasks
+    for (size_t ix = 0; ix < shards_.size(); ix++) {
+      Guard g(shards_[ix]->mutex);
+      shards_[ix]->running = false;
+      atomicAdd(&pending_, -static_cast<int64_t>(shards_[ix]->count()));
+      shards_[ix]->clear();
+    }
+
+    // Remove dispatcher's reference to us.
+    dispatcher_->manager_ = NULL;
+  }
+}
+
+size_t TimingWheelTimerManager::taskCount() const {
+  size_t count = 0;
+  for (size_t ix = 0; ix < shards_.size(); ix++) {
+    Guard g(shards_[ix]->mutex);
+    count += shards_[ix]->count();
+  }
+  return count;
+}
+
+TimingWheelTimerManager::Shard& TimingWheelTimerManager::shardFor(const Runnable* task) {
+  return *shards_[hashOf(task) % shards_.size()];
+}
+
+void TimingWheelTimerManager::add(shared_ptr<Runnable> task, int64_t timeout) {
+  int64_t due = (Util::monotonicTime() + timeout + tick_ - 1) / tick_;
+
+  // Counted first, so the dispatcher never thinks there are fewer tasks
+  // than there are
+  bool wake = atomicAdd(&pending_, 1) == 1;
+  {
+    Shard& shard = shardFor(task.get());
+    Guard g(shard.mutex);
+    if (!shard.running) {
+      atomicAdd(&pending_, -1);
+      throw IllegalStateException();
+    }
+    try {
+      shard.add(task, due);
+    } catch (...) {
+      atomicAdd(&pending_, -1);
+      throw;
+    }
+  }
+
+  // Until there was a task, the dispatcher was waiting for one
+  if (wake) {
+    Synchronized s(monitor_);
+    monitor_.notify();
+  }
+}
+
+void TimingWheelTimerManager::remove(shared_ptr<Runnable> task) {
+  Shard& shard = shardFor(task.get());
+  Guard g(shard.mutex);
+  if (!shard.running) {
+    throw IllegalStateException();
+  }
+  if (!shard.remove(task.get())) {
+    throw NoSuchTaskException();
+  }
+  atomicAdd(&pending_, -1);
+}
+
+TimerManager::STATE TimingWheelTimerManager::state() const { return state_; }
+
+}}} // apache::thrift::concurrency
@@ -0,0 +1,86 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_CONCURRENCY_TIMINGWHEELTIMERMANAGER_H_
+#define _THRIFT_CONCURRENCY_TIMINGWHEELTIMERMANAGER_H_ 1
+
+#include <thrift/concurrency/TimerManager.h>
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+namespace apache { namespace thrift { namespace concurrency {
+
+/**
+ * Timer manager for large numbers of short-lived timers, such as a timeout
+ * for every call, most of which are removed before they fall due.
+ *
+ * Tasks are kept in hashed timing wheels of slotCount slots, each tickMs
+ * wide, rather than in one sorted map, so add() and remove() take constant
+ * time and recycle their records rather than allocate them.  The wheels
+ * are split into shardCount shards, each with its own lock, and a task
+ * goes to the shard its Runnable hashes to, so callers on different
+ * threads seldom contend.  A task runs on the dispatcher thread within a
+ * tick after it falls due; never before.
+ *
+ * remove() throws NoSuchTaskException for a task that has been run or is
+ * being run.
+ */
+class TimingWheelTimerManager : public TimerManager {
+
+ public:
+
+  TimingWheelTimerManager(int64_t tickMs=1LL, size_t slotCount=4096, size_t shardCount=16);
+
+  virtual ~TimingWheelTimerManager();
+
+  virtual void start();
+
+  virtual void stop();
+
+  virtual size_t taskCount() const;
+
+  using TimerManager::add;
+
+  virtual void add(boost::shared_ptr<Runnable> task, int64_t timeout);
+
+  virtual void remove(boost::shared_ptr<Runnable> task);
+
+  virtual STATE state() const;
+
+ private:
+  class Shard;
+  friend class Shard;
+  class Dispatcher;
+  friend class Dispatcher;
+
+  Shard& shardFor(const Runnable* task);
+
+  const int64_t tick_;
+  std::vector<Shard*> shards_;
+  volatile int64_t pending_;
+  Monitor monitor_;
+  STATE state_;
+  boost::shared_ptr<Dispatcher> dispatcher_;
+  boost::shared_ptr<Thread> dispatcherThread_;
+};
+
+}}} // apache::thrift::concurrency
+
+#endif // #ifndef _THRIFT_CONCURRENCY_TIMINGWHEELTIMERMANAGER_H_
@@ -26,6 +26,12 @@
 #include <sys/time.h>
 #endif
 
+#if defined(_MSC_VER)
+# define THRIFT_THREAD_LOCAL __declspec(thread)
+#else
+# define THRIFT_THREAD_LOCAL __thread
+#endif
+
 namespace apache { namespace thrift { namespace concurrency {
 
 int64_t Util::currentTimeTicks(int64_t ticksPerSec) {
@@ -38,4 +44,45 @@ int64_t Util::currentTimeTicks(int64_t ticksPerSec) {
   return result;
 }
 
+int64_t Util::monotonicTimeTicks(int64_t ticksPerSec) {
+#if defined(CLOCK_MONOTONIC) && !defined(_WIN32)
+  int64_t result;
+  struct THRIFT_TIMESPEC now;
+  int ret = clock_gettime(CLOCK_MONOTONIC, &now);
+  assert(ret == 0);
+  THRIFT_UNUSED_VARIABLE(ret);
+  toTicks(result, now, ticksPerSec);
+  return result;
+#else
+  return currentTimeTicks(ticksPerSec);
+#endif
+}
+
+int64_t Util::coarseMonotonicTime() {
+#if defined(CLOCK_MONOTONIC_COARSE)
+  int64_t result;
+  struct THRIFT_TIMESPEC now;
+  int ret = clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  assert(ret == 0);
+  THRIFT_UNUSED_VARIABLE(ret);
+  toTicks(result, now, MS_PER_S);
+  return result;
+#else
+  return monotonicTime();
+#endif
+}
+
+// 0 until the thread first ticks it
+static THRIFT_THREAD_LOCAL int64_t cachedNow = 0;
+
+int64_t Util::tickCachedTime() {
+  cachedNow = coarseMonotonicTime();
+  return cachedNow;
+}
+
+int64_t Util::cachedTime() {
+  int64_t now = cachedNow;
+  return now != 0 ? now : monotonicTime();
+}
+
 }}} // apache::thrift::concurrency
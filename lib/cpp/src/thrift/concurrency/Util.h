@@ -145,6 +145,44 @@ class Util {
    * Get current time as micros from epoch
    */
   static int64_t currentTimeUsec() { return currentTimeTicks(US_PER_S); }
+
+  /**
+   * Get the time of a clock that is never set back, as arbitrary-size
+   * ticks from some arbitrary point; for deadlines and intervals rather
+   * than dates, which NTP stepping the clock can't upset
+   */
+  static int64_t monotonicTimeTicks(int64_t ticksPerSec);
+
+  /**
+   * The monotonic clock in milliseconds.  Monitor::waitForTime() deadlines
+   * are on it.
+   */
+  static int64_t monotonicTime() { return monotonicTimeTicks(MS_PER_S); }
+
+  /**
+   * The monotonic clock in micros
+   */
+  static int64_t monotonicTimeUsec() { return monotonicTimeTicks(US_PER_S); }
+
+  /**
+   * monotonicTime() as of the last timer tick, a few milliseconds behind at
+   * most, but costing next to nothing to read (CLOCK_MONOTONIC_COARSE);
+   * monotonicTime() where there is no such clock
+   */
+  static int64_t coarseMonotonicTime();
+
+  /**
+   * Sets the calling thread's cached clock to coarseMonotonicTime(), and
+   * returns it.  For an event loop to call once per turn, so that the
+   * callbacks of the turn share one reading.
+   */
+  static int64_t tickCachedTime();
+
+  /**
+   * The calling thread's cached clock, as of its last tickCachedTime(), or
+   * monotonicTime() on a thread that never called it
+   */
+  static int64_t cachedTime();
 };
 
 }}} // apache::thrift::concurrency
@@ -0,0 +1,862 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/Atomic.h>
+#include <thrift/concurrency/Exception.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/Util.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <vector>
+
+#if defined(_MSC_VER)
+# define THRIFT_THREAD_LOCAL __declspec(thread)
+#else
+# define THRIFT_THREAD_LOCAL __thread
+#endif
+
+namespace apache { namespace thrift { namespace concurrency {
+
+using boost::shared_ptr;
+
+/**
+ * A ThreadManager whose workers each keep a queue of their own.
+ *
+ * Tasks added from outside go on a shared injection queue, from which an
+ * idle worker takes a batch at a time under the manager's lock.  Tasks
+ * added by a worker go on that worker's queue without any lock.  A worker
+ * runs the newest task on its own queue first, and when that is empty
+ * takes from the injection queue, then steals the oldest task from the
+ * other workers' queues, and only then sleeps.  Stealing is lock-free
+ * (Chase and Lev, "Dynamic Circular Work-Stealing Deque"), with a fixed
+ * capacity; a worker whose queue is full adds to the injection queue
+ * instead.
+ *
+ * pendingTaskCountMax, add() timeouts and expiration behave as they do in
+ * ThreadManager::Impl, except that an expired task on a worker's queue is
+ * dropped when it comes to be run rather than by removeExpiredTasks(),
+ * which sees only the injection queue.  Task records are recycled rather
+ * than allocated for each add().
+ */
+class WorkStealingThreadManager : public ThreadManager {
+
+ public:
+  WorkStealingThreadManager(size_t workerCount, size_t pendingTaskCountMax);
+
+  ~WorkStealingThreadManager();
+
+  void start();
+
+  void stop() { stopImpl(false); }
+
+  void join() { stopImpl(true); }
+
+  ThreadManager::STATE state() const {
+    Guard g(mutex_);
+    return state_;
+  }
+
+  shared_ptr<ThreadFactory> threadFactory() const {
+    Guard g(mutex_);
+    return threadFactory_;
+  }
+
+  void threadFactory(shared_ptr<ThreadFactory> value) {
+    Guard g(mutex_);
+    threadFactory_ = value;
+  }
+
+  void addWorker(size_t value);
+
+  void removeWorker(size_t value);
+
+  size_t idleWorkerCount() const {
+    return static_cast<size_t>(atomicLoad<ATOMIC_ACQUIRE>(&idleCount_));
+  }
+
+  size_t workerCount() const {
+    Guard g(mutex_);
+    return workerCount_;
+  }
+
+  size_t pendingTaskCount() const {
+    return static_cast<size_t>(atomicLoad<ATOMIC_ACQUIRE>(&pendingCount_));
+  }
+
+  size_t totalTaskCount() const {
+    return static_cast<size_t>(atomicLoad<ATOMIC_ACQUIRE>(&totalCount_));
+  }
+
+  size_t pendingTaskCountMax() const {
+    return pendingTaskCountMax_;
+  }
+
+  size_t expiredTaskCount() {
+    int64_t result = atomicLoad<ATOMIC_ACQUIRE>(&expiredCount_);
+    atomicAdd(&expiredCount_, -result);
+    return static_cast<size_t>(result);
+  }
+
+  void add(shared_ptr<Runnable> value, int64_t timeout, int64_t expiration);
+
+  void remove(shared_ptr<Runnable> task);
+
+  shared_ptr<Runnable> removeNextPending();
+
+  void removeExpiredTasks();
+
+  void setExpireCallback(ExpireCallback expireCallback);
+
+ private:
+  struct Task {
+    shared_ptr<Runnable> runnable;
+    int64_t expireTime;
+    Task* next;
+  };
+
+  class Queue;
+  class Worker;
+  friend class Worker;
+
+  // The worker running on this thread, if any
+  static THRIFT_THREAD_LOCAL Worker* currentWorker_;
+
+  // Most tasks a worker takes from the injection queue at once
+  static const size_t INJECTION_BATCH = 16;
+
+  // Most free task records kept by each worker, and by the manager
+  static const size_t WORKER_FREE_TASKS = 64;
+  static const size_t MANAGER_FREE_TASKS = 1024;
+
+  void stopImpl(bool join);
+
+  // Whether worker should keep running; called with mutex_ held
+  bool isActive() const;
+
+  // The next task for worker once its own queue is empty, or NULL once it
+  // should exit
+  Task* nextTask(Worker* worker);
+
+  // Takes a task from the injection queue, and a batch more onto worker's
+  // queue; called with mutex_ held
+  Task* takeInjected(Worker* worker);
+
+  // Steals a task from any worker's queue but worker's own
+  Task* steal(Worker* worker);
+
+  void runTask(Worker* worker, Task* task);
+
+  // Accounts for a task taken off a queue
+  void taskTaken();
+
+  bool isExpired(const Task* task, int64_t& now) const;
+
+  void expire(Task* task);
+
+  void removeExpiredTasksLocked();
+
+  // Called with mutex_ held
+  Task* newTaskLocked();
+  void freeTaskLocked(Task* task);
+
+  const size_t initialWorkerCount_;
+  const size_t pendingTaskCountMax_;
+
+  size_t workerCount_;
+  size_t workerMaxCount_;
+  ExpireCallback expireCallback_;
+  ThreadManager::STATE state_;
+  shared_ptr<ThreadFactory> threadFactory_;
+
+  Mutex mutex_;
+  Monitor monitor_;
+  Monitor maxMonitor_;
+  Monitor workerMonitor_;
+
+  // Counts read without mutex_
+  volatile int64_t idleCount_;
+  volatile int64_t pendingCount_;
+  volatile int64_t totalCount_;
+  volatile int64_t expiredCount_;
+  volatile int64_t injectedCount_;
+  volatile int64_t retiringCount_;
+  volatile int64_t blockedAddCount_;
+  volatile int64_t accepting_;
+
+  std::deque<Task*> injected_;
+  Task* freeTasks_;
+  size_t freeTaskCount_;
+
+  // Every queue, each in use by at most one worker; the vector is replaced
+  // rather than changed, so thieves can read it without mutex_, and old
+  // ones kept until the manager goes
+  void* volatile queues_;
+  std::vector<std::vector<Queue*>*> retiredQueues_;
+
+  std::set<shared_ptr<Thread> > workers_;
+  std::set<shared_ptr<Thread> > deadWorkers_;
+};
+
+const size_t WorkStealingThreadManager::INJECTION_BATCH;
+const size_t WorkStealingThreadManager::WORKER_FREE_TASKS;
+const size_t WorkStealingThreadManager::MANAGER_FREE_TASKS;
+
+THRIFT_THREAD_LOCAL WorkStealingThreadManager::Worker* WorkStealingThreadManager::currentWorker_ = NULL;
+
+/**
+ * A fixed-capacity Chase-Lev deque.  Only its owner pushes and pops, at
+ * the bottom; anyone steals, from the top.
+ */
+class WorkStealingThreadManager::Queue {
+ public:
+  static const int64_t CAPACITY = 256;
+
+  Queue() : top_(0), bottom_(0), inUse(false) {
+    for (int64_t i = 0; i < CAPACITY; ++i) {
+      ring_[i] = NULL;
+    }
+  }
+
+  bool push(Task* task) {
+    int64_t b = atomicLoad<ATOMIC_ACQUIRE>(&bottom_);
+    int64_t t = atomicLoad<ATOMIC_ACQUIRE>(&top_);
+    if (b - t >= CAPACITY) {
+      return false;
+    }
+    atomicStore<ATOMIC_RELEASE>(&ring_[b & (CAPACITY - 1)], task);
+    atomicStore<ATOMIC_RELEASE>(&bottom_, b + 1);
+    return true;
+  }
+
+  Task* pop() {
+    int64_t b = atomicLoad<ATOMIC_ACQUIRE>(&bottom_) - 1;
+    atomicStore<ATOMIC_RELEASE>(&bottom_, b);
+    atomicFence();
+    int64_t t = atomicLoad<ATOMIC_ACQUIRE>(&top_);
+    if (t > b) {
+      atomicStore<ATOMIC_RELEASE>(&bottom_, b + 1);
+      return NULL;
+    }
+    Task* task = static_cast<Task*>(atomicLoad<ATOMIC_ACQUIRE>(&ring_[b & (CAPACITY - 1)]));
+    if (t == b) {
+      // The last one, which a thief may be taking too
+      if (!atomicCompareAndSwap(&top_, t, t + 1)) {
+        task = NULL;
+      }
+      atomicStore<ATOMIC_RELEASE>(&bottom_, b + 1);
+    }
+    return task;
+  }
+
+  Task* steal() {
+    int64_t t = atomicLoad<ATOMIC_ACQUIRE>(&top_);
+    atomicFence();
+    int64_t b = atomicLoad<ATOMIC_ACQUIRE>(&bottom_);
+    if (t >= b) {
+      return NULL;
+    }
+    Task* task = static_cast<Task*>(atomicLoad<ATOMIC_ACQUIRE>(&ring_[t & (CAPACITY - 1)]));
+    if (!atomicCompareAndSwap(&top_, t, t + 1)) {
+      return NULL;
+    }
+    return task;
+  }
+
+ private:
+  volatile int64_t top_;
+  volatile int64_t bottom_;
+  void* volatile ring_[CAPACITY];
+
+ public:
+  // Guarded by the manager's mutex_
+  bool inUse;
+};
+
+class WorkStealingThreadManager::Worker : public Runnable {
+ public:
+  Worker(WorkStealingThreadManager* manager, Queue* queue) :
+    manager_(manager),
+    queue_(queue),
+    freeTasks_(NULL),
+    freeTaskCount_(0),
+    victim_(0) {}
+
+  ~Worker() {
+    while (freeTasks_ != NULL) {
+      Task* task = freeTasks_;
+      freeTasks_ = task->next;
+      delete task;
+    }
+  }
+
+  void run() {
+    bool active = false;
+    {
+      Guard g(manager_->mutex_);
+      active = manager_->workerCount_ < manager_->workerMaxCount_;
+      if (active) {
+        manager_->workerCount_++;
+        if (manager_->workerCount_ == manager_->workerMaxCount_) {
+          manager_->workerMonitor_.notify();
+        }
+      }
+    }
+
+    currentWorker_ = this;
+    while (active) {
+      Task* task = NULL;
+      if (atomicLoad<ATOMIC_ACQUIRE>(&manager_->retiringCount_) == 0) {
+        task = queue_->pop();
+      }
+      if (task == NULL) {
+        task = manager_->nextTask(this);
+      }
+      if (task == NULL) {
+        break;
+      }
+      manager_->runTask(this, task);
+    }
+    currentWorker_ = NULL;
+
+    {
+      Guard g(manager_->mutex_);
+      manager_->deadWorkers_.insert(this->thread());
+      manager_->workerMonitor_.notifyAll();
+    }
+  }
+
+  Task* newTask() {
+    if (freeTasks_ == NULL) {
+      return new Task();
+    }
+    Task* task = freeTasks_;
+    freeTasks_ = task->next;
+    freeTaskCount_--;
+    return task;
+  }
+
+  void freeTask(Task* task) {
+    task->runnable.reset();
+    if (freeTaskCount_ < WORKER_FREE_TASKS) {
+      task->next = freeTasks_;
+      freeTasks_ = task;
+      freeTaskCount_++;
+    } else {
+      delete task;
+    }
+  }
+
+ private:
+  WorkStealingThreadManager* manager_;
+  Queue* queue_;
+  Task* freeTasks_;
+  size_t freeTaskCount_;
+  size_t victim_;
+
+  friend class WorkStealingThreadManager;
+};
+
+WorkStealingThreadManager::WorkStealingThreadManager(size_t workerCount,
+                                                     size_t pendingTaskCountMax) :
+  initialWorkerCount_(workerCount),
+  pendingTaskCountMax_(pendingTaskCountMax),
+  workerCount_(0),
+  workerMaxCount_(0),
+  state_(ThreadManager::UNINITIALIZED),
+  monitor_(&mutex_),
+  maxMonitor_(&mutex_),
+  workerMonitor_(&mutex_),
+  idleCount_(0),
+  pendingCount_(0),
+  totalCount_(0),
+  expiredCount_(0),
+  injectedCount_(0),
+  retiringCount_(0),
+  blockedAddCount_(0),
+  accepting_(0),
+  freeTasks_(NULL),
+  freeTaskCount_(0),
+  queues_(new std::vector<Queue*>()) {}
+
+WorkStealingThreadManager::~WorkStealingThreadManager() {
+  stop();
+
+  std::vector<Queue*>* queues = static_cast<std::vector<Queue*>*>(queues_);
+  for (std::vector<Queue*>::iterator it = queues->begin(); it != queues->end(); ++it) {
+    Task* task;
+    while ((task = (*it)->steal()) != NULL) {
+      delete task;
+    }
+    delete *it;
+  }
+  delete queues;
+  for (size_t i = 0; i < retiredQueues_.size(); ++i) {
+    delete retiredQueues_[i];
+  }
+
+  for (std::deque<Task*>::iterator it = injected_.begin(); it != injected_.end(); ++it) {
+    delete *it;
+  }
+  while (freeTasks_ != NULL) {
+    Task* task = freeTasks_;
+    freeTasks_ = task->next;
+    delete task;
+  }
+}
+
+void WorkStealingThreadManager::start() {
+  {
+    Guard g(mutex_);
+    if (state_ != ThreadManager::UNINITIALIZED) {
+      return;
+    }
+    if (!threadFactory_) {
+      throw InvalidArgumentException();
+    }
+    state_ = ThreadManager::STARTED;
+    atomicStore<ATOMIC_RELEASE>(&accepting_, 1);
+  }
+  addWorker(initialWorkerCount_);
+}
+
+void WorkStealingThreadManager::stopImpl(bool join) {
+  size_t count = 0;
+  {
+    Guard g(mutex_);
+    if (state_ == ThreadManager::STOPPED ||
+        state_ == ThreadManager::STOPPING ||
+        state_ == ThreadManager::JOINING) {
+      return;
+    }
+    state_ = join ? ThreadManager::JOINING : ThreadManager::STOPPING;
+    atomicStore<ATOMIC_RELEASE>(&accepting_, 0);
+    count = workerMaxCount_;
+  }
+
+  removeWorker(count);
+
+  Guard g(mutex_);
+  state_ = ThreadManager::STOPPED;
+}
+
+void WorkStealingThreadManager::addWorker(size_t value) {
+  std::vector<shared_ptr<Thread> > newThreads;
+  {
+    Guard g(mutex_);
+    std::vector<Queue*>* queues = static_cast<std::vector<Queue*>*>(queues_);
+    std::vector<Queue*>* grown = NULL;
+    std::vector<Queue*>::iterator free = queues->begin();
+    for (size_t ix = 0; ix < value; ix++) {
+      while (free != queues->end() && (*free)->inUse) {
+        ++free;
+      }
+      Queue* queue;
+      if (free != queues->end()) {
+        queue = *free;
+      } else {
+        if (grown == NULL) {
+          grown = new std::vector<Queue*>(*queues);
+        }
+        queue = new Queue();
+        grown->push_back(queue);
+      }
+      queue->inUse = true;
+      newThreads.push_back(threadFactory_->newThread(
+        shared_ptr<Runnable>(new Worker(this, queue))));
+    }
+    if (grown != NULL) {
+      retiredQueues_.push_back(queues);
+      atomicStore<ATOMIC_RELEASE>(&queues_, grown);
+    }
+    workerMaxCount_ += value;
+    workers_.insert(newThreads.begin(), newThreads.end());
+  }
+
+  for (size_t ix = 0; ix < newThreads.size(); ix++) {
+    newThreads[ix]->start();
+  }
+
+  Guard g(mutex_);
+  while (workerCount_ < workerMaxCount_) {
+    workerMonitor_.waitForever();
+  }
+}
+
+void WorkStealingThreadManager::removeWorker(size_t value) {
+  Guard g(mutex_);
+  if (value > workerMaxCount_) {
+    throw InvalidArgumentException();
+  }
+
+  workerMaxCount_ -= value;
+  atomicStore<ATOMIC_RELEASE>(&retiringCount_, static_cast<int64_t>(workerCount_ - workerMaxCount_));
+  monitor_.notifyAll();
+
+  while (workerCount_ != workerMaxCount_) {
+    workerMonitor_.waitForever();
+  }
+
+  for (std::set<shared_ptr<Thread> >::iterator ix = deadWorkers_.begin();
+       ix != deadWorkers_.end(); ix++) {
+    workers_.erase(*ix);
+  }
+  deadWorkers_.clear();
+}
+
+bool WorkStealingThreadManager::isActive() const {
+  return workerCount_ <= workerMaxCount_ ||
+         (state_ == ThreadManager::JOINING && atomicLoad<ATOMIC_ACQUIRE>(&pendingCount_) != 0);
+}
+
+WorkStealingThreadManager::Task* WorkStealingThreadManager::nextTask(Worker* worker) {
+  while (true) {
+    if (atomicLoad<ATOMIC_ACQUIRE>(&retiringCount_) == 0) {
+      if (atomicLoad<ATOMIC_ACQUIRE>(&injectedCount_) != 0) {
+        Guard g(mutex_);
+        Task* task = takeInjected(worker);
+        if (task != NULL) {
+          return task;
+        }
+      }
+      Task* task = steal(worker);
+      if (task != NULL) {
+        return task;
+      }
+    }
+
+    Guard g(mutex_);
+    if (!isActive()) {
+      // Leave the rest of this worker's queue to the others
+      Task* task;
+      while ((task = worker->queue_->pop()) != NULL) {
+        injected_.push_back(task);
+      }
+      atomicStore<ATOMIC_RELEASE>(&injectedCount_, static_cast<int64_t>(injected_.size()));
+      worker->queue_->inUse = false;
+      workerCount_--;
+      atomicStore<ATOMIC_RELEASE>(&retiringCount_, static_cast<int64_t>(workerCount_ - workerMaxCount_));
+      if (!injected_.empty()) {
+        monitor_.notify();
+      }
+      return NULL;
+    }
+
+    Task* task = worker->queue_->pop();
+    if (task == NULL) {
+      task = takeInjected(worker);
+    }
+    if (task != NULL) {
+      return task;
+    }
+
+    // Announce this worker as idle before looking at the other queues a
+    // last time, so that a worker adding to its own queue after that look
+    // sees it and wakes it
+    atomicAdd(&idleCount_, 1);
+    task = steal(worker);
+    if (task == NULL) {
+      if (state_ == ThreadManager::JOINING) {
+        monitor_.waitForTimeRelative(1);
+      } else {
+        monitor_.waitForever();
+      }
+    }
+    atomicAdd(&idleCount_, -1);
+    if (task != NULL) {
+      return task;
+    }
+  }
+}
+
+WorkStealingThreadManager::Task* WorkStealingThreadManager::takeInjected(Worker* worker) {
+  // Hand back the records of tasks this worker has run, which mostly came
+  // from here
+  while (worker->freeTasks_ != NULL && freeTaskCount_ < MANAGER_FREE_TASKS) {
+    Task* free = worker->freeTasks_;
+    worker->freeTasks_ = free->next;
+    worker->freeTaskCount_--;
+    free->next = freeTasks_;
+    freeTasks_ = free;
+    freeTaskCount_++;
+  }
+
+  if (injected_.empty()) {
+    return NULL;
+  }
+  Task* task = injected_.front();
+  injected_.pop_front();
+
+  size_t batch = (std::min)(injected_.size() / (std::max)(workerMaxCount_, (size_t)1),
+                            INJECTION_BATCH);
+  for (size_t ix = 0; ix < batch && worker->queue_->push(injected_.front()); ix++) {
+    injected_.pop_front();
+  }
+  atomicStore<ATOMIC_RELEASE>(&injectedCount_, static_cast<int64_t>(injected_.size()));
+  return task;
+}
+
+WorkStealingThreadManager::Task* WorkStealingThreadManager::steal(Worker* worker) {
+  const std::vector<Queue*>* queues =
+    static_cast<const std::vector<Queue*>*>(atomicLoad<ATOMIC_ACQUIRE>(&queues_));
+  size_t count = queues->size();
+  for (size_t ix = 0; ix < count; ix++) {
+    Queue* queue = (*queues)[(worker->victim_ + ix) % count];
+    if (queue == worker->queue_) {
+      continue;
+    }
+    Task* task = queue->steal();
+    if (task != NULL) {
+      worker->victim_ = (worker->victim_ + ix) % count;
+      return task;
+    }
+  }
+  worker->victim_++;
+  return NULL;
+}
+
+void WorkStealingThreadManager::taskTaken() {
+  atomicAdd(&pendingCount_, -1);
+  if (pendingTaskCountMax_ != 0 && atomicLoad<ATOMIC_ACQUIRE>(&blockedAddCount_) != 0) {
+    Guard g(mutex_);
+    maxMonitor_.notify();
+  }
+}
+
+bool WorkStealingThreadManager::isExpired(const Task* task, int64_t& now) const {
+  if (task->expireTime == 0LL) {
+    return false;
+  }
+  if (now == 0LL) {
+    now = Util::monotonicTime();
+  }
+  return task->expireTime <= now;
+}
+
+void WorkStealingThreadManager::expire(Task* task) {
+  if (expireCallback_) {
+    expireCallback_(task->runnable);
+  }
+  atomicAdd(&expiredCount_, 1);
+}
+
+void WorkStealingThreadManager::runTask(Worker* worker, Task* task) {
+  taskTaken();
+
+  int64_t now = 0LL;
+  if (isExpired(task, now)) {
+    expire(task);
+  } else {
+    try {
+      task->runnable->run();
+    } catch(...) {
+      // XXX need to log this
+    }
+  }
+
+  atomicAdd(&totalCount_, -1);
+  worker->freeTask(task);
+}
+
+WorkStealingThreadManager::Task* WorkStealingThreadManager::newTaskLocked() {
+  if (freeTasks_ == NULL) {
+    return new Task();
+  }
+  Task* task = freeTasks_;
+  freeTasks_ = task->next;
+  freeTaskCount_--;
+  return task;
+}
+
+void WorkStealingThreadManager::freeTaskLocked(Task* task) {
+  task->runnable.reset();
+  if (freeTaskCount_ < MANAGER_FREE_TASKS) {
+    task->next = freeTasks_;
+    freeTasks_ = task;
+    freeTaskCount_++;
+  } else {
+    delete task;
+  }
+}
+
+void WorkStealingThreadManager::add(shared_ptr<Runnable> value,
+                                    int64_t timeout,
+                                    int64_t expiration) {
+  int64_t expireTime = expiration != 0LL ? Util::monotonicTime() + expiration : 0LL;
+
+  Worker* worker = currentWorker_;
+  bool own = worker != NULL && worker->manager_ == this;
+  if (own && atomicLoad<ATOMIC_ACQUIRE>(&accepting_) != 0) {
+    // A worker cannot wait for room, as it may be the one to make it
+    if (pendingTaskCountMax_ > 0 &&
+        atomicLoad<ATOMIC_ACQUIRE>(&pendingCount_) >= static_cast<int64_t>(pendingTaskCountMax_)) {
+      throw TooManyPendingTasksException();
+    }
+
+    Task* task = worker->newTask();
+    task->runnable = value;
+    task->expireTime = expireTime;
+    atomicAdd(&pendingCount_, 1);
+    atomicAdd(&totalCount_, 1);
+    if (worker->queue_->push(task)) {
+      atomicFence();
+      if (atomicLoad<ATOMIC_ACQUIRE>(&idleCount_) != 0) {
+        Guard g(mutex_);
+        monitor_.notify();
+      }
+      return;
+    }
+
+    // Its queue is full
+    Guard g(mutex_);
+    injected_.push_back(task);
+    atomicStore<ATOMIC_RELEASE>(&injectedCount_, static_cast<int64_t>(injected_.size()));
+    if (atomicLoad<ATOMIC_ACQUIRE>(&idleCount_) != 0) {
+      monitor_.notify();
+    }
+    return;
+  }
+
+  Guard g(mutex_, timeout);
+
+  if (!g) {
+    throw TimedOutException();
+  }
+
+  if (state_ != ThreadManager::STARTED) {
+    throw IllegalStateException("WorkStealingThreadManager::add ThreadManager "
+                                "not started");
+  }
+
+  removeExpiredTasksLocked();
+  if (pendingTaskCountMax_ > 0 &&
+      atomicLoad<ATOMIC_ACQUIRE>(&pendingCount_) >= static_cast<int64_t>(pendingTaskCountMax_)) {
+    if (!own && timeout >= 0) {
+      atomicAdd(&blockedAddCount_, 1);
+      try {
+        while (atomicLoad<ATOMIC_ACQUIRE>(&pendingCount_) >= static_cast<int64_t>(pendingTaskCountMax_)) {
+          // This is thread safe because the mutex is shared between monitors.
+          maxMonitor_.wait(timeout);
+        }
+      } catch(...) {
+        atomicAdd(&blockedAddCount_, -1);
+        throw;
+      }
+      atomicAdd(&blockedAddCount_, -1);
+    } else {
+      throw TooManyPendingTasksException();
+    }
+  }
+
+  Task* task = newTaskLocked();
+  task->runnable = value;
+  task->expireTime = expireTime;
+  atomicAdd(&pendingCount_, 1);
+  atomicAdd(&totalCount_, 1);
+  injected_.push_back(task);
+  atomicStore<ATOMIC_RELEASE>(&injectedCount_, static_cast<int64_t>(injected_.size()));
+
+  // If idle thread is available notify it, otherwise all worker threads are
+  // running and will get around to this task in time.
+  if (atomicLoad<ATOMIC_ACQUIRE>(&idleCount_) != 0) {
+    monitor_.notify();
+  }
+}
+
+void WorkStealingThreadManager::remove(shared_ptr<Runnable> task) {
+  (void) task;
+  Guard g(mutex_);
+  if (state_ != ThreadManager::STARTED) {
+    throw IllegalStateException("WorkStealingThreadManager::remove ThreadManager not "
+                                "started");
+  }
+}
+
+shared_ptr<Runnable> WorkStealingThreadManager::removeNextPending() {
+  Guard g(mutex_);
+  if (state_ != ThreadManager::STARTED) {
+    throw IllegalStateException("WorkStealingThreadManager::removeNextPending "
+                                "ThreadManager not started");
+  }
+
+  Task* task = NULL;
+  if (!injected_.empty()) {
+    task = injected_.front();
+    injected_.pop_front();
+    atomicStore<ATOMIC_RELEASE>(&injectedCount_, static_cast<int64_t>(injected_.size()));
+  } else {
+    const std::vector<Queue*>* queues = static_cast<const std::vector<Queue*>*>(queues_);
+    for (size_t ix = 0; ix < queues->size() && task == NULL; ix++) {
+      task = (*queues)[ix]->steal();
+    }
+  }
+  if (task == NULL) {
+    return shared_ptr<Runnable>();
+  }
+
+  atomicAdd(&pendingCount_, -1);
+  atomicAdd(&totalCount_, -1);
+  if (pendingTaskCountMax_ != 0) {
+    maxMonitor_.notify();
+  }
+  shared_ptr<Runnable> runnable = task->runnable;
+  freeTaskLocked(task);
+  return runnable;
+}
+
+void WorkStealingThreadManager::removeExpiredTasks() {
+  Guard g(mutex_);
+  removeExpiredTasksLocked();
+}
+
+void WorkStealingThreadManager::removeExpiredTasksLocked() {
+  int64_t now = 0LL; // we won't ask for the time untile we need it
+
+  // note that this loop breaks at the first non-expiring task
+  size_t removed = 0;
+  while (!injected_.empty() && isExpired(injected_.front(), now)) {
+    Task* task = injected_.front();
+    injected_.pop_front();
+    expire(task);
+    freeTaskLocked(task);
+    removed++;
+  }
+  if (removed != 0) {
+    atomicStore<ATOMIC_RELEASE>(&injectedCount_, static_cast<int64_t>(injected_.size()));
+    atomicAdd(&pendingCount_, -static_cast<int64_t>(removed));
+    atomicAdd(&totalCount_, -static_cast<int64_t>(removed));
+  }
+}
+
+void WorkStealingThreadManager::setExpireCallback(ExpireCallback expireCallback) {
+  expireCallback_ = expireCallback;
+}
+
+shared_ptr<ThreadManager> ThreadManager::newWorkStealingThreadManager(size_t count,
+                                                                      size_t pendingTaskCountMax) {
+  return shared_ptr<ThreadManager>(new WorkStealingThreadManager(count, pendingTaskCountMax));
+}
+
+}}} // apache::thrift::concurrency
@@ -24,6 +24,7 @@
 #include <thrift/transport/TTransport.h>
 #include <thrift/protocol/TProtocol.h>
 #include <TProcessor.h>
+#include <thrift/concurrency/ShardedCounters.h>
 
 namespace apache { namespace thrift { namespace processor {
 
@@ -60,11 +61,7 @@ public:
       printf("%s (", fname.c_str());
     }
     if (frequency_) {
-      if (frequency_map_.find(fname) != frequency_map_.end()) {
-        frequency_map_[fname]++;
-      } else {
-        frequency_map_[fname] = 1;
-      }
+      frequency_map_.increment(fname);
     }
 
     apache::thrift::protocol::TType ftype;
@@ -88,8 +85,11 @@ public:
     return true;
   }
 
-  const std::map<std::string, int64_t>& get_frequency_map() {
-    return frequency_map_;
+  /// Calls per function, summed over the threads that counted them
+  std::map<std::string, int64_t> get_frequency_map() const {
+    std::map<std::string, int64_t> frequency_map;
+    frequency_map_.getAll(frequency_map);
+    return frequency_map;
   }
 
 protected:
@@ -255,7 +255,7 @@ protected:
   }
 
   boost::shared_ptr<apache::thrift::protocol::TProtocol> piprot_;
-  std::map<std::string, int64_t> frequency_map_;
+  apache::thrift::concurrency::ShardedCounters frequency_map_;
 
   bool print_;
   bool frequency_;
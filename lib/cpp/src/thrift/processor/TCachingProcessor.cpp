@@ -0,0 +1,466 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/processor/TCachingProcessor.h>
+#include <thrift/TApplicationException.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+#include <cstring>
+
+using boost::shared_ptr;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Util;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolFactory;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TVirtualTransport;
+
+namespace apache { namespace thrift { namespace processor {
+
+namespace {
+
+/// Bytes an entry is counted for besides its key and result
+const size_t ENTRY_OVERHEAD = 128;
+
+/**
+ * Reads from another transport, keeping a copy of what it read, until
+ * told to replay: then what it kept is read again before the rest.
+ */
+class RecordingTransport : public TVirtualTransport<RecordingTransport> {
+ public:
+  explicit RecordingTransport(shared_ptr<TTransport> transport)
+    : transport_(transport), replaying_(false), replayPos_(0) {}
+
+  bool isOpen() { return transport_->isOpen(); }
+  bool peek() { return replayPos_ < copy_.size() || transport_->peek(); }
+  void open() { transport_->open(); }
+  void close() { transport_->close(); }
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    if (replaying_) {
+      if (replayPos_ < copy_.size()) {
+        uint32_t left = static_cast<uint32_t>(copy_.size() - replayPos_);
+        uint32_t got = len < left ? len : left;
+        std::memcpy(buf, copy_.data() + replayPos_, got);
+        replayPos_ += got;
+        return got;
+      }
+      return transport_->read(buf, len);
+    }
+    uint32_t got = transport_->read(buf, len);
+    copy_.append(reinterpret_cast<const char*>(buf), got);
+    return got;
+  }
+
+  uint32_t readEnd() { return transport_->readEnd(); }
+
+  void write(const uint8_t* buf, uint32_t len) { transport_->write(buf, len); }
+  uint32_t writeEnd() { return transport_->writeEnd(); }
+  void flush() { transport_->flush(); }
+
+  /// Stop keeping a copy, and read what was kept again
+  void replay() {
+    replaying_ = true;
+    replayPos_ = 0;
+  }
+
+  const std::string& getCopy() const { return copy_; }
+
+ private:
+  shared_ptr<TTransport> transport_;
+  std::string copy_;
+  bool replaying_;
+  size_t replayPos_;
+};
+
+/// Writes to another transport, keeping a copy of what it wrote
+class CopyingWriteTransport : public TVirtualTransport<CopyingWriteTransport> {
+ public:
+  explicit CopyingWriteTransport(shared_ptr<TTransport> transport)
+    : transport_(transport) {}
+
+  bool isOpen() { return transport_->isOpen(); }
+  void open() { transport_->open(); }
+  void close() { transport_->close(); }
+
+  void write(const uint8_t* buf, uint32_t len) {
+    transport_->write(buf, len);
+    copy_.append(reinterpret_cast<const char*>(buf), len);
+  }
+
+  uint32_t writeEnd() { return transport_->writeEnd(); }
+  void flush() { transport_->flush(); }
+
+  const std::string& getCopy() const { return copy_; }
+
+ private:
+  shared_ptr<TTransport> transport_;
+  std::string copy_;
+};
+
+/// FNV-1a
+uint64_t hashBytes(const std::string& bytes) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    hash ^= static_cast<uint8_t>(bytes[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/**
+ * Skip the arguments of the call whose header was read, setting where
+ * they start and end in what the recording kept.
+ */
+void skipArgs(RecordingTransport& recording, TProtocol& reader,
+              size_t& argsStart, size_t& argsEnd) {
+  argsStart = recording.getCopy().size();
+  reader.skip(protocol::T_STRUCT);
+  argsEnd = recording.getCopy().size();
+  reader.readMessageEnd();
+  recording.readEnd();
+}
+
+/// Answer with the body of a reply, or an internal error if there is none
+void writeReply(TProtocol& out, const std::string& name, TMessageType type,
+                int32_t seqid, const std::string* body) {
+  if (body) {
+    out.writeMessageBegin(name, type, seqid);
+    out.getTransport()->write(reinterpret_cast<const uint8_t*>(body->data()),
+                              static_cast<uint32_t>(body->size()));
+  } else {
+    TApplicationException x(TApplicationException::INTERNAL_ERROR,
+                            "TCachingProcessor: no reply to the identical call");
+    out.writeMessageBegin(name, protocol::T_EXCEPTION, seqid);
+    x.write(&out);
+  }
+  out.writeMessageEnd();
+  out.getTransport()->writeEnd();
+  out.getTransport()->flush();
+}
+
+}
+
+const size_t TCachingProcessor::DEFAULT_MAX_BYTES;
+
+TCachingProcessor::TCachingProcessor(shared_ptr<TProcessor> processor,
+                                     shared_ptr<TProtocolFactory> protocolFactory,
+                                     size_t maxBytes)
+  : processor_(processor),
+    protocolFactory_(protocolFactory),
+    maxBytes_(maxBytes),
+    bytes_(0),
+    hits_(0),
+    misses_(0),
+    coalesced_(0) {}
+
+void TCachingProcessor::setCacheable(const std::string& name, int64_t ttl) {
+  Method& method = methods_[name];
+  method.ttl = ttl > 0 ? ttl : 0;
+  if (method.ttl == 0 && !method.coalesced) {
+    methods_.erase(name);
+  }
+}
+
+void TCachingProcessor::setCoalesced(const std::string& name, bool coalesced) {
+  Method& method = methods_[name];
+  method.coalesced = coalesced;
+  if (method.ttl == 0 && !method.coalesced) {
+    methods_.erase(name);
+  }
+}
+
+bool TCachingProcessor::process(shared_ptr<TProtocol> in,
+                                shared_ptr<TProtocol> out,
+                                void* connectionContext) {
+  if (methods_.empty()) {
+    return processor_->process(in, out, connectionContext);
+  }
+
+  shared_ptr<RecordingTransport> recording(new RecordingTransport(in->getTransport()));
+  shared_ptr<TProtocol> reader = protocolFactory_->getProtocol(recording);
+  std::string name;
+  TMessageType type;
+  int32_t seqid;
+  reader->readMessageBegin(name, type, seqid);
+
+  std::map<std::string, Method>::const_iterator method = methods_.find(name);
+  if (method == methods_.end() || type != protocol::T_CALL) {
+    // The processor reads the header again, then the rest as it comes
+    recording->replay();
+    return processor_->process(protocolFactory_->getProtocol(recording),
+                               out, connectionContext);
+  }
+
+  size_t argsStart;
+  size_t argsEnd;
+  skipArgs(*recording, *reader, argsStart, argsEnd);
+  return serve(recording->getCopy(), argsStart, argsEnd, out, name, seqid,
+               method->second, connectionContext);
+}
+
+bool TCachingProcessor::processMessage(shared_ptr<TProtocol> in,
+                                       shared_ptr<TProtocol> out,
+                                       const std::string& name,
+                                       TMessageType type,
+                                       int32_t seqid,
+                                       void* connectionContext) {
+  std::map<std::string, Method>::const_iterator method = methods_.find(name);
+  if (method == methods_.end() || type != protocol::T_CALL) {
+    return processor_->processMessage(in, out, name, type, seqid, connectionContext);
+  }
+
+  // The header was read already
+  shared_ptr<RecordingTransport> recording(new RecordingTransport(in->getTransport()));
+  shared_ptr<TProtocol> reader = protocolFactory_->getProtocol(recording);
+  size_t argsStart;
+  size_t argsEnd;
+  skipArgs(*recording, *reader, argsStart, argsEnd);
+  return serve(recording->getCopy(), argsStart, argsEnd, out, name, seqid,
+               method->second, connectionContext);
+}
+
+bool TCachingProcessor::serve(const std::string& request,
+                              size_t argsStart,
+                              size_t argsEnd,
+                              shared_ptr<TProtocol> out,
+                              const std::string& name,
+                              int32_t seqid,
+                              const Method& method,
+                              void* connectionContext) {
+  // The key is the name and the arguments, without the sequence id
+  std::string key;
+  key.reserve(name.size() + 1 + argsEnd - argsStart);
+  key.append(name).append(1, '\0').append(request, argsStart, argsEnd - argsStart);
+  uint64_t hash = hashBytes(key);
+
+  bool answered = false;
+  TMessageType type = protocol::T_REPLY;
+  shared_ptr<const std::string> body;
+  shared_ptr<Flight> flight;
+  {
+    Synchronized s(monitor_);
+    if (method.ttl > 0) {
+      answered = lookup(hash, key, body);
+    }
+    if (!answered && method.coalesced) {
+      std::map<uint64_t, shared_ptr<Flight> >::iterator it = flights_.find(hash);
+      if (it == flights_.end()) {
+        flight.reset(new Flight());
+        flight->key = key;
+        flights_[hash] = flight;
+      } else if (it->second->key == key) {
+        shared_ptr<Flight> leader = it->second;
+        ++coalesced_;
+        Waiter waiter;
+        waiter.complete = TDeferredReply::defer();
+        if (waiter.complete) {
+          waiter.out = out;
+          waiter.seqid = seqid;
+          leader->waiters.push_back(waiter);
+          return true;
+        }
+        while (!leader->done) {
+          monitor_.wait();
+        }
+        answered = true;
+        type = leader->type;
+        body = leader->body;
+      }
+      // Otherwise a call with the same hash is in flight; serve this one apart
+    }
+  }
+  if (answered) {
+    writeReply(*out, name, type, seqid, body.get());
+    return true;
+  }
+
+  // Serve the call from what was read, keeping a copy of the reply
+  shared_ptr<TMemoryBuffer> requestBuffer(new TMemoryBuffer(
+    reinterpret_cast<uint8_t*>(const_cast<char*>(request.data())) + argsStart,
+    static_cast<uint32_t>(request.size() - argsStart)));
+  shared_ptr<CopyingWriteTransport> copying(new CopyingWriteTransport(out->getTransport()));
+  bool served;
+  try {
+    served = processor_->processMessage(protocolFactory_->getProtocol(requestBuffer),
+                                        protocolFactory_->getProtocol(copying),
+                                        name, protocol::T_CALL, seqid, connectionContext);
+  } catch (...) {
+    if (flight) {
+      land(hash, key, name, flight, protocol::T_EXCEPTION, shared_ptr<const std::string>(), 0);
+    }
+    throw;
+  }
+
+  const std::string& reply = copying->getCopy();
+  type = protocol::T_EXCEPTION;
+  if (!reply.empty()) {
+    try {
+      shared_ptr<TMemoryBuffer> replyBuffer(new TMemoryBuffer(
+        reinterpret_cast<uint8_t*>(const_cast<char*>(reply.data())),
+        static_cast<uint32_t>(reply.size())));
+      shared_ptr<TProtocol> replyReader = protocolFactory_->getProtocol(replyBuffer);
+      std::string replyName;
+      int32_t replySeqid;
+      replyReader->readMessageBegin(replyName, type, replySeqid);
+      if (type == protocol::T_REPLY || type == protocol::T_EXCEPTION) {
+        uint32_t bodyStart = static_cast<uint32_t>(reply.size()) - replyBuffer->available_read();
+        replyReader->skip(protocol::T_STRUCT);
+        uint32_t bodyEnd = static_cast<uint32_t>(reply.size()) - replyBuffer->available_read();
+        body.reset(new std::string(reply, bodyStart, bodyEnd - bodyStart));
+      }
+    } catch (const TException& e) {
+      GlobalOutput.printf("TCachingProcessor: can't read the reply to %s: %s",
+                          name.c_str(), e.what());
+    }
+  }
+  if (flight || (method.ttl > 0 && type == protocol::T_REPLY && body)) {
+    land(hash, key, name, flight, type, body, method.ttl);
+  }
+  return served;
+}
+
+void TCachingProcessor::land(uint64_t hash,
+                             const std::string& key,
+                             const std::string& name,
+                             const shared_ptr<Flight>& flight,
+                             TMessageType type,
+                             const shared_ptr<const std::string>& body,
+                             int64_t ttl) {
+  std::vector<Waiter> waiters;
+  {
+    // Keep the result before the flight goes, so no identical call misses both
+    Synchronized s(monitor_);
+    if (ttl > 0 && type == protocol::T_REPLY && body) {
+      insert(hash, key, body, ttl);
+    }
+    if (flight) {
+      flights_.erase(hash);
+      flight->done = true;
+      flight->type = type;
+      flight->body = body;
+      waiters.swap(flight->waiters);
+      monitor_.notifyAll();
+    }
+  }
+
+  for (std::vector<Waiter>::iterator waiter = waiters.begin(); waiter != waiters.end(); ++waiter) {
+    try {
+      writeReply(*waiter->out, name, type, waiter->seqid, body.get());
+    } catch (const TException& e) {
+      GlobalOutput.printf("TCachingProcessor: can't answer a call to %s: %s",
+                          name.c_str(), e.what());
+    }
+    try {
+      waiter->complete();
+    } catch (const TException& e) {
+      GlobalOutput.printf("TCachingProcessor: can't complete a call to %s: %s",
+                          name.c_str(), e.what());
+    }
+  }
+}
+
+bool TCachingProcessor::lookup(uint64_t hash, const std::string& key,
+                               shared_ptr<const std::string>& result) {
+  std::map<uint64_t, EntryList::iterator>::iterator it = index_.find(hash);
+  if (it != index_.end()) {
+    EntryList::iterator entry = it->second;
+    if (entry->expires <= Util::monotonicTime()) {
+      erase(entry);
+    } else if (entry->key == key) {
+      entries_.splice(entries_.begin(), entries_, entry);
+      result = entry->result;
+      ++hits_;
+      return true;
+    }
+  }
+  ++misses_;
+  return false;
+}
+
+void TCachingProcessor::insert(uint64_t hash, const std::string& key,
+                               const shared_ptr<const std::string>& result, int64_t ttl) {
+  size_t size = key.size() + result->size() + ENTRY_OVERHEAD;
+  if (size > maxBytes_) {
+    return;
+  }
+
+  // A call made again before the first was kept, or another with the same hash
+  std::map<uint64_t, EntryList::iterator>::iterator it = index_.find(hash);
+  if (it != index_.end()) {
+    erase(it->second);
+  }
+
+  Entry entry;
+  entry.hash = hash;
+  entry.key = key;
+  entry.result = result;
+  entry.expires = Util::monotonicTime() + ttl;
+  entries_.push_front(entry);
+  index_[hash] = entries_.begin();
+  bytes_ += size;
+
+  while (bytes_ > maxBytes_) {
+    erase(--entries_.end());
+  }
+}
+
+void TCachingProcessor::erase(EntryList::iterator entry) {
+  bytes_ -= entry->key.size() + entry->result->size() + ENTRY_OVERHEAD;
+  index_.erase(entry->hash);
+  entries_.erase(entry);
+}
+
+void TCachingProcessor::clear() {
+  Synchronized s(monitor_);
+  entries_.clear();
+  index_.clear();
+  bytes_ = 0;
+}
+
+uint64_t TCachingProcessor::getHits() const {
+  Synchronized s(monitor_);
+  return hits_;
+}
+
+uint64_t TCachingProcessor::getMisses() const {
+  Synchronized s(monitor_);
+  return misses_;
+}
+
+uint64_t TCachingProcessor::getCoalesced() const {
+  Synchronized s(monitor_);
+  return coalesced_;
+}
+
+size_t TCachingProcessor::getNumEntries() const {
+  Synchronized s(monitor_);
+  return index_.size();
+}
+
+size_t TCachingProcessor::getBytes() const {
+  Synchronized s(monitor_);
+  return bytes_;
+}
+
+}}} // apache::thrift::processor
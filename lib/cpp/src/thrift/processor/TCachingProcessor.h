@@ -0,0 +1,200 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROCESSOR_TCACHINGPROCESSOR_H_
+#define _THRIFT_PROCESSOR_TCACHINGPROCESSOR_H_ 1
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/TDeferredReply.h>
+#include <thrift/TProcessor.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/protocol/TProtocol.h>
+
+namespace apache { namespace thrift { namespace processor {
+
+/**
+ * Wraps a processor, and answers calls to cacheable methods from the
+ * results of earlier calls with the same arguments, without the wrapped
+ * processor, and so the handler, ever seeing them.
+ *
+ * A call is looked up by its method name and the bytes of its arguments
+ * as they arrived; the arguments are skipped over, not read into a struct.
+ * A call found is answered with a message header carrying its own
+ * sequence id in front of the stored bytes of the result.  A call not
+ * found is served as usual, and its reply, declared exceptions included,
+ * kept for ttl milliseconds.  TApplicationExceptions are not kept.  Once
+ * the cache holds more than maxBytes, the results used longest ago go.
+ *
+ * Only make methods cacheable whose results depend on nothing but their
+ * arguments, for as long as the ttl.  Calls are read with, and answered
+ * with, protocols from protocolFactory, which must be the protocol the
+ * clients speak over what the server's transport hands up, as for
+ * TCaptureProcessor; TJSONProtocol, which reads ahead, can't be used.
+ * Calls to other methods only have their message header read twice.  Set
+ * the methods up before serving.
+ *
+ * Calls to coalesced methods made while an identical call, by name and
+ * arguments, is being served are not served again: they wait for that
+ * call's reply, exceptions included, and are answered with it, so a
+ * stampede of identical calls costs the handler one.  Where the server
+ * allows it (see TDeferredReply) the waiting calls give back their thread
+ * and are answered from the thread serving the first; elsewhere they wait
+ * on their own.  A method may be coalesced whether it is cacheable or not.
+ */
+class TCachingProcessor : public TProcessor {
+ public:
+  /// Default most bytes of arguments and results to keep
+  static const size_t DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+
+  /**
+   * @param processor serves every call not answered from the cache.
+   * @param protocolFactory makes the protocols calls are read and answered with.
+   * @param maxBytes most bytes of arguments and results to keep.
+   */
+  TCachingProcessor(boost::shared_ptr<TProcessor> processor,
+                    boost::shared_ptr<protocol::TProtocolFactory> protocolFactory,
+                    size_t maxBytes = DEFAULT_MAX_BYTES);
+
+  /**
+   * Keep the results of calls to the method for ttl milliseconds; 0 to
+   * stop keeping them.
+   */
+  void setCacheable(const std::string& name, int64_t ttl);
+
+  /// Answer identical calls to the method made at once with one reply
+  void setCoalesced(const std::string& name, bool coalesced = true);
+
+  virtual bool process(boost::shared_ptr<protocol::TProtocol> in,
+                       boost::shared_ptr<protocol::TProtocol> out,
+                       void* connectionContext);
+
+  virtual bool processMessage(boost::shared_ptr<protocol::TProtocol> in,
+                              boost::shared_ptr<protocol::TProtocol> out,
+                              const std::string& name,
+                              protocol::TMessageType type,
+                              int32_t seqid,
+                              void* connectionContext);
+
+  /// Forget every result kept
+  void clear();
+
+  // Calls answered from the cache, and calls to cacheable methods that weren't
+  uint64_t getHits() const;
+  uint64_t getMisses() const;
+  /// Calls answered with the reply to an identical call in flight
+  uint64_t getCoalesced() const;
+
+  size_t getNumEntries() const;
+  /// Bytes of arguments and results kept
+  size_t getBytes() const;
+
+ private:
+  struct Method {
+    Method() : ttl(0), coalesced(false) {}
+
+    int64_t ttl;
+    bool coalesced;
+  };
+
+  struct Entry {
+    uint64_t hash;
+    /// The method name, a NUL and the arguments
+    std::string key;
+    /// The result, between the message header and its end
+    boost::shared_ptr<const std::string> result;
+    /// When to forget it, in milliseconds
+    int64_t expires;
+  };
+
+  typedef std::list<Entry> EntryList;
+
+  /// A call deferred until the identical call in flight is answered
+  struct Waiter {
+    boost::shared_ptr<protocol::TProtocol> out;
+    int32_t seqid;
+    TDeferredReply::Completion complete;
+  };
+
+  /// A call to a coalesced method being served
+  struct Flight {
+    Flight() : done(false), type(protocol::T_EXCEPTION) {}
+
+    std::string key;
+    bool done;
+    /// Once done, the reply's type and body; no body if there was no reply
+    protocol::TMessageType type;
+    boost::shared_ptr<const std::string> body;
+    std::vector<Waiter> waiters;
+  };
+
+  /// Serve a call to a cacheable or coalesced method, its arguments skipped
+  bool serve(const std::string& request,
+             size_t argsStart,
+             size_t argsEnd,
+             boost::shared_ptr<protocol::TProtocol> out,
+             const std::string& name,
+             int32_t seqid,
+             const Method& method,
+             void* connectionContext);
+
+  /**
+   * Keep a reply for ttl milliseconds if it is a result, and land the
+   * flight, if any, answering its waiters.  body is NULL if there was no
+   * reply to read.
+   */
+  void land(uint64_t hash,
+            const std::string& key,
+            const std::string& name,
+            const boost::shared_ptr<Flight>& flight,
+            protocol::TMessageType type,
+            const boost::shared_ptr<const std::string>& body,
+            int64_t ttl);
+
+  // With monitor_ held
+  /// Look up a call, taking the result if there is one still good
+  bool lookup(uint64_t hash, const std::string& key,
+              boost::shared_ptr<const std::string>& result);
+  void insert(uint64_t hash, const std::string& key,
+              const boost::shared_ptr<const std::string>& result, int64_t ttl);
+  void erase(EntryList::iterator entry);
+
+  boost::shared_ptr<TProcessor> processor_;
+  boost::shared_ptr<protocol::TProtocolFactory> protocolFactory_;
+  size_t maxBytes_;
+  std::map<std::string, Method> methods_;
+
+  /// Guards what follows, and is notified as flights land
+  apache::thrift::concurrency::Monitor monitor_;
+  /// Most recently used first
+  EntryList entries_;
+  std::map<uint64_t, EntryList::iterator> index_;
+  std::map<uint64_t, boost::shared_ptr<Flight> > flights_;
+  size_t bytes_;
+  uint64_t hits_;
+  uint64_t misses_;
+  uint64_t coalesced_;
+};
+
+}}} // apache::thrift::processor
+
+#endif // #ifndef _THRIFT_PROCESSOR_TCACHINGPROCESSOR_H_
@@ -0,0 +1,402 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/processor/TCaptureProcessor.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/transport/PlatformSocket.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#if defined(_MSC_VER)
+# define THRIFT_THREAD_LOCAL __declspec(thread)
+#else
+# define THRIFT_THREAD_LOCAL __thread
+#endif
+
+using boost::shared_ptr;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::Util;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolFactory;
+using apache::thrift::transport::TFileReaderTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TVirtualTransport;
+
+namespace apache { namespace thrift { namespace processor {
+
+namespace {
+
+/// Calls left on this thread until the next is sampled, or 0 to start over
+THRIFT_THREAD_LOCAL uint32_t callsUntilCapture = 0;
+
+/// Reads from another transport, keeping a copy of what it read
+class CopyingTransport : public TVirtualTransport<CopyingTransport> {
+ public:
+  explicit CopyingTransport(shared_ptr<TTransport> transport)
+    : transport_(transport) {}
+
+  bool isOpen() { return transport_->isOpen(); }
+  bool peek() { return transport_->peek(); }
+  void open() { transport_->open(); }
+  void close() { transport_->close(); }
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    uint32_t got = transport_->read(buf, len);
+    copy_.append(reinterpret_cast<const char*>(buf), got);
+    return got;
+  }
+
+  uint32_t readEnd() { return transport_->readEnd(); }
+
+  void write(const uint8_t* buf, uint32_t len) { transport_->write(buf, len); }
+  uint32_t writeEnd() { return transport_->writeEnd(); }
+  void flush() { transport_->flush(); }
+
+  const std::string& getCopy() const { return copy_; }
+
+ private:
+  shared_ptr<TTransport> transport_;
+  std::string copy_;
+};
+
+void putBigEndian(uint8_t* buf, uint64_t value, int size) {
+  for (int i = size - 1; i >= 0; --i) {
+    buf[i] = static_cast<uint8_t>(value);
+    value >>= 8;
+  }
+}
+
+uint64_t getBigEndian(const uint8_t* buf, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value = (value << 8) | buf[i];
+  }
+  return value;
+}
+
+}
+
+const uint8_t TCaptureProcessor::RECORD_VERSION;
+const uint8_t TCaptureProcessor::FLAG_ONEWAY;
+const uint32_t TCaptureProcessor::HEADER_SIZE;
+
+TCaptureProcessor::TCaptureProcessor(shared_ptr<TProcessor> processor,
+                                     shared_ptr<TProtocolFactory> protocolFactory,
+                                     shared_ptr<TTransport> log,
+                                     uint32_t sampleEvery)
+  : processor_(processor),
+    protocolFactory_(protocolFactory),
+    log_(log),
+    sampleEvery_(sampleEvery) {}
+
+bool TCaptureProcessor::process(shared_ptr<TProtocol> in,
+                                shared_ptr<TProtocol> out,
+                                void* connectionContext) {
+  uint32_t every = sampleEvery_;
+  if (every == 0) {
+    return processor_->process(in, out, connectionContext);
+  }
+  if (callsUntilCapture == 0 || callsUntilCapture > every) {
+    callsUntilCapture = every;
+  }
+  if (--callsUntilCapture != 0) {
+    return processor_->process(in, out, connectionContext);
+  }
+  return capture(in, out, connectionContext);
+}
+
+bool TCaptureProcessor::capture(shared_ptr<TProtocol> in,
+                                shared_ptr<TProtocol> out,
+                                void* connectionContext) {
+  shared_ptr<CopyingTransport> copying(new CopyingTransport(in->getTransport()));
+  int64_t start = Util::currentTimeUsec();
+  int64_t begin = Util::monotonicTimeUsec();
+  bool result = processor_->process(protocolFactory_->getProtocol(copying),
+                                    out, connectionContext);
+  int64_t duration = Util::monotonicTimeUsec() - begin;
+
+  const std::string& request = copying->getCopy();
+  if (request.empty()) {
+    return result;
+  }
+
+  uint8_t flags = 0;
+  try {
+    shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer(
+      reinterpret_cast<uint8_t*>(const_cast<char*>(request.data())),
+      static_cast<uint32_t>(request.size())));
+    std::string name;
+    TMessageType type;
+    int32_t seqid;
+    protocolFactory_->getProtocol(buffer)->readMessageBegin(name, type, seqid);
+    if (type == protocol::T_ONEWAY) {
+      flags |= FLAG_ONEWAY;
+    }
+  } catch (const TException&) {
+    // Replayed as a call; the server will make of it what it did before
+  }
+
+  std::string record(HEADER_SIZE, '\0');
+  uint8_t* header = reinterpret_cast<uint8_t*>(&record[0]);
+  header[0] = RECORD_VERSION;
+  header[1] = flags;
+  putBigEndian(header + 4, static_cast<uint64_t>(start), 8);
+  putBigEndian(header + 12, static_cast<uint64_t>(duration < 0 ? 0 : duration), 4);
+  record += request;
+
+  try {
+    log_->write(reinterpret_cast<const uint8_t*>(record.data()),
+                static_cast<uint32_t>(record.size()));
+  } catch (const TException& e) {
+    GlobalOutput.printf("TCaptureProcessor: writing to the log failed: %s", e.what());
+  }
+  return result;
+}
+
+bool TCaptureProcessor::parseRecord(const uint8_t* record, uint32_t size, Record& parsed) {
+  if (size < HEADER_SIZE || record[0] != RECORD_VERSION) {
+    return false;
+  }
+  parsed.oneway = (record[1] & FLAG_ONEWAY) != 0;
+  parsed.timestampUsec = static_cast<int64_t>(getBigEndian(record + 4, 8));
+  parsed.durationUsec = static_cast<uint32_t>(getBigEndian(record + 12, 4));
+  parsed.request = record + HEADER_SIZE;
+  parsed.requestSize = size - HEADER_SIZE;
+  return true;
+}
+
+/// Calls waiting for a connection
+class TCaptureReplayer::Queue {
+ public:
+  struct Call {
+    std::string request;
+    bool oneway;
+    /// When it is to be sent, microseconds since the epoch
+    int64_t due;
+  };
+
+  /// How many calls may wait before the reader waits for them
+  static const size_t MAX_WAITING = 1024;
+
+  Queue() : closed_(false) {}
+
+  void push(const Call& call) {
+    Synchronized s(monitor_);
+    while (calls_.size() >= MAX_WAITING) {
+      monitor_.wait();
+    }
+    calls_.push_back(call);
+    monitor_.notifyAll();
+  }
+
+  /// Takes the next call, or returns false once there are no more
+  bool pop(Call& call) {
+    Synchronized s(monitor_);
+    while (calls_.empty() && !closed_) {
+      monitor_.wait();
+    }
+    if (calls_.empty()) {
+      return false;
+    }
+    call = calls_.front();
+    calls_.pop_front();
+    monitor_.notifyAll();
+    return true;
+  }
+
+  void close() {
+    Synchronized s(monitor_);
+    closed_ = true;
+    monitor_.notifyAll();
+  }
+
+ private:
+  Monitor monitor_;
+  std::deque<Call> calls_;
+  bool closed_;
+};
+
+/// Sends the calls it takes from the queue over a connection of its own
+class TCaptureReplayer::Connection : public Runnable {
+ public:
+  Connection(Queue* queue, ConnectFunction connect,
+             shared_ptr<TProtocolFactory> protocolFactory)
+    : sent(0),
+      failed(0),
+      late(0),
+      queue_(queue),
+      connect_(connect),
+      protocolFactory_(protocolFactory) {}
+
+  void run() {
+    Queue::Call call;
+    while (queue_->pop(call)) {
+      int64_t begin = Util::monotonicTimeUsec();
+      if (begin - call.due > 1000) {
+        ++late;
+      }
+      ++sent;
+      try {
+        send(call);
+        if (!call.oneway) {
+          latencies.push_back(Util::monotonicTimeUsec() - begin);
+        }
+      } catch (const TException& e) {
+        GlobalOutput.printf("TCaptureReplayer: call failed: %s", e.what());
+        ++failed;
+        if (transport_) {
+          try {
+            transport_->close();
+          } catch (const TException&) {
+          }
+        }
+        transport_.reset();
+        protocol_.reset();
+      }
+    }
+  }
+
+  std::vector<int64_t> latencies;
+  uint64_t sent;
+  uint64_t failed;
+  uint64_t late;
+
+ private:
+  void send(const Queue::Call& call) {
+    if (!transport_) {
+      transport_ = connect_();
+      protocol_ = protocolFactory_->getProtocol(transport_);
+    }
+    transport_->write(reinterpret_cast<const uint8_t*>(call.request.data()),
+                      static_cast<uint32_t>(call.request.size()));
+    transport_->writeEnd();
+    transport_->flush();
+    if (call.oneway) {
+      return;
+    }
+
+    std::string name;
+    TMessageType type;
+    int32_t seqid;
+    protocol_->readMessageBegin(name, type, seqid);
+    protocol_->skip(protocol::T_STRUCT);
+    protocol_->readMessageEnd();
+    transport_->readEnd();
+  }
+
+  Queue* queue_;
+  ConnectFunction connect_;
+  shared_ptr<TProtocolFactory> protocolFactory_;
+  shared_ptr<TTransport> transport_;
+  shared_ptr<TProtocol> protocol_;
+};
+
+TCaptureReplayer::TCaptureReplayer(shared_ptr<TFileReaderTransport> log,
+                                   ConnectFunction connect,
+                                   shared_ptr<TProtocolFactory> protocolFactory)
+  : log_(log),
+    connect_(connect),
+    protocolFactory_(protocolFactory),
+    speed_(1.0),
+    connections_(1) {}
+
+TCaptureReplayer::Result TCaptureReplayer::replay(uint64_t maxCalls) {
+  Queue queue;
+  PlatformThreadFactory threadFactory;
+  threadFactory.setDetached(false);
+  std::vector<shared_ptr<Connection> > connections;
+  std::vector<shared_ptr<Thread> > threads;
+  for (uint32_t i = 0; i < std::max(connections_, 1u); ++i) {
+    connections.push_back(shared_ptr<Connection>(
+      new Connection(&queue, connect_, protocolFactory_)));
+    threads.push_back(threadFactory.newThread(connections.back()));
+    threads.back()->start();
+  }
+
+  int64_t start = Util::monotonicTimeUsec();
+  int64_t firstCaptured = 0;
+  uint64_t read = 0;
+  std::string event;
+  while ((maxCalls == 0 || read < maxCalls) && log_->readFullEvent(&event)) {
+    TCaptureProcessor::Record record;
+    if (!TCaptureProcessor::parseRecord(reinterpret_cast<const uint8_t*>(event.data()),
+                                        static_cast<uint32_t>(event.size()), record)) {
+      GlobalOutput("TCaptureReplayer: skipping an event that is not a capture record");
+      continue;
+    }
+    if (read++ == 0) {
+      firstCaptured = record.timestampUsec;
+    }
+
+    Queue::Call call;
+    call.request.assign(reinterpret_cast<const char*>(record.request), record.requestSize);
+    call.oneway = record.oneway;
+    if (speed_ > 0) {
+      call.due = start + static_cast<int64_t>((record.timestampUsec - firstCaptured) / speed_);
+      for (int64_t now = Util::monotonicTimeUsec(); now < call.due;
+           now = Util::monotonicTimeUsec()) {
+        THRIFT_SLEEP_USEC(static_cast<unsigned int>(std::min<int64_t>(call.due - now, 100000)));
+      }
+    } else {
+      call.due = Util::monotonicTimeUsec();
+    }
+    queue.push(call);
+  }
+  queue.close();
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+
+  Result result;
+  result.sent = 0;
+  result.failed = 0;
+  result.late = 0;
+  result.elapsedUsec = Util::monotonicTimeUsec() - start;
+  std::vector<int64_t> latencies;
+  for (size_t i = 0; i < connections.size(); ++i) {
+    result.sent += connections[i]->sent;
+    result.failed += connections[i]->failed;
+    result.late += connections[i]->late;
+    latencies.insert(latencies.end(), connections[i]->latencies.begin(),
+                     connections[i]->latencies.end());
+  }
+  std::sort(latencies.begin(), latencies.end());
+  if (latencies.empty()) {
+    result.p50Usec = result.p99Usec = result.maxUsec = 0;
+  } else {
+    result.p50Usec = latencies[latencies.size() / 2];
+    result.p99Usec = latencies[latencies.size() * 99 / 100];
+    result.maxUsec = latencies.back();
+  }
+  return result;
+}
+
+}}} // apache::thrift::processor
@@ -0,0 +1,171 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROCESSOR_TCAPTUREPROCESSOR_H_
+#define _THRIFT_PROCESSOR_TCAPTUREPROCESSOR_H_ 1
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/TProcessor.h>
+#include <thrift/cxxfunctional.h>
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TFileTransport.h>
+
+namespace apache { namespace thrift { namespace processor {
+
+/**
+ * Wraps a processor, and writes one call in every sampleEvery to a log, as
+ * it arrived, for TCaptureReplayer to send to a server again later.
+ *
+ * Calls not sampled cost a thread-local count and nothing more.  A sampled
+ * call is read through a transport that keeps a copy of its bytes, with a
+ * protocol from protocolFactory, which must be the protocol the clients
+ * speak over what the server's transport hands up: the message, with any
+ * framing already taken off.  Each sampled call is one event in the log,
+ * usually a TFileTransport, which writes on a thread of its own:
+ *
+ *     version     1 byte, RECORD_VERSION
+ *     flags       1 byte, FLAG_ONEWAY for oneway calls
+ *     reserved    2 bytes, 0
+ *     timestamp   8 bytes, when the call arrived, microseconds since the epoch
+ *     duration    4 bytes, microseconds it took to serve
+ *     request     the rest, the message as read
+ *
+ * with numbers big-endian.  Calls are counted, and sampled, on each thread
+ * separately.
+ */
+class TCaptureProcessor : public TProcessor {
+ public:
+  static const uint8_t RECORD_VERSION = 1;
+  static const uint8_t FLAG_ONEWAY = 1;
+  static const uint32_t HEADER_SIZE = 16;
+
+  /// What a record's header says
+  struct Record {
+    bool oneway;
+    int64_t timestampUsec;
+    uint32_t durationUsec;
+    /// Where the request starts in the record, and its size
+    const uint8_t* request;
+    uint32_t requestSize;
+  };
+
+  /**
+   * @param processor serves every call.
+   * @param protocolFactory makes the protocol sampled calls are read with.
+   * @param log where the sampled calls are written, one event each.
+   * @param sampleEvery the share of calls to write is 1 in this; 0 for none.
+   */
+  TCaptureProcessor(boost::shared_ptr<TProcessor> processor,
+                    boost::shared_ptr<protocol::TProtocolFactory> protocolFactory,
+                    boost::shared_ptr<transport::TTransport> log,
+                    uint32_t sampleEvery);
+
+  virtual bool process(boost::shared_ptr<protocol::TProtocol> in,
+                       boost::shared_ptr<protocol::TProtocol> out,
+                       void* connectionContext);
+
+  void setSampleEvery(uint32_t sampleEvery) { sampleEvery_ = sampleEvery; }
+  uint32_t getSampleEvery() const { return sampleEvery_; }
+
+  /**
+   * Reads the header of a record of size bytes.
+   *
+   * @return false if it is too short or of another version.
+   */
+  static bool parseRecord(const uint8_t* record, uint32_t size, Record& parsed);
+
+ private:
+  /// Serves a sampled call and writes it to the log
+  bool capture(boost::shared_ptr<protocol::TProtocol> in,
+               boost::shared_ptr<protocol::TProtocol> out,
+               void* connectionContext);
+
+  boost::shared_ptr<TProcessor> processor_;
+  boost::shared_ptr<protocol::TProtocolFactory> protocolFactory_;
+  boost::shared_ptr<transport::TTransport> log_;
+  volatile uint32_t sampleEvery_;
+};
+
+/**
+ * Sends the calls a TCaptureProcessor wrote to a log to a server, at the
+ * pace they were captured, faster, or as fast as they will go, over a
+ * number of connections, and measures how long the server takes to answer.
+ *
+ * This thread reads the log and hands each call, once it is due, to the
+ * first connection free; a call that has to wait for one counts as late.
+ * Answers are read and thrown away.  A connection that fails is made
+ * again for the next call.
+ */
+class TCaptureReplayer {
+ public:
+  /// Makes an open transport to the server for a connection, framed as it expects
+  typedef apache::thrift::stdcxx::function<boost::shared_ptr<transport::TTransport>()>
+    ConnectFunction;
+
+  struct Result {
+    uint64_t sent;
+    uint64_t failed;
+    /// Sent more than a millisecond after they were due
+    uint64_t late;
+    /// Latency of the answered calls, in microseconds
+    int64_t p50Usec;
+    int64_t p99Usec;
+    int64_t maxUsec;
+    /// From the first call sent to the last answered
+    int64_t elapsedUsec;
+  };
+
+  /**
+   * @param log the capture, read from where it is.
+   * @param connect makes the connections.
+   * @param protocolFactory protocol the answers are read with.
+   */
+  TCaptureReplayer(boost::shared_ptr<transport::TFileReaderTransport> log,
+                   ConnectFunction connect,
+                   boost::shared_ptr<protocol::TProtocolFactory> protocolFactory);
+
+  /**
+   * How many times faster than captured to send the calls: 1 for the
+   * captured pace, 0 for as fast as the connections go.
+   */
+  void setSpeed(double speed) { speed_ = speed; }
+
+  void setConnections(uint32_t connections) { connections_ = connections; }
+
+  /**
+   * Sends the calls in the log, up to maxCalls if that isn't 0, and waits
+   * for their answers.
+   */
+  Result replay(uint64_t maxCalls = 0);
+
+ private:
+  class Queue;
+  class Connection;
+
+  boost::shared_ptr<transport::TFileReaderTransport> log_;
+  ConnectFunction connect_;
+  boost::shared_ptr<protocol::TProtocolFactory> protocolFactory_;
+  double speed_;
+  uint32_t connections_;
+};
+
+}}} // apache::thrift::processor
+
+#endif // #ifndef _THRIFT_PROCESSOR_TCAPTUREPROCESSOR_H_
@@ -0,0 +1,254 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/processor/TLatencyStatsHandler.h>
+#include <thrift/concurrency/Thread.h>
+#include <thrift/concurrency/Util.h>
+
+#include <cstdio>
+#include <cstring>
+
+using apache::thrift::concurrency::ShardedCounters;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::Util;
+
+namespace apache { namespace thrift { namespace processor {
+
+namespace {
+
+const char* const PHASE_NAMES[] = { "read", "handler", "write" };
+
+/// Where each number is in a method's row of counters
+enum {
+  ROW_CALLS,
+  ROW_ERRORS,
+  ROW_BYTES_IN,
+  ROW_BYTES_OUT,
+  ROW_BUCKETS,
+  ROW_WIDTH = ROW_BUCKETS + TLatencyStatsHandler::NUM_PHASES * TLatencyStatsHandler::NUM_BUCKETS
+};
+
+}
+
+struct TLatencyStatsHandler::Context {
+  const char* fn;
+  /// stats is fn's row for thread, the one that last recorded the call
+  Thread::id_t thread;
+  int64_t* stats;
+  /// When the phase under way began
+  int64_t phaseStart;
+};
+
+TLatencyStatsHandler::TLatencyStatsHandler(const std::string& prefix)
+  : prefix_(prefix) {
+}
+
+int TLatencyStatsHandler::bucketOf(uint64_t value) {
+  // The top three bits below the leading one pick one of 8 buckets
+  int msb = 63;
+  if (value < 16) {
+    return static_cast<int>(value);
+  }
+  while (!(value >> msb)) {
+    --msb;
+  }
+  int shift = msb - 3;
+  int bucket = shift * 8 + static_cast<int>(value >> shift);
+  return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+}
+
+uint64_t TLatencyStatsHandler::bucketFloor(int bucket) {
+  if (bucket < 16) {
+    return static_cast<uint64_t>(bucket);
+  }
+  int shift = bucket / 8 - 1;
+  return static_cast<uint64_t>(bucket - shift * 8) << shift;
+}
+
+int64_t* TLatencyStatsHandler::methodStats(Context* ctx) {
+  // Looked up again if the call moved threads, as with an async handler
+  // finishing elsewhere
+  if (ctx->stats == NULL || !Thread::is_current(ctx->thread)) {
+    ctx->thread = Thread::get_current();
+    ctx->stats = counters_.slots(ctx->fn, ROW_WIDTH);
+  }
+  return ctx->stats;
+}
+
+void TLatencyStatsHandler::record(int64_t* stats, Phase phase, int64_t usec) {
+  int bucket = bucketOf(usec > 0 ? static_cast<uint64_t>(usec) : 0);
+  ShardedCounters::add(&stats[ROW_BUCKETS + phase * NUM_BUCKETS + bucket], 1);
+}
+
+void* TLatencyStatsHandler::getContext(const char* fn_name, void* serverContext) {
+  (void) serverContext;
+  Context* ctx = new Context;
+  ctx->fn = fn_name;
+  ctx->stats = NULL;
+  ctx->phaseStart = Util::monotonicTimeUsec();
+  return ctx;
+}
+
+void TLatencyStatsHandler::freeContext(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  delete static_cast<Context*>(ctx);
+}
+
+void TLatencyStatsHandler::preRead(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  static_cast<Context*>(ctx)->phaseStart = Util::monotonicTimeUsec();
+}
+
+void TLatencyStatsHandler::postRead(void* ctx, const char* fn_name, uint32_t bytes) {
+  (void) fn_name;
+  Context* c = static_cast<Context*>(ctx);
+  int64_t now = Util::monotonicTimeUsec();
+  int64_t* stats = methodStats(c);
+  record(stats, PHASE_READ, now - c->phaseStart);
+  ShardedCounters::add(&stats[ROW_BYTES_IN], bytes);
+  c->phaseStart = now;
+}
+
+void TLatencyStatsHandler::preWrite(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  Context* c = static_cast<Context*>(ctx);
+  int64_t now = Util::monotonicTimeUsec();
+  int64_t* stats = methodStats(c);
+  record(stats, PHASE_HANDLER, now - c->phaseStart);
+  ShardedCounters::add(&stats[ROW_CALLS], 1);
+  c->phaseStart = now;
+}
+
+void TLatencyStatsHandler::postWrite(void* ctx, const char* fn_name, uint32_t bytes) {
+  (void) fn_name;
+  Context* c = static_cast<Context*>(ctx);
+  int64_t* stats = methodStats(c);
+  record(stats, PHASE_WRITE, Util::monotonicTimeUsec() - c->phaseStart);
+  ShardedCounters::add(&stats[ROW_BYTES_OUT], bytes);
+}
+
+void TLatencyStatsHandler::asyncComplete(void* ctx, const char* fn_name) {
+  // Oneway calls end here, with nothing to write
+  (void) fn_name;
+  Context* c = static_cast<Context*>(ctx);
+  int64_t* stats = methodStats(c);
+  record(stats, PHASE_HANDLER, Util::monotonicTimeUsec() - c->phaseStart);
+  ShardedCounters::add(&stats[ROW_CALLS], 1);
+}
+
+void TLatencyStatsHandler::handlerError(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  ShardedCounters::add(&methodStats(static_cast<Context*>(ctx))[ROW_ERRORS], 1);
+}
+
+int64_t TLatencyStatsHandler::MethodSnapshot::percentile(Phase phase, double q) const {
+  if (samples[phase] == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(samples[phase]) + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    seen += buckets[phase][i];
+    if (seen >= rank) {
+      // The most a sample in the bucket can be
+      return i + 1 < NUM_BUCKETS ? static_cast<int64_t>(bucketFloor(i + 1) - 1)
+                                 : static_cast<int64_t>(bucketFloor(i));
+    }
+  }
+  return static_cast<int64_t>(bucketFloor(NUM_BUCKETS - 1));
+}
+
+void TLatencyStatsHandler::getSnapshot(std::map<std::string, MethodSnapshot>& _return) const {
+  std::map<std::string, std::vector<int64_t> > rows;
+  counters_.getRows(rows);
+  for (std::map<std::string, std::vector<int64_t> >::const_iterator it = rows.begin();
+       it != rows.end(); ++it) {
+    const std::vector<int64_t>& row = it->second;
+    MethodSnapshot& snapshot = _return[it->first];
+    memset(&snapshot, 0, sizeof(MethodSnapshot));
+    snapshot.calls = static_cast<uint64_t>(row[ROW_CALLS]);
+    snapshot.errors = static_cast<uint64_t>(row[ROW_ERRORS]);
+    snapshot.bytesIn = static_cast<uint64_t>(row[ROW_BYTES_IN]);
+    snapshot.bytesOut = static_cast<uint64_t>(row[ROW_BYTES_OUT]);
+    for (int phase = 0; phase < NUM_PHASES; ++phase) {
+      for (int b = 0; b < NUM_BUCKETS; ++b) {
+        uint64_t n = static_cast<uint64_t>(row[ROW_BUCKETS + phase * NUM_BUCKETS + b]);
+        snapshot.buckets[phase][b] = n;
+        snapshot.samples[phase] += n;
+      }
+    }
+  }
+}
+
+void TLatencyStatsHandler::getCounters(std::map<std::string, int64_t>& _return) const {
+  std::map<std::string, MethodSnapshot> snapshots;
+  getSnapshot(snapshots);
+  for (std::map<std::string, MethodSnapshot>::const_iterator it = snapshots.begin();
+       it != snapshots.end(); ++it) {
+    const std::string name = prefix_ + it->first + ".";
+    const MethodSnapshot& s = it->second;
+    _return[name + "calls"] = static_cast<int64_t>(s.calls);
+    _return[name + "errors"] = static_cast<int64_t>(s.errors);
+    _return[name + "bytes_in"] = static_cast<int64_t>(s.bytesIn);
+    _return[name + "bytes_out"] = static_cast<int64_t>(s.bytesOut);
+    for (int phase = 0; phase < NUM_PHASES; ++phase) {
+      const std::string us = name + PHASE_NAMES[phase] + "_us.";
+      _return[us + "p50"] = s.percentile(static_cast<Phase>(phase), 0.5);
+      _return[us + "p99"] = s.percentile(static_cast<Phase>(phase), 0.99);
+      _return[us + "p999"] = s.percentile(static_cast<Phase>(phase), 0.999);
+    }
+  }
+}
+
+std::string TLatencyStatsHandler::getStatsText() const {
+  std::map<std::string, MethodSnapshot> snapshots;
+  getSnapshot(snapshots);
+
+  std::string text;
+  char line[512];
+  snprintf(line, sizeof(line), "%-32s %10s %8s %12s %12s  %-20s %-20s %-20s\n",
+           "method", "calls", "errors", "bytes_in", "bytes_out",
+           "read_us p50/99/999", "handler_us p50/99/999", "write_us p50/99/999");
+  text += line;
+  for (std::map<std::string, MethodSnapshot>::const_iterator it = snapshots.begin();
+       it != snapshots.end(); ++it) {
+    const MethodSnapshot& s = it->second;
+    char phases[NUM_PHASES][64];
+    for (int phase = 0; phase < NUM_PHASES; ++phase) {
+      snprintf(phases[phase], sizeof(phases[phase]), "%lld/%lld/%lld",
+               static_cast<long long>(s.percentile(static_cast<Phase>(phase), 0.5)),
+               static_cast<long long>(s.percentile(static_cast<Phase>(phase), 0.99)),
+               static_cast<long long>(s.percentile(static_cast<Phase>(phase), 0.999)));
+    }
+    snprintf(line, sizeof(line), "%-32s %10llu %8llu %12llu %12llu  %-20s %-20s %-20s\n",
+             it->first.c_str(),
+             static_cast<unsigned long long>(s.calls),
+             static_cast<unsigned long long>(s.errors),
+             static_cast<unsigned long long>(s.bytesIn),
+             static_cast<unsigned long long>(s.bytesOut),
+             phases[PHASE_READ], phases[PHASE_HANDLER], phases[PHASE_WRITE]);
+    text += line;
+  }
+  return text;
+}
+
+}}} // apache::thrift::processor
@@ -0,0 +1,122 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROCESSOR_TLATENCYSTATSHANDLER_H_
+#define _THRIFT_PROCESSOR_TLATENCYSTATSHANDLER_H_ 1
+
+#include <map>
+#include <string>
+#include <vector>
+#include <thrift/TProcessor.h>
+#include <thrift/concurrency/ShardedCounters.h>
+
+namespace apache { namespace thrift { namespace processor {
+
+/**
+ * TProcessorEventHandler that keeps, for every method, histograms of the
+ * time spent reading the arguments, in the handler and writing the
+ * response, with counts of calls, undeclared exceptions and bytes read
+ * and written.
+ *
+ * Each method's numbers are a row of ShardedCounters, so every thread
+ * records into histograms of its own, without locks or shared cache lines;
+ * a lock is only taken the first time a thread sees a method.  The histograms are log-linear, like HDR
+ * histograms with one significant digit: every power of two microseconds
+ * is split into 8 buckets, so a percentile is good to within 12.5%, up to
+ * about 50 days.
+ *
+ * getCounters() adds p50, p99 and p999 of each phase, in microseconds,
+ * and the totals to an fb303 counter map; getStatsText() formats the same
+ * as a table.  Install it with the processor's setEventHandler().
+ */
+class TLatencyStatsHandler : public TProcessorEventHandler {
+ public:
+  /// Buckets in each histogram
+  static const int NUM_BUCKETS = 320;
+
+  /**
+   * @param prefix put in front of every counter name getCounters() adds.
+   */
+  explicit TLatencyStatsHandler(const std::string& prefix = "thrift.");
+
+  void* getContext(const char* fn_name, void* serverContext);
+  void freeContext(void* ctx, const char* fn_name);
+  void preRead(void* ctx, const char* fn_name);
+  void postRead(void* ctx, const char* fn_name, uint32_t bytes);
+  void preWrite(void* ctx, const char* fn_name);
+  void postWrite(void* ctx, const char* fn_name, uint32_t bytes);
+  void asyncComplete(void* ctx, const char* fn_name);
+  void handlerError(void* ctx, const char* fn_name);
+
+  enum Phase {
+    PHASE_READ,
+    PHASE_HANDLER,
+    PHASE_WRITE,
+    NUM_PHASES
+  };
+
+  /// A method's numbers, summed over all threads
+  struct MethodSnapshot {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    /// Samples per bucket, for each phase
+    uint64_t buckets[NUM_PHASES][NUM_BUCKETS];
+    uint64_t samples[NUM_PHASES];
+
+    /**
+     * The microseconds below which q, from 0 to 1, of the samples of
+     * phase fall, or 0 if there are none.
+     */
+    int64_t percentile(Phase phase, double q) const;
+  };
+
+  /// Sum up the threads' numbers for every method seen so far
+  void getSnapshot(std::map<std::string, MethodSnapshot>& _return) const;
+
+  /**
+   * Add counters named <prefix><method>.<phase>_us.p50/p99/p999, and
+   * <prefix><method>.calls/errors/bytes_in/bytes_out, for every method.
+   */
+  void getCounters(std::map<std::string, int64_t>& _return) const;
+
+  /// A line per method, with its totals and percentiles
+  std::string getStatsText() const;
+
+  /// Bucket that a value falls in, and the least value in a bucket
+  static int bucketOf(uint64_t value);
+  static uint64_t bucketFloor(int bucket);
+
+ private:
+  struct Context;
+
+  /// The calling thread's row of numbers for the method ctx is a call of
+  int64_t* methodStats(Context* ctx);
+
+  /// Record a sample of phase in a row from methodStats()
+  static void record(int64_t* stats, Phase phase, int64_t usec);
+
+  std::string prefix_;
+  apache::thrift::concurrency::ShardedCounters counters_;
+};
+
+}}} // apache::thrift::processor
+
+#endif // #ifndef _THRIFT_PROCESSOR_TLATENCYSTATSHANDLER_H_
@@ -23,7 +23,9 @@
 #include <thrift/protocol/TProtocolDecorator.h>
 #include <thrift/TApplicationException.h>
 #include <thrift/TProcessor.h>
-#include <boost/tokenizer.hpp>
+#include <algorithm>
+#include <map>
+#include <vector>
 
 namespace apache 
 { 
@@ -31,42 +33,6 @@ namespace apache
     { 
         using boost::shared_ptr;
 
-        namespace protocol {
-
-            /**
-             *  To be able to work with any protocol, we needed
-             *  to allow them to call readMessageBegin() and get a TMessage in exactly
-             *  the standard format, without the service name prepended to TMessage.name.
-             */
-            class StoredMessageProtocol : public TProtocolDecorator
-            {
-            public:
-                StoredMessageProtocol( shared_ptr<protocol::TProtocol> _protocol,
-                    const std::string& _name, const TMessageType _type, 
-                    const int32_t _seqid) :
-                    TProtocolDecorator(_protocol),
-                    name(_name),
-                    type(_type),
-                    seqid(_seqid)
-                {
-                }
-
-                uint32_t readMessageBegin_virt(std::string& _name, TMessageType& _type, int32_t& _seqid)
-                {
-                    
-                    _name  = name;
-                    _type  = type;
-                    _seqid = seqid;
-
-                    return 0; // (Normal TProtocol read functions return number of bytes read)
-                }
-
-                std::string name;
-                TMessageType type;
-                int32_t seqid;
-            };
-        } //namespace protocol
-
         /**
          * <code>TMultiplexedProcessor</code> is a <code>TProcessor</code> allowing
          * a single <code>TServer</code> to provide multiple services.
@@ -113,6 +79,21 @@ namespace apache
                                     shared_ptr<TProcessor> processor )
             {
                 services[serviceName] = processor;
+
+                ServiceEntry entry;
+                entry.hash = hashName(serviceName.data(), serviceName.size());
+                entry.name = serviceName;
+                entry.processor = processor;
+                std::vector<ServiceEntry>::iterator it =
+                    std::lower_bound(lookup.begin(), lookup.end(), entry);
+                while( it != lookup.end() && it->hash == entry.hash && it->name != serviceName ) {
+                    ++it;
+                }
+                if( it != lookup.end() && it->hash == entry.hash ) {
+                    it->processor = processor;
+                } else {
+                    lookup.insert(it, entry);
+                }
             }
 
             /**
@@ -122,8 +103,8 @@ namespace apache
              *     <li>Read the beginning of the message.</li>
              *     <li>Extract the service name from the message.</li>
              *     <li>Using the service name to locate the appropriate processor.</li>
-             *     <li>Dispatch to the processor, with a decorated instance of TProtocol
-             *         that allows readMessageBegin() to return the original TMessage.</li>
+             *     <li>Hand the rest of the message to that processor with
+             *         processMessage().</li>
              * </ol>
              *  
              * \throws TException If the message type is not T_CALL or T_ONEWAY, if
@@ -160,29 +141,24 @@ namespace apache
                     throw TException(msg);
                 }
 
-                // Extract the service name
-                
-                boost::tokenizer<boost::char_separator<char> > tok( name, boost::char_separator<char>(":") );
-
-                std::vector<std::string> tokens;
-                std::copy( tok.begin(), tok.end(), std::back_inserter(tokens) );
-
-                // A valid message should consist of two tokens: the service
-                // name and the name of the method to call.
-                if( tokens.size() == 2 )
+                // A valid message name is the service name and the name of
+                // the method to call, separated by a colon.  The service is
+                // looked up without copying its name out of the message.
+                std::string::size_type colon = name.find(':');
+                if( colon != std::string::npos && colon > 0 && colon + 1 < name.size() &&
+                    name.find(':', colon + 1) == std::string::npos )
                 {
                     // Search for a processor associated with this service name.
-                    services_t::iterator it = services.find(tokens[0]);
+                    const ServiceEntry* entry = findService(name.data(), colon);
 
-                    if( it != services.end() )
+                    if( entry != NULL )
                     {
-                        shared_ptr<TProcessor> processor = it->second;
-                        // Let the processor registered for this service name 
-                        // process the message.
-                        return processor->process( 
-                            shared_ptr<protocol::TProtocol>( 
-                                new protocol::StoredMessageProtocol( in, tokens[1], type, seqid ) ), 
-                            out, connectionContext );
+                        shared_ptr<TProcessor> processor = entry->processor;
+                        // Let the processor registered for this service name
+                        // process the message, under the method name alone.
+                        name.erase(0, colon + 1);
+                        return processor->processMessage( in, out, name, type, seqid,
+                                                          connectionContext );
                     }
                     else
                     {
@@ -192,7 +168,7 @@ namespace apache
                         in->getTransport()->readEnd();
                         
                         std::string msg("TMultiplexedProcessor: Unknown service: ");
-                        msg += tokens[0];
+                        msg.append(name, 0, colon);
                         ::apache::thrift::TApplicationException x(
                             ::apache::thrift::TApplicationException::PROTOCOL_ERROR, 
                             msg);
@@ -209,8 +185,42 @@ namespace apache
             }
 
         private:
+            struct ServiceEntry {
+                uint32_t hash;
+                std::string name;
+                shared_ptr<TProcessor> processor;
+
+                bool operator<(const ServiceEntry& that) const {
+                    return hash < that.hash;
+                }
+            };
+
+            static uint32_t hashName(const char* name, size_t len) {
+                uint32_t hash = 2166136261U;
+                for( size_t i = 0; i < len; ++i ) {
+                    hash = (hash ^ (uint8_t)name[i]) * 16777619U;
+                }
+                return hash;
+            }
+
+            const ServiceEntry* findService(const char* name, size_t len) const {
+                ServiceEntry key;
+                key.hash = hashName(name, len);
+                std::vector<ServiceEntry>::const_iterator it =
+                    std::lower_bound(lookup.begin(), lookup.end(), key);
+                for( ; it != lookup.end() && it->hash == key.hash; ++it ) {
+                    if( it->name.size() == len && it->name.compare(0, len, name, len) == 0 ) {
+                        return &*it;
+                    }
+                }
+                return NULL;
+            }
+
             /** Map of service processor objects, indexed by service names. */
             services_t services;
+
+            /** The same services ordered by a hash of their names, for lookup. */
+            std::vector<ServiceEntry> lookup;
         };
     }
 } 
@@ -0,0 +1,126 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/processor/TTraceEventHandler.h>
+#include <thrift/concurrency/Util.h>
+
+using apache::thrift::concurrency::Util;
+
+namespace apache { namespace thrift { namespace processor {
+
+struct TTraceEventHandler::Context {
+  TTraceSpan span;
+  /// The thread's context before this call's, put back when it is done
+  TTraceContext previous;
+  /// When the span started, on the monotonic clock, for its duration
+  int64_t startMonotonicUsec;
+  bool finished;
+};
+
+TTraceEventHandler::TTraceEventHandler(boost::shared_ptr<TTraceSink> sink,
+                                       double sampleRate)
+  : sink_(sink),
+    sampleRate_(sampleRate) {
+  if (sampleRate <= 0) {
+    sampleBelow_ = 0;
+  } else if (sampleRate >= 1) {
+    sampleBelow_ = ~static_cast<uint64_t>(0);
+  } else {
+    sampleBelow_ = static_cast<uint64_t>(sampleRate * 18446744073709551616.0);
+  }
+}
+
+void* TTraceEventHandler::getContext(const char* fn_name, void* serverContext) {
+  (void) serverContext;
+  Context* ctx = new Context;
+  TTraceContext& trace = ctx->span.context;
+  trace = TTraceContext::takeReceived();
+  if (!trace.valid()) {
+    trace.traceId = TTraceContext::newId();
+    trace.sampled = sampleBelow_ != 0 && trace.traceId - 1 < sampleBelow_;
+  }
+  trace.spanId = TTraceContext::newId();
+
+  ctx->span.name = fn_name;
+  ctx->span.startUsec = Util::currentTimeUsec();
+  ctx->startMonotonicUsec = Util::monotonicTimeUsec();
+  ctx->span.durationUsec = 0;
+  ctx->span.bytesIn = 0;
+  ctx->span.bytesOut = 0;
+  ctx->span.error = false;
+  ctx->finished = false;
+
+  ctx->previous = TTraceContext::current();
+  TTraceContext::setCurrent(trace);
+  return ctx;
+}
+
+void TTraceEventHandler::finish(Context* ctx) {
+  if (!ctx->finished) {
+    ctx->span.durationUsec = Util::monotonicTimeUsec() - ctx->startMonotonicUsec;
+    ctx->finished = true;
+  }
+}
+
+void TTraceEventHandler::freeContext(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  if (ctx == NULL) {
+    return;
+  }
+  Context* c = static_cast<Context*>(ctx);
+  finish(c);
+
+  // An async call may be freed on another thread, whose context isn't ours
+  if (TTraceContext::current().spanId == c->span.context.spanId) {
+    TTraceContext::setCurrent(c->previous);
+  }
+
+  if (c->span.context.sampled && sink_) {
+    try {
+      sink_->emit(c->span);
+    } catch (const std::exception& e) {
+      GlobalOutput.printf("TTraceEventHandler: sink threw (ignored): %s", e.what());
+    }
+  }
+  delete c;
+}
+
+void TTraceEventHandler::postRead(void* ctx, const char* fn_name, uint32_t bytes) {
+  (void) fn_name;
+  static_cast<Context*>(ctx)->span.bytesIn = bytes;
+}
+
+void TTraceEventHandler::postWrite(void* ctx, const char* fn_name, uint32_t bytes) {
+  (void) fn_name;
+  Context* c = static_cast<Context*>(ctx);
+  c->span.bytesOut = bytes;
+  finish(c);
+}
+
+void TTraceEventHandler::asyncComplete(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  finish(static_cast<Context*>(ctx));
+}
+
+void TTraceEventHandler::handlerError(void* ctx, const char* fn_name) {
+  (void) fn_name;
+  static_cast<Context*>(ctx)->span.error = true;
+}
+
+}}} // apache::thrift::processor
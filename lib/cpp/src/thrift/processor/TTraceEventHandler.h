@@ -0,0 +1,77 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROCESSOR_TTRACEEVENTHANDLER_H_
+#define _THRIFT_PROCESSOR_TTRACEEVENTHANDLER_H_ 1
+
+#include <boost/shared_ptr.hpp>
+#include <thrift/TProcessor.h>
+#include <thrift/TTrace.h>
+
+namespace apache { namespace thrift { namespace processor {
+
+/**
+ * TProcessorEventHandler that makes every call served a span of a trace
+ * (see TTraceContext).
+ *
+ * A call whose caller sent a trace, over a THeaderProtocol, joins it as a
+ * child of the caller's span; any other call starts a trace of its own,
+ * sampled at sampleRate.  The span is the thread's current context while
+ * the handler runs, so the handler can read it and the calls it makes
+ * carry it on.  Spans of sampled traces go to the sink once the response
+ * is written.  Install it with the processor's setEventHandler().
+ *
+ * A span starts once the call's name has been read, so it leaves out time
+ * spent queued in the server; a gap between a span and its parent's is
+ * the network, the queue or the caller.
+ */
+class TTraceEventHandler : public TProcessorEventHandler {
+ public:
+  /**
+   * @param sink where spans of sampled traces go.
+   * @param sampleRate the part, from 0 to 1, of the traces started here to
+   *                   sample.  Traces from callers keep their decision.
+   */
+  explicit TTraceEventHandler(boost::shared_ptr<TTraceSink> sink,
+                              double sampleRate = 0.01);
+
+  void* getContext(const char* fn_name, void* serverContext);
+  void freeContext(void* ctx, const char* fn_name);
+  void postRead(void* ctx, const char* fn_name, uint32_t bytes);
+  void postWrite(void* ctx, const char* fn_name, uint32_t bytes);
+  void asyncComplete(void* ctx, const char* fn_name);
+  void handlerError(void* ctx, const char* fn_name);
+
+  double getSampleRate() const { return sampleRate_; }
+
+ private:
+  struct Context;
+
+  /// Ends the span if it hasn't yet
+  static void finish(Context* ctx);
+
+  boost::shared_ptr<TTraceSink> sink_;
+  double sampleRate_;
+  /// Ids below this are sampled, as ids are uniformly random
+  uint64_t sampleBelow_;
+};
+
+}}} // apache::thrift::processor
+
+#endif // #ifndef _THRIFT_PROCESSOR_TTRACEEVENTHANDLER_H_
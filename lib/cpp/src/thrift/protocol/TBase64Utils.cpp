@@ -20,6 +20,15 @@
 #include <thrift/protocol/TBase64Utils.h>
 
 #include <boost/static_assert.hpp>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#include <immintrin.h>
+#define THRIFT_BASE64_AVX2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define THRIFT_BASE64_NEON 1
+#endif
 
 using std::string;
 
@@ -75,5 +84,219 @@ void base64_decode(uint8_t *buf, uint32_t len) {
   }
 }
 
+namespace {
+
+#ifdef THRIFT_BASE64_AVX2
+// The kernels are compiled for AVX2 on their own and only called once the
+// CPU is known to have it, so the rest of the build is left alone.  Each
+// returns how much of its input it handled; the caller does the rest.
+
+bool cpuHasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+}
+
+const bool HAVE_AVX2 = cpuHasAvx2();
+
+// 24 bytes to 32 characters at a time.  Reads 28 bytes per step.
+__attribute__((target("avx2")))
+uint32_t encodeAvx2(const uint8_t *in, uint32_t len, uint8_t *out) {
+  // Each lane takes 12 bytes and spreads every 3 over a 32-bit word
+  const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                          1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  // What to add to a 6-bit value to reach its character, by range
+  const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                           'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  uint32_t pos = 0;
+  while (len - pos >= 28) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + pos));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + pos + 12));
+    __m256i v = _mm256_shuffle_epi8(
+      _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), spread);
+
+    // Move each 6-bit group to the bottom of its own byte
+    __m256i ac = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)),
+                                    _mm256_set1_epi32(0x04000040));
+    __m256i bd = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)),
+                                    _mm256_set1_epi32(0x01000010));
+    __m256i idx = _mm256_or_si256(ac, bd);
+
+    // 0-25 pick entry 13, 26-51 entry 0, and 52-63 entries 1-12
+    __m256i range = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+    __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+    range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+    __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), idx);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + pos / 3 * 4), chars);
+    pos += 24;
+  }
+  return pos;
+}
+
+// 32 characters to 24 bytes at a time, stopping short of any block with a
+// character outside the alphabet.  Writes 32 bytes per step, so it needs
+// that much room left in out.
+__attribute__((target("avx2")))
+uint32_t decodeAvx2(const uint8_t *in, uint32_t len, uint8_t *out, uint32_t outLen) {
+  // Valid characters find no bit in common between these two, by nibble
+  const __m256i loBits = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                          0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i hiBits = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  // What to add to a character to reach its value, by high nibble ('/' is 1)
+  const __m256i offsets = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                           0, 0, 0, 0, 0, 0, 0, 0,
+                                           0, 16, 19, 4, -65, -65, -71, -71,
+                                           0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i gather = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i slash = _mm256_set1_epi8('/');
+  uint32_t pos = 0;
+  uint32_t outPos = 0;
+  while (len - pos >= 32 && outLen - outPos >= 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + pos));
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), nibble);
+    __m256i lo = _mm256_and_si256(v, nibble);
+    if (!_mm256_testz_si256(_mm256_shuffle_epi8(loBits, lo),
+                            _mm256_shuffle_epi8(hiBits, hi))) {
+      break;
+    }
+    __m256i row = _mm256_add_epi8(_mm256_cmpeq_epi8(v, slash), hi);
+    v = _mm256_add_epi8(v, _mm256_shuffle_epi8(offsets, row));
+
+    // Pack each four 6-bit values into three bytes, then the lanes together
+    __m256i pairs = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(words, gather),
+                                                _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + outPos), bytes);
+    pos += 32;
+    outPos += 24;
+  }
+  return pos;
+}
+#endif // THRIFT_BASE64_AVX2
+
+#ifdef THRIFT_BASE64_NEON
+// 48 bytes to 64 characters at a time
+uint32_t encodeNeon(const uint8_t *in, uint32_t len, uint8_t *out) {
+  uint8x16x4_t table;
+  for (int i = 0; i < 4; ++i) {
+    table.val[i] = vld1q_u8(kBase64EncodeTable + 16 * i);
+  }
+  const uint8x16_t low6 = vdupq_n_u8(0x3f);
+  uint32_t pos = 0;
+  while (len - pos >= 48) {
+    uint8x16x3_t src = vld3q_u8(in + pos);
+    uint8x16x4_t chars;
+    chars.val[0] = vshrq_n_u8(src.val[0], 2);
+    chars.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(src.val[0], 4), vshrq_n_u8(src.val[1], 4)), low6);
+    chars.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(src.val[1], 2), vshrq_n_u8(src.val[2], 6)), low6);
+    chars.val[3] = vandq_u8(src.val[2], low6);
+    for (int i = 0; i < 4; ++i) {
+      chars.val[i] = vqtbl4q_u8(table, chars.val[i]);
+    }
+    vst4q_u8(out + pos / 3 * 4, chars);
+    pos += 48;
+  }
+  return pos;
+}
+
+// 64 characters to 48 bytes at a time, stopping short of any block with a
+// character outside the alphabet
+uint32_t decodeNeon(const uint8_t *in, uint32_t len, uint8_t *out) {
+  uint8x16x4_t low;
+  uint8x16x4_t high;
+  for (int i = 0; i < 4; ++i) {
+    low.val[i] = vld1q_u8(kBase64DecodeTable + 16 * i);
+    high.val[i] = vld1q_u8(kBase64DecodeTable + 64 + 16 * i);
+  }
+  const uint8x16_t sixtyFour = vdupq_n_u8(64);
+  uint32_t pos = 0;
+  uint32_t outPos = 0;
+  while (len - pos >= 64) {
+    uint8x16x4_t v = vld4q_u8(in + pos);
+    uint8x16_t values = vdupq_n_u8(0);
+    uint8x16_t chars = vdupq_n_u8(0);
+    for (int i = 0; i < 4; ++i) {
+      chars = vorrq_u8(chars, v.val[i]);
+      // Characters past 127 look up 0 here, so are caught by chars instead
+      v.val[i] = vqtbx4q_u8(vqtbl4q_u8(low, v.val[i]), high,
+                            vsubq_u8(v.val[i], sixtyFour));
+      values = vorrq_u8(values, v.val[i]);
+    }
+    if (vmaxvq_u8(values) > 63 || vmaxvq_u8(chars) > 127) {
+      break;
+    }
+    uint8x16x3_t bytes;
+    bytes.val[0] = vorrq_u8(vshlq_n_u8(v.val[0], 2), vshrq_n_u8(v.val[1], 4));
+    bytes.val[1] = vorrq_u8(vshlq_n_u8(v.val[1], 4), vshrq_n_u8(v.val[2], 2));
+    bytes.val[2] = vorrq_u8(vshlq_n_u8(v.val[2], 6), v.val[3]);
+    vst3q_u8(out + outPos, bytes);
+    pos += 64;
+    outPos += 48;
+  }
+  return pos;
+}
+#endif // THRIFT_BASE64_NEON
+
+} // namespace
+
+void base64_encode_buffer(const uint8_t *in, uint32_t len, uint8_t *out) {
+  uint32_t pos = 0;
+#if defined(THRIFT_BASE64_AVX2)
+  if (HAVE_AVX2) {
+    pos = encodeAvx2(in, len, out);
+  }
+#elif defined(THRIFT_BASE64_NEON)
+  pos = encodeNeon(in, len, out);
+#endif
+  out += pos / 3 * 4;
+  while (len - pos >= 3) {
+    base64_encode(in + pos, 3, out);
+    pos += 3;
+    out += 4;
+  }
+  if (len > pos) {
+    base64_encode(in + pos, len - pos, out);
+  }
+}
+
+uint32_t base64_decode_buffer(const uint8_t *in, uint32_t len, uint8_t *out) {
+  uint32_t outLen = base64_decoded_size(len);
+  uint32_t pos = 0;
+#if defined(THRIFT_BASE64_AVX2)
+  if (HAVE_AVX2) {
+    pos = decodeAvx2(in, len, out, outLen);
+  }
+#elif defined(THRIFT_BASE64_NEON)
+  pos = decodeNeon(in, len, out);
+#endif
+  uint8_t *b = out + pos / 4 * 3;
+  uint8_t quad[4];
+  while (len - pos >= 4) {
+    std::memcpy(quad, in + pos, 4);
+    base64_decode(quad, 4);
+    std::memcpy(b, quad, 3);
+    pos += 4;
+    b += 3;
+  }
+  if (len - pos > 1) {
+    std::memcpy(quad, in + pos, len - pos);
+    base64_decode(quad, len - pos);
+    std::memcpy(b, quad, len - pos - 1);
+  }
+  return outLen;
+}
+
 
 }}} // apache::thrift::protocol
@@ -37,6 +37,29 @@ void base64_encode(const uint8_t *in, uint32_t len, uint8_t *buf);
 // no '=' padding should be included in the input
 void base64_decode(uint8_t *buf, uint32_t len);
 
+// The number of characters base64_encode_buffer() writes for len bytes
+inline uint32_t base64_encoded_size(uint32_t len) {
+  return len / 3 * 4 + (len % 3 != 0 ? len % 3 + 1 : 0);
+}
+
+// Encodes all len bytes at in, unpadded, into out, which must have room
+// for base64_encoded_size(len) bytes and may not overlap in.  Long inputs
+// go through AVX2 (where the CPU has it) or NEON, the rest as
+// base64_encode() would.
+void base64_encode_buffer(const uint8_t *in, uint32_t len, uint8_t *out);
+
+// The number of bytes base64_decode_buffer() writes for len characters
+inline uint32_t base64_decoded_size(uint32_t len) {
+  return len / 4 * 3 + (len % 4 > 1 ? len % 4 - 1 : 0);
+}
+
+// Decodes len unpadded base64 characters at in into out, which must have
+// room for base64_decoded_size(len) bytes and may not overlap in.  A single
+// character left over at the end is ignored, and characters outside the
+// alphabet come out just as base64_decode() leaves them.
+// Returns base64_decoded_size(len).
+uint32_t base64_decode_buffer(const uint8_t *in, uint32_t len, uint8_t *out);
+
 }}} // apache::thrift::protocol
 
 #endif // #define _THRIFT_PROTOCOL_TBASE64UTILS_H_
@@ -22,6 +22,7 @@
 
 #include <thrift/protocol/TProtocol.h>
 #include <thrift/protocol/TVirtualProtocol.h>
+#include <thrift/TRecycleBin.h>
 
 #include <boost/shared_ptr.hpp>
 
@@ -85,6 +86,16 @@ class TBinaryProtocolT
     strict_write_ = strict_write;
   }
 
+  /**
+   * Puts the protocol over a different transport, for a new connection,
+   * keeping its string buffer.
+   */
+  void resetTransport(boost::shared_ptr<Transport_> trans) {
+    this->ptrans_ = trans;
+    trans_ = trans.get();
+    this->resetMessageLimits();
+  }
+
   /**
    * Writing functions.
    */
@@ -104,6 +115,15 @@ class TBinaryProtocolT
                                   const TType fieldType,
                                   const int16_t fieldId);
 
+  /**
+   * The header is the field's type and then its id in network order, as
+   * laid out by the generator.
+   */
+  inline uint32_t writeFieldHeader(const char* name,
+                                   const TType fieldType,
+                                   const int16_t fieldId,
+                                   const char* binaryHeader);
+
   inline uint32_t writeFieldEnd();
 
   inline uint32_t writeFieldStop();
@@ -134,11 +154,25 @@ class TBinaryProtocolT
 
   inline uint32_t writeDouble(const double dub);
 
+  uint32_t writeI32s(const int32_t* values, uint32_t n);
+
+  uint32_t writeI64s(const int64_t* values, uint32_t n);
+
+  uint32_t writeDoubles(const double* values, uint32_t n);
+
   template <typename StrType>
   inline uint32_t writeString(const StrType& str);
 
   inline uint32_t writeBinary(const std::string& str);
 
+  uint32_t writeStringView(const TStringView& str) {
+    return writeString(str);
+  }
+
+  uint32_t writeBinaryView(const TStringView& str) {
+    return writeString(str);
+  }
+
   /**
    * Reading functions
    */
@@ -188,14 +222,53 @@ class TBinaryProtocolT
 
   inline uint32_t readDouble(double& dub);
 
+  uint32_t readI32s(int32_t* values, uint32_t n);
+
+  uint32_t readI64s(int64_t* values, uint32_t n);
+
+  uint32_t readDoubles(double* values, uint32_t n);
+
   template<typename StrType>
   inline uint32_t readString(StrType& str);
 
   inline uint32_t readBinary(std::string& str);
 
+  uint32_t readStringView(TStringView& str) {
+    return readString(str);
+  }
+
+  uint32_t readBinaryView(TStringView& str) {
+    int32_t size;
+    uint32_t result = readI32(size);
+    return result + readStringBody(str, size, false);
+  }
+
+  uint32_t readRaw(TType type, std::string& raw);
+
+  uint32_t writeRaw(const std::string& raw);
+
+  TRawFormat getRawFormat() {
+    return T_RAW_BINARY;
+  }
+
+  uint32_t skip(TType type);
+
  protected:
+  // text is whether the bytes are held to setValidateUtf8()
   template<typename StrType>
-  uint32_t readStringBody(StrType& str, int32_t sz);
+  uint32_t readStringBody(StrType& str, int32_t sz, bool text = false);
+
+  uint32_t readStringBody(TStringView& str, int32_t sz, bool text = false);
+
+  uint32_t writeArray(const void* values, uint32_t n, uint32_t width);
+  uint32_t readArray(void* values, uint32_t n, uint32_t width);
+
+  uint32_t readRawBytes(std::string& raw, uint32_t len);
+  int32_t rawSize(const std::string& raw);
+
+  uint32_t skipBytes(uint32_t len);
+  static uint32_t fixedWidth(TType type);
+  static uint32_t minWidth(TType type);
 
   Transport_* trans_;
 
@@ -224,6 +297,9 @@ class TBinaryProtocolFactoryT : public TProtocolFactory {
   TBinaryProtocolFactoryT() :
     string_limit_(0),
     container_limit_(0),
+    recursion_limit_(0),
+    message_size_limit_(0),
+    validate_utf8_(false),
     strict_read_(false),
     strict_write_(true) {}
 
@@ -231,6 +307,9 @@ class TBinaryProtocolFactoryT : public TProtocolFactory {
                           bool strict_read, bool strict_write) :
     string_limit_(string_limit),
     container_limit_(container_limit),
+    recursion_limit_(0),
+    message_size_limit_(0),
+    validate_utf8_(false),
     strict_read_(strict_read),
     strict_write_(strict_write) {}
 
@@ -244,14 +323,41 @@ class TBinaryProtocolFactoryT : public TProtocolFactory {
     container_limit_ = container_limit;
   }
 
+  void setRecursionLimit(uint32_t depth) {
+    recursion_limit_ = depth;
+  }
+
+  void setMessageSizeLimit(uint32_t bytes) {
+    message_size_limit_ = bytes;
+  }
+
+  void setValidateUtf8(bool validate) {
+    validate_utf8_ = validate;
+  }
+
   void setStrict(bool strict_read, bool strict_write) {
     strict_read_ = strict_read;
     strict_write_ = strict_write;
   }
 
+  /**
+   * Keep up to limit protocols given back through recycle(), string buffer
+   * and all, for getProtocol() to reuse.  0, the default, keeps none.
+   */
+  void setRecycleLimit(size_t limit) {
+    recycled_.setLimit(limit);
+  }
+
   boost::shared_ptr<TProtocol> getProtocol(boost::shared_ptr<TTransport> trans) {
     boost::shared_ptr<Transport_> specific_trans =
       boost::dynamic_pointer_cast<Transport_>(trans);
+    if (specific_trans) {
+      boost::shared_ptr<TBinaryProtocolT<Transport_> > recycled = recycled_.take();
+      if (recycled) {
+        recycled->resetTransport(specific_trans);
+        return recycled;
+      }
+    }
     TProtocol* prot;
     if (specific_trans) {
       prot = new TBinaryProtocolT<Transport_>(specific_trans, string_limit_,
@@ -261,15 +367,33 @@ class TBinaryProtocolFactoryT : public TProtocolFactory {
       prot = new TBinaryProtocol(trans, string_limit_, container_limit_,
                                  strict_read_, strict_write_);
     }
+    prot->setRecursionLimit(recursion_limit_);
+    prot->setMessageSizeLimit(message_size_limit_);
+    prot->setValidateUtf8(validate_utf8_);
 
     return boost::shared_ptr<TProtocol>(prot);
   }
 
+  void recycle(boost::shared_ptr<TProtocol>& prot) {
+    boost::shared_ptr<TBinaryProtocolT<Transport_> > specific_prot =
+      boost::dynamic_pointer_cast<TBinaryProtocolT<Transport_> >(prot);
+    prot.reset();
+    if (specific_prot && specific_prot.unique()) {
+      // Let go of the transport now rather than when reused
+      specific_prot->resetTransport(boost::shared_ptr<Transport_>());
+      recycled_.put(specific_prot);
+    }
+  }
+
  private:
   int32_t string_limit_;
   int32_t container_limit_;
+  uint32_t recursion_limit_;
+  uint32_t message_size_limit_;
+  bool validate_utf8_;
   bool strict_read_;
   bool strict_write_;
+  TRecycleBin<TBinaryProtocolT<Transport_> > recycled_;
 
 };
 
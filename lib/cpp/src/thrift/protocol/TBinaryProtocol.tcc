@@ -22,6 +22,11 @@
 
 #include <thrift/protocol/TBinaryProtocol.h>
 
+#include <thrift/protocol/TByteSwap.h>
+#include <thrift/TAllocTracking.h>
+
+#include <algorithm>
+#include <cstring>
 #include <limits>
 
 
@@ -68,10 +73,24 @@ uint32_t TBinaryProtocolT<Transport_>::writeFieldBegin(const char* name,
                                                        const TType fieldType,
                                                        const int16_t fieldId) {
   (void) name;
-  uint32_t wsize = 0;
-  wsize += writeByte((int8_t)fieldType);
-  wsize += writeI16(fieldId);
-  return wsize;
+  uint8_t header[3];
+  header[0] = (uint8_t)fieldType;
+  header[1] = (uint8_t)((uint16_t)fieldId >> 8);
+  header[2] = (uint8_t)fieldId;
+  this->trans_->write(header, 3);
+  return 3;
+}
+
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::writeFieldHeader(const char* name,
+                                                        const TType fieldType,
+                                                        const int16_t fieldId,
+                                                        const char* binaryHeader) {
+  (void) name;
+  (void) fieldType;
+  (void) fieldId;
+  this->trans_->write((const uint8_t*)binaryHeader, 3);
+  return 3;
 }
 
 template <class Transport_>
@@ -174,6 +193,51 @@ uint32_t TBinaryProtocolT<Transport_>::writeDouble(const double dub) {
   return 8;
 }
 
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::writeI32s(const int32_t* values,
+                                                 uint32_t n) {
+  return writeArray(values, n, 4);
+}
+
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::writeI64s(const int64_t* values,
+                                                 uint32_t n) {
+  return writeArray(values, n, 8);
+}
+
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::writeDoubles(const double* values,
+                                                    uint32_t n) {
+  BOOST_STATIC_ASSERT(sizeof(double) == sizeof(uint64_t));
+  BOOST_STATIC_ASSERT(std::numeric_limits<double>::is_iec559);
+  return writeArray(values, n, 8);
+}
+
+/**
+ * Write n values of width bytes, byte swapped a chunk at a time into a
+ * stack buffer.
+ */
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::writeArray(const void* values,
+                                                  uint32_t n,
+                                                  uint32_t width) {
+  uint8_t buf[1024];
+  const uint8_t* in = static_cast<const uint8_t*>(values);
+  const uint32_t chunk = sizeof(buf) / width;
+  uint32_t left = n;
+  while (left > 0) {
+    uint32_t count = (std::min)(left, chunk);
+    if (width == 4) {
+      detail::networkCopy32(buf, in, count);
+    } else {
+      detail::networkCopy64(buf, in, count);
+    }
+    this->trans_->write(buf, count * width);
+    in += count * width;
+    left -= count;
+  }
+  return n * width;
+}
 
 template <class Transport_>
 template<typename StrType>
@@ -201,6 +265,8 @@ template <class Transport_>
 uint32_t TBinaryProtocolT<Transport_>::readMessageBegin(std::string& name,
                                                         TMessageType& messageType,
                                                         int32_t& seqid) {
+  this->resetMessageLimits();
+
   uint32_t result = 0;
   int32_t sz;
   result += readI32(sz);
@@ -237,11 +303,13 @@ uint32_t TBinaryProtocolT<Transport_>::readMessageEnd() {
 template <class Transport_>
 uint32_t TBinaryProtocolT<Transport_>::readStructBegin(std::string& name) {
   name = "";
+  this->incrementRecursionDepth();
   return 0;
 }
 
 template <class Transport_>
 uint32_t TBinaryProtocolT<Transport_>::readStructEnd() {
+  this->decrementRecursionDepth();
   return 0;
 }
 
@@ -284,12 +352,15 @@ uint32_t TBinaryProtocolT<Transport_>::readMapBegin(TType& keyType,
   } else if (this->container_limit_ && sizei > this->container_limit_) {
     throw TProtocolException(TProtocolException::SIZE_LIMIT);
   }
+  this->incrementRecursionDepth();
+  this->checkMessageBytes((uint64_t)sizei * (minWidth(keyType) + minWidth(valType)));
   size = (uint32_t)sizei;
   return result;
 }
 
 template <class Transport_>
 uint32_t TBinaryProtocolT<Transport_>::readMapEnd() {
+  this->decrementRecursionDepth();
   return 0;
 }
 
@@ -307,12 +378,15 @@ uint32_t TBinaryProtocolT<Transport_>::readListBegin(TType& elemType,
   } else if (this->container_limit_ && sizei > this->container_limit_) {
     throw TProtocolException(TProtocolException::SIZE_LIMIT);
   }
+  this->incrementRecursionDepth();
+  this->checkMessageBytes((uint64_t)sizei * minWidth(elemType));
   size = (uint32_t)sizei;
   return result;
 }
 
 template <class Transport_>
 uint32_t TBinaryProtocolT<Transport_>::readListEnd() {
+  this->decrementRecursionDepth();
   return 0;
 }
 
@@ -330,12 +404,15 @@ uint32_t TBinaryProtocolT<Transport_>::readSetBegin(TType& elemType,
   } else if (this->container_limit_ && sizei > this->container_limit_) {
     throw TProtocolException(TProtocolException::SIZE_LIMIT);
   }
+  this->incrementRecursionDepth();
+  this->checkMessageBytes((uint64_t)sizei * minWidth(elemType));
   size = (uint32_t)sizei;
   return result;
 }
 
 template <class Transport_>
 uint32_t TBinaryProtocolT<Transport_>::readSetEnd() {
+  this->decrementRecursionDepth();
   return 0;
 }
 
@@ -403,24 +480,81 @@ uint32_t TBinaryProtocolT<Transport_>::readDouble(double& dub) {
   return 8;
 }
 
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::readI32s(int32_t* values, uint32_t n) {
+  return readArray(values, n, 4);
+}
+
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::readI64s(int64_t* values, uint32_t n) {
+  return readArray(values, n, 8);
+}
+
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::readDoubles(double* values, uint32_t n) {
+  BOOST_STATIC_ASSERT(sizeof(double) == sizeof(uint64_t));
+  BOOST_STATIC_ASSERT(std::numeric_limits<double>::is_iec559);
+  return readArray(values, n, 8);
+}
+
+/**
+ * Read n values of width bytes.  Whatever the transport can lend is byte
+ * swapped straight out of its buffer; the rest is read into values and
+ * swapped in place.
+ */
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::readArray(void* values,
+                                                 uint32_t n,
+                                                 uint32_t width) {
+  uint8_t* out = static_cast<uint8_t*>(values);
+  uint32_t left = n;
+  while (left > 0) {
+    uint32_t len = width;
+    const uint8_t* borrowed = this->trans_->borrow(NULL, &len);
+    uint32_t count;
+    if (borrowed != NULL) {
+      count = (std::min)(left, len / width);
+    } else {
+      // A chunk at a time, so the swap finds the data still in cache
+      count = (std::min)(left, 65536 / width);
+      this->trans_->readAll(out, count * width);
+      borrowed = out;
+    }
+    if (width == 4) {
+      detail::networkCopy32(out, borrowed, count);
+    } else {
+      detail::networkCopy64(out, borrowed, count);
+    }
+    if (borrowed != out) {
+      this->trans_->consume(count * width);
+    }
+    out += count * width;
+    left -= count;
+  }
+  return n * width;
+}
+
 template <class Transport_>
 template<typename StrType>
 uint32_t TBinaryProtocolT<Transport_>::readString(StrType& str) {
   uint32_t result;
   int32_t size;
   result = readI32(size);
-  return result + readStringBody(str, size);
+  return result + readStringBody(str, size, true);
 }
 
 template <class Transport_>
 uint32_t TBinaryProtocolT<Transport_>::readBinary(std::string& str) {
-  return TBinaryProtocolT<Transport_>::readString(str);
+  int32_t size;
+  uint32_t result = readI32(size);
+  return result + readStringBody(str, size, false);
 }
 
 template <class Transport_>
 template<typename StrType>
 uint32_t TBinaryProtocolT<Transport_>::readStringBody(StrType& str,
-                                                      int32_t size) {
+                                                      int32_t size,
+                                                      bool text) {
   uint32_t result = 0;
 
   // Catch error cases
@@ -430,6 +564,7 @@ uint32_t TBinaryProtocolT<Transport_>::readStringBody(StrType& str,
   if (this->string_limit_ > 0 && size > this->string_limit_) {
     throw TProtocolException(TProtocolException::SIZE_LIMIT);
   }
+  this->checkMessageBytes((uint32_t)size);
 
   // Catch empty string case
   if (size == 0) {
@@ -441,6 +576,9 @@ uint32_t TBinaryProtocolT<Transport_>::readStringBody(StrType& str,
   const uint8_t* borrow_buf;
   uint32_t got = size;
   if ((borrow_buf = this->trans_->borrow(NULL, &got))) {
+    if (text) {
+      this->checkUtf8(borrow_buf, size);
+    }
     str.assign((const char*)borrow_buf, size);
     this->trans_->consume(size);
     return size;
@@ -448,6 +586,7 @@ uint32_t TBinaryProtocolT<Transport_>::readStringBody(StrType& str,
 
   // Use the heap here to prevent stack overflow for v. large strings
   if (size > this->string_buf_size_ || this->string_buf_ == NULL) {
+    TAllocScope scope(TAllocTracking::PROTOCOL);
     void* new_string_buf = std::realloc(this->string_buf_, (uint32_t)size);
     if (new_string_buf == NULL) {
       throw std::bad_alloc();
@@ -456,10 +595,313 @@ uint32_t TBinaryProtocolT<Transport_>::readStringBody(StrType& str,
     this->string_buf_size_ = size;
   }
   this->trans_->readAll(this->string_buf_, size);
+  if (text) {
+    this->checkUtf8(this->string_buf_, size);
+  }
   str.assign((char*)this->string_buf_, size);
   return (uint32_t)size;
 }
 
+/**
+ * Points str into the transport's buffer when the transport can share it;
+ * otherwise the bytes are read straight into the view's own copy.
+ */
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::readStringBody(TStringView& str,
+                                                      int32_t size,
+                                                      bool text) {
+  // Catch error cases
+  if (size < 0) {
+    throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+  }
+  if (this->string_limit_ > 0 && size > this->string_limit_) {
+    throw TProtocolException(TProtocolException::SIZE_LIMIT);
+  }
+  this->checkMessageBytes((uint32_t)size);
+
+  // Catch empty string case
+  if (size == 0) {
+    str.clear();
+    return 0;
+  }
+
+  boost::shared_ptr<const void> owner = this->trans_->getBorrowOwner();
+  uint32_t got = size;
+  const uint8_t* borrow_buf;
+  if (owner && (borrow_buf = this->trans_->borrow(NULL, &got))) {
+    str = TStringView((const char*)borrow_buf, size, owner);
+    this->trans_->consume(size);
+  } else {
+    this->trans_->readAll((uint8_t*)str.allocate(size), size);
+  }
+  if (text) {
+    this->checkUtf8((const uint8_t*)str.data(), size);
+  }
+  return (uint32_t)size;
+}
+
+/**
+ * Raw values are copied off the wire as they are, walking just far enough
+ * into each one to find where it ends.
+ */
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::readRaw(TType type, std::string& raw) {
+  switch (type) {
+  case T_BOOL:
+  case T_BYTE:
+    return readRawBytes(raw, 1);
+  case T_I16:
+    return readRawBytes(raw, 2);
+  case T_I32:
+    return readRawBytes(raw, 4);
+  case T_I64:
+  case T_DOUBLE:
+    return readRawBytes(raw, 8);
+  case T_STRING:
+    {
+      uint32_t result = readRawBytes(raw, 4);
+      int32_t size = rawSize(raw);
+      if (this->string_limit_ > 0 && size > this->string_limit_) {
+        throw TProtocolException(TProtocolException::SIZE_LIMIT);
+      }
+      this->checkMessageBytes((uint32_t)size);
+      return result + readRawBytes(raw, (uint32_t)size);
+    }
+  case T_STRUCT:
+    {
+      TInputRecursionTracker tracker(*this);
+      uint32_t result = 0;
+      while (true) {
+        result += readRawBytes(raw, 1);
+        TType ftype = (TType)(uint8_t)raw[raw.size() - 1];
+        if (ftype == T_STOP) {
+          break;
+        }
+        result += readRawBytes(raw, 2);
+        result += readRaw(ftype, raw);
+      }
+      return result;
+    }
+  case T_MAP:
+    {
+      uint32_t result = readRawBytes(raw, 6);
+      TType keyType = (TType)(uint8_t)raw[raw.size() - 6];
+      TType valType = (TType)(uint8_t)raw[raw.size() - 5];
+      int32_t size = rawSize(raw);
+      if (this->container_limit_ && size > this->container_limit_) {
+        throw TProtocolException(TProtocolException::SIZE_LIMIT);
+      }
+      TInputRecursionTracker tracker(*this);
+      this->checkMessageBytes((uint64_t)size * (minWidth(keyType) + minWidth(valType)));
+      for (int32_t i = 0; i < size; i++) {
+        result += readRaw(keyType, raw);
+        result += readRaw(valType, raw);
+      }
+      return result;
+    }
+  case T_SET:
+  case T_LIST:
+    {
+      uint32_t result = readRawBytes(raw, 5);
+      TType elemType = (TType)(uint8_t)raw[raw.size() - 5];
+      int32_t size = rawSize(raw);
+      if (this->container_limit_ && size > this->container_limit_) {
+        throw TProtocolException(TProtocolException::SIZE_LIMIT);
+      }
+      TInputRecursionTracker tracker(*this);
+      this->checkMessageBytes((uint64_t)size * minWidth(elemType));
+      // Fixed width elements are copied in one go
+      uint32_t width = fixedWidth(elemType);
+      if (width != 0 && (uint32_t)size <= 0x7fffffff / width) {
+        return result + readRawBytes(raw, (uint32_t)size * width);
+      }
+      for (int32_t i = 0; i < size; i++) {
+        result += readRaw(elemType, raw);
+      }
+      return result;
+    }
+  default:
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Unknown type in raw value");
+  }
+}
+
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::writeRaw(const std::string& raw) {
+  uint32_t size = (uint32_t)raw.size();
+  this->trans_->write((const uint8_t*)raw.data(), size);
+  return size;
+}
+
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::readRawBytes(std::string& raw, uint32_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  size_t offset = raw.size();
+  raw.resize(offset + len);
+  this->trans_->readAll((uint8_t*)&raw[offset], len);
+  return len;
+}
+
+/**
+ * The size that makes up the last four bytes of raw.
+ */
+template <class Transport_>
+int32_t TBinaryProtocolT<Transport_>::rawSize(const std::string& raw) {
+  int32_t size;
+  std::memcpy(&size, raw.data() + raw.size() - 4, 4);
+  size = (int32_t)ntohl(size);
+  if (size < 0) {
+    throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+  }
+  return size;
+}
+
+/**
+ * Skips a value without going through the generic, one read at a time
+ * skip().  Strings and containers of fixed width values are stepped over
+ * in one go, as the size up front says how many bytes they take.
+ */
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::skip(TType type) {
+  switch (type) {
+  case T_BOOL:
+  case T_BYTE:
+  case T_I16:
+  case T_I32:
+  case T_I64:
+  case T_DOUBLE:
+    return skipBytes(fixedWidth(type));
+  case T_STRING:
+    {
+      int32_t size;
+      uint32_t result = readI32(size);
+      if (size < 0) {
+        throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+      }
+      if (this->string_limit_ > 0 && size > this->string_limit_) {
+        throw TProtocolException(TProtocolException::SIZE_LIMIT);
+      }
+      this->checkMessageBytes((uint32_t)size);
+      return result + skipBytes((uint32_t)size);
+    }
+  case T_STRUCT:
+    {
+      TInputRecursionTracker tracker(*this);
+      uint32_t result = 0;
+      while (true) {
+        int8_t ftype;
+        result += readByte(ftype);
+        if (ftype == T_STOP) {
+          break;
+        }
+        result += skipBytes(2);
+        result += skip((TType)ftype);
+      }
+      return result;
+    }
+  case T_MAP:
+    {
+      TType keyType;
+      TType valType;
+      uint32_t size;
+      uint32_t result = readMapBegin(keyType, valType, size);
+      uint32_t keyWidth = fixedWidth(keyType);
+      uint32_t valWidth = fixedWidth(valType);
+      if (keyWidth != 0 && valWidth != 0 && size <= 0xffffffff / (keyWidth + valWidth)) {
+        result += skipBytes(size * (keyWidth + valWidth));
+      } else {
+        for (uint32_t i = 0; i < size; i++) {
+          result += skip(keyType);
+          result += skip(valType);
+        }
+      }
+      return result + readMapEnd();
+    }
+  case T_SET:
+  case T_LIST:
+    {
+      TType elemType;
+      uint32_t size;
+      uint32_t result = readListBegin(elemType, size);
+      uint32_t width = fixedWidth(elemType);
+      if (width != 0 && size <= 0xffffffff / width) {
+        result += skipBytes(size * width);
+      } else {
+        for (uint32_t i = 0; i < size; i++) {
+          result += skip(elemType);
+        }
+      }
+      return result + readListEnd();
+    }
+  default:
+    return 0;
+  }
+}
+
+/**
+ * Consumes len bytes straight out of the transport's buffer where it can.
+ */
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::skipBytes(uint32_t len) {
+  uint32_t remaining = len;
+  while (remaining > 0) {
+    uint32_t avail = 1;
+    if (this->trans_->borrow(NULL, &avail) != NULL) {
+      uint32_t give = (std::min)(avail, remaining);
+      this->trans_->consume(give);
+      remaining -= give;
+    } else {
+      uint8_t scratch[512];
+      uint32_t give = (std::min)((uint32_t)sizeof(scratch), remaining);
+      this->trans_->readAll(scratch, give);
+      remaining -= give;
+    }
+  }
+  return len;
+}
+
+/**
+ * The encoded size of a value of the given type, or 0 if it varies.
+ */
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::fixedWidth(TType type) {
+  switch (type) {
+  case T_BOOL:
+  case T_BYTE:
+    return 1;
+  case T_I16:
+    return 2;
+  case T_I32:
+    return 4;
+  case T_I64:
+  case T_DOUBLE:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * The fewest bytes a value of type can take, for charging a container's
+ * elements against the message size limit before any are read.
+ */
+template <class Transport_>
+uint32_t TBinaryProtocolT<Transport_>::minWidth(TType type) {
+  switch (type) {
+  case T_STRING:
+    return 4;
+  case T_MAP:
+    return 6;
+  case T_SET:
+  case T_LIST:
+    return 5;
+  default:
+    return (std::max)(fixedWidth(type), 1U);
+  }
+}
+
 }}} // apache::thrift::protocol
 
 #endif // #ifndef _THRIFT_PROTOCOL_TBINARYPROTOCOL_TCC_
@@ -0,0 +1,120 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/protocol/TByteSwap.h>
+#include <thrift/protocol/TProtocol.h>
+
+#include <cstring>
+
+#if __THRIFT_BYTE_ORDER == __THRIFT_LITTLE_ENDIAN
+# if defined(__SSE2__)
+#  include <emmintrin.h>
+#  define THRIFT_BYTESWAP_SSE2 1
+# elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define THRIFT_BYTESWAP_NEON 1
+# endif
+#endif
+
+namespace apache { namespace thrift { namespace protocol {
+
+namespace detail {
+
+namespace {
+
+#ifdef THRIFT_BYTESWAP_SSE2
+// Swaps the bytes of each 16-bit lane
+inline __m128i swap16(__m128i v) {
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+inline __m128i swap32(__m128i v) {
+  v = swap16(v);
+  v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+inline __m128i swap64(__m128i v) {
+  v = swap16(v);
+  v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+  return _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+#endif
+
+} // anonymous namespace
+
+void networkCopy32(void* dst, const void* src, uint32_t n) {
+#if __THRIFT_BYTE_ORDER == __THRIFT_BIG_ENDIAN
+  if (dst != src) {
+    std::memcpy(dst, src, static_cast<size_t>(n) * 4);
+  }
+#else
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  const uint8_t* in = static_cast<const uint8_t*>(src);
+  uint32_t i = 0;
+#if defined(THRIFT_BYTESWAP_SSE2)
+  for (; n - i >= 4; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * i), swap32(v));
+  }
+#elif defined(THRIFT_BYTESWAP_NEON)
+  for (; n - i >= 4; i += 4) {
+    vst1q_u8(out + 4 * i, vrev32q_u8(vld1q_u8(in + 4 * i)));
+  }
+#endif
+  for (; i < n; ++i) {
+    uint32_t v;
+    std::memcpy(&v, in + 4 * i, 4);
+    v = ntohl(v);
+    std::memcpy(out + 4 * i, &v, 4);
+  }
+#endif
+}
+
+void networkCopy64(void* dst, const void* src, uint32_t n) {
+#if __THRIFT_BYTE_ORDER == __THRIFT_BIG_ENDIAN
+  if (dst != src) {
+    std::memcpy(dst, src, static_cast<size_t>(n) * 8);
+  }
+#else
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  const uint8_t* in = static_cast<const uint8_t*>(src);
+  uint32_t i = 0;
+#if defined(THRIFT_BYTESWAP_SSE2)
+  for (; n - i >= 2; i += 2) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 8 * i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8 * i), swap64(v));
+  }
+#elif defined(THRIFT_BYTESWAP_NEON)
+  for (; n - i >= 2; i += 2) {
+    vst1q_u8(out + 8 * i, vrev64q_u8(vld1q_u8(in + 8 * i)));
+  }
+#endif
+  for (; i < n; ++i) {
+    uint64_t v;
+    std::memcpy(&v, in + 8 * i, 8);
+    v = ntohll(v);
+    std::memcpy(out + 8 * i, &v, 8);
+  }
+#endif
+}
+
+} // apache::thrift::protocol::detail
+
+}}} // apache::thrift::protocol
@@ -0,0 +1,47 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TBYTESWAP_H_
+#define _THRIFT_PROTOCOL_TBYTESWAP_H_ 1
+
+#include <thrift/Thrift.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+namespace detail {
+
+/**
+ * Copies n 4-byte values from src to dst, converting between host and
+ * network byte order; the conversion is the same both ways.  Uses SSE2 or
+ * NEON a block at a time where it can.  Neither pointer has to be aligned,
+ * and dst may be the same as src to convert in place, but the two must
+ * not otherwise overlap.
+ */
+void networkCopy32(void* dst, const void* src, uint32_t n);
+
+/**
+ * As networkCopy32(), for 8-byte values (i64s and doubles).
+ */
+void networkCopy64(void* dst, const void* src, uint32_t n);
+
+} // apache::thrift::protocol::detail
+
+}}} // apache::thrift::protocol
+
+#endif // #define _THRIFT_PROTOCOL_TBYTESWAP_H_
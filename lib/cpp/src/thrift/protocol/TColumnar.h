@@ -0,0 +1,213 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TCOLUMNAR_H_
+#define _THRIFT_PROTOCOL_TCOLUMNAR_H_ 1
+
+#include <string.h>
+#include <string>
+#include <thrift/protocol/TCompactVarint.h>
+#include <thrift/protocol/TProtocol.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * Builds the column blob of a list<struct> field annotated cpp.columnar.
+ *
+ * Such a field goes on the wire as binary rather than as a list: the
+ * number of rows, then each field of the row struct in id order as a
+ * column.  An optional field's column starts with a bitmap of the rows
+ * that have it, and only those rows' values follow.  Integers and enums
+ * are zigzag varints of the difference from the previous row's value,
+ * bools are bits, doubles eight bytes, and strings all the lengths then
+ * all the bytes.  A reader still accepts the field as an ordinary list,
+ * so a struct can be annotated without breaking readers of old data, but
+ * readers of the new data need code generated with the annotation too.
+ */
+class TColumnarWriter {
+ public:
+  TColumnarWriter() : bits_(0), numBits_(0) {}
+
+  void writeCount(uint32_t count) { writeVarint(count); }
+
+  void writeVarint(uint64_t n) {
+    uint8_t buf[10];
+    buf_.append((const char*)buf, detail::compact::encodeVarint64(n, buf));
+  }
+
+  /// value as a zigzag varint of its difference from prev, then the new prev
+  void writeDelta(int64_t value, int64_t& prev) {
+    int64_t delta = static_cast<int64_t>(static_cast<uint64_t>(value) -
+                                         static_cast<uint64_t>(prev));
+    writeVarint((static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+    prev = value;
+  }
+
+  void writeByte(int8_t byte) { buf_.push_back(static_cast<char>(byte)); }
+
+  void writeDouble(double dub) {
+    uint64_t bits = htonll(bitwise_cast<uint64_t>(dub));
+    buf_.append((const char*)&bits, 8);
+  }
+
+  void writeBit(bool bit) {
+    bits_ |= static_cast<uint8_t>(bit ? 1 : 0) << numBits_;
+    if (++numBits_ == 8) {
+      endBits();
+    }
+  }
+
+  /// Pads the bits written since the last byte boundary out to a byte
+  void endBits() {
+    if (numBits_ > 0) {
+      buf_.push_back(static_cast<char>(bits_));
+      bits_ = 0;
+      numBits_ = 0;
+    }
+  }
+
+  void writeLength(size_t length) { writeVarint(length); }
+
+  void writeBytes(const std::string& str) { buf_.append(str); }
+
+  const std::string& getBuffer() const { return buf_; }
+
+ private:
+  std::string buf_;
+  uint8_t bits_;
+  uint32_t numBits_;
+};
+
+/**
+ * Reads back the columns written by a TColumnarWriter, in the same order.
+ * Running off the end of the data, or a count or length that cannot fit
+ * in what is left, throws a TProtocolException.
+ */
+class TColumnarReader {
+ public:
+  explicit TColumnarReader(const std::string& data)
+    : pos_((const uint8_t*)data.data()),
+      end_(pos_ + data.size()),
+      bits_(0),
+      numBits_(0) {}
+
+  /**
+   * The number of rows.  Every row takes at least a bit of every column,
+   * so there cannot be more than eight times as many as bytes left.
+   */
+  uint32_t readCount() {
+    uint64_t count = readVarint();
+    if (count > 8 * static_cast<uint64_t>(end_ - pos_)) {
+      throw TProtocolException(TProtocolException::INVALID_DATA,
+                               "Columnar row count larger than the data");
+    }
+    return static_cast<uint32_t>(count);
+  }
+
+  uint64_t readVarint() {
+    uint64_t result = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+      uint8_t byte = next();
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return result;
+      }
+    }
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Columnar varint is too long");
+  }
+
+  int64_t readDelta(int64_t& prev) {
+    uint64_t zigzag = readVarint();
+    uint64_t delta = (zigzag >> 1) ^ (0 - (zigzag & 1));
+    prev = static_cast<int64_t>(static_cast<uint64_t>(prev) + delta);
+    return prev;
+  }
+
+  int8_t readByte() { return static_cast<int8_t>(next()); }
+
+  double readDouble() {
+    need(8);
+    uint64_t bits;
+    memcpy(&bits, pos_, 8);
+    pos_ += 8;
+    return bitwise_cast<double>(ntohll(bits));
+  }
+
+  bool readBit() {
+    if (numBits_ == 0) {
+      bits_ = next();
+      numBits_ = 8;
+    }
+    bool bit = (bits_ & 1) != 0;
+    bits_ >>= 1;
+    --numBits_;
+    return bit;
+  }
+
+  void endBits() { numBits_ = 0; }
+
+  size_t readLength() {
+    uint64_t length = readVarint();
+    if (length > static_cast<uint64_t>(end_ - pos_)) {
+      throw TProtocolException(TProtocolException::INVALID_DATA,
+                               "Columnar string longer than the data");
+    }
+    return static_cast<size_t>(length);
+  }
+
+  /// Fills str, already sized by readLength(), with its bytes
+  void readBytes(std::string& str) {
+    need(str.size());
+    if (!str.empty()) {
+      memcpy(&str[0], pos_, str.size());
+    }
+    pos_ += str.size();
+  }
+
+  /// Checks that every byte has been read
+  void finish() {
+    if (pos_ != end_) {
+      throw TProtocolException(TProtocolException::INVALID_DATA,
+                               "Columnar data left over");
+    }
+  }
+
+ private:
+  uint8_t next() {
+    need(1);
+    return *pos_++;
+  }
+
+  void need(size_t len) {
+    if (static_cast<size_t>(end_ - pos_) < len) {
+      throw TProtocolException(TProtocolException::INVALID_DATA,
+                               "Columnar data cut short");
+    }
+  }
+
+  const uint8_t* pos_;
+  const uint8_t* end_;
+  uint8_t bits_;
+  uint32_t numBits_;
+};
+
+}}} // apache::thrift::protocol
+
+#endif // #ifndef _THRIFT_PROTOCOL_TCOLUMNAR_H_
@@ -21,6 +21,7 @@
 #define _THRIFT_PROTOCOL_TCOMPACTPROTOCOL_H_ 1
 
 #include <thrift/protocol/TVirtualProtocol.h>
+#include <thrift/TRecycleBin.h>
 
 #include <stack>
 #include <boost/shared_ptr.hpp>
@@ -101,6 +102,22 @@ class TCompactProtocolT
     free(string_buf_);
   }
 
+  /**
+   * Puts the protocol over a different transport, for a new connection,
+   * keeping its string buffer.
+   */
+  void resetTransport(boost::shared_ptr<Transport_> trans) {
+    this->ptrans_ = trans;
+    trans_ = trans.get();
+    this->resetMessageLimits();
+    while (!lastField_.empty()) {
+      lastField_.pop();
+    }
+    lastFieldId_ = 0;
+    booleanField_.name = NULL;
+    boolValue_.hasBoolValue = false;
+  }
+
 
   /**
    * Writing functions
@@ -140,12 +157,20 @@ class TCompactProtocolT
 
   uint32_t writeI64(const int64_t i64);
 
+  uint32_t writeI32s(const int32_t* values, uint32_t n);
+
+  uint32_t writeI64s(const int64_t* values, uint32_t n);
+
   uint32_t writeDouble(const double dub);
 
   uint32_t writeString(const std::string& str);
 
   uint32_t writeBinary(const std::string& str);
 
+  uint32_t writeStringView(const TStringView& str);
+
+  uint32_t writeBinaryView(const TStringView& str);
+
   /**
   * These methods are called by structs, but don't actually have any wired
   * output or purpose
@@ -203,28 +228,57 @@ class TCompactProtocolT
 
   uint32_t readI64(int64_t& i64);
 
+  uint32_t readI32s(int32_t* values, uint32_t n);
+
+  uint32_t readI64s(int64_t* values, uint32_t n);
+
   uint32_t readDouble(double& dub);
 
   uint32_t readString(std::string& str);
 
   uint32_t readBinary(std::string& str);
 
+  uint32_t readStringView(TStringView& str);
+
+  uint32_t readBinaryView(TStringView& str);
+
+  uint32_t readRaw(TType type, std::string& raw);
+
+  uint32_t writeRaw(const std::string& raw);
+
+  TRawFormat getRawFormat() {
+    return T_RAW_COMPACT;
+  }
+
+  uint32_t skip(TType type);
+
   /*
    *These methods are here for the struct to call, but don't have any wire
    * encoding.
    */
   uint32_t readMessageEnd() { return 0; }
   uint32_t readFieldEnd() { return 0; }
-  uint32_t readMapEnd() { return 0; }
-  uint32_t readListEnd() { return 0; }
-  uint32_t readSetEnd() { return 0; }
+  uint32_t readMapEnd() { this->decrementRecursionDepth(); return 0; }
+  uint32_t readListEnd() { this->decrementRecursionDepth(); return 0; }
+  uint32_t readSetEnd() { this->decrementRecursionDepth(); return 0; }
 
  protected:
+  // readBinary() and readString(); text is whether the bytes are held to
+  // setValidateUtf8()
+  uint32_t readBytes(std::string& str, bool text);
+  uint32_t readBytesView(TStringView& str, bool text);
   uint32_t readVarint32(int32_t& i32);
   uint32_t readVarint64(int64_t& i64);
   int32_t zigzagToI32(uint32_t n);
   int64_t zigzagToI64(uint64_t n);
   TType getTType(int8_t type);
+  uint32_t readRawValue(int8_t type, std::string& raw);
+  uint32_t readRawBytes(std::string& raw, uint32_t len);
+  uint32_t readRawVarint(std::string& raw, uint64_t& value);
+  uint32_t skipBytes(uint32_t len);
+  uint32_t skipVarints(uint32_t n);
+  static uint32_t fixedWidth(TType type);
+  static uint32_t minWidth(TType type);
 
   // Buffer for reading strings, save for the lifetime of the protocol to
   // avoid memory churn allocating memory on every string read
@@ -244,11 +298,17 @@ class TCompactProtocolFactoryT : public TProtocolFactory {
  public:
   TCompactProtocolFactoryT() :
     string_limit_(0),
-    container_limit_(0) {}
+    container_limit_(0),
+    recursion_limit_(0),
+    message_size_limit_(0),
+    validate_utf8_(false) {}
 
   TCompactProtocolFactoryT(int32_t string_limit, int32_t container_limit) :
     string_limit_(string_limit),
-    container_limit_(container_limit) {}
+    container_limit_(container_limit),
+    recursion_limit_(0),
+    message_size_limit_(0),
+    validate_utf8_(false) {}
 
   virtual ~TCompactProtocolFactoryT() {}
 
@@ -260,9 +320,36 @@ class TCompactProtocolFactoryT : public TProtocolFactory {
     container_limit_ = container_limit;
   }
 
+  void setRecursionLimit(uint32_t depth) {
+    recursion_limit_ = depth;
+  }
+
+  void setMessageSizeLimit(uint32_t bytes) {
+    message_size_limit_ = bytes;
+  }
+
+  void setValidateUtf8(bool validate) {
+    validate_utf8_ = validate;
+  }
+
+  /**
+   * Keep up to limit protocols given back through recycle(), string buffer
+   * and all, for getProtocol() to reuse.  0, the default, keeps none.
+   */
+  void setRecycleLimit(size_t limit) {
+    recycled_.setLimit(limit);
+  }
+
   boost::shared_ptr<TProtocol> getProtocol(boost::shared_ptr<TTransport> trans) {
     boost::shared_ptr<Transport_> specific_trans =
       boost::dynamic_pointer_cast<Transport_>(trans);
+    if (specific_trans) {
+      boost::shared_ptr<TCompactProtocolT<Transport_> > recycled = recycled_.take();
+      if (recycled) {
+        recycled->resetTransport(specific_trans);
+        return recycled;
+      }
+    }
     TProtocol* prot;
     if (specific_trans) {
       prot = new TCompactProtocolT<Transport_>(specific_trans, string_limit_,
@@ -270,13 +357,31 @@ class TCompactProtocolFactoryT : public TProtocolFactory {
     } else {
       prot = new TCompactProtocol(trans, string_limit_, container_limit_);
     }
+    prot->setRecursionLimit(recursion_limit_);
+    prot->setMessageSizeLimit(message_size_limit_);
+    prot->setValidateUtf8(validate_utf8_);
 
     return boost::shared_ptr<TProtocol>(prot);
   }
 
+  void recycle(boost::shared_ptr<TProtocol>& prot) {
+    boost::shared_ptr<TCompactProtocolT<Transport_> > specific_prot =
+      boost::dynamic_pointer_cast<TCompactProtocolT<Transport_> >(prot);
+    prot.reset();
+    if (specific_prot && specific_prot.unique()) {
+      // Let go of the transport now rather than when reused
+      specific_prot->resetTransport(boost::shared_ptr<Transport_>());
+      recycled_.put(specific_prot);
+    }
+  }
+
  private:
   int32_t string_limit_;
   int32_t container_limit_;
+  uint32_t recursion_limit_;
+  uint32_t message_size_limit_;
+  bool validate_utf8_;
+  TRecycleBin<TCompactProtocolT<Transport_> > recycled_;
 
 };
 
@@ -19,8 +19,13 @@
 #ifndef _THRIFT_PROTOCOL_TCOMPACTPROTOCOL_TCC_
 #define _THRIFT_PROTOCOL_TCOMPACTPROTOCOL_TCC_ 1
 
+#include <algorithm>
 #include <limits>
 
+#include <thrift/protocol/TCompactVarint.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/TAllocTracking.h>
+
 /*
  * TCompactProtocol::i*ToZigzag depend on the fact that the right shift
  * operator on a signed integer is an arithmetic (sign-extending) shift.
@@ -246,6 +251,64 @@ uint32_t TCompactProtocolT<Transport_>::writeI64(const int64_t i64) {
   return writeVarint64(i64ToZigzag(i64));
 }
 
+/**
+ * Write a run of i32s as zigzag varints, a chunk at a time.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::writeI32s(const int32_t* values,
+                                                  uint32_t n) {
+  const uint32_t chunk = 64;
+  uint8_t buf[chunk * 5];
+  uint32_t wsize = 0;
+  while (n > 0) {
+    uint32_t count = (std::min)(n, chunk);
+    uint8_t* out = transport::borrowWrite(*trans_, count * 5);
+    if (out != NULL) {
+      uint32_t size = detail::compact::encodeZigzag32(values, count, out);
+      transport::consumeWrite(*trans_, size);
+      wsize += size;
+      values += count;
+      n -= count;
+      continue;
+    }
+    uint32_t size = detail::compact::encodeZigzag32(values, count, buf);
+    trans_->write(buf, size);
+    wsize += size;
+    values += count;
+    n -= count;
+  }
+  return wsize;
+}
+
+/**
+ * Write a run of i64s as zigzag varints, a chunk at a time.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::writeI64s(const int64_t* values,
+                                                  uint32_t n) {
+  const uint32_t chunk = 32;
+  uint8_t buf[chunk * 10];
+  uint32_t wsize = 0;
+  while (n > 0) {
+    uint32_t count = (std::min)(n, chunk);
+    uint8_t* out = transport::borrowWrite(*trans_, count * 10);
+    if (out != NULL) {
+      uint32_t size = detail::compact::encodeZigzag64(values, count, out);
+      transport::consumeWrite(*trans_, size);
+      wsize += size;
+      values += count;
+      n -= count;
+      continue;
+    }
+    uint32_t size = detail::compact::encodeZigzag64(values, count, buf);
+    trans_->write(buf, size);
+    wsize += size;
+    values += count;
+    n -= count;
+  }
+  return wsize;
+}
+
 /**
  * Write a double to the wire as 8 bytes.
  */
@@ -276,6 +339,19 @@ uint32_t TCompactProtocolT<Transport_>::writeBinary(const std::string& str) {
   return wsize;
 }
 
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::writeStringView(const TStringView& str) {
+  return writeBinaryView(str);
+}
+
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::writeBinaryView(const TStringView& str) {
+  uint32_t ssize = static_cast<uint32_t>(str.size());
+  uint32_t wsize = writeVarint32(ssize) + ssize;
+  trans_->write((const uint8_t*)str.data(), ssize);
+  return wsize;
+}
+
 //
 // Internal Writing methods
 //
@@ -331,43 +407,37 @@ uint32_t TCompactProtocolT<Transport_>::writeCollectionBegin(const TType elemTyp
 }
 
 /**
- * Write an i32 as a varint. Results in 1-5 bytes on the wire.
+ * Write an i32 as a varint. Results in 1-5 bytes on the wire.  A buffered
+ * transport with room for them has them encoded in place.
  */
 template <class Transport_>
 uint32_t TCompactProtocolT<Transport_>::writeVarint32(uint32_t n) {
-  uint8_t buf[5];
-  uint32_t wsize = 0;
-
-  while (true) {
-    if ((n & ~0x7F) == 0) {
-      buf[wsize++] = (int8_t)n;
-      break;
-    } else {
-      buf[wsize++] = (int8_t)((n & 0x7F) | 0x80);
-      n >>= 7;
-    }
+  uint8_t* out = transport::borrowWrite(*trans_, 5);
+  if (out != NULL) {
+    uint32_t wsize = detail::compact::encodeVarint32(n, out);
+    transport::consumeWrite(*trans_, wsize);
+    return wsize;
   }
+  uint8_t buf[5];
+  uint32_t wsize = detail::compact::encodeVarint32(n, buf);
   trans_->write(buf, wsize);
   return wsize;
 }
 
 /**
- * Write an i64 as a varint. Results in 1-10 bytes on the wire.
+ * Write an i64 as a varint. Results in 1-10 bytes on the wire, encoded in
+ * place like writeVarint32()'s.
  */
 template <class Transport_>
 uint32_t TCompactProtocolT<Transport_>::writeVarint64(uint64_t n) {
-  uint8_t buf[10];
-  uint32_t wsize = 0;
-
-  while (true) {
-    if ((n & ~0x7FL) == 0) {
-      buf[wsize++] = (int8_t)n;
-      break;
-    } else {
-      buf[wsize++] = (int8_t)((n & 0x7F) | 0x80);
-      n >>= 7;
-    }
+  uint8_t* out = transport::borrowWrite(*trans_, 10);
+  if (out != NULL) {
+    uint32_t wsize = detail::compact::encodeVarint64(n, out);
+    transport::consumeWrite(*trans_, wsize);
+    return wsize;
   }
+  uint8_t buf[10];
+  uint32_t wsize = detail::compact::encodeVarint64(n, buf);
   trans_->write(buf, wsize);
   return wsize;
 }
@@ -415,6 +485,8 @@ uint32_t TCompactProtocolT<Transport_>::readMessageBegin(
   int8_t versionAndType;
   int8_t version;
 
+  this->resetMessageLimits();
+
   rsize += readByte(protocolId);
   if (protocolId != PROTOCOL_ID) {
     throw TProtocolException(TProtocolException::BAD_VERSION, "Bad protocol identifier");
@@ -440,6 +512,7 @@ uint32_t TCompactProtocolT<Transport_>::readMessageBegin(
 template <class Transport_>
 uint32_t TCompactProtocolT<Transport_>::readStructBegin(std::string& name) {
   name = "";
+  this->incrementRecursionDepth();
   lastField_.push(lastFieldId_);
   lastFieldId_ = 0;
   return 0;
@@ -453,6 +526,7 @@ template <class Transport_>
 uint32_t TCompactProtocolT<Transport_>::readStructEnd() {
   lastFieldId_ = lastField_.top();
   lastField_.pop();
+  this->decrementRecursionDepth();
   return 0;
 }
 
@@ -527,6 +601,8 @@ uint32_t TCompactProtocolT<Transport_>::readMapBegin(TType& keyType,
 
   keyType = getTType((int8_t)((uint8_t)kvType >> 4));
   valType = getTType((int8_t)((uint8_t)kvType & 0xf));
+  this->incrementRecursionDepth();
+  this->checkMessageBytes((uint64_t)msize * (minWidth(keyType) + minWidth(valType)));
   size = (uint32_t)msize;
 
   return rsize;
@@ -559,6 +635,8 @@ uint32_t TCompactProtocolT<Transport_>::readListBegin(TType& elemType,
   }
 
   elemType = getTType((int8_t)(size_and_type & 0x0f));
+  this->incrementRecursionDepth();
+  this->checkMessageBytes((uint64_t)lsize * minWidth(elemType));
   size = (uint32_t)lsize;
 
   return rsize;
@@ -639,6 +717,61 @@ uint32_t TCompactProtocolT<Transport_>::readI64(int64_t& i64) {
   return rsize;
 }
 
+/**
+ * Read a run of i32s.  As much as possible is decoded in place from the
+ * transport's buffer; a value the transport can't lend is read on its own.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::readI32s(int32_t* values, uint32_t n) {
+  uint32_t rsize = 0;
+  while (n > 0) {
+    uint32_t len = 1;
+    uint32_t count = 0;
+    uint32_t used = 0;
+    const uint8_t* borrowed = trans_->borrow(NULL, &len);
+    if (borrowed != NULL) {
+      count = detail::compact::decodeZigzag32(borrowed, len, values, n, &used);
+    }
+    if (count == 0) {
+      rsize += readI32(*values);
+      count = 1;
+    } else {
+      trans_->consume(used);
+      rsize += used;
+    }
+    values += count;
+    n -= count;
+  }
+  return rsize;
+}
+
+/**
+ * Read a run of i64s, as readI32s().
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::readI64s(int64_t* values, uint32_t n) {
+  uint32_t rsize = 0;
+  while (n > 0) {
+    uint32_t len = 1;
+    uint32_t count = 0;
+    uint32_t used = 0;
+    const uint8_t* borrowed = trans_->borrow(NULL, &len);
+    if (borrowed != NULL) {
+      count = detail::compact::decodeZigzag64(borrowed, len, values, n, &used);
+    }
+    if (count == 0) {
+      rsize += readI64(*values);
+      count = 1;
+    } else {
+      trans_->consume(used);
+      rsize += used;
+    }
+    values += count;
+    n -= count;
+  }
+  return rsize;
+}
+
 /**
  * No magic here - just read a double off the wire.
  */
@@ -659,14 +792,19 @@ uint32_t TCompactProtocolT<Transport_>::readDouble(double& dub) {
 
 template <class Transport_>
 uint32_t TCompactProtocolT<Transport_>::readString(std::string& str) {
-  return readBinary(str);
+  return readBytes(str, true);
+}
+
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::readBinary(std::string& str) {
+  return readBytes(str, false);
 }
 
 /**
  * Read a byte[] from the wire.
  */
 template <class Transport_>
-uint32_t TCompactProtocolT<Transport_>::readBinary(std::string& str) {
+uint32_t TCompactProtocolT<Transport_>::readBytes(std::string& str, bool text) {
   int32_t rsize = 0;
   int32_t size;
 
@@ -684,9 +822,11 @@ uint32_t TCompactProtocolT<Transport_>::readBinary(std::string& str) {
   if (string_limit_ > 0 && size > string_limit_) {
     throw TProtocolException(TProtocolException::SIZE_LIMIT);
   }
+  this->checkMessageBytes((uint32_t)size);
 
   // Use the heap here to prevent stack overflow for v. large strings
   if (size > string_buf_size_ || string_buf_ == NULL) {
+    TAllocScope scope(TAllocTracking::PROTOCOL);
     void* new_string_buf = std::realloc(string_buf_, (uint32_t)size);
     if (new_string_buf == NULL) {
       throw std::bad_alloc();
@@ -695,11 +835,66 @@ uint32_t TCompactProtocolT<Transport_>::readBinary(std::string& str) {
     string_buf_size_ = size;
   }
   trans_->readAll(string_buf_, size);
+  if (text) {
+    this->checkUtf8(string_buf_, size);
+  }
   str.assign((char*)string_buf_, size);
 
   return rsize + (uint32_t)size;
 }
 
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::readStringView(TStringView& str) {
+  return readBytesView(str, true);
+}
+
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::readBinaryView(TStringView& str) {
+  return readBytesView(str, false);
+}
+
+/**
+ * Read a byte[] into a view.  It points into the transport's buffer when
+ * the transport can share it; otherwise the bytes are read straight into
+ * the view's own copy.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::readBytesView(TStringView& str, bool text) {
+  int32_t rsize = 0;
+  int32_t size;
+
+  rsize += readVarint32(size);
+  // Catch empty string case
+  if (size == 0) {
+    str.clear();
+    return rsize;
+  }
+
+  // Catch error cases
+  if (size < 0) {
+    throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+  }
+  if (string_limit_ > 0 && size > string_limit_) {
+    throw TProtocolException(TProtocolException::SIZE_LIMIT);
+  }
+  this->checkMessageBytes((uint32_t)size);
+
+  boost::shared_ptr<const void> owner = trans_->getBorrowOwner();
+  uint32_t got = size;
+  const uint8_t* borrowed;
+  if (owner && (borrowed = trans_->borrow(NULL, &got))) {
+    str = TStringView((const char*)borrowed, size, owner);
+    trans_->consume(size);
+  } else {
+    trans_->readAll((uint8_t*)str.allocate(size), size);
+  }
+  if (text) {
+    this->checkUtf8((const uint8_t*)str.data(), size);
+  }
+
+  return rsize + (uint32_t)size;
+}
+
 /**
  * Read an i32 from the wire as a varint. The MSB of each byte is set
  * if there is another byte to follow. This can read up to 5 bytes.
@@ -813,6 +1008,344 @@ TType TCompactProtocolT<Transport_>::getTType(int8_t type) {
   return T_STOP;
 }
 
+/**
+ * Raw values are copied off the wire as they are, walking just far enough
+ * into each one to find where it ends.  A bool field's value is part of
+ * its header, so there is nothing left to copy for one.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::readRaw(TType type, std::string& raw) {
+  if (type == T_BOOL && boolValue_.hasBoolValue) {
+    throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+                             "Bool fields have no raw value.");
+  }
+  return readRawValue(getCompactType(type), raw);
+}
+
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::writeRaw(const std::string& raw) {
+  uint32_t size = (uint32_t)raw.size();
+  trans_->write((const uint8_t*)raw.data(), size);
+  return size;
+}
+
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::readRawValue(int8_t type, std::string& raw) {
+  uint64_t value;
+  switch (type) {
+  case detail::compact::CT_BOOLEAN_TRUE:
+  case detail::compact::CT_BOOLEAN_FALSE:
+  case detail::compact::CT_BYTE:
+    return readRawBytes(raw, 1);
+  case detail::compact::CT_I16:
+  case detail::compact::CT_I32:
+  case detail::compact::CT_I64:
+    return readRawVarint(raw, value);
+  case detail::compact::CT_DOUBLE:
+    return readRawBytes(raw, 8);
+  case detail::compact::CT_BINARY:
+    {
+      uint32_t rsize = readRawVarint(raw, value);
+      int32_t size = (int32_t)value;
+      if (size < 0) {
+        throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+      } else if (string_limit_ > 0 && size > string_limit_) {
+        throw TProtocolException(TProtocolException::SIZE_LIMIT);
+      }
+      this->checkMessageBytes((uint32_t)size);
+      return rsize + readRawBytes(raw, (uint32_t)size);
+    }
+  case detail::compact::CT_STRUCT:
+    {
+      TInputRecursionTracker tracker(*this);
+      uint32_t rsize = 0;
+      while (true) {
+        rsize += readRawBytes(raw, 1);
+        uint8_t header = (uint8_t)raw[raw.size() - 1];
+        int8_t ftype = (int8_t)(header & 0x0f);
+        if (ftype == detail::compact::CT_STOP) {
+          break;
+        }
+        // No delta means the field id follows as a varint
+        if ((header & 0xf0) == 0) {
+          rsize += readRawVarint(raw, value);
+        }
+        if (ftype != detail::compact::CT_BOOLEAN_TRUE &&
+            ftype != detail::compact::CT_BOOLEAN_FALSE) {
+          rsize += readRawValue(ftype, raw);
+        }
+      }
+      return rsize;
+    }
+  case detail::compact::CT_MAP:
+    {
+      uint32_t rsize = readRawVarint(raw, value);
+      int32_t size = (int32_t)value;
+      if (size < 0) {
+        throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+      } else if (container_limit_ && size > container_limit_) {
+        throw TProtocolException(TProtocolException::SIZE_LIMIT);
+      }
+      if (size == 0) {
+        return rsize;
+      }
+      rsize += readRawBytes(raw, 1);
+      uint8_t kvType = (uint8_t)raw[raw.size() - 1];
+      TInputRecursionTracker tracker(*this);
+      this->checkMessageBytes((uint64_t)size * 2);
+      for (int32_t i = 0; i < size; i++) {
+        rsize += readRawValue((int8_t)(kvType >> 4), raw);
+        rsize += readRawValue((int8_t)(kvType & 0x0f), raw);
+      }
+      return rsize;
+    }
+  case detail::compact::CT_LIST:
+  case detail::compact::CT_SET:
+    {
+      uint32_t rsize = readRawBytes(raw, 1);
+      uint8_t sizeAndType = (uint8_t)raw[raw.size() - 1];
+      int32_t size = sizeAndType >> 4;
+      if (size == 15) {
+        rsize += readRawVarint(raw, value);
+        size = (int32_t)value;
+      }
+      if (size < 0) {
+        throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+      } else if (container_limit_ && size > container_limit_) {
+        throw TProtocolException(TProtocolException::SIZE_LIMIT);
+      }
+      int8_t elemType = (int8_t)(sizeAndType & 0x0f);
+      TInputRecursionTracker tracker(*this);
+      this->checkMessageBytes((uint64_t)size);
+      // Fixed width elements are copied in one go
+      if (elemType == detail::compact::CT_BYTE ||
+          elemType == detail::compact::CT_BOOLEAN_TRUE ||
+          elemType == detail::compact::CT_BOOLEAN_FALSE) {
+        return rsize + readRawBytes(raw, (uint32_t)size);
+      }
+      if (elemType == detail::compact::CT_DOUBLE && size <= 0x7fffffff / 8) {
+        return rsize + readRawBytes(raw, (uint32_t)size * 8);
+      }
+      for (int32_t i = 0; i < size; i++) {
+        rsize += readRawValue(elemType, raw);
+      }
+      return rsize;
+    }
+  default:
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Unknown type in raw value.");
+  }
+}
+
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::readRawBytes(std::string& raw, uint32_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  size_t offset = raw.size();
+  raw.resize(offset + len);
+  trans_->readAll((uint8_t*)&raw[offset], len);
+  return len;
+}
+
+/**
+ * Copies a varint to raw, returning its value as well.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::readRawVarint(std::string& raw, uint64_t& value) {
+  uint8_t buf[10];
+  uint32_t size = 0;
+  value = 0;
+  while (true) {
+    if (UNLIKELY(size == sizeof(buf))) {
+      throw TProtocolException(TProtocolException::INVALID_DATA, "Variable-length int over 10 bytes.");
+    }
+    trans_->readAll(&buf[size], 1);
+    value |= (uint64_t)(buf[size] & 0x7f) << (7 * size);
+    if (!(buf[size++] & 0x80)) {
+      break;
+    }
+  }
+  raw.append((const char*)buf, size);
+  return size;
+}
+
+/**
+ * Skips a value without going through the generic, one read at a time
+ * skip().  Strings and containers of fixed width values are stepped over
+ * in one go, and containers of integers by counting the bytes that end
+ * each varint.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::skip(TType type) {
+  switch (type) {
+  case T_BOOL:
+    {
+      bool value;
+      return readBool(value);
+    }
+  case T_BYTE:
+  case T_DOUBLE:
+    return skipBytes(fixedWidth(type));
+  case T_I16:
+  case T_I32:
+  case T_I64:
+    return skipVarints(1);
+  case T_STRING:
+    {
+      int32_t size;
+      uint32_t rsize = readVarint32(size);
+      if (size < 0) {
+        throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+      }
+      if (string_limit_ > 0 && size > string_limit_) {
+        throw TProtocolException(TProtocolException::SIZE_LIMIT);
+      }
+      this->checkMessageBytes((uint32_t)size);
+      return rsize + skipBytes((uint32_t)size);
+    }
+  case T_STRUCT:
+    {
+      uint32_t rsize = 0;
+      std::string name;
+      TType ftype;
+      int16_t fid;
+      rsize += readStructBegin(name);
+      while (true) {
+        rsize += readFieldBegin(name, ftype, fid);
+        if (ftype == T_STOP) {
+          break;
+        }
+        rsize += skip(ftype);
+      }
+      rsize += readStructEnd();
+      return rsize;
+    }
+  case T_MAP:
+    {
+      TType keyType;
+      TType valType;
+      uint32_t size;
+      uint32_t rsize = readMapBegin(keyType, valType, size);
+      uint32_t keyWidth = fixedWidth(keyType);
+      uint32_t valWidth = fixedWidth(valType);
+      if (keyWidth != 0 && valWidth != 0 && size <= 0xffffffff / (keyWidth + valWidth)) {
+        rsize += skipBytes(size * (keyWidth + valWidth));
+      } else {
+        for (uint32_t i = 0; i < size; i++) {
+          rsize += skip(keyType);
+          rsize += skip(valType);
+        }
+      }
+      return rsize + readMapEnd();
+    }
+  case T_SET:
+  case T_LIST:
+    {
+      TType elemType;
+      uint32_t size;
+      uint32_t rsize = readListBegin(elemType, size);
+      uint32_t width = fixedWidth(elemType);
+      if (width != 0 && size <= 0xffffffff / width) {
+        rsize += skipBytes(size * width);
+      } else if (elemType == T_I16 || elemType == T_I32 || elemType == T_I64) {
+        rsize += skipVarints(size);
+      } else {
+        for (uint32_t i = 0; i < size; i++) {
+          rsize += skip(elemType);
+        }
+      }
+      return rsize + readListEnd();
+    }
+  default:
+    return 0;
+  }
+}
+
+/**
+ * Consumes len bytes straight out of the transport's buffer where it can.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::skipBytes(uint32_t len) {
+  uint32_t remaining = len;
+  while (remaining > 0) {
+    uint32_t avail = 1;
+    if (trans_->borrow(NULL, &avail) != NULL) {
+      uint32_t give = (std::min)(avail, remaining);
+      trans_->consume(give);
+      remaining -= give;
+    } else {
+      uint8_t scratch[512];
+      uint32_t give = (std::min)((uint32_t)sizeof(scratch), remaining);
+      trans_->readAll(scratch, give);
+      remaining -= give;
+    }
+  }
+  return len;
+}
+
+/**
+ * Skips n varints, counting the bytes without a continuation bit in the
+ * transport's buffer where it can.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::skipVarints(uint32_t n) {
+  uint32_t rsize = 0;
+  uint32_t run = 0;  // Continuation bytes so far in the current varint
+  while (n > 0) {
+    uint32_t avail = 1;
+    const uint8_t* buf = trans_->borrow(NULL, &avail);
+    uint8_t byte;
+    if (buf == NULL) {
+      trans_->readAll(&byte, 1);
+      buf = &byte;
+      avail = 1;
+    }
+    uint32_t i = 0;
+    while (i < avail && n > 0) {
+      if (buf[i++] & 0x80) {
+        if (UNLIKELY(++run >= 10)) {
+          throw TProtocolException(TProtocolException::INVALID_DATA, "Variable-length int over 10 bytes.");
+        }
+      } else {
+        run = 0;
+        --n;
+      }
+    }
+    if (buf != &byte) {
+      trans_->consume(i);
+    }
+    rsize += i;
+  }
+  return rsize;
+}
+
+/**
+ * The encoded size of a value of the given type, or 0 if it varies.  Bools
+ * take a byte outside of field headers.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::fixedWidth(TType type) {
+  switch (type) {
+  case T_BOOL:
+  case T_BYTE:
+    return 1;
+  case T_DOUBLE:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * The fewest bytes a value of type can take, for charging a container's
+ * elements against the message size limit before any are read.
+ */
+template <class Transport_>
+uint32_t TCompactProtocolT<Transport_>::minWidth(TType type) {
+  return (std::max)(fixedWidth(type), 1U);
+}
+
 }}} // apache::thrift::protocol
 
 #endif // _THRIFT_PROTOCOL_TCOMPACTPROTOCOL_TCC_
@@ -0,0 +1,308 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/protocol/TCompactVarint.h>
+#include <thrift/protocol/TProtocolException.h>
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define THRIFT_VARINT_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON) && !defined(__AARCH64EB__)
+#include <arm_neon.h>
+#define THRIFT_VARINT_NEON 1
+#endif
+
+#if defined(THRIFT_VARINT_SSE2) && defined(__x86_64__)
+#define THRIFT_VARINT_BMI2 1
+#endif
+
+namespace apache { namespace thrift { namespace protocol {
+
+namespace detail { namespace compact {
+
+namespace {
+
+const uint32_t MAX_VARINT_BYTES = 10;
+
+void throwTooLong() {
+  throw TProtocolException(TProtocolException::INVALID_DATA,
+                           "Variable-length int over 10 bytes.");
+}
+
+inline uint32_t toZigzag32(int32_t n) {
+  return (static_cast<uint32_t>(n) << 1) ^ static_cast<uint32_t>(n >> 31);
+}
+
+inline uint64_t toZigzag64(int64_t n) {
+  return (static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63);
+}
+
+inline void fromZigzag(uint64_t n, int32_t* out) {
+  uint32_t u = static_cast<uint32_t>(n);
+  *out = static_cast<int32_t>((u >> 1) ^ (0 - (u & 1)));
+}
+
+inline void fromZigzag(uint64_t n, int64_t* out) {
+  *out = static_cast<int64_t>((n >> 1) ^ (0 - (n & 1)));
+}
+
+// The value of the size byte varint at p
+struct ScalarExtract {
+  static uint64_t get(const uint8_t* p, uint32_t size) {
+    uint64_t val = 0;
+    for (uint32_t i = 0; i < size; ++i) {
+      val |= static_cast<uint64_t>(p[i] & 0x7f) << (7 * i);
+    }
+    return val;
+  }
+};
+
+#ifdef THRIFT_VARINT_BMI2
+// The same with one pext over the first eight bytes.  It is only used once
+// the CPU is known to have BMI2; going through asm keeps -mbmi2 off the
+// rest of the build.  Reads eight bytes at p whatever size is.
+struct Bmi2Extract {
+  static uint64_t get(const uint8_t* p, uint32_t size) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    uint64_t val;
+    __asm__("pextq %2, %1, %0"
+            : "=r"(val)
+            : "r"(word), "r"(0x7f7f7f7f7f7f7f7fULL));
+    if (size < 8) {
+      return val & ((1ULL << (7 * size)) - 1);
+    }
+    if (size > 8) {
+      val |= ScalarExtract::get(p + 8, size - 8) << 56;
+    }
+    return val;
+  }
+};
+
+bool cpuHasBmi2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("bmi2") != 0;
+}
+
+const bool HAVE_BMI2 = cpuHasBmi2();
+#endif
+
+#if defined(THRIFT_VARINT_SSE2) || defined(THRIFT_VARINT_NEON)
+#define THRIFT_VARINT_BLOCKS 1
+
+const uint32_t BLOCK = 16;
+
+// Bit i set when byte i of the 16 at p has its continuation bit set
+inline uint32_t continuationMask(const uint8_t* p) {
+#ifdef THRIFT_VARINT_SSE2
+  return static_cast<uint32_t>(
+    _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+#else
+  static const int8_t shifts[16] = {0, 1, 2, 3, 4, 5, 6, 7,
+                                    0, 1, 2, 3, 4, 5, 6, 7};
+  uint8x16_t bits = vshlq_u8(vshrq_n_u8(vld1q_u8(p), 7), vld1q_s8(shifts));
+  return static_cast<uint32_t>(vaddv_u8(vget_low_u8(bits)))
+       | (static_cast<uint32_t>(vaddv_u8(vget_high_u8(bits))) << 8);
+#endif
+}
+
+// Sixteen one-byte varints
+inline void decodeSingleBytes(const uint8_t* p, int32_t* out) {
+#ifdef THRIFT_VARINT_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi32(1);
+  __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+  __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+  __m128i words[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                       _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+  for (int i = 0; i < 4; ++i) {
+    __m128i sign = _mm_sub_epi32(zero, _mm_and_si128(words[i], one));
+    __m128i val = _mm_xor_si128(_mm_srli_epi32(words[i], 1), sign);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * i), val);
+  }
+#else
+  for (uint32_t i = 0; i < BLOCK; ++i) {
+    fromZigzag(p[i], out + i);
+  }
+#endif
+}
+
+inline void decodeSingleBytes(const uint8_t* p, int64_t* out) {
+  for (uint32_t i = 0; i < BLOCK; ++i) {
+    fromZigzag(p[i], out + i);
+  }
+}
+
+#ifdef THRIFT_VARINT_SSE2
+// Encodes sixteen values that each fit in one byte, or returns false
+inline bool encodeSingleBytes(const int32_t* values, uint8_t* buf) {
+  __m128i zz[4];
+  __m128i all = _mm_setzero_si128();
+  for (int i = 0; i < 4; ++i) {
+    __m128i val = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + 4 * i));
+    zz[i] = _mm_xor_si128(_mm_slli_epi32(val, 1), _mm_srai_epi32(val, 31));
+    all = _mm_or_si128(all, zz[i]);
+  }
+  __m128i high = _mm_and_si128(all, _mm_set1_epi32(~0x7f));
+  if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xffff) {
+    return false;
+  }
+  __m128i lo = _mm_packs_epi32(zz[0], zz[1]);
+  __m128i hi = _mm_packs_epi32(zz[2], zz[3]);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(buf), _mm_packus_epi16(lo, hi));
+  return true;
+}
+#endif
+
+#endif // SSE2 || NEON
+
+template <typename T, class Extract>
+uint32_t decodeRun(const uint8_t* buf, uint32_t len,
+                   T* out, uint32_t n, uint32_t* consumed) {
+  uint32_t pos = 0;
+  uint32_t count = 0;
+
+#ifdef THRIFT_VARINT_BLOCKS
+  // A block at a time while there are another 16 bytes after it, so a
+  // varint that starts near the end of the block can be read in one go.
+  while (count < n && len - pos >= 2 * BLOCK) {
+    uint32_t mask = continuationMask(buf + pos);
+    if (mask == 0 && n - count >= BLOCK) {
+      decodeSingleBytes(buf + pos, out + count);
+      pos += BLOCK;
+      count += BLOCK;
+      continue;
+    }
+
+    // Walk the bytes that end a varint
+    uint32_t ends = ~mask & 0xffff;
+    if (ends == 0) {
+      throwTooLong();
+    }
+    uint32_t start = 0;
+    do {
+      uint32_t end = static_cast<uint32_t>(__builtin_ctz(ends));
+      uint32_t size = end - start + 1;
+      if (size > MAX_VARINT_BYTES) {
+        throwTooLong();
+      }
+      fromZigzag(Extract::get(buf + pos + start, size), out + count);
+      ++count;
+      start = end + 1;
+      ends &= ends - 1;
+    } while (ends != 0 && count < n);
+    pos += start;
+  }
+#endif
+
+  // One at a time for the rest
+  while (count < n) {
+    uint32_t size = 0;
+    while (pos + size < len && size < MAX_VARINT_BYTES && (buf[pos + size] & 0x80)) {
+      ++size;
+    }
+    if (pos + size >= len) {
+      break;
+    }
+    if (size == MAX_VARINT_BYTES) {
+      throwTooLong();
+    }
+    ++size;
+    fromZigzag(ScalarExtract::get(buf + pos, size), out + count);
+    ++count;
+    pos += size;
+  }
+
+  *consumed = pos;
+  return count;
+}
+
+template <typename T>
+uint32_t decodeZigzag(const uint8_t* buf, uint32_t len,
+                      T* out, uint32_t n, uint32_t* consumed) {
+#ifdef THRIFT_VARINT_BMI2
+  if (HAVE_BMI2) {
+    return decodeRun<T, Bmi2Extract>(buf, len, out, n, consumed);
+  }
+#endif
+  return decodeRun<T, ScalarExtract>(buf, len, out, n, consumed);
+}
+
+} // anonymous namespace
+
+uint32_t encodeZigzag32(const int32_t* values, uint32_t n, uint8_t* buf) {
+  uint32_t pos = 0;
+  uint32_t i = 0;
+#ifdef THRIFT_VARINT_SSE2
+  while (n - i >= BLOCK) {
+    if (encodeSingleBytes(values + i, buf + pos)) {
+      pos += BLOCK;
+      i += BLOCK;
+      continue;
+    }
+    for (uint32_t end = i + BLOCK; i < end; ++i) {
+      pos += encodeVarint32(toZigzag32(values[i]), buf + pos);
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    pos += encodeVarint32(toZigzag32(values[i]), buf + pos);
+  }
+  return pos;
+}
+
+uint32_t encodeZigzag64(const int64_t* values, uint32_t n, uint8_t* buf) {
+  uint32_t pos = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    pos += encodeVarint64(toZigzag64(values[i]), buf + pos);
+  }
+  return pos;
+}
+
+uint32_t decodeZigzag32(const uint8_t* buf, uint32_t len,
+                        int32_t* out, uint32_t n, uint32_t* consumed) {
+  return decodeZigzag(buf, len, out, n, consumed);
+}
+
+uint32_t decodeZigzag64(const uint8_t* buf, uint32_t len,
+                        int64_t* out, uint32_t n, uint32_t* consumed) {
+  return decodeZigzag(buf, len, out, n, consumed);
+}
+
+const char* varintDecoderName() {
+#ifdef THRIFT_VARINT_BMI2
+  if (HAVE_BMI2) {
+    return "bmi2";
+  }
+#endif
+#if defined(THRIFT_VARINT_SSE2)
+  return "sse2";
+#elif defined(THRIFT_VARINT_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+}} // apache::thrift::protocol::detail::compact
+
+}}} // apache::thrift::protocol
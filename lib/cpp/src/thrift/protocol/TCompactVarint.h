@@ -0,0 +1,154 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TCOMPACTVARINT_H_
+#define _THRIFT_PROTOCOL_TCOMPACTVARINT_H_ 1
+
+#include <thrift/Thrift.h>
+
+/*
+ * Varint kernels for TCompactProtocol's runs of i32s and i64s.
+ *
+ * Decoding looks at 16 bytes at a time with SSE2 (or NEON) to find where
+ * each varint ends, turns a block of one-byte values straight into
+ * integers, and on x86-64 CPUs with BMI2 (checked at runtime) gathers the
+ * 7-bit groups of each longer value with a single pext.  Anything else
+ * falls back to plain C++.
+ */
+
+namespace apache { namespace thrift { namespace protocol {
+
+namespace detail { namespace compact {
+
+/**
+ * Number of bytes n takes as a varint, 1 to 5.
+ */
+inline uint32_t varintSize32(uint32_t n) {
+#ifdef __GNUC__
+  uint32_t bits = 32 - __builtin_clz(n | 1);
+#else
+  uint32_t bits = 1;
+  while (n >>= 1) {
+    ++bits;
+  }
+#endif
+  // bits / 7, rounded up, without a divide
+  return (bits * 9 + 64) >> 6;
+}
+
+/**
+ * Number of bytes n takes as a varint, 1 to 10.
+ */
+inline uint32_t varintSize64(uint64_t n) {
+#ifdef __GNUC__
+  uint32_t bits = 64 - __builtin_clzll(n | 1);
+#else
+  uint32_t bits = 1;
+  while (n >>= 1) {
+    ++bits;
+  }
+#endif
+  return (bits * 9 + 64) >> 6;
+}
+
+/**
+ * Writes n as a varint to buf, which must have room for 5 bytes.  The
+ * length is worked out first, so there is no test on every byte.
+ *
+ * @return the number of bytes written
+ */
+inline uint32_t encodeVarint32(uint32_t n, uint8_t* buf) {
+  if (n < 0x80) {
+    buf[0] = static_cast<uint8_t>(n);
+    return 1;
+  }
+  uint32_t size = varintSize32(n);
+  uint32_t last = size - 1;
+  for (uint32_t i = 0; i < last; ++i) {
+    buf[i] = static_cast<uint8_t>(n | 0x80);
+    n >>= 7;
+  }
+  buf[last] = static_cast<uint8_t>(n);
+  return size;
+}
+
+/**
+ * Writes n as a varint to buf, which must have room for 10 bytes.
+ *
+ * @return the number of bytes written
+ */
+inline uint32_t encodeVarint64(uint64_t n, uint8_t* buf) {
+  if (n < 0x80) {
+    buf[0] = static_cast<uint8_t>(n);
+    return 1;
+  }
+  uint32_t size = varintSize64(n);
+  uint32_t last = size - 1;
+  for (uint32_t i = 0; i < last; ++i) {
+    buf[i] = static_cast<uint8_t>(n | 0x80);
+    n >>= 7;
+  }
+  buf[last] = static_cast<uint8_t>(n);
+  return size;
+}
+
+/**
+ * Writes n values as zigzag varints to buf, which must have room for
+ * 5 * n bytes.
+ *
+ * @return the number of bytes written
+ */
+uint32_t encodeZigzag32(const int32_t* values, uint32_t n, uint8_t* buf);
+
+/**
+ * Writes n values as zigzag varints to buf, which must have room for
+ * 10 * n bytes.
+ *
+ * @return the number of bytes written
+ */
+uint32_t encodeZigzag64(const int64_t* values, uint32_t n, uint8_t* buf);
+
+/**
+ * Decodes up to n zigzag varints from the len bytes at buf.  Stops early
+ * at a varint that runs past the end of buf, which the caller then has to
+ * read some other way.
+ *
+ * @param consumed  Set to the number of bytes used
+ * @return the number of values decoded
+ * @throws TProtocolException if a varint is over 10 bytes
+ */
+uint32_t decodeZigzag32(const uint8_t* buf, uint32_t len,
+                        int32_t* out, uint32_t n, uint32_t* consumed);
+
+/**
+ * As decodeZigzag32(), for i64s.
+ */
+uint32_t decodeZigzag64(const uint8_t* buf, uint32_t len,
+                        int64_t* out, uint32_t n, uint32_t* consumed);
+
+/**
+ * Which decoder was picked for this CPU: "bmi2", "sse2", "neon" or "scalar".
+ */
+const char* varintDecoderName();
+
+}} // apache::thrift::protocol::detail::compact
+
+}}} // apache::thrift::protocol
+
+#endif // #define _THRIFT_PROTOCOL_TCOMPACTVARINT_H_
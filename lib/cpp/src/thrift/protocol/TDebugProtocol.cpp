@@ -22,26 +22,52 @@
 #include <cassert>
 #include <cctype>
 #include <cstdio>
+#include <cstring>
 #include <stdexcept>
-#include <boost/static_assert.hpp>
-#include <boost/lexical_cast.hpp>
 
 using std::string;
 
 
-static string byte_to_hex(const uint8_t byte) {
-  char buf[3];
-  int ret = std::sprintf(buf, "%02x", (int)byte);
-  THRIFT_UNUSED_VARIABLE(ret);
-  assert(ret == 2);
-  assert(buf[2] == '\0');
-  return buf;
+// sprintf is most of the cost of printing small values, so these do the
+// formatting by hand.
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Writes v in decimal to out, which needs 20 bytes, and returns the end
+static char* format_int(char* out, int64_t v) {
+  char digits[20];
+  uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+  int n = 0;
+  do {
+    digits[n++] = (char)('0' + u % 10);
+    u /= 10;
+  } while (u != 0);
+  if (v < 0) {
+    *out++ = '-';
+  }
+  while (n > 0) {
+    *out++ = digits[--n];
+  }
+  return out;
+}
+
+static char* format_hex(char* out, uint8_t byte) {
+  *out++ = hex_digits[byte >> 4];
+  *out++ = hex_digits[byte & 0xf];
+  return out;
+}
+
+static char* format_str(char* out, const char* str) {
+  while (*str != '\0') {
+    *out++ = *str++;
+  }
+  return out;
 }
 
 
 namespace apache { namespace thrift { namespace protocol {
 
-string TDebugProtocol::fieldTypeName(TType type) {
+const char* TDebugProtocol::fieldTypeName(TType type) {
   switch (type) {
     case T_STOP   : return "stop"   ;
     case T_VOID   : return "void"   ;
@@ -63,39 +89,91 @@ string TDebugProtocol::fieldTypeName(TType type) {
   }
 }
 
+void TDebugProtocol::init(uint32_t buf_size) {
+  buf_size_ = buf_size;
+  string_limit_ = DEFAULT_STRING_LIMIT;
+  string_prefix_size_ = DEFAULT_STRING_PREFIX_SIZE;
+  depth_limit_ = 0;
+  length_limit_ = 0;
+  length_ = 0;
+  truncated_ = false;
+  skip_depth_ = 0;
+  indent_ = 0;
+  write_state_.push_back(UNINIT);
+  setLengthLimit(0);
+}
+
 void TDebugProtocol::indentUp() {
-  indent_str_ += string(indent_inc, ' ');
+  indent_ += indent_inc;
 }
 
 void TDebugProtocol::indentDown() {
-  if (indent_str_.length() < (string::size_type)indent_inc) {
+  if (indent_ < indent_inc) {
     throw TProtocolException(TProtocolException::INVALID_DATA);
   }
-  indent_str_.erase(indent_str_.length() - indent_inc);
+  indent_ -= indent_inc;
 }
 
-uint32_t TDebugProtocol::writePlain(const string& str) {
-  if(str.length() > (std::numeric_limits<uint32_t>::max)())
-    throw TProtocolException(TProtocolException::SIZE_LIMIT);
-  trans_->write((uint8_t*)str.data(), static_cast<uint32_t>(str.length()));
-  return static_cast<uint32_t>(str.length());
+uint32_t TDebugProtocol::writePlain(const char* str, uint32_t len) {
+  if (truncated_) {
+    return 0;
+  }
+  if ((length_limit_ != 0 || buf_ != NULL) && len > length_limit_ - length_) {
+    // Fill what is left and mark the cut, which a buffer has room for
+    // unless it is under three bytes
+    uint32_t size = length_limit_ - length_;
+    emit(str, size);
+    uint32_t mark = 3;
+    if (buf_ != NULL && mark > buf_size_ - length_) {
+      mark = buf_size_ - length_;
+    }
+    emit("...", mark);
+    truncated_ = true;
+    return size + mark;
+  }
+
+  emit(str, len);
+  return len;
+}
+
+void TDebugProtocol::emit(const char* str, uint32_t len) {
+  if (trans_ != NULL) {
+    trans_->write((const uint8_t*)str, len);
+  } else if (str_ != NULL) {
+    str_->append(str, len);
+  } else {
+    std::memcpy(buf_ + length_, str, len);
+  }
+  length_ += len;
+}
+
+uint32_t TDebugProtocol::writePlain(const char* str) {
+  return writePlain(str, static_cast<uint32_t>(std::strlen(str)));
 }
 
-uint32_t TDebugProtocol::writeIndented(const string& str) {
-  if(str.length() > (std::numeric_limits<uint32_t>::max)())
-    throw TProtocolException(TProtocolException::SIZE_LIMIT);
-  if(indent_str_.length() > (std::numeric_limits<uint32_t>::max)())
-    throw TProtocolException(TProtocolException::SIZE_LIMIT);
-  uint64_t total_len = indent_str_.length() + str.length();
-  if(total_len > (std::numeric_limits<uint32_t>::max)())
-    throw TProtocolException(TProtocolException::SIZE_LIMIT);
-  trans_->write((uint8_t*)indent_str_.data(), static_cast<uint32_t>(indent_str_.length()));
-  trans_->write((uint8_t*)str.data(), static_cast<uint32_t>(str.length()));
-  return static_cast<uint32_t>(indent_str_.length() + str.length());
+uint32_t TDebugProtocol::writeIndent() {
+  static const char spaces[] = "                                ";
+  static const int32_t chunk = sizeof(spaces) - 1;
+  uint32_t size = 0;
+  int32_t left = indent_;
+  while (left > 0) {
+    int32_t n = left < chunk ? left : chunk;
+    size += writePlain(spaces, n);
+    left -= n;
+  }
+  return size;
+}
+
+uint32_t TDebugProtocol::writeIndented(const char* str) {
+  uint32_t size = writeIndent();
+  size += writePlain(str);
+  return size;
 }
 
 uint32_t TDebugProtocol::startItem() {
   uint32_t size;
+  char idx[32];
+  char* end;
 
   switch (write_state_.back()) {
     case UNINIT:
@@ -106,14 +184,16 @@ uint32_t TDebugProtocol::startItem() {
     case STRUCT:
       return 0;
     case SET:
-      return writeIndented("");
+      return writeIndent();
     case MAP_KEY:
-      return writeIndented("");
+      return writeIndent();
     case MAP_VALUE:
-      return writePlain(" -> ");
+      return writePlain(" -> ", 4);
     case LIST:
-      size = writeIndented(
-          "[" + boost::lexical_cast<string>(list_idx_.back()) + "] = ");
+      size = writeIndent();
+      idx[0] = '[';
+      end = format_str(format_int(idx + 1, list_idx_.back()), "] = ");
+      size += writePlain(idx, static_cast<uint32_t>(end - idx));
       list_idx_.back()++;
       return size;
     default:
@@ -131,26 +211,77 @@ uint32_t TDebugProtocol::endItem() {
       //return writeIndented(str);
       return 0;
     case STRUCT:
-      return writePlain(",\n");
+      return writePlain(",\n", 2);
     case SET:
-      return writePlain(",\n");
+      return writePlain(",\n", 2);
     case MAP_KEY:
       write_state_.back() = MAP_VALUE;
       return 0;
     case MAP_VALUE:
       write_state_.back() = MAP_KEY;
-      return writePlain(",\n");
+      return writePlain(",\n", 2);
     case LIST:
-      return writePlain(",\n");
+      return writePlain(",\n", 2);
     default:
       throw std::logic_error("Invalid enum value.");
   }
 }
 
-uint32_t TDebugProtocol::writeItem(const std::string& str) {
+uint32_t TDebugProtocol::writeItem(const char* str, uint32_t len) {
+  if (skip_depth_ > 0) {
+    return 0;
+  }
   uint32_t size = 0;
   size += startItem();
-  size += writePlain(str);
+  size += writePlain(str, len);
+  size += endItem();
+  return size;
+}
+
+/**
+ * Whether a struct or container starting here falls inside one the depth
+ * limit left out, in which case it is counted but not printed.
+ */
+bool TDebugProtocol::skipContainer() {
+  if (skip_depth_ > 0) {
+    ++skip_depth_;
+    return true;
+  }
+  return false;
+}
+
+uint32_t TDebugProtocol::writeContainerBegin(const char* header, uint32_t len,
+                                             write_state_t state) {
+  uint32_t size = 0;
+  size += startItem();
+  size += writePlain(header, len);
+  if (depth_limit_ > 0 &&
+      static_cast<int32_t>(write_state_.size()) > depth_limit_) {
+    size += writePlain(" {...}", 6);
+    skip_depth_ = 1;
+    return size;
+  }
+  size += writePlain(" {\n", 3);
+  indentUp();
+  write_state_.push_back(state);
+  if (state == LIST) {
+    list_idx_.push_back(0);
+  }
+  return size;
+}
+
+uint32_t TDebugProtocol::writeContainerEnd() {
+  if (skip_depth_ > 0) {
+    // Only the outermost elided container gets its item ending
+    return --skip_depth_ == 0 ? endItem() : 0;
+  }
+  indentDown();
+  if (write_state_.back() == LIST) {
+    list_idx_.pop_back();
+  }
+  write_state_.pop_back();
+  uint32_t size = 0;
+  size += writeIndented("}");
   size += endItem();
   return size;
 }
@@ -159,7 +290,7 @@ uint32_t TDebugProtocol::writeMessageBegin(const std::string& name,
                                            const TMessageType messageType,
                                            const int32_t seqid) {
   (void) seqid;
-  string mtype;
+  const char* mtype = "";
   switch (messageType) {
     case T_CALL      : mtype = "call"   ; break;
     case T_REPLY     : mtype = "reply"  ; break;
@@ -167,7 +298,12 @@ uint32_t TDebugProtocol::writeMessageBegin(const std::string& name,
     case T_ONEWAY    : mtype = "oneway" ; break;
   }
 
-  uint32_t size = writeIndented("(" + mtype + ") " + name + "(");
+  uint32_t size = writeIndent();
+  size += writePlain("(", 1);
+  size += writePlain(mtype);
+  size += writePlain(") ", 2);
+  size += writePlain(name.data(), static_cast<uint32_t>(name.size()));
+  size += writePlain("(", 1);
   indentUp();
   return size;
 }
@@ -178,38 +314,40 @@ uint32_t TDebugProtocol::writeMessageEnd() {
 }
 
 uint32_t TDebugProtocol::writeStructBegin(const char* name) {
-  uint32_t size = 0;
-  size += startItem();
-  size += writePlain(string(name) + " {\n");
-  indentUp();
-  write_state_.push_back(STRUCT);
-  return size;
+  if (skipContainer()) {
+    return 0;
+  }
+  return writeContainerBegin(name, static_cast<uint32_t>(std::strlen(name)),
+                             STRUCT);
 }
 
 uint32_t TDebugProtocol::writeStructEnd() {
-  indentDown();
-  write_state_.pop_back();
-  uint32_t size = 0;
-  size += writeIndented("}");
-  size += endItem();
-  return size;
+  return writeContainerEnd();
 }
 
 uint32_t TDebugProtocol::writeFieldBegin(const char* name,
                                          const TType fieldType,
                                          const int16_t fieldId) {
-  // sprintf(id_str, "%02d", fieldId);
-  string id_str = boost::lexical_cast<string>(fieldId);
-  if (id_str.length() == 1) id_str = '0' + id_str;
-
-  return writeIndented(
-      id_str + ": " +
-      name + " (" +
-      fieldTypeName(fieldType) + ") = ");
+  if (skip_depth_ > 0) {
+    return 0;
+  }
+  char id_str[16];
+  char* end = id_str;
+  if (fieldId >= 0 && fieldId < 10) {
+    *end++ = '0';
+  }
+  end = format_str(format_int(end, fieldId), ": ");
+  uint32_t size = writeIndent();
+  size += writePlain(id_str, static_cast<uint32_t>(end - id_str));
+  size += writePlain(name);
+  size += writePlain(" (", 2);
+  size += writePlain(fieldTypeName(fieldType));
+  size += writePlain(") = ", 4);
+  return size;
 }
 
 uint32_t TDebugProtocol::writeFieldEnd() {
-  assert(write_state_.back() == STRUCT);
+  assert(skip_depth_ > 0 || write_state_.back() == STRUCT);
   return 0;
 }
 
@@ -222,132 +360,156 @@ uint32_t TDebugProtocol::writeMapBegin(const TType keyType,
                                        const TType valType,
                                        const uint32_t size) {
   // TODO(dreiss): Optimize short maps?
-  uint32_t bsize = 0;
-  bsize += startItem();
-  bsize += writePlain(
-      "map<" + fieldTypeName(keyType) + "," + fieldTypeName(valType) + ">"
-      "[" + boost::lexical_cast<string>(size) + "] {\n");
-  indentUp();
-  write_state_.push_back(MAP_KEY);
-  return bsize;
+  if (skipContainer()) {
+    return 0;
+  }
+  char header[64];
+  char* end = format_str(header, "map<");
+  end = format_str(end, fieldTypeName(keyType));
+  end = format_str(end, ",");
+  end = format_str(end, fieldTypeName(valType));
+  end = format_str(end, ">[");
+  end = format_str(format_int(end, size), "]");
+  return writeContainerBegin(header, static_cast<uint32_t>(end - header),
+                             MAP_KEY);
 }
 
 uint32_t TDebugProtocol::writeMapEnd() {
-  indentDown();
-  write_state_.pop_back();
-  uint32_t size = 0;
-  size += writeIndented("}");
-  size += endItem();
-  return size;
+  return writeContainerEnd();
 }
 
 uint32_t TDebugProtocol::writeListBegin(const TType elemType,
                                         const uint32_t size) {
   // TODO(dreiss): Optimize short arrays.
-  uint32_t bsize = 0;
-  bsize += startItem();
-  bsize += writePlain(
-      "list<" + fieldTypeName(elemType) + ">"
-      "[" + boost::lexical_cast<string>(size) + "] {\n");
-  indentUp();
-  write_state_.push_back(LIST);
-  list_idx_.push_back(0);
-  return bsize;
+  if (skipContainer()) {
+    return 0;
+  }
+  char header[64];
+  char* end = format_str(header, "list<");
+  end = format_str(end, fieldTypeName(elemType));
+  end = format_str(end, ">[");
+  end = format_str(format_int(end, size), "]");
+  return writeContainerBegin(header, static_cast<uint32_t>(end - header),
+                             LIST);
 }
 
 uint32_t TDebugProtocol::writeListEnd() {
-  indentDown();
-  write_state_.pop_back();
-  list_idx_.pop_back();
-  uint32_t size = 0;
-  size += writeIndented("}");
-  size += endItem();
-  return size;
+  return writeContainerEnd();
 }
 
 uint32_t TDebugProtocol::writeSetBegin(const TType elemType,
                                        const uint32_t size) {
   // TODO(dreiss): Optimize short sets.
-  uint32_t bsize = 0;
-  bsize += startItem();
-  bsize += writePlain(
-      "set<" + fieldTypeName(elemType) + ">"
-      "[" + boost::lexical_cast<string>(size) + "] {\n");
-  indentUp();
-  write_state_.push_back(SET);
-  return bsize;
+  if (skipContainer()) {
+    return 0;
+  }
+  char header[64];
+  char* end = format_str(header, "set<");
+  end = format_str(end, fieldTypeName(elemType));
+  end = format_str(end, ">[");
+  end = format_str(format_int(end, size), "]");
+  return writeContainerBegin(header, static_cast<uint32_t>(end - header),
+                             SET);
 }
 
 uint32_t TDebugProtocol::writeSetEnd() {
-  indentDown();
-  write_state_.pop_back();
-  uint32_t size = 0;
-  size += writeIndented("}");
-  size += endItem();
-  return size;
+  return writeContainerEnd();
 }
 
 uint32_t TDebugProtocol::writeBool(const bool value) {
-  return writeItem(value ? "true" : "false");
+  return value ? writeItem("true", 4) : writeItem("false", 5);
 }
 
 uint32_t TDebugProtocol::writeByte(const int8_t byte) {
-  return writeItem("0x" + byte_to_hex(byte));
+  char buf[4] = { '0', 'x' };
+  format_hex(buf + 2, byte);
+  return writeItem(buf, 4);
 }
 
 uint32_t TDebugProtocol::writeI16(const int16_t i16) {
-  return writeItem(boost::lexical_cast<string>(i16));
+  char buf[24];
+  return writeItem(buf, static_cast<uint32_t>(format_int(buf, i16) - buf));
 }
 
 uint32_t TDebugProtocol::writeI32(const int32_t i32) {
-  return writeItem(boost::lexical_cast<string>(i32));
+  char buf[24];
+  return writeItem(buf, static_cast<uint32_t>(format_int(buf, i32) - buf));
 }
 
 uint32_t TDebugProtocol::writeI64(const int64_t i64) {
-  return writeItem(boost::lexical_cast<string>(i64));
+  char buf[24];
+  return writeItem(buf, static_cast<uint32_t>(format_int(buf, i64) - buf));
 }
 
 uint32_t TDebugProtocol::writeDouble(const double dub) {
-  return writeItem(boost::lexical_cast<string>(dub));
+  // Round-trip precision, as boost::lexical_cast used to give
+  char buf[32];
+  return writeItem(buf, std::sprintf(buf, "%.17g", dub));
 }
 
 
 uint32_t TDebugProtocol::writeString(const string& str) {
   // XXX Raw/UTF-8?
-
-  string to_show = str;
-  if (to_show.length() > (string::size_type)string_limit_) {
-    to_show = str.substr(0, string_prefix_size_);
-    to_show += "[...](" + boost::lexical_cast<string>(str.length()) + ")";
+  if (skip_depth_ > 0) {
+    return 0;
   }
 
-  string output = "\"";
+  string::size_type show = str.length();
+  bool cut = show > (string::size_type)string_limit_;
+  if (cut && show > (string::size_type)string_prefix_size_) {
+    show = string_prefix_size_;
+  }
 
-  for (string::const_iterator it = to_show.begin(); it != to_show.end(); ++it) {
-    if (*it == '\\') {
-      output += "\\\\";
-    } else if (*it == '"') {
-      output += "\\\"";
-    } else if (std::isprint(*it)) {
-      output += *it;
+  // Escaped a piece at a time through a fixed buffer, flushed while there
+  // is still room for the longest escape
+  char out[256];
+  uint32_t len = 0;
+  uint32_t size = startItem();
+  out[len++] = '"';
+  for (string::size_type i = 0; i < show; ++i) {
+    if (len > sizeof(out) - 4) {
+      size += writePlain(out, len);
+      len = 0;
+    }
+    char c = str[i];
+    if (c == '\\') {
+      out[len++] = '\\';
+      out[len++] = '\\';
+    } else if (c == '"') {
+      out[len++] = '\\';
+      out[len++] = '"';
+    } else if (std::isprint((unsigned char)c)) {
+      out[len++] = c;
     } else {
-      switch (*it) {
-        case '\a': output += "\\a"; break;
-        case '\b': output += "\\b"; break;
-        case '\f': output += "\\f"; break;
-        case '\n': output += "\\n"; break;
-        case '\r': output += "\\r"; break;
-        case '\t': output += "\\t"; break;
-        case '\v': output += "\\v"; break;
-        default:
-          output += "\\x";
-          output += byte_to_hex(*it);
+      const char* esc = NULL;
+      switch (c) {
+        case '\a': esc = "\\a"; break;
+        case '\b': esc = "\\b"; break;
+        case '\f': esc = "\\f"; break;
+        case '\n': esc = "\\n"; break;
+        case '\r': esc = "\\r"; break;
+        case '\t': esc = "\\t"; break;
+        case '\v': esc = "\\v"; break;
+      }
+      if (esc != NULL) {
+        out[len++] = esc[0];
+        out[len++] = esc[1];
+      } else {
+        out[len++] = '\\';
+        out[len++] = 'x';
+        format_hex(out + len, (uint8_t)c);
+        len += 2;
       }
     }
   }
-
-  output += '\"';
-  return writeItem(output);
+  size += writePlain(out, len);
+  if (cut) {
+    len = std::sprintf(out, "[...](%lu)", (unsigned long)str.length());
+    size += writePlain(out, len);
+  }
+  size += writePlain("\"", 1);
+  size += endItem();
+  return size;
 }
 
 uint32_t TDebugProtocol::writeBinary(const string& str) {
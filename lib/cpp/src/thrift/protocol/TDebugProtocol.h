@@ -60,10 +60,37 @@ class TDebugProtocol : public TVirtualProtocol<TDebugProtocol> {
   TDebugProtocol(boost::shared_ptr<TTransport> trans)
     : TVirtualProtocol<TDebugProtocol>(trans)
     , trans_(trans.get())
-    , string_limit_(DEFAULT_STRING_LIMIT)
-    , string_prefix_size_(DEFAULT_STRING_PREFIX_SIZE)
+    , str_(NULL)
+    , buf_(NULL)
   {
-    write_state_.push_back(UNINIT);
+    init(0);
+  }
+
+  /**
+   * Appends the output to *str instead of writing it to a transport.
+   * getTransport() returns NULL.
+   */
+  TDebugProtocol(std::string* str)
+    : TVirtualProtocol<TDebugProtocol>(boost::shared_ptr<TTransport>())
+    , trans_(NULL)
+    , str_(str)
+    , buf_(NULL)
+  {
+    init(0);
+  }
+
+  /**
+   * Prints into buf, which has room for size bytes, instead of writing to a
+   * transport.  getLength() says how much of buf was used.  getTransport()
+   * returns NULL.
+   */
+  TDebugProtocol(char* buf, uint32_t size)
+    : TVirtualProtocol<TDebugProtocol>(boost::shared_ptr<TTransport>())
+    , trans_(NULL)
+    , str_(NULL)
+    , buf_(buf)
+  {
+    init(size);
   }
 
   static const int32_t DEFAULT_STRING_LIMIT = 256;
@@ -77,6 +104,36 @@ class TDebugProtocol : public TVirtualProtocol<TDebugProtocol> {
     string_prefix_size_ = string_prefix_size;
   }
 
+  /**
+   * Structs and containers nested more than depth_limit deep are printed
+   * as "{...}" without their contents.  0, the default, means no limit.
+   */
+  void setDepthLimit(int32_t depth_limit) {
+    depth_limit_ = depth_limit;
+  }
+
+  /**
+   * Stops printing after length_limit bytes and adds "..." to show where
+   * the output was cut.  0, the default, means no limit.  Printing into a
+   * buffer is always limited to what fits with the "...".
+   */
+  void setLengthLimit(uint32_t length_limit) {
+    if (buf_ != NULL) {
+      uint32_t most = buf_size_ > 3 ? buf_size_ - 3 : 0;
+      if (length_limit == 0 || length_limit > most) {
+        length_limit = most;
+      }
+    }
+    length_limit_ = length_limit;
+  }
+
+  /**
+   * Number of bytes printed so far.
+   */
+  uint32_t getLength() const {
+    return length_;
+  }
+
 
   uint32_t writeMessageBegin(const std::string& name,
                              const TMessageType messageType,
@@ -131,22 +188,41 @@ class TDebugProtocol : public TVirtualProtocol<TDebugProtocol> {
 
 
  private:
+  void init(uint32_t buf_size);
   void indentUp();
   void indentDown();
-  uint32_t writePlain(const std::string& str);
-  uint32_t writeIndented(const std::string& str);
+  uint32_t writePlain(const char* str, uint32_t len);
+  uint32_t writePlain(const char* str);
+  void emit(const char* str, uint32_t len);
+  uint32_t writeIndent();
+  uint32_t writeIndented(const char* str);
   uint32_t startItem();
   uint32_t endItem();
-  uint32_t writeItem(const std::string& str);
+  uint32_t writeItem(const char* str, uint32_t len);
+  bool skipContainer();
+  uint32_t writeContainerBegin(const char* header, uint32_t len,
+                               write_state_t state);
+  uint32_t writeContainerEnd();
 
-  static std::string fieldTypeName(TType type);
+  static const char* fieldTypeName(TType type);
 
+  // Exactly one of these is where the output goes
   TTransport* trans_;
+  std::string* str_;
+  char* buf_;
+  uint32_t buf_size_;
 
   int32_t string_limit_;
   int32_t string_prefix_size_;
+  int32_t depth_limit_;
+  uint32_t length_limit_;
+  uint32_t length_;
+  bool truncated_;
 
-  std::string indent_str_;
+  // How many levels of nesting are being left out by the depth limit
+  int32_t skip_depth_;
+
+  int32_t indent_;
   static const int indent_inc = 2;
 
   std::vector<write_state_t> write_state_;
@@ -177,18 +253,35 @@ namespace apache { namespace thrift {
 
 template<typename ThriftStruct>
 std::string ThriftDebugString(const ThriftStruct& ts) {
-  using namespace apache::thrift::transport;
   using namespace apache::thrift::protocol;
-  TMemoryBuffer* buffer = new TMemoryBuffer;
-  boost::shared_ptr<TTransport> trans(buffer);
-  TDebugProtocol protocol(trans);
+  std::string str;
+  TDebugProtocol protocol(&str);
 
   ts.write(&protocol);
 
-  uint8_t* buf;
-  uint32_t size;
-  buffer->getBuffer(&buf, &size);
-  return std::string((char*)buf, (unsigned int)size);
+  return str;
+}
+
+/**
+ * Prints ts into buf, which has room for size bytes, and NUL-terminates it.
+ * Returns the length printed.  Output that does not fit is cut off with
+ * "...", and nesting deeper than depth_limit (if not 0) is elided, so this
+ * is cheap enough to use on sampled requests.
+ */
+template<typename ThriftStruct>
+uint32_t ThriftDebugString(const ThriftStruct& ts, char* buf, uint32_t size,
+                           int32_t depth_limit = 0) {
+  using namespace apache::thrift::protocol;
+  if (size == 0) {
+    return 0;
+  }
+  TDebugProtocol protocol(buf, size - 1);
+  protocol.setDepthLimit(depth_limit);
+
+  ts.write(&protocol);
+
+  buf[protocol.getLength()] = '\0';
+  return protocol.getLength();
 }
 
 // TODO(dreiss): This is badly broken.  Don't use it unless you are me.
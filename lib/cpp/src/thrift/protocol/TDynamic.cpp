@@ -0,0 +1,278 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/protocol/TDynamic.h>
+
+#include <algorithm>
+#include <boost/container/map.hpp>
+
+namespace apache { namespace thrift { namespace protocol {
+
+using namespace std;
+
+const TDynamicValue* TDynamicValue::getField(int16_t id) const {
+  for (Items::const_iterator it = items_.begin(); it != items_.end(); ++it) {
+    if (it->id_ == id) {
+      return &*it;
+    }
+  }
+  return NULL;
+}
+
+TDynamicValue* TDynamicValue::getField(int16_t id) {
+  return const_cast<TDynamicValue*>(static_cast<const TDynamicValue*>(this)->getField(id));
+}
+
+TDynamicValue& TDynamicValue::setField(int16_t id) {
+  if (type_ != T_STRUCT) {
+    setContainer(T_STRUCT);
+  }
+  TDynamicValue* field = getField(id);
+  if (field == NULL) {
+    items_.emplace_back();
+    field = &items_.back();
+    field->id_ = id;
+  }
+  return *field;
+}
+
+const TDynamicValue* TDynamicValue::find(const vector<int16_t>& path) const {
+  const TDynamicValue* value = this;
+  for (size_t i = 0; i < path.size() && value != NULL; ++i) {
+    value = value->type_ == T_STRUCT ? value->getField(path[i]) : NULL;
+  }
+  return value;
+}
+
+/**
+ * The fields a plan is limited to, as a tree of names.  A name with no
+ * fields under it keeps all of its value.
+ */
+struct TDecodePlan::Paths {
+  boost::container::map<string, Paths> fields;
+};
+
+namespace {
+
+TException planError(const string& what) {
+  return TException("TDecodePlan: " + what);
+}
+
+bool compareFieldIds(const TSchemaField& a, const TSchemaField& b) {
+  return a.id < b.id;
+}
+
+}
+
+TDecodePlan::TDecodePlan(const TSchema& schema,
+                         const string& root,
+                         const vector<string>& paths) {
+  int32_t index = schema.findStruct(root);
+  if (index < 0) {
+    throw planError("unknown struct " + root);
+  }
+
+  Paths tree;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    Paths* at = &tree;
+    size_t begin = 0;
+    while (true) {
+      size_t end = paths[i].find('.', begin);
+      at = &at->fields[paths[i].substr(begin, end == string::npos ? string::npos : end - begin)];
+      if (end == string::npos) {
+        break;
+      }
+      begin = end + 1;
+    }
+  }
+
+  vector<int32_t> full(schema.getStructs().size(), -1);
+  compileStruct(schema, index, tree.fields.empty() ? NULL : &tree, full);
+}
+
+/**
+ * Adds the plan struct for struct index of schema, limited to paths unless
+ * it is NULL.  Whole structs are compiled once, which also ends recursion
+ * through structs that contain themselves.
+ */
+int32_t TDecodePlan::compileStruct(const TSchema& schema,
+                                   int32_t index,
+                                   const Paths* paths,
+                                   vector<int32_t>& full) {
+  if (paths == NULL && full[index] >= 0) {
+    return full[index];
+  }
+  int32_t position = static_cast<int32_t>(structs_.size());
+  if (paths == NULL) {
+    full[index] = position;
+  }
+
+  const TSchemaStruct& sstruct = schema.getStructs()[index];
+  vector<TSchemaField> sfields = sstruct.fields;
+  sort(sfields.begin(), sfields.end(), compareFieldIds);
+
+  structs_.push_back(Struct());
+  structs_[position].name = sstruct.name.substr(sstruct.name.rfind('.') + 1);
+
+  if (paths != NULL) {
+    boost::container::map<string, Paths>::const_iterator it;
+    for (it = paths->fields.begin(); it != paths->fields.end(); ++it) {
+      if (sstruct.findField(it->first) == NULL) {
+        throw planError("no field " + it->first + " in " + sstruct.name);
+      }
+    }
+  }
+
+  vector<Field> fields(sfields.size());
+  for (size_t i = 0; i < sfields.size(); ++i) {
+    const TSchemaField& sfield = sfields[i];
+    Field& field = fields[i];
+    field.id = sfield.id;
+    field.ttype = schema.getTypes()[sfield.type].ttype;
+    field.name = sfield.name;
+    field.keep = true;
+    field.node = -1;
+
+    const Paths* under = NULL;
+    if (paths != NULL) {
+      boost::container::map<string, Paths>::const_iterator it = paths->fields.find(sfield.name);
+      if (it == paths->fields.end()) {
+        field.keep = false;
+        continue;
+      }
+      if (!it->second.fields.empty()) {
+        under = &it->second;
+      }
+    }
+    field.node = compileNode(schema, sfield.type, under, full);
+  }
+
+  // A table by id, unless the ids are too sparse for one to be worth it
+  Struct& tstruct = structs_[position];
+  tstruct.fields.swap(fields);
+  tstruct.minId = tstruct.fields.empty() ? 0 : tstruct.fields.front().id;
+  if (!tstruct.fields.empty()) {
+    size_t range = static_cast<size_t>(tstruct.fields.back().id - tstruct.minId) + 1;
+    if (range <= 4 * tstruct.fields.size() + 8) {
+      tstruct.byId.assign(range, -1);
+      for (size_t i = 0; i < tstruct.fields.size(); ++i) {
+        tstruct.byId[tstruct.fields[i].id - tstruct.minId] = static_cast<int32_t>(i);
+      }
+    }
+  }
+  return position;
+}
+
+/**
+ * Adds the node for type of schema.  Paths go on through lists and sets to
+ * their elements, and through maps to their values.
+ */
+int32_t TDecodePlan::compileNode(const TSchema& schema,
+                                 int32_t type,
+                                 const Paths* paths,
+                                 vector<int32_t>& full) {
+  const TSchemaType& stype = schema.getTypes()[type];
+  int32_t position = static_cast<int32_t>(nodes_.size());
+  Node node;
+  node.ttype = stype.ttype;
+  node.binary = stype.binary;
+  node.index = -1;
+  node.key = -1;
+  node.value = -1;
+  nodes_.push_back(node);
+
+  switch (stype.ttype) {
+  case T_STRUCT:
+    node.index = compileStruct(schema, stype.index, paths, full);
+    break;
+  case T_MAP:
+    node.key = compileNode(schema, stype.key, NULL, full);
+    node.value = compileNode(schema, stype.value, paths, full);
+    break;
+  case T_LIST:
+  case T_SET:
+    node.value = compileNode(schema, stype.value, paths, full);
+    break;
+  default:
+    if (paths != NULL) {
+      throw planError("no fields under " + paths->fields.begin()->first);
+    }
+    break;
+  }
+  nodes_[position] = node;
+  return position;
+}
+
+size_t TDecodePlan::lookup(const Struct& tstruct, int16_t fid) const {
+  const vector<Field>& fields = tstruct.fields;
+  if (!tstruct.byId.empty()) {
+    int32_t offset = fid - tstruct.minId;
+    if (offset < 0 || offset >= static_cast<int32_t>(tstruct.byId.size())
+        || tstruct.byId[offset] < 0) {
+      return fields.size();
+    }
+    return static_cast<size_t>(tstruct.byId[offset]);
+  }
+  size_t low = 0;
+  size_t high = fields.size();
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (fields[middle].id < fid) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low < fields.size() && fields[low].id == fid ? low : fields.size();
+}
+
+vector<int16_t> TDecodePlan::resolve(const string& path) const {
+  vector<int16_t> ids;
+  int32_t index = 0;
+  size_t begin = 0;
+  while (true) {
+    size_t end = path.find('.', begin);
+    string name = path.substr(begin, end == string::npos ? string::npos : end - begin);
+    if (index < 0) {
+      throw planError(path + " is not a path of struct fields");
+    }
+
+    const vector<Field>& fields = structs_[index].fields;
+    const Field* field = NULL;
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (fields[i].name == name) {
+        field = &fields[i];
+        break;
+      }
+    }
+    if (field == NULL || !field->keep) {
+      throw planError("no field " + name + " in " + structs_[index].name);
+    }
+    ids.push_back(field->id);
+
+    if (end == string::npos) {
+      break;
+    }
+    begin = end + 1;
+    index = field->ttype == T_STRUCT ? nodes_[field->node].index : -1;
+  }
+  return ids;
+}
+
+}}} // apache::thrift::protocol
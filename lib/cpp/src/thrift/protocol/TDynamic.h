@@ -0,0 +1,233 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TDYNAMIC_H_
+#define _THRIFT_PROTOCOL_TDYNAMIC_H_ 1
+
+#include <string>
+#include <vector>
+#include <boost/container/vector.hpp>
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/protocol/TSchema.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * A Thrift value of any type, as read by a TDecodePlan: a number, a
+ * string, a container or a struct.
+ *
+ * A list or set holds its elements, a map its keys and values in turn, and
+ * a struct the fields that were read, each knowing its id.  Enums are
+ * their i32.  Reading into a value again reuses the storage of its
+ * strings and containers.
+ */
+class TDynamicValue {
+ public:
+  typedef boost::container::vector<TDynamicValue> Items;
+
+  TDynamicValue() : type_(T_STOP), id_(0), i_(0) {}
+
+  /// The type, or T_STOP if nothing has been read or set
+  TType getType() const { return type_; }
+
+  /// The field id, if this is a field of a struct
+  int16_t getId() const { return id_; }
+
+  bool getBool() const { return i_ != 0; }
+  /// A byte, i16, i32 or i64
+  int64_t getInt() const { return i_; }
+  double getDouble() const { return d_; }
+  const std::string& getString() const { return str_; }
+
+  void setBool(bool value) { set(T_BOOL, value ? 1 : 0); }
+  void setByte(int8_t value) { set(T_BYTE, value); }
+  void setI16(int16_t value) { set(T_I16, value); }
+  void setI32(int32_t value) { set(T_I32, value); }
+  void setI64(int64_t value) { set(T_I64, value); }
+  void setDouble(double value) {
+    type_ = T_DOUBLE;
+    d_ = value;
+  }
+  void setString(const std::string& value) {
+    type_ = T_STRING;
+    str_ = value;
+  }
+
+  /// Makes this an empty list, set, map or struct
+  void setContainer(TType type) {
+    type_ = type;
+    items_.clear();
+  }
+
+  /// The elements of a list or set, the keys and values of a map, or the
+  /// fields of a struct
+  const Items& getItems() const { return items_; }
+  Items& getItems() { return items_; }
+
+  /// The struct field id, or NULL if it was not read
+  const TDynamicValue* getField(int16_t id) const;
+  TDynamicValue* getField(int16_t id);
+
+  /// The struct field id, added if it is not there
+  TDynamicValue& setField(int16_t id);
+
+  /**
+   * The field reached through the struct fields path, from
+   * TDecodePlan::resolve(), or NULL if one of them was not read.
+   */
+  const TDynamicValue* find(const std::vector<int16_t>& path) const;
+
+ private:
+  friend class TDecodePlan;
+
+  void set(TType type, int64_t value) {
+    type_ = type;
+    i_ = value;
+  }
+
+  TType type_;
+  int16_t id_;
+  union {
+    int64_t i_;
+    double d_;
+  };
+  std::string str_;
+  Items items_;
+};
+
+/**
+ * A struct of a TSchema compiled for reading and writing TDynamicValues.
+ *
+ * Compiling flattens the schema into arrays indexed by position: finding a
+ * field is an index into a table by id, or no lookup at all when fields
+ * come in the order they are declared, and each value's type is known
+ * before it is read.  Names are only kept for writing.  So reading through
+ * a plan costs about what a generated read() does, plus the TDynamicValue
+ * each field is stored in.
+ *
+ * A plan can be limited to some fields, given as dotted paths of field
+ * names such as "route.points.x"; a path through a list, set or map
+ * applies to its struct elements or values.  Everything else is skipped
+ * on the wire, which makes extracting a routing key or filtering fields
+ * out of a message little more than a TProtocol::skip() of it.  Writing a
+ * value through a limited plan writes only those fields.
+ *
+ * Reading and writing are templates on the protocol, like the code the
+ * compiler generates with templates, so a concrete protocol such as
+ * TBinaryProtocolT<TBufferBase> is not called through virtual functions.
+ * A plan is immutable, and may be shared between threads.
+ */
+class TDecodePlan {
+ public:
+  /**
+   * Compiles the struct called root of schema.
+   *
+   * @param paths The fields to read, or all of them if empty
+   */
+  TDecodePlan(const TSchema& schema,
+              const std::string& root,
+              const std::vector<std::string>& paths = std::vector<std::string>());
+
+  template <class Protocol_>
+  uint32_t read(Protocol_* iprot, TDynamicValue& value) const {
+    return readStruct(iprot, 0, value);
+  }
+
+  template <class Protocol_>
+  uint32_t write(Protocol_* oprot, const TDynamicValue& value) const {
+    return writeStruct(oprot, 0, value);
+  }
+
+  /**
+   * The field ids of the struct fields path, dotted names from the root,
+   * for TDynamicValue::find().
+   */
+  std::vector<int16_t> resolve(const std::string& path) const;
+
+ private:
+  struct Node {
+    TType ttype;
+    bool binary;
+    /// The plan struct of a T_STRUCT
+    int32_t index;
+    /// The node of a map's keys
+    int32_t key;
+    /// The node of a list's or set's elements, or of a map's values
+    int32_t value;
+  };
+
+  struct Field {
+    int16_t id;
+    TType ttype;
+    /// False for fields left out of a limited plan, which are skipped
+    bool keep;
+    int32_t node;
+    std::string name;
+  };
+
+  struct Struct {
+    std::string name;
+    int16_t minId;
+    /// The field of each id from minId, or -1; empty if the ids are too
+    /// sparse, and the fields are searched
+    std::vector<int32_t> byId;
+    std::vector<Field> fields;
+  };
+
+  struct Paths;
+
+  int32_t compileStruct(const TSchema& schema, int32_t index, const Paths* paths,
+                        std::vector<int32_t>& full);
+  int32_t compileNode(const TSchema& schema, int32_t type, const Paths* paths,
+                      std::vector<int32_t>& full);
+
+  /// The field with id fid, trying the one after the last found first
+  const Field* findField(const Struct& tstruct, int16_t fid, size_t& next) const {
+    const std::vector<Field>& fields = tstruct.fields;
+    if (next < fields.size() && fields[next].id == fid) {
+      return &fields[next++];
+    }
+    size_t i = lookup(tstruct, fid);
+    if (i == fields.size()) {
+      return NULL;
+    }
+    next = i + 1;
+    return &fields[i];
+  }
+
+  size_t lookup(const Struct& tstruct, int16_t fid) const;
+
+  template <class Protocol_>
+  uint32_t readStruct(Protocol_* iprot, int32_t index, TDynamicValue& value) const;
+  template <class Protocol_>
+  uint32_t readNode(Protocol_* iprot, int32_t index, TDynamicValue& value) const;
+  template <class Protocol_>
+  uint32_t writeStruct(Protocol_* oprot, int32_t index, const TDynamicValue& value) const;
+  template <class Protocol_>
+  uint32_t writeNode(Protocol_* oprot, int32_t index, const TDynamicValue& value) const;
+
+  std::vector<Node> nodes_;
+  std::vector<Struct> structs_;
+};
+
+}}} // apache::thrift::protocol
+
+#include <thrift/protocol/TDynamic.tcc>
+
+#endif // #ifndef _THRIFT_PROTOCOL_TDYNAMIC_H_
@@ -0,0 +1,278 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TDYNAMIC_TCC_
+#define _THRIFT_PROTOCOL_TDYNAMIC_TCC_ 1
+
+#include <thrift/protocol/TDynamic.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * Reads the fields of struct index the plan keeps into value, reusing the
+ * items it already has, and skips the rest.  A field whose type on the
+ * wire is not the one in the schema is skipped too, as generated code does.
+ */
+template <class Protocol_>
+uint32_t TDecodePlan::readStruct(Protocol_* iprot, int32_t index, TDynamicValue& value) const {
+  const Struct& tstruct = structs_[index];
+  TDynamicValue::Items& items = value.items_;
+  value.type_ = T_STRUCT;
+
+  uint32_t xfer = 0;
+  std::string fname;
+  TType ftype;
+  int16_t fid;
+  size_t next = 0;
+  size_t count = 0;
+
+  xfer += iprot->readStructBegin(fname);
+  while (true) {
+    xfer += iprot->readFieldBegin(fname, ftype, fid);
+    if (ftype == T_STOP) {
+      break;
+    }
+    const Field* field = findField(tstruct, fid, next);
+    if (field != NULL && field->keep && field->ttype == ftype) {
+      if (count == items.size()) {
+        items.emplace_back();
+      }
+      TDynamicValue& item = items[count++];
+      item.id_ = fid;
+      xfer += readNode(iprot, field->node, item);
+    } else {
+      xfer += iprot->skip(ftype);
+    }
+    xfer += iprot->readFieldEnd();
+  }
+  xfer += iprot->readStructEnd();
+
+  items.resize(count);
+  return xfer;
+}
+
+template <class Protocol_>
+uint32_t TDecodePlan::readNode(Protocol_* iprot, int32_t index, TDynamicValue& value) const {
+  const Node& node = nodes_[index];
+  uint32_t xfer = 0;
+  value.type_ = node.ttype;
+
+  switch (node.ttype) {
+  case T_BOOL: {
+    bool v;
+    xfer += iprot->readBool(v);
+    value.i_ = v ? 1 : 0;
+    break;
+  }
+  case T_BYTE: {
+    int8_t v;
+    xfer += iprot->readByte(v);
+    value.i_ = v;
+    break;
+  }
+  case T_I16: {
+    int16_t v;
+    xfer += iprot->readI16(v);
+    value.i_ = v;
+    break;
+  }
+  case T_I32: {
+    int32_t v;
+    xfer += iprot->readI32(v);
+    value.i_ = v;
+    break;
+  }
+  case T_I64:
+    xfer += iprot->readI64(value.i_);
+    break;
+  case T_DOUBLE:
+    xfer += iprot->readDouble(value.d_);
+    break;
+  case T_STRING:
+    if (node.binary) {
+      xfer += iprot->readBinary(value.str_);
+    } else {
+      xfer += iprot->readString(value.str_);
+    }
+    break;
+  case T_STRUCT:
+    xfer += readStruct(iprot, node.index, value);
+    break;
+  case T_LIST:
+  case T_SET: {
+    TType etype;
+    uint32_t size;
+    if (node.ttype == T_LIST) {
+      xfer += iprot->readListBegin(etype, size);
+    } else {
+      xfer += iprot->readSetBegin(etype, size);
+    }
+    if (etype == nodes_[node.value].ttype) {
+      value.items_.resize(size);
+      for (uint32_t i = 0; i < size; ++i) {
+        xfer += readNode(iprot, node.value, value.items_[i]);
+      }
+    } else {
+      value.items_.clear();
+      for (uint32_t i = 0; i < size; ++i) {
+        xfer += iprot->skip(etype);
+      }
+    }
+    if (node.ttype == T_LIST) {
+      xfer += iprot->readListEnd();
+    } else {
+      xfer += iprot->readSetEnd();
+    }
+    break;
+  }
+  case T_MAP: {
+    TType ktype;
+    TType vtype;
+    uint32_t size;
+    xfer += iprot->readMapBegin(ktype, vtype, size);
+    if (ktype == nodes_[node.key].ttype && vtype == nodes_[node.value].ttype) {
+      value.items_.resize(2 * static_cast<size_t>(size));
+      for (uint32_t i = 0; i < size; ++i) {
+        xfer += readNode(iprot, node.key, value.items_[2 * i]);
+        xfer += readNode(iprot, node.value, value.items_[2 * i + 1]);
+      }
+    } else {
+      value.items_.clear();
+      for (uint32_t i = 0; i < size; ++i) {
+        xfer += iprot->skip(ktype);
+        xfer += iprot->skip(vtype);
+      }
+    }
+    xfer += iprot->readMapEnd();
+    break;
+  }
+  default:
+    throw TProtocolException(TProtocolException::INVALID_DATA);
+  }
+  return xfer;
+}
+
+/**
+ * Writes the fields of value that struct index keeps, in the order they
+ * are in value.
+ */
+template <class Protocol_>
+uint32_t TDecodePlan::writeStruct(Protocol_* oprot,
+                                  int32_t index,
+                                  const TDynamicValue& value) const {
+  const Struct& tstruct = structs_[index];
+  if (value.type_ != T_STRUCT) {
+    throw TProtocolException(TProtocolException::INVALID_DATA);
+  }
+
+  uint32_t xfer = 0;
+  size_t next = 0;
+  xfer += oprot->writeStructBegin(tstruct.name.c_str());
+  TDynamicValue::Items::const_iterator it;
+  for (it = value.items_.begin(); it != value.items_.end(); ++it) {
+    const Field* field = findField(tstruct, it->id_, next);
+    if (field == NULL || !field->keep) {
+      continue;
+    }
+    xfer += oprot->writeFieldBegin(field->name.c_str(), field->ttype, field->id);
+    xfer += writeNode(oprot, field->node, *it);
+    xfer += oprot->writeFieldEnd();
+  }
+  xfer += oprot->writeFieldStop();
+  xfer += oprot->writeStructEnd();
+  return xfer;
+}
+
+template <class Protocol_>
+uint32_t TDecodePlan::writeNode(Protocol_* oprot,
+                                int32_t index,
+                                const TDynamicValue& value) const {
+  const Node& node = nodes_[index];
+  if (value.type_ != node.ttype) {
+    throw TProtocolException(TProtocolException::INVALID_DATA);
+  }
+
+  uint32_t xfer = 0;
+  switch (node.ttype) {
+  case T_BOOL:
+    xfer += oprot->writeBool(value.i_ != 0);
+    break;
+  case T_BYTE:
+    xfer += oprot->writeByte(static_cast<int8_t>(value.i_));
+    break;
+  case T_I16:
+    xfer += oprot->writeI16(static_cast<int16_t>(value.i_));
+    break;
+  case T_I32:
+    xfer += oprot->writeI32(static_cast<int32_t>(value.i_));
+    break;
+  case T_I64:
+    xfer += oprot->writeI64(value.i_);
+    break;
+  case T_DOUBLE:
+    xfer += oprot->writeDouble(value.d_);
+    break;
+  case T_STRING:
+    if (node.binary) {
+      xfer += oprot->writeBinary(value.str_);
+    } else {
+      xfer += oprot->writeString(value.str_);
+    }
+    break;
+  case T_STRUCT:
+    xfer += writeStruct(oprot, node.index, value);
+    break;
+  case T_LIST:
+  case T_SET: {
+    uint32_t size = static_cast<uint32_t>(value.items_.size());
+    TType etype = nodes_[node.value].ttype;
+    if (node.ttype == T_LIST) {
+      xfer += oprot->writeListBegin(etype, size);
+    } else {
+      xfer += oprot->writeSetBegin(etype, size);
+    }
+    for (uint32_t i = 0; i < size; ++i) {
+      xfer += writeNode(oprot, node.value, value.items_[i]);
+    }
+    if (node.ttype == T_LIST) {
+      xfer += oprot->writeListEnd();
+    } else {
+      xfer += oprot->writeSetEnd();
+    }
+    break;
+  }
+  case T_MAP: {
+    uint32_t size = static_cast<uint32_t>(value.items_.size() / 2);
+    xfer += oprot->writeMapBegin(nodes_[node.key].ttype, nodes_[node.value].ttype, size);
+    for (uint32_t i = 0; i < size; ++i) {
+      xfer += writeNode(oprot, node.key, value.items_[2 * i]);
+      xfer += writeNode(oprot, node.value, value.items_[2 * i + 1]);
+    }
+    xfer += oprot->writeMapEnd();
+    break;
+  }
+  default:
+    throw TProtocolException(TProtocolException::INVALID_DATA);
+  }
+  return xfer;
+}
+
+}}} // apache::thrift::protocol
+
+#endif // #ifndef _THRIFT_PROTOCOL_TDYNAMIC_TCC_
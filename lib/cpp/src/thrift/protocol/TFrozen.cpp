@@ -0,0 +1,87 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+#include <thrift/protocol/TFrozen.h>
+#include <thrift/transport/TTransportException.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+using apache::thrift::transport::TTransportException;
+
+TFrozenFile::TFrozenFile(const std::string& path, bool populate) : data_(NULL), size_(0) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    int errno_copy = errno;
+    throw TTransportException(TTransportException::NOT_OPEN,
+                              "TFrozenFile: could not open " + path,
+                              errno_copy);
+  }
+
+  struct stat f_info;
+  if (fstat(fd, &f_info) < 0) {
+    int errno_copy = errno;
+    ::close(fd);
+    throw TTransportException(TTransportException::UNKNOWN, "TFrozenFile (fstat)", errno_copy);
+  }
+  if (static_cast<uint64_t>(f_info.st_size) > (std::numeric_limits<size_t>::max)()) {
+    ::close(fd);
+    throw TTransportException("TFrozenFile: file too large to map");
+  }
+  size_ = static_cast<size_t>(f_info.st_size);
+
+  // An empty file can't be mapped; frozenRoot() rejects it anyway
+  if (size_ > 0) {
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (populate) {
+      flags |= MAP_POPULATE;
+    }
+#endif
+    void* map = mmap(NULL, size_, PROT_READ, flags, fd, 0);
+    if (map == MAP_FAILED) {
+      int errno_copy = errno;
+      ::close(fd);
+      GlobalOutput.perror("TFrozenFile: mmap() ", errno_copy);
+      throw TTransportException(TTransportException::UNKNOWN, "TFrozenFile (mmap)", errno_copy);
+    }
+    data_ = static_cast<const uint8_t*>(map);
+#ifndef MAP_POPULATE
+    if (populate) {
+      madvise(map, size_, MADV_WILLNEED);
+    }
+#endif
+  }
+  // The mapping holds the file open
+  ::close(fd);
+}
+
+TFrozenFile::~TFrozenFile() {
+  if (data_ != NULL) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+}
+
+}}} // apache::thrift::protocol
@@ -0,0 +1,624 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TFROZEN_H_
+#define _THRIFT_PROTOCOL_TFROZEN_H_ 1
+
+#include <string.h>
+#include <limits>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <thrift/protocol/TProtocol.h>
+
+/**
+ * The frozen format, written by code generated with the frozen option, is
+ * read in place: a struct's <name>_view reads its fields straight out of
+ * the buffer, which is typically a file mapped with TFrozenFile, so there
+ * is nothing to decode before the first lookup and nothing copied after.
+ *
+ * A buffer starts with the four bytes "TFZ1" and the offset of the root
+ * struct.  A struct is a count of slots, then one slot for each field, in
+ * id order, holding the offset of the field's value, or 0 if it is unset.
+ * Numbers are little endian at their natural width, bools and bytes one
+ * byte, enums four.  A string is a four byte length and its bytes.  A list
+ * or set is a four byte count, its top bit set if the elements are sorted,
+ * then the elements; numbers are stored in the list itself, and anything
+ * else as the offset of its value.  A map is the count, then the keys as a
+ * list's elements, then the values.  Offsets are four bytes, counted
+ * forward from where they are stored, so a buffer is at most 4GB.
+ *
+ * Nothing is aligned: loads are unaligned, which costs nothing on the
+ * machines this is meant for.  A reader may have fewer or more fields than
+ * the writer, as long as fields are only added with ids above the existing
+ * ones: slots it does not know are never looked at, and slots the writer
+ * did not have read as unset.  Every offset and length is checked against
+ * the buffer as it is followed, so a damaged file throws a
+ * TProtocolException rather than reading out of bounds.
+ */
+
+namespace apache { namespace thrift { namespace protocol {
+
+namespace detail { namespace frozen {
+
+/// The top bit of a list or map count, set if the elements are sorted
+const uint32_t SORTED = 0x80000000U;
+
+inline uint16_t load16(const uint8_t* p) {
+#if __THRIFT_BYTE_ORDER == __THRIFT_LITTLE_ENDIAN
+  uint16_t v;
+  memcpy(&v, p, 2);
+  return v;
+#else
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+#endif
+}
+
+inline uint32_t load32(const uint8_t* p) {
+#if __THRIFT_BYTE_ORDER == __THRIFT_LITTLE_ENDIAN
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+#else
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+#endif
+}
+
+inline uint64_t load64(const uint8_t* p) {
+#if __THRIFT_BYTE_ORDER == __THRIFT_LITTLE_ENDIAN
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+#else
+  return static_cast<uint64_t>(load32(p)) | (static_cast<uint64_t>(load32(p + 4)) << 32);
+#endif
+}
+
+inline void store16(uint8_t* p, uint16_t v) {
+  p[0] = static_cast<uint8_t>(v);
+  p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+inline void store32(uint8_t* p, uint32_t v) {
+#if __THRIFT_BYTE_ORDER == __THRIFT_LITTLE_ENDIAN
+  memcpy(p, &v, 4);
+#else
+  for (int i = 0; i < 4; ++i) {
+    p[i] = static_cast<uint8_t>(v >> (8 * i));
+  }
+#endif
+}
+
+inline void store64(uint8_t* p, uint64_t v) {
+  store32(p, static_cast<uint32_t>(v));
+  store32(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+inline void check(size_t size, uint64_t at, uint64_t len) {
+  if (at + len > size) {
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "frozen offset past the end of the buffer");
+  }
+}
+
+/// The target of the offset stored at at, or 0 for none
+inline uint32_t follow(const uint8_t* data, size_t size, uint32_t at) {
+  uint32_t rel = load32(data + at);
+  if (rel == 0) {
+    return 0;
+  }
+  uint64_t target = static_cast<uint64_t>(at) + rel;
+  check(size, target, 0);
+  return static_cast<uint32_t>(target);
+}
+
+}} // detail::frozen
+
+/**
+ * Builds a frozen buffer.  Generated writeFrozen() methods append a struct
+ * and return its offset, which goes to finish() for the root.
+ */
+class TFrozenWriter {
+ public:
+  TFrozenWriter() : buf_("TFZ1\0\0\0\0", 8) {}
+
+  /// Appends a struct of slots fields, all unset, and returns its offset
+  uint32_t beginStruct(uint32_t slots) {
+    uint32_t at = grow(4 + 4 * static_cast<uint64_t>(slots));
+    detail::frozen::store32(ptr(at), slots);
+    return at;
+  }
+
+  /// Points slot of the struct at table at the value at target
+  void setSlot(uint32_t table, uint32_t slot, uint32_t target) {
+    putOffset(table + 4 + 4 * slot, target);
+  }
+
+  /// Appends a list or set of count elements width bytes wide
+  uint32_t beginList(uint32_t count, uint32_t width, bool sorted = false) {
+    return beginContainer(count, static_cast<uint64_t>(count) * width, sorted);
+  }
+
+  /// Appends a map of count keys and values, keys first
+  uint32_t beginMap(uint32_t count, uint32_t keyWidth, uint32_t valueWidth, bool sorted = false) {
+    return beginContainer(count, static_cast<uint64_t>(count) * (keyWidth + valueWidth), sorted);
+  }
+
+  /// The offset of the first element of a list, set or map
+  static uint32_t elements(uint32_t container) { return container + 4; }
+
+  uint32_t writeBool(bool value) { return writeByte(value ? 1 : 0); }
+
+  uint32_t writeByte(int8_t byte) {
+    uint32_t at = grow(1);
+    putByte(at, byte);
+    return at;
+  }
+
+  uint32_t writeI16(int16_t i16) {
+    uint32_t at = grow(2);
+    putI16(at, i16);
+    return at;
+  }
+
+  uint32_t writeI32(int32_t i32) {
+    uint32_t at = grow(4);
+    putI32(at, i32);
+    return at;
+  }
+
+  uint32_t writeI64(int64_t i64) {
+    uint32_t at = grow(8);
+    putI64(at, i64);
+    return at;
+  }
+
+  uint32_t writeDouble(double dub) {
+    uint32_t at = grow(8);
+    putDouble(at, dub);
+    return at;
+  }
+
+  uint32_t writeString(const char* data, size_t len) {
+    if (len > std::numeric_limits<uint32_t>::max()) {
+      throw TProtocolException(TProtocolException::SIZE_LIMIT);
+    }
+    uint32_t at = grow(4 + static_cast<uint64_t>(len));
+    detail::frozen::store32(ptr(at), static_cast<uint32_t>(len));
+    if (len > 0) {
+      memcpy(ptr(at + 4), data, len);
+    }
+    return at;
+  }
+
+  uint32_t writeString(const std::string& str) { return writeString(str.data(), str.size()); }
+
+  // Elements of lists and maps, and the slots, are filled in with these
+
+  void putBool(uint32_t at, bool value) { putByte(at, value ? 1 : 0); }
+
+  void putByte(uint32_t at, int8_t byte) { *ptr(at) = static_cast<uint8_t>(byte); }
+
+  void putI16(uint32_t at, int16_t i16) {
+    detail::frozen::store16(ptr(at), static_cast<uint16_t>(i16));
+  }
+
+  void putI32(uint32_t at, int32_t i32) {
+    detail::frozen::store32(ptr(at), static_cast<uint32_t>(i32));
+  }
+
+  void putI64(uint32_t at, int64_t i64) {
+    detail::frozen::store64(ptr(at), static_cast<uint64_t>(i64));
+  }
+
+  void putDouble(uint32_t at, double dub) {
+    detail::frozen::store64(ptr(at), bitwise_cast<uint64_t>(dub));
+  }
+
+  void putI32s(uint32_t at, const int32_t* values, uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i, at += 4) {
+      putI32(at, values[i]);
+    }
+  }
+
+  void putI64s(uint32_t at, const int64_t* values, uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i, at += 8) {
+      putI64(at, values[i]);
+    }
+  }
+
+  void putDoubles(uint32_t at, const double* values, uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i, at += 8) {
+      putDouble(at, values[i]);
+    }
+  }
+
+  /// Stores at at the offset of target, which must have been written later
+  void putOffset(uint32_t at, uint32_t target) {
+    detail::frozen::store32(ptr(at), target - at);
+  }
+
+  /// Makes the struct at root the root of the buffer
+  void finish(uint32_t root) { putOffset(4, root); }
+
+  const std::string& getBuffer() const { return buf_; }
+
+  /// Empties the buffer for another root, keeping its storage
+  void reset() { buf_.resize(8); }
+
+ private:
+  uint32_t beginContainer(uint32_t count, uint64_t len, bool sorted) {
+    if (count >= detail::frozen::SORTED) {
+      throw TProtocolException(TProtocolException::SIZE_LIMIT);
+    }
+    uint32_t at = grow(4 + len);
+    detail::frozen::store32(ptr(at), count | (sorted ? detail::frozen::SORTED : 0));
+    return at;
+  }
+
+  uint32_t grow(uint64_t len) {
+    uint64_t at = buf_.size();
+    if (at + len > std::numeric_limits<uint32_t>::max()) {
+      throw TProtocolException(TProtocolException::SIZE_LIMIT,
+                               "a frozen buffer is limited to 4GB");
+    }
+    buf_.resize(static_cast<size_t>(at + len));
+    return static_cast<uint32_t>(at);
+  }
+
+  uint8_t* ptr(uint32_t at) { return reinterpret_cast<uint8_t*>(&buf_[0]) + at; }
+
+  std::string buf_;
+};
+
+/**
+ * A string or binary field of a frozen struct: a pointer into the buffer
+ * and a length.  It converts from std::string for lookups.
+ */
+class TFrozenString {
+ public:
+  TFrozenString() : data_(""), size_(0) {}
+  TFrozenString(const char* str) : data_(str), size_(static_cast<uint32_t>(strlen(str))) {}
+  TFrozenString(const std::string& str)
+    : data_(str.data()), size_(static_cast<uint32_t>(str.size())) {}
+  TFrozenString(const char* data, uint32_t size) : data_(data), size_(size) {}
+
+  TFrozenString(const uint8_t* data, size_t size, uint32_t at) {
+    detail::frozen::check(size, at, 4);
+    size_ = detail::frozen::load32(data + at);
+    detail::frozen::check(size, at + 4, size_);
+    data_ = reinterpret_cast<const char*>(data + at + 4);
+  }
+
+  const char* data() const { return data_; }
+  uint32_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  char operator[](uint32_t i) const { return data_[i]; }
+
+  std::string str() const { return std::string(data_, size_); }
+
+  int compare(const TFrozenString& other) const {
+    int c = memcmp(data_, other.data_, size_ < other.size_ ? size_ : other.size_);
+    if (c != 0) {
+      return c;
+    }
+    return size_ < other.size_ ? -1 : (size_ > other.size_ ? 1 : 0);
+  }
+
+  bool operator==(const TFrozenString& other) const {
+    return size_ == other.size_ && memcmp(data_, other.data_, size_) == 0;
+  }
+  bool operator!=(const TFrozenString& other) const { return !(*this == other); }
+  bool operator<(const TFrozenString& other) const { return compare(other) < 0; }
+
+ private:
+  const char* data_;
+  uint32_t size_;
+};
+
+/**
+ * How the elements of frozen lists and maps are stored and read: numbers
+ * in place, anything else, a view, through an offset.
+ */
+template <class T>
+struct TFrozenTraits {
+  static const uint32_t width = 4;
+  static T load(const uint8_t* data, size_t size, uint32_t at) {
+    uint32_t target = detail::frozen::follow(data, size, at);
+    return target ? T(data, size, target) : T();
+  }
+};
+
+#define THRIFT_FROZEN_NUMBER(type, bytes, expr)                                   \
+  template <>                                                                     \
+  struct TFrozenTraits<type> {                                                    \
+    static const uint32_t width = bytes;                                          \
+    static type load(const uint8_t* data, size_t, uint32_t at) {                  \
+      const uint8_t* p = data + at;                                               \
+      return expr;                                                                \
+    }                                                                             \
+  };
+
+THRIFT_FROZEN_NUMBER(bool, 1, *p != 0)
+THRIFT_FROZEN_NUMBER(int8_t, 1, static_cast<int8_t>(*p))
+THRIFT_FROZEN_NUMBER(int16_t, 2, static_cast<int16_t>(detail::frozen::load16(p)))
+THRIFT_FROZEN_NUMBER(int32_t, 4, static_cast<int32_t>(detail::frozen::load32(p)))
+THRIFT_FROZEN_NUMBER(int64_t, 8, static_cast<int64_t>(detail::frozen::load64(p)))
+THRIFT_FROZEN_NUMBER(double, 8, bitwise_cast<double>(detail::frozen::load64(p)))
+
+#undef THRIFT_FROZEN_NUMBER
+
+/**
+ * A list or set field of a frozen struct.  Elements come by value: numbers,
+ * TFrozenStrings, or views.  indexOf() is a binary search in a set written
+ * from an ordered container, and a scan otherwise.
+ */
+template <class T>
+class TFrozenList {
+ public:
+  typedef TFrozenTraits<T> Traits;
+
+  class const_iterator {
+   public:
+    const_iterator(const TFrozenList* list, uint32_t i) : list_(list), i_(i) {}
+    T operator*() const { return (*list_)[i_]; }
+    const_iterator& operator++() {
+      ++i_;
+      return *this;
+    }
+    bool operator==(const const_iterator& other) const { return i_ == other.i_; }
+    bool operator!=(const const_iterator& other) const { return i_ != other.i_; }
+
+   private:
+    const TFrozenList* list_;
+    uint32_t i_;
+  };
+
+  TFrozenList() : data_(NULL), size_(0), elems_(0), count_(0), sorted_(false) {}
+
+  TFrozenList(const uint8_t* data, size_t size, uint32_t at) : data_(data), size_(size) {
+    detail::frozen::check(size, at, 4);
+    uint32_t count = detail::frozen::load32(data + at);
+    count_ = count & ~detail::frozen::SORTED;
+    sorted_ = (count & detail::frozen::SORTED) != 0;
+    elems_ = at + 4;
+    detail::frozen::check(size, elems_, static_cast<uint64_t>(count_) * Traits::width);
+  }
+
+  uint32_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+
+  T operator[](uint32_t i) const { return Traits::load(data_, size_, elems_ + i * Traits::width); }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, count_); }
+
+  /// The position of value, or size() if it is not there
+  uint32_t indexOf(const T& value) const {
+    if (sorted_) {
+      uint32_t lo = 0;
+      uint32_t hi = count_;
+      while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if ((*this)[mid] < value) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      return lo < count_ && (*this)[lo] == value ? lo : count_;
+    }
+    for (uint32_t i = 0; i < count_; ++i) {
+      if ((*this)[i] == value) {
+        return i;
+      }
+    }
+    return count_;
+  }
+
+  bool contains(const T& value) const { return indexOf(value) < count_; }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  uint32_t elems_;
+  uint32_t count_;
+  bool sorted_;
+};
+
+/**
+ * A map field of a frozen struct.  The keys are kept apart from the values,
+ * so the binary search of indexOf() only touches keys.
+ */
+template <class K, class V>
+class TFrozenMap {
+ public:
+  TFrozenMap() : data_(NULL), size_(0), keys_(0), values_(0), count_(0), sorted_(false) {}
+
+  TFrozenMap(const uint8_t* data, size_t size, uint32_t at) : data_(data), size_(size) {
+    detail::frozen::check(size, at, 4);
+    uint32_t count = detail::frozen::load32(data + at);
+    count_ = count & ~detail::frozen::SORTED;
+    sorted_ = (count & detail::frozen::SORTED) != 0;
+    keys_ = at + 4;
+    values_ = keys_ + count_ * TFrozenTraits<K>::width;
+    detail::frozen::check(size,
+                          keys_,
+                          static_cast<uint64_t>(count_) *
+                            (TFrozenTraits<K>::width + TFrozenTraits<V>::width));
+  }
+
+  uint32_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+
+  K keyAt(uint32_t i) const {
+    return TFrozenTraits<K>::load(data_, size_, keys_ + i * TFrozenTraits<K>::width);
+  }
+
+  V valueAt(uint32_t i) const {
+    return TFrozenTraits<V>::load(data_, size_, values_ + i * TFrozenTraits<V>::width);
+  }
+
+  /// The position of key, or size() if it is not there
+  uint32_t indexOf(const K& key) const {
+    if (sorted_) {
+      uint32_t lo = 0;
+      uint32_t hi = count_;
+      while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (keyAt(mid) < key) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      return lo < count_ && keyAt(lo) == key ? lo : count_;
+    }
+    for (uint32_t i = 0; i < count_; ++i) {
+      if (keyAt(i) == key) {
+        return i;
+      }
+    }
+    return count_;
+  }
+
+  bool contains(const K& key) const { return indexOf(key) < count_; }
+
+  /// Looks key up, leaving its value in value if it is there
+  bool find(const K& key, V& value) const {
+    uint32_t i = indexOf(key);
+    if (i == count_) {
+      return false;
+    }
+    value = valueAt(i);
+    return true;
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  uint32_t keys_;
+  uint32_t values_;
+  uint32_t count_;
+  bool sorted_;
+};
+
+/**
+ * The base of the generated <name>_view classes, which read a frozen
+ * struct's fields in place.  A default constructed view, like that of an
+ * unset struct field, has every field unset.
+ */
+class TFrozenStruct {
+ public:
+  TFrozenStruct() : data_(NULL), size_(0), table_(0), slots_(0) {}
+
+  TFrozenStruct(const uint8_t* data, size_t size, uint32_t table)
+    : data_(data), size_(size), table_(table) {
+    detail::frozen::check(size, table, 4);
+    slots_ = detail::frozen::load32(data + table);
+    detail::frozen::check(size, table + 4, 4 * static_cast<uint64_t>(slots_));
+  }
+
+  /// True if this is the view of nothing
+  bool isNull() const { return data_ == NULL; }
+
+ protected:
+  /// Where the value of slot is, if width bytes of it fit, or 0 if unset
+  uint32_t locate(uint32_t slot, uint32_t width) const {
+    if (slot >= slots_) {
+      return 0;
+    }
+    uint32_t at = detail::frozen::follow(data_, size_, table_ + 4 + 4 * slot);
+    if (at != 0) {
+      detail::frozen::check(size_, at, width);
+    }
+    return at;
+  }
+
+  bool isSet(uint32_t slot) const { return locate(slot, 0) != 0; }
+
+  template <class T>
+  T load(uint32_t slot, T dflt) const {
+    uint32_t at = locate(slot, TFrozenTraits<T>::width);
+    return at ? TFrozenTraits<T>::load(data_, size_, at) : dflt;
+  }
+
+  /// A string, list, map or struct, which is empty if unset
+  template <class T>
+  T loadView(uint32_t slot) const {
+    uint32_t at = locate(slot, 0);
+    return at ? T(data_, size_, at) : T();
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  uint32_t table_;
+  uint32_t slots_;
+};
+
+/**
+ * The root struct of a frozen buffer, as a View, which is one of the
+ * generated <name>_view classes.
+ */
+template <class View>
+View frozenRoot(const void* buffer, size_t size) {
+  const uint8_t* data = static_cast<const uint8_t*>(buffer);
+  if (size < 8 || memcmp(data, "TFZ1", 4) != 0) {
+    throw TProtocolException(TProtocolException::INVALID_DATA, "not a frozen buffer");
+  }
+  uint32_t root = detail::frozen::follow(data, size, 4);
+  if (root == 0) {
+    throw TProtocolException(TProtocolException::INVALID_DATA, "frozen buffer has no root");
+  }
+  return View(data, size, root);
+}
+
+/**
+ * A file mapped read only, for frozen data.  Nothing is read until it is
+ * looked at, so opening a large file costs no more than a small one, and
+ * the pages are shared with every other process mapping the same file.
+ * The views it hands out must not outlive it.
+ */
+class TFrozenFile : boost::noncopyable {
+ public:
+  /**
+   * Maps path.
+   *
+   * @param populate Fault the whole file in now, rather than on first use
+   */
+  explicit TFrozenFile(const std::string& path, bool populate = false);
+  ~TFrozenFile();
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  template <class View>
+  View root() const {
+    return frozenRoot<View>(data_, size_);
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+};
+
+}}} // apache::thrift::protocol
+
+#endif // #define _THRIFT_PROTOCOL_TFROZEN_H_
@@ -0,0 +1,147 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/protocol/THeaderProtocol.h>
+#include <thrift/TTrace.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/protocol/TJSONProtocol.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+using boost::shared_ptr;
+using transport::THeaderTransport;
+
+namespace {
+
+shared_ptr<TProtocol> makeProtocol(const shared_ptr<THeaderTransport>& trans,
+                                   uint16_t protocolId) {
+  switch (protocolId) {
+  case THeaderTransport::T_BINARY_PROTOCOL:
+    return shared_ptr<TProtocol>(new TBinaryProtocolT<THeaderTransport>(trans));
+  case THeaderTransport::T_COMPACT_PROTOCOL:
+    return shared_ptr<TProtocol>(new TCompactProtocolT<THeaderTransport>(trans));
+  case THeaderTransport::T_JSON_PROTOCOL:
+    return shared_ptr<TProtocol>(new TJSONProtocol(trans));
+  default:
+    throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+                             "THeaderProtocol: unknown protocol id");
+  }
+}
+
+}
+
+THeaderProtocol::THeaderProtocol(shared_ptr<THeaderTransport> trans,
+                                 uint16_t protocolId)
+  : TProtocolDecorator(makeProtocol(trans, protocolId)),
+    trans_(trans),
+    protocolId_(protocolId),
+    traceHeaders_(false) {
+  trans_->setProtocolId(protocolId);
+  protocols_[protocolId] = protocol;
+}
+
+void THeaderProtocol::useProtocol(uint16_t protocolId) {
+  if (protocolId == protocolId_) {
+    return;
+  }
+  shared_ptr<TProtocol>& cached = protocols_[protocolId];
+  if (!cached) {
+    try {
+      cached = makeProtocol(trans_, protocolId);
+    } catch (...) {
+      protocols_.erase(protocolId);
+      throw;
+    }
+  }
+  protocol = cached;
+  protocolId_ = protocolId;
+}
+
+uint32_t THeaderProtocol::readMessageBegin_virt(std::string& name,
+                                                TMessageType& messageType,
+                                                int32_t& seqid) {
+  trans_->readFrameIfNeeded();
+  useProtocol(trans_->getProtocolId());
+  uint32_t size = protocol->readMessageBegin(name, messageType, seqid);
+  if (messageType == T_CALL || messageType == T_ONEWAY) {
+    TTraceContext::received(trans_->getReadHeaders());
+  }
+  return size;
+}
+
+uint32_t THeaderProtocol::writeMessageBegin_virt(const std::string& name,
+                                                 const TMessageType messageType,
+                                                 const int32_t seqid) {
+  useProtocol(trans_->getProtocolId());
+  trans_->setSequenceId(seqid);
+  if (messageType == T_CALL || messageType == T_ONEWAY) {
+    writeTrace();
+  }
+  return protocol->writeMessageBegin(name, messageType, seqid);
+}
+
+void THeaderProtocol::writeTrace() {
+  TTraceContext trace = TTraceContext::current();
+  if (trace.valid()) {
+    TTraceContext::HeaderMap headers;
+    trace.writeHeaders(headers);
+    for (TTraceContext::HeaderMap::const_iterator it = headers.begin();
+         it != headers.end(); ++it) {
+      trans_->setHeader(it->first, it->second);
+    }
+    traceHeaders_ = true;
+  } else if (traceHeaders_) {
+    trans_->removeHeader(TTraceContext::TRACE_ID_HEADER);
+    trans_->removeHeader(TTraceContext::SPAN_ID_HEADER);
+    trans_->removeHeader(TTraceContext::SAMPLED_HEADER);
+    traceHeaders_ = false;
+  }
+}
+
+shared_ptr<TProtocol> THeaderProtocolFactory::getProtocol(
+    shared_ptr<transport::TTransport> trans) {
+  concurrency::Guard g(mutex_);
+
+  UnpairedMap::iterator it = unpaired_.find(trans.get());
+  if (it != unpaired_.end()) {
+    shared_ptr<THeaderProtocol> paired = it->second.lock();
+    unpaired_.erase(it);
+    if (paired) {
+      return paired;
+    }
+  }
+
+  // Forget protocols whose other half was never asked for
+  for (it = unpaired_.begin(); it != unpaired_.end(); ) {
+    if (it->second.expired()) {
+      unpaired_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  shared_ptr<THeaderTransport> header(new THeaderTransport(trans));
+  header->setTransforms(transforms_);
+  shared_ptr<THeaderProtocol> result(new THeaderProtocol(header, protocolId_));
+  unpaired_[trans.get()] = result;
+  return result;
+}
+
+}}} // apache::thrift::protocol
@@ -0,0 +1,113 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_THEADERPROTOCOL_H_
+#define _THRIFT_PROTOCOL_THEADERPROTOCOL_H_ 1
+
+#include <map>
+#include <boost/weak_ptr.hpp>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/protocol/TProtocolDecorator.h>
+#include <thrift/transport/THeaderTransport.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * The protocol for a THeaderTransport: each message is read and written
+ * with the protocol the transport's frame names, binary, compact or JSON.
+ * A server using it answers each client in the protocol it spoke.
+ *
+ * It also carries the thread's TTraceContext: calls written send its ids
+ * in the frame's headers, and calls read keep what came with them for
+ * processor::TTraceEventHandler.
+ */
+class THeaderProtocol : public TProtocolDecorator {
+ public:
+  explicit THeaderProtocol(
+    boost::shared_ptr<transport::THeaderTransport> trans,
+    uint16_t protocolId = transport::THeaderTransport::T_BINARY_PROTOCOL);
+
+  virtual ~THeaderProtocol() {}
+
+  uint32_t readMessageBegin_virt(std::string& name,
+                                 TMessageType& messageType,
+                                 int32_t& seqid);
+
+  uint32_t writeMessageBegin_virt(const std::string& name,
+                                  const TMessageType messageType,
+                                  const int32_t seqid);
+
+  boost::shared_ptr<transport::THeaderTransport> getHeaderTransport() {
+    return trans_;
+  }
+
+ private:
+  /// Switches to protocolId for the message that follows
+  void useProtocol(uint16_t protocolId);
+
+  /// Puts the thread's trace in the headers of the call about to be written
+  void writeTrace();
+
+  boost::shared_ptr<transport::THeaderTransport> trans_;
+  uint16_t protocolId_;
+  /// Whether the headers hold a trace, to be taken out when there is none
+  bool traceHeaders_;
+
+  /// The protocols used so far, kept for the next message using them
+  std::map<uint16_t, boost::shared_ptr<TProtocol> > protocols_;
+};
+
+/**
+ * Makes THeaderProtocols, each over a THeaderTransport of its own.
+ *
+ * The protocol has to read and write through the same THeaderTransport to
+ * answer in the form it was asked, so when the same transport is passed
+ * twice, as TSimpleServer, TThreadedServer and TThreadPoolServer do for
+ * their input and output protocols, the second call returns what the
+ * first one made.  For TNonblockingServer use setHeaderTransport() instead.
+ */
+class THeaderProtocolFactory : public TProtocolFactory {
+ public:
+  explicit THeaderProtocolFactory(
+    uint16_t protocolId = transport::THeaderTransport::T_BINARY_PROTOCOL)
+    : protocolId_(protocolId) {}
+
+  virtual ~THeaderProtocolFactory() {}
+
+  /// Accept transform id, applying and undoing it with what factory makes
+  void setTransform(uint16_t id, boost::shared_ptr<transport::TTransportFactory> factory) {
+    transforms_[id] = factory;
+  }
+
+  boost::shared_ptr<TProtocol> getProtocol(boost::shared_ptr<transport::TTransport> trans);
+
+ private:
+  typedef std::map<transport::TTransport*, boost::weak_ptr<THeaderProtocol> > UnpairedMap;
+
+  uint16_t protocolId_;
+  transport::THeaderTransport::TransformMap transforms_;
+
+  /// Protocols made once, waiting for the other direction to ask
+  UnpairedMap unpaired_;
+  concurrency::Mutex mutex_;
+};
+
+}}} // apache::thrift::protocol
+
+#endif // #ifndef _THRIFT_PROTOCOL_THEADERPROTOCOL_H_
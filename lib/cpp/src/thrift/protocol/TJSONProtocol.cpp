@@ -20,8 +20,9 @@
 #include <thrift/protocol/TJSONProtocol.h>
 
 #include <math.h>
-#include <boost/lexical_cast.hpp>
+#include <thrift/TAllocTracking.h>
 #include <thrift/protocol/TBase64Utils.h>
+#include <thrift/protocol/TJSONUtils.h>
 #include <thrift/transport/TTransportException.h>
 
 using namespace apache::thrift::transport;
@@ -43,8 +44,6 @@ static const uint8_t kJSONStringDelimiter = '"';
 static const uint8_t kJSONZeroChar = '0';
 static const uint8_t kJSONEscapeChar = 'u';
 
-static const std::string kJSONEscapePrefix("\\u00");
-
 static const uint32_t kThriftVersion1 = 1;
 
 static const std::string kThriftNan("NaN");
@@ -146,18 +145,6 @@ static TType getTypeIDForTypeName(const std::string &name) {
 }
 
 
-// This table describes the handling for the first 0x30 characters
-//  0 : escape using "\u00xx" notation
-//  1 : just output index
-// <other> : escape using "\<other>" notation
-static const uint8_t kJSONCharTable[0x30] = {
-//  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
-    0,  0,  0,  0,  0,  0,  0,  0,'b','t','n',  0,'f','r',  0,  0, // 0
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 1
-    1,  1,'"',  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 2
-};
-
-
 // This string's characters must match up with the elements in kEscapeCharVals.
 // I don't have '/' on this list even though it appears on www.json.org --
 // it is not in the RFC
@@ -203,42 +190,6 @@ static uint8_t hexVal(uint8_t ch) {
   }
 }
 
-// Return the hex character representing the integer val. The value is masked
-// to make sure it is in the correct range.
-static uint8_t hexChar(uint8_t val) {
-  val &= 0x0F;
-  if (val < 10) {
-    return val + '0';
-  }
-  else {
-    return val - 10 + 'a';
-  }
-}
-
-// Return true if the character ch is in [-+0-9.Ee]; false otherwise
-static bool isJSONNumeric(uint8_t ch) {
-  switch (ch) {
-  case '+':
-  case '-':
-  case '.':
-  case '0':
-  case '1':
-  case '2':
-  case '3':
-  case '4':
-  case '5':
-  case '6':
-  case '7':
-  case '8':
-  case '9':
-  case 'E':
-  case 'e':
-    return true;
-  }
-  return false;
-}
-
-
 /**
  * Class to serve as base JSON context and as base class for other context
  * implementations
@@ -377,59 +328,16 @@ void TJSONProtocol::popContext() {
   contexts_.pop();
 }
 
-// Write the character ch as a JSON escape sequence ("\u00xx")
-uint32_t TJSONProtocol::writeJSONEscapeChar(uint8_t ch) {
-  trans_->write((const uint8_t *)kJSONEscapePrefix.c_str(),
-                static_cast<uint32_t>(kJSONEscapePrefix.length()));
-  uint8_t outCh = hexChar(ch >> 4);
-  trans_->write(&outCh, 1);
-  outCh = hexChar(ch);
-  trans_->write(&outCh, 1);
-  return 6;
-}
-
-// Write the character ch as part of a JSON string, escaping as appropriate.
-uint32_t TJSONProtocol::writeJSONChar(uint8_t ch) {
-  if (ch >= 0x30) {
-    if (ch == kJSONBackslash) { // Only special character >= 0x30 is '\'
-      trans_->write(&kJSONBackslash, 1);
-      trans_->write(&kJSONBackslash, 1);
-      return 2;
-    }
-    else {
-      trans_->write(&ch, 1);
-      return 1;
-    }
-  }
-  else {
-    uint8_t outCh = kJSONCharTable[ch];
-    // Check if regular character, backslash escaped, or JSON escaped
-    if (outCh == 1) {
-      trans_->write(&ch, 1);
-      return 1;
-    }
-    else if (outCh > 1) {
-      trans_->write(&kJSONBackslash, 1);
-      trans_->write(&outCh, 1);
-      return 2;
-    }
-    else {
-      return writeJSONEscapeChar(ch);
-    }
-  }
-}
-
 // Write out the contents of the string str as a JSON string, escaping
 // characters as appropriate.
 uint32_t TJSONProtocol::writeJSONString(const std::string &str) {
   uint32_t result = context_->write(*trans_);
   result += 2; // For quotes
   trans_->write(&kJSONStringDelimiter, 1);
-  std::string::const_iterator iter(str.begin());
-  std::string::const_iterator end(str.end());
-  while (iter != end) {
-    result += writeJSONChar(*iter++);
-  }
+  if(str.length() > (std::numeric_limits<uint32_t>::max)())
+    throw TProtocolException(TProtocolException::SIZE_LIMIT);
+  result += writeJSONChars(*trans_, (const uint8_t *)str.data(),
+                           static_cast<uint32_t>(str.length()));
   trans_->write(&kJSONStringDelimiter, 1);
   return result;
 }
@@ -440,23 +348,21 @@ uint32_t TJSONProtocol::writeJSONBase64(const std::string &str) {
   uint32_t result = context_->write(*trans_);
   result += 2; // For quotes
   trans_->write(&kJSONStringDelimiter, 1);
-  uint8_t b[4];
   const uint8_t *bytes = (const uint8_t *)str.c_str();
   if(str.length() > (std::numeric_limits<uint32_t>::max)())
     throw TProtocolException(TProtocolException::SIZE_LIMIT);
   uint32_t len = static_cast<uint32_t>(str.length());
-  while (len >= 3) {
-    // Encode 3 bytes at a time
-    base64_encode(bytes, 3, b);
-    trans_->write(b, 4);
-    result += 4;
-    bytes += 3;
-    len -=3;
-  }
-  if (len) { // Handle remainder
-    base64_encode(bytes, len, b);
-    trans_->write(b, len + 1);
-    result += len + 1;
+  // Encode a few kilobytes at a time, so the transport sees few writes
+  uint8_t b[4096];
+  const uint32_t chunk = sizeof(b) / 4 * 3;
+  while (len > 0) {
+    uint32_t n = len < chunk ? len : chunk;
+    uint32_t size = base64_encoded_size(n);
+    base64_encode_buffer(bytes, n, b);
+    trans_->write(b, size);
+    result += size;
+    bytes += n;
+    len -= n;
   }
   trans_->write(&kJSONStringDelimiter, 1);
   return result;
@@ -467,16 +373,16 @@ uint32_t TJSONProtocol::writeJSONBase64(const std::string &str) {
 template <typename NumberType>
 uint32_t TJSONProtocol::writeJSONInteger(NumberType num) {
   uint32_t result = context_->write(*trans_);
-  std::string val(boost::lexical_cast<std::string>(num));
+  char buf[24];
+  char* end = buf + sizeof(buf);
+  char* val = formatJSONInteger(static_cast<int64_t>(num), end);
   bool escapeNum = context_->escapeNum();
   if (escapeNum) {
     trans_->write(&kJSONStringDelimiter, 1);
     result += 1;
   }
-  if(val.length() > (std::numeric_limits<uint32_t>::max)())
-    throw TProtocolException(TProtocolException::SIZE_LIMIT);
-  trans_->write((const uint8_t *)val.c_str(), static_cast<uint32_t>(val.length()));
-  result += static_cast<uint32_t>(val.length());
+  trans_->write((const uint8_t *)val, static_cast<uint32_t>(end - val));
+  result += static_cast<uint32_t>(end - val);
   if (escapeNum) {
     trans_->write(&kJSONStringDelimiter, 1);
     result += 1;
@@ -488,27 +394,23 @@ uint32_t TJSONProtocol::writeJSONInteger(NumberType num) {
 // "NaN" or "Infinity" or "-Infinity".
 uint32_t TJSONProtocol::writeJSONDouble(double num) {
   uint32_t result = context_->write(*trans_);
-  std::string val(boost::lexical_cast<std::string>(num));
+  std::string val;
 
-  // Normalize output of boost::lexical_cast for NaNs and Infinities
-  bool special = false;
-  switch (val[0]) {
-  case 'N':
-  case 'n':
+  // NaNs and Infinities are written as strings
+  bool special = true;
+  if (num != num) {
     val = kThriftNan;
-    special = true;
-    break;
-  case 'I':
-  case 'i':
+  }
+  else if (num == HUGE_VAL) {
     val = kThriftInfinity;
-    special = true;
-    break;
-  case '-':
-    if ((val[1] == 'I') || (val[1] == 'i')) {
-      val = kThriftNegativeInfinity;
-      special = true;
-    }
-    break;
+  }
+  else if (num == -HUGE_VAL) {
+    val = kThriftNegativeInfinity;
+  }
+  else {
+    special = false;
+    char buf[32];
+    val.assign(buf, formatJSONDouble(num, buf));
   }
 
   bool escapeNum = special || context_->escapeNum();
@@ -528,6 +430,7 @@ uint32_t TJSONProtocol::writeJSONDouble(double num) {
 }
 
 uint32_t TJSONProtocol::writeJSONObjectStart() {
+  TAllocScope scope(TAllocTracking::PROTOCOL);
   uint32_t result = context_->write(*trans_);
   trans_->write(&kJSONObjectStart, 1);
   pushContext(boost::shared_ptr<TJSONContext>(new JSONPairContext()));
@@ -541,6 +444,7 @@ uint32_t TJSONProtocol::writeJSONObjectEnd() {
 }
 
 uint32_t TJSONProtocol::writeJSONArrayStart() {
+  TAllocScope scope(TAllocTracking::PROTOCOL);
   uint32_t result = context_->write(*trans_);
   trans_->write(&kJSONArrayStart, 1);
   pushContext(boost::shared_ptr<TJSONContext>(new JSONListContext()));
@@ -696,6 +600,18 @@ uint32_t TJSONProtocol::readJSONString(std::string &str, bool skipContext) {
   uint8_t ch;
   str.clear();
   while (true) {
+    // Copy the run of plain characters straight out of the transport's buffer
+    uint32_t avail;
+    const uint8_t* buf = reader_.borrow(&avail);
+    if (buf != NULL && avail > 0) {
+      uint32_t run = scanJSONStringRun(buf, avail);
+      str.append((const char *)buf, run);
+      reader_.consume(run);
+      result += run;
+      if (run == avail) {
+        continue;
+      }
+    }
     ch = reader_.read();
     ++result;
     if (ch == kJSONStringDelimiter) {
@@ -726,22 +642,14 @@ uint32_t TJSONProtocol::readJSONString(std::string &str, bool skipContext) {
 uint32_t TJSONProtocol::readJSONBase64(std::string &str) {
   std::string tmp;
   uint32_t result = readJSONString(tmp);
-  uint8_t *b = (uint8_t *)tmp.c_str();
   if(tmp.length() > (std::numeric_limits<uint32_t>::max)())
     throw TProtocolException(TProtocolException::SIZE_LIMIT);
   uint32_t len = static_cast<uint32_t>(tmp.length());
-  str.clear();
-  while (len >= 4) {
-    base64_decode(b, 4);
-    str.append((const char *)b, 3);
-    b += 4;
-    len -= 4;
-  }
-  // Don't decode if we hit the end or got a single leftover byte (invalid
-  // base64 but legal for skip of regular string type)
-  if (len > 1) {
-    base64_decode(b, len);
-    str.append((const char *)b, len - 1);
+  // A single leftover byte is dropped (invalid base64 but legal for skip of
+  // regular string type)
+  str.resize(base64_decoded_size(len));
+  if (!str.empty()) {
+    base64_decode_buffer((const uint8_t *)tmp.data(), len, (uint8_t *)&str[0]);
   }
   return result;
 }
@@ -752,6 +660,21 @@ uint32_t TJSONProtocol::readJSONNumericChars(std::string &str) {
   uint32_t result = 0;
   str.clear();
   while (true) {
+    uint32_t avail;
+    const uint8_t* buf = reader_.borrow(&avail);
+    if (buf != NULL && avail > 0) {
+      uint32_t run = 0;
+      while (run < avail && isJSONNumeric(buf[run])) {
+        ++run;
+      }
+      str.append((const char *)buf, run);
+      reader_.consume(run);
+      result += run;
+      if (run < avail) {
+        break;
+      }
+      continue;
+    }
     uint8_t ch = reader_.peek();
     if (!isJSONNumeric(ch)) {
       break;
@@ -773,13 +696,10 @@ uint32_t TJSONProtocol::readJSONInteger(NumberType &num) {
   }
   std::string str;
   result += readJSONNumericChars(str);
-  try {
-    num = boost::lexical_cast<NumberType>(str);
-  }
-  catch (boost::bad_lexical_cast e) {
-    throw new TProtocolException(TProtocolException::INVALID_DATA,
-                                 "Expected numeric value; got \"" + str +
-                                  "\"");
+  if (!parseJSONInteger(str.data(), str.size(), num)) {
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Expected numeric value; got \"" + str +
+                             "\"");
   }
   if (context_->escapeNum()) {
     result += readJSONSyntaxChar(kJSONStringDelimiter);
@@ -809,13 +729,10 @@ uint32_t TJSONProtocol::readJSONDouble(double &num) {
         throw new TProtocolException(TProtocolException::INVALID_DATA,
                                      "Numeric data unexpectedly quoted");
       }
-      try {
-        num = boost::lexical_cast<double>(str);
-      }
-      catch (boost::bad_lexical_cast e) {
-        throw new TProtocolException(TProtocolException::INVALID_DATA,
-                                     "Expected numeric value; got \"" + str +
-                                     "\"");
+      if (!parseJSONDouble(str.data(), str.size(), num)) {
+        throw TProtocolException(TProtocolException::INVALID_DATA,
+                                 "Expected numeric value; got \"" + str +
+                                 "\"");
       }
     }
   }
@@ -825,19 +742,17 @@ uint32_t TJSONProtocol::readJSONDouble(double &num) {
       readJSONSyntaxChar(kJSONStringDelimiter);
     }
     result += readJSONNumericChars(str);
-    try {
-      num = boost::lexical_cast<double>(str);
-    }
-    catch (boost::bad_lexical_cast e) {
-      throw new TProtocolException(TProtocolException::INVALID_DATA,
-                                   "Expected numeric value; got \"" + str +
-                                   "\"");
+    if (!parseJSONDouble(str.data(), str.size(), num)) {
+      throw TProtocolException(TProtocolException::INVALID_DATA,
+                               "Expected numeric value; got \"" + str +
+                               "\"");
     }
   }
   return result;
 }
 
 uint32_t TJSONProtocol::readJSONObjectStart() {
+  TAllocScope scope(TAllocTracking::PROTOCOL);
   uint32_t result = context_->read(reader_);
   result += readJSONSyntaxChar(kJSONObjectStart);
   pushContext(boost::shared_ptr<TJSONContext>(new JSONPairContext()));
@@ -851,6 +766,7 @@ uint32_t TJSONProtocol::readJSONObjectEnd() {
 }
 
 uint32_t TJSONProtocol::readJSONArrayStart() {
+  TAllocScope scope(TAllocTracking::PROTOCOL);
   uint32_t result = context_->read(reader_);
   result += readJSONSyntaxChar(kJSONArrayStart);
   pushContext(boost::shared_ptr<TJSONContext>(new JSONListContext()));
@@ -866,6 +782,7 @@ uint32_t TJSONProtocol::readJSONArrayEnd() {
 uint32_t TJSONProtocol::readMessageBegin(std::string& name,
                                          TMessageType& messageType,
                                          int32_t& seqid) {
+  resetMessageLimits();
   uint32_t result = readJSONArrayStart();
   uint64_t tmpVal = 0;
   result += readJSONInteger(tmpVal);
@@ -889,10 +806,12 @@ uint32_t TJSONProtocol::readMessageEnd() {
 
 uint32_t TJSONProtocol::readStructBegin(std::string& name) {
   (void) name;
+  incrementRecursionDepth();
   return readJSONObjectStart();
 }
 
 uint32_t TJSONProtocol::readStructEnd() {
+  decrementRecursionDepth();
   return readJSONObjectEnd();
 }
 
@@ -938,11 +857,15 @@ uint32_t TJSONProtocol::readMapBegin(TType& keyType,
   if(tmpVal > (std::numeric_limits<uint32_t>::max)())
     throw TProtocolException(TProtocolException::SIZE_LIMIT);
   size = static_cast<uint32_t>(tmpVal);
+  // Every entry takes at least a key and a value
+  incrementRecursionDepth();
+  checkMessageBytes((uint64_t)size * 2);
   result += readJSONObjectStart();
   return result;
 }
 
 uint32_t TJSONProtocol::readMapEnd() {
+  decrementRecursionDepth();
   return readJSONObjectEnd() + readJSONArrayEnd();
 }
 
@@ -957,10 +880,13 @@ uint32_t TJSONProtocol::readListBegin(TType& elemType,
   if(tmpVal > (std::numeric_limits<uint32_t>::max)())
     throw TProtocolException(TProtocolException::SIZE_LIMIT);
   size = static_cast<uint32_t>(tmpVal);
+  incrementRecursionDepth();
+  checkMessageBytes(size);
   return result;
 }
 
 uint32_t TJSONProtocol::readListEnd() {
+  decrementRecursionDepth();
   return readJSONArrayEnd();
 }
 
@@ -975,10 +901,13 @@ uint32_t TJSONProtocol::readSetBegin(TType& elemType,
   if(tmpVal > (std::numeric_limits<uint32_t>::max)())
     throw TProtocolException(TProtocolException::SIZE_LIMIT);
   size = static_cast<uint32_t>(tmpVal);
+  incrementRecursionDepth();
+  checkMessageBytes(size);
   return result;
 }
 
 uint32_t TJSONProtocol::readSetEnd() {
+  decrementRecursionDepth();
   return readJSONArrayEnd();
 }
 
@@ -1013,11 +942,16 @@ uint32_t TJSONProtocol::readDouble(double& dub) {
 }
 
 uint32_t TJSONProtocol::readString(std::string &str) {
-  return readJSONString(str);
+  uint32_t result = readJSONString(str);
+  checkMessageBytes(str.size());
+  checkUtf8((const uint8_t *)str.data(), static_cast<uint32_t>(str.size()));
+  return result;
 }
 
 uint32_t TJSONProtocol::readBinary(std::string &str) {
-  return readJSONBase64(str);
+  uint32_t result = readJSONBase64(str);
+  checkMessageBytes(str.size());
+  return result;
 }
 
 }}} // apache::thrift::protocol
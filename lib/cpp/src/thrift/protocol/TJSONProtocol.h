@@ -100,10 +100,6 @@ class TJSONProtocol : public TVirtualProtocol<TJSONProtocol> {
 
   void popContext();
 
-  uint32_t writeJSONEscapeChar(uint8_t ch);
-
-  uint32_t writeJSONChar(uint8_t ch);
-
   uint32_t writeJSONString(const std::string &str);
 
   uint32_t writeJSONBase64(const std::string &str);
@@ -282,6 +278,25 @@ class TJSONProtocol : public TVirtualProtocol<TJSONProtocol> {
       return data_;
     }
 
+    /**
+     * Borrows whatever the transport has buffered, so that a run of
+     * characters can be scanned in place rather than read one at a time.
+     * Returns NULL when a peeked character is pending or the transport has
+     * nothing to lend; read() the next character then.
+     */
+    const uint8_t* borrow(uint32_t* len) {
+      if (hasData_) {
+        return NULL;
+      }
+      *len = 1;
+      return trans_->borrow(NULL, len);
+    }
+
+    /// Consumes len bytes of what borrow() returned
+    void consume(uint32_t len) {
+      trans_->consume(len);
+    }
+
    private:
     TTransport *trans_;
     bool hasData_;
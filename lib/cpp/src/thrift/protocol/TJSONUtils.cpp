@@ -0,0 +1,201 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/protocol/TJSONUtils.h>
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <boost/lexical_cast.hpp>
+#include <thrift/transport/TTransport.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+static const uint8_t kJSONBackslash = '\\';
+static const uint8_t kJSONStringDelimiter = '"';
+
+// This table describes the handling for the first 0x30 characters
+//  0 : escape using "\u00xx" notation
+//  1 : just output index
+// <other> : escape using "\<other>" notation
+static const uint8_t kJSONCharTable[0x30] = {
+//  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+    0,  0,  0,  0,  0,  0,  0,  0,'b','t','n',  0,'f','r',  0,  0, // 0
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 1
+    1,  1,'"',  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 2
+};
+
+// Return the hex character representing the integer val. The value is masked
+// to make sure it is in the correct range.
+static uint8_t hexChar(uint8_t val) {
+  val &= 0x0F;
+  if (val < 10) {
+    return val + '0';
+  }
+  else {
+    return val - 10 + 'a';
+  }
+}
+
+// Return true if the character ch has to be escaped in a JSON string
+static bool isJSONEscaped(uint8_t ch) {
+  return ch == kJSONBackslash || (ch < 0x30 && kJSONCharTable[ch] != 1);
+}
+
+// Whether the C library reads and writes numbers with a '.' decimal point,
+// so that strtod() and snprintf() give JSON numbers.
+static bool hasDecimalPoint() {
+  const char* point = localeconv()->decimal_point;
+  return point[0] == '.' && point[1] == '\0';
+}
+
+bool isJSONNumeric(uint8_t ch) {
+  switch (ch) {
+  case '+':
+  case '-':
+  case '.':
+  case '0':
+  case '1':
+  case '2':
+  case '3':
+  case '4':
+  case '5':
+  case '6':
+  case '7':
+  case '8':
+  case '9':
+  case 'E':
+  case 'e':
+    return true;
+  }
+  return false;
+}
+
+uint32_t writeJSONChars(transport::TTransport& trans, const uint8_t* str, uint32_t len) {
+  const uint8_t* end = str + len;
+  uint32_t result = 0;
+  while (str != end) {
+    const uint8_t* run = str;
+    while (str != end && !isJSONEscaped(*str)) {
+      ++str;
+    }
+    if (str != run) {
+      trans.write(run, static_cast<uint32_t>(str - run));
+      result += static_cast<uint32_t>(str - run);
+    }
+    if (str == end) {
+      break;
+    }
+    uint8_t ch = *str++;
+    uint8_t escape[6] = { kJSONBackslash, 0, 0, 0, 0, 0 };
+    if (ch == kJSONBackslash) {
+      escape[1] = kJSONBackslash;
+      trans.write(escape, 2);
+      result += 2;
+    }
+    else if (kJSONCharTable[ch] > 1) {
+      escape[1] = kJSONCharTable[ch];
+      trans.write(escape, 2);
+      result += 2;
+    }
+    else {
+      // "\u00xx"
+      escape[1] = 'u';
+      escape[2] = '0';
+      escape[3] = '0';
+      escape[4] = hexChar(ch >> 4);
+      escape[5] = hexChar(ch);
+      trans.write(escape, 6);
+      result += 6;
+    }
+  }
+  return result;
+}
+
+uint32_t scanJSONStringRun(const uint8_t* buf, uint32_t len) {
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+  uint32_t pos = 0;
+  while (len - pos >= 8) {
+    uint64_t word;
+    memcpy(&word, buf + pos, 8);
+    uint64_t quotes = word ^ (ones * kJSONStringDelimiter);
+    uint64_t slashes = word ^ (ones * kJSONBackslash);
+    // Nonzero if any byte of quotes or slashes is zero
+    if ((((quotes - ones) & ~quotes) | ((slashes - ones) & ~slashes)) & highs) {
+      break;
+    }
+    pos += 8;
+  }
+  while (pos < len && buf[pos] != kJSONStringDelimiter && buf[pos] != kJSONBackslash) {
+    ++pos;
+  }
+  return pos;
+}
+
+char* formatJSONInteger(int64_t num, char* end) {
+  uint64_t mag = num < 0 ? 0 - static_cast<uint64_t>(num) : static_cast<uint64_t>(num);
+  char* pos = end;
+  do {
+    *--pos = static_cast<char>('0' + mag % 10);
+    mag /= 10;
+  } while (mag != 0);
+  if (num < 0) {
+    *--pos = '-';
+  }
+  return pos;
+}
+
+uint32_t formatJSONDouble(double num, char* buf) {
+  if (hasDecimalPoint()) {
+    // The same 17 significant digits lexical_cast gives, without a stream
+    return static_cast<uint32_t>(snprintf(buf, 32, "%.17g", num));
+  }
+  std::string val(boost::lexical_cast<std::string>(num));
+  memcpy(buf, val.data(), val.size());
+  return static_cast<uint32_t>(val.size());
+}
+
+bool parseJSONDouble(const char* str, size_t len, double& num) {
+  if (len == 0) {
+    return false;
+  }
+  for (size_t i = 0; i < len; ++i) {
+    if (!isJSONNumeric(str[i])) {
+      return false;
+    }
+  }
+  std::string val(str, len);
+  if (!hasDecimalPoint()) {
+    try {
+      num = boost::lexical_cast<double>(val);
+    }
+    catch (boost::bad_lexical_cast&) {
+      return false;
+    }
+    return true;
+  }
+  char* end;
+  num = strtod(val.c_str(), &end);
+  return end == val.c_str() + val.size();
+}
+
+}}} // apache::thrift::protocol
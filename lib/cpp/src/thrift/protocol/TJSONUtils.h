@@ -0,0 +1,103 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TJSONUTILS_H_
+#define _THRIFT_PROTOCOL_TJSONUTILS_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits>
+
+namespace apache { namespace thrift { namespace transport {
+class TTransport;
+}}}
+
+namespace apache { namespace thrift { namespace protocol {
+
+// Helpers shared by TJSONProtocol and TSimpleJSONProtocol.
+
+// Return true if the character ch is in [-+0-9.Ee]; false otherwise
+bool isJSONNumeric(uint8_t ch);
+
+// Write the len bytes at str to trans as the inside of a JSON string, escaping
+// quotes, backslashes and control characters, and return how many bytes were
+// written.  Runs of characters needing no escape are written in one go.
+uint32_t writeJSONChars(transport::TTransport& trans, const uint8_t* str, uint32_t len);
+
+// Return the length of the run of characters at the start of buf, len bytes
+// long, that stand for themselves in a JSON string: everything up to the
+// first quote or backslash.  Eight bytes are checked at a time.
+uint32_t scanJSONStringRun(const uint8_t* buf, uint32_t len);
+
+// Write num in decimal into the 20 or more characters before end, and return
+// where it starts.
+char* formatJSONInteger(int64_t num, char* end);
+
+// Write num, which must be finite, into buf, which must hold at least 32
+// characters, with 17 significant digits so that it reads back exactly.
+// Return the length written.
+uint32_t formatJSONDouble(double num, char* buf);
+
+// Parse the len characters at str as a decimal integer in the range of
+// NumberType.  Return false if they are not one.
+template <typename NumberType>
+bool parseJSONInteger(const char* str, size_t len, NumberType& num) {
+  typedef std::numeric_limits<NumberType> limits;
+  const char* end = str + len;
+  bool negative = false;
+  if (str != end && (*str == '-' || *str == '+')) {
+    negative = (*str == '-');
+    ++str;
+  }
+  if (str == end) {
+    return false;
+  }
+  const uint64_t cutoff = (std::numeric_limits<uint64_t>::max)() / 10;
+  uint64_t mag = 0;
+  for (; str != end; ++str) {
+    if (*str < '0' || *str > '9') {
+      return false;
+    }
+    uint64_t digit = static_cast<uint64_t>(*str - '0');
+    if (mag > cutoff || (mag == cutoff && digit > (std::numeric_limits<uint64_t>::max)() % 10)) {
+      return false;
+    }
+    mag = mag * 10 + digit;
+  }
+  if (negative && mag != 0) {
+    if (!limits::is_signed || mag - 1 > static_cast<uint64_t>((limits::max)())) {
+      return false;
+    }
+    num = static_cast<NumberType>(-static_cast<int64_t>(mag - 1) - 1);
+  } else {
+    if (mag > static_cast<uint64_t>((limits::max)())) {
+      return false;
+    }
+    num = static_cast<NumberType>(mag);
+  }
+  return true;
+}
+
+// Parse the len characters at str, which must all be JSON numeric
+// characters, as a double.  Return false if they are not one.
+bool parseJSONDouble(const char* str, size_t len, double& num);
+
+}}} // apache::thrift::protocol
+
+#endif // #define _THRIFT_PROTOCOL_TJSONUTILS_H_
@@ -34,13 +34,34 @@ namespace apache
             {
                 if( _type == T_CALL || _type == T_ONEWAY )
                 {
-                    return TProtocolDecorator::writeMessageBegin_virt( serviceName + separator + _name, _type, _seqid );
+                    return TProtocolDecorator::writeMessageBegin_virt( prefixedName(_name), _type, _seqid );
                 }
                 else
                 {
                     return TProtocolDecorator::writeMessageBegin_virt(_name, _type, _seqid);
                 }
             }
+
+            const std::string& TMultiplexedProtocol::prefixedName(const std::string& _name)
+            {
+                std::map<std::string, std::string>::const_iterator it = prefixedNames.find(_name);
+                if( it != prefixedNames.end() )
+                {
+                    return it->second;
+                }
+
+                if( prefixedNames.size() < MAX_CACHED_NAMES )
+                {
+                    std::string& prefixed = prefixedNames[_name];
+                    prefixed.reserve(serviceName.size() + separator.size() + _name.size());
+                    prefixed.append(serviceName).append(separator).append(_name);
+                    return prefixed;
+                }
+
+                // Cache is full; reuse one buffer rather than allocating per call
+                scratch.assign(serviceName).append(separator).append(_name);
+                return scratch;
+            }
         }
     }
 }
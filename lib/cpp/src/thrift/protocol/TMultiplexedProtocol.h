@@ -21,6 +21,7 @@
 #define THRIFT_TMULTIPLEXEDPROTOCOL_H_ 1
 
 #include <thrift/protocol/TProtocolDecorator.h>
+#include <map>
 
 namespace apache 
 { 
@@ -92,8 +93,19 @@ namespace apache
                     const TMessageType _type, 
                     const int32_t _seqid);
             private:
+                /**
+                 * Returns <code>serviceName + separator + _name</code>.  Clients call the
+                 * same handful of methods over and over, so the prefixed names are built
+                 * once and kept, up to MAX_CACHED_NAMES of them.
+                 */
+                const std::string& prefixedName(const std::string& _name);
+
+                static const size_t MAX_CACHED_NAMES = 1024;
+
                 const std::string serviceName;
                 const std::string separator;
+                std::map<std::string, std::string> prefixedNames;
+                std::string scratch;
             };
 
         }
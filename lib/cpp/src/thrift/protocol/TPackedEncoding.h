@@ -0,0 +1,254 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TPACKEDENCODING_H_
+#define _THRIFT_PROTOCOL_TPACKEDENCODING_H_ 1
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/protocol/TByteSwap.h>
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * Writes the packed encoding, which code generated with the packed option
+ * produces through each struct's writePacked().
+ *
+ * The packed encoding is laid out entirely by the compiler.  A struct is a
+ * bitmap with one bit for each optional field, in id order, followed by
+ * the fields that are present, also in id order, with no tags or types.
+ * Numbers are fixed width in network byte order, bools one byte, strings
+ * and containers a four byte size followed by their contents.  This makes
+ * it about as small as the dense protocol and as quick as the binary one,
+ * but the reader must have been generated from exactly the same IDL as the
+ * writer: there is no way to skip unknown fields.  It suits data written
+ * and read by the same program, such as a private storage format.
+ */
+class TPackedWriter {
+ public:
+  explicit TPackedWriter(boost::shared_ptr<transport::TBufferBase> trans)
+    : trans_(trans.get()), transHolder_(trans) {}
+
+  uint32_t writeBool(bool value) {
+    uint8_t byte = value ? 1 : 0;
+    trans_->write(&byte, 1);
+    return 1;
+  }
+
+  uint32_t writeByte(int8_t byte) {
+    trans_->write((uint8_t*)&byte, 1);
+    return 1;
+  }
+
+  uint32_t writeI16(int16_t i16) {
+    int16_t net = (int16_t)htons(i16);
+    trans_->write((uint8_t*)&net, 2);
+    return 2;
+  }
+
+  uint32_t writeI32(int32_t i32) {
+    int32_t net = (int32_t)htonl(i32);
+    trans_->write((uint8_t*)&net, 4);
+    return 4;
+  }
+
+  uint32_t writeI64(int64_t i64) {
+    int64_t net = (int64_t)htonll(i64);
+    trans_->write((uint8_t*)&net, 8);
+    return 8;
+  }
+
+  uint32_t writeDouble(double dub) {
+    uint64_t bits = htonll(bitwise_cast<uint64_t>(dub));
+    trans_->write((uint8_t*)&bits, 8);
+    return 8;
+  }
+
+  /// The size of a string or container
+  uint32_t writeSize(uint32_t size) {
+    return writeI32((int32_t)size);
+  }
+
+  uint32_t writeString(const std::string& str) {
+    uint32_t size = static_cast<uint32_t>(str.size());
+    writeSize(size);
+    trans_->write((const uint8_t*)str.data(), size);
+    return 4 + size;
+  }
+
+  /// The presence bits of a struct's optional fields
+  uint32_t writeBitmap(const uint8_t* bits, uint32_t len) {
+    trans_->write(bits, len);
+    return len;
+  }
+
+  uint32_t writeI32s(const int32_t* values, uint32_t n) {
+    return writeArray(values, n, 4);
+  }
+
+  uint32_t writeI64s(const int64_t* values, uint32_t n) {
+    return writeArray(values, n, 8);
+  }
+
+  uint32_t writeDoubles(const double* values, uint32_t n) {
+    return writeArray(values, n, 8);
+  }
+
+ private:
+  // Byte swaps a chunk at a time on the stack, then writes it
+  uint32_t writeArray(const void* values, uint32_t n, uint32_t width) {
+    uint8_t chunk[1024];
+    const uint8_t* src = static_cast<const uint8_t*>(values);
+    uint32_t perChunk = sizeof(chunk) / width;
+    uint32_t left = n;
+    while (left > 0) {
+      uint32_t count = left < perChunk ? left : perChunk;
+      if (width == 4) {
+        detail::networkCopy32(chunk, src, count);
+      } else {
+        detail::networkCopy64(chunk, src, count);
+      }
+      trans_->write(chunk, count * width);
+      src += count * width;
+      left -= count;
+    }
+    return n * width;
+  }
+
+  transport::TBufferBase* trans_;
+  boost::shared_ptr<transport::TBufferBase> transHolder_;
+};
+
+/**
+ * Reads the packed encoding written by a TPackedWriter, through each
+ * struct's readPacked().
+ */
+class TPackedReader {
+ public:
+  explicit TPackedReader(boost::shared_ptr<transport::TBufferBase> trans)
+    : trans_(trans.get()), transHolder_(trans) {}
+
+  uint32_t readBool(bool& value) {
+    uint8_t byte;
+    trans_->readAll(&byte, 1);
+    value = byte != 0;
+    return 1;
+  }
+
+  uint32_t readByte(int8_t& byte) {
+    trans_->readAll((uint8_t*)&byte, 1);
+    return 1;
+  }
+
+  uint32_t readI16(int16_t& i16) {
+    int16_t net;
+    trans_->readAll((uint8_t*)&net, 2);
+    i16 = (int16_t)ntohs(net);
+    return 2;
+  }
+
+  uint32_t readI32(int32_t& i32) {
+    int32_t net;
+    trans_->readAll((uint8_t*)&net, 4);
+    i32 = (int32_t)ntohl(net);
+    return 4;
+  }
+
+  uint32_t readI64(int64_t& i64) {
+    int64_t net;
+    trans_->readAll((uint8_t*)&net, 8);
+    i64 = (int64_t)ntohll(net);
+    return 8;
+  }
+
+  uint32_t readDouble(double& dub) {
+    uint64_t bits;
+    trans_->readAll((uint8_t*)&bits, 8);
+    dub = bitwise_cast<double>(ntohll(bits));
+    return 8;
+  }
+
+  uint32_t readSize(uint32_t& size) {
+    int32_t value;
+    readI32(value);
+    if (value < 0) {
+      throw TProtocolException(TProtocolException::NEGATIVE_SIZE);
+    }
+    size = static_cast<uint32_t>(value);
+    return 4;
+  }
+
+  uint32_t readString(std::string& str) {
+    uint32_t size;
+    readSize(size);
+    // Borrowed whole if the buffer has it all, or else read a piece at a
+    // time, so a corrupt size fails at the end of the data rather than in
+    // one huge allocation
+    uint32_t got = size;
+    const uint8_t* data = trans_->borrow(NULL, &got);
+    if (data != NULL) {
+      str.assign((const char*)data, size);
+      trans_->consume(size);
+      return 4 + size;
+    }
+    str.clear();
+    uint32_t left = size;
+    while (left > 0) {
+      uint32_t piece = left < 65536 ? left : 65536;
+      size_t at = str.size();
+      str.resize(at + piece);
+      trans_->readAll((uint8_t*)&str[at], piece);
+      left -= piece;
+    }
+    return 4 + size;
+  }
+
+  uint32_t readBitmap(uint8_t* bits, uint32_t len) {
+    trans_->readAll(bits, len);
+    return len;
+  }
+
+  uint32_t readI32s(int32_t* values, uint32_t n) {
+    trans_->readAll((uint8_t*)values, n * 4);
+    detail::networkCopy32(values, values, n);
+    return n * 4;
+  }
+
+  uint32_t readI64s(int64_t* values, uint32_t n) {
+    trans_->readAll((uint8_t*)values, n * 8);
+    detail::networkCopy64(values, values, n);
+    return n * 8;
+  }
+
+  uint32_t readDoubles(double* values, uint32_t n) {
+    trans_->readAll((uint8_t*)values, n * 8);
+    detail::networkCopy64(values, values, n);
+    return n * 8;
+  }
+
+ private:
+  transport::TBufferBase* trans_;
+  boost::shared_ptr<transport::TBufferBase> transHolder_;
+};
+
+}}} // apache::thrift::protocol
+
+#endif // #ifndef _THRIFT_PROTOCOL_TPACKEDENCODING_H_
@@ -20,8 +20,10 @@
 #ifndef _THRIFT_PROTOCOL_TPROTOCOL_H_
 #define _THRIFT_PROTOCOL_TPROTOCOL_H_ 1
 
+#include <thrift/TStringView.h>
 #include <thrift/transport/TTransport.h>
 #include <thrift/protocol/TProtocolException.h>
+#include <thrift/protocol/TUtf8.h>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/static_assert.hpp>
@@ -177,6 +179,18 @@ enum TMessageType {
   T_ONEWAY     = 4
 };
 
+/**
+ * Enumerated definition of the encodings TProtocol::readRaw() and
+ * writeRaw() capture values in.
+ */
+enum TRawFormat {
+  T_RAW_NONE    = 0,
+  T_RAW_BINARY  = 1,
+  T_RAW_COMPACT = 2
+};
+
+struct TStructSpec;
+
 
 /**
  * Helper template for implementing TProtocol::skip().
@@ -350,12 +364,44 @@ class TProtocol {
 
   virtual uint32_t writeI64_virt(const int64_t i64) = 0;
 
+  virtual uint32_t writeI32s_virt(const int32_t* values, uint32_t n) {
+    uint32_t wsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      wsize += writeI32_virt(values[i]);
+    }
+    return wsize;
+  }
+
+  virtual uint32_t writeI64s_virt(const int64_t* values, uint32_t n) {
+    uint32_t wsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      wsize += writeI64_virt(values[i]);
+    }
+    return wsize;
+  }
+
+  virtual uint32_t writeDoubles_virt(const double* values, uint32_t n) {
+    uint32_t wsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      wsize += writeDouble_virt(values[i]);
+    }
+    return wsize;
+  }
+
   virtual uint32_t writeDouble_virt(const double dub) = 0;
 
   virtual uint32_t writeString_virt(const std::string& str) = 0;
 
   virtual uint32_t writeBinary_virt(const std::string& str) = 0;
 
+  virtual uint32_t writeStringView_virt(const TStringView& str) {
+    return writeString_virt(str.str());
+  }
+
+  virtual uint32_t writeBinaryView_virt(const TStringView& str) {
+    return writeBinary_virt(str.str());
+  }
+
   uint32_t writeMessageBegin(const std::string& name,
                              const TMessageType messageType,
                              const int32_t seqid) {
@@ -386,6 +432,27 @@ class TProtocol {
     return writeFieldBegin_virt(name, fieldType, fieldId);
   }
 
+  /**
+   * Writes a field header as writeFieldBegin() does, given also the three
+   * bytes TBinaryProtocol encodes it as.  Generated code passes those as a
+   * constant so that the binary protocol can write them in one go; other
+   * protocols ignore them.
+   */
+  uint32_t writeFieldHeader(const char* name,
+                            const TType fieldType,
+                            const int16_t fieldId,
+                            const char* binaryHeader) {
+    T_VIRTUAL_CALL();
+    return writeFieldHeader_virt(name, fieldType, fieldId, binaryHeader);
+  }
+  virtual uint32_t writeFieldHeader_virt(const char* name,
+                                         const TType fieldType,
+                                         const int16_t fieldId,
+                                         const char* binaryHeader) {
+    (void) binaryHeader;
+    return writeFieldBegin_virt(name, fieldType, fieldId);
+  }
+
   uint32_t writeFieldEnd() {
     T_VIRTUAL_CALL();
     return writeFieldEnd_virt();
@@ -453,6 +520,26 @@ class TProtocol {
     return writeI64_virt(i64);
   }
 
+  /**
+   * Writes n i32s back to back, as the elements of a list or set, and
+   * likewise writeI64s() and writeDoubles().  Protocols with a faster way
+   * than one writeI32() each override them.
+   */
+  uint32_t writeI32s(const int32_t* values, uint32_t n) {
+    T_VIRTUAL_CALL();
+    return writeI32s_virt(values, n);
+  }
+
+  uint32_t writeI64s(const int64_t* values, uint32_t n) {
+    T_VIRTUAL_CALL();
+    return writeI64s_virt(values, n);
+  }
+
+  uint32_t writeDoubles(const double* values, uint32_t n) {
+    T_VIRTUAL_CALL();
+    return writeDoubles_virt(values, n);
+  }
+
   uint32_t writeDouble(const double dub) {
     T_VIRTUAL_CALL();
     return writeDouble_virt(dub);
@@ -468,6 +555,20 @@ class TProtocol {
     return writeBinary_virt(str);
   }
 
+  /**
+   * Writes a string (or binary) held in a view; protocols that can write
+   * it without a copy to a std::string override it.
+   */
+  uint32_t writeStringView(const TStringView& str) {
+    T_VIRTUAL_CALL();
+    return writeStringView_virt(str);
+  }
+
+  uint32_t writeBinaryView(const TStringView& str) {
+    T_VIRTUAL_CALL();
+    return writeBinaryView_virt(str);
+  }
+
   /**
    * Reading functions
    */
@@ -516,12 +617,50 @@ class TProtocol {
 
   virtual uint32_t readI64_virt(int64_t& i64) = 0;
 
+  virtual uint32_t readI32s_virt(int32_t* values, uint32_t n) {
+    uint32_t rsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      rsize += readI32_virt(values[i]);
+    }
+    return rsize;
+  }
+
+  virtual uint32_t readI64s_virt(int64_t* values, uint32_t n) {
+    uint32_t rsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      rsize += readI64_virt(values[i]);
+    }
+    return rsize;
+  }
+
+  virtual uint32_t readDoubles_virt(double* values, uint32_t n) {
+    uint32_t rsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      rsize += readDouble_virt(values[i]);
+    }
+    return rsize;
+  }
+
   virtual uint32_t readDouble_virt(double& dub) = 0;
 
   virtual uint32_t readString_virt(std::string& str) = 0;
 
   virtual uint32_t readBinary_virt(std::string& str) = 0;
 
+  virtual uint32_t readStringView_virt(TStringView& str) {
+    std::string copy;
+    uint32_t rsize = readString_virt(copy);
+    str.assign(copy.data(), copy.size());
+    return rsize;
+  }
+
+  virtual uint32_t readBinaryView_virt(TStringView& str) {
+    std::string copy;
+    uint32_t rsize = readBinary_virt(copy);
+    str.assign(copy.data(), copy.size());
+    return rsize;
+  }
+
   uint32_t readMessageBegin(std::string& name,
                             TMessageType& messageType,
                             int32_t& seqid) {
@@ -539,6 +678,20 @@ class TProtocol {
     return readStructBegin_virt(name);
   }
 
+  /**
+   * readStructBegin() for a struct whose fields spec describes.  Protocols
+   * that do not put field ids and types on the wire, like
+   * TSimpleJSONProtocol, look fields up by name in it; the rest ignore it.
+   */
+  uint32_t readStructBeginSpec(std::string& name, const TStructSpec& spec) {
+    T_VIRTUAL_CALL();
+    return readStructBeginSpec_virt(name, spec);
+  }
+  virtual uint32_t readStructBeginSpec_virt(std::string& name, const TStructSpec& spec) {
+    (void) spec;
+    return readStructBegin_virt(name);
+  }
+
   uint32_t readStructEnd() {
     T_VIRTUAL_CALL();
     return readStructEnd_virt();
@@ -611,6 +764,25 @@ class TProtocol {
     return readI64_virt(i64);
   }
 
+  /**
+   * Reads n i32s written by writeI32s() (or one writeI32() each), and
+   * likewise readI64s() and readDoubles().
+   */
+  uint32_t readI32s(int32_t* values, uint32_t n) {
+    T_VIRTUAL_CALL();
+    return readI32s_virt(values, n);
+  }
+
+  uint32_t readI64s(int64_t* values, uint32_t n) {
+    T_VIRTUAL_CALL();
+    return readI64s_virt(values, n);
+  }
+
+  uint32_t readDoubles(double* values, uint32_t n) {
+    T_VIRTUAL_CALL();
+    return readDoubles_virt(values, n);
+  }
+
   uint32_t readDouble(double& dub) {
     T_VIRTUAL_CALL();
     return readDouble_virt(dub);
@@ -626,6 +798,22 @@ class TProtocol {
     return readBinary_virt(str);
   }
 
+  /**
+   * Reads a string (or binary) into a view.  Protocols that support it
+   * point the view into the transport's buffer when the transport can
+   * share it (see TTransport::getBorrowOwner()); otherwise the view gets
+   * its own copy.
+   */
+  uint32_t readStringView(TStringView& str) {
+    T_VIRTUAL_CALL();
+    return readStringView_virt(str);
+  }
+
+  uint32_t readBinaryView(TStringView& str) {
+    T_VIRTUAL_CALL();
+    return readBinaryView_virt(str);
+  }
+
   /*
    * std::vector is specialized for bool, and its elements are individual bits
    * rather than bools.   We need to define a different version of readBool()
@@ -647,6 +835,116 @@ class TProtocol {
     return ::apache::thrift::protocol::skip(*this, type);
   }
 
+  /**
+   * Skips over a value like skip(), appending its encoded bytes to raw so
+   * that it can be decoded later, or written back out unchanged by
+   * writeRaw().  Used for fields that are only decoded on demand (see
+   * TLazy).  Only protocols whose getRawFormat() is not T_RAW_NONE support
+   * either; bytes may only be written by a protocol of the same format.
+   */
+  uint32_t readRaw(TType type, std::string& raw) {
+    T_VIRTUAL_CALL();
+    return readRaw_virt(type, raw);
+  }
+  virtual uint32_t readRaw_virt(TType type, std::string& raw) {
+    (void) type;
+    (void) raw;
+    throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+                             "protocol has no raw value support");
+  }
+
+  uint32_t writeRaw(const std::string& raw) {
+    T_VIRTUAL_CALL();
+    return writeRaw_virt(raw);
+  }
+  virtual uint32_t writeRaw_virt(const std::string& raw) {
+    (void) raw;
+    throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+                             "protocol has no raw value support");
+  }
+
+  virtual TRawFormat getRawFormat() {
+    return T_RAW_NONE;
+  }
+
+  /**
+   * Limits on what a single incoming message can make the reader do, so a
+   * malformed or hostile one is turned away before it costs much.  The
+   * recursion limit is how deeply structs and containers may nest.  The
+   * message size limit is how many bytes a message may take; it is checked
+   * against the sizes its strings and containers give as each is read, so
+   * one claiming more than that is refused before anything is allocated
+   * for it.  Both count from the last readMessageBegin(), or from
+   * resetMessageLimits() for values read on their own.  Zero, the default,
+   * means no limit.
+   */
+  void setRecursionLimit(uint32_t depth) {
+    recursion_limit_ = depth;
+  }
+
+  uint32_t getRecursionLimit() const {
+    return recursion_limit_;
+  }
+
+  void setMessageSizeLimit(uint32_t bytes) {
+    message_size_limit_ = bytes;
+  }
+
+  uint32_t getMessageSizeLimit() const {
+    return message_size_limit_;
+  }
+
+  void resetMessageLimits() {
+    recursion_depth_ = 0;
+    message_bytes_ = 0;
+  }
+
+  /**
+   * Whether readString() refuses strings that are not well-formed UTF-8,
+   * with INVALID_DATA.  The bytes are checked as they are read, while still
+   * in cache, so handlers need not make a pass of their own.  binary fields
+   * are never checked.  Off by default.
+   */
+  void setValidateUtf8(bool validate) {
+    validate_utf8_ = validate;
+  }
+
+  bool getValidateUtf8() const {
+    return validate_utf8_;
+  }
+
+  /**
+   * Accounting for the limits above, done by the protocols as they read.
+   */
+  void incrementRecursionDepth() {
+    if (++recursion_depth_ > recursion_limit_ && recursion_limit_ != 0) {
+      throw TProtocolException(TProtocolException::DEPTH_LIMIT);
+    }
+  }
+
+  void decrementRecursionDepth() {
+    if (recursion_depth_ > 0) {
+      --recursion_depth_;
+    }
+  }
+
+  void checkUtf8(const uint8_t* data, uint32_t len) {
+    if (validate_utf8_ && !validUtf8(data, len)) {
+      throw TProtocolException(TProtocolException::INVALID_DATA,
+                               "String is not valid UTF-8");
+    }
+  }
+
+  void checkMessageBytes(uint64_t bytes) {
+    if (message_size_limit_ != 0) {
+      message_bytes_ += bytes;
+      if (message_bytes_ > message_size_limit_) {
+        throw TProtocolException(TProtocolException::SIZE_LIMIT,
+                                 "Message size limit exceeded");
+      }
+    }
+  }
+
   inline boost::shared_ptr<TTransport> getTransport() {
     return ptrans_;
   }
@@ -662,13 +960,43 @@ class TProtocol {
 
  protected:
   TProtocol(boost::shared_ptr<TTransport> ptrans):
-    ptrans_(ptrans) {
+    ptrans_(ptrans),
+    recursion_limit_(0),
+    recursion_depth_(0),
+    message_size_limit_(0),
+    message_bytes_(0),
+    validate_utf8_(false) {
   }
 
   boost::shared_ptr<TTransport> ptrans_;
 
  private:
   TProtocol() {}
+
+  uint32_t recursion_limit_;
+  uint32_t recursion_depth_;
+  uint32_t message_size_limit_;
+  uint64_t message_bytes_;
+  bool validate_utf8_;
+};
+
+/**
+ * Counts one level of nesting against a protocol's recursion limit for as
+ * long as it is in scope, for readers that recurse without going through
+ * the protocol's begin and end calls.
+ */
+class TInputRecursionTracker {
+ public:
+  explicit TInputRecursionTracker(TProtocol& prot) : prot_(prot) {
+    prot_.incrementRecursionDepth();
+  }
+
+  ~TInputRecursionTracker() {
+    prot_.decrementRecursionDepth();
+  }
+
+ private:
+  TProtocol& prot_;
 };
 
 /**
@@ -681,6 +1009,15 @@ class TProtocolFactory {
   virtual ~TProtocolFactory() {}
 
   virtual boost::shared_ptr<TProtocol> getProtocol(boost::shared_ptr<TTransport> trans) = 0;
+
+  /**
+   * Takes back a protocol that getProtocol() made, once its connection is
+   * closed, for reuse as TTransportFactory::recycle() does transports.
+   * prot is left empty.
+   */
+  virtual void recycle(boost::shared_ptr<TProtocol>& prot) {
+    prot.reset();
+  }
 };
 
 /**
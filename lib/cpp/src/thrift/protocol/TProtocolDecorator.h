@@ -37,16 +37,21 @@ namespace apache
              * concrete decorator subclasses.  
              *
              * <p>See p.175 of Design Patterns (by Gamma et al.)</p>
+             *
+             * <p>Given the concrete type of the enclosed protocol as Protocol_,
+             * the forwarded calls are bound at compile time, so each call costs
+             * the one virtual call into the decorator rather than two.</p>
              * 
              * @see apache::thrift::protocol::TMultiplexedProtocol
              */
-            class TProtocolDecorator : public TProtocol
+            template <class Protocol_ = TProtocol>
+            class TProtocolDecoratorT : public TProtocol
             {
             public:
-                virtual ~TProtocolDecorator() {}
+                virtual ~TProtocolDecoratorT() {}
                 
                 // Desc: Initializes the protocol decorator object.
-                TProtocolDecorator( shared_ptr<TProtocol> proto ) 
+                TProtocolDecoratorT( shared_ptr<Protocol_> proto ) 
                     : TProtocol(proto->getTransport()), protocol(proto)
                 {
                 }
@@ -86,15 +91,21 @@ namespace apache
                 virtual uint32_t writeI16_virt(const int16_t i16)  { return protocol->writeI16(i16); }
                 virtual uint32_t writeI32_virt(const int32_t i32)  { return protocol->writeI32(i32); }
                 virtual uint32_t writeI64_virt(const int64_t i64)  { return protocol->writeI64(i64); }
+                virtual uint32_t writeI32s_virt(const int32_t* values, uint32_t n) { return protocol->writeI32s(values, n); }
+                virtual uint32_t writeI64s_virt(const int64_t* values, uint32_t n) { return protocol->writeI64s(values, n); }
+                virtual uint32_t writeDoubles_virt(const double* values, uint32_t n) { return protocol->writeDoubles(values, n); }
 
                 virtual uint32_t writeDouble_virt(const double dub) { return protocol->writeDouble(dub); }
                 virtual uint32_t writeString_virt(const std::string& str) { return protocol->writeString(str); }
                 virtual uint32_t writeBinary_virt(const std::string& str) { return protocol->writeBinary(str); }
+                virtual uint32_t writeStringView_virt(const TStringView& str) { return protocol->writeStringView(str); }
+                virtual uint32_t writeBinaryView_virt(const TStringView& str) { return protocol->writeBinaryView(str); }
 
                 virtual uint32_t readMessageBegin_virt(std::string& name, TMessageType& messageType, int32_t& seqid) { return protocol->readMessageBegin(name,messageType,seqid); }
                 virtual uint32_t readMessageEnd_virt() { return protocol->readMessageEnd(); }
 
                 virtual uint32_t readStructBegin_virt(std::string& name) { return protocol->readStructBegin(name); }
+                virtual uint32_t readStructBeginSpec_virt(std::string& name, const TStructSpec& spec) { return protocol->readStructBeginSpec(name, spec); }
                 virtual uint32_t readStructEnd_virt() { return protocol->readStructEnd(); }
 
                 virtual uint32_t readFieldBegin_virt(std::string& name, TType& fieldType, int16_t& fieldId) { return protocol->readFieldBegin(name, fieldType, fieldId); }
@@ -117,14 +128,64 @@ namespace apache
                 virtual uint32_t readI16_virt(int16_t& i16) { return protocol->readI16(i16); }
                 virtual uint32_t readI32_virt(int32_t& i32) { return protocol->readI32(i32); }
                 virtual uint32_t readI64_virt(int64_t& i64) { return protocol->readI64(i64); }
+                virtual uint32_t readI32s_virt(int32_t* values, uint32_t n) { return protocol->readI32s(values, n); }
+                virtual uint32_t readI64s_virt(int64_t* values, uint32_t n) { return protocol->readI64s(values, n); }
+                virtual uint32_t readDoubles_virt(double* values, uint32_t n) { return protocol->readDoubles(values, n); }
 
                 virtual uint32_t readDouble_virt(double& dub) { return protocol->readDouble(dub); }
 
                 virtual uint32_t readString_virt(std::string& str) { return protocol->readString(str); }
                 virtual uint32_t readBinary_virt(std::string& str) { return protocol->readBinary(str); }
+                virtual uint32_t readStringView_virt(TStringView& str) { return protocol->readStringView(str); }
+                virtual uint32_t readBinaryView_virt(TStringView& str) { return protocol->readBinaryView(str); }
+
+                virtual uint32_t readRaw_virt(TType type, std::string& raw) { return protocol->readRaw(type, raw); }
+                virtual uint32_t writeRaw_virt(const std::string& raw) { return protocol->writeRaw(raw); }
+                virtual uint32_t writeFieldHeader_virt(const char* name,
+                    const TType fieldType,
+                    const int16_t fieldId,
+                    const char* binaryHeader) { return protocol->writeFieldHeader(name,fieldType,fieldId,binaryHeader); }
+                virtual TRawFormat getRawFormat() { return protocol->getRawFormat(); }
+
+            protected:
+                shared_ptr<Protocol_> protocol;    
+            };
+
+            typedef TProtocolDecoratorT<> TProtocolDecorator;
+
+            /**
+             * A decorator handing back a message header that has already been
+             * read, for processors that are passed a message after something
+             * else has looked at its header.
+             *
+             * @see apache::thrift::TProcessor::processMessage
+             */
+            class StoredMessageProtocol : public TProtocolDecorator
+            {
+            public:
+                StoredMessageProtocol( shared_ptr<protocol::TProtocol> _protocol,
+                    const std::string& _name, const TMessageType _type, 
+                    const int32_t _seqid) :
+                    TProtocolDecorator(_protocol),
+                    name(_name),
+                    type(_type),
+                    seqid(_seqid)
+                {
+                }
+
+                uint32_t readMessageBegin_virt(std::string& _name, TMessageType& _type, int32_t& _seqid)
+                {
+                    
+                    _name  = name;
+                    _type  = type;
+                    _seqid = seqid;
+
+                    return 0; // (Normal TProtocol read functions return number of bytes read)
+                }
 
-            private:
-                shared_ptr<TProtocol> protocol;    
+                std::string name;
+                TMessageType type;
+                int32_t seqid;
             };
         }
     }
@@ -45,6 +45,7 @@ class TProtocolException : public apache::thrift::TException {
   , SIZE_LIMIT = 3
   , BAD_VERSION = 4
   , NOT_IMPLEMENTED = 5
+  , DEPTH_LIMIT = 6
   };
 
   TProtocolException() :
@@ -84,6 +85,7 @@ class TProtocolException : public apache::thrift::TException {
         case SIZE_LIMIT      : return "TProtocolException: Exceeded size limit";
         case BAD_VERSION     : return "TProtocolException: Invalid version";
         case NOT_IMPLEMENTED : return "TProtocolException: Not implemented";
+        case DEPTH_LIMIT     : return "TProtocolException: Exceeded depth limit";
         default              : return "TProtocolException: (Invalid exception type)";
       }
     } else {
@@ -0,0 +1,272 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/protocol/TSchema.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace apache { namespace thrift { namespace protocol {
+
+using namespace std;
+
+namespace {
+
+TException schemaError(int line, const string& what) {
+  ostringstream message;
+  message << "TSchema: line " << line << ": " << what;
+  return TException(message.str());
+}
+
+int32_t parseNumber(const string& word, int line) {
+  char* end = NULL;
+  long value = strtol(word.c_str(), &end, 10);
+  if (word.empty() || *end != '\0') {
+    throw schemaError(line, "bad number " + word);
+  }
+  return static_cast<int32_t>(value);
+}
+
+}
+
+const TSchemaField* TSchemaStruct::findField(const string& fieldName) const {
+  for (size_t i = 0; i < fields.size(); ++i) {
+    if (fields[i].name == fieldName) {
+      return &fields[i];
+    }
+  }
+  return NULL;
+}
+
+TSchema::TSchema(const string& text) {
+  vector<vector<string> > lines;
+  {
+    istringstream in(text);
+    string line;
+    while (getline(in, line)) {
+      istringstream words(line);
+      vector<string> split;
+      string word;
+      while (words >> word) {
+        split.push_back(word);
+      }
+      lines.push_back(split);
+    }
+  }
+  if (lines.empty() || lines[0].size() != 2 || lines[0][0] != "thrift-schema") {
+    throw schemaError(1, "not a thrift schema");
+  }
+  if (lines[0][1] != "1") {
+    throw schemaError(1, "unknown schema version " + lines[0][1]);
+  }
+
+  // Names first, as types may refer to structs declared after them
+  for (size_t i = 1; i < lines.size(); ++i) {
+    const vector<string>& words = lines[i];
+    if (words.size() < 2) {
+      continue;
+    }
+    if (words[0] == "struct" || words[0] == "union" || words[0] == "exception") {
+      structsByName_[words[1]] = static_cast<int32_t>(structs_.size());
+      structs_.push_back(TSchemaStruct());
+      structs_.back().name = words[1];
+    } else if (words[0] == "enum") {
+      enumsByName_[words[1]] = static_cast<int32_t>(enums_.size());
+      enums_.push_back(TSchemaEnum());
+      enums_.back().name = words[1];
+    } else if (words[0] == "service") {
+      servicesByName_[words[1]] = static_cast<int32_t>(services_.size());
+      services_.push_back(TSchemaService());
+      services_.back().name = words[1];
+      services_.back().extends = -1;
+    }
+  }
+
+  TSchemaStruct* tstruct = NULL;
+  TSchemaEnum* tenum = NULL;
+  TSchemaService* tservice = NULL;
+  for (size_t i = 1; i < lines.size(); ++i) {
+    const vector<string>& words = lines[i];
+    int line = static_cast<int>(i + 1);
+    if (words.empty()) {
+      continue;
+    }
+    const string& kind = words[0];
+
+    if (kind == "struct" || kind == "union" || kind == "exception") {
+      tstruct = &structs_[structsByName_[words[1]]];
+    } else if (kind == "enum") {
+      tenum = &enums_[enumsByName_[words[1]]];
+    } else if (kind == "service") {
+      tservice = &services_[servicesByName_[words[1]]];
+      if (words.size() > 2) {
+        int32_t extends = findService(words[2]);
+        if (extends < 0) {
+          throw schemaError(line, "unknown service " + words[2]);
+        }
+        tservice->extends = extends;
+      }
+    } else if (kind == "field") {
+      if (tstruct == NULL || words.size() != 5) {
+        throw schemaError(line, "bad field");
+      }
+      TSchemaField field;
+      field.id = static_cast<int16_t>(parseNumber(words[1], line));
+      if (words[2] == "req") {
+        field.req = T_SCHEMA_REQUIRED;
+      } else if (words[2] == "opt") {
+        field.req = T_SCHEMA_OPTIONAL;
+      } else {
+        field.req = T_SCHEMA_DEFAULT;
+      }
+      size_t pos = 0;
+      field.type = parseType(words[3], pos, line);
+      if (pos != words[3].size()) {
+        throw schemaError(line, "bad type " + words[3]);
+      }
+      field.name = words[4];
+      tstruct->fields.push_back(field);
+    } else if (kind == "value") {
+      if (tenum == NULL || words.size() != 3) {
+        throw schemaError(line, "bad enum value");
+      }
+      tenum->values.push_back(make_pair(words[1], parseNumber(words[2], line)));
+    } else if (kind == "function") {
+      if (tservice == NULL || words.size() != 5) {
+        throw schemaError(line, "bad function");
+      }
+      TSchemaFunction function;
+      function.name = words[1];
+      function.oneway = words[2] == "1";
+      function.args = findStruct(words[3]);
+      function.result = findStruct(words[4]);
+      if (function.args < 0 || function.result < 0) {
+        throw schemaError(line, "unknown args or result struct");
+      }
+      tservice->functions.push_back(function);
+    } else {
+      throw schemaError(line, "unknown declaration " + kind);
+    }
+  }
+}
+
+boost::shared_ptr<TSchema> TSchema::load(const string& path) {
+  ifstream in(path.c_str(), ios::in | ios::binary);
+  if (!in) {
+    throw TException("TSchema: could not open " + path);
+  }
+  ostringstream text;
+  text << in.rdbuf();
+  return boost::shared_ptr<TSchema>(new TSchema(text.str()));
+}
+
+/**
+ * Parses the type at pos in text, leaving pos after it.
+ */
+int32_t TSchema::parseType(const string& text, size_t& pos, int line) {
+  size_t end = text.find_first_of("<,>", pos);
+  string word = text.substr(pos, end == string::npos ? string::npos : end - pos);
+  pos = end == string::npos ? text.size() : end;
+
+  TSchemaType type;
+  type.binary = false;
+  type.index = -1;
+  type.key = -1;
+  type.value = -1;
+
+  if (word == "bool") {
+    type.ttype = T_BOOL;
+  } else if (word == "byte") {
+    type.ttype = T_BYTE;
+  } else if (word == "i16") {
+    type.ttype = T_I16;
+  } else if (word == "i32") {
+    type.ttype = T_I32;
+  } else if (word == "i64") {
+    type.ttype = T_I64;
+  } else if (word == "double") {
+    type.ttype = T_DOUBLE;
+  } else if (word == "string" || word == "binary") {
+    type.ttype = T_STRING;
+    type.binary = word == "binary";
+  } else if (word.compare(0, 5, "enum:") == 0) {
+    type.ttype = T_I32;
+    map<string, int32_t>::const_iterator it = enumsByName_.find(word.substr(5));
+    if (it == enumsByName_.end()) {
+      throw schemaError(line, "unknown enum " + word.substr(5));
+    }
+    type.index = it->second;
+  } else if (word.compare(0, 7, "struct:") == 0) {
+    type.ttype = T_STRUCT;
+    type.index = findStruct(word.substr(7));
+    if (type.index < 0) {
+      throw schemaError(line, "unknown struct " + word.substr(7));
+    }
+  } else if (word == "list" || word == "set" || word == "map") {
+    type.ttype = word == "list" ? T_LIST : (word == "set" ? T_SET : T_MAP);
+    if (pos >= text.size() || text[pos] != '<') {
+      throw schemaError(line, "bad type " + text);
+    }
+    ++pos;
+    if (type.ttype == T_MAP) {
+      type.key = parseType(text, pos, line);
+      if (pos >= text.size() || text[pos] != ',') {
+        throw schemaError(line, "bad type " + text);
+      }
+      ++pos;
+    }
+    type.value = parseType(text, pos, line);
+    if (pos >= text.size() || text[pos] != '>') {
+      throw schemaError(line, "bad type " + text);
+    }
+    ++pos;
+  } else {
+    throw schemaError(line, "unknown type " + word);
+  }
+
+  types_.push_back(type);
+  return static_cast<int32_t>(types_.size() - 1);
+}
+
+int32_t TSchema::findStruct(const string& name) const {
+  map<string, int32_t>::const_iterator it = structsByName_.find(name);
+  return it == structsByName_.end() ? -1 : it->second;
+}
+
+int32_t TSchema::findService(const string& name) const {
+  map<string, int32_t>::const_iterator it = servicesByName_.find(name);
+  return it == servicesByName_.end() ? -1 : it->second;
+}
+
+const TSchemaFunction* TSchema::findFunction(const string& service, const string& name) const {
+  int32_t index = findService(service);
+  while (index >= 0) {
+    const TSchemaService& tservice = services_[index];
+    for (size_t i = 0; i < tservice.functions.size(); ++i) {
+      if (tservice.functions[i].name == name) {
+        return &tservice.functions[i];
+      }
+    }
+    index = tservice.extends;
+  }
+  return NULL;
+}
+
+}}} // apache::thrift::protocol
@@ -0,0 +1,137 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TSCHEMA_H_
+#define _THRIFT_PROTOCOL_TSCHEMA_H_ 1
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/Thrift.h>
+#include <thrift/protocol/TProtocol.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * A type in a TSchema.  Types refer to each other, and to structs and
+ * enums, by their index in the schema.
+ */
+struct TSchemaType {
+  TType ttype;
+  /// For T_STRING, whether it is binary, which some protocols encode apart
+  bool binary;
+  /// The struct of a T_STRUCT, or the enum of an enum's T_I32, else -1
+  int32_t index;
+  /// The key type of a map, else -1
+  int32_t key;
+  /// The element type of a list or set, or the value type of a map, else -1
+  int32_t value;
+};
+
+enum TSchemaRequiredness {
+  T_SCHEMA_DEFAULT,
+  T_SCHEMA_REQUIRED,
+  T_SCHEMA_OPTIONAL
+};
+
+struct TSchemaField {
+  int16_t id;
+  TSchemaRequiredness req;
+  std::string name;
+  int32_t type;
+};
+
+/// A struct, union or exception, with its fields in id order
+struct TSchemaStruct {
+  std::string name;
+  std::vector<TSchemaField> fields;
+
+  /// The field called name, or NULL
+  const TSchemaField* findField(const std::string& fieldName) const;
+};
+
+struct TSchemaEnum {
+  std::string name;
+  std::vector<std::pair<std::string, int32_t> > values;
+};
+
+/// A function, with the structs its arguments and result go on the wire as
+struct TSchemaFunction {
+  std::string name;
+  bool oneway;
+  int32_t args;
+  int32_t result;
+};
+
+struct TSchemaService {
+  std::string name;
+  /// The service this one extends, or -1
+  int32_t extends;
+  std::vector<TSchemaFunction> functions;
+};
+
+/**
+ * The types and services of a Thrift program, loaded at run time from the
+ * .tschema file the compiler writes with --gen schema.  Names are
+ * qualified with their program, as in tutorial.Work.
+ *
+ * A TSchema is only a description; TDecodePlan compiles one into what
+ * TDynamicValue messages are read and written with.
+ */
+class TSchema {
+ public:
+  /// Parses the text of a .tschema file, throwing a TException if it is bad
+  explicit TSchema(const std::string& text);
+
+  /// Loads a .tschema file
+  static boost::shared_ptr<TSchema> load(const std::string& path);
+
+  const std::vector<TSchemaType>& getTypes() const { return types_; }
+  const std::vector<TSchemaStruct>& getStructs() const { return structs_; }
+  const std::vector<TSchemaEnum>& getEnums() const { return enums_; }
+  const std::vector<TSchemaService>& getServices() const { return services_; }
+
+  /// The index of the struct called name, or -1
+  int32_t findStruct(const std::string& name) const;
+
+  /// The index of the service called name, or -1
+  int32_t findService(const std::string& name) const;
+
+  /**
+   * The function called name of the service called service, or of the
+   * services it extends, or NULL.
+   */
+  const TSchemaFunction* findFunction(const std::string& service, const std::string& name) const;
+
+ private:
+  int32_t parseType(const std::string& text, size_t& pos, int line);
+
+  std::vector<TSchemaType> types_;
+  std::vector<TSchemaStruct> structs_;
+  std::vector<TSchemaEnum> enums_;
+  std::vector<TSchemaService> services_;
+  std::map<std::string, int32_t> structsByName_;
+  std::map<std::string, int32_t> enumsByName_;
+  std::map<std::string, int32_t> servicesByName_;
+};
+
+}}} // apache::thrift::protocol
+
+#endif // #ifndef _THRIFT_PROTOCOL_TSCHEMA_H_
@@ -0,0 +1,52 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TSERIALIZEDSIZE_H_
+#define _THRIFT_PROTOCOL_TSERIALIZEDSIZE_H_ 1
+
+#include <boost/shared_ptr.hpp>
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TCountingTransport.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * The exact number of bytes value takes when written with the protocol
+ * template Protocol_, such as TBinaryProtocolT or TCompactProtocolT:
+ *
+ *   uint32_t size = serializedSize<TCompactProtocolT>(request);
+ *   buffer->reserve(size);
+ *
+ * The value is written to a TCountingTransport, so nothing is stored or
+ * copied, and the protocol's writes into the transport are inlined.
+ * Generated structs have a serializedSize<Protocol_>() method that calls
+ * this.
+ */
+template <template <class> class Protocol_, class T>
+uint32_t serializedSize(const T& value) {
+  boost::shared_ptr<transport::TCountingTransport> counter(
+    new transport::TCountingTransport());
+  Protocol_<transport::TCountingTransport> prot(counter);
+  value.write(&prot);
+  return static_cast<uint32_t>(counter->getCount());
+}
+
+}}} // apache::thrift::protocol
+
+#endif // #ifndef _THRIFT_PROTOCOL_TSERIALIZEDSIZE_H_
@@ -0,0 +1,945 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/protocol/TSimpleJSONProtocol.h>
+
+#include <math.h>
+#include <string.h>
+#include <thrift/protocol/TBase64Utils.h>
+#include <thrift/protocol/TJSONUtils.h>
+
+using namespace apache::thrift::transport;
+
+namespace apache { namespace thrift { namespace protocol {
+
+static const uint8_t kJSONObjectStart = '{';
+static const uint8_t kJSONObjectEnd = '}';
+static const uint8_t kJSONArrayStart = '[';
+static const uint8_t kJSONArrayEnd = ']';
+static const uint8_t kJSONPairSeparator = ':';
+static const uint8_t kJSONElemSeparator = ',';
+static const uint8_t kJSONBackslash = '\\';
+static const uint8_t kJSONStringDelimiter = '"';
+
+static const std::string kJSONTrue("true");
+static const std::string kJSONFalse("false");
+static const std::string kJSONNull("null");
+
+static const std::string kThriftNan("NaN");
+static const std::string kThriftInfinity("Infinity");
+static const std::string kThriftNegativeInfinity("-Infinity");
+
+static bool isJSONWhitespace(uint8_t ch) {
+  return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+// Return true if ch ends a number or literal outside a string
+static bool isJSONDelimiter(uint8_t ch) {
+  return isJSONWhitespace(ch) || ch == kJSONElemSeparator || ch == kJSONPairSeparator ||
+         ch == kJSONObjectEnd || ch == kJSONArrayEnd;
+}
+
+static TProtocolException unexpectedEnd() {
+  return TProtocolException(TProtocolException::INVALID_DATA,
+                            "Unexpected end of JSON value");
+}
+
+// Return the value of the four hex digits at pos in str
+static uint32_t readHex4(const std::string& str, size_t pos) {
+  if (pos + 4 > str.size()) {
+    throw unexpectedEnd();
+  }
+  uint32_t value = 0;
+  for (size_t i = pos; i < pos + 4; ++i) {
+    uint8_t ch = static_cast<uint8_t>(str[i]);
+    value <<= 4;
+    if (ch >= '0' && ch <= '9') {
+      value |= ch - '0';
+    }
+    else if (ch >= 'a' && ch <= 'f') {
+      value |= ch - 'a' + 10;
+    }
+    else if (ch >= 'A' && ch <= 'F') {
+      value |= ch - 'A' + 10;
+    }
+    else {
+      throw TProtocolException(TProtocolException::INVALID_DATA,
+                               "Expected hex val ([0-9a-fA-F]); got \'"
+                                 + std::string((char *)&ch, 1) + "\'.");
+    }
+  }
+  return value;
+}
+
+// Append the code point cp to str in UTF-8
+static void appendUTF8(std::string& str, uint32_t cp) {
+  if (cp < 0x80) {
+    str += static_cast<char>(cp);
+  }
+  else if (cp < 0x800) {
+    str += static_cast<char>(0xC0 | (cp >> 6));
+    str += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+  else if (cp < 0x10000) {
+    str += static_cast<char>(0xE0 | (cp >> 12));
+    str += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    str += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+  else {
+    str += static_cast<char>(0xF0 | (cp >> 18));
+    str += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    str += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    str += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+}
+
+
+TSimpleJSONProtocol::TSimpleJSONProtocol(boost::shared_ptr<TTransport> ptrans) :
+  TVirtualProtocol<TSimpleJSONProtocol>(ptrans),
+  trans_(ptrans.get()),
+  pos_(0) {
+}
+
+TSimpleJSONProtocol::~TSimpleJSONProtocol() {}
+
+  /**
+   * Writing functions
+   */
+
+// Whether the next value written is a key of the innermost object
+bool TSimpleJSONProtocol::atKey() const {
+  if (writeContexts_.empty()) {
+    return false;
+  }
+  const Context& ctx = writeContexts_.back();
+  return ctx.object && ctx.state != COLON;
+}
+
+// Write the comma or colon that goes before the next value, if any
+uint32_t TSimpleJSONProtocol::writeSeparator() {
+  if (writeContexts_.empty()) {
+    return 0;
+  }
+  Context& ctx = writeContexts_.back();
+  switch (ctx.state) {
+  case FIRST:
+    ctx.state = ctx.object ? COLON : NEXT;
+    return 0;
+  case NEXT:
+    trans_->write(&kJSONElemSeparator, 1);
+    ctx.state = ctx.object ? COLON : NEXT;
+    return 1;
+  case COLON:
+    trans_->write(&kJSONPairSeparator, 1);
+    ctx.state = NEXT;
+    return 1;
+  default:
+    ctx.state = NEXT;
+    return 0;
+  }
+}
+
+uint32_t TSimpleJSONProtocol::writeQuote() {
+  trans_->write(&kJSONStringDelimiter, 1);
+  return 1;
+}
+
+uint32_t TSimpleJSONProtocol::writeOpen(uint8_t ch, bool object) {
+  if (atKey()) {
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Map keys must be strings, numbers or bools");
+  }
+  uint32_t result = writeSeparator();
+  trans_->write(&ch, 1);
+  writeContexts_.push_back(Context(object, NULL));
+  return result + 1;
+}
+
+uint32_t TSimpleJSONProtocol::writeClose(uint8_t ch) {
+  writeContexts_.pop_back();
+  trans_->write(&ch, 1);
+  return 1;
+}
+
+// Write a number or literal, quoted if it is a map key
+uint32_t TSimpleJSONProtocol::writeNumber(const char* str, uint32_t len) {
+  bool key = atKey();
+  uint32_t result = writeSeparator();
+  if (key) {
+    result += writeQuote();
+  }
+  trans_->write((const uint8_t *)str, len);
+  result += len;
+  if (key) {
+    result += writeQuote();
+  }
+  return result;
+}
+
+template <typename NumberType>
+uint32_t TSimpleJSONProtocol::writeInteger(NumberType num) {
+  char buf[24];
+  char* end = buf + sizeof(buf);
+  char* val = formatJSONInteger(static_cast<int64_t>(num), end);
+  return writeNumber(val, static_cast<uint32_t>(end - val));
+}
+
+uint32_t TSimpleJSONProtocol::writeMessageBegin(const std::string& name,
+                                                const TMessageType messageType,
+                                                const int32_t seqid) {
+  uint32_t result = writeOpen(kJSONArrayStart, false);
+  result += writeString(name);
+  result += writeInteger(static_cast<int32_t>(messageType));
+  result += writeInteger(seqid);
+  return result;
+}
+
+uint32_t TSimpleJSONProtocol::writeMessageEnd() {
+  return writeClose(kJSONArrayEnd);
+}
+
+uint32_t TSimpleJSONProtocol::writeStructBegin(const char* name) {
+  (void) name;
+  return writeOpen(kJSONObjectStart, true);
+}
+
+uint32_t TSimpleJSONProtocol::writeStructEnd() {
+  return writeClose(kJSONObjectEnd);
+}
+
+uint32_t TSimpleJSONProtocol::writeFieldBegin(const char* name,
+                                              const TType fieldType,
+                                              const int16_t fieldId) {
+  (void) fieldType;
+  (void) fieldId;
+  uint32_t result = writeSeparator();
+  result += writeQuote();
+  result += writeJSONChars(*trans_, (const uint8_t *)name,
+                           static_cast<uint32_t>(strlen(name)));
+  result += writeQuote();
+  return result;
+}
+
+uint32_t TSimpleJSONProtocol::writeFieldEnd() {
+  return 0;
+}
+
+uint32_t TSimpleJSONProtocol::writeFieldStop() {
+  return 0;
+}
+
+uint32_t TSimpleJSONProtocol::writeMapBegin(const TType keyType,
+                                            const TType valType,
+                                            const uint32_t size) {
+  (void) keyType;
+  (void) valType;
+  (void) size;
+  return writeOpen(kJSONObjectStart, true);
+}
+
+uint32_t TSimpleJSONProtocol::writeMapEnd() {
+  return writeClose(kJSONObjectEnd);
+}
+
+uint32_t TSimpleJSONProtocol::writeListBegin(const TType elemType,
+                                             const uint32_t size) {
+  (void) elemType;
+  (void) size;
+  return writeOpen(kJSONArrayStart, false);
+}
+
+uint32_t TSimpleJSONProtocol::writeListEnd() {
+  return writeClose(kJSONArrayEnd);
+}
+
+uint32_t TSimpleJSONProtocol::writeSetBegin(const TType elemType,
+                                            const uint32_t size) {
+  (void) elemType;
+  (void) size;
+  return writeOpen(kJSONArrayStart, false);
+}
+
+uint32_t TSimpleJSONProtocol::writeSetEnd() {
+  return writeClose(kJSONArrayEnd);
+}
+
+uint32_t TSimpleJSONProtocol::writeBool(const bool value) {
+  const std::string& str = value ? kJSONTrue : kJSONFalse;
+  return writeNumber(str.data(), static_cast<uint32_t>(str.size()));
+}
+
+uint32_t TSimpleJSONProtocol::writeByte(const int8_t byte) {
+  return writeInteger(byte);
+}
+
+uint32_t TSimpleJSONProtocol::writeI16(const int16_t i16) {
+  return writeInteger(i16);
+}
+
+uint32_t TSimpleJSONProtocol::writeI32(const int32_t i32) {
+  return writeInteger(i32);
+}
+
+uint32_t TSimpleJSONProtocol::writeI64(const int64_t i64) {
+  return writeInteger(i64);
+}
+
+uint32_t TSimpleJSONProtocol::writeDouble(const double dub) {
+  // NaNs and Infinities are written as strings
+  if (dub != dub) {
+    return writeString(kThriftNan);
+  }
+  else if (dub == HUGE_VAL) {
+    return writeString(kThriftInfinity);
+  }
+  else if (dub == -HUGE_VAL) {
+    return writeString(kThriftNegativeInfinity);
+  }
+  char buf[32];
+  return writeNumber(buf, formatJSONDouble(dub, buf));
+}
+
+uint32_t TSimpleJSONProtocol::writeString(const std::string& str) {
+  if(str.length() > (std::numeric_limits<uint32_t>::max)())
+    throw TProtocolException(TProtocolException::SIZE_LIMIT);
+  uint32_t result = writeSeparator();
+  result += writeQuote();
+  result += writeJSONChars(*trans_, (const uint8_t *)str.data(),
+                           static_cast<uint32_t>(str.length()));
+  result += writeQuote();
+  return result;
+}
+
+uint32_t TSimpleJSONProtocol::writeBinary(const std::string& str) {
+  if(str.length() > (std::numeric_limits<uint32_t>::max)())
+    throw TProtocolException(TProtocolException::SIZE_LIMIT);
+  uint32_t result = writeSeparator();
+  result += writeQuote();
+  const uint8_t *bytes = (const uint8_t *)str.data();
+  uint32_t len = static_cast<uint32_t>(str.length());
+  uint8_t b[4096];
+  const uint32_t chunk = sizeof(b) / 4 * 3;
+  while (len > 0) {
+    uint32_t n = len < chunk ? len : chunk;
+    uint32_t size = base64_encoded_size(n);
+    base64_encode_buffer(bytes, n, b);
+    trans_->write(b, size);
+    result += size;
+    bytes += n;
+    len -= n;
+  }
+  result += writeQuote();
+  return result;
+}
+
+  /**
+   * Reading functions
+   */
+
+// Take in the whole of the next top-level value, dropping what has been read
+// of the last one.  Anything the transport hands over past its end is kept
+// for the value after.  A value nested or sized past the protocol's limits
+// is refused while it is still coming in.
+void TSimpleJSONProtocol::loadValue() {
+  input_.erase(0, pos_);
+  pos_ = 0;
+
+  size_t scan = 0;
+  uint32_t depth = 0;
+  bool started = false;
+  bool scalar = false;
+  bool inString = false;
+  bool escaped = false;
+  while (true) {
+    for (; scan < input_.size(); ++scan) {
+      uint8_t ch = static_cast<uint8_t>(input_[scan]);
+      if (inString) {
+        if (escaped) {
+          escaped = false;
+        }
+        else if (ch == kJSONBackslash) {
+          escaped = true;
+        }
+        else if (ch == kJSONStringDelimiter) {
+          inString = false;
+          if (depth == 0) {
+            return;
+          }
+        }
+      }
+      else if (scalar) {
+        if (isJSONDelimiter(ch)) {
+          return;
+        }
+      }
+      else if (!started) {
+        if (isJSONWhitespace(ch)) {
+          continue;
+        }
+        started = true;
+        if (ch == kJSONObjectStart || ch == kJSONArrayStart) {
+          depth = 1;
+          checkLoadDepth(depth);
+        }
+        else if (ch == kJSONStringDelimiter) {
+          inString = true;
+        }
+        else {
+          scalar = true;
+        }
+      }
+      else if (ch == kJSONStringDelimiter) {
+        inString = true;
+      }
+      else if (ch == kJSONObjectStart || ch == kJSONArrayStart) {
+        checkLoadDepth(++depth);
+      }
+      else if (ch == kJSONObjectEnd || ch == kJSONArrayEnd) {
+        if (--depth == 0) {
+          return;
+        }
+      }
+    }
+    if (getMessageSizeLimit() != 0 && scan > getMessageSizeLimit()) {
+      throw TProtocolException(TProtocolException::SIZE_LIMIT,
+                               "Message size limit exceeded");
+    }
+
+    // Take whatever the transport has buffered, or failing that one byte
+    uint32_t len = 1;
+    const uint8_t* buf = trans_->borrow(NULL, &len);
+    if (buf != NULL && len > 0) {
+      input_.append((const char *)buf, len);
+      trans_->consume(len);
+    }
+    else {
+      uint8_t ch;
+      trans_->readAll(&ch, 1);
+      input_ += static_cast<char>(ch);
+    }
+  }
+}
+
+void TSimpleJSONProtocol::skipWhitespace() {
+  while (pos_ < input_.size() && isJSONWhitespace(input_[pos_])) {
+    ++pos_;
+  }
+}
+
+void TSimpleJSONProtocol::expectChar(uint8_t ch) {
+  if (pos_ >= input_.size()) {
+    throw unexpectedEnd();
+  }
+  uint8_t ch2 = static_cast<uint8_t>(input_[pos_]);
+  if (ch2 != ch) {
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Expected \'" + std::string((char *)&ch, 1) +
+                             "\'; got \'" + std::string((char *)&ch2, 1) +
+                             "\'.");
+  }
+  ++pos_;
+}
+
+// Read the comma or colon that goes before the next value, if any, and the
+// whitespace around it
+uint32_t TSimpleJSONProtocol::readSeparator() {
+  if (readContexts_.empty()) {
+    loadValue();
+  }
+  size_t start = pos_;
+  skipWhitespace();
+  if (!readContexts_.empty()) {
+    Context& ctx = readContexts_.back();
+    switch (ctx.state) {
+    case FIRST:
+      ctx.state = ctx.object ? COLON : NEXT;
+      break;
+    case NEXT:
+      expectChar(kJSONElemSeparator);
+      ctx.state = ctx.object ? COLON : NEXT;
+      break;
+    case COLON:
+      expectChar(kJSONPairSeparator);
+      ctx.state = NEXT;
+      break;
+    case VALUE:
+      ctx.state = NEXT;
+      break;
+    }
+    skipWhitespace();
+  }
+  return static_cast<uint32_t>(pos_ - start);
+}
+
+uint32_t TSimpleJSONProtocol::readOpen(uint8_t ch, bool object, const TStructSpec* spec) {
+  uint32_t result = readSeparator();
+  expectChar(ch);
+  readContexts_.push_back(Context(object, spec));
+  return result + 1;
+}
+
+uint32_t TSimpleJSONProtocol::readClose(uint8_t ch) {
+  size_t start = pos_;
+  skipWhitespace();
+  expectChar(ch);
+  readContexts_.pop_back();
+  return static_cast<uint32_t>(pos_ - start);
+}
+
+// Decodes a JSON string, including unescaping, and returns the string via str
+uint32_t TSimpleJSONProtocol::readJSONString(std::string& str) {
+  size_t start = pos_;
+  expectChar(kJSONStringDelimiter);
+  str.clear();
+  while (true) {
+    // Copy the run of plain characters in one go
+    uint32_t run = scanJSONStringRun((const uint8_t *)input_.data() + pos_,
+                                     static_cast<uint32_t>(input_.size() - pos_));
+    str.append(input_, pos_, run);
+    pos_ += run;
+    if (pos_ + 1 >= input_.size()) {
+      if (pos_ < input_.size() && input_[pos_] == kJSONStringDelimiter) {
+        ++pos_;
+        break;
+      }
+      throw unexpectedEnd();
+    }
+    uint8_t ch = static_cast<uint8_t>(input_[pos_++]);
+    if (ch == kJSONStringDelimiter) {
+      break;
+    }
+    ch = static_cast<uint8_t>(input_[pos_++]);
+    switch (ch) {
+    case '"':
+    case '\\':
+    case '/':
+      str += static_cast<char>(ch);
+      break;
+    case 'b':
+      str += '\b';
+      break;
+    case 'f':
+      str += '\f';
+      break;
+    case 'n':
+      str += '\n';
+      break;
+    case 'r':
+      str += '\r';
+      break;
+    case 't':
+      str += '\t';
+      break;
+    case 'u': {
+      uint32_t cp = readHex4(input_, pos_);
+      pos_ += 4;
+      // A surrogate pair spells out a code point past the first 64K
+      if (cp >= 0xD800 && cp < 0xDC00 && input_.compare(pos_, 2, "\\u") == 0) {
+        uint32_t low = readHex4(input_, pos_ + 2);
+        if (low >= 0xDC00 && low < 0xE000) {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          pos_ += 6;
+        }
+      }
+      appendUTF8(str, cp);
+      break;
+    }
+    default:
+      throw TProtocolException(TProtocolException::INVALID_DATA,
+                               "Expected control char, got '" +
+                               std::string((const char *)&ch, 1)  + "'.");
+    }
+  }
+  return static_cast<uint32_t>(pos_ - start);
+}
+
+// Read a number or literal, quoted or not, and point token at its text
+uint32_t TSimpleJSONProtocol::readToken(const char*& token, size_t& len) {
+  size_t start = pos_;
+  if (pos_ < input_.size() && input_[pos_] == kJSONStringDelimiter) {
+    size_t end = input_.find(static_cast<char>(kJSONStringDelimiter), pos_ + 1);
+    if (end == std::string::npos) {
+      throw unexpectedEnd();
+    }
+    token = input_.data() + pos_ + 1;
+    len = end - pos_ - 1;
+    pos_ = end + 1;
+  }
+  else {
+    size_t end = pos_;
+    while (end < input_.size() && !isJSONDelimiter(input_[end])) {
+      ++end;
+    }
+    token = input_.data() + pos_;
+    len = end - pos_;
+    pos_ = end;
+  }
+  return static_cast<uint32_t>(pos_ - start);
+}
+
+template <typename NumberType>
+uint32_t TSimpleJSONProtocol::readInteger(NumberType& num) {
+  uint32_t result = readSeparator();
+  const char* token;
+  size_t len;
+  result += readToken(token, len);
+  if (!parseJSONInteger(token, len, num)) {
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Expected numeric value; got \"" +
+                             std::string(token, len) + "\"");
+  }
+  return result;
+}
+
+// Count the elements of the list or map being opened, whose close is at the
+// same depth
+uint32_t TSimpleJSONProtocol::countElements(uint8_t close) const {
+  size_t pos = pos_;
+  while (pos < input_.size() && isJSONWhitespace(input_[pos])) {
+    ++pos;
+  }
+  if (pos < input_.size() && static_cast<uint8_t>(input_[pos]) == close) {
+    return 0;
+  }
+  uint32_t count = 1;
+  uint32_t depth = 0;
+  for (; pos < input_.size(); ++pos) {
+    uint8_t ch = static_cast<uint8_t>(input_[pos]);
+    if (ch == kJSONStringDelimiter) {
+      pos = skipString(pos) - 1;
+    }
+    else if (ch == kJSONObjectStart || ch == kJSONArrayStart) {
+      ++depth;
+    }
+    else if (ch == kJSONObjectEnd || ch == kJSONArrayEnd) {
+      if (depth == 0) {
+        return count;
+      }
+      --depth;
+    }
+    else if (ch == kJSONElemSeparator && depth == 0) {
+      ++count;
+    }
+  }
+  throw unexpectedEnd();
+}
+
+// Return the position just past the string starting at pos
+void TSimpleJSONProtocol::checkLoadDepth(uint32_t depth) const {
+  if (getRecursionLimit() != 0 && depth > getRecursionLimit()) {
+    throw TProtocolException(TProtocolException::DEPTH_LIMIT);
+  }
+}
+
+size_t TSimpleJSONProtocol::skipString(size_t pos) const {
+  for (++pos; pos < input_.size(); ++pos) {
+    if (input_[pos] == kJSONBackslash) {
+      ++pos;
+    }
+    else if (input_[pos] == kJSONStringDelimiter) {
+      return pos + 1;
+    }
+  }
+  throw unexpectedEnd();
+}
+
+// Return the position just past the value starting at pos
+size_t TSimpleJSONProtocol::skipValue(size_t pos) const {
+  if (pos >= input_.size()) {
+    throw unexpectedEnd();
+  }
+  uint8_t ch = static_cast<uint8_t>(input_[pos]);
+  if (ch == kJSONStringDelimiter) {
+    return skipString(pos);
+  }
+  if (ch != kJSONObjectStart && ch != kJSONArrayStart) {
+    size_t start = pos;
+    while (pos < input_.size() && !isJSONDelimiter(input_[pos])) {
+      ++pos;
+    }
+    if (pos == start) {
+      throw TProtocolException(TProtocolException::INVALID_DATA,
+                               "Unexpected \'" + std::string((char *)&ch, 1) +
+                               "\' in JSON value");
+    }
+    return pos;
+  }
+  uint32_t depth = 0;
+  for (; pos < input_.size(); ++pos) {
+    ch = static_cast<uint8_t>(input_[pos]);
+    if (ch == kJSONStringDelimiter) {
+      pos = skipString(pos) - 1;
+    }
+    else if (ch == kJSONObjectStart || ch == kJSONArrayStart) {
+      ++depth;
+    }
+    else if (ch == kJSONObjectEnd || ch == kJSONArrayEnd) {
+      if (--depth == 0) {
+        return pos + 1;
+      }
+    }
+  }
+  throw unexpectedEnd();
+}
+
+// Guess the Thrift type of the value at pos, for skipping it
+TType TSimpleJSONProtocol::guessType(size_t pos) const {
+  while (pos < input_.size() && isJSONWhitespace(input_[pos])) {
+    ++pos;
+  }
+  if (pos >= input_.size()) {
+    throw unexpectedEnd();
+  }
+  uint8_t ch = static_cast<uint8_t>(input_[pos]);
+  switch (ch) {
+  case kJSONObjectStart:
+    return T_STRUCT;
+  case kJSONArrayStart:
+    return T_LIST;
+  case kJSONStringDelimiter:
+    return T_STRING;
+  case 't':
+  case 'f':
+    return T_BOOL;
+  }
+  if (!isJSONNumeric(ch)) {
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Unexpected \'" + std::string((char *)&ch, 1) +
+                             "\' in JSON value");
+  }
+  for (; pos < input_.size() && !isJSONDelimiter(input_[pos]); ++pos) {
+    ch = static_cast<uint8_t>(input_[pos]);
+    if (ch == '.' || ch == 'e' || ch == 'E') {
+      return T_DOUBLE;
+    }
+  }
+  return T_I64;
+}
+
+uint32_t TSimpleJSONProtocol::readMessageBegin(std::string& name,
+                                               TMessageType& messageType,
+                                               int32_t& seqid) {
+  resetMessageLimits();
+  uint32_t result = readOpen(kJSONArrayStart, false, NULL);
+  result += readString(name);
+  int32_t type;
+  result += readInteger(type);
+  messageType = static_cast<TMessageType>(type);
+  result += readInteger(seqid);
+  return result;
+}
+
+uint32_t TSimpleJSONProtocol::readMessageEnd() {
+  return readClose(kJSONArrayEnd);
+}
+
+uint32_t TSimpleJSONProtocol::readStructBegin(std::string& name) {
+  (void) name;
+  return readOpen(kJSONObjectStart, true, NULL);
+}
+
+uint32_t TSimpleJSONProtocol::readStructBeginSpec(std::string& name, const TStructSpec& spec) {
+  (void) name;
+  return readOpen(kJSONObjectStart, true, &spec);
+}
+
+uint32_t TSimpleJSONProtocol::readStructEnd() {
+  return readClose(kJSONObjectEnd);
+}
+
+uint32_t TSimpleJSONProtocol::readFieldBegin(std::string& name,
+                                             TType& fieldType,
+                                             int16_t& fieldId) {
+  size_t start = pos_;
+  while (true) {
+    skipWhitespace();
+    if (pos_ < input_.size() && input_[pos_] == kJSONObjectEnd) {
+      fieldType = T_STOP;
+      fieldId = 0;
+      break;
+    }
+    readSeparator();
+    readJSONString(name);
+    readSeparator();
+    Context& ctx = readContexts_.back();
+    ctx.state = VALUE;
+
+    // A null field is the same as a missing one
+    if (input_.compare(pos_, kJSONNull.size(), kJSONNull) == 0 &&
+        (pos_ + kJSONNull.size() == input_.size() ||
+         isJSONDelimiter(input_[pos_ + kJSONNull.size()]))) {
+      pos_ += kJSONNull.size();
+      ctx.state = NEXT;
+      continue;
+    }
+
+    const TFieldSpec* field = NULL;
+    if (ctx.spec != NULL) {
+      field = ctx.spec->findField(name.data(), name.size());
+    }
+    if (field != NULL) {
+      fieldId = field->id;
+      fieldType = field->type;
+    }
+    else {
+      fieldId = 0;
+      fieldType = guessType(pos_);
+    }
+    break;
+  }
+  return static_cast<uint32_t>(pos_ - start);
+}
+
+uint32_t TSimpleJSONProtocol::readFieldEnd() {
+  return 0;
+}
+
+uint32_t TSimpleJSONProtocol::readMapBegin(TType& keyType,
+                                           TType& valType,
+                                           uint32_t& size) {
+  uint32_t result = readOpen(kJSONObjectStart, true, NULL);
+  size = countElements(kJSONObjectEnd);
+  keyType = T_STRING;
+  valType = T_STRING;
+  if (size > 0) {
+    // The type of the first value, past its key and colon
+    size_t pos = skipString(input_.find(static_cast<char>(kJSONStringDelimiter), pos_));
+    pos = input_.find(static_cast<char>(kJSONPairSeparator), pos);
+    if (pos == std::string::npos) {
+      throw unexpectedEnd();
+    }
+    valType = guessType(pos + 1);
+  }
+  return result;
+}
+
+uint32_t TSimpleJSONProtocol::readMapEnd() {
+  return readClose(kJSONObjectEnd);
+}
+
+uint32_t TSimpleJSONProtocol::readListBegin(TType& elemType,
+                                            uint32_t& size) {
+  uint32_t result = readOpen(kJSONArrayStart, false, NULL);
+  size = countElements(kJSONArrayEnd);
+  elemType = size > 0 ? guessType(pos_) : T_STRING;
+  return result;
+}
+
+uint32_t TSimpleJSONProtocol::readListEnd() {
+  return readClose(kJSONArrayEnd);
+}
+
+uint32_t TSimpleJSONProtocol::readSetBegin(TType& elemType,
+                                           uint32_t& size) {
+  return readListBegin(elemType, size);
+}
+
+uint32_t TSimpleJSONProtocol::readSetEnd() {
+  return readClose(kJSONArrayEnd);
+}
+
+uint32_t TSimpleJSONProtocol::readBool(bool& value) {
+  uint32_t result = readSeparator();
+  const char* token;
+  size_t len;
+  result += readToken(token, len);
+  if (kJSONTrue.compare(0, std::string::npos, token, len) == 0) {
+    value = true;
+  }
+  else if (kJSONFalse.compare(0, std::string::npos, token, len) == 0) {
+    value = false;
+  }
+  else {
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Expected true or false; got \"" +
+                             std::string(token, len) + "\"");
+  }
+  return result;
+}
+
+uint32_t TSimpleJSONProtocol::readByte(int8_t& byte) {
+  return readInteger(byte);
+}
+
+uint32_t TSimpleJSONProtocol::readI16(int16_t& i16) {
+  return readInteger(i16);
+}
+
+uint32_t TSimpleJSONProtocol::readI32(int32_t& i32) {
+  return readInteger(i32);
+}
+
+uint32_t TSimpleJSONProtocol::readI64(int64_t& i64) {
+  return readInteger(i64);
+}
+
+uint32_t TSimpleJSONProtocol::readDouble(double& dub) {
+  uint32_t result = readSeparator();
+  const char* token;
+  size_t len;
+  result += readToken(token, len);
+  if (kThriftNan.compare(0, std::string::npos, token, len) == 0) {
+    dub = HUGE_VAL/HUGE_VAL; // generates NaN
+  }
+  else if (kThriftInfinity.compare(0, std::string::npos, token, len) == 0) {
+    dub = HUGE_VAL;
+  }
+  else if (kThriftNegativeInfinity.compare(0, std::string::npos, token, len) == 0) {
+    dub = -HUGE_VAL;
+  }
+  else if (!parseJSONDouble(token, len, dub)) {
+    throw TProtocolException(TProtocolException::INVALID_DATA,
+                             "Expected numeric value; got \"" +
+                             std::string(token, len) + "\"");
+  }
+  return result;
+}
+
+uint32_t TSimpleJSONProtocol::readString(std::string& str) {
+  uint32_t result = readSeparator();
+  return result + readJSONString(str);
+}
+
+uint32_t TSimpleJSONProtocol::readBinary(std::string& str) {
+  std::string tmp;
+  uint32_t result = readString(tmp);
+  // Padding is not written, but other encoders may add it
+  size_t len = tmp.find('=');
+  if (len == std::string::npos) {
+    len = tmp.length();
+  }
+  if(len > (std::numeric_limits<uint32_t>::max)())
+    throw TProtocolException(TProtocolException::SIZE_LIMIT);
+  uint32_t left = static_cast<uint32_t>(len);
+  str.resize(base64_decoded_size(left));
+  if (!str.empty()) {
+    base64_decode_buffer((const uint8_t *)tmp.data(), left, (uint8_t *)&str[0]);
+  }
+  return result;
+}
+
+uint32_t TSimpleJSONProtocol::skip(TType type) {
+  (void) type;
+  uint32_t result = readSeparator();
+  size_t start = pos_;
+  pos_ = skipValue(pos_);
+  return result + static_cast<uint32_t>(pos_ - start);
+}
+
+}}} // apache::thrift::protocol
@@ -0,0 +1,252 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TSIMPLEJSONPROTOCOL_H_
+#define _THRIFT_PROTOCOL_TSIMPLEJSONPROTOCOL_H_ 1
+
+#include <thrift/protocol/TVirtualProtocol.h>
+#include <thrift/protocol/TStructSpec.h>
+
+#include <string>
+#include <vector>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * Plain JSON, keyed by field name, for consumers that know nothing of
+ * Thrift:
+ *
+ *   {"id":7,"name":"seven","tags":["a","b"],"counts":{"1":2}}
+ *
+ * Structs and maps are JSON objects, lists and sets are arrays, bools are
+ * true and false, and binaries are unpadded base64 strings.  Map keys are
+ * always strings, so numeric and bool keys are quoted, and maps keyed by
+ * structs or containers cannot be written.  NaN and the infinities are
+ * written as the strings "NaN", "Infinity" and "-Infinity", as
+ * TJSONProtocol does.  A message is an array of its name, type and
+ * sequence id followed by its body.
+ *
+ * The writer streams each token straight to the transport.
+ *
+ * Field ids and types are not written, so reading needs the struct's
+ * TStructSpec, which code generated with the simple_json option passes
+ * through readStructBeginSpec().  Fields it does not name, and all fields
+ * of structs read without one, come back with id 0 and a type guessed from
+ * the JSON, so that they are skipped.  Container sizes are not written
+ * either, so the reader takes in each whole top-level value before it
+ * starts, and counts the elements of a list or map as it opens it.
+ */
+class TSimpleJSONProtocol : public TVirtualProtocol<TSimpleJSONProtocol> {
+ public:
+  TSimpleJSONProtocol(boost::shared_ptr<TTransport> ptrans);
+
+  ~TSimpleJSONProtocol();
+
+  /**
+   * Writing functions.
+   */
+
+  uint32_t writeMessageBegin(const std::string& name,
+                             const TMessageType messageType,
+                             const int32_t seqid);
+
+  uint32_t writeMessageEnd();
+
+  uint32_t writeStructBegin(const char* name);
+
+  uint32_t writeStructEnd();
+
+  uint32_t writeFieldBegin(const char* name,
+                           const TType fieldType,
+                           const int16_t fieldId);
+
+  uint32_t writeFieldEnd();
+
+  uint32_t writeFieldStop();
+
+  uint32_t writeMapBegin(const TType keyType,
+                         const TType valType,
+                         const uint32_t size);
+
+  uint32_t writeMapEnd();
+
+  uint32_t writeListBegin(const TType elemType,
+                          const uint32_t size);
+
+  uint32_t writeListEnd();
+
+  uint32_t writeSetBegin(const TType elemType,
+                         const uint32_t size);
+
+  uint32_t writeSetEnd();
+
+  uint32_t writeBool(const bool value);
+
+  uint32_t writeByte(const int8_t byte);
+
+  uint32_t writeI16(const int16_t i16);
+
+  uint32_t writeI32(const int32_t i32);
+
+  uint32_t writeI64(const int64_t i64);
+
+  uint32_t writeDouble(const double dub);
+
+  uint32_t writeString(const std::string& str);
+
+  uint32_t writeBinary(const std::string& str);
+
+  /**
+   * Reading functions
+   */
+
+  uint32_t readMessageBegin(std::string& name,
+                            TMessageType& messageType,
+                            int32_t& seqid);
+
+  uint32_t readMessageEnd();
+
+  uint32_t readStructBegin(std::string& name);
+
+  uint32_t readStructBeginSpec(std::string& name, const TStructSpec& spec);
+
+  virtual uint32_t readStructBeginSpec_virt(std::string& name, const TStructSpec& spec) {
+    return readStructBeginSpec(name, spec);
+  }
+
+  uint32_t readStructEnd();
+
+  uint32_t readFieldBegin(std::string& name,
+                          TType& fieldType,
+                          int16_t& fieldId);
+
+  uint32_t readFieldEnd();
+
+  uint32_t readMapBegin(TType& keyType,
+                        TType& valType,
+                        uint32_t& size);
+
+  uint32_t readMapEnd();
+
+  uint32_t readListBegin(TType& elemType,
+                         uint32_t& size);
+
+  uint32_t readListEnd();
+
+  uint32_t readSetBegin(TType& elemType,
+                        uint32_t& size);
+
+  uint32_t readSetEnd();
+
+  uint32_t readBool(bool& value);
+
+  // Provide the default readBool() implementation for std::vector<bool>
+  using TVirtualProtocol<TSimpleJSONProtocol>::readBool;
+
+  uint32_t readByte(int8_t& byte);
+
+  uint32_t readI16(int16_t& i16);
+
+  uint32_t readI32(int32_t& i32);
+
+  uint32_t readI64(int64_t& i64);
+
+  uint32_t readDouble(double& dub);
+
+  uint32_t readString(std::string& str);
+
+  uint32_t readBinary(std::string& str);
+
+  /**
+   * Skips the next value, whatever it holds.  JSON from elsewhere need not
+   * stick to one type per list, so the type guessed for it is ignored.
+   */
+  uint32_t skip(TType type);
+
+ private:
+  // Where a reader or writer is in the innermost object or array
+  enum State {
+    FIRST,   // before the first element or key
+    NEXT,    // before a later element or key, after a comma
+    COLON,   // before an object's value, after a colon
+    VALUE    // at an object's value, the colon already read
+  };
+
+  struct Context {
+    Context(bool isObject, const TStructSpec* structSpec)
+      : object(isObject), state(FIRST), spec(structSpec) {}
+
+    bool object;
+    State state;
+    const TStructSpec* spec;
+  };
+
+  uint32_t writeSeparator();
+  uint32_t writeQuote();
+  uint32_t writeOpen(uint8_t ch, bool object);
+  uint32_t writeClose(uint8_t ch);
+  uint32_t writeNumber(const char* str, uint32_t len);
+  template <typename NumberType>
+  uint32_t writeInteger(NumberType num);
+  bool atKey() const;
+
+  void loadValue();
+  void checkLoadDepth(uint32_t depth) const;
+  uint32_t readSeparator();
+  uint32_t readOpen(uint8_t ch, bool object, const TStructSpec* spec);
+  uint32_t readClose(uint8_t ch);
+  uint32_t readJSONString(std::string& str);
+  uint32_t readToken(const char*& token, size_t& len);
+  template <typename NumberType>
+  uint32_t readInteger(NumberType& num);
+  void skipWhitespace();
+  void expectChar(uint8_t ch);
+  uint32_t countElements(uint8_t close) const;
+  TType guessType(size_t pos) const;
+  size_t skipString(size_t pos) const;
+  size_t skipValue(size_t pos) const;
+
+  TTransport* trans_;
+
+  std::vector<Context> writeContexts_;
+
+  std::vector<Context> readContexts_;
+
+  // The top-level value being read, and how far into it the reader is
+  std::string input_;
+  size_t pos_;
+};
+
+/**
+ * Constructs input and output protocol objects given transports.
+ */
+class TSimpleJSONProtocolFactory : public TProtocolFactory {
+ public:
+  TSimpleJSONProtocolFactory() {}
+
+  virtual ~TSimpleJSONProtocolFactory() {}
+
+  boost::shared_ptr<TProtocol> getProtocol(boost::shared_ptr<TTransport> trans) {
+    return boost::shared_ptr<TProtocol>(new TSimpleJSONProtocol(trans));
+  }
+};
+
+}}} // apache::thrift::protocol
+
+#endif // #define _THRIFT_PROTOCOL_TSIMPLEJSONPROTOCOL_H_
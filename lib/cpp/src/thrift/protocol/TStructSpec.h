@@ -0,0 +1,85 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TSTRUCTSPEC_H_
+#define _THRIFT_PROTOCOL_TSTRUCTSPEC_H_ 1
+
+#include <string.h>
+#include <thrift/protocol/TProtocol.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * The name, id and type of one field of a struct.
+ */
+struct TFieldSpec {
+  const char* name;
+  int16_t id;
+  TType type;
+};
+
+/**
+ * A struct's fields, with a perfect hash table for finding them by name.
+ *
+ * The generator's simple_json option emits one of these for each struct,
+ * as a static structSpec() method, and has read() pass it to
+ * TProtocol::readStructBeginSpec().  The table is laid out by the
+ * compiler: slots has mask + 1 entries, and the field named name, if there
+ * is one, is fields[slots[hashFieldName(name, len, seed) & mask]].  Empty
+ * slots hold -1.
+ */
+struct TStructSpec {
+  const char* name;
+  const TFieldSpec* fields;
+  uint32_t numFields;
+  const int16_t* slots;
+  uint32_t mask;
+  uint32_t seed;
+
+  /// The field called fieldName, len bytes long, or NULL if there is none
+  const TFieldSpec* findField(const char* fieldName, size_t len) const {
+    int16_t slot = slots[hashFieldName(fieldName, len, seed) & mask];
+    if (slot < 0) {
+      return NULL;
+    }
+    const TFieldSpec* field = &fields[slot];
+    if (strncmp(field->name, fieldName, len) != 0 || field->name[len] != '\0') {
+      return NULL;
+    }
+    return field;
+  }
+
+  /**
+   * Seeded FNV-1a with the high bits folded in.  The compiler searches for
+   * a seed under which no two names share a slot, so it has its own copy of
+   * this function that must be kept the same.
+   */
+  static uint32_t hashFieldName(const char* fieldName, size_t len, uint32_t seed) {
+    uint32_t hash = 2166136261U ^ seed;
+    for (size_t i = 0; i < len; ++i) {
+      hash ^= static_cast<uint8_t>(fieldName[i]);
+      hash *= 16777619U;
+    }
+    return hash ^ (hash >> 16);
+  }
+};
+
+}}} // apache::thrift::protocol
+
+#endif // #ifndef _THRIFT_PROTOCOL_TSTRUCTSPEC_H_
@@ -0,0 +1,245 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/protocol/TUtf8.h>
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#include <immintrin.h>
+#define THRIFT_UTF8_AVX2 1
+#endif
+
+namespace apache { namespace thrift { namespace protocol {
+
+namespace {
+
+bool validUtf8Scalar(const uint8_t* p, uint32_t len) {
+  uint32_t i = 0;
+  while (i < len) {
+    // Skip ASCII a word at a time
+    if (len - i >= 8) {
+      uint64_t word;
+      std::memcpy(&word, p + i, sizeof(word));
+      if ((word & 0x8080808080808080ULL) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+    uint8_t c = p[i];
+    if (c < 0x80) {
+      ++i;
+      continue;
+    }
+
+    // How many continuation bytes follow, and the range the first of
+    // them must be in to rule out overlong forms, surrogates and values
+    // past U+10FFFF
+    uint32_t n;
+    uint8_t lo = 0x80;
+    uint8_t hi = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf) {
+      n = 1;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      n = 2;
+      if (c == 0xe0) {
+        lo = 0xa0;
+      } else if (c == 0xed) {
+        hi = 0x9f;
+      }
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      n = 3;
+      if (c == 0xf0) {
+        lo = 0x90;
+      } else if (c == 0xf4) {
+        hi = 0x8f;
+      }
+    } else {
+      return false;
+    }
+    if (len - i - 1 < n || p[i + 1] < lo || p[i + 1] > hi) {
+      return false;
+    }
+    for (uint32_t k = 2; k <= n; ++k) {
+      if ((p[i + k] & 0xc0) != 0x80) {
+        return false;
+      }
+    }
+    i += n + 1;
+  }
+  return true;
+}
+
+#ifdef THRIFT_UTF8_AVX2
+// Keiser and Lemire's check: each pair of adjacent bytes is looked up by
+// the high and low nibble of the first and the high nibble of the second,
+// and the three results share a bit only for a bad pair.  Whether a pair
+// of continuation bytes is allowed depends on the lead two or three bytes
+// back, which is checked on its own.
+
+bool cpuHasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+}
+
+const bool HAVE_AVX2 = cpuHasAvx2();
+
+const int8_t TOO_SHORT = 1 << 0;   // lead byte not followed by a continuation
+const int8_t TOO_LONG = 1 << 1;    // ASCII followed by a continuation
+const int8_t OVERLONG_3 = 1 << 2;
+const int8_t TOO_LARGE = 1 << 3;
+const int8_t SURROGATE = 1 << 4;
+const int8_t OVERLONG_2 = 1 << 5;
+const int8_t TOO_LARGE_1000 = 1 << 6;
+const int8_t OVERLONG_4 = 1 << 6;
+const int8_t TWO_CONTS = static_cast<int8_t>(1 << 7);
+const int8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+// The 16 bytes given, in both lanes
+__attribute__((target("avx2")))
+inline __m256i table(int8_t a0, int8_t a1, int8_t a2, int8_t a3,
+                     int8_t a4, int8_t a5, int8_t a6, int8_t a7,
+                     int8_t a8, int8_t a9, int8_t a10, int8_t a11,
+                     int8_t a12, int8_t a13, int8_t a14, int8_t a15) {
+  return _mm256_broadcastsi128_si256(_mm_setr_epi8(a0, a1, a2, a3, a4, a5, a6, a7,
+                                                   a8, a9, a10, a11, a12, a13, a14, a15));
+}
+
+// The 32 bytes ending n bytes into in, the rest taken from the end of prev
+template <int n>
+__attribute__((target("avx2")))
+inline __m256i previous(__m256i in, __m256i prev) {
+  return _mm256_alignr_epi8(in, _mm256_permute2x128_si256(prev, in, 0x21), 16 - n);
+}
+
+// Nonzero wherever in, following prev, breaks the rules
+__attribute__((target("avx2")))
+inline __m256i checkBlock(__m256i in, __m256i prev) {
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i byte1High = table(
+    // 0xxx: ASCII
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    // 10xx: continuation
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    // 1100, 1101: two byte lead
+    TOO_SHORT | OVERLONG_2, TOO_SHORT,
+    // 1110: three byte lead
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    // 1111: four byte lead
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+  const __m256i byte1Low = table(
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY, CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000);
+  const __m256i byte2High = table(
+    // 0xxx: ASCII
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    // 1000, 1001, 101x: continuation
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    // 11xx: lead
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+  __m256i prev1 = previous<1>(in, prev);
+  __m256i special = _mm256_and_si256(
+    _mm256_and_si256(
+      _mm256_shuffle_epi8(byte1High, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+      _mm256_shuffle_epi8(byte1Low, _mm256_and_si256(prev1, nibble))),
+    _mm256_shuffle_epi8(byte2High, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+
+  // Third and fourth bytes must be continuations, and nothing else may be
+  // a second continuation in a row
+  __m256i third = _mm256_subs_epu8(previous<2>(in, prev), _mm256_set1_epi8(0xe0 - 0x80));
+  __m256i fourth = _mm256_subs_epu8(previous<3>(in, prev), _mm256_set1_epi8(0xf0 - 0x80));
+  __m256i must = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(-0x80));
+  return _mm256_xor_si256(must, special);
+}
+
+__attribute__((target("avx2")))
+bool validUtf8Avx2(const uint8_t* p, uint32_t len) {
+  // Nonzero in the last three bytes if a sequence runs off the end
+  const __m256i lastLeads = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i prev = zero;
+  __m256i incomplete = zero;
+  __m256i error = zero;
+  uint32_t pos = 0;
+  for (;;) {
+    // The last block is padded with ASCII, so a sequence cut short by the
+    // end of the input is caught like any other
+    bool last = len - pos < 32;
+    __m256i in;
+    if (!last) {
+      in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + pos));
+    } else {
+      uint8_t tail[32];
+      std::memset(tail, 0, sizeof(tail));
+      std::memcpy(tail, p + pos, len - pos);
+      in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail));
+    }
+
+    if (_mm256_movemask_epi8(in) == 0) {
+      error = _mm256_or_si256(error, incomplete);
+      prev = zero;
+      incomplete = zero;
+    } else {
+      error = _mm256_or_si256(error, checkBlock(in, prev));
+      incomplete = _mm256_subs_epu8(in, lastLeads);
+      prev = in;
+    }
+    if (!_mm256_testz_si256(error, error)) {
+      return false;
+    }
+    if (last) {
+      return true;
+    }
+    pos += 32;
+  }
+}
+#endif // THRIFT_UTF8_AVX2
+
+} // namespace
+
+bool validUtf8(const uint8_t* data, uint32_t len) {
+#ifdef THRIFT_UTF8_AVX2
+  if (HAVE_AVX2) {
+    return validUtf8Avx2(data, len);
+  }
+#endif
+  return validUtf8Scalar(data, len);
+}
+
+}}} // apache::thrift::protocol
@@ -0,0 +1,40 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_PROTOCOL_TUTF8_H_
+#define _THRIFT_PROTOCOL_TUTF8_H_ 1
+
+#include <thrift/Thrift.h>
+
+namespace apache { namespace thrift { namespace protocol {
+
+/**
+ * Whether the len bytes at data are well-formed UTF-8: no overlong forms,
+ * surrogates, code points past U+10FFFF or sequences cut short.
+ *
+ * On x86-64 CPUs with AVX2 (checked at runtime) it looks at 32 bytes at a
+ * time, checking every byte against the two before it with table lookups
+ * rather than walking the sequences one by one.  Elsewhere runs of ASCII
+ * are skipped eight bytes at a time and the rest is checked in plain C++.
+ */
+bool validUtf8(const uint8_t* data, uint32_t len);
+
+}}} // apache::thrift::protocol
+
+#endif // #define _THRIFT_PROTOCOL_TUTF8_H_
@@ -309,6 +309,19 @@ class TProtocolDefaults : public TProtocol {
     return ::apache::thrift::protocol::skip(*this, type);
   }
 
+  uint32_t readRaw(TType type, std::string& raw) {
+    (void) type;
+    (void) raw;
+    throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+                             "this protocol does not support raw values.");
+  }
+
+  uint32_t writeRaw(const std::string& raw) {
+    (void) raw;
+    throw TProtocolException(TProtocolException::NOT_IMPLEMENTED,
+                             "this protocol does not support raw values.");
+  }
+
  protected:
   TProtocolDefaults(boost::shared_ptr<TTransport> ptrans)
     : TProtocol(ptrans)
@@ -409,6 +422,18 @@ class TVirtualProtocol : public Super_ {
     return static_cast<Protocol_*>(this)->writeI64(i64);
   }
 
+  virtual uint32_t writeI32s_virt(const int32_t* values, uint32_t n) {
+    return static_cast<Protocol_*>(this)->writeI32s(values, n);
+  }
+
+  virtual uint32_t writeI64s_virt(const int64_t* values, uint32_t n) {
+    return static_cast<Protocol_*>(this)->writeI64s(values, n);
+  }
+
+  virtual uint32_t writeDoubles_virt(const double* values, uint32_t n) {
+    return static_cast<Protocol_*>(this)->writeDoubles(values, n);
+  }
+
   virtual uint32_t writeDouble_virt(const double dub) {
     return static_cast<Protocol_*>(this)->writeDouble(dub);
   }
@@ -421,6 +446,14 @@ class TVirtualProtocol : public Super_ {
     return static_cast<Protocol_*>(this)->writeBinary(str);
   }
 
+  virtual uint32_t writeStringView_virt(const TStringView& str) {
+    return static_cast<Protocol_*>(this)->writeStringView(str);
+  }
+
+  virtual uint32_t writeBinaryView_virt(const TStringView& str) {
+    return static_cast<Protocol_*>(this)->writeBinaryView(str);
+  }
+
   /**
    * Reading functions
    */
@@ -507,6 +540,18 @@ class TVirtualProtocol : public Super_ {
     return static_cast<Protocol_*>(this)->readI64(i64);
   }
 
+  virtual uint32_t readI32s_virt(int32_t* values, uint32_t n) {
+    return static_cast<Protocol_*>(this)->readI32s(values, n);
+  }
+
+  virtual uint32_t readI64s_virt(int64_t* values, uint32_t n) {
+    return static_cast<Protocol_*>(this)->readI64s(values, n);
+  }
+
+  virtual uint32_t readDoubles_virt(double* values, uint32_t n) {
+    return static_cast<Protocol_*>(this)->readDoubles(values, n);
+  }
+
   virtual uint32_t readDouble_virt(double& dub) {
     return static_cast<Protocol_*>(this)->readDouble(dub);
   }
@@ -519,10 +564,46 @@ class TVirtualProtocol : public Super_ {
     return static_cast<Protocol_*>(this)->readBinary(str);
   }
 
+  virtual uint32_t readStringView_virt(TStringView& str) {
+    return static_cast<Protocol_*>(this)->readStringView(str);
+  }
+
+  virtual uint32_t readBinaryView_virt(TStringView& str) {
+    return static_cast<Protocol_*>(this)->readBinaryView(str);
+  }
+
   virtual uint32_t skip_virt(TType type) {
     return static_cast<Protocol_*>(this)->skip(type);
   }
 
+  virtual uint32_t readRaw_virt(TType type, std::string& raw) {
+    return static_cast<Protocol_*>(this)->readRaw(type, raw);
+  }
+
+  virtual uint32_t writeRaw_virt(const std::string& raw) {
+    return static_cast<Protocol_*>(this)->writeRaw(raw);
+  }
+
+  virtual uint32_t writeFieldHeader_virt(const char* name,
+                                         const TType fieldType,
+                                         const int16_t fieldId,
+                                         const char* binaryHeader) {
+    return static_cast<Protocol_*>(this)->writeFieldHeader(name, fieldType,
+                                                           fieldId, binaryHeader);
+  }
+
+  /*
+   * By default the header is written by writeFieldBegin().
+   */
+  uint32_t writeFieldHeader(const char* name,
+                            const TType fieldType,
+                            const int16_t fieldId,
+                            const char* binaryHeader) {
+    (void) binaryHeader;
+    return static_cast<Protocol_*>(this)->writeFieldBegin(name, fieldType,
+                                                          fieldId);
+  }
+
   /*
    * Provide a default skip() implementation that uses non-virtual read
    * methods.
@@ -553,6 +634,84 @@ class TVirtualProtocol : public Super_ {
   }
   using Super_::readBool; // so we don't hide readBool(bool&)
 
+  /*
+   * Provide default implementations of the integer run reads and writes,
+   * one element at a time, for protocols with no faster way.
+   */
+  uint32_t writeI32s(const int32_t* values, uint32_t n) {
+    uint32_t wsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      wsize += static_cast<Protocol_*>(this)->writeI32(values[i]);
+    }
+    return wsize;
+  }
+
+  uint32_t writeI64s(const int64_t* values, uint32_t n) {
+    uint32_t wsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      wsize += static_cast<Protocol_*>(this)->writeI64(values[i]);
+    }
+    return wsize;
+  }
+
+  uint32_t writeDoubles(const double* values, uint32_t n) {
+    uint32_t wsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      wsize += static_cast<Protocol_*>(this)->writeDouble(values[i]);
+    }
+    return wsize;
+  }
+
+  uint32_t readI32s(int32_t* values, uint32_t n) {
+    uint32_t rsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      rsize += static_cast<Protocol_*>(this)->readI32(values[i]);
+    }
+    return rsize;
+  }
+
+  uint32_t readI64s(int64_t* values, uint32_t n) {
+    uint32_t rsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      rsize += static_cast<Protocol_*>(this)->readI64(values[i]);
+    }
+    return rsize;
+  }
+
+  uint32_t readDoubles(double* values, uint32_t n) {
+    uint32_t rsize = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      rsize += static_cast<Protocol_*>(this)->readDouble(values[i]);
+    }
+    return rsize;
+  }
+
+  /*
+   * Provide default implementations of the string view reads and writes,
+   * which go through a std::string.
+   */
+  uint32_t writeStringView(const TStringView& str) {
+    return static_cast<Protocol_*>(this)->writeString(str.str());
+  }
+
+  uint32_t writeBinaryView(const TStringView& str) {
+    return static_cast<Protocol_*>(this)->writeBinary(str.str());
+  }
+
+  uint32_t readStringView(TStringView& str) {
+    std::string copy;
+    uint32_t rsize = static_cast<Protocol_*>(this)->readString(copy);
+    str.assign(copy.data(), copy.size());
+    return rsize;
+  }
+
+  uint32_t readBinaryView(TStringView& str) {
+    std::string copy;
+    uint32_t rsize = static_cast<Protocol_*>(this)->readBinary(copy);
+    str.assign(copy.data(), copy.size());
+    return rsize;
+  }
+
  protected:
   TVirtualProtocol(boost::shared_ptr<TTransport> ptrans)
     : Super_(ptrans)
@@ -20,18 +20,34 @@
 #include <thrift/qt/TQTcpServer.h>
 #include <thrift/qt/TQIODeviceTransport.h>
 
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QTcpSocket>
+#include <QtEndian>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 
 #include <thrift/cxxfunctional.h>
 
+#include <thrift/concurrency/Exception.h>
+#include <thrift/concurrency/ThreadManager.h>
 #include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
 #include <thrift/async/TAsyncProcessor.h>
 
 using boost::shared_ptr;
+using boost::weak_ptr;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::ThreadManager;
+using apache::thrift::server::TBufferPool;
 using apache::thrift::protocol::TProtocol;
 using apache::thrift::protocol::TProtocolFactory;
 using apache::thrift::transport::TTransport;
 using apache::thrift::transport::TTransportException;
+using apache::thrift::transport::TMemoryBuffer;
 using apache::thrift::transport::TQIODeviceTransport;
 using apache::thrift::stdcxx::function;
 using apache::thrift::stdcxx::bind;
@@ -40,21 +56,185 @@ QT_USE_NAMESPACE
 
 namespace apache { namespace thrift { namespace async {
 
-struct TQTcpServer::ConnectionContext {
+class TQTcpServer::ConnectionContext {
+ public:
   shared_ptr<QTcpSocket> connection_;
   shared_ptr<TTransport> transport_;
   shared_ptr<TProtocol> iprot_;
   shared_ptr<TProtocol> oprot_;
 
+  // What has arrived for the thread manager, in a buffer from pool_
+  TBufferPool* pool_;
+  uint8_t* buf_;
+  uint32_t bufCapacity_;
+  uint32_t bufLen_;
+  // A request is on a worker
+  bool busy_;
+
   explicit ConnectionContext(shared_ptr<QTcpSocket> connection,
                              shared_ptr<TTransport> transport,
                              shared_ptr<TProtocol> iprot,
-                             shared_ptr<TProtocol> oprot)
+                             shared_ptr<TProtocol> oprot,
+                             TBufferPool* pool = NULL)
     : connection_(connection)
     , transport_(transport)
     , iprot_(iprot)
     , oprot_(oprot)
+    , pool_(pool)
+    , buf_(NULL)
+    , bufCapacity_(0)
+    , bufLen_(0)
+    , busy_(false)
+  {}
+
+  ~ConnectionContext()
+  {
+    if (buf_) {
+      pool_->giveBack(buf_, bufCapacity_);
+    }
+  }
+
+  // Make room for len more bytes
+  void reserve(uint32_t len)
+  {
+    if (bufCapacity_ - bufLen_ >= len) {
+      return;
+    }
+    uint32_t capacity;
+    uint8_t* buf = pool_->borrow(bufLen_ + len, &capacity);
+    if (bufLen_) {
+      memcpy(buf, buf_, bufLen_);
+    }
+    if (buf_) {
+      pool_->giveBack(buf_, bufCapacity_);
+    }
+    buf_ = buf;
+    bufCapacity_ = capacity;
+  }
+
+  // Drop the first len bytes, giving the buffer back once it is empty
+  void consume(uint32_t len)
+  {
+    bufLen_ -= len;
+    if (bufLen_) {
+      memmove(buf_, buf_ + len, bufLen_);
+    } else {
+      pool_->giveBack(buf_, bufCapacity_);
+      buf_ = NULL;
+      bufCapacity_ = 0;
+    }
+  }
+};
+
+/**
+ * One request on its way through a worker.  Only the event loop thread
+ * looks at the connection, and only once the call is back from the worker.
+ */
+class TQTcpServer::Call {
+ public:
+  weak_ptr<ConnectionContext> ctx_;
+  // The request, in a buffer from pool_
+  uint8_t* frame_;
+  uint32_t frameCapacity_;
+  shared_ptr<TMemoryBuffer> input_;
+  shared_ptr<TMemoryBuffer> output_;
+  shared_ptr<TProtocol> iprot_;
+  shared_ptr<TProtocol> oprot_;
+  bool posted_;
+  bool healthy_;
+
+  Call()
+    : frame_(NULL)
+    , frameCapacity_(0)
+    , posted_(false)
+    , healthy_(false)
   {}
+
+  ~Call()
+  {
+    // Pool buffers are plain malloc() blocks, so one the event loop never
+    // took back can be freed from here
+    std::free(frame_);
+  }
+};
+
+/**
+ * Hands finished calls from the workers to the event loop thread with a
+ * queued call of finishCalls().  Outlives the server for the sake of calls
+ * still on a worker when it goes away.
+ */
+class TQTcpServer::Mailbox {
+ public:
+  explicit Mailbox(TQTcpServer* server)
+    : server_(server)
+  {}
+
+  void post(shared_ptr<Call> call, bool healthy)
+  {
+    QMutexLocker locker(&mutex_);
+    if (call->posted_) {
+      return;
+    }
+    call->posted_ = true;
+    call->healthy_ = healthy;
+    if (!server_) {
+      return;
+    }
+    done_.push_back(call);
+    if (done_.size() == 1) {
+      QMetaObject::invokeMethod(server_, "finishCalls", Qt::QueuedConnection);
+    }
+  }
+
+  void take(std::vector<shared_ptr<Call> >& done)
+  {
+    QMutexLocker locker(&mutex_);
+    done.swap(done_);
+  }
+
+  void detach()
+  {
+    QMutexLocker locker(&mutex_);
+    server_ = NULL;
+    done_.clear();
+  }
+
+ private:
+  QMutex mutex_;
+  TQTcpServer* server_;
+  std::vector<shared_ptr<Call> > done_;
+};
+
+class TQTcpServer::CallTask : public Runnable {
+ public:
+  CallTask(shared_ptr<TAsyncProcessor> processor,
+           shared_ptr<Call> call,
+           shared_ptr<Mailbox> mailbox)
+    : processor_(processor)
+    , call_(call)
+    , mailbox_(mailbox)
+  {}
+
+  void run()
+  {
+    try {
+      processor_->process(
+        bind(&Mailbox::post, mailbox_,
+             call_, apache::thrift::stdcxx::placeholders::_1),
+        call_->iprot_, call_->oprot_);
+    } catch (const std::exception& ex) {
+      qWarning("[TQTcpServer] Exception during processing: '%s'", ex.what());
+      mailbox_->post(call_, false);
+    } catch (...) {
+      qWarning("[TQTcpServer] Unknown processor exception");
+      mailbox_->post(call_, false);
+    }
+  }
+
+ private:
+  shared_ptr<TAsyncProcessor> processor_;
+  shared_ptr<Call> call_;
+  shared_ptr<Mailbox> mailbox_;
 };
 
 TQTcpServer::TQTcpServer(shared_ptr<QTcpServer> server,
@@ -65,12 +245,20 @@ TQTcpServer::TQTcpServer(shared_ptr<QTcpServer> server,
   , server_(server)
   , processor_(processor)
   , pfact_(pfact)
+  , maxFrameSize_(MAX_FRAME_SIZE)
 {
+  mailbox_.reset(new Mailbox(this));
   connect(server.get(), SIGNAL(newConnection()), SLOT(processIncoming()));
 }
 
 TQTcpServer::~TQTcpServer()
 {
+  mailbox_->detach();
+}
+
+void TQTcpServer::setThreadManager(shared_ptr<ThreadManager> threadManager)
+{
+  threadManager_ = threadManager;
 }
 
 void TQTcpServer::processIncoming()
@@ -96,7 +284,8 @@ void TQTcpServer::processIncoming()
     
     ctxMap_[connection.get()] =
       shared_ptr<ConnectionContext>(
-         new ConnectionContext(connection, transport, iprot, oprot));
+         new ConnectionContext(connection, transport, iprot, oprot,
+                               threadManager_ ? &pool_ : NULL));
     
     connect(connection.get(), SIGNAL(readyRead()), SLOT(beginDecode()));
     
@@ -117,6 +306,11 @@ void TQTcpServer::beginDecode()
   }
   
   shared_ptr<ConnectionContext> ctx = ctxMap_[connection];
+
+  if (ctx->pool_) {
+    readFrames(ctx);
+    return;
+  }
   
   try {
     processor_->process(
@@ -154,4 +348,101 @@ void TQTcpServer::finish(shared_ptr<ConnectionContext> ctx, bool healthy)
   }
 }
 
+void TQTcpServer::readFrames(shared_ptr<ConnectionContext> ctx)
+{
+  qint64 avail = ctx->connection_->bytesAvailable();
+  if (avail <= 0) {
+    return;
+  }
+  ctx->reserve(static_cast<uint32_t>(avail));
+  qint64 got = ctx->connection_->read(
+    reinterpret_cast<char*>(ctx->buf_ + ctx->bufLen_), avail);
+  if (got < 0) {
+    qWarning("[TQTcpServer] Failed to read from QTcpSocket");
+    ctxMap_.erase(ctx->connection_.get());
+    return;
+  }
+  ctx->bufLen_ += static_cast<uint32_t>(got);
+  dispatch(ctx);
+}
+
+void TQTcpServer::dispatch(shared_ptr<ConnectionContext> ctx)
+{
+  if (ctx->busy_ || ctx->bufLen_ < sizeof(uint32_t)) {
+    return;
+  }
+  uint32_t frameSize = qFromBigEndian<quint32>(ctx->buf_);
+  if (frameSize > maxFrameSize_) {
+    qWarning("[TQTcpServer] Frame size %u too large, remote side not "
+             "using TFramedTransport?", frameSize);
+    ctxMap_.erase(ctx->connection_.get());
+    return;
+  }
+  if (ctx->bufLen_ - sizeof(uint32_t) < frameSize) {
+    return;
+  }
+
+  shared_ptr<Call> call(new Call());
+  call->ctx_ = ctx;
+  call->frame_ = pool_.borrow(frameSize, &call->frameCapacity_);
+  memcpy(call->frame_, ctx->buf_ + sizeof(uint32_t), frameSize);
+  ctx->consume(sizeof(uint32_t) + frameSize);
+
+  call->input_.reset(new TMemoryBuffer(call->frame_, frameSize));
+  call->output_.reset(new TMemoryBuffer());
+  // Leave room for the frame size, written once the response is done
+  call->output_->getWritePtr(sizeof(uint32_t));
+  call->output_->wroteBytes(sizeof(uint32_t));
+  try {
+    call->iprot_ = pfact_->getProtocol(call->input_);
+    call->oprot_ = pfact_->getProtocol(call->output_);
+    ctx->busy_ = true;
+    threadManager_->add(shared_ptr<Runnable>(new CallTask(processor_, call, mailbox_)));
+  } catch (const apache::thrift::concurrency::TooManyPendingTasksException&) {
+    qWarning("[TQTcpServer] Thread manager is full, dropping connection");
+    ctxMap_.erase(ctx->connection_.get());
+  } catch (...) {
+    qWarning("[TQTcpServer] Failed to start processing");
+    ctxMap_.erase(ctx->connection_.get());
+  }
+}
+
+void TQTcpServer::finishCalls()
+{
+  std::vector<shared_ptr<Call> > done;
+  mailbox_->take(done);
+
+  for (size_t i = 0; i < done.size(); ++i) {
+    shared_ptr<Call> call = done[i];
+    pool_.giveBack(call->frame_, call->frameCapacity_);
+    call->frame_ = NULL;
+
+    shared_ptr<ConnectionContext> ctx = call->ctx_.lock();
+    if (!ctx) {
+      // Closed while the request was on a worker
+      continue;
+    }
+    ctx->busy_ = false;
+    if (!call->healthy_) {
+      qWarning("[TQTcpServer] Processor failed to process data successfully");
+      ctxMap_.erase(ctx->connection_.get());
+      continue;
+    }
+
+    uint8_t* buf;
+    uint32_t len;
+    call->output_->getBuffer(&buf, &len);
+    // A oneway call writes nothing past the space for the frame size
+    if (len > sizeof(uint32_t)) {
+      qToBigEndian<quint32>(len - sizeof(uint32_t), buf);
+      if (ctx->connection_->write(reinterpret_cast<const char*>(buf), len) != len) {
+        qWarning("[TQTcpServer] Failed to write to QTcpSocket");
+        ctxMap_.erase(ctx->connection_.get());
+        continue;
+      }
+    }
+    dispatch(ctx);
+  }
+}
+
 }}} // apache::thrift::async
@@ -25,10 +25,16 @@
 
 #include <boost/shared_ptr.hpp>
 
+#include <thrift/server/TBufferPool.h>
+
 namespace apache { namespace thrift { namespace protocol {
 class TProtocolFactory;
 }}} // apache::thrift::protocol
 
+namespace apache { namespace thrift { namespace concurrency {
+class ThreadManager;
+}}} // apache::thrift::concurrency
+
 namespace apache { namespace thrift { namespace async {
 
 class TAsyncProcessor;
@@ -37,6 +43,12 @@ class TAsyncProcessor;
  *  Server that uses Qt to listen for connections.
  *  Simply give it a QTcpServer that is listening, along with an async
  *  processor and a protocol factory, and then run the Qt event loop.
+ *
+ *  By default each request is processed in the Qt event loop as it
+ *  arrives, so a slow handler holds up the thread running the loop.  With
+ *  setThreadManager() requests are processed on its workers instead and
+ *  their responses handed back to the loop thread to be written, which
+ *  stays free for the GUI or whatever else it runs.
  */
 class TQTcpServer : public QObject {
  Q_OBJECT
@@ -47,22 +59,69 @@ class TQTcpServer : public QObject {
               QT_PREPEND_NAMESPACE(QObject)* parent = NULL);
   virtual ~TQTcpServer();
 
+  /// Default limit on the size of a frame read for the thread manager
+  static const uint32_t MAX_FRAME_SIZE = 256 * 1024 * 1024;
+
+  /**
+   * Process requests on the workers of threadManager, which must already
+   * be started, rather than in the Qt event loop.  NULL goes back to the
+   * event loop.  Only affects connections accepted after the call.
+   *
+   * Requests can only be handed over whole, so clients must frame them
+   * as TFramedTransport does; responses are framed the same way.  Each
+   * connection has one request on a worker at a time, so responses stay
+   * in order.  The processor must be safe to call from several threads,
+   * and the completion it is given may be called from any thread.
+   */
+  void setThreadManager(
+      boost::shared_ptr<apache::thrift::concurrency::ThreadManager> threadManager);
+
+  /**
+   * Sets the largest frame read for the thread manager; bigger ones close
+   * the connection.
+   */
+  void setMaxFrameSize(uint32_t maxFrameSize) {
+    maxFrameSize_ = maxFrameSize;
+  }
+
+  uint32_t getMaxFrameSize() const {
+    return maxFrameSize_;
+  }
+
  private Q_SLOTS:
   void processIncoming();
   void beginDecode();
   void socketClosed();
+  void finishCalls();
 
  private:
   TQTcpServer(const TQTcpServer&);
   TQTcpServer& operator=(const TQTcpServer&);
   
   class ConnectionContext;
+  class Call;
+  class CallTask;
+  class Mailbox;
 
   void finish(boost::shared_ptr<ConnectionContext> ctx, bool healthy);
 
+  /// Read what has arrived for the thread manager and dispatch it
+  void readFrames(boost::shared_ptr<ConnectionContext> ctx);
+  /// Hand the next complete frame, if any, to the thread manager
+  void dispatch(boost::shared_ptr<ConnectionContext> ctx);
+
   boost::shared_ptr<QTcpServer> server_;
   boost::shared_ptr<TAsyncProcessor> processor_;
   boost::shared_ptr<apache::thrift::protocol::TProtocolFactory> pfact_;
+  boost::shared_ptr<apache::thrift::concurrency::ThreadManager> threadManager_;
+  uint32_t maxFrameSize_;
+
+  /// Where workers leave finished calls; outlives the server if it must
+  boost::shared_ptr<Mailbox> mailbox_;
+
+  /// Frame buffers; only touched by the event loop thread, and declared
+  /// before ctxMap_ so the contexts can give theirs back
+  apache::thrift::server::TBufferPool pool_;
 
   std::map<QT_PREPEND_NAMESPACE(QTcpSocket)*, boost::shared_ptr<ConnectionContext> > ctxMap_;
 };
@@ -0,0 +1,137 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/server/TBufferPool.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace apache { namespace thrift { namespace server {
+
+const uint32_t TBufferPool::MIN_CLASS_SIZE;
+const uint32_t TBufferPool::DEFAULT_MAX_CLASS_SIZE;
+const size_t TBufferPool::DEFAULT_MAX_FREE_BYTES;
+
+TBufferPool::TBufferPool(uint32_t maxClassSize, size_t maxFreeBytes)
+  : maxClassSize_(MIN_CLASS_SIZE)
+  , maxFreeBytes_(maxFreeBytes)
+  , freeBytes_(0) {
+  freeLists_.push_back(NULL);
+  while (maxClassSize_ < maxClassSize && maxClassSize_ < (1u << 31)) {
+    maxClassSize_ <<= 1;
+    freeLists_.push_back(NULL);
+  }
+}
+
+TBufferPool::~TBufferPool() {
+  trim();
+}
+
+int TBufferPool::classOf(uint32_t capacity) const {
+  uint32_t classSize = MIN_CLASS_SIZE;
+  for (size_t i = 0; i < freeLists_.size(); ++i, classSize <<= 1) {
+    if (classSize == capacity) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+uint8_t* TBufferPool::borrow(uint32_t size, uint32_t* capacity) {
+  if (size > maxClassSize_) {
+    uint8_t* buf = (uint8_t*)std::malloc(size);
+    if (buf == NULL) {
+      throw std::bad_alloc();
+    }
+    *capacity = size;
+    return buf;
+  }
+
+  uint32_t classSize = MIN_CLASS_SIZE;
+  size_t i = 0;
+  while (classSize < size) {
+    classSize <<= 1;
+    ++i;
+  }
+
+  FreeBuffer* head = freeLists_[i];
+  if (head != NULL) {
+    freeLists_[i] = head->next;
+    freeBytes_ -= classSize;
+    *capacity = classSize;
+    return reinterpret_cast<uint8_t*>(head);
+  }
+
+  uint8_t* buf = (uint8_t*)std::malloc(classSize);
+  if (buf == NULL) {
+    throw std::bad_alloc();
+  }
+  *capacity = classSize;
+  return buf;
+}
+
+void TBufferPool::giveBack(uint8_t* buf, uint32_t capacity) {
+  if (buf == NULL) {
+    return;
+  }
+
+  int i = classOf(capacity);
+  if (i < 0 || freeBytes_ + capacity > maxFreeBytes_) {
+    std::free(buf);
+    return;
+  }
+
+  FreeBuffer* head = reinterpret_cast<FreeBuffer*>(buf);
+  head->next = freeLists_[i];
+  freeLists_[i] = head;
+  freeBytes_ += capacity;
+}
+
+void TBufferPool::trim() {
+  for (size_t i = 0; i < freeLists_.size(); ++i) {
+    while (freeLists_[i] != NULL) {
+      FreeBuffer* head = freeLists_[i];
+      freeLists_[i] = head->next;
+      std::free(head);
+    }
+  }
+  freeBytes_ = 0;
+}
+
+void TBufferPool::prefill(uint32_t size, size_t count) {
+  // Taking them all out first is what makes the pool allocate new ones
+  // rather than handing the same buffer back each time
+  std::vector<uint8_t*> bufs;
+  bufs.reserve(count);
+  uint32_t capacity = 0;
+  try {
+    for (size_t i = 0; i < count; ++i) {
+      uint8_t* buf = borrow(size, &capacity);
+      std::memset(buf, 0, capacity);
+      bufs.push_back(buf);
+    }
+  } catch (const std::bad_alloc&) {
+    // Keep what was allocated; a short pool is no reason to fail
+  }
+  for (size_t i = 0; i < bufs.size(); ++i) {
+    giveBack(bufs[i], capacity);
+  }
+}
+
+}}} // apache::thrift::server
@@ -0,0 +1,160 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TBUFFERPOOL_H_
+#define _THRIFT_SERVER_TBUFFERPOOL_H_ 1
+
+#include <thrift/Thrift.h>
+#include <thrift/concurrency/Mutex.h>
+#include <vector>
+#include <cstddef>
+
+namespace apache { namespace thrift { namespace server {
+
+/**
+ * A pool of byte buffers in power-of-two size classes.  Buffers handed back
+ * are kept on a free list for their class and handed out again, so a steady
+ * stream of similarly sized frames does no malloc or free at all.
+ *
+ * Requests larger than the largest class, and buffers handed back while the
+ * pool already holds its limit of free memory, go straight to the heap.
+ * Every buffer is an ordinary malloc() block, so one that was borrowed may
+ * also be released with free() or handed to a different pool.
+ *
+ * A pool is not thread safe; the intended use is one per IO thread.
+ */
+class TBufferPool {
+ public:
+  /// Size of the smallest class
+  static const uint32_t MIN_CLASS_SIZE = 64;
+
+  /// Default size of the largest class
+  static const uint32_t DEFAULT_MAX_CLASS_SIZE = 1024 * 1024;
+
+  /// Default limit on free memory held by the pool
+  static const size_t DEFAULT_MAX_FREE_BYTES = 16 * 1024 * 1024;
+
+  /**
+   * @param maxClassSize largest size class; rounded up to a power of two.
+   * @param maxFreeBytes limit on the total size of pooled free buffers.
+   */
+  explicit TBufferPool(uint32_t maxClassSize = DEFAULT_MAX_CLASS_SIZE,
+                       size_t maxFreeBytes = DEFAULT_MAX_FREE_BYTES);
+
+  ~TBufferPool();
+
+  /**
+   * Get a buffer of at least size bytes.
+   *
+   * @param size the minimum number of bytes needed.
+   * @param capacity set to the actual size of the returned buffer; pass
+   *                 this back to giveBack().
+   * @return the buffer.  Throws std::bad_alloc if none could be allocated.
+   */
+  uint8_t* borrow(uint32_t size, uint32_t* capacity);
+
+  /**
+   * Return a buffer to the pool, or to the heap if it can't be kept.
+   *
+   * @param buf the buffer; NULL is ignored.
+   * @param capacity its size as reported by borrow().
+   */
+  void giveBack(uint8_t* buf, uint32_t capacity);
+
+  /// Release every pooled free buffer back to the heap.
+  void trim();
+
+  /**
+   * Make sure the pool holds count free buffers of at least size bytes,
+   * as far as its limit on free memory allows, with every page of them
+   * already touched so the first borrowers take no page faults.
+   *
+   * @param size the minimum number of bytes in each buffer.
+   * @param count how many buffers to hold.
+   */
+  void prefill(uint32_t size, size_t count);
+
+  /// Total size of the free buffers currently held.
+  size_t getFreeBytes() const {
+    return freeBytes_;
+  }
+
+  uint32_t getMaxClassSize() const {
+    return maxClassSize_;
+  }
+
+  size_t getMaxFreeBytes() const {
+    return maxFreeBytes_;
+  }
+
+ private:
+  /// Free buffers are chained through their own first bytes.
+  struct FreeBuffer {
+    FreeBuffer* next;
+  };
+
+  /// The class index for a buffer of exactly capacity bytes, or -1.
+  int classOf(uint32_t capacity) const;
+
+  std::vector<FreeBuffer*> freeLists_;
+  uint32_t maxClassSize_;
+  size_t maxFreeBytes_;
+  size_t freeBytes_;
+};
+
+/**
+ * A TBufferPool shared between threads, e.g. by the TBufferedTransports of
+ * every connection of a TThreadPoolServer.  Each call takes a lock.
+ */
+class TConcurrentBufferPool {
+ public:
+  explicit TConcurrentBufferPool(uint32_t maxClassSize = TBufferPool::DEFAULT_MAX_CLASS_SIZE,
+                                 size_t maxFreeBytes = TBufferPool::DEFAULT_MAX_FREE_BYTES)
+    : pool_(maxClassSize, maxFreeBytes) {}
+
+  /// See TBufferPool::borrow()
+  uint8_t* borrow(uint32_t size, uint32_t* capacity) {
+    concurrency::Guard g(mutex_);
+    return pool_.borrow(size, capacity);
+  }
+
+  /// See TBufferPool::giveBack()
+  void giveBack(uint8_t* buf, uint32_t capacity) {
+    concurrency::Guard g(mutex_);
+    pool_.giveBack(buf, capacity);
+  }
+
+  void trim() {
+    concurrency::Guard g(mutex_);
+    pool_.trim();
+  }
+
+  size_t getFreeBytes() const {
+    concurrency::Guard g(mutex_);
+    return pool_.getFreeBytes();
+  }
+
+ private:
+  concurrency::Mutex mutex_;
+  TBufferPool pool_;
+};
+
+}}} // apache::thrift::server
+
+#endif // #ifndef _THRIFT_SERVER_TBUFFERPOOL_H_
@@ -0,0 +1,341 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/server/TCompletionServer.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TSocket.h>
+
+#include <inttypes.h>
+#include <cstdio>
+#include <cstring>
+#include <typeinfo>
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+
+namespace apache { namespace thrift { namespace server {
+
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace std;
+using boost::shared_ptr;
+
+namespace {
+
+const int LISTEN_BACKLOG = 1024;
+
+/// Connection buffers are given back to the heap above this size when idle
+const size_t IDLE_BUFFER_LIMIT = 1024 * 1024;
+
+template<class T>
+inline char* const_cast_sockopt(T* v) {
+  return reinterpret_cast<char*>(v);
+}
+
+/// Empty buf, giving its memory back if it has grown large
+void releaseBuffer(std::vector<uint8_t>& buf, size_t& pos) {
+  if (buf.capacity() > IDLE_BUFFER_LIMIT) {
+    std::vector<uint8_t>().swap(buf);
+  } else {
+    buf.clear();
+  }
+  pos = 0;
+}
+
+}
+
+TCompletionServer::Connection::Connection() :
+  inPos(0),
+  outPos(0),
+  started(false),
+  recvArmed(false),
+  sending(false),
+  closing(false),
+  inflight(0),
+  connectionContext(NULL) {
+}
+
+TCompletionServer::Connection::~Connection() {
+}
+
+void TCompletionServer::initialize() {
+  serverName_ = "TCompletionServer";
+  port_ = 0;
+  serverSocket_ = THRIFT_INVALID_SOCKET;
+  listenFamily_ = AF_INET;
+  stop_ = false;
+  maxFrameSize_ = MAX_FRAME_SIZE;
+}
+
+std::string TCompletionServer::getConnectionInfo(const Connection* conn) const {
+  return conn->tSocket ? conn->tSocket->getSocketInfo() : std::string("<unknown>");
+}
+
+void TCompletionServer::createAndListenOnSocket() {
+  struct addrinfo hints, *res, *res0;
+  char port[sizeof("65536") + 1];
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
+  sprintf(port, "%d", port_);
+
+  // Wildcard address
+  int error = getaddrinfo(NULL, port, &hints, &res0);
+  if (error) {
+    throw TException(string(serverName_) + "::serve() getaddrinfo " +
+                     string(THRIFT_GAI_STRERROR(error)));
+  }
+
+  // Pick the ipv6 address first since ipv4 addresses can be mapped
+  // into ipv6 space.
+  for (res = res0; res; res = res->ai_next) {
+    if (res->ai_family == AF_INET6 || res->ai_next == NULL)
+      break;
+  }
+
+  int type = res->ai_socktype;
+#ifdef SOCK_CLOEXEC
+  type |= SOCK_CLOEXEC;
+#endif
+  THRIFT_SOCKET s = socket(res->ai_family, type, res->ai_protocol);
+  if (s == THRIFT_INVALID_SOCKET) {
+    freeaddrinfo(res0);
+    throw TException(string(serverName_) + "::serve() socket() -1");
+  }
+
+  #ifdef IPV6_V6ONLY
+  if (res->ai_family == AF_INET6) {
+    int zero = 0;
+    if (-1 == setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, const_cast_sockopt(&zero), sizeof(zero))) {
+      GlobalOutput.printf("%s::serve() IPV6_V6ONLY", serverName_);
+    }
+  }
+  #endif // #ifdef IPV6_V6ONLY
+
+  int one = 1;
+
+  // Set THRIFT_NO_SOCKET_CACHING to avoid 2MSL delay on server restart
+  setsockopt(s, SOL_SOCKET, THRIFT_NO_SOCKET_CACHING, const_cast_sockopt(&one), sizeof(one));
+
+  if (::bind(s, res->ai_addr, static_cast<int>(res->ai_addrlen)) == -1) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    ::THRIFT_CLOSESOCKET(s);
+    freeaddrinfo(res0);
+    throw TTransportException(TTransportException::NOT_OPEN,
+                              string(serverName_) + "::serve() bind",
+                              errno_copy);
+  }
+  listenFamily_ = res->ai_family;
+  freeaddrinfo(res0);
+
+  if (listen(s, LISTEN_BACKLOG) == -1) {
+    ::THRIFT_CLOSESOCKET(s);
+    throw TException(string(serverName_) + "::serve() listen");
+  }
+
+  if (port_ == 0) {
+    sockaddr_storage addrStorage;
+    socklen_t addrLen = sizeof(addrStorage);
+    if (getsockname(s, (sockaddr*)&addrStorage, &addrLen) == 0) {
+      if (addrStorage.ss_family == AF_INET6) {
+        port_ = ntohs(((sockaddr_in6*)&addrStorage)->sin6_port);
+      } else {
+        port_ = ntohs(((sockaddr_in*)&addrStorage)->sin_port);
+      }
+    }
+  }
+
+  serverSocket_ = s;
+}
+
+void TCompletionServer::startConnection(Connection* conn) {
+  conn->inputTransport.reset(new TMemoryBuffer(NULL, 0));
+  conn->outputTransport.reset(new TMemoryBuffer());
+  conn->factoryInputTransport = getInputTransportFactory()->getTransport(conn->inputTransport);
+  conn->factoryOutputTransport = getOutputTransportFactory()->getTransport(conn->outputTransport);
+  conn->inputProtocol = getInputProtocolFactory()->getProtocol(conn->factoryInputTransport);
+  conn->outputProtocol = getOutputProtocolFactory()->getProtocol(conn->factoryOutputTransport);
+
+  if (eventHandler_) {
+    conn->connectionContext = eventHandler_->createContext(conn->inputProtocol,
+                                                           conn->outputProtocol);
+  }
+  conn->processor = getProcessor(conn->inputProtocol, conn->outputProtocol, conn->transport);
+  conn->started = true;
+
+  queueRecv(conn);
+}
+
+bool TCompletionServer::completed(Connection* conn) {
+  --conn->inflight;
+  if (conn->closing) {
+    if (conn->inflight == 0) {
+      destroyConnection(conn);
+    }
+    return false;
+  }
+  return true;
+}
+
+void TCompletionServer::received(Connection* conn, const uint8_t* data, size_t size) {
+  conn->in.insert(conn->in.end(), data, data + size);
+  advance(conn);
+}
+
+void TCompletionServer::sent(Connection* conn, size_t bytes) {
+  conn->outPos += bytes;
+  if (conn->outPos == conn->out.size()) {
+    releaseBuffer(conn->out, conn->outPos);
+  }
+  advance(conn);
+}
+
+void TCompletionServer::advance(Connection* conn) {
+  if (conn->sending) {
+    // Anything received waits for the send to finish
+    return;
+  }
+
+  for (;;) {
+    size_t avail = conn->in.size() - conn->inPos;
+    if (avail < sizeof(uint32_t)) {
+      break;
+    }
+    uint32_t frameSize;
+    memcpy(&frameSize, &conn->in[conn->inPos], sizeof(frameSize));
+    frameSize = ntohl(frameSize);
+    if (frameSize > maxFrameSize_) {
+      GlobalOutput.printf("%s: frame size too large "
+                          "(%" PRIu32 " > %" PRIu32 ") from client %s. "
+                          "Remote side not using TFramedTransport?",
+                          serverName_, frameSize, maxFrameSize_,
+                          getConnectionInfo(conn).c_str());
+      closeConnection(conn);
+      return;
+    }
+    if (avail - sizeof(uint32_t) < frameSize) {
+      break;
+    }
+    if (!processFrame(conn, &conn->in[conn->inPos + sizeof(uint32_t)], frameSize)) {
+      closeConnection(conn);
+      return;
+    }
+    conn->inPos += sizeof(uint32_t) + frameSize;
+  }
+
+  if (conn->inPos == conn->in.size()) {
+    releaseBuffer(conn->in, conn->inPos);
+  } else if (conn->inPos > 0) {
+    conn->in.erase(conn->in.begin(), conn->in.begin() + conn->inPos);
+    conn->inPos = 0;
+  }
+
+  if (conn->outPos < conn->out.size()) {
+    queueSend(conn);
+  } else if (!conn->recvArmed) {
+    queueRecv(conn);
+  }
+}
+
+bool TCompletionServer::processFrame(Connection* conn, const uint8_t* frame, uint32_t size) {
+  conn->inputTransport->resetBuffer(const_cast<uint8_t*>(frame), size);
+  conn->outputTransport->resetBuffer();
+  // Prepend four bytes of blank space to the buffer so we can
+  // write the frame size there later.
+  conn->outputTransport->getWritePtr(4);
+  conn->outputTransport->wroteBytes(4);
+
+  try {
+    if (eventHandler_) {
+      eventHandler_->processContext(conn->connectionContext, conn->transport);
+    }
+    conn->processor->process(conn->inputProtocol, conn->outputProtocol,
+                             conn->connectionContext);
+  } catch (const TTransportException &ttx) {
+    GlobalOutput.printf("%s transport error in process(): %s",
+                        serverName_, ttx.what());
+    return false;
+  } catch (const std::exception &x) {
+    GlobalOutput.printf("Server::process() uncaught exception: %s: %s",
+                        typeid(x).name(), x.what());
+    return false;
+  } catch (...) {
+    GlobalOutput.printf("Server::process() unknown exception");
+    return false;
+  }
+
+  uint8_t* buf;
+  uint32_t len;
+  conn->outputTransport->getBuffer(&buf, &len);
+  // A oneway call writes nothing past the space for the frame size
+  if (len > 4) {
+    uint32_t frameSize = htonl(len - 4);
+    memcpy(buf, &frameSize, sizeof(frameSize));
+    conn->out.insert(conn->out.end(), buf, buf + len);
+  }
+  return true;
+}
+
+void TCompletionServer::closeConnection(Connection* conn) {
+  if (conn->closing) {
+    return;
+  }
+  conn->closing = true;
+  cancelConnection(conn);
+  if (conn->inflight == 0) {
+    destroyConnection(conn);
+  }
+}
+
+void TCompletionServer::closeConnections() {
+  std::vector<Connection*> open(connections_.begin(), connections_.end());
+  for (size_t i = 0; i < open.size(); ++i) {
+    closeConnection(open[i]);
+  }
+}
+
+void TCompletionServer::destroyConnection(Connection* conn) {
+  if (conn->started) {
+    if (eventHandler_) {
+      eventHandler_->deleteContext(conn->connectionContext,
+                                   conn->inputProtocol, conn->outputProtocol);
+    }
+    conn->factoryInputTransport->close();
+    conn->factoryOutputTransport->close();
+  }
+  if (conn->transport) {
+    conn->transport->close();
+  }
+  connections_.erase(conn);
+  delete conn;
+}
+
+}}} // apache::thrift::server
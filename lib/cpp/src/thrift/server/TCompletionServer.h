@@ -0,0 +1,206 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TCOMPLETIONSERVER_H_
+#define _THRIFT_SERVER_TCOMPLETIONSERVER_H_ 1
+
+#include <set>
+#include <string>
+#include <vector>
+#include <thrift/server/TServer.h>
+#include <thrift/transport/PlatformSocket.h>
+
+namespace apache { namespace thrift {
+
+namespace transport {
+class TMemoryBuffer;
+class TSocket;
+}
+
+namespace server {
+
+/**
+ * Base of the framed transport servers driven by completions rather than
+ * by readiness: TUringServer on Linux and TIOCPServer on Windows.
+ *
+ * A subclass queues receives and sends with its platform's interface and
+ * hands back what they did through received() and sent().  This class cuts
+ * the frames out of what arrives, runs the processor over them on the IO
+ * thread, gathers the responses, and asks for the next send or receive.
+ * It also keeps count of each connection's queued operations, so that a
+ * connection being closed is freed only once the kernel is done with its
+ * buffers.
+ */
+class TCompletionServer : public TServer {
+ public:
+  /// Default limit on the size of a frame
+  static const uint32_t MAX_FRAME_SIZE = 256 * 1024 * 1024;
+
+  /**
+   * Sets the largest frame accepted; bigger ones close the connection.
+   */
+  void setMaxFrameSize(uint32_t maxFrameSize) {
+    maxFrameSize_ = maxFrameSize;
+  }
+
+  uint32_t getMaxFrameSize() const {
+    return maxFrameSize_;
+  }
+
+  /**
+   * Port the server listens on.  With port 0 this is the ephemeral port
+   * picked once serve() has bound the socket.
+   */
+  int getListenPort() const {
+    return port_;
+  }
+
+ protected:
+  /**
+   * A client connection.  Frames are gathered in in, and the responses to
+   * them in out until they are sent.  Subclasses add the handle and the
+   * state of their queued operations.
+   */
+  struct Connection {
+    Connection();
+    virtual ~Connection();
+
+    std::vector<uint8_t> in;
+    size_t inPos;
+    std::vector<uint8_t> out;
+    size_t outPos;
+
+    /// The transports and processor are set up
+    bool started;
+    /// A receive is queued
+    bool recvArmed;
+    /// A send of out is queued
+    bool sending;
+    bool closing;
+    /// Number of queued operations
+    int inflight;
+
+    /// Owns the handle
+    boost::shared_ptr<transport::TTransport> transport;
+    /// The same as transport for a TCP client, otherwise NULL
+    boost::shared_ptr<transport::TSocket> tSocket;
+    boost::shared_ptr<transport::TMemoryBuffer> inputTransport;
+    boost::shared_ptr<transport::TMemoryBuffer> outputTransport;
+    boost::shared_ptr<transport::TTransport> factoryInputTransport;
+    boost::shared_ptr<transport::TTransport> factoryOutputTransport;
+    boost::shared_ptr<protocol::TProtocol> inputProtocol;
+    boost::shared_ptr<protocol::TProtocol> outputProtocol;
+    boost::shared_ptr<TProcessor> processor;
+    void* connectionContext;
+  };
+
+  template<typename ProcessorFactory>
+  TCompletionServer(
+      const boost::shared_ptr<ProcessorFactory>& processorFactory,
+      THRIFT_OVERLOAD_IF(ProcessorFactory, TProcessorFactory)) :
+    TServer(processorFactory) {
+    initialize();
+  }
+
+  template<typename Processor>
+  TCompletionServer(const boost::shared_ptr<Processor>& processor,
+                    THRIFT_OVERLOAD_IF(Processor, TProcessor)) :
+    TServer(processor) {
+    initialize();
+  }
+
+  /**
+   * Queue a receive into conn, setting recvArmed and counting it in
+   * inflight, or close conn if that fails.
+   */
+  virtual void queueRecv(Connection* conn) = 0;
+
+  /**
+   * Queue a send of out from outPos, setting sending and counting it in
+   * inflight, or close conn if that fails.  A receive may be queued along
+   * with it if none is.
+   */
+  virtual void queueSend(Connection* conn) = 0;
+
+  /**
+   * Make whatever conn has queued complete soon; closeConnection() calls
+   * this before it looks at inflight.
+   */
+  virtual void cancelConnection(Connection* conn) = 0;
+
+  /// Who is at the other end of conn, for messages
+  virtual std::string getConnectionInfo(const Connection* conn) const;
+
+  /// Bind serverSocket_ to port_ and listen, noting its address family
+  void createAndListenOnSocket();
+
+  /// Set up the transports and processor of conn and queue its first receive
+  void startConnection(Connection* conn);
+
+  /**
+   * Note that one of conn's operations completed.  Returns false if conn
+   * is closing, in which case it may have been freed.
+   */
+  bool completed(Connection* conn);
+
+  /// Take size bytes received on conn, processing every frame complete
+  void received(Connection* conn, const uint8_t* data, size_t size);
+
+  /// Note that bytes of out were sent on conn and queue what comes next
+  void sent(Connection* conn, size_t bytes);
+
+  /// Process the complete frames received and queue what comes next
+  void advance(Connection* conn);
+
+  /// Start closing a connection; it is freed once nothing is in flight
+  void closeConnection(Connection* conn);
+
+  /// Start closing every connection, as serve() ends
+  void closeConnections();
+
+  void destroyConnection(Connection* conn);
+
+  /// Used in messages
+  const char* serverName_;
+
+  /// Port to listen on, or below 0 for none
+  int port_;
+
+  /// Listen socket, while serving
+  THRIFT_SOCKET serverSocket_;
+
+  /// Address family of the listen socket
+  int listenFamily_;
+
+  volatile bool stop_;
+
+  uint32_t maxFrameSize_;
+
+  std::set<Connection*> connections_;
+
+ private:
+  void initialize();
+
+  /// Run the processor over one frame, appending the response to out
+  bool processFrame(Connection* conn, const uint8_t* frame, uint32_t size);
+};
+
+}}} // apache::thrift::server
+
+#endif // #ifndef _THRIFT_SERVER_TCOMPLETIONSERVER_H_
@@ -0,0 +1,520 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/server/TEventLoop.h>
+#include <thrift/concurrency/Util.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <vector>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_EVENT_H
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+#include <event.h>
+
+namespace apache { namespace thrift { namespace server {
+
+using boost::shared_ptr;
+using apache::thrift::concurrency::Util;
+
+namespace {
+
+/**
+ * The tick of the loops that wait for readiness themselves: how long they
+ * may wait, and the callback once that is up.
+ */
+class Ticker {
+ public:
+  Ticker() :
+    interval_(0),
+    callback_(NULL),
+    arg_(NULL),
+    next_(0) {}
+
+  void set(int64_t interval, TEventLoop::TickCallback callback, void* arg) {
+    interval_ = interval > 0 ? interval : 1;
+    callback_ = callback;
+    arg_ = arg;
+    next_ = Util::monotonicTime() + interval_;
+  }
+
+  /// Milliseconds to wait for readiness, -1 for as long as it takes
+  int timeout() const {
+    if (callback_ == NULL) {
+      return -1;
+    }
+    int64_t left = next_ - Util::monotonicTime();
+    if (left <= 0) {
+      return 0;
+    }
+    return left < INT_MAX ? static_cast<int>(left) : INT_MAX;
+  }
+
+  /// Call back if the tick is due
+  void check() {
+    if (callback_ == NULL) {
+      return;
+    }
+    int64_t now = Util::monotonicTime();
+    if (now >= next_) {
+      next_ = now + interval_;
+      callback_(arg_);
+    }
+  }
+
+ private:
+  int64_t interval_;
+  TEventLoop::TickCallback callback_;
+  void* arg_;
+  int64_t next_;
+};
+
+/**
+ * Loop on a libevent event_base.
+ */
+class TLibeventLoop : public TEventLoop {
+ public:
+  TLibeventLoop(event_base* base, bool ownBase) :
+    base_(base),
+    ownBase_(ownBase),
+    tickCallback_(NULL),
+    tickArg_(NULL),
+    tickAdded_(false) {
+  }
+
+  ~TLibeventLoop() {
+    if (tickAdded_) {
+      event_del(&tick_);
+    }
+    if (ownBase_) {
+      event_base_free(base_);
+    }
+  }
+
+  bool add(Event* ev) {
+    struct event* e = static_cast<struct event*>(ev->backendData);
+    if (e == NULL) {
+      e = new struct event;
+      ev->backendData = e;
+      ev->freeBackendData = freeEvent;
+    } else if (ev->added && event_del(e) == -1) {
+      return false;
+    }
+    ev->added = false;
+
+    event_set(e, ev->fd, (ev->flags & (READ | WRITE)) | EV_PERSIST,
+              dispatch, ev);
+    event_base_set(base_, e);
+    if (event_add(e, 0) == -1) {
+      return false;
+    }
+    ev->added = true;
+    return true;
+  }
+
+  bool del(Event* ev) {
+    if (!ev->added) {
+      return true;
+    }
+    ev->added = false;
+    return event_del(static_cast<struct event*>(ev->backendData)) != -1;
+  }
+
+  void setTick(int64_t interval, TickCallback callback, void* arg) {
+    if (tickAdded_) {
+      event_del(&tick_);
+      tickAdded_ = false;
+    }
+    tickCallback_ = callback;
+    tickArg_ = arg;
+    if (callback == NULL) {
+      return;
+    }
+    event_set(&tick_, -1, EV_PERSIST, tickHandler, this);
+    event_base_set(base_, &tick_);
+    struct timeval tv;
+    Util::toTimeval(tv, interval > 0 ? interval : 1);
+    if (event_add(&tick_, &tv) == -1) {
+      throw TException("TLibeventLoop: event_add() failed for the tick");
+    }
+    tickAdded_ = true;
+  }
+
+  void run() {
+    event_base_loop(base_, 0);
+  }
+
+  void breakLoop() {
+    event_base_loopbreak(base_);
+  }
+
+  std::string getMethod() const {
+    return std::string("libevent ") + event_get_version() + " " +
+      event_base_get_method(base_);
+  }
+
+  event_base* getEventBase() const {
+    return base_;
+  }
+
+ private:
+  static void freeEvent(void* e) {
+    delete static_cast<struct event*>(e);
+  }
+
+  // libevent has no hook for the start of a turn, so the cached clock is
+  // ticked before each callback instead
+  static void dispatch(THRIFT_SOCKET fd, short which, void* v) {
+    Event* ev = static_cast<Event*>(v);
+    Util::tickCachedTime();
+    ev->callback(fd, which, ev->arg);
+  }
+
+  static void tickHandler(THRIFT_SOCKET fd, short which, void* v) {
+    (void)fd;
+    (void)which;
+    Util::tickCachedTime();
+    TLibeventLoop* loop = static_cast<TLibeventLoop*>(v);
+    loop->tickCallback_(loop->tickArg_);
+  }
+
+  event_base* base_;
+  bool ownBase_;
+
+  struct event tick_;
+  TickCallback tickCallback_;
+  void* tickArg_;
+  bool tickAdded_;
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+/**
+ * Loop on an epoll descriptor.
+ */
+class TEpollLoop : public TEventLoop {
+ public:
+  TEpollLoop() :
+    broken_(false),
+    ready_(MAX_EVENTS),
+    numReady_(0) {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ == -1) {
+      throw TException("TEpollLoop: epoll_create1() failed: " +
+                       TOutput::strerror_s(errno));
+    }
+  }
+
+  ~TEpollLoop() {
+    ::close(epollFd_);
+  }
+
+  bool add(Event* ev) {
+    struct epoll_event e;
+    e.events = 0;
+    if (ev->flags & READ) {
+      e.events |= EPOLLIN;
+    }
+    if (ev->flags & WRITE) {
+      e.events |= EPOLLOUT;
+    }
+    if (ev->flags & EDGE) {
+      e.events |= EPOLLET;
+    }
+    e.data.ptr = ev;
+    if (epoll_ctl(epollFd_, ev->added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, ev->fd, &e) == -1) {
+      GlobalOutput.perror("TEpollLoop: epoll_ctl() ", errno);
+      return false;
+    }
+    ev->added = true;
+    return true;
+  }
+
+  bool del(Event* ev) {
+    if (!ev->added) {
+      return true;
+    }
+    ev->added = false;
+    forget(ev);
+    struct epoll_event e;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_DEL, ev->fd, &e) == -1 && errno != EBADF) {
+      GlobalOutput.perror("TEpollLoop: epoll_ctl() ", errno);
+      return false;
+    }
+    return true;
+  }
+
+  void setTick(int64_t interval, TickCallback callback, void* arg) {
+    ticker_.set(interval, callback, arg);
+  }
+
+  void run() {
+    broken_ = false;
+    while (!broken_) {
+      numReady_ = epoll_wait(epollFd_, &ready_[0], MAX_EVENTS, ticker_.timeout());
+      if (numReady_ == -1) {
+        numReady_ = 0;
+        if (errno == EINTR) {
+          continue;
+        }
+        GlobalOutput.perror("TEpollLoop: epoll_wait() ", errno);
+        return;
+      }
+      Util::tickCachedTime();
+      for (int i = 0; i < numReady_ && !broken_; ++i) {
+        Event* ev = static_cast<Event*>(ready_[i].data.ptr);
+        if (ev == NULL) {
+          continue;
+        }
+        // Errors and hangups are reported to whichever side is watched
+        uint32_t got = ready_[i].events;
+        short which = 0;
+        if (got & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+          which |= READ;
+        }
+        if (got & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+          which |= WRITE;
+        }
+        which &= ev->flags;
+        if (which != 0) {
+          ev->callback(ev->fd, which, ev->arg);
+        }
+      }
+      numReady_ = 0;
+      if (!broken_) {
+        ticker_.check();
+      }
+    }
+  }
+
+  void breakLoop() {
+    broken_ = true;
+  }
+
+  std::string getMethod() const {
+    return "epoll";
+  }
+
+ private:
+  static const int MAX_EVENTS = 64;
+
+  /// Drop ev from the readiness being dispatched
+  void forget(Event* ev) {
+    for (int i = 0; i < numReady_; ++i) {
+      if (ready_[i].data.ptr == ev) {
+        ready_[i].data.ptr = NULL;
+      }
+    }
+  }
+
+  int epollFd_;
+  volatile bool broken_;
+  std::vector<struct epoll_event> ready_;
+  int numReady_;
+  Ticker ticker_;
+};
+#endif // HAVE_SYS_EPOLL_H
+
+#ifdef HAVE_SYS_EVENT_H
+/**
+ * Loop on a kqueue.
+ */
+class TKqueueLoop : public TEventLoop {
+ public:
+  TKqueueLoop() :
+    broken_(false),
+    ready_(MAX_EVENTS),
+    numReady_(0) {
+    kqueueFd_ = kqueue();
+    if (kqueueFd_ == -1) {
+      throw TException("TKqueueLoop: kqueue() failed: " +
+                       TOutput::strerror_s(errno));
+    }
+  }
+
+  ~TKqueueLoop() {
+    ::close(kqueueFd_);
+  }
+
+  bool add(Event* ev) {
+    // Each filter is registered on its own, so remember which are set
+    short before = ev->added ? static_cast<short>(reinterpret_cast<intptr_t>(ev->backendData)) : 0;
+    u_short clear = (ev->flags & EDGE) ? EV_CLEAR : 0;
+    struct kevent changes[2];
+    int n = 0;
+    if (ev->flags & READ) {
+      EV_SET(&changes[n++], ev->fd, EVFILT_READ, EV_ADD | EV_ENABLE | clear, 0, 0, ev);
+    } else if (before & READ) {
+      EV_SET(&changes[n++], ev->fd, EVFILT_READ, EV_DELETE, 0, 0, ev);
+    }
+    if (ev->flags & WRITE) {
+      EV_SET(&changes[n++], ev->fd, EVFILT_WRITE, EV_ADD | EV_ENABLE | clear, 0, 0, ev);
+    } else if (before & WRITE) {
+      EV_SET(&changes[n++], ev->fd, EVFILT_WRITE, EV_DELETE, 0, 0, ev);
+    }
+    if (n > 0 && kevent(kqueueFd_, changes, n, NULL, 0, NULL) == -1) {
+      GlobalOutput.perror("TKqueueLoop: kevent() ", errno);
+      return false;
+    }
+    ev->backendData = reinterpret_cast<void*>(static_cast<intptr_t>(ev->flags & (READ | WRITE)));
+    ev->added = true;
+    return true;
+  }
+
+  bool del(Event* ev) {
+    if (!ev->added) {
+      return true;
+    }
+    short before = static_cast<short>(reinterpret_cast<intptr_t>(ev->backendData));
+    ev->added = false;
+    ev->backendData = NULL;
+    forget(ev);
+
+    struct kevent changes[2];
+    int n = 0;
+    if (before & READ) {
+      EV_SET(&changes[n++], ev->fd, EVFILT_READ, EV_DELETE, 0, 0, ev);
+    }
+    if (before & WRITE) {
+      EV_SET(&changes[n++], ev->fd, EVFILT_WRITE, EV_DELETE, 0, 0, ev);
+    }
+    if (n > 0 && kevent(kqueueFd_, changes, n, NULL, 0, NULL) == -1 && errno != EBADF) {
+      GlobalOutput.perror("TKqueueLoop: kevent() ", errno);
+      return false;
+    }
+    return true;
+  }
+
+  void setTick(int64_t interval, TickCallback callback, void* arg) {
+    ticker_.set(interval, callback, arg);
+  }
+
+  void run() {
+    broken_ = false;
+    while (!broken_) {
+      int timeout = ticker_.timeout();
+      struct timespec ts;
+      if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000L;
+      }
+      numReady_ = kevent(kqueueFd_, NULL, 0, &ready_[0], MAX_EVENTS,
+                         timeout >= 0 ? &ts : NULL);
+      if (numReady_ == -1) {
+        numReady_ = 0;
+        if (errno == EINTR) {
+          continue;
+        }
+        GlobalOutput.perror("TKqueueLoop: kevent() ", errno);
+        return;
+      }
+      Util::tickCachedTime();
+      for (int i = 0; i < numReady_ && !broken_; ++i) {
+        Event* ev = static_cast<Event*>(ready_[i].udata);
+        if (ev == NULL || (ready_[i].flags & EV_ERROR)) {
+          continue;
+        }
+        short which = (ready_[i].filter == EVFILT_READ) ? READ : WRITE;
+        which &= ev->flags;
+        if (which != 0) {
+          ev->callback(ev->fd, which, ev->arg);
+        }
+      }
+      numReady_ = 0;
+      if (!broken_) {
+        ticker_.check();
+      }
+    }
+  }
+
+  void breakLoop() {
+    broken_ = true;
+  }
+
+  std::string getMethod() const {
+    return "kqueue";
+  }
+
+ private:
+  static const int MAX_EVENTS = 64;
+
+  /// Drop ev from the readiness being dispatched
+  void forget(Event* ev) {
+    for (int i = 0; i < numReady_; ++i) {
+      if (ready_[i].udata == ev) {
+        ready_[i].udata = NULL;
+      }
+    }
+  }
+
+  int kqueueFd_;
+  volatile bool broken_;
+  std::vector<struct kevent> ready_;
+  int numReady_;
+  Ticker ticker_;
+};
+#endif // HAVE_SYS_EVENT_H
+
+}
+
+shared_ptr<TEventLoop> TEventLoop::create(Backend backend) {
+  switch (backend) {
+  case BACKEND_DEFAULT:
+  case BACKEND_LIBEVENT:
+    {
+      event_base* base = event_base_new();
+      if (base == NULL) {
+        throw TException("TEventLoop: event_base_new() failed");
+      }
+      return shared_ptr<TEventLoop>(new TLibeventLoop(base, true));
+    }
+
+  case BACKEND_EPOLL:
+#ifdef HAVE_SYS_EPOLL_H
+    return shared_ptr<TEventLoop>(new TEpollLoop());
+#else
+    throw TException("TEventLoop: epoll is not available on this platform");
+#endif
+
+  case BACKEND_KQUEUE:
+#ifdef HAVE_SYS_EVENT_H
+    return shared_ptr<TEventLoop>(new TKqueueLoop());
+#else
+    throw TException("TEventLoop: kqueue is not available on this platform");
+#endif
+  }
+
+  throw TException("TEventLoop: unknown backend");
+}
+
+shared_ptr<TEventLoop> TEventLoop::wrap(event_base* base) {
+  return shared_ptr<TEventLoop>(new TLibeventLoop(base, false));
+}
+
+}}} // apache::thrift::server
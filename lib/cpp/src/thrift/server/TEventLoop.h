@@ -0,0 +1,159 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TEVENTLOOP_H_
+#define _THRIFT_SERVER_TEVENTLOOP_H_ 1
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/Thrift.h>
+#include <thrift/transport/PlatformSocket.h>
+
+struct event_base;
+
+namespace apache { namespace thrift { namespace server {
+
+/**
+ * The event loop an IO thread of TNonblockingServer runs: persistent
+ * interest in a descriptor becoming readable or writable, and a loop that
+ * calls back until it is broken.
+ *
+ * The backend is picked at runtime.  libevent is the default and the only
+ * one that can run on an event_base supplied by the user; epoll (Linux) and
+ * kqueue (BSD, macOS) call the kernel directly.
+ */
+class TEventLoop {
+ public:
+  /// Interest and readiness flags; the same values as libevent's EV_*
+  enum {
+    READ = 0x02,
+    WRITE = 0x04,
+    /**
+     * Report readiness only when it changes (EPOLLET, EV_CLEAR).  Only for
+     * handlers that read or accept until the descriptor would block.
+     * Ignored by libevent.
+     */
+    EDGE = 0x40
+  };
+
+  enum Backend {
+    BACKEND_DEFAULT,
+    BACKEND_LIBEVENT,
+    BACKEND_EPOLL,
+    BACKEND_KQUEUE
+  };
+
+  typedef void (*Callback)(THRIFT_SOCKET fd, short which, void* arg);
+
+  typedef void (*TickCallback)(void* arg);
+
+  /**
+   * A registration, owned by the caller like a libevent struct event.  Set
+   * the fields, then add() it; add() again after changing flags.
+   */
+  struct Event {
+    Event() :
+      fd(THRIFT_INVALID_SOCKET),
+      flags(0),
+      callback(NULL),
+      arg(NULL),
+      added(false),
+      backendData(NULL),
+      freeBackendData(NULL) {}
+
+    ~Event() {
+      if (freeBackendData != NULL) {
+        freeBackendData(backendData);
+      }
+    }
+
+    THRIFT_SOCKET fd;
+    short flags;
+    Callback callback;
+    void* arg;
+
+    /// Whether the event is registered with a loop
+    bool added;
+
+    /// Owned by the backend
+    void* backendData;
+    void (*freeBackendData)(void*);
+
+   private:
+    Event(const Event&);
+    Event& operator=(const Event&);
+  };
+
+  virtual ~TEventLoop() {}
+
+  /**
+   * Watch ev->fd for ev->flags, or change what it is watched for.
+   */
+  virtual bool add(Event* ev) = 0;
+
+  /**
+   * Stop watching ev.  It won't be called back after this, even for
+   * readiness already collected.  Does nothing if ev isn't added.
+   */
+  virtual bool del(Event* ev) = 0;
+
+  /**
+   * Call callback(arg) from run() about every interval milliseconds, in
+   * between readiness callbacks, for work such as timeouts that needs no
+   * descriptor.  A NULL callback stops the tick.  One tick per loop.
+   */
+  virtual void setTick(int64_t interval, TickCallback callback, void* arg) = 0;
+
+  /**
+   * Call back ready events until breakLoop().  Each turn of the loop first
+   * ticks the thread's Util::cachedTime(), so callbacks can read the time
+   * from it rather than the clock; libevent ticks it per callback.
+   */
+  virtual void run() = 0;
+
+  /**
+   * Make run() return once the callback in progress is done.  From another
+   * thread, the loop also has to be woken by an event.
+   */
+  virtual void breakLoop() = 0;
+
+  /// Name of the mechanism, for logging
+  virtual std::string getMethod() const = 0;
+
+  /// The libevent event_base, or NULL for the other backends
+  virtual event_base* getEventBase() const {
+    return NULL;
+  }
+
+  /**
+   * Create a loop.
+   *
+   * @throws TException if the backend isn't available on this platform.
+   */
+  static boost::shared_ptr<TEventLoop> create(Backend backend = BACKEND_DEFAULT);
+
+  /**
+   * Loop on an event_base owned by someone else.
+   */
+  static boost::shared_ptr<TEventLoop> wrap(event_base* base);
+};
+
+}}} // apache::thrift::server
+
+#endif // #ifndef _THRIFT_SERVER_TEVENTLOOP_H_
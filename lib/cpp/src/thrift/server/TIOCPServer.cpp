@@ -0,0 +1,584 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include <thrift/thrift-config.h>
+
+#ifdef _WIN32
+
+#include <thrift/server/TIOCPServer.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TPipe.h>
+#include <thrift/transport/TSocket.h>
+#include <thrift/windows/TWinsockSingleton.h>
+
+#include <cstring>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+
+namespace apache { namespace thrift { namespace server {
+
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace std;
+using boost::shared_ptr;
+
+namespace {
+
+/// What an overlapped operation was for
+enum OpType {
+  OP_ACCEPT,
+  OP_CONNECT_PIPE,
+  OP_RECV,
+  OP_SEND
+};
+
+/// Room AcceptEx() wants for each of the two addresses it returns
+const DWORD ACCEPT_ADDRESS_SIZE = sizeof(sockaddr_storage) + 16;
+
+/// Size of the kernel buffers of each pipe instance
+const DWORD PIPE_BUFFER_SIZE = 65536;
+
+/// Times a pipe instance is reused after a client leaves before connecting
+const int CONNECT_PIPE_RETRIES = 4;
+
+template<class T>
+inline char* const_cast_sockopt(T* v) {
+  return reinterpret_cast<char*>(v);
+}
+
+}
+
+/**
+ * An overlapped operation.  The OVERLAPPED comes first, so the pointer a
+ * completion hands back is the operation.
+ */
+struct TIOCPServer::Operation {
+  OVERLAPPED overlapped;
+  OpType type;
+  /// The Acceptor or Connection the operation belongs to
+  void* owner;
+
+  void reset(OpType opType) {
+    memset(&overlapped, 0, sizeof(overlapped));
+    type = opType;
+  }
+};
+
+/**
+ * One AcceptEx() kept outstanding on the listen socket.
+ */
+struct TIOCPServer::Acceptor {
+  Operation op;
+  /// Socket the next client is accepted into
+  THRIFT_SOCKET socket;
+  bool pending;
+  char addresses[2 * ACCEPT_ADDRESS_SIZE];
+};
+
+/**
+ * A client connection, or a pipe instance waiting for one.
+ */
+struct TIOCPServer::Connection : public TCompletionServer::Connection {
+  /// The socket or pipe
+  HANDLE handle;
+  bool pipe;
+
+  /// The pipe connect, then every receive
+  Operation readOp;
+  Operation sendOp;
+
+  std::vector<uint8_t> recvBuffer;
+
+  Connection(HANDLE h, bool isPipe) :
+    handle(h),
+    pipe(isPipe) {
+    readOp.owner = this;
+    sendOp.owner = this;
+  }
+};
+
+TIOCPServer::~TIOCPServer() {
+  cleanup();
+}
+
+void TIOCPServer::init(int port) {
+  serverName_ = "TIOCPServer";
+  port_ = port;
+  completionPort_ = NULL;
+  pendingAccepts_ = PENDING_ACCEPTS;
+  pendingPipes_ = PENDING_PIPES;
+  recvBufferSize_ = RECV_BUFFER_SIZE;
+  acceptEx_ = NULL;
+  getAcceptExSockaddrs_ = NULL;
+}
+
+void TIOCPServer::setPipeName(const std::string& pipename) {
+  if (pipename.empty() || pipename.find("\\\\") != std::string::npos) {
+    pipeName_ = pipename;
+  } else {
+    pipeName_ = "\\\\.\\pipe\\" + pipename;
+  }
+}
+
+void TIOCPServer::loadExtensions() {
+  GUID acceptExGuid = WSAID_ACCEPTEX;
+  GUID sockaddrsGuid = WSAID_GETACCEPTEXSOCKADDRS;
+  LPFN_ACCEPTEX acceptEx = NULL;
+  LPFN_GETACCEPTEXSOCKADDRS getAcceptExSockaddrs = NULL;
+  DWORD bytes = 0;
+
+  if (WSAIoctl(serverSocket_, SIO_GET_EXTENSION_FUNCTION_POINTER,
+               &acceptExGuid, sizeof(acceptExGuid), &acceptEx, sizeof(acceptEx),
+               &bytes, NULL, NULL) == SOCKET_ERROR ||
+      WSAIoctl(serverSocket_, SIO_GET_EXTENSION_FUNCTION_POINTER,
+               &sockaddrsGuid, sizeof(sockaddrsGuid),
+               &getAcceptExSockaddrs, sizeof(getAcceptExSockaddrs),
+               &bytes, NULL, NULL) == SOCKET_ERROR) {
+    throw TException("TIOCPServer::serve() looking up AcceptEx() failed: " +
+                     TOutput::strerror_s(THRIFT_GET_SOCKET_ERROR));
+  }
+  acceptEx_ = reinterpret_cast<void*>(acceptEx);
+  getAcceptExSockaddrs_ = reinterpret_cast<void*>(getAcceptExSockaddrs);
+}
+
+void TIOCPServer::postAccept(Acceptor* acceptor) {
+  acceptor->socket = socket(listenFamily_, SOCK_STREAM, IPPROTO_TCP);
+  if (acceptor->socket == THRIFT_INVALID_SOCKET) {
+    GlobalOutput.perror("TIOCPServer: socket() ", THRIFT_GET_SOCKET_ERROR);
+    return;
+  }
+
+  acceptor->op.reset(OP_ACCEPT);
+  LPFN_ACCEPTEX acceptEx = reinterpret_cast<LPFN_ACCEPTEX>(acceptEx_);
+  DWORD bytes = 0;
+  if (!acceptEx(serverSocket_, acceptor->socket, acceptor->addresses, 0,
+                ACCEPT_ADDRESS_SIZE, ACCEPT_ADDRESS_SIZE, &bytes,
+                &acceptor->op.overlapped)) {
+    int error = THRIFT_GET_SOCKET_ERROR;
+    if (error != ERROR_IO_PENDING) {
+      GlobalOutput.perror("TIOCPServer: AcceptEx() ", error);
+      ::THRIFT_CLOSESOCKET(acceptor->socket);
+      acceptor->socket = THRIFT_INVALID_SOCKET;
+      return;
+    }
+  }
+  // Even an accept that finished at once reports to the port
+  acceptor->pending = true;
+}
+
+void TIOCPServer::postConnectPipe() {
+  HANDLE pipe = CreateNamedPipeA(pipeName_.c_str(),
+                                 PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+                                 PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE,
+                                 PIPE_UNLIMITED_INSTANCES,
+                                 PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, NULL);
+  if (pipe == INVALID_HANDLE_VALUE) {
+    GlobalOutput.perror("TIOCPServer: CreateNamedPipe() ", GetLastError());
+    return;
+  }
+  if (CreateIoCompletionPort(pipe, completionPort_, 0, 0) == NULL) {
+    GlobalOutput.perror("TIOCPServer: CreateIoCompletionPort() ", GetLastError());
+    CloseHandle(pipe);
+    return;
+  }
+
+  Connection* conn = new Connection(pipe, true);
+  conn->transport.reset(new TPipe(pipe));
+  connections_.insert(conn);
+
+  for (int attempt = 0; ; ++attempt) {
+    conn->readOp.reset(OP_CONNECT_PIPE);
+    DWORD error = ERROR_IO_PENDING;
+    if (!ConnectNamedPipe(pipe, &conn->readOp.overlapped)) {
+      error = GetLastError();
+    }
+
+    if (error == ERROR_IO_PENDING) {
+      ++conn->inflight;
+      return;
+    }
+    if (error == ERROR_PIPE_CONNECTED) {
+      // A client got in between CreateNamedPipe() and ConnectNamedPipe();
+      // nothing is queued for it
+      handleConnectPipe(conn, 0);
+      return;
+    }
+    if (error == ERROR_NO_DATA && attempt < CONNECT_PIPE_RETRIES) {
+      // That client has already gone again
+      DisconnectNamedPipe(pipe);
+      continue;
+    }
+    GlobalOutput.perror("TIOCPServer: ConnectNamedPipe() ", error);
+    closeConnection(conn);
+    return;
+  }
+}
+
+void TIOCPServer::postRecv(Connection* conn) {
+  conn->readOp.reset(OP_RECV);
+  DWORD size = static_cast<DWORD>(conn->recvBuffer.size());
+  DWORD error = 0;
+  if (conn->pipe) {
+    if (!ReadFile(conn->handle, &conn->recvBuffer[0], size, NULL,
+                  &conn->readOp.overlapped)) {
+      error = GetLastError();
+    }
+  } else {
+    WSABUF buf;
+    buf.buf = reinterpret_cast<char*>(&conn->recvBuffer[0]);
+    buf.len = size;
+    DWORD flags = 0;
+    if (WSARecv(reinterpret_cast<SOCKET>(conn->handle), &buf, 1, NULL, &flags,
+                &conn->readOp.overlapped, NULL) == SOCKET_ERROR) {
+      error = WSAGetLastError();
+    }
+  }
+
+  // ERROR_MORE_DATA is part of a pipe message, which still completes to the port
+  if (error != 0 && error != ERROR_IO_PENDING && error != ERROR_MORE_DATA) {
+    if (error != ERROR_BROKEN_PIPE && error != WSAECONNRESET) {
+      GlobalOutput.perror("TIOCPServer: recv ", error);
+    }
+    closeConnection(conn);
+    return;
+  }
+  conn->recvArmed = true;
+  ++conn->inflight;
+}
+
+void TIOCPServer::postSend(Connection* conn) {
+  conn->sendOp.reset(OP_SEND);
+  DWORD size = static_cast<DWORD>(conn->out.size() - conn->outPos);
+  DWORD error = 0;
+  if (conn->pipe) {
+    if (!WriteFile(conn->handle, &conn->out[conn->outPos], size, NULL,
+                   &conn->sendOp.overlapped)) {
+      error = GetLastError();
+    }
+  } else {
+    WSABUF buf;
+    buf.buf = reinterpret_cast<char*>(&conn->out[conn->outPos]);
+    buf.len = size;
+    if (WSASend(reinterpret_cast<SOCKET>(conn->handle), &buf, 1, NULL, 0,
+                &conn->sendOp.overlapped, NULL) == SOCKET_ERROR) {
+      error = WSAGetLastError();
+    }
+  }
+
+  if (error != 0 && error != ERROR_IO_PENDING) {
+    if (error != ERROR_NO_DATA && error != WSAECONNRESET) {
+      GlobalOutput.perror("TIOCPServer: send ", error);
+    }
+    closeConnection(conn);
+    return;
+  }
+  conn->sending = true;
+  ++conn->inflight;
+}
+
+void TIOCPServer::handleAccept(Acceptor* acceptor, DWORD error) {
+  acceptor->pending = false;
+  THRIFT_SOCKET s = acceptor->socket;
+  acceptor->socket = THRIFT_INVALID_SOCKET;
+
+  if (error != 0 || stop_) {
+    ::THRIFT_CLOSESOCKET(s);
+    if (!stop_) {
+      // A client that gave up before it was accepted ends up here too
+      if (error != ERROR_NETNAME_DELETED && error != WSAECONNRESET) {
+        GlobalOutput.perror("TIOCPServer: AcceptEx ", error);
+      }
+      postAccept(acceptor);
+    }
+    return;
+  }
+
+  // The addresses must be read before the buffer is posted again
+  sockaddr* localAddr = NULL;
+  sockaddr* remoteAddr = NULL;
+  int localLen = 0;
+  int remoteLen = 0;
+  LPFN_GETACCEPTEXSOCKADDRS getAcceptExSockaddrs =
+    reinterpret_cast<LPFN_GETACCEPTEXSOCKADDRS>(getAcceptExSockaddrs_);
+  getAcceptExSockaddrs(acceptor->addresses, 0, ACCEPT_ADDRESS_SIZE, ACCEPT_ADDRESS_SIZE,
+                       &localAddr, &localLen, &remoteAddr, &remoteLen);
+  shared_ptr<TSocket> tSocket(new TSocket(s));
+  if (remoteAddr != NULL) {
+    tSocket->setCachedAddress(remoteAddr, remoteLen);
+  }
+
+  postAccept(acceptor);
+
+  // Lets getpeername(), shutdown() and the like work on the socket
+  setsockopt(s, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
+             const_cast_sockopt(&serverSocket_), sizeof(serverSocket_));
+  int one = 1;
+  setsockopt(s, IPPROTO_TCP, TCP_NODELAY, const_cast_sockopt(&one), sizeof(one));
+
+  HANDLE handle = reinterpret_cast<HANDLE>(s);
+  if (CreateIoCompletionPort(handle, completionPort_, 0, 0) == NULL) {
+    GlobalOutput.perror("TIOCPServer: CreateIoCompletionPort() ", GetLastError());
+    tSocket->close();
+    return;
+  }
+
+  Connection* conn = new Connection(handle, false);
+  conn->transport = tSocket;
+  conn->tSocket = tSocket;
+  conn->recvBuffer.resize(recvBufferSize_);
+  connections_.insert(conn);
+  startConnection(conn);
+}
+
+void TIOCPServer::handleConnectPipe(Connection* conn, DWORD error) {
+  if (stop_) {
+    closeConnection(conn);
+    return;
+  }
+
+  // Keep as many instances waiting as before
+  postConnectPipe();
+
+  if (error != 0) {
+    if (error != ERROR_NO_DATA && error != ERROR_BROKEN_PIPE) {
+      GlobalOutput.perror("TIOCPServer: ConnectNamedPipe ", error);
+    }
+    closeConnection(conn);
+    return;
+  }
+  conn->recvBuffer.resize(recvBufferSize_);
+  startConnection(conn);
+}
+
+void TIOCPServer::handleRecv(Connection* conn, DWORD bytes, DWORD error) {
+  if (error == ERROR_MORE_DATA) {
+    // The rest of the pipe message comes with the next read
+    error = 0;
+  }
+  if (error != 0 || bytes == 0) {
+    if (error != 0 && error != ERROR_BROKEN_PIPE &&
+        error != ERROR_NETNAME_DELETED && error != WSAECONNRESET) {
+      GlobalOutput.perror("TIOCPServer: recv ", error);
+    }
+    closeConnection(conn);
+    return;
+  }
+
+  received(conn, &conn->recvBuffer[0], bytes);
+}
+
+void TIOCPServer::handleSend(Connection* conn, DWORD bytes, DWORD error) {
+  if (error != 0) {
+    if (error != ERROR_NO_DATA && error != ERROR_BROKEN_PIPE &&
+        error != ERROR_NETNAME_DELETED && error != WSAECONNRESET) {
+      GlobalOutput.perror("TIOCPServer: send ", error);
+    }
+    closeConnection(conn);
+    return;
+  }
+
+  sent(conn, bytes);
+}
+
+void TIOCPServer::queueRecv(TCompletionServer::Connection* conn) {
+  postRecv(static_cast<Connection*>(conn));
+}
+
+void TIOCPServer::queueSend(TCompletionServer::Connection* conn) {
+  // The next request is read once the response is out
+  postSend(static_cast<Connection*>(conn));
+}
+
+void TIOCPServer::cancelConnection(TCompletionServer::Connection* base) {
+  Connection* conn = static_cast<Connection*>(base);
+  if (conn->inflight > 0) {
+    // The posted operations complete with ERROR_OPERATION_ABORTED.  Every
+    // one was posted by this thread, which is all CancelIo() covers.
+    CancelIo(conn->handle);
+  }
+}
+
+std::string TIOCPServer::getConnectionInfo(const TCompletionServer::Connection* conn) const {
+  if (static_cast<const Connection*>(conn)->pipe) {
+    return pipeName_;
+  }
+  return TCompletionServer::getConnectionInfo(conn);
+}
+
+void TIOCPServer::handleCompletion(Operation* op, DWORD bytes, DWORD error) {
+  if (op->type == OP_ACCEPT) {
+    handleAccept(static_cast<Acceptor*>(op->owner), error);
+    return;
+  }
+
+  Connection* conn = static_cast<Connection*>(op->owner);
+  if (op->type == OP_RECV) {
+    conn->recvArmed = false;
+  } else if (op->type == OP_SEND) {
+    conn->sending = false;
+  }
+  if (!completed(conn)) {
+    return;
+  }
+
+  switch (op->type) {
+  case OP_CONNECT_PIPE:
+    handleConnectPipe(conn, error);
+    break;
+
+  case OP_RECV:
+    handleRecv(conn, bytes, error);
+    break;
+
+  case OP_SEND:
+    handleSend(conn, bytes, error);
+    break;
+
+  default:
+    break;
+  }
+}
+
+bool TIOCPServer::runOnce() {
+  DWORD bytes = 0;
+  ULONG_PTR key = 0;
+  OVERLAPPED* overlapped = NULL;
+  BOOL ok = GetQueuedCompletionStatus(completionPort_, &bytes, &key, &overlapped, INFINITE);
+  if (overlapped == NULL) {
+    if (!ok) {
+      throw TException("TIOCPServer: GetQueuedCompletionStatus() failed: " +
+                       TOutput::strerror_s(GetLastError()));
+    }
+    // Woken by stop()
+    return false;
+  }
+
+  DWORD error = ok ? 0 : GetLastError();
+  handleCompletion(reinterpret_cast<Operation*>(overlapped), bytes, error);
+  return true;
+}
+
+void TIOCPServer::serve() {
+  stop_ = false;
+  TWinsockSingleton::create();
+
+  try {
+    completionPort_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (completionPort_ == NULL) {
+      throw TException("TIOCPServer::serve() CreateIoCompletionPort() failed: " +
+                       TOutput::strerror_s(GetLastError()));
+    }
+
+    if (port_ >= 0) {
+      createAndListenOnSocket();
+      if (CreateIoCompletionPort(reinterpret_cast<HANDLE>(serverSocket_),
+                                 completionPort_, 0, 0) == NULL) {
+        throw TException("TIOCPServer::serve() CreateIoCompletionPort() failed: " +
+                         TOutput::strerror_s(GetLastError()));
+      }
+      loadExtensions();
+      for (uint32_t i = 0; i < pendingAccepts_; ++i) {
+        Acceptor* acceptor = new Acceptor();
+        acceptor->op.owner = acceptor;
+        acceptor->socket = THRIFT_INVALID_SOCKET;
+        acceptor->pending = false;
+        acceptors_.push_back(acceptor);
+        postAccept(acceptor);
+      }
+    }
+    if (!pipeName_.empty()) {
+      for (uint32_t i = 0; i < pendingPipes_; ++i) {
+        postConnectPipe();
+      }
+    }
+  } catch (...) {
+    cleanup();
+    throw;
+  }
+
+  // Notify handler of the preServe event
+  if (eventHandler_) {
+    eventHandler_->preServe();
+  }
+
+  while (!stop_) {
+    runOnce();
+  }
+
+  // Let the posted operations finish, as the kernel may still be using
+  // their buffers
+  if (serverSocket_ != THRIFT_INVALID_SOCKET) {
+    CancelIo(reinterpret_cast<HANDLE>(serverSocket_));
+  }
+  closeConnections();
+  for (;;) {
+    bool accepting = false;
+    for (size_t i = 0; i < acceptors_.size(); ++i) {
+      accepting = accepting || acceptors_[i]->pending;
+    }
+    if (connections_.empty() && !accepting) {
+      break;
+    }
+    runOnce();
+  }
+
+  cleanup();
+}
+
+void TIOCPServer::stop() {
+  stop_ = true;
+  if (completionPort_ != NULL) {
+    if (!PostQueuedCompletionStatus(completionPort_, 0, 0, NULL)) {
+      GlobalOutput.perror("TIOCPServer::stop() PostQueuedCompletionStatus ",
+                          GetLastError());
+    }
+  }
+}
+
+void TIOCPServer::cleanup() {
+  // Closing the sockets and pipes aborts anything still posted on them
+  if (serverSocket_ != THRIFT_INVALID_SOCKET) {
+    ::THRIFT_CLOSESOCKET(serverSocket_);
+    serverSocket_ = THRIFT_INVALID_SOCKET;
+  }
+  for (size_t i = 0; i < acceptors_.size(); ++i) {
+    if (acceptors_[i]->socket != THRIFT_INVALID_SOCKET) {
+      ::THRIFT_CLOSESOCKET(acceptors_[i]->socket);
+    }
+    delete acceptors_[i];
+  }
+  acceptors_.clear();
+
+  while (!connections_.empty()) {
+    destroyConnection(*connections_.begin());
+  }
+
+  if (completionPort_ != NULL) {
+    CloseHandle(completionPort_);
+    completionPort_ = NULL;
+  }
+}
+
+}}} // apache::thrift::server
+
+#endif // _WIN32
@@ -0,0 +1,195 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TIOCPSERVER_H_
+#define _THRIFT_SERVER_TIOCPSERVER_H_ 1
+
+#include <string>
+#include <vector>
+#include <thrift/server/TCompletionServer.h>
+
+namespace apache { namespace thrift { namespace server {
+
+#ifdef _WIN32
+
+/**
+ * Framed transport server for Windows driven by an I/O completion port,
+ * serving TCP clients, named pipe clients, or both.
+ *
+ * Speaks the same protocol as TNonblockingServer: every message carries a
+ * four byte frame size, and the processor runs on the IO thread.  Rather
+ * than wait on select() or on one blocking call per connection, every
+ * accept, pipe connect, read and write is overlapped and reports to the
+ * one completion port:
+ *
+ *  - several AcceptEx() calls are kept outstanding on the listen socket,
+ *  - several pipe instances are kept waiting in ConnectNamedPipe(), in
+ *    the message mode TPipe clients expect,
+ *  - each connection has at most one read or one write outstanding, and
+ *    reads again only once its responses are written.
+ *
+ * So the thread only wakes for work that is done, however many clients
+ * are connected.  It waits with GetQueuedCompletionStatus() and cancels
+ * with CancelIo(), so it runs on Windows XP and later.
+ */
+class TIOCPServer : public TCompletionServer {
+ public:
+  /// Default size of each connection's read buffer
+  static const uint32_t RECV_BUFFER_SIZE = 16384;
+
+  /// Default number of accepts kept outstanding
+  static const uint32_t PENDING_ACCEPTS = 16;
+
+  /// Default number of pipe instances kept waiting for a client
+  static const uint32_t PENDING_PIPES = 4;
+
+  template<typename ProcessorFactory>
+  TIOCPServer(
+      const boost::shared_ptr<ProcessorFactory>& processorFactory,
+      int port,
+      THRIFT_OVERLOAD_IF(ProcessorFactory, TProcessorFactory)) :
+    TCompletionServer(processorFactory) {
+    init(port);
+  }
+
+  template<typename Processor>
+  TIOCPServer(const boost::shared_ptr<Processor>& processor,
+              int port,
+              THRIFT_OVERLOAD_IF(Processor, TProcessor)) :
+    TCompletionServer(processor) {
+    init(port);
+  }
+
+  template<typename ProcessorFactory>
+  TIOCPServer(
+      const boost::shared_ptr<ProcessorFactory>& processorFactory,
+      const boost::shared_ptr<TProtocolFactory>& protocolFactory,
+      int port,
+      THRIFT_OVERLOAD_IF(ProcessorFactory, TProcessorFactory)) :
+    TCompletionServer(processorFactory) {
+    init(port);
+    setInputProtocolFactory(protocolFactory);
+    setOutputProtocolFactory(protocolFactory);
+  }
+
+  template<typename Processor>
+  TIOCPServer(
+      const boost::shared_ptr<Processor>& processor,
+      const boost::shared_ptr<TProtocolFactory>& protocolFactory,
+      int port,
+      THRIFT_OVERLOAD_IF(Processor, TProcessor)) :
+    TCompletionServer(processor) {
+    init(port);
+    setInputProtocolFactory(protocolFactory);
+    setOutputProtocolFactory(protocolFactory);
+  }
+
+  ~TIOCPServer();
+
+  /**
+   * Also serve clients of the named pipe pipename, given as to TPipeServer.
+   * With a port below 0 only the pipe is served.  Takes effect at the next
+   * serve().
+   */
+  void setPipeName(const std::string& pipename);
+
+  const std::string& getPipeName() const {
+    return pipeName_;
+  }
+
+  /**
+   * Sets how many accepts and pipe instances are kept waiting for clients,
+   * which is how many can arrive at once without waiting for the IO thread.
+   * Takes effect at the next serve().
+   */
+  void setPendingAccepts(uint32_t accepts, uint32_t pipes) {
+    pendingAccepts_ = accepts;
+    pendingPipes_ = pipes;
+  }
+
+  /**
+   * Sets the size of each connection's read buffer.  Takes effect for
+   * connections made after the call.
+   */
+  void setRecvBufferSize(uint32_t size) {
+    recvBufferSize_ = size;
+  }
+
+  /**
+   * Main workhorse function, starts up the server listening and loops over
+   * the completion port until stop() is called.
+   */
+  void serve();
+
+  /**
+   * Makes serve() return.  May be called from any thread.
+   */
+  void stop();
+
+ private:
+  struct Operation;
+  struct Acceptor;
+  struct Connection;
+
+  void init(int port);
+
+  void loadExtensions();
+
+  void postAccept(Acceptor* acceptor);
+  void postConnectPipe();
+  void postRecv(Connection* conn);
+  void postSend(Connection* conn);
+
+  void handleCompletion(Operation* op, DWORD bytes, DWORD error);
+  void handleAccept(Acceptor* acceptor, DWORD error);
+  void handleConnectPipe(Connection* conn, DWORD error);
+  void handleRecv(Connection* conn, DWORD bytes, DWORD error);
+  void handleSend(Connection* conn, DWORD bytes, DWORD error);
+
+  void queueRecv(TCompletionServer::Connection* conn);
+  void queueSend(TCompletionServer::Connection* conn);
+  void cancelConnection(TCompletionServer::Connection* conn);
+  std::string getConnectionInfo(const TCompletionServer::Connection* conn) const;
+
+  /// Wait for and handle one completion; false if woken with nothing
+  bool runOnce();
+
+  void cleanup();
+
+  std::string pipeName_;
+
+  /// The completion port, while serving
+  HANDLE completionPort_;
+
+  uint32_t pendingAccepts_;
+  uint32_t pendingPipes_;
+  uint32_t recvBufferSize_;
+
+  /// AcceptEx() and GetAcceptExSockaddrs(), looked up for the listen socket
+  void* acceptEx_;
+  void* getAcceptExSockaddrs_;
+
+  std::vector<Acceptor*> acceptors_;
+};
+
+#endif // _WIN32
+
+}}} // apache::thrift::server
+
+#endif // #ifndef _THRIFT_SERVER_TIOCPSERVER_H_
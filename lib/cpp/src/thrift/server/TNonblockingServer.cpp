@@ -22,12 +22,27 @@
 #include <thrift/thrift-config.h>
 
 #include <thrift/server/TNonblockingServer.h>
+#include <thrift/TApplicationException.h>
+#include <thrift/TDeadline.h>
+#include <thrift/TDeferredReply.h>
+#include <thrift/TProbe.h>
+#include <thrift/concurrency/Atomic.h>
 #include <thrift/concurrency/Exception.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/protocol/THeaderProtocol.h>
 #include <thrift/transport/TSocket.h>
+#include <thrift/transport/TSSLSocket.h>
 #include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ThreadPlacement.h>
 #include <thrift/transport/PlatformSocket.h>
 
+#include <algorithm>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/make_shared.hpp>
 #include <iostream>
+#include <deque>
+#include <sstream>
 
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
@@ -46,6 +61,10 @@
 #include <netdb.h>
 #endif
 
+#ifdef HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+
 #ifdef HAVE_FCNTL_H
 #include <fcntl.h>
 #endif
@@ -56,6 +75,22 @@
 #include <sched.h>
 #endif
 
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_SYS_POLL_H
+#include <sys/poll.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#endif
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define THRIFT_ZEROCOPY_SEND 1
+#endif
+
 #ifndef AF_LOCAL
 #define AF_LOCAL AF_UNIX
 #endif
@@ -99,35 +134,79 @@ enum TAppState {
   APP_CLOSE_CONNECTION
 };
 
+/// What a call turned away by a TConnectionQuota is told
+static const char* const THROTTLED_REASON = "TNonblockingServer: over quota";
+
+/// Messages a second each call site logging a failure of one connection prints
+static const uint32_t CONNECTION_ERRORS_PER_SECOND = 10;
+
+/// The port a socket is bound to, or -1
+static int localPort(THRIFT_SOCKET s) {
+  sockaddr_storage addrStorage;
+  socklen_t addrLen = sizeof(addrStorage);
+  if (getsockname(s, (sockaddr*)&addrStorage, &addrLen) != 0) {
+    return -1;
+  }
+  if (addrStorage.ss_family == AF_INET6) {
+    return ntohs(((sockaddr_in6*)&addrStorage)->sin6_port);
+  } else if (addrStorage.ss_family == AF_INET) {
+    return ntohs(((sockaddr_in*)&addrStorage)->sin_port);
+  }
+  return -1;
+}
+
 /**
  * Represents a connection that is handled via libevent. This connection
  * essentially encapsulates a socket that has some associated libevent state.
  */
 class TNonblockingServer::TConnection {
+ public:
+  class Task;
+  friend class TNonblockingIOThread;
+
+  /// One request on a pipelined connection, with its own buffers and protocols
+  struct PipelinedCall {
+    boost::shared_ptr<TMemoryBuffer> input;
+    boost::shared_ptr<TMemoryBuffer> output;
+    boost::shared_ptr<TProtocol> inputProtocol;
+    boost::shared_ptr<TProtocol> outputProtocol;
+    /// The task that last ran this call, kept for reuse
+    boost::shared_ptr<Task> task;
+    bool done;
+    bool failed;
+  };
+
  private:
-  /// Server IO Thread handling this connection
-  TNonblockingIOThread* ioThread_;
+  // The fields every event touches come first, so that working a connection
+  // mostly stays within its first few cache lines.  State only some
+  // connections need hangs off it, allocated when first used.
 
-  /// Server handle
-  TNonblockingServer* server_;
+  /// Socket mode
+  TSocketState socketState_;
 
-  /// TProcessor
-  boost::shared_ptr<TProcessor> processor_;
+  /// Application state
+  TAppState appState_;
 
-  /// Object wrapping network socket
-  boost::shared_ptr<TSocket> tSocket_;
+  /// TEventLoop flags currently registered
+  short eventFlags_;
 
-  /// Libevent object
-  struct event event_;
+  /// TEventLoop flags the state machine asked for; TLS may register more
+  short requestedFlags_;
 
-  /// Libevent flags
-  short eventFlags_;
+  /// True if this connection pipelines requests (see setPipelineDepth())
+  bool pipelined_;
 
-  /// Socket mode
-  TSocketState socketState_;
+  /// True once the client has sent an unframed request; see setHeaderTransport()
+  bool unframed_;
 
-  /// Application state
-  TAppState appState_;
+  /// True while readFrames() is taking requests out of what it received
+  bool readingFrames_;
+
+  /// Set while close() must leave returning us to the server to the caller
+  bool deferReturn_;
+
+  /// True while reading waits for the server's memory budget
+  bool memoryWait_;
 
   /// How much data needed to read
   uint32_t readWant_;
@@ -135,11 +214,17 @@ class TNonblockingServer::TConnection {
   /// Where in the read buffer are we
   uint32_t readBufferPos_;
 
+  /// Read buffer size
+  uint32_t readBufferSize_;
+
   /// Read buffer
   uint8_t* readBuffer_;
 
-  /// Read buffer size
-  uint32_t readBufferSize_;
+  /**
+   * The request being served when it is still in the IO thread's receive
+   * buffer rather than readBuffer_, else NULL
+   */
+  const uint8_t* borrowedRequest_;
 
   /// Write buffer
   uint8_t* writeBuffer_;
@@ -150,17 +235,37 @@ class TNonblockingServer::TConnection {
   /// How far through writing are we?
   uint32_t writeBufferPos_;
 
-  /// Largest size of write buffer seen since buffer was constructed
-  size_t largestWriteBufferSize_;
+  /// Bytes this connection currently counts in the IO thread's pending bytes
+  uint32_t pendingBytes_;
 
   /// Count of the number of calls for use with getResizeBufferEveryN().
   int32_t callsForResize_;
 
-  /// Task handle
-  int taskHandle_;
+  /// Server IO Thread handling this connection
+  TNonblockingIOThread* ioThread_;
+
+  /// Server handle
+  TNonblockingServer* server_;
+
+  /// Object wrapping network socket
+  boost::shared_ptr<TSocket> tSocket_;
+
+  /// tSocket_ when the server speaks TLS, otherwise NULL
+  boost::shared_ptr<TSSLSocket> tlsSocket_;
+
+  /// Requests read so far, and how many had been when the wait began
+  uint64_t requestsRead_;
+  uint64_t waitRequests_;
+
+  /// What the connection waits for from its client; see updateWait()
+  TNonblockingIOThread::Wait wait_;
 
-  /// Task event
-  struct event taskEvent_;
+  /// When the wait times out, 0 if it doesn't
+  int64_t waitDeadline_;
+
+  /// Neighbours in the IO thread's list for wait_, while it has a deadline
+  TConnection* waitPrev_;
+  TConnection* waitNext_;
 
   /// Transport to read from
   boost::shared_ptr<TMemoryBuffer> inputTransport_;
@@ -168,30 +273,259 @@ class TNonblockingServer::TConnection {
   /// Transport that processor writes to
   boost::shared_ptr<TMemoryBuffer> outputTransport_;
 
-  /// extra transport generated by transport factory (e.g. BufferedRouterTransport)
-  boost::shared_ptr<TTransport> factoryInputTransport_;
-  boost::shared_ptr<TTransport> factoryOutputTransport_;
-
   /// Protocol decoder
   boost::shared_ptr<TProtocol> inputProtocol_;
 
   /// Protocol encoder
   boost::shared_ptr<TProtocol> outputProtocol_;
 
+  /// TProcessor
+  boost::shared_ptr<TProcessor> processor_;
+
+  /// The task that last ran this connection's request, kept for reuse
+  boost::shared_ptr<Task> task_;
+
+  /// Registration with the IO thread's event loop
+  TEventLoop::Event event_;
+
+  // Colder: per connection rather than per event, or per event only with
+  // options that are off by default
+
+  /// The IO thread the connection last ran on, which keeps it when closed
+  TNonblockingIOThread* ownerThread_;
+
+  /// Neighbours in the owner's list of open connections
+  TConnection* activePrev_;
+  TConnection* activeNext_;
+
+  /// When the owner last kept it for reuse
+  int64_t idleSince_;
+
+  /// When a call last needed buffers beyond the idle limits
+  int64_t buffersNeededAt_;
+
+  /// Largest size of write buffer seen since buffer was constructed
+  size_t largestWriteBufferSize_;
+
+  /// The port the connection came in on, with the factories it is served by
+  const TNonblockingServer::Listener* listener_;
+
+  /// The async processor, if the connection's port is served by one
+  boost::shared_ptr<TAsyncProcessor> asyncProcessor_;
+
+  /// Trims buffers no call has needed for the server's buffer trim age
+  void trimBuffersByAge();
+
+  /// Transport that processor writes to, when using segmented write buffers
+  boost::shared_ptr<TSegmentedMemoryBuffer> segmentedOutputTransport_;
+
+  /// Frame size followed by the segments of segmentedOutputTransport_
+  std::vector<TIOVec> writeIov_;
+
+  /// First entry of writeIov_ that hasn't been completely sent
+  size_t writeIovPos_;
+
+  /// Frame size in network byte order, pointed to by writeIov_[0]
+  uint32_t writeFrameSize_;
+
+  /// Whether responses may go out with MSG_ZEROCOPY; see startZeroCopy()
+  enum {
+    ZEROCOPY_UNTRIED,
+    ZEROCOPY_ON,
+    ZEROCOPY_OFF
+  } zeroCopy_;
+
+  /// True if the response being sent goes out with MSG_ZEROCOPY
+  bool zeroCopyResponse_;
+
+  /**
+   * Response buffer that MSG_ZEROCOPY sends were made from, and how many of
+   * those the kernel has yet to report it is done with.  The buffer is NULL
+   * while it is still the output transport's, for the response being sent.
+   */
+  struct ZeroCopySpan {
+    uint8_t* buffer;
+    uint32_t capacity;
+    uint64_t firstSend;
+    uint64_t endSend;
+    uint64_t outstanding;
+  };
+
+  /// What MSG_ZEROCOPY sends need kept, made when they are first turned on
+  struct ZeroCopyState {
+    ZeroCopyState() : sends(0), spare(NULL), spareCapacity(0) {}
+
+    /// MSG_ZEROCOPY sends made on the socket, which the kernel numbers from 0
+    uint64_t sends;
+
+    /// Sends the kernel has yet to report on, oldest first
+    std::vector<ZeroCopySpan> spans;
+
+    /// A buffer the kernel is done with, for the next response set aside
+    uint8_t* spare;
+    uint32_t spareCapacity;
+  };
+
+  /// NULL until the connection first sends with MSG_ZEROCOPY
+  boost::scoped_ptr<ZeroCopyState> zeroCopyState_;
+
+  /// True if MSG_ZEROCOPY sends are waiting on the kernel's report
+  bool zeroCopyOutstanding() const {
+    return zeroCopyState_ && !zeroCopyState_->spans.empty();
+  }
+
+  /// extra transport generated by transport factory (e.g. BufferedRouterTransport)
+  boost::shared_ptr<TTransport> factoryInputTransport_;
+  boost::shared_ptr<TTransport> factoryOutputTransport_;
+
   /// Server event handler, if any
   boost::shared_ptr<TServerEventHandler> serverEventHandler_;
 
   /// Thrift call context, if any
   void *connectionContext_;
 
+  /// What a pipelined connection keeps, made the first time it pipelines
+  struct Pipeline {
+    Pipeline() : callsAwaitingNotify(0), outputPos(0), closing(false) {}
+
+    ~Pipeline() {
+      for (size_t i = 0; i < calls.size(); ++i) {
+        delete calls[i];
+      }
+      for (size_t i = 0; i < spareCalls.size(); ++i) {
+        delete spareCalls[i];
+      }
+    }
+
+    /// Requests dispatched but not yet answered, in arrival order
+    std::deque<PipelinedCall*> calls;
+
+    /// Calls taken from calls by collectCalls(), reused to avoid allocation
+    std::vector<PipelinedCall*> finishedCalls;
+
+    /// Answered PipelinedCall objects kept for reuse
+    std::vector<PipelinedCall*> spareCalls;
+
+    /// Guards the done and failed flags of the calls in calls
+    Mutex callsMutex;
+
+    /// Calls handed to the thread manager whose notification hasn't arrived
+    size_t callsAwaitingNotify;
+
+    /// Framed responses waiting to be sent
+    boost::shared_ptr<TMemoryBuffer> output;
+
+    /// How much of output has been sent
+    uint32_t outputPos;
+
+    /// Set once the connection should close when its calls finish
+    bool closing;
+  };
+
+  /// NULL until the connection first pipelines
+  boost::scoped_ptr<Pipeline> pipeline_;
+
+  /// The client's address without the port, kept for admission control
+  /// and per-client quotas
+  std::string clientAddress_;
+
+  /// This connection's own tokens under a PER_CONNECTION quota
+  TConnectionQuota::Bucket quotaBucket_;
+
+  /**
+   * Bytes the client sent after the request being served, or the start of
+   * a frame size, kept until the connection reads its next request
+   */
+  std::string readAhead_;
+
+  /// For finding where an unframed request ends
+  boost::shared_ptr<TMemoryBuffer> unframedProbe_;
+  boost::shared_ptr<TProtocol> unframedBinaryProbe_;
+  boost::shared_ptr<TProtocol> unframedCompactProbe_;
+
+  /// Makes the protocol for the given buffers when the server uses
+  /// THeaderTransport, otherwise returns NULL
+  boost::shared_ptr<TProtocol> headerProtocol(
+    const boost::shared_ptr<TTransport>& input,
+    const boost::shared_ptr<TTransport>& output);
+
+  /// Returns the size of the deadline prefix at the start of a request
+  /// frame, setting deadline from it or from the frame's header
+  uint32_t readDeadline(const uint8_t* frame, uint32_t size, int64_t& deadline);
+
+  /**
+   * Receives into the IO thread's buffer, after what was read ahead, and
+   * serves the complete requests found there one after another for as
+   * long as the connection is ready for the next one.  A frame that is
+   * only partly there is copied to readBuffer_ to be read on into.
+   *
+   * @param recv false to go on only with what was read ahead.
+   */
+  void readFrames(bool recv);
+
+  /**
+   * Starts on the request at the front of len received bytes.
+   *
+   * @return the bytes used, 0 if the frame size isn't all there.
+   */
+  uint32_t takeFrame(const uint8_t* data, uint32_t len);
+
+  /// Copies a borrowed request to readBuffer_ for it to outlive this call
+  void keepRequest();
+
+  /// Makes readBuffer_ hold at least size bytes, from the pool if in use
+  void sizeReadBuffer(uint32_t size);
+
+  /// Starts reading unframed requests, with start the first len bytes
+  void startUnframed(const uint8_t* start, uint32_t len);
+
+  /// Reads the next unframed request, beginning with what came after the last
+  void resumeUnframed();
+
+  /// Moves on if the read buffer holds a whole unframed request
+  void readUnframed();
+
+  /// Size of the unframed request in the read buffer, 0 if not all there
+  uint32_t unframedMessageSize();
+
+  /// Reads the header of a task's call if a policy needs it, sets its
+  /// priority and its service's thread manager (NULL for the usual one),
+  /// and returns whether to run it on this thread
+  bool routeTask(Task& task, int& priority, ThreadManager*& threadManager);
+
+  /**
+   * Asks the server's admission control, if any, whether task may be
+   * queued for a worker.
+   *
+   * @return false if the call should be refused.
+   */
+  bool admitTask(Task& task);
+
+  /**
+   * Takes a call of size bytes from the server's connection quota, if any.
+   *
+   * @return false if the call should be throttled.
+   */
+  bool withinQuota(uint32_t size);
+
+  /// Makes slot a task for the given call, reusing the one there if no one
+  /// else holds it any longer
+  boost::shared_ptr<Task>& prepareTask(boost::shared_ptr<Task>& slot,
+                                       const boost::shared_ptr<TProtocol>& input,
+                                       const boost::shared_ptr<TProtocol>& output,
+                                       PipelinedCall* call);
+
+  /// Abandons the tasks that others still hold, and lets go of them
+  void abandonTasks();
+
   /// Go into read mode
   void setRead() {
-    setFlags(EV_READ | EV_PERSIST);
+    setFlags(TEventLoop::READ);
   }
 
   /// Go into write mode
   void setWrite() {
-    setFlags(EV_WRITE | EV_PERSIST);
+    setFlags(TEventLoop::WRITE);
   }
 
   /// Set socket idle
@@ -214,35 +548,203 @@ class TNonblockingServer::TConnection {
    */
   void workSocket();
 
- public:
+  /**
+   * Libevent handler for pipelined connections.  Sends queued responses,
+   * reads whatever the client has sent and dispatches every complete frame
+   * there is room for.
+   *
+   * @param which the flags libevent passed.
+   */
+  void workSocketPipelined(short which);
 
-  class Task;
+  /**
+   * Handler for TLS connections.  Sends pending ciphertext, then runs the
+   * state machine for as long as OpenSSL holds input it asked for.
+   *
+   * @param which the flags the event loop passed.
+   */
+  void workSocketTLS(short which);
+
+  /// Read from the client: bytes read, 0 at end of stream or if the client
+  /// went away or the read failed, -1 if none yet
+  int32_t readClient(uint8_t* buf, uint32_t len);
+
+  /// Write to the client as much as it takes without blocking: bytes sent,
+  /// or less than 0 if the client went away or the write failed
+  int32_t writeClient(const uint8_t* buf, uint32_t len);
+
+  /// writeClient() over a sequence of buffers.
+  int32_t writevClient(const TIOVec* iov, uint32_t iovcnt);
+
+  /// Log the error a failed write left, unless it was the client leaving
+  void logWriteError();
+
+  /// True if the response can go out with MSG_ZEROCOPY, turning SO_ZEROCOPY
+  /// on the first time
+  bool startZeroCopy();
+
+  /// writeClient() with MSG_ZEROCOPY, copying if the kernel won't take more
+  int32_t writeClientZeroCopy(const uint8_t* buf, uint32_t len);
+
+  /// Once a response is sent, set its buffer aside while the kernel may
+  /// still be sending from it
+  void holdZeroCopyBuffer();
+
+  /// Take the kernel's reports on MSG_ZEROCOPY sends from the socket's error
+  /// queue and free the buffers it is done with.  True if there were any.
+  bool reapZeroCopy();
+
+  /// Keep a buffer the kernel is done with as the spare, or free it
+  void releaseZeroCopyBuffer(uint8_t* buf, uint32_t capacity);
+
+  /// Free the spare, if any
+  void releaseZeroCopySpare();
+
+  /// True if the socket has something to read, or an error to report
+  bool readable();
+
+  /// transition() for pipelined connections.
+  void pipelineTransition();
+
+  /// Dispatch buffered frames, gather finished calls and update the events.
+  void pipelineStep();
+
+  /// Dispatch the complete frames in the read buffer, up to the depth.
+  void dispatchFrames();
+
+  /// Dispatch one request frame.
+  void dispatchCall(const uint8_t* frame, uint32_t size);
+
+  /// Move finished calls out of the pipeline and queue their responses.
+  void collectCalls();
+
+  /**
+   * Whether the server, if overloaded, takes on one more call of this
+   * pipelined connection.
+   */
+  bool admitPipelinedCall();
+
+  /// Buffer housekeeping once the responses queued have gone out.
+  void pipelineSent(uint32_t len);
+
+  /// Close once no calls are left running.
+  void pipelineClose();
+
+  /// Register for reads and/or writes as the pipeline allows.
+  void updatePipelineFlags();
+
+  /// Grow the read buffer to at least size bytes.
+  void reserveReadBuffer(uint32_t size);
+
+  /// What the connection waits for from its client in the state it is in
+  TNonblockingIOThread::Wait currentWait();
+
+  /**
+   * Starts the timeout for what the connection now waits for, unless it
+   * is already running for the same wait on the same request.
+   */
+  void updateWait();
+
+  /**
+   * Ends a handler's work on the connection, begun by setting
+   * deferReturn_: gives the connection back to the server if the work
+   * closed it, and otherwise times what it now waits for.
+   */
+  void finishWork();
+
+  /// What every constructor does before the connection is given a client
+  void create(TNonblockingIOThread* ioThread);
+
+ public:
 
   /// Constructor
   TConnection(THRIFT_SOCKET socket, TNonblockingIOThread* ioThread,
-              const sockaddr* addr, socklen_t addrLen) {
-    readBuffer_ = NULL;
-    readBufferSize_ = 0;
-
-    ioThread_ = ioThread;
-    server_ = ioThread->getServer();
+              const sockaddr* addr, socklen_t addrLen,
+              const TNonblockingServer::Listener* listener) {
+    create(ioThread);
+    init(socket, ioThread, addr, addrLen, listener);
+  }
 
-    // Allocate input and output transports these only need to be allocated
-    // once per TConnection (they don't need to be reallocated on init() call)
-    inputTransport_.reset(new TMemoryBuffer(readBuffer_, readBufferSize_));
-    outputTransport_.reset(
-      new TMemoryBuffer(static_cast<uint32_t>(server_->getWriteBufferDefaultSize())));
-    tSocket_.reset(new TSocket());
-    init(socket, ioThread, addr, addrLen);
+  /**
+   * Constructor for a connection made ahead of need, kept idle until
+   * init() gives it a client.  Its read buffer is allocated up to the idle
+   * limit and touched, unless read buffers come from a pool.
+   */
+  explicit TConnection(TNonblockingIOThread* ioThread) {
+    create(ioThread);
+    ownerThread_ = ioThread;
+    activePrev_ = NULL;
+    activeNext_ = NULL;
+    idleSince_ = Util::cachedTime();
+    size_t limit = server_->getIdleReadBufferLimit();
+    if (limit > 0 && !ioThread->getBufferPool()) {
+      sizeReadBuffer(static_cast<uint32_t>(limit));
+      std::memset(readBuffer_, 0, readBufferSize_);
+    }
   }
 
   ~TConnection() {
     std::free(readBuffer_);
+    if (zeroCopyState_) {
+      std::free(zeroCopyState_->spare);
+    }
   }
 
   /// Close this connection and free or reset its resources.
   void close();
 
+  /**
+   * Close a connection that is between requests while the server drains,
+   * passing its socket to the successor first if there is one to take it.
+   */
+  void retire();
+
+  /// Hand the read buffer back to the IO thread's pool, if it has one.
+  void releaseReadBuffer();
+
+  /// Update this connection's share of the IO thread's pending bytes.
+  void setPendingBytes(uint32_t bytes) {
+    if (bytes != pendingBytes_) {
+      int64_t delta = static_cast<int64_t>(bytes) - pendingBytes_;
+      ioThread_->addPendingBytes(delta);
+      if (server_->getMemoryBudget() != 0) {
+        server_->chargeMemory(delta);
+      }
+      pendingBytes_ = bytes;
+    }
+  }
+
+  /**
+   * setPendingBytes() if the server's memory budget has room for the
+   * bytes added.
+   *
+   * @return false if it hasn't, and the connection has to waitForMemory().
+   */
+  bool reservePendingBytes(uint32_t bytes) {
+    if (bytes > pendingBytes_ && server_->getMemoryBudget() != 0) {
+      if (!server_->reserveMemory(bytes - pendingBytes_)) {
+        return false;
+      }
+      ioThread_->addPendingBytes(static_cast<int64_t>(bytes) - pendingBytes_);
+      pendingBytes_ = bytes;
+      return true;
+    }
+    setPendingBytes(bytes);
+    return true;
+  }
+
+  /// Stop reading until the IO thread resumes us with resumeReading().
+  void waitForMemory() {
+    memoryWait_ = true;
+    ioThread_->addMemoryWaiter(this);
+    if (!pipelined_) {
+      setIdle();
+    }
+  }
+
+  /// Read again after waitForMemory(), trying the budget again.
+  void resumeReading();
+
  /**
    * Check buffers against any size limits and shrink it if exceeded.
    *
@@ -253,7 +755,8 @@ class TNonblockingServer::TConnection {
 
   /// Initialize
   void init(THRIFT_SOCKET socket, TNonblockingIOThread* ioThread,
-            const sockaddr* addr, socklen_t addrLen);
+            const sockaddr* addr, socklen_t addrLen,
+            const TNonblockingServer::Listener* listener);
 
   /**
    * This is called when the application transitions from one state into
@@ -264,15 +767,46 @@ class TNonblockingServer::TConnection {
 
   /**
    * C-callable event handler for connection events.  Provides a callback
-   * that libevent can understand which invokes connection_->workSocket().
+   * for the event loop which invokes connection_->workSocket().
    *
    * @param fd the descriptor the event occurred on.
    * @param which the flags associated with the event.
    * @param v void* callback arg where we placed TConnection's "this".
    */
-  static void eventHandler(evutil_socket_t fd, short /* which */, void* v) {
-    assert(fd == ((TConnection*)v)->getTSocket()->getSocketFD());
-    ((TConnection*)v)->workSocket();
+  static void eventHandler(THRIFT_SOCKET fd, short which, void* v) {
+    TConnection* connection = (TConnection*)v;
+    assert(fd == connection->getTSocket()->getSocketFD());
+    if (connection->tlsSocket_) {
+      connection->workSocketTLS(which);
+      return;
+    }
+    connection->deferReturn_ = true;
+    if (connection->pipelined_) {
+      connection->workSocketPipelined(which);
+    } else if (connection->zeroCopyOutstanding() &&
+               connection->reapZeroCopy() && (which & TEventLoop::READ) &&
+               !connection->readable()) {
+      // Only the kernel reporting on zero copy sends, which wakes readers
+      // too; a read now would find nothing
+    } else {
+      connection->workSocket();
+    }
+    connection->finishWork();
+  }
+
+  /**
+   * transition() for the IO thread's own handlers: when a task is done, or
+   * a connection new.
+   */
+  void step() {
+    deferReturn_ = true;
+    transition();
+    finishWork();
+  }
+
+  /// Close the connection because its client took too long
+  void timeOut() {
+    close();
   }
 
   /**
@@ -280,7 +814,8 @@ class TNonblockingServer::TConnection {
    * Can be called either when processing is completed or when a waiting
    * task has been preemptively terminated (on overload).
    *
-   * Don't call this from the IO thread itself.
+   * From the IO thread itself, the connection is stepped on the next turn
+   * of the event loop.
    *
    * @return true if successful, false if unable to notify (check THRIFT_GET_SOCKET_ERROR).
    */
@@ -296,6 +831,47 @@ class TNonblockingServer::TConnection {
     return ioThread_->getThreadNumber();
   }
 
+  /**
+   * Mark a pipelined call as finished.  Called by whoever ran it, before
+   * notifying the IO thread.
+   *
+   * @param call the call.
+   * @param failed true if the connection should be closed.
+   */
+  void finishCall(PipelinedCall* call, bool failed) {
+    Guard g(pipeline_->callsMutex);
+    call->done = true;
+    call->failed = failed;
+  }
+
+  /// Close a pipelined connection because one of its tasks won't run.
+  void abandonCall(PipelinedCall* call) {
+    finishCall(call, true);
+    if (!notifyIOThread()) {
+      throw TException("TConnection::abandonCall: failed write on notify pipe");
+    }
+  }
+
+  /// Whether this connection pipelines requests.
+  bool isPipelined() const {
+    return pipelined_;
+  }
+
+  /**
+   * The async processor's callback: the response is in the output
+   * transport, or the connection is to close if success is false.  It may
+   * run on any thread, the IO thread included, while or after the processor
+   * is called.
+   */
+  void asyncProcessed(bool success) {
+    if (!success) {
+      appState_ = APP_CLOSE_CONNECTION;
+    }
+    if (!notifyIOThread()) {
+      throw TException("TConnection::asyncProcessed: failed write on notify pipe");
+    }
+  }
+
   /// Force connection shutdown for this connection.
   void forceClose() {
     appState_ = APP_CLOSE_CONNECTION;
@@ -329,43 +905,136 @@ class TNonblockingServer::TConnection {
     return connectionContext_;
   }
 
+  /// The client's address as raw bytes, empty if not kept
+  const std::string& getClientAddress() const {
+    return clientAddress_;
+  }
+
 };
 
-class TNonblockingServer::TConnection::Task: public Runnable {
+class TNonblockingServer::TConnection::Task
+  : public Runnable,
+    public boost::enable_shared_from_this<TNonblockingServer::TConnection::Task> {
  public:
   Task(boost::shared_ptr<TProcessor> processor,
        boost::shared_ptr<TProtocol> input,
        boost::shared_ptr<TProtocol> output,
-       TConnection* connection) :
+       TConnection* connection,
+       PipelinedCall* call = NULL) :
     processor_(processor),
     input_(input),
     output_(output),
     connection_(connection),
+    call_(call),
     serverEventHandler_(connection_->getServerEventHandler()),
-    connectionContext_(connection_->getConnectionContext()) {}
+    connectionContext_(connection_->getConnectionContext()),
+    hasHeader_(false),
+    messageType_(T_CALL),
+    seqid_(0),
+    deadline_(0),
+    admission_(NULL),
+    queuedAt_(0),
+    abandoned_(false) {}
 
-  void run() {
-    try {
-      for (;;) {
-        if (serverEventHandler_) {
-          serverEventHandler_->processContext(connectionContext_, connection_->getTSocket());
-        }
-        if (!processor_->process(input_, output_, connectionContext_) ||
-            !input_->getTransport()->peek()) {
-          break;
-        }
-      }
-    } catch (const TTransportException& ttx) {
-      GlobalOutput.printf("TNonblockingServer: client died: %s", ttx.what());
-    } catch (const bad_alloc&) {
-      GlobalOutput("TNonblockingServer: caught bad_alloc exception.");
-      exit(1);
-    } catch (const std::exception& x) {
-      GlobalOutput.printf("TNonblockingServer: process() exception: %s: %s",
-                          typeid(x).name(), x.what());
-    } catch (...) {
-      GlobalOutput.printf(
-        "TNonblockingServer: unknown exception while processing.");
+  /**
+   * Readies a finished task to run another call, which may be for another
+   * client if the connection has been reused since.
+   */
+  void reset(const boost::shared_ptr<TProcessor>& processor,
+             const boost::shared_ptr<TProtocol>& input,
+             const boost::shared_ptr<TProtocol>& output,
+             TConnection* connection,
+             PipelinedCall* call) {
+    // Assign only what changed, to spare the reference count traffic
+    if (processor_ != processor) {
+      processor_ = processor;
+    }
+    if (input_ != input) {
+      input_ = input;
+    }
+    if (output_ != output) {
+      output_ = output;
+    }
+    connection_ = connection;
+    call_ = call;
+    if (serverEventHandler_ != connection->getServerEventHandler()) {
+      serverEventHandler_ = connection->getServerEventHandler();
+    }
+    connectionContext_ = connection->getConnectionContext();
+    hasHeader_ = false;
+    messageType_ = T_CALL;
+    seqid_ = 0;
+    headerError_.clear();
+    deadline_ = 0;
+    admission_ = NULL;
+    abandoned_ = false;
+  }
+
+  /// Sets the client's deadline for the call, 0 for none; see TDeadline
+  void setDeadline(int64_t deadline) {
+    deadline_ = deadline;
+  }
+
+  /**
+   * Notes that admission let the task into the thread manager's queue at
+   * now, to tell it how long the task waited once it runs.
+   */
+  void setAdmitted(TAdmissionControl* admission, int64_t now) {
+    admission_ = admission;
+    queuedAt_ = now;
+  }
+
+  /**
+   * Cuts the task off from its connection, which is closing while the task
+   * is still held by a worker or by a deferred reply.  Its completion then
+   * does nothing.
+   */
+  void abandon() {
+    Guard g(abandonMutex_);
+    abandoned_ = true;
+  }
+
+  /// Tells admission control the task left the queue without running
+  void drop() {
+    if (admission_) {
+      admission_->dropped(connection_->getClientAddress());
+      admission_ = NULL;
+    }
+  }
+
+  void run() {
+    if (admission_) {
+      int64_t now = Util::monotonicTime();
+      admission_->started(connection_->getClientAddress(), now - queuedAt_, now);
+      admission_ = NULL;
+    }
+
+    // The processor may finish the call later, from another thread, so the
+    // completion keeps this task alive, and out of reuse, until then
+    bool deferred;
+    {
+      TDeferredReplyScope deferral(
+        apache::thrift::stdcxx::bind(&Task::complete, shared_from_this()),
+        input_->getTransport().get());
+      process();
+      deferred = deferral.release();
+    }
+    if (!deferred) {
+      complete();
+    }
+  }
+
+  /**
+   * Hands the output back to the connection, once the call is answered,
+   * unless the connection closed and let go of the task since.
+   */
+  void complete() {
+    Guard g(abandonMutex_);
+    if (abandoned_) {
+      return;
+    }
+    if (call_) {
+      connection_->finishCall(call_, false);
     }
 
     // Signal completion back to the libevent thread via a pipe
@@ -374,30 +1043,212 @@ class TNonblockingServer::TConnection::Task: public Runnable {
     }
   }
 
+  /**
+   * Reads the header of the first message in the input, so the policies
+   * can route the task by its name.  The header is not read again:
+   * process() hands it to the processor.
+   *
+   * @return false if the header could not be read.
+   */
+  bool readHeader() {
+    try {
+      input_->readMessageBegin(name_, messageType_, seqid_);
+    } catch (const std::exception& x) {
+      // The processor would have failed on the same bytes
+      headerError_ = x.what();
+      return false;
+    }
+    hasHeader_ = true;
+    return true;
+  }
+
+  /// The name of the message read by readHeader()
+  const std::string& getName() const {
+    return name_;
+  }
+
+  /**
+   * Answers the call with a TApplicationException of type INTERNAL_ERROR
+   * carrying reason rather than process it; a oneway call is just dropped.
+   * INTERNAL_ERROR is one every language's clients know, where a type of
+   * its own would reach most of them as UNKNOWN.
+   */
+  void refuse(const char* reason = "TNonblockingServer: overloaded") {
+    if (!hasHeader_ && !readHeader()) {
+      GlobalOutput.printf("TNonblockingServer: refuse() exception: %s",
+                          headerError_.c_str());
+      return;
+    }
+    hasHeader_ = false;
+    if (messageType_ == T_ONEWAY) {
+      return;
+    }
+    try {
+      TApplicationException x(TApplicationException::INTERNAL_ERROR, reason);
+      output_->writeMessageBegin(name_, T_EXCEPTION, seqid_);
+      x.write(output_.get());
+      output_->writeMessageEnd();
+      output_->getTransport()->writeEnd();
+      output_->getTransport()->flush();
+    } catch (const std::exception& x) {
+      GlobalOutput.printf("TNonblockingServer: refuse() exception: %s: %s",
+                          typeid(x).name(), x.what());
+    }
+  }
+
+  /// Process the messages in the input, without notifying anyone.
+  void process() {
+    if (!headerError_.empty()) {
+      GlobalOutput.printf("TNonblockingServer: process() exception: %s",
+                          headerError_.c_str());
+      return;
+    }
+    TDeadlineScope deadlineScope(deadline_);
+    try {
+      for (;;) {
+        if (serverEventHandler_) {
+          serverEventHandler_->processContext(connectionContext_, connection_->getTSocket());
+        }
+        bool more;
+        if (hasHeader_) {
+          hasHeader_ = false;
+          more = processor_->processMessage(input_, output_, name_, messageType_,
+                                            seqid_, connectionContext_);
+        } else {
+          more = processor_->process(input_, output_, connectionContext_);
+        }
+        if (!more || !input_->getTransport()->peek()) {
+          break;
+        }
+      }
+    } catch (const TTransportException& ttx) {
+      T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                       "TNonblockingServer: client died: %s", ttx.what());
+    } catch (const bad_alloc&) {
+      GlobalOutput("TNonblockingServer: caught bad_alloc exception.");
+      exit(1);
+    } catch (const std::exception& x) {
+      GlobalOutput.printf("TNonblockingServer: process() exception: %s: %s",
+                          typeid(x).name(), x.what());
+    } catch (...) {
+      GlobalOutput.printf(
+        "TNonblockingServer: unknown exception while processing.");
+    }
+  }
+
   TConnection* getTConnection() {
     return connection_;
   }
 
+  /// The pipelined call this task runs, or NULL
+  PipelinedCall* getCall() {
+    return call_;
+  }
+
  private:
   boost::shared_ptr<TProcessor> processor_;
   boost::shared_ptr<TProtocol> input_;
   boost::shared_ptr<TProtocol> output_;
   TConnection* connection_;
+  PipelinedCall* call_;
   boost::shared_ptr<TServerEventHandler> serverEventHandler_;
   void* connectionContext_;
+
+  /// The header of the first message, when read by readHeader()
+  bool hasHeader_;
+  std::string name_;
+  TMessageType messageType_;
+  int32_t seqid_;
+  std::string headerError_;
+
+  int64_t deadline_;
+
+  /// Admission control the task was let in by, until it runs
+  TAdmissionControl* admission_;
+  int64_t queuedAt_;
+
+  /// Set by abandon(), which complete() may race with
+  Mutex abandonMutex_;
+  bool abandoned_;
 };
 
+void TNonblockingServer::TConnection::create(TNonblockingIOThread* ioThread) {
+  readBuffer_ = NULL;
+  readBufferSize_ = 0;
+  pipelined_ = false;
+  unframed_ = false;
+
+  ioThread_ = ioThread;
+  server_ = ioThread->getServer();
+  listener_ = NULL;
+  idleSince_ = 0;
+  buffersNeededAt_ = 0;
+
+  // Allocate input and output transports these only need to be allocated
+  // once per TConnection (they don't need to be reallocated on init() call).
+  // Each is made in one block with its reference count.
+  inputTransport_ = boost::make_shared<TMemoryBuffer>(readBuffer_, readBufferSize_);
+  if (server_->getUseSegmentedWriteBuffers()) {
+    segmentedOutputTransport_ = boost::make_shared<TSegmentedMemoryBuffer>(
+      static_cast<uint32_t>(server_->getWriteBufferDefaultSize()));
+  } else {
+    outputTransport_ = boost::make_shared<TMemoryBuffer>(
+      static_cast<uint32_t>(server_->getWriteBufferDefaultSize()));
+  }
+  if (server_->getSSLSocketFactory()) {
+    tlsSocket_ = server_->getSSLSocketFactory()->createSocket();
+    tlsSocket_->server(true);
+    tSocket_ = tlsSocket_;
+  } else {
+    tSocket_ = boost::make_shared<TSocket>();
+  }
+  deferReturn_ = false;
+}
+
 void TNonblockingServer::TConnection::init(THRIFT_SOCKET socket,
                                            TNonblockingIOThread* ioThread,
                                            const sockaddr* addr,
-                                           socklen_t addrLen) {
+                                           socklen_t addrLen,
+                                           const TNonblockingServer::Listener* listener) {
   tSocket_->setSocketFD(socket);
   tSocket_->setCachedAddress(addr, addrLen);
 
   ioThread_ = ioThread;
+  ownerThread_ = ioThread;
   server_ = ioThread->getServer();
+  activePrev_ = NULL;
+  activeNext_ = NULL;
+
+  clientAddress_.clear();
+  quotaBucket_ = TConnectionQuota::Bucket();
+  if (server_->getAdmissionControl() || server_->getConnectionQuota()) {
+    if (addr->sa_family == AF_INET) {
+      const sockaddr_in* in = reinterpret_cast<const sockaddr_in*>(addr);
+      clientAddress_.assign(reinterpret_cast<const char*>(&in->sin_addr),
+                            sizeof(in->sin_addr));
+    } else if (addr->sa_family == AF_INET6) {
+      const sockaddr_in6* in6 = reinterpret_cast<const sockaddr_in6*>(addr);
+      clientAddress_.assign(reinterpret_cast<const char*>(&in6->sin6_addr),
+                            sizeof(in6->sin6_addr));
+    }
+  }
+
+  if (server_->getTcpQuickAck()) {
+    tSocket_->setQuickAck(true);
+  }
+  if (server_->getBusyPoll() > 0) {
+    tSocket_->setBusyPoll(server_->getBusyPoll());
+  }
   appState_ = APP_INIT;
   eventFlags_ = 0;
+  requestedFlags_ = 0;
+
+  wait_ = TNonblockingIOThread::WAIT_NONE;
+  waitDeadline_ = 0;
+  waitPrev_ = NULL;
+  waitNext_ = NULL;
+  requestsRead_ = 0;
+  waitRequests_ = 0;
 
   readBufferPos_ = 0;
   readWant_ = 0;
@@ -405,22 +1256,73 @@ void TNonblockingServer::TConnection::init(THRIFT_SOCKET socket,
   writeBuffer_ = NULL;
   writeBufferSize_ = 0;
   writeBufferPos_ = 0;
+  writeIov_.clear();
+  writeIovPos_ = 0;
   largestWriteBufferSize_ = 0;
 
+  zeroCopy_ = ZEROCOPY_UNTRIED;
+  zeroCopyResponse_ = false;
+  if (zeroCopyState_) {
+    // The kernel numbers the sends on each socket from 0
+    zeroCopyState_->sends = 0;
+    assert(zeroCopyState_->spans.empty());
+  }
+
   socketState_ = SOCKET_RECV_FRAMING;
   callsForResize_ = 0;
+  pendingBytes_ = 0;
+  memoryWait_ = false;
+
+  // An async processor takes one request at a time
+  pipelined_ = server_->getPipelineDepth() > 1 && !listener->asyncProcessorFactory;
+  if (pipelined_) {
+    if (!pipeline_) {
+      pipeline_.reset(new Pipeline());
+      pipeline_->output = boost::make_shared<TMemoryBuffer>(
+        static_cast<uint32_t>(server_->getWriteBufferDefaultSize()));
+    }
+    assert(pipeline_->calls.empty() && pipeline_->callsAwaitingNotify == 0);
+    pipeline_->closing = false;
+    pipeline_->outputPos = 0;
+    pipeline_->output->resetBuffer();
+  }
+
+  // Spare calls have protocols made by the factories of the last listener
+  if (listener != listener_) {
+    if (pipeline_) {
+      for (size_t i = 0; i < pipeline_->spareCalls.size(); ++i) {
+        delete pipeline_->spareCalls[i];
+      }
+      pipeline_->spareCalls.clear();
+    }
+    listener_ = listener;
+  }
 
   // get input/transports
-  factoryInputTransport_ = server_->getInputTransportFactory()->getTransport(
+  factoryInputTransport_ = listener_->inputTransportFactory->getTransport(
                              inputTransport_);
-  factoryOutputTransport_ = server_->getOutputTransportFactory()->getTransport(
-                             outputTransport_);
+  if (segmentedOutputTransport_) {
+    factoryOutputTransport_ = listener_->outputTransportFactory->getTransport(
+                               segmentedOutputTransport_);
+  } else {
+    factoryOutputTransport_ = listener_->outputTransportFactory->getTransport(
+                               outputTransport_);
+  }
 
   // Create protocol
-  inputProtocol_ = server_->getInputProtocolFactory()->getProtocol(
-                     factoryInputTransport_);
-  outputProtocol_ = server_->getOutputProtocolFactory()->getProtocol(
-                     factoryOutputTransport_);
+  unframed_ = false;
+  readAhead_.clear();
+  readingFrames_ = false;
+  borrowedRequest_ = NULL;
+  inputProtocol_ = headerProtocol(factoryInputTransport_, factoryOutputTransport_);
+  if (inputProtocol_) {
+    outputProtocol_ = inputProtocol_;
+  } else {
+    inputProtocol_ = listener_->inputProtocolFactory->getProtocol(
+                       factoryInputTransport_);
+    outputProtocol_ = listener_->outputProtocolFactory->getProtocol(
+                       factoryOutputTransport_);
+  }
 
   // Set up for any server event handler
   serverEventHandler_ = server_->getEventHandler();
@@ -432,61 +1334,317 @@ void TNonblockingServer::TConnection::init(THRIFT_SOCKET socket,
   }
 
   // Get the processor
-  processor_ = server_->getProcessor(inputProtocol_, outputProtocol_, tSocket_);
+  TConnectionInfo connInfo;
+  connInfo.input = inputProtocol_;
+  connInfo.output = outputProtocol_;
+  connInfo.transport = tSocket_;
+  if (listener_->asyncProcessorFactory) {
+    asyncProcessor_ = listener_->asyncProcessorFactory->getProcessor(connInfo);
+  } else {
+    processor_ = listener_->processorFactory->getProcessor(connInfo);
+  }
+
+  if (tlsSocket_) {
+    tlsSocket_->startNonblocking();
+  }
 }
 
-void TNonblockingServer::TConnection::workSocket() {
-  int got=0, left=0, sent=0;
-  uint32_t fetch = 0;
+int32_t TNonblockingServer::TConnection::readClient(uint8_t* buf, uint32_t len) {
+  if (tlsSocket_) {
+    return tlsSocket_->readNonblocking(buf, len);
+  }
+  int32_t got = tSocket_->tryRead(buf, len);
+  if (got == TTransport::TRY_FAILED) {
+    T_PERROR_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                     "TConnection::readClient() ", THRIFT_GET_SOCKET_ERROR);
+    return 0;
+  }
+  return got;
+}
 
-  switch (socketState_) {
-  case SOCKET_RECV_FRAMING:
-    union {
-      uint8_t buf[sizeof(uint32_t)];
-      uint32_t size;
-    } framing;
-
-    // if we've already received some bytes we kept them here
-    framing.size = readWant_;
-    // determine size of this frame
-    try {
-      // Read from the socket
-      fetch = tSocket_->read(&framing.buf[readBufferPos_],
-                             uint32_t(sizeof(framing.size) - readBufferPos_));
-      if (fetch == 0) {
-        // Whenever we get here it means a remote disconnect
-        close();
-        return;
+int32_t TNonblockingServer::TConnection::writeClient(const uint8_t* buf,
+                                                     uint32_t len) {
+  if (tlsSocket_) {
+    return static_cast<int32_t>(tlsSocket_->writeNonblocking(buf, len));
+  }
+  int32_t sent = tSocket_->tryWrite(buf, len);
+  if (sent == TTransport::TRY_FAILED) {
+    logWriteError();
+  }
+  return sent;
+}
+
+void TNonblockingServer::TConnection::logWriteError() {
+  int errno_copy = THRIFT_GET_SOCKET_ERROR;
+  if (!TSocket::isDisconnect(errno_copy)) {
+    T_PERROR_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                     "TConnection::writeClient() ", errno_copy);
+  }
+}
+
+int32_t TNonblockingServer::TConnection::writevClient(const TIOVec* iov,
+                                                      uint32_t iovcnt) {
+  if (!tlsSocket_) {
+    int32_t sent = tSocket_->tryWritev(iov, iovcnt);
+    if (sent == TTransport::TRY_FAILED) {
+      logWriteError();
+    }
+    return sent;
+  }
+  int32_t sent = 0;
+  for (uint32_t i = 0; i < iovcnt; ++i) {
+    uint32_t b = tlsSocket_->writeNonblocking(iov[i].base, iov[i].len);
+    sent += static_cast<int32_t>(b);
+    if (b < iov[i].len) {
+      break;
+    }
+  }
+  return sent;
+}
+
+bool TNonblockingServer::TConnection::startZeroCopy() {
+#ifdef THRIFT_ZEROCOPY_SEND
+  if (zeroCopy_ == ZEROCOPY_UNTRIED) {
+    zeroCopy_ = ZEROCOPY_OFF;
+    if (!tlsSocket_) {
+      // A socket taken over with it already on has sends numbered by its
+      // previous owner, which can't be told apart from ours
+      THRIFT_SOCKET fd = tSocket_->getSocketFD();
+      int on = 0;
+      socklen_t onLen = sizeof(on);
+      if (getsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, &onLen) == 0 && !on) {
+        on = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+          zeroCopy_ = ZEROCOPY_ON;
+          if (!zeroCopyState_) {
+            zeroCopyState_.reset(new ZeroCopyState());
+          }
+        }
       }
-      readBufferPos_ += fetch;
-    } catch (TTransportException& te) {
-      GlobalOutput.printf("TConnection::workSocket(): %s", te.what());
-      close();
+    }
+  }
+#endif
+  return zeroCopy_ == ZEROCOPY_ON;
+}
 
-      return;
+int32_t TNonblockingServer::TConnection::writeClientZeroCopy(const uint8_t* buf,
+                                                             uint32_t len) {
+#ifdef THRIFT_ZEROCOPY_SEND
+  THRIFT_SSIZET b = send(tSocket_->getSocketFD(), buf, len,
+                         MSG_ZEROCOPY | MSG_NOSIGNAL);
+  if (b < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    if (errno_copy == THRIFT_EWOULDBLOCK || errno_copy == THRIFT_EAGAIN) {
+      return 0;
+    }
+    if (errno_copy == ENOBUFS) {
+      // Out of room for pinned pages or reports: copy this part
+      return writeClient(buf, len);
     }
+    if (!TSocket::isDisconnect(errno_copy)) {
+      T_PERROR_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                       "TConnection::writeClientZeroCopy() ", errno_copy);
+    }
+    return TTransport::TRY_FAILED;
+  }
 
-    if (readBufferPos_ < sizeof(framing.size)) {
-      // more needed before frame size is known -- save what we have so far
-      readWant_ = framing.size;
-      return;
+  // The kernel numbers each send that took anything
+  if (zeroCopyState_->spans.empty() || zeroCopyState_->spans.back().buffer != NULL) {
+    ZeroCopySpan span;
+    span.buffer = NULL;
+    span.capacity = 0;
+    span.firstSend = zeroCopyState_->sends;
+    span.endSend = zeroCopyState_->sends;
+    span.outstanding = 0;
+    zeroCopyState_->spans.push_back(span);
+  }
+  ++zeroCopyState_->spans.back().endSend;
+  ++zeroCopyState_->spans.back().outstanding;
+  ++zeroCopyState_->sends;
+  return static_cast<int32_t>(b);
+#else
+  return writeClient(buf, len);
+#endif
+}
+
+void TNonblockingServer::TConnection::holdZeroCopyBuffer() {
+  zeroCopyResponse_ = false;
+  if (zeroCopyState_->spans.empty() || zeroCopyState_->spans.back().buffer != NULL) {
+    // Every part was copied
+    return;
+  }
+  ZeroCopySpan& span = zeroCopyState_->spans.back();
+  if (span.outstanding == 0) {
+    zeroCopyState_->spans.pop_back();
+    return;
+  }
+
+  // The next response is written somewhere else meanwhile
+  span.buffer = outputTransport_->releaseBuffer(&span.capacity);
+  uint8_t* next;
+  uint32_t capacity;
+  if (zeroCopyState_->spare != NULL) {
+    next = zeroCopyState_->spare;
+    capacity = zeroCopyState_->spareCapacity;
+    zeroCopyState_->spare = NULL;
+  } else if (ioThread_->getBufferPool()) {
+    next = ioThread_->getBufferPool()->borrow(span.capacity, &capacity);
+  } else {
+    next = static_cast<uint8_t*>(std::malloc(span.capacity));
+    if (next == NULL) {
+      throw std::bad_alloc();
     }
+    capacity = span.capacity;
+  }
+  outputTransport_->resetBuffer(next, capacity, TMemoryBuffer::TAKE_OWNERSHIP);
+  outputTransport_->resetBuffer();
+}
 
-    readWant_ = ntohl(framing.size);
-    if (readWant_ > server_->getMaxFrameSize()) {
-      // Don't allow giant frame sizes.  This prevents bad clients from
-      // causing us to try and allocate a giant buffer.
-      GlobalOutput.printf("TNonblockingServer: frame size too large "
-                          "(%" PRIu32 " > %" PRIu64 ") from client %s. "
-                          "Remote side not using TFramedTransport?",
-                          readWant_,
-                          (uint64_t)server_->getMaxFrameSize(),
-                          tSocket_->getSocketInfo().c_str());
+bool TNonblockingServer::TConnection::reapZeroCopy() {
+  bool reaped = false;
+#ifdef THRIFT_ZEROCOPY_SEND
+  if (!zeroCopyState_) {
+    return false;
+  }
+  THRIFT_SOCKET fd = tSocket_->getSocketFD();
+  for (;;) {
+    char control[128];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      break;
+    }
+    reaped = true;
+
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      const struct sock_extended_err* err =
+        reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cm));
+      if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        // Loopback, or a device that can't send from our pages: the copy
+        // was only put off, so it may as well be made up front
+        zeroCopy_ = ZEROCOPY_OFF;
+      }
+
+      // Sends ee_info to ee_data are done, numbered modulo 2^32
+      uint64_t first = zeroCopyState_->sends -
+        static_cast<uint32_t>(static_cast<uint32_t>(zeroCopyState_->sends) - err->ee_info);
+      uint64_t end = first + static_cast<uint32_t>(err->ee_data - err->ee_info) + 1;
+      for (size_t i = 0; i < zeroCopyState_->spans.size(); ++i) {
+        ZeroCopySpan& span = zeroCopyState_->spans[i];
+        uint64_t from = std::max(first, span.firstSend);
+        uint64_t to = std::min(end, span.endSend);
+        if (from < to) {
+          span.outstanding -= to - from;
+        }
+      }
+    }
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < zeroCopyState_->spans.size(); ++i) {
+    if (zeroCopyState_->spans[i].buffer != NULL && zeroCopyState_->spans[i].outstanding == 0) {
+      releaseZeroCopyBuffer(zeroCopyState_->spans[i].buffer, zeroCopyState_->spans[i].capacity);
+    } else {
+      zeroCopyState_->spans[kept++] = zeroCopyState_->spans[i];
+    }
+  }
+  zeroCopyState_->spans.resize(kept);
+#endif
+  return reaped;
+}
+
+void TNonblockingServer::TConnection::releaseZeroCopyBuffer(uint8_t* buf,
+                                                            uint32_t capacity) {
+  if (zeroCopyState_->spare == NULL) {
+    zeroCopyState_->spare = buf;
+    zeroCopyState_->spareCapacity = capacity;
+  } else if (ioThread_->getBufferPool()) {
+    ioThread_->getBufferPool()->giveBack(buf, capacity);
+  } else {
+    std::free(buf);
+  }
+}
+
+void TNonblockingServer::TConnection::releaseZeroCopySpare() {
+  if (!zeroCopyState_ || zeroCopyState_->spare == NULL) {
+    return;
+  }
+  if (ioThread_ && ioThread_->getBufferPool()) {
+    ioThread_->getBufferPool()->giveBack(zeroCopyState_->spare, zeroCopyState_->spareCapacity);
+  } else {
+    std::free(zeroCopyState_->spare);
+  }
+  zeroCopyState_->spare = NULL;
+  zeroCopyState_->spareCapacity = 0;
+}
+
+bool TNonblockingServer::TConnection::readable() {
+  struct THRIFT_POLLFD fds[1];
+  fds[0].fd = tSocket_->getSocketFD();
+  fds[0].events = THRIFT_POLLIN;
+  fds[0].revents = 0;
+  return THRIFT_POLL(fds, 1, 0) != 0;
+}
+
+void TNonblockingServer::TConnection::workSocketTLS(short which) {
+  try {
+    tlsSocket_->flushNonblocking();
+  } catch (TTransportException& te) {
+    T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                     "TConnection::workSocket(): %s", te.what());
+    if (pipelined_) {
+      pipelineClose();
+    } else {
       close();
-      return;
     }
-    // size known; now get the rest of the frame
-    transition();
+    return;
+  }
+
+  // Readiness the state machine didn't ask for was only for TLS, and input
+  // OpenSSL already holds won't be signalled by the socket
+  which &= requestedFlags_;
+  if ((requestedFlags_ & TEventLoop::READ) && tlsSocket_->hasBufferedInput()) {
+    which |= TEventLoop::READ;
+  }
+
+  deferReturn_ = true;
+  while (which != 0) {
+    if (pipelined_) {
+      workSocketPipelined(which);
+    } else {
+      workSocket();
+    }
+    if (ioThread_ == NULL) {
+      break;
+    }
+    which = 0;
+    if ((requestedFlags_ & TEventLoop::READ) && tlsSocket_->hasBufferedInput()) {
+      which = TEventLoop::READ;
+    }
+  }
+  if (ioThread_ != NULL) {
+    setFlags(requestedFlags_);
+  }
+  finishWork();
+}
+
+void TNonblockingServer::TConnection::workSocket() {
+  int32_t got=0;
+  int left=0, sent=0;
+  uint32_t fetch = 0;
+
+  switch (socketState_) {
+  case SOCKET_RECV_FRAMING:
+    readFrames(true);
     return;
 
   case SOCKET_RECV:
@@ -496,10 +1654,11 @@ void TNonblockingServer::TConnection::workSocket() {
     try {
       // Read from the socket
       fetch = readWant_ - readBufferPos_;
-      got = tSocket_->read(readBuffer_ + readBufferPos_, fetch);
+      got = readClient(readBuffer_ + readBufferPos_, fetch);
     }
     catch (TTransportException& te) {
-      GlobalOutput.printf("TConnection::workSocket(): %s", te.what());
+      T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                       "TConnection::workSocket(): %s", te.what());
       close();
 
       return;
@@ -509,6 +1668,11 @@ void TNonblockingServer::TConnection::workSocket() {
       // Move along in the buffer
       readBufferPos_ += got;
 
+      if (unframed_) {
+        readUnframed();
+        return;
+      }
+
       // Check that we did not overdo it
       assert(readBufferPos_ <= readWant_);
 
@@ -518,6 +1682,10 @@ void TNonblockingServer::TConnection::workSocket() {
       }
       return;
     }
+    if (got < 0) {
+      // Nothing decrypted yet
+      return;
+    }
 
     // Whenever we get down here it means a remote disconnect
     close();
@@ -536,22 +1704,54 @@ void TNonblockingServer::TConnection::workSocket() {
     }
 
     try {
-      left = writeBufferSize_ - writeBufferPos_;
-      sent = tSocket_->write_partial(writeBuffer_ + writeBufferPos_, left);
+      if (!writeIov_.empty()) {
+        sent = writevClient(
+          &writeIov_[writeIovPos_],
+          static_cast<uint32_t>(writeIov_.size() - writeIovPos_));
+      } else if (zeroCopyResponse_) {
+        left = writeBufferSize_ - writeBufferPos_;
+        sent = writeClientZeroCopy(writeBuffer_ + writeBufferPos_, left);
+      } else {
+        left = writeBufferSize_ - writeBufferPos_;
+        sent = writeClient(writeBuffer_ + writeBufferPos_, left);
+      }
     }
     catch (TTransportException& te) {
-      GlobalOutput.printf("TConnection::workSocket(): %s ", te.what());
+      T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                       "TConnection::workSocket(): %s", te.what());
+      close();
+      return;
+    }
+    if (sent < 0) {
+      // The client went away
       close();
       return;
     }
 
     writeBufferPos_ += sent;
 
+    // Step over the segments that have gone out, and trim the one that
+    // was only partially sent so the next send starts at the right place.
+    for (uint32_t done = sent; done > 0 && writeIovPos_ < writeIov_.size();) {
+      TIOVec& iov = writeIov_[writeIovPos_];
+      if (done < iov.len) {
+        iov.base += done;
+        iov.len -= done;
+        break;
+      }
+      done -= iov.len;
+      ++writeIovPos_;
+    }
+
     // Did we overdo it?
     assert(writeBufferPos_ <= writeBufferSize_);
 
     // We are done!
     if (writeBufferPos_ == writeBufferSize_) {
+      THRIFT_PROBE2(response_written, this, writeBufferSize_);
+      if (zeroCopyResponse_) {
+        holdZeroCopyBuffer();
+      }
       transition();
     }
 
@@ -573,55 +1773,117 @@ void TNonblockingServer::TConnection::transition() {
   assert(ioThread_);
   assert(server_);
 
+  THRIFT_PROBE3(connection_transition, this, appState_, socketState_);
+
+  if (pipelined_) {
+    pipelineTransition();
+    return;
+  }
+
   // Switch upon the state that we are currently in and move to a new state
   switch (appState_) {
 
   case APP_READ_REQUEST:
     // We are done reading the request, package the read buffer into transport
-    // and get back some data from the dispatch function
-    inputTransport_->resetBuffer(readBuffer_, readBufferPos_);
-    outputTransport_->resetBuffer();
-    // Prepend four bytes of blank space to the buffer so we can
-    // write the frame size there later.
-    outputTransport_->getWritePtr(4);
-    outputTransport_->wroteBytes(4);
+    // and get back some data from the dispatch function.  A deadline prefix,
+    // if the client sent one, is for the server rather than the processor.
+    ++requestsRead_;
+    THRIFT_PROBE2(frame_read, this, readBufferPos_);
+    int64_t deadline;
+    {
+      uint8_t* request = borrowedRequest_ ?
+        const_cast<uint8_t*>(borrowedRequest_) : readBuffer_;
+      uint32_t skip = readDeadline(request, readBufferPos_, deadline);
+      inputTransport_->resetBuffer(request + skip, readBufferPos_ - skip);
+    }
+    if (segmentedOutputTransport_) {
+      // The frame size goes out from writeFrameSize_, so no space is needed
+      // for it in the buffer.
+      segmentedOutputTransport_->resetBuffer();
+    } else {
+      outputTransport_->resetBuffer();
+      // Prepend four bytes of blank space to the buffer so we can
+      // write the frame size there later.
+      outputTransport_->getWritePtr(4);
+      outputTransport_->wroteBytes(4);
+    }
 
     server_->incrementActiveProcessors();
 
-    if (server_->isThreadPoolProcessing()) {
-      // We are setting up a Task to do this work and we will wait on it
-
-      // Create task and dispatch to the thread manager
-      boost::shared_ptr<Runnable> task =
-        boost::shared_ptr<Runnable>(new Task(processor_,
-                                             inputProtocol_,
-                                             outputProtocol_,
-                                             this));
-      // The application is now waiting on the task to finish
+    if (asyncProcessor_) {
+      // Wait as if on a task until asyncProcessed() says the response is
+      // ready, which it may have by the time process() returns
       appState_ = APP_WAIT_TASK;
-
-        try {
-          server_->addTask(task);
-        } catch (IllegalStateException & ise) {
-          // The ThreadManager is not ready to handle any more tasks (it's probably shutting down).
-          GlobalOutput.printf("IllegalStateException: Server::process() %s", ise.what());
-          close();
-        }
-
-      // Set this connection idle so that libevent doesn't process more
-      // data on it while we're still waiting for the threadmanager to
-      // finish this task
+      keepRequest();
       setIdle();
+      try {
+        if (serverEventHandler_) {
+          serverEventHandler_->processContext(connectionContext_,
+                                              getTSocket());
+        }
+        TDeadlineScope deadlineScope(deadline);
+        asyncProcessor_->process(
+          apache::thrift::stdcxx::bind(&TConnection::asyncProcessed, this,
+                                       apache::thrift::stdcxx::placeholders::_1),
+          inputProtocol_, outputProtocol_);
+      } catch (const std::exception &x) {
+        GlobalOutput.printf("TNonblockingServer: async process() exception: %s: %s",
+                            typeid(x).name(), x.what());
+        server_->decrementActiveProcessors();
+        close();
+      }
       return;
+    } else if (server_->isThreadPoolProcessing()) {
+      // We are setting up a Task to do this work and we will wait on it
+
+      // Create task and dispatch to the thread manager
+      boost::shared_ptr<Task>& task =
+        prepareTask(task_, inputProtocol_, outputProtocol_, NULL);
+      task->setDeadline(deadline);
+      int priority = 0;
+      ThreadManager* threadManager = NULL;
+      if (!withinQuota(readBufferPos_)) {
+        // The client is over its quota; turned away before anything else
+        task->refuse(THROTTLED_REASON);
+      } else if (routeTask(*task, priority, threadManager)) {
+        // Cheap enough to run here; then carry on as if a worker had run it
+        task->process();
+      } else if (!admitTask(*task)) {
+        // Answered here, as cheaply as can be
+        task->refuse();
+      } else {
+        // The application is now waiting on the task to finish
+        appState_ = APP_WAIT_TASK;
+        keepRequest();
+
+        try {
+          server_->addTask(task, priority, ioThread_->getThreadNumber(), deadline,
+                           threadManager);
+        } catch (IllegalStateException & ise) {
+          // The ThreadManager is not ready to handle any more tasks (it's probably shutting down).
+          GlobalOutput.printf("IllegalStateException: Server::process() %s", ise.what());
+          task->drop();
+          close();
+        }
+
+        // Set this connection idle so that libevent doesn't process more
+        // data on it while we're still waiting for the threadmanager to
+        // finish this task
+        setIdle();
+        return;
+      }
     } else {
       try {
         if (serverEventHandler_) {
           serverEventHandler_->processContext(connectionContext_,
                                               getTSocket());
         }
-        // Invoke the processor
-        processor_->process(inputProtocol_, outputProtocol_,
-                            connectionContext_);
+        // Invoke the processor on each message in the frame, as a task would
+        TDeadlineScope deadlineScope(deadline);
+        while (processor_->process(inputProtocol_, outputProtocol_,
+                                   connectionContext_) &&
+               inputProtocol_->getTransport()->peek()) {
+        }
       } catch (const TTransportException &ttx) {
         GlobalOutput.printf("TNonblockingServer transport error in "
                             "process(): %s", ttx.what());
@@ -651,8 +1913,17 @@ void TNonblockingServer::TConnection::transition() {
     // the writeBuffer_ for actual writing by the libevent thread
 
     server_->decrementActiveProcessors();
+    // The request has been consumed, so a pooled read buffer can go back
+    borrowedRequest_ = NULL;
+    releaseReadBuffer();
+    setPendingBytes(0);
+
     // Get the result of the operation
-    outputTransport_->getBuffer(&writeBuffer_, &writeBufferSize_);
+    if (segmentedOutputTransport_) {
+      writeBufferSize_ = segmentedOutputTransport_->available_read() + 4;
+    } else {
+      outputTransport_->getBuffer(&writeBuffer_, &writeBufferSize_);
+    }
 
     // If the function call generated return data, then move into the send
     // state and get going
@@ -665,10 +1936,35 @@ void TNonblockingServer::TConnection::transition() {
 
       // Put the frame size into the write buffer
       int32_t frameSize = (int32_t)htonl(writeBufferSize_ - 4);
-      memcpy(writeBuffer_, &frameSize, 4);
+      if (segmentedOutputTransport_) {
+        // Send the frame size and then the segments, all straight from
+        // where they are.
+        writeIov_.clear();
+        if (unframed_) {
+          // Unframed clients get no frame size back
+          writeBufferPos_ = 4;
+        } else {
+          memcpy(&writeFrameSize_, &frameSize, 4);
+          TIOVec header;
+          header.base = reinterpret_cast<const uint8_t*>(&writeFrameSize_);
+          header.len = 4;
+          writeIov_.push_back(header);
+        }
+        segmentedOutputTransport_->getSegments(writeIov_);
+        writeIovPos_ = 0;
+      } else if (unframed_) {
+        writeBufferPos_ = 4;
+      } else {
+        memcpy(writeBuffer_, &frameSize, 4);
+      }
+      zeroCopyResponse_ = !segmentedOutputTransport_ &&
+                          server_->getZeroCopyThreshold() > 0 &&
+                          writeBufferSize_ >= server_->getZeroCopyThreshold() &&
+                          startZeroCopy();
 
       // Socket into write mode
       appState_ = APP_SEND_RESULT;
+      setPendingBytes(writeBufferSize_);
       setWrite();
 
       // Try to work the socket immediately
@@ -686,7 +1982,9 @@ void TNonblockingServer::TConnection::transition() {
     if (writeBufferSize_ > largestWriteBufferSize_) {
       largestWriteBufferSize_ = writeBufferSize_;
     }
-    if (server_->getResizeBufferEveryN() > 0
+    if (server_->getBufferTrimAge() > 0) {
+      trimBuffersByAge();
+    } else if (server_->getResizeBufferEveryN() > 0
         && ++callsForResize_ >= server_->getResizeBufferEveryN()) {
       checkIdleBufferMemLimit(server_->getIdleReadBufferLimit(),
                               server_->getIdleWriteBufferLimit());
@@ -702,6 +2000,14 @@ void TNonblockingServer::TConnection::transition() {
     writeBuffer_ = NULL;
     writeBufferPos_ = 0;
     writeBufferSize_ = 0;
+    writeIov_.clear();
+    writeIovPos_ = 0;
+    setPendingBytes(0);
+
+    if (unframed_) {
+      resumeUnframed();
+      return;
+    }
 
     // Into read4 state we go
     socketState_ = SOCKET_RECV_FRAMING;
@@ -712,33 +2018,20 @@ void TNonblockingServer::TConnection::transition() {
     // Register read event
     setRead();
 
-    // Try to work the socket right away
-    // workSocket();
+    // The client may have sent its next request already.  Within
+    // readFrames() it is taken when this returns.
+    if (!readAhead_.empty() && !readingFrames_) {
+      readFrames(false);
+    }
 
     return;
 
   case APP_READ_FRAME_SIZE:
     // We just read the request length
-    // Double the buffer size until it is big enough
-    if (readWant_ > readBufferSize_) {
-      if (readBufferSize_ == 0) {
-        readBufferSize_ = 1;
-      }
-      uint32_t newSize = readBufferSize_;
-      while (readWant_ > newSize) {
-        newSize *= 2;
-      }
-
-      uint8_t* newBuffer = (uint8_t*)std::realloc(readBuffer_, newSize);
-      if (newBuffer == NULL) {
-        // nothing else to be done...
-        throw std::bad_alloc();
-      }
-      readBuffer_ = newBuffer;
-      readBufferSize_ = newSize;
-    }
+    sizeReadBuffer(readWant_);
 
     readBufferPos_= 0;
+    setPendingBytes(readWant_);
 
     // Move into read request state
     socketState_ = SOCKET_RECV;
@@ -760,695 +2053,2824 @@ void TNonblockingServer::TConnection::transition() {
   }
 }
 
-void TNonblockingServer::TConnection::setFlags(short eventFlags) {
-  // Catch the do nothing case
-  if (eventFlags_ == eventFlags) {
-    return;
+void TNonblockingServer::TConnection::workSocketPipelined(short which) {
+  // Send first, since finished responses are what let the client go on
+  if (which & TEventLoop::WRITE) {
+    uint8_t* buf;
+    uint32_t len;
+    pipeline_->output->getBuffer(&buf, &len);
+    if (pipeline_->outputPos < len) {
+      int32_t sent;
+      try {
+        sent = writeClient(buf + pipeline_->outputPos,
+                           len - pipeline_->outputPos);
+      } catch (TTransportException& te) {
+        T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                         "TConnection::workSocket(): %s", te.what());
+        pipelineClose();
+        return;
+      }
+      if (sent < 0) {
+        // The client went away
+        pipelineClose();
+        return;
+      }
+      pipeline_->outputPos += sent;
+      if (pipeline_->outputPos == len) {
+        pipeline_->output->resetBuffer();
+        pipeline_->outputPos = 0;
+        pipelineSent(len);
+      }
+    }
   }
 
-  // Delete a previously existing event
-  if (eventFlags_ != 0) {
-    if (event_del(&event_) == -1) {
-      GlobalOutput("TConnection::setFlags event_del");
+  if ((which & TEventLoop::READ) && !pipeline_->closing) {
+    // Read ahead, so frames that follow the current one arrive together
+    reserveReadBuffer(readBufferPos_ + 16 * 1024);
+    int32_t got;
+    try {
+      got = readClient(readBuffer_ + readBufferPos_,
+                       readBufferSize_ - readBufferPos_);
+    } catch (TTransportException& te) {
+      T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                       "TConnection::workSocket(): %s", te.what());
+      pipelineClose();
+      return;
+    }
+
+    if (got == 0) {
+      // Whenever we get here it means a remote disconnect
+      pipelineClose();
       return;
     }
+    if (got > 0) {
+      readBufferPos_ += got;
+    }
   }
 
-  // Update in memory structure
-  eventFlags_ = eventFlags;
+  pipelineStep();
+}
 
-  // Do not call event_set if there are no flags
-  if (!eventFlags_) {
+void TNonblockingServer::TConnection::pipelineTransition() {
+  if (appState_ == APP_INIT) {
+    // New connection: start reading
+    appState_ = APP_READ_REQUEST;
+    updatePipelineFlags();
     return;
   }
 
-  /*
-   * event_set:
-   *
-   * Prepares the event structure &event to be used in future calls to
-   * event_add() and event_del().  The event will be prepared to call the
-   * eventHandler using the 'sock' file descriptor to monitor events.
-   *
-   * The events can be either EV_READ, EV_WRITE, or both, indicating
-   * that an application can read or write from the file respectively without
-   * blocking.
-   *
-   * The eventHandler will be called with the file descriptor that triggered
-   * the event and the type of event which will be one of: EV_TIMEOUT,
-   * EV_SIGNAL, EV_READ, EV_WRITE.
-   *
-   * The additional flag EV_PERSIST makes an event_add() persistent until
-   * event_del() has been called.
-   *
-   * Once initialized, the &event struct can be used repeatedly with
-   * event_add() and event_del() and does not need to be reinitialized unless
-   * the eventHandler and/or the argument to it are to be changed.  However,
-   * when an ev structure has been added to libevent using event_add() the
-   * structure must persist until the event occurs (assuming EV_PERSIST
-   * is not set) or is removed using event_del().  You may not reuse the same
-   * ev structure for multiple monitored descriptors; each descriptor needs
-   * its own ev.
-   */
-  event_set(&event_, tSocket_->getSocketFD(), eventFlags_,
-            TConnection::eventHandler, this);
-  event_base_set(ioThread_->getEventBase(), &event_);
+  // We were notified that a call given to the thread manager has finished
+  assert(pipeline_->callsAwaitingNotify > 0);
+  --pipeline_->callsAwaitingNotify;
 
-  // Add the event
-  if (event_add(&event_, 0) == -1) {
-    GlobalOutput("TConnection::setFlags(): could not event_add");
+  if (pipeline_->closing) {
+    pipelineClose();
+    return;
   }
+
+  pipelineStep();
 }
 
-/**
- * Closes a connection
- */
-void TNonblockingServer::TConnection::close() {
-  // Delete the registered libevent
-  if (event_del(&event_) == -1) {
-    GlobalOutput.perror("TConnection::close() event_del", THRIFT_GET_SOCKET_ERROR);
-  }
+void TNonblockingServer::TConnection::pipelineStep() {
+  dispatchFrames();
+  collectCalls();
 
-  if (serverEventHandler_) {
-    serverEventHandler_->deleteContext(connectionContext_, inputProtocol_, outputProtocol_);
+  if (pipeline_->closing) {
+    pipelineClose();
+    return;
   }
-  ioThread_ = NULL;
 
-  // Close the socket
-  tSocket_->close();
+  updatePipelineFlags();
+}
 
-  // close any factory produced transports
-  factoryInputTransport_->close();
-  factoryOutputTransport_->close();
+void TNonblockingServer::TConnection::dispatchFrames() {
+  uint32_t pos = 0;
+  uint32_t frameSize;
+
+  while (!pipeline_->closing &&
+         pipeline_->calls.size() < server_->getPipelineDepth() &&
+         readBufferPos_ - pos >= sizeof(frameSize)) {
+    memcpy(&frameSize, readBuffer_ + pos, sizeof(frameSize));
+    frameSize = ntohl(frameSize);
+    if (frameSize > server_->getMaxFrameSize()) {
+      // Don't allow giant frame sizes.  This prevents bad clients from
+      // causing us to try and allocate a giant buffer.
+      T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                       "TNonblockingServer: frame size too large "
+                       "(%" PRIu32 " > %" PRIu64 ") from client %s. "
+                       "Remote side not using TFramedTransport?",
+                       frameSize,
+                       (uint64_t)server_->getMaxFrameSize(),
+                       tSocket_->getSocketInfo().c_str());
+      pipeline_->closing = true;
+      return;
+    }
+    if (readBufferPos_ - pos - sizeof(frameSize) < frameSize) {
+      break;
+    }
+
+    dispatchCall(readBuffer_ + pos + sizeof(frameSize), frameSize);
+    pos += static_cast<uint32_t>(sizeof(frameSize)) + frameSize;
+  }
+
+  // Keep whatever is left from the start of the buffer
+  if (pos > 0) {
+    memmove(readBuffer_, readBuffer_ + pos, readBufferPos_ - pos);
+    readBufferPos_ -= pos;
+  }
 
-  // Give this object back to the server that owns it
-  server_->returnConnection(this);
+  // Make room for the rest of a partly received frame
+  if (readBufferPos_ >= sizeof(frameSize)) {
+    memcpy(&frameSize, readBuffer_, sizeof(frameSize));
+    frameSize = ntohl(frameSize);
+    if (frameSize <= server_->getMaxFrameSize()) {
+      reserveReadBuffer(static_cast<uint32_t>(sizeof(frameSize)) + frameSize);
+    }
+  }
 }
 
-void TNonblockingServer::TConnection::checkIdleBufferMemLimit(
-    size_t readLimit,
-    size_t writeLimit) {
-  if (readLimit > 0 && readBufferSize_ > readLimit) {
-    free(readBuffer_);
-    readBuffer_ = NULL;
-    readBufferSize_ = 0;
+void TNonblockingServer::TConnection::dispatchCall(const uint8_t* frame,
+                                                   uint32_t size) {
+  PipelinedCall* call;
+  if (pipeline_->spareCalls.empty()) {
+    call = new PipelinedCall;
+    call->input.reset(new TMemoryBuffer());
+    call->output.reset(new TMemoryBuffer(
+      static_cast<uint32_t>(server_->getWriteBufferDefaultSize())));
+    call->inputProtocol = headerProtocol(call->input, call->output);
+    if (call->inputProtocol) {
+      call->outputProtocol = call->inputProtocol;
+    } else {
+      call->inputProtocol = listener_->inputProtocolFactory->getProtocol(
+        listener_->inputTransportFactory->getTransport(call->input));
+      call->outputProtocol = listener_->outputProtocolFactory->getProtocol(
+        listener_->outputTransportFactory->getTransport(call->output));
+    }
+  } else {
+    call = pipeline_->spareCalls.back();
+    pipeline_->spareCalls.pop_back();
   }
 
-  if (writeLimit > 0 && largestWriteBufferSize_ > writeLimit) {
-    // just start over
-    outputTransport_->resetBuffer(static_cast<uint32_t>(server_->getWriteBufferDefaultSize()));
-    largestWriteBufferSize_ = 0;
+  ++requestsRead_;
+  THRIFT_PROBE2(frame_read, this, size);
+  int64_t deadline;
+  uint32_t skip = readDeadline(frame, size, deadline);
+  call->input->resetBuffer();
+  call->input->write(frame + skip, size - skip);
+  call->output->resetBuffer();
+  call->done = false;
+  call->failed = false;
+  pipeline_->calls.push_back(call);
+
+  server_->incrementActiveProcessors();
+
+  if (server_->isThreadPoolProcessing()) {
+    boost::shared_ptr<Task>& task =
+      prepareTask(call->task, call->inputProtocol, call->outputProtocol, call);
+    task->setDeadline(deadline);
+    int priority = 0;
+    ThreadManager* threadManager = NULL;
+    if (!withinQuota(size)) {
+      task->refuse(THROTTLED_REASON);
+      finishCall(call, false);
+      return;
+    }
+    if (pipeline_->calls.size() > 1 && !admitPipelinedCall()) {
+      task->refuse();
+      finishCall(call, false);
+      return;
+    }
+    if (routeTask(*task, priority, threadManager)) {
+      task->process();
+      finishCall(call, false);
+      return;
+    }
+    if (!admitTask(*task)) {
+      task->refuse();
+      finishCall(call, false);
+      return;
+    }
+    ++pipeline_->callsAwaitingNotify;
+    try {
+      server_->addTask(task, priority, ioThread_->getThreadNumber(), deadline,
+                       threadManager);
+    } catch (IllegalStateException & ise) {
+      // The ThreadManager is not ready to handle any more tasks (it's probably shutting down).
+      GlobalOutput.printf("IllegalStateException: Server::process() %s", ise.what());
+      task->drop();
+      --pipeline_->callsAwaitingNotify;
+      finishCall(call, true);
+    }
+  } else {
+    Task task(processor_, call->inputProtocol, call->outputProtocol, this, call);
+    task.setDeadline(deadline);
+    task.process();
+    finishCall(call, false);
   }
 }
 
-TNonblockingServer::~TNonblockingServer() {
-  // Close any active connections (moves them to the idle connection stack)
-  while (activeConnections_.size()) {
-	  activeConnections_.front()->close();
+bool TNonblockingServer::TConnection::admitTask(Task& task) {
+  TAdmissionControl* admission = server_->getAdmissionControl().get();
+  if (admission == NULL) {
+    return true;
   }
-  // Clean up unused TConnection objects in connectionStack_
-  while (!connectionStack_.empty()) {
-    TConnection* connection = connectionStack_.top();
-    connectionStack_.pop();
-    delete connection;
+  // Sojourn times are short, so the precise clock
+  int64_t now = Util::monotonicTime();
+  if (!admission->admit(clientAddress_, now)) {
+    return false;
   }
-  // The TNonblockingIOThread objects have shared_ptrs to the Thread
-  // objects and the Thread objects have shared_ptrs to the TNonblockingIOThread
-  // objects (as runnable) so these objects will never deallocate without help.
-  while (!ioThreads_.empty()) {
-	  boost::shared_ptr<TNonblockingIOThread> iot = ioThreads_.back();
-	  ioThreads_.pop_back();
-	  iot->setThread(boost::shared_ptr<Thread>());
+  task.setAdmitted(admission, now);
+  return true;
+}
+
+bool TNonblockingServer::TConnection::withinQuota(uint32_t size) {
+  TConnectionQuota* quota = server_->getConnectionQuota().get();
+  if (quota == NULL) {
+    return true;
+  }
+  int64_t now = Util::monotonicTimeUsec();
+  if (quota->getScope() == TConnectionQuota::PER_CONNECTION) {
+    return quota->admit(quotaBucket_, size, now);
   }
+  return quota->admit(clientAddress_, size, now);
 }
 
-/**
- * Creates a new connection either by reusing an object off the stack or
- * by allocating a new one entirely
- */
-TNonblockingServer::TConnection* TNonblockingServer::createConnection(
-    THRIFT_SOCKET socket, const sockaddr* addr, socklen_t addrLen) {
-  // Check the stack
-  Guard g(connMutex_);
+bool TNonblockingServer::TConnection::routeTask(Task& task, int& priority,
+                                                ThreadManager*& threadManager) {
+  TTaskPriorityPolicy* priorityPolicy = server_->getTaskPriorityPolicy().get();
+  TInlineCallPolicy* inlinePolicy = server_->getInlineCallPolicy().get();
+  bool byService = server_->hasServiceThreadManagers();
+  if ((priorityPolicy == NULL && inlinePolicy == NULL && !byService) ||
+      !task.readHeader()) {
+    return false;
+  }
+  if (priorityPolicy) {
+    priority = priorityPolicy->getPriority(task.getName());
+  }
+  if (byService) {
+    threadManager = server_->getServiceThreadManager(task.getName());
+  }
+  return inlinePolicy && inlinePolicy->isInline(task.getName());
+}
 
-  // pick an IO thread to handle this connection -- currently round robin
-  assert(nextIOThread_ < ioThreads_.size());
-  int selectedThreadIdx = nextIOThread_;
-  nextIOThread_ = (nextIOThread_ + 1) % ioThreads_.size();
+boost::shared_ptr<TNonblockingServer::TConnection::Task>&
+TNonblockingServer::TConnection::prepareTask(boost::shared_ptr<Task>& slot,
+                                             const boost::shared_ptr<TProtocol>& input,
+                                             const boost::shared_ptr<TProtocol>& output,
+                                             PipelinedCall* call) {
+  // A worker drops its hold on a task just after the task notifies this
+  // thread, so a task may now and then be found still held, and replaced
+  if (slot && slot.unique()) {
+    slot->reset(processor_, input, output, this, call);
+  } else {
+    slot.reset(new Task(processor_, input, output, this, call));
+  }
+  return slot;
+}
 
-  TNonblockingIOThread* ioThread = ioThreads_[selectedThreadIdx].get();
+bool TNonblockingServer::TConnection::admitPipelinedCall() {
+  // Past its first, each call is one an unpipelined client would have had
+  // to connect for, so the overload action applies as it would on accept
+  TOverloadAction action = server_->getOverloadAction();
+  if (action == T_OVERLOAD_NO_ACTION || !server_->serverOverloaded()) {
+    return true;
+  }
+  return action == T_OVERLOAD_DRAIN_TASK_QUEUE && server_->drainPendingTask();
+}
 
-  // Check the connection stack to see if we can re-use
-  TConnection* result = NULL;
-  if (connectionStack_.empty()) {
-    result = new TConnection(socket, ioThread, addr, addrLen);
-    ++numTConnections_;
-  } else {
-    result = connectionStack_.top();
-    connectionStack_.pop();
-    result->init(socket, ioThread, addr, addrLen);
+void TNonblockingServer::TConnection::pipelineSent(uint32_t len) {
+  // For trimBuffersByAge(), the buffers in use are the response just sent
+  // and the part of the next request read so far
+  if (len > largestWriteBufferSize_) {
+    largestWriteBufferSize_ = len;
+  }
+  if (server_->getBufferTrimAge() > 0) {
+    writeBufferSize_ = len;
+    readWant_ = readBufferPos_;
+    trimBuffersByAge();
+  } else if (server_->getResizeBufferEveryN() > 0 &&
+             callsForResize_ >= server_->getResizeBufferEveryN()) {
+    checkIdleBufferMemLimit(server_->getIdleReadBufferLimit(),
+                            server_->getIdleWriteBufferLimit());
+    callsForResize_ = 0;
   }
-  activeConnections_.push_back(result);
-  return result;
 }
 
-/**
- * Returns a connection to the stack
- */
-void TNonblockingServer::returnConnection(TConnection* connection) {
-  Guard g(connMutex_);
+void TNonblockingServer::TConnection::abandonTasks() {
+  if (task_ && !task_.unique()) {
+    task_->abandon();
+    task_.reset();
+  }
+  if (pipeline_) {
+    for (size_t i = 0; i < pipeline_->calls.size(); ++i) {
+      boost::shared_ptr<Task>& task = pipeline_->calls[i]->task;
+      if (task && !task.unique()) {
+        task->abandon();
+        task.reset();
+      }
+    }
+  }
+}
 
-  activeConnections_.erase(std::remove(activeConnections_.begin(), activeConnections_.end(), connection), activeConnections_.end());
+void TNonblockingServer::TConnection::collectCalls() {
+  {
+    Guard g(pipeline_->callsMutex);
+    if (server_->getPipelineOutOfOrder()) {
+      size_t kept = 0;
+      for (size_t i = 0; i < pipeline_->calls.size(); ++i) {
+        if (pipeline_->calls[i]->done) {
+          pipeline_->finishedCalls.push_back(pipeline_->calls[i]);
+        } else {
+          pipeline_->calls[kept++] = pipeline_->calls[i];
+        }
+      }
+      pipeline_->calls.resize(kept);
+    } else {
+      while (!pipeline_->calls.empty() && pipeline_->calls.front()->done) {
+        pipeline_->finishedCalls.push_back(pipeline_->calls.front());
+        pipeline_->calls.pop_front();
+      }
+    }
+  }
 
-  if (connectionStackLimit_ &&
-      (connectionStack_.size() >= connectionStackLimit_)) {
-    delete connection;
-    --numTConnections_;
-  } else {
-    connection->checkIdleBufferMemLimit(idleReadBufferLimit_, idleWriteBufferLimit_);
-    connectionStack_.push(connection);
+  for (size_t i = 0; i < pipeline_->finishedCalls.size(); ++i) {
+    PipelinedCall* call = pipeline_->finishedCalls[i];
+    server_->decrementActiveProcessors();
+    ++callsForResize_;
+    if (call->failed) {
+      pipeline_->closing = true;
+    } else if (!pipeline_->closing) {
+      // Oneway calls have nothing to send
+      uint8_t* buf;
+      uint32_t len;
+      call->output->getBuffer(&buf, &len);
+      if (len > 0) {
+        uint32_t frameSize = htonl(len);
+        pipeline_->output->write((const uint8_t*)&frameSize, sizeof(frameSize));
+        pipeline_->output->write(buf, len);
+      }
+    }
+    pipeline_->spareCalls.push_back(call);
   }
+  pipeline_->finishedCalls.clear();
 }
 
-/**
- * Server socket had something happen.  We accept all waiting client
- * connections on fd and assign TConnection objects to handle those requests.
- */
-void TNonblockingServer::handleEvent(THRIFT_SOCKET fd, short which) {
-  (void) which;
-  // Make sure that libevent didn't mess up the socket handles
-  assert(fd == serverSocket_);
+void TNonblockingServer::TConnection::pipelineClose() {
+  pipeline_->closing = true;
+  if (pipeline_->callsAwaitingNotify > 0) {
+    // Tasks still refer to us; wait for them before really closing
+    setIdle();
+    return;
+  }
 
-  // Server socket accepted a new connection
-  socklen_t addrLen;
-  sockaddr_storage addrStorage;
-  sockaddr* addrp = (sockaddr*)&addrStorage;
-  addrLen = sizeof(addrStorage);
+  collectCalls();
+  assert(pipeline_->calls.empty());
+  close();
+}
 
-  // Going to accept a new client socket
-  THRIFT_SOCKET clientSocket;
+void TNonblockingServer::TConnection::updatePipelineFlags() {
+  uint8_t* buf;
+  uint32_t len;
+  pipeline_->output->getBuffer(&buf, &len);
+  setPendingBytes(readBufferPos_ + len - pipeline_->outputPos);
+
+  short flags = 0;
+  if (!pipeline_->closing && pipeline_->calls.size() < server_->getPipelineDepth()) {
+    // Between frames, reading waits for the memory budget
+    if (!memoryWait_ && readBufferPos_ == 0 && server_->getMemoryBudget() != 0 &&
+        !server_->reserveMemory(0)) {
+      waitForMemory();
+    }
+    if (!memoryWait_) {
+      flags |= TEventLoop::READ;
+    }
+  }
+  if (pipeline_->outputPos < len) {
+    flags |= TEventLoop::WRITE;
+  }
+  setFlags(flags);
+}
 
-  // Accept as many new clients as possible, even though libevent signaled only
-  // one, this helps us to avoid having to go back into the libevent engine so
-  // many times
-  while ((clientSocket = ::accept(fd, addrp, &addrLen)) != -1) {
-    // If we're overloaded, take action here
-    if (overloadAction_ != T_OVERLOAD_NO_ACTION && serverOverloaded()) {
-      Guard g(connMutex_);
-      nConnectionsDropped_++;
-      nTotalConnectionsDropped_++;
-      if (overloadAction_ == T_OVERLOAD_CLOSE_ON_ACCEPT) {
-        ::THRIFT_CLOSESOCKET(clientSocket);
-        return;
-      } else if (overloadAction_ == T_OVERLOAD_DRAIN_TASK_QUEUE) {
-        if (!drainPendingTask()) {
-          // Nothing left to discard, so we drop connection instead.
-          ::THRIFT_CLOSESOCKET(clientSocket);
-          return;
+boost::shared_ptr<TProtocol> TNonblockingServer::TConnection::headerProtocol(
+    const boost::shared_ptr<TTransport>& input,
+    const boost::shared_ptr<TTransport>& output) {
+  if (!server_->getHeaderTransport()) {
+    return boost::shared_ptr<TProtocol>();
+  }
+  boost::shared_ptr<THeaderTransport> header(new THeaderTransport(input, output));
+  header->setExternalFraming(true);
+  header->setMaxFrameSize(static_cast<uint32_t>(server_->getMaxFrameSize()));
+  header->setTransforms(server_->getHeaderTransforms());
+  return boost::shared_ptr<TProtocol>(new apache::thrift::protocol::THeaderProtocol(header));
+}
+
+uint32_t TNonblockingServer::TConnection::readDeadline(const uint8_t* frame,
+                                                       uint32_t size,
+                                                       int64_t& deadline) {
+  uint32_t skip = TDeadline::readPrefix(frame, size, deadline);
+  if (deadline == 0 && server_->getHeaderTransport()) {
+    THeaderTransport::StringToStringMap headers;
+    if (THeaderTransport::readHeaders(frame + skip, size - skip, headers)) {
+      THeaderTransport::StringToStringMap::const_iterator it =
+        headers.find(THeaderTransport::CLIENT_TIMEOUT_HEADER);
+      if (it != headers.end()) {
+        int64_t budget = atoll(it->second.c_str());
+        if (budget > 0) {
+          deadline = Util::cachedTime() + budget;
         }
       }
     }
+  }
+  return skip;
+}
 
-    // Explicitly set this socket to NONBLOCK mode
-    int flags;
-    if ((flags = THRIFT_FCNTL(clientSocket, THRIFT_F_GETFL, 0)) < 0 ||
-        THRIFT_FCNTL(clientSocket, THRIFT_F_SETFL, flags | THRIFT_O_NONBLOCK) < 0) {
-      GlobalOutput.perror("thriftServerEventHandler: set THRIFT_O_NONBLOCK (THRIFT_FCNTL) ", THRIFT_GET_SOCKET_ERROR);
-      ::THRIFT_CLOSESOCKET(clientSocket);
+void TNonblockingServer::TConnection::readFrames(bool recv) {
+  uint32_t size;
+  uint8_t* buf = ioThread_->getRecvBuffer(&size);
+  uint32_t len = static_cast<uint32_t>(readAhead_.size());
+  assert(len <= size);
+  if (len > 0) {
+    memcpy(buf, readAhead_.data(), len);
+  }
+
+  if (recv) {
+    int32_t got;
+    try {
+      got = readClient(buf + len, size - len);
+    } catch (TTransportException& te) {
+      T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                       "TConnection::workSocket(): %s", te.what());
+      close();
       return;
     }
-
-    // Create a new TConnection for this client socket.
-    TConnection* clientConnection =
-      createConnection(clientSocket, addrp, addrLen);
-
-    // Fail fast if we could not create a TConnection object
-    if (clientConnection == NULL) {
-      GlobalOutput.printf("thriftServerEventHandler: failed TConnection factory");
-      ::THRIFT_CLOSESOCKET(clientSocket);
+    if (got < 0) {
+      // Nothing decrypted yet
       return;
     }
-
-    /*
-     * Either notify the ioThread that is assigned this connection to
-     * start processing, or if it is us, we'll just ask this
-     * connection to do its initial state change here.
-     *
-     * (We need to avoid writing to our own notification pipe, to
-     * avoid possible deadlocks if the pipe is full.)
-     *
-     * The IO thread #0 is the only one that handles these listen
-     * events, so unless the connection has been assigned to thread #0
-     * we know it's not on our thread.
-     */
-    if (clientConnection->getIOThreadNumber() == 0) {
-      clientConnection->transition();
-    } else {
-      clientConnection->notifyIOThread();
+    if (got == 0) {
+      // Whenever we get here it means a remote disconnect
+      close();
+      return;
+    }
+    len += got;
+  }
+  readAhead_.clear();
+
+  // Requests that leave the connection ready for another, such as oneway
+  // ones served here, are followed straight away by the next
+  uint32_t pos = 0;
+  readingFrames_ = true;
+  while (pos < len && socketState_ == SOCKET_RECV_FRAMING && !unframed_) {
+    uint32_t used = takeFrame(buf + pos, len - pos);
+    if (ioThread_ == NULL) {
+      // Closed
+      readingFrames_ = false;
+      return;
     }
+    if (used == 0) {
+      break;
+    }
+    pos += used;
+  }
+  readingFrames_ = false;
 
-    // addrLen is written by the accept() call, so needs to be set before the next call.
-    addrLen = sizeof(addrStorage);
+  if (pos < len) {
+    readAhead_.assign(reinterpret_cast<const char*>(buf + pos), len - pos);
   }
+}
 
+uint32_t TNonblockingServer::TConnection::takeFrame(const uint8_t* data,
+                                                    uint32_t len) {
+  uint32_t frameSize;
+  if (len < sizeof(frameSize)) {
+    return 0;
+  }
 
-  // Done looping accept, now we have to make sure the error is due to
-  // blocking. Any other error is a problem
-  if (THRIFT_GET_SOCKET_ERROR != THRIFT_EAGAIN && THRIFT_GET_SOCKET_ERROR != THRIFT_EWOULDBLOCK) {
-    GlobalOutput.perror("thriftServerEventHandler: accept() ", THRIFT_GET_SOCKET_ERROR);
+  // With THeaderTransport, what would be a giant frame size may be the
+  // start of an unframed binary or compact message
+  if (server_->getHeaderTransport() &&
+      ((data[0] == 0x80 && data[1] == 0x01) || data[0] == 0x82)) {
+    startUnframed(data, len);
+    return len;
+  }
+
+  memcpy(&frameSize, data, sizeof(frameSize));
+  frameSize = ntohl(frameSize);
+  if (frameSize > server_->getMaxFrameSize()) {
+    // Don't allow giant frame sizes.  This prevents bad clients from
+    // causing us to try and allocate a giant buffer.
+    T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                     "TNonblockingServer: frame size too large "
+                     "(%" PRIu32 " > %" PRIu64 ") from client %s. "
+                     "Remote side not using TFramedTransport?",
+                     frameSize,
+                     (uint64_t)server_->getMaxFrameSize(),
+                     tSocket_->getSocketInfo().c_str());
+    close();
+    return len;
   }
+  if (!reservePendingBytes(frameSize)) {
+    // The frame stays in readAhead_ until there is memory for it
+    waitForMemory();
+    return 0;
+  }
+  data += sizeof(frameSize);
+  len -= static_cast<uint32_t>(sizeof(frameSize));
+  readWant_ = frameSize;
+
+  if (len >= frameSize) {
+    // Served from where it was received unless a task has to take it
+    borrowedRequest_ = data;
+    readBufferPos_ = frameSize;
+    setPendingBytes(frameSize);
+    socketState_ = SOCKET_RECV;
+    appState_ = APP_READ_REQUEST;
+    transition();
+    return static_cast<uint32_t>(sizeof(frameSize)) + frameSize;
+  }
+
+  // size known; read the rest of the frame into readBuffer_
+  transition();
+  memcpy(readBuffer_, data, len);
+  readBufferPos_ = len;
+  return static_cast<uint32_t>(sizeof(frameSize)) + len;
 }
 
-/**
- * Creates a socket to listen on and binds it to the local port.
- */
-void TNonblockingServer::createAndListenOnSocket() {
-  THRIFT_SOCKET s;
+void TNonblockingServer::TConnection::keepRequest() {
+  if (borrowedRequest_ == NULL) {
+    return;
+  }
 
-  struct addrinfo hints, *res, *res0;
-  int error;
+  // The receive buffer is the IO thread's to reuse, so the request is
+  // moved, keeping the place the task has read up to
+  uint32_t unread = inputTransport_->available_read();
+  sizeReadBuffer(readBufferPos_);
+  memcpy(readBuffer_, borrowedRequest_, readBufferPos_);
+  inputTransport_->resetBuffer(readBuffer_ + readBufferPos_ - unread, unread);
+  borrowedRequest_ = NULL;
+}
+
+void TNonblockingServer::TConnection::sizeReadBuffer(uint32_t size) {
+  // Double the buffer size until it is big enough
+  if (size > readBufferSize_ && ioThread_->getBufferPool()) {
+    TBufferPool* pool = ioThread_->getBufferPool();
+    pool->giveBack(readBuffer_, readBufferSize_);
+    readBuffer_ = NULL;
+    readBufferSize_ = 0;
+    readBuffer_ = pool->borrow(size, &readBufferSize_);
+  } else if (size > readBufferSize_) {
+    if (readBufferSize_ == 0) {
+      readBufferSize_ = 1;
+    }
+    uint32_t newSize = readBufferSize_;
+    while (size > newSize) {
+      newSize *= 2;
+    }
+
+    uint8_t* newBuffer = (uint8_t*)std::realloc(readBuffer_, newSize);
+    if (newBuffer == NULL) {
+      // nothing else to be done...
+      throw std::bad_alloc();
+    }
+    readBuffer_ = newBuffer;
+    readBufferSize_ = newSize;
+  }
+}
+
+void TNonblockingServer::TConnection::startUnframed(const uint8_t* start,
+                                                    uint32_t len) {
+  unframed_ = true;
+  reserveReadBuffer(std::max(len, static_cast<uint32_t>(16 * 1024)));
+  memcpy(readBuffer_, start, len);
+  readBufferPos_ = len;
+
+  socketState_ = SOCKET_RECV;
+  appState_ = APP_READ_REQUEST;
+  readUnframed();
+}
+
+void TNonblockingServer::TConnection::resumeUnframed() {
+  socketState_ = SOCKET_RECV;
+  appState_ = APP_READ_REQUEST;
+
+  reserveReadBuffer(static_cast<uint32_t>(readAhead_.size()) + 16 * 1024);
+  readBufferPos_ = static_cast<uint32_t>(readAhead_.size());
+  if (readBufferPos_ > 0) {
+    memcpy(readBuffer_, readAhead_.data(), readBufferPos_);
+    readAhead_.clear();
+  }
+  readWant_ = readBufferSize_;
+  setRead();
+
+  // The client may have sent the whole of its next request already
+  if (readBufferPos_ > 0) {
+    readUnframed();
+  }
+}
+
+void TNonblockingServer::TConnection::readUnframed() {
+  uint32_t size;
+  try {
+    size = unframedMessageSize();
+  } catch (const TException& x) {
+    T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                     "TNonblockingServer: bad unframed request from client %s: %s",
+                     tSocket_->getSocketInfo().c_str(), x.what());
+    close();
+    return;
+  }
+
+  if (size == 0) {
+    if (readBufferPos_ >= server_->getMaxFrameSize()) {
+      T_OUTPUT_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                       "TNonblockingServer: unframed request too large "
+                       "(> %" PRIu64 ") from client %s",
+                       (uint64_t)server_->getMaxFrameSize(),
+                       tSocket_->getSocketInfo().c_str());
+      close();
+      return;
+    }
+    if (readBufferPos_ == readBufferSize_) {
+      reserveReadBuffer(readBufferSize_ + 1);
+    }
+    readWant_ = readBufferSize_;
+    setPendingBytes(readBufferPos_);
+    return;
+  }
+
+  // Whatever came after belongs to the next request
+  readAhead_.assign(reinterpret_cast<const char*>(readBuffer_ + size),
+                        readBufferPos_ - size);
+  readBufferPos_ = size;
+  readWant_ = size;
+  transition();
+}
+
+uint32_t TNonblockingServer::TConnection::unframedMessageSize() {
+  if (!unframedProbe_) {
+    unframedProbe_.reset(new TMemoryBuffer());
+  }
+  unframedProbe_->resetBuffer(readBuffer_, readBufferPos_);
+
+  // Limit sizes to what the server would take framed, so a bad length
+  // can't make us allocate more
+  int32_t limit = static_cast<int32_t>(
+    std::min(server_->getMaxFrameSize(), static_cast<size_t>(INT_MAX)));
+  boost::shared_ptr<TProtocol>* probe;
+  if (readBuffer_[0] == 0x82) {
+    probe = &unframedCompactProbe_;
+    if (!*probe) {
+      probe->reset(new apache::thrift::protocol::TCompactProtocolT<TMemoryBuffer>(
+        unframedProbe_, limit, limit));
+    }
+  } else {
+    probe = &unframedBinaryProbe_;
+    if (!*probe) {
+      probe->reset(new apache::thrift::protocol::TBinaryProtocolT<TMemoryBuffer>(
+        unframedProbe_, limit, limit, true, true));
+    }
+  }
+
+  std::string name;
+  TMessageType messageType;
+  int32_t seqid;
+  try {
+    (*probe)->readMessageBegin(name, messageType, seqid);
+    (*probe)->skip(apache::thrift::protocol::T_STRUCT);
+    (*probe)->readMessageEnd();
+  } catch (const TTransportException& ttx) {
+    if (ttx.getType() == TTransportException::END_OF_FILE) {
+      return 0;
+    }
+    throw;
+  }
+  return readBufferPos_ - unframedProbe_->available_read();
+}
+
+void TNonblockingServer::TConnection::reserveReadBuffer(uint32_t size) {
+  if (size <= readBufferSize_) {
+    return;
+  }
+
+  uint64_t newSize = readBufferSize_ == 0 ? 1 : readBufferSize_;
+  while (newSize < size) {
+    newSize *= 2;
+  }
+  if (newSize > 0xffffffffu) {
+    newSize = size;
+  }
+
+  uint8_t* newBuffer = (uint8_t*)std::realloc(readBuffer_, static_cast<size_t>(newSize));
+  if (newBuffer == NULL) {
+    // nothing else to be done...
+    throw std::bad_alloc();
+  }
+  readBuffer_ = newBuffer;
+  readBufferSize_ = static_cast<uint32_t>(newSize);
+}
+
+TNonblockingIOThread::Wait TNonblockingServer::TConnection::currentWait() {
+  if (pipelined_) {
+    // Waiting on the server as long as a call or a response is outstanding
+    uint8_t* buf;
+    uint32_t len;
+    pipeline_->output->getBuffer(&buf, &len);
+    if (!pipeline_->calls.empty() || pipeline_->closing || pipeline_->outputPos < len) {
+      return TNonblockingIOThread::WAIT_NONE;
+    }
+    if (readBufferPos_ == 0) {
+      return memoryWait_ ?
+        TNonblockingIOThread::WAIT_NONE : TNonblockingIOThread::WAIT_IDLE;
+    }
+    return readBufferPos_ < sizeof(uint32_t) ?
+      TNonblockingIOThread::WAIT_HEADER : TNonblockingIOThread::WAIT_BODY;
+  }
+
+  switch (appState_) {
+  case APP_READ_FRAME_SIZE:
+    if (memoryWait_) {
+      // Waiting on us, not the client
+      return TNonblockingIOThread::WAIT_NONE;
+    }
+    // Nothing but part of a frame size waits in readAhead_ here
+    return readAhead_.empty() ?
+      TNonblockingIOThread::WAIT_IDLE : TNonblockingIOThread::WAIT_HEADER;
+  case APP_READ_REQUEST:
+    // An unframed request has no frame size to wait for
+    return (unframed_ && readBufferPos_ == 0) ?
+      TNonblockingIOThread::WAIT_IDLE : TNonblockingIOThread::WAIT_BODY;
+  default:
+    return TNonblockingIOThread::WAIT_NONE;
+  }
+}
+
+void TNonblockingServer::TConnection::updateWait() {
+  TNonblockingIOThread::Wait wait = currentWait();
+  if (wait != wait_ || requestsRead_ != waitRequests_) {
+    waitRequests_ = requestsRead_;
+    ioThread_->setWait(this, wait);
+  }
+}
+
+void TNonblockingServer::TConnection::resumeReading() {
+  memoryWait_ = false;
+  server_->leaveMemoryWait();
+
+  deferReturn_ = true;
+  if (pipelined_) {
+    updatePipelineFlags();
+  } else {
+    // The frame size that had to wait is first in readAhead_
+    setRead();
+    readFrames(false);
+  }
+  finishWork();
+}
+
+void TNonblockingServer::TConnection::finishWork() {
+  deferReturn_ = false;
+  if (ioThread_ == NULL) {
+    // Closed while we were working
+    ownerThread_->returnConnection(this);
+    return;
+  }
+  if (server_->isDraining() &&
+      currentWait() == TNonblockingIOThread::WAIT_IDLE) {
+    retire();
+    return;
+  }
+  updateWait();
+}
+
+void TNonblockingServer::TConnection::setFlags(short eventFlags) {
+  requestedFlags_ = eventFlags;
+
+  // Ciphertext the socket hasn't taken yet needs it writable, and so does
+  // input OpenSSL already holds: the socket being writable is what gets us
+  // called back to read it
+  if (tlsSocket_ && (tlsSocket_->hasPendingOutput() ||
+                     ((eventFlags & TEventLoop::READ) &&
+                      tlsSocket_->hasBufferedInput()))) {
+    eventFlags |= TEventLoop::WRITE;
+  }
+
+  // Catch the do nothing case
+  if (eventFlags_ == eventFlags) {
+    return;
+  }
+
+  TEventLoop* loop = ioThread_->getEventLoop();
+
+  // Update in memory structure
+  eventFlags_ = eventFlags;
+
+  // With no flags we stop listening for events
+  if (!eventFlags_) {
+    if (!loop->del(&event_)) {
+      GlobalOutput("TConnection::setFlags(): could not delete event");
+    }
+    return;
+  }
+
+  // The event stays registered until it is deleted, and adding it again
+  // just changes what it waits for
+  event_.fd = tSocket_->getSocketFD();
+  event_.flags = eventFlags_;
+  event_.callback = TConnection::eventHandler;
+  event_.arg = this;
+  if (!loop->add(&event_)) {
+    GlobalOutput("TConnection::setFlags(): could not add event");
+  }
+}
+
+/**
+ * Closes a connection
+ */
+void TNonblockingServer::TConnection::close() {
+  // A late completion must not reach whoever is served here next
+  abandonTasks();
+
+  ioThread_->setWait(this, TNonblockingIOThread::WAIT_NONE);
+  if (memoryWait_) {
+    memoryWait_ = false;
+    ioThread_->removeMemoryWaiter(this);
+    server_->leaveMemoryWait();
+  }
+
+  // Delete the registered event
+  if (!ioThread_->getEventLoop()->del(&event_)) {
+    GlobalOutput.perror("TConnection::close() event del", THRIFT_GET_SOCKET_ERROR);
+  }
+
+  if (serverEventHandler_) {
+    serverEventHandler_->deleteContext(connectionContext_, inputProtocol_, outputProtocol_);
+  }
+  releaseReadBuffer();
+  setPendingBytes(0);
+
+  // The kernel may still be sending from buffers it hasn't reported on, but
+  // only to a client that is being cut off
+  if (zeroCopyState_) {
+    reapZeroCopy();
+    for (size_t i = 0; i < zeroCopyState_->spans.size(); ++i) {
+      std::free(zeroCopyState_->spans[i].buffer);
+    }
+    zeroCopyState_->spans.clear();
+    releaseZeroCopySpare();
+  }
+
+  ioThread_->addConnections(-1);
+  ioThread_ = NULL;
+
+  // Close the socket
+  tSocket_->close();
+
+  // close any factory produced transports
+  factoryInputTransport_->close();
+  factoryOutputTransport_->close();
+
+  // Give this object back to the IO thread that owns it, unless that is
+  // left to the handler that is working it
+  if (!deferReturn_) {
+    ownerThread_->returnConnection(this);
+  }
+}
+
+void TNonblockingServer::TConnection::retire() {
+  // Reports on sends still in flight would go to the successor, which
+  // knows nothing of them.  finishWork() comes back once they are in.
+  if (zeroCopyOutstanding()) {
+    reapZeroCopy();
+    if (zeroCopyOutstanding()) {
+      updateWait();
+      return;
+    }
+  }
+
+  // OpenSSL's session state can't follow the socket
+  if (!tlsSocket_ && server_->passConnection(tSocket_->getSocketFD())) {
+    tSocket_->detach();
+  }
+  close();
+}
+
+void TNonblockingServer::TConnection::releaseReadBuffer() {
+  if (readBuffer_ != NULL && ioThread_ && ioThread_->getBufferPool()) {
+    ioThread_->getBufferPool()->giveBack(readBuffer_, readBufferSize_);
+    readBuffer_ = NULL;
+    readBufferSize_ = 0;
+  }
+}
+
+void TNonblockingServer::TConnection::checkIdleBufferMemLimit(
+    size_t readLimit,
+    size_t writeLimit) {
+  if (pipelined_) {
+    // A pipelined connection keeps what it has read of the next requests,
+    // and the requests and responses of its calls in their own buffers
+    for (size_t i = 0; i < pipeline_->spareCalls.size(); ++i) {
+      PipelinedCall* call = pipeline_->spareCalls[i];
+      call->input->resetBuffer();
+      if (readLimit > 0 && call->input->available_write() > readLimit) {
+        call->input->resetBuffer(TMemoryBuffer::defaultSize);
+      }
+      call->output->resetBuffer();
+      if (writeLimit > 0 && call->output->available_write() > writeLimit) {
+        call->output->resetBuffer(
+          static_cast<uint32_t>(server_->getWriteBufferDefaultSize()));
+      }
+    }
+    if (writeLimit > 0 && pipeline_->outputPos == 0 &&
+        pipeline_->output->available_read() == 0 &&
+        pipeline_->output->available_write() > writeLimit) {
+      pipeline_->output->resetBuffer(
+        static_cast<uint32_t>(server_->getWriteBufferDefaultSize()));
+    }
+    if (readBufferPos_ > 0) {
+      readLimit = 0;
+    }
+  }
+
+  if (readLimit > 0 && readBufferSize_ > readLimit) {
+    free(readBuffer_);
+    readBuffer_ = NULL;
+    readBufferSize_ = 0;
+  }
+
+  if (writeLimit > 0 && largestWriteBufferSize_ > writeLimit) {
+    // just start over
+    if (segmentedOutputTransport_) {
+      segmentedOutputTransport_->resetBuffer(
+        static_cast<uint32_t>(server_->getWriteBufferDefaultSize()));
+    } else {
+      outputTransport_->resetBuffer(static_cast<uint32_t>(server_->getWriteBufferDefaultSize()));
+    }
+    releaseZeroCopySpare();
+    largestWriteBufferSize_ = 0;
+  }
+}
+
+void TNonblockingServer::TConnection::trimBuffersByAge() {
+  size_t readLimit = server_->getIdleReadBufferLimit();
+  size_t writeLimit = server_->getIdleWriteBufferLimit();
+  if (!(readLimit > 0 && readBufferSize_ > readLimit) &&
+      !(writeLimit > 0 && largestWriteBufferSize_ > writeLimit)) {
+    return;
+  }
+
+  // Only a connection holding big buffers looks at the clock
+  int64_t now = Util::cachedTime();
+  if ((readLimit > 0 && readWant_ > readLimit) ||
+      (writeLimit > 0 && writeBufferSize_ > writeLimit)) {
+    buffersNeededAt_ = now;
+  } else if (now - buffersNeededAt_ >= server_->getBufferTrimAge()) {
+    checkIdleBufferMemLimit(readLimit, writeLimit);
+  }
+}
+
+TNonblockingServer::~TNonblockingServer() {
+  // Close any active connections and free the idle ones
+  for (size_t i = 0; i < ioThreads_.size(); ++i) {
+    ioThreads_[i]->cleanupConnections();
+  }
+  for (size_t i = 0; i < inheritedSockets_.size(); ++i) {
+    ::THRIFT_CLOSESOCKET(inheritedSockets_[i]);
+  }
+  for (size_t i = 0; i < listeners_.size(); ++i) {
+    if (listeners_[i]->socket != THRIFT_INVALID_SOCKET) {
+      ::THRIFT_CLOSESOCKET(listeners_[i]->socket);
+    }
+  }
+  if (restartSocket_ != THRIFT_INVALID_SOCKET) {
+    // Still ours: nobody took over
+    ::THRIFT_CLOSESOCKET(restartSocket_);
+    ::unlink(hotRestartPath_.c_str());
+  }
+  // The TNonblockingIOThread objects have shared_ptrs to the Thread
+  // objects and the Thread objects have shared_ptrs to the TNonblockingIOThread
+  // objects (as runnable) so these objects will never deallocate without help.
+  while (!ioThreads_.empty()) {
+	  boost::shared_ptr<TNonblockingIOThread> iot = ioThreads_.back();
+	  ioThreads_.pop_back();
+	  iot->setThread(boost::shared_ptr<Thread>());
+  }
+}
+
+size_t TNonblockingServer::getNumConnections() const {
+  return getNumActiveConnections() + getNumIdleConnections();
+}
+
+size_t TNonblockingServer::getNumActiveConnections() const {
+  size_t count = 0;
+  for (size_t i = 0; i < ioThreads_.size(); ++i) {
+    count += ioThreads_[i]->getNumConnections();
+  }
+  return count;
+}
+
+size_t TNonblockingServer::getNumIdleConnections() const {
+  size_t count = 0;
+  for (size_t i = 0; i < ioThreads_.size(); ++i) {
+    count += ioThreads_[i]->getNumCachedConnections();
+  }
+  return count;
+}
+
+void TNonblockingServer::getIOThreadStats(
+    std::vector<TIOThreadStats>& _return,
+    bool withConnections,
+    int64_t timeoutMs) const {
+  std::vector<uint64_t> tickets(ioThreads_.size());
+  for (size_t i = 0; i < ioThreads_.size(); ++i) {
+    tickets[i] = ioThreads_[i]->requestStats(withConnections);
+  }
+
+  int64_t deadline = Util::monotonicTime() + timeoutMs;
+  _return.resize(ioThreads_.size());
+  for (size_t i = 0; i < ioThreads_.size(); ++i) {
+    ioThreads_[i]->waitForStats(tickets[i], deadline, _return[i]);
+  }
+}
+
+/**
+ * Picks an IO thread for a new connection and counts it there, so that
+ * the next pick sees it
+ */
+TNonblockingIOThread* TNonblockingServer::selectIOThread(
+    TNonblockingIOThread* acceptThread) {
+  Guard g(connMutex_);
+
+  // With a listen socket per IO thread the connection stays on the
+  // accepting thread, unless it wasn't accepted here
+  TNonblockingIOThread* ioThread;
+  if (useReusePort_ && acceptThread) {
+    ioThread = acceptThread;
+  } else if (ioThreadAssignmentPolicy_) {
+    size_t selectedThreadIdx = ioThreadAssignmentPolicy_->select(ioThreads_);
+    assert(selectedThreadIdx < ioThreads_.size());
+    ioThread = ioThreads_[selectedThreadIdx].get();
+  } else {
+    assert(nextIOThread_ < ioThreads_.size());
+    int selectedThreadIdx = nextIOThread_;
+    nextIOThread_ = (nextIOThread_ + 1) % ioThreads_.size();
+
+    ioThread = ioThreads_[selectedThreadIdx].get();
+  }
+  ioThread->addConnections(1);
+  return ioThread;
+}
+
+/**
+ * Server socket had something happen.  We accept all waiting client
+ * connections on fd and assign TConnection objects to handle those requests.
+ */
+void TNonblockingServer::handleEvent(THRIFT_SOCKET fd, short which,
+                                     TNonblockingIOThread* acceptThread) {
+  (void) which;
+  const Listener* listener = findListener(fd);
+
+  // Make sure that the event loop didn't mess up the socket handles
+  assert(fd == serverSocket_ || useReusePort_ || listener != &serverListener_);
+
+  // Only the server's port has a listen socket per IO thread
+  TNonblockingIOThread* localThread =
+    listener == &serverListener_ ? acceptThread : NULL;
+
+  // Server socket accepted a new connection
+  socklen_t addrLen;
+  sockaddr_storage addrStorage;
+  sockaddr* addrp = (sockaddr*)&addrStorage;
+
+  // Going to accept a new client socket
+  THRIFT_SOCKET clientSocket;
+
+  // Accept as many new clients as possible, even though the event loop
+  // signaled only one, this helps us to avoid having to go back into the
+  // loop so many times.  An edge triggered loop won't signal again until
+  // accept() would block, so connections that are dropped don't end it.
+  for (;;) {
+    // addrLen is written by the accept() call, so needs to be set before each call.
+    addrLen = sizeof(addrStorage);
+    clientSocket = ::accept(fd, addrp, &addrLen);
+    if (clientSocket == -1) {
+      break;
+    }
+
+    // If we're overloaded, take action here
+    if (overloadAction_ != T_OVERLOAD_NO_ACTION && serverOverloaded()) {
+      Guard g(connMutex_);
+      nConnectionsDropped_++;
+      nTotalConnectionsDropped_++;
+      if (overloadAction_ == T_OVERLOAD_CLOSE_ON_ACCEPT) {
+        ::THRIFT_CLOSESOCKET(clientSocket);
+        continue;
+      } else if (overloadAction_ == T_OVERLOAD_DRAIN_TASK_QUEUE) {
+        if (!drainPendingTask()) {
+          // Nothing left to discard, so we drop connection instead.
+          ::THRIFT_CLOSESOCKET(clientSocket);
+          continue;
+        }
+      }
+    }
+
+    // Explicitly set this socket to NONBLOCK mode
+    int flags;
+    if ((flags = THRIFT_FCNTL(clientSocket, THRIFT_F_GETFL, 0)) < 0 ||
+        THRIFT_FCNTL(clientSocket, THRIFT_F_SETFL, flags | THRIFT_O_NONBLOCK) < 0) {
+      GlobalOutput.perror("thriftServerEventHandler: set THRIFT_O_NONBLOCK (THRIFT_FCNTL) ", THRIFT_GET_SOCKET_ERROR);
+      ::THRIFT_CLOSESOCKET(clientSocket);
+      continue;
+    }
+
+    adoptSocket(clientSocket, addrp, addrLen, listener,
+                selectIOThread(localThread), acceptThread);
+  }
+
+
+  // Done looping accept, now we have to make sure the error is due to
+  // blocking. Any other error is a problem
+  if (THRIFT_GET_SOCKET_ERROR != THRIFT_EAGAIN && THRIFT_GET_SOCKET_ERROR != THRIFT_EWOULDBLOCK) {
+    T_PERROR_LIMITED(T_OUTPUT_WARNING, CONNECTION_ERRORS_PER_SECOND,
+                     "thriftServerEventHandler: accept() ", THRIFT_GET_SOCKET_ERROR);
+  }
+}
+
+void TNonblockingServer::adoptSocket(THRIFT_SOCKET socket,
+                                     const sockaddr* addr,
+                                     socklen_t addrLen,
+                                     const Listener* listener,
+                                     TNonblockingIOThread* ioThread,
+                                     TNonblockingIOThread* currentThread) {
+  /*
+   * Either hand the socket to the ioThread that is assigned it, which
+   * makes the TConnection from its own idle ones, or if it is us, we'll
+   * just start the connection here.
+   *
+   * (We need to avoid writing to our own notification pipe, to
+   * avoid possible deadlocks if the pipe is full.)
+   */
+  if (ioThread == currentThread) {
+    ioThread->startConnection(socket, addr, addrLen, listener);
+  } else if (!ioThread->handOff(socket, addr, addrLen, listener)) {
+    GlobalOutput.perror("thriftServerEventHandler: handOff() ", THRIFT_GET_SOCKET_ERROR);
+    ioThread->addConnections(-1);
+    ::THRIFT_CLOSESOCKET(socket);
+  }
+}
+
+/**
+ * Creates a socket to listen on and binds it to the local port.
+ */
+void TNonblockingServer::createAndListenOnSocket() {
+  listenSocket(createBoundSocket(port_));
+}
+
+/**
+ * Creates a socket and binds it to a local port.
+ */
+THRIFT_SOCKET TNonblockingServer::createBoundSocket(int listenPort) {
+  THRIFT_SOCKET s;
+
+  struct addrinfo hints, *res, *res0;
+  int error;
 
   char port[sizeof("65536") + 1];
   memset(&hints, 0, sizeof(hints));
   hints.ai_family = PF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
   hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
-  sprintf(port, "%d", port_);
+  sprintf(port, "%d", listenPort);
+
+  // Wildcard address
+  error = getaddrinfo(NULL, port, &hints, &res0);
+  if (error) {
+    throw TException("TNonblockingServer::serve() getaddrinfo " +
+                     string(THRIFT_GAI_STRERROR(error)));
+  }
+
+  // Pick the ipv6 address first since ipv4 addresses can be mapped
+  // into ipv6 space.
+  for (res = res0; res; res = res->ai_next) {
+    if (res->ai_family == AF_INET6 || res->ai_next == NULL)
+      break;
+  }
+
+  // Create the server socket
+  s = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (s == -1) {
+    freeaddrinfo(res0);
+    throw TException("TNonblockingServer::serve() socket() -1");
+  }
+
+  #ifdef IPV6_V6ONLY
+  if (res->ai_family == AF_INET6) {
+    int zero = 0;
+    if (-1 == setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, const_cast_sockopt(&zero), sizeof(zero))) {
+      GlobalOutput("TServerSocket::listen() IPV6_V6ONLY");
+    }
+  }
+  #endif // #ifdef IPV6_V6ONLY
+
+
+  int one = 1;
+
+  // Set THRIFT_NO_SOCKET_CACHING to avoid 2MSL delay on server restart
+  setsockopt(s, SOL_SOCKET, THRIFT_NO_SOCKET_CACHING, const_cast_sockopt(&one), sizeof(one));
+
+  #ifdef SO_REUSEPORT
+  // Lets every IO thread bind its own socket to the same port
+  if (useReusePort_ &&
+      -1 == setsockopt(s, SOL_SOCKET, SO_REUSEPORT, const_cast_sockopt(&one), sizeof(one))) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    ::THRIFT_CLOSESOCKET(s);
+    freeaddrinfo(res0);
+    throw TTransportException(TTransportException::NOT_OPEN,
+                              "TNonblockingServer::serve() SO_REUSEPORT",
+                              errno_copy);
+  }
+  #endif
+
+  if (::bind(s, res->ai_addr, static_cast<int>(res->ai_addrlen)) == -1) {
+    ::THRIFT_CLOSESOCKET(s);
+    freeaddrinfo(res0);
+    throw TTransportException(TTransportException::NOT_OPEN,
+                              "TNonblockingServer::serve() bind",
+                              THRIFT_GET_SOCKET_ERROR);
+  }
+
+  // Done with the addr info
+  freeaddrinfo(res0);
+
+  return s;
+}
+
+/**
+ * Takes a socket created by listenSocket() and sets various options on it
+ * to prepare for use in the server.
+ */
+void TNonblockingServer::listenSocket(THRIFT_SOCKET s) {
+  prepareListenSocket(s);
+
+  // Cool, this socket is good to go, set it as the serverSocket_
+  serverSocket_ = s;
+}
+
+/**
+ * Sets the listen options on a bound socket and starts it listening.
+ */
+void TNonblockingServer::prepareListenSocket(THRIFT_SOCKET s) {
+  // Set socket to nonblocking mode
+  int flags;
+  if ((flags = THRIFT_FCNTL(s, THRIFT_F_GETFL, 0)) < 0 ||
+      THRIFT_FCNTL(s, THRIFT_F_SETFL, flags | THRIFT_O_NONBLOCK) < 0) {
+    ::THRIFT_CLOSESOCKET(s);
+    throw TException("TNonblockingServer::serve() THRIFT_O_NONBLOCK");
+  }
+
+  int one = 1;
+  struct linger ling = {0, 0};
+
+  // Keepalive to ensure full result flushing
+  setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, const_cast_sockopt(&one), sizeof(one));
+
+  // Turn linger off to avoid hung sockets
+  setsockopt(s, SOL_SOCKET, SO_LINGER, const_cast_sockopt(&ling), sizeof(ling));
+
+  // Set TCP nodelay if available, MAC OS X Hack
+  // See http://lists.danga.com/pipermail/memcached/2005-March/001240.html
+  #ifndef TCP_NOPUSH
+  setsockopt(s, IPPROTO_TCP, TCP_NODELAY, const_cast_sockopt(&one), sizeof(one));
+  #endif
+
+  #ifdef TCP_LOW_MIN_RTO
+  if (TSocket::getUseLowMinRto()) {
+    setsockopt(s, IPPROTO_TCP, TCP_LOW_MIN_RTO, const_cast_sockopt(&one), sizeof(one));
+  }
+  #endif
+
+  #ifdef TCP_DEFER_ACCEPT
+  if (tcpDeferAccept_ > 0) {
+    setsockopt(s, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+               const_cast_sockopt(&tcpDeferAccept_), sizeof(tcpDeferAccept_));
+  }
+  #endif
+
+  // Must be set before listen()
+  if (tcpFastOpen_ > 0) {
+  #ifdef TCP_FASTOPEN
+    if (-1 == setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN,
+                         const_cast_sockopt(&tcpFastOpen_), sizeof(tcpFastOpen_))) {
+      GlobalOutput.perror("TNonblockingServer: TCP_FASTOPEN ", THRIFT_GET_SOCKET_ERROR);
+    }
+  #else
+    GlobalOutput.printf("TNonblockingServer: TCP_FASTOPEN is not supported");
+  #endif
+  }
+
+  #ifdef SO_BUSY_POLL
+  if (busyPoll_ > 0) {
+    setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, const_cast_sockopt(&busyPoll_), sizeof(busyPoll_));
+  }
+  #endif
+
+  #ifdef SO_INCOMING_CPU
+  if (incomingCpu_ >= 0) {
+    setsockopt(s, SOL_SOCKET, SO_INCOMING_CPU,
+               const_cast_sockopt(&incomingCpu_), sizeof(incomingCpu_));
+  }
+  #endif
+
+  if (listen(s, LISTEN_BACKLOG) == -1) {
+    ::THRIFT_CLOSESOCKET(s);
+    throw TException("TNonblockingServer::serve() listen");
+  }
+}
+
+void TNonblockingServer::addListener(
+    int port,
+    const boost::shared_ptr<TProcessorFactory>& processorFactory,
+    const boost::shared_ptr<TTransportFactory>& inputTransportFactory,
+    const boost::shared_ptr<TTransportFactory>& outputTransportFactory,
+    const boost::shared_ptr<TProtocolFactory>& inputProtocolFactory,
+    const boost::shared_ptr<TProtocolFactory>& outputProtocolFactory) {
+  shared_ptr<Listener> listener(new Listener);
+  listener->port = port;
+  listener->socket = THRIFT_INVALID_SOCKET;
+  listener->processorFactory = processorFactory;
+  listener->inputTransportFactory = inputTransportFactory;
+  listener->outputTransportFactory = outputTransportFactory;
+  listener->inputProtocolFactory = inputProtocolFactory;
+  listener->outputProtocolFactory = outputProtocolFactory;
+  listeners_.push_back(listener);
+}
+
+const TNonblockingServer::Listener* TNonblockingServer::findListener(
+    THRIFT_SOCKET fd) const {
+  for (size_t i = 0; i < listeners_.size(); ++i) {
+    if (listeners_[i]->socket == fd) {
+      return listeners_[i].get();
+    }
+  }
+  return &serverListener_;
+}
+
+const TNonblockingServer::Listener* TNonblockingServer::findListenerByPort(
+    int port) const {
+  for (size_t i = 0; i < listeners_.size(); ++i) {
+    if (listeners_[i]->port == port && port > 0) {
+      return listeners_[i].get();
+    }
+  }
+  return &serverListener_;
+}
+
+void TNonblockingServer::takeOver(const std::string& path) {
+  if (serverSocket_ != THRIFT_INVALID_SOCKET) {
+    throw TException("TNonblockingServer::takeOver(): already has a listen socket");
+  }
+
+  shared_ptr<TSocket> predecessor(new TSocket(path));
+  predecessor->open();
+
+  // The first batch is the listen sockets, in IO thread order
+  std::vector<THRIFT_SOCKET> fds;
+  if (!predecessor->receiveDescriptors(&fds) || fds.empty()) {
+    throw TException("TNonblockingServer::takeOver(): no listen socket received");
+  }
+  for (size_t i = 0; i < fds.size(); ++i) {
+    try {
+      prepareListenSocket(fds[i]);
+    } catch (...) {
+      // prepareListenSocket() closed fds[i]
+      for (size_t j = 0; j < fds.size(); ++j) {
+        if (j != i) {
+          ::THRIFT_CLOSESOCKET(fds[j]);
+        }
+      }
+      throw;
+    }
+  }
+  GlobalOutput.printf("TNonblockingServer: took over %d listen sockets from %s",
+                      (int)fds.size(), path.c_str());
+
+  // A socket on the port of one of our listeners is that listener's, and
+  // the rest are for the server's port, one per IO thread
+  std::vector<THRIFT_SOCKET> serverSockets;
+  for (size_t i = 0; i < fds.size(); ++i) {
+    int port = localPort(fds[i]);
+    size_t j = 0;
+    while (j < listeners_.size() &&
+           !(port > 0 && listeners_[j]->port == port &&
+             listeners_[j]->socket == THRIFT_INVALID_SOCKET)) {
+      ++j;
+    }
+    if (j < listeners_.size()) {
+      listeners_[j]->socket = fds[i];
+    } else if (port_ == 0 || port == port_) {
+      serverSockets.push_back(fds[i]);
+    } else {
+      GlobalOutput.printf("TNonblockingServer: no listener for port %d taken over", port);
+      ::THRIFT_CLOSESOCKET(fds[i]);
+    }
+  }
+  if (serverSockets.empty()) {
+    throw TException("TNonblockingServer::takeOver(): no listen socket for the server's port");
+  }
+
+  serverSocket_ = serverSockets[0];
+  inheritedSockets_.assign(serverSockets.begin() + 1, serverSockets.end());
+  predecessor_ = predecessor;
+}
+
+void TNonblockingServer::createRestartSocket() {
+#ifdef HAVE_SYS_UN_H
+  sockaddr_un address;
+  if (hotRestartPath_.size() >= sizeof(address.sun_path)) {
+    throw TException("TNonblockingServer: hot restart path too long");
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, hotRestartPath_.data(), hotRestartPath_.size());
+
+  THRIFT_SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (s == THRIFT_INVALID_SOCKET) {
+    GlobalOutput.perror("TNonblockingServer: restart socket ", THRIFT_GET_SOCKET_ERROR);
+    throw TException("TNonblockingServer: could not create restart socket");
+  }
+
+  // Whatever is at the path is left by a server that is gone, or one we
+  // have taken over from, which no longer listens there
+  ::unlink(hotRestartPath_.c_str());
+
+  int flags;
+  if (bind(s, (sockaddr*)&address, sizeof(address)) == -1 ||
+      listen(s, 1) == -1 ||
+      (flags = THRIFT_FCNTL(s, THRIFT_F_GETFL, 0)) < 0 ||
+      THRIFT_FCNTL(s, THRIFT_F_SETFL, flags | THRIFT_O_NONBLOCK) < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    ::THRIFT_CLOSESOCKET(s);
+    GlobalOutput.perror("TNonblockingServer: restart socket ", errno_copy);
+    throw TException("TNonblockingServer: could not listen for a successor");
+  }
+  restartSocket_ = s;
+#else
+  throw TException("TNonblockingServer: hot restart needs Unix domain sockets");
+#endif
+}
+
+void TNonblockingServer::acceptSuccessor() {
+  THRIFT_SOCKET s = ::accept(restartSocket_, NULL, NULL);
+  if (s == THRIFT_INVALID_SOCKET) {
+    if (THRIFT_GET_SOCKET_ERROR != THRIFT_EAGAIN &&
+        THRIFT_GET_SOCKET_ERROR != THRIFT_EWOULDBLOCK) {
+      GlobalOutput.perror("TNonblockingServer: restart accept() ", THRIFT_GET_SOCKET_ERROR);
+    }
+    return;
+  }
+  shared_ptr<TSocket> successor(new TSocket(s));
 
-  // Wildcard address
-  error = getaddrinfo(NULL, port, &hints, &res0);
-  if (error) {
-    throw TException("TNonblockingServer::serve() getaddrinfo " +
-                     string(THRIFT_GAI_STRERROR(error)));
+  std::vector<THRIFT_SOCKET> fds;
+  for (size_t i = 0; i < ioThreads_.size(); ++i) {
+    if (ioThreads_[i]->getListenSocket() != THRIFT_INVALID_SOCKET) {
+      fds.push_back(ioThreads_[i]->getListenSocket());
+    }
+  }
+  for (size_t i = 0; i < listeners_.size(); ++i) {
+    fds.push_back(listeners_[i]->socket);
+  }
+  try {
+    successor->sendDescriptors(fds);
+  } catch (TTransportException& te) {
+    // Carry on serving; another successor may try again
+    GlobalOutput.printf("TNonblockingServer: hot restart failed: %s", te.what());
+    return;
+  }
+  GlobalOutput.printf("TNonblockingServer: handed %d listen sockets over", (int)fds.size());
+
+  // Without connections to pass, dropping the channel tells the successor
+  // there are none
+  if (passConnections_) {
+    Guard g(successorMutex_);
+    successor_ = successor;
+  }
+  drain();
+}
+
+bool TNonblockingServer::receiveConnections(TNonblockingIOThread* acceptThread) {
+  std::vector<THRIFT_SOCKET> fds;
+  bool more;
+  try {
+    more = predecessor_->receiveDescriptors(&fds);
+  } catch (TTransportException& te) {
+    GlobalOutput.printf("TNonblockingServer: receiving connections: %s", te.what());
+    more = false;
+  }
+
+  for (size_t i = 0; i < fds.size(); ++i) {
+    sockaddr_storage addrStorage;
+    socklen_t addrLen = sizeof(addrStorage);
+    if (getpeername(fds[i], (sockaddr*)&addrStorage, &addrLen) == -1) {
+      // The client has gone meanwhile
+      ::THRIFT_CLOSESOCKET(fds[i]);
+      continue;
+    }
+
+    // The predecessor made it nonblocking, and that is shared with us.  It
+    // goes to any IO thread, even with a listen socket each.
+    adoptSocket(fds[i], (sockaddr*)&addrStorage, addrLen,
+                findListenerByPort(localPort(fds[i])), selectIOThread(NULL),
+                acceptThread);
+  }
+  if (!more) {
+    GlobalOutput.printf("TNonblockingServer: all connections taken over");
+  }
+  return more;
+}
+
+bool TNonblockingServer::passConnection(THRIFT_SOCKET fd) {
+  Guard g(successorMutex_);
+  if (!successor_) {
+    return false;
+  }
+  try {
+    successor_->sendDescriptors(std::vector<THRIFT_SOCKET>(1, fd));
+  } catch (TTransportException& te) {
+    GlobalOutput.printf("TNonblockingServer: passing a connection: %s", te.what());
+    successor_.reset();
+    return false;
+  }
+  return true;
+}
+
+void TNonblockingServer::drain() {
+  {
+    Guard g(connMutex_);
+    if (draining_ || ioThreads_.empty()) {
+      return;
+    }
+    draining_ = true;
+  }
+  GlobalOutput.printf("TNonblockingServer: draining %d connections",
+                      (int)getNumActiveConnections());
+  for (size_t i = 0; i < ioThreads_.size(); ++i) {
+    ioThreads_[i]->drain();
+  }
+}
+
+void TNonblockingServer::ioThreadDrained() {
+  {
+    Guard g(connMutex_);
+    if (++drainedIOThreads_ < ioThreads_.size()) {
+      return;
+    }
+  }
+
+  // Closing the channel tells the successor it has everything
+  {
+    Guard g(successorMutex_);
+    successor_.reset();
+  }
+  stop();
+}
+
+bool TNonblockingServer::reserveMemory(uint64_t bytes) {
+  Guard g(memoryMutex_);
+  if (memoryInUse_ == 0 ||
+      (memoryInUse_ < memoryBudget_ && bytes <= memoryBudget_ - memoryInUse_)) {
+    memoryInUse_ += bytes;
+    return true;
+  }
+  ++memoryWaiters_;
+  return false;
+}
+
+void TNonblockingServer::chargeMemory(int64_t delta) {
+  {
+    Guard g(memoryMutex_);
+    memoryInUse_ += delta;
+    if (delta >= 0 || memoryWaiters_ == 0 || memoryWakeSent_ ||
+        memoryInUse_ >= memoryBudget_) {
+      return;
+    }
+    memoryWakeSent_ = true;
+  }
+
+  // The IO threads don't say whose the waiters are, and there are few
+  for (size_t i = 0; i < ioThreads_.size(); ++i) {
+    ioThreads_[i]->resumeMemoryWaiters();
+  }
+}
+
+void TNonblockingServer::leaveMemoryWait() {
+  Guard g(memoryMutex_);
+  --memoryWaiters_;
+}
+
+void TNonblockingServer::memoryWakeTaken() {
+  Guard g(memoryMutex_);
+  memoryWakeSent_ = false;
+}
+
+void TNonblockingServer::setThreadManager(boost::shared_ptr<ThreadManager> threadManager) {
+  threadManager_ = threadManager;
+  if (threadManager) {
+    threadManager->setExpireCallback(apache::thrift::stdcxx::bind(&TNonblockingServer::expireClose, this, apache::thrift::stdcxx::placeholders::_1));
+    threadPoolProcessing_ = true;
+  } else {
+    threadPoolProcessing_ = false;
+  }
+}
+
+void TNonblockingServer::setServiceThreadManager(
+    const std::string& name, boost::shared_ptr<ThreadManager> threadManager) {
+  if (threadManager) {
+    threadManager->setExpireCallback(apache::thrift::stdcxx::bind(&TNonblockingServer::expireClose, this, apache::thrift::stdcxx::placeholders::_1));
+    serviceThreadManagers_[name] = threadManager;
+  } else {
+    serviceThreadManagers_.erase(name);
+  }
+}
+
+ThreadManager* TNonblockingServer::getServiceThreadManager(const std::string& name) const {
+  std::map<std::string, boost::shared_ptr<ThreadManager> >::const_iterator it =
+    serviceThreadManagers_.find(name);
+  if (it == serviceThreadManagers_.end()) {
+    std::string::size_type colon = name.find(':');
+    if (colon == std::string::npos) {
+      return NULL;
+    }
+    it = serviceThreadManagers_.find(name.substr(0, colon));
+  }
+  return it == serviceThreadManagers_.end() ? NULL : it->second.get();
+}
+
+void TNonblockingServer::setIOThreadManagers(
+    const std::vector<boost::shared_ptr<ThreadManager> >& ioThreadManagers) {
+  ioThreadManagers_ = ioThreadManagers;
+  for (size_t i = 0; i < ioThreadManagers_.size(); ++i) {
+    if (ioThreadManagers_[i]) {
+      ioThreadManagers_[i]->setExpireCallback(apache::thrift::stdcxx::bind(&TNonblockingServer::expireClose, this, apache::thrift::stdcxx::placeholders::_1));
+    }
+  }
+}
+
+bool  TNonblockingServer::serverOverloaded() {
+  size_t activeConnections = getNumActiveConnections();
+  // Pipelined connections ask from every IO thread
+  Guard g(connMutex_);
+  if (numActiveProcessors_ > maxActiveProcessors_ ||
+      activeConnections > maxConnections_) {
+    if (!overloaded_) {
+       GlobalOutput.printf("TNonblockingServer: overload condition begun.");
+      overloaded_ = true;
+    }
+  } else {
+    if (overloaded_ &&
+        (numActiveProcessors_ <= overloadHysteresis_ * maxActiveProcessors_) &&
+        (activeConnections <= overloadHysteresis_ * maxConnections_)) {
+      GlobalOutput.printf("TNonblockingServer: overload ended; "
+                          "%u dropped (%llu total)",
+                          nConnectionsDropped_, nTotalConnectionsDropped_);
+      nConnectionsDropped_ = 0;
+      overloaded_ = false;
+    }
+  }
+
+  return overloaded_;
+}
+
+bool TNonblockingServer::drainPendingTask() {
+  std::map<std::string, boost::shared_ptr<ThreadManager> >::const_iterator service =
+    serviceThreadManagers_.begin();
+  for (size_t i = 0; i <= ioThreadManagers_.size() + serviceThreadManagers_.size(); ++i) {
+    boost::shared_ptr<ThreadManager> threadManager;
+    if (i == 0) {
+      threadManager = threadManager_;
+    } else if (i <= ioThreadManagers_.size()) {
+      threadManager = ioThreadManagers_[i - 1];
+    } else {
+      threadManager = (service++)->second;
+    }
+    if (!threadManager) {
+      continue;
+    }
+    boost::shared_ptr<Runnable> task = threadManager->removeNextPending();
+    if (task) {
+      TConnection::Task* connectionTask =
+        static_cast<TConnection::Task*>(task.get());
+      TConnection* connection = connectionTask->getTConnection();
+      connectionTask->drop();
+      assert(connection && connection->getServer()
+             && (connection->getState() == APP_WAIT_TASK
+                 || connection->isPipelined()));
+      if (connectionTask->getCall()) {
+        connection->abandonCall(connectionTask->getCall());
+      } else {
+        connection->forceClose();
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void TNonblockingServer::expireClose(boost::shared_ptr<Runnable> task) {
+  TConnection::Task* connectionTask =
+    static_cast<TConnection::Task*>(task.get());
+  TConnection* connection = connectionTask->getTConnection();
+  connectionTask->drop();
+  assert(connection && connection->getServer() &&
+         (connection->getState() == APP_WAIT_TASK ||
+          connection->isPipelined()));
+  if (connectionTask->getCall()) {
+    connection->abandonCall(connectionTask->getCall());
+  } else {
+    connection->forceClose();
+  }
+}
+
+void TNonblockingServer::stop() {
+  // Breaks the event loop in all threads so that they end ASAP.
+  for (uint32_t i = 0; i < ioThreads_.size(); ++i) {
+    ioThreads_[i]->stop();
+  }
+}
+
+/// Touches bytes of stack a page at a time, so all of it is mapped
+static void touchStack(size_t bytes) {
+  volatile uint8_t page[4096];
+  page[0] = 0;
+  if (bytes > sizeof(page)) {
+    touchStack(bytes - sizeof(page));
+  }
+  // Using the page after the call keeps it from becoming a jump
+  page[sizeof(page) - 1] = page[0];
+}
+
+/**
+ * Touches the stack of one ThreadManager worker.  Each waits for the rest
+ * to start, so no worker runs two of them.
+ */
+class StackWarmer : public Runnable {
+ public:
+  struct Latch {
+    Monitor monitor;
+    size_t waiting;
+  };
+
+  StackWarmer(const boost::shared_ptr<Latch>& latch, size_t bytes)
+    : latch_(latch), bytes_(bytes) {}
+
+  void run() {
+    touchStack(bytes_);
+    Synchronized s(latch_->monitor);
+    if (--latch_->waiting == 0) {
+      latch_->monitor.notifyAll();
+    }
+    while (latch_->waiting > 0) {
+      if (latch_->monitor.waitForTimeRelative(WAIT_MS) != 0) {
+        break;
+      }
+    }
+  }
+
+  /// How long anyone waits for the workers to start
+  static const int64_t WAIT_MS = 1000;
+
+ private:
+  boost::shared_ptr<Latch> latch_;
+  size_t bytes_;
+};
+
+const int64_t StackWarmer::WAIT_MS;
+
+void TNonblockingServer::warmUp() {
+  if (warmupStackBytes_ > 0 && threadManager_ &&
+      threadManager_->state() == ThreadManager::STARTED) {
+    boost::shared_ptr<StackWarmer::Latch> latch = boost::make_shared<StackWarmer::Latch>();
+    size_t workers = threadManager_->workerCount();
+    latch->waiting = workers;
+    try {
+      for (size_t i = 0; i < workers; ++i) {
+        threadManager_->add(boost::make_shared<StackWarmer>(latch, warmupStackBytes_));
+      }
+      Synchronized s(latch->monitor);
+      while (latch->waiting > 0) {
+        if (latch->monitor.waitForTimeRelative(StackWarmer::WAIT_MS) != 0) {
+          GlobalOutput.printf("TNonblockingServer: %d workers did not warm "
+                              "their stacks in time", (int)latch->waiting);
+          break;
+        }
+      }
+    } catch (const TException& e) {
+      GlobalOutput.printf("TNonblockingServer: could not warm worker stacks: %s",
+                          e.what());
+    }
+  }
+
+  // An asynchronous processor answers through callbacks that need a
+  // connection, so only the plain one can be run here
+  if (warmupRequestCount_ > 0 && processorFactory_) {
+    for (uint32_t i = 0; i < warmupRequestCount_; ++i) {
+      try {
+        boost::shared_ptr<TMemoryBuffer> input = boost::make_shared<TMemoryBuffer>(
+          reinterpret_cast<uint8_t*>(const_cast<char*>(warmupRequest_.data())),
+          static_cast<uint32_t>(warmupRequest_.size()));
+        boost::shared_ptr<TMemoryBuffer> output = boost::make_shared<TMemoryBuffer>();
+        TConnectionInfo connInfo;
+        connInfo.input = inputProtocolFactory_->getProtocol(
+                           inputTransportFactory_->getTransport(input));
+        connInfo.output = outputProtocolFactory_->getProtocol(
+                            outputTransportFactory_->getTransport(output));
+        connInfo.transport = input;
+        processorFactory_->getProcessor(connInfo)->process(connInfo.input,
+                                                           connInfo.output, NULL);
+      } catch (const std::exception& e) {
+        GlobalOutput.printf("TNonblockingServer: warmup request failed: %s",
+                            e.what());
+        break;
+      }
+    }
+  }
+}
+
+void TNonblockingServer::registerEvents(event_base* user_event_base) {
+  userEventBase_ = user_event_base;
+
+  if (sslSocketFactory_ && !sslSocketFactory_->server()) {
+    // A client mode factory would give the sockets a client access manager
+    throw TException("TNonblockingServer: SSL socket factory not in server mode");
+  }
+
+  #ifndef SO_REUSEPORT
+  if (useReusePort_) {
+    GlobalOutput.printf("TNonblockingServer: SO_REUSEPORT is not supported, "
+                        "accepting on IO thread #0 only");
+    useReusePort_ = false;
+  }
+  #endif
+
+  // Before the listen socket exists, so no client waits on it
+  warmUp();
+
+  if (!hotRestartPath_.empty()) {
+    createRestartSocket();
+  }
+
+  // init listen socket
+  if (serverSocket_ == THRIFT_INVALID_SOCKET) {
+    createAndListenOnSocket();
+  } else if (!inheritedSockets_.empty()) {
+    // The predecessor had a listen socket per IO thread, so we need as many
+    useReusePort_ = true;
+    numIOThreads_ = std::max(numIOThreads_, inheritedSockets_.size() + 1);
+  } else if (useReusePort_) {
+    // We can't tell whether a socket we were given will share its port
+    GlobalOutput.printf("TNonblockingServer: SO_REUSEPORT ignored for a "
+                        "supplied listen socket");
+    useReusePort_ = false;
+  }
+
+  if (port_ == 0) {
+    // For getPort(), and the other IO threads have to bind to the port we
+    // were given
+    port_ = std::max(localPort(serverSocket_), 0);
+  }
+
+  serverListener_.port = port_;
+  serverListener_.socket = serverSocket_;
+  serverListener_.processorFactory = processorFactory_;
+  serverListener_.asyncProcessorFactory = asyncProcessorFactory_;
+  serverListener_.inputTransportFactory = inputTransportFactory_;
+  serverListener_.outputTransportFactory = outputTransportFactory_;
+  serverListener_.inputProtocolFactory = inputProtocolFactory_;
+  serverListener_.outputProtocolFactory = outputProtocolFactory_;
+
+  for (size_t i = 0; i < listeners_.size(); ++i) {
+    if (listeners_[i]->socket == THRIFT_INVALID_SOCKET) {
+      THRIFT_SOCKET s = createBoundSocket(listeners_[i]->port);
+      prepareListenSocket(s);
+      listeners_[i]->socket = s;
+      if (listeners_[i]->port == 0) {
+        listeners_[i]->port = std::max(localPort(s), 0);
+      }
+    }
+    GlobalOutput.printf("TNonblockingServer: listening on port %d as well",
+                        listeners_[i]->port);
+  }
+
+  // set up the IO threads
+  assert(ioThreads_.empty());
+  if (!numIOThreads_) {
+    numIOThreads_ = DEFAULT_IO_THREADS;
+  }
+
+  for (uint32_t id = 0; id < numIOThreads_; ++id) {
+    // the first IO thread also does the listening on server socket, and
+    // with SO_REUSEPORT the others listen on sockets of their own
+    THRIFT_SOCKET listenFd = THRIFT_INVALID_SOCKET;
+    if (id == 0) {
+      listenFd = serverSocket_;
+    } else if (id <= inheritedSockets_.size()) {
+      listenFd = inheritedSockets_[id - 1];
+    } else if (useReusePort_) {
+      listenFd = createBoundSocket(port_);
+      prepareListenSocket(listenFd);
+    }
+
+    shared_ptr<TNonblockingIOThread> thread(
+      new TNonblockingIOThread(this, id, listenFd, useHighPriorityIOThreads_));
+    ioThreads_.push_back(thread);
+  }
+  inheritedSockets_.clear();
+
+  // Notify handler of the preServe event
+  if (eventHandler_) {
+    eventHandler_->preServe();
+  }
+
+  // Start all of our helper IO threads. Note that the threads run forever,
+  // only terminating if stop() is called.
+  assert(ioThreads_.size() == numIOThreads_);
+  assert(ioThreads_.size() > 0);
+
+  GlobalOutput.printf(T_OUTPUT_INFO, "TNonblockingServer: Serving on port %d, %d io threads.",
+               port_, ioThreads_.size());
+
+  // Launch all the secondary IO threads in separate threads
+  if (ioThreads_.size() > 1) {
+    ioThreadFactory_.reset(new PlatformThreadFactory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+      PlatformThreadFactory::OTHER,  // scheduler
+      PlatformThreadFactory::NORMAL, // priority
+      1,                          // stack size (MB)
+#endif
+      false                       // detached
+    ));
+
+    assert(ioThreadFactory_.get());
+
+    // intentionally starting at thread 1, not 0
+    for (uint32_t i = 1; i < ioThreads_.size(); ++i) {
+      shared_ptr<Thread> thread = ioThreadFactory_->newThread(ioThreads_[i]);
+      ioThreads_[i]->setThread(thread);
+      thread->start();
+    }
+
+    // Thread 0 starts accepting, or taking connections over, at once, and
+    // hands some to the others
+    for (uint32_t i = 1; i < ioThreads_.size(); ++i) {
+      ioThreads_[i]->waitForEvents();
+    }
+  }
+
+  // Register the events for the primary (listener) IO thread
+  ioThreads_[0]->registerEvents();
+}
+
+/**
+ * Main workhorse function, starts up the server listening on a port and
+ * loops over the libevent handler.
+ */
+void TNonblockingServer::serve() {
+
+  registerEvents(NULL);
+
+  // Run the primary (listener) IO thread loop in our main thread; this will
+  // only return when the server is shutting down.
+  ioThreads_[0]->run();
+
+  // Ensure all threads are finished before exiting serve()
+  for (uint32_t i = 0; i < ioThreads_.size(); ++i) {
+    ioThreads_[i]->join();
+    GlobalOutput.printf(T_OUTPUT_INFO, "TNonblocking: join done for IO thread #%d", i);
+  }
+
+  // Drained connections are closed, but tasks that expired or were shed
+  // may still be queued or running
+  if (draining_) {
+    if (threadManager_) {
+      threadManager_->join();
+    }
+    for (size_t i = 0; i < ioThreadManagers_.size(); ++i) {
+      if (ioThreadManagers_[i]) {
+        ioThreadManagers_[i]->join();
+      }
+    }
+    std::map<std::string, boost::shared_ptr<ThreadManager> >::const_iterator it;
+    for (it = serviceThreadManagers_.begin(); it != serviceThreadManagers_.end(); ++it) {
+      it->second->join();
+    }
   }
+}
 
-  // Pick the ipv6 address first since ipv4 addresses can be mapped
-  // into ipv6 space.
-  for (res = res0; res; res = res->ai_next) {
-    if (res->ai_family == AF_INET6 || res->ai_next == NULL)
-      break;
+TNonblockingIOThread::TNonblockingIOThread(TNonblockingServer* server,
+                                           int number,
+                                           THRIFT_SOCKET listenSocket,
+                                           bool useHighPriority)
+      : server_(server)
+      , number_(number)
+      , listenSocket_(listenSocket)
+      , useHighPriority_(useHighPriority)
+      , notifyWakePending_(false)
+      , drainPending_(false)
+      , memoryResumePending_(false)
+      , draining_(false)
+      , drained_(false)
+      , statsRequested_(0)
+      , statsWithConnections_(false)
+      , statsTaken_(0)
+      , statsServed_(0)
+      , recvBuffer_(RECV_BUFFER_SIZE)
+      , eventsRegistered_(false)
+      , numConnections_(0)
+      , numCachedConnections_(0)
+      , pendingBytes_(0)
+      , activeFirst_(NULL) {
+  notificationPipeFDs_[0] = -1;
+  notificationPipeFDs_[1] = -1;
+  for (int wait = 0; wait < WAIT_KINDS; ++wait) {
+    waitFirst_[wait] = NULL;
+    waitLast_[wait] = NULL;
   }
+  if (server_->getUseBufferPool()) {
+    bufferPool_.reset(new TBufferPool(TBufferPool::DEFAULT_MAX_CLASS_SIZE,
+                                      server_->getBufferPoolLimit()));
+  }
+}
 
-  // Create the server socket
-  s = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-  if (s == -1) {
-    freeaddrinfo(res0);
-    throw TException("TNonblockingServer::serve() socket() -1");
+TNonblockingIOThread::~TNonblockingIOThread() {
+  // make sure our associated thread is fully finished
+  join();
+
+  if (listenSocket_ >= 0) {
+    if (0 != ::THRIFT_CLOSESOCKET(listenSocket_)) {
+      GlobalOutput.perror("TNonblockingIOThread listenSocket_ close(): ",
+                          THRIFT_GET_SOCKET_ERROR);
+    }
+    listenSocket_ = THRIFT_INVALID_SOCKET;
   }
 
-  #ifdef IPV6_V6ONLY
-  if (res->ai_family == AF_INET6) {
-    int zero = 0;
-    if (-1 == setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, const_cast_sockopt(&zero), sizeof(zero))) {
-      GlobalOutput("TServerSocket::listen() IPV6_V6ONLY");
+  if (notificationPipeFDs_[1] == notificationPipeFDs_[0]) {
+    // An eventfd serves as both ends
+    notificationPipeFDs_[1] = THRIFT_INVALID_SOCKET;
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (notificationPipeFDs_[i] >= 0) {
+      if (0 != ::THRIFT_CLOSESOCKET(notificationPipeFDs_[i])) {
+        GlobalOutput.perror("TNonblockingIOThread notificationPipe close(): ",
+                            THRIFT_GET_SOCKET_ERROR);
+      }
+      notificationPipeFDs_[i] = THRIFT_INVALID_SOCKET;
     }
   }
-  #endif // #ifdef IPV6_V6ONLY
+}
 
+void TNonblockingIOThread::createNotificationPipe() {
+#if defined(HAVE_SYS_EVENTFD_H) && defined(EFD_NONBLOCK) && defined(EFD_CLOEXEC)
+  // An eventfd is a single descriptor holding a counter, so a wakeup is
+  // one 8-byte write and draining any number of them is one read.
+  int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (efd >= 0) {
+    notificationPipeFDs_[0] = efd;
+    notificationPipeFDs_[1] = efd;
+    return;
+  }
+  GlobalOutput.perror("TNonblockingServer::createNotificationPipe eventfd ", errno);
+#endif
+  if(evutil_socketpair(AF_LOCAL, SOCK_STREAM, 0, notificationPipeFDs_) == -1) {
+    GlobalOutput.perror("TNonblockingServer::createNotificationPipe ", EVUTIL_SOCKET_ERROR());
+    throw TException("can't create notification pipe");
+  }
+  if(evutil_make_socket_nonblocking(notificationPipeFDs_[0])<0 ||
+     evutil_make_socket_nonblocking(notificationPipeFDs_[1])<0) {
+    ::THRIFT_CLOSESOCKET(notificationPipeFDs_[0]);
+    ::THRIFT_CLOSESOCKET(notificationPipeFDs_[1]);
+    throw TException("TNonblockingServer::createNotificationPipe() THRIFT_O_NONBLOCK");
+  }
+  for (int i = 0; i < 2; ++i) {
+#if LIBEVENT_VERSION_NUMBER < 0x02000000
+    int flags;
+    if ((flags = THRIFT_FCNTL(notificationPipeFDs_[i], F_GETFD, 0)) < 0 ||
+        THRIFT_FCNTL(notificationPipeFDs_[i], F_SETFD, flags | FD_CLOEXEC) < 0) {
+#else
+    if (evutil_make_socket_closeonexec(notificationPipeFDs_[i]) < 0) {
+#endif
+      ::THRIFT_CLOSESOCKET(notificationPipeFDs_[0]);
+      ::THRIFT_CLOSESOCKET(notificationPipeFDs_[1]);
+      throw TException("TNonblockingServer::createNotificationPipe() "
+        "FD_CLOEXEC");
+    }
+  }
+}
 
-  int one = 1;
+/**
+ * Register the core libevent events onto the proper base.
+ */
+void TNonblockingIOThread::registerEvents() {
+  threadId_ = Thread::get_current();
 
-  // Set THRIFT_NO_SOCKET_CACHING to avoid 2MSL delay on server restart
-  setsockopt(s, SOL_SOCKET, THRIFT_NO_SOCKET_CACHING, const_cast_sockopt(&one), sizeof(one));
+  assert(!eventLoop_);
+  if (getServer()->getUserEventBase() != NULL) {
+    eventLoop_ = TEventLoop::wrap(getServer()->getUserEventBase());
+  } else {
+    eventLoop_ = TEventLoop::create(getServer()->getEventLoopBackend());
+  }
 
-  if (::bind(s, res->ai_addr, static_cast<int>(res->ai_addrlen)) == -1) {
-    ::THRIFT_CLOSESOCKET(s);
-    freeaddrinfo(res0);
-    throw TTransportException(TTransportException::NOT_OPEN,
-                              "TNonblockingServer::serve() bind",
-                              THRIFT_GET_SOCKET_ERROR);
+  if (number_ == 0) {
+    GlobalOutput.printf("TNonblockingServer: using %s",
+                        eventLoop_->getMethod().c_str());
   }
 
-  // Done with the addr info
-  freeaddrinfo(res0);
+  if (listenSocket_ >= 0) {
+    // Register the server event.  handleEvent() accepts until the socket
+    // would block, so edge triggering is safe.
+    serverEvent_.fd = listenSocket_;
+    serverEvent_.flags = TEventLoop::READ | TEventLoop::EDGE;
+    serverEvent_.callback = TNonblockingIOThread::listenHandler;
+    serverEvent_.arg = this;
 
-  // Set up this file descriptor for listening
-  listenSocket(s);
-}
+    // Add the event and start up the server
+    if (!eventLoop_->add(&serverEvent_)) {
+      throw TException("TNonblockingServer::serve(): "
+                       "could not add server listen event");
+    }
+    GlobalOutput.printf("TNonblocking: IO thread #%d registered for listen.",
+                        number_);
+  }
 
-/**
- * Takes a socket created by listenSocket() and sets various options on it
- * to prepare for use in the server.
- */
-void TNonblockingServer::listenSocket(THRIFT_SOCKET s) {
-  // Set socket to nonblocking mode
-  int flags;
-  if ((flags = THRIFT_FCNTL(s, THRIFT_F_GETFL, 0)) < 0 ||
-      THRIFT_FCNTL(s, THRIFT_F_SETFL, flags | THRIFT_O_NONBLOCK) < 0) {
-    ::THRIFT_CLOSESOCKET(s);
-    throw TException("TNonblockingServer::serve() THRIFT_O_NONBLOCK");
+  for (size_t i = 0; number_ == 0 && i < server_->listeners_.size(); ++i) {
+    // The same handler as the server's port; it tells them apart by fd
+    shared_ptr<TEventLoop::Event> event(new TEventLoop::Event);
+    event->fd = server_->listeners_[i]->socket;
+    event->flags = TEventLoop::READ | TEventLoop::EDGE;
+    event->callback = TNonblockingIOThread::listenHandler;
+    event->arg = this;
+    if (!eventLoop_->add(event.get())) {
+      throw TException("TNonblockingServer::serve(): "
+                       "could not add listener event");
+    }
+    listenerEvents_.push_back(event);
   }
 
-  int one = 1;
-  struct linger ling = {0, 0};
+  if (number_ == 0 && server_->restartSocket_ != THRIFT_INVALID_SOCKET) {
+    restartEvent_.fd = server_->restartSocket_;
+    restartEvent_.flags = TEventLoop::READ;
+    restartEvent_.callback = TNonblockingIOThread::restartHandler;
+    restartEvent_.arg = this;
+    if (!eventLoop_->add(&restartEvent_)) {
+      throw TException("TNonblockingServer::serve(): "
+                       "could not add hot restart event");
+    }
+  }
 
-  // Keepalive to ensure full result flushing
-  setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, const_cast_sockopt(&one), sizeof(one));
+  if (number_ == 0 && server_->predecessor_) {
+    predecessorEvent_.fd = server_->predecessor_->getSocketFD();
+    predecessorEvent_.flags = TEventLoop::READ;
+    predecessorEvent_.callback = TNonblockingIOThread::predecessorHandler;
+    predecessorEvent_.arg = this;
+    if (!eventLoop_->add(&predecessorEvent_)) {
+      throw TException("TNonblockingServer::serve(): "
+                       "could not add predecessor event");
+    }
+  }
 
-  // Turn linger off to avoid hung sockets
-  setsockopt(s, SOL_SOCKET, SO_LINGER, const_cast_sockopt(&ling), sizeof(ling));
+  createNotificationPipe();
 
-  // Set TCP nodelay if available, MAC OS X Hack
-  // See http://lists.danga.com/pipermail/memcached/2005-March/001240.html
-  #ifndef TCP_NOPUSH
-  setsockopt(s, IPPROTO_TCP, TCP_NODELAY, const_cast_sockopt(&one), sizeof(one));
-  #endif
+  // Create an event to be notified when a task finishes.  The handler
+  // drains the pipe as well.
+  notificationEvent_.fd = getNotificationRecvFD();
+  notificationEvent_.flags = TEventLoop::READ | TEventLoop::EDGE;
+  notificationEvent_.callback = TNonblockingIOThread::notifyHandler;
+  notificationEvent_.arg = this;
 
-  #ifdef TCP_LOW_MIN_RTO
-  if (TSocket::getUseLowMinRto()) {
-    setsockopt(s, IPPROTO_TCP, TCP_LOW_MIN_RTO, const_cast_sockopt(&one), sizeof(one));
+  // Add the event and start up the server
+  if (!eventLoop_->add(&notificationEvent_)) {
+    throw TException("TNonblockingServer::serve(): "
+                     "could not add task-done notification event");
   }
-  #endif
+  GlobalOutput.printf("TNonblocking: IO thread #%d registered for notify.",
+                      number_);
 
-  if (listen(s, LISTEN_BACKLOG) == -1) {
-    ::THRIFT_CLOSESOCKET(s);
-    throw TException("TNonblockingServer::serve() listen");
+  // Look for timed out connections and old idle ones four times in the
+  // shortest timeout, or every second for long ones
+  int64_t shortest = server_->getBufferTrimAge();
+  for (int wait = 0; wait < WAIT_KINDS; ++wait) {
+    int64_t timeout = waitTimeout(static_cast<Wait>(wait));
+    if (timeout > 0 && (shortest == 0 || timeout < shortest)) {
+      shortest = timeout;
+    }
+  }
+  if (shortest > 0) {
+    eventLoop_->setTick(std::max(std::min(shortest / 4, static_cast<int64_t>(1000)),
+                                 static_cast<int64_t>(10)),
+                        TNonblockingIOThread::tickHandler, this);
   }
 
-  // Cool, this socket is good to go, set it as the serverSocket_
-  serverSocket_ = s;
+  Synchronized s(eventsMonitor_);
+  eventsRegistered_ = true;
+  eventsMonitor_.notifyAll();
 }
 
-void TNonblockingServer::setThreadManager(boost::shared_ptr<ThreadManager> threadManager) {
-  threadManager_ = threadManager;
-  if (threadManager) {
-    threadManager->setExpireCallback(apache::thrift::stdcxx::bind(&TNonblockingServer::expireClose, this, apache::thrift::stdcxx::placeholders::_1));
-    threadPoolProcessing_ = true;
-  } else {
-    threadPoolProcessing_ = false;
+void TNonblockingIOThread::waitForEvents() {
+  Synchronized s(eventsMonitor_);
+  while (!eventsRegistered_) {
+    eventsMonitor_.wait();
   }
 }
 
-bool  TNonblockingServer::serverOverloaded() {
-  size_t activeConnections = numTConnections_ - connectionStack_.size();
-  if (numActiveProcessors_ > maxActiveProcessors_ ||
-      activeConnections > maxConnections_) {
-    if (!overloaded_) {
-       GlobalOutput.printf("TNonblockingServer: overload condition begun.");
-      overloaded_ = true;
+int64_t TNonblockingIOThread::waitTimeout(Wait wait) const {
+  switch (wait) {
+  case WAIT_IDLE:
+    return server_->getIdleTimeout();
+  case WAIT_HEADER:
+    return server_->getHeaderReadTimeout();
+  case WAIT_BODY:
+    return server_->getBodyReadTimeout();
+  default:
+    return 0;
+  }
+}
+
+void TNonblockingIOThread::setWait(TNonblockingServer::TConnection* conn, Wait wait) {
+  if (conn->waitDeadline_ != 0) {
+    Wait old = conn->wait_;
+    if (conn->waitPrev_) {
+      conn->waitPrev_->waitNext_ = conn->waitNext_;
+    } else {
+      waitFirst_[old] = conn->waitNext_;
     }
-  } else {
-    if (overloaded_ &&
-        (numActiveProcessors_ <= overloadHysteresis_ * maxActiveProcessors_) &&
-        (activeConnections <= overloadHysteresis_ * maxConnections_)) {
-      GlobalOutput.printf("TNonblockingServer: overload ended; "
-                          "%u dropped (%llu total)",
-                          nConnectionsDropped_, nTotalConnectionsDropped_);
-      nConnectionsDropped_ = 0;
-      overloaded_ = false;
+    if (conn->waitNext_) {
+      conn->waitNext_->waitPrev_ = conn->waitPrev_;
+    } else {
+      waitLast_[old] = conn->waitPrev_;
     }
+    conn->waitPrev_ = NULL;
+    conn->waitNext_ = NULL;
+    conn->waitDeadline_ = 0;
   }
 
-  return overloaded_;
+  conn->wait_ = wait;
+  int64_t timeout = waitTimeout(wait);
+  if (timeout <= 0) {
+    return;
+  }
+  conn->waitDeadline_ = Util::cachedTime() + timeout;
+  conn->waitPrev_ = waitLast_[wait];
+  if (waitLast_[wait]) {
+    waitLast_[wait]->waitNext_ = conn;
+  } else {
+    waitFirst_[wait] = conn;
+  }
+  waitLast_[wait] = conn;
 }
 
-bool TNonblockingServer::drainPendingTask() {
-  if (threadManager_) {
-    boost::shared_ptr<Runnable> task = threadManager_->removeNextPending();
-    if (task) {
-      TConnection* connection =
-        static_cast<TConnection::Task*>(task.get())->getTConnection();
-      assert(connection && connection->getServer()
-             && connection->getState() == APP_WAIT_TASK);
-      connection->forceClose();
-      return true;
+void TNonblockingIOThread::tickHandler(void* v) {
+  TNonblockingIOThread* ioThread = (TNonblockingIOThread*)v;
+  int64_t now = Util::tickCachedTime();
+  for (int wait = 0; wait < WAIT_KINDS; ++wait) {
+    // Closing a connection takes it off the list
+    TNonblockingServer::TConnection* conn;
+    while ((conn = ioThread->waitFirst_[wait]) != NULL &&
+           conn->waitDeadline_ <= now) {
+      conn->timeOut();
     }
   }
-  return false;
+
+  int64_t age = ioThread->server_->getBufferTrimAge();
+  std::deque<TNonblockingServer::TConnection*>& cache = ioThread->connectionCache_;
+  if (age > 0 && !cache.empty() && cache.front()->idleSince_ <= now - age) {
+    size_t freed = 0;
+    while (!cache.empty() && cache.front()->idleSince_ <= now - age) {
+      delete cache.front();
+      cache.pop_front();
+      ++freed;
+    }
+    atomicAdd(&ioThread->numCachedConnections_, -freed);
+  }
 }
 
-void TNonblockingServer::expireClose(boost::shared_ptr<Runnable> task) {
-  TConnection* connection =
-    static_cast<TConnection::Task*>(task.get())->getTConnection();
-  assert(connection && connection->getServer() &&
-         connection->getState() == APP_WAIT_TASK);
-  connection->forceClose();
+size_t TNonblockingIOThread::cacheLimit() const {
+  size_t limit = server_->getConnectionStackLimit();
+  size_t threads = server_->getNumIOThreads();
+  if (limit == 0 || threads <= 1) {
+    return limit;
+  }
+  return (limit + threads - 1) / threads;
 }
 
-void TNonblockingServer::stop() {
-  // Breaks the event loop in all threads so that they end ASAP.
-  for (uint32_t i = 0; i < ioThreads_.size(); ++i) {
-    ioThreads_[i]->stop();
+void TNonblockingIOThread::warmUp() {
+  size_t threads = std::max(server_->getNumIOThreads(), static_cast<size_t>(1));
+  size_t count = (server_->getWarmupConnections() + threads - 1) / threads;
+  size_t limit = cacheLimit();
+  if (limit > 0) {
+    count = std::min(count, limit);
+  }
+  while (connectionCache_.size() < count) {
+    connectionCache_.push_back(new TNonblockingServer::TConnection(this));
+    atomicAdd(&numCachedConnections_, 1);
+  }
+
+  if (bufferPool_ && server_->getWarmupBuffers() > 0) {
+    bufferPool_->prefill(server_->getWarmupBufferSize(), server_->getWarmupBuffers());
   }
 }
 
-void TNonblockingServer::registerEvents(event_base* user_event_base) {
-  userEventBase_ = user_event_base;
+void TNonblockingIOThread::startConnection(
+    THRIFT_SOCKET socket,
+    const sockaddr* addr,
+    socklen_t addrLen,
+    const TNonblockingServer::Listener* listener) {
+  TNonblockingServer::TConnection* conn;
+  if (connectionCache_.empty()) {
+    conn = new TNonblockingServer::TConnection(socket, this, addr, addrLen,
+                                               listener);
+  } else {
+    conn = connectionCache_.back();
+    connectionCache_.pop_back();
+    atomicAdd(&numCachedConnections_, static_cast<size_t>(-1));
+    conn->init(socket, this, addr, addrLen, listener);
+  }
 
-  // init listen socket
-  if (serverSocket_ == THRIFT_INVALID_SOCKET)
-    createAndListenOnSocket();
+  conn->activeNext_ = activeFirst_;
+  if (activeFirst_) {
+    activeFirst_->activePrev_ = conn;
+  }
+  activeFirst_ = conn;
 
-  // set up the IO threads
-  assert(ioThreads_.empty());
-  if (!numIOThreads_) {
-    numIOThreads_ = DEFAULT_IO_THREADS;
+  conn->step();
+}
+
+void TNonblockingIOThread::returnConnection(TNonblockingServer::TConnection* conn) {
+  if (conn->activePrev_) {
+    conn->activePrev_->activeNext_ = conn->activeNext_;
+  } else {
+    activeFirst_ = conn->activeNext_;
+  }
+  if (conn->activeNext_) {
+    conn->activeNext_->activePrev_ = conn->activePrev_;
+  }
+  conn->activePrev_ = NULL;
+  conn->activeNext_ = NULL;
+
+  size_t limit = cacheLimit();
+  if (limit > 0 && connectionCache_.size() >= limit) {
+    // Keep the one just used and free the one that has waited longest
+    delete connectionCache_.front();
+    connectionCache_.pop_front();
+    atomicAdd(&numCachedConnections_, static_cast<size_t>(-1));
   }
 
-  for (uint32_t id = 0; id < numIOThreads_; ++id) {
-    // the first IO thread also does the listening on server socket
-    THRIFT_SOCKET listenFd = (id == 0 ? serverSocket_ : THRIFT_INVALID_SOCKET);
+  // With an age set the tick frees what waits too long, so the buffers are
+  // kept for the next connection; otherwise they are trimmed now
+  if (server_->getBufferTrimAge() > 0) {
+    conn->idleSince_ = Util::cachedTime();
+  } else {
+    conn->checkIdleBufferMemLimit(server_->getIdleReadBufferLimit(),
+                                  server_->getIdleWriteBufferLimit());
+  }
+  connectionCache_.push_back(conn);
+  atomicAdd(&numCachedConnections_, 1);
+  checkDrained();
+}
 
-    shared_ptr<TNonblockingIOThread> thread(
-      new TNonblockingIOThread(this, id, listenFd, useHighPriorityIOThreads_));
-    ioThreads_.push_back(thread);
+void TNonblockingIOThread::cleanupConnections() {
+  for (size_t i = 0; i < acceptQueue_.size(); ++i) {
+    ::THRIFT_CLOSESOCKET(acceptQueue_[i].socket);
+    addConnections(-1);
   }
+  acceptQueue_.clear();
 
-  // Notify handler of the preServe event
-  if (eventHandler_) {
-    eventHandler_->preServe();
+  // Closing a connection takes it off the list
+  while (activeFirst_) {
+    activeFirst_->close();
   }
 
-  // Start all of our helper IO threads. Note that the threads run forever,
-  // only terminating if stop() is called.
-  assert(ioThreads_.size() == numIOThreads_);
-  assert(ioThreads_.size() > 0);
+  while (!connectionCache_.empty()) {
+    delete connectionCache_.back();
+    connectionCache_.pop_back();
+  }
+  atomicStore<ATOMIC_RELAXED>(&numCachedConnections_, 0);
+}
 
-  GlobalOutput.printf("TNonblockingServer: Serving on port %d, %d io threads.",
-               port_, ioThreads_.size());
+void TNonblockingIOThread::drain() {
+  if (Thread::is_current(threadId_)) {
+    beginDrain();
+    return;
+  }
 
-  // Launch all the secondary IO threads in separate threads
-  if (ioThreads_.size() > 1) {
-    ioThreadFactory_.reset(new PlatformThreadFactory(
-#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
-      PlatformThreadFactory::OTHER,  // scheduler
-      PlatformThreadFactory::NORMAL, // priority
-      1,                          // stack size (MB)
-#endif
-      false                       // detached
-    ));
+  bool wakeNeeded;
+  {
+    Guard g(notifyMutex_);
+    drainPending_ = true;
+    wakeNeeded = !notifyWakePending_;
+    notifyWakePending_ = true;
+  }
+  if (wakeNeeded && !wake()) {
+    wakeFailed("TNonblockingIOThread::drain() wake ");
+  }
+}
+
+void TNonblockingIOThread::addMemoryWaiter(TNonblockingServer::TConnection* conn) {
+  memoryWaiters_.push_back(conn);
+}
+
+void TNonblockingIOThread::removeMemoryWaiter(TNonblockingServer::TConnection* conn) {
+  std::vector<TNonblockingServer::TConnection*>::iterator it =
+    std::find(memoryWaiters_.begin(), memoryWaiters_.end(), conn);
+  if (it != memoryWaiters_.end()) {
+    memoryWaiters_.erase(it);
+  }
+}
 
-    assert(ioThreadFactory_.get());
+void TNonblockingIOThread::resumeMemoryWaiters() {
+  bool wakeNeeded;
+  {
+    Guard g(notifyMutex_);
+    memoryResumePending_ = true;
+    wakeNeeded = !notifyWakePending_;
+    notifyWakePending_ = true;
+  }
+  if (wakeNeeded && !wake()) {
+    wakeFailed("TNonblockingIOThread::resumeMemoryWaiters() wake ");
+  }
+}
 
-    // intentionally starting at thread 1, not 0
-    for (uint32_t i = 1; i < ioThreads_.size(); ++i) {
-      shared_ptr<Thread> thread = ioThreadFactory_->newThread(ioThreads_[i]);
-      ioThreads_[i]->setThread(thread);
-      thread->start();
+uint64_t TNonblockingIOThread::requestStats(bool withConnections) {
+  uint64_t ticket;
+  bool wakeNeeded;
+  {
+    Guard g(notifyMutex_);
+    ticket = ++statsRequested_;
+    withConnections = withConnections || statsWithConnections_;
+    if (Thread::is_current(threadId_)) {
+      statsWithConnections_ = false;
+      wakeNeeded = false;
+    } else {
+      statsWithConnections_ = withConnections;
+      wakeNeeded = !notifyWakePending_;
+      notifyWakePending_ = true;
     }
   }
 
-  // Register the events for the primary (listener) IO thread
-  ioThreads_[0]->registerEvents();
+  if (Thread::is_current(threadId_)) {
+    statsTaken_ = ticket;
+    publishStats(ticket, withConnections);
+  } else if (wakeNeeded && !wake()) {
+    wakeFailed("TNonblockingIOThread::requestStats() wake ");
+  }
+  return ticket;
 }
 
-/**
- * Main workhorse function, starts up the server listening on a port and
- * loops over the libevent handler.
- */
-void TNonblockingServer::serve() {
-
-  registerEvents(NULL);
+bool TNonblockingIOThread::waitForStats(uint64_t ticket, int64_t deadline,
+                                        TIOThreadStats& stats) {
+  {
+    Synchronized s(statsMonitor_);
+    while (statsServed_ < ticket) {
+      int64_t left = deadline - Util::monotonicTime();
+      if (left <= 0) {
+        break;
+      }
+      statsMonitor_.waitForTimeRelative(left);
+    }
+    if (statsServed_ >= ticket) {
+      stats = stats_;
+      return true;
+    }
+  }
 
-  // Run the primary (listener) IO thread loop in our main thread; this will
-  // only return when the server is shutting down.
-  ioThreads_[0]->run();
+  stats = TIOThreadStats();
+  stats.number = number_;
+  stats.connections = getNumConnections();
+  stats.cachedConnections = getNumCachedConnections();
+  stats.pendingBytes = getPendingBytes();
+  return false;
+}
 
-  // Ensure all threads are finished before exiting serve()
-  for (uint32_t i = 0; i < ioThreads_.size(); ++i) {
-    ioThreads_[i]->join();
-    GlobalOutput.printf("TNonblocking: join done for IO thread #%d", i);
+/// How TConnectionStats names a connection's state
+static const char* appStateName(TAppState state) {
+  switch (state) {
+  case APP_WAIT_TASK:
+    return "processing";
+  case APP_SEND_RESULT:
+    return "sending";
+  case APP_CLOSE_CONNECTION:
+    return "closing";
+  default:
+    return "reading";
   }
 }
 
-TNonblockingIOThread::TNonblockingIOThread(TNonblockingServer* server,
-                                           int number,
-                                           THRIFT_SOCKET listenSocket,
-                                           bool useHighPriority)
-      : server_(server)
-      , number_(number)
-      , listenSocket_(listenSocket)
-      , useHighPriority_(useHighPriority)
-      , eventBase_(NULL)
-      , ownEventBase_(false) {
-  notificationPipeFDs_[0] = -1;
-  notificationPipeFDs_[1] = -1;
-}
+void TNonblockingIOThread::publishStats(uint64_t ticket, bool withConnections) {
+  TIOThreadStats stats;
+  stats.number = number_;
+  stats.connections = getNumConnections();
+  stats.cachedConnections = getNumCachedConnections();
+  stats.pendingBytes = getPendingBytes();
+  stats.bufferPoolFreeBytes = bufferPool_ ? bufferPool_->getFreeBytes() : 0;
+  stats.complete = true;
+
+  if (withConnections) {
+    for (TNonblockingServer::TConnection* conn = activeFirst_;
+         conn != NULL;
+         conn = conn->activeNext_) {
+      TConnectionStats c;
+      c.socket = conn->tSocket_->getSocketFD();
+      c.clientAddress = conn->tSocket_->getPeerAddress();
+      c.clientPort = conn->tSocket_->getPeerPort();
+      c.state = appStateName(conn->appState_);
+      c.readBufferSize = conn->readBufferSize_;
+      c.writeBufferSize = conn->writeBufferSize_;
+      c.pendingBytes = conn->pendingBytes_;
+      c.requests = conn->requestsRead_;
+      stats.connectionStats.push_back(c);
+    }
+  }
 
-TNonblockingIOThread::~TNonblockingIOThread() {
-  // make sure our associated thread is fully finished
-  join();
+  Synchronized s(statsMonitor_);
+  if (ticket > statsServed_) {
+    statsServed_ = ticket;
+    stats_ = stats;
+    statsMonitor_.notifyAll();
+  }
+}
 
-  if (eventBase_ && ownEventBase_) {
-    event_base_free(eventBase_);
-    ownEventBase_ = false;
+void TNonblockingIOThread::beginDrain() {
+  if (draining_) {
+    return;
   }
+  draining_ = true;
 
   if (listenSocket_ >= 0) {
-    if (0 != ::THRIFT_CLOSESOCKET(listenSocket_)) {
-      GlobalOutput.perror("TNonblockingIOThread listenSocket_ close(): ",
+    if (!eventLoop_->del(&serverEvent_)) {
+      GlobalOutput.perror("TNonblockingIOThread::beginDrain() event del: ",
                           THRIFT_GET_SOCKET_ERROR);
     }
+    ::THRIFT_CLOSESOCKET(listenSocket_);
     listenSocket_ = THRIFT_INVALID_SOCKET;
   }
 
-  for (int i = 0; i < 2; ++i) {
-    if (notificationPipeFDs_[i] >= 0) {
-      if (0 != ::THRIFT_CLOSESOCKET(notificationPipeFDs_[i])) {
-        GlobalOutput.perror("TNonblockingIOThread notificationPipe close(): ",
-                            THRIFT_GET_SOCKET_ERROR);
-      }
-      notificationPipeFDs_[i] = THRIFT_INVALID_SOCKET;
-    }
+  for (size_t i = 0; i < listenerEvents_.size(); ++i) {
+    eventLoop_->del(listenerEvents_[i].get());
+    ::THRIFT_CLOSESOCKET(listenerEvents_[i]->fd);
   }
-}
-
-void TNonblockingIOThread::createNotificationPipe() {
-  if(evutil_socketpair(AF_LOCAL, SOCK_STREAM, 0, notificationPipeFDs_) == -1) {
-    GlobalOutput.perror("TNonblockingServer::createNotificationPipe ", EVUTIL_SOCKET_ERROR());
-    throw TException("can't create notification pipe");
+  listenerEvents_.clear();
+  for (size_t i = 0; number_ == 0 && i < server_->listeners_.size(); ++i) {
+    server_->listeners_[i]->socket = THRIFT_INVALID_SOCKET;
   }
-  if(evutil_make_socket_nonblocking(notificationPipeFDs_[0])<0 ||
-     evutil_make_socket_nonblocking(notificationPipeFDs_[1])<0) {
-    ::THRIFT_CLOSESOCKET(notificationPipeFDs_[0]);
-    ::THRIFT_CLOSESOCKET(notificationPipeFDs_[1]);
-    throw TException("TNonblockingServer::createNotificationPipe() THRIFT_O_NONBLOCK");
+
+  // A server that drains can't be taken over any more
+  if (restartEvent_.added) {
+    eventLoop_->del(&restartEvent_);
+    ::THRIFT_CLOSESOCKET(server_->restartSocket_);
+    server_->restartSocket_ = THRIFT_INVALID_SOCKET;
   }
-  for (int i = 0; i < 2; ++i) {
-#if LIBEVENT_VERSION_NUMBER < 0x02000000
-    int flags;
-    if ((flags = THRIFT_FCNTL(notificationPipeFDs_[i], F_GETFD, 0)) < 0 ||
-        THRIFT_FCNTL(notificationPipeFDs_[i], F_SETFD, flags | FD_CLOEXEC) < 0) {
-#else
-    if (evutil_make_socket_closeonexec(notificationPipeFDs_[i]) < 0) {
-#endif
-      ::THRIFT_CLOSESOCKET(notificationPipeFDs_[0]);
-      ::THRIFT_CLOSESOCKET(notificationPipeFDs_[1]);
-      throw TException("TNonblockingServer::createNotificationPipe() "
-        "FD_CLOEXEC");
+
+  // The others are retired by finishWork() once they are between requests
+  TNonblockingServer::TConnection* conn = activeFirst_;
+  while (conn) {
+    TNonblockingServer::TConnection* next = conn->activeNext_;
+    if (conn->currentWait() == WAIT_IDLE) {
+      conn->retire();
     }
+    conn = next;
   }
+  checkDrained();
 }
 
-/**
- * Register the core libevent events onto the proper base.
- */
-void TNonblockingIOThread::registerEvents() {
-  threadId_ = Thread::get_current();
+void TNonblockingIOThread::checkDrained() {
+  if (draining_ && !drained_ && getNumConnections() == 0) {
+    drained_ = true;
+    server_->ioThreadDrained();
+  }
+}
+
+/* static */
+void TNonblockingIOThread::restartHandler(THRIFT_SOCKET fd, short which, void* v) {
+  (void)fd;
+  (void)which;
+  TNonblockingIOThread* ioThread = (TNonblockingIOThread*)v;
+  ioThread->server_->acceptSuccessor();
+}
 
-  assert(eventBase_ == 0);
-  eventBase_ = getServer()->getUserEventBase();
-  if (eventBase_ == NULL) {
-    eventBase_ = event_base_new();
-    ownEventBase_ = true;
+/* static */
+void TNonblockingIOThread::predecessorHandler(THRIFT_SOCKET fd, short which, void* v) {
+  (void)fd;
+  (void)which;
+  TNonblockingIOThread* ioThread = (TNonblockingIOThread*)v;
+  if (!ioThread->server_->receiveConnections(ioThread)) {
+    ioThread->eventLoop_->del(&ioThread->predecessorEvent_);
+    ioThread->server_->predecessor_.reset();
   }
+}
 
-  // Print some libevent stats
-  if (number_ == 0) {
-    GlobalOutput.printf("TNonblockingServer: using libevent %s method %s",
-            event_get_version(),
-            event_base_get_method(eventBase_));
+bool TNonblockingIOThread::handOff(THRIFT_SOCKET socket,
+                                   const sockaddr* addr,
+                                   socklen_t addrLen,
+                                   const TNonblockingServer::Listener* listener) {
+  if (getNotificationSendFD() < 0) {
+    return false;
   }
 
-  if (listenSocket_ >= 0) {
-    // Register the server event
-    event_set(&serverEvent_,
-              listenSocket_,
-              EV_READ | EV_PERSIST,
-              TNonblockingIOThread::listenHandler,
-              server_);
-    event_base_set(eventBase_, &serverEvent_);
+  Accepted accepted;
+  accepted.socket = socket;
+  accepted.addrLen = std::min(addrLen, static_cast<socklen_t>(sizeof(accepted.addr)));
+  memcpy(&accepted.addr, addr, accepted.addrLen);
+  accepted.listener = listener;
+
+  bool wakeNeeded;
+  {
+    Guard g(notifyMutex_);
+    acceptQueue_.push_back(accepted);
+    wakeNeeded = !notifyWakePending_;
+    notifyWakePending_ = true;
+  }
+  if (!wakeNeeded || wake()) {
+    return true;
+  }
 
-    // Add the event and start up the server
-    if (-1 == event_add(&serverEvent_, 0)) {
-      throw TException("TNonblockingServer::serve(): "
-                       "event_add() failed on server listen event");
+  // The caller closes the socket, so take it back unless the IO thread
+  // already has it.
+  Guard g(notifyMutex_);
+  for (size_t i = acceptQueue_.size(); i-- > 0;) {
+    if (acceptQueue_[i].socket == socket) {
+      acceptQueue_.erase(acceptQueue_.begin() + i);
+      notifyWakePending_ = false;
+      return false;
     }
-    GlobalOutput.printf("TNonblocking: IO thread #%d registered for listen.",
-                        number_);
   }
+  return true;
+}
 
-  createNotificationPipe();
+bool TNonblockingIOThread::notify(TNonblockingServer::TConnection* conn) {
+  THRIFT_SOCKET fd = getNotificationSendFD();
+  if (fd < 0) {
+    return false;
+  }
 
-  // Create an event to be notified when a task finishes
-  event_set(&notificationEvent_,
-            getNotificationRecvFD(),
-            EV_READ | EV_PERSIST,
-            TNonblockingIOThread::notifyHandler,
-            this);
+  // Only the first notification after the IO thread has taken the queue
+  // needs to wake it; the rest ride along in the same batch.  The queue is
+  // a vector under notifyMutex_ rather than a lock-free list so that a
+  // failed wake can take its entry back out, which a producer can't do
+  // with an MPSC list; the lock is only held for a push or a swap.
+  bool wakeNeeded;
+  {
+    Guard g(notifyMutex_);
+    notifyQueue_.push_back(conn);
+    wakeNeeded = !notifyWakePending_;
+    notifyWakePending_ = true;
+  }
+  if (!wakeNeeded || wake()) {
+    return true;
+  }
 
-  // Attach to the base
-  event_base_set(eventBase_, &notificationEvent_);
+  // The IO thread won't wake for the batch, so take conn back out for the
+  // caller to fail and let the next notification try to wake it again.
+  // If the thread has already taken conn, it will run it.
+  Guard g(notifyMutex_);
+  std::vector<TNonblockingServer::TConnection*>::reverse_iterator it =
+    std::find(notifyQueue_.rbegin(), notifyQueue_.rend(), conn);
+  if (it == notifyQueue_.rend()) {
+    return true;
+  }
+  notifyQueue_.erase((++it).base());
+  notifyWakePending_ = false;
+  return false;
+}
 
-  // Add the event and start up the server
-  if (-1 == event_add(&notificationEvent_, 0)) {
-    throw TException("TNonblockingServer::serve(): "
-                     "event_add() failed on task-done notification event");
+void TNonblockingIOThread::wakeFailed(const char* where) {
+  int errno_copy = THRIFT_GET_SOCKET_ERROR;
+  {
+    Guard g(notifyMutex_);
+    notifyWakePending_ = false;
   }
-  GlobalOutput.printf("TNonblocking: IO thread #%d registered for notify.",
-                      number_);
+  GlobalOutput.perror(where, errno_copy);
 }
 
-bool TNonblockingIOThread::notify(TNonblockingServer::TConnection* conn) {
+bool TNonblockingIOThread::wake() {
   THRIFT_SOCKET fd = getNotificationSendFD();
-  if (fd < 0) {
-    return false;
+
+#ifdef HAVE_SYS_EVENTFD_H
+  if (fd == getNotificationRecvFD()) {
+    uint64_t one = 1;
+    if (::write(fd, &one, sizeof(one)) != sizeof(one)) {
+      return false;
+    }
+    return true;
   }
+#endif
 
-  const int kSize = sizeof(conn);
-  if (send(fd, const_cast_sockopt(&conn), kSize, 0) != kSize) {
+  const uint8_t kWake = 0;
+  if (send(fd, const_cast_sockopt(&kWake), 1, 0) != 1) {
     return false;
   }
 
   return true;
 }
 
-/* static */
-void TNonblockingIOThread::notifyHandler(evutil_socket_t fd, short which, void* v) {
-  TNonblockingIOThread* ioThread = (TNonblockingIOThread*) v;
-  assert(ioThread);
-  (void)which;
+bool TNonblockingIOThread::drainNotificationPipe(THRIFT_SOCKET fd) {
+#ifdef HAVE_SYS_EVENTFD_H
+  if (fd == getNotificationSendFD()) {
+    uint64_t count;
+    if (::read(fd, &count, sizeof(count)) < 0
+        && errno != EAGAIN && errno != EWOULDBLOCK) {
+      GlobalOutput.perror("TNonblocking: notifyHandler read() failed: ", errno);
+      return false;
+    }
+    return true;
+  }
+#endif
 
+  uint8_t buf[64];
   while (true) {
-    TNonblockingServer::TConnection* connection = 0;
-    const int kSize = sizeof(connection);
-    int nBytes = recv(fd, cast_sockopt(&connection), kSize, 0);
-    if (nBytes == kSize) {
-      if (connection == NULL) {
-        // this is the command to stop our thread, exit the handler!
-        return;
-      }
-      connection->transition();
-    } else if (nBytes > 0) {
-      // throw away these bytes and hope that next time we get a solid read
-      GlobalOutput.printf("notifyHandler: Bad read of %d bytes, wanted %d",
-                          nBytes, kSize);
-      ioThread->breakLoop(true);
-      return;
+    int nBytes = recv(fd, cast_sockopt(buf), sizeof(buf), 0);
+    if (nBytes > 0) {
+      continue;
     } else if (nBytes == 0) {
       GlobalOutput.printf("notifyHandler: Notify socket closed!");
-      // exit the loop
-      break;
+      return true;
     } else { // nBytes < 0
       if (THRIFT_GET_SOCKET_ERROR != THRIFT_EWOULDBLOCK && THRIFT_GET_SOCKET_ERROR != THRIFT_EAGAIN) {
           GlobalOutput.perror(
             "TNonblocking: notifyHandler read() failed: ", THRIFT_GET_SOCKET_ERROR);
-          ioThread->breakLoop(true);
-          return;
+          return false;
       }
-      // exit the loop
-      break;
+      return true;
+    }
+  }
+}
+
+/* static */
+void TNonblockingIOThread::notifyHandler(THRIFT_SOCKET fd, short which, void* v) {
+  TNonblockingIOThread* ioThread = (TNonblockingIOThread*) v;
+  assert(ioThread);
+  (void)which;
+
+  // Clear the wakeup before taking the queue, so that anything queued after
+  // the swap signals us again.
+  if (!ioThread->drainNotificationPipe(fd)) {
+    ioThread->breakLoop(true);
+    return;
+  }
+
+  std::vector<TNonblockingServer::TConnection*>& batch = ioThread->notifyBatch_;
+  std::vector<Accepted>& accepted = ioThread->acceptBatch_;
+  bool drain;
+  bool memoryResume;
+  uint64_t statsTicket;
+  bool statsWithConnections;
+  {
+    Guard g(ioThread->notifyMutex_);
+    batch.swap(ioThread->notifyQueue_);
+    accepted.swap(ioThread->acceptQueue_);
+    drain = ioThread->drainPending_;
+    ioThread->drainPending_ = false;
+    memoryResume = ioThread->memoryResumePending_;
+    ioThread->memoryResumePending_ = false;
+    ioThread->notifyWakePending_ = false;
+    statsTicket = ioThread->statsRequested_;
+    statsWithConnections = ioThread->statsWithConnections_;
+    ioThread->statsWithConnections_ = false;
+  }
+
+  for (size_t i = 0; i < accepted.size(); ++i) {
+    ioThread->startConnection(accepted[i].socket,
+                              reinterpret_cast<sockaddr*>(&accepted[i].addr),
+                              accepted[i].addrLen,
+                              accepted[i].listener);
+  }
+  accepted.clear();
+
+  if (drain) {
+    ioThread->beginDrain();
+  }
+
+  if (memoryResume) {
+    // Each tries the budget again, in the order they stopped, and those
+    // that still don't fit wait again
+    ioThread->server_->memoryWakeTaken();
+    std::vector<TNonblockingServer::TConnection*>& waiters = ioThread->memoryWaitersBatch_;
+    waiters.swap(ioThread->memoryWaiters_);
+    for (size_t i = 0; i < waiters.size(); ++i) {
+      waiters[i]->resumeReading();
+    }
+    waiters.clear();
+  }
+
+  if (statsTicket > ioThread->statsTaken_) {
+    ioThread->statsTaken_ = statsTicket;
+    ioThread->publishStats(statsTicket, statsWithConnections);
+  }
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (batch[i] == NULL) {
+      // this is the command to stop our thread, exit the handler!
+      batch.clear();
+      return;
     }
+    batch[i]->step();
   }
+  batch.clear();
 }
 
 void TNonblockingIOThread::breakLoop(bool error) {
@@ -1462,9 +4884,9 @@ void TNonblockingIOThread::breakLoop(bool error) {
   }
 
   // sets a flag so that the loop exits on the next event
-  event_base_loopbreak(eventBase_);
+  eventLoop_->breakLoop();
 
-  // event_base_loopbreak() only causes the loop to exit the next time
+  // breakLoop() only causes the loop to exit the next time
   // it wakes up.  We need to force it to wake up, in case there are
   // no real events it needs to process.
   //
@@ -1509,18 +4931,33 @@ void TNonblockingIOThread::setCurrentThreadHighPriority(bool value) {
 }
 
 void TNonblockingIOThread::run() {
-  if (eventBase_ == NULL)
+  if (!eventLoop_)
     registerEvents();
 
   GlobalOutput.printf("TNonblockingServer: IO thread #%d entering loop...",
                       number_);
 
+  if (server_->getNumaPlacement()) {
+    ThreadPlacement placement;
+    placement.numaNode = number_ % ThreadPlacement::numaNodeCount();
+    std::ostringstream name;
+    name << "thrift-io-" << number_;
+    placement.name = name.str();
+    if (!placement.apply()) {
+      GlobalOutput.printf("TNonblockingServer: could not place IO thread #%d on NUMA node %d",
+                          number_, placement.numaNode);
+    }
+  }
+
   if (useHighPriority_) {
     setCurrentThreadHighPriority(true);
   }
 
-  // Run libevent engine, never returns, invokes calls to eventHandler
-  event_base_loop(eventBase_, 0);
+  // After placement, so what it allocates is on this thread's node
+  warmUp();
+
+  // Run the event loop, never returns, invokes calls to eventHandler
+  eventLoop_->run();
 
   if (useHighPriority_) {
     setCurrentThreadHighPriority(false);
@@ -1536,12 +4973,24 @@ void TNonblockingIOThread::run() {
 void TNonblockingIOThread::cleanupEvents() {
   // stop the listen socket, if any
   if (listenSocket_ >= 0) {
-    if (event_del(&serverEvent_) == -1) {
-      GlobalOutput.perror("TNonblockingIOThread::stop() event_del: ", THRIFT_GET_SOCKET_ERROR);
+    if (!eventLoop_->del(&serverEvent_)) {
+      GlobalOutput.perror("TNonblockingIOThread::stop() event del: ", THRIFT_GET_SOCKET_ERROR);
     }
   }
 
-  event_del(&notificationEvent_);
+  for (size_t i = 0; i < listenerEvents_.size(); ++i) {
+    eventLoop_->del(listenerEvents_[i].get());
+  }
+  listenerEvents_.clear();
+  if (restartEvent_.added) {
+    eventLoop_->del(&restartEvent_);
+  }
+  if (predecessorEvent_.added) {
+    eventLoop_->del(&predecessorEvent_);
+  }
+
+  eventLoop_->del(&notificationEvent_);
+  eventLoop_->setTick(0, NULL, NULL);
 }
 
 
@@ -1564,4 +5013,247 @@ void TNonblockingIOThread::join() {
   }
 }
 
+size_t TLeastConnectionsPolicy::select(
+    const std::vector<boost::shared_ptr<TNonblockingIOThread> >& ioThreads) {
+  size_t n = ioThreads.size();
+  size_t best = next_ % n;
+  size_t bestConnections = ioThreads[best]->getNumConnections();
+  for (size_t i = 1; i < n && bestConnections > 0; ++i) {
+    size_t idx = (next_ + i) % n;
+    size_t connections = ioThreads[idx]->getNumConnections();
+    if (connections < bestConnections) {
+      best = idx;
+      bestConnections = connections;
+    }
+  }
+  next_ = (best + 1) % n;
+  return best;
+}
+
+size_t TLeastPendingBytesPolicy::select(
+    const std::vector<boost::shared_ptr<TNonblockingIOThread> >& ioThreads) {
+  size_t n = ioThreads.size();
+  size_t best = next_ % n;
+  uint64_t bestBytes = ioThreads[best]->getPendingBytes();
+  size_t bestConnections = ioThreads[best]->getNumConnections();
+  for (size_t i = 1; i < n; ++i) {
+    size_t idx = (next_ + i) % n;
+    uint64_t bytes = ioThreads[idx]->getPendingBytes();
+    size_t connections = ioThreads[idx]->getNumConnections();
+    if (bytes < bestBytes ||
+        (bytes == bestBytes && connections < bestConnections)) {
+      best = idx;
+      bestBytes = bytes;
+      bestConnections = connections;
+    }
+  }
+  next_ = (best + 1) % n;
+  return best;
+}
+
+int TNamedTaskPriorityPolicy::getPriority(const std::string& name) {
+  std::map<std::string, int>::const_iterator it = priorities_.find(name);
+  if (it == priorities_.end()) {
+    std::string::size_type colon = name.find(':');
+    if (colon != std::string::npos) {
+      it = priorities_.find(name.substr(0, colon));
+    }
+  }
+  return it == priorities_.end() ? defaultPriority_ : it->second;
+}
+
+bool TNamedInlineCallPolicy::isInline(const std::string& name) {
+  std::map<std::string, bool>::const_iterator it = inline_.find(name);
+  if (it == inline_.end()) {
+    std::string::size_type colon = name.find(':');
+    if (colon != std::string::npos) {
+      it = inline_.find(name.substr(0, colon));
+    }
+  }
+  return it != inline_.end() && it->second;
+}
+
+TAdmissionControl::TAdmissionControl(int64_t target, int64_t interval)
+  : target_(target),
+    interval_(interval),
+    intervalEnd_(0),
+    minSojourn_(-1),
+    overloaded_(0),
+    totalQueued_(0),
+    clients_(0),
+    refused_(0) {}
+
+TAdmissionControl::Stripe& TAdmissionControl::stripeOf(const std::string& client) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < client.size(); ++i) {
+    hash = (hash ^ static_cast<uint8_t>(client[i])) * 16777619u;
+  }
+  return stripes_[hash % STRIPES];
+}
+
+bool TAdmissionControl::admit(const std::string& client, int64_t now) {
+  endInterval(now);
+  Stripe& stripe = stripeOf(client);
+  Guard g(stripe.mutex);
+  std::map<std::string, size_t>::iterator it = stripe.queued.find(client);
+  size_t queued = it == stripe.queued.end() ? 0 : it->second;
+  // At or over the fair share of queued / clients; never true for a new one
+  if (queued > 0 && atomicLoad<ATOMIC_RELAXED>(&overloaded_) &&
+      static_cast<int64_t>(queued) * atomicLoad<ATOMIC_RELAXED>(&clients_) >=
+        atomicLoad<ATOMIC_RELAXED>(&totalQueued_)) {
+    atomicAdd(&refused_, 1);
+    return false;
+  }
+  if (queued == 0) {
+    stripe.queued[client] = 1;
+    atomicAdd(&clients_, 1);
+  } else {
+    ++it->second;
+  }
+  atomicAdd(&totalQueued_, 1);
+  return true;
+}
+
+void TAdmissionControl::started(const std::string& client, int64_t sojourn, int64_t now) {
+  dequeued(client);
+  endInterval(now);
+  int64_t seen = atomicLoad<ATOMIC_RELAXED>(&minSojourn_);
+  while ((seen < 0 || sojourn < seen) &&
+         !atomicCompareAndSwap(&minSojourn_, seen, sojourn)) {
+    seen = atomicLoad<ATOMIC_RELAXED>(&minSojourn_);
+  }
+}
+
+void TAdmissionControl::dropped(const std::string& client) {
+  dequeued(client);
+}
+
+bool TAdmissionControl::isOverloaded() {
+  return atomicLoad<ATOMIC_RELAXED>(&overloaded_) != 0;
+}
+
+uint64_t TAdmissionControl::getRefusedCount() {
+  return atomicLoad<ATOMIC_RELAXED>(&refused_);
+}
+
+void TAdmissionControl::endInterval(int64_t now) {
+  int64_t end = atomicLoad<ATOMIC_RELAXED>(&intervalEnd_);
+  // Only the thread that moves the interval on judges it
+  if (now < end || !atomicCompareAndSwap(&intervalEnd_, end, now + interval_)) {
+    return;
+  }
+  int64_t minSojourn = atomicExchange(&minSojourn_, -1);
+  bool wasOverloaded = atomicLoad<ATOMIC_RELAXED>(&overloaded_) != 0;
+  bool overloaded;
+  if (minSojourn >= 0) {
+    overloaded = minSojourn > target_;
+  } else {
+    // Nothing started: either nothing was queued, or the workers are all
+    // stuck and whatever was queued is still waiting
+    overloaded = wasOverloaded && atomicLoad<ATOMIC_RELAXED>(&totalQueued_) > 0;
+  }
+  if (overloaded != wasOverloaded) {
+    GlobalOutput.printf(overloaded ?
+                        "TNonblockingServer: admission control begun." :
+                        "TNonblockingServer: admission control ended.");
+    atomicStore<ATOMIC_RELAXED>(&overloaded_, overloaded ? 1 : 0);
+  }
+}
+
+void TAdmissionControl::dequeued(const std::string& client) {
+  Stripe& stripe = stripeOf(client);
+  Guard g(stripe.mutex);
+  std::map<std::string, size_t>::iterator it = stripe.queued.find(client);
+  if (it == stripe.queued.end()) {
+    return;
+  }
+  if (--it->second == 0) {
+    stripe.queued.erase(it);
+    atomicAdd(&clients_, -1);
+  }
+  atomicAdd(&totalQueued_, -1);
+}
+
+TConnectionQuota::TConnectionQuota(double callsPerSecond,
+                                   double bytesPerSecond,
+                                   double burst,
+                                   Scope scope)
+  : scope_(scope),
+    callsPerSecond_(callsPerSecond),
+    bytesPerSecond_(bytesPerSecond),
+    burst_(burst),
+    nextPrune_(0),
+    throttled_(0) {}
+
+void TConnectionQuota::setLimits(double callsPerSecond, double bytesPerSecond, double burst) {
+  Guard g(mutex_);
+  callsPerSecond_ = callsPerSecond;
+  bytesPerSecond_ = bytesPerSecond;
+  burst_ = burst;
+}
+
+bool TConnectionQuota::admit(const std::string& client, uint32_t size, int64_t now) {
+  Guard g(mutex_);
+  if (callsPerSecond_ <= 0 && bytesPerSecond_ <= 0) {
+    return true;
+  }
+  prune(now);
+  return take(clients_[client], size, now);
+}
+
+bool TConnectionQuota::admit(Bucket& bucket, uint32_t size, int64_t now) {
+  Guard g(mutex_);
+  if (callsPerSecond_ <= 0 && bytesPerSecond_ <= 0) {
+    return true;
+  }
+  return take(bucket, size, now);
+}
+
+uint64_t TConnectionQuota::getThrottledCount() {
+  Guard g(mutex_);
+  return throttled_;
+}
+
+bool TConnectionQuota::take(Bucket& bucket, uint32_t size, int64_t now) {
+  double callsMax = callsPerSecond_ * burst_;
+  double bytesMax = bytesPerSecond_ * burst_;
+  if (bucket.last == 0) {
+    bucket.calls = callsMax;
+    bucket.bytes = bytesMax;
+  } else if (now > bucket.last) {
+    double elapsed = (now - bucket.last) / 1e6;
+    bucket.calls = std::min(callsMax, bucket.calls + elapsed * callsPerSecond_);
+    bucket.bytes = std::min(bytesMax, bucket.bytes + elapsed * bytesPerSecond_);
+  }
+  bucket.last = now;
+
+  bool callsOk = callsPerSecond_ <= 0 || bucket.calls >= 1.0;
+  bool bytesOk = bytesPerSecond_ <= 0 || bucket.bytes >= std::min<double>(size, bytesMax);
+  if (!callsOk || !bytesOk) {
+    ++throttled_;
+    return false;
+  }
+  bucket.calls -= 1.0;
+  bucket.bytes -= size;
+  return true;
+}
+
+void TConnectionQuota::prune(int64_t now) {
+  if (now < nextPrune_) {
+    return;
+  }
+  // Anything idle for burst seconds is full again, whatever it was
+  int64_t full = static_cast<int64_t>(burst_ * 1e6);
+  std::map<std::string, Bucket>::iterator it = clients_.begin();
+  while (it != clients_.end()) {
+    if (now - it->second.last >= full) {
+      clients_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+  nextPrune_ = now + std::max<int64_t>(full, 1000000);
+}
+
 }}} // apache::thrift::server
@@ -22,15 +22,27 @@
 
 #include <thrift/Thrift.h>
 #include <thrift/server/TServer.h>
+#include <thrift/server/TBufferPool.h>
+#include <thrift/server/TEventLoop.h>
+#include <thrift/async/TAsyncProcessor.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
 #include <thrift/transport/PlatformSocket.h>
 #include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/THeaderTransport.h>
 #include <thrift/transport/TSocket.h>
 #include <thrift/concurrency/ThreadManager.h>
 #include <climits>
+#include <thrift/concurrency/Atomic.h>
 #include <thrift/concurrency/Thread.h>
 #include <thrift/concurrency/PlatformThreadFactory.h>
 #include <thrift/concurrency/Mutex.h>
-#include <stack>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/AdaptiveMutex.h>
+#include <thrift/concurrency/Util.h>
+#include <boost/scoped_ptr.hpp>
+#include <deque>
+#include <map>
 #include <vector>
 #include <string>
 #include <cstdlib>
@@ -41,18 +53,33 @@
 
 
 
+namespace apache { namespace thrift { namespace transport {
+class TSSLSocketFactory;
+}}}
+
 namespace apache { namespace thrift { namespace server {
 
 using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TSegmentedMemoryBuffer;
+using apache::thrift::transport::TIOVec;
 using apache::thrift::transport::TSocket;
+using apache::thrift::transport::TSSLSocketFactory;
+using apache::thrift::transport::THeaderTransport;
 using apache::thrift::protocol::TProtocol;
+using apache::thrift::async::TAsyncProcessorFactory;
 using apache::thrift::concurrency::Runnable;
 using apache::thrift::concurrency::ThreadManager;
 using apache::thrift::concurrency::PlatformThreadFactory;
 using apache::thrift::concurrency::ThreadFactory;
 using apache::thrift::concurrency::Thread;
 using apache::thrift::concurrency::Mutex;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::AdaptiveMutex;
 using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Util;
+using apache::thrift::concurrency::ATOMIC_RELAXED;
+using apache::thrift::concurrency::atomicAdd;
+using apache::thrift::concurrency::atomicLoad;
 
 #ifdef LIBEVENT_VERSION_NUMBER
 #define LIBEVENT_VERSION_MAJOR (LIBEVENT_VERSION_NUMBER >> 24)
@@ -108,6 +135,75 @@ enum TOverloadAction {
 };
 
 class TNonblockingIOThread;
+class TIOThreadAssignmentPolicy;
+class TTaskPriorityPolicy;
+class TInlineCallPolicy;
+class TAdmissionControl;
+class TConnectionQuota;
+
+/**
+ * Protocols specialized for the buffers TNonblockingServer reads calls from
+ * and writes responses to, a TMemoryBuffer in and a TMemoryBuffer or
+ * TSegmentedMemoryBuffer out, all of them TBufferBase.  Serve with one of
+ * the factories and a processor generated with the templates option and
+ * instantiated over the matching protocol, e.g.
+ * MyServiceProcessorT<TNonblockingBinaryProtocol>, and each call is decoded,
+ * dispatched and encoded without a virtual call, pipelined or not.
+ */
+typedef apache::thrift::protocol::TBinaryProtocolT<
+  apache::thrift::transport::TBufferBase> TNonblockingBinaryProtocol;
+typedef apache::thrift::protocol::TBinaryProtocolFactoryT<
+  apache::thrift::transport::TBufferBase> TNonblockingBinaryProtocolFactory;
+typedef apache::thrift::protocol::TCompactProtocolT<
+  apache::thrift::transport::TBufferBase> TNonblockingCompactProtocol;
+typedef apache::thrift::protocol::TCompactProtocolFactoryT<
+  apache::thrift::transport::TBufferBase> TNonblockingCompactProtocolFactory;
+
+/// A TNonblockingServer connection, as TNonblockingIOThread::waitForStats()
+/// reports it
+struct TConnectionStats {
+  THRIFT_SOCKET socket;
+
+  std::string clientAddress;
+  int clientPort;
+
+  /// "reading", "processing", "sending" or "closing"
+  const char* state;
+
+  uint32_t readBufferSize;
+  uint32_t writeBufferSize;
+
+  /// What the connection counts in its IO thread's pending bytes
+  uint32_t pendingBytes;
+
+  /// Requests read on the connection so far
+  uint64_t requests;
+};
+
+/// What TNonblockingIOThread::waitForStats() reports of an IO thread
+struct TIOThreadStats {
+  TIOThreadStats()
+    : number(0)
+    , connections(0)
+    , cachedConnections(0)
+    , pendingBytes(0)
+    , bufferPoolFreeBytes(0)
+    , complete(false) {}
+
+  int number;
+  size_t connections;
+  size_t cachedConnections;
+  uint64_t pendingBytes;
+
+  /// Free memory held by the thread's buffer pool
+  size_t bufferPoolFreeBytes;
+
+  /// Filled when asked for
+  std::vector<TConnectionStats> connectionStats;
+
+  /// False if the thread didn't answer, when only the counts are filled
+  bool complete;
+};
 
 class TNonblockingServer : public TServer {
  private:
@@ -118,7 +214,7 @@ class TNonblockingServer : public TServer {
   /// Listen backlog
   static const int LISTEN_BACKLOG = 1024;
 
-  /// Default limit on size of idle connection pool
+  /// Default limit on size of idle connection pool, over all IO threads
   static const size_t CONNECTION_STACK_LIMIT = 1024;
 
   /// Default limit on frame size
@@ -127,6 +223,19 @@ class TNonblockingServer : public TServer {
   /// Default limit on total number of connected sockets
   static const int MAX_CONNECTIONS = INT_MAX;
 
+  /// A port, and what the connections accepted on it are served with
+  struct Listener {
+    int port;
+    THRIFT_SOCKET socket;
+    boost::shared_ptr<TProcessorFactory> processorFactory;
+    /// Set instead of processorFactory for a port served asynchronously
+    boost::shared_ptr<TAsyncProcessorFactory> asyncProcessorFactory;
+    boost::shared_ptr<TTransportFactory> inputTransportFactory;
+    boost::shared_ptr<TTransportFactory> outputTransportFactory;
+    boost::shared_ptr<TProtocolFactory> inputProtocolFactory;
+    boost::shared_ptr<TProtocolFactory> outputProtocolFactory;
+  };
+
   /// Default limit on connections in handler/task processing
   static const int MAX_ACTIVE_PROCESSORS = INT_MAX;
 
@@ -151,6 +260,9 @@ class TNonblockingServer : public TServer {
   /// Whether to set high scheduling priority for IO threads
   bool useHighPriorityIOThreads_;
 
+  /// Whether to place each IO thread on a NUMA node of its own
+  bool numaPlacement_;
+
   /// Server socket file descriptor
   THRIFT_SOCKET serverSocket_;
 
@@ -160,12 +272,28 @@ class TNonblockingServer : public TServer {
   /// The optional user-provided event-base (for single-thread servers)
   event_base* userEventBase_;
 
+  /// Event loop implementation the IO threads run
+  TEventLoop::Backend eventLoopBackend_;
+
+  /// Source of the SSL context for TLS connections, or NULL for plain ones
+  boost::shared_ptr<TSSLSocketFactory> sslSocketFactory_;
+
   /// For processing via thread pool, may be NULL
   boost::shared_ptr<ThreadManager> threadManager_;
 
   /// Is thread pool processing?
   bool threadPoolProcessing_;
 
+  /// Processes requests in place of the TServer's processors, if set
+  boost::shared_ptr<TAsyncProcessorFactory> asyncProcessorFactory_;
+
+  /// Thread managers for the calls read by each IO thread, or NULL for
+  /// threadManager_
+  std::vector<boost::shared_ptr<ThreadManager> > ioThreadManagers_;
+
+  /// Thread managers of their own for the calls of some services, by name
+  std::map<std::string, boost::shared_ptr<ThreadManager> > serviceThreadManagers_;
+
   // Factory to create the IO threads
   boost::shared_ptr<PlatformThreadFactory> ioThreadFactory_;
 
@@ -175,16 +303,34 @@ class TNonblockingServer : public TServer {
   // Index of next IO Thread to be used (for round-robin)
   uint32_t nextIOThread_;
 
-  // Synchronizes access to connection stack and similar data
-  Mutex connMutex_;
+  // Chooses the IO thread for new connections; round robin if NULL
+  boost::shared_ptr<TIOThreadAssignmentPolicy> ioThreadAssignmentPolicy_;
+
+  // Ranks tasks for the thread manager by message name; all equal if NULL
+  boost::shared_ptr<TTaskPriorityPolicy> taskPriorityPolicy_;
+
+  // Picks the calls run on the IO thread despite a thread manager; none if NULL
+  boost::shared_ptr<TInlineCallPolicy> inlineCallPolicy_;
 
-  /// Number of TConnection object we've created
-  size_t numTConnections_;
+  // Refuses calls while the thread manager's queue stands; all run if NULL
+  boost::shared_ptr<TAdmissionControl> admissionControl_;
+
+  // Throttles clients over their rate of calls or bytes; none if NULL
+  boost::shared_ptr<TConnectionQuota> connectionQuota_;
+
+  /// Whether clients are detected and answered through THeaderTransport
+  bool headerTransport_;
+
+  /// Transforms header clients may use
+  THeaderTransport::TransformMap headerTransforms_;
+
+  // Synchronizes access to the processor count and similar data
+  AdaptiveMutex connMutex_;
 
   /// Number of Connections processing or waiting to process
   size_t numActiveProcessors_;
 
-  /// Limit for how many TConnection objects to cache
+  /// Limit for how many TConnection objects to cache, over all IO threads
   size_t connectionStackLimit_;
 
   /// Limit for number of connections processing or waiting to process
@@ -199,6 +345,15 @@ class TNonblockingServer : public TServer {
   /// Time in milliseconds before an unperformed task expires (0 == infinite).
   int64_t taskExpireTime_;
 
+  /// Milliseconds a connection may wait for a request to start (0 == infinite)
+  int64_t idleTimeout_;
+
+  /// Milliseconds to get a frame size from its first byte (0 == infinite)
+  int64_t headerReadTimeout_;
+
+  /// Milliseconds to get a frame from its size (0 == infinite)
+  int64_t bodyReadTimeout_;
+
   /**
    * Hysteresis for overload state.  This is the fraction of the overload
    * value that needs to be reached before the overload state is cleared;
@@ -216,16 +371,16 @@ class TNonblockingServer : public TServer {
   size_t writeBufferDefaultSize_;
 
   /**
-   * Max read buffer size for an idle TConnection.  When we place an idle
-   * TConnection into connectionStack_ or on every resizeBufferEveryN_ calls,
+   * Max read buffer size for an idle TConnection.  When we cache an idle
+   * TConnection or on every resizeBufferEveryN_ calls,
    * we will free the buffer (such that it will be reinitialized by the next
    * received frame) if it has exceeded this limit.  0 disables this check.
    */
   size_t idleReadBufferLimit_;
 
   /**
-   * Max write buffer size for an idle connection.  When we place an idle
-   * TConnection into connectionStack_ or on every resizeBufferEveryN_ calls,
+   * Max write buffer size for an idle connection.  When we cache an idle
+   * TConnection or on every resizeBufferEveryN_ calls,
    * we insure that its write buffer is <= to this size; otherwise we
    * replace it with a new one of writeBufferDefaultSize_ bytes to insure that
    * idle connections don't hog memory. 0 disables this check.
@@ -238,6 +393,88 @@ class TNonblockingServer : public TServer {
    */
   int32_t resizeBufferEveryN_;
 
+  /**
+   * If nonzero, buffers are trimmed by age instead of every
+   * resizeBufferEveryN_ calls; see setBufferTrimAge().
+   */
+  int64_t bufferTrimAge_;
+
+  /**
+   * If true, responses are written to a TSegmentedMemoryBuffer made of
+   * writeBufferDefaultSize_ byte segments instead of a TMemoryBuffer, and
+   * sent with gather writes.
+   */
+  bool useSegmentedWriteBuffers_;
+
+  /// Responses this big or bigger go out with MSG_ZEROCOPY; 0 for none
+  uint32_t zeroCopyThreshold_;
+
+  /**
+   * If true, each IO thread keeps a TBufferPool that connections borrow
+   * their read buffers from, and return them to once a request has been
+   * processed.
+   */
+  bool useBufferPool_;
+
+  /**
+   * If true, every IO thread listens on its own SO_REUSEPORT socket and
+   * accepts its own connections, instead of IO thread 0 accepting them all.
+   */
+  bool useReusePort_;
+
+  /// TCP_FASTOPEN queue length for the listen sockets; 0 if off
+  int tcpFastOpen_;
+
+  /// TCP_DEFER_ACCEPT seconds for the listen sockets; 0 if off
+  int tcpDeferAccept_;
+
+  /// If true, connections ACK straight away (TCP_QUICKACK)
+  bool tcpQuickAck_;
+
+  /// SO_BUSY_POLL microseconds for connections; 0 if off
+  int busyPoll_;
+
+  /// SO_INCOMING_CPU for the listen sockets, or -1
+  int incomingCpu_;
+
+  /// Requests a connection may have in flight at once; <= 1 disables pipelining
+  size_t pipelineDepth_;
+
+  /// If true, pipelined responses are sent as they finish, not in order
+  bool pipelineOutOfOrder_;
+
+  /// Limit on the free memory held by each IO thread's buffer pool.
+  size_t bufferPoolLimit_;
+
+  /// Server-wide limit on pending bytes, 0 if there is none
+  size_t memoryBudget_;
+
+  /// Guards memoryInUse_, memoryWaiters_ and memoryWakeSent_
+  mutable Mutex memoryMutex_;
+
+  /// Pending bytes over all connections, while there is a budget
+  uint64_t memoryInUse_;
+
+  /// Connections that stopped reading until memory is freed
+  size_t memoryWaiters_;
+
+  /// True once the IO threads have been woken to resume them, until one has
+  bool memoryWakeSent_;
+
+  /// Idle connection objects made before serving, over all IO threads
+  size_t warmupConnections_;
+
+  /// Size and number of buffers put in each IO thread's pool before serving
+  uint32_t warmupBufferSize_;
+  size_t warmupBuffers_;
+
+  /// Stack touched by each ThreadManager worker before serving
+  size_t warmupStackBytes_;
+
+  /// A request run through the processor before serving, and how many times
+  std::string warmupRequest_;
+  uint32_t warmupRequestCount_;
+
   /// Set if we are currently in an overloaded state.
   bool overloaded_;
 
@@ -247,21 +484,38 @@ class TNonblockingServer : public TServer {
   /// Count of connections dropped on overload since server started
   uint64_t nTotalConnectionsDropped_;
 
-  /**
-   * This is a stack of all the objects that have been created but that
-   * are NOT currently in use. When we close a connection, we place it on this
-   * stack so that the object can be reused later, rather than freeing the
-   * memory and reallocating a new object later.
-   */
-  std::stack<TConnection*> connectionStack_;
+  /// Unix socket path a successor connects to, to take over; empty if none
+  std::string hotRestartPath_;
 
-  /**
-   * This container holds pointers to all active connections. This container
-   * allows the server to clean up unlcosed connection objects at destruction,
-   * which in turn allows their transports, protocols, processors and handlers
-   * to deallocate and clean up correctly.
-   */
-  std::vector<TConnection*> activeConnections_;
+  /// Whether idle connections are passed to the successor or closed
+  bool passConnections_;
+
+  /// Listens at hotRestartPath_ for the successor
+  THRIFT_SOCKET restartSocket_;
+
+  /// The server taking over from us, once it has connected
+  boost::shared_ptr<TSocket> successor_;
+
+  /// Serializes the IO threads' use of successor_
+  Mutex successorMutex_;
+
+  /// The server we are taking over from, until it has passed us everything
+  boost::shared_ptr<TSocket> predecessor_;
+
+  /// Listen sockets from the predecessor for IO threads 1 and up
+  std::vector<THRIFT_SOCKET> inheritedSockets_;
+
+  /// Set once drain() has been called
+  volatile bool draining_;
+
+  /// IO threads that have had no connections since drain() was called
+  size_t drainedIOThreads_;
+
+  /// The server's own port and factories, filled in by registerEvents()
+  Listener serverListener_;
+
+  /// Ports added with addListener(), accepted on by IO thread 0
+  std::vector<boost::shared_ptr<Listener> > listeners_;
 
   /**
    * Called when server socket had something happen.  We accept all waiting
@@ -270,33 +524,89 @@ class TNonblockingServer : public TServer {
    *
    * @param fd the listen socket.
    * @param which the event flag that triggered the handler.
+   * @param acceptThread the IO thread that owns fd.
+   */
+  void handleEvent(THRIFT_SOCKET fd, short which,
+                   TNonblockingIOThread* acceptThread);
+
+  /**
+   * Creates a socket and binds it to a local port, setting SO_REUSEPORT
+   * on it if useReusePort_ is set.
+   *
+   * @param port the port to bind, 0 for any.
+   * @return the bound socket.
+   */
+  THRIFT_SOCKET createBoundSocket(int port);
+
+  /// The added listener accepting on fd, or serverListener_.
+  const Listener* findListener(THRIFT_SOCKET fd) const;
+
+  /// The added listener for port, or serverListener_.
+  const Listener* findListenerByPort(int port) const;
+
+  /**
+   * Sets the options a listening socket needs and calls listen() on it.
+   * Closes the socket and throws on failure.
+   *
+   * @param fd the bound socket.
    */
-  void handleEvent(THRIFT_SOCKET fd, short which);
+  void prepareListenSocket(THRIFT_SOCKET fd);
 
   void init(int port) {
     serverSocket_ = THRIFT_INVALID_SOCKET;
     numIOThreads_ = DEFAULT_IO_THREADS;
     nextIOThread_ = 0;
     useHighPriorityIOThreads_ = false;
+    numaPlacement_ = false;
     port_ = port;
     userEventBase_ = NULL;
+    eventLoopBackend_ = TEventLoop::BACKEND_DEFAULT;
     threadPoolProcessing_ = false;
-    numTConnections_ = 0;
     numActiveProcessors_ = 0;
     connectionStackLimit_ = CONNECTION_STACK_LIMIT;
     maxActiveProcessors_ = MAX_ACTIVE_PROCESSORS;
     maxConnections_ = MAX_CONNECTIONS;
     maxFrameSize_ = MAX_FRAME_SIZE;
     taskExpireTime_ = 0;
+    idleTimeout_ = 0;
+    headerReadTimeout_ = 0;
+    bodyReadTimeout_ = 0;
+    headerTransport_ = false;
     overloadHysteresis_ = 0.8;
     overloadAction_ = T_OVERLOAD_NO_ACTION;
     writeBufferDefaultSize_ = WRITE_BUFFER_DEFAULT_SIZE;
     idleReadBufferLimit_ = IDLE_READ_BUFFER_LIMIT;
     idleWriteBufferLimit_ = IDLE_WRITE_BUFFER_LIMIT;
     resizeBufferEveryN_ = RESIZE_BUFFER_EVERY_N;
+    bufferTrimAge_ = 0;
+    useSegmentedWriteBuffers_ = false;
+    zeroCopyThreshold_ = 0;
+    useBufferPool_ = false;
+    useReusePort_ = false;
+    tcpFastOpen_ = 0;
+    tcpDeferAccept_ = 0;
+    tcpQuickAck_ = false;
+    busyPoll_ = 0;
+    incomingCpu_ = -1;
+    pipelineDepth_ = 1;
+    pipelineOutOfOrder_ = false;
+    bufferPoolLimit_ = TBufferPool::DEFAULT_MAX_FREE_BYTES;
+    memoryBudget_ = 0;
+    memoryInUse_ = 0;
+    memoryWaiters_ = 0;
+    memoryWakeSent_ = false;
+    warmupConnections_ = 0;
+    warmupBufferSize_ = 0;
+    warmupBuffers_ = 0;
+    warmupStackBytes_ = 0;
+    warmupRequestCount_ = 0;
     overloaded_ = false;
     nConnectionsDropped_ = 0;
     nTotalConnectionsDropped_ = 0;
+    passConnections_ = true;
+    restartSocket_ = THRIFT_INVALID_SOCKET;
+    draining_ = false;
+    drainedIOThreads_ = 0;
   }
 
  public:
@@ -395,6 +705,45 @@ class TNonblockingServer : public TServer {
     setThreadManager(threadManager);
   }
 
+  /**
+   * Serves requests with an async processor rather than a TProcessor.  The
+   * IO thread hands it each request and carries on with other connections;
+   * the connection waits, as it would on a task, until the processor's
+   * callback says the response is ready, which may be from any thread.
+   * The IO thread then sends it.  Neither the thread manager nor
+   * pipelining is used for these connections.
+   */
+  template<typename AsyncProcessorFactory>
+  TNonblockingServer(
+      const boost::shared_ptr<AsyncProcessorFactory>& asyncProcessorFactory,
+      const boost::shared_ptr<TProtocolFactory>& protocolFactory,
+      int port,
+      THRIFT_OVERLOAD_IF(AsyncProcessorFactory, TAsyncProcessorFactory)) :
+    TServer(boost::shared_ptr<TProcessorFactory>()),
+    asyncProcessorFactory_(asyncProcessorFactory) {
+
+    init(port);
+
+    setInputProtocolFactory(protocolFactory);
+    setOutputProtocolFactory(protocolFactory);
+  }
+
+  template<typename AsyncProcessor>
+  TNonblockingServer(
+      const boost::shared_ptr<AsyncProcessor>& asyncProcessor,
+      const boost::shared_ptr<TProtocolFactory>& protocolFactory,
+      int port,
+      THRIFT_OVERLOAD_IF(AsyncProcessor, TAsyncProcessor)) :
+    TServer(boost::shared_ptr<TProcessorFactory>()),
+    asyncProcessorFactory_(new apache::thrift::async::TSingletonAsyncProcessorFactory(
+                             asyncProcessor)) {
+
+    init(port);
+
+    setInputProtocolFactory(protocolFactory);
+    setOutputProtocolFactory(protocolFactory);
+  }
+
   ~TNonblockingServer();
 
   void setThreadManager(boost::shared_ptr<ThreadManager> threadManager);
@@ -413,6 +762,171 @@ class TNonblockingServer : public TServer {
     numIOThreads_ = numThreads;
   }
 
+  /**
+   * Sets the policy that picks the IO thread for each new connection.
+   * Connections are assigned round robin if no policy is set.  Not used
+   * for connections accepted on per-IO-thread sockets (setUseReusePort()).
+   */
+  void setIOThreadAssignmentPolicy(
+      boost::shared_ptr<TIOThreadAssignmentPolicy> policy) {
+    ioThreadAssignmentPolicy_ = policy;
+  }
+
+  boost::shared_ptr<TIOThreadAssignmentPolicy> getIOThreadAssignmentPolicy() const {
+    return ioThreadAssignmentPolicy_;
+  }
+
+  /**
+   * Sets the policy that gives each task a priority class from the name of
+   * the message it starts with, so that with a thread manager that honours
+   * them (ThreadManager::newSimpleThreadManager()) interactive calls are
+   * run ahead of batch ones under load.  Within a class, tasks run in
+   * order of expiration, which setTaskExpireTime() sets.  The header is
+   * read on the IO thread, so only the first message of a frame is ranked.
+   */
+  void setTaskPriorityPolicy(boost::shared_ptr<TTaskPriorityPolicy> policy) {
+    taskPriorityPolicy_ = policy;
+  }
+
+  boost::shared_ptr<TTaskPriorityPolicy> getTaskPriorityPolicy() const {
+    return taskPriorityPolicy_;
+  }
+
+  /**
+   * Sets the policy that picks, by the name of the message a frame starts
+   * with, calls cheap enough to run on the IO thread that read them rather
+   * than on the thread manager.  Such a call costs no hand-off to a worker
+   * and back, but holds up every other connection on its IO thread while
+   * it runs, so only calls that never block belong here.  Has no effect
+   * without a thread manager, where every call runs on its IO thread.
+   */
+  void setInlineCallPolicy(boost::shared_ptr<TInlineCallPolicy> policy) {
+    inlineCallPolicy_ = policy;
+  }
+
+  boost::shared_ptr<TInlineCallPolicy> getInlineCallPolicy() const {
+    return inlineCallPolicy_;
+  }
+
+  /**
+   * Sets the admission control that decides, as each call is read, whether
+   * to hand it to the thread manager or to answer it at once with a
+   * TApplicationException of type INTERNAL_ERROR, which costs the server
+   * next to nothing and tells the client to back off or try elsewhere.
+   * Unlike the overload actions, the connection stays open.  Calls run
+   * on the IO thread by the inline call policy are always let in.  Has no
+   * effect without a thread manager.
+   */
+  void setAdmissionControl(boost::shared_ptr<TAdmissionControl> admissionControl) {
+    admissionControl_ = admissionControl;
+  }
+
+  boost::shared_ptr<TAdmissionControl> getAdmissionControl() const {
+    return admissionControl_;
+  }
+
+  /**
+   * Sets the quota each client, or each connection, is held to as its
+   * calls are read.  A call over it is answered at once with a
+   * TApplicationException of type INTERNAL_ERROR, before admission control
+   * or the inline call policy see it, so one client flooding an IO thread
+   * cannot crowd out the others on it.  The limits may be changed through
+   * the quota while the server runs, but the quota itself is set before
+   * serve().  Has no effect without a thread manager.
+   */
+  void setConnectionQuota(boost::shared_ptr<TConnectionQuota> connectionQuota) {
+    connectionQuota_ = connectionQuota;
+  }
+
+  boost::shared_ptr<TConnectionQuota> getConnectionQuota() const {
+    return connectionQuota_;
+  }
+
+  /**
+   * Sets whether every connection reads and writes through a
+   * THeaderTransport and THeaderProtocol instead of the transport and
+   * protocol factories.  One port then serves header clients, whatever
+   * protocol and transforms they use, framed binary, compact and JSON
+   * clients, and unframed binary and compact clients, each answered as it
+   * asked.  A header client's client_timeout header sets the deadline of
+   * its call, as a TDeadline prefix does.  Unframed clients need a
+   * pipeline depth of 1.
+   */
+  void setHeaderTransport(bool headerTransport) {
+    headerTransport_ = headerTransport;
+  }
+
+  bool getHeaderTransport() const {
+    return headerTransport_;
+  }
+
+  /**
+   * Accepts transform id from header clients, undoing and applying it with
+   * what factory makes, e.g. THeaderTransport::ZLIB_TRANSFORM with a
+   * TZlibTransportFactory.  All transforms must be set before serve().
+   */
+  void setHeaderTransform(uint16_t id,
+                          boost::shared_ptr<transport::TTransportFactory> factory) {
+    headerTransforms_[id] = factory;
+  }
+
+  const THeaderTransport::TransformMap& getHeaderTransforms() const {
+    return headerTransforms_;
+  }
+
+  /**
+   * Sets whether IO thread i runs on, and takes its memory from, NUMA node
+   * i modulo the number of nodes, under the name thrift-io-i.  Applied as
+   * each IO thread starts, including the one that calls serve().
+   */
+  void setNumaPlacement(bool numaPlacement) {
+    numaPlacement_ = numaPlacement;
+  }
+
+  bool getNumaPlacement() const {
+    return numaPlacement_;
+  }
+
+  /**
+   * Gives IO thread i the thread manager ioThreadManagers[i] for the calls
+   * it reads, where that is set, instead of the server's.  With workers
+   * made by a factory placed on IO thread i's node (see setNumaPlacement()
+   * and PosixThreadFactory::setPlacement()), a call is read, run and
+   * answered without leaving the node.  The server's thread manager is
+   * still needed, and runs the calls of the other IO threads.
+   */
+  void setIOThreadManagers(
+      const std::vector<boost::shared_ptr<ThreadManager> >& ioThreadManagers);
+
+  const std::vector<boost::shared_ptr<ThreadManager> >& getIOThreadManagers() const {
+    return ioThreadManagers_;
+  }
+
+  /**
+   * Gives the calls of a service a thread manager of its own, so that a
+   * slow service only ties up its own workers and the others' calls keep
+   * running: the service's thread manager is its bulkhead, and the number
+   * of its workers bounds the calls of the service run at once.
+   *
+   * name is "Service" for every call TMultiplexedProcessor hands to the
+   * processor registered as Service, "Service:method" for one method of
+   * it, or the method name of a service not multiplexed; names are looked
+   * up as TNamedTaskPriorityPolicy looks them up.  Calls of other services
+   * go to the thread manager they would have otherwise, which the server
+   * still needs.  The header is read on the IO thread, so only the first
+   * message of a frame picks the thread manager.  Set up before serving;
+   * a NULL threadManager removes the service's.
+   */
+  void setServiceThreadManager(const std::string& name,
+                               boost::shared_ptr<ThreadManager> threadManager);
+
+  /// The thread manager of the service a message is for, NULL if none
+  ThreadManager* getServiceThreadManager(const std::string& name) const;
+
+  bool hasServiceThreadManagers() const {
+    return !serviceThreadManagers_.empty();
+  }
+
   /** Return whether the IO threads will get high scheduling priority */
   bool useHighPriorityIOThreads() const {
     return useHighPriorityIOThreads_;
@@ -439,6 +953,8 @@ class TNonblockingServer : public TServer {
 
   /**
    * Set the maximum number of unused TConnection we will hold in reserve.
+   * Each IO thread keeps its own share of them, reusing the one it closed
+   * last and freeing the one it closed longest ago when over its share.
    *
    * @param sz the new limit for TConnection pool size.
    */
@@ -450,8 +966,43 @@ class TNonblockingServer : public TServer {
     return threadPoolProcessing_;
   }
 
-  void addTask(boost::shared_ptr<Runnable> task) {
-    threadManager_->add(task, 0LL, taskExpireTime_);
+  /// The async processors' factory, or NULL if TProcessors are used
+  boost::shared_ptr<TAsyncProcessorFactory> getAsyncProcessorFactory() const {
+    return asyncProcessorFactory_;
+  }
+
+  /**
+   * Hands a task to threadManager if set, else to the thread manager of
+   * the IO thread that read it.
+   *
+   * The task expires after the task expire time or at deadline, the
+   * absolute time in milliseconds the client sent (see TDeadline), if that
+   * comes first; the thread manager drops a task that expires before a
+   * worker gets to it, and the connection is closed as for any expired task.
+   */
+  void addTask(boost::shared_ptr<Runnable> task, int priority = 0,
+               int ioThreadNumber = -1, int64_t deadline = 0,
+               ThreadManager* threadManager = NULL) {
+    if (threadManager == NULL) {
+      threadManager = threadManager_.get();
+      if (ioThreadNumber >= 0 &&
+          static_cast<size_t>(ioThreadNumber) < ioThreadManagers_.size() &&
+          ioThreadManagers_[ioThreadNumber]) {
+        threadManager = ioThreadManagers_[ioThreadNumber].get();
+      }
+    }
+    int64_t expiration = taskExpireTime_;
+    if (deadline != 0) {
+      // An expiration of 0 would mean never, so one already late gets 1
+      int64_t left = deadline - Util::cachedTime();
+      if (left < 1) {
+        left = 1;
+      }
+      if (expiration == 0 || left < expiration) {
+        expiration = left;
+      }
+    }
+    threadManager->addWithPriority(task, priority, 0LL, expiration);
   }
 
   /**
@@ -459,27 +1010,31 @@ class TNonblockingServer : public TServer {
    *
    * @return count of connected sockets.
    */
-  size_t getNumConnections() const {
-    return numTConnections_;
-  }
+  size_t getNumConnections() const;
 
   /**
    * Return the count of sockets currently connected to.
    *
    * @return count of connected sockets.
    */
-  size_t getNumActiveConnections() const {
-    return getNumConnections() - getNumIdleConnections();
-  }
+  size_t getNumActiveConnections() const;
 
   /**
    * Return the count of connection objects allocated but not in use.
    *
    * @return count of idle connection objects.
    */
-  size_t getNumIdleConnections() const {
-    return connectionStack_.size();
-  }
+  size_t getNumIdleConnections() const;
+
+  /**
+   * Fills _return with each IO thread's stats, and its connections' if
+   * withConnections, for an admin endpoint such as TServerIntrospection.
+   * The threads are asked together, and waited for up to timeoutMs in all;
+   * see TNonblockingIOThread::requestStats().
+   */
+  void getIOThreadStats(std::vector<TIOThreadStats>& _return,
+                        bool withConnections,
+                        int64_t timeoutMs = 1000) const;
 
   /**
    * Return count of number of connections which are currently processing.
@@ -621,6 +1176,49 @@ class TNonblockingServer : public TServer {
     taskExpireTime_ = taskExpireTime;
   }
 
+  /**
+   * Set the time in milliseconds a connection may wait between requests,
+   * or for its first, before it is closed (0 == infinite).  Connections
+   * waiting on the server, for a call to run or a response to be sent,
+   * are not timed out.  Set before serving.
+   */
+  void setIdleTimeout(int64_t idleTimeout) {
+    idleTimeout_ = idleTimeout;
+  }
+
+  int64_t getIdleTimeout() const {
+    return idleTimeout_;
+  }
+
+  /**
+   * Set the time in milliseconds a client may take to send the frame size
+   * of a request once it has sent the first byte (0 == infinite).  Set
+   * before serving.
+   */
+  void setHeaderReadTimeout(int64_t headerReadTimeout) {
+    headerReadTimeout_ = headerReadTimeout;
+  }
+
+  int64_t getHeaderReadTimeout() const {
+    return headerReadTimeout_;
+  }
+
+  /**
+   * Set the time in milliseconds a client may take to send the rest of a
+   * request once its frame size is in, or all of an unframed request
+   * (0 == infinite).  Unlike a socket timeout, this is not restarted by
+   * each byte, so a client trickling a request in can't hold on to its
+   * connection and read buffer.  Allow for the largest requests on the
+   * slowest links.  Set before serving.
+   */
+  void setBodyReadTimeout(int64_t bodyReadTimeout) {
+    bodyReadTimeout_ = bodyReadTimeout;
+  }
+
+  int64_t getBodyReadTimeout() const {
+    return bodyReadTimeout_;
+  }
+
   /**
    * Determine if the server is currently overloaded.
    * This function checks the maximums for open connections and connections
@@ -727,97 +1325,669 @@ class TNonblockingServer : public TServer {
   }
 
   /**
-   * Get # of calls made between buffer size checks.  0 means disabled.
+   * Get the memory budget of the whole server.
    *
-   * @return # of calls between buffer size checks.
+   * @return # bytes, 0 if there is no budget.
    */
-  int32_t getResizeBufferEveryN() const {
-    return resizeBufferEveryN_;
+  size_t getMemoryBudget() const {
+    return memoryBudget_;
   }
 
   /**
-   * Check buffer sizes every "count" calls.  This allows buffer limits
-   * to be enforced for persistant connections with a controllable degree
-   * of overhead. 0 disables checks except at connection close.
+   * Set a memory budget for the whole server, on what the IO threads count
+   * as pending bytes over all connections: requests being read, requests
+   * queued for or being processed, and responses being sent.  The idle
+   * buffer limits and the maximum frame size only bound each connection.
    *
-   * @param count the number of calls between checks, or 0 to disable
+   * A connection only starts reading a request once its frame size fits
+   * in what is left of the budget.  Until then it stops reading from its
+   * socket, without a timeout, and its client is held back by TCP flow
+   * control, so the server slows down rather than running out of memory.
+   * A request is let in whenever nothing is counted, so one larger than
+   * the budget is served alone.  Pipelined connections stop reading
+   * between frames while the budget is used up.  Responses are never held
+   * back, since sending them is what frees memory.  Must be set before
+   * serve().
+   *
+   * @param budget # bytes, 0 for none.
    */
-  void setResizeBufferEveryN(int32_t count) {
-    resizeBufferEveryN_ = count;
+  void setMemoryBudget(size_t budget) {
+    memoryBudget_ = budget;
   }
 
   /**
-   * Main workhorse function, starts up the server listening on a port and
-   * loops over the libevent handler.
+   * Get the bytes counted against the memory budget.
+   *
+   * @return # bytes; 0 if there is no budget.
    */
-  void serve();
+  uint64_t getMemoryInUse() const {
+    Guard g(memoryMutex_);
+    return memoryInUse_;
+  }
 
   /**
-   * Causes the server to terminate gracefully (can be called from any thread).
+   * Get the number of connection objects made before serving.
+   *
+   * @return # connections over all IO threads, 0 for none.
    */
-  void stop();
-
-  /// Creates a socket to listen on and binds it to the local port.
-  void createAndListenOnSocket();
+  size_t getWarmupConnections() const {
+    return warmupConnections_;
+  }
 
   /**
-   * Takes a socket created by createAndListenOnSocket() and sets various
-   * options on it to prepare for use in the server.
+   * Make this many connection objects before serving, shared out between
+   * the IO threads and kept as idle connections for the first clients to
+   * take, so the first minute after a restart is not spent in the
+   * allocator and in page faults.  Each IO thread makes its share on its
+   * own thread, after NUMA placement, and keeps no more than its share of
+   * the connection stack limit.  Their read buffers are allocated up to
+   * the idle read buffer limit, unless read buffers come from a pool.
+   * Like any idle connection, they are freed after the buffer trim age if
+   * one is set.  Must be set before serve().
    *
-   * @param fd descriptor of socket to be initialized/
+   * @param count # connections over all IO threads, 0 for none.
    */
-  void listenSocket(THRIFT_SOCKET fd);
+  void setWarmupConnections(size_t count) {
+    warmupConnections_ = count;
+  }
 
   /**
-   * Register the optional user-provided event-base (for single-thread servers)
-   *
-   * This method should be used when the server is running in a single-thread
-   * mode, and the event base is provided by the user (i.e., the caller).
+   * Fill each IO thread's buffer pool before serving, with count buffers
+   * of at least size bytes whose pages have all been touched.  Only
+   * applies with setUseBufferPool(), and is capped by the pool's limit.
+   * Must be set before serve().
    *
-   * @param user_event_base the user-provided event-base. The user is
-   * responsible for freeing the event base memory.
+   * @param size # bytes in each buffer.
+   * @param count # buffers per IO thread, 0 for none.
    */
-  void registerEvents(event_base* user_event_base);
+  void setWarmupBuffers(uint32_t size, size_t count) {
+    warmupBufferSize_ = size;
+    warmupBuffers_ = count;
+  }
+
+  uint32_t getWarmupBufferSize() const {
+    return warmupBufferSize_;
+  }
+
+  size_t getWarmupBuffers() const {
+    return warmupBuffers_;
+  }
 
   /**
-   * Returns the optional user-provided event-base (for single-thread servers).
+   * Have each worker of the ThreadManager touch this much of its stack
+   * before serving, so the pages are mapped before the first requests
+   * need them.  The ThreadManager must have been started, and bytes must
+   * be well short of the stack size its thread factory gives workers.
+   * Must be set before serve().
+   *
+   * @param bytes # bytes of stack, 0 for none.
    */
-  event_base* getUserEventBase() const { return userEventBase_; }
+  void setWarmupStackBytes(size_t bytes) {
+    warmupStackBytes_ = bytes;
+  }
+
+  size_t getWarmupStackBytes() const {
+    return warmupStackBytes_;
+  }
 
- private:
   /**
-   * Callback function that the threadmanager calls when a task reaches
-   * its expiration time.  It is needed to clean up the expired connection.
+   * Run request through the server's processor times times before
+   * serving, to fill caches and do whatever the handler does lazily.
+   * request is one message as the input protocol reads it, without the
+   * frame size; its responses are thrown away.  The handler is really
+   * called, so use a call that is safe to repeat, such as a health check.
+   * Failures are logged and do not stop the server starting.  Only the
+   * server's own processor is run, not an asynchronous one.  Must be set
+   * before serve().
    *
-   * @param task the runnable associated with the expired task.
+   * @param request the serialized request.
+   * @param times how many times to run it, 0 for none.
    */
-  void expireClose(boost::shared_ptr<Runnable> task);
+  void setWarmupRequest(const std::string& request, uint32_t times) {
+    warmupRequest_ = request;
+    warmupRequestCount_ = times;
+  }
 
   /**
-   * Return an initialized connection object.  Creates or recovers from
-   * pool a TConnection and initializes it with the provided socket FD
-   * and flags.
+   * Get # of calls made between buffer size checks.  0 means disabled.
    *
-   * @param socket FD of socket associated with this connection.
-   * @param addr the sockaddr of the client
-   * @param addrLen the length of addr
-   * @return pointer to initialized TConnection object.
+   * @return # of calls between buffer size checks.
    */
-  TConnection* createConnection(THRIFT_SOCKET socket, const sockaddr* addr,
-                                            socklen_t addrLen);
+  int32_t getResizeBufferEveryN() const {
+    return resizeBufferEveryN_;
+  }
 
   /**
-   * Returns a connection to pool or deletion.  If the connection pool
-   * (a stack) isn't full, place the connection object on it, otherwise
-   * just delete it.
+   * Check buffer sizes every "count" calls.  This allows buffer limits
+   * to be enforced for persistant connections with a controllable degree
+   * of overhead. 0 disables checks except at connection close.
    *
-   * @param connection the TConection being returned.
+   * @param count the number of calls between checks, or 0 to disable
    */
-  void returnConnection(TConnection* connection);
-};
+  void setResizeBufferEveryN(int32_t count) {
+    resizeBufferEveryN_ = count;
+  }
 
-class TNonblockingIOThread : public Runnable {
+  /**
+   * Get the age in milliseconds at which unused buffers are trimmed.
+   *
+   * @return the age, or 0 if buffers are checked every N calls.
+   */
+  int64_t getBufferTrimAge() const {
+    return bufferTrimAge_;
+  }
+
+  /**
+   * Trim buffers by age instead of every N calls.  A connection's buffers
+   * beyond the idle limits are trimmed once no call has needed them for
+   * age milliseconds, and idle TConnection objects held in reserve for
+   * that long are freed.  0 (the default) means setResizeBufferEveryN()
+   * applies, and idle objects are trimmed as they are put in reserve.
+   * Must be called before serve().
+   *
+   * @param age milliseconds, or 0 to check every N calls.
+   */
+  void setBufferTrimAge(int64_t age) {
+    bufferTrimAge_ = age;
+  }
+
+  /**
+   * Get whether connections write responses into segmented buffers.
+   *
+   * @return true if TSegmentedMemoryBuffer is used for responses.
+   */
+  bool getUseSegmentedWriteBuffers() const {
+    return useSegmentedWriteBuffers_;
+  }
+
+  /**
+   * Set whether connections write responses into a TSegmentedMemoryBuffer
+   * (with segments of the write buffer default size) rather than a
+   * TMemoryBuffer.  Large responses then grow without being copied, and are
+   * sent straight from their segments.  Must be set before serve().
+   * Processors generated with the templates option then need to be
+   * instantiated over a protocol on TBufferBase, which both buffers share,
+   * such as TNonblockingBinaryProtocol, to keep their specialized path.
+   *
+   * @param val true to use segmented write buffers.
+   */
+  void setUseSegmentedWriteBuffers(bool val) {
+    useSegmentedWriteBuffers_ = val;
+  }
+
+  /**
+   * Get the size from which responses are sent with MSG_ZEROCOPY.
+   *
+   * @return # bytes, or 0 if responses are always copied.
+   */
+  uint32_t getZeroCopyThreshold() const {
+    return zeroCopyThreshold_;
+  }
+
+  /**
+   * Send responses of at least bytes bytes, frame size included, with
+   * MSG_ZEROCOPY where Linux supports it, so the kernel sends them from
+   * the response buffer instead of copying them into the socket first.
+   * The kernel reports when it is done with the buffer through the
+   * socket's error queue; until then the buffer is set aside and the
+   * connection's next response is written into another one, from the IO
+   * thread's pool with setUseBufferPool().  Worth it from a few hundred KB
+   * up.  TLS, pipelined connections and segmented write buffers are always
+   * copied, as are connections whose sends the kernel copies anyway, such
+   * as over loopback.  0 (the default) disables zero copy sends.
+   *
+   * @param bytes the smallest response to send without copying, or 0.
+   */
+  void setZeroCopyThreshold(uint32_t bytes) {
+    zeroCopyThreshold_ = bytes;
+  }
+
+  /**
+   * Get whether connections borrow read buffers from a per-IO-thread pool.
+   *
+   * @return true if read buffers are pooled.
+   */
+  bool getUseBufferPool() const {
+    return useBufferPool_;
+  }
+
+  /**
+   * Set whether connections borrow their read buffers from a TBufferPool
+   * owned by their IO thread.  A connection takes a buffer when a frame
+   * arrives and returns it as soon as the request has been processed, so
+   * idle connections hold no read buffer and steady-state traffic does no
+   * malloc for it.  Must be set before serve().
+   *
+   * @param val true to pool read buffers.
+   */
+  void setUseBufferPool(bool val) {
+    useBufferPool_ = val;
+  }
+
+  /**
+   * Get the limit on free memory held by each IO thread's buffer pool.
+   *
+   * @return # bytes of free buffers kept per IO thread.
+   */
+  size_t getBufferPoolLimit() const {
+    return bufferPoolLimit_;
+  }
+
+  /**
+   * Set the limit on free memory held by each IO thread's buffer pool.
+   * Buffers returned beyond this are freed.  Must be set before serve().
+   *
+   * @param limit # bytes of free buffers kept per IO thread.
+   */
+  void setBufferPoolLimit(size_t limit) {
+    bufferPoolLimit_ = limit;
+  }
+
+  /**
+   * Get whether each IO thread accepts on its own SO_REUSEPORT socket.
+   *
+   * @return true if per-IO-thread accept is in use.
+   */
+  bool getUseReusePort() const {
+    return useReusePort_;
+  }
+
+  /**
+   * Set whether each IO thread should listen on its own SO_REUSEPORT socket
+   * bound to the server port.  The kernel then spreads incoming connections
+   * across the threads, and each connection stays on the thread that
+   * accepted it, rather than thread #0 accepting everything and handing
+   * connections around.  Ignored where SO_REUSEPORT is not available, and
+   * when a listen socket was passed in with listenSocket().  Must be set
+   * before serve().
+   *
+   * @param val true to accept on every IO thread.
+   */
+  void setUseReusePort(bool val) {
+    useReusePort_ = val;
+  }
+
+  /**
+   * Set the number of TCP Fast Open connections (data on the SYN) the
+   * listen sockets may have pending.  0, the default, turns Fast Open off.
+   * Must be set before serve().
+   *
+   * @param queueLen the TCP_FASTOPEN queue length.
+   */
+  void setTcpFastOpen(int queueLen) {
+    tcpFastOpen_ = queueLen;
+  }
+
+  int getTcpFastOpen() const {
+    return tcpFastOpen_;
+  }
+
+  /**
+   * Set how many seconds the kernel holds a new connection back from
+   * accept() waiting for its first data.  0, the default, turns
+   * TCP_DEFER_ACCEPT off.  Must be set before serve().
+   *
+   * @param seconds the longest wait for data.
+   */
+  void setTcpDeferAccept(int seconds) {
+    tcpDeferAccept_ = seconds;
+  }
+
+  int getTcpDeferAccept() const {
+    return tcpDeferAccept_;
+  }
+
+  /**
+   * Set whether connections ACK requests straight away instead of
+   * delaying the ACK; see TSocket::setQuickAck().
+   *
+   * @param val true to set TCP_QUICKACK after every read.
+   */
+  void setTcpQuickAck(bool val) {
+    tcpQuickAck_ = val;
+  }
+
+  bool getTcpQuickAck() const {
+    return tcpQuickAck_;
+  }
+
+  /**
+   * Set how long, in microseconds, reads on the listen sockets and
+   * connections may busy-poll the device queue (SO_BUSY_POLL).  0, the
+   * default, turns it off.
+   *
+   * @param usec the busy poll time.
+   */
+  void setBusyPoll(int usec) {
+    busyPoll_ = usec;
+  }
+
+  int getBusyPoll() const {
+    return busyPoll_;
+  }
+
+  /**
+   * Set the CPU whose SYNs the listen sockets prefer among SO_REUSEPORT
+   * listeners (SO_INCOMING_CPU).  -1, the default, leaves it to the
+   * kernel.  Must be set before serve().
+   *
+   * @param cpu the CPU number.
+   */
+  void setIncomingCpu(int cpu) {
+    incomingCpu_ = cpu;
+  }
+
+  int getIncomingCpu() const {
+    return incomingCpu_;
+  }
+
+  /**
+   * Get the number of requests a connection may have in flight at once.
+   *
+   * @return the pipeline depth; 1 means requests are handled one at a time.
+   */
+  size_t getPipelineDepth() const {
+    return pipelineDepth_;
+  }
+
+  /**
+   * Set the number of requests a connection may have in flight at once.
+   * With a depth above 1, every complete frame a client has sent is
+   * dispatched as soon as it arrives (to the thread manager, if there is
+   * one) rather than after the previous response has gone out, so the
+   * processor may be called concurrently for one connection.  Responses
+   * are sent in request order unless setPipelineOutOfOrder() is set.
+   * Must be set before serve().
+   *
+   * @param depth maximum requests in flight per connection.
+   */
+  void setPipelineDepth(size_t depth) {
+    pipelineDepth_ = depth;
+  }
+
+  /**
+   * Get whether pipelined responses may be sent out of request order.
+   *
+   * @return true if responses are sent as they finish.
+   */
+  bool getPipelineOutOfOrder() const {
+    return pipelineOutOfOrder_;
+  }
+
+  /**
+   * Set whether pipelined responses are sent as soon as they finish rather
+   * than in request order.  Only for clients that match replies to calls by
+   * seqid.
+   *
+   * @param val true to send responses as they finish.
+   */
+  void setPipelineOutOfOrder(bool val) {
+    pipelineOutOfOrder_ = val;
+  }
+
+  /**
+   * Main workhorse function, starts up the server listening on a port and
+   * loops over the libevent handler.
+   */
+  void serve();
+
+  /**
+   * Causes the server to terminate gracefully (can be called from any thread).
+   */
+  void stop();
+
+  /// Creates a socket to listen on and binds it to the local port.
+  void createAndListenOnSocket();
+
+  /**
+   * Takes a socket created by createAndListenOnSocket() and sets various
+   * options on it to prepare for use in the server.
+   *
+   * @param fd descriptor of socket to be initialized/
+   */
+  void listenSocket(THRIFT_SOCKET fd);
+
+  /**
+   * Accepts connections on another port as well, serving them with
+   * processorFactory and these factories rather than the server's own.
+   * Each listener shares the IO threads, thread managers, limits and event
+   * handler with the server's port, so one server can serve an internal
+   * and an external port, say, without the threads of two.  IO thread 0
+   * accepts on every listener.  TLS and header detection apply to all
+   * ports alike.  Must be called before serve(), and before takeOver() for
+   * the predecessor's socket on the same port to be taken over.
+   *
+   * @param port the port to listen on; 0 for any, see getListenerPort().
+   */
+  template<typename ProcessorFactory>
+  void addListener(int port,
+                   const boost::shared_ptr<ProcessorFactory>& processorFactory,
+                   const boost::shared_ptr<TTransportFactory>& transportFactory,
+                   const boost::shared_ptr<TProtocolFactory>& protocolFactory,
+                   THRIFT_OVERLOAD_IF(ProcessorFactory, TProcessorFactory)) {
+    addListener(port, boost::shared_ptr<TProcessorFactory>(processorFactory),
+                transportFactory, transportFactory,
+                protocolFactory, protocolFactory);
+  }
+
+  template<typename Processor>
+  void addListener(int port,
+                   const boost::shared_ptr<Processor>& processor,
+                   const boost::shared_ptr<TTransportFactory>& transportFactory,
+                   const boost::shared_ptr<TProtocolFactory>& protocolFactory,
+                   THRIFT_OVERLOAD_IF(Processor, TProcessor)) {
+    addListener(port,
+                boost::shared_ptr<TProcessorFactory>(
+                  new TSingletonProcessorFactory(processor)),
+                transportFactory, transportFactory,
+                protocolFactory, protocolFactory);
+  }
+
+  void addListener(int port,
+                   const boost::shared_ptr<TProcessorFactory>& processorFactory,
+                   const boost::shared_ptr<TTransportFactory>& inputTransportFactory,
+                   const boost::shared_ptr<TTransportFactory>& outputTransportFactory,
+                   const boost::shared_ptr<TProtocolFactory>& inputProtocolFactory,
+                   const boost::shared_ptr<TProtocolFactory>& outputProtocolFactory);
+
+  /// Number of ports added with addListener()
+  size_t getNumListeners() const {
+    return listeners_.size();
+  }
+
+  /**
+   * Returns the server's port; for a server made with port 0, the port it
+   * was bound to once serve() has been called.
+   */
+  int getPort() const {
+    return port_;
+  }
+
+  /**
+   * Returns the port of the i'th listener added; for one added with port
+   * 0, the port it was bound to once serve() has been called.
+   */
+  int getListenerPort(size_t i) const {
+    return listeners_[i]->port;
+  }
+
+  /**
+   * Lets a new server process take over from this one without dropping
+   * clients.  The server listens on a Unix domain socket at path, and a
+   * successor that calls takeOver(path) is handed the listen sockets;
+   * this server then drains, see drain().  With passConnections, each
+   * connection is passed to the successor once it is between requests,
+   * rather than closed, except TLS ones.  Must be called before serve().
+   *
+   * @param path where to listen for the successor; any file there is
+   *             removed.
+   * @param passConnections whether to pass connections as well.
+   */
+  void setHotRestartPath(const std::string& path, bool passConnections = true) {
+    hotRestartPath_ = path;
+    passConnections_ = passConnections;
+  }
+
+  const std::string& getHotRestartPath() const {
+    return hotRestartPath_;
+  }
+
+  /**
+   * Takes over from the server listening for a successor at path: serves
+   * on its listen sockets, and on the connections it passes on while it
+   * drains.  Use instead of listenSocket(), before serve().
+   *
+   * @param path the predecessor's setHotRestartPath().
+   * @throws TException if the predecessor can't be reached or sends no
+   *         listen socket.
+   */
+  void takeOver(const std::string& path);
+
+  /**
+   * Stops accepting and closes each connection as soon as it is between
+   * requests, or passes it to the successor.  Once no connection is left,
+   * joins the thread managers, so the tasks they still hold are finished,
+   * and serve() returns.  Unlike stop(), no request under way is dropped.
+   * Can be called from any thread.
+   */
+  void drain();
+
+  /// Whether drain() has been called
+  bool isDraining() const {
+    return draining_;
+  }
+
+  /**
+   * Register the optional user-provided event-base (for single-thread servers)
+   *
+   * This method should be used when the server is running in a single-thread
+   * mode, and the event base is provided by the user (i.e., the caller).
+   *
+   * @param user_event_base the user-provided event-base. The user is
+   * responsible for freeing the event base memory.
+   */
+  void registerEvents(event_base* user_event_base);
+
+  /**
+   * Returns the optional user-provided event-base (for single-thread servers).
+   */
+  event_base* getUserEventBase() const { return userEventBase_; }
+
+  /**
+   * Sets the event loop the IO threads run: libevent (the default), or
+   * epoll or kqueue used directly.  A user-provided event-base always means
+   * libevent.  Must be called before serve().
+   */
+  void setEventLoopBackend(TEventLoop::Backend backend) {
+    eventLoopBackend_ = backend;
+  }
+
+  TEventLoop::Backend getEventLoopBackend() const {
+    return eventLoopBackend_;
+  }
+
+  /**
+   * Speak TLS on every connection, with the certificates, ciphers and
+   * peer checks set up on factory.  Handshakes and records are driven by
+   * the IO threads like the rest of the connection, through memory buffers,
+   * so they never block a thread.  The processor and the server event
+   * handler get the connection's TSSLSocket.  The factory must be in
+   * server mode.  Must be called before serve().
+   */
+  void setSSLSocketFactory(boost::shared_ptr<TSSLSocketFactory> factory) {
+    sslSocketFactory_ = factory;
+  }
+
+  boost::shared_ptr<TSSLSocketFactory> getSSLSocketFactory() const {
+    return sslSocketFactory_;
+  }
+
+ private:
+  /// What the warmup setters ask of the server as a whole
+  void warmUp();
+
+  /**
+   * Callback function that the threadmanager calls when a task reaches
+   * its expiration time.  It is needed to clean up the expired connection.
+   *
+   * @param task the runnable associated with the expired task.
+   */
+  void expireClose(boost::shared_ptr<Runnable> task);
+
+  /**
+   * Picks the IO thread to handle a newly accepted connection.
+   *
+   * @param acceptThread the thread that accepted it, or NULL for one
+   *                     passed by the predecessor.
+   */
+  TNonblockingIOThread* selectIOThread(TNonblockingIOThread* acceptThread);
+
+  /**
+   * Starts handling a new socket on ioThread, from the thread it was
+   * accepted or received on.
+   */
+  void adoptSocket(THRIFT_SOCKET socket, const sockaddr* addr,
+                   socklen_t addrLen, const Listener* listener,
+                   TNonblockingIOThread* ioThread,
+                   TNonblockingIOThread* currentThread);
+
+  /// Listens at hotRestartPath_ on restartSocket_.
+  void createRestartSocket();
+
+  /**
+   * Accepts the successor on restartSocket_, passes it the listen sockets
+   * and starts draining.
+   */
+  void acceptSuccessor();
+
+  /**
+   * Starts the connections in a batch passed by the predecessor.
+   *
+   * @return false once the predecessor has nothing more to pass.
+   */
+  bool receiveConnections(TNonblockingIOThread* acceptThread);
+
+  /**
+   * Passes a connection's socket to the successor, if there is one.
+   *
+   * @return true if it was passed, and only needs closing here.
+   */
+  bool passConnection(THRIFT_SOCKET fd);
+
+  /// Called by each IO thread once it has no connections left to drain.
+  void ioThreadDrained();
+
+  /**
+   * Takes bytes out of the memory budget, if they fit in it or nothing is
+   * counted against it.  Otherwise the caller is counted as waiting, and
+   * must wait for its IO thread's resumeMemoryWaiters().
+   *
+   * @return true if the bytes were taken.
+   */
+  bool reserveMemory(uint64_t bytes);
+
+  /// Counts delta bytes against the memory budget, whether they fit or not,
+  /// waking the IO threads if freeing them leaves room for waiters.
+  void chargeMemory(int64_t delta);
+
+  /// Called for each waiter that stops waiting, resumed or closed.
+  void leaveMemoryWait();
+
+  /// Called by an IO thread as it resumes its waiters.
+  void memoryWakeTaken();
+};
+
+class TNonblockingIOThread : public Runnable {
  public:
+  /// What a connection waits for from its client, each with its timeout
+  enum Wait {
+    WAIT_NONE = -1,
+    WAIT_IDLE,
+    WAIT_HEADER,
+    WAIT_BODY,
+    WAIT_KINDS
+  };
+
   // Creates an IO thread and sets up the event base.  The listenSocket should
   // be a valid FD on which listen() has already been called.  If the
   // listenSocket is < 0, accepting will not be done.
@@ -828,12 +1998,75 @@ class TNonblockingIOThread : public Runnable {
 
   ~TNonblockingIOThread();
 
-  // Returns the event-base for this thread.
-  event_base* getEventBase() const { return eventBase_; }
+  // Returns the event-base for this thread, or NULL unless it runs libevent.
+  event_base* getEventBase() const {
+    return eventLoop_ ? eventLoop_->getEventBase() : NULL;
+  }
+
+  // Returns the event loop for this thread.
+  TEventLoop* getEventLoop() const { return eventLoop_.get(); }
 
   // Returns the server for this thread.
   TNonblockingServer* getServer() const { return server_; }
 
+  // Returns the number of connections currently assigned to this thread.
+  size_t getNumConnections() const {
+    return atomicLoad<ATOMIC_RELAXED>(&numConnections_);
+  }
+
+  // Returns the bytes of requests being read or processed and responses
+  // waiting to be sent, summed over this thread's connections.
+  uint64_t getPendingBytes() const {
+    return atomicLoad<ATOMIC_RELAXED>(&pendingBytes_);
+  }
+
+  // Returns the number of idle connection objects this thread holds.
+  size_t getNumCachedConnections() const {
+    return atomicLoad<ATOMIC_RELAXED>(&numCachedConnections_);
+  }
+
+  // Asks the thread to take its stats, and its connections' if
+  // withConnections, waking it.  Its connections and buffer pool are only
+  // touched by the thread, so another can't read them itself.  Returns a
+  // ticket for waitForStats().  Called from the thread, takes them at once.
+  uint64_t requestStats(bool withConnections);
+
+  // Waits until deadline, in ms as Util::monotonicTime(), for the stats asked
+  // for with ticket.  Returns false if the thread didn't answer in time, as
+  // when it isn't running, leaving stats with just the counts.
+  bool waitForStats(uint64_t ticket, int64_t deadline, TIOThreadStats& stats);
+
+  // Adjusts the counters behind getNumConnections() and getPendingBytes().
+  void addConnections(int delta) {
+    atomicAdd(&numConnections_, static_cast<size_t>(delta));
+  }
+  void addPendingBytes(int64_t delta) {
+    atomicAdd(&pendingBytes_, static_cast<uint64_t>(delta));
+  }
+
+  // Keeps conn, which has stopped reading, until resumeMemoryWaiters(), or
+  // forgets it when it closes.  Only to be used from this thread.
+  void addMemoryWaiter(TNonblockingServer::TConnection* conn);
+  void removeMemoryWaiter(TNonblockingServer::TConnection* conn);
+
+  // Has the thread let its memory waiters try again, waking it.
+  void resumeMemoryWaiters();
+
+  // Returns the buffer pool for this thread, or NULL if pooling is off.
+  // Only to be used from this thread.
+  TBufferPool* getBufferPool() const { return bufferPool_.get(); }
+
+  /// Size of the buffer connections receive into
+  static const uint32_t RECV_BUFFER_SIZE = 64 * 1024;
+
+  // Returns the buffer connections receive into and take their requests
+  // out of, setting size.  Only to be used from this thread, and only
+  // for the duration of a call.
+  uint8_t* getRecvBuffer(uint32_t* size) {
+    *size = static_cast<uint32_t>(recvBuffer_.size());
+    return &recvBuffer_[0];
+  }
+
   // Returns the number of this IO thread.
   int getThreadNumber() const { return number_; }
 
@@ -841,11 +2074,12 @@ class TNonblockingIOThread : public Runnable {
   // only be called after the thread has been started.
   Thread::id_t getThreadId() const { return threadId_; }
 
-  // Returns the send-fd for task complete notifications.
-  evutil_socket_t getNotificationSendFD() const { return notificationPipeFDs_[1]; }
+  // Returns the send-fd for task complete notifications.  This is the same
+  // descriptor as the read-fd when an eventfd is in use.
+  THRIFT_SOCKET getNotificationSendFD() const { return notificationPipeFDs_[1]; }
 
   // Returns the read-fd for task complete notifications.
-  evutil_socket_t getNotificationRecvFD() const { return notificationPipeFDs_[0]; }
+  THRIFT_SOCKET getNotificationRecvFD() const { return notificationPipeFDs_[0]; }
 
   // Returns the actual thread object associated with this IO thread.
   boost::shared_ptr<Thread> getThread() const { return thread_; }
@@ -853,7 +2087,10 @@ class TNonblockingIOThread : public Runnable {
   // Sets the actual thread object associated with this IO thread.
   void setThread(const boost::shared_ptr<Thread>& t) { thread_ = t; }
 
-  // Used by TConnection objects to indicate processing has finished.
+  // Used by TConnection objects to indicate processing has finished.  The
+  // connection is queued, and the IO thread is woken only if it isn't
+  // already due to take the queue, so completions arriving together cost
+  // a single wakeup.
   bool notify(TNonblockingServer::TConnection* conn);
 
   // Enters the event loop and does not return until a call to stop().
@@ -868,16 +2105,51 @@ class TNonblockingIOThread : public Runnable {
   /// Registers the events for the notification & listen sockets
   void registerEvents();
 
+  // Waits until registerEvents() has been done by the thread, so that
+  // connections can be handed to it.
+  void waitForEvents();
+
+  // Starts conn's timeout for wait, ending the one it had, if any.  With
+  // WAIT_NONE, just ends it.  Only to be used from this thread.
+  void setWait(TNonblockingServer::TConnection* conn, Wait wait);
+
+  // Starts handling a newly accepted socket, in an idle connection object
+  // of this thread's if it has one, the way listener serves them.  Only to
+  // be used from this thread.
+  void startConnection(THRIFT_SOCKET socket, const sockaddr* addr,
+                       socklen_t addrLen,
+                       const TNonblockingServer::Listener* listener);
+
+  // Queues a newly accepted socket for startConnection() on this thread,
+  // waking it if need be.  Returns false if it can't be woken.
+  bool handOff(THRIFT_SOCKET socket, const sockaddr* addr, socklen_t addrLen,
+               const TNonblockingServer::Listener* listener);
+
+  // Takes back a closed connection, keeping it for reuse or deleting it.
+  // Only to be used from this thread.
+  void returnConnection(TNonblockingServer::TConnection* conn);
+
+  // Closes this thread's connections and deletes its idle connection
+  // objects, once the thread has stopped.
+  void cleanupConnections();
+
+  // Stops this thread accepting and retires its connections that are
+  // between requests, waking the thread to do it if called from another.
+  void drain();
+
+  // Returns the socket this thread accepts on, or THRIFT_INVALID_SOCKET.
+  THRIFT_SOCKET getListenSocket() const { return listenSocket_; }
+
  private:
   /**
    * C-callable event handler for signaling task completion.  Provides a
-   * callback that libevent can understand that will read a connection
-   * object's address from a pipe and call connection->transition() for
-   * that object.
+   * callback that libevent can understand that will clear the wakeup on
+   * the notification pipe and call connection->transition() for every
+   * connection queued by notify() since the last call.
    *
    * @param fd the descriptor the event occurred on.
    */
-  static void notifyHandler(evutil_socket_t fd, short which, void* v);
+  static void notifyHandler(THRIFT_SOCKET fd, short which, void* v);
 
   /**
    * C-callable event handler for listener events.  Provides a callback
@@ -885,18 +2157,60 @@ class TNonblockingIOThread : public Runnable {
    *
    * @param fd the descriptor the event occured on.
    * @param which the flags associated with the event.
-   * @param v void* callback arg where we placed TNonblockingServer's "this".
+   * @param v void* callback arg where we placed TNonblockingIOThread's "this".
    */
-  static void listenHandler(evutil_socket_t fd, short which, void* v) {
-    ((TNonblockingServer*)v)->handleEvent(fd, which);
+  static void listenHandler(THRIFT_SOCKET fd, short which, void* v) {
+    TNonblockingIOThread* ioThread = (TNonblockingIOThread*)v;
+    ioThread->getServer()->handleEvent(fd, which, ioThread);
   }
 
+  /// Event handler for a successor connecting to take over.
+  static void restartHandler(THRIFT_SOCKET fd, short which, void* v);
+
+  /// Event handler for connections passed by the predecessor.
+  static void predecessorHandler(THRIFT_SOCKET fd, short which, void* v);
+
+  /// drain() on this thread.
+  void beginDrain();
+
+  /// Tells the server once a draining thread has no connections left.
+  void checkDrained();
+
   /// Exits the loop ASAP in case of shutdown or error.
   void breakLoop(bool error);
 
+  /// Wakes the thread to take its queues; false on error.
+  bool wake();
+
+  /// Logs a failed wake() and clears notifyWakePending_ so the next
+  /// notification tries again.  Flags already set stay for that wake.
+  void wakeFailed(const char* where);
+
+  /// Takes the stats on this thread and hands them to waitForStats()
+  void publishStats(uint64_t ticket, bool withConnections);
+
+  /**
+   * Tick of the event loop: closes the connections that have timed out,
+   * and frees the idle connection objects that are past the buffer trim
+   * age.
+   */
+  static void tickHandler(void* v);
+
+  /// The most idle connection objects this thread keeps
+  size_t cacheLimit() const;
+
+  /// Makes this thread's warmup connections and fills its buffer pool
+  void warmUp();
+
+  /// The timeout of each kind of wait, 0 if none
+  int64_t waitTimeout(Wait wait) const;
+
   /// Create the pipe used to notify I/O process of task completion.
   void createNotificationPipe();
 
+  /// Consume pending wakeups on the notification pipe; false on error.
+  bool drainNotificationPipe(THRIFT_SOCKET fd);
+
   /// Unregisters our events for notification and listen sockets.
   void cleanupEvents();
 
@@ -919,26 +2233,416 @@ class TNonblockingIOThread : public Runnable {
   /// Sets a high scheduling priority when running
   bool useHighPriority_;
 
-  /// pointer to eventbase to be used for looping
-  event_base* eventBase_;
+  /// event loop this thread runs
+  boost::shared_ptr<TEventLoop> eventLoop_;
+
+  /// Used with eventLoop_ for connection events (only in listener thread)
+  TEventLoop::Event serverEvent_;
 
-  /// Set to true if this class is responsible for freeing the event base
-  /// memory.
-  bool ownEventBase_;
+  /// Used with eventLoop_ for task completion notification
+  TEventLoop::Event notificationEvent_;
 
-  /// Used with eventBase_ for connection events (only in listener thread)
-  struct event serverEvent_;
+  /// For the server's restart socket and predecessor (only in thread 0)
+  TEventLoop::Event restartEvent_;
+  TEventLoop::Event predecessorEvent_;
 
-  /// Used with eventBase_ for task completion notification
-  struct event notificationEvent_;
+  /// For the server's added listeners (only in thread 0)
+  std::vector<boost::shared_ptr<TEventLoop::Event> > listenerEvents_;
 
  /// File descriptors for pipe used for task completion notification.
-  evutil_socket_t notificationPipeFDs_[2];
+  THRIFT_SOCKET notificationPipeFDs_[2];
+
+  /// Guards notifyQueue_, acceptQueue_, notifyWakePending_, drainPending_,
+  /// memoryResumePending_, statsRequested_ and statsWithConnections_
+  Mutex notifyMutex_;
+
+  /// Connections queued by notify() for the next notifyHandler() call
+  std::vector<TNonblockingServer::TConnection*> notifyQueue_;
+
+  /// The batch being processed by notifyHandler(); swapped with notifyQueue_
+  std::vector<TNonblockingServer::TConnection*> notifyBatch_;
+
+  /// A socket accepted by another thread, waiting for startConnection()
+  struct Accepted {
+    THRIFT_SOCKET socket;
+    socklen_t addrLen;
+    sockaddr_storage addr;
+    const TNonblockingServer::Listener* listener;
+  };
+
+  /// Sockets queued by handOff() for the next notifyHandler() call
+  std::vector<Accepted> acceptQueue_;
+
+  /// Swapped with acceptQueue_, like notifyBatch_
+  std::vector<Accepted> acceptBatch_;
+
+  /// True once a wakeup has been sent that notifyHandler() hasn't consumed
+  bool notifyWakePending_;
+
+  /// Set by drain() for notifyHandler() to call beginDrain()
+  bool drainPending_;
+
+  /// Set by resumeMemoryWaiters() for notifyHandler()
+  bool memoryResumePending_;
+
+  /// Connections waiting for the memory budget; only this thread touches
+  /// these two
+  std::vector<TNonblockingServer::TConnection*> memoryWaiters_;
+  std::vector<TNonblockingServer::TConnection*> memoryWaitersBatch_;
+
+  /// Set by beginDrain(); only this thread touches these two
+  bool draining_;
+
+  /// Set once checkDrained() has told the server
+  bool drained_;
+
+  /// The last ticket requestStats() gave out, and whether any of those not
+  /// yet taken wanted connections
+  uint64_t statsRequested_;
+  bool statsWithConnections_;
+
+  /// The last ticket this thread took stats for; only it touches this
+  uint64_t statsTaken_;
+
+  /// The last ticket taken stats answer, and those stats
+  Monitor statsMonitor_;
+  uint64_t statsServed_;
+  TIOThreadStats stats_;
+
+  /// See getRecvBuffer()
+  std::vector<uint8_t> recvBuffer_;
+
+  /// Signalled when registerEvents() is done and eventsRegistered_ set
+  Monitor eventsMonitor_;
+  bool eventsRegistered_;
+
+  /// Pool for connection read buffers, if the server uses one
+  boost::scoped_ptr<TBufferPool> bufferPool_;
+
+  // The counts are atomics, as the assignment policies read them for every
+  // connection accepted, and pendingBytes_ moves with every read and write
+
+  /// Connections currently assigned to this thread
+  volatile size_t numConnections_;
+
+  /// Size of connectionCache_, for other threads to read
+  volatile size_t numCachedConnections_;
+
+  /// See getPendingBytes()
+  volatile uint64_t pendingBytes_;
+
+  /**
+   * Connections with a timeout running, a list for each kind of wait.  All
+   * in a list have the same timeout, so the list is in order of deadline
+   * if each is added at the end.
+   */
+  TNonblockingServer::TConnection* waitFirst_[WAIT_KINDS];
+  TNonblockingServer::TConnection* waitLast_[WAIT_KINDS];
+
+  /// This thread's open connections
+  TNonblockingServer::TConnection* activeFirst_;
+
+  /**
+   * Idle connection objects, in the order they were closed.  Only this
+   * thread touches them, so reusing the one at the back gets memory still
+   * in this CPU's cache and on its node, and the front is the least
+   * recently used to free.
+   */
+  std::deque<TNonblockingServer::TConnection*> connectionCache_;
 
   /// Actual IO Thread
   boost::shared_ptr<Thread> thread_;
 };
 
+/**
+ * Decides which IO thread a newly accepted connection is handed to.
+ * select() is called with the server's connection lock held, so it is
+ * never called concurrently.
+ */
+class TIOThreadAssignmentPolicy {
+ public:
+  virtual ~TIOThreadAssignmentPolicy() {}
+
+  /**
+   * Pick an IO thread.
+   *
+   * @param ioThreads the server's IO threads; never empty.
+   * @return index into ioThreads of the thread to use.
+   */
+  virtual size_t select(
+      const std::vector<boost::shared_ptr<TNonblockingIOThread> >& ioThreads) = 0;
+};
+
+/**
+ * Assigns each connection to the IO thread with the fewest connections.
+ * Ties are broken round robin.
+ */
+class TLeastConnectionsPolicy : public TIOThreadAssignmentPolicy {
+ public:
+  TLeastConnectionsPolicy() : next_(0) {}
+
+  virtual size_t select(
+      const std::vector<boost::shared_ptr<TNonblockingIOThread> >& ioThreads);
+
+ private:
+  size_t next_;
+};
+
+/**
+ * Assigns each connection to the IO thread with the fewest bytes of
+ * requests and responses in flight, and then the fewest connections.
+ * Ties are broken round robin.
+ */
+class TLeastPendingBytesPolicy : public TIOThreadAssignmentPolicy {
+ public:
+  TLeastPendingBytesPolicy() : next_(0) {}
+
+  virtual size_t select(
+      const std::vector<boost::shared_ptr<TNonblockingIOThread> >& ioThreads);
+
+ private:
+  size_t next_;
+};
+
+/**
+ * Gives a task the priority class it is scheduled with, higher first.
+ * getPriority() is called from every IO thread at once.
+ */
+class TTaskPriorityPolicy {
+ public:
+  virtual ~TTaskPriorityPolicy() {}
+
+  /**
+   * Rank a message.
+   *
+   * @param name the message name, "Service:method" for a multiplexed call.
+   * @return the task's priority class; 0 is that of unranked tasks.
+   */
+  virtual int getPriority(const std::string& name) = 0;
+};
+
+/**
+ * Ranks messages from a table of names.  A multiplexed call takes the
+ * priority of "Service:method" if set, then that of "Service"; any other
+ * message that of its name.  Messages not in the table get the default.
+ * Set the table up before serving.
+ */
+class TNamedTaskPriorityPolicy : public TTaskPriorityPolicy {
+ public:
+  explicit TNamedTaskPriorityPolicy(int defaultPriority = 0)
+    : defaultPriority_(defaultPriority) {}
+
+  void setPriority(const std::string& name, int priority) {
+    priorities_[name] = priority;
+  }
+
+  virtual int getPriority(const std::string& name);
+
+ private:
+  int defaultPriority_;
+  std::map<std::string, int> priorities_;
+};
+
+/**
+ * Picks the calls to run on the IO thread rather than the thread manager.
+ * isInline() is called from every IO thread at once.
+ */
+class TInlineCallPolicy {
+ public:
+  virtual ~TInlineCallPolicy() {}
+
+  /**
+   * @param name the message name, "Service:method" for a multiplexed call.
+   * @return whether to run the call on the IO thread.
+   */
+  virtual bool isInline(const std::string& name) = 0;
+};
+
+/**
+ * Picks calls from a table of names, looked up as TNamedTaskPriorityPolicy
+ * does: "Service:method", then "Service", for a multiplexed call.  Calls
+ * not in the table go to the thread manager.  Set the table up before
+ * serving.
+ */
+class TNamedInlineCallPolicy : public TInlineCallPolicy {
+ public:
+  void setInline(const std::string& name, bool isInline = true) {
+    inline_[name] = isInline;
+  }
+
+  virtual bool isInline(const std::string& name);
+
+ private:
+  std::map<std::string, bool> inline_;
+};
+
+/**
+ * Admission control for TNonblockingServer after CoDel: a queue whose
+ * shortest wait over a whole interval is above target is a standing queue
+ * rather than a burst being absorbed, and will only grow.
+ *
+ * Workers report how long each call waited in the thread manager.  An
+ * interval whose shortest wait was above target starts an overload, and
+ * one whose shortest wait was not, or in which nothing was queued, ends
+ * it.  While overloaded, a call is refused if its client already has at
+ * least its fair share of the queued calls, the number queued divided by
+ * the clients queueing them, so a client sending more than the others is
+ * the one refused, and a client with nothing queued always gets in.
+ * Clients are told apart by address, so the connections of one host
+ * share one share.
+ *
+ * All methods are called from IO threads and workers at once.  The
+ * interval and the totals are kept in atomics, and the per client counts
+ * in maps of their own with a lock each, the client's address picking
+ * the map, so admitting one call locks out only the calls that hash with
+ * it.
+ */
+class TAdmissionControl {
+ public:
+  /**
+   * @param target the wait in milliseconds a queue may keep up.
+   * @param interval the milliseconds over which the shortest wait is
+   *        taken; about the time a call takes to run.
+   */
+  explicit TAdmissionControl(int64_t target = 5LL, int64_t interval = 100LL);
+
+  /**
+   * Decides whether to queue a call from client.  If so, exactly one of
+   * started() or dropped() must follow for it.
+   *
+   * @param client the client's address.
+   * @param now the current time in milliseconds, as Util::monotonicTime().
+   */
+  bool admit(const std::string& client, int64_t now);
+
+  /// An admitted call began to run after waiting sojourn milliseconds
+  void started(const std::string& client, int64_t sojourn, int64_t now);
+
+  /// An admitted call was dropped from the queue without running
+  void dropped(const std::string& client);
+
+  /// Whether the last interval found a standing queue
+  bool isOverloaded();
+
+  /// Number of calls refused since the server started
+  uint64_t getRefusedCount();
+
+ private:
+  /// Ends the current interval if now is past it
+  void endInterval(int64_t now);
+
+  /// One call fewer queued for client
+  void dequeued(const std::string& client);
+
+  /// Number of per client maps
+  static const size_t STRIPES = 16;
+
+  /// Calls admitted but not yet started, for the clients hashing here
+  struct Stripe {
+    std::map<std::string, size_t> queued;
+    Mutex mutex;
+  };
+
+  Stripe& stripeOf(const std::string& client);
+
+  int64_t target_;
+  int64_t interval_;
+
+  /// When the current interval ends
+  volatile int64_t intervalEnd_;
+  /// Shortest wait reported in the current interval, -1 if none
+  volatile int64_t minSojourn_;
+  volatile int32_t overloaded_;
+
+  Stripe stripes_[STRIPES];
+  /// Calls admitted but not yet started, and the clients they are from
+  volatile int64_t totalQueued_;
+  volatile int64_t clients_;
+
+  volatile uint64_t refused_;
+};
+
+/**
+ * Token bucket quotas on the calls TNonblockingServer reads, in calls and
+ * in request bytes per second.  A bucket holds up to burst seconds' worth
+ * of each and refills continuously; a call takes one call and its size in
+ * bytes, and is throttled, taking nothing, if either runs short.  A call
+ * larger than the byte bucket is let through when the bucket is full, and
+ * leaves it in debt.  A limit of 0 is no limit.
+ *
+ * With PER_CLIENT the connections from one address share a bucket; with
+ * PER_CONNECTION each connection keeps its own.  The limits may be changed
+ * at any time and apply from the next call.  All methods are called from
+ * IO threads at once.
+ */
+class TConnectionQuota {
+ public:
+  enum Scope {
+    PER_CLIENT,
+    PER_CONNECTION
+  };
+
+  /// One client's or connection's tokens
+  struct Bucket {
+    Bucket() : calls(0), bytes(0), last(0) {}
+
+    double calls;
+    double bytes;
+    /// When the bucket was last refilled in microseconds, 0 if never
+    int64_t last;
+  };
+
+  /**
+   * @param callsPerSecond calls a client may make each second.
+   * @param bytesPerSecond request bytes a client may send each second.
+   * @param burst the seconds of either a client may save up.
+   */
+  explicit TConnectionQuota(double callsPerSecond = 0.0,
+                            double bytesPerSecond = 0.0,
+                            double burst = 1.0,
+                            Scope scope = PER_CLIENT);
+
+  void setLimits(double callsPerSecond, double bytesPerSecond, double burst = 1.0);
+
+  Scope getScope() const {
+    return scope_;
+  }
+
+  /**
+   * Takes a call of size bytes from client's bucket.
+   *
+   * @param client the client's address.
+   * @param now the current time in microseconds, as Util::monotonicTimeUsec().
+   * @return false if the call is to be throttled.
+   */
+  bool admit(const std::string& client, uint32_t size, int64_t now);
+
+  /// Takes a call of size bytes from a bucket the caller keeps
+  bool admit(Bucket& bucket, uint32_t size, int64_t now);
+
+  /// Number of calls throttled since the server started
+  uint64_t getThrottledCount();
+
+ private:
+  /// Refills bucket to now and takes the call from it if it can
+  bool take(Bucket& bucket, uint32_t size, int64_t now);
+
+  /// Drops the client buckets that have filled up again, as a new one would be
+  void prune(int64_t now);
+
+  Scope scope_;
+  double callsPerSecond_;
+  double bytesPerSecond_;
+  double burst_;
+
+  std::map<std::string, Bucket> clients_;
+  /// When clients_ is next pruned
+  int64_t nextPrune_;
+
+  uint64_t throttled_;
+  Mutex mutex_;
+};
+
 }}} // apache::thrift::server
 
 #endif // #ifndef _THRIFT_SERVER_TNONBLOCKINGSERVER_H_
@@ -267,6 +267,28 @@ protected:
     return processorFactory_->getProcessor(connInfo);
   }
 
+  /**
+   * Hands a finished connection's protocols, and the transports under
+   * them, back to the factories that made them, for the next connection
+   * to reuse.  Call once the transports are closed.  Factories only keep
+   * what nothing else still holds.  input and output are left empty.
+   */
+  void recycle(boost::shared_ptr<TProtocol>& input,
+               boost::shared_ptr<TProtocol>& output) {
+    boost::shared_ptr<TTransport> inputTransport = input->getTransport();
+    boost::shared_ptr<TTransport> outputTransport = output->getTransport();
+    if (output == input) {
+      output.reset();
+    }
+    if (outputTransport == inputTransport) {
+      outputTransport.reset();
+    }
+    inputProtocolFactory_->recycle(input);
+    outputProtocolFactory_->recycle(output);
+    inputTransportFactory_->recycle(inputTransport);
+    outputTransportFactory_->recycle(outputTransport);
+  }
+
   // Class variables
   boost::shared_ptr<TProcessorFactory> processorFactory_;
   boost::shared_ptr<TServerTransport> serverTransport_;
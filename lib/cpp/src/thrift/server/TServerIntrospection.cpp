@@ -0,0 +1,269 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/server/TServerIntrospection.h>
+
+#include <stdio.h>
+#include <thrift/TAllocTracking.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/TimerManager.h>
+#include <thrift/server/TBufferPool.h>
+#include <thrift/server/TNonblockingServer.h>
+
+namespace apache { namespace thrift { namespace server {
+
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::ThreadManager;
+using apache::thrift::concurrency::TimerManager;
+using boost::shared_ptr;
+
+TServerIntrospection::TServerIntrospection(const std::string& prefix)
+  : prefix_(prefix)
+  , timeoutMs_(1000) {
+}
+
+void TServerIntrospection::setServer(shared_ptr<TNonblockingServer> server) {
+  Guard g(mutex_);
+  server_ = server;
+}
+
+void TServerIntrospection::addThreadManager(const std::string& name,
+                                            shared_ptr<ThreadManager> threadManager) {
+  Guard g(mutex_);
+  threadManagers_[name] = threadManager;
+}
+
+void TServerIntrospection::addTimerManager(const std::string& name,
+                                           shared_ptr<TimerManager> timerManager) {
+  Guard g(mutex_);
+  timerManagers_[name] = timerManager;
+}
+
+void TServerIntrospection::addBufferPool(const std::string& name,
+                                         shared_ptr<TConcurrentBufferPool> bufferPool) {
+  Guard g(mutex_);
+  bufferPools_[name] = bufferPool;
+}
+
+void TServerIntrospection::setTimeout(int64_t timeoutMs) {
+  Guard g(mutex_);
+  timeoutMs_ = timeoutMs;
+}
+
+void TServerIntrospection::getThreadManagers(ThreadManagerMap& _return) {
+  Guard g(mutex_);
+  _return = threadManagers_;
+  if (server_) {
+    if (server_->getThreadManager()) {
+      _return["server"] = server_->getThreadManager();
+    }
+    const std::vector<shared_ptr<ThreadManager> >& io = server_->getIOThreadManagers();
+    for (size_t i = 0; i < io.size(); ++i) {
+      if (io[i]) {
+        char name[32];
+        snprintf(name, sizeof(name), "io_thread.%lu", static_cast<unsigned long>(i));
+        _return[name] = io[i];
+      }
+    }
+  }
+}
+
+void TServerIntrospection::getCounters(std::map<std::string, int64_t>& _return) {
+  shared_ptr<TNonblockingServer> server;
+  int64_t timeoutMs;
+  std::map<std::string, shared_ptr<TimerManager> > timerManagers;
+  std::map<std::string, shared_ptr<TConcurrentBufferPool> > bufferPools;
+  {
+    Guard g(mutex_);
+    server = server_;
+    timeoutMs = timeoutMs_;
+    timerManagers = timerManagers_;
+    bufferPools = bufferPools_;
+  }
+
+  if (server) {
+    const std::string name = prefix_ + "server.";
+    _return[name + "connections"] = static_cast<int64_t>(server->getNumActiveConnections());
+    _return[name + "idle_connections"] = static_cast<int64_t>(server->getNumIdleConnections());
+    _return[name + "active_processors"] =
+      static_cast<int64_t>(server->getNumActiveProcessors());
+    if (boost::shared_ptr<TAdmissionControl> admission = server->getAdmissionControl()) {
+      _return[name + "refused_calls"] = static_cast<int64_t>(admission->getRefusedCount());
+    }
+    if (boost::shared_ptr<TConnectionQuota> quota = server->getConnectionQuota()) {
+      _return[name + "throttled_calls"] = static_cast<int64_t>(quota->getThrottledCount());
+    }
+
+    std::vector<TIOThreadStats> ioThreads;
+    server->getIOThreadStats(ioThreads, false, timeoutMs);
+    for (size_t i = 0; i < ioThreads.size(); ++i) {
+      const TIOThreadStats& s = ioThreads[i];
+      char thread[64];
+      snprintf(thread, sizeof(thread), "server.io_thread.%d.", s.number);
+      const std::string threadName = prefix_ + thread;
+      _return[threadName + "connections"] = static_cast<int64_t>(s.connections);
+      _return[threadName + "cached_connections"] = static_cast<int64_t>(s.cachedConnections);
+      _return[threadName + "pending_bytes"] = static_cast<int64_t>(s.pendingBytes);
+      if (s.complete) {
+        _return[threadName + "buffer_pool_free_bytes"] =
+          static_cast<int64_t>(s.bufferPoolFreeBytes);
+      }
+    }
+  }
+
+  ThreadManagerMap threadManagers;
+  getThreadManagers(threadManagers);
+  for (ThreadManagerMap::const_iterator it = threadManagers.begin();
+       it != threadManagers.end(); ++it) {
+    const std::string name = prefix_ + "thread_manager." + it->first + ".";
+    ThreadManager& tm = *it->second;
+    _return[name + "workers"] = static_cast<int64_t>(tm.workerCount());
+    _return[name + "idle_workers"] = static_cast<int64_t>(tm.idleWorkerCount());
+    _return[name + "pending_tasks"] = static_cast<int64_t>(tm.pendingTaskCount());
+    _return[name + "total_tasks"] = static_cast<int64_t>(tm.totalTaskCount());
+    _return[name + "expired_tasks"] = static_cast<int64_t>(tm.expiredTaskCount());
+  }
+
+  for (std::map<std::string, shared_ptr<TimerManager> >::const_iterator it =
+         timerManagers.begin(); it != timerManagers.end(); ++it) {
+    _return[prefix_ + "timer_manager." + it->first + ".tasks"] =
+      static_cast<int64_t>(it->second->taskCount());
+  }
+
+  for (std::map<std::string, shared_ptr<TConcurrentBufferPool> >::const_iterator it =
+         bufferPools.begin(); it != bufferPools.end(); ++it) {
+    _return[prefix_ + "buffer_pool." + it->first + ".free_bytes"] =
+      static_cast<int64_t>(it->second->getFreeBytes());
+  }
+
+  if (TAllocTracking::active()) {
+    TAllocTracking::Counts counts;
+    TAllocTracking::getCounts(counts);
+    for (int c = 0; c < TAllocTracking::NUM_CATEGORIES; ++c) {
+      const std::string name = prefix_ + "alloc." +
+        TAllocTracking::name(static_cast<TAllocTracking::Category>(c)) + ".";
+      _return[name + "allocations"] = static_cast<int64_t>(counts.allocations[c]);
+      _return[name + "bytes"] = static_cast<int64_t>(counts.bytes[c]);
+    }
+  }
+}
+
+std::string TServerIntrospection::getStatsText(bool withConnections) {
+  shared_ptr<TNonblockingServer> server;
+  int64_t timeoutMs;
+  std::map<std::string, shared_ptr<TimerManager> > timerManagers;
+  std::map<std::string, shared_ptr<TConcurrentBufferPool> > bufferPools;
+  {
+    Guard g(mutex_);
+    server = server_;
+    timeoutMs = timeoutMs_;
+    timerManagers = timerManagers_;
+    bufferPools = bufferPools_;
+  }
+
+  std::string text;
+  char line[512];
+
+  if (server) {
+    std::vector<TIOThreadStats> ioThreads;
+    server->getIOThreadStats(ioThreads, withConnections, timeoutMs);
+    snprintf(line, sizeof(line), "%-10s %12s %8s %14s %16s\n",
+             "io_thread", "connections", "cached", "pending_bytes", "pool_free_bytes");
+    text += line;
+    for (size_t i = 0; i < ioThreads.size(); ++i) {
+      const TIOThreadStats& s = ioThreads[i];
+      if (s.complete) {
+        snprintf(line, sizeof(line), "%-10d %12lu %8lu %14llu %16lu\n",
+                 s.number,
+                 static_cast<unsigned long>(s.connections),
+                 static_cast<unsigned long>(s.cachedConnections),
+                 static_cast<unsigned long long>(s.pendingBytes),
+                 static_cast<unsigned long>(s.bufferPoolFreeBytes));
+      } else {
+        snprintf(line, sizeof(line), "%-10d %12lu %8lu %14llu %16s\n",
+                 s.number,
+                 static_cast<unsigned long>(s.connections),
+                 static_cast<unsigned long>(s.cachedConnections),
+                 static_cast<unsigned long long>(s.pendingBytes),
+                 "(no answer)");
+      }
+      text += line;
+
+      for (size_t j = 0; j < s.connectionStats.size(); ++j) {
+        const TConnectionStats& c = s.connectionStats[j];
+        snprintf(line, sizeof(line),
+                 "  fd %-6d %-40s %-6d %-10s read_buf %-8u write_buf %-8u pending %-8u requests %llu\n",
+                 static_cast<int>(c.socket), c.clientAddress.c_str(), c.clientPort, c.state,
+                 c.readBufferSize, c.writeBufferSize, c.pendingBytes,
+                 static_cast<unsigned long long>(c.requests));
+        text += line;
+      }
+    }
+  }
+
+  ThreadManagerMap threadManagers;
+  getThreadManagers(threadManagers);
+  if (!threadManagers.empty()) {
+    snprintf(line, sizeof(line), "%-24s %8s %8s %8s %12s %8s\n",
+             "thread_manager", "workers", "idle", "pending", "total", "expired");
+    text += line;
+  }
+  for (ThreadManagerMap::const_iterator it = threadManagers.begin();
+       it != threadManagers.end(); ++it) {
+    ThreadManager& tm = *it->second;
+    snprintf(line, sizeof(line), "%-24s %8lu %8lu %8lu %12lu %8lu\n",
+             it->first.c_str(),
+             static_cast<unsigned long>(tm.workerCount()),
+             static_cast<unsigned long>(tm.idleWorkerCount()),
+             static_cast<unsigned long>(tm.pendingTaskCount()),
+             static_cast<unsigned long>(tm.totalTaskCount()),
+             static_cast<unsigned long>(tm.expiredTaskCount()));
+    text += line;
+  }
+
+  for (std::map<std::string, shared_ptr<TimerManager> >::const_iterator it =
+         timerManagers.begin(); it != timerManagers.end(); ++it) {
+    snprintf(line, sizeof(line), "timer_manager %s: %lu tasks\n", it->first.c_str(),
+             static_cast<unsigned long>(it->second->taskCount()));
+    text += line;
+  }
+
+  for (std::map<std::string, shared_ptr<TConcurrentBufferPool> >::const_iterator it =
+         bufferPools.begin(); it != bufferPools.end(); ++it) {
+    snprintf(line, sizeof(line), "buffer_pool %s: %lu free bytes\n", it->first.c_str(),
+             static_cast<unsigned long>(it->second->getFreeBytes()));
+    text += line;
+  }
+
+  if (TAllocTracking::active()) {
+    TAllocTracking::Counts counts;
+    TAllocTracking::getCounts(counts);
+    for (int c = 0; c < TAllocTracking::NUM_CATEGORIES; ++c) {
+      snprintf(line, sizeof(line), "alloc %s: %llu allocations, %llu bytes\n",
+               TAllocTracking::name(static_cast<TAllocTracking::Category>(c)),
+               static_cast<unsigned long long>(counts.allocations[c]),
+               static_cast<unsigned long long>(counts.bytes[c]));
+      text += line;
+    }
+  }
+
+  return text;
+}
+
+}}} // apache::thrift::server
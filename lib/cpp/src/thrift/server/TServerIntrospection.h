@@ -0,0 +1,100 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TSERVERINTROSPECTION_H_
+#define _THRIFT_SERVER_TSERVERINTROSPECTION_H_ 1
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/concurrency/Mutex.h>
+
+namespace apache { namespace thrift {
+
+namespace concurrency {
+class ThreadManager;
+class TimerManager;
+}
+
+namespace server {
+
+class TNonblockingServer;
+class TConcurrentBufferPool;
+
+/**
+ * Reports a running server's internals for an admin endpoint: each IO
+ * thread's connections, pending bytes and buffer pool, each connection's
+ * state and buffer sizes, the queue of every ThreadManager and TimerManager
+ * it is given, and TAllocTracking's counts when an allocator hook keeps
+ * them.
+ *
+ * getCounters() adds them to an fb303 counter map, and getStatsText()
+ * formats them, with a line per connection, for getStatusDetails(); hand
+ * one to FacebookBase::setIntrospection() to serve both.  A server's IO
+ * threads are asked for what only they may touch and waited for up to the
+ * timeout, so a call costs each thread one wakeup.
+ */
+class TServerIntrospection {
+ public:
+  /**
+   * @param prefix put in front of every counter name getCounters() adds.
+   */
+  explicit TServerIntrospection(const std::string& prefix = "thrift.");
+  virtual ~TServerIntrospection() {}
+
+  /// Reports server's IO threads and connections, and its ThreadManagers
+  void setServer(boost::shared_ptr<TNonblockingServer> server);
+
+  void addThreadManager(const std::string& name,
+                        boost::shared_ptr<concurrency::ThreadManager> threadManager);
+
+  void addTimerManager(const std::string& name,
+                       boost::shared_ptr<concurrency::TimerManager> timerManager);
+
+  void addBufferPool(const std::string& name,
+                     boost::shared_ptr<TConcurrentBufferPool> bufferPool);
+
+  /// How long to wait for the IO threads, in ms; 1000 by default
+  void setTimeout(int64_t timeoutMs);
+
+  virtual void getCounters(std::map<std::string, int64_t>& _return);
+
+  virtual std::string getStatsText(bool withConnections = true);
+
+ private:
+  typedef std::map<std::string, boost::shared_ptr<concurrency::ThreadManager> >
+    ThreadManagerMap;
+
+  /// The thread managers given, and the server's own
+  void getThreadManagers(ThreadManagerMap& _return);
+
+  std::string prefix_;
+  int64_t timeoutMs_;
+
+  concurrency::Mutex mutex_;
+  boost::shared_ptr<TNonblockingServer> server_;
+  ThreadManagerMap threadManagers_;
+  std::map<std::string, boost::shared_ptr<concurrency::TimerManager> > timerManagers_;
+  std::map<std::string, boost::shared_ptr<TConcurrentBufferPool> > bufferPools_;
+};
+
+}}} // apache::thrift::server
+
+#endif // #ifndef _THRIFT_SERVER_TSERVERINTROSPECTION_H_
@@ -20,9 +20,12 @@
 #include <thrift/thrift-config.h>
 
 #include <thrift/server/TThreadPoolServer.h>
+#include <thrift/TApplicationException.h>
 #include <thrift/transport/TTransportException.h>
 #include <thrift/concurrency/Thread.h>
 #include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/Util.h>
+#include <algorithm>
 #include <string>
 #include <iostream>
 
@@ -48,12 +51,15 @@ public:
     processor_(processor),
     input_(input),
     output_(output),
-    transport_(transport) {
+    transport_(transport),
+    queuedAt_(Util::monotonicTime()) {
   }
 
   ~Task() {}
 
   void run() {
+    server_.taskStarted(Util::monotonicTime() - queuedAt_);
+
     boost::shared_ptr<TServerEventHandler> eventHandler =
       server_.getEventHandler();
     void* connectionContext = NULL;
@@ -100,14 +106,19 @@ public:
       GlobalOutput(errStr.c_str());
     }
 
+    processor_.reset();
+    server_.recycle(input_, output_);
   }
 
  private:
-  TServer& server_;
+  TThreadPoolServer& server_;
   shared_ptr<TProcessor> processor_;
   shared_ptr<TProtocol> input_;
   shared_ptr<TProtocol> output_;
   shared_ptr<TTransport> transport_;
+
+  /// When the task was handed to the thread manager
+  int64_t queuedAt_;
 };
 
 TThreadPoolServer::~TThreadPoolServer() {}
@@ -135,6 +146,13 @@ void TThreadPoolServer::serve() {
       inputProtocol.reset();
       outputProtocol.reset();
 
+      if (acceptPolicy_ == T_ACCEPT_BACKLOG) {
+        waitForRoom();
+        if (stop_) {
+          break;
+        }
+      }
+
       // Fetch client from server
       client = serverTransport_->accept();
 
@@ -150,7 +168,15 @@ void TThreadPoolServer::serve() {
       // Add to threadmanager pool
       shared_ptr<TThreadPoolServer::Task> task(new TThreadPoolServer::Task(
             *this, processor, inputProtocol, outputProtocol, client));
-      threadManager_->add(task, timeout_, taskExpiration_);
+      if (acceptPolicy_ == T_ACCEPT_REJECT) {
+        try {
+          threadManager_->add(task, -1, taskExpiration_);
+        } catch (TooManyPendingTasksException&) {
+          reject(outputProtocol, client);
+        }
+      } else {
+        threadManager_->add(task, timeout_, taskExpiration_);
+      }
 
     } catch (TTransportException& ttx) {
       if (inputTransport) { inputTransport->close(); }
@@ -208,4 +234,73 @@ void TThreadPoolServer::setTaskExpiration(int64_t value) {
   taskExpiration_ = value;
 }
 
+void TThreadPoolServer::waitForRoom() {
+  size_t max = threadManager_->pendingTaskCountMax();
+  if (max == 0 || threadManager_->pendingTaskCount() < max) {
+    return;
+  }
+  {
+    Guard g(queueStatsMutex_);
+    ++queueStats_.deferred;
+  }
+
+  // Tasks that expire leave the queue without a word, so look again now
+  // and then
+  Synchronized s(roomMonitor_);
+  while (!stop_ && threadManager_->pendingTaskCount() >= max) {
+    roomMonitor_.waitForTimeRelative(100);
+  }
+}
+
+void TThreadPoolServer::reject(shared_ptr<TProtocol> output,
+                               shared_ptr<TTransport> client) {
+  {
+    Guard g(queueStatsMutex_);
+    ++queueStats_.rejected;
+  }
+
+  // The request isn't read, so the reply can't name it; clients look at
+  // the exception before the name and sequence id
+  try {
+    TApplicationException x(TApplicationException::INTERNAL_ERROR,
+                            "TThreadPoolServer: overloaded");
+    output->writeMessageBegin("", T_EXCEPTION, 0);
+    x.write(output.get());
+    output->writeMessageEnd();
+    output->getTransport()->writeEnd();
+    output->getTransport()->flush();
+  } catch (const TException& tx) {
+    string errStr = string("TThreadPoolServer: reject failed: ") + tx.what();
+    GlobalOutput(errStr.c_str());
+  }
+  client->close();
+}
+
+void TThreadPoolServer::taskStarted(int64_t wait) {
+  {
+    Guard g(queueStatsMutex_);
+    ++queueStats_.tasks;
+    queueStats_.totalWait += wait;
+    queueStats_.maxWait = std::max(queueStats_.maxWait, wait);
+  }
+  if (acceptPolicy_ == T_ACCEPT_BACKLOG) {
+    Synchronized s(roomMonitor_);
+    roomMonitor_.notify();
+  }
+}
+
+TThreadPoolServer::QueueStats TThreadPoolServer::getQueueStats() const {
+  Guard g(queueStatsMutex_);
+  return queueStats_;
+}
+
+void TThreadPoolServer::resetQueueStats() {
+  Guard g(queueStatsMutex_);
+  queueStats_.tasks = 0;
+  queueStats_.totalWait = 0;
+  queueStats_.maxWait = 0;
+  queueStats_.rejected = 0;
+  queueStats_.deferred = 0;
+}
+
 }}} // apache::thrift::server
@@ -20,6 +20,8 @@
 #ifndef _THRIFT_SERVER_TTHREADPOOLSERVER_H_
 #define _THRIFT_SERVER_TTHREADPOOLSERVER_H_ 1
 
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/Mutex.h>
 #include <thrift/concurrency/ThreadManager.h>
 #include <thrift/server/TServer.h>
 #include <thrift/transport/TServerTransport.h>
@@ -28,6 +30,9 @@
 
 namespace apache { namespace thrift { namespace server {
 
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::Mutex;
+using apache::thrift::concurrency::Synchronized;
 using apache::thrift::concurrency::ThreadManager;
 using apache::thrift::protocol::TProtocolFactory;
 using apache::thrift::transport::TServerTransport;
@@ -37,6 +42,34 @@ class TThreadPoolServer : public TServer {
  public:
   class Task;
 
+  /**
+   * What to do with a connection when the thread manager's queue is at
+   * its pendingTaskCountMax().
+   */
+  enum TAcceptPolicy {
+    /// Accept it and wait for room, for up to getTimeout() ms
+    T_ACCEPT_WAIT,
+    /// Accept it, answer with an overloaded exception, and close it
+    T_ACCEPT_REJECT,
+    /// Leave it in the listen backlog until there is room
+    T_ACCEPT_BACKLOG
+  };
+
+  /// How long connections waited in the thread manager's queue, and what
+  /// became of those that found it full
+  struct QueueStats {
+    /// Connections that reached a worker
+    uint64_t tasks;
+    /// Milliseconds they waited, summed
+    int64_t totalWait;
+    /// The longest any waited, in milliseconds
+    int64_t maxWait;
+    /// Connections refused under T_ACCEPT_REJECT
+    uint64_t rejected;
+    /// Accepts put off under T_ACCEPT_BACKLOG
+    uint64_t deferred;
+  };
+
   template<typename ProcessorFactory>
   TThreadPoolServer(
       const boost::shared_ptr<ProcessorFactory>& processorFactory,
@@ -50,7 +83,10 @@ class TThreadPoolServer : public TServer {
     threadManager_(threadManager),
     stop_(false),
     timeout_(0),
-    taskExpiration_(0) {}
+    taskExpiration_(0),
+    acceptPolicy_(T_ACCEPT_WAIT) {
+    resetQueueStats();
+  }
 
   template<typename Processor>
   TThreadPoolServer(
@@ -64,7 +100,10 @@ class TThreadPoolServer : public TServer {
     threadManager_(threadManager),
     stop_(false),
     timeout_(0),
-    taskExpiration_(0) {}
+    taskExpiration_(0),
+    acceptPolicy_(T_ACCEPT_WAIT) {
+    resetQueueStats();
+  }
 
   template<typename ProcessorFactory>
   TThreadPoolServer(
@@ -82,7 +121,10 @@ class TThreadPoolServer : public TServer {
     threadManager_(threadManager),
     stop_(false),
     timeout_(0),
-    taskExpiration_(0) {}
+    taskExpiration_(0),
+    acceptPolicy_(T_ACCEPT_WAIT) {
+    resetQueueStats();
+  }
 
   template<typename Processor>
   TThreadPoolServer(
@@ -100,7 +142,10 @@ class TThreadPoolServer : public TServer {
     threadManager_(threadManager),
     stop_(false),
     timeout_(0),
-    taskExpiration_(0) {}
+    taskExpiration_(0),
+    acceptPolicy_(T_ACCEPT_WAIT) {
+    resetQueueStats();
+  }
 
   virtual ~TThreadPoolServer();
 
@@ -112,6 +157,10 @@ class TThreadPoolServer : public TServer {
 
   virtual void stop() {
     stop_ = true;
+    {
+      Synchronized s(roomMonitor_);
+      roomMonitor_.notify();
+    }
     serverTransport_->interrupt();
   }
 
@@ -119,7 +168,34 @@ class TThreadPoolServer : public TServer {
 
   virtual void setTaskExpiration(int64_t value);
 
+  /**
+   * Sets what is done with connections that come while the thread
+   * manager's queue is full; T_ACCEPT_WAIT by default.  Only matters if
+   * the thread manager has a pendingTaskCountMax().
+   */
+  void setAcceptPolicy(TAcceptPolicy policy) {
+    acceptPolicy_ = policy;
+  }
+
+  TAcceptPolicy getAcceptPolicy() const {
+    return acceptPolicy_;
+  }
+
+  /// Returns the queue statistics gathered since the last reset
+  QueueStats getQueueStats() const;
+
+  void resetQueueStats();
+
  protected:
+  /// Waits for the thread manager's queue to have room, or the server to stop
+  void waitForRoom();
+
+  /// Answers a connection with an overloaded exception and closes it
+  void reject(boost::shared_ptr<TProtocol> output,
+              boost::shared_ptr<TTransport> client);
+
+  /// A task leaves the queue for a worker after waiting wait ms
+  void taskStarted(int64_t wait);
 
   boost::shared_ptr<ThreadManager> threadManager_;
 
@@ -129,6 +205,14 @@ class TThreadPoolServer : public TServer {
 
   volatile int64_t taskExpiration_;
 
+  TAcceptPolicy acceptPolicy_;
+
+  /// Notified as tasks leave the queue, when accepts wait for room
+  Monitor roomMonitor_;
+
+  QueueStats queueStats_;
+  mutable Mutex queueStatsMutex_;
+
 };
 
 }}} // apache::thrift::server
@@ -17,16 +17,56 @@
  * under the License.
  */
 
+#include <thrift/thrift-config.h>
+
 #include <thrift/server/TThreadedServer.h>
+#include <thrift/transport/PlatformSocket.h>
+#include <thrift/transport/TSocket.h>
 #include <thrift/transport/TTransportException.h>
+#include <thrift/transport/TVirtualTransport.h>
 #include <thrift/concurrency/PlatformThreadFactory.h>
 
+#include <cerrno>
+#include <deque>
 #include <string>
 #include <iostream>
+#include <typeinfo>
+#include <vector>
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_POLL_H
+#include <sys/poll.h>
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#ifndef AF_LOCAL
+#define AF_LOCAL AF_UNIX
+#endif
+
+#ifndef SOCKOPT_CAST_T
+#   ifndef _WIN32
+#       define SOCKOPT_CAST_T void
+#   else
+#       define SOCKOPT_CAST_T char
+#   endif // _WIN32
+#endif
+
+template<class T>
+inline const SOCKOPT_CAST_T* const_cast_sockopt(const T* v) {
+    return reinterpret_cast<const SOCKOPT_CAST_T*>(v);
+}
+
+template<class T>
+inline SOCKOPT_CAST_T* cast_sockopt(T* v) {
+    return reinterpret_cast<SOCKOPT_CAST_T*>(v);
+}
 
 namespace apache { namespace thrift { namespace server {
 
@@ -37,6 +77,79 @@ using namespace apache::thrift::protocol;
 using namespace apache::thrift::transport;
 using namespace apache::thrift::concurrency;
 
+namespace {
+
+/**
+ * The client socket of a parked connection, as the transport factories see
+ * it.  While the server peeks for the next request the socket doesn't
+ * wait: the transports above only get to it once they have nothing
+ * buffered, and with nothing to read yet it notes that the connection is
+ * idle and has peek() return false, or read() return 0.
+ */
+class TParkingSocket : public TVirtualTransport<TParkingSocket> {
+ public:
+  explicit TParkingSocket(shared_ptr<TSocket> socket)
+    : socket_(socket), peeking_(false), idle_(false) {}
+
+  bool isOpen() { return socket_->isOpen(); }
+
+  bool peek() {
+    if (peeking_ && !readable()) {
+      return false;
+    }
+    return socket_->peek();
+  }
+
+  void open() { socket_->open(); }
+  void close() { socket_->close(); }
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    if (peeking_ && !readable()) {
+      return 0;
+    }
+    return socket_->read(buf, len);
+  }
+
+  void write(const uint8_t* buf, uint32_t len) { socket_->write(buf, len); }
+  void writev(const TIOVec* iov, uint32_t iovcnt) { socket_->writev(iov, iovcnt); }
+  void transferFrom(int fd, off_t offset, uint32_t len) {
+    socket_->transferFrom(fd, offset, len);
+  }
+  void flush() { socket_->flush(); }
+
+  THRIFT_SOCKET getSocketFD() { return socket_->getSocketFD(); }
+
+  /// Begins or ends the server's peek for the next request
+  void setPeeking(bool peeking) {
+    peeking_ = peeking;
+    if (peeking) {
+      idle_ = false;
+    }
+  }
+
+  /// Whether the last peek found no input, rather than the end of it
+  bool wasIdle() const { return idle_; }
+
+ private:
+  bool readable() {
+    THRIFT_POLLFD fds;
+    fds.fd = socket_->getSocketFD();
+    fds.events = THRIFT_POLLIN;
+    fds.revents = 0;
+    if (THRIFT_POLL(&fds, 1, 0) == 0) {
+      idle_ = true;
+      return false;
+    }
+    return true;
+  }
+
+  shared_ptr<TSocket> socket_;
+  bool peeking_;
+  bool idle_;
+};
+
+}
+
 class TThreadedServer::Task: public Runnable {
 
 public:
@@ -45,46 +158,52 @@ public:
        shared_ptr<TProcessor> processor,
        shared_ptr<TProtocol> input,
        shared_ptr<TProtocol> output,
-       shared_ptr<TTransport> transport) :
+       shared_ptr<TTransport> transport,
+       shared_ptr<TParkingSocket> parkingSocket = shared_ptr<TParkingSocket>()) :
     server_(server),
     processor_(processor),
     input_(input),
     output_(output),
-    transport_(transport) {
+    transport_(transport),
+    parkingSocket_(parkingSocket),
+    connectionContext_(NULL),
+    begun_(false),
+    registered_(false) {
   }
 
   ~Task() {}
 
   void run() {
-    boost::shared_ptr<TServerEventHandler> eventHandler =
-      server_.getEventHandler();
-    void* connectionContext = NULL;
-    if (eventHandler) {
-      connectionContext = eventHandler->createContext(input_, output_);
+    begin();
+    serveRequests();
+    end();
+  }
+
+  /**
+   * Serves a parked connection's requests until it is idle again.
+   *
+   * @return true if the connection should be parked again, false if it
+   *         has been closed.
+   */
+  bool resume() {
+    if (!begun_) {
+      begin();
     }
-    try {
-      for (;;) {
-        if (eventHandler) {
-          eventHandler->processContext(connectionContext, transport_);
-        }
-        if (!processor_->process(input_, output_, connectionContext) ||
-            !input_->getTransport()->peek()) {
-          break;
-        }
-      }
-    } catch (const TTransportException& ttx) {
-      if (ttx.getType() != TTransportException::END_OF_FILE) {
-        string errStr = string("TThreadedServer client died: ") + ttx.what();
-        GlobalOutput(errStr.c_str());
-      }
-    } catch (const std::exception &x) {
-      GlobalOutput.printf("TThreadedServer exception: %s: %s",
-                          typeid(x).name(), x.what());
-    } catch (...) {
-      GlobalOutput("TThreadedServer uncaught exception.");
+    if (serveRequests()) {
+      return true;
     }
-    if (eventHandler) {
-      eventHandler->deleteContext(connectionContext, input_, output_);
+    end();
+    return false;
+  }
+
+  THRIFT_SOCKET getSocketFD() const {
+    return parkingSocket_->getSocketFD();
+  }
+
+  /// Ends the connection, closing its transports.
+  void end() {
+    if (eventHandler_) {
+      eventHandler_->deleteContext(connectionContext_, input_, output_);
     }
 
     try {
@@ -100,6 +219,10 @@ public:
       GlobalOutput(errStr.c_str());
     }
 
+    // Before the server can be told it has no tasks left
+    processor_.reset();
+    server_.recycle(input_, output_);
+
     // Remove this task from parent bookkeeping
     {
       Synchronized s(server_.tasksMonitor_);
@@ -108,21 +231,409 @@ public:
         server_.tasksMonitor_.notify();
       }
     }
-
   }
 
  private:
+  void begin() {
+    begun_ = true;
+    eventHandler_ = server_.getEventHandler();
+    if (eventHandler_) {
+      connectionContext_ = eventHandler_->createContext(input_, output_);
+    }
+  }
+
+  /// Returns true if the connection is parked and waiting for input
+  bool serveRequests() {
+    try {
+      for (;;) {
+        if (eventHandler_) {
+          eventHandler_->processContext(connectionContext_, transport_);
+        }
+        if (!processor_->process(input_, output_, connectionContext_)) {
+          break;
+        }
+        if (!parkingSocket_) {
+          if (!input_->getTransport()->peek()) {
+            break;
+          }
+          continue;
+        }
+        parkingSocket_->setPeeking(true);
+        bool more = input_->getTransport()->peek();
+        parkingSocket_->setPeeking(false);
+        if (!more) {
+          return parkingSocket_->wasIdle();
+        }
+      }
+    } catch (const TTransportException& ttx) {
+      if (ttx.getType() != TTransportException::END_OF_FILE) {
+        string errStr = string("TThreadedServer client died: ") + ttx.what();
+        GlobalOutput(errStr.c_str());
+      }
+    } catch (const std::exception &x) {
+      GlobalOutput.printf("TThreadedServer exception: %s: %s",
+                          typeid(x).name(), x.what());
+    } catch (...) {
+      GlobalOutput("TThreadedServer uncaught exception.");
+    }
+    return false;
+  }
+
   TThreadedServer& server_;
   friend class TThreadedServer;
+  friend class TThreadedServer::Parking;
 
   shared_ptr<TProcessor> processor_;
   shared_ptr<TProtocol> input_;
   shared_ptr<TProtocol> output_;
   shared_ptr<TTransport> transport_;
+  shared_ptr<TParkingSocket> parkingSocket_;
+
+  shared_ptr<TServerEventHandler> eventHandler_;
+  void* connectionContext_;
+  bool begun_;
+
+  /// Whether the socket has been added to the epoll set
+  bool registered_;
 };
 
+/**
+ * Parked connections and the workers that serve them.  A poller thread
+ * waits for parked connections to become readable and queues them, and a
+ * worker takes each from the queue, serves it until it is idle, and parks
+ * it again.  A worker is started whenever more are queued than there are
+ * workers free to take them.
+ */
+class TThreadedServer::Parking {
+ public:
+  /// How long a worker with nothing to do waits before it ends
+  static const int64_t WORKER_IDLE_TIME = 60 * 1000;
+
+  explicit Parking(TThreadedServer& server);
+
+  ~Parking();
+
+  /// Starts the poller thread
+  void start();
+
+  /// Waits for task to be readable, or ends it if stopping
+  void park(Task* task);
+
+  /// Ends the parked and queued connections, and waits for the workers
+  void stop();
+
+ private:
+  class Poller : public Runnable {
+   public:
+    explicit Poller(Parking& parking) : parking_(parking) {}
+    void run() { parking_.watch(); }
+   private:
+    Parking& parking_;
+  };
+
+  class Worker : public Runnable {
+   public:
+    explicit Worker(Parking& parking) : parking_(parking) {}
+    void run() { parking_.work(); }
+   private:
+    Parking& parking_;
+  };
+
+  /// The poller thread's loop
+  void watch();
+
+  /// A worker thread's loop
+  void work();
+
+  /// Moves a parked task to the queue; the monitor must be held
+  void ready(Task* task);
+
+  /// Has the queue taken, starting workers if need be; the monitor must be held
+  void dispatch();
+
+  /// Ends a task and frees it
+  static void endTask(Task* task);
+
+  TThreadedServer& server_;
+
+  /// Guards everything below but the descriptors
+  Monitor monitor_;
+  std::set<Task*> parked_;
+  std::deque<Task*> ready_;
+
+  /// Workers running, and those of them not serving a connection
+  size_t workers_;
+  size_t idleWorkers_;
+
+  bool pollerRunning_;
+  bool stopping_;
+
+  /// Set when the poller has been woken to look at parked_ again
+  bool wakePending_;
+
+  /// Wakes the poller; the poller reads from wakeFds_[0]
+  THRIFT_SOCKET wakeFds_[2];
+
+#ifdef HAVE_SYS_EPOLL_H
+  int epollFd_;
+#endif
+};
+
+TThreadedServer::Parking::Parking(TThreadedServer& server)
+  : server_(server),
+    workers_(0),
+    idleWorkers_(0),
+    pollerRunning_(false),
+    stopping_(false),
+    wakePending_(false) {
+  if (-1 == THRIFT_SOCKETPAIR(AF_LOCAL, SOCK_STREAM, 0, wakeFds_)) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    GlobalOutput.perror("TThreadedServer::Parking socketpair() ", errno_copy);
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "TThreadedServer: socketpair()", errno_copy);
+  }
+#ifdef HAVE_SYS_EPOLL_H
+  epollFd_ = epoll_create(1);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epollFd_ < 0 || epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFds_[0], &ev) < 0) {
+    int errno_copy = errno;
+    GlobalOutput.perror("TThreadedServer::Parking epoll ", errno_copy);
+    if (epollFd_ >= 0) {
+      ::close(epollFd_);
+    }
+    ::THRIFT_CLOSESOCKET(wakeFds_[0]);
+    ::THRIFT_CLOSESOCKET(wakeFds_[1]);
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "TThreadedServer: epoll", errno_copy);
+  }
+#endif
+}
+
+TThreadedServer::Parking::~Parking() {
+#ifdef HAVE_SYS_EPOLL_H
+  ::close(epollFd_);
+#endif
+  ::THRIFT_CLOSESOCKET(wakeFds_[0]);
+  ::THRIFT_CLOSESOCKET(wakeFds_[1]);
+}
+
+void TThreadedServer::Parking::start() {
+  pollerRunning_ = true;
+  try {
+    server_.threadFactory_->newThread(
+      shared_ptr<Runnable>(new Poller(*this)))->start();
+  } catch (...) {
+    pollerRunning_ = false;
+    throw;
+  }
+}
+
+void TThreadedServer::Parking::park(Task* task) {
+  {
+    // Held throughout, so that stop() can't end the task under us
+    Synchronized s(monitor_);
+    if (!stopping_) {
+#ifdef HAVE_SYS_EPOLL_H
+      // One shot, so that only one worker is given the connection
+      struct epoll_event ev;
+      ev.events = EPOLLIN | EPOLLONESHOT;
+      ev.data.ptr = task;
+      int op = task->registered_ ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+      task->registered_ = true;
+      if (epoll_ctl(epollFd_, op, task->getSocketFD(), &ev) == 0) {
+        parked_.insert(task);
+        return;
+      }
+      GlobalOutput.perror("TThreadedServer::Parking epoll_ctl() ", errno);
+#else
+      parked_.insert(task);
+      // The poller builds its poll set afresh once woken
+      if (!wakePending_) {
+        wakePending_ = true;
+        const uint8_t kWake = 0;
+        send(wakeFds_[1], const_cast_sockopt(&kWake), 1, 0);
+      }
+      return;
+#endif
+    }
+  }
+  endTask(task);
+}
+
+void TThreadedServer::Parking::stop() {
+  std::vector<Task*> ended;
+  {
+    Synchronized s(monitor_);
+    stopping_ = true;
+    monitor_.notifyAll();
+    const uint8_t kWake = 0;
+    send(wakeFds_[1], const_cast_sockopt(&kWake), 1, 0);
+    while (pollerRunning_) {
+      monitor_.waitForever();
+    }
+
+    ended.assign(parked_.begin(), parked_.end());
+    ended.insert(ended.end(), ready_.begin(), ready_.end());
+    parked_.clear();
+    ready_.clear();
+  }
+
+  for (size_t i = 0; i < ended.size(); ++i) {
+    endTask(ended[i]);
+  }
+
+  // Workers end once they are done with the connections they are serving
+  Synchronized s(monitor_);
+  while (workers_ > 0) {
+    monitor_.waitForever();
+  }
+}
+
+void TThreadedServer::Parking::watch() {
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event events[64];
+  for (;;) {
+    int n = epoll_wait(epollFd_, events, 64, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      GlobalOutput.perror("TThreadedServer::Parking epoll_wait() ", errno);
+      break;
+    }
+
+    Synchronized s(monitor_);
+    if (stopping_) {
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      if (events[i].data.ptr != NULL) {
+        ready(static_cast<Task*>(events[i].data.ptr));
+      }
+    }
+    dispatch();
+  }
+#else
+  std::vector<THRIFT_POLLFD> fds;
+  std::vector<Task*> tasks;
+  for (;;) {
+    {
+      Synchronized s(monitor_);
+      if (stopping_) {
+        break;
+      }
+      wakePending_ = false;
+      fds.resize(parked_.size() + 1);
+      tasks.assign(parked_.begin(), parked_.end());
+    }
+    fds[0].fd = wakeFds_[0];
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      fds[i + 1].fd = tasks[i]->getSocketFD();
+    }
+    for (size_t i = 0; i < fds.size(); ++i) {
+      fds[i].events = THRIFT_POLLIN;
+      fds[i].revents = 0;
+    }
+
+    int n = THRIFT_POLL(&fds[0], static_cast<unsigned long>(fds.size()), -1);
+    if (n < 0) {
+      if (THRIFT_GET_SOCKET_ERROR == THRIFT_EINTR) {
+        continue;
+      }
+      GlobalOutput.perror("TThreadedServer::Parking poll() ", THRIFT_GET_SOCKET_ERROR);
+      break;
+    }
+    if (fds[0].revents) {
+      uint8_t buf[64];
+      recv(wakeFds_[0], cast_sockopt(buf), sizeof(buf), 0);
+    }
+
+    Synchronized s(monitor_);
+    if (stopping_) {
+      break;
+    }
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      if (fds[i + 1].revents) {
+        ready(tasks[i]);
+      }
+    }
+    dispatch();
+  }
+#endif
+
+  Synchronized s(monitor_);
+  pollerRunning_ = false;
+  monitor_.notifyAll();
+}
+
+void TThreadedServer::Parking::ready(Task* task) {
+  parked_.erase(task);
+  ready_.push_back(task);
+}
+
+void TThreadedServer::Parking::dispatch() {
+  for (size_t i = 0; i < ready_.size() && i < idleWorkers_; ++i) {
+    monitor_.notify();
+  }
+  while (ready_.size() > idleWorkers_) {
+    // A new worker counts as free until it takes a connection
+    ++workers_;
+    ++idleWorkers_;
+    try {
+      server_.threadFactory_->newThread(
+        shared_ptr<Runnable>(new Worker(*this)))->start();
+    } catch (const std::exception& x) {
+      --workers_;
+      --idleWorkers_;
+      GlobalOutput.printf("TThreadedServer: could not start a worker: %s", x.what());
+      break;
+    }
+  }
+}
+
+void TThreadedServer::Parking::work() {
+  Synchronized s(monitor_);
+  for (;;) {
+    while (ready_.empty() && !stopping_) {
+      if (monitor_.waitForTimeRelative(WORKER_IDLE_TIME) == THRIFT_ETIMEDOUT &&
+          ready_.empty()) {
+        break;
+      }
+    }
+    if (ready_.empty()) {
+      break;
+    }
+    Task* task = ready_.front();
+    ready_.pop_front();
+    --idleWorkers_;
+
+    monitor_.unlock();
+    if (task->resume()) {
+      park(task);
+    } else {
+      delete task;
+    }
+    monitor_.lock();
+    ++idleWorkers_;
+  }
+
+  --idleWorkers_;
+  --workers_;
+  if (workers_ == 0) {
+    monitor_.notifyAll();
+  }
+}
+
+void TThreadedServer::Parking::endTask(Task* task) {
+  task->end();
+  delete task;
+}
+
 void TThreadedServer::init() {
   stop_ = false;
+  parkIdleConnections_ = false;
 
   if (!threadFactory_) {
     threadFactory_.reset(new PlatformThreadFactory);
@@ -142,6 +653,11 @@ void TThreadedServer::serve() {
   // Start the server listening
   serverTransport_->listen();
 
+  if (parkIdleConnections_) {
+    parking_.reset(new Parking(*this));
+    parking_->start();
+  }
+
   // Run the preServe event
   if (eventHandler_) {
     eventHandler_->preServe();
@@ -158,9 +674,19 @@ void TThreadedServer::serve() {
       // Fetch client from server
       client = serverTransport_->accept();
 
+      // Only a plain socket can be parked: poll() can't see into what a
+      // TLS session has buffered
+      shared_ptr<TParkingSocket> parkingSocket;
+      shared_ptr<TTransport> socket = client;
+      if (parking_ && typeid(*client) == typeid(TSocket)) {
+        parkingSocket.reset(new TParkingSocket(
+          boost::static_pointer_cast<TSocket>(client)));
+        socket = parkingSocket;
+      }
+
       // Make IO transports
-      inputTransport = inputTransportFactory_->getTransport(client);
-      outputTransport = outputTransportFactory_->getTransport(client);
+      inputTransport = inputTransportFactory_->getTransport(socket);
+      outputTransport = outputTransportFactory_->getTransport(socket);
       inputProtocol = inputProtocolFactory_->getProtocol(inputTransport);
       outputProtocol = outputProtocolFactory_->getProtocol(outputTransport);
 
@@ -171,7 +697,17 @@ void TThreadedServer::serve() {
                                                               processor,
                                                               inputProtocol,
                                                               outputProtocol,
-                                                              client);
+                                                              client,
+                                                              parkingSocket);
+
+      if (parkingSocket) {
+        {
+          Synchronized s(tasksMonitor_);
+          tasks_.insert(task);
+        }
+        parking_->park(task);
+        continue;
+      }
 
       // Create a task
       shared_ptr<Runnable> runnable =
@@ -225,6 +761,9 @@ void TThreadedServer::serve() {
       GlobalOutput(errStr.c_str());
     }
     try {
+      if (parking_) {
+        parking_->stop();
+      }
       Synchronized s(tasksMonitor_);
       while (!tasks_.empty()) {
         tasksMonitor_.wait();
@@ -234,7 +773,10 @@ void TThreadedServer::serve() {
       GlobalOutput(errStr.c_str());
     }
     stop_ = false;
+  } else if (parking_) {
+    parking_->stop();
   }
+  parking_.reset();
 
 }
 
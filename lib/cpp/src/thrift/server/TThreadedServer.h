@@ -79,12 +79,38 @@ class TThreadedServer : public TServer {
     serverTransport_->interrupt();
   }
 
+  /**
+   * Park connections between requests instead of giving each a thread of
+   * its own.  An idle TSocket client waits in a poll set shared by all of
+   * them, and is served by a worker thread once it has sent something; the
+   * processor is still called in blocking style, one request at a time.
+   * Workers are started as needed and end after a minute with nothing to
+   * do, so there are about as many threads as requests being served.
+   * Clients on other transports keep a thread each.  Must be called before
+   * serve().
+   */
+  void setParkIdleConnections(bool park) {
+    parkIdleConnections_ = park;
+  }
+
+  bool getParkIdleConnections() const {
+    return parkIdleConnections_;
+  }
+
  protected:
+  class Parking;
+
   void init();
 
   boost::shared_ptr<ThreadFactory> threadFactory_;
   volatile bool stop_;
 
+  /// See setParkIdleConnections()
+  bool parkIdleConnections_;
+
+  /// The poll set and workers for parked connections, while serving
+  boost::shared_ptr<Parking> parking_;
+
   Monitor tasksMonitor_;
   std::set<Task*> tasks_;
 
@@ -0,0 +1,583 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/server/TUringServer.h>
+#include <thrift/concurrency/Atomic.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TSocket.h>
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+namespace apache { namespace thrift { namespace server {
+
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace std;
+using boost::shared_ptr;
+
+namespace {
+
+/// What a completion belongs to, kept in the low bits of its user_data
+enum Op {
+  OP_ACCEPT = 1,
+  OP_WAKEUP = 2,
+  OP_PROVIDE = 3,
+  OP_RECV = 4,
+  OP_SEND = 5
+};
+
+const uint64_t OP_MASK = 7;
+
+/// Group the receive buffers are registered under
+const uint16_t BUFFER_GROUP = 0;
+
+template<class T>
+inline void* const_cast_sockopt(T* v) {
+  return reinterpret_cast<void*>(v);
+}
+
+}
+
+/**
+ * An io_uring set up with the raw system calls, so there is no dependency
+ * on liburing.  Only one thread may use it.
+ */
+class TUringServer::Ring {
+ public:
+  explicit Ring(uint32_t entries) :
+    pending_(0) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if (fd_ < 0) {
+      throw TException("TUringServer: io_uring_setup() failed: " +
+                       TOutput::strerror_s(errno));
+    }
+
+    sqSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqSize_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+      sqSize_ = cqSize_ = std::max(sqSize_, cqSize_);
+    }
+
+    sqPtr_ = mmap(NULL, sqSize_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    cqPtr_ = sqPtr_;
+    if (sqPtr_ != MAP_FAILED && !single) {
+      cqPtr_ = mmap(NULL, cqSize_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    }
+    sqesSize_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = MAP_FAILED;
+    if (sqPtr_ != MAP_FAILED && cqPtr_ != MAP_FAILED) {
+      sqes_ = mmap(NULL, sqesSize_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    }
+    if (sqes_ == MAP_FAILED) {
+      int errno_copy = errno;
+      unmap();
+      ::close(fd_);
+      throw TException("TUringServer: mmap() of the ring failed: " +
+                       TOutput::strerror_s(errno_copy));
+    }
+
+    char* sq = static_cast<char*>(sqPtr_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqEntries_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_entries);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+    char* cq = static_cast<char*>(cqPtr_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+  }
+
+  ~Ring() {
+    unmap();
+    ::close(fd_);
+  }
+
+  /**
+   * Get a zeroed submission entry, submitting what is queued first if the
+   * queue is full.  While the completion queue is full too, the kernel
+   * takes no more submissions, so its completions are set aside for
+   * next() to make room; they can't be handled here, in the middle of
+   * handling another.
+   */
+  struct io_uring_sqe* getSqe() {
+    unsigned tail = *sqTail_;
+    while (tail - atomicLoad<ATOMIC_ACQUIRE>(sqHead_) >= sqEntries_) {
+      if (!enter(0)) {
+        reap();
+      }
+    }
+    unsigned index = tail & sqMask_;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    atomicStore<ATOMIC_RELEASE>(sqTail_, tail + 1);
+    ++pending_;
+    return sqe;
+  }
+
+  /**
+   * Submit everything queued and wait for at least waitFor completions,
+   * not waiting while some are set aside.  Returns false if the kernel
+   * took nothing as the completion queue is full.
+   */
+  bool enter(unsigned waitFor) {
+    if (!backlog_.empty()) {
+      waitFor = 0;
+    }
+    for (;;) {
+      int ret = static_cast<int>(syscall(__NR_io_uring_enter, fd_, pending_, waitFor,
+                                         waitFor ? IORING_ENTER_GETEVENTS : 0,
+                                         NULL, 0));
+      if (ret >= 0) {
+        pending_ -= std::min(pending_, static_cast<unsigned>(ret));
+        return true;
+      }
+      if (errno == EINTR) {
+        if (waitFor) {
+          // Let the caller look at the stop flag
+          return true;
+        }
+        continue;
+      }
+      if (errno == EBUSY || errno == EAGAIN) {
+        // The completion queue is full; the caller drains it
+        return false;
+      }
+      throw TException("TUringServer: io_uring_enter() failed: " +
+                       TOutput::strerror_s(errno));
+    }
+  }
+
+  /**
+   * Take the next completion, if there is one, those set aside first.
+   */
+  bool next(uint64_t* userData, int* res, uint32_t* flags) {
+    if (!backlog_.empty()) {
+      const Completion& c = backlog_.front();
+      *userData = c.userData;
+      *res = c.res;
+      *flags = c.flags;
+      backlog_.pop_front();
+      return true;
+    }
+    unsigned head = *cqHead_;
+    if (head == atomicLoad<ATOMIC_ACQUIRE>(cqTail_)) {
+      return false;
+    }
+    const struct io_uring_cqe* cqe = &cqes_[head & cqMask_];
+    *userData = cqe->user_data;
+    *res = cqe->res;
+    *flags = cqe->flags;
+    atomicStore<ATOMIC_RELEASE>(cqHead_, head + 1);
+    return true;
+  }
+
+ private:
+  struct Completion {
+    uint64_t userData;
+    int res;
+    uint32_t flags;
+  };
+
+  /// Move every completion in the queue to backlog_
+  void reap() {
+    unsigned head = *cqHead_;
+    unsigned tail = atomicLoad<ATOMIC_ACQUIRE>(cqTail_);
+    for (; head != tail; ++head) {
+      const struct io_uring_cqe* cqe = &cqes_[head & cqMask_];
+      Completion c;
+      c.userData = cqe->user_data;
+      c.res = cqe->res;
+      c.flags = cqe->flags;
+      backlog_.push_back(c);
+    }
+    atomicStore<ATOMIC_RELEASE>(cqHead_, head);
+  }
+
+  void unmap() {
+    if (sqes_ != MAP_FAILED) {
+      munmap(sqes_, sqesSize_);
+    }
+    if (cqPtr_ != MAP_FAILED && cqPtr_ != sqPtr_) {
+      munmap(cqPtr_, cqSize_);
+    }
+    if (sqPtr_ != MAP_FAILED) {
+      munmap(sqPtr_, sqSize_);
+    }
+  }
+
+  int fd_;
+  unsigned pending_;
+
+  void* sqPtr_;
+  void* cqPtr_;
+  void* sqes_;
+  size_t sqSize_;
+  size_t cqSize_;
+  size_t sqesSize_;
+
+  unsigned* sqHead_;
+  unsigned* sqTail_;
+  unsigned sqMask_;
+  unsigned sqEntries_;
+  unsigned* sqArray_;
+
+  unsigned* cqHead_;
+  unsigned* cqTail_;
+  unsigned cqMask_;
+  struct io_uring_cqe* cqes_;
+
+  /// Completions reaped to make room for submissions, not yet handled
+  std::deque<Completion> backlog_;
+};
+
+/**
+ * A client connection: a socket, with whatever it has queued on the ring.
+ */
+struct TUringServer::Connection : public TCompletionServer::Connection {
+  int fd;
+};
+
+TUringServer::~TUringServer() {
+  cleanup();
+}
+
+void TUringServer::init(int port) {
+  serverName_ = "TUringServer";
+  port_ = port;
+  wakeupFd_ = -1;
+  wakeupValue_ = 0;
+  ring_ = NULL;
+  ringEntries_ = RING_ENTRIES;
+  recvBufferCount_ = RECV_BUFFER_COUNT;
+  recvBufferSize_ = RECV_BUFFER_SIZE;
+  multishotAccept_ = true;
+}
+
+void TUringServer::armAccept() {
+  struct io_uring_sqe* sqe = ring_->getSqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = serverSocket_;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  if (multishotAccept_) {
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  }
+  sqe->user_data = OP_ACCEPT;
+}
+
+void TUringServer::armWakeup() {
+  struct io_uring_sqe* sqe = ring_->getSqe();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = wakeupFd_;
+  sqe->addr = reinterpret_cast<uintptr_t>(&wakeupValue_);
+  sqe->len = sizeof(wakeupValue_);
+  sqe->user_data = OP_WAKEUP;
+}
+
+void TUringServer::provideBuffers(uint32_t first, uint32_t count) {
+  struct io_uring_sqe* sqe = ring_->getSqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = static_cast<int32_t>(count);
+  sqe->addr = reinterpret_cast<uintptr_t>(&recvBuffers_[0] + first * recvBufferSize_);
+  sqe->len = recvBufferSize_;
+  sqe->off = first;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = OP_PROVIDE;
+}
+
+void TUringServer::armRecv(Connection* conn) {
+  struct io_uring_sqe* sqe = ring_->getSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->fd;
+  sqe->len = recvBufferSize_;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = reinterpret_cast<uintptr_t>(conn) | OP_RECV;
+  conn->recvArmed = true;
+  ++conn->inflight;
+}
+
+void TUringServer::handleAccept(int fd, bool more) {
+  if (fd < 0) {
+    if (fd == -EINVAL && multishotAccept_) {
+      // Kernel predates multishot accept
+      multishotAccept_ = false;
+      armAccept();
+      return;
+    }
+    if (!stop_) {
+      GlobalOutput.perror("TUringServer: accept ", -fd);
+    }
+    if (!more && !stop_) {
+      armAccept();
+    }
+    return;
+  }
+  if (stop_) {
+    ::close(fd);
+    return;
+  }
+  if (!more) {
+    armAccept();
+  }
+
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, const_cast_sockopt(&one), sizeof(one));
+
+  Connection* conn = new Connection();
+  conn->fd = fd;
+  conn->tSocket.reset(new TSocket(fd));
+  conn->transport = conn->tSocket;
+  sockaddr_storage addrStorage;
+  socklen_t addrLen = sizeof(addrStorage);
+  if (getpeername(fd, (sockaddr*)&addrStorage, &addrLen) == 0) {
+    conn->tSocket->setCachedAddress((sockaddr*)&addrStorage, addrLen);
+  }
+
+  connections_.insert(conn);
+  startConnection(conn);
+}
+
+void TUringServer::handleRecv(Connection* conn, int res, uint32_t flags) {
+  if (res == -ENOBUFS) {
+    // Every buffer is taken; try again once one comes back
+    starved_.push_back(conn);
+    return;
+  }
+  if (res == -ECANCELED) {
+    // The send this receive was linked behind came up short
+    advance(conn);
+    return;
+  }
+  if (res <= 0) {
+    if (res < 0 && res != -ECONNRESET) {
+      GlobalOutput.perror("TUringServer: recv ", -res);
+    }
+    closeConnection(conn);
+    return;
+  }
+
+  if (flags & IORING_CQE_F_BUFFER) {
+    uint32_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    // Copied out before the buffer goes back, as getSqe() may submit
+    received(conn, &recvBuffers_[0] + bid * recvBufferSize_, res);
+    provideBuffers(bid, 1);
+  } else {
+    advance(conn);
+  }
+}
+
+void TUringServer::handleSend(Connection* conn, int res) {
+  if (res < 0) {
+    if (res != -EPIPE && res != -ECONNRESET) {
+      GlobalOutput.perror("TUringServer: send ", -res);
+    }
+    closeConnection(conn);
+    return;
+  }
+
+  sent(conn, res);
+}
+
+void TUringServer::queueRecv(TCompletionServer::Connection* conn) {
+  armRecv(static_cast<Connection*>(conn));
+}
+
+void TUringServer::queueSend(TCompletionServer::Connection* base) {
+  Connection* conn = static_cast<Connection*>(base);
+  struct io_uring_sqe* sqe = ring_->getSqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = conn->fd;
+  sqe->addr = reinterpret_cast<uintptr_t>(&conn->out[conn->outPos]);
+  sqe->len = static_cast<uint32_t>(conn->out.size() - conn->outPos);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = reinterpret_cast<uintptr_t>(conn) | OP_SEND;
+  conn->sending = true;
+  ++conn->inflight;
+  if (!conn->recvArmed) {
+    // Read the next request once the response is out
+    sqe->flags = IOSQE_IO_LINK;
+    armRecv(conn);
+  }
+}
+
+void TUringServer::cancelConnection(TCompletionServer::Connection* base) {
+  Connection* conn = static_cast<Connection*>(base);
+  starved_.erase(std::remove(starved_.begin(), starved_.end(), conn), starved_.end());
+  if (conn->inflight > 0) {
+    // Makes the queued operations complete
+    shutdown(conn->fd, SHUT_RDWR);
+  }
+}
+
+void TUringServer::handleCompletion(uint64_t userData, int res, uint32_t flags) {
+  Connection* conn = reinterpret_cast<Connection*>(static_cast<uintptr_t>(userData & ~OP_MASK));
+  switch (userData & OP_MASK) {
+  case OP_ACCEPT:
+    handleAccept(res, (flags & IORING_CQE_F_MORE) != 0);
+    break;
+
+  case OP_WAKEUP:
+    if (!stop_) {
+      armWakeup();
+    }
+    break;
+
+  case OP_PROVIDE:
+    if (res < 0) {
+      GlobalOutput.perror("TUringServer: provide buffers ", -res);
+    } else if (!starved_.empty()) {
+      std::vector<Connection*> starved;
+      starved.swap(starved_);
+      for (size_t i = 0; i < starved.size(); ++i) {
+        armRecv(starved[i]);
+      }
+    }
+    break;
+
+  case OP_RECV:
+    conn->recvArmed = false;
+    if (conn->closing && (flags & IORING_CQE_F_BUFFER)) {
+      provideBuffers(flags >> IORING_CQE_BUFFER_SHIFT, 1);
+    }
+    if (completed(conn)) {
+      handleRecv(conn, res, flags);
+    }
+    break;
+
+  case OP_SEND:
+    conn->sending = false;
+    if (completed(conn)) {
+      handleSend(conn, res);
+    }
+    break;
+  }
+}
+
+void TUringServer::serve() {
+  stop_ = false;
+  createAndListenOnSocket();
+
+  try {
+    wakeupFd_ = eventfd(0, EFD_CLOEXEC);
+    if (wakeupFd_ < 0) {
+      throw TException("TUringServer::serve() eventfd() failed: " +
+                       TOutput::strerror_s(errno));
+    }
+    ring_ = new Ring(ringEntries_);
+
+    recvBuffers_.resize(static_cast<size_t>(recvBufferCount_) * recvBufferSize_);
+    provideBuffers(0, recvBufferCount_);
+    armAccept();
+    armWakeup();
+  } catch (...) {
+    cleanup();
+    throw;
+  }
+
+  // Notify handler of the preServe event
+  if (eventHandler_) {
+    eventHandler_->preServe();
+  }
+
+  while (!stop_) {
+    ring_->enter(1);
+
+    uint64_t userData;
+    int res;
+    uint32_t flags;
+    while (!stop_ && ring_->next(&userData, &res, &flags)) {
+      handleCompletion(userData, res, flags);
+    }
+  }
+
+  // Let the queued operations of every connection finish, as the kernel
+  // may still be using their buffers
+  closeConnections();
+  while (!connections_.empty()) {
+    ring_->enter(1);
+    uint64_t userData;
+    int res;
+    uint32_t flags;
+    while (ring_->next(&userData, &res, &flags)) {
+      handleCompletion(userData, res, flags);
+    }
+  }
+
+  cleanup();
+}
+
+void TUringServer::stop() {
+  stop_ = true;
+  if (wakeupFd_ >= 0) {
+    uint64_t one = 1;
+    if (write(wakeupFd_, &one, sizeof(one)) != sizeof(one)) {
+      GlobalOutput.perror("TUringServer::stop() write ", errno);
+    }
+  }
+}
+
+void TUringServer::cleanup() {
+  // Closing the ring cancels the accept and the wakeup
+  delete ring_;
+  ring_ = NULL;
+
+  while (!connections_.empty()) {
+    destroyConnection(*connections_.begin());
+  }
+  starved_.clear();
+  std::vector<uint8_t>().swap(recvBuffers_);
+
+  if (serverSocket_ != THRIFT_INVALID_SOCKET) {
+    ::THRIFT_CLOSESOCKET(serverSocket_);
+    serverSocket_ = THRIFT_INVALID_SOCKET;
+  }
+  if (wakeupFd_ >= 0) {
+    ::close(wakeupFd_);
+    wakeupFd_ = -1;
+  }
+}
+
+}}} // apache::thrift::server
@@ -0,0 +1,179 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_SERVER_TURINGSERVER_H_
+#define _THRIFT_SERVER_TURINGSERVER_H_ 1
+
+#include <vector>
+#include <thrift/server/TCompletionServer.h>
+
+namespace apache { namespace thrift { namespace server {
+
+/**
+ * Framed transport server driven by a Linux io_uring instead of libevent.
+ *
+ * Speaks the same protocol as TNonblockingServer: every message carries a
+ * four byte frame size, and the processor runs on the IO thread.  Instead
+ * of waiting for readiness and then calling read() or write(), the server
+ * queues its work on the ring and picks up the results:
+ *
+ *  - one multishot accept produces all new connections,
+ *  - receives draw their buffers from a group registered with the kernel,
+ *    so idle connections hold no read buffer,
+ *  - a response is sent with the next receive linked behind it,
+ *
+ * and everything queued while handling one batch of completions goes to the
+ * kernel in a single io_uring_enter() call.  Frames that arrive together
+ * are processed together and their responses sent with one send.
+ *
+ * Requires Linux 5.19 or later for the multishot accept; older kernels fall
+ * back to rearming a single accept after every connection.
+ */
+class TUringServer : public TCompletionServer {
+ public:
+  /// Default number of submission queue entries
+  static const uint32_t RING_ENTRIES = 256;
+
+  /// Default number of receive buffers registered with the kernel
+  static const uint32_t RECV_BUFFER_COUNT = 256;
+
+  /// Default size of each receive buffer
+  static const uint32_t RECV_BUFFER_SIZE = 16384;
+
+  template<typename ProcessorFactory>
+  TUringServer(
+      const boost::shared_ptr<ProcessorFactory>& processorFactory,
+      int port,
+      THRIFT_OVERLOAD_IF(ProcessorFactory, TProcessorFactory)) :
+    TCompletionServer(processorFactory) {
+    init(port);
+  }
+
+  template<typename Processor>
+  TUringServer(const boost::shared_ptr<Processor>& processor,
+               int port,
+               THRIFT_OVERLOAD_IF(Processor, TProcessor)) :
+    TCompletionServer(processor) {
+    init(port);
+  }
+
+  template<typename ProcessorFactory>
+  TUringServer(
+      const boost::shared_ptr<ProcessorFactory>& processorFactory,
+      const boost::shared_ptr<TProtocolFactory>& protocolFactory,
+      int port,
+      THRIFT_OVERLOAD_IF(ProcessorFactory, TProcessorFactory)) :
+    TCompletionServer(processorFactory) {
+    init(port);
+    setInputProtocolFactory(protocolFactory);
+    setOutputProtocolFactory(protocolFactory);
+  }
+
+  template<typename Processor>
+  TUringServer(
+      const boost::shared_ptr<Processor>& processor,
+      const boost::shared_ptr<TProtocolFactory>& protocolFactory,
+      int port,
+      THRIFT_OVERLOAD_IF(Processor, TProcessor)) :
+    TCompletionServer(processor) {
+    init(port);
+    setInputProtocolFactory(protocolFactory);
+    setOutputProtocolFactory(protocolFactory);
+  }
+
+  ~TUringServer();
+
+  /**
+   * Sets the number of submission queue entries.  Takes effect at the next
+   * serve().
+   */
+  void setRingEntries(uint32_t entries) {
+    ringEntries_ = entries;
+  }
+
+  uint32_t getRingEntries() const {
+    return ringEntries_;
+  }
+
+  /**
+   * Sets the number and size of the receive buffers shared by all
+   * connections.  Takes effect at the next serve().
+   */
+  void setRecvBuffers(uint32_t count, uint32_t size) {
+    recvBufferCount_ = count;
+    recvBufferSize_ = size;
+  }
+
+  /**
+   * Main workhorse function, starts up the server listening on a port and
+   * loops over the ring until stop() is called.
+   */
+  void serve();
+
+  /**
+   * Makes serve() return.  May be called from any thread.
+   */
+  void stop();
+
+ private:
+  class Ring;
+  struct Connection;
+
+  void init(int port);
+
+  void armAccept();
+  void armWakeup();
+  void armRecv(Connection* conn);
+  void provideBuffers(uint32_t first, uint32_t count);
+
+  void handleCompletion(uint64_t userData, int res, uint32_t flags);
+  void handleAccept(int fd, bool more);
+  void handleRecv(Connection* conn, int res, uint32_t flags);
+  void handleSend(Connection* conn, int res);
+
+  void queueRecv(TCompletionServer::Connection* conn);
+  void queueSend(TCompletionServer::Connection* conn);
+  void cancelConnection(TCompletionServer::Connection* conn);
+
+  void cleanup();
+
+  /// eventfd that stop() signals
+  int wakeupFd_;
+  uint64_t wakeupValue_;
+
+  uint32_t ringEntries_;
+  uint32_t recvBufferCount_;
+  uint32_t recvBufferSize_;
+
+  /// The ring, while serving
+  Ring* ring_;
+
+  /// Memory of the receive buffers
+  std::vector<uint8_t> recvBuffers_;
+
+  /// Connections whose receive found no free buffer
+  std::vector<Connection*> starved_;
+
+  /// Whether the kernel takes multishot accepts
+  bool multishotAccept_;
+};
+
+}}} // apache::thrift::server
+
+#endif // #ifndef _THRIFT_SERVER_TURINGSERVER_H_
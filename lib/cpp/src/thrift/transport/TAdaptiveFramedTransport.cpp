@@ -0,0 +1,252 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <thrift/transport/TAdaptiveFramedTransport.h>
+#include <thrift/transport/TZlibTransport.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+namespace {
+
+// Bytes of the frame the entropy estimate looks at
+const uint32_t ENTROPY_SAMPLES = 4096;
+
+// Frames whose sample needs more bits per byte than this are left alone
+const double MAX_ENTROPY = 7.0;
+
+// Deflate expands a byte to at most 1032 and adds a few of its own
+const uint64_t MAX_INFLATE_RATIO = 1032;
+const uint64_t MAX_INFLATE_OVERHEAD = 64;
+
+/**
+ * Order-0 entropy, in bits per byte, of evenly spaced bytes from buf.
+ */
+double sampleEntropy(const uint8_t* buf, uint32_t len) {
+  uint32_t counts[256];
+  memset(counts, 0, sizeof(counts));
+
+  uint32_t step = (len > ENTROPY_SAMPLES) ? len / ENTROPY_SAMPLES : 1;
+  uint32_t samples = 0;
+  for (uint32_t i = 0; i < len; i += step) {
+    ++counts[buf[i]];
+    ++samples;
+  }
+
+  double entropy = 0.0;
+  for (int i = 0; i < 256; ++i) {
+    if (counts[i] != 0) {
+      double p = static_cast<double>(counts[i]) / samples;
+      entropy -= p * std::log(p);
+    }
+  }
+  return entropy / std::log(2.0);
+}
+
+}
+
+const uint32_t TAdaptiveFramedTransport::DEFAULT_MIN_COMPRESS_SIZE;
+const uint32_t TAdaptiveFramedTransport::NEVER_COMPRESS;
+const uint32_t TAdaptiveFramedTransport::COMPRESSED_FLAG;
+
+TAdaptiveFramedTransport::TAdaptiveFramedTransport(
+    boost::shared_ptr<TTransport> transport,
+    uint32_t minCompressSize,
+    bool checkEntropy,
+    int comp_level) :
+  TFramedTransport(transport),
+  minCompressSize_(minCompressSize),
+  checkEntropy_(checkEntropy),
+  comp_level_(comp_level),
+  rFrameSize_(0),
+  cBufSize_(0),
+  rstream_(NULL),
+  wstream_(NULL) {
+}
+
+TAdaptiveFramedTransport::~TAdaptiveFramedTransport() {
+  if (rstream_ != NULL) {
+    inflateEnd(rstream_);
+    delete rstream_;
+  }
+  if (wstream_ != NULL) {
+    deflateEnd(wstream_);
+    delete wstream_;
+  }
+}
+
+// The streams are only set up once a frame is compressed, since that costs
+// a few hundred KB.
+void TAdaptiveFramedTransport::initDeflate() {
+  if (wstream_ != NULL) {
+    return;
+  }
+  z_stream* stream = new z_stream;
+  memset(stream, 0, sizeof(*stream));
+  int rv = deflateInit(stream, comp_level_);
+  if (rv != Z_OK) {
+    TZlibTransportException ex(rv, stream->msg);
+    delete stream;
+    throw ex;
+  }
+  wstream_ = stream;
+}
+
+void TAdaptiveFramedTransport::initInflate() {
+  if (rstream_ != NULL) {
+    return;
+  }
+  z_stream* stream = new z_stream;
+  memset(stream, 0, sizeof(*stream));
+  int rv = inflateInit(stream);
+  if (rv != Z_OK) {
+    TZlibTransportException ex(rv, stream->msg);
+    delete stream;
+    throw ex;
+  }
+  rstream_ = stream;
+}
+
+bool TAdaptiveFramedTransport::shouldCompress(const uint8_t* buf, uint32_t len) {
+  if (minCompressSize_ == NEVER_COMPRESS || len < minCompressSize_) {
+    return false;
+  }
+  // Too small to come out ahead of the extra header word
+  if (len < 16) {
+    return false;
+  }
+  return !checkEntropy_ || sampleEntropy(buf, len) <= MAX_ENTROPY;
+}
+
+void TAdaptiveFramedTransport::flush() {
+  uint8_t* payload = wBuf_.get() + sizeof(uint32_t);
+  uint32_t sz = static_cast<uint32_t>(wBase_ - payload);
+  if (!shouldCompress(payload, sz)) {
+    TFramedTransport::flush();
+    return;
+  }
+
+  initDeflate();
+  if (cBufSize_ < sz + 2 * sizeof(uint32_t)) {
+    cBuf_.reset(new uint8_t[sz + 2 * sizeof(uint32_t)]);
+    cBufSize_ = sz + 2 * sizeof(uint32_t);
+  }
+
+  int rv = deflateReset(wstream_);
+  if (rv != Z_OK) {
+    throw TZlibTransportException(rv, wstream_->msg);
+  }
+
+  // Only room for a result smaller than the frame, header word included;
+  // if it doesn't fit, it isn't worth sending.
+  wstream_->next_in = payload;
+  wstream_->avail_in = sz;
+  wstream_->next_out = cBuf_.get() + 2 * sizeof(uint32_t);
+  wstream_->avail_out = sz - sizeof(uint32_t) - 1;
+  rv = deflate(wstream_, Z_FINISH);
+  if (rv != Z_STREAM_END) {
+    if (rv != Z_OK && rv != Z_BUF_ERROR) {
+      throw TZlibTransportException(rv, wstream_->msg);
+    }
+    TFramedTransport::flush();
+    return;
+  }
+
+  uint32_t clen = static_cast<uint32_t>(wstream_->total_out);
+  uint32_t word = htonl(COMPRESSED_FLAG | (clen + static_cast<uint32_t>(sizeof(uint32_t))));
+  uint32_t ulen = htonl(sz);
+  memcpy(cBuf_.get(), &word, sizeof(word));
+  memcpy(cBuf_.get() + sizeof(word), &ulen, sizeof(ulen));
+
+  // Reset the write buffer first, as TFramedTransport::flush() does
+  wBase_ = payload;
+
+  transport_->write(cBuf_.get(), clen + 2 * static_cast<uint32_t>(sizeof(uint32_t)));
+  transport_->flush();
+}
+
+bool TAdaptiveFramedTransport::readFrame() {
+  uint32_t word;
+  if (!readFrameHeader(&word)) {
+    return false;
+  }
+
+  if ((word & COMPRESSED_FLAG) == 0) {
+    if (word > rBufSize_) {
+      rBuf_.reset(new uint8_t[word]);
+      rBufSize_ = word;
+    }
+    transport_->readAll(rBuf_.get(), word);
+    setReadBuffer(rBuf_.get(), word);
+    rFrameSize_ = word + static_cast<uint32_t>(sizeof(word));
+    return true;
+  }
+
+  uint32_t sz = word & ~COMPRESSED_FLAG;
+  if (sz < sizeof(uint32_t)) {
+    throw TTransportException(TTransportException::CORRUPTED_DATA,
+                              "TAdaptiveFramedTransport: compressed frame too short");
+  }
+  if (sz > cBufSize_) {
+    cBuf_.reset(new uint8_t[sz]);
+    cBufSize_ = sz;
+  }
+  transport_->readAll(cBuf_.get(), sz);
+
+  uint32_t ulen;
+  memcpy(&ulen, cBuf_.get(), sizeof(ulen));
+  ulen = ntohl(ulen);
+  uint32_t clen = sz - static_cast<uint32_t>(sizeof(ulen));
+  if (ulen > 0x7fffffff ||
+      ulen > clen * MAX_INFLATE_RATIO + MAX_INFLATE_OVERHEAD) {
+    throw TTransportException(TTransportException::CORRUPTED_DATA,
+                              "TAdaptiveFramedTransport: bad uncompressed size");
+  }
+
+  if (ulen > rBufSize_) {
+    rBuf_.reset(new uint8_t[ulen]);
+    rBufSize_ = ulen;
+  }
+
+  initInflate();
+  int rv = inflateReset(rstream_);
+  if (rv != Z_OK) {
+    throw TZlibTransportException(rv, rstream_->msg);
+  }
+  rstream_->next_in = cBuf_.get() + sizeof(ulen);
+  rstream_->avail_in = clen;
+  rstream_->next_out = rBuf_.get();
+  rstream_->avail_out = ulen;
+  rv = inflate(rstream_, Z_FINISH);
+  if (rv != Z_STREAM_END || rstream_->avail_out != 0 || rstream_->avail_in != 0) {
+    throw TTransportException(TTransportException::CORRUPTED_DATA,
+                              "TAdaptiveFramedTransport: bad compressed frame");
+  }
+
+  setReadBuffer(rBuf_.get(), ulen);
+  rFrameSize_ = sz + static_cast<uint32_t>(sizeof(word));
+  return true;
+}
+
+uint32_t TAdaptiveFramedTransport::readEnd() {
+  return rFrameSize_;
+}
+
+}}} // apache::thrift::transport
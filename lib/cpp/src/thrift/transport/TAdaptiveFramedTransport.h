@@ -0,0 +1,146 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TADAPTIVEFRAMEDTRANSPORT_H_
+#define _THRIFT_TRANSPORT_TADAPTIVEFRAMEDTRANSPORT_H_ 1
+
+#include <zlib.h>
+#include <boost/scoped_array.hpp>
+#include <thrift/transport/TBufferTransports.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * A framed transport that compresses the frames worth compressing.
+ *
+ * Frames smaller than a threshold, and optionally frames whose bytes look
+ * random already, are sent exactly as TFramedTransport sends them.  Others
+ * are deflated, and sent compressed if that made them smaller: the top bit
+ * of the frame size marks them, and the uncompressed size comes before the
+ * zlib data.
+ *
+ * It reads both kinds of frame, so it can talk to a TFramedTransport as
+ * long as it doesn't compress, and it reads everything a TFramedTransport
+ * writes.
+ */
+class TAdaptiveFramedTransport : public TFramedTransport {
+ public:
+  /// Frames of at least this many bytes are considered for compression
+  static const uint32_t DEFAULT_MIN_COMPRESS_SIZE = 1024;
+
+  /// Threshold that turns compression off
+  static const uint32_t NEVER_COMPRESS = 0xffffffff;
+
+  /**
+   * @param transport        The transport to write frames to and read them from.
+   * @param minCompressSize  Size from which frames are considered for
+   *                         compression, or NEVER_COMPRESS.
+   * @param checkEntropy     Skip frames whose sampled bytes are nearly
+   *                         random, such as already compressed data.
+   * @param comp_level       zlib compression level (1=fast, 6=default, 9=max).
+   */
+  TAdaptiveFramedTransport(boost::shared_ptr<TTransport> transport,
+                           uint32_t minCompressSize = DEFAULT_MIN_COMPRESS_SIZE,
+                           bool checkEntropy = true,
+                           int comp_level = Z_DEFAULT_COMPRESSION);
+
+  ~TAdaptiveFramedTransport();
+
+  void setMinCompressSize(uint32_t minCompressSize) {
+    minCompressSize_ = minCompressSize;
+  }
+
+  uint32_t getMinCompressSize() const {
+    return minCompressSize_;
+  }
+
+  void setCheckEntropy(bool checkEntropy) {
+    checkEntropy_ = checkEntropy;
+  }
+
+  bool getCheckEntropy() const {
+    return checkEntropy_;
+  }
+
+  virtual void flush();
+
+  uint32_t readEnd();
+
+  /// TTransport's, as TFramedTransport's reads frames without readFrame()
+  int32_t tryRead(uint8_t* buf, uint32_t len) {
+    return TTransport::tryRead(buf, len);
+  }
+
+  /// Marks a compressed frame in the frame size
+  static const uint32_t COMPRESSED_FLAG = 0x80000000;
+
+ protected:
+  virtual bool readFrame();
+
+  /// Whether the len bytes at buf are worth deflating
+  bool shouldCompress(const uint8_t* buf, uint32_t len);
+
+  void initDeflate();
+  void initInflate();
+
+  uint32_t minCompressSize_;
+  bool checkEntropy_;
+  const int comp_level_;
+
+  /// Bytes of the last frame read, as it was on the wire
+  uint32_t rFrameSize_;
+
+  /// Compressed frames on their way out or in
+  boost::scoped_array<uint8_t> cBuf_;
+  uint32_t cBufSize_;
+
+  z_stream* rstream_;
+  z_stream* wstream_;
+};
+
+/**
+ * Wraps a transport into an adaptively compressed framed one.
+ *
+ */
+class TAdaptiveFramedTransportFactory : public TTransportFactory {
+ public:
+  TAdaptiveFramedTransportFactory(
+      uint32_t minCompressSize = TAdaptiveFramedTransport::DEFAULT_MIN_COMPRESS_SIZE,
+      bool checkEntropy = true,
+      int comp_level = Z_DEFAULT_COMPRESSION) :
+    minCompressSize_(minCompressSize),
+    checkEntropy_(checkEntropy),
+    comp_level_(comp_level) {}
+
+  virtual ~TAdaptiveFramedTransportFactory() {}
+
+  virtual boost::shared_ptr<TTransport> getTransport(boost::shared_ptr<TTransport> trans) {
+    return boost::shared_ptr<TTransport>(
+      new TAdaptiveFramedTransport(trans, minCompressSize_, checkEntropy_, comp_level_));
+  }
+
+ private:
+  uint32_t minCompressSize_;
+  bool checkEntropy_;
+  int comp_level_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TADAPTIVEFRAMEDTRANSPORT_H_
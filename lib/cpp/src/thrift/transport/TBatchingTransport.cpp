@@ -0,0 +1,169 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/transport/TBatchingTransport.h>
+#include <thrift/concurrency/FunctionRunner.h>
+#include <thrift/concurrency/Util.h>
+
+using boost::shared_ptr;
+using apache::thrift::concurrency::FunctionRunner;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Util;
+
+namespace apache { namespace thrift { namespace transport {
+
+const uint32_t TBatchingTransport::DEFAULT_MAX_MESSAGES;
+const uint32_t TBatchingTransport::DEFAULT_MAX_BYTES;
+const int64_t TBatchingTransport::DEFAULT_MAX_DELAY_US;
+
+TBatchingTransport::TBatchingTransport(shared_ptr<TTransport> transport,
+                                       uint32_t maxMessages,
+                                       uint32_t maxBytes,
+                                       int64_t maxDelay)
+  : transport_(transport),
+    maxMessages_(maxMessages),
+    maxBytes_(maxBytes),
+    maxDelay_(maxDelay),
+    unsent_(false),
+    batchMessages_(0),
+    batchBytes_(0),
+    batchStart_(0),
+    stopping_(false),
+    numBatches_(0),
+    numMessages_(0) {
+  if (maxDelay_ > 0) {
+    threadFactory_.setDetached(false);
+    flusher_ = threadFactory_.newThread(FunctionRunner::create(
+      apache::thrift::stdcxx::bind(&TBatchingTransport::flushDelayed, this)));
+    flusher_->start();
+  }
+}
+
+TBatchingTransport::~TBatchingTransport() {
+  try {
+    flushBatch();
+  } catch (const TException& e) {
+    GlobalOutput.printf("TBatchingTransport: calls lost on destruction: %s", e.what());
+  }
+  stop();
+}
+
+void TBatchingTransport::close() {
+  flushBatch();
+  transport_->close();
+}
+
+uint32_t TBatchingTransport::read(uint8_t* buf, uint32_t len) {
+  // Whatever the client waits for may be in the batch
+  if (unsent_) {
+    flushBatch();
+  }
+  return transport_->read(buf, len);
+}
+
+void TBatchingTransport::flush() {
+  Synchronized s(monitor_);
+  if (!error_.empty()) {
+    std::string error;
+    error.swap(error_);
+    throw TTransportException(TTransportException::UNKNOWN, error);
+  }
+  if (!message_.empty()) {
+    transport_->write(reinterpret_cast<const uint8_t*>(message_.data()),
+                      static_cast<uint32_t>(message_.size()));
+    batchBytes_ += static_cast<uint32_t>(message_.size());
+    message_.clear();
+    unsent_ = true;
+    if (batchMessages_++ == 0 && maxDelay_ > 0) {
+      batchStart_ = Util::monotonicTimeUsec();
+      monitor_.notify();
+    }
+  }
+  if ((maxMessages_ > 0 && batchMessages_ >= maxMessages_) ||
+      (maxBytes_ > 0 && batchBytes_ >= maxBytes_)) {
+    send();
+  }
+}
+
+void TBatchingTransport::flushBatch() {
+  flush();
+  Synchronized s(monitor_);
+  if (batchMessages_ > 0) {
+    send();
+  }
+  unsent_ = false;
+}
+
+void TBatchingTransport::send() {
+  uint32_t messages = batchMessages_;
+  batchMessages_ = 0;
+  batchBytes_ = 0;
+  transport_->flush();
+  ++numBatches_;
+  numMessages_ += messages;
+}
+
+void TBatchingTransport::flushDelayed() {
+  Synchronized s(monitor_);
+  while (!stopping_) {
+    if (batchMessages_ == 0) {
+      monitor_.wait();
+      continue;
+    }
+    int64_t due = batchStart_ + maxDelay_;
+    if (Util::monotonicTimeUsec() < due) {
+      struct THRIFT_TIMESPEC abstime;
+      abstime.tv_sec = due / (1000 * 1000);
+      abstime.tv_nsec = (due % (1000 * 1000)) * 1000;
+      monitor_.waitForTime(&abstime);
+      continue;
+    }
+    try {
+      send();
+    } catch (const TException& e) {
+      GlobalOutput.printf("TBatchingTransport: delayed flush failed: %s", e.what());
+      error_ = e.what();
+    }
+  }
+}
+
+void TBatchingTransport::stop() {
+  if (!flusher_) {
+    return;
+  }
+  {
+    Synchronized s(monitor_);
+    stopping_ = true;
+    monitor_.notify();
+  }
+  flusher_->join();
+  flusher_.reset();
+}
+
+uint64_t TBatchingTransport::getNumBatches() const {
+  Synchronized s(monitor_);
+  return numBatches_;
+}
+
+uint64_t TBatchingTransport::getNumMessages() const {
+  Synchronized s(monitor_);
+  return numMessages_;
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,151 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TBATCHINGTRANSPORT_H_
+#define _THRIFT_TRANSPORT_TBATCHINGTRANSPORT_H_ 1
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Lets a client send calls in batches, rather than with a flush each.
+ *
+ * A generated client flushes its transport once per call it sends.  This
+ * transport holds those flushes back, handing each call's bytes to the
+ * transport it wraps as they are flushed, and flushing that transport only
+ * once maxMessages calls or maxBytes bytes are waiting, or the oldest has
+ * waited maxDelay microseconds.  Over a TFramedTransport, a batch goes out
+ * as one frame holding several messages, which TNonblockingServer and the
+ * blocking servers all serve one after another.
+ *
+ * Made for oneway calls, such as logging.  Before reading, the calls
+ * waiting are flushed, so a call expecting a reply goes out at once, with
+ * any sent before it.  A limit of 0 is no limit.  With a maxDelay, a thread
+ * of the transport's own flushes batches that waited long enough; an error
+ * it meets is thrown by the next flush(), and the batch lost.  Without
+ * one, a batch only goes once full, or when the client reads or calls
+ * flushBatch().
+ *
+ * One thread sends calls at a time, as with any client transport.
+ */
+class TBatchingTransport : public TVirtualTransport<TBatchingTransport> {
+ public:
+  static const uint32_t DEFAULT_MAX_MESSAGES = 64;
+  static const uint32_t DEFAULT_MAX_BYTES = 64 * 1024;
+  static const int64_t DEFAULT_MAX_DELAY_US = 1000;
+
+  /**
+   * @param transport   the transport to send batches on, usually framed.
+   * @param maxMessages calls to send in a batch at most.
+   * @param maxBytes    bytes of calls from which a batch is sent.
+   * @param maxDelay    microseconds a call may wait for its batch to go.
+   */
+  TBatchingTransport(boost::shared_ptr<TTransport> transport,
+                     uint32_t maxMessages = DEFAULT_MAX_MESSAGES,
+                     uint32_t maxBytes = DEFAULT_MAX_BYTES,
+                     int64_t maxDelay = DEFAULT_MAX_DELAY_US);
+
+  /// Sends the calls waiting, as close() does
+  ~TBatchingTransport();
+
+  bool isOpen() {
+    return transport_->isOpen();
+  }
+
+  bool peek() {
+    return transport_->peek();
+  }
+
+  void open() {
+    transport_->open();
+  }
+
+  /// Sends the calls waiting, then closes the transport
+  void close();
+
+  /// Sends the calls waiting first
+  uint32_t read(uint8_t* buf, uint32_t len);
+
+  uint32_t readEnd() {
+    return transport_->readEnd();
+  }
+
+  void write(const uint8_t* buf, uint32_t len) {
+    message_.append(reinterpret_cast<const char*>(buf), len);
+  }
+
+  /// Ends a call, sending the batch if that fills it
+  void flush();
+
+  /// Sends the calls waiting now
+  void flushBatch();
+
+  boost::shared_ptr<TTransport> getUnderlyingTransport() {
+    return transport_;
+  }
+
+  /// Batches sent, and calls sent in them
+  uint64_t getNumBatches() const;
+  uint64_t getNumMessages() const;
+
+ private:
+  /// Send the batch, with monitor_ held
+  void send();
+
+  /// Flush batches that waited long enough, until stopped
+  void flushDelayed();
+
+  void stop();
+
+  boost::shared_ptr<TTransport> transport_;
+  uint32_t maxMessages_;
+  uint32_t maxBytes_;
+  int64_t maxDelay_;
+
+  // Only the client's thread touches these
+  /// The call being written
+  std::string message_;
+  /// Whether calls were handed over since the client last sent them all
+  bool unsent_;
+
+  /// Guards what follows; notified as a batch starts, and on stopping
+  apache::thrift::concurrency::Monitor monitor_;
+  /// Calls handed to transport_ but not flushed
+  uint32_t batchMessages_;
+  uint32_t batchBytes_;
+  /// When the first of them was, in microseconds
+  int64_t batchStart_;
+  /// The error the last delayed flush met, to throw
+  std::string error_;
+  bool stopping_;
+  uint64_t numBatches_;
+  uint64_t numMessages_;
+
+  apache::thrift::concurrency::PlatformThreadFactory threadFactory_;
+  boost::shared_ptr<apache::thrift::concurrency::Thread> flusher_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TBATCHINGTRANSPORT_H_
@@ -18,15 +18,142 @@
  */
 
 #include <cassert>
+#include <cstdlib>
 #include <algorithm>
+#include <vector>
 
 #include <thrift/transport/TBufferTransports.h>
+#include <thrift/server/TBufferPool.h>
 
 using std::string;
 
 namespace apache { namespace thrift { namespace transport {
 
 
+TBufferedTransport::~TBufferedTransport() {
+  freeBuffer(rBuf_, rBufCapacity_);
+  freeBuffer(wBuf_, wBufCapacity_);
+}
+
+uint8_t* TBufferedTransport::allocateBuffer(uint32_t size, uint32_t* capacity) {
+  if (pool_) {
+    return pool_->borrow(size, capacity);
+  }
+  *capacity = size;
+  TAllocScope scope(TAllocTracking::TRANSPORT);
+  return new uint8_t[size];
+}
+
+void TBufferedTransport::freeBuffer(uint8_t* buf, uint32_t capacity) {
+  if (buf == NULL) {
+    return;
+  }
+  if (pool_) {
+    pool_->giveBack(buf, capacity);
+  } else {
+    delete[] buf;
+  }
+}
+
+void TBufferedTransport::ensureReadBuffer() {
+  if (rBuf_ == NULL) {
+    rBuf_ = allocateBuffer(rBufSize_, &rBufCapacity_);
+    setReadBuffer(rBuf_, 0);
+  }
+}
+
+void TBufferedTransport::ensureWriteBuffer() {
+  if (wBuf_ == NULL) {
+    wBuf_ = allocateBuffer(wBufSize_, &wBufCapacity_);
+    setWriteBuffer(wBuf_, wBufSize_);
+  }
+}
+
+bool TBufferedTransport::releaseBuffers() {
+  if (rBase_ != rBound_ || wBase_ != wBuf_) {
+    return false;
+  }
+  freeBuffer(rBuf_, rBufCapacity_);
+  freeBuffer(wBuf_, wBufCapacity_);
+  rBuf_ = wBuf_ = NULL;
+  rBufCapacity_ = wBufCapacity_ = 0;
+  rBufSize_ = rBufInitialSize_;
+  lastFill_ = smallFills_ = 0;
+  initPointers();
+  return true;
+}
+
+void TBufferedTransport::adaptReadBuffer() {
+  assert(rBase_ == rBound_);
+  uint32_t size = rBufSize_;
+  if (lastFill_ == rBufSize_ && rBufSize_ < rBufMaxSize_) {
+    // There may well have been more waiting
+    size = (std::min)(rBufSize_ * 2, rBufMaxSize_);
+    smallFills_ = 0;
+  } else if (lastFill_ < rBufSize_ / 4 && rBufSize_ > rBufInitialSize_) {
+    // Only shrink after a run of small fills, so as not to flap
+    if (++smallFills_ == 16) {
+      size = (std::max)(rBufSize_ / 2, rBufInitialSize_);
+      smallFills_ = 0;
+    }
+  } else {
+    smallFills_ = 0;
+  }
+
+  if (size != rBufSize_) {
+    freeBuffer(rBuf_, rBufCapacity_);
+    rBuf_ = NULL;
+    rBufCapacity_ = 0;
+    rBufSize_ = size;
+  }
+  ensureReadBuffer();
+}
+
+uint32_t TBufferedTransport::fillReadBuffer() {
+  adaptReadBuffer();
+  lastFill_ = transport_->read(rBuf_, rBufSize_);
+  setReadBuffer(rBuf_, lastFill_);
+  return lastFill_;
+}
+
+int32_t TBufferedTransport::tryFillReadBuffer() {
+  adaptReadBuffer();
+  int32_t got = transport_->tryRead(rBuf_, rBufSize_);
+  if (got > 0) {
+    lastFill_ = static_cast<uint32_t>(got);
+    setReadBuffer(rBuf_, lastFill_);
+  }
+  return got;
+}
+
+void TBufferedTransport::setBufferPool(boost::shared_ptr<server::TConcurrentBufferPool> pool) {
+  // Buffers have to go back to where they came from
+  if (!releaseBuffers()) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TBufferedTransport::setBufferPool() with data buffered");
+  }
+  pool_ = pool;
+}
+
+void TBufferedTransport::resetTransport(boost::shared_ptr<TTransport> transport) {
+  transport_ = transport;
+  initPointers();
+  if (releaseWhenIdle_) {
+    releaseBuffers();
+  }
+}
+
+bool TBufferedTransport::peek() {
+  if (rBase_ == rBound_) {
+    // Wait for the next request without holding any memory
+    if (releaseWhenIdle_ && releaseBuffers() && !transport_->peek()) {
+      return false;
+    }
+    fillReadBuffer();
+  }
+  return (rBound_ > rBase_);
+}
+
 uint32_t TBufferedTransport::readSlow(uint8_t* buf, uint32_t len) {
   uint32_t have = static_cast<uint32_t>(rBound_ - rBase_);
 
@@ -40,16 +167,19 @@ uint32_t TBufferedTransport::readSlow(uint8_t* buf, uint32_t len) {
   // attempting to read from it could block.
   if (have > 0) {
     memcpy(buf, rBase_, have);
-    setReadBuffer(rBuf_.get(), 0);
+    setReadBuffer(rBuf_, 0);
     return have;
   }
 
-  // No data is available in our buffer.
-  // Get more from underlying transport up to buffer size.
-  // Note that this makes a lot of sense if len < rBufSize_
-  // and almost no sense otherwise.  TODO(dreiss): Fix that
-  // case (possibly including some readv hotness).
-  setReadBuffer(rBuf_.get(), transport_->read(rBuf_.get(), rBufSize_));
+  // No data is available in our buffer.  A read at least as big as the
+  // buffer would only be copied through it a piece at a time, so let the
+  // underlying transport put it where it is going in one go.
+  if (len >= rBufSize_) {
+    return transport_->read(buf, len);
+  }
+
+  // Otherwise get more from the underlying transport up to buffer size.
+  fillReadBuffer();
 
   // Hand over whatever we have.
   uint32_t give = (std::min)(len, static_cast<uint32_t>(rBound_ - rBase_));
@@ -59,8 +189,35 @@ uint32_t TBufferedTransport::readSlow(uint8_t* buf, uint32_t len) {
   return give;
 }
 
+int32_t TBufferedTransport::tryRead(uint8_t* buf, uint32_t len) {
+  uint32_t have = static_cast<uint32_t>(rBound_ - rBase_);
+  if (have == 0) {
+    if (len >= rBufSize_) {
+      return transport_->tryRead(buf, len);
+    }
+    int32_t got = tryFillReadBuffer();
+    if (got <= 0) {
+      return got;
+    }
+    have = static_cast<uint32_t>(got);
+  }
+
+  uint32_t give = (std::min)(len, have);
+  memcpy(buf, rBase_, give);
+  rBase_ += give;
+  return static_cast<int32_t>(give);
+}
+
 void TBufferedTransport::writeSlow(const uint8_t* buf, uint32_t len) {
-  uint32_t have_bytes = static_cast<uint32_t>(wBase_ - wBuf_.get());
+  ensureWriteBuffer();
+  if (static_cast<ptrdiff_t>(len) <= wBound_ - wBase_) {
+    // It fits now that there is a buffer
+    memcpy(wBase_, buf, len);
+    wBase_ += len;
+    return;
+  }
+
+  uint32_t have_bytes = static_cast<uint32_t>(wBase_ - wBuf_);
   uint32_t space = static_cast<uint32_t>(wBound_ - wBase_);
   // We should only take the slow path if we can't accomodate the write
   // with the free space already in the buffer.
@@ -86,12 +243,21 @@ void TBufferedTransport::writeSlow(const uint8_t* buf, uint32_t len) {
   // This case also covers the case where the buffer is empty,
   // but it is clearer (I think) to think of it as two separate cases.
   if ((have_bytes + len >= 2*wBufSize_) || (have_bytes == 0)) {
-    // TODO(dreiss): writev
+    // Reset wBase_ first so an exception leaves us with an empty buffer,
+    // just like flush().
+    wBase_ = wBuf_;
     if (have_bytes > 0) {
-      transport_->write(wBuf_.get(), have_bytes);
+      // Hand both to the underlying transport at once so a socket can send
+      // them with one syscall.
+      TIOVec iov[2];
+      iov[0].base = wBuf_;
+      iov[0].len = have_bytes;
+      iov[1].base = buf;
+      iov[1].len = len;
+      transport_->writev(iov, 2);
+    } else {
+      transport_->write(buf, len);
     }
-    transport_->write(buf, len);
-    wBase_ = wBuf_.get();
     return;
   }
 
@@ -99,15 +265,57 @@ void TBufferedTransport::writeSlow(const uint8_t* buf, uint32_t len) {
   memcpy(wBase_, buf, space);
   buf += space;
   len -= space;
-  transport_->write(wBuf_.get(), wBufSize_);
+  transport_->write(wBuf_, wBufSize_);
 
   // Copy the rest into our buffer.
   assert(len < wBufSize_);
-  memcpy(wBuf_.get(), buf, len);
-  wBase_ = wBuf_.get() + len;
+  memcpy(wBuf_, buf, len);
+  wBase_ = wBuf_ + len;
   return;
 }
 
+void TBufferedTransport::writev(const TIOVec* iov, uint32_t iovcnt) {
+  ensureWriteBuffer();
+  uint32_t space = static_cast<uint32_t>(wBound_ - wBase_);
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < iovcnt; ++i) {
+    total += iov[i].len;
+  }
+
+  // Small writes are cheaper to buffer up than to send.
+  if (total <= space) {
+    for (uint32_t i = 0; i < iovcnt; ++i) {
+      TBufferBase::write(iov[i].base, iov[i].len);
+    }
+    return;
+  }
+
+  // Otherwise, send whatever we have buffered along with the caller's
+  // buffers, without copying any of the caller's data.
+  uint32_t have_bytes = static_cast<uint32_t>(wBase_ - wBuf_);
+  std::vector<TIOVec> out;
+  out.reserve(iovcnt + 1);
+  if (have_bytes > 0) {
+    TIOVec pending;
+    pending.base = wBuf_;
+    pending.len = have_bytes;
+    out.push_back(pending);
+  }
+  out.insert(out.end(), iov, iov + iovcnt);
+
+  wBase_ = wBuf_;
+  transport_->writev(&out[0], static_cast<uint32_t>(out.size()));
+}
+
+void TBufferedTransport::transferFrom(int fd, off_t offset, uint32_t len) {
+  uint32_t have_bytes = static_cast<uint32_t>(wBase_ - wBuf_);
+  if (have_bytes > 0) {
+    wBase_ = wBuf_;
+    transport_->write(wBuf_, have_bytes);
+  }
+  transport_->transferFrom(fd, offset, len);
+}
+
 const uint8_t* TBufferedTransport::borrowSlow(uint8_t* buf, uint32_t* len) {
   (void) buf;
   (void) len;
@@ -118,13 +326,13 @@ const uint8_t* TBufferedTransport::borrowSlow(uint8_t* buf, uint32_t* len) {
 
 void TBufferedTransport::flush()  {
   // Write out any data waiting in the write buffer.
-  uint32_t have_bytes = static_cast<uint32_t>(wBase_ - wBuf_.get());
+  uint32_t have_bytes = static_cast<uint32_t>(wBase_ - wBuf_);
   if (have_bytes > 0) {
     // Note that we reset wBase_ prior to the underlying write
     // to ensure we're in a sane state (i.e. internal buffer cleaned)
     // if the underlying write throws up an exception
-    wBase_ = wBuf_.get();
-    transport_->write(wBuf_.get(), have_bytes);
+    wBase_ = wBuf_;
+    transport_->write(wBuf_, have_bytes);
   }
 
   // Flush the underlying transport.
@@ -132,6 +340,32 @@ void TBufferedTransport::flush()  {
 }
 
 
+boost::shared_ptr<TTransport> TBufferedTransportFactory::getTransport(boost::shared_ptr<TTransport> trans) {
+  boost::shared_ptr<TBufferedTransport> buffered = recycled_.take();
+  if (buffered) {
+    buffered->resetTransport(trans);
+    return buffered;
+  }
+  buffered.reset(new TBufferedTransport(trans, bufferSize_));
+  if (pool_) {
+    buffered->setBufferPool(pool_);
+  }
+  buffered->setReleaseWhenIdle(releaseWhenIdle_);
+  return buffered;
+}
+
+void TBufferedTransportFactory::recycle(boost::shared_ptr<TTransport>& trans) {
+  boost::shared_ptr<TBufferedTransport> buffered =
+    boost::dynamic_pointer_cast<TBufferedTransport>(trans);
+  trans.reset();
+  if (buffered && buffered.unique()) {
+    // Let go of the connection now rather than when reused
+    buffered->resetTransport(boost::shared_ptr<TTransport>());
+    recycled_.put(buffered);
+  }
+}
+
+
 uint32_t TFramedTransport::readSlow(uint8_t* buf, uint32_t len) {
   uint32_t want = len;
   uint32_t have = static_cast<uint32_t>(rBound_ - rBase_);
@@ -171,11 +405,33 @@ bool TFramedTransport::readFrame() {
   // TODO(dreiss): Think about using readv here, even though it would
   // result in (gasp) read-ahead.
 
+  uint32_t word;
+  if (!readFrameHeader(&word)) {
+    return false;
+  }
+
+  int32_t sz = static_cast<int32_t>(word);
+  if (sz < 0) {
+    throw TTransportException("Frame size has negative value");
+  }
+
+  // Read the frame payload, and reset markers.
+  if (sz > static_cast<int32_t>(rBufSize_)) {
+    TAllocScope scope(TAllocTracking::TRANSPORT);
+    rBuf_.reset(new uint8_t[sz]);
+    rBufSize_ = sz;
+  }
+  transport_->readAll(rBuf_.get(), sz);
+  setReadBuffer(rBuf_.get(), sz);
+  return true;
+}
+
+bool TFramedTransport::readFrameHeader(uint32_t* word) {
   // Read the size of the next frame.
   // We can't use readAll(&sz, sizeof(sz)), since that always throws an
   // exception on EOF.  We want to throw an exception only if EOF occurs after
   // partial size data.
-  int32_t sz;
+  uint32_t sz;
   uint32_t size_bytes_read = 0;
   while (size_bytes_read < sizeof(sz)) {
     uint8_t* szp = reinterpret_cast<uint8_t*>(&sz) + size_bytes_read;
@@ -196,20 +452,68 @@ bool TFramedTransport::readFrame() {
     size_bytes_read += bytes_read;
   }
 
-  sz = ntohl(sz);
+  *word = ntohl(sz);
+  return true;
+}
 
-  if (sz < 0) {
-    throw TTransportException("Frame size has negative value");
+int32_t TFramedTransport::tryRead(uint8_t* buf, uint32_t len) {
+  // Empty frames have nothing to give
+  while (rBase_ == rBound_) {
+    int32_t status = tryReadFrame();
+    if (status <= 0) {
+      return status;
+    }
   }
 
-  // Read the frame payload, and reset markers.
-  if (sz > static_cast<int32_t>(rBufSize_)) {
-    rBuf_.reset(new uint8_t[sz]);
-    rBufSize_ = sz;
+  uint32_t give = (std::min)(len, static_cast<uint32_t>(rBound_ - rBase_));
+  memcpy(buf, rBase_, give);
+  rBase_ += give;
+  return static_cast<int32_t>(give);
+}
+
+int32_t TFramedTransport::tryReadFrame() {
+  const uint32_t headerSize = static_cast<uint32_t>(sizeof(pendingWord_));
+  while (pendingPos_ < headerSize) {
+    int32_t got = transport_->tryRead(
+      reinterpret_cast<uint8_t*>(&pendingWord_) + pendingPos_, headerSize - pendingPos_);
+    if (got == 0 && pendingPos_ > 0) {
+      // End of stream after a partial frame header
+      return TRY_FAILED;
+    }
+    if (got <= 0) {
+      return got;
+    }
+    pendingPos_ += static_cast<uint32_t>(got);
+    if (pendingPos_ == headerSize) {
+      int32_t sz = static_cast<int32_t>(ntohl(pendingWord_));
+      if (sz < 0) {
+        return TRY_FAILED;
+      }
+      if (sz > static_cast<int32_t>(rBufSize_)) {
+        TAllocScope scope(TAllocTracking::TRANSPORT);
+        rBuf_.reset(new uint8_t[sz]);
+        rBufSize_ = sz;
+      }
+    }
   }
-  transport_->readAll(rBuf_.get(), sz);
+
+  uint32_t sz = ntohl(pendingWord_);
+  while (pendingPos_ - headerSize < sz) {
+    uint32_t have = pendingPos_ - headerSize;
+    int32_t got = transport_->tryRead(rBuf_.get() + have, sz - have);
+    if (got == 0) {
+      // End of stream part way through the frame
+      return TRY_FAILED;
+    }
+    if (got < 0) {
+      return got;
+    }
+    pendingPos_ += static_cast<uint32_t>(got);
+  }
+
+  pendingPos_ = 0;
   setReadBuffer(rBuf_.get(), sz);
-  return true;
+  return 1;
 }
 
 void TFramedTransport::writeSlow(const uint8_t* buf, uint32_t len) {
@@ -223,11 +527,33 @@ void TFramedTransport::writeSlow(const uint8_t* buf, uint32_t len) {
   while (new_size < len + have) {
     new_size = new_size > 0 ? new_size * 2 : 1;
   }
+  resizeWriteBuffer(new_size);
+
+  // Copy the data into the new buffer.
+  memcpy(wBase_, buf, len);
+  wBase_ += len;
+}
+
+void TFramedTransport::reserve(uint32_t len) {
+  uint32_t have = static_cast<uint32_t>(wBase_ - wBuf_.get());
+  if (len <= static_cast<uint32_t>(wBound_ - wBase_)) {
+    return;
+  }
+  if (len + have < have /* overflow */ || len + have > 0x7fffffff) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+        "Attempted to write over 2 GB to TFramedTransport.");
+  }
+  resizeWriteBuffer(len + have);
+}
+
+void TFramedTransport::resizeWriteBuffer(uint32_t new_size) {
+  uint32_t have = static_cast<uint32_t>(wBase_ - wBuf_.get());
 
   // TODO(dreiss): Consider modifying this class to use malloc/free
   // so we can use realloc here.
 
   // Allocate new buffer.
+  TAllocScope scope(TAllocTracking::TRANSPORT);
   uint8_t* new_buf = new uint8_t[new_size];
 
   // Copy the old buffer to the new one.
@@ -238,10 +564,6 @@ void TFramedTransport::writeSlow(const uint8_t* buf, uint32_t len) {
   wBufSize_ = new_size;
   wBase_ = wBuf_.get() + have;
   wBound_ = wBuf_.get() + wBufSize_;
-
-  // Copy the data into the new buffer.
-  memcpy(wBase_, buf, len);
-  wBase_ += len;
 }
 
 void TFramedTransport::flush()  {
@@ -270,6 +592,39 @@ void TFramedTransport::flush()  {
   transport_->flush();
 }
 
+void TFramedTransport::flushWith(const TIOVec* iov, uint32_t iovcnt) {
+  uint32_t sz_nbo;
+  uint32_t have = static_cast<uint32_t>(wBase_ - (wBuf_.get() + sizeof(sz_nbo)));
+  uint64_t total = have;
+  for (uint32_t i = 0; i < iovcnt; ++i) {
+    total += iov[i].len;
+  }
+  if (total > 0x7fffffff) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+        "Attempted to write over 2 GB to TFramedTransport.");
+  }
+  if (total == 0) {
+    transport_->flush();
+    return;
+  }
+  sz_nbo = htonl(static_cast<uint32_t>(total));
+  memcpy(wBuf_.get(), (uint8_t*)&sz_nbo, sizeof(sz_nbo));
+
+  // The size and what was written so far go first, from the buffer
+  std::vector<TIOVec> out;
+  out.reserve(iovcnt + 1);
+  TIOVec head;
+  head.base = wBuf_.get();
+  head.len = static_cast<uint32_t>(sizeof(sz_nbo)) + have;
+  out.push_back(head);
+  out.insert(out.end(), iov, iov + iovcnt);
+
+  // As in flush(), the buffer is reset before the write can throw
+  wBase_ = wBuf_.get() + sizeof(sz_nbo);
+  transport_->writev(&out[0], static_cast<uint32_t>(out.size()));
+  transport_->flush();
+}
+
 uint32_t TFramedTransport::writeEnd() {
   return static_cast<uint32_t>(wBase_ - wBuf_.get());
 }
@@ -346,8 +701,30 @@ void TMemoryBuffer::ensureCanWrite(uint32_t len) {
     new_size = new_size > 0 ? new_size * 2 : 1;
     avail = available_write() + (new_size - bufferSize_);
   }
+  resizeBuffer(new_size);
+}
 
+void TMemoryBuffer::reserve(uint32_t len) {
+  uint32_t avail = available_write();
+  if (len <= avail) {
+    return;
+  }
+
+  if (!owner_) {
+    throw TTransportException("Insufficient space in external MemoryBuffer");
+  }
+
+  uint32_t new_size = bufferSize_ + (len - avail);
+  if (new_size < bufferSize_ /* overflow */) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+        "Attempted to reserve over 4 GB in TMemoryBuffer.");
+  }
+  resizeBuffer(new_size);
+}
+
+void TMemoryBuffer::resizeBuffer(uint32_t new_size) {
   // Allocate into a new pointer so we don't bork ours if it fails.
+  TAllocScope scope(TAllocTracking::TRANSPORT);
   void* new_buffer = std::realloc(buffer_, new_size);
   if (new_buffer == NULL) {
     throw std::bad_alloc();
@@ -388,4 +765,197 @@ const uint8_t* TMemoryBuffer::borrowSlow(uint8_t* buf, uint32_t* len) {
   return NULL;
 }
 
+
+TSegmentedMemoryBuffer::TSegmentedMemoryBuffer()
+  : segmentSize_(defaultSegmentSize)
+  , readSegment_(0)
+  , writeSegment_(0) {
+  resetBuffer(defaultSegmentSize);
+}
+
+TSegmentedMemoryBuffer::TSegmentedMemoryBuffer(uint32_t segmentSize)
+  : segmentSize_(segmentSize)
+  , readSegment_(0)
+  , writeSegment_(0) {
+  resetBuffer(segmentSize);
+}
+
+TSegmentedMemoryBuffer::~TSegmentedMemoryBuffer() {
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    std::free(segments_[i].data);
+  }
+}
+
+void TSegmentedMemoryBuffer::resetBuffer() {
+  readSegment_ = 0;
+  writeSegment_ = 0;
+  segments_[0].length = 0;
+  setReadBuffer(segments_[0].data, 0);
+  setWriteBuffer(segments_[0].data, segmentSize_);
+}
+
+void TSegmentedMemoryBuffer::resetBuffer(uint32_t segmentSize) {
+  // Small segments would make the per-segment bookkeeping dominate.
+  segmentSize = (std::max)(segmentSize, static_cast<uint32_t>(16));
+
+  Segment first;
+  first.data = (uint8_t*)std::malloc(segmentSize);
+  if (first.data == NULL) {
+    throw std::bad_alloc();
+  }
+  first.length = 0;
+
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    std::free(segments_[i].data);
+  }
+  segments_.clear();
+  segments_.push_back(first);
+  segmentSize_ = segmentSize;
+  resetBuffer();
+}
+
+void TSegmentedMemoryBuffer::getSegments(std::vector<TIOVec>& iov) {
+  refreshRead();
+  TIOVec v;
+  v.base = rBase_;
+  v.len = static_cast<uint32_t>(rBound_ - rBase_);
+  if (v.len > 0) {
+    iov.push_back(v);
+  }
+  for (size_t i = readSegment_ + 1; i <= writeSegment_; ++i) {
+    v.base = segments_[i].data;
+    v.len = segmentLength(i);
+    if (v.len > 0) {
+      iov.push_back(v);
+    }
+  }
+}
+
+void TSegmentedMemoryBuffer::writeTo(TTransport& transport) {
+  std::vector<TIOVec> iov;
+  iov.reserve(writeSegment_ - readSegment_ + 1);
+  getSegments(iov);
+  if (!iov.empty()) {
+    transport.writev(&iov[0], static_cast<uint32_t>(iov.size()));
+  }
+}
+
+std::string TSegmentedMemoryBuffer::getBufferAsString() {
+  std::string str;
+  appendBufferToString(str);
+  return str;
+}
+
+void TSegmentedMemoryBuffer::appendBufferToString(std::string& str) {
+  std::vector<TIOVec> iov;
+  getSegments(iov);
+  str.reserve(str.size() + available_read());
+  for (size_t i = 0; i < iov.size(); ++i) {
+    str.append((const char*)iov[i].base, iov[i].len);
+  }
+}
+
+uint32_t TSegmentedMemoryBuffer::available_read() const {
+  uint32_t avail = segmentLength(readSegment_) -
+    static_cast<uint32_t>(rBase_ - segments_[readSegment_].data);
+  for (size_t i = readSegment_ + 1; i <= writeSegment_; ++i) {
+    avail += segmentLength(i);
+  }
+  return avail;
+}
+
+uint32_t TSegmentedMemoryBuffer::readEnd() {
+  uint32_t bytes = static_cast<uint32_t>(rBase_ - segments_[readSegment_].data);
+  for (size_t i = 0; i < readSegment_; ++i) {
+    bytes += segments_[i].length;
+  }
+  if (available_read() == 0) {
+    resetBuffer();
+  }
+  return bytes;
+}
+
+uint32_t TSegmentedMemoryBuffer::writeEnd() {
+  uint32_t bytes = 0;
+  for (size_t i = 0; i <= writeSegment_; ++i) {
+    bytes += segmentLength(i);
+  }
+  return bytes;
+}
+
+uint32_t TSegmentedMemoryBuffer::refreshRead() {
+  for (;;) {
+    rBound_ = segments_[readSegment_].data + segmentLength(readSegment_);
+    if (rBase_ < rBound_ || readSegment_ == writeSegment_) {
+      return static_cast<uint32_t>(rBound_ - rBase_);
+    }
+    ++readSegment_;
+    rBase_ = segments_[readSegment_].data;
+  }
+}
+
+void TSegmentedMemoryBuffer::nextWriteSegment() {
+  if (writeSegment_ + 1 == segments_.size()) {
+    Segment next;
+    TAllocScope scope(TAllocTracking::TRANSPORT);
+    next.data = (uint8_t*)std::malloc(segmentSize_);
+    if (next.data == NULL) {
+      throw std::bad_alloc();
+    }
+    segments_.push_back(next);
+  }
+
+  segments_[writeSegment_].length = segmentLength(writeSegment_);
+  ++writeSegment_;
+  segments_[writeSegment_].length = 0;
+  setWriteBuffer(segments_[writeSegment_].data, segmentSize_);
+}
+
+uint32_t TSegmentedMemoryBuffer::readSlow(uint8_t* buf, uint32_t len) {
+  uint32_t got = 0;
+  while (got < len) {
+    uint32_t avail = refreshRead();
+    if (avail == 0) {
+      break;
+    }
+    uint32_t give = (std::min)(len - got, avail);
+    memcpy(buf + got, rBase_, give);
+    rBase_ += give;
+    got += give;
+  }
+  return got;
+}
+
+void TSegmentedMemoryBuffer::writeSlow(const uint8_t* buf, uint32_t len) {
+  uint64_t total = static_cast<uint64_t>(writeEnd()) + len;
+  if (total > 0x7fffffff) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+        "Attempted to write over 2 GB to TSegmentedMemoryBuffer.");
+  }
+
+  while (len > 0) {
+    uint32_t space = static_cast<uint32_t>(wBound_ - wBase_);
+    if (space == 0) {
+      nextWriteSegment();
+      continue;
+    }
+    uint32_t give = (std::min)(space, len);
+    memcpy(wBase_, buf, give);
+    wBase_ += give;
+    buf += give;
+    len -= give;
+  }
+}
+
+const uint8_t* TSegmentedMemoryBuffer::borrowSlow(uint8_t* buf, uint32_t* len) {
+  (void) buf;
+  // We can't hand out a pointer to data that spans two segments, and
+  // copying into buf wouldn't let consume() skip over both of them.
+  if (refreshRead() >= *len) {
+    *len = static_cast<uint32_t>(rBound_ - rBase_);
+    return rBase_;
+  }
+  return NULL;
+}
+
 }}} // apache::thrift::transport
@@ -21,8 +21,11 @@
 #define _THRIFT_TRANSPORT_TBUFFERTRANSPORTS_H_ 1
 
 #include <cstring>
+#include <vector>
 #include <boost/scoped_array.hpp>
 
+#include <thrift/TAllocTracking.h>
+#include <thrift/TRecycleBin.h>
 #include <thrift/transport/TTransport.h>
 #include <thrift/transport/TVirtualTransport.h>
 
@@ -34,7 +37,13 @@
 #define TDB_UNLIKELY(val) (val)
 #endif
 
-namespace apache { namespace thrift { namespace transport {
+namespace apache { namespace thrift {
+
+namespace server {
+class TConcurrentBufferPool;
+}
+
+namespace transport {
 
 
 /**
@@ -57,7 +66,8 @@ class TBufferBase : public TVirtualTransport<TBufferBase> {
    * When we have enough data buffered to fulfill the read, we can satisfy it
    * with a single memcpy, then adjust our internal pointers.  If the buffer
    * is empty, we call out to our slow path, implemented by a subclass.
-   * This method is meant to eventually be nonvirtual and inlinable.
+   * This method is nonvirtual and inlinable, so a protocol templated on
+   * TBufferBase or a subclass reads straight from the buffer.
    */
   uint32_t read(uint8_t* buf, uint32_t len) {
     uint8_t* new_rBase = rBase_ + len;
@@ -88,8 +98,7 @@ class TBufferBase : public TVirtualTransport<TBufferBase> {
    * When we have enough empty space in our buffer to accomodate the write, we
    * can satisfy it with a single memcpy, then adjust our internal pointers.
    * If the buffer is full, we call out to our slow path, implemented by a
-   * subclass.  This method is meant to eventually be nonvirtual and
-   * inlinable.
+   * subclass.  Like read(), this method is nonvirtual and inlinable.
    */
   void write(const uint8_t* buf, uint32_t len) {
     uint8_t* new_wBase = wBase_ + len;
@@ -126,6 +135,27 @@ class TBufferBase : public TVirtualTransport<TBufferBase> {
     }
   }
 
+  /**
+   * Fast-path in-place write.  Returns where up to len bytes may be written
+   * straight into the buffer, for output whose size is only known once it
+   * is encoded, or NULL if the buffer hasn't that much room left, in which
+   * case write() takes the slow path as usual.  Follow it with
+   * consumeWrite() of what was actually written.
+   */
+  uint8_t* borrowWrite(uint32_t len) {
+    if (TDB_LIKELY(static_cast<ptrdiff_t>(len) <= wBound_ - wBase_)) {
+      return wBase_;
+    }
+    return NULL;
+  }
+
+  /**
+   * Commits len bytes written in place after borrowWrite().
+   */
+  void consumeWrite(uint32_t len) {
+    wBase_ += len;
+  }
+
 
  protected:
 
@@ -181,12 +211,54 @@ class TBufferBase : public TVirtualTransport<TBufferBase> {
   uint8_t* wBound_;
 };
 
+/**
+ * TBufferBase::borrowWrite() and consumeWrite() for code templated on its
+ * transport, such as the protocols.  Which overload applies is settled at
+ * compile time, so with a TBufferBase or a subclass these are as cheap as
+ * calling the members directly, and other transports, which have no buffer
+ * to lend, always get NULL.
+ */
+template <class Transport_>
+inline uint8_t* borrowWrite(Transport_& trans, uint32_t len,
+                            THRIFT_OVERLOAD_IF(Transport_, TBufferBase)) {
+  return trans.borrowWrite(len);
+}
+
+template <class Transport_>
+inline void consumeWrite(Transport_& trans, uint32_t len,
+                         THRIFT_OVERLOAD_IF(Transport_, TBufferBase)) {
+  trans.consumeWrite(len);
+}
+
+#define THRIFT_UNBUFFERED_IF(T) \
+  typename ::boost::disable_if<typename ::boost::is_convertible<T*, TBufferBase*>::type, \
+                               void*>::type = NULL
+
+template <class Transport_>
+inline uint8_t* borrowWrite(Transport_&, uint32_t, THRIFT_UNBUFFERED_IF(Transport_)) {
+  return NULL;
+}
+
+template <class Transport_>
+inline void consumeWrite(Transport_&, uint32_t, THRIFT_UNBUFFERED_IF(Transport_)) {
+  throw TTransportException(TTransportException::BAD_ARGS,
+                            "consumeWrite did not follow a borrowWrite.");
+}
+
+#undef THRIFT_UNBUFFERED_IF
+
 
 /**
  * Buffered transport. For reads it will read more data than is requested
  * and will serve future data out of a local buffer. For writes, data is
  * stored to an in memory buffer before being written out.
  *
+ * The buffers are only allocated once they are first needed.  With
+ * setReleaseWhenIdle() they are given back whenever peek() finds both of
+ * them empty, which is where the threaded servers wait between requests,
+ * so an idle connection holds no buffer memory.  setBufferPool() has them
+ * come from, and go back to, a pool shared by many transports.
+ *
  */
 class TBufferedTransport
   : public TVirtualTransport<TBufferedTransport, TBufferBase> {
@@ -194,13 +266,23 @@ class TBufferedTransport
 
   static const int DEFAULT_BUFFER_SIZE = 512;
 
+  /// How far the read buffer may grow by default
+  static const int DEFAULT_MAX_READ_BUFFER_SIZE = 64 * 1024;
+
   /// Use default buffer sizes.
   TBufferedTransport(boost::shared_ptr<TTransport> transport)
     : transport_(transport)
     , rBufSize_(DEFAULT_BUFFER_SIZE)
+    , rBufInitialSize_(DEFAULT_BUFFER_SIZE)
+    , rBufMaxSize_(DEFAULT_MAX_READ_BUFFER_SIZE)
     , wBufSize_(DEFAULT_BUFFER_SIZE)
-    , rBuf_(new uint8_t[rBufSize_])
-    , wBuf_(new uint8_t[wBufSize_])
+    , rBuf_(NULL)
+    , wBuf_(NULL)
+    , rBufCapacity_(0)
+    , wBufCapacity_(0)
+    , releaseWhenIdle_(false)
+    , lastFill_(0)
+    , smallFills_(0)
   {
     initPointers();
   }
@@ -209,9 +291,16 @@ class TBufferedTransport
   TBufferedTransport(boost::shared_ptr<TTransport> transport, uint32_t sz)
     : transport_(transport)
     , rBufSize_(sz)
+    , rBufInitialSize_(sz)
+    , rBufMaxSize_(DEFAULT_MAX_READ_BUFFER_SIZE)
     , wBufSize_(sz)
-    , rBuf_(new uint8_t[rBufSize_])
-    , wBuf_(new uint8_t[wBufSize_])
+    , rBuf_(NULL)
+    , wBuf_(NULL)
+    , rBufCapacity_(0)
+    , wBufCapacity_(0)
+    , releaseWhenIdle_(false)
+    , lastFill_(0)
+    , smallFills_(0)
   {
     initPointers();
   }
@@ -220,13 +309,22 @@ class TBufferedTransport
   TBufferedTransport(boost::shared_ptr<TTransport> transport, uint32_t rsz, uint32_t wsz)
     : transport_(transport)
     , rBufSize_(rsz)
+    , rBufInitialSize_(rsz)
+    , rBufMaxSize_(DEFAULT_MAX_READ_BUFFER_SIZE)
     , wBufSize_(wsz)
-    , rBuf_(new uint8_t[rBufSize_])
-    , wBuf_(new uint8_t[wBufSize_])
+    , rBuf_(NULL)
+    , wBuf_(NULL)
+    , rBufCapacity_(0)
+    , wBufCapacity_(0)
+    , releaseWhenIdle_(false)
+    , lastFill_(0)
+    , smallFills_(0)
   {
     initPointers();
   }
 
+  ~TBufferedTransport();
+
   void open() {
     transport_->open();
   }
@@ -235,22 +333,44 @@ class TBufferedTransport
     return transport_->isOpen();
   }
 
-  bool peek() {
-    if (rBase_ == rBound_) {
-      setReadBuffer(rBuf_.get(), transport_->read(rBuf_.get(), rBufSize_));
-    }
-    return (rBound_ > rBase_);
-  }
+  /**
+   * With setReleaseWhenIdle(), gives the buffers back first if both are
+   * empty and waits on the underlying transport's peek().
+   */
+  bool peek();
 
   void close() {
     flush();
     transport_->close();
   }
 
+  /**
+   * Reads of at least the buffer's size go straight into buf when nothing
+   * is buffered, rather than being copied through the buffer in pieces.
+   */
   virtual uint32_t readSlow(uint8_t* buf, uint32_t len);
 
+  /**
+   * Refills the buffer with the underlying transport's tryRead(), so
+   * nothing is thrown between the two.  Large reads skip the buffer as in
+   * readSlow().
+   */
+  int32_t tryRead(uint8_t* buf, uint32_t len);
+
   virtual void writeSlow(const uint8_t* buf, uint32_t len);
 
+  /**
+   * Buffers small gather writes.  Larger ones are passed down to the
+   * underlying transport in one piece, along with any data already buffered.
+   */
+  virtual void writev(const TIOVec* iov, uint32_t iovcnt);
+
+  /**
+   * Writes out whatever is buffered, then lets the underlying transport
+   * send the file's bytes itself.
+   */
+  virtual void transferFrom(int fd, off_t offset, uint32_t len);
+
   void flush();
 
 
@@ -279,19 +399,86 @@ class TBufferedTransport
     return TBufferBase::readAll(buf, len);
   }
 
+  /**
+   * Take the buffers from pool, which may be shared with other threads,
+   * rather than the heap.  Must be called while nothing is buffered.
+   */
+  void setBufferPool(boost::shared_ptr<server::TConcurrentBufferPool> pool);
+
+  /**
+   * The read buffer starts at the size given to the constructor.  When the
+   * underlying transport fills all of it, it doubles, up to maxSize, and
+   * when refills keep using less than a quarter of it, it halves, down to
+   * where it started.  releaseBuffers() puts it back to where it started.
+   * A maxSize no bigger than the starting size keeps it fixed.
+   */
+  void setMaxReadBufferSize(uint32_t maxSize) {
+    rBufMaxSize_ = maxSize;
+  }
+
+  /// The read buffer's current size
+  uint32_t getReadBufferSize() const {
+    return rBufSize_;
+  }
+
+  /// Whether peek() gives the buffers back when both are empty
+  void setReleaseWhenIdle(bool releaseWhenIdle) {
+    releaseWhenIdle_ = releaseWhenIdle;
+  }
+
+  /**
+   * Gives both buffers back now, unless either holds data.  They are
+   * allocated again on the next read or write.
+   *
+   * @return whether the buffers were released
+   */
+  bool releaseBuffers();
+
+  /**
+   * Puts this over a different underlying transport, for a new connection.
+   * Anything buffered is thrown away, but the buffers are kept unless
+   * setReleaseWhenIdle() is on.
+   */
+  void resetTransport(boost::shared_ptr<TTransport> transport);
+
  protected:
   void initPointers() {
-    setReadBuffer(rBuf_.get(), 0);
-    setWriteBuffer(wBuf_.get(), wBufSize_);
-    // Write size never changes.
+    setReadBuffer(rBuf_, 0);
+    setWriteBuffer(wBuf_, wBuf_ ? wBufSize_ : 0);
   }
 
+  // Allocate the buffers on first use
+  void ensureReadBuffer();
+  void ensureWriteBuffer();
+
+  // Resize the empty read buffer as the last fill suggests, then fill it
+  uint32_t fillReadBuffer();
+  int32_t tryFillReadBuffer();
+  void adaptReadBuffer();
+
+  uint8_t* allocateBuffer(uint32_t size, uint32_t* capacity);
+  void freeBuffer(uint8_t* buf, uint32_t capacity);
+
   boost::shared_ptr<TTransport> transport_;
 
   uint32_t rBufSize_;
+  uint32_t rBufInitialSize_;
+  uint32_t rBufMaxSize_;
   uint32_t wBufSize_;
-  boost::scoped_array<uint8_t> rBuf_;
-  boost::scoped_array<uint8_t> wBuf_;
+  uint8_t* rBuf_;
+  uint8_t* wBuf_;
+
+  // What the pool actually handed out, to give back
+  uint32_t rBufCapacity_;
+  uint32_t wBufCapacity_;
+
+  boost::shared_ptr<server::TConcurrentBufferPool> pool_;
+  bool releaseWhenIdle_;
+
+  // How much the last fill of the read buffer got, and how many fills in a
+  // row have used less than a quarter of it
+  uint32_t lastFill_;
+  uint32_t smallFills_;
 };
 
 
@@ -301,17 +488,42 @@ class TBufferedTransport
  */
 class TBufferedTransportFactory : public TTransportFactory {
  public:
-  TBufferedTransportFactory() {}
+  TBufferedTransportFactory()
+    : bufferSize_(TBufferedTransport::DEFAULT_BUFFER_SIZE)
+    , releaseWhenIdle_(false) {}
+
+  /**
+   * Makes transports with bufferSize byte buffers taken from pool (the heap
+   * if NULL) and given back whenever the connection is idle.
+   */
+  TBufferedTransportFactory(uint32_t bufferSize,
+                            boost::shared_ptr<server::TConcurrentBufferPool> pool)
+    : bufferSize_(bufferSize)
+    , pool_(pool)
+    , releaseWhenIdle_(true) {}
 
   virtual ~TBufferedTransportFactory() {}
 
   /**
    * Wraps the transport into a buffered one.
    */
-  virtual boost::shared_ptr<TTransport> getTransport(boost::shared_ptr<TTransport> trans) {
-    return boost::shared_ptr<TTransport>(new TBufferedTransport(trans));
+  virtual boost::shared_ptr<TTransport> getTransport(boost::shared_ptr<TTransport> trans);
+
+  /**
+   * Keep up to limit transports given back through recycle(), buffers and
+   * all, for getTransport() to reuse.  0, the default, keeps none.
+   */
+  void setRecycleLimit(size_t limit) {
+    recycled_.setLimit(limit);
   }
 
+  virtual void recycle(boost::shared_ptr<TTransport>& trans);
+
+ private:
+  uint32_t bufferSize_;
+  boost::shared_ptr<server::TConcurrentBufferPool> pool_;
+  bool releaseWhenIdle_;
+  TRecycleBin<TBufferedTransport> recycled_;
 };
 
 
@@ -321,6 +533,9 @@ class TBufferedTransportFactory : public TTransportFactory {
  * binary chunk followed by the data payload. This allows the receiver on the
  * other end to always do fixed-length reads.
  *
+ * Since the frame size goes first, writev() still copies into the buffer
+ * like write(); flushWith() ends a frame with buffers that aren't copied.
+ *
  */
 class TFramedTransport
   : public TVirtualTransport<TFramedTransport, TBufferBase> {
@@ -335,6 +550,8 @@ class TFramedTransport
     , wBufSize_(DEFAULT_BUFFER_SIZE)
     , rBuf_()
     , wBuf_(new uint8_t[wBufSize_])
+    , pendingWord_(0)
+    , pendingPos_(0)
   {
     initPointers();
   }
@@ -345,6 +562,8 @@ class TFramedTransport
     , wBufSize_(sz)
     , rBuf_()
     , wBuf_(new uint8_t[wBufSize_])
+    , pendingWord_(0)
+    , pendingPos_(0)
   {
     initPointers();
   }
@@ -368,10 +587,38 @@ class TFramedTransport
 
   virtual uint32_t readSlow(uint8_t* buf, uint32_t len);
 
+  /**
+   * Gathers the next frame over as many calls as the underlying
+   * transport's tryRead() takes to deliver it, so a partial frame gives
+   * TRY_LATER rather than blocking.  Don't mix with read() part way
+   * through a frame.
+   */
+  int32_t tryRead(uint8_t* buf, uint32_t len);
+
   virtual void writeSlow(const uint8_t* buf, uint32_t len);
 
   virtual void flush();
 
+  /**
+   * Ends the current frame with iov's buffers and sends it as flush() does,
+   * the frame size, what was written before and the buffers going to the
+   * underlying transport's writev() in one call.  The buffers aren't
+   * copied, so large payloads, or blobs owned elsewhere, reach a socket
+   * without passing through the write buffer.
+   *
+   * @param iov     The buffers that end the frame
+   * @param iovcnt  How many entries of iov there are
+   */
+  void flushWith(const TIOVec* iov, uint32_t iovcnt);
+
+  /**
+   * Makes room for len more bytes in the current frame, growing the buffer
+   * once to exactly that size if it is short.  Call it with the
+   * serializedSize() of a message before writing it to avoid the buffer
+   * doubling as it goes.
+   */
+  void reserve(uint32_t len);
+
   uint32_t readEnd();
 
   uint32_t writeEnd();
@@ -390,6 +637,17 @@ class TFramedTransport
     return TBufferBase::readAll(buf,len);
   }
 
+  /**
+   * Puts this over a different underlying transport, for a new connection.
+   * Any partial frame is thrown away, but the buffers are kept.
+   */
+  void resetTransport(boost::shared_ptr<TTransport> transport) {
+    transport_ = transport;
+    pendingWord_ = 0;
+    pendingPos_ = 0;
+    initPointers();
+  }
+
  protected:
   /**
    * Reads a frame of input from the underlying stream.
@@ -397,7 +655,17 @@ class TFramedTransport
    * Returns true if a frame was read successfully, or false on EOF.
    * (Raises a TTransportException if EOF occurs after a partial frame.)
    */
-  bool readFrame();
+  virtual bool readFrame();
+
+  /**
+   * Reads the four byte frame header into *word, in host byte order.
+   *
+   * Returns false on EOF before any of it, like readFrame().
+   */
+  bool readFrameHeader(uint32_t* word);
+
+  // Moves what has been written so far into a new buffer of new_size.
+  void resizeWriteBuffer(uint32_t new_size);
 
   void initPointers() {
     setReadBuffer(NULL, 0);
@@ -408,12 +676,23 @@ class TFramedTransport
     this->write((uint8_t*)&pad, sizeof(pad));
   }
 
+  /**
+   * tryRead()'s readFrame(): 1 once a frame is in the buffer, otherwise
+   * what the underlying transport's tryRead() gave.
+   */
+  int32_t tryReadFrame();
+
   boost::shared_ptr<TTransport> transport_;
 
   uint32_t rBufSize_;
   uint32_t wBufSize_;
   boost::scoped_array<uint8_t> rBuf_;
   boost::scoped_array<uint8_t> wBuf_;
+
+  // The frame tryRead() is part way through: its size, in network byte
+  // order, and how many bytes of it, counting the size, have arrived
+  uint32_t pendingWord_;
+  uint32_t pendingPos_;
 };
 
 /**
@@ -430,9 +709,35 @@ class TFramedTransportFactory : public TTransportFactory {
    * Wraps the transport into a framed one.
    */
   virtual boost::shared_ptr<TTransport> getTransport(boost::shared_ptr<TTransport> trans) {
+    boost::shared_ptr<TFramedTransport> framed = recycled_.take();
+    if (framed) {
+      framed->resetTransport(trans);
+      return framed;
+    }
     return boost::shared_ptr<TTransport>(new TFramedTransport(trans));
   }
 
+  /**
+   * Keep up to limit transports given back through recycle(), buffers and
+   * all, for getTransport() to reuse.  0, the default, keeps none.
+   */
+  void setRecycleLimit(size_t limit) {
+    recycled_.setLimit(limit);
+  }
+
+  virtual void recycle(boost::shared_ptr<TTransport>& trans) {
+    boost::shared_ptr<TFramedTransport> framed =
+      boost::dynamic_pointer_cast<TFramedTransport>(trans);
+    trans.reset();
+    if (framed && framed.unique()) {
+      // Let go of the connection now rather than when reused
+      framed->resetTransport(boost::shared_ptr<TTransport>());
+      recycled_.put(framed);
+    }
+  }
+
+ private:
+  TRecycleBin<TFramedTransport> recycled_;
 };
 
 
@@ -452,6 +757,7 @@ class TMemoryBuffer : public TVirtualTransport<TMemoryBuffer, TBufferBase> {
   void initCommon(uint8_t* buf, uint32_t size, bool owner, uint32_t wPos) {
     if (buf == NULL && size != 0) {
       assert(owner);
+      TAllocScope scope(TAllocTracking::TRANSPORT);
       buf = (uint8_t*)std::malloc(size);
       if (buf == NULL) {
         throw std::bad_alloc();
@@ -495,6 +801,10 @@ class TMemoryBuffer : public TVirtualTransport<TMemoryBuffer, TBufferBase> {
    *   TMemoryBuffer will become the "owner" of the buffer,
    *   and will be responsible for freeing it.
    *   The membory must have been allocated with malloc.
+   *
+   * A buffer can also be observed along with a handle that keeps it alive
+   * (see the constructor taking an owner).  Strings can then be read from
+   * it as TStringViews that point into the buffer.
    */
   enum MemoryPolicy
   { OBSERVE = 1
@@ -551,12 +861,35 @@ class TMemoryBuffer : public TVirtualTransport<TMemoryBuffer, TBufferBase> {
     }
   }
 
+  /**
+   * Construct a TMemoryBuffer that observes buf, which bufferOwner keeps
+   * alive; it is held until the buffer is reset, and by every view into
+   * the buffer handed out through getBorrowOwner().
+   *
+   * @param buf          The contents of the buffer, which are not written to.
+   * @param sz           The size of @c buf.
+   * @param bufferOwner  Keeps @c buf valid, e.g. the shared_ptr to the
+   *                     std::string it points into.
+   */
+  TMemoryBuffer(uint8_t* buf, uint32_t sz, boost::shared_ptr<const void> bufferOwner) {
+    if (buf == NULL && sz != 0) {
+      throw TTransportException(TTransportException::BAD_ARGS,
+                                "TMemoryBuffer given null buffer with non-zero size.");
+    }
+    initCommon(buf, sz, false, sz);
+    bufferOwner_ = bufferOwner;
+  }
+
   ~TMemoryBuffer() {
     if (owner_) {
       std::free(buffer_);
     }
   }
 
+  boost::shared_ptr<const void> getBorrowOwner() {
+    return bufferOwner_;
+  }
+
   bool isOpen() {
     return true;
   }
@@ -603,6 +936,7 @@ class TMemoryBuffer : public TVirtualTransport<TMemoryBuffer, TBufferBase> {
     if (!owner_) {
       wBound_ = wBase_;
       bufferSize_ = 0;
+      bufferOwner_.reset();
     }
   }
 
@@ -627,6 +961,12 @@ class TMemoryBuffer : public TVirtualTransport<TMemoryBuffer, TBufferBase> {
     // Our old self gets destroyed.
   }
 
+  /// See constructor documentation.
+  void resetBuffer(uint8_t* buf, uint32_t sz, boost::shared_ptr<const void> bufferOwner) {
+    TMemoryBuffer new_buffer(buf, sz, bufferOwner);
+    this->swap(new_buffer);
+  }
+
   /// See constructor documentation.
   void resetBuffer(uint32_t sz) {
     // Construct the new buffer.
@@ -636,6 +976,22 @@ class TMemoryBuffer : public TVirtualTransport<TMemoryBuffer, TBufferBase> {
     // Our old self gets destroyed.
   }
 
+  /**
+   * Gives up the buffer, which must be owned, without freeing it.  The
+   * caller frees it with free().  This is left empty, as if constructed
+   * with size 0, and may be handed a new buffer with resetBuffer().
+   *
+   * @param capacity set to the allocated size of the buffer.
+   * @return the buffer, from its start rather than from the read position.
+   */
+  uint8_t* releaseBuffer(uint32_t* capacity) {
+    assert(owner_);
+    uint8_t* buf = buffer_;
+    *capacity = bufferSize_;
+    initCommon(NULL, 0, true, 0);
+    return buf;
+  }
+
   std::string readAsString(uint32_t len) {
     std::string str;
     (void)readAppendToString(str, len);
@@ -683,6 +1039,11 @@ class TMemoryBuffer : public TVirtualTransport<TMemoryBuffer, TBufferBase> {
   // that had been provided by getWritePtr().
   void wroteBytes(uint32_t len);
 
+  // Ensures there is room to write 'len' more bytes, growing the buffer once
+  // to exactly that size rather than doubling.  Useful with the
+  // serializedSize() of a message about to be written.
+  void reserve(uint32_t len);
+
   /*
    * TVirtualTransport provides a default implementation of readAll().
    * We want to use the TBufferBase version instead.
@@ -703,11 +1064,15 @@ class TMemoryBuffer : public TVirtualTransport<TMemoryBuffer, TBufferBase> {
     swap(wBound_,     that.wBound_);
 
     swap(owner_,      that.owner_);
+    swap(bufferOwner_, that.bufferOwner_);
   }
 
   // Make sure there's at least 'len' bytes available for writing.
   void ensureCanWrite(uint32_t len);
 
+  // Reallocate the buffer to new_size, keeping the read and write positions.
+  void resizeBuffer(uint32_t new_size);
+
   // Compute the position and available data for reading.
   void computeRead(uint32_t len, uint8_t** out_start, uint32_t* out_give);
 
@@ -726,10 +1091,161 @@ class TMemoryBuffer : public TVirtualTransport<TMemoryBuffer, TBufferBase> {
   // Is this object the owner of the buffer?
   bool owner_;
 
+  // Keeps an observed buffer alive, for views into it
+  boost::shared_ptr<const void> bufferOwner_;
+
   // Don't forget to update constrctors, initCommon, and swap if
   // you add new members.
 };
 
+
+/**
+ * A memory buffer made of a chain of fixed-size segments.
+ *
+ * It is written and read like a TMemoryBuffer, but when it runs out of room
+ * it simply adds another segment to the chain rather than reallocating and
+ * copying everything written so far.  That keeps large messages from needing twice
+ * their size in memory while growing, and lets the contents be written out
+ * with one gather write (see getSegments() and writeTo()) rather than first
+ * being flattened into one contiguous block.
+ *
+ * The TBufferBase fast paths work within one segment at a time.  borrow()
+ * will fail rather than copy when the requested bytes span two segments.
+ *
+ * It only owns its own segments, so it is not a drop-in TMemoryBuffer:
+ * there is no getBuffer(), since the contents needn't be contiguous, no
+ * resetBuffer() onto memory supplied by the caller, and no observing or
+ * copying of an existing buffer.  getBufferAsString() and resetBuffer()
+ * with no buffer work as TMemoryBuffer's do.
+ */
+class TSegmentedMemoryBuffer
+  : public TVirtualTransport<TSegmentedMemoryBuffer, TBufferBase> {
+ public:
+  static const uint32_t defaultSegmentSize = 16 * 1024;
+
+  /**
+   * Construct a buffer using segments of defaultSegmentSize bytes.
+   */
+  TSegmentedMemoryBuffer();
+
+  /**
+   * Construct a buffer using segments of a specified size.
+   *
+   * @param segmentSize  The size of each segment; at least 16 bytes.
+   */
+  TSegmentedMemoryBuffer(uint32_t segmentSize);
+
+  ~TSegmentedMemoryBuffer();
+
+  bool isOpen() {
+    return true;
+  }
+
+  bool peek() {
+    return available_read() > 0;
+  }
+
+  void open() {}
+
+  void close() {}
+
+  /**
+   * Discards the contents of the buffer.  The segments are kept so that
+   * refilling the buffer doesn't have to allocate anything.
+   */
+  void resetBuffer();
+
+  /**
+   * Discards the contents of the buffer and frees all of its segments,
+   * switching to a new segment size.
+   */
+  void resetBuffer(uint32_t segmentSize);
+
+  /**
+   * Appends one entry per segment describing the unread contents of the
+   * buffer.  The pointers stay valid until the buffer is next written,
+   * reset or destroyed.
+   */
+  void getSegments(std::vector<TIOVec>& iov);
+
+  /**
+   * Writes the unread contents of the buffer to another transport with
+   * one call to writev().  Does not consume them.
+   */
+  void writeTo(TTransport& transport);
+
+  std::string getBufferAsString();
+
+  void appendBufferToString(std::string& str);
+
+  uint32_t getSegmentSize() const {
+    return segmentSize_;
+  }
+
+  /// Number of bytes of memory held in segments.
+  uint32_t getAllocatedSize() const {
+    return static_cast<uint32_t>(segments_.size()) * segmentSize_;
+  }
+
+  uint32_t available_read() const;
+
+  // return number of bytes read
+  uint32_t readEnd();
+
+  // Return number of bytes written
+  uint32_t writeEnd();
+
+  /*
+   * TVirtualTransport provides a default implementation of readAll().
+   * We want to use the TBufferBase version instead.
+   */
+  uint32_t readAll(uint8_t* buf, uint32_t len) {
+    return TBufferBase::readAll(buf,len);
+  }
+
+ protected:
+  // Number of bytes written to segment i.
+  uint32_t segmentLength(size_t i) const {
+    if (i == writeSegment_) {
+      return static_cast<uint32_t>(wBase_ - segments_[i].data);
+    }
+    return segments_[i].length;
+  }
+
+  // Point rBound_ at the end of the data in the read segment, moving on to
+  // the next segment if this one has been used up.  Returns the number of
+  // bytes now available through the fast path.
+  uint32_t refreshRead();
+
+  // Move writing on to the next segment, allocating it if needed.
+  void nextWriteSegment();
+
+  uint32_t readSlow(uint8_t* buf, uint32_t len);
+
+  void writeSlow(const uint8_t* buf, uint32_t len);
+
+  const uint8_t* borrowSlow(uint8_t* buf, uint32_t* len);
+
+  struct Segment {
+    uint8_t* data;
+    // Bytes written, not counting the current write segment.
+    uint32_t length;
+  };
+
+  // Segments in use are segments_[0] through segments_[writeSegment_];
+  // any after that are spares left over from an earlier resetBuffer().
+  std::vector<Segment> segments_;
+
+  // Size of every segment
+  uint32_t segmentSize_;
+
+  // Index of the segment rBase_ points into
+  size_t readSegment_;
+
+  // Index of the segment wBase_ points into
+  size_t writeSegment_;
+};
+
 }}} // apache::thrift::transport
 
 #endif // #ifndef _THRIFT_TRANSPORT_TBUFFERTRANSPORTS_H_
@@ -0,0 +1,349 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/transport/TConsistentHashPool.h>
+#include <thrift/transport/TTransportException.h>
+
+#include <cmath>
+#include <set>
+#include <sstream>
+
+namespace apache { namespace thrift { namespace transport {
+
+using namespace std;
+
+using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+
+namespace {
+
+/// FNV-1a, then mixed so that similar names land far apart on the ring
+uint64_t ringHash(const string& bytes) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    hash ^= static_cast<uint8_t>(bytes[i]);
+    hash *= 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+}
+
+const size_t TConsistentHashPool::DEFAULT_VIRTUAL_NODES;
+
+TConsistentHashPool::TConsistentHashPool(const vector< shared_ptr<TSocketPoolServer> >& servers,
+                                         size_t virtualNodes) :
+  virtualNodes_(virtualNodes > 0 ? virtualNodes : 1),
+  loadFactor_(1.25),
+  active_(0),
+  maxIdle_(8),
+  maxActive_(0),
+  maxIdleTime_(0),
+  retryInterval_(60),
+  maxConsecutiveFailures_(1),
+  connTimeout_(0),
+  sendTimeout_(0),
+  recvTimeout_(0)
+{
+  for (size_t i = 0; i < servers.size(); ++i) {
+    addServer(servers[i]);
+  }
+}
+
+TConsistentHashPool::TConsistentHashPool(const vector<pair<string, int> >& servers,
+                                         size_t virtualNodes) :
+  virtualNodes_(virtualNodes > 0 ? virtualNodes : 1),
+  loadFactor_(1.25),
+  active_(0),
+  maxIdle_(8),
+  maxActive_(0),
+  maxIdleTime_(0),
+  retryInterval_(60),
+  maxConsecutiveFailures_(1),
+  connTimeout_(0),
+  sendTimeout_(0),
+  recvTimeout_(0)
+{
+  for (size_t i = 0; i < servers.size(); ++i) {
+    addServer(servers[i].first, servers[i].second);
+  }
+}
+
+string TConsistentHashPool::shardName(const string& host, int port) {
+  ostringstream name;
+  name << host << ':' << port;
+  return name.str();
+}
+
+void TConsistentHashPool::addServer(shared_ptr<TSocketPoolServer> server) {
+  string name = shardName(server->host_, server->port_);
+
+  Guard g(mutex_);
+  if (shards_.find(name) != shards_.end()) {
+    return;
+  }
+  shared_ptr<Shard> shard(new Shard());
+  shard->server = server;
+  shard->pool.reset(new TSocketConnectionPool(vector< shared_ptr<TSocketPoolServer> >(1, server)));
+  shard->active = 0;
+  configure(*shard->pool);
+  shards_[name] = shard;
+
+  for (size_t i = 0; i < virtualNodes_; ++i) {
+    ostringstream point;
+    point << name << '-' << i;
+    ring_[ringHash(point.str())] = shard;
+  }
+}
+
+void TConsistentHashPool::addServer(const string& host, int port) {
+  addServer(shared_ptr<TSocketPoolServer>(new TSocketPoolServer(host, port)));
+}
+
+void TConsistentHashPool::removeServer(const string& host, int port) {
+  shared_ptr<Shard> shard;
+  {
+    Guard g(mutex_);
+    map<string, shared_ptr<Shard> >::iterator it = shards_.find(shardName(host, port));
+    if (it == shards_.end()) {
+      return;
+    }
+    shard = it->second;
+    shards_.erase(it);
+
+    for (Ring::iterator point = ring_.begin(); point != ring_.end();) {
+      if (point->second == shard) {
+        ring_.erase(point++);
+      } else {
+        ++point;
+      }
+    }
+  }
+  // The pool closes its idle sockets once the last one handed out is back
+}
+
+void TConsistentHashPool::setLoadFactor(double loadFactor) {
+  Guard g(mutex_);
+  loadFactor_ = loadFactor;
+}
+
+void TConsistentHashPool::configure(TSocketConnectionPool& pool) const {
+  pool.setMaxIdle(maxIdle_);
+  pool.setMaxActive(maxActive_);
+  pool.setMaxIdleTime(maxIdleTime_);
+  pool.setRetryInterval(retryInterval_);
+  pool.setMaxConsecutiveFailures(maxConsecutiveFailures_);
+  pool.setConnTimeout(connTimeout_);
+  pool.setSendTimeout(sendTimeout_);
+  pool.setRecvTimeout(recvTimeout_);
+}
+
+template <typename Setter, typename Value>
+void TConsistentHashPool::configureAll(Setter setter, Value value) {
+  for (map<string, shared_ptr<Shard> >::iterator it = shards_.begin();
+       it != shards_.end(); ++it) {
+    ((*it->second->pool).*setter)(value);
+  }
+}
+
+void TConsistentHashPool::setMaxIdle(size_t maxIdle) {
+  Guard g(mutex_);
+  maxIdle_ = maxIdle;
+  configureAll(&TSocketConnectionPool::setMaxIdle, maxIdle);
+}
+
+void TConsistentHashPool::setMaxActive(size_t maxActive) {
+  Guard g(mutex_);
+  maxActive_ = maxActive;
+  configureAll(&TSocketConnectionPool::setMaxActive, maxActive);
+}
+
+void TConsistentHashPool::setMaxIdleTime(int maxIdleTime) {
+  Guard g(mutex_);
+  maxIdleTime_ = maxIdleTime;
+  configureAll(&TSocketConnectionPool::setMaxIdleTime, maxIdleTime);
+}
+
+void TConsistentHashPool::setRetryInterval(int retryInterval) {
+  Guard g(mutex_);
+  retryInterval_ = retryInterval;
+  configureAll(&TSocketConnectionPool::setRetryInterval, retryInterval);
+}
+
+void TConsistentHashPool::setMaxConsecutiveFailures(int maxConsecutiveFailures) {
+  Guard g(mutex_);
+  maxConsecutiveFailures_ = maxConsecutiveFailures;
+  configureAll(&TSocketConnectionPool::setMaxConsecutiveFailures, maxConsecutiveFailures);
+}
+
+void TConsistentHashPool::setConnTimeout(int ms) {
+  Guard g(mutex_);
+  connTimeout_ = ms;
+  configureAll(&TSocketConnectionPool::setConnTimeout, ms);
+}
+
+void TConsistentHashPool::setSendTimeout(int ms) {
+  Guard g(mutex_);
+  sendTimeout_ = ms;
+  configureAll(&TSocketConnectionPool::setSendTimeout, ms);
+}
+
+void TConsistentHashPool::setRecvTimeout(int ms) {
+  Guard g(mutex_);
+  recvTimeout_ = ms;
+  configureAll(&TSocketConnectionPool::setRecvTimeout, ms);
+}
+
+void TConsistentHashPool::walk(const string& key, vector< shared_ptr<Shard> >& shards) const {
+  if (ring_.empty()) {
+    return;
+  }
+  set<Shard*> seen;
+  Ring::const_iterator start = ring_.lower_bound(ringHash(key));
+  Ring::const_iterator point = start;
+  do {
+    if (point == ring_.end()) {
+      point = ring_.begin();
+    }
+    if (seen.insert(point->second.get()).second) {
+      shards.push_back(point->second);
+      if (shards.size() == shards_.size()) {
+        return;
+      }
+    }
+    ++point;
+  } while (point != start);
+}
+
+shared_ptr<TSocketPoolServer> TConsistentHashPool::getServer(const string& key) const {
+  Guard g(mutex_);
+  if (ring_.empty()) {
+    return shared_ptr<TSocketPoolServer>();
+  }
+  Ring::const_iterator point = ring_.lower_bound(ringHash(key));
+  if (point == ring_.end()) {
+    point = ring_.begin();
+  }
+  return point->second->server;
+}
+
+shared_ptr<TSocket> TConsistentHashPool::acquire(const string& key) {
+  vector< shared_ptr<Shard> > shards;
+  size_t bound;
+  {
+    Guard g(mutex_);
+    walk(key, shards);
+    if (loadFactor_ > 0 && !shards.empty()) {
+      // Counting the socket about to be handed out
+      bound = static_cast<size_t>(
+        ceil(loadFactor_ * static_cast<double>(active_ + 1) / static_cast<double>(shards.size())));
+    } else {
+      bound = static_cast<size_t>(-1);
+    }
+  }
+
+  // Servers within the bound first, in ring order; then the full ones
+  vector< shared_ptr<Shard> > full;
+  for (int pass = 0; pass < 2; ++pass) {
+    vector< shared_ptr<Shard> >& candidates = pass == 0 ? shards : full;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      Shard& shard = *candidates[i];
+      {
+        // Hold the slot while connecting
+        Guard g(mutex_);
+        if (pass == 0 && shard.active >= bound) {
+          full.push_back(candidates[i]);
+          continue;
+        }
+        ++shard.active;
+        ++active_;
+      }
+
+      shared_ptr<TSocket> socket;
+      try {
+        socket = shard.pool->acquire();
+      } catch (const TTransportException&) {
+        // Down, or at maxActive
+      }
+
+      Guard g(mutex_);
+      if (socket) {
+        owners_[socket.get()] = candidates[i];
+        return socket;
+      }
+      --shard.active;
+      --active_;
+    }
+  }
+
+  throw TTransportException(TTransportException::NOT_OPEN,
+                            "TConsistentHashPool::acquire: no server for the key could be reached");
+}
+
+void TConsistentHashPool::release(shared_ptr<TSocket> socket, bool reusable) {
+  if (!socket) {
+    return;
+  }
+
+  shared_ptr<Shard> shard;
+  {
+    Guard g(mutex_);
+    map<TSocket*, shared_ptr<Shard> >::iterator it = owners_.find(socket.get());
+    if (it == owners_.end()) {
+      GlobalOutput("TConsistentHashPool::release: socket not from this pool");
+      return;
+    }
+    shard = it->second;
+    owners_.erase(it);
+    --shard->active;
+    --active_;
+  }
+  shard->pool->release(socket, reusable);
+}
+
+void TConsistentHashPool::checkHealth() {
+  vector< shared_ptr<Shard> > shards;
+  {
+    Guard g(mutex_);
+    for (map<string, shared_ptr<Shard> >::iterator it = shards_.begin();
+         it != shards_.end(); ++it) {
+      shards.push_back(it->second);
+    }
+  }
+  for (size_t i = 0; i < shards.size(); ++i) {
+    shards[i]->pool->checkHealth();
+  }
+}
+
+size_t TConsistentHashPool::getNumServers() const {
+  Guard g(mutex_);
+  return shards_.size();
+}
+
+size_t TConsistentHashPool::getNumActive() const {
+  Guard g(mutex_);
+  return active_;
+}
+
+}}} // apache::thrift::transport
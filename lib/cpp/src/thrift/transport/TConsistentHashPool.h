@@ -0,0 +1,171 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCONSISTENTHASHPOOL_H_
+#define _THRIFT_TRANSPORT_TCONSISTENTHASHPOOL_H_ 1
+
+#include <map>
+#include <string>
+#include <vector>
+#include <thrift/transport/TSocketConnectionPool.h>
+#include <thrift/concurrency/Mutex.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Client side pool of open sockets to a sharded set of servers, handing
+ * out a socket to the server that owns a key.
+ *
+ * Servers are placed on a hash ring at virtualNodes points each, and a key
+ * belongs to the first server at or after the key's own hash, so adding or
+ * removing a server only moves the keys of the ring arcs it gains or
+ * loses, about 1/N of them.
+ *
+ * With a load factor c, acquire() bounds each server to c times the mean
+ * number of sockets handed out (consistent hashing with bounded loads): a
+ * key whose owner is full goes to the next server along the ring that
+ * isn't.  Servers that are down or at maxActive are passed over the same
+ * way.  A load factor of 0 turns the bound off.
+ *
+ * Each server's sockets are kept by a TSocketConnectionPool of its own,
+ * set up with this pool's settings, and marked down by its failure
+ * counters.  All methods are thread safe.
+ */
+class TConsistentHashPool {
+ public:
+  /// Ring points per server by default
+  static const size_t DEFAULT_VIRTUAL_NODES = 160;
+
+  /**
+   * @param servers the shards.
+   * @param virtualNodes ring points per server.
+   */
+  TConsistentHashPool(const std::vector< boost::shared_ptr<TSocketPoolServer> >& servers,
+                      size_t virtualNodes = DEFAULT_VIRTUAL_NODES);
+
+  TConsistentHashPool(const std::vector<std::pair<std::string, int> >& servers,
+                      size_t virtualNodes = DEFAULT_VIRTUAL_NODES);
+
+  /**
+   * Add a server, taking over its share of the keys.  A server already
+   * in the pool is left as it is.
+   */
+  void addServer(boost::shared_ptr<TSocketPoolServer> server);
+
+  void addServer(const std::string& host, int port);
+
+  /**
+   * Remove a server, its keys going to the servers after it on the ring.
+   * Its idle sockets are closed; sockets handed out can still be released.
+   */
+  void removeServer(const std::string& host, int port);
+
+  /**
+   * Sets the bound on each server's load, as a multiple of the mean; 0
+   * for none.  Defaults to 1.25.
+   */
+  void setLoadFactor(double loadFactor);
+
+  // Settings of the servers' TSocketConnectionPools
+  void setMaxIdle(size_t maxIdle);
+  void setMaxActive(size_t maxActive);
+  void setMaxIdleTime(int maxIdleTime);
+  void setRetryInterval(int retryInterval);
+  void setMaxConsecutiveFailures(int maxConsecutiveFailures);
+  void setConnTimeout(int ms);
+  void setSendTimeout(int ms);
+  void setRecvTimeout(int ms);
+
+  /**
+   * The server owning a key, regardless of load or health; NULL if the
+   * pool is empty.
+   */
+  boost::shared_ptr<TSocketPoolServer> getServer(const std::string& key) const;
+
+  /**
+   * Get an open socket to the server owning key, or the first after it on
+   * the ring that is up and within the load bound.
+   *
+   * @throws TTransportException NOT_OPEN if no server could be reached.
+   */
+  boost::shared_ptr<TSocket> acquire(const std::string& key);
+
+  /**
+   * Give back a socket returned by acquire().
+   *
+   * @param socket the socket.
+   * @param reusable false if the connection is in an unknown state; the
+   *                 socket is closed.
+   */
+  void release(boost::shared_ptr<TSocket> socket, bool reusable = true);
+
+  /// Run TSocketConnectionPool::checkHealth() for each server
+  void checkHealth();
+
+  size_t getNumServers() const;
+
+  /// Sockets handed out, over all servers
+  size_t getNumActive() const;
+
+ private:
+  /// A server and its sockets
+  struct Shard {
+    boost::shared_ptr<TSocketPoolServer> server;
+    boost::shared_ptr<TSocketConnectionPool> pool;
+    /// Sockets handed out
+    size_t active;
+  };
+
+  typedef std::map<uint64_t, boost::shared_ptr<Shard> > Ring;
+
+  static std::string shardName(const std::string& host, int port);
+
+  /// Set a new pool up with the settings; with mutex_ held
+  void configure(TSocketConnectionPool& pool) const;
+
+  /// Apply a setting to every server's pool
+  template <typename Setter, typename Value>
+  void configureAll(Setter setter, Value value);
+
+  /// The servers after key's hash on the ring, each once; with mutex_ held
+  void walk(const std::string& key, std::vector< boost::shared_ptr<Shard> >& shards) const;
+
+  mutable concurrency::Mutex mutex_;
+  size_t virtualNodes_;
+  double loadFactor_;
+  /// Servers by "host:port"
+  std::map<std::string, boost::shared_ptr<Shard> > shards_;
+  Ring ring_;
+  /// Shards of the sockets handed out, which may have been removed since
+  std::map<TSocket*, boost::shared_ptr<Shard> > owners_;
+  size_t active_;
+
+  size_t maxIdle_;
+  size_t maxActive_;
+  int maxIdleTime_;
+  int retryInterval_;
+  int maxConsecutiveFailures_;
+  int connTimeout_;
+  int sendTimeout_;
+  int recvTimeout_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TCONSISTENTHASHPOOL_H_
@@ -0,0 +1,62 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TCOUNTINGTRANSPORT_H_
+#define _THRIFT_TRANSPORT_TCOUNTINGTRANSPORT_H_ 1
+
+#include <thrift/transport/TTransport.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * A null transport that counts the bytes written to it, and nothing else.
+ * A protocol writing to one works out how big a message is without
+ * storing it anywhere; see protocol::serializedSize().
+ */
+class TCountingTransport : public TVirtualTransport<TCountingTransport> {
+ public:
+  TCountingTransport() : count_(0) {}
+
+  bool isOpen() {
+    return true;
+  }
+
+  void open() {}
+
+  void write(const uint8_t* /* buf */, uint32_t len) {
+    count_ += len;
+  }
+
+  /// Bytes written since construction or the last resetCount()
+  uint64_t getCount() const {
+    return count_;
+  }
+
+  void resetCount() {
+    count_ = 0;
+  }
+
+ private:
+  uint64_t count_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TCOUNTINGTRANSPORT_H_
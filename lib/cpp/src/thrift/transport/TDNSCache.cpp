@@ -0,0 +1,246 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include <thrift/transport/TDNSCache.h>
+#include <thrift/transport/TTransportException.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+using namespace std;
+
+using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::ThreadFactory;
+
+/**
+ * Runs TDNSCache::refresh() until told to stop.
+ */
+class TDNSCache::Refresher : public Runnable {
+ public:
+  explicit Refresher(TDNSCache* cache) : cache_(cache) {}
+
+  void run() {
+    for (;;) {
+      {
+        Guard g(cache_->monitor_.mutex());
+        if (!cache_->refresherStop_) {
+          cache_->monitor_.waitForTimeRelative(cache_->refreshIntervalMs_);
+        }
+        if (cache_->refresherStop_) {
+          cache_->refresherRunning_ = false;
+          cache_->monitor_.notifyAll();
+          return;
+        }
+      }
+      cache_->refresh();
+    }
+  }
+
+ private:
+  TDNSCache* cache_;
+};
+
+TDNSCache::TDNSCache(int ttlSeconds) :
+  ttl_(ttlSeconds),
+  refreshIntervalMs_(0),
+  refresherRunning_(false),
+  refresherStop_(false) {
+}
+
+TDNSCache::~TDNSCache() {
+  stopRefresher();
+}
+
+void TDNSCache::setTtl(int ttlSeconds) {
+  Guard g(monitor_.mutex());
+  ttl_ = ttlSeconds;
+}
+
+string TDNSCache::makeKey(const string& host, int port) {
+  char portStr[sizeof("65535")];
+  sprintf(portStr, "%d", port);
+  return host + ":" + portStr;
+}
+
+void TDNSCache::lookup(const string& host, int port,
+                       vector<TResolvedAddress>& addresses) {
+  struct addrinfo hints, *res, *res0;
+  char portStr[sizeof("65535")];
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
+  sprintf(portStr, "%d", port);
+
+  int error = getaddrinfo(host.c_str(), portStr, &hints, &res0);
+  if (error) {
+    string errStr = "TDNSCache::lookup() getaddrinfo() " + makeKey(host, port) +
+      " " + string(THRIFT_GAI_STRERROR(error));
+    GlobalOutput(errStr.c_str());
+    throw TTransportException(TTransportException::NOT_OPEN, "Could not resolve host for client socket.");
+  }
+
+  addresses.clear();
+  for (res = res0; res; res = res->ai_next) {
+    if (res->ai_addrlen > sizeof(sockaddr_storage)) {
+      continue;
+    }
+    TResolvedAddress address;
+    address.family = res->ai_family;
+    address.socktype = res->ai_socktype;
+    address.protocol = res->ai_protocol;
+    std::memcpy(&address.addr, res->ai_addr, res->ai_addrlen);
+    address.addrlen = static_cast<socklen_t>(res->ai_addrlen);
+    addresses.push_back(address);
+  }
+  freeaddrinfo(res0);
+
+  if (addresses.empty()) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Could not resolve host for client socket.");
+  }
+}
+
+void TDNSCache::resolve(const string& host, int port,
+                        vector<TResolvedAddress>& addresses) {
+  string key = makeKey(host, port);
+  int ttl;
+
+  {
+    Guard g(monitor_.mutex());
+    map<string, Entry>::iterator it = entries_.find(key);
+    if (it != entries_.end() && it->second.expires > time(NULL)) {
+      addresses = it->second.addresses;
+      return;
+    }
+    ttl = ttl_;
+  }
+
+  // Resolve without the lock so other names aren't held up
+  lookup(host, port, addresses);
+
+  Guard g(monitor_.mutex());
+  Entry& entry = entries_[key];
+  entry.host = host;
+  entry.port = port;
+  entry.addresses = addresses;
+  entry.expires = time(NULL) + ttl;
+}
+
+void TDNSCache::invalidate(const string& host, int port) {
+  Guard g(monitor_.mutex());
+  entries_.erase(makeKey(host, port));
+}
+
+void TDNSCache::clear() {
+  Guard g(monitor_.mutex());
+  entries_.clear();
+}
+
+void TDNSCache::refresh() {
+  vector< pair<string, int> > due;
+  int ttl;
+
+  {
+    Guard g(monitor_.mutex());
+    time_t soon = time(NULL) + static_cast<time_t>(refreshIntervalMs_ / 1000) + 1;
+    for (map<string, Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->second.expires <= soon) {
+        due.push_back(make_pair(it->second.host, it->second.port));
+      }
+    }
+    ttl = ttl_;
+  }
+
+  for (size_t i = 0; i < due.size(); ++i) {
+    vector<TResolvedAddress> addresses;
+    try {
+      lookup(due[i].first, due[i].second, addresses);
+    } catch (TTransportException&) {
+      // Keep serving what we had; resolve() retries once it expires
+      continue;
+    }
+
+    Guard g(monitor_.mutex());
+    map<string, Entry>::iterator it = entries_.find(makeKey(due[i].first, due[i].second));
+    if (it != entries_.end()) {
+      it->second.addresses = addresses;
+      it->second.expires = time(NULL) + ttl;
+    }
+  }
+}
+
+void TDNSCache::startRefresher(shared_ptr<ThreadFactory> threadFactory,
+                               int64_t intervalMs) {
+  if (intervalMs <= 0) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TDNSCache: refresh interval must be positive");
+  }
+
+  Guard g(monitor_.mutex());
+  if (refresherRunning_) {
+    return;
+  }
+
+  refreshThread_ = threadFactory->newThread(shared_ptr<Runnable>(new Refresher(this)));
+  refreshIntervalMs_ = intervalMs;
+  refresherStop_ = false;
+  refresherRunning_ = true;
+  try {
+    refreshThread_->start();
+  } catch (...) {
+    refresherRunning_ = false;
+    refreshThread_.reset();
+    throw;
+  }
+}
+
+void TDNSCache::stopRefresher() {
+  shared_ptr<Thread> thread;
+
+  {
+    Guard g(monitor_.mutex());
+    if (!refresherRunning_) {
+      return;
+    }
+    refresherStop_ = true;
+    monitor_.notifyAll();
+    while (refresherRunning_) {
+      monitor_.waitForever();
+    }
+    thread.swap(refreshThread_);
+  }
+
+  if (thread) {
+    thread->join();
+  }
+}
+
+size_t TDNSCache::size() const {
+  Guard g(monitor_.mutex());
+  return entries_.size();
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,159 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TDNSCACHE_H_
+#define _THRIFT_TRANSPORT_TDNSCACHE_H_ 1
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/transport/PlatformSocket.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/Thread.h>
+
+#ifdef HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * One address a host name resolved to, ready for socket() and connect().
+ */
+struct TResolvedAddress {
+  int family;
+  int socktype;
+  int protocol;
+  sockaddr_storage addr;
+  socklen_t addrlen;
+};
+
+/**
+ * Thread safe cache of getaddrinfo() results for stream sockets, keyed by
+ * host and port.
+ *
+ * getaddrinfo() doesn't report record TTLs, so entries live for the TTL the
+ * cache was configured with.  The background refresher re-resolves entries
+ * before they expire and keeps the old addresses if the resolver fails, so
+ * a resolver hiccup doesn't stall connects.
+ *
+ * TSocket uses the cache given to setDNSCache(), or else the one given to
+ * TSocket::setDefaultDNSCache(), which covers TSocketPool, THttpClient and
+ * everything else that opens a TSocket.
+ */
+class TDNSCache {
+ public:
+  /**
+   * @param ttlSeconds how long a resolution is trusted.
+   */
+  explicit TDNSCache(int ttlSeconds = 60);
+
+  /**
+   * Stops the refresher.
+   */
+  virtual ~TDNSCache();
+
+  /**
+   * Sets how long a resolution is trusted, for entries resolved from now on.
+   */
+  void setTtl(int ttlSeconds);
+
+  /**
+   * Get the addresses of host and port, resolving them if they aren't
+   * cached or have expired.
+   *
+   * @throws TTransportException NOT_OPEN if the name doesn't resolve.
+   */
+  void resolve(const std::string& host, int port,
+               std::vector<TResolvedAddress>& addresses);
+
+  /**
+   * Forget host and port, for example because none of its addresses
+   * could be reached.
+   */
+  void invalidate(const std::string& host, int port);
+
+  /**
+   * Forget everything.
+   */
+  void clear();
+
+  /**
+   * Re-resolve every entry that expires within the next refresh interval,
+   * keeping the old addresses where resolution fails.
+   */
+  void refresh();
+
+  /**
+   * Run refresh() every intervalMs on a thread from threadFactory, until
+   * stopRefresher() is called or the cache is destroyed.
+   */
+  void startRefresher(boost::shared_ptr<concurrency::ThreadFactory> threadFactory,
+                      int64_t intervalMs);
+
+  /**
+   * Stop the refresher and wait for it to exit.
+   */
+  void stopRefresher();
+
+  /**
+   * Number of cached entries.
+   */
+  size_t size() const;
+
+  /**
+   * Call getaddrinfo() for a stream socket to host and port.
+   *
+   * @throws TTransportException NOT_OPEN if the name doesn't resolve.
+   */
+  static void lookup(const std::string& host, int port,
+                     std::vector<TResolvedAddress>& addresses);
+
+ protected:
+  struct Entry {
+    std::string host;
+    int port;
+    std::vector<TResolvedAddress> addresses;
+    time_t expires;
+  };
+
+  class Refresher;
+
+  static std::string makeKey(const std::string& host, int port);
+
+  /** Guards everything below, and is the refresher's monitor */
+  concurrency::Monitor monitor_;
+
+  std::map<std::string, Entry> entries_;
+
+  int ttl_;
+
+  boost::shared_ptr<concurrency::Thread> refreshThread_;
+  int64_t refreshIntervalMs_;
+  bool refresherRunning_;
+  bool refresherStop_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TDNSCACHE_H_
@@ -0,0 +1,114 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TDEADLINETRANSPORT_H_
+#define _THRIFT_TRANSPORT_TDEADLINETRANSPORT_H_ 1
+
+#include <thrift/TDeadline.h>
+#include <thrift/transport/TTransport.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+#include <boost/shared_ptr.hpp>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Tells a TNonblockingServer how long the client will wait for each call.
+ *
+ * Layered over a TFramedTransport, it writes a TDeadline prefix carrying
+ * the budget set with setBudget() at the start of each frame, so the
+ * server can drop calls that have waited in its queue past the budget and
+ * its handlers can see the deadline with TDeadline::remaining().  With a
+ * budget of 0 nothing is added and frames are as they would be without it.
+ *
+ * Only servers that look for the prefix understand it; don't send it to
+ * others.
+ */
+class TDeadlineTransport : public TVirtualTransport<TDeadlineTransport> {
+ public:
+  explicit TDeadlineTransport(boost::shared_ptr<TTransport> transport)
+    : transport_(transport), budgetMs_(0), frameStarted_(false) {}
+
+  /// Milliseconds each call from now on may take, or 0 for no limit
+  void setBudget(uint32_t budgetMs) {
+    budgetMs_ = budgetMs;
+  }
+
+  uint32_t getBudget() const {
+    return budgetMs_;
+  }
+
+  bool isOpen() {
+    return transport_->isOpen();
+  }
+
+  bool peek() {
+    return transport_->peek();
+  }
+
+  void open() {
+    transport_->open();
+  }
+
+  void close() {
+    transport_->close();
+  }
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    return transport_->read(buf, len);
+  }
+
+  uint32_t readEnd() {
+    return transport_->readEnd();
+  }
+
+  void write(const uint8_t* buf, uint32_t len) {
+    if (!frameStarted_) {
+      frameStarted_ = true;
+      if (budgetMs_ != 0) {
+        uint8_t prefix[TDeadline::PREFIX_SIZE];
+        TDeadline::writePrefix(prefix, budgetMs_);
+        transport_->write(prefix, TDeadline::PREFIX_SIZE);
+      }
+    }
+    transport_->write(buf, len);
+  }
+
+  uint32_t writeEnd() {
+    return transport_->writeEnd();
+  }
+
+  void flush() {
+    frameStarted_ = false;
+    transport_->flush();
+  }
+
+  boost::shared_ptr<TTransport> getUnderlyingTransport() {
+    return transport_;
+  }
+
+ private:
+  boost::shared_ptr<TTransport> transport_;
+  uint32_t budgetMs_;
+  bool frameStarted_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TDEADLINETRANSPORT_H_
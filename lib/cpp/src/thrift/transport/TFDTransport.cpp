@@ -30,6 +30,9 @@
 #ifdef _WIN32
 #include <io.h>
 #endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 
 using namespace std;
 
@@ -94,4 +97,33 @@ void TFDTransport::write(const uint8_t* buf, uint32_t len) {
   }
 }
 
+void TFDTransport::transferFrom(int fd, off_t offset, uint32_t len) {
+#ifdef HAVE_SYS_SENDFILE_H
+  while (len > 0) {
+    THRIFT_SSIZET rv = ::sendfile(fd_, fd, &offset, len);
+    if (rv < 0) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy == THRIFT_EINTR) {
+        continue;
+      }
+      if (errno_copy == EINVAL || errno_copy == ENOSYS) {
+        // One end or the other isn't something sendfile() handles.
+        break;
+      }
+      throw TTransportException(TTransportException::UNKNOWN,
+                                "TFDTransport::transferFrom()",
+                                errno_copy);
+    } else if (rv == 0) {
+      throw TTransportException(TTransportException::END_OF_FILE,
+                                "TFDTransport::transferFrom() file ended early");
+    }
+    len -= static_cast<uint32_t>(rv);
+  }
+  if (len == 0) {
+    return;
+  }
+#endif
+  TTransport::transferFrom(fd, offset, len);
+}
+
 }}} // apache::thrift::transport
@@ -62,6 +62,20 @@ class TFDTransport : public TVirtualTransport<TFDTransport> {
 
   void write(const uint8_t* buf, uint32_t len);
 
+  /**
+   * Has the kernel copy the bytes with sendfile() where it can.
+   */
+  void transferFrom(int fd, off_t offset, uint32_t len);
+
+  /**
+   * Writes len bytes of this file, from offset on, to out with
+   * out.transferFrom(), so a socket can send them straight from the page
+   * cache.  This transport's file position is left alone.
+   */
+  void transferTo(TTransport& out, off_t offset, uint32_t len) {
+    out.transferFrom(fd_, offset, len);
+  }
+
   void setFD(int fd) { fd_ = fd; }
   int getFD() { return fd_; }
 
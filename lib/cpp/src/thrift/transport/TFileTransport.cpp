@@ -22,7 +22,10 @@
 #include <thrift/transport/TFileTransport.h>
 #include <thrift/transport/TTransportUtils.h>
 #include <thrift/transport/PlatformSocket.h>
+#include <thrift/concurrency/Atomic.h>
 #include <thrift/concurrency/FunctionRunner.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/Util.h>
 
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
@@ -36,16 +39,29 @@
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
 #endif
+#include <algorithm>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <iostream>
 #include <limits>
+#include <vector>
 #ifdef HAVE_SYS_STAT_H
 #include <sys/stat.h>
 #endif
+#ifdef HAVE_SYS_POLL_H
+#include <sys/poll.h>
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 #ifdef _WIN32
 #include <io.h>
+#else
+#include <limits.h>
+#include <sys/uio.h>
 #endif
 
 namespace apache { namespace thrift { namespace transport {
@@ -56,6 +72,410 @@ using namespace std;
 using namespace apache::thrift::protocol;
 using namespace apache::thrift::concurrency;
 
+#ifndef _WIN32
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/**
+ * Write out every iovec in batch, resuming after short writes.  The batch
+ * is cleared either way.  Returns false on an IO error.
+ */
+static bool writeBatch(int fd, std::vector<struct iovec>& batch) {
+  size_t next = 0;
+  while (next < batch.size()) {
+    int count = static_cast<int>((std::min)(batch.size() - next, size_t(IOV_MAX)));
+    ssize_t written = ::writev(fd, &batch[next], count);
+    if (written == -1) {
+      if (THRIFT_GET_SOCKET_ERROR == THRIFT_EINTR) {
+        continue;
+      }
+      batch.clear();
+      return false;
+    }
+
+    // skip the iovecs that made it out completely, trim a partial one
+    while (next < batch.size() && written >= static_cast<ssize_t>(batch[next].iov_len)) {
+      written -= batch[next].iov_len;
+      ++next;
+    }
+    if (written > 0) {
+      batch[next].iov_base = static_cast<uint8_t*>(batch[next].iov_base) + written;
+      batch[next].iov_len -= written;
+    }
+  }
+  batch.clear();
+  return true;
+}
+#endif
+
+// A compressed block record holds the codec id, the number of events and
+// their uncompressed size ahead of the compressed events
+static const uint32_t BLOCK_INFO_SIZE = 1 + 4 + 4;
+
+/**
+ * Uncompresses the blocks a TFileTransport reads, and hands out their
+ * events.  The block after the current one can be handed to prefetch(),
+ * which unpacks it on a helper thread while the reader works through the
+ * current one.
+ */
+class TFileBlockReader {
+ public:
+  typedef std::map<uint8_t, shared_ptr<TTransportFactory> > CodecMap;
+
+  TFileBlockReader(const CodecMap& codecs)
+    : codecs_(codecs)
+    , pos_(0)
+    , numEvents_(0)
+    , pendingMaxSize_(0)
+    , aheadEvents_(0)
+    , busy_(false)
+    , ready_(false)
+    , stop_(false) {
+    threadFactory_.setDetached(false);
+  }
+
+  ~TFileBlockReader() {
+    if (thread_) {
+      {
+        Synchronized s(monitor_);
+        stop_ = true;
+        monitor_.notifyAll();
+      }
+      thread_->join();
+    }
+  }
+
+  // Next event of the current block, or NULL once it is used up
+  eventInfo* nextEvent() {
+    if (numEvents_ == 0) {
+      return NULL;
+    }
+    uint32_t eventSize;
+    memcpy(&eventSize, &current_[pos_], 4);
+    eventInfo* event = new eventInfo();
+    event->eventBuff_ = new uint8_t[eventSize];
+    memcpy(event->eventBuff_, &current_[pos_ + 4], eventSize);
+    event->eventSize_ = eventSize;
+    pos_ += 4 + eventSize;
+    numEvents_--;
+    return event;
+  }
+
+  void skipEvents(uint32_t count) {
+    while (count-- > 0 && numEvents_ > 0) {
+      uint32_t eventSize;
+      memcpy(&eventSize, &current_[pos_], 4);
+      pos_ += 4 + eventSize;
+      numEvents_--;
+    }
+  }
+
+  // Make frame the current block
+  void load(const eventInfo* frame, uint32_t maxSize) {
+    wait();
+    numEvents_ = 0;
+    pos_ = 0;
+    unpack(codecs_, frame, maxSize, current_, numEvents_);
+  }
+
+  // Start unpacking frame as the block after the current one
+  void prefetch(eventInfo* frame, uint32_t maxSize) {
+    Synchronized s(monitor_);
+    if (!thread_) {
+      thread_ = threadFactory_.newThread(FunctionRunner::create(startThread, this));
+      thread_->start();
+    }
+    pending_.reset(frame);
+    pendingMaxSize_ = maxSize;
+    busy_ = true;
+    monitor_.notifyAll();
+  }
+
+  // Make the prefetched block the current one, if there is one
+  bool takePrefetched() {
+    Synchronized s(monitor_);
+    while (busy_) {
+      monitor_.wait();
+    }
+    if (!ready_) {
+      return false;
+    }
+    ready_ = false;
+    if (!error_.empty()) {
+      std::string error;
+      error.swap(error_);
+      throw TTransportException(TTransportException::CORRUPTED_DATA, error);
+    }
+    current_.swap(ahead_);
+    numEvents_ = aheadEvents_;
+    pos_ = 0;
+    return true;
+  }
+
+  // Drop the current block and the prefetched one
+  void reset() {
+    wait();
+    Synchronized s(monitor_);
+    ready_ = false;
+    error_.clear();
+    numEvents_ = 0;
+    pos_ = 0;
+  }
+
+  static uint32_t getEventCount(const eventInfo* frame) {
+    uint32_t numEvents = 0;
+    if (frame->eventSize_ >= BLOCK_INFO_SIZE) {
+      memcpy(&numEvents, frame->eventBuff_ + 1, 4);
+    }
+    return numEvents;
+  }
+
+ private:
+  static void* startThread(void* ptr) {
+    static_cast<TFileBlockReader*>(ptr)->run();
+    return NULL;
+  }
+
+  void run() {
+    while (true) {
+      boost::scoped_ptr<eventInfo> frame;
+      uint32_t maxSize;
+      {
+        Synchronized s(monitor_);
+        while (!busy_ && !stop_) {
+          monitor_.wait();
+        }
+        if (stop_) {
+          return;
+        }
+        frame.swap(pending_);
+        maxSize = pendingMaxSize_;
+      }
+
+      // the reader waits for busy_ to clear before it touches ahead_
+      std::string error;
+      try {
+        unpack(codecs_, frame.get(), maxSize, ahead_, aheadEvents_);
+      } catch (std::exception& e) {
+        error = e.what();
+      }
+
+      Synchronized s(monitor_);
+      error_ = error;
+      busy_ = false;
+      ready_ = true;
+      monitor_.notifyAll();
+    }
+  }
+
+  void wait() {
+    Synchronized s(monitor_);
+    while (busy_) {
+      monitor_.wait();
+    }
+  }
+
+  static void unpack(const CodecMap& codecs,
+                     const eventInfo* frame,
+                     uint32_t maxSize,
+                     std::vector<uint8_t>& events,
+                     uint32_t& numEvents) {
+    if (frame->eventSize_ < BLOCK_INFO_SIZE) {
+      throw TTransportException(TTransportException::CORRUPTED_DATA,
+                                "TFileTransport: truncated compressed block");
+    }
+    uint8_t codec = frame->eventBuff_[0];
+    uint32_t count;
+    uint32_t rawSize;
+    memcpy(&count, frame->eventBuff_ + 1, 4);
+    memcpy(&rawSize, frame->eventBuff_ + 5, 4);
+    CodecMap::const_iterator it = codecs.find(codec);
+    if (it == codecs.end() || !it->second) {
+      throw TTransportException(TTransportException::CORRUPTED_DATA,
+                                "TFileTransport: block compressed with an unknown codec");
+    }
+    if (rawSize > maxSize) {
+      throw TTransportException(TTransportException::CORRUPTED_DATA,
+                                "TFileTransport: compressed block larger than the block size");
+    }
+
+    shared_ptr<TMemoryBuffer> in(new TMemoryBuffer(frame->eventBuff_ + BLOCK_INFO_SIZE,
+                                                   frame->eventSize_ - BLOCK_INFO_SIZE));
+    shared_ptr<TTransport> decoder = it->second->getTransport(in);
+    events.resize(rawSize);
+    uint32_t got = 0;
+    while (got < rawSize) {
+      uint32_t n = decoder->read(&events[got], rawSize - got);
+      if (n == 0) {
+        throw TTransportException(TTransportException::CORRUPTED_DATA,
+                                  "TFileTransport: compressed block shorter than its size");
+      }
+      got += n;
+    }
+
+    // check the events fill the block exactly, so handing them out can't overrun
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t eventSize;
+      if (rawSize - pos < 4) {
+        pos = rawSize + 1;
+        break;
+      }
+      memcpy(&eventSize, &events[pos], 4);
+      if (eventSize == 0 || eventSize > rawSize - pos - 4) {
+        pos = rawSize + 1;
+        break;
+      }
+      pos += 4 + eventSize;
+    }
+    if (pos != rawSize) {
+      throw TTransportException(TTransportException::CORRUPTED_DATA,
+                                "TFileTransport: corrupted events in compressed block");
+    }
+    numEvents = count;
+  }
+
+  const CodecMap codecs_;
+
+  std::vector<uint8_t> current_;
+  uint32_t pos_;
+  uint32_t numEvents_;
+
+  // the block being unpacked ahead, guarded by monitor_
+  Monitor monitor_;
+  boost::scoped_ptr<eventInfo> pending_;
+  uint32_t pendingMaxSize_;
+  std::vector<uint8_t> ahead_;
+  uint32_t aheadEvents_;
+  bool busy_;
+  bool ready_;
+  bool stop_;
+  std::string error_;
+
+  PlatformThreadFactory threadFactory_;
+  shared_ptr<Thread> thread_;
+};
+
+/**
+ * Reads the log ahead of a TFileTransport reader on a helper thread, into a
+ * second buffer that is swapped for the reader's once it has parsed its own,
+ * so the reader does not wait on the disk while there is more to read.  The
+ * helper reads at the file offset, so the reader calls cancel() before it
+ * moves that.
+ */
+class TFileReadAhead {
+ public:
+  TFileReadAhead(uint32_t size)
+    : buff_(new uint8_t[size])
+    , size_(size)
+    , fd_(-1)
+    , offset_(0)
+    , len_(0)
+    , busy_(false)
+    , ready_(false)
+    , stop_(false) {
+    threadFactory_.setDetached(false);
+  }
+
+  ~TFileReadAhead() {
+    if (thread_) {
+      {
+        Synchronized s(monitor_);
+        stop_ = true;
+        monitor_.notifyAll();
+      }
+      thread_->join();
+    }
+    delete[] buff_;
+  }
+
+  // Start reading the buffer at offset, where fd is positioned
+  void start(int fd, off_t offset) {
+    Synchronized s(monitor_);
+    if (!thread_) {
+      thread_ = threadFactory_.newThread(FunctionRunner::create(startThread, this));
+      thread_->start();
+    }
+    fd_ = fd;
+    offset_ = offset;
+    ready_ = false;
+    busy_ = true;
+    monitor_.notifyAll();
+  }
+
+  // Swap buff, of the size this was made with, for the buffer read at
+  // offset.  False if it wasn't read ahead or the read failed.
+  bool take(off_t offset, uint8_t*& buff, uint32_t& len) {
+    Synchronized s(monitor_);
+    while (busy_) {
+      monitor_.wait();
+    }
+    if (!ready_ || offset_ != offset) {
+      ready_ = false;
+      return false;
+    }
+    ready_ = false;
+    std::swap(buff, buff_);
+    len = len_;
+    return true;
+  }
+
+  // Wait for a read in progress, and drop what it read
+  void cancel() {
+    Synchronized s(monitor_);
+    while (busy_) {
+      monitor_.wait();
+    }
+    ready_ = false;
+  }
+
+ private:
+  static void* startThread(void* ptr) {
+    static_cast<TFileReadAhead*>(ptr)->run();
+    return NULL;
+  }
+
+  void run() {
+    while (true) {
+      int fd;
+      {
+        Synchronized s(monitor_);
+        while (!busy_ && !stop_) {
+          monitor_.wait();
+        }
+        if (stop_) {
+          return;
+        }
+        fd = fd_;
+      }
+
+      // buff_ is the helper's until busy_ clears
+      int32_t got = static_cast<int32_t>(::read(fd, buff_, size_));
+
+      Synchronized s(monitor_);
+      len_ = got > 0 ? static_cast<uint32_t>(got) : 0;
+      ready_ = got >= 0;
+      busy_ = false;
+      monitor_.notifyAll();
+    }
+  }
+
+  uint8_t* buff_;
+  const uint32_t size_;
+
+  Monitor monitor_;
+  int fd_;
+  off_t offset_;
+  uint32_t len_;
+  bool busy_;
+  bool ready_;
+  bool stop_;
+
+  PlatformThreadFactory threadFactory_;
+  shared_ptr<Thread> thread_;
+};
+
 TFileTransport::TFileTransport(string path, bool readOnly)
   : readState_()
   , readBuff_(NULL)
@@ -69,10 +489,22 @@ TFileTransport::TFileTransport(string path, bool readOnly)
   , maxEventSize_(DEFAULT_MAX_EVENT_SIZE)
   , maxCorruptedEvents_(DEFAULT_MAX_CORRUPTED_EVENTS)
   , eofSleepTime_(DEFAULT_EOF_SLEEP_TIME_US)
+  , readAhead_(false)
+  , inotifyFd_(-1)
+  , syncPolicy_(SYNC_FSYNC)
+  , groupCommit_(false)
+  , preallocateChunks_(false)
+  , indexInterval_(0)
+  , numEventsWritten_(0)
+  , writeBlockCodec_(0)
+  , blockSize_(DEFAULT_BLOCK_SIZE)
+  , blockNumEvents_(0)
+  , blockFrameEvents_(0)
   , corruptedEventSleepTime_(DEFAULT_CORRUPTED_SLEEP_TIME_US)
   , writerThreadIOErrorSleepTime_(DEFAULT_WRITER_THREAD_SLEEP_TIME_US)
   , dequeueBuffer_(NULL)
   , enqueueBuffer_(NULL)
+  , flushTarget_(0)
   , notFull_(&mutex_)
   , notEmpty_(&mutex_)
   , closing_(false)
@@ -142,6 +574,9 @@ TFileTransport::~TFileTransport() {
     enqueueBuffer_ = NULL;
   }
 
+  // stop reading ahead before the file is closed under it
+  fileReadAhead_.reset();
+
   if (readBuff_) {
     delete[] readBuff_;
     readBuff_ = NULL;
@@ -152,6 +587,13 @@ TFileTransport::~TFileTransport() {
     currentEvent_ = NULL;
   }
 
+#ifdef HAVE_SYS_INOTIFY_H
+  if (inotifyFd_ >= 0) {
+    ::close(inotifyFd_);
+    inotifyFd_ = -1;
+  }
+#endif
+
   // close logfile
   if (fd_ > 0) {
     if(-1 == ::THRIFT_CLOSESOCKET(fd_)) {
@@ -207,6 +649,15 @@ void TFileTransport::enqueueEvent(const uint8_t* buf, uint32_t eventLen) {
     return;
   }
 
+  // the ring copies the event itself; only waking the writer takes the lock
+  if (enqueueRing_) {
+    if (enqueueRing_->addEvent(buf, eventLen)) {
+      Guard g(mutex_);
+      notEmpty_.notify();
+    }
+    return;
+  }
+
   eventInfo* toEnqueue = new eventInfo();
   toEnqueue->eventBuff_ = (uint8_t *)std::malloc((sizeof(uint8_t) * eventLen) + 4);
   if (toEnqueue->eventBuff_ == NULL) {
@@ -260,9 +711,10 @@ bool TFileTransport::swapEventBuffers(struct timeval* deadline) {
 
   if (!enqueueBuffer_->isEmpty()) {
     swap = true;
-  } else if (closing_) {
+  } else if (closing_ || (forceFlush_ && blockNumEvents_ > 0)) {
     // even though there is no data to write,
-    // return immediately if the transport is closing
+    // return immediately if the transport is closing, or a flush is
+    // waiting for the block being gathered
     swap = false;
   } else {
     if (deadline != NULL) {
@@ -292,6 +744,45 @@ bool TFileTransport::swapEventBuffers(struct timeval* deadline) {
 }
 
 
+bool TFileTransport::waitForRingEvents(struct timeval* deadline) {
+  if (!enqueueRing_->isEmpty()) {
+    return true;
+  }
+
+  Guard g(mutex_);
+  if (closing_ || forceFlush_) {
+    return !enqueueRing_->isEmpty();
+  }
+
+  // Producers only take mutex_ to notify us once they see this flag, so it
+  // must be raised before the last look at the ring.
+  enqueueRing_->setConsumerWaiting(true);
+  if (enqueueRing_->isEmpty()) {
+    if (deadline != NULL) {
+      notEmpty_.waitForTime(deadline);
+    } else {
+      notEmpty_.wait();
+    }
+  }
+  enqueueRing_->setConsumerWaiting(false);
+
+  return !enqueueRing_->isEmpty();
+}
+
+void TFileTransport::enableLockFreeEnqueue() {
+  if (readOnly_) {
+    throw TTransportException("TFileTransport: attempting to write to file opened readonly");
+  }
+
+  Guard g(mutex_);
+  if (bufferAndThreadInitialized_) {
+    GlobalOutput("Cannot enable lock-free enqueue after writer thread started");
+    return;
+  }
+  enqueueRing_.reset(new TFileTransportRing(eventBufferSize_));
+  initBufferAndWriteThread();
+}
+
 void TFileTransport::writerThread() {
   bool hasIOError = false;
 
@@ -319,6 +810,8 @@ void TFileTransport::writerThread() {
       _chsize_s(fd_, offset_);
 #endif
       readState_.resetAllValues();
+      openIndex();
+      preallocateChunk();
     } catch (...) {
       int errno_copy = THRIFT_GET_SOCKET_ERROR;
       GlobalOutput.perror("TFileTransport: writerThread() initialization ", errno_copy);
@@ -331,6 +824,11 @@ void TFileTransport::writerThread() {
   getNextFlushTime(&ts_next_flush);
   uint32_t unflushed = 0;
 
+#ifndef _WIN32
+  // events queued up for a single writev() when group commit is on
+  std::vector<struct iovec> batch;
+#endif
+
   while (1) {
     // this will only be true when the destructor is being invoked
     if (closing_) {
@@ -339,10 +837,9 @@ void TFileTransport::writerThread() {
       }
 
       // Try to empty buffers before exit
-      if (enqueueBuffer_->isEmpty() && dequeueBuffer_->isEmpty()) {
-#ifndef _WIN32
-        fsync(fd_);
-#endif
+      if (enqueueBuffer_->isEmpty() && dequeueBuffer_->isEmpty() && blockNumEvents_ == 0 &&
+          (!enqueueRing_ || enqueueRing_->isDrained(enqueueRing_->getEnqueued()))) {
+        syncLogFile();
         if (-1 == ::THRIFT_CLOSESOCKET(fd_)) {
           int errno_copy = THRIFT_GET_SOCKET_ERROR;
           GlobalOutput.perror("TFileTransport: writerThread() ::close() ", errno_copy);
@@ -354,9 +851,25 @@ void TFileTransport::writerThread() {
       }
     }
 
-    if (swapEventBuffers(&ts_next_flush)) {
-      eventInfo* outEvent;
-      while (NULL != (outEvent = dequeueBuffer_->getNext())) {
+    bool haveEvents = enqueueRing_ ? waitForRingEvents(&ts_next_flush)
+                                   : swapEventBuffers(&ts_next_flush);
+
+    // a partly filled block goes out whenever the log would be flushed
+    bool sealDue = blockNumEvents_ > 0 && (closing_ || forceFlush_ || isPast(&ts_next_flush));
+
+    if (haveEvents || sealDue) {
+      while (1) {
+        eventInfo* outEvent = enqueueRing_ ? enqueueRing_->getNext() : dequeueBuffer_->getNext();
+        if (outEvent == NULL) {
+          if (!sealDue || blockNumEvents_ == 0) {
+            break;
+          }
+          outEvent = sealBlock();
+          if (outEvent == NULL) {
+            continue;
+          }
+        }
+
         // Remove an event from the buffer and write it out to disk. If there is any IO error, for instance,
         // the output file is unmounted or deleted, then this event is dropped. However, the writer thread
         // will: (1) sleep for a short while; (2) try to reopen the file; (3) if successful then start writing
@@ -375,6 +888,7 @@ void TFileTransport::writerThread() {
           try {
             openLogFile();
             seekToEnd();
+            openIndex();
             unflushed = 0;
             hasIOError = false;
             T_LOG_OPER("TFileTransport: log file %s reopened by writer thread during error recovery", filename_.c_str());
@@ -384,11 +898,20 @@ void TFileTransport::writerThread() {
         }
 
         // sanity check on event
-        if ((maxEventSize_ > 0) && (outEvent->eventSize_ > maxEventSize_)) {
+        if ((maxEventSize_ > 0) && (outEvent->eventSize_ > maxEventSize_) &&
+            outEvent != &blockFrame_) {
           T_ERROR("msg size is greater than max event size: %u > %u\n", outEvent->eventSize_, maxEventSize_);
           continue;
         }
 
+        // with compression, events only go out as part of a block
+        if (writeBlockCodec_ != 0 && outEvent != &blockFrame_) {
+          outEvent = addToBlock(outEvent);
+          if (outEvent == NULL) {
+            continue;
+          }
+        }
+
         // If chunking is required, then make sure that msg does not cross chunk boundary
         if ((outEvent->eventSize_ > 0) && (chunkSize_ != 0)) {
           // event size must be less than chunk size
@@ -402,6 +925,15 @@ void TFileTransport::writerThread() {
 
           // if adding this event will cross a chunk boundary, pad the chunk with zeros
           if (chunk1 != chunk2) {
+#ifndef _WIN32
+            // the batch has to hit the file before the offset can be refetched
+            if (!batch.empty() && !writeBatch(fd_, batch)) {
+              int errno_copy = THRIFT_GET_SOCKET_ERROR;
+              GlobalOutput.perror("TFileTransport: error while writing events ", errno_copy);
+              hasIOError = true;
+              continue;
+            }
+#endif
             // refetch the offset to keep in sync
             offset_ = lseek(fd_, 0, SEEK_CUR);
             int32_t padding = (int32_t)((offset_ / chunkSize_ + 1) * chunkSize_ - offset_);
@@ -417,9 +949,28 @@ void TFileTransport::writerThread() {
             }
             unflushed += padding;
             offset_ += padding;
+            preallocateChunk();
           }
         }
 
+        if (outEvent->eventSize_ > 0) {
+          indexEvents(outEvent == &blockFrame_ ? blockFrameEvents_ : 1);
+        }
+
+#ifndef _WIN32
+        // the event stays alive in dequeueBuffer_ until the batch is written;
+        // a block is large enough to go out on its own
+        if (groupCommit_ && outEvent->eventSize_ > 0 && outEvent != &blockFrame_) {
+          struct iovec iov;
+          iov.iov_base = outEvent->eventBuff_;
+          iov.iov_len = outEvent->eventSize_;
+          batch.push_back(iov);
+          unflushed += outEvent->eventSize_;
+          offset_ += outEvent->eventSize_;
+          continue;
+        }
+#endif
+
         // write the dequeued event to the file
         if (outEvent->eventSize_ > 0) {
           if (-1 == ::write(fd_, outEvent->eventBuff_, outEvent->eventSize_)) {
@@ -432,7 +983,18 @@ void TFileTransport::writerThread() {
           offset_ += outEvent->eventSize_;
         }
       }
-      dequeueBuffer_->reset();
+#ifndef _WIN32
+      if (!batch.empty() && !writeBatch(fd_, batch)) {
+        int errno_copy = THRIFT_GET_SOCKET_ERROR;
+        GlobalOutput.perror("TFileTransport: error while writing events ", errno_copy);
+        hasIOError = true;
+      }
+#endif
+      if (enqueueRing_) {
+        enqueueRing_->reset();
+      } else {
+        dequeueBuffer_->reset();
+      }
     }
 
     if (hasIOError) {
@@ -449,7 +1011,9 @@ void TFileTransport::writerThread() {
 	{
     Guard g(mutex_);
     if (forceFlush_) {
-      if (!enqueueBuffer_->isEmpty()) {
+      if (blockNumEvents_ > 0 ||
+          (enqueueRing_ ? !enqueueRing_->isDrained(flushTarget_)
+                        : !enqueueBuffer_->isEmpty())) {
         // If forceFlush_ is true, we need to flush all available data.
         // If enqueueBuffer_ is not empty, go back to the start of the loop to
         // write it out.
@@ -459,6 +1023,11 @@ void TFileTransport::writerThread() {
         // forceFlush_.  Therefore the next time around the loop enqueueBuffer_
         // is guaranteed to be empty.  (I.e., we're guaranteed to make progress
         // and clear forceFlush_ the next time around the loop.)
+        //
+        // The ring keeps accepting events during a flush, so there we only
+        // wait for the events that were enqueued when flush() was called.
+        //
+        // Events gathered into a block go out the next time around too.
         continue;
       }
       forced_flush = true;
@@ -470,11 +1039,7 @@ void TFileTransport::writerThread() {
     if (forced_flush || unflushed > flushMaxBytes_) {
       flush = true;
     } else {
-      struct timeval current_time;
-      THRIFT_GETTIMEOFDAY(&current_time, NULL);
-      if (current_time.tv_sec > ts_next_flush.tv_sec ||
-          (current_time.tv_sec == ts_next_flush.tv_sec &&
-           current_time.tv_usec > ts_next_flush.tv_usec)) {
+      if (isPast(&ts_next_flush)) {
         if (unflushed > 0) {
           flush = true;
         } else {
@@ -487,9 +1052,7 @@ void TFileTransport::writerThread() {
 
     if (flush) {
       // sync (force flush) file to disk
-#ifndef _WIN32
-      fsync(fd_);
-#endif
+      syncLogFile();
       unflushed = 0;
       getNextFlushTime(&ts_next_flush);
 
@@ -514,6 +1077,9 @@ void TFileTransport::flush() {
   Guard g(mutex_);
 
   // Indicate that we are requesting a flush
+  if (enqueueRing_) {
+    flushTarget_ = enqueueRing_->getEnqueued();
+  }
   forceFlush_ = true;
   // Wake up the writer thread so it will perform the flush immediately
   notEmpty_.notify();
@@ -587,8 +1153,48 @@ uint32_t TFileTransport::read(uint8_t* buf, uint32_t len) {
   return len;
 }
 
+bool TFileTransport::readFullEvent(std::string* event) {
+  if (!currentEvent_) {
+    currentEvent_ = readEvent();
+  }
+  if (!currentEvent_) {
+    return false;
+  }
+
+  event->assign(reinterpret_cast<const char*>(currentEvent_->eventBuff_ + currentEvent_->eventBuffPos_),
+                currentEvent_->eventSize_ - currentEvent_->eventBuffPos_);
+  delete(currentEvent_);
+  currentEvent_ = NULL;
+  return true;
+}
+
 // note caller is responsible for freeing returned events
 eventInfo* TFileTransport::readEvent() {
+  while (1) {
+    // events of the current block first, then of the one unpacked ahead
+    if (blockReader_) {
+      eventInfo* event = blockReader_->nextEvent();
+      if (event) {
+        return event;
+      }
+      if (blockReader_->takePrefetched()) {
+        prefetchBlock();
+        continue;
+      }
+    }
+
+    eventInfo* frame = readFrame();
+    if (frame == NULL || !frame->eventBlock_) {
+      return frame;
+    }
+    scoped_ptr<eventInfo> block(frame);
+    loadBlock(block.get());
+    prefetchBlock();
+  }
+}
+
+// Reads the next record, an event or a compressed block of them
+eventInfo* TFileTransport::readFrame() {
   int readTries = 0;
 
   if (!readBuff_) {
@@ -600,7 +1206,7 @@ eventInfo* TFileTransport::readEvent() {
     if (readState_.bufferPtr_ == readState_.bufferLen_) {
       // advance the offset pointer
       offset_ += readState_.bufferLen_;
-      readState_.bufferLen_ = static_cast<uint32_t>(::read(fd_, readBuff_, readBuffSize_));
+      readState_.bufferLen_ = readFile();
       //       if (readState_.bufferLen_) {
       //         T_DEBUG_L(1, "Amount read: %u (offset: %lu)", readState_.bufferLen_, offset_);
       //       }
@@ -615,7 +1221,7 @@ eventInfo* TFileTransport::readEvent() {
       } else if (readState_.bufferLen_ == 0) {  // EOF
         // wait indefinitely if there is no timeout
         if (readTimeout_ == TAIL_READ_TIMEOUT) {
-          THRIFT_SLEEP_USEC(eofSleepTime_);
+          waitForData(eofSleepTime_);
           continue;
         } else if (readTimeout_ == NO_TAIL_READ_TIMEOUT) {
           // reset state
@@ -627,7 +1233,7 @@ eventInfo* TFileTransport::readEvent() {
             readState_.resetState(0);
             return NULL;
           } else {
-            THRIFT_SLEEP_USEC(readTimeout_ * 1000);
+            waitForData(readTimeout_ * 1000);
             readTries++;
             continue;
           }
@@ -666,7 +1272,9 @@ eventInfo* TFileTransport::readEvent() {
             delete(readState_.event_);
           }
           readState_.event_ = new eventInfo();
-          readState_.event_->eventSize_ = readState_.getEventSize();
+          readState_.event_->eventSize_ = readState_.getEventSize() & ~COMPRESSED_BLOCK_FLAG;
+          readState_.event_->eventBlock_ =
+            (readState_.getEventSize() & COMPRESSED_BLOCK_FLAG) != 0;
 
           // check if the event is corrupted and perform recovery if required
           if (isEventCorrupted()) {
@@ -713,7 +1321,8 @@ eventInfo* TFileTransport::readEvent() {
 
 bool TFileTransport::isEventCorrupted() {
   // an error is triggered if:
-  if ( (maxEventSize_ > 0) &&  (readState_.event_->eventSize_ > maxEventSize_)) {
+  if ( (maxEventSize_ > 0) &&  (readState_.event_->eventSize_ > maxEventSize_) &&
+       !readState_.event_->eventBlock_) {
     // 1. Event size is larger than user-speficied max-event size
     T_ERROR("Read corrupt event. Event size(%u) greater than max event size (%u)",
             readState_.event_->eventSize_, maxEventSize_);
@@ -795,6 +1404,9 @@ void TFileTransport::seekToChunk(int32_t chunk) {
     chunk += numChunks;
   }
 
+  // the read ahead moves the file offset too
+  cancelReadAhead();
+
   // too large a value for reverse seek, just seek to beginning
   if (chunk < 0) {
     T_DEBUG("%s", "Incorrect value for reverse seek. Seeking to beginning...");
@@ -815,6 +1427,7 @@ void TFileTransport::seekToChunk(int32_t chunk) {
   off_t newOffset = off_t(chunk) * chunkSize_;
   offset_ = lseek(fd_, newOffset, SEEK_SET);
   readState_.resetAllValues();
+  resetBlocks();
   currentEvent_ = NULL;
   if (offset_ == -1) {
     GlobalOutput("TFileTransport: lseek error in seekToChunk");
@@ -828,7 +1441,7 @@ void TFileTransport::seekToChunk(int32_t chunk) {
     // keep on reading unti the last event at point of seekChunk call
     boost::scoped_ptr<eventInfo> event;
     while ((offset_ + readState_.bufferPtr_) < minEndOffset) {
-      event.reset(readEvent());
+      event.reset(readFrame());
       if (event.get() == NULL) {
         break;
       }
@@ -842,6 +1455,78 @@ void TFileTransport::seekToEnd() {
   seekToChunk(getNumChunks());
 }
 
+void TFileTransport::seekToEvent(uint64_t eventNumber) {
+  if (fd_ <= 0) {
+    throw TTransportException("File not open");
+  }
+
+  // start from the closest indexed event, or the top if there is none
+  TFileTransportIndex index(TFileTransportIndex::pathFor(filename_));
+  index.load();
+  TFileTransportIndex::Entry entry;
+  uint64_t curEvent = 0;
+  off_t newOffset = 0;
+  if (index.findEvent(eventNumber, &entry)) {
+    curEvent = entry.eventNumber;
+    newOffset = static_cast<off_t>(entry.offset);
+  }
+  seekToOffset(newOffset);
+
+  // skip the few events up to the requested one, whole blocks at a time
+  int32_t oldReadTimeout = getReadTimeout();
+  setReadTimeout(NO_TAIL_READ_TIMEOUT);
+  boost::scoped_ptr<eventInfo> event;
+  while (curEvent < eventNumber) {
+    event.reset(readFrame());
+    if (event.get() == NULL) {
+      break;
+    }
+    if (!event->eventBlock_) {
+      curEvent++;
+      continue;
+    }
+    uint32_t numEvents = getBlockEventCount(event.get());
+    if (curEvent + numEvents <= eventNumber) {
+      curEvent += numEvents;
+      continue;
+    }
+    loadBlock(event.get());
+    blockReader_->skipEvents(static_cast<uint32_t>(eventNumber - curEvent));
+    break;
+  }
+  setReadTimeout(oldReadTimeout);
+}
+
+void TFileTransport::seekToTime(int64_t timestampUs) {
+  if (fd_ <= 0) {
+    throw TTransportException("File not open");
+  }
+
+  TFileTransportIndex index(TFileTransportIndex::pathFor(filename_));
+  index.load();
+  TFileTransportIndex::Entry entry;
+  if (index.findTime(timestampUs, &entry)) {
+    seekToOffset(static_cast<off_t>(entry.offset));
+  } else {
+    seekToOffset(0);
+  }
+}
+
+void TFileTransport::seekToOffset(off_t newOffset) {
+  cancelReadAhead();
+  offset_ = lseek(fd_, newOffset, SEEK_SET);
+  readState_.resetAllValues();
+  resetBlocks();
+  if (currentEvent_) {
+    delete currentEvent_;
+    currentEvent_ = NULL;
+  }
+  if (offset_ == -1) {
+    GlobalOutput("TFileTransport: lseek error in seekToOffset");
+    throw TTransportException("TFileTransport: lseek error in seekToOffset");
+  }
+}
+
 uint32_t TFileTransport::getNumChunks() {
   if (fd_ <= 0) {
     return 0;
@@ -872,18 +1557,327 @@ uint32_t TFileTransport::getCurChunk() {
   return static_cast<uint32_t>(offset_/chunkSize_);
 }
 
-// Utility Functions
-void TFileTransport::openLogFile() {
-#ifndef _WIN32
-  mode_t mode = readOnly_ ? S_IRUSR | S_IRGRP | S_IROTH : S_IRUSR | S_IWUSR| S_IRGRP | S_IROTH;
-  int flags = readOnly_ ? O_RDONLY : O_RDWR | O_CREAT | O_APPEND;
-  fd_ = ::open(filename_.c_str(), flags, mode);
-#else
-  int mode = readOnly_ ? _S_IREAD : _S_IREAD | _S_IWRITE;
-  int flags = readOnly_ ? _O_RDONLY : _O_RDWR | _O_CREAT | _O_APPEND;
-  fd_ = ::_open(filename_.c_str(), flags, mode);
-#endif
-  offset_ = 0;
+void TFileTransport::openIndex() {
+  if (indexInterval_ == 0) {
+    return;
+  }
+
+  off_t endOffset = lseek(fd_, 0, SEEK_END);
+  if (endOffset == -1) {
+    throw TTransportException("TFileTransport: lseek error in openIndex");
+  }
+
+  TFileTransportIndex::Entry last;
+  last.eventNumber = 0;
+  last.offset = 0;
+  try {
+    index_.reset(new TFileTransportIndex(TFileTransportIndex::pathFor(filename_)));
+    index_->load();
+
+    // forget entries for events that did not make it into the log
+    const std::vector<TFileTransportIndex::Entry>& entries = index_->getEntries();
+    size_t keep = entries.size();
+    while (keep > 0 && entries[keep - 1].offset >= static_cast<uint64_t>(endOffset)) {
+      keep--;
+    }
+    if (keep < entries.size()) {
+      index_->truncate(keep);
+    }
+    if (keep > 0) {
+      last = entries[keep - 1];
+    }
+  } catch (TException& te) {
+    // the log is still usable without its index
+    GlobalOutput.printf("TFileTransport: disabling index for %s: %s",
+                        filename_.c_str(), te.what());
+    index_.reset();
+  }
+
+  // count the events after the last entry to continue the numbering
+  numEventsWritten_ = last.eventNumber;
+  seekToOffset(static_cast<off_t>(last.offset));
+  int32_t oldReadTimeout = getReadTimeout();
+  setReadTimeout(NO_TAIL_READ_TIMEOUT);
+  boost::scoped_ptr<eventInfo> event;
+  while ((offset_ + readState_.bufferPtr_) < endOffset) {
+    event.reset(readFrame());
+    if (event.get() == NULL) {
+      break;
+    }
+    numEventsWritten_ += event->eventBlock_ ? getBlockEventCount(event.get()) : 1;
+  }
+  setReadTimeout(oldReadTimeout);
+  seekToOffset(endOffset);
+}
+
+// A block gets an entry if any of its events would have had one
+void TFileTransport::indexEvents(uint32_t count) {
+  if (index_ && (numEventsWritten_ + indexInterval_ - 1) / indexInterval_ * indexInterval_ <
+                  numEventsWritten_ + count) {
+    struct timeval now;
+    THRIFT_GETTIMEOFDAY(&now, NULL);
+
+    TFileTransportIndex::Entry entry;
+    entry.eventNumber = numEventsWritten_;
+    entry.offset = offset_;
+    entry.timestampUs = static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_usec;
+    try {
+      index_->append(entry);
+    } catch (TException& te) {
+      GlobalOutput.printf("TFileTransport: disabling index for %s: %s",
+                          filename_.c_str(), te.what());
+      index_.reset();
+    }
+  }
+  numEventsWritten_ += count;
+}
+
+void TFileTransport::setWriteBlockCodec(uint8_t id) {
+  if (id != 0) {
+    CodecMap::const_iterator it = blockCodecs_.find(id);
+    if (it == blockCodecs_.end() || !it->second) {
+      throw TTransportException(TTransportException::BAD_ARGS,
+                                "TFileTransport: unknown block codec");
+    }
+  }
+  writeBlockCodec_ = id;
+}
+
+/**
+ * Gather event into the block being filled.  Returns the block to write
+ * if one was sealed: the previous one if event doesn't fit in it, or the
+ * one event filled.
+ */
+eventInfo* TFileTransport::addToBlock(eventInfo* event) {
+  if (event->eventSize_ == 0) {
+    return NULL;
+  }
+  if (event->eventSize_ > chunkSize_) {
+    T_ERROR("TFileTransport: event size(%u) > chunk size(%u): skipping event", event->eventSize_, chunkSize_);
+    return NULL;
+  }
+
+  eventInfo* sealed = NULL;
+  if (blockNumEvents_ > 0 && blockEvents_.size() + event->eventSize_ > blockSize_) {
+    sealed = sealBlock();
+  }
+  blockEvents_.append(reinterpret_cast<const char*>(event->eventBuff_), event->eventSize_);
+  blockNumEvents_++;
+  if (sealed == NULL && blockEvents_.size() >= blockSize_) {
+    sealed = sealBlock();
+  }
+  return sealed;
+}
+
+/**
+ * Compress the gathered events into blockFrame_, ready to be written like
+ * an event.  Returns NULL, dropping the events, if the codec fails.
+ */
+eventInfo* TFileTransport::sealBlock() {
+  uint32_t numEvents = blockNumEvents_;
+  uint32_t rawSize = static_cast<uint32_t>(blockEvents_.size());
+  blockNumEvents_ = 0;
+
+  try {
+    shared_ptr<TMemoryBuffer> out(new TMemoryBuffer(rawSize / 2 + 4 + BLOCK_INFO_SIZE));
+    uint8_t header[4 + BLOCK_INFO_SIZE];
+    header[4] = writeBlockCodec_;
+    memcpy(header + 5, &numEvents, 4);
+    memcpy(header + 9, &rawSize, 4);
+    out->write(header, sizeof(header));
+
+    shared_ptr<TTransport> encoder = blockCodecs_[writeBlockCodec_]->getTransport(out);
+    encoder->write(reinterpret_cast<const uint8_t*>(blockEvents_.data()), rawSize);
+    encoder->flush();
+
+    uint8_t* buf;
+    uint32_t len;
+    out->getBuffer(&buf, &len);
+    uint32_t frameSize = (len - 4) | COMPRESSED_BLOCK_FLAG;
+    memcpy(buf, &frameSize, 4);
+
+    delete[] blockFrame_.eventBuff_;
+    blockFrame_.eventBuff_ = NULL;
+    blockFrame_.eventSize_ = 0;
+    blockFrame_.eventBuff_ = new uint8_t[len];
+    memcpy(blockFrame_.eventBuff_, buf, len);
+    blockFrame_.eventSize_ = len;
+  } catch (std::exception& e) {
+    GlobalOutput.printf("TFileTransport: dropping a block of %u events: %s", numEvents, e.what());
+    blockEvents_.clear();
+    return NULL;
+  }
+
+  blockEvents_.clear();
+  blockFrameEvents_ = numEvents;
+  return &blockFrame_;
+}
+
+/**
+ * Fills readBuff_ with what follows offset_ in the file, from the read
+ * ahead if there is one, and starts reading the buffer after it.
+ */
+int32_t TFileTransport::readFile() {
+  uint32_t len;
+  if (!fileReadAhead_ || !fileReadAhead_->take(offset_, readBuff_, len)) {
+    int32_t got = static_cast<int32_t>(::read(fd_, readBuff_, readBuffSize_));
+    if (got <= 0) {
+      return got;
+    }
+    len = static_cast<uint32_t>(got);
+  }
+
+  // a short read is the end of the file, where reading ahead finds nothing
+  if (readAhead_ && len == readBuffSize_) {
+    if (!fileReadAhead_) {
+      fileReadAhead_.reset(new TFileReadAhead(readBuffSize_));
+    }
+    fileReadAhead_->start(fd_, offset_ + len);
+  }
+  return static_cast<int32_t>(len);
+}
+
+void TFileTransport::cancelReadAhead() {
+  if (fileReadAhead_) {
+    fileReadAhead_->cancel();
+  }
+}
+
+/**
+ * Waits at most timeoutUs for the file to be written to.  With inotify this
+ * returns as soon as it is, otherwise it just sleeps.
+ */
+void TFileTransport::waitForData(uint32_t timeoutUs) {
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_SYS_POLL_H)
+  if (inotifyFd_ == -1) {
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd_ >= 0 && inotify_add_watch(inotifyFd_, filename_.c_str(), IN_MODIFY) < 0) {
+      ::close(inotifyFd_);
+      inotifyFd_ = -1;
+    }
+    if (inotifyFd_ < 0) {
+      // don't try again on every wait
+      GlobalOutput.perror("TFileTransport: inotify unavailable, polling ", errno);
+      inotifyFd_ = -2;
+    }
+  }
+  if (inotifyFd_ >= 0) {
+    struct pollfd fds[1];
+    fds[0].fd = inotifyFd_;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    int timeoutMs = static_cast<int>((timeoutUs + 999) / 1000);
+    if (poll(fds, 1, timeoutMs) > 0) {
+      // writes since the last wait are covered by the read that follows
+      char events[4096];
+      while (::read(inotifyFd_, events, sizeof(events)) > 0) {
+      }
+    }
+    return;
+  }
+#endif
+  THRIFT_SLEEP_USEC(timeoutUs);
+}
+
+void TFileTransport::loadBlock(const eventInfo* frame) {
+  if (!blockReader_) {
+    blockReader_.reset(new TFileBlockReader(blockCodecs_));
+  }
+  blockReader_->load(frame, getMaxBlockSize());
+}
+
+/**
+ * Hand the next record to the block reader to unpack ahead, if it is a
+ * block that is already in the read buffer whole.  Reading ahead of that
+ * would have to wait on the file, which tailing readers must not do here.
+ */
+void TFileTransport::prefetchBlock() {
+  if (isBlockBuffered()) {
+    blockReader_->prefetch(readFrame(), getMaxBlockSize());
+  }
+}
+
+bool TFileTransport::isBlockBuffered() {
+  if (!readState_.readingSize_ || readState_.eventSizeBuffPos_ != 0) {
+    return false;
+  }
+  int32_t available = readState_.bufferLen_ - readState_.bufferPtr_;
+  off_t pos = offset_ + readState_.bufferPtr_;
+  if (available < 4 || pos / chunkSize_ != (pos + 3) / chunkSize_) {
+    return false;
+  }
+
+  // only a well formed block, so that readFrame() neither reads the file
+  // nor starts a recovery
+  uint32_t size;
+  memcpy(&size, readBuff_ + readState_.bufferPtr_, 4);
+  if ((size & COMPRESSED_BLOCK_FLAG) == 0) {
+    return false;
+  }
+  size &= ~COMPRESSED_BLOCK_FLAG;
+  return size > 0 && size <= chunkSize_ && size <= static_cast<uint32_t>(available - 4) &&
+         pos / chunkSize_ == (pos + 4 + size - 1) / chunkSize_;
+}
+
+void TFileTransport::resetBlocks() {
+  if (blockReader_) {
+    blockReader_->reset();
+  }
+}
+
+uint32_t TFileTransport::getBlockEventCount(const eventInfo* frame) {
+  return TFileBlockReader::getEventCount(frame);
+}
+
+void TFileTransport::syncLogFile() {
+#ifndef _WIN32
+  switch (syncPolicy_) {
+    case SYNC_NONE:
+      break;
+    case SYNC_FDATASYNC:
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+      fdatasync(fd_);
+      break;
+#else
+      // no fdatasync() on this platform, fall back to fsync()
+#endif
+    case SYNC_FSYNC:
+    default:
+      fsync(fd_);
+      break;
+  }
+#endif
+}
+
+void TFileTransport::preallocateChunk() {
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+  if (!preallocateChunks_ || chunkSize_ == 0) {
+    return;
+  }
+
+  // reserve the rest of the current chunk without moving EOF, so readers
+  // and O_APPEND writes are unaffected.  Failure only costs the optimization.
+  off_t chunkEnd = (offset_ / chunkSize_ + 1) * chunkSize_;
+  if (-1 == fallocate(fd_, FALLOC_FL_KEEP_SIZE, offset_, chunkEnd - offset_)) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    GlobalOutput.perror("TFileTransport: preallocateChunk() fallocate ", errno_copy);
+    preallocateChunks_ = false;
+  }
+#endif
+}
+
+// Utility Functions
+void TFileTransport::openLogFile() {
+#ifndef _WIN32
+  mode_t mode = readOnly_ ? S_IRUSR | S_IRGRP | S_IROTH : S_IRUSR | S_IWUSR| S_IRGRP | S_IROTH;
+  int flags = readOnly_ ? O_RDONLY : O_RDWR | O_CREAT | O_APPEND;
+  fd_ = ::open(filename_.c_str(), flags, mode);
+#else
+  int mode = readOnly_ ? _S_IREAD : _S_IREAD | _S_IWRITE;
+  int flags = readOnly_ ? _O_RDONLY : _O_RDWR | _O_CREAT | _O_APPEND;
+  fd_ = ::_open(filename_.c_str(), flags, mode);
+#endif
+  offset_ = 0;
 
   // make sure open call was successful
   if(fd_ == -1) {
@@ -894,8 +1888,22 @@ void TFileTransport::openLogFile() {
 
 }
 
+void TFileTransport::monotonicTimeval(struct timeval* now) {
+  int64_t usec = concurrency::Util::monotonicTimeUsec();
+  now->tv_sec = static_cast<long>(usec / 1000000);
+  now->tv_usec = static_cast<long>(usec % 1000000);
+}
+
+bool TFileTransport::isPast(const struct timeval* deadline) {
+  struct timeval now;
+  monotonicTimeval(&now);
+  return now.tv_sec > deadline->tv_sec ||
+         (now.tv_sec == deadline->tv_sec && now.tv_usec > deadline->tv_usec);
+}
+
 void TFileTransport::getNextFlushTime(struct timeval* ts_next_flush) {
-  THRIFT_GETTIMEOFDAY(ts_next_flush, NULL);
+  // On the monotonic clock, as Monitor::waitForTime() takes
+  monotonicTimeval(ts_next_flush);
 
   ts_next_flush->tv_usec += flushMaxUs_;
   if (ts_next_flush->tv_usec > 1000000) {
@@ -970,6 +1978,241 @@ bool TFileTransportBuffer::isEmpty() {
   return writePoint_ == 0;
 }
 
+TFileTransportRing::TFileTransportRing(uint32_t size)
+  : size_(1)
+  , enqueuePos_(0)
+  , releasePos_(0)
+  , consumerWaiting_(0)
+  , readPos_(0)
+{
+  // a power of two lets positions map to slots with a mask
+  while (size_ < size) {
+    size_ <<= 1;
+  }
+  slots_ = new Slot[size_];
+  for (uint64_t i = 0; i < size_; i++) {
+    slots_[i].seq_ = i;
+    slots_[i].capacity_ = 0;
+  }
+}
+
+TFileTransportRing::~TFileTransportRing() {
+  delete[] slots_;
+}
+
+bool TFileTransportRing::addEvent(const uint8_t* buf, uint32_t eventLen) {
+  uint64_t pos = atomicAdd(&enqueuePos_, 1) - 1;
+  Slot& slot = slots_[pos & (size_ - 1)];
+
+  // wait for the writer to hand the slot back if the ring is full
+  for (uint32_t spins = 0; atomicLoad<ATOMIC_ACQUIRE>(&slot.seq_) != pos; spins++) {
+    if (spins > 100) {
+      THRIFT_SLEEP_USEC(10);
+    }
+  }
+
+  eventInfo& event = slot.event_;
+  if (slot.capacity_ < eventLen + 4) {
+    delete[] event.eventBuff_;
+    event.eventBuff_ = NULL;
+    event.eventSize_ = 0;
+    slot.capacity_ = 0;
+    try {
+      event.eventBuff_ = new uint8_t[eventLen + 4];
+    } catch (...) {
+      // publish an empty event so the writer does not stall on this slot
+      atomicStore<ATOMIC_RELEASE>(&slot.seq_, pos + 1);
+      throw;
+    }
+    slot.capacity_ = eventLen + 4;
+  }
+
+  // first 4 bytes is the event length
+  memcpy(event.eventBuff_, (void*)(&eventLen), 4);
+  // actual event contents
+  memcpy(event.eventBuff_ + 4, buf, eventLen);
+  event.eventSize_ = eventLen + 4;
+  event.eventBuffPos_ = 0;
+  atomicStore<ATOMIC_RELEASE>(&slot.seq_, pos + 1);
+
+  // pairs with the fence in setConsumerWaiting()
+  atomicFence();
+  return atomicLoad<ATOMIC_ACQUIRE>(&consumerWaiting_) != 0;
+}
+
+eventInfo* TFileTransportRing::getNext() {
+  Slot& slot = slots_[readPos_ & (size_ - 1)];
+  if (atomicLoad<ATOMIC_ACQUIRE>(&slot.seq_) != readPos_ + 1) {
+    // no more published entries
+    return NULL;
+  }
+  readPos_++;
+  return &slot.event_;
+}
+
+void TFileTransportRing::reset() {
+  for (uint64_t pos = releasePos_; pos < readPos_; pos++) {
+    Slot& slot = slots_[pos & (size_ - 1)];
+    if (slot.capacity_ > MAX_RETAINED_EVENT_SIZE) {
+      delete[] slot.event_.eventBuff_;
+      slot.event_.eventBuff_ = NULL;
+      slot.capacity_ = 0;
+    }
+    slot.event_.eventSize_ = 0;
+    atomicStore<ATOMIC_RELEASE>(&slot.seq_, pos + size_);
+  }
+  atomicStore<ATOMIC_RELEASE>(&releasePos_, readPos_);
+}
+
+bool TFileTransportRing::isEmpty() {
+  return atomicLoad<ATOMIC_ACQUIRE>(&slots_[readPos_ & (size_ - 1)].seq_) != readPos_ + 1;
+}
+
+void TFileTransportRing::setConsumerWaiting(bool waiting) {
+  atomicStore<ATOMIC_RELEASE>(&consumerWaiting_, waiting ? 1 : 0);
+  atomicFence();
+}
+
+uint64_t TFileTransportRing::getEnqueued() {
+  return atomicLoad<ATOMIC_ACQUIRE>(&enqueuePos_);
+}
+
+bool TFileTransportRing::isDrained(uint64_t enqueued) {
+  return atomicLoad<ATOMIC_ACQUIRE>(&releasePos_) >= enqueued;
+}
+
+TFileTransportIndex::TFileTransportIndex(const string& path)
+  : path_(path)
+  , fd_(-1)
+  , writable_(false)
+{}
+
+TFileTransportIndex::~TFileTransportIndex() {
+  if (fd_ >= 0) {
+    ::THRIFT_CLOSESOCKET(fd_);
+    fd_ = -1;
+  }
+}
+
+void TFileTransportIndex::openIndexFile(bool write) {
+  if (fd_ >= 0 && (writable_ || !write)) {
+    return;
+  }
+  if (fd_ >= 0) {
+    ::THRIFT_CLOSESOCKET(fd_);
+    fd_ = -1;
+  }
+
+#ifndef _WIN32
+  mode_t mode = write ? S_IRUSR | S_IWUSR| S_IRGRP | S_IROTH : S_IRUSR | S_IRGRP | S_IROTH;
+  int flags = write ? O_RDWR | O_CREAT | O_APPEND : O_RDONLY;
+  fd_ = ::open(path_.c_str(), flags, mode);
+#else
+  int mode = write ? _S_IREAD | _S_IWRITE : _S_IREAD;
+  int flags = write ? _O_RDWR | _O_CREAT | _O_APPEND | _O_BINARY : _O_RDONLY | _O_BINARY;
+  fd_ = ::_open(path_.c_str(), flags, mode);
+#endif
+  writable_ = write;
+
+  if (fd_ == -1) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    // a log without an index is fine to read
+    if (!write && errno_copy == ENOENT) {
+      return;
+    }
+    GlobalOutput.perror("TFileTransportIndex: ::open() file: " + path_, errno_copy);
+    throw TTransportException(TTransportException::NOT_OPEN, path_, errno_copy);
+  }
+}
+
+void TFileTransportIndex::load() {
+  openIndexFile(writable_);
+  if (fd_ < 0) {
+    return;
+  }
+
+  off_t offset = static_cast<off_t>(entries_.size() * sizeof(Entry));
+  if (lseek(fd_, offset, SEEK_SET) == -1) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "TFileTransportIndex::load() (lseek)",
+                              errno_copy);
+  }
+
+  // only take whole entries; the writer may be halfway through the next one
+  Entry buf[1024];
+  while (true) {
+    int got = static_cast<int>(::read(fd_, buf, sizeof(buf)));
+    if (got == -1) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      throw TTransportException(TTransportException::UNKNOWN,
+                                "TFileTransportIndex::load() (read)",
+                                errno_copy);
+    }
+    entries_.insert(entries_.end(), buf, buf + got / sizeof(Entry));
+    if (got < static_cast<int>(sizeof(buf))) {
+      break;
+    }
+  }
+}
+
+static bool entryBeforeEvent(uint64_t eventNumber, const TFileTransportIndex::Entry& entry) {
+  return eventNumber < entry.eventNumber;
+}
+
+static bool entryBeforeTime(int64_t timestampUs, const TFileTransportIndex::Entry& entry) {
+  return timestampUs < entry.timestampUs;
+}
+
+bool TFileTransportIndex::findEvent(uint64_t eventNumber, Entry* entry) const {
+  vector<Entry>::const_iterator it =
+    upper_bound(entries_.begin(), entries_.end(), eventNumber, entryBeforeEvent);
+  if (it == entries_.begin()) {
+    return false;
+  }
+  *entry = *(--it);
+  return true;
+}
+
+bool TFileTransportIndex::findTime(int64_t timestampUs, Entry* entry) const {
+  vector<Entry>::const_iterator it =
+    upper_bound(entries_.begin(), entries_.end(), timestampUs, entryBeforeTime);
+  if (it == entries_.begin()) {
+    return false;
+  }
+  *entry = *(--it);
+  return true;
+}
+
+void TFileTransportIndex::append(const Entry& entry) {
+  openIndexFile(true);
+  if (-1 == ::write(fd_, &entry, sizeof(entry))) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    GlobalOutput.perror("TFileTransportIndex: error while writing entry ", errno_copy);
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "TFileTransportIndex::append() (write)",
+                              errno_copy);
+  }
+  entries_.push_back(entry);
+}
+
+void TFileTransportIndex::truncate(size_t numEntries) {
+  openIndexFile(true);
+  off_t length = static_cast<off_t>(numEntries * sizeof(Entry));
+#ifndef _WIN32
+  int rv = ftruncate(fd_, length);
+#else
+  int rv = _chsize_s(fd_, length);
+#endif
+  if (rv != 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "TFileTransportIndex::truncate()",
+                              errno_copy);
+  }
+  entries_.resize(numEntries);
+}
+
 TFileProcessor::TFileProcessor(shared_ptr<TProcessor> processor,
                                shared_ptr<TProtocolFactory> protocolFactory,
                                shared_ptr<TFileReaderTransport> inputTransport):
@@ -1043,6 +2286,204 @@ void TFileProcessor::process(uint32_t numEvents, bool tail) {
 
 }
 
+void TFileProcessor::processChunks(uint32_t firstChunk, uint32_t numChunks) {
+  shared_ptr<TProtocol> inputProtocol = inputProtocolFactory_->getProtocol(inputTransport_);
+  shared_ptr<TProtocol> outputProtocol = outputProtocolFactory_->getProtocol(outputTransport_);
+
+  // Readers report the chunk of the next event once it has been peeked at.
+  // (TFileTransport reports the chunk of its read buffer, which is the same
+  // as long as the chunk size is a multiple of the read buffer size.)
+  inputTransport_->seekToChunk(static_cast<int32_t>(firstChunk));
+  uint64_t endChunk = static_cast<uint64_t>(firstChunk) + numChunks;
+
+  while(1) {
+    // bad form to use exceptions for flow control but there is really
+    // no other way around it
+    try {
+      if (!inputTransport_->peek() || inputTransport_->getCurChunk() >= endChunk) {
+        break;
+      }
+      processor_->process(inputProtocol, outputProtocol, NULL);
+    } catch (TEOFException&) {
+      break;
+    } catch (TException &te) {
+      cerr << te.what() << endl;
+      break;
+    }
+  }
+}
+
+namespace {
+
+/**
+ * State shared between TFileProcessor::processParallel() and its lanes.
+ */
+struct ParallelReplay {
+  shared_ptr<TProcessor> processor;
+  shared_ptr<TProtocolFactory> inputProtocolFactory;
+  shared_ptr<TProtocolFactory> outputProtocolFactory;
+  shared_ptr<TTransport> outputTransport;
+
+  // guards everything below, and the queues of all lanes
+  Monitor monitor;
+  // events handed to lanes and not processed yet
+  uint32_t pending;
+  bool failed;
+  std::string error;
+
+  ParallelReplay() : pending(0), failed(false) {}
+};
+
+/**
+ * A queue of events for processParallel() that is drained by at most one
+ * ThreadManager task at a time, which keeps the events in order.
+ */
+class ReplayLane : public Runnable {
+ public:
+  ReplayLane(shared_ptr<ParallelReplay> replay)
+    : replay_(replay)
+    , scheduled_(false) {}
+
+  // Queue an event, which is swapped out of event.  Returns true if the
+  // caller has to schedule the lane.  Must hold replay_->monitor.
+  bool add(std::string& event) {
+    queue_.push_back(std::string());
+    queue_.back().swap(event);
+    replay_->pending++;
+    if (scheduled_) {
+      return false;
+    }
+    scheduled_ = true;
+    return true;
+  }
+
+  void run() {
+    shared_ptr<TProtocol> outputProtocol =
+      replay_->outputProtocolFactory->getProtocol(replay_->outputTransport);
+
+    while (true) {
+      std::deque<std::string> events;
+      {
+        Synchronized s(replay_->monitor);
+        if (queue_.empty() || replay_->failed) {
+          replay_->pending -= static_cast<uint32_t>(queue_.size());
+          queue_.clear();
+          scheduled_ = false;
+          replay_->monitor.notifyAll();
+          return;
+        }
+        events.swap(queue_);
+      }
+
+      std::string error;
+      for (std::deque<std::string>::iterator it = events.begin();
+           it != events.end() && error.empty(); ++it) {
+        shared_ptr<TMemoryBuffer> event(new TMemoryBuffer(
+          reinterpret_cast<uint8_t*>(const_cast<char*>(it->data())),
+          static_cast<uint32_t>(it->size())));
+        try {
+          replay_->processor->process(
+            replay_->inputProtocolFactory->getProtocol(event), outputProtocol, NULL);
+        } catch (TException& te) {
+          error = te.what();
+        }
+      }
+
+      Synchronized s(replay_->monitor);
+      replay_->pending -= static_cast<uint32_t>(events.size());
+      if (!error.empty() && !replay_->failed) {
+        replay_->failed = true;
+        replay_->error = error;
+      }
+      replay_->monitor.notifyAll();
+    }
+  }
+
+ private:
+  shared_ptr<ParallelReplay> replay_;
+  std::deque<std::string> queue_;
+  bool scheduled_;
+};
+
+// bound on the events read ahead of the lanes, per lane
+const uint32_t MAX_PENDING_EVENTS_PER_LANE = 1024;
+
+}
+
+void TFileProcessor::processParallel(shared_ptr<ThreadManager> threadManager,
+                                     uint32_t numLanes,
+                                     EventKeyFunction keyFunction) {
+  if (numLanes == 0) {
+    numLanes = (std::max)(static_cast<uint32_t>(threadManager->workerCount()), 1u);
+  }
+
+  shared_ptr<ParallelReplay> replay(new ParallelReplay());
+  replay->processor = processor_;
+  replay->inputProtocolFactory = inputProtocolFactory_;
+  replay->outputProtocolFactory = outputProtocolFactory_;
+  replay->outputTransport = outputTransport_;
+
+  std::vector<shared_ptr<ReplayLane> > lanes;
+  for (uint32_t i = 0; i < numLanes; i++) {
+    lanes.push_back(shared_ptr<ReplayLane>(new ReplayLane(replay)));
+  }
+  uint32_t maxPending = MAX_PENDING_EVENTS_PER_LANE * numLanes;
+
+  std::string event;
+  uint64_t numRead = 0;
+  while (1) {
+    try {
+      if (!inputTransport_->readFullEvent(&event)) {
+        break;
+      }
+    } catch (TEOFException&) {
+      break;
+    } catch (TException &te) {
+      cerr << te.what() << endl;
+      break;
+    }
+
+    uint64_t lane;
+    if (keyFunction) {
+      lane = keyFunction(reinterpret_cast<const uint8_t*>(event.data()),
+                         static_cast<uint32_t>(event.size())) % numLanes;
+    } else {
+      lane = numRead % numLanes;
+    }
+    numRead++;
+
+    bool schedule;
+    {
+      Synchronized s(replay->monitor);
+      while (replay->pending >= maxPending && !replay->failed) {
+        replay->monitor.wait();
+      }
+      if (replay->failed) {
+        break;
+      }
+      schedule = lanes[lane]->add(event);
+    }
+
+    if (schedule) {
+      try {
+        threadManager->add(lanes[lane]);
+      } catch (TException&) {
+        // no room on the ThreadManager, drain the lane on this thread
+        lanes[lane]->run();
+      }
+    }
+  }
+
+  // wait for the lanes to finish
+  Synchronized s(replay->monitor);
+  while (replay->pending > 0) {
+    replay->monitor.wait();
+  }
+  if (replay->failed) {
+    cerr << replay->error << endl;
+  }
+}
+
 void TFileProcessor::processChunk() {
   shared_ptr<TProtocol> inputProtocol = inputProtocolFactory_->getProtocol(inputTransport_);
   shared_ptr<TProtocol> outputProtocol = outputProtocolFactory_->getProtocol(outputTransport_);
@@ -24,7 +24,10 @@
 #include <thrift/Thrift.h>
 #include <thrift/TProcessor.h>
 
+#include <algorithm>
+#include <map>
 #include <string>
+#include <vector>
 #include <stdio.h>
 
 #include <boost/scoped_ptr.hpp>
@@ -34,6 +37,11 @@
 #include <thrift/concurrency/Monitor.h>
 #include <thrift/concurrency/PlatformThreadFactory.h>
 #include <thrift/concurrency/Thread.h>
+#include <thrift/cxxfunctional.h>
+
+namespace apache { namespace thrift { namespace concurrency {
+class ThreadManager;
+}}} // apache::thrift::concurrency
 
 namespace apache { namespace thrift { namespace transport {
 
@@ -47,8 +55,10 @@ typedef struct eventInfo {
   uint8_t* eventBuff_;
   uint32_t eventSize_;
   uint32_t eventBuffPos_;
+  // a compressed block of events rather than an event, as read from a file
+  bool eventBlock_;
 
-  eventInfo():eventBuff_(NULL), eventSize_(0), eventBuffPos_(0){};
+  eventInfo():eventBuff_(NULL), eventSize_(0), eventBuffPos_(0), eventBlock_(false){};
   ~eventInfo() {
     if (eventBuff_) {
       delete[] eventBuff_;
@@ -146,6 +156,117 @@ class TFileTransportBuffer {
     eventInfo** buffer_;
 };
 
+/**
+ * TFileTransportRing - bounded multi-producer, single-consumer queue used by
+ * TFileTransport in place of the two swapped TFileTransportBuffers once
+ * lock-free enqueueing is enabled.
+ *
+ * A producer claims a slot with a single atomic increment and copies its
+ * event into the slot's own buffer, which is kept around for the next lap,
+ * so enqueueing neither locks nor allocates in the common case.  The writer
+ * sees events in claim order through getNext(), and hands the slots back to
+ * producers with reset(), just like TFileTransportBuffer.
+ */
+class TFileTransportRing {
+  public:
+    TFileTransportRing(uint32_t size);
+    ~TFileTransportRing();
+
+    // Producer side; blocks while the ring is full.  Returns true if the
+    // consumer is waiting for events and has to be woken up.
+    bool addEvent(const uint8_t* buf, uint32_t eventLen);
+
+    // Consumer side
+    eventInfo* getNext();
+    void reset();
+    bool isEmpty();
+    void setConsumerWaiting(bool waiting);
+
+    // Number of events claimed so far, and whether the consumer has reset()
+    // past a given count of them
+    uint64_t getEnqueued();
+    bool isDrained(uint64_t enqueued);
+
+  private:
+    TFileTransportRing(); // should not be used
+
+    struct Slot {
+      // pos + 1 once the event for pos is published, pos + size_ once the
+      // slot is free for the producer of that position
+      volatile uint64_t seq_;
+      uint32_t capacity_;
+      eventInfo event_;
+    };
+
+    Slot* slots_;
+    uint64_t size_;
+
+    // keep the producer and consumer counters on separate cache lines
+    char pad0_[64];
+    volatile uint64_t enqueuePos_;
+    char pad1_[64];
+    volatile uint64_t releasePos_;
+    volatile uint64_t consumerWaiting_;
+    uint64_t readPos_;
+
+    // slot buffers grown past this are released instead of kept
+    static const uint32_t MAX_RETAINED_EVENT_SIZE = 64 * 1024;
+};
+
+/**
+ * TFileTransportIndex - sidecar index of a TFileTransport log, kept in a
+ * separate file next to it (see TFileTransport::setIndexInterval()).
+ *
+ * Every K-th event gets a fixed-size entry recording its number within the
+ * log, the file offset of its size field, and when the writer thread wrote
+ * it.  Entries are appended in order, so both event numbers and timestamps
+ * can be binary searched.
+ */
+class TFileTransportIndex {
+  public:
+    struct Entry {
+      uint64_t eventNumber;
+      uint64_t offset;
+      // microseconds since the epoch
+      int64_t timestampUs;
+    };
+
+    TFileTransportIndex(const std::string& path);
+    ~TFileTransportIndex();
+
+    // Read entries appended since the last call; safe while being written
+    void load();
+
+    // Last entry at or before the given event number / time
+    bool findEvent(uint64_t eventNumber, Entry* entry) const;
+    bool findTime(int64_t timestampUs, Entry* entry) const;
+
+    const std::vector<Entry>& getEntries() const {
+      return entries_;
+    }
+
+    // Writer side
+    void append(const Entry& entry);
+    void truncate(size_t numEntries);
+
+    static std::string pathFor(const std::string& logPath) {
+      return logPath + ".idx";
+    }
+
+  private:
+    TFileTransportIndex(); // should not be used
+
+    void openIndexFile(bool write);
+
+    std::string path_;
+    int fd_;
+    bool writable_;
+    std::vector<Entry> entries_;
+};
+
+class TFileBlockReader;
+class TFileReadAhead;
+
 /**
  * Abstract interface for transports used to read files
  */
@@ -158,6 +279,32 @@ class TFileReaderTransport : virtual public TTransport {
   virtual uint32_t getCurChunk() = 0;
   virtual void seekToChunk(int32_t chunk) = 0;
   virtual void seekToEnd() = 0;
+
+  /**
+   * Seek to an event number, or to the last indexed event written at or
+   * before a time, using the TFileTransportIndex next to the log.  Readers
+   * that don't support the index throw.
+   */
+  virtual void seekToEvent(uint64_t eventNumber) {
+    (void) eventNumber;
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "Seeking by event is not supported");
+  }
+  virtual void seekToTime(int64_t timestampUs) {
+    (void) timestampUs;
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "Seeking by time is not supported");
+  }
+
+  /**
+   * Read what is left of the current event, or all of the next one, into
+   * event.  Returns false if no event turned up within the read timeout.
+   */
+  virtual bool readFullEvent(std::string* event) {
+    (void) event;
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "Reading whole events is not supported");
+  }
 };
 
 /**
@@ -198,6 +345,9 @@ class TFileTransport : public TFileReaderTransport,
   void seekToEnd();
   uint32_t getNumChunks();
   uint32_t getCurChunk();
+  void seekToEvent(uint64_t eventNumber);
+  void seekToTime(int64_t timestampUs);
+  bool readFullEvent(std::string* event);
 
   // for changing the output file
   void resetOutputFile(int fd, std::string filename, off_t offset);
@@ -242,6 +392,15 @@ class TFileTransport : public TFileReaderTransport,
     return eventBufferSize_;
   }
 
+  /**
+   * Queue events through a lock-free TFileTransportRing of
+   * getEventBufferSize() slots instead of the mutex-protected buffers, so
+   * that concurrent writers no longer serialize on mutex_.  This starts the
+   * writer thread: set the chunk and buffer sizes first, and call it before
+   * the transport is shared between threads.
+   */
+  void enableLockFreeEnqueue();
+
   void setFlushMaxUs(uint32_t flushMaxUs) {
     if (flushMaxUs) {
       flushMaxUs_ = flushMaxUs;
@@ -283,6 +442,123 @@ class TFileTransport : public TFileReaderTransport,
     return eofSleepTime_;
   }
 
+  /**
+   * Read the file ahead on a helper thread: while events are parsed out of
+   * one read buffer, the next is read into a second one, so the reader only
+   * waits on the disk when it is ahead of it.  Costs a second buffer of
+   * getReadBuffSize() bytes.
+   *
+   * Independently of this, a reader tailing the file is woken by inotify
+   * when the file is written, where that is available, rather than only
+   * after the EOF sleep time, which then just bounds the wait.
+   */
+  void setReadAhead(bool readAhead) {
+    readAhead_ = readAhead;
+  }
+  bool getReadAhead() {
+    return readAhead_;
+  }
+
+  /**
+   * How the writer thread makes flushed data durable.  SYNC_NONE leaves it
+   * to the OS, so flush() only guarantees the data has been written.
+   */
+  enum SyncPolicy {
+    SYNC_FSYNC,
+    SYNC_FDATASYNC,
+    SYNC_NONE
+  };
+  void setSyncPolicy(SyncPolicy syncPolicy) {
+    syncPolicy_ = syncPolicy;
+  }
+  SyncPolicy getSyncPolicy() {
+    return syncPolicy_;
+  }
+
+  /**
+   * With group commit the writer thread hands every event it dequeued in
+   * one pass to the kernel with a single writev(), instead of one write()
+   * per event.  An IO error then drops the whole batch.
+   */
+  void setGroupCommit(bool groupCommit) {
+    groupCommit_ = groupCommit;
+  }
+  bool getGroupCommit() {
+    return groupCommit_;
+  }
+
+  /**
+   * Reserve disk space one chunk at a time as the log reaches it, without
+   * changing the file size.  Only supported on Linux; ignored elsewhere.
+   */
+  void setPreallocateChunks(bool preallocateChunks) {
+    preallocateChunks_ = preallocateChunks;
+  }
+  bool getPreallocateChunks() {
+    return preallocateChunks_;
+  }
+
+  /**
+   * Have the writer thread maintain a TFileTransportIndex with an entry for
+   * every indexInterval-th event, 0 to disable.  Set before the first write.
+   */
+  void setIndexInterval(uint32_t indexInterval) {
+    indexInterval_ = indexInterval;
+  }
+  uint32_t getIndexInterval() {
+    return indexInterval_;
+  }
+
+  /**
+   * Compressed blocks.  Once a write codec is set, the writer thread gathers
+   * events into blocks of about getBlockSize() bytes and writes each
+   * compressed as one record, its size field flagged with
+   * COMPRESSED_BLOCK_FLAG.  A block holds the id of its codec and the
+   * number of events in it, so seekToEvent() and a restarted writer count
+   * events without uncompressing, and never straddles a chunk, so
+   * seekToChunk() still lands on a record.  The sidecar index points at
+   * blocks.  Blocks are written once full, and when the log is flushed or
+   * the flush interval passes, so tailing readers see events that late.
+   *
+   * Reading uncompresses blocks transparently, the next one on a helper
+   * thread while events are read from the current one.  Logs may mix
+   * blocks and plain events; TMappedFileTransport reads neither kind of
+   * log with blocks in it.
+   *
+   * Codecs are TTransportFactory objects wrapping a stream, as for
+   * THeaderTransport: TZlibTransportFactory, TLZ4TransportFactory,
+   * TZstdTransportFactory, by the ids of
+   * TNegotiatedCompressionTransport::Codec, or any other with an id both
+   * writer and readers agree on.  Set codecs before the first read or
+   * write.
+   */
+  void setBlockCodec(uint8_t id, boost::shared_ptr<TTransportFactory> factory) {
+    blockCodecs_[id] = factory;
+  }
+
+  /// The codec to compress written events with, 0 to write them plainly
+  void setWriteBlockCodec(uint8_t id);
+  uint8_t getWriteBlockCodec() {
+    return writeBlockCodec_;
+  }
+
+  /**
+   * Uncompressed size at which blocks are written.  It bounds what readers
+   * accept as well, together with the chunk size, so keep it the same on
+   * both sides, and well below the chunk size: a block whose compressed
+   * form does not fit a chunk is dropped like an event that doesn't.
+   */
+  void setBlockSize(uint32_t blockSize) {
+    if (blockSize) {
+      blockSize_ = blockSize;
+    }
+  }
+  uint32_t getBlockSize() {
+    return blockSize_;
+  }
+
+  static const uint32_t COMPRESSED_BLOCK_FLAG = 0x80000000;
+
   /*
    * Override TTransport *_virt() functions to invoke our implementations.
    * We cannot use TVirtualTransport to provide these, since we need to inherit
@@ -297,11 +573,15 @@ class TFileTransport : public TFileReaderTransport,
   virtual void write_virt(const uint8_t* buf, uint32_t len) {
     this->write(buf, len);
   }
+  virtual bool peek_virt() {
+    return this->peek();
+  }
 
  private:
   // helper functions for writing to a file
   void enqueueEvent(const uint8_t* buf, uint32_t eventLen);
   bool swapEventBuffers(struct timeval* deadline);
+  bool waitForRingEvents(struct timeval* deadline);
   bool initBufferAndWriteThread();
 
   // control for writer thread
@@ -313,14 +593,43 @@ class TFileTransport : public TFileReaderTransport,
 
   // helper functions for reading from a file
   eventInfo* readEvent();
+  eventInfo* readFrame();
+
+  // helper functions for compressed blocks
+  eventInfo* addToBlock(eventInfo* event);
+  eventInfo* sealBlock();
+  void loadBlock(const eventInfo* frame);
+  void prefetchBlock();
+  bool isBlockBuffered();
+  void resetBlocks();
+  uint32_t getMaxBlockSize() {
+    return (std::max)(blockSize_, chunkSize_);
+  }
+  static uint32_t getBlockEventCount(const eventInfo* frame);
 
   // event corruption-related functions
   bool isEventCorrupted();
   void performRecovery();
 
+  // helper functions for the writer thread's IO policies
+  void syncLogFile();
+  void preallocateChunk();
+
+  // reading the file, ahead of the reader if readAhead_ is set
+  int32_t readFile();
+  void cancelReadAhead();
+  void waitForData(uint32_t timeoutUs);
+
+  // helper functions for the sidecar index
+  void openIndex();
+  void indexEvents(uint32_t count);
+  void seekToOffset(off_t offset);
+
   // Utility functions
   void openLogFile();
   void getNextFlushTime(struct timeval* ts_next_flush);
+  static void monotonicTimeval(struct timeval* now);
+  static bool isPast(const struct timeval* deadline);
 
   // Class variables
   readState readState_;
@@ -361,6 +670,39 @@ class TFileTransport : public TFileReaderTransport,
   uint32_t eofSleepTime_;
   static const uint32_t DEFAULT_EOF_SLEEP_TIME_US = 500 * 1000;
 
+  // whether to read the file ahead on a helper thread, and the inotify
+  // instance tailing waits on
+  bool readAhead_;
+  int inotifyFd_;
+
+  // durability and batching policies of the writer thread
+  SyncPolicy syncPolicy_;
+  bool groupCommit_;
+  bool preallocateChunks_;
+
+  // sidecar index, and the number of the next event the writer appends
+  uint32_t indexInterval_;
+  boost::scoped_ptr<TFileTransportIndex> index_;
+  uint64_t numEventsWritten_;
+
+  // compressed blocks: the codecs, and the events the writer thread has
+  // gathered for the next block, and the last block it sealed
+  typedef std::map<uint8_t, boost::shared_ptr<TTransportFactory> > CodecMap;
+  CodecMap blockCodecs_;
+  uint8_t writeBlockCodec_;
+  uint32_t blockSize_;
+  static const uint32_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+  std::string blockEvents_;
+  uint32_t blockNumEvents_;
+  eventInfo blockFrame_;
+  uint32_t blockFrameEvents_;
+
+  // uncompresses the blocks read
+  boost::scoped_ptr<TFileBlockReader> blockReader_;
+
+  // reads the file ahead when readAhead_ is set
+  boost::scoped_ptr<TFileReadAhead> fileReadAhead_;
+
   // sleep duration when a corrupted event is encountered
   uint32_t corruptedEventSleepTime_;
   static const uint32_t DEFAULT_CORRUPTED_SLEEP_TIME_US = 1 * 1000 * 1000;
@@ -378,6 +720,11 @@ class TFileTransport : public TFileReaderTransport,
   TFileTransportBuffer *dequeueBuffer_;
   TFileTransportBuffer *enqueueBuffer_;
 
+  // replaces both buffers when lock-free enqueueing is enabled
+  boost::scoped_ptr<TFileTransportRing> enqueueRing_;
+  // ring position a pending flush() has to wait for
+  uint64_t flushTarget_;
+
   // conditions used to block when the buffer is full or empty
   Monitor notFull_, notEmpty_;
   volatile bool closing_;
@@ -417,6 +764,12 @@ class TEOFException : public TTransportException {
 // wrapper class to process events from a file containing thrift events
 class TFileProcessor {
  public:
+  /**
+   * Maps an event to an ordering key for processParallel()
+   */
+  typedef apache::thrift::stdcxx::function<uint64_t(const uint8_t* event, uint32_t len)>
+    EventKeyFunction;
+
   /**
    * Constructor that defaults output transport to null transport
    *
@@ -460,6 +813,36 @@ class TFileProcessor {
    */
   void processChunk();
 
+  /**
+   * process the events of numChunks chunks starting at firstChunk
+   *
+   * Chunks can be replayed independently, so a log can be fanned out over
+   * several threads by giving each its own input transport and
+   * TFileProcessor and a disjoint chunk range.
+   *
+   * @param firstChunk first chunk to process
+   * @param numChunks number of chunks to process
+   */
+  void processChunks(uint32_t firstChunk, uint32_t numChunks);
+
+  /**
+   * processes events from the file on the threads of a ThreadManager
+   *
+   * This thread reads the events and spreads them over numLanes lanes, each
+   * of which is processed by one task at a time.  With a key function, all
+   * events with the same key share a lane and are processed in log order;
+   * without one, events are dealt out round-robin and no order is kept.
+   * The processor and output transport are shared by all tasks, so they
+   * must be thread safe.
+   *
+   * @param threadManager started ThreadManager to process events on
+   * @param numLanes number of lanes (0 for the number of workers)
+   * @param keyFunction ordering key of an event, may be empty
+   */
+  void processParallel(boost::shared_ptr<apache::thrift::concurrency::ThreadManager> threadManager,
+                       uint32_t numLanes,
+                       EventKeyFunction keyFunction = EventKeyFunction());
+
  private:
   boost::shared_ptr<TProcessor> processor_;
   boost::shared_ptr<TProtocolFactory> inputProtocolFactory_;
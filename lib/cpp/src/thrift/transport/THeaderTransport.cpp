@@ -0,0 +1,421 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/transport/THeaderTransport.h>
+#include <thrift/protocol/TCompactVarint.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+using boost::shared_ptr;
+
+namespace {
+
+// Big enough for the fixed part of a header and nothing else
+const uint32_t FIXED_HEADER_SIZE = 10;
+
+// First bytes of messages of the protocols that come without a header
+const uint8_t BINARY_VERSION_BYTE = 0x80;
+const uint8_t COMPACT_PROTOCOL_ID = 0x82;
+const uint8_t JSON_START = '[';
+
+inline uint16_t readBE16(const uint8_t* p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline uint32_t readBE32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+inline void writeBE16(uint8_t* p, uint16_t n) {
+  p[0] = static_cast<uint8_t>(n >> 8);
+  p[1] = static_cast<uint8_t>(n);
+}
+
+inline void writeBE32(uint8_t* p, uint32_t n) {
+  p[0] = static_cast<uint8_t>(n >> 24);
+  p[1] = static_cast<uint8_t>(n >> 16);
+  p[2] = static_cast<uint8_t>(n >> 8);
+  p[3] = static_cast<uint8_t>(n);
+}
+
+void corrupt(const char* message) {
+  throw TTransportException(TTransportException::CORRUPTED_DATA, message);
+}
+
+uint32_t readVarint(const uint8_t*& p, const uint8_t* end) {
+  uint32_t result = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (p == end) {
+      corrupt("THeaderTransport: header ends inside a varint");
+    }
+    uint8_t byte = *p++;
+    result |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return result;
+    }
+  }
+  corrupt("THeaderTransport: varint too long");
+  return 0;
+}
+
+std::string readVarString(const uint8_t*& p, const uint8_t* end) {
+  uint32_t size = readVarint(p, end);
+  if (size > static_cast<uint32_t>(end - p)) {
+    corrupt("THeaderTransport: header ends inside a string");
+  }
+  std::string result(reinterpret_cast<const char*>(p), size);
+  p += size;
+  return result;
+}
+
+void writeVarint(std::vector<uint8_t>& out, uint32_t n) {
+  uint8_t buf[5];
+  uint32_t size = protocol::detail::compact::encodeVarint32(n, buf);
+  out.insert(out.end(), buf, buf + size);
+}
+
+void writeVarString(std::vector<uint8_t>& out, const std::string& str) {
+  writeVarint(out, static_cast<uint32_t>(str.size()));
+  out.insert(out.end(), str.begin(), str.end());
+}
+
+/**
+ * Parses the variable part of a header, from just after its size to the
+ * end of its padding.
+ */
+void parseHeader(const uint8_t* p, const uint8_t* end, uint16_t& protocolId,
+                 std::vector<uint16_t>& transforms,
+                 THeaderTransport::StringToStringMap& headers) {
+  protocolId = static_cast<uint16_t>(readVarint(p, end));
+
+  uint32_t count = readVarint(p, end);
+  if (count > static_cast<uint32_t>(end - p)) {
+    corrupt("THeaderTransport: too many transforms");
+  }
+  transforms.clear();
+  for (uint32_t i = 0; i < count; ++i) {
+    transforms.push_back(static_cast<uint16_t>(readVarint(p, end)));
+  }
+
+  headers.clear();
+  while (p != end) {
+    uint32_t infoId = readVarint(p, end);
+    if (infoId == THeaderTransport::INFO_KEYVALUE) {
+      uint32_t pairs = readVarint(p, end);
+      for (uint32_t i = 0; i < pairs; ++i) {
+        std::string key = readVarString(p, end);
+        headers[key] = readVarString(p, end);
+      }
+    } else {
+      // Padding, or an info block from a later version: nothing more we
+      // can make sense of
+      break;
+    }
+  }
+}
+
+}
+
+const uint16_t THeaderTransport::HEADER_MAGIC;
+const uint32_t THeaderTransport::DEFAULT_MAX_FRAME_SIZE;
+const char* const THeaderTransport::CLIENT_TIMEOUT_HEADER = "client_timeout";
+
+THeaderTransport::THeaderTransport(shared_ptr<TTransport> transport)
+  : inputTransport_(transport),
+    outputTransport_(transport),
+    clientType_(HEADER_CLIENT_TYPE),
+    protocolId_(T_BINARY_PROTOCOL),
+    seqId_(0),
+    externalFraming_(false),
+    maxFrameSize_(DEFAULT_MAX_FRAME_SIZE) {
+  transformBuffers_[0].reset(new TMemoryBuffer());
+  transformBuffers_[1].reset(new TMemoryBuffer());
+}
+
+THeaderTransport::THeaderTransport(shared_ptr<TTransport> inputTransport,
+                                   shared_ptr<TTransport> outputTransport)
+  : inputTransport_(inputTransport),
+    outputTransport_(outputTransport),
+    clientType_(HEADER_CLIENT_TYPE),
+    protocolId_(T_BINARY_PROTOCOL),
+    seqId_(0),
+    externalFraming_(false),
+    maxFrameSize_(DEFAULT_MAX_FRAME_SIZE) {
+  transformBuffers_[0].reset(new TMemoryBuffer());
+  transformBuffers_[1].reset(new TMemoryBuffer());
+}
+
+uint32_t THeaderTransport::read(uint8_t* buf, uint32_t len) {
+  uint32_t got = readBuffer_.read(buf, len);
+  if (got > 0 || len == 0) {
+    return got;
+  }
+  if (clientType_ == UNFRAMED_CLIENT_TYPE && !externalFraming_) {
+    // Unframed messages are read straight from the stream
+    return inputTransport_->read(buf, len);
+  }
+  readFrame();
+  return readBuffer_.read(buf, len);
+}
+
+void THeaderTransport::readFrameIfNeeded() {
+  if (readBuffer_.available_read() > 0 ||
+      (clientType_ == UNFRAMED_CLIENT_TYPE && !externalFraming_)) {
+    return;
+  }
+  readFrame();
+}
+
+void THeaderTransport::readFrame() {
+  if (externalFraming_) {
+    // Everything there is makes the frame.  Borrowing spares a copy when
+    // the input is a memory buffer, as it is in TNonblockingServer.
+    uint32_t size = 0;
+    const uint8_t* frame = inputTransport_->borrow(NULL, &size);
+    if (frame != NULL && size > 0) {
+      inputTransport_->consume(size);
+    } else {
+      frameBuffer_.resetBuffer();
+      for (;;) {
+        uint8_t* buf = frameBuffer_.getWritePtr(4096);
+        uint32_t got = inputTransport_->read(buf, 4096);
+        if (got == 0) {
+          break;
+        }
+        frameBuffer_.wroteBytes(got);
+      }
+      uint8_t* copied;
+      frameBuffer_.getBuffer(&copied, &size);
+      frame = copied;
+    }
+    if (size == 0) {
+      throw TTransportException(TTransportException::END_OF_FILE,
+                                "No more data to read.");
+    }
+    readPayload(frame, size);
+    return;
+  }
+
+  uint8_t sizeBuf[4];
+  inputTransport_->readAll(sizeBuf, sizeof(sizeBuf));
+
+  if ((sizeBuf[0] == BINARY_VERSION_BYTE && sizeBuf[1] == 0x01) ||
+      sizeBuf[0] == COMPACT_PROTOCOL_ID) {
+    // Not a size but the start of an unframed message; hand it out, then
+    // the rest of the stream as it comes
+    clientType_ = UNFRAMED_CLIENT_TYPE;
+    protocolId_ = sizeBuf[0] == COMPACT_PROTOCOL_ID ? T_COMPACT_PROTOCOL
+                                                    : T_BINARY_PROTOCOL;
+    readTransforms_.clear();
+    readHeaders_.clear();
+    readBuffer_.resetBuffer(sizeBuf, sizeof(sizeBuf), TMemoryBuffer::COPY);
+    return;
+  }
+
+  uint32_t size = readBE32(sizeBuf);
+  if (size == 0 || size > maxFrameSize_) {
+    corrupt("THeaderTransport: bad frame size");
+  }
+  frameBuffer_.resetBuffer();
+  uint8_t* frame = frameBuffer_.getWritePtr(size);
+  inputTransport_->readAll(frame, size);
+  frameBuffer_.wroteBytes(size);
+  readPayload(frame, size);
+}
+
+void THeaderTransport::readPayload(const uint8_t* payload, uint32_t size) {
+  if (size >= 2 && readBE16(payload) == HEADER_MAGIC) {
+    readHeaderFrame(payload, size);
+    return;
+  }
+
+  if (payload[0] == BINARY_VERSION_BYTE) {
+    protocolId_ = T_BINARY_PROTOCOL;
+  } else if (payload[0] == COMPACT_PROTOCOL_ID) {
+    protocolId_ = T_COMPACT_PROTOCOL;
+  } else if (payload[0] == JSON_START) {
+    protocolId_ = T_JSON_PROTOCOL;
+  } else {
+    corrupt("THeaderTransport: frame of unknown format");
+  }
+  clientType_ = FRAMED_CLIENT_TYPE;
+  readTransforms_.clear();
+  readHeaders_.clear();
+  readBuffer_.resetBuffer(const_cast<uint8_t*>(payload), size);
+}
+
+void THeaderTransport::readHeaderFrame(const uint8_t* payload, uint32_t size) {
+  if (size < FIXED_HEADER_SIZE) {
+    corrupt("THeaderTransport: frame too short for its header");
+  }
+  uint32_t headerEnd = FIXED_HEADER_SIZE + 4 * static_cast<uint32_t>(readBE16(payload + 8));
+  if (headerEnd > size) {
+    corrupt("THeaderTransport: header bigger than its frame");
+  }
+
+  uint16_t protocolId;
+  parseHeader(payload + FIXED_HEADER_SIZE, payload + headerEnd, protocolId,
+              readTransforms_, readHeaders_);
+
+  const uint8_t* data = payload + headerEnd;
+  uint32_t dataSize = size - headerEnd;
+  for (size_t i = readTransforms_.size(); i-- > 0;) {
+    const shared_ptr<TMemoryBuffer>& out = transformBuffers_[i % 2];
+    transform(readTransforms_[i], true, data, dataSize, out);
+    uint8_t* undone;
+    out->getBuffer(&undone, &dataSize);
+    data = undone;
+  }
+
+  // Replies go back the way the request came
+  clientType_ = HEADER_CLIENT_TYPE;
+  protocolId_ = protocolId;
+  seqId_ = static_cast<int32_t>(readBE32(payload + 4));
+  writeTransforms_ = readTransforms_;
+
+  readBuffer_.resetBuffer(const_cast<uint8_t*>(data), dataSize);
+}
+
+void THeaderTransport::transform(uint16_t id, bool undo,
+                                 const uint8_t* data, uint32_t size,
+                                 const shared_ptr<TMemoryBuffer>& out) {
+  TransformMap::const_iterator it = transforms_.find(id);
+  if (it == transforms_.end() || !it->second) {
+    corrupt("THeaderTransport: unknown transform");
+  }
+
+  out->resetBuffer();
+  if (undo) {
+    shared_ptr<TMemoryBuffer> in(
+      new TMemoryBuffer(const_cast<uint8_t*>(data), size));
+    shared_ptr<TTransport> decoder = it->second->getTransport(in);
+    for (;;) {
+      uint8_t* buf = out->getWritePtr(4096);
+      uint32_t got = decoder->read(buf, 4096);
+      if (got == 0) {
+        break;
+      }
+      out->wroteBytes(got);
+      if (out->available_read() > maxFrameSize_) {
+        corrupt("THeaderTransport: frame too large once transformed");
+      }
+    }
+  } else {
+    shared_ptr<TTransport> encoder = it->second->getTransport(out);
+    encoder->write(data, size);
+    encoder->flush();
+  }
+}
+
+void THeaderTransport::addWriteTransform(uint16_t id) {
+  TransformMap::const_iterator it = transforms_.find(id);
+  if (it == transforms_.end() || !it->second) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "THeaderTransport: unknown transform");
+  }
+  writeTransforms_.push_back(id);
+}
+
+void THeaderTransport::buildHeader() {
+  headerBuffer_.assign(FIXED_HEADER_SIZE, 0);
+
+  writeVarint(headerBuffer_, protocolId_);
+  writeVarint(headerBuffer_, static_cast<uint32_t>(writeTransforms_.size()));
+  for (size_t i = 0; i < writeTransforms_.size(); ++i) {
+    writeVarint(headerBuffer_, writeTransforms_[i]);
+  }
+
+  if (!writeHeaders_.empty()) {
+    writeVarint(headerBuffer_, INFO_KEYVALUE);
+    writeVarint(headerBuffer_, static_cast<uint32_t>(writeHeaders_.size()));
+    for (StringToStringMap::const_iterator it = writeHeaders_.begin();
+         it != writeHeaders_.end(); ++it) {
+      writeVarString(headerBuffer_, it->first);
+      writeVarString(headerBuffer_, it->second);
+    }
+  }
+
+  while ((headerBuffer_.size() - FIXED_HEADER_SIZE) % 4 != 0) {
+    headerBuffer_.push_back(INFO_PADDING);
+  }
+  size_t words = (headerBuffer_.size() - FIXED_HEADER_SIZE) / 4;
+  if (words > 0xffff) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "THeaderTransport: headers too large");
+  }
+
+  writeBE16(&headerBuffer_[0], HEADER_MAGIC);
+  writeBE16(&headerBuffer_[2], 0);
+  writeBE32(&headerBuffer_[4], static_cast<uint32_t>(seqId_));
+  writeBE16(&headerBuffer_[8], static_cast<uint16_t>(words));
+}
+
+void THeaderTransport::flush() {
+  uint8_t* data;
+  uint32_t size;
+  writeBuffer_.getBuffer(&data, &size);
+  // The bytes stay where they are until the next write; resetting first
+  // means a failed write doesn't leave them to be sent again
+  writeBuffer_.resetBuffer();
+
+  uint32_t headerSize = 0;
+  if (clientType_ == HEADER_CLIENT_TYPE) {
+    for (size_t i = 0; i < writeTransforms_.size(); ++i) {
+      const shared_ptr<TMemoryBuffer>& out = transformBuffers_[i % 2];
+      transform(writeTransforms_[i], false, data, size, out);
+      out->getBuffer(&data, &size);
+    }
+    buildHeader();
+    headerSize = static_cast<uint32_t>(headerBuffer_.size());
+  }
+
+  if (!externalFraming_ && clientType_ != UNFRAMED_CLIENT_TYPE) {
+    uint8_t sizeBuf[4];
+    writeBE32(sizeBuf, headerSize + size);
+    outputTransport_->write(sizeBuf, sizeof(sizeBuf));
+  }
+  if (headerSize > 0) {
+    outputTransport_->write(&headerBuffer_[0], headerSize);
+  }
+  outputTransport_->write(data, size);
+  outputTransport_->flush();
+}
+
+bool THeaderTransport::readHeaders(const uint8_t* frame, uint32_t size,
+                                   StringToStringMap& headers) {
+  if (size < FIXED_HEADER_SIZE || readBE16(frame) != HEADER_MAGIC) {
+    return false;
+  }
+  uint32_t headerEnd = FIXED_HEADER_SIZE + 4 * static_cast<uint32_t>(readBE16(frame + 8));
+  if (headerEnd > size) {
+    return false;
+  }
+  try {
+    uint16_t protocolId;
+    std::vector<uint16_t> transforms;
+    parseHeader(frame + FIXED_HEADER_SIZE, frame + headerEnd, protocolId,
+                transforms, headers);
+  } catch (const TTransportException&) {
+    return false;
+  }
+  return true;
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,258 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_THEADERTRANSPORT_H_
+#define _THRIFT_TRANSPORT_THEADERTRANSPORT_H_ 1
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <thrift/transport/TTransport.h>
+#include <thrift/transport/TVirtualTransport.h>
+#include <thrift/transport/TBufferTransports.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * A framed transport whose frames say how to read them.
+ *
+ * Each frame is a TFramedTransport frame whose payload starts with a header:
+ *
+ *     0x0fff         magic, 2 bytes
+ *     flags          2 bytes, 0
+ *     sequence id    4 bytes, that of the message in the frame
+ *     header size    2 bytes, in words of 4 bytes
+ *     header         varints: the protocol id, the number of transforms,
+ *                    the transform ids, then info blocks, padded with 0s
+ *     payload        the message, with the transforms applied in order
+ *
+ * The one info block understood is INFO_KEYVALUE: a count, then that many
+ * pairs of strings, each a varint length and its bytes.  These headers are
+ * how tracing ids and deadlines travel with a call.
+ *
+ * On reading, the transport also accepts plain TFramedTransport frames and
+ * unframed messages of the binary and compact protocols, and writes back in
+ * the form, protocol and transforms of what it last read, so one server
+ * serves old and new clients alike.  THeaderProtocol picks the protocol for
+ * each message from getProtocolId().
+ *
+ * Transforms are TTransportFactory objects wrapping a stream, as for
+ * TNegotiatedCompressionTransport: TZlibTransportFactory,
+ * TZstdTransportFactory, TLZ4TransportFactory, or any other with an id both
+ * ends agree on.
+ */
+class THeaderTransport : public TVirtualTransport<THeaderTransport> {
+ public:
+  /// How the last frame read was framed, and so how the next is written
+  enum ClientType {
+    HEADER_CLIENT_TYPE = 0,
+    FRAMED_CLIENT_TYPE = 1,
+    UNFRAMED_CLIENT_TYPE = 2
+  };
+
+  enum ProtocolId {
+    T_BINARY_PROTOCOL = 0,
+    T_JSON_PROTOCOL = 1,
+    T_COMPACT_PROTOCOL = 2
+  };
+
+  /// Transform ids for the compression transports that come with Thrift
+  enum Transform {
+    ZLIB_TRANSFORM = 1,
+    ZSTD_TRANSFORM = 5,
+    LZ4_TRANSFORM = 6
+  };
+
+  enum InfoId {
+    INFO_PADDING = 0,
+    INFO_KEYVALUE = 1
+  };
+
+  typedef std::map<std::string, std::string> StringToStringMap;
+  typedef std::map<uint16_t, boost::shared_ptr<TTransportFactory> > TransformMap;
+
+  static const uint16_t HEADER_MAGIC = 0x0fff;
+  static const uint32_t DEFAULT_MAX_FRAME_SIZE = 256 * 1024 * 1024;
+
+  /// Header with the milliseconds the client will wait, in decimal
+  static const char* const CLIENT_TIMEOUT_HEADER;
+
+  explicit THeaderTransport(boost::shared_ptr<TTransport> transport);
+
+  THeaderTransport(boost::shared_ptr<TTransport> inputTransport,
+                   boost::shared_ptr<TTransport> outputTransport);
+
+  bool isOpen() {
+    return inputTransport_->isOpen();
+  }
+
+  bool peek() {
+    return readBuffer_.available_read() > 0 || inputTransport_->peek();
+  }
+
+  void open() {
+    inputTransport_->open();
+  }
+
+  void close() {
+    inputTransport_->close();
+  }
+
+  uint32_t read(uint8_t* buf, uint32_t len);
+
+  void write(const uint8_t* buf, uint32_t len) {
+    writeBuffer_.write(buf, len);
+  }
+
+  void flush();
+
+  /**
+   * Reads the next frame unless some of the last is left; called at the
+   * start of each message so the protocol is known before it is read.
+   */
+  void readFrameIfNeeded();
+
+  /// Protocol of the last frame read, or of the frames to write
+  uint16_t getProtocolId() const {
+    return protocolId_;
+  }
+
+  void setProtocolId(uint16_t protocolId) {
+    protocolId_ = protocolId;
+  }
+
+  ClientType getClientType() const {
+    return clientType_;
+  }
+
+  /// Sequence id written in the header of the next frame
+  void setSequenceId(int32_t seqId) {
+    seqId_ = seqId;
+  }
+
+  /**
+   * Makes transform id known, applied and undone with what factory makes.
+   * Frames using a transform that is not known can't be read.
+   */
+  void setTransform(uint16_t id, boost::shared_ptr<TTransportFactory> factory) {
+    transforms_[id] = factory;
+  }
+
+  void setTransforms(const TransformMap& transforms) {
+    transforms_ = transforms;
+  }
+
+  /// Applies a known transform to frames written from now on
+  void addWriteTransform(uint16_t id);
+
+  const std::vector<uint16_t>& getReadTransforms() const {
+    return readTransforms_;
+  }
+
+  const std::vector<uint16_t>& getWriteTransforms() const {
+    return writeTransforms_;
+  }
+
+  /// Sets a header sent with every frame written until clearHeaders()
+  void setHeader(const std::string& key, const std::string& value) {
+    writeHeaders_[key] = value;
+  }
+
+  void removeHeader(const std::string& key) {
+    writeHeaders_.erase(key);
+  }
+
+  void clearHeaders() {
+    writeHeaders_.clear();
+  }
+
+  const StringToStringMap& getWriteHeaders() const {
+    return writeHeaders_;
+  }
+
+  /// Headers of the last frame read
+  const StringToStringMap& getReadHeaders() const {
+    return readHeaders_;
+  }
+
+  /**
+   * For servers that frame requests and replies themselves, such as
+   * TNonblockingServer: each frame is the whole of what the input transport
+   * holds, without its size, and frames are written without one.
+   */
+  void setExternalFraming(bool externalFraming) {
+    externalFraming_ = externalFraming;
+  }
+
+  void setMaxFrameSize(uint32_t maxFrameSize) {
+    maxFrameSize_ = maxFrameSize;
+  }
+
+  boost::shared_ptr<TTransport> getUnderlyingTransport() {
+    return inputTransport_;
+  }
+
+  /**
+   * Reads the key/value headers of a frame payload, without undoing its
+   * transforms, for a server to look at before a worker reads the frame.
+   *
+   * @return false if the payload is not a header frame.
+   */
+  static bool readHeaders(const uint8_t* frame, uint32_t size,
+                          StringToStringMap& headers);
+
+ private:
+  void readFrame();
+  void readPayload(const uint8_t* payload, uint32_t size);
+  void readHeaderFrame(const uint8_t* payload, uint32_t size);
+  void transform(uint16_t id, bool undo, const uint8_t* data, uint32_t size,
+                 const boost::shared_ptr<TMemoryBuffer>& out);
+  void buildHeader();
+
+  boost::shared_ptr<TTransport> inputTransport_;
+  boost::shared_ptr<TTransport> outputTransport_;
+
+  /// Payload of the frame being read, transforms undone
+  TMemoryBuffer readBuffer_;
+  /// Written since the last flush
+  TMemoryBuffer writeBuffer_;
+  /// The frame being read, as it came
+  TMemoryBuffer frameBuffer_;
+  /// Where transforms put their output, in turns
+  boost::shared_ptr<TMemoryBuffer> transformBuffers_[2];
+  /// Header of the frame being written
+  std::vector<uint8_t> headerBuffer_;
+
+  ClientType clientType_;
+  uint16_t protocolId_;
+  int32_t seqId_;
+  bool externalFraming_;
+  uint32_t maxFrameSize_;
+
+  TransformMap transforms_;
+  std::vector<uint16_t> readTransforms_;
+  std::vector<uint16_t> writeTransforms_;
+  StringToStringMap readHeaders_;
+  StringToStringMap writeHeaders_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_THEADERTRANSPORT_H_
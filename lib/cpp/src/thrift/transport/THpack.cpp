@@ -0,0 +1,513 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/transport/THpack.h>
+#include <thrift/transport/TTransportException.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+namespace {
+
+struct THuffmanCode {
+  uint32_t code;
+  uint8_t bits;
+};
+
+// RFC 7541 Appendix B, as {code, length in bits} indexed by symbol
+const THuffmanCode HUFFMAN_CODES[257] = {
+  {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+  {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+  {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+  {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+  {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+  {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+  {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+  {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+  {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12}, {0x1ff9, 13}, {0x15, 6},
+  {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+  {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6}, {0x0, 5}, {0x1, 5}, {0x2, 5},
+  {0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6},
+  {0x5c, 7}, {0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+  {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7},
+  {0x61, 7}, {0x62, 7}, {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7},
+  {0x68, 7}, {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+  {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7}, {0xfd, 8},
+  {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+  {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6},
+  {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6},
+  {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5}, {0x9, 5},
+  {0x2d, 6}, {0x77, 7}, {0x78, 7}, {0x79, 7}, {0x7a, 7}, {0x7b, 7},
+  {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+  {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20}, {0x3fffd3, 22},
+  {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22},
+  {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23},
+  {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23}, {0xffffec, 24},
+  {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24},
+  {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23},
+  {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22},
+  {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22},
+  {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22},
+  {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21}, {0x7fffea, 23},
+  {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21},
+  {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21},
+  {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23},
+  {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20},
+  {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23},
+  {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23}, {0x3ffffe0, 26},
+  {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22},
+  {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26},
+  {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27},
+  {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19},
+  {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27},
+  {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24}, {0x1fffe4, 21},
+  {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28},
+  {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20},
+  {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21}, {0x3fffe9, 22},
+  {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22},
+  {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24},
+  {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23}, {0x3ffffeb, 26},
+  {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27},
+  {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27},
+  {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27}, {0x7ffffee, 27},
+  {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30}
+};
+
+// The codes are canonical, so for each length the codes are consecutive
+// and decoding only needs the first code of each length and the symbols
+// in code order.
+const uint32_t HUFFMAN_FIRST_CODE[31] = {
+  0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x14, 0x5c, 0xf8, 0x0, 0x3f8, 0x7fa, 0xffa,
+  0x1ff8, 0x3ffc, 0x7ffc, 0x0, 0x0, 0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2,
+  0x7fffd8, 0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0,
+  0x3ffffffc
+};
+
+const uint16_t HUFFMAN_FIRST_INDEX[31] = {
+  0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92, 0, 0, 0, 95, 98,
+  106, 119, 145, 174, 186, 190, 205, 224, 0, 253
+};
+
+const uint16_t HUFFMAN_COUNT[31] = {
+  0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26,
+  29, 12, 4, 15, 19, 29, 0, 4
+};
+
+const uint16_t HUFFMAN_SYMBOLS[257] = {
+  48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51, 52, 53,
+  54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114,
+  117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82,
+  83, 84, 85, 86, 87, 89, 106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44,
+  59, 88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62, 0, 36, 64, 91, 93, 126,
+  94, 125, 60, 96, 123, 92, 195, 208, 128, 130, 131, 162, 184, 194, 224, 226,
+  153, 161, 167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129, 132,
+  133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170, 173, 178, 181, 185,
+  186, 187, 189, 190, 196, 198, 228, 232, 233, 1, 135, 137, 138, 139, 140,
+  141, 143, 147, 149, 150, 151, 152, 155, 157, 158, 165, 166, 168, 174, 175,
+  180, 182, 183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159, 171,
+  206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193, 200, 201, 202, 205,
+  210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211, 212, 214, 221,
+  222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+  6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20, 21, 23, 24, 25, 26, 27, 28, 29,
+  30, 31, 127, 220, 249, 10, 13, 22, 256
+};
+const uint32_t HUFFMAN_EOS = 256;
+
+// RFC 7541 Appendix A; index 1 is the first entry
+const uint32_t STATIC_TABLE_SIZE = 61;
+const char* const STATIC_TABLE[STATIC_TABLE_SIZE + 1][2] = {
+  {"", ""},
+  {":authority", ""},
+  {":method", "GET"},
+  {":method", "POST"},
+  {":path", "/"},
+  {":path", "/index.html"},
+  {":scheme", "http"},
+  {":scheme", "https"},
+  {":status", "200"},
+  {":status", "204"},
+  {":status", "206"},
+  {":status", "304"},
+  {":status", "400"},
+  {":status", "404"},
+  {":status", "500"},
+  {"accept-charset", ""},
+  {"accept-encoding", "gzip, deflate"},
+  {"accept-language", ""},
+  {"accept-ranges", ""},
+  {"accept", ""},
+  {"access-control-allow-origin", ""},
+  {"age", ""},
+  {"allow", ""},
+  {"authorization", ""},
+  {"cache-control", ""},
+  {"content-disposition", ""},
+  {"content-encoding", ""},
+  {"content-language", ""},
+  {"content-length", ""},
+  {"content-location", ""},
+  {"content-range", ""},
+  {"content-type", ""},
+  {"cookie", ""},
+  {"date", ""},
+  {"etag", ""},
+  {"expect", ""},
+  {"expires", ""},
+  {"from", ""},
+  {"host", ""},
+  {"if-match", ""},
+  {"if-modified-since", ""},
+  {"if-none-match", ""},
+  {"if-range", ""},
+  {"if-unmodified-since", ""},
+  {"last-modified", ""},
+  {"link", ""},
+  {"location", ""},
+  {"max-forwards", ""},
+  {"proxy-authenticate", ""},
+  {"proxy-authorization", ""},
+  {"range", ""},
+  {"referer", ""},
+  {"refresh", ""},
+  {"retry-after", ""},
+  {"server", ""},
+  {"set-cookie", ""},
+  {"strict-transport-security", ""},
+  {"transfer-encoding", ""},
+  {"user-agent", ""},
+  {"vary", ""},
+  {"via", ""},
+  {"www-authenticate", ""}
+};
+
+void corrupted(const char* what) {
+  throw TTransportException(TTransportException::CORRUPTED_DATA,
+                            std::string("HPACK: ") + what);
+}
+
+uint32_t huffmanLength(const std::string& str) {
+  uint64_t bits = 0;
+  for (size_t i = 0; i < str.size(); ++i) {
+    bits += HUFFMAN_CODES[static_cast<uint8_t>(str[i])].bits;
+  }
+  return static_cast<uint32_t>((bits + 7) / 8);
+}
+
+void huffmanEncode(const std::string& str, std::string* out) {
+  uint64_t acc = 0;
+  uint32_t accBits = 0;
+  for (size_t i = 0; i < str.size(); ++i) {
+    const THuffmanCode& c = HUFFMAN_CODES[static_cast<uint8_t>(str[i])];
+    acc = (acc << c.bits) | c.code;
+    accBits += c.bits;
+    while (accBits >= 8) {
+      accBits -= 8;
+      out->push_back(static_cast<char>(acc >> accBits));
+    }
+  }
+  if (accBits > 0) {
+    // Pad with the most significant bits of EOS, which are all ones
+    out->push_back(static_cast<char>((acc << (8 - accBits)) | (0xff >> accBits)));
+  }
+}
+
+void huffmanDecode(const uint8_t* data, uint32_t len, std::string* out) {
+  uint32_t code = 0;
+  uint32_t bits = 0;
+  for (uint32_t i = 0; i < len; ++i) {
+    for (int shift = 7; shift >= 0; --shift) {
+      code = (code << 1) | ((data[i] >> shift) & 1);
+      ++bits;
+      if (bits > 30) {
+        corrupted("bad Huffman code");
+      }
+      uint32_t offset = code - HUFFMAN_FIRST_CODE[bits];
+      if (HUFFMAN_COUNT[bits] > 0 && code >= HUFFMAN_FIRST_CODE[bits] &&
+          offset < HUFFMAN_COUNT[bits]) {
+        uint16_t symbol = HUFFMAN_SYMBOLS[HUFFMAN_FIRST_INDEX[bits] + offset];
+        if (symbol == HUFFMAN_EOS) {
+          corrupted("EOS in Huffman string");
+        }
+        out->push_back(static_cast<char>(symbol));
+        code = 0;
+        bits = 0;
+      }
+    }
+  }
+  // Whatever is left has to be a short prefix of EOS
+  if (bits > 7 || code != (1u << bits) - 1) {
+    corrupted("bad Huffman padding");
+  }
+}
+
+}
+
+THpackTable::THpackTable(uint32_t maxSize) :
+  size_(0),
+  maxSize_(maxSize) {
+}
+
+void THpackTable::add(const std::string& name, const std::string& value) {
+  uint32_t size = entrySize(name, value);
+  if (size > maxSize_) {
+    // Adding an entry larger than the table just empties it
+    evict(0);
+    return;
+  }
+  evict(maxSize_ - size);
+  entries_.push_front(THpackHeader(name, value));
+  size_ += size;
+}
+
+void THpackTable::setMaxSize(uint32_t maxSize) {
+  maxSize_ = maxSize;
+  evict(maxSize_);
+}
+
+void THpackTable::evict(uint32_t targetSize) {
+  while (size_ > targetSize) {
+    const THpackHeader& oldest = entries_.back();
+    size_ -= entrySize(oldest.first, oldest.second);
+    entries_.pop_back();
+  }
+}
+
+THpackEncoder::THpackEncoder(uint32_t maxTableSize) :
+  table_(maxTableSize),
+  limit_(maxTableSize),
+  sizeUpdatePending_(false) {
+}
+
+void THpackEncoder::setMaxTableSize(uint32_t maxTableSize) {
+  if (maxTableSize > limit_) {
+    maxTableSize = limit_;
+  }
+  if (maxTableSize != table_.getMaxSize()) {
+    table_.setMaxSize(maxTableSize);
+    sizeUpdatePending_ = true;
+  }
+}
+
+void THpackEncoder::encodeInteger(uint32_t value, uint8_t prefixBits, uint8_t flags, std::string* out) {
+  uint32_t max = (1u << prefixBits) - 1;
+  if (value < max) {
+    out->push_back(static_cast<char>(flags | value));
+    return;
+  }
+  out->push_back(static_cast<char>(flags | max));
+  value -= max;
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void THpackEncoder::encodeString(const std::string& str, std::string* out) {
+  uint32_t huffLen = huffmanLength(str);
+  if (huffLen < str.size()) {
+    encodeInteger(huffLen, 7, 0x80, out);
+    huffmanEncode(str, out);
+  } else {
+    encodeInteger(static_cast<uint32_t>(str.size()), 7, 0x00, out);
+    out->append(str);
+  }
+}
+
+void THpackEncoder::encode(const THpackHeaders& headers, std::string* out) {
+  if (sizeUpdatePending_) {
+    encodeInteger(table_.getMaxSize(), 5, 0x20, out);
+    sizeUpdatePending_ = false;
+  }
+
+  for (THpackHeaders::const_iterator it = headers.begin(); it != headers.end(); ++it) {
+    const std::string& name = it->first;
+    const std::string& value = it->second;
+
+    uint32_t fullIndex = 0;
+    uint32_t nameIndex = 0;
+    for (uint32_t i = 1; i <= STATIC_TABLE_SIZE && fullIndex == 0; ++i) {
+      if (name == STATIC_TABLE[i][0]) {
+        if (nameIndex == 0) {
+          nameIndex = i;
+        }
+        if (value == STATIC_TABLE[i][1]) {
+          fullIndex = i;
+        }
+      }
+    }
+    for (size_t i = 0; i < table_.getNumEntries() && fullIndex == 0; ++i) {
+      const THpackHeader& entry = table_.get(i);
+      if (entry.first == name) {
+        uint32_t index = static_cast<uint32_t>(STATIC_TABLE_SIZE + 1 + i);
+        if (nameIndex == 0) {
+          nameIndex = index;
+        }
+        if (entry.second == value) {
+          fullIndex = index;
+        }
+      }
+    }
+
+    if (fullIndex != 0) {
+      // Indexed Header Field
+      encodeInteger(fullIndex, 7, 0x80, out);
+      continue;
+    }
+
+    bool index = (name != "content-length") &&
+      THpackTable::entrySize(name, value) <= table_.getMaxSize();
+    if (index) {
+      // Literal Header Field with Incremental Indexing
+      encodeInteger(nameIndex, 6, 0x40, out);
+    } else {
+      // Literal Header Field without Indexing
+      encodeInteger(nameIndex, 4, 0x00, out);
+    }
+    if (nameIndex == 0) {
+      encodeString(name, out);
+    }
+    encodeString(value, out);
+    if (index) {
+      table_.add(name, value);
+    }
+  }
+}
+
+THpackDecoder::THpackDecoder(uint32_t maxTableSize) :
+  table_(maxTableSize),
+  limit_(maxTableSize),
+  maxHeaderListSize_(0) {
+}
+
+uint32_t THpackDecoder::decodeInteger(const uint8_t* data, uint32_t len, uint32_t* pos, uint8_t prefixBits) {
+  if (*pos >= len) {
+    corrupted("truncated integer");
+  }
+  uint32_t max = (1u << prefixBits) - 1;
+  uint32_t value = data[(*pos)++] & max;
+  if (value < max) {
+    return value;
+  }
+  uint32_t shift = 0;
+  while (true) {
+    if (*pos >= len) {
+      corrupted("truncated integer");
+    }
+    uint8_t b = data[(*pos)++];
+    if (shift > 28 || (shift == 28 && (b & 0x7f) > 0x0f)) {
+      corrupted("integer overflow");
+    }
+    uint64_t next = value + (static_cast<uint64_t>(b & 0x7f) << shift);
+    if (next > 0xffffffffULL) {
+      corrupted("integer overflow");
+    }
+    value = static_cast<uint32_t>(next);
+    if ((b & 0x80) == 0) {
+      return value;
+    }
+    shift += 7;
+  }
+}
+
+void THpackDecoder::decodeString(const uint8_t* data, uint32_t len, uint32_t* pos, std::string* str) {
+  if (*pos >= len) {
+    corrupted("truncated string");
+  }
+  bool huffman = (data[*pos] & 0x80) != 0;
+  uint32_t strLen = decodeInteger(data, len, pos, 7);
+  if (strLen > len - *pos) {
+    corrupted("truncated string");
+  }
+  str->clear();
+  if (huffman) {
+    huffmanDecode(data + *pos, strLen, str);
+  } else {
+    str->assign(reinterpret_cast<const char*>(data + *pos), strLen);
+  }
+  *pos += strLen;
+}
+
+void THpackDecoder::lookup(uint32_t index, std::string* name, std::string* value) const {
+  if (index == 0) {
+    corrupted("index 0");
+  }
+  if (index <= STATIC_TABLE_SIZE) {
+    name->assign(STATIC_TABLE[index][0]);
+    if (value != NULL) {
+      value->assign(STATIC_TABLE[index][1]);
+    }
+    return;
+  }
+  index -= STATIC_TABLE_SIZE + 1;
+  if (index >= table_.getNumEntries()) {
+    corrupted("index past the dynamic table");
+  }
+  const THpackHeader& entry = table_.get(index);
+  name->assign(entry.first);
+  if (value != NULL) {
+    value->assign(entry.second);
+  }
+}
+
+void THpackDecoder::decode(const uint8_t* data, uint32_t len, THpackHeaders* headers) {
+  uint32_t pos = 0;
+  uint32_t listSize = 0;
+  bool fieldSeen = false;
+  std::string name;
+  std::string value;
+
+  while (pos < len) {
+    uint8_t b = data[pos];
+    if (b & 0x80) {
+      // Indexed Header Field
+      lookup(decodeInteger(data, len, &pos, 7), &name, &value);
+    } else if ((b & 0xe0) == 0x20) {
+      // Dynamic Table Size Update, only allowed ahead of the first field
+      uint32_t size = decodeInteger(data, len, &pos, 5);
+      if (fieldSeen || size > limit_) {
+        corrupted("bad table size update");
+      }
+      table_.setMaxSize(size);
+      continue;
+    } else {
+      // Literal Header Field with Incremental Indexing (01), without
+      // Indexing (0000) or Never Indexed (0001)
+      bool index = (b & 0xc0) == 0x40;
+      uint32_t nameIndex = decodeInteger(data, len, &pos, index ? 6 : 4);
+      if (nameIndex == 0) {
+        decodeString(data, len, &pos, &name);
+      } else {
+        lookup(nameIndex, &name, NULL);
+      }
+      decodeString(data, len, &pos, &value);
+      if (index) {
+        table_.add(name, value);
+      }
+    }
+
+    fieldSeen = true;
+    listSize += THpackTable::entrySize(name, value);
+    if (maxHeaderListSize_ > 0 && listSize > maxHeaderListSize_) {
+      corrupted("header list too large");
+    }
+    headers->push_back(THpackHeader(name, value));
+  }
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,142 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_THPACK_H_
+#define _THRIFT_TRANSPORT_THPACK_H_ 1
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include <thrift/Thrift.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * A header field as HPACK sees it: a lower case name and a value.
+ */
+typedef std::pair<std::string, std::string> THpackHeader;
+typedef std::vector<THpackHeader> THpackHeaders;
+
+/**
+ * The dynamic table shared by the two ends of one direction of an HTTP/2
+ * connection (RFC 7541 section 2.3.2).  Index 0 is the newest entry.
+ */
+class THpackTable {
+ public:
+  static const uint32_t DEFAULT_MAX_SIZE = 4096;
+
+  THpackTable(uint32_t maxSize = DEFAULT_MAX_SIZE);
+
+  // Size of an entry as accounted by RFC 7541 section 4.1
+  static uint32_t entrySize(const std::string& name, const std::string& value) {
+    return static_cast<uint32_t>(name.size() + value.size() + 32);
+  }
+
+  void add(const std::string& name, const std::string& value);
+  void setMaxSize(uint32_t maxSize);
+
+  uint32_t getMaxSize() const {
+    return maxSize_;
+  }
+  uint32_t getSize() const {
+    return size_;
+  }
+  size_t getNumEntries() const {
+    return entries_.size();
+  }
+  const THpackHeader& get(size_t i) const {
+    return entries_[i];
+  }
+
+ private:
+  void evict(uint32_t targetSize);
+
+  std::deque<THpackHeader> entries_;
+  uint32_t size_;
+  uint32_t maxSize_;
+};
+
+/**
+ * Compresses header lists for one direction of a connection.
+ *
+ * Static table matches are sent as one byte, and other headers are entered
+ * into the dynamic table so that repeating them on later requests of the
+ * same connection costs one or two bytes each.  Values that differ from
+ * message to message (content-length) are never indexed, and strings are
+ * Huffman coded when that is shorter.
+ */
+class THpackEncoder {
+ public:
+  THpackEncoder(uint32_t maxTableSize = THpackTable::DEFAULT_MAX_SIZE);
+
+  /**
+   * Called with the peer's SETTINGS_HEADER_TABLE_SIZE.  The table never
+   * grows past the size given to the constructor, and a change is signalled
+   * at the start of the next header block.
+   */
+  void setMaxTableSize(uint32_t maxTableSize);
+
+  void encode(const THpackHeaders& headers, std::string* out);
+
+  static void encodeInteger(uint32_t value, uint8_t prefixBits, uint8_t flags, std::string* out);
+  static void encodeString(const std::string& str, std::string* out);
+
+ private:
+  THpackTable table_;
+  uint32_t limit_;
+  bool sizeUpdatePending_;
+};
+
+/**
+ * Decompresses header blocks for one direction of a connection.  Any
+ * malformed block throws TTransportException(CORRUPTED_DATA); once that
+ * happens the table is out of sync and the connection has to go.
+ */
+class THpackDecoder {
+ public:
+  THpackDecoder(uint32_t maxTableSize = THpackTable::DEFAULT_MAX_SIZE);
+
+  /**
+   * Fails blocks that expand to more than maxHeaderListSize bytes, counted
+   * as for SETTINGS_MAX_HEADER_LIST_SIZE.  0 means no limit.
+   */
+  void setMaxHeaderListSize(uint32_t maxHeaderListSize) {
+    maxHeaderListSize_ = maxHeaderListSize;
+  }
+
+  void decode(const uint8_t* data, uint32_t len, THpackHeaders* headers);
+
+  // Read an integer with the given prefix at *pos, advancing it
+  static uint32_t decodeInteger(const uint8_t* data, uint32_t len, uint32_t* pos, uint8_t prefixBits);
+  static void decodeString(const uint8_t* data, uint32_t len, uint32_t* pos, std::string* str);
+
+ private:
+  // value may be NULL when only the name is wanted
+  void lookup(uint32_t index, std::string* name, std::string* value) const;
+
+  THpackTable table_;
+  // the SETTINGS_HEADER_TABLE_SIZE we announced, which bounds size updates
+  uint32_t limit_;
+  uint32_t maxHeaderListSize_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_THPACK_H_
@@ -0,0 +1,747 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/transport/THttp2Session.h>
+#include <thrift/transport/TTransportException.h>
+
+#include <cstring>
+
+namespace apache { namespace thrift { namespace transport {
+
+const char* THttp2Session::CONNECTION_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+namespace {
+
+const uint8_t FLAG_END_STREAM = 0x1;
+const uint8_t FLAG_ACK = 0x1;
+const uint8_t FLAG_END_HEADERS = 0x4;
+const uint8_t FLAG_PADDED = 0x8;
+const uint8_t FLAG_PRIORITY = 0x20;
+
+const uint32_t FRAME_HEADER_SIZE = 9;
+const uint32_t DEFAULT_WINDOW_SIZE = 65535;
+const uint32_t DEFAULT_MAX_FRAME_SIZE = 16384;
+const uint32_t MAX_WINDOW_SIZE = 0x7fffffff;
+const uint32_t MAX_STREAM_ID = 0x7fffffff;
+
+// What we grant the peer.  Bodies are buffered whole anyway, so windows
+// are only there to keep a fast sender from running away with memory;
+// they are topped up once half used.
+const uint32_t LOCAL_STREAM_WINDOW = 1024 * 1024;
+const uint32_t LOCAL_CONNECTION_WINDOW = 16 * 1024 * 1024;
+const uint32_t LOCAL_MAX_HEADER_LIST_SIZE = 64 * 1024;
+
+uint32_t readUInt32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+    (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+void writeUInt32(std::string* out, uint32_t v) {
+  out->push_back(static_cast<char>(v >> 24));
+  out->push_back(static_cast<char>(v >> 16));
+  out->push_back(static_cast<char>(v >> 8));
+  out->push_back(static_cast<char>(v));
+}
+
+void writeSetting(std::string* out, uint16_t id, uint32_t value) {
+  out->push_back(static_cast<char>(id >> 8));
+  out->push_back(static_cast<char>(id));
+  writeUInt32(out, value);
+}
+
+// Strip the Pad Length field and padding of a PADDED frame
+bool stripPadding(uint8_t flags, const uint8_t** payload, uint32_t* len) {
+  if (!(flags & FLAG_PADDED)) {
+    return true;
+  }
+  if (*len < 1) {
+    return false;
+  }
+  uint32_t padLen = (*payload)[0];
+  if (padLen >= *len) {
+    return false;
+  }
+  *payload += 1;
+  *len -= 1 + padLen;
+  return true;
+}
+
+}
+
+THttp2Session::THttp2Session(Role role) :
+  role_(role),
+  encoder_(),
+  decoder_(),
+  nextStreamId_(role == CLIENT ? 1 : 2),
+  lastPeerStreamId_(0),
+  continuationStream_(0),
+  continuationEndStream_(false),
+  maxConcurrentStreams_(DEFAULT_MAX_CONCURRENT_STREAMS),
+  maxMessageSize_(DEFAULT_MAX_MESSAGE_SIZE),
+  peerMaxConcurrentStreams_(DEFAULT_MAX_CONCURRENT_STREAMS),
+  peerInitialWindowSize_(DEFAULT_WINDOW_SIZE),
+  peerMaxFrameSize_(DEFAULT_MAX_FRAME_SIZE),
+  connSendWindow_(DEFAULT_WINDOW_SIZE),
+  connRecvWindow_(DEFAULT_WINDOW_SIZE),
+  prefaceReceived_(role == CLIENT),
+  goAwaySent_(false),
+  goAwayReceived_(false),
+  failed_(false),
+  outPos_(0) {
+  decoder_.setMaxHeaderListSize(LOCAL_MAX_HEADER_LIST_SIZE);
+}
+
+void THttp2Session::start() {
+  if (role_ == CLIENT) {
+    out_.append(CONNECTION_PREFACE, CONNECTION_PREFACE_LEN);
+  }
+
+  std::string settings;
+  if (role_ == CLIENT) {
+    writeSetting(&settings, SETTINGS_ENABLE_PUSH, 0);
+  }
+  writeSetting(&settings, SETTINGS_MAX_CONCURRENT_STREAMS, maxConcurrentStreams_);
+  writeSetting(&settings, SETTINGS_INITIAL_WINDOW_SIZE, LOCAL_STREAM_WINDOW);
+  writeSetting(&settings, SETTINGS_MAX_HEADER_LIST_SIZE, LOCAL_MAX_HEADER_LIST_SIZE);
+  writeFrameHeader(static_cast<uint32_t>(settings.size()), FRAME_SETTINGS, 0, 0);
+  out_.append(settings);
+
+  writeWindowUpdate(0, LOCAL_CONNECTION_WINDOW - DEFAULT_WINDOW_SIZE);
+  connRecvWindow_ = LOCAL_CONNECTION_WINDOW;
+}
+
+void THttp2Session::receive(const uint8_t* data, uint32_t len) {
+  if (failed_) {
+    return;
+  }
+  in_.append(reinterpret_cast<const char*>(data), len);
+
+  size_t pos = 0;
+  if (!prefaceReceived_) {
+    size_t have = in_.size() < CONNECTION_PREFACE_LEN ? in_.size() : CONNECTION_PREFACE_LEN;
+    if (memcmp(in_.data(), CONNECTION_PREFACE, have) != 0) {
+      connectionError(H2_PROTOCOL_ERROR, "bad connection preface");
+    }
+    if (have < CONNECTION_PREFACE_LEN) {
+      return;
+    }
+    prefaceReceived_ = true;
+    pos = CONNECTION_PREFACE_LEN;
+  }
+
+  while (!failed_ && in_.size() - pos >= FRAME_HEADER_SIZE) {
+    const uint8_t* header = reinterpret_cast<const uint8_t*>(in_.data() + pos);
+    uint32_t frameLen = (static_cast<uint32_t>(header[0]) << 16) |
+      (static_cast<uint32_t>(header[1]) << 8) | header[2];
+    if (frameLen > DEFAULT_MAX_FRAME_SIZE) {
+      connectionError(H2_FRAME_SIZE_ERROR, "frame too large");
+    }
+    if (in_.size() - pos - FRAME_HEADER_SIZE < frameLen) {
+      break;
+    }
+    uint8_t type = header[3];
+    uint8_t flags = header[4];
+    uint32_t streamId = readUInt32(header + 5) & MAX_STREAM_ID;
+
+    // The frame is copied out, since callbacks may feed us more data
+    std::string payload(in_, pos + FRAME_HEADER_SIZE, frameLen);
+    pos += FRAME_HEADER_SIZE + frameLen;
+    handleFrame(type, flags, streamId,
+                reinterpret_cast<const uint8_t*>(payload.data()), frameLen);
+  }
+  in_.erase(0, pos);
+}
+
+void THttp2Session::handleFrame(uint8_t type, uint8_t flags, uint32_t streamId,
+                                const uint8_t* payload, uint32_t len) {
+  if (continuationStream_ != 0 &&
+      (type != FRAME_CONTINUATION || streamId != continuationStream_)) {
+    connectionError(H2_PROTOCOL_ERROR, "expected CONTINUATION");
+  }
+
+  switch (type) {
+  case FRAME_DATA:
+    handleData(flags, streamId, payload, len);
+    break;
+
+  case FRAME_HEADERS:
+    handleHeaders(flags, streamId, payload, len);
+    break;
+
+  case FRAME_CONTINUATION:
+    if (continuationStream_ == 0 || streamId != continuationStream_) {
+      connectionError(H2_PROTOCOL_ERROR, "unexpected CONTINUATION");
+    }
+    headerBlock_.append(reinterpret_cast<const char*>(payload), len);
+    if (headerBlock_.size() > LOCAL_MAX_HEADER_LIST_SIZE * 2) {
+      connectionError(H2_ENHANCE_YOUR_CALM, "header block too large");
+    }
+    if (flags & FLAG_END_HEADERS) {
+      continuationStream_ = 0;
+      processHeaderBlock(streamId, continuationEndStream_);
+    }
+    break;
+
+  case FRAME_PRIORITY:
+    if (streamId == 0) {
+      connectionError(H2_PROTOCOL_ERROR, "PRIORITY on stream 0");
+    }
+    if (len != 5) {
+      streamError(streamId, H2_FRAME_SIZE_ERROR);
+    }
+    break;
+
+  case FRAME_RST_STREAM: {
+    if (streamId == 0) {
+      connectionError(H2_PROTOCOL_ERROR, "RST_STREAM on stream 0");
+    }
+    if (len != 4) {
+      connectionError(H2_FRAME_SIZE_ERROR, "bad RST_STREAM");
+    }
+    StreamMap::iterator it = streams_.find(streamId);
+    if (it != streams_.end()) {
+      streams_.erase(it);
+      if (streamErrorCallback_) {
+        streamErrorCallback_(streamId, readUInt32(payload));
+      }
+    }
+    break;
+  }
+
+  case FRAME_SETTINGS:
+    handleSettings(flags, streamId, payload, len);
+    break;
+
+  case FRAME_PUSH_PROMISE:
+    // We announce SETTINGS_ENABLE_PUSH 0, and clients never push
+    connectionError(H2_PROTOCOL_ERROR, "unexpected PUSH_PROMISE");
+    break;
+
+  case FRAME_PING:
+    if (streamId != 0) {
+      connectionError(H2_PROTOCOL_ERROR, "PING on a stream");
+    }
+    if (len != 8) {
+      connectionError(H2_FRAME_SIZE_ERROR, "bad PING");
+    }
+    if (!(flags & FLAG_ACK)) {
+      writeFrameHeader(8, FRAME_PING, FLAG_ACK, 0);
+      out_.append(reinterpret_cast<const char*>(payload), 8);
+    }
+    break;
+
+  case FRAME_GOAWAY:
+    if (streamId != 0) {
+      connectionError(H2_PROTOCOL_ERROR, "GOAWAY on a stream");
+    }
+    handleGoAway(payload, len);
+    break;
+
+  case FRAME_WINDOW_UPDATE:
+    handleWindowUpdate(streamId, payload, len);
+    break;
+
+  default:
+    // Unknown frame types must be ignored
+    break;
+  }
+}
+
+void THttp2Session::handleData(uint8_t flags, uint32_t streamId,
+                               const uint8_t* payload, uint32_t len) {
+  if (streamId == 0) {
+    connectionError(H2_PROTOCOL_ERROR, "DATA on stream 0");
+  }
+
+  // The whole frame counts against flow control, padding included
+  if (len > connRecvWindow_) {
+    connectionError(H2_FLOW_CONTROL_ERROR, "connection window exceeded");
+  }
+  connRecvWindow_ -= len;
+  if (connRecvWindow_ < LOCAL_CONNECTION_WINDOW / 2) {
+    writeWindowUpdate(0, static_cast<uint32_t>(LOCAL_CONNECTION_WINDOW - connRecvWindow_));
+    connRecvWindow_ = LOCAL_CONNECTION_WINDOW;
+  }
+
+  uint32_t frameLen = len;
+  if (!stripPadding(flags, &payload, &len)) {
+    connectionError(H2_PROTOCOL_ERROR, "bad padding");
+  }
+
+  StreamMap::iterator it = streams_.find(streamId);
+  if (it == streams_.end() || it->second.remoteClosed || !it->second.headersDone) {
+    if (it == streams_.end() && streamId > lastPeerStreamId_ && (streamId & 1) != (nextStreamId_ & 1)) {
+      connectionError(H2_PROTOCOL_ERROR, "DATA on an idle stream");
+    }
+    if (it == streams_.end()) {
+      // Probably one we reset that the peer hadn't heard about yet
+      writeRstStream(streamId, H2_STREAM_CLOSED);
+    } else {
+      streamError(streamId, it->second.remoteClosed ? H2_STREAM_CLOSED : H2_PROTOCOL_ERROR);
+    }
+    return;
+  }
+
+  Stream& stream = it->second;
+  if (frameLen > stream.recvWindow) {
+    streamError(streamId, H2_FLOW_CONTROL_ERROR);
+    return;
+  }
+  stream.recvWindow -= frameLen;
+  if (stream.body.size() + len > maxMessageSize_) {
+    streamError(streamId, H2_CANCEL);
+    return;
+  }
+  stream.body.append(reinterpret_cast<const char*>(payload), len);
+
+  if (flags & FLAG_END_STREAM) {
+    stream.remoteClosed = true;
+    deliverMessage(it);
+  } else if (stream.recvWindow < LOCAL_STREAM_WINDOW / 2) {
+    writeWindowUpdate(streamId, static_cast<uint32_t>(LOCAL_STREAM_WINDOW - stream.recvWindow));
+    stream.recvWindow = LOCAL_STREAM_WINDOW;
+  }
+}
+
+void THttp2Session::handleHeaders(uint8_t flags, uint32_t streamId,
+                                  const uint8_t* payload, uint32_t len) {
+  if (streamId == 0) {
+    connectionError(H2_PROTOCOL_ERROR, "HEADERS on stream 0");
+  }
+  if (!stripPadding(flags, &payload, &len)) {
+    connectionError(H2_PROTOCOL_ERROR, "bad padding");
+  }
+  if (flags & FLAG_PRIORITY) {
+    if (len < 5) {
+      connectionError(H2_FRAME_SIZE_ERROR, "bad HEADERS");
+    }
+    payload += 5;
+    len -= 5;
+  }
+
+  headerBlock_.assign(reinterpret_cast<const char*>(payload), len);
+  bool endStream = (flags & FLAG_END_STREAM) != 0;
+  if (flags & FLAG_END_HEADERS) {
+    processHeaderBlock(streamId, endStream);
+  } else {
+    continuationStream_ = streamId;
+    continuationEndStream_ = endStream;
+  }
+}
+
+void THttp2Session::processHeaderBlock(uint32_t streamId, bool endStream) {
+  // Always decode, or the dynamic table would go out of sync
+  THpackHeaders headers;
+  try {
+    decoder_.decode(reinterpret_cast<const uint8_t*>(headerBlock_.data()),
+                    static_cast<uint32_t>(headerBlock_.size()), &headers);
+  } catch (const TTransportException& e) {
+    connectionError(H2_COMPRESSION_ERROR, e.what());
+  }
+  headerBlock_.clear();
+
+  StreamMap::iterator it = streams_.find(streamId);
+  if (it == streams_.end()) {
+    if (role_ == CLIENT || (streamId & 1) == 0) {
+      if (streamId >= nextStreamId_) {
+        connectionError(H2_PROTOCOL_ERROR, "HEADERS on an idle stream");
+      }
+      // A stream we've already given up on
+      return;
+    }
+    if (streamId <= lastPeerStreamId_) {
+      connectionError(H2_STREAM_CLOSED, "HEADERS on a closed stream");
+    }
+    lastPeerStreamId_ = streamId;
+    if (goAwaySent_) {
+      return;
+    }
+    if (streams_.size() >= maxConcurrentStreams_) {
+      writeRstStream(streamId, H2_REFUSED_STREAM);
+      return;
+    }
+    it = streams_.insert(StreamMap::value_type(
+        streamId, Stream(peerInitialWindowSize_, LOCAL_STREAM_WINDOW))).first;
+  }
+
+  Stream& stream = it->second;
+  if (stream.remoteClosed) {
+    streamError(streamId, H2_STREAM_CLOSED);
+    return;
+  }
+
+  if (stream.headersDone) {
+    // Trailers, which have to end the stream and are of no interest to us
+    if (!endStream) {
+      streamError(streamId, H2_PROTOCOL_ERROR);
+      return;
+    }
+  } else {
+    // Interim responses (100 Continue and the like) are skipped
+    bool interim = false;
+    if (role_ == CLIENT) {
+      for (THpackHeaders::const_iterator h = headers.begin(); h != headers.end(); ++h) {
+        if (h->first == ":status") {
+          interim = !h->second.empty() && h->second[0] == '1';
+          break;
+        }
+      }
+    }
+    if (interim) {
+      if (endStream) {
+        streamError(streamId, H2_PROTOCOL_ERROR);
+      }
+      return;
+    }
+    stream.headers.swap(headers);
+    stream.headersDone = true;
+  }
+
+  if (endStream) {
+    stream.remoteClosed = true;
+    deliverMessage(it);
+  }
+}
+
+void THttp2Session::deliverMessage(StreamMap::iterator it) {
+  uint32_t streamId = it->first;
+  Stream& stream = it->second;
+
+  THpackHeaders headers;
+  std::string body;
+  headers.swap(stream.headers);
+  body.swap(stream.body);
+
+  if (role_ == CLIENT) {
+    // Done with the stream, even if the server answered before taking all
+    // of the request
+    if (!stream.localClosed) {
+      writeRstStream(streamId, H2_NO_ERROR);
+    }
+    streams_.erase(it);
+  } else if (stream.localClosed) {
+    streams_.erase(it);
+  }
+
+  if (messageCallback_) {
+    messageCallback_(streamId, headers, body);
+  }
+}
+
+void THttp2Session::handleSettings(uint8_t flags, uint32_t streamId,
+                                   const uint8_t* payload, uint32_t len) {
+  if (streamId != 0) {
+    connectionError(H2_PROTOCOL_ERROR, "SETTINGS on a stream");
+  }
+  if (flags & FLAG_ACK) {
+    if (len != 0) {
+      connectionError(H2_FRAME_SIZE_ERROR, "bad SETTINGS ack");
+    }
+    return;
+  }
+  if (len % 6 != 0) {
+    connectionError(H2_FRAME_SIZE_ERROR, "bad SETTINGS");
+  }
+
+  for (uint32_t i = 0; i < len; i += 6) {
+    uint16_t id = static_cast<uint16_t>((payload[i] << 8) | payload[i + 1]);
+    uint32_t value = readUInt32(payload + i + 2);
+    switch (id) {
+    case SETTINGS_HEADER_TABLE_SIZE:
+      encoder_.setMaxTableSize(value);
+      break;
+    case SETTINGS_ENABLE_PUSH:
+      if (value > 1) {
+        connectionError(H2_PROTOCOL_ERROR, "bad SETTINGS_ENABLE_PUSH");
+      }
+      break;
+    case SETTINGS_MAX_CONCURRENT_STREAMS:
+      peerMaxConcurrentStreams_ = value;
+      break;
+    case SETTINGS_INITIAL_WINDOW_SIZE: {
+      if (value > MAX_WINDOW_SIZE) {
+        connectionError(H2_FLOW_CONTROL_ERROR, "bad SETTINGS_INITIAL_WINDOW_SIZE");
+      }
+      // Applies to the streams already open as well
+      int64_t delta = static_cast<int64_t>(value) - peerInitialWindowSize_;
+      for (StreamMap::iterator it = streams_.begin(); it != streams_.end(); ++it) {
+        it->second.sendWindow += delta;
+        if (it->second.sendWindow > MAX_WINDOW_SIZE) {
+          connectionError(H2_FLOW_CONTROL_ERROR, "stream window overflow");
+        }
+      }
+      peerInitialWindowSize_ = value;
+      break;
+    }
+    case SETTINGS_MAX_FRAME_SIZE:
+      if (value < DEFAULT_MAX_FRAME_SIZE || value > 0xffffff) {
+        connectionError(H2_PROTOCOL_ERROR, "bad SETTINGS_MAX_FRAME_SIZE");
+      }
+      peerMaxFrameSize_ = value;
+      break;
+    default:
+      // SETTINGS_MAX_HEADER_LIST_SIZE is advisory; unknown ones are ignored
+      break;
+    }
+  }
+
+  writeFrameHeader(0, FRAME_SETTINGS, FLAG_ACK, 0);
+  sendPendingData();
+}
+
+void THttp2Session::handleGoAway(const uint8_t* payload, uint32_t len) {
+  if (len < 8) {
+    connectionError(H2_FRAME_SIZE_ERROR, "bad GOAWAY");
+  }
+  uint32_t lastStreamId = readUInt32(payload) & MAX_STREAM_ID;
+  goAwayReceived_ = true;
+
+  // Streams we opened past lastStreamId were never seen, and can be retried
+  std::vector<uint32_t> refused;
+  for (StreamMap::iterator it = streams_.upper_bound(lastStreamId); it != streams_.end(); ) {
+    if ((it->first & 1) == (nextStreamId_ & 1)) {
+      refused.push_back(it->first);
+      streams_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+  if (streamErrorCallback_) {
+    for (size_t i = 0; i < refused.size(); ++i) {
+      streamErrorCallback_(refused[i], H2_REFUSED_STREAM);
+    }
+  }
+}
+
+void THttp2Session::handleWindowUpdate(uint32_t streamId, const uint8_t* payload, uint32_t len) {
+  if (len != 4) {
+    connectionError(H2_FRAME_SIZE_ERROR, "bad WINDOW_UPDATE");
+  }
+  uint32_t increment = readUInt32(payload) & MAX_WINDOW_SIZE;
+
+  if (streamId == 0) {
+    if (increment == 0) {
+      connectionError(H2_PROTOCOL_ERROR, "zero WINDOW_UPDATE");
+    }
+    connSendWindow_ += increment;
+    if (connSendWindow_ > MAX_WINDOW_SIZE) {
+      connectionError(H2_FLOW_CONTROL_ERROR, "connection window overflow");
+    }
+  } else {
+    StreamMap::iterator it = streams_.find(streamId);
+    if (it == streams_.end()) {
+      return;
+    }
+    if (increment == 0) {
+      streamError(streamId, H2_PROTOCOL_ERROR);
+      return;
+    }
+    it->second.sendWindow += increment;
+    if (it->second.sendWindow > MAX_WINDOW_SIZE) {
+      streamError(streamId, H2_FLOW_CONTROL_ERROR);
+      return;
+    }
+  }
+  sendPendingData();
+}
+
+bool THttp2Session::canSubmitRequest() const {
+  return role_ == CLIENT && !failed_ && !isGoingAway() &&
+    nextStreamId_ <= MAX_STREAM_ID && streams_.size() < peerMaxConcurrentStreams_;
+}
+
+uint32_t THttp2Session::submitRequest(const THpackHeaders& headers,
+                                      const uint8_t* body, uint32_t len) {
+  if (!canSubmitRequest()) {
+    throw TTransportException(TTransportException::INTERNAL_ERROR,
+                              "THttp2Session: no stream available");
+  }
+  uint32_t streamId = nextStreamId_;
+  nextStreamId_ += 2;
+
+  StreamMap::iterator it = streams_.insert(StreamMap::value_type(
+      streamId, Stream(peerInitialWindowSize_, LOCAL_STREAM_WINDOW))).first;
+  writeHeaders(streamId, headers, len == 0);
+  queueBody(it, body, len);
+  return streamId;
+}
+
+void THttp2Session::submitResponse(uint32_t streamId, const THpackHeaders& headers,
+                                   const uint8_t* body, uint32_t len) {
+  StreamMap::iterator it = streams_.find(streamId);
+  if (failed_ || it == streams_.end() || it->second.localClosed) {
+    return;
+  }
+  writeHeaders(streamId, headers, len == 0);
+  queueBody(it, body, len);
+}
+
+void THttp2Session::queueBody(StreamMap::iterator it, const uint8_t* body, uint32_t len) {
+  if (len == 0) {
+    // The HEADERS frame carried END_STREAM
+    it->second.localClosed = true;
+    if (it->second.remoteClosed) {
+      streams_.erase(it);
+    }
+    return;
+  }
+  it->second.pending.assign(reinterpret_cast<const char*>(body), len);
+  it->second.pendingPos = 0;
+  sendPendingData();
+}
+
+void THttp2Session::sendPendingData() {
+  StreamMap::iterator it = streams_.begin();
+  while (it != streams_.end() && connSendWindow_ > 0) {
+    Stream& stream = it->second;
+    while (stream.pendingPos < stream.pending.size() &&
+           stream.sendWindow > 0 && connSendWindow_ > 0) {
+      int64_t n = stream.pending.size() - stream.pendingPos;
+      if (n > stream.sendWindow) {
+        n = stream.sendWindow;
+      }
+      if (n > connSendWindow_) {
+        n = connSendWindow_;
+      }
+      if (n > peerMaxFrameSize_) {
+        n = peerMaxFrameSize_;
+      }
+      bool last = stream.pendingPos + n == stream.pending.size();
+      writeFrameHeader(static_cast<uint32_t>(n), FRAME_DATA, last ? FLAG_END_STREAM : 0, it->first);
+      out_.append(stream.pending, stream.pendingPos, static_cast<size_t>(n));
+      stream.pendingPos += static_cast<size_t>(n);
+      stream.sendWindow -= n;
+      connSendWindow_ -= n;
+      if (last) {
+        stream.pending.clear();
+        stream.pendingPos = 0;
+        stream.localClosed = true;
+        break;
+      }
+    }
+    if (stream.localClosed && stream.remoteClosed) {
+      streams_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void THttp2Session::resetStream(uint32_t streamId, uint32_t errorCode) {
+  StreamMap::iterator it = streams_.find(streamId);
+  if (it == streams_.end()) {
+    return;
+  }
+  streams_.erase(it);
+  writeRstStream(streamId, errorCode);
+}
+
+void THttp2Session::goAway(uint32_t errorCode) {
+  if (!goAwaySent_) {
+    writeGoAway(errorCode);
+  }
+}
+
+void THttp2Session::connectionError(uint32_t errorCode, const std::string& what) {
+  if (!goAwaySent_) {
+    writeGoAway(errorCode);
+  }
+  failed_ = true;
+  in_.clear();
+  throw TTransportException(TTransportException::CORRUPTED_DATA, "THttp2Session: " + what);
+}
+
+void THttp2Session::streamError(uint32_t streamId, uint32_t errorCode) {
+  streams_.erase(streamId);
+  writeRstStream(streamId, errorCode);
+  if (streamErrorCallback_) {
+    streamErrorCallback_(streamId, errorCode);
+  }
+}
+
+void THttp2Session::writeFrameHeader(uint32_t len, uint8_t type, uint8_t flags, uint32_t streamId) {
+  out_.push_back(static_cast<char>(len >> 16));
+  out_.push_back(static_cast<char>(len >> 8));
+  out_.push_back(static_cast<char>(len));
+  out_.push_back(static_cast<char>(type));
+  out_.push_back(static_cast<char>(flags));
+  writeUInt32(&out_, streamId);
+}
+
+void THttp2Session::writeHeaders(uint32_t streamId, const THpackHeaders& headers, bool endStream) {
+  std::string block;
+  encoder_.encode(headers, &block);
+
+  // HEADERS, then as many CONTINUATION frames as the peer's frame size needs
+  size_t pos = 0;
+  uint8_t type = FRAME_HEADERS;
+  uint8_t flags = endStream ? FLAG_END_STREAM : 0;
+  do {
+    size_t n = block.size() - pos;
+    if (n > peerMaxFrameSize_) {
+      n = peerMaxFrameSize_;
+    }
+    if (pos + n == block.size()) {
+      flags |= FLAG_END_HEADERS;
+    }
+    writeFrameHeader(static_cast<uint32_t>(n), type, flags, streamId);
+    out_.append(block, pos, n);
+    pos += n;
+    type = FRAME_CONTINUATION;
+    flags = 0;
+  } while (pos < block.size());
+}
+
+void THttp2Session::writeWindowUpdate(uint32_t streamId, uint32_t increment) {
+  writeFrameHeader(4, FRAME_WINDOW_UPDATE, 0, streamId);
+  writeUInt32(&out_, increment);
+}
+
+void THttp2Session::writeRstStream(uint32_t streamId, uint32_t errorCode) {
+  writeFrameHeader(4, FRAME_RST_STREAM, 0, streamId);
+  writeUInt32(&out_, errorCode);
+}
+
+void THttp2Session::writeGoAway(uint32_t errorCode) {
+  writeFrameHeader(8, FRAME_GOAWAY, 0, 0);
+  writeUInt32(&out_, lastPeerStreamId_);
+  writeUInt32(&out_, errorCode);
+  goAwaySent_ = true;
+}
+
+const uint8_t* THttp2Session::getOutput(uint32_t* len) const {
+  *len = static_cast<uint32_t>(out_.size() - outPos_);
+  if (*len == 0) {
+    return NULL;
+  }
+  return reinterpret_cast<const uint8_t*>(out_.data() + outPos_);
+}
+
+void THttp2Session::consumeOutput(uint32_t len) {
+  outPos_ += len;
+  if (outPos_ >= out_.size()) {
+    out_.clear();
+    outPos_ = 0;
+  } else if (outPos_ > 64 * 1024 && outPos_ > out_.size() / 2) {
+    out_.erase(0, outPos_);
+    outPos_ = 0;
+  }
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,290 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_THTTP2SESSION_H_
+#define _THRIFT_TRANSPORT_THTTP2SESSION_H_ 1
+
+#include <map>
+#include <string>
+#include <thrift/cxxfunctional.h>
+#include <thrift/transport/THpack.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * One end of an HTTP/2 connection (RFC 7540), without any IO of its own.
+ *
+ * Bytes read from the socket go into receive(), and whatever the session
+ * wants sent is picked up with getOutput()/consumeOutput().  Requests and
+ * responses are whole messages: a message's body is collected until the
+ * peer ends its stream and is then handed to the message callback, while
+ * outgoing bodies are sent as the peer's flow control windows allow.  Any
+ * number of streams can be in flight at once, up to the limit the peer
+ * announced, which is what lets many calls share one connection.
+ *
+ * Only cleartext connections with prior knowledge ("h2c" without the
+ * HTTP/1.1 upgrade dance) are handled; server push is disabled and
+ * priorities are ignored.
+ *
+ * Connection errors queue a GOAWAY and throw TTransportException; the
+ * caller should write out what is pending and close the connection.  Not
+ * thread safe.
+ */
+class THttp2Session {
+ public:
+  enum Role {
+    CLIENT,
+    SERVER
+  };
+
+  // RFC 7540 section 7
+  enum ErrorCode {
+    H2_NO_ERROR = 0x0,
+    H2_PROTOCOL_ERROR = 0x1,
+    H2_INTERNAL_ERROR = 0x2,
+    H2_FLOW_CONTROL_ERROR = 0x3,
+    H2_SETTINGS_TIMEOUT = 0x4,
+    H2_STREAM_CLOSED = 0x5,
+    H2_FRAME_SIZE_ERROR = 0x6,
+    H2_REFUSED_STREAM = 0x7,
+    H2_CANCEL = 0x8,
+    H2_COMPRESSION_ERROR = 0x9,
+    H2_CONNECT_ERROR = 0xa,
+    H2_ENHANCE_YOUR_CALM = 0xb,
+    H2_INADEQUATE_SECURITY = 0xc,
+    H2_HTTP_1_1_REQUIRED = 0xd
+  };
+
+  /**
+   * A complete request (on a server) or final response (on a client).
+   * For a response the body is only good for the duration of the call.
+   */
+  typedef apache::thrift::stdcxx::function<
+    void(uint32_t streamId, const THpackHeaders& headers, const std::string& body)>
+    MessageCallback;
+
+  /**
+   * A stream ended without a complete message: it was reset by the peer,
+   * refused by a GOAWAY, or its message broke a limit.
+   */
+  typedef apache::thrift::stdcxx::function<void(uint32_t streamId, uint32_t errorCode)>
+    StreamErrorCallback;
+
+  static const uint32_t DEFAULT_MAX_CONCURRENT_STREAMS = 100;
+  static const uint32_t DEFAULT_MAX_MESSAGE_SIZE = 256 * 1024 * 1024;
+
+  THttp2Session(Role role);
+
+  void setMessageCallback(const MessageCallback& cob) {
+    messageCallback_ = cob;
+  }
+  void setStreamErrorCallback(const StreamErrorCallback& cob) {
+    streamErrorCallback_ = cob;
+  }
+
+  /**
+   * How many streams the peer may have open at once.  Only takes effect if
+   * set before start().
+   */
+  void setMaxConcurrentStreams(uint32_t maxConcurrentStreams) {
+    maxConcurrentStreams_ = maxConcurrentStreams;
+  }
+  uint32_t getMaxConcurrentStreams() const {
+    return maxConcurrentStreams_;
+  }
+
+  /**
+   * Streams whose incoming body grows past this are reset with H2_CANCEL.
+   */
+  void setMaxMessageSize(uint32_t maxMessageSize) {
+    maxMessageSize_ = maxMessageSize;
+  }
+  uint32_t getMaxMessageSize() const {
+    return maxMessageSize_;
+  }
+
+  /**
+   * Queue the connection preface and our settings.  Call once, first.
+   */
+  void start();
+
+  /**
+   * Feed bytes read from the peer, running callbacks for whatever messages
+   * they complete.
+   */
+  void receive(const uint8_t* data, uint32_t len);
+
+  /**
+   * Whether a client can open another stream right now: the peer's
+   * concurrency limit isn't reached and the connection isn't going away.
+   */
+  bool canSubmitRequest() const;
+
+  /**
+   * Client only: open a stream carrying a request.  headers must have the
+   * pseudo-headers first.  Returns the stream id the response will carry.
+   */
+  uint32_t submitRequest(const THpackHeaders& headers, const uint8_t* body, uint32_t len);
+
+  /**
+   * Server only: answer the request on streamId.  Does nothing if the
+   * stream has been reset in the meantime.
+   */
+  void submitResponse(uint32_t streamId, const THpackHeaders& headers,
+                      const uint8_t* body, uint32_t len);
+
+  void resetStream(uint32_t streamId, uint32_t errorCode);
+
+  /**
+   * Tell the peer no new streams will be accepted.  Streams already open
+   * are still served.
+   */
+  void goAway(uint32_t errorCode);
+
+  bool isGoingAway() const {
+    return goAwaySent_ || goAwayReceived_;
+  }
+  size_t getNumStreams() const {
+    return streams_.size();
+  }
+
+  /**
+   * Bytes waiting to be written to the peer.  Returns NULL if none.
+   */
+  const uint8_t* getOutput(uint32_t* len) const;
+  void consumeOutput(uint32_t len);
+  bool hasOutput() const {
+    return outPos_ < out_.size();
+  }
+
+  static const char* CONNECTION_PREFACE;
+  static const uint32_t CONNECTION_PREFACE_LEN = 24;
+
+ private:
+  enum FrameType {
+    FRAME_DATA = 0x0,
+    FRAME_HEADERS = 0x1,
+    FRAME_PRIORITY = 0x2,
+    FRAME_RST_STREAM = 0x3,
+    FRAME_SETTINGS = 0x4,
+    FRAME_PUSH_PROMISE = 0x5,
+    FRAME_PING = 0x6,
+    FRAME_GOAWAY = 0x7,
+    FRAME_WINDOW_UPDATE = 0x8,
+    FRAME_CONTINUATION = 0x9
+  };
+
+  enum Setting {
+    SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    SETTINGS_ENABLE_PUSH = 0x2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    SETTINGS_MAX_FRAME_SIZE = 0x5,
+    SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+  };
+
+  struct Stream {
+    Stream(int64_t sendWindow, int64_t recvWindow) :
+      headersDone(false),
+      remoteClosed(false),
+      localClosed(false),
+      sendWindow(sendWindow),
+      recvWindow(recvWindow),
+      pendingPos(0) {}
+
+    THpackHeaders headers;
+    std::string body;
+    bool headersDone;
+    bool remoteClosed;
+    bool localClosed;
+
+    // may go negative when the peer shrinks its initial window
+    int64_t sendWindow;
+    int64_t recvWindow;
+
+    // outgoing body not yet sent, ending the stream once it is
+    std::string pending;
+    size_t pendingPos;
+  };
+  typedef std::map<uint32_t, Stream> StreamMap;
+
+  void handleFrame(uint8_t type, uint8_t flags, uint32_t streamId,
+                   const uint8_t* payload, uint32_t len);
+  void handleData(uint8_t flags, uint32_t streamId, const uint8_t* payload, uint32_t len);
+  void handleHeaders(uint8_t flags, uint32_t streamId, const uint8_t* payload, uint32_t len);
+  void handleSettings(uint8_t flags, uint32_t streamId, const uint8_t* payload, uint32_t len);
+  void handleGoAway(const uint8_t* payload, uint32_t len);
+  void handleWindowUpdate(uint32_t streamId, const uint8_t* payload, uint32_t len);
+  void processHeaderBlock(uint32_t streamId, bool endStream);
+  void deliverMessage(StreamMap::iterator it);
+
+  // Queue a GOAWAY and throw
+  void connectionError(uint32_t errorCode, const std::string& what);
+  // Reset a stream we have a problem with and tell the owner about it
+  void streamError(uint32_t streamId, uint32_t errorCode);
+
+  void writeFrameHeader(uint32_t len, uint8_t type, uint8_t flags, uint32_t streamId);
+  void writeHeaders(uint32_t streamId, const THpackHeaders& headers, bool endStream);
+  void writeWindowUpdate(uint32_t streamId, uint32_t increment);
+  void writeRstStream(uint32_t streamId, uint32_t errorCode);
+  void writeGoAway(uint32_t errorCode);
+  void queueBody(StreamMap::iterator it, const uint8_t* body, uint32_t len);
+  void sendPendingData();
+
+  Role role_;
+  THpackEncoder encoder_;
+  THpackDecoder decoder_;
+
+  StreamMap streams_;
+  // next stream id we open, and the highest one the peer opened
+  uint32_t nextStreamId_;
+  uint32_t lastPeerStreamId_;
+
+  // stream and flags of a header block waiting for CONTINUATION frames
+  uint32_t continuationStream_;
+  bool continuationEndStream_;
+  std::string headerBlock_;
+
+  // our settings, and what we know of the peer's
+  uint32_t maxConcurrentStreams_;
+  uint32_t maxMessageSize_;
+  uint32_t peerMaxConcurrentStreams_;
+  uint32_t peerInitialWindowSize_;
+  uint32_t peerMaxFrameSize_;
+
+  int64_t connSendWindow_;
+  int64_t connRecvWindow_;
+
+  bool prefaceReceived_;
+  bool goAwaySent_;
+  bool goAwayReceived_;
+  // set once a connection error has been raised; input is ignored after that
+  bool failed_;
+
+  std::string in_;
+  std::string out_;
+  size_t outPos_;
+
+  MessageCallback messageCallback_;
+  StreamErrorCallback streamErrorCallback_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_THTTP2SESSION_H_
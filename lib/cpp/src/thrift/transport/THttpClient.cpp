@@ -53,6 +53,8 @@ void THttpClient::parseHeader(char* header) {
   } else if (boost::istarts_with(header, "Content-Length")) {
     chunked_ = false;
     contentLength_ = atoi(value);
+  } else if (boost::istarts_with(header, "Content-Encoding")) {
+    parseContentEncoding(value);
   }
 }
 
@@ -85,18 +87,35 @@ bool THttpClient::parseStatusLine(char* status) {
 }
 
 void THttpClient::flush() {
-  // Fetch the contents of the write buffer
-  uint8_t* buf;
-  uint32_t len;
-  writeBuffer_.getBuffer(&buf, &len);
+  // The read side is left alone, so that responses to earlier pipelined
+  // requests can still be read after this one has been sent
+  writeMessage();
+}
 
+std::string THttpClient::buildHeader(uint32_t contentLength, bool chunked) {
   // Construct the HTTP header
   std::ostringstream h;
   h <<
     "POST " << path_ << " HTTP/1.1" << CRLF <<
     "Host: " << host_ << CRLF <<
-    "Content-Type: application/x-thrift" << CRLF <<
-    "Content-Length: " << len << CRLF <<
+    "Content-Type: application/x-thrift" << CRLF;
+  if (chunked) {
+    h << "Transfer-Encoding: chunked" << CRLF;
+  } else {
+    h << "Content-Length: " << contentLength << CRLF;
+  }
+  if (writeEncoding_ != NULL) {
+    h << "Content-Encoding: " << writeEncoding_ << CRLF;
+  }
+  if (!codings_.empty()) {
+    // Ask for the response compressed with any coding we can decode
+    h << "Accept-Encoding: ";
+    for (size_t i = 0; i < codings_.size(); ++i) {
+      h << (i > 0 ? ", " : "") << codings_[i]->getName();
+    }
+    h << CRLF;
+  }
+  h <<
     "Accept: application/x-thrift" << CRLF <<
     "User-Agent: Thrift/" << VERSION << " (C++/THttpClient)" << CRLF <<
     CRLF;
@@ -104,14 +123,7 @@ void THttpClient::flush() {
 
   if(header.size() > (std::numeric_limits<uint32_t>::max)())
     throw TTransportException("Header too big");
-  // Write the header, then the data, then flush
-  transport_->write((const uint8_t*)header.c_str(), static_cast<uint32_t>(header.size()));
-  transport_->write(buf, len);
-  transport_->flush();
-
-  // Reset the buffer and header variables
-  writeBuffer_.resetBuffer();
-  readHeaders_ = true;
+  return header;
 }
 
 }}} // apache::thrift::transport
@@ -41,6 +41,7 @@ class THttpClient : public THttpTransport {
 
   virtual void parseHeader(char* header);
   virtual bool parseStatusLine(char* status);
+  virtual std::string buildHeader(uint32_t contentLength, bool chunked);
 
 };
 
@@ -20,6 +20,7 @@
 #include <cstdlib>
 #include <sstream>
 #include <iostream>
+#include <boost/algorithm/string.hpp>
 
 #include <thrift/transport/THttpServer.h>
 #include <thrift/transport/TSocket.h>
@@ -39,16 +40,21 @@ void THttpServer::parseHeader(char* header) {
   if (colon == NULL) {
     return;
   }
-  size_t sz = colon - header;
+  *colon = '\0';
   char* value = colon+1;
 
-  if (strncmp(header, "Transfer-Encoding", sz) == 0) {
-    if (strstr(value, "chunked") != NULL) {
+  // Header names are case-insensitive, and must match in full
+  if (boost::iequals(header, "Transfer-Encoding")) {
+    if (boost::icontains(value, "chunked")) {
       chunked_ = true;
     }
-  } else if (strncmp(header, "Content-Length", sz) == 0) {
+  } else if (boost::iequals(header, "Content-Length")) {
     chunked_ = false;
     contentLength_ = atoi(value);
+  } else if (boost::iequals(header, "Content-Encoding")) {
+    parseContentEncoding(value);
+  } else if (boost::iequals(header, "Accept-Encoding")) {
+    parseAcceptEncoding(value);
   }
 }
 
@@ -105,11 +111,11 @@ bool THttpServer::parseStatusLine(char* status) {
 }
 
 void THttpServer::flush() {
-  // Fetch the contents of the write buffer
-  uint8_t* buf;
-  uint32_t len;
-  writeBuffer_.getBuffer(&buf, &len);
+  // Pipelined requests behind the one being answered stay buffered
+  writeMessage();
+}
 
+std::string THttpServer::buildHeader(uint32_t contentLength, bool chunked) {
   // Construct the HTTP header
   std::ostringstream h;
   h <<
@@ -117,21 +123,32 @@ void THttpServer::flush() {
     "Date: " << getTimeRFC1123() << CRLF <<
     "Server: Thrift/" << VERSION << CRLF <<
     "Access-Control-Allow-Origin: *" << CRLF <<
-    "Content-Type: application/x-thrift" << CRLF <<
-    "Content-Length: " << len << CRLF <<
+    "Content-Type: application/x-thrift" << CRLF;
+  if (chunked) {
+    h << "Transfer-Encoding: chunked" << CRLF;
+  } else {
+    h << "Content-Length: " << contentLength << CRLF;
+  }
+  if (writeEncoding_ != NULL) {
+    h << "Content-Encoding: " << writeEncoding_ << CRLF;
+  }
+  if (!codings_.empty()) {
+    // Caches must not hand this response to clients that can't decode it
+    h << "Vary: Accept-Encoding" << CRLF;
+  }
+  h <<
     "Connection: Keep-Alive" << CRLF <<
     CRLF;
-  string header = h.str();
-
-  // Write the header, then the data, then flush
-  // cast should be fine, because none of "header" is under attacker control
-  transport_->write((const uint8_t*)header.c_str(), static_cast<uint32_t>(header.size()));
-  transport_->write(buf, len);
-  transport_->flush();
+  return h.str();
+}
 
-  // Reset the buffer and header variables
-  writeBuffer_.resetBuffer();
-  readHeaders_ = true;
+THttpContentCoding* THttpServer::chooseWriteCoding() {
+  for (size_t i = 0; i < codings_.size(); ++i) {
+    if (isAccepted(codings_[i]->getName())) {
+      return codings_[i].get();
+    }
+  }
+  return NULL;
 }
 
 std::string THttpServer::getTimeRFC1123()
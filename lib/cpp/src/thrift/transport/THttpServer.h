@@ -37,6 +37,8 @@ class THttpServer : public THttpTransport {
   void readHeaders();
   virtual void parseHeader(char* header);
   virtual bool parseStatusLine(char* status);
+  virtual std::string buildHeader(uint32_t contentLength, bool chunked);
+  virtual THttpContentCoding* chooseWriteCoding();
   std::string getTimeRFC1123();
 
 };
@@ -46,17 +48,39 @@ class THttpServer : public THttpTransport {
  */
 class THttpServerTransportFactory : public TTransportFactory {
  public:
-  THttpServerTransportFactory() {}
+  THttpServerTransportFactory() :
+    compressThreshold_(THttpTransport::DEFAULT_COMPRESS_THRESHOLD) {}
 
   virtual ~THttpServerTransportFactory() {}
 
+  /**
+   * Have every transport made from now on understand and offer the coding.
+   * See THttpTransport::addContentCoding().
+   */
+  void addContentCoding(boost::shared_ptr<THttpContentCoding> coding) {
+    codings_.push_back(coding);
+  }
+
+  void setCompressThreshold(uint32_t compressThreshold) {
+    compressThreshold_ = compressThreshold;
+  }
+
   /**
    * Wraps the transport into a buffered one.
    */
   virtual boost::shared_ptr<TTransport> getTransport(boost::shared_ptr<TTransport> trans) {
-    return boost::shared_ptr<TTransport>(new THttpServer(trans));
+    boost::shared_ptr<THttpServer> server(new THttpServer(trans));
+    for (size_t i = 0; i < codings_.size(); ++i) {
+      server->addContentCoding(codings_[i]);
+    }
+    server->setCompressThreshold(compressThreshold_);
+    return server;
   }
 
+ private:
+  std::vector<boost::shared_ptr<THttpContentCoding> > codings_;
+  uint32_t compressThreshold_;
+
 };
 
 }}} // apache::thrift::transport
@@ -17,6 +17,9 @@
  * under the License.
  */
 
+#include <cctype>
+#include <cstdlib>
+
 #include <thrift/transport/THttpTransport.h>
 
 namespace apache { namespace thrift { namespace transport {
@@ -34,10 +37,16 @@ THttpTransport::THttpTransport(boost::shared_ptr<TTransport> transport) :
   chunkedDone_(false),
   chunkSize_(0),
   contentLength_(0),
+  writeChunkSize_(0),
+  writeChunked_(false),
   httpBuf_(NULL),
   httpPos_(0),
   httpBufLen_(0),
-  httpBufSize_(1024) {
+  httpBufSize_(1024),
+  compressThreshold_(DEFAULT_COMPRESS_THRESHOLD),
+  maxDecodedSize_(DEFAULT_MAX_DECODED_SIZE),
+  readCoding_(NULL),
+  writeEncoding_(NULL) {
   init();
 }
 
@@ -67,34 +76,84 @@ uint32_t THttpTransport::read(uint8_t* buf, uint32_t len) {
 }
 
 uint32_t THttpTransport::readEnd() {
-  // Read any pending chunked data (footers etc.)
+  // Skip whatever the caller left of this message (chunks, footers etc.) so
+  // that a pipelined message behind it starts out at the right place
+  readBuffer_.resetBuffer();
+  if (readHeaders_) {
+    return 0;
+  }
+
   if (chunked_) {
     while (!chunkedDone_) {
       readChunked();
+      readBuffer_.resetBuffer();
+    }
+  } else {
+    while (contentLength_ > 0) {
+      readContentPart();
+      readBuffer_.resetBuffer();
     }
   }
+  readHeaders_ = true;
   return 0;
 }
 
 uint32_t THttpTransport::readMoreData() {
   uint32_t size;
 
-  // Get more data!
-  refill();
-
   if (readHeaders_) {
     readHeaders();
   }
 
+  if (readCoding_ != NULL) {
+    return readDecoded();
+  }
+
   if (chunked_) {
     size = readChunked();
+    if (chunkedDone_) {
+      readHeaders_ = true;
+    }
   } else {
-    size = readContent(contentLength_);
+    size = readContentPart();
+    if (contentLength_ == 0) {
+      readHeaders_ = true;
+    }
   }
-  readHeaders_ = true;
   return size;
 }
 
+uint32_t THttpTransport::readDecoded() {
+  // A compressed body can only be decoded whole
+  if (chunked_) {
+    while (!chunkedDone_) {
+      readChunked();
+    }
+  } else {
+    while (contentLength_ > 0) {
+      readContentPart();
+    }
+  }
+  readHeaders_ = true;
+  THttpContentCoding* coding = readCoding_;
+  readCoding_ = NULL;
+
+  uint8_t* buf;
+  uint32_t len;
+  readBuffer_.getBuffer(&buf, &len);
+  if (len == 0) {
+    return 0;
+  }
+  codingBuffer_.resetBuffer();
+  coding->decode(buf, len, codingBuffer_, maxDecodedSize_);
+
+  codingBuffer_.getBuffer(&buf, &len);
+  readBuffer_.resetBuffer();
+  readBuffer_.write(buf, len);
+  codingBuffer_.resetBuffer();
+  return len;
+}
+
 uint32_t THttpTransport::readChunked() {
   uint32_t length = 0;
 
@@ -156,15 +215,54 @@ uint32_t THttpTransport::readContent(uint32_t size) {
   return size;
 }
 
+uint32_t THttpTransport::readContentPart() {
+  if (contentLength_ == 0) {
+    return 0;
+  }
+  if (httpPos_ == httpBufLen_) {
+    httpPos_ = 0;
+    httpBufLen_ = 0;
+    refill();
+  }
+
+  // Hand out only what has arrived, rather than waiting for the whole body
+  uint32_t give = httpBufLen_ - httpPos_;
+  if (contentLength_ < give) {
+    give = contentLength_;
+  }
+  readBuffer_.write((uint8_t*)(httpBuf_+httpPos_), give);
+  httpPos_ += give;
+  contentLength_ -= give;
+  return give;
+}
+
 char* THttpTransport::readLine() {
+  // bytes from httpPos_ already searched for the CRLF
+  uint32_t scanned = 0;
   while (true) {
+    // Only look at bytes that weren't there on the last pass.  Back up one
+    // in case the CR arrived at the end of the previous read.
+    uint32_t scan = httpPos_ + scanned;
+    if (scanned > 0) {
+      scan--;
+    }
     char* eol = NULL;
-
-    eol = strstr(httpBuf_+httpPos_, CRLF);
+    char* cr;
+    while ((cr = (char*)memchr(httpBuf_+scan, '\r', httpBufLen_-scan)) != NULL) {
+      scan = static_cast<uint32_t>(cr-httpBuf_) + 1;
+      if (scan == httpBufLen_) {
+        break;
+      }
+      if (*(cr+1) == '\n') {
+        eol = cr;
+        break;
+      }
+    }
 
     // No CRLF yet?
     if (eol == NULL) {
       // Shift whatever we have now to front and refill
+      scanned = httpBufLen_ - httpPos_;
       shift();
       refill();
     } else {
@@ -217,6 +315,8 @@ void THttpTransport::readHeaders() {
   chunked_ = false;
   chunkedDone_ = false;
   chunkSize_ = 0;
+  readCoding_ = NULL;
+  acceptEncoding_.clear();
 
   // Control state flow
   bool statusLine = true;
@@ -245,8 +345,143 @@ void THttpTransport::readHeaders() {
   }
 }
 
+static string trimLower(const char* begin, const char* end) {
+  while (begin < end && isspace((unsigned char)*begin)) {
+    begin++;
+  }
+  while (end > begin && isspace((unsigned char)*(end-1))) {
+    end--;
+  }
+  string s(begin, end);
+  for (string::iterator it = s.begin(); it != s.end(); ++it) {
+    *it = static_cast<char>(tolower((unsigned char)*it));
+  }
+  return s;
+}
+
+void THttpTransport::parseContentEncoding(const char* value) {
+  string name = trimLower(value, value + strlen(value));
+  if (name.empty() || name == "identity") {
+    readCoding_ = NULL;
+    return;
+  }
+  readCoding_ = findCoding(name);
+  if (readCoding_ == NULL) {
+    throw TTransportException("Unsupported Content-Encoding: " + name);
+  }
+}
+
+void THttpTransport::parseAcceptEncoding(const char* value) {
+  // The header may be repeated, which is the same as one comma separated list
+  if (!acceptEncoding_.empty()) {
+    acceptEncoding_ += ',';
+  }
+  acceptEncoding_ += trimLower(value, value + strlen(value));
+}
+
+THttpContentCoding* THttpTransport::findCoding(const string& name) {
+  for (size_t i = 0; i < codings_.size(); ++i) {
+    if (name == codings_[i]->getName()) {
+      return codings_[i].get();
+    }
+  }
+  return NULL;
+}
+
+bool THttpTransport::isAccepted(const char* name) {
+  // Tokens, each perhaps with parameters such as ";q=0.5"; q=0 refuses it
+  const char* p = acceptEncoding_.c_str();
+  bool wildcard = false;
+  while (*p != '\0') {
+    const char* end = strchr(p, ',');
+    if (end == NULL) {
+      end = p + strlen(p);
+    }
+    const char* semi = static_cast<const char*>(memchr(p, ';', end - p));
+    string token = trimLower(p, semi != NULL ? semi : end);
+    bool refused = false;
+    if (semi != NULL) {
+      string params = trimLower(semi + 1, end);
+      string::size_type q = params.find("q=");
+      refused = q != string::npos && atof(params.c_str() + q + 2) <= 0.0;
+    }
+    if (token == name) {
+      return !refused;
+    }
+    if (token == "*") {
+      wildcard = !refused;
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+  return wildcard;
+}
+
 void THttpTransport::write(const uint8_t* buf, uint32_t len) {
   writeBuffer_.write(buf, len);
+  if (writeChunkSize_ > 0 && writeBuffer_.available_read() >= writeChunkSize_) {
+    writeChunk();
+  }
+}
+
+void THttpTransport::writeChunk() {
+  uint8_t* buf;
+  uint32_t len;
+  writeBuffer_.getBuffer(&buf, &len);
+
+  if (!writeChunked_) {
+    string header = buildHeader(0, true);
+    transport_->write((const uint8_t*)header.c_str(), static_cast<uint32_t>(header.size()));
+    writeChunked_ = true;
+  }
+
+  if (len > 0) {
+    char size[16];
+    int sizeLen = sprintf(size, "%x\r\n", len);
+    transport_->write((const uint8_t*)size, sizeLen);
+    transport_->write(buf, len);
+    transport_->write((const uint8_t*)CRLF, CRLF_LEN);
+  }
+  writeBuffer_.resetBuffer();
+}
+
+void THttpTransport::writeMessage() {
+  if (writeChunked_) {
+    // Last data chunk, then the terminating one with no footers
+    writeChunk();
+    static const char* lastChunk = "0\r\n\r\n";
+    transport_->write((const uint8_t*)lastChunk, 5);
+    writeChunked_ = false;
+  } else {
+    uint8_t* buf;
+    uint32_t len;
+    writeBuffer_.getBuffer(&buf, &len);
+
+    THttpContentCoding* coding = len >= compressThreshold_ ? chooseWriteCoding() : NULL;
+    if (coding != NULL) {
+      codingBuffer_.resetBuffer();
+      coding->encode(buf, len, codingBuffer_);
+      uint8_t* encoded;
+      uint32_t encodedLen;
+      codingBuffer_.getBuffer(&encoded, &encodedLen);
+      // Not worth a Content-Encoding if it came out no smaller
+      if (encodedLen < len) {
+        buf = encoded;
+        len = encodedLen;
+        writeEncoding_ = coding->getName();
+      }
+    }
+
+    // Write the header, then the data
+    // cast should be fine, because none of "header" is under attacker control
+    string header = buildHeader(len, false);
+    writeEncoding_ = NULL;
+    transport_->write((const uint8_t*)header.c_str(), static_cast<uint32_t>(header.size()));
+    transport_->write(buf, len);
+  }
+  transport_->flush();
+
+  writeBuffer_.resetBuffer();
+  codingBuffer_.resetBuffer();
 }
 
 }}}
@@ -20,17 +20,57 @@
 #ifndef _THRIFT_TRANSPORT_THTTPTRANSPORT_H_
 #define _THRIFT_TRANSPORT_THTTPTRANSPORT_H_ 1
 
+#include <string>
+#include <vector>
 #include <thrift/transport/TBufferTransports.h>
 #include <thrift/transport/TVirtualTransport.h>
 
 namespace apache { namespace thrift { namespace transport {
 
+/**
+ * A Content-Encoding THttpTransport can compress bodies with.  The ones
+ * Thrift comes with live next to the transports whose library they share:
+ * THttpZlibContentCoding (gzip and deflate) and THttpZstdContentCoding.
+ *
+ * A coding holds no state between calls, so one object can be shared by
+ * any number of transports and threads.
+ */
+class THttpContentCoding {
+ public:
+  virtual ~THttpContentCoding() {}
+
+  /// The token naming it in Content-Encoding and Accept-Encoding, lower case
+  virtual const char* getName() const = 0;
+
+  /// Compress len bytes of in, appending the result to out
+  virtual void encode(const uint8_t* in, uint32_t len, TMemoryBuffer& out) = 0;
+
+  /**
+   * Decompress len bytes of in, appending the result to out.  Throws
+   * rather than produce more than maxLen bytes.
+   */
+  virtual void decode(const uint8_t* in, uint32_t len, TMemoryBuffer& out,
+                      uint32_t maxLen) = 0;
+};
+
 /**
  * HTTP implementation of the thrift transport. This was irritating
  * to write, but the alternatives in C++ land are daunting. Linking CURL
  * requires 23 dynamic libraries last time I checked (WTF?!?). All we have
  * here is a VERY basic HTTP/1.1 client which supports HTTP 100 Continue,
  * chunked transfer encoding, keepalive, etc. Tested against Apache.
+ *
+ * Bodies are streamed: read() hands out a Content-Length body as it arrives
+ * and a chunked body one chunk at a time, and with setWriteChunkSize() the
+ * outgoing body goes out as chunks instead of being held for flush().  Bytes
+ * past the end of the current message stay buffered for the next one, so
+ * several requests can be pipelined on one persistent connection as long as
+ * each message is finished off with readEnd().
+ *
+ * With content codings added, bodies that arrive compressed are decoded
+ * whole before read() hands any of them out, and THttpServer compresses
+ * responses of at least getCompressThreshold() bytes with the first coding
+ * the client accepts.  Chunked bodies are always sent as they are.
  */
 class THttpTransport : public TVirtualTransport<THttpTransport> {
  public:
@@ -47,6 +87,10 @@ class THttpTransport : public TVirtualTransport<THttpTransport> {
   }
 
   bool peek() {
+    // A pipelined message may already be sitting in our buffer
+    if (readBuffer_.available_read() > 0 || httpPos_ < httpBufLen_) {
+      return true;
+    }
     return transport_->peek();
   }
 
@@ -62,6 +106,54 @@ class THttpTransport : public TVirtualTransport<THttpTransport> {
 
   virtual void flush() = 0;
 
+  /**
+   * Once this many body bytes have been written, send them as one chunk of a
+   * "Transfer-Encoding: chunked" message rather than waiting for flush().
+   * 0 (the default) buffers the whole body and sends it with Content-Length.
+   */
+  void setWriteChunkSize(uint32_t writeChunkSize) {
+    writeChunkSize_ = writeChunkSize;
+  }
+  uint32_t getWriteChunkSize() {
+    return writeChunkSize_;
+  }
+
+  /// Default for setCompressThreshold()
+  static const uint32_t DEFAULT_COMPRESS_THRESHOLD = 1024;
+
+  /// Default for setMaxDecodedSize()
+  static const uint32_t DEFAULT_MAX_DECODED_SIZE = 256 * 1024 * 1024;
+
+  /**
+   * Understand the coding in bodies that are read, and offer it for bodies
+   * that are written.  Codings added first are preferred.
+   */
+  void addContentCoding(boost::shared_ptr<THttpContentCoding> coding) {
+    codings_.push_back(coding);
+  }
+
+  /**
+   * Bodies shorter than this are sent uncompressed, since they would gain
+   * little and cost the time to compress.
+   */
+  void setCompressThreshold(uint32_t compressThreshold) {
+    compressThreshold_ = compressThreshold;
+  }
+  uint32_t getCompressThreshold() {
+    return compressThreshold_;
+  }
+
+  /**
+   * Largest a compressed body may grow to once decoded; bigger ones fail
+   * the read.
+   */
+  void setMaxDecodedSize(uint32_t maxDecodedSize) {
+    maxDecodedSize_ = maxDecodedSize;
+  }
+  uint32_t getMaxDecodedSize() {
+    return maxDecodedSize_;
+  }
+
  protected:
 
   boost::shared_ptr<TTransport> transport_;
@@ -73,13 +165,31 @@ class THttpTransport : public TVirtualTransport<THttpTransport> {
   bool chunked_;
   bool chunkedDone_;
   uint32_t chunkSize_;
+  // body bytes of the current message not yet read
   uint32_t contentLength_;
 
+  uint32_t writeChunkSize_;
+  // headers of the outgoing message have gone out and chunks are following
+  bool writeChunked_;
+
   char* httpBuf_;
   uint32_t httpPos_;
   uint32_t httpBufLen_;
   uint32_t httpBufSize_;
 
+  std::vector<boost::shared_ptr<THttpContentCoding> > codings_;
+  uint32_t compressThreshold_;
+  uint32_t maxDecodedSize_;
+  // coding of the body being read, or NULL if it is sent as it is
+  THttpContentCoding* readCoding_;
+  // Accept-Encoding of the message last read, in lower case
+  std::string acceptEncoding_;
+  // Content-Encoding of the message being written, or NULL for none
+  const char* writeEncoding_;
+  // compressed form of the body being written, or decoded form of the one
+  // being read
+  TMemoryBuffer codingBuffer_;
+
   virtual void init();
 
   uint32_t readMoreData();
@@ -94,6 +204,28 @@ class THttpTransport : public TVirtualTransport<THttpTransport> {
   uint32_t parseChunkSize(char* line);
 
   uint32_t readContent(uint32_t size);
+  uint32_t readContentPart();
+  // Read the rest of a compressed body and decode it into readBuffer_
+  uint32_t readDecoded();
+
+  // For parseHeader(), with the header's value
+  void parseContentEncoding(const char* value);
+  void parseAcceptEncoding(const char* value);
+
+  THttpContentCoding* findCoding(const std::string& name);
+  // Whether the message last read lists the coding in its Accept-Encoding
+  bool isAccepted(const char* name);
+  // Coding for the body about to be written, or NULL to send it as it is
+  virtual THttpContentCoding* chooseWriteCoding() {
+    return NULL;
+  }
+
+  // Header for the outgoing message, with either a Content-Length or a
+  // "Transfer-Encoding: chunked" line
+  virtual std::string buildHeader(uint32_t contentLength, bool chunked) = 0;
+  void writeChunk();
+  // Send whatever is left of the outgoing message and flush the transport
+  void writeMessage();
 
   void refill();
   void shift();
@@ -0,0 +1,442 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <boost/lexical_cast.hpp>
+#define LZ4F_STATIC_LINKING_ONLY
+#include <lz4frame.h>
+#include <thrift/transport/TLZ4Transport.h>
+
+using std::string;
+
+namespace apache { namespace thrift { namespace transport {
+
+namespace {
+
+// Frames are made of linked 64KB blocks with a content checksum at the end.
+// The small block size keeps the worst case LZ4 needs in cwbuf_ down.
+void makePreferences(LZ4F_preferences_t* prefs, int comp_level) {
+  memset(prefs, 0, sizeof(*prefs));
+  prefs->frameInfo.blockSizeID = LZ4F_max64KB;
+  prefs->frameInfo.blockMode = LZ4F_blockLinked;
+  prefs->frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+  prefs->compressionLevel = comp_level;
+}
+
+}
+
+string TLZ4TransportException::errorMessage(size_t code, const char* where) {
+  string rv = "lz4 error: ";
+  rv += LZ4F_getErrorName(code);
+  if (where) {
+    rv += " (in ";
+    rv += where;
+    rv += ")";
+  }
+  return rv;
+}
+
+TLZ4Transport::TLZ4Transport(boost::shared_ptr<TTransport> transport,
+                             int urbuf_size,
+                             int crbuf_size,
+                             int uwbuf_size,
+                             int cwbuf_size,
+                             int comp_level,
+                             boost::shared_ptr<TLZ4Dictionary> dictionary) :
+  transport_(transport),
+  dictionary_(dictionary),
+  urpos_(0),
+  urend_(0),
+  crpos_(0),
+  crend_(0),
+  uwpos_(0),
+  cwpos_(0),
+  input_ended_(false),
+  output_started_(false),
+  output_finished_(false),
+  output_pending_(false),
+  urbuf_size_(urbuf_size),
+  crbuf_size_(crbuf_size),
+  uwbuf_size_(uwbuf_size),
+  cwbuf_size_(cwbuf_size),
+  urbuf_(NULL),
+  crbuf_(NULL),
+  uwbuf_(NULL),
+  cwbuf_(NULL),
+  rstream_(NULL),
+  wstream_(NULL),
+  comp_level_(comp_level)
+{
+  if (uwbuf_size_ < MIN_DIRECT_COMPRESS_SIZE) {
+    // Have to copy this into a local because of a linking issue.
+    int minimum = MIN_DIRECT_COMPRESS_SIZE;
+    throw TTransportException(
+        TTransportException::BAD_ARGS,
+        "TLZ4Transport: uncompressed write buffer must be at least "
+        + boost::lexical_cast<string>(minimum) + ".");
+  }
+  if (urbuf_size <= 0 || crbuf_size <= 0) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TLZ4Transport: buffer sizes must be positive.");
+  }
+
+  LZ4F_preferences_t prefs;
+  makePreferences(&prefs, comp_level_);
+  cwbuf_size_ = std::max(cwbuf_size_,
+                         (uint32_t) LZ4F_compressBound(uwbuf_size_, &prefs));
+
+  try {
+    urbuf_ = new uint8_t[urbuf_size_];
+    crbuf_ = new uint8_t[crbuf_size_];
+    uwbuf_ = new uint8_t[uwbuf_size_];
+    cwbuf_ = new uint8_t[cwbuf_size_];
+
+    checkLZ4Rv(LZ4F_createDecompressionContext(&rstream_, LZ4F_VERSION),
+               "LZ4F_createDecompressionContext");
+    checkLZ4Rv(LZ4F_createCompressionContext(&wstream_, LZ4F_VERSION),
+               "LZ4F_createCompressionContext");
+  } catch (...) {
+    LZ4F_freeDecompressionContext(rstream_);
+    LZ4F_freeCompressionContext(wstream_);
+    delete[] urbuf_;
+    delete[] crbuf_;
+    delete[] uwbuf_;
+    delete[] cwbuf_;
+    throw;
+  }
+}
+
+inline void TLZ4Transport::checkLZ4Rv(size_t rv, const char* where) {
+  if (LZ4F_isError(rv)) {
+    throw TLZ4TransportException(rv, where);
+  }
+}
+
+TLZ4Transport::~TLZ4Transport() {
+  // Anything written but not flushed is discarded along with the context,
+  // which is the defined TTransport behavior.
+  LZ4F_freeDecompressionContext(rstream_);
+  LZ4F_freeCompressionContext(wstream_);
+
+  delete[] urbuf_;
+  delete[] crbuf_;
+  delete[] uwbuf_;
+  delete[] cwbuf_;
+}
+
+bool TLZ4Transport::isOpen() {
+  return (readAvail() > 0) || (crpos_ < crend_) || output_pending_ ||
+    transport_->isOpen();
+}
+
+bool TLZ4Transport::peek() {
+  return (readAvail() > 0) || (crpos_ < crend_) || output_pending_ ||
+    transport_->peek();
+}
+
+
+// READING STRATEGY
+//
+// The same as TZlibTransport's: copy out of urbuf_, and when it runs dry,
+// decompress from crbuf_ into it, refilling crbuf_ from the underlying
+// transport when that is empty too.
+//
+// LZ4 decodes a whole block at a time and keeps what doesn't fit in urbuf_.
+// output_pending_ records that, so we go back to LZ4 for it before blocking
+// on the underlying transport.
+
+inline int TLZ4Transport::readAvail() {
+  return urend_ - urpos_;
+}
+
+uint32_t TLZ4Transport::read(uint8_t* buf, uint32_t len) {
+  uint32_t need = len;
+
+  while (true) {
+    uint32_t give = std::min((uint32_t) readAvail(), need);
+    memcpy(buf, urbuf_ + urpos_, give);
+    need -= give;
+    buf += give;
+    urpos_ += give;
+
+    if (need == 0) {
+      return len;
+    }
+
+    // Return what we have rather than block in the underlying transport.
+    if (need < len && crpos_ == crend_ && !output_pending_) {
+      return len - need;
+    }
+
+    if (input_ended_) {
+      return len - need;
+    }
+
+    // The uncompressed read buffer is empty.
+    urpos_ = 0;
+    urend_ = 0;
+
+    if (!readFromLZ4()) {
+      // no data available from underlying transport
+      return len - need;
+    }
+  }
+}
+
+bool TLZ4Transport::readFromLZ4() {
+  assert(!input_ended_);
+
+  if (crpos_ == crend_ && !output_pending_) {
+    uint32_t got = transport_->read(crbuf_, crbuf_size_);
+    if (got == 0) {
+      return false;
+    }
+    crpos_ = 0;
+    crend_ = got;
+  }
+
+  size_t dstSize = urbuf_size_ - urend_;
+  size_t srcSize = crend_ - crpos_;
+  size_t rv;
+  if (dictionary_) {
+    const string& dict = dictionary_->getData();
+    rv = LZ4F_decompress_usingDict(rstream_, urbuf_ + urend_, &dstSize,
+                                   crbuf_ + crpos_, &srcSize,
+                                   dict.data(), dict.size(), NULL);
+  } else {
+    rv = LZ4F_decompress(rstream_, urbuf_ + urend_, &dstSize,
+                         crbuf_ + crpos_, &srcSize, NULL);
+  }
+  checkLZ4Rv(rv, "LZ4F_decompress");
+
+  crpos_ += static_cast<uint32_t>(srcSize);
+  urend_ += static_cast<uint32_t>(dstSize);
+  output_pending_ = (urend_ == urbuf_size_);
+
+  // Zero means the frame is complete and its checksum matched.
+  if (rv == 0) {
+    input_ended_ = true;
+    output_pending_ = false;
+  }
+
+  return true;
+}
+
+
+// WRITING STRATEGY
+//
+// Small writes are buffered in uwbuf_ as in TZlibTransport; big ones go
+// straight to LZ4, at most uwbuf_size_ bytes at a time.  LZ4 only
+// compresses into a buffer big enough for the worst case, so cwbuf_ is
+// written to the underlying transport whenever what is left of it is
+// smaller than that.
+
+void TLZ4Transport::write(const uint8_t* buf, uint32_t len) {
+  if (output_finished_) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "write() called after finish()");
+  }
+
+  if (len > MIN_DIRECT_COMPRESS_SIZE) {
+    flushToLZ4(uwbuf_, uwpos_);
+    uwpos_ = 0;
+    flushToLZ4(buf, len);
+  } else if (len > 0) {
+    if (uwbuf_size_ - uwpos_ < len) {
+      flushToLZ4(uwbuf_, uwpos_);
+      uwpos_ = 0;
+    }
+    memcpy(uwbuf_ + uwpos_, buf, len);
+    uwpos_ += len;
+  }
+}
+
+void TLZ4Transport::flush()  {
+  if (output_finished_) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "flush() called after finish()");
+  }
+
+  flushToTransport(false);
+}
+
+void TLZ4Transport::finish()  {
+  if (output_finished_) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "finish() called more than once");
+  }
+
+  flushToTransport(true);
+}
+
+void TLZ4Transport::reserveOutput(size_t len) {
+  if (cwbuf_size_ - cwpos_ < len) {
+    transport_->write(cwbuf_, cwpos_);
+    cwpos_ = 0;
+  }
+}
+
+void TLZ4Transport::beginFrame() {
+  if (output_started_) {
+    return;
+  }
+
+  LZ4F_preferences_t prefs;
+  makePreferences(&prefs, comp_level_);
+  reserveOutput(LZ4F_HEADER_SIZE_MAX);
+  size_t rv;
+  if (dictionary_) {
+    rv = LZ4F_compressBegin_usingCDict(wstream_, cwbuf_ + cwpos_,
+                                       cwbuf_size_ - cwpos_,
+                                       dictionary_->getCDict(), &prefs);
+  } else {
+    rv = LZ4F_compressBegin(wstream_, cwbuf_ + cwpos_,
+                            cwbuf_size_ - cwpos_, &prefs);
+  }
+  checkLZ4Rv(rv, "LZ4F_compressBegin");
+  cwpos_ += static_cast<uint32_t>(rv);
+  output_started_ = true;
+}
+
+void TLZ4Transport::flushToTransport(bool end)  {
+  flushToLZ4(uwbuf_, uwpos_);
+  uwpos_ = 0;
+
+  beginFrame();
+
+  LZ4F_preferences_t prefs;
+  makePreferences(&prefs, comp_level_);
+  reserveOutput(LZ4F_compressBound(0, &prefs));
+  size_t rv;
+  if (end) {
+    rv = LZ4F_compressEnd(wstream_, cwbuf_ + cwpos_, cwbuf_size_ - cwpos_, NULL);
+    checkLZ4Rv(rv, "LZ4F_compressEnd");
+    output_finished_ = true;
+  } else {
+    rv = LZ4F_flush(wstream_, cwbuf_ + cwpos_, cwbuf_size_ - cwpos_, NULL);
+    checkLZ4Rv(rv, "LZ4F_flush");
+  }
+  cwpos_ += static_cast<uint32_t>(rv);
+
+  transport_->write(cwbuf_, cwpos_);
+  cwpos_ = 0;
+
+  transport_->flush();
+}
+
+void TLZ4Transport::flushToLZ4(const uint8_t* buf, uint32_t len) {
+  if (len == 0) {
+    return;
+  }
+
+  beginFrame();
+
+  LZ4F_preferences_t prefs;
+  makePreferences(&prefs, comp_level_);
+  while (len > 0) {
+    uint32_t chunk = std::min(len, uwbuf_size_);
+    reserveOutput(LZ4F_compressBound(chunk, &prefs));
+    size_t rv = LZ4F_compressUpdate(wstream_, cwbuf_ + cwpos_,
+                                    cwbuf_size_ - cwpos_, buf, chunk, NULL);
+    checkLZ4Rv(rv, "LZ4F_compressUpdate");
+    cwpos_ += static_cast<uint32_t>(rv);
+    buf += chunk;
+    len -= chunk;
+  }
+}
+
+const uint8_t* TLZ4Transport::borrow(uint8_t* buf, uint32_t* len) {
+  (void) buf;
+  // Don't try to be clever with shifting buffers.
+  // If we have enough data, give a pointer to it,
+  // otherwise let the protcol use its slow path.
+  if (readAvail() >= (int)*len) {
+    *len = (uint32_t)readAvail();
+    return urbuf_ + urpos_;
+  }
+  return NULL;
+}
+
+void TLZ4Transport::consume(uint32_t len) {
+  if (readAvail() >= (int)len) {
+    urpos_ += len;
+  } else {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "consume did not follow a borrow.");
+  }
+}
+
+void TLZ4Transport::verifyChecksum() {
+  // If LZ4 has already reported the end of the frame,
+  // it has verified the checksum.
+  if (input_ended_) {
+    return;
+  }
+
+  // This should only be called when reading is complete.
+  if (readAvail() > 0) {
+    throw TTransportException(
+        TTransportException::CORRUPTED_DATA,
+        "verifyChecksum() called before end of lz4 frame");
+  }
+
+  urpos_ = 0;
+  urend_ = 0;
+
+  // This will throw an exception if the checksum is bad.  If the last read
+  // filled urbuf_, the first call may only find out nothing was held back.
+  bool performed_decompress = readFromLZ4();
+  if (performed_decompress && !input_ended_ && readAvail() == 0) {
+    performed_decompress = readFromLZ4();
+  }
+  if (!performed_decompress) {
+    // As with TZlibTransport, whether this blocks or fails depends on how
+    // the underlying transport reports that no data is available yet.
+    throw TTransportException(TTransportException::CORRUPTED_DATA,
+                              "checksum not available yet in "
+                              "verifyChecksum()");
+  }
+
+  if (input_ended_) {
+    return;
+  }
+
+  throw TTransportException(TTransportException::CORRUPTED_DATA,
+                            "verifyChecksum() called before end of "
+                            "lz4 frame");
+}
+
+
+TLZ4Dictionary::TLZ4Dictionary(const string& data) :
+  data_(data),
+  cdict_(NULL) {
+  cdict_ = LZ4F_createCDict(data_.data(), data_.size());
+  if (cdict_ == NULL) {
+    throw std::bad_alloc();
+  }
+}
+
+TLZ4Dictionary::~TLZ4Dictionary() {
+  LZ4F_freeCDict(cdict_);
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,248 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TLZ4TRANSPORT_H_
+#define _THRIFT_TRANSPORT_TLZ4TRANSPORT_H_ 1
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/transport/TTransport.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+struct LZ4F_cctx_s;
+struct LZ4F_dctx_s;
+struct LZ4F_CDict_s;
+
+namespace apache { namespace thrift { namespace transport {
+
+class TLZ4TransportException : public TTransportException {
+ public:
+  TLZ4TransportException(size_t code, const char* where) :
+    TTransportException(TTransportException::INTERNAL_ERROR,
+                        errorMessage(code, where)),
+    lz4_code_(code) {}
+
+  virtual ~TLZ4TransportException() throw() {}
+
+  size_t getLZ4Code() { return lz4_code_; }
+
+  static std::string errorMessage(size_t code, const char* where);
+
+  size_t lz4_code_;
+};
+
+class TLZ4Dictionary;
+
+/**
+ * This transport uses the LZ4 frame format to compress on write and
+ * decompress on read.
+ *
+ * It behaves like TZlibTransport: flush() ends a block so the peer can
+ * decode everything written so far, and finish() ends the frame with a
+ * checksum of the content that verifyChecksum() checks on the other side.
+ *
+ * LZ4 compresses less tightly than zlib but is an order of magnitude
+ * faster, which suits links where CPU rather than bandwidth is scarce.
+ * Short messages that share a lot of structure compress much better with a
+ * dictionary; both ends must use the same one.
+ */
+class TLZ4Transport : public TVirtualTransport<TLZ4Transport> {
+ public:
+
+  /**
+   * @param transport    The transport to read compressed data from
+   *                     and write compressed data to.
+   * @param urbuf_size   Uncompressed buffer size for reading.
+   * @param crbuf_size   Compressed buffer size for reading.
+   * @param uwbuf_size   Uncompressed buffer size for writing.
+   * @param cwbuf_size   Compressed buffer size for writing.  It is grown to
+   *                     what LZ4 needs to compress uwbuf_size bytes at once,
+   *                     which is a little over 64KB.
+   * @param comp_level   Compression level (0=default[fast], 3-12=HC[slow]).
+   * @param dictionary   Dictionary to compress and decompress with, or NULL.
+   */
+  TLZ4Transport(boost::shared_ptr<TTransport> transport,
+                int urbuf_size = DEFAULT_URBUF_SIZE,
+                int crbuf_size = DEFAULT_CRBUF_SIZE,
+                int uwbuf_size = DEFAULT_UWBUF_SIZE,
+                int cwbuf_size = DEFAULT_CWBUF_SIZE,
+                int comp_level = DEFAULT_COMP_LEVEL,
+                boost::shared_ptr<TLZ4Dictionary> dictionary =
+                  boost::shared_ptr<TLZ4Dictionary>());
+
+  /**
+   * TLZ4Transport destructor.
+   *
+   * Warning: Destroying a TLZ4Transport object may discard any written but
+   * unflushed data.  You must explicitly call flush() or finish() to ensure
+   * that data is actually written and flushed to the underlying transport.
+   */
+  ~TLZ4Transport();
+
+  bool isOpen();
+  bool peek();
+
+  void open() {
+    transport_->open();
+  }
+
+  void close() {
+    transport_->close();
+  }
+
+  uint32_t read(uint8_t* buf, uint32_t len);
+
+  void write(const uint8_t* buf, uint32_t len);
+
+  void flush();
+
+  /**
+   * End the LZ4 frame.
+   *
+   * This writes any pending data followed by the end of the frame, including
+   * the checksum.  Once finish() has been called, no new data can be written
+   * to the stream.
+   */
+  void finish();
+
+  const uint8_t* borrow(uint8_t* buf, uint32_t* len);
+
+  void consume(uint32_t len);
+
+  /**
+   * Verify the checksum at the end of the LZ4 frame.
+   *
+   * This may only be called after all data has been read.
+   * It verifies the checksum that was written by the finish() call.
+   */
+  void verifyChecksum();
+
+  static const int DEFAULT_URBUF_SIZE = 128;
+  static const int DEFAULT_CRBUF_SIZE = 1024;
+  static const int DEFAULT_UWBUF_SIZE = 128;
+  static const int DEFAULT_CWBUF_SIZE = 1024;
+  static const int DEFAULT_COMP_LEVEL = 0;
+
+ protected:
+
+  inline void checkLZ4Rv(size_t rv, const char* where);
+  inline int readAvail();
+  void beginFrame();
+  void reserveOutput(size_t len);
+  void flushToTransport(bool end);
+  void flushToLZ4(const uint8_t* buf, uint32_t len);
+  bool readFromLZ4();
+
+ protected:
+  // Writes smaller than this are buffered up.
+  // Larger (or equal) writes are dumped straight to LZ4.
+  static const uint32_t MIN_DIRECT_COMPRESS_SIZE = 32;
+
+  boost::shared_ptr<TTransport> transport_;
+  boost::shared_ptr<TLZ4Dictionary> dictionary_;
+
+  uint32_t urpos_;
+  uint32_t urend_;
+  uint32_t crpos_;
+  uint32_t crend_;
+  uint32_t uwpos_;
+  uint32_t cwpos_;
+
+  /// True iff LZ4 has reached the end of the frame.
+  bool input_ended_;
+  /// True iff the frame header has been written.
+  bool output_started_;
+  /// True iff we have finished the output stream.
+  bool output_finished_;
+  /// True iff LZ4 filled urbuf_ and may be holding more uncompressed data.
+  bool output_pending_;
+
+  uint32_t urbuf_size_;
+  uint32_t crbuf_size_;
+  uint32_t uwbuf_size_;
+  uint32_t cwbuf_size_;
+
+  uint8_t* urbuf_;
+  uint8_t* crbuf_;
+  uint8_t* uwbuf_;
+  uint8_t* cwbuf_;
+
+  struct LZ4F_dctx_s* rstream_;
+  struct LZ4F_cctx_s* wstream_;
+  const int comp_level_;
+};
+
+/**
+ * An LZ4 dictionary, digested for compression.  It is immutable and can be
+ * shared by any number of transports.
+ *
+ * LZ4 uses up to the last 64KB of the dictionary; "zstd --train" produces
+ * good ones.
+ */
+class TLZ4Dictionary {
+ public:
+  explicit TLZ4Dictionary(const std::string& data);
+
+  ~TLZ4Dictionary();
+
+  const std::string& getData() const { return data_; }
+  struct LZ4F_CDict_s* getCDict() const { return cdict_; }
+
+ private:
+  TLZ4Dictionary(const TLZ4Dictionary&);
+  TLZ4Dictionary& operator=(const TLZ4Dictionary&);
+
+  std::string data_;
+  struct LZ4F_CDict_s* cdict_;
+};
+
+/**
+ * Wraps a transport into an LZ4 compressed one.
+ *
+ */
+class TLZ4TransportFactory : public TTransportFactory {
+ public:
+  TLZ4TransportFactory(int comp_level = TLZ4Transport::DEFAULT_COMP_LEVEL,
+                       boost::shared_ptr<TLZ4Dictionary> dictionary =
+                         boost::shared_ptr<TLZ4Dictionary>()) :
+    comp_level_(comp_level),
+    dictionary_(dictionary) {}
+
+  virtual ~TLZ4TransportFactory() {}
+
+  virtual boost::shared_ptr<TTransport> getTransport(
+                                         boost::shared_ptr<TTransport> trans) {
+    return boost::shared_ptr<TTransport>(
+      new TLZ4Transport(trans,
+                        TLZ4Transport::DEFAULT_URBUF_SIZE,
+                        TLZ4Transport::DEFAULT_CRBUF_SIZE,
+                        TLZ4Transport::DEFAULT_UWBUF_SIZE,
+                        TLZ4Transport::DEFAULT_CWBUF_SIZE,
+                        comp_level_,
+                        dictionary_));
+  }
+
+ private:
+  int comp_level_;
+  boost::shared_ptr<TLZ4Dictionary> dictionary_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TLZ4TRANSPORT_H_
@@ -0,0 +1,452 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/transport/TMappedFileTransport.h>
+#include <thrift/transport/PlatformSocket.h>
+#include <thrift/TLogging.h>
+
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <sys/mman.h>
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+namespace apache { namespace thrift { namespace transport {
+
+using namespace std;
+
+const uint32_t TMappedFileTransport::DEFAULT_READ_AHEAD_SIZE;
+const uint32_t TMappedFileTransport::DEFAULT_CHUNK_SIZE;
+const uint32_t TMappedFileTransport::DEFAULT_EOF_SLEEP_TIME_US;
+
+TMappedFileTransport::TMappedFileTransport(string path)
+  : filename_(path)
+  , fd_(-1)
+  , map_(NULL)
+  , mapLen_(0)
+  , rpos_(0)
+  , rend_(0)
+  , adviseMark_(0)
+  , readTimeout_(TFileTransport::NO_TAIL_READ_TIMEOUT)
+  , chunkSize_(DEFAULT_CHUNK_SIZE)
+  , maxEventSize_(0)
+  , eofSleepTime_(DEFAULT_EOF_SLEEP_TIME_US)
+  , readAheadSize_(DEFAULT_READ_AHEAD_SIZE)
+{
+  fd_ = ::open(filename_.c_str(), O_RDONLY);
+  if (fd_ == -1) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    GlobalOutput.perror("TMappedFileTransport: ::open() file: " + filename_, errno_copy);
+    throw TTransportException(TTransportException::NOT_OPEN, filename_, errno_copy);
+  }
+
+  try {
+    remap();
+  } catch (...) {
+    close();
+    throw;
+  }
+}
+
+TMappedFileTransport::~TMappedFileTransport() {
+  close();
+}
+
+void TMappedFileTransport::close() {
+  unmap();
+  if (fd_ >= 0) {
+    if (-1 == ::close(fd_)) {
+      GlobalOutput.perror("TMappedFileTransport: ::close() ", THRIFT_GET_SOCKET_ERROR);
+    }
+    fd_ = -1;
+  }
+}
+
+bool TMappedFileTransport::peek() {
+  if (rpos_ == rend_ && !nextEvent()) {
+    return false;
+  }
+  return true;
+}
+
+uint32_t TMappedFileTransport::read(uint8_t* buf, uint32_t len) {
+  if (rpos_ == rend_ && !nextEvent()) {
+    return 0;
+  }
+
+  // never hand out more than what is left of the current event
+  uint32_t remaining = static_cast<uint32_t>(rend_ - rpos_);
+  if (len > remaining) {
+    len = remaining;
+  }
+  memcpy(buf, map_ + rpos_, len);
+  rpos_ += len;
+  return len;
+}
+
+uint32_t TMappedFileTransport::readAll(uint8_t* buf, uint32_t len) {
+  uint32_t have = 0;
+  uint32_t get = 0;
+
+  while (have < len) {
+    get = read(buf+have, len-have);
+    if (get <= 0) {
+      throw TEOFException();
+    }
+    have += get;
+  }
+
+  return have;
+}
+
+const uint8_t* TMappedFileTransport::borrow(uint8_t* buf, uint32_t* len) {
+  (void) buf;
+  if (rpos_ == rend_ && !nextEvent()) {
+    return NULL;
+  }
+
+  uint32_t remaining = static_cast<uint32_t>(rend_ - rpos_);
+  if (remaining < *len) {
+    return NULL;
+  }
+  *len = remaining;
+  return map_ + rpos_;
+}
+
+bool TMappedFileTransport::readFullEvent(std::string* event) {
+  if (rpos_ == rend_ && !nextEvent()) {
+    return false;
+  }
+  event->assign(reinterpret_cast<const char*>(map_ + rpos_),
+                static_cast<size_t>(rend_ - rpos_));
+  rpos_ = rend_;
+  return true;
+}
+
+void TMappedFileTransport::consume(uint32_t len) {
+  if (len > rend_ - rpos_) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "consume did not follow a borrow.");
+  }
+  rpos_ += len;
+}
+
+bool TMappedFileTransport::nextEvent() {
+  int readTries = 0;
+
+  while (true) {
+    if (findEvent()) {
+      readAhead();
+      return true;
+    }
+
+    // the writer may have appended since we last mapped the file
+    if (remap()) {
+      continue;
+    }
+
+    if (readTimeout_ == TFileTransport::TAIL_READ_TIMEOUT) {
+      THRIFT_SLEEP_USEC(eofSleepTime_);
+      continue;
+    } else if (readTimeout_ > 0 && readTries == 0) {
+      THRIFT_SLEEP_USEC(readTimeout_ * 1000);
+      readTries++;
+      continue;
+    }
+    return false;
+  }
+}
+
+bool TMappedFileTransport::findEvent() {
+  off_t pos = rend_;
+
+  while (true) {
+    // TFileTransport never lets the size field straddle a chunk boundary
+    if (pos / chunkSize_ != (pos + 3) / chunkSize_) {
+      pos = (pos / chunkSize_ + 1) * chunkSize_;
+    }
+
+    if (pos + 4 > mapLen_) {
+      break;
+    }
+
+    uint32_t eventSize;
+    memcpy(&eventSize, map_ + pos, sizeof(eventSize));
+
+    if (eventSize == 0) {
+      // 0 length event indicates padding, which runs to the end of the chunk
+      pos = (pos / chunkSize_ + 1) * chunkSize_;
+      continue;
+    }
+
+    if (eventSize & TFileTransport::COMPRESSED_BLOCK_FLAG) {
+      throw TTransportException(TTransportException::NOT_OPEN,
+                                "TMappedFileTransport: log has compressed blocks, "
+                                "read it with TFileTransport");
+    }
+
+    if ((maxEventSize_ > 0) && (eventSize > maxEventSize_)) {
+      T_ERROR("Read corrupt event. Event size(%u) greater than max event size (%u)",
+              eventSize, maxEventSize_);
+      pos = skipCorruptedChunk(pos);
+      continue;
+    } else if (eventSize > chunkSize_) {
+      T_ERROR("Read corrupt event. Event size(%u) greater than chunk size (%u)",
+              eventSize, chunkSize_);
+      pos = skipCorruptedChunk(pos);
+      continue;
+    } else if ((pos / chunkSize_) != ((pos + 4 + eventSize - 1) / chunkSize_)) {
+      T_ERROR("Read corrupt event. Event crosses chunk boundary. Event size:%u  Offset:%lu",
+              eventSize, static_cast<unsigned long>(pos + 4));
+      pos = skipCorruptedChunk(pos);
+      continue;
+    }
+
+    // the writer has not finished appending this one yet
+    if (pos + 4 + eventSize > mapLen_) {
+      break;
+    }
+
+    rpos_ = pos + 4;
+    rend_ = rpos_ + eventSize;
+    return true;
+  }
+
+  // everything before pos was padding or skipped, so don't rescan it
+  rpos_ = rend_ = pos;
+  return false;
+}
+
+off_t TMappedFileTransport::skipCorruptedChunk(off_t offset) {
+  off_t nextChunk = (offset / chunkSize_ + 1) * chunkSize_;
+
+  // if tailing the file, the scan resumes once the next chunk shows up
+  if (nextChunk < mapLen_ || readTimeout_ == TFileTransport::TAIL_READ_TIMEOUT) {
+    return nextChunk;
+  }
+
+  // nothing to skip to: leave the reader at the last good event and punt
+  rpos_ = rend_;
+  char errorMsg[1024];
+  sprintf(errorMsg, "TMappedFileTransport: log file corrupted at offset: %lu",
+          static_cast<unsigned long>(offset));
+  GlobalOutput(errorMsg);
+  throw TTransportException(errorMsg);
+}
+
+bool TMappedFileTransport::remap() {
+  if (fd_ < 0) {
+    throw TTransportException(TTransportException::NOT_OPEN, "File not open");
+  }
+
+  struct stat f_info;
+  if (fstat(fd_, &f_info) < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "TMappedFileTransport::remap() (fstat)",
+                              errno_copy);
+  }
+
+  // logs only ever grow; ignore the file being truncated underneath us
+  if (f_info.st_size <= mapLen_) {
+    return false;
+  }
+  if (static_cast<uint64_t>(f_info.st_size) > (std::numeric_limits<size_t>::max)()) {
+    throw TTransportException("TMappedFileTransport: file too large to map");
+  }
+
+  unmap();
+  void* map = mmap(NULL, static_cast<size_t>(f_info.st_size), PROT_READ,
+                   MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    GlobalOutput.perror("TMappedFileTransport: mmap() ", errno_copy);
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "TMappedFileTransport::remap() (mmap)",
+                              errno_copy);
+  }
+  map_ = static_cast<uint8_t*>(map);
+  mapLen_ = f_info.st_size;
+
+  // the advice is per mapping, so it has to be given again every time
+  madvise(map_, static_cast<size_t>(mapLen_), MADV_SEQUENTIAL);
+  adviseMark_ = rpos_;
+  return true;
+}
+
+void TMappedFileTransport::unmap() {
+  if (map_ != NULL) {
+    munmap(map_, static_cast<size_t>(mapLen_));
+    map_ = NULL;
+    mapLen_ = 0;
+  }
+}
+
+void TMappedFileTransport::readAhead() {
+  if (readAheadSize_ == 0 || rpos_ < adviseMark_) {
+    return;
+  }
+
+  static const off_t pageSize = sysconf(_SC_PAGESIZE);
+  off_t start = rpos_ - (rpos_ % pageSize);
+  off_t len = mapLen_ - start;
+  if (len > readAheadSize_) {
+    len = readAheadSize_;
+  }
+  madvise(map_ + start, static_cast<size_t>(len), MADV_WILLNEED);
+
+  // ask again once half of this window has been consumed, so the kernel
+  // always has work queued ahead of the reader
+  adviseMark_ = rpos_ + readAheadSize_ / 2;
+}
+
+void TMappedFileTransport::seekToChunk(int32_t chunk) {
+  if (fd_ < 0) {
+    throw TTransportException("File not open");
+  }
+
+  int32_t numChunks = getNumChunks();
+
+  // file is empty, seeking to chunk is pointless
+  if (numChunks == 0) {
+    return;
+  }
+
+  // negative indicates reverse seek (from the end)
+  if (chunk < 0) {
+    chunk += numChunks;
+  }
+
+  // too large a value for reverse seek, just seek to beginning
+  if (chunk < 0) {
+    T_DEBUG("%s", "Incorrect value for reverse seek. Seeking to beginning...");
+    chunk = 0;
+  }
+
+  // cannot seek past EOF
+  bool seekToEnd = false;
+  if (chunk >= numChunks) {
+    T_DEBUG("%s", "Trying to seek past EOF. Seeking to EOF instead...");
+    seekToEnd = true;
+    chunk = numChunks - 1;
+  }
+
+  remap();
+  rpos_ = rend_ = off_t(chunk) * chunkSize_;
+  adviseMark_ = rpos_;
+
+  // skip over every complete event at the point of the call; only the size
+  // fields are touched, not the event bodies
+  if (seekToEnd) {
+    while (findEvent()) {
+      rpos_ = rend_;
+    }
+  }
+}
+
+void TMappedFileTransport::seekToEnd() {
+  seekToChunk(getNumChunks());
+}
+
+void TMappedFileTransport::seekToEvent(uint64_t eventNumber) {
+  if (fd_ < 0) {
+    throw TTransportException("File not open");
+  }
+  if (!index_) {
+    index_.reset(new TFileTransportIndex(TFileTransportIndex::pathFor(filename_)));
+  }
+  index_->load();
+
+  // start from the closest indexed event, or the top if there is none
+  TFileTransportIndex::Entry entry;
+  uint64_t curEvent = 0;
+  off_t offset = 0;
+  if (index_->findEvent(eventNumber, &entry)) {
+    curEvent = entry.eventNumber;
+    offset = static_cast<off_t>(entry.offset);
+  }
+
+  remap();
+  rpos_ = rend_ = offset;
+  while (curEvent < eventNumber && findEvent()) {
+    rpos_ = rend_;
+    curEvent++;
+  }
+  adviseMark_ = rpos_;
+}
+
+void TMappedFileTransport::seekToTime(int64_t timestampUs) {
+  if (fd_ < 0) {
+    throw TTransportException("File not open");
+  }
+  if (!index_) {
+    index_.reset(new TFileTransportIndex(TFileTransportIndex::pathFor(filename_)));
+  }
+  index_->load();
+
+  TFileTransportIndex::Entry entry;
+  off_t offset = 0;
+  if (index_->findTime(timestampUs, &entry)) {
+    offset = static_cast<off_t>(entry.offset);
+  }
+
+  remap();
+  rpos_ = rend_ = offset;
+  adviseMark_ = rpos_;
+}
+
+uint32_t TMappedFileTransport::getNumChunks() {
+  if (fd_ < 0) {
+    return 0;
+  }
+
+  struct stat f_info;
+  int rv = fstat(fd_, &f_info);
+
+  if (rv < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    throw TTransportException(TTransportException::UNKNOWN,
+                              "TMappedFileTransport::getNumChunks() (fstat)",
+                              errno_copy);
+  }
+
+  if (f_info.st_size > 0) {
+    size_t numChunks = ((f_info.st_size)/chunkSize_) + 1;
+    if (numChunks > (std::numeric_limits<uint32_t>::max)())
+      throw TTransportException("Too many chunks");
+    return static_cast<uint32_t>(numChunks);
+  }
+
+  // empty file has no chunks
+  return 0;
+}
+
+uint32_t TMappedFileTransport::getCurChunk() {
+  return static_cast<uint32_t>(rpos_/chunkSize_);
+}
+
+}}} // apache::thrift::transport
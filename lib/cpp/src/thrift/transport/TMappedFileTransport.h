@@ -0,0 +1,183 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TMAPPEDFILETRANSPORT_H_
+#define _THRIFT_TRANSPORT_TMAPPEDFILETRANSPORT_H_ 1
+
+#include <thrift/transport/TFileTransport.h>
+
+#include <string>
+#include <sys/types.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Read-only transport over a log written by TFileTransport that maps the
+ * file into memory instead of copying it through a read buffer.
+ *
+ * Each read() or borrow() is served straight out of the mapping and never
+ * crosses an event boundary, so a protocol can borrow() whole fields without
+ * any copy.  Pointers returned by borrow() stay valid until the next call
+ * that has to look for a new event, since tailing a growing file remaps it.
+ *
+ * The mapping is advised MADV_SEQUENTIAL and the kernel is asked to fault in
+ * the next getReadAheadSize() bytes ahead of the reader.  seekToChunk() is a
+ * pointer move, and seekToEnd() only walks event headers in the last chunk.
+ * With a TFileTransportIndex, seekToEvent() walks at most one index
+ * interval's worth of headers.
+ */
+class TMappedFileTransport : public TFileReaderTransport {
+ public:
+  TMappedFileTransport(std::string path);
+  ~TMappedFileTransport();
+
+  bool isOpen() {
+    return fd_ >= 0;
+  }
+  void close();
+
+  bool peek();
+  uint32_t read(uint8_t* buf, uint32_t len);
+  uint32_t readAll(uint8_t* buf, uint32_t len);
+  const uint8_t* borrow(uint8_t* buf, uint32_t* len);
+  void consume(uint32_t len);
+
+  // log-file specific functions
+  void seekToChunk(int32_t chunk);
+  void seekToEnd();
+  uint32_t getNumChunks();
+  uint32_t getCurChunk();
+  void seekToEvent(uint64_t eventNumber);
+  void seekToTime(int64_t timestampUs);
+  bool readFullEvent(std::string* event);
+
+  // Setter/Getter functions for user-controllable options.  The timeout
+  // values have the same meaning as for TFileTransport.
+  void setReadTimeout(int32_t readTimeout) {
+    readTimeout_ = readTimeout;
+  }
+  int32_t getReadTimeout() {
+    return readTimeout_;
+  }
+
+  void setChunkSize(uint32_t chunkSize) {
+    if (chunkSize) {
+      chunkSize_ = chunkSize;
+    }
+  }
+  uint32_t getChunkSize() {
+    return chunkSize_;
+  }
+
+  void setMaxEventSize(uint32_t maxEventSize) {
+    maxEventSize_ = maxEventSize;
+  }
+  uint32_t getMaxEventSize() {
+    return maxEventSize_;
+  }
+
+  void setEofSleepTimeUs(uint32_t eofSleepTime) {
+    if (eofSleepTime) {
+      eofSleepTime_ = eofSleepTime;
+    }
+  }
+  uint32_t getEofSleepTimeUs() {
+    return eofSleepTime_;
+  }
+
+  // 0 disables explicit readahead and leaves it to MADV_SEQUENTIAL
+  void setReadAheadSize(uint32_t readAheadSize) {
+    readAheadSize_ = readAheadSize;
+    adviseMark_ = rpos_;
+  }
+  uint32_t getReadAheadSize() {
+    return readAheadSize_;
+  }
+
+  /*
+   * Override TTransport *_virt() functions to invoke our implementations.
+   * We cannot use TVirtualTransport to provide these, since we need to inherit
+   * virtually from TTransport.
+   */
+  virtual uint32_t read_virt(uint8_t* buf, uint32_t len) {
+    return this->read(buf, len);
+  }
+  virtual uint32_t readAll_virt(uint8_t* buf, uint32_t len) {
+    return this->readAll(buf, len);
+  }
+  virtual const uint8_t* borrow_virt(uint8_t* buf, uint32_t* len) {
+    return this->borrow(buf, len);
+  }
+  virtual void consume_virt(uint32_t len) {
+    this->consume(len);
+  }
+  virtual bool peek_virt() {
+    return this->peek();
+  }
+
+ private:
+  // Position rpos_/rend_ on the next complete event, waiting for the file
+  // to grow as dictated by readTimeout_.  Returns false if none turned up.
+  bool nextEvent();
+
+  // Scan forward from rend_ for a complete event already in the mapping
+  bool findEvent();
+
+  // Like TFileTransport::performRecovery(), minus the reread of the chunk.
+  // Returns the offset to resume scanning from.
+  off_t skipCorruptedChunk(off_t offset);
+
+  // (Re)map the file if its size changed; returns true if it grew
+  bool remap();
+  void unmap();
+
+  // Ask the kernel to start faulting in the data after rpos_
+  void readAhead();
+
+  std::string filename_;
+  int fd_;
+
+  uint8_t* map_;
+  off_t mapLen_;
+
+  // unread part of the current event, as file offsets into map_
+  off_t rpos_;
+  off_t rend_;
+
+  // rpos_ past which the next readahead request is issued
+  off_t adviseMark_;
+
+  // loaded on the first seek by event or time, and topped up on later ones
+  boost::scoped_ptr<TFileTransportIndex> index_;
+
+  int32_t readTimeout_;
+  uint32_t chunkSize_;
+  uint32_t maxEventSize_;
+  uint32_t eofSleepTime_;
+
+  uint32_t readAheadSize_;
+  static const uint32_t DEFAULT_READ_AHEAD_SIZE = 4 * 1024 * 1024;
+
+  static const uint32_t DEFAULT_CHUNK_SIZE = 16 * 1024 * 1024;
+  static const uint32_t DEFAULT_EOF_SLEEP_TIME_US = 500 * 1000;
+};
+
+}}} // apache::thrift::transport
+
+#endif // _THRIFT_TRANSPORT_TMAPPEDFILETRANSPORT_H_
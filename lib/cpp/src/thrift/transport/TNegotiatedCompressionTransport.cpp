@@ -0,0 +1,174 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/transport/TNegotiatedCompressionTransport.h>
+
+#include <boost/lexical_cast.hpp>
+
+namespace apache { namespace thrift { namespace transport {
+
+using boost::shared_ptr;
+
+const uint8_t TNegotiatedCompressionTransport::HEADER_MAGIC;
+const uint8_t TNegotiatedCompressionTransport::HEADER_VERSION;
+const uint32_t TNegotiatedCompressionTransport::HEADER_SIZE;
+
+TNegotiatedCompressionTransport::TNegotiatedCompressionTransport(
+    shared_ptr<TTransport> transport,
+    uint8_t codec,
+    shared_ptr<TTransportFactory> codecFactory) :
+  transport_(transport),
+  codec_(codec),
+  client_(true),
+  headerSent_(false),
+  headerPos_(0) {
+  if (codecFactory) {
+    codecTransport_ = codecFactory->getTransport(transport_);
+  } else {
+    codecTransport_ = transport_;
+  }
+}
+
+TNegotiatedCompressionTransport::TNegotiatedCompressionTransport(
+    shared_ptr<TTransport> transport,
+    shared_ptr<const CodecMap> codecs) :
+  transport_(transport),
+  codecs_(codecs),
+  codec_(CODEC_NONE),
+  client_(false),
+  headerSent_(false),
+  headerPos_(0) {
+}
+
+bool TNegotiatedCompressionTransport::isOpen() {
+  return negotiated() ? codecTransport_->isOpen() : transport_->isOpen();
+}
+
+bool TNegotiatedCompressionTransport::peek() {
+  return negotiated() ? codecTransport_->peek() : transport_->peek();
+}
+
+bool TNegotiatedCompressionTransport::readHeader() {
+  while (headerPos_ < HEADER_SIZE) {
+    uint32_t got = transport_->read(header_ + headerPos_, HEADER_SIZE - headerPos_);
+    if (got == 0) {
+      if (headerPos_ == 0) {
+        // The peer went away, or there is nothing to read yet
+        return false;
+      }
+      throw TTransportException(TTransportException::END_OF_FILE,
+                                "TNegotiatedCompressionTransport: truncated header");
+    }
+    headerPos_ += got;
+  }
+
+  if (header_[0] != HEADER_MAGIC || header_[1] != HEADER_VERSION) {
+    throw TTransportException(TTransportException::CORRUPTED_DATA,
+                              "TNegotiatedCompressionTransport: bad header");
+  }
+
+  CodecMap::const_iterator it = codecs_->find(header_[2]);
+  if (it == codecs_->end()) {
+    throw TTransportException(TTransportException::CORRUPTED_DATA,
+                              "TNegotiatedCompressionTransport: codec " +
+                              boost::lexical_cast<std::string>((int)header_[2]) +
+                              " not accepted");
+  }
+
+  codec_ = header_[2];
+  if (it->second) {
+    codecTransport_ = it->second->getTransport(transport_);
+  } else {
+    codecTransport_ = transport_;
+  }
+  return true;
+}
+
+void TNegotiatedCompressionTransport::sendHeader() {
+  if (client_ && !headerSent_) {
+    uint8_t header[HEADER_SIZE] = { HEADER_MAGIC, HEADER_VERSION, codec_ };
+    transport_->write(header, HEADER_SIZE);
+    headerSent_ = true;
+  }
+}
+
+uint32_t TNegotiatedCompressionTransport::read(uint8_t* buf, uint32_t len) {
+  if (!negotiated() && !readHeader()) {
+    return 0;
+  }
+  return codecTransport_->read(buf, len);
+}
+
+void TNegotiatedCompressionTransport::write(const uint8_t* buf, uint32_t len) {
+  if (!negotiated()) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TNegotiatedCompressionTransport: write() before "
+                              "the peer announced a codec");
+  }
+  sendHeader();
+  codecTransport_->write(buf, len);
+}
+
+void TNegotiatedCompressionTransport::flush() {
+  if (negotiated()) {
+    // Codecs may write out something even if no data was written
+    sendHeader();
+    codecTransport_->flush();
+  } else {
+    transport_->flush();
+  }
+}
+
+uint32_t TNegotiatedCompressionTransport::readEnd() {
+  return negotiated() ? codecTransport_->readEnd() : transport_->readEnd();
+}
+
+uint32_t TNegotiatedCompressionTransport::writeEnd() {
+  return negotiated() ? codecTransport_->writeEnd() : transport_->writeEnd();
+}
+
+shared_ptr<TTransport> TNegotiatedCompressionTransportFactory::getTransport(
+    shared_ptr<TTransport> trans) {
+  concurrency::Guard g(mutex_);
+
+  UnpairedMap::iterator it = unpaired_.find(trans.get());
+  if (it != unpaired_.end()) {
+    shared_ptr<TNegotiatedCompressionTransport> paired = it->second.lock();
+    unpaired_.erase(it);
+    if (paired) {
+      return paired;
+    }
+  }
+
+  // Forget transports whose other half was never asked for
+  for (it = unpaired_.begin(); it != unpaired_.end(); ) {
+    if (it->second.expired()) {
+      unpaired_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  shared_ptr<TNegotiatedCompressionTransport> result(
+    new TNegotiatedCompressionTransport(trans, codecs_));
+  unpaired_[trans.get()] = result;
+  return result;
+}
+
+}}} // apache::thrift::transport
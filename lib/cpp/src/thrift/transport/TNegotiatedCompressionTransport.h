@@ -0,0 +1,168 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TNEGOTIATEDCOMPRESSIONTRANSPORT_H_
+#define _THRIFT_TRANSPORT_TNEGOTIATEDCOMPRESSIONTRANSPORT_H_ 1
+
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/transport/TTransport.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Lets one server accept clients compressing with different codecs.
+ *
+ * Before its first byte of data the client sends a three byte header: a
+ * magic byte, a version and the id of its codec.  The server looks the id up
+ * among the codecs it accepts, decompresses the rest of the input with it and
+ * compresses its replies with it too, without a header of its own.
+ *
+ * The codecs themselves are TTransportFactory objects wrapping the stream:
+ * TZlibTransportFactory, TLZ4TransportFactory or TZstdTransportFactory, or
+ * any other with an id both ends agree on.  A NULL factory means no
+ * compression.
+ */
+class TNegotiatedCompressionTransport
+  : public TVirtualTransport<TNegotiatedCompressionTransport> {
+ public:
+  /// Codec ids for the compression transports that come with Thrift
+  enum Codec {
+    CODEC_NONE = 0,
+    CODEC_ZLIB = 1,
+    CODEC_LZ4 = 2,
+    CODEC_ZSTD = 3
+  };
+
+  typedef std::map<uint8_t, boost::shared_ptr<TTransportFactory> > CodecMap;
+
+  static const uint8_t HEADER_MAGIC = 0xc7;
+  static const uint8_t HEADER_VERSION = 1;
+  static const uint32_t HEADER_SIZE = 3;
+
+  /**
+   * Client side: announce codec, then compress with what codecFactory makes.
+   */
+  TNegotiatedCompressionTransport(boost::shared_ptr<TTransport> transport,
+                                  uint8_t codec,
+                                  boost::shared_ptr<TTransportFactory> codecFactory);
+
+  /**
+   * Server side: use whichever of codecs the peer announces.
+   */
+  TNegotiatedCompressionTransport(boost::shared_ptr<TTransport> transport,
+                                  boost::shared_ptr<const CodecMap> codecs);
+
+  bool isOpen();
+  bool peek();
+
+  void open() {
+    transport_->open();
+  }
+
+  void close() {
+    transport_->close();
+  }
+
+  uint32_t read(uint8_t* buf, uint32_t len);
+
+  void write(const uint8_t* buf, uint32_t len);
+
+  void flush();
+
+  uint32_t readEnd();
+  uint32_t writeEnd();
+
+  /// Whether the codec is known: always on the client, after the header on the server
+  bool negotiated() const {
+    return codecTransport_ != NULL;
+  }
+
+  /// The codec id; only meaningful once negotiated()
+  uint8_t getCodec() const {
+    return codec_;
+  }
+
+  boost::shared_ptr<TTransport> getUnderlyingTransport() {
+    return transport_;
+  }
+
+ private:
+  bool readHeader();
+  void sendHeader();
+
+  boost::shared_ptr<TTransport> transport_;
+  boost::shared_ptr<const CodecMap> codecs_;
+
+  /// The compressing transport, or transport_ for CODEC_NONE
+  boost::shared_ptr<TTransport> codecTransport_;
+
+  uint8_t codec_;
+  bool client_;
+  bool headerSent_;
+  uint8_t header_[HEADER_SIZE];
+  uint32_t headerPos_;
+};
+
+/**
+ * Makes server side TNegotiatedCompressionTransports.
+ *
+ * Servers ask for an input and an output transport for each client.  Both
+ * have to be the same object so that replies use the codec the request
+ * came with, so when the same client transport is passed twice the second
+ * call returns what the first one made.  TSimpleServer, TThreadedServer and
+ * TThreadPoolServer do this if this factory is both their input and output
+ * transport factory.  TNonblockingServer wraps different buffers for each
+ * direction and can't use it.
+ */
+class TNegotiatedCompressionTransportFactory : public TTransportFactory {
+ public:
+  TNegotiatedCompressionTransportFactory() :
+    codecs_(new TNegotiatedCompressionTransport::CodecMap()) {}
+
+  virtual ~TNegotiatedCompressionTransportFactory() {}
+
+  /**
+   * Accept codec, decoding and encoding with what factory makes.  All codecs
+   * must be added before the server starts.
+   */
+  void addCodec(uint8_t codec, boost::shared_ptr<TTransportFactory> factory) {
+    (*codecs_)[codec] = factory;
+  }
+
+  virtual boost::shared_ptr<TTransport> getTransport(
+                                         boost::shared_ptr<TTransport> trans);
+
+ private:
+  typedef std::map<TTransport*, boost::weak_ptr<TNegotiatedCompressionTransport> >
+    UnpairedMap;
+
+  boost::shared_ptr<TNegotiatedCompressionTransport::CodecMap> codecs_;
+
+  /// Transports made once, waiting for the other direction to ask
+  UnpairedMap unpaired_;
+  concurrency::Mutex mutex_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TNEGOTIATEDCOMPRESSIONTRANSPORT_H_
@@ -17,31 +17,124 @@
  * under the License.
  */
 
+#include <thrift/concurrency/ThreadManager.h>
 #include <thrift/transport/TSSLServerSocket.h>
 #include <thrift/transport/TSSLSocket.h>
 
 namespace apache { namespace thrift { namespace transport {
 
 using namespace boost;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::ThreadManager;
+
+/**
+ * Runs one accepted connection's handshake for setHandshakeThreadManager().
+ */
+class TSSLServerSocket::Handshake : public Runnable {
+ public:
+  Handshake(TSSLServerSocket* server, shared_ptr<TSSLSocket> socket)
+    : server_(server), socket_(socket) {}
+
+  void run() {
+    bool ok = false;
+    try {
+      socket_->handshake();
+      ok = true;
+    } catch (const TTransportException& te) {
+      GlobalOutput.printf("TSSLServerSocket handshake: %s", te.what());
+    }
+    server_->handshakeDone(socket_, ok);
+  }
+
+ private:
+  TSSLServerSocket* server_;
+  shared_ptr<TSSLSocket> socket_;
+};
 
 /**
  * SSL server socket implementation.
  */
 TSSLServerSocket::TSSLServerSocket(int port,
                                    shared_ptr<TSSLSocketFactory> factory):
-                                   TServerSocket(port), factory_(factory) {
+                                   TServerSocket(port), factory_(factory),
+                                   closing_(false) {
   factory_->server(true);
 }
 
 TSSLServerSocket::TSSLServerSocket(int port, int sendTimeout, int recvTimeout,
                                    shared_ptr<TSSLSocketFactory> factory):
                                    TServerSocket(port, sendTimeout, recvTimeout),
-                                   factory_(factory) {
+                                   factory_(factory), closing_(false) {
   factory_->server(true);
 }
 
+TSSLServerSocket::~TSSLServerSocket() {
+  close();
+}
+
+void TSSLServerSocket::setHandshakeThreadManager(shared_ptr<ThreadManager> threads) {
+  handshakeThreads_ = threads;
+}
+
 shared_ptr<TSocket> TSSLServerSocket::createSocket(int client) {
   return factory_->createSocket(client);
 }
 
+bool TSSLServerSocket::handOff(shared_ptr<TSocket> client) {
+  shared_ptr<TSSLSocket> socket = dynamic_pointer_cast<TSSLSocket>(client);
+  if (!handshakeThreads_ || !socket) {
+    return false;
+  }
+  {
+    Synchronized s(handshakeMonitor_);
+    if (closing_) {
+      return false;
+    }
+    handshaking_.insert(socket.get());
+  }
+  try {
+    handshakeThreads_->add(shared_ptr<Runnable>(new Handshake(this, socket)));
+  } catch (const TException& te) {
+    // Left for the first read or write to shake hands, as without threads
+    GlobalOutput.printf("TSSLServerSocket::handOff() %s", te.what());
+    Synchronized s(handshakeMonitor_);
+    handshaking_.erase(socket.get());
+    handshakeMonitor_.notifyAll();
+    return false;
+  }
+  return true;
+}
+
+void TSSLServerSocket::handshakeDone(shared_ptr<TSSLSocket> socket, bool ok) {
+  {
+    Synchronized s(handshakeMonitor_);
+    handshaking_.erase(socket.get());
+    if (ok && !closing_) {
+      addAcceptedTransport(socket);
+    }
+    handshakeMonitor_.notifyAll();
+  }
+  if (!ok) {
+    socket->close();
+  }
+}
+
+void TSSLServerSocket::close() {
+  {
+    Synchronized s(handshakeMonitor_);
+    closing_ = true;
+    // Handshakes waiting on their clients fail at once
+    for (std::set<TSSLSocket*>::iterator it = handshaking_.begin();
+         it != handshaking_.end(); ++it) {
+      shutdown((*it)->getSocketFD(), THRIFT_SHUT_RDWR);
+    }
+    while (!handshaking_.empty()) {
+      handshakeMonitor_.wait();
+    }
+    closing_ = false;
+  }
+  TServerSocket::close();
+}
+
 }}}
@@ -20,11 +20,20 @@
 #ifndef _THRIFT_TRANSPORT_TSSLSERVERSOCKET_H_
 #define _THRIFT_TRANSPORT_TSSLSERVERSOCKET_H_ 1
 
+#include <set>
 #include <boost/shared_ptr.hpp>
+#include <thrift/concurrency/Monitor.h>
 #include <thrift/transport/TServerSocket.h>
 
-namespace apache { namespace thrift { namespace transport {
+namespace apache { namespace thrift {
 
+namespace concurrency {
+class ThreadManager;
+}
+
+namespace transport {
+
+class TSSLSocket;
 class TSSLSocketFactory;
 
 /**
@@ -49,11 +58,43 @@ class TSSLServerSocket: public TServerSocket {
    */
   TSSLServerSocket(int port, int sendTimeout, int recvTimeout,
                    boost::shared_ptr<TSSLSocketFactory> factory);
+
+  ~TSSLServerSocket();
+
+  /**
+   * Run the handshakes of accepted connections on threads' workers, and
+   * have accept() return only connections whose handshake is done, rather
+   * than each handshake happening on whichever thread first uses the
+   * connection.  Handshakes then go on in parallel however the server
+   * serves connections, and clients that fail theirs never reach it.  A
+   * receive timeout keeps a client that stalls from holding a worker.
+   *
+   * @param threads A started ThreadManager; NULL turns it off
+   */
+  void setHandshakeThreadManager(boost::shared_ptr<concurrency::ThreadManager> threads);
+
+  /**
+   * Also aborts handshakes under way and waits for them to end.
+   */
+  void close();
+
  protected:
   boost::shared_ptr<TSocket> createSocket(int socket);
+  bool handOff(boost::shared_ptr<TSocket> client);
   boost::shared_ptr<TSSLSocketFactory> factory_;
+
+ private:
+  class Handshake;
+  void handshakeDone(boost::shared_ptr<TSSLSocket> socket, bool ok);
+
+  boost::shared_ptr<concurrency::ThreadManager> handshakeThreads_;
+  // guards the members below, and is notified as handshakes end
+  concurrency::Monitor handshakeMonitor_;
+  // sockets whose handshake is under way
+  std::set<TSSLSocket*> handshaking_;
+  bool closing_;
 };
 
-}}}
+}}} // apache::thrift::transport
 
 #endif
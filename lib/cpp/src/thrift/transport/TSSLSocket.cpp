@@ -39,13 +39,14 @@
 #include <thrift/transport/PlatformSocket.h>
 
 #define OPENSSL_VERSION_NO_THREAD_ID 0x10000000L
+#define OPENSSL_VERSION_TLS_METHOD   0x10100000L
 
 using namespace std;
 using namespace boost;
 using namespace apache::thrift::concurrency;
 
 struct CRYPTO_dynlock_value {
-  Mutex mutex;
+  ReadWriteMutex mutex;
 };
 
 namespace apache { namespace thrift { namespace transport {
@@ -55,24 +56,88 @@ static void buildErrors(string& message, int error = 0);
 static bool matchName(const char* host, const char* pattern, int size);
 static char uppercase(char c);
 
+// Sessions a server resumes are tied to this, see SSL_CTX_set_session_id_context
+static const unsigned char SESSION_ID_CONTEXT[] = "thrift";
+
+// Ciphertext received per recv() in non-blocking mode; one full record
+static const uint32_t NONBLOCKING_RECV_SIZE = 16 * 1024 + 512;
+
+// writeNonblocking() takes no more plaintext while this much is unsent
+static const size_t NONBLOCKING_OUTPUT_LIMIT = 64 * 1024;
+
 // SSLContext implementation
-SSLContext::SSLContext() {
-  ctx_ = SSL_CTX_new(TLSv1_method());
+SSLContext::SSLContext(): resumeSessions_(false) {
+  // Negotiate the highest version both sides have, from TLS 1.0 up
+#if (OPENSSL_VERSION_NUMBER >= OPENSSL_VERSION_TLS_METHOD)
+  ctx_ = SSL_CTX_new(TLS_method());
+#else
+  ctx_ = SSL_CTX_new(SSLv23_method());
+#endif
   if (ctx_ == NULL) {
     string errors;
     buildErrors(errors);
     throw TSSLException("SSL_CTX_new: " + errors);
   }
+#if (OPENSSL_VERSION_NUMBER >= OPENSSL_VERSION_TLS_METHOD)
+  SSL_CTX_set_min_proto_version(ctx_, TLS1_VERSION);
+#else
+  SSL_CTX_set_options(ctx_, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+#endif
   SSL_CTX_set_mode(ctx_, SSL_MODE_AUTO_RETRY);
+  SSL_CTX_set_session_id_context(ctx_, SESSION_ID_CONTEXT,
+                                 sizeof(SESSION_ID_CONTEXT) - 1);
 }
 
 SSLContext::~SSLContext() {
+  for (map<string, SSL_SESSION*>::iterator it = sessions_.begin();
+       it != sessions_.end(); ++it) {
+    SSL_SESSION_free(it->second);
+  }
+  sessions_.clear();
   if (ctx_ != NULL) {
     SSL_CTX_free(ctx_);
     ctx_ = NULL;
   }
 }
 
+void SSLContext::resumeSessions(bool flag) {
+  Guard guard(sessionMutex_);
+  resumeSessions_ = flag;
+  if (!flag) {
+    for (map<string, SSL_SESSION*>::iterator it = sessions_.begin();
+         it != sessions_.end(); ++it) {
+      SSL_SESSION_free(it->second);
+    }
+    sessions_.clear();
+  }
+}
+
+void SSLContext::saveSession(const string& key, SSL_SESSION* session) {
+  Guard guard(sessionMutex_);
+  SSL_SESSION*& slot = sessions_[key];
+  if (slot != NULL) {
+    SSL_SESSION_free(slot);
+  }
+  slot = session;
+}
+
+void SSLContext::applySession(const string& key, SSL* ssl) {
+  Guard guard(sessionMutex_);
+  map<string, SSL_SESSION*>::iterator it = sessions_.find(key);
+  if (it != sessions_.end()) {
+    SSL_set_session(ssl, it->second);
+  }
+}
+
+void SSLContext::removeSession(const string& key) {
+  Guard guard(sessionMutex_);
+  map<string, SSL_SESSION*>::iterator it = sessions_.find(key);
+  if (it != sessions_.end()) {
+    SSL_SESSION_free(it->second);
+    sessions_.erase(it);
+  }
+}
+
 SSL* SSLContext::createSSL() {
   SSL* ssl = SSL_new(ctx_);
   if (ssl == NULL) {
@@ -85,15 +150,18 @@ SSL* SSLContext::createSSL() {
 
 // TSSLSocket implementation
 TSSLSocket::TSSLSocket(boost::shared_ptr<SSLContext> ctx):
-  TSocket(), server_(false), ssl_(NULL), ctx_(ctx) {
+  TSocket(), server_(false), ssl_(NULL), nonblocking_(false),
+  handshakeDone_(false), inputBlocked_(false), outputPos_(0), ctx_(ctx) {
 }
 
 TSSLSocket::TSSLSocket(boost::shared_ptr<SSLContext> ctx, int socket):
-  TSocket(socket), server_(false), ssl_(NULL), ctx_(ctx) {
+  TSocket(socket), server_(false), ssl_(NULL), nonblocking_(false),
+  handshakeDone_(false), inputBlocked_(false), outputPos_(0), ctx_(ctx) {
 }
 
 TSSLSocket::TSSLSocket(boost::shared_ptr<SSLContext> ctx, string host, int port):
-  TSocket(host, port), server_(false), ssl_(NULL), ctx_(ctx) {
+  TSocket(host, port), server_(false), ssl_(NULL), nonblocking_(false),
+  handshakeDone_(false), inputBlocked_(false), outputPos_(0), ctx_(ctx) {
 }
 
 TSSLSocket::~TSSLSocket() {
@@ -142,7 +210,21 @@ void TSSLSocket::open() {
 }
 
 void TSSLSocket::close() {
-  if (ssl_ != NULL) {
+  if (ssl_ != NULL && nonblocking_) {
+    // Queue close_notify and send it if the socket takes it right away
+    SSL_shutdown(ssl_);
+    try {
+      flushNonblocking();
+    } catch (TTransportException&) {
+      // The peer is gone, nothing more to tell it
+    }
+    SSL_free(ssl_);
+    ssl_ = NULL;
+    nonblocking_ = false;
+    output_.clear();
+    outputPos_ = 0;
+    ERR_clear_error();
+  } else if (ssl_ != NULL) {
     int rc = SSL_shutdown(ssl_);
     if (rc == 0) {
       rc = SSL_shutdown(ssl_);
@@ -196,6 +278,232 @@ void TSSLSocket::write(const uint8_t* buf, uint32_t len) {
   }
 }
 
+void TSSLSocket::writev(const TIOVec* iov, uint32_t iovcnt) {
+  checkHandshake();
+  if (kernelTLSSend()) {
+    // The kernel frames whatever is sent into records, so skip OpenSSL
+    TSocket::writev(iov, iovcnt);
+    return;
+  }
+  for (uint32_t i = 0; i < iovcnt; ++i) {
+    write(iov[i].base, iov[i].len);
+  }
+}
+
+void TSSLSocket::transferFrom(int fd, off_t offset, uint32_t len) {
+  checkHandshake();
+  if (kernelTLSSend()) {
+    TSocket::transferFrom(fd, offset, len);
+    return;
+  }
+  TTransport::transferFrom(fd, offset, len);
+}
+
+void TSSLSocket::startNonblocking() {
+  if (!TSocket::isOpen()) {
+    throw TTransportException(TTransportException::NOT_OPEN);
+  }
+  if (ssl_ != NULL) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "startNonblocking: handshake already started");
+  }
+  BIO* rbio = BIO_new(BIO_s_mem());
+  BIO* wbio = BIO_new(BIO_s_mem());
+  if (rbio == NULL || wbio == NULL) {
+    if (rbio != NULL) {
+      BIO_free(rbio);
+    }
+    if (wbio != NULL) {
+      BIO_free(wbio);
+    }
+    string errors;
+    buildErrors(errors);
+    throw TSSLException("BIO_new: " + errors);
+  }
+  ssl_ = ctx_->createSSL();
+  SSL_set_bio(ssl_, rbio, wbio);
+  SSL_set_app_data(ssl_, this);
+  if (server()) {
+    SSL_set_accept_state(ssl_);
+  } else {
+    SSL_set_connect_state(ssl_);
+  }
+  nonblocking_ = true;
+  handshakeDone_ = false;
+  inputBlocked_ = false;
+  output_.clear();
+  outputPos_ = 0;
+}
+
+int32_t TSSLSocket::readNonblocking(uint8_t* buf, uint32_t len) {
+  if (!nonblocking_) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "readNonblocking: startNonblocking() not called");
+  }
+  uint32_t have = 0;
+  while (have < len) {
+    ERR_clear_error();
+    int rc = SSL_read(ssl_, buf + have, len - have);
+    checkHandshakeDone();
+    if (rc > 0) {
+      have += rc;
+      continue;
+    }
+    int error = SSL_get_error(ssl_, rc);
+    if (error == SSL_ERROR_WANT_READ) {
+      // Handshake messages and the like may be waiting to go out
+      flushNonblocking();
+      int32_t got = receiveNonblocking();
+      if (got > 0) {
+        continue;
+      }
+      if (have > 0) {
+        break;
+      }
+      return (got == 0) ? 0 : -1;
+    }
+    if (error == SSL_ERROR_ZERO_RETURN) {
+      break;
+    }
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    string errors;
+    buildErrors(errors, errno_copy);
+    throw TSSLException("SSL_read: " + errors);
+  }
+  flushNonblocking();
+  return static_cast<int32_t>(have);
+}
+
+uint32_t TSSLSocket::writeNonblocking(const uint8_t* buf, uint32_t len) {
+  if (!nonblocking_) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "writeNonblocking: startNonblocking() not called");
+  }
+  if (output_.size() - outputPos_ >= NONBLOCKING_OUTPUT_LIMIT &&
+      !flushNonblocking() &&
+      output_.size() - outputPos_ >= NONBLOCKING_OUTPUT_LIMIT) {
+    return 0;
+  }
+  uint32_t take = len;
+  if (take > NONBLOCKING_OUTPUT_LIMIT) {
+    take = static_cast<uint32_t>(NONBLOCKING_OUTPUT_LIMIT);
+  }
+  if (take == 0) {
+    return 0;
+  }
+  ERR_clear_error();
+  int rc = SSL_write(ssl_, buf, take);
+  checkHandshakeDone();
+  if (rc <= 0) {
+    if (SSL_get_error(ssl_, rc) == SSL_ERROR_WANT_READ) {
+      // Still handshaking; the reads will get it done
+      flushNonblocking();
+      return 0;
+    }
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    string errors;
+    buildErrors(errors, errno_copy);
+    throw TSSLException("SSL_write: " + errors);
+  }
+  flushNonblocking();
+  return static_cast<uint32_t>(rc);
+}
+
+bool TSSLSocket::flushNonblocking() {
+  queueOutput();
+  while (outputPos_ < output_.size()) {
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+    int b = static_cast<int>(::send(socket_,
+                                    reinterpret_cast<const char*>(&output_[outputPos_]),
+                                    output_.size() - outputPos_, flags));
+    if (b < 0) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy == THRIFT_EINTR) {
+        continue;
+      }
+      if (errno_copy == THRIFT_EAGAIN || errno_copy == THRIFT_EWOULDBLOCK) {
+        return false;
+      }
+      throw TTransportException(TTransportException::NOT_OPEN, "send()", errno_copy);
+    }
+    outputPos_ += b;
+  }
+  output_.clear();
+  outputPos_ = 0;
+  return true;
+}
+
+bool TSSLSocket::hasPendingOutput() const {
+  if (!nonblocking_) {
+    return false;
+  }
+  return outputPos_ < output_.size() || BIO_ctrl_pending(SSL_get_wbio(ssl_)) > 0;
+}
+
+bool TSSLSocket::hasBufferedInput() const {
+  if (!nonblocking_ || inputBlocked_) {
+    return false;
+  }
+  return SSL_pending(ssl_) > 0 || BIO_ctrl_pending(SSL_get_rbio(ssl_)) > 0;
+}
+
+void TSSLSocket::queueOutput() {
+  BIO* wbio = SSL_get_wbio(ssl_);
+  size_t pending = BIO_ctrl_pending(wbio);
+  if (pending == 0) {
+    return;
+  }
+  if (outputPos_ == output_.size()) {
+    output_.clear();
+    outputPos_ = 0;
+  }
+  size_t end = output_.size();
+  output_.resize(end + pending);
+  int got = BIO_read(wbio, &output_[end], static_cast<int>(pending));
+  output_.resize(end + (got > 0 ? got : 0));
+}
+
+int32_t TSSLSocket::receiveNonblocking() {
+  uint8_t buf[NONBLOCKING_RECV_SIZE];
+  for (;;) {
+    int got = static_cast<int>(::recv(socket_, reinterpret_cast<char*>(buf), sizeof(buf), 0));
+    if (got > 0) {
+      inputBlocked_ = false;
+      if (BIO_write(SSL_get_rbio(ssl_), buf, got) != got) {
+        string errors;
+        buildErrors(errors);
+        throw TSSLException("BIO_write: " + errors);
+      }
+      return got;
+    }
+    if (got == 0) {
+      return 0;
+    }
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    if (errno_copy == THRIFT_EINTR) {
+      continue;
+    }
+    if (errno_copy == THRIFT_EAGAIN || errno_copy == THRIFT_EWOULDBLOCK) {
+      inputBlocked_ = true;
+      return -1;
+    }
+    if (errno_copy == THRIFT_ECONNRESET) {
+      return 0;
+    }
+    throw TTransportException(TTransportException::UNKNOWN, "recv()", errno_copy);
+  }
+}
+
+void TSSLSocket::checkHandshakeDone() {
+  if (!handshakeDone_ && SSL_is_init_finished(ssl_)) {
+    handshakeDone_ = true;
+    authorize();
+  }
+}
+
 void TSSLSocket::flush() {
   // Don't throw exception if not open. Thrift servers close socket twice.
   if (ssl_ == NULL) {
@@ -212,6 +520,8 @@ void TSSLSocket::flush() {
     buildErrors(errors, errno_copy);
     throw TSSLException("BIO_flush: " + errors);
   }
+  // Kernel TLS writes go through TSocket and may have been corked
+  TSocket::flush();
 }
 
 void TSSLSocket::checkHandshake() {
@@ -223,6 +533,11 @@ void TSSLSocket::checkHandshake() {
   }
   ssl_ = ctx_->createSSL();
   SSL_set_fd(ssl_, socket_);
+  SSL_set_app_data(ssl_, this);
+  bool resume = !server() && ctx_->resumeSessions() && !sessionKey().empty();
+  if (resume) {
+    ctx_->applySession(sessionKey(), ssl_);
+  }
   int rc;
   if (server()) {
     rc = SSL_accept(ssl_);
@@ -231,6 +546,9 @@ void TSSLSocket::checkHandshake() {
   }
   if (rc <= 0) {
     int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    if (resume) {
+      ctx_->removeSession(sessionKey());
+    }
     string fname(server() ? "SSL_accept" : "SSL_connect");
     string errors;
     buildErrors(errors, errno_copy);
@@ -239,6 +557,55 @@ void TSSLSocket::checkHandshake() {
   authorize();
 }
 
+string TSSLSocket::sessionKey() {
+  if (host_.empty()) {
+    return "";
+  }
+  return host_ + ":" + lexical_cast<string>(port_);
+}
+
+bool TSSLSocket::sessionReused() const {
+  return ssl_ != NULL && SSL_session_reused(ssl_);
+}
+
+bool TSSLSocket::kernelTLSSend() const {
+  if (ssl_ == NULL) {
+    return false;
+  }
+#ifdef BIO_get_ktls_send
+  BIO* bio = SSL_get_wbio(ssl_);
+  return bio != NULL && BIO_get_ktls_send(bio);
+#else
+  return false;
+#endif
+}
+
+bool TSSLSocket::kernelTLSRecv() const {
+  if (ssl_ == NULL) {
+    return false;
+  }
+#ifdef BIO_get_ktls_recv
+  BIO* bio = SSL_get_rbio(ssl_);
+  return bio != NULL && BIO_get_ktls_recv(bio);
+#else
+  return false;
+#endif
+}
+
+int TSSLSocket::newSessionCallback(SSL* ssl, SSL_SESSION* session) {
+  TSSLSocket* socket = static_cast<TSSLSocket*>(SSL_get_app_data(ssl));
+  if (socket == NULL || socket->server() || !socket->ctx_->resumeSessions()) {
+    return 0;
+  }
+  string key = socket->sessionKey();
+  if (key.empty()) {
+    return 0;
+  }
+  // Returning 1 hands our reference to the cache
+  socket->ctx_->saveSession(key, session);
+  return 1;
+}
+
 void TSSLSocket::authorize() {
   int rc = SSL_get_verify_result(ssl_);
   if (rc != X509_V_OK) {  // verify authentication result
@@ -465,6 +832,33 @@ void TSSLSocketFactory::loadTrustedCertificates(const char* path) {
   }
 }
 
+void TSSLSocketFactory::sessionResumption(bool enable) {
+  ctx_->resumeSessions(enable);
+  if (enable) {
+    SSL_CTX_set_session_cache_mode(ctx_->get(), SSL_SESS_CACHE_BOTH);
+    SSL_CTX_sess_set_new_cb(ctx_->get(), TSSLSocket::newSessionCallback);
+    SSL_CTX_clear_options(ctx_->get(), SSL_OP_NO_TICKET);
+  } else {
+    SSL_CTX_set_session_cache_mode(ctx_->get(), SSL_SESS_CACHE_OFF);
+    SSL_CTX_sess_set_new_cb(ctx_->get(), NULL);
+    SSL_CTX_set_options(ctx_->get(), SSL_OP_NO_TICKET);
+  }
+}
+
+void TSSLSocketFactory::kernelTLS(bool enable) {
+#ifdef SSL_OP_ENABLE_KTLS
+  if (enable) {
+    SSL_CTX_set_options(ctx_->get(), SSL_OP_ENABLE_KTLS);
+  } else {
+    SSL_CTX_clear_options(ctx_->get(), SSL_OP_ENABLE_KTLS);
+  }
+#else
+  if (enable) {
+    throw TSSLException("kernelTLS: OpenSSL was built without kernel TLS");
+  }
+#endif
+}
+
 void TSSLSocketFactory::randomize() {
   RAND_poll();
 }
@@ -489,16 +883,26 @@ int TSSLSocketFactory::passwordCallback(char* password,
   return length;
 }
 
-static shared_array<Mutex> mutexes;
-
-static void callbackLocking(int mode, int n, const char*, int) {
-  if (mode & CRYPTO_LOCK) {
-    mutexes[n].lock();
+// OpenSSL before 1.1 locks through these callbacks, asking for a read
+// lock where it only looks, e.g. at the error string and session tables.
+// From 1.1 on it has locks of its own and the callbacks are ignored.
+#if (OPENSSL_VERSION_NUMBER < OPENSSL_VERSION_TLS_METHOD)
+static shared_array<ReadWriteMutex> mutexes;
+
+static void lockMode(const ReadWriteMutex& mutex, int mode) {
+  if (!(mode & CRYPTO_LOCK)) {
+    mutex.release();
+  } else if (mode & CRYPTO_READ) {
+    mutex.acquireRead();
   } else {
-    mutexes[n].unlock();
+    mutex.acquireWrite();
   }
 }
 
+static void callbackLocking(int mode, int n, const char*, int) {
+  lockMode(mutexes[n], mode);
+}
+
 #if (OPENSSL_VERSION_NUMBER < OPENSSL_VERSION_NO_THREAD_ID)
 static unsigned long callbackThreadID() {
   return (unsigned long) pthread_self();
@@ -513,17 +917,14 @@ static void dyn_lock(int mode,
                      struct CRYPTO_dynlock_value* lock,
                      const char*, int) {
   if (lock != NULL) {
-    if (mode & CRYPTO_LOCK) {
-      lock->mutex.lock();
-    } else {
-      lock->mutex.unlock();
-    }
+    lockMode(lock->mutex, mode);
   }
 }
 
 static void dyn_destroy(struct CRYPTO_dynlock_value* lock, const char*, int) {
   delete lock;
 }
+#endif // OPENSSL_VERSION_NUMBER < OPENSSL_VERSION_TLS_METHOD
 
 void TSSLSocketFactory::initializeOpenSSL() {
   if (initialized) {
@@ -532,13 +933,9 @@ void TSSLSocketFactory::initializeOpenSSL() {
   initialized = true;
   SSL_library_init();
   SSL_load_error_strings();
+#if (OPENSSL_VERSION_NUMBER < OPENSSL_VERSION_TLS_METHOD)
   // static locking
-  mutexes = shared_array<Mutex>(new Mutex[::CRYPTO_num_locks()]);
-  if (mutexes == NULL) {
-    throw TTransportException(TTransportException::INTERNAL_ERROR,
-          "initializeOpenSSL() failed, "
-          "out of memory while creating mutex array");
-  }
+  mutexes = shared_array<ReadWriteMutex>(new ReadWriteMutex[::CRYPTO_num_locks()]);
 #if (OPENSSL_VERSION_NUMBER < OPENSSL_VERSION_NO_THREAD_ID)
   CRYPTO_set_id_callback(callbackThreadID);
 #endif
@@ -547,6 +944,7 @@ void TSSLSocketFactory::initializeOpenSSL() {
   CRYPTO_set_dynlock_create_callback(dyn_create);
   CRYPTO_set_dynlock_lock_callback(dyn_lock);
   CRYPTO_set_dynlock_destroy_callback(dyn_destroy);
+#endif
 }
 
 void TSSLSocketFactory::cleanupOpenSSL() {
@@ -554,6 +952,7 @@ void TSSLSocketFactory::cleanupOpenSSL() {
     return;
   }
   initialized = false;
+#if (OPENSSL_VERSION_NUMBER < OPENSSL_VERSION_TLS_METHOD)
 #if (OPENSSL_VERSION_NUMBER < OPENSSL_VERSION_NO_THREAD_ID)
   CRYPTO_set_id_callback(NULL);
 #endif
@@ -561,11 +960,14 @@ void TSSLSocketFactory::cleanupOpenSSL() {
   CRYPTO_set_dynlock_create_callback(NULL);
   CRYPTO_set_dynlock_lock_callback(NULL);
   CRYPTO_set_dynlock_destroy_callback(NULL);
+#endif
   CRYPTO_cleanup_all_ex_data();
   ERR_free_strings();
   EVP_cleanup();
   ERR_remove_state(0);
+#if (OPENSSL_VERSION_NUMBER < OPENSSL_VERSION_TLS_METHOD)
   mutexes.reset();
+#endif
 }
 
 // extract error messages from error queue
@@ -20,7 +20,9 @@
 #ifndef _THRIFT_TRANSPORT_TSSLSOCKET_H_
 #define _THRIFT_TRANSPORT_TSSLSOCKET_H_ 1
 
+#include <map>
 #include <string>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 #include <openssl/ssl.h>
 #include <thrift/concurrency/Mutex.h>
@@ -47,6 +49,25 @@ class TSSLSocket: public TSocket {
   uint32_t read(uint8_t* buf, uint32_t len);
   void     write(const uint8_t* buf, uint32_t len);
   void     flush();
+  /**
+   * Writes the buffers with one gather write when the kernel encrypts for
+   * this connection, otherwise with one SSL_write() per buffer.
+   */
+  void     writev(const TIOVec* iov, uint32_t iovcnt);
+  /**
+   * sendfile() when the kernel encrypts for this connection, otherwise
+   * through SSL_write() like any other write.
+   */
+  void     transferFrom(int fd, off_t offset, uint32_t len);
+  /**
+   * TTransport's, as TSocket's would go around OpenSSL.
+   */
+  int32_t  tryRead(uint8_t* buf, uint32_t len) {
+    return TTransport::tryRead(buf, len);
+  }
+  int32_t  tryWrite(const uint8_t* buf, uint32_t len) {
+    return TTransport::tryWrite(buf, len);
+  }
    /**
    * Set whether to use client or server side SSL handshake protocol.
    *
@@ -65,6 +86,60 @@ class TSSLSocket: public TSocket {
   virtual void access(boost::shared_ptr<AccessManager> manager) {
     access_ = manager;
   }
+  /**
+   * Carry out the handshake now rather than on first use.
+   */
+  void handshake() {
+    checkHandshake();
+  }
+  /**
+   * Whether the handshake resumed an earlier session.
+   */
+  bool sessionReused() const;
+  /**
+   * Whether the kernel encrypts what is sent on this connection.
+   */
+  bool kernelTLSSend() const;
+  /**
+   * Whether the kernel decrypts what is received on this connection.
+   */
+  bool kernelTLSRecv() const;
+  /**
+   * Switch to non-blocking use, for servers that drive the socket from an
+   * event loop.  The socket must be connected and in non-blocking mode.
+   * OpenSSL reads and writes ciphertext through memory buffers, and the
+   * handshake is carried out by the first calls to readNonblocking().
+   */
+  void startNonblocking();
+  /**
+   * Read plaintext, receiving from the socket while OpenSSL needs more.
+   *
+   * @return bytes read, 0 at end of stream, or -1 if nothing can be read
+   *         until the socket is readable again
+   */
+  int32_t readNonblocking(uint8_t* buf, uint32_t len);
+  /**
+   * Encrypt from buf, unless too much earlier output is still waiting for
+   * the socket, and send what the socket takes.
+   *
+   * @return plaintext bytes taken, possibly 0
+   */
+  uint32_t writeNonblocking(const uint8_t* buf, uint32_t len);
+  /**
+   * Send queued ciphertext.
+   *
+   * @return true if none is left
+   */
+  bool flushNonblocking();
+  /**
+   * Whether ciphertext is waiting for the socket to become writable.
+   */
+  bool hasPendingOutput() const;
+  /**
+   * Whether readNonblocking() may return data without the socket becoming
+   * readable, because OpenSSL holds received records.
+   */
+  bool hasBufferedInput() const;
 protected:
   /**
    * Constructor.
@@ -93,12 +168,31 @@ protected:
    * Initiate SSL handshake if not already initiated.
    */
   void checkHandshake();
+  /**
+   * Key of the client session cache: the remote host and port.
+   */
+  std::string sessionKey();
 
   bool server_;
   SSL* ssl_;
+  /// Non-blocking mode: true after startNonblocking()
+  bool nonblocking_;
+  bool handshakeDone_;
+  /// Last readNonblocking() found nothing to decrypt
+  bool inputBlocked_;
+  /// Ciphertext not yet sent, from outputPos_ on
+  std::vector<uint8_t> output_;
+  size_t outputPos_;
   boost::shared_ptr<SSLContext> ctx_;
   boost::shared_ptr<AccessManager> access_;
   friend class TSSLSocketFactory;
+ private:
+  static int newSessionCallback(SSL* ssl, SSL_SESSION* session);
+  /// Move what OpenSSL wrote to its memory buffer into output_
+  void queueOutput();
+  /// Receive into OpenSSL's memory buffer: >0 bytes, 0 at EOF, -1 if none
+  int32_t receiveNonblocking();
+  void checkHandshakeDone();
 };
 
 /**
@@ -161,6 +255,25 @@ class TSSLSocketFactory {
    * @param path Path to trusted certificate file
    */
   virtual void loadTrustedCertificates(const char* path);
+  /**
+   * Enable/Disable session resumption.  Clients offer the session of their
+   * last connection to the same host and port, so reconnects skip the full
+   * handshake; servers resume from their session cache or a session ticket.
+   * Enabled by default on the server side only.
+   *
+   * @param enable Resume sessions if true
+   */
+  virtual void sessionResumption(bool enable);
+  /**
+   * Enable/Disable kernel TLS.  Once the handshake is done, connections whose
+   * cipher the kernel supports hand bulk encryption to it, and writev() goes
+   * to the socket in one gather write.  Needs a kernel with TLS support and
+   * OpenSSL 3.0 built with it; other connections keep encrypting in OpenSSL.
+   *
+   * @param enable Use kernel TLS where possible if true
+   * @throws TSSLException if OpenSSL has no kernel TLS support
+   */
+  virtual void kernelTLS(bool enable);
   /**
    * Default randomize method.
    */
@@ -238,8 +351,28 @@ class SSLContext {
   virtual ~SSLContext();
   SSL* createSSL();
   SSL_CTX* get() { return ctx_; }
+  /**
+   * Whether client sockets resume sessions from this context's cache.
+   */
+  bool resumeSessions() const { return resumeSessions_; }
+  void resumeSessions(bool flag);
+  /**
+   * Keep session as the one to resume for key, taking over its reference.
+   */
+  void saveSession(const std::string& key, SSL_SESSION* session);
+  /**
+   * Set the session kept for key, if any, to be resumed by ssl.
+   */
+  void applySession(const std::string& key, SSL* ssl);
+  /**
+   * Forget the session kept for key.
+   */
+  void removeSession(const std::string& key);
  private:
   SSL_CTX* ctx_;
+  bool resumeSessions_;
+  concurrency::Mutex sessionMutex_;
+  std::map<std::string, SSL_SESSION*> sessions_;
 };
 
 /**
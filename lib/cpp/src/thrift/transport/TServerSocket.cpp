@@ -19,6 +19,7 @@
 
 #include <thrift/thrift-config.h>
 
+#include <cstddef>
 #include <cstring>
 #include <sys/types.h>
 #ifdef HAVE_SYS_SOCKET_H
@@ -41,6 +42,9 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 #include <thrift/transport/TSocket.h>
 #include <thrift/transport/TServerSocket.h>
@@ -51,6 +55,18 @@
 #define AF_LOCAL AF_UNIX
 #endif
 
+// An eventfd wakes accept() with one descriptor and a counter, rather than
+// a socketpair with a byte per wakeup to read back
+#if defined(HAVE_SYS_EVENTFD_H) && defined(EFD_CLOEXEC)
+#define THRIFT_ACCEPT_EVENTFD 1
+#endif
+
+// accept4() returns a close-on-exec socket in blocking mode in one call;
+// accept() elsewhere may copy O_NONBLOCK from the listening socket
+#if defined(__linux__) && defined(SOCK_CLOEXEC)
+#define THRIFT_ACCEPT4 1
+#endif
+
 #ifndef SOCKOPT_CAST_T
 #   ifndef _WIN32
 #       define SOCKOPT_CAST_T void
@@ -85,8 +101,17 @@ TServerSocket::TServerSocket(int port) :
   retryDelay_(0),
   tcpSendBuffer_(0),
   tcpRecvBuffer_(0),
+  tcpDeferAccept_(1),
+  tcpFastOpen_(0),
+  tcpQuickAck_(false),
+  busyPoll_(0),
+  incomingCpu_(-1),
   intSock1_(THRIFT_INVALID_SOCKET),
-  intSock2_(THRIFT_INVALID_SOCKET) {}
+  intSock2_(THRIFT_INVALID_SOCKET),
+  optionsPreset_(false),
+  inheritedSocket_(THRIFT_INVALID_SOCKET),
+  listenSocketPassed_(false),
+  pendingInterrupts_(0) {}
 
 TServerSocket::TServerSocket(int port, int sendTimeout, int recvTimeout) :
   port_(port),
@@ -99,8 +124,17 @@ TServerSocket::TServerSocket(int port, int sendTimeout, int recvTimeout) :
   retryDelay_(0),
   tcpSendBuffer_(0),
   tcpRecvBuffer_(0),
+  tcpDeferAccept_(1),
+  tcpFastOpen_(0),
+  tcpQuickAck_(false),
+  busyPoll_(0),
+  incomingCpu_(-1),
   intSock1_(THRIFT_INVALID_SOCKET),
-  intSock2_(THRIFT_INVALID_SOCKET) {}
+  intSock2_(THRIFT_INVALID_SOCKET),
+  optionsPreset_(false),
+  inheritedSocket_(THRIFT_INVALID_SOCKET),
+  listenSocketPassed_(false),
+  pendingInterrupts_(0) {}
 
 TServerSocket::TServerSocket(string path) :
   port_(0),
@@ -114,8 +148,17 @@ TServerSocket::TServerSocket(string path) :
   retryDelay_(0),
   tcpSendBuffer_(0),
   tcpRecvBuffer_(0),
+  tcpDeferAccept_(1),
+  tcpFastOpen_(0),
+  tcpQuickAck_(false),
+  busyPoll_(0),
+  incomingCpu_(-1),
   intSock1_(THRIFT_INVALID_SOCKET),
-  intSock2_(THRIFT_INVALID_SOCKET) {}
+  intSock2_(THRIFT_INVALID_SOCKET),
+  optionsPreset_(false),
+  inheritedSocket_(THRIFT_INVALID_SOCKET),
+  listenSocketPassed_(false),
+  pendingInterrupts_(0) {}
 
 TServerSocket::~TServerSocket() {
   close();
@@ -123,10 +166,12 @@ TServerSocket::~TServerSocket() {
 
 void TServerSocket::setSendTimeout(int sendTimeout) {
   sendTimeout_ = sendTimeout;
+  optionsPreset_ = false;
 }
 
 void TServerSocket::setRecvTimeout(int recvTimeout) {
   recvTimeout_ = recvTimeout;
+  optionsPreset_ = false;
 }
 
 void TServerSocket::setAcceptTimeout(int accTimeout) {
@@ -153,15 +198,68 @@ void TServerSocket::setTcpRecvBuffer(int tcpRecvBuffer) {
   tcpRecvBuffer_ = tcpRecvBuffer;
 }
 
+void TServerSocket::setTcpDeferAccept(int seconds) {
+  tcpDeferAccept_ = seconds;
+}
+
+void TServerSocket::setTcpFastOpen(int queueLen) {
+  tcpFastOpen_ = queueLen;
+}
+
+void TServerSocket::setTcpQuickAck(bool quickAck) {
+  tcpQuickAck_ = quickAck;
+}
+
+void TServerSocket::setBusyPoll(int usec) {
+  busyPoll_ = usec;
+  optionsPreset_ = false;
+}
+
+void TServerSocket::setIncomingCpu(int cpu) {
+  incomingCpu_ = cpu;
+}
+
+void TServerSocket::setListenSocket(THRIFT_SOCKET listenSocket) {
+  if (inheritedSocket_ != THRIFT_INVALID_SOCKET) {
+    ::THRIFT_CLOSESOCKET(inheritedSocket_);
+  }
+  inheritedSocket_ = listenSocket;
+}
+
 void TServerSocket::listen() {
-  THRIFT_SOCKET sv[2];
-  if (-1 == THRIFT_SOCKETPAIR(AF_LOCAL, SOCK_STREAM, 0, sv)) {
-    GlobalOutput.perror("TServerSocket::listen() socketpair() ", THRIFT_GET_SOCKET_ERROR);
-    intSock1_ = THRIFT_INVALID_SOCKET;
-    intSock2_ = THRIFT_INVALID_SOCKET;
+  intSock1_ = THRIFT_INVALID_SOCKET;
+  intSock2_ = THRIFT_INVALID_SOCKET;
+#ifdef THRIFT_ACCEPT_EVENTFD
+  int efd = eventfd(0, EFD_CLOEXEC);
+  if (efd >= 0) {
+    intSock1_ = efd;
+    intSock2_ = efd;
   } else {
-    intSock1_ = sv[1];
-    intSock2_ = sv[0];
+    GlobalOutput.perror("TServerSocket::listen() eventfd() ", THRIFT_GET_SOCKET_ERROR);
+  }
+#endif
+  if (intSock2_ == THRIFT_INVALID_SOCKET) {
+    THRIFT_SOCKET sv[2];
+    if (-1 == THRIFT_SOCKETPAIR(AF_LOCAL, SOCK_STREAM, 0, sv)) {
+      GlobalOutput.perror("TServerSocket::listen() socketpair() ", THRIFT_GET_SOCKET_ERROR);
+    } else {
+      intSock1_ = sv[1];
+      intSock2_ = sv[0];
+    }
+  }
+
+  if (inheritedSocket_ != THRIFT_INVALID_SOCKET) {
+    // Already bound and listening, it only has to be nonblocking
+    serverSocket_ = inheritedSocket_;
+    inheritedSocket_ = THRIFT_INVALID_SOCKET;
+    int flags = THRIFT_FCNTL(serverSocket_, THRIFT_F_GETFL, 0);
+    if (flags == -1 || -1 == THRIFT_FCNTL(serverSocket_, THRIFT_F_SETFL, flags | THRIFT_O_NONBLOCK)) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      GlobalOutput.perror("TServerSocket::listen() THRIFT_FCNTL() inherited socket ", errno_copy);
+      close();
+      throw TTransportException(TTransportException::NOT_OPEN, "THRIFT_FCNTL() failed", errno_copy);
+    }
+    return;
   }
 
   struct addrinfo hints, *res, *res0;
@@ -239,15 +337,47 @@ void TServerSocket::listen() {
 
   // Defer accept
   #ifdef TCP_DEFER_ACCEPT
-  if (-1 == setsockopt(serverSocket_, SOL_SOCKET, TCP_DEFER_ACCEPT,
-                       &one, sizeof(one))) {
-    int errno_copy = THRIFT_GET_SOCKET_ERROR;
-    GlobalOutput.perror("TServerSocket::listen() setsockopt() TCP_DEFER_ACCEPT ", errno_copy);
-    close();
-    throw TTransportException(TTransportException::NOT_OPEN, "Could not set TCP_DEFER_ACCEPT", errno_copy);
+  if (tcpDeferAccept_ > 0 && path_.empty()) {
+    if (-1 == setsockopt(serverSocket_, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                         cast_sockopt(&tcpDeferAccept_), sizeof(tcpDeferAccept_))) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      GlobalOutput.perror("TServerSocket::listen() setsockopt() TCP_DEFER_ACCEPT ", errno_copy);
+      close();
+      throw TTransportException(TTransportException::NOT_OPEN, "Could not set TCP_DEFER_ACCEPT", errno_copy);
+    }
   }
   #endif // #ifdef TCP_DEFER_ACCEPT
 
+  // Fast open, data on the SYN
+  if (tcpFastOpen_ > 0 && path_.empty()) {
+  #ifdef TCP_FASTOPEN
+    if (-1 == setsockopt(serverSocket_, IPPROTO_TCP, TCP_FASTOPEN,
+                         cast_sockopt(&tcpFastOpen_), sizeof(tcpFastOpen_))) {
+      GlobalOutput.perror("TServerSocket::listen() setsockopt() TCP_FASTOPEN ", THRIFT_GET_SOCKET_ERROR);
+    }
+  #else
+    GlobalOutput("TServerSocket::listen() TCP_FASTOPEN not supported");
+  #endif // #ifdef TCP_FASTOPEN
+  }
+
+  #ifdef SO_BUSY_POLL
+  if (busyPoll_ > 0) {
+    if (-1 == setsockopt(serverSocket_, SOL_SOCKET, SO_BUSY_POLL,
+                         cast_sockopt(&busyPoll_), sizeof(busyPoll_))) {
+      GlobalOutput.perror("TServerSocket::listen() setsockopt() SO_BUSY_POLL ", THRIFT_GET_SOCKET_ERROR);
+    }
+  }
+  #endif // #ifdef SO_BUSY_POLL
+
+  #ifdef SO_INCOMING_CPU
+  if (incomingCpu_ >= 0) {
+    if (-1 == setsockopt(serverSocket_, SOL_SOCKET, SO_INCOMING_CPU,
+                         cast_sockopt(&incomingCpu_), sizeof(incomingCpu_))) {
+      GlobalOutput.perror("TServerSocket::listen() setsockopt() SO_INCOMING_CPU ", THRIFT_GET_SOCKET_ERROR);
+    }
+  }
+  #endif // #ifdef SO_INCOMING_CPU
+
   #ifdef IPV6_V6ONLY
   if (res->ai_family == AF_INET6 && path_.empty()) {
     int zero = 0;
@@ -313,9 +443,14 @@ void TServerSocket::listen() {
       throw TTransportException(TTransportException::NOT_OPEN, " Unix Domain socket path too long");
     }
 
+    std::memset(&address, 0, sizeof(address));
     address.sun_family = AF_UNIX;
-    THRIFT_SNPRINTF(address.sun_path, sizeof(address.sun_path), "%s", path_.c_str());
+    std::memcpy(address.sun_path, path_.data(), path_.length());
     len = sizeof(address);
+    if (path_[0] == '\0') {
+      // Abstract names are not NUL terminated; every byte counts
+      len = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path_.length());
+    }
 
     do {
       if (0 == ::bind(serverSocket_, (struct sockaddr *) &address, len)) {
@@ -363,9 +498,44 @@ void TServerSocket::listen() {
   }
 
   // The socket is now listening!
+  optionsPreset_ = presetAcceptedOptions();
+}
+
+bool TServerSocket::presetAcceptedOptions() {
+#ifdef __linux__
+  // Linux copies these from the listening socket to each accepted one,
+  // where they don't affect the nonblocking accept() itself
+  if (sendTimeout_ > 0) {
+    struct timeval s = {(int)(sendTimeout_/1000), (int)((sendTimeout_%1000)*1000)};
+    if (-1 == setsockopt(serverSocket_, SOL_SOCKET, SO_SNDTIMEO, cast_sockopt(&s), sizeof(s))) {
+      GlobalOutput.perror("TServerSocket::listen() setsockopt() SO_SNDTIMEO ", THRIFT_GET_SOCKET_ERROR);
+      return false;
+    }
+  }
+  if (recvTimeout_ > 0) {
+    struct timeval r = {(int)(recvTimeout_/1000), (int)((recvTimeout_%1000)*1000)};
+    if (-1 == setsockopt(serverSocket_, SOL_SOCKET, SO_RCVTIMEO, cast_sockopt(&r), sizeof(r))) {
+      GlobalOutput.perror("TServerSocket::listen() setsockopt() SO_RCVTIMEO ", THRIFT_GET_SOCKET_ERROR);
+      return false;
+    }
+  }
+  // SO_BUSY_POLL was set along with the other listening socket options
+  return true;
+#else
+  return false;
+#endif
 }
 
 shared_ptr<TTransport> TServerSocket::acceptImpl() {
+  while (true) {
+    shared_ptr<TTransport> client = acceptOne();
+    if (client) {
+      return client;
+    }
+  }
+}
+
+shared_ptr<TTransport> TServerSocket::acceptOne() {
   if (serverSocket_ == THRIFT_INVALID_SOCKET) {
     throw TTransportException(TTransportException::NOT_OPEN, "TServerSocket not listening");
   }
@@ -375,7 +545,28 @@ shared_ptr<TTransport> TServerSocket::acceptImpl() {
   int maxEintrs = 5;
   int numEintrs = 0;
 
+  PendingSocket pending;
+
   while (true) {
+    // Interrupts, then connections already accepted, before waiting
+    {
+      concurrency::Guard g(acceptedMutex_);
+      if (pendingInterrupts_ > 0) {
+        --pendingInterrupts_;
+        throw TTransportException(TTransportException::INTERRUPTED);
+      }
+      if (!acceptedTransports_.empty()) {
+        shared_ptr<TTransport> transport = acceptedTransports_.front();
+        acceptedTransports_.pop_front();
+        return transport;
+      }
+      if (!acceptedSockets_.empty()) {
+        pending = acceptedSockets_.front();
+        acceptedSockets_.pop_front();
+        break;
+      }
+    }
+
     std::memset(fds, 0 , sizeof(fds));
     fds[0].fd = serverSocket_;
     fds[0].events = THRIFT_POLLIN;
@@ -400,19 +591,31 @@ shared_ptr<TTransport> TServerSocket::acceptImpl() {
       GlobalOutput.perror("TServerSocket::acceptImpl() THRIFT_POLL() ", errno_copy);
       throw TTransportException(TTransportException::UNKNOWN, "Unknown", errno_copy);
     } else if (ret > 0) {
-      // Check for an interrupt signal
+      // Clear the wakeup; what it was for is looked at above
       if (intSock2_ != THRIFT_INVALID_SOCKET
           && (fds[1].revents & THRIFT_POLLIN)) {
-        int8_t buf;
-        if (-1 == recv(intSock2_, cast_sockopt(&buf), sizeof(int8_t), 0)) {
+        uint64_t buf[8];
+#ifdef THRIFT_ACCEPT_EVENTFD
+        if (intSock2_ == intSock1_) {
+          if (-1 == ::read(intSock2_, buf, sizeof(uint64_t))) {
+            GlobalOutput.perror("TServerSocket::acceptImpl() read() interrupt ", THRIFT_GET_SOCKET_ERROR);
+          }
+          continue;
+        }
+#endif
+        if (-1 == recv(intSock2_, cast_sockopt(buf), sizeof(buf), 0)) {
           GlobalOutput.perror("TServerSocket::acceptImpl() recv() interrupt ", THRIFT_GET_SOCKET_ERROR);
         }
-        throw TTransportException(TTransportException::INTERRUPTED);
+        continue;
       }
 
       // Check for the actual server socket being ready
       if (fds[0].revents & THRIFT_POLLIN) {
-        break;
+        if (acceptBatch(pending)) {
+          break;
+        }
+        // Another process sharing the listen socket got there first
+        continue;
       }
     } else {
       GlobalOutput("TServerSocket::acceptImpl() THRIFT_POLL 0");
@@ -420,63 +623,180 @@ shared_ptr<TTransport> TServerSocket::acceptImpl() {
     }
   }
 
-  struct sockaddr_storage clientAddress;
-  int size = sizeof(clientAddress);
-  THRIFT_SOCKET clientSocket = ::accept(serverSocket_,
-                              (struct sockaddr *) &clientAddress,
-                              (socklen_t *) &size);
-
-  if (clientSocket == -1) {
-    int errno_copy = THRIFT_GET_SOCKET_ERROR;
-    GlobalOutput.perror("TServerSocket::acceptImpl() ::accept() ", errno_copy);
-    throw TTransportException(TTransportException::UNKNOWN, "accept()", errno_copy);
-  }
-
-  // Make sure client socket is blocking
-  int flags = THRIFT_FCNTL(clientSocket, THRIFT_F_GETFL, 0);
-  if (flags == -1) {
-    int errno_copy = THRIFT_GET_SOCKET_ERROR;
-    GlobalOutput.perror("TServerSocket::acceptImpl() THRIFT_FCNTL() THRIFT_F_GETFL ", errno_copy);
-    throw TTransportException(TTransportException::UNKNOWN, "THRIFT_FCNTL(THRIFT_F_GETFL)", errno_copy);
-  }
+  THRIFT_SOCKET clientSocket = pending.socket;
+#ifdef THRIFT_ACCEPT4
+  bool blocking = pending.accepted;
+#else
+  bool blocking = false;
+#endif
+  if (!blocking) {
+    // Make sure client socket is blocking
+    int flags = THRIFT_FCNTL(clientSocket, THRIFT_F_GETFL, 0);
+    if (flags == -1) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      GlobalOutput.perror("TServerSocket::acceptImpl() THRIFT_FCNTL() THRIFT_F_GETFL ", errno_copy);
+      ::THRIFT_CLOSESOCKET(clientSocket);
+      throw TTransportException(TTransportException::UNKNOWN, "THRIFT_FCNTL(THRIFT_F_GETFL)", errno_copy);
+    }
 
-  if (-1 == THRIFT_FCNTL(clientSocket, THRIFT_F_SETFL, flags & ~THRIFT_O_NONBLOCK)) {
-    int errno_copy = THRIFT_GET_SOCKET_ERROR;
-    GlobalOutput.perror("TServerSocket::acceptImpl() THRIFT_FCNTL() THRIFT_F_SETFL ~THRIFT_O_NONBLOCK ", errno_copy);
-    throw TTransportException(TTransportException::UNKNOWN, "THRIFT_FCNTL(THRIFT_F_SETFL)", errno_copy);
+    if (-1 == THRIFT_FCNTL(clientSocket, THRIFT_F_SETFL, flags & ~THRIFT_O_NONBLOCK)) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      GlobalOutput.perror("TServerSocket::acceptImpl() THRIFT_FCNTL() THRIFT_F_SETFL ~THRIFT_O_NONBLOCK ", errno_copy);
+      ::THRIFT_CLOSESOCKET(clientSocket);
+      throw TTransportException(TTransportException::UNKNOWN, "THRIFT_FCNTL(THRIFT_F_SETFL)", errno_copy);
+    }
   }
 
   shared_ptr<TSocket> client = createSocket(clientSocket);
-  if (sendTimeout_ > 0) {
-    client->setSendTimeout(sendTimeout_);
+  if (pending.accepted && optionsPreset_) {
+    client->setInheritedOptions(sendTimeout_, recvTimeout_, busyPoll_);
+  } else {
+    if (sendTimeout_ > 0) {
+      client->setSendTimeout(sendTimeout_);
+    }
+    if (recvTimeout_ > 0) {
+      client->setRecvTimeout(recvTimeout_);
+    }
+    if (busyPoll_ > 0) {
+      client->setBusyPoll(busyPoll_);
+    }
   }
-  if (recvTimeout_ > 0) {
-    client->setRecvTimeout(recvTimeout_);
+  if (tcpQuickAck_ && path_.empty()) {
+    client->setQuickAck(true);
+  }
+  if (pending.addressLen > 0) {
+    client->setCachedAddress((sockaddr*) &pending.address, pending.addressLen);
   }
-  client->setCachedAddress((sockaddr*) &clientAddress, size);
 
+  if (handOff(client)) {
+    return shared_ptr<TTransport>();
+  }
   return client;
 }
 
+bool TServerSocket::acceptBatch(PendingSocket& first) {
+  // A burst of connections, e.g. clients failing over from another server,
+  // is taken off the backlog at once rather than one per poll()
+  int accepted = 0;
+  PendingSocket next;
+  next.accepted = true;
+  while (accepted < ACCEPT_BATCH_SIZE) {
+    next.addressLen = sizeof(next.address);
+#ifdef THRIFT_ACCEPT4
+    next.socket = accept4(serverSocket_, (struct sockaddr *) &next.address,
+                          &next.addressLen, SOCK_CLOEXEC);
+#else
+    next.socket = ::accept(serverSocket_, (struct sockaddr *) &next.address,
+                           &next.addressLen);
+#endif
+    if (next.socket == THRIFT_INVALID_SOCKET) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy == THRIFT_EAGAIN || errno_copy == THRIFT_EWOULDBLOCK) {
+        break;
+      }
+      if (accepted > 0) {
+        // Left for the next accept() to report if it persists
+        break;
+      }
+      GlobalOutput.perror("TServerSocket::acceptImpl() ::accept() ", errno_copy);
+      throw TTransportException(TTransportException::UNKNOWN, "accept()", errno_copy);
+    }
+    if (accepted++ == 0) {
+      first = next;
+    } else {
+      concurrency::Guard g(acceptedMutex_);
+      acceptedSockets_.push_back(next);
+    }
+  }
+  return accepted > 0;
+}
+
 shared_ptr<TSocket> TServerSocket::createSocket(THRIFT_SOCKET clientSocket) {
   return shared_ptr<TSocket>(new TSocket(clientSocket));
 }
 
+bool TServerSocket::handOff(shared_ptr<TSocket>) {
+  return false;
+}
+
+void TServerSocket::addAcceptedTransport(shared_ptr<TTransport> transport) {
+  {
+    concurrency::Guard g(acceptedMutex_);
+    acceptedTransports_.push_back(transport);
+  }
+  signalAccept();
+}
+
 void TServerSocket::interrupt() {
-  if (intSock1_ != THRIFT_INVALID_SOCKET) {
-    int8_t byte = 0;
-    if (-1 == send(intSock1_, cast_sockopt(&byte), sizeof(int8_t), 0)) {
-      GlobalOutput.perror("TServerSocket::interrupt() send() ", THRIFT_GET_SOCKET_ERROR);
+  {
+    concurrency::Guard g(acceptedMutex_);
+    ++pendingInterrupts_;
+  }
+  signalAccept();
+}
+
+void TServerSocket::signalAccept() {
+  if (intSock1_ == THRIFT_INVALID_SOCKET) {
+    return;
+  }
+#ifdef THRIFT_ACCEPT_EVENTFD
+  if (intSock1_ == intSock2_) {
+    uint64_t one = 1;
+    if (-1 == ::write(intSock1_, &one, sizeof(one))) {
+      GlobalOutput.perror("TServerSocket::signalAccept() write() ", THRIFT_GET_SOCKET_ERROR);
     }
+    return;
+  }
+#endif
+  int8_t byte = 0;
+  if (-1 == send(intSock1_, cast_sockopt(&byte), sizeof(int8_t), 0)) {
+    GlobalOutput.perror("TServerSocket::signalAccept() send() ", THRIFT_GET_SOCKET_ERROR);
+  }
+}
+
+void TServerSocket::passListenSocket(shared_ptr<TSocket> channel) {
+  if (serverSocket_ == THRIFT_INVALID_SOCKET) {
+    throw TTransportException(TTransportException::NOT_OPEN, "TServerSocket not listening");
+  }
+  channel->sendDescriptors(std::vector<THRIFT_SOCKET>(1, serverSocket_));
+  listenSocketPassed_ = true;
+}
+
+void TServerSocket::addAcceptedSocket(THRIFT_SOCKET clientSocket) {
+  PendingSocket pending;
+  pending.socket = clientSocket;
+  pending.addressLen = 0;
+  pending.accepted = false;
+  {
+    concurrency::Guard g(acceptedMutex_);
+    acceptedSockets_.push_back(pending);
   }
+  signalAccept();
 }
 
 void TServerSocket::close() {
   if (serverSocket_ != THRIFT_INVALID_SOCKET) {
-    shutdown(serverSocket_, THRIFT_SHUT_RDWR);
+    // shutdown() would stop the listen socket for everyone holding it
+    if (!listenSocketPassed_) {
+      shutdown(serverSocket_, THRIFT_SHUT_RDWR);
+    }
     ::THRIFT_CLOSESOCKET(serverSocket_);
   }
-  if (intSock1_ != THRIFT_INVALID_SOCKET) {
+  if (inheritedSocket_ != THRIFT_INVALID_SOCKET) {
+    ::THRIFT_CLOSESOCKET(inheritedSocket_);
+  }
+  // Closed once the lock is let go
+  std::deque<shared_ptr<TTransport> > transports;
+  {
+    concurrency::Guard g(acceptedMutex_);
+    for (size_t i = 0; i < acceptedSockets_.size(); ++i) {
+      ::THRIFT_CLOSESOCKET(acceptedSockets_[i].socket);
+    }
+    acceptedSockets_.clear();
+    transports.swap(acceptedTransports_);
+    pendingInterrupts_ = 0;
+  }
+  if (intSock1_ != THRIFT_INVALID_SOCKET && intSock1_ != intSock2_) {
       ::THRIFT_CLOSESOCKET(intSock1_);
   }
   if (intSock2_ != THRIFT_INVALID_SOCKET) {
@@ -485,6 +805,9 @@ void TServerSocket::close() {
   serverSocket_ = THRIFT_INVALID_SOCKET;
   intSock1_ = THRIFT_INVALID_SOCKET;
   intSock2_ = THRIFT_INVALID_SOCKET;
+  inheritedSocket_ = THRIFT_INVALID_SOCKET;
+  listenSocketPassed_ = false;
+  optionsPreset_ = false;
 }
 
 }}} // apache::thrift::transport
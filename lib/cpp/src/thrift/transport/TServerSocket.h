@@ -22,8 +22,15 @@
 
 #include <thrift/transport/TServerTransport.h>
 #include <thrift/transport/PlatformSocket.h>
+#include <thrift/concurrency/Mutex.h>
 #include <boost/shared_ptr.hpp>
 
+#include <deque>
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
 namespace apache { namespace thrift { namespace transport {
 
 class TSocket;
@@ -37,8 +44,15 @@ class TServerSocket : public TServerTransport {
  public:
   const static int DEFAULT_BACKLOG = 1024;
 
+  /// Most connections taken off the backlog per wakeup; the rest wait
+  const static int ACCEPT_BATCH_SIZE = 64;
+
   TServerSocket(int port);
   TServerSocket(int port, int sendTimeout, int recvTimeout);
+  /**
+   * Listens on a Unix domain socket.  A path starting with a NUL byte
+   * names a socket in the Linux abstract namespace.
+   */
   TServerSocket(std::string path);
 
   ~TServerSocket();
@@ -55,16 +69,108 @@ class TServerSocket : public TServerTransport {
   void setTcpSendBuffer(int tcpSendBuffer);
   void setTcpRecvBuffer(int tcpRecvBuffer);
 
+  /**
+   * Seconds the kernel holds a new connection back from accept() waiting
+   * for its first data (TCP_DEFER_ACCEPT); 0 turns it off.  Defaults to 1.
+   */
+  void setTcpDeferAccept(int seconds);
+
+  /**
+   * Accept data on the SYN from TCP Fast Open clients, with at most
+   * queueLen such connections pending (TCP_FASTOPEN); 0 turns it off.
+   */
+  void setTcpFastOpen(int queueLen);
+
+  /// TSocket::setQuickAck() for accepted connections
+  void setTcpQuickAck(bool quickAck);
+
+  /// SO_BUSY_POLL in microseconds for accepted connections; 0 turns it off
+  void setBusyPoll(int usec);
+
+  /**
+   * SO_INCOMING_CPU for the listening socket, which among SO_REUSEPORT
+   * listeners picks the one whose CPU handled the SYN; -1 leaves it unset.
+   */
+  void setIncomingCpu(int cpu);
+
   void listen();
   void close();
 
+  /**
+   * Makes one blocked, or the next, accept() throw INTERRUPTED.
+   */
   void interrupt();
 
+  /**
+   * Returns the listening descriptor, or THRIFT_INVALID_SOCKET.
+   */
+  THRIFT_SOCKET getSocketFD() {
+    return serverSocket_;
+  }
+
+  /**
+   * Makes listen() use a socket that is already bound and listening, e.g.
+   * one inherited from the process this one replaces, rather than creating
+   * its own.  The server socket takes ownership of it.
+   */
+  void setListenSocket(THRIFT_SOCKET listenSocket);
+
+  /**
+   * Sends the listening socket to another process over channel, a
+   * connected Unix domain TSocket.  Both processes can accept on it until
+   * this one stops; close() then leaves it listening for the other.
+   */
+  void passListenSocket(boost::shared_ptr<TSocket> channel);
+
+  /**
+   * Queues an already-connected descriptor, e.g. one received with
+   * TSocket::receiveDescriptors(), to be returned by the next accept().
+   * Safe to call while another thread is blocked in accept().
+   */
+  void addAcceptedSocket(THRIFT_SOCKET clientSocket);
+
  protected:
   boost::shared_ptr<TTransport> acceptImpl();
   virtual boost::shared_ptr<TSocket> createSocket(THRIFT_SOCKET client);
 
+  /**
+   * Given each accepted connection before accept() returns it.  Returning
+   * true takes it over, e.g. to finish setting it up on another thread and
+   * pass it back with addAcceptedTransport(), and accept() waits on.
+   */
+  virtual bool handOff(boost::shared_ptr<TSocket> client);
+
+  /**
+   * Queues a connection to be returned as it is by the next accept().
+   * Safe to call while another thread is blocked in accept().
+   */
+  void addAcceptedTransport(boost::shared_ptr<TTransport> transport);
+
  private:
+  // A connection waiting to be returned by accept()
+  struct PendingSocket {
+    THRIFT_SOCKET socket;
+    // from accept(), addressLen 0 if unknown
+    struct sockaddr_storage address;
+    socklen_t addressLen;
+    // taken from serverSocket_ by acceptBatch()
+    bool accepted;
+  };
+
+  // Accepts up to ACCEPT_BATCH_SIZE connections, queueing all but the
+  // first; false if there were none
+  bool acceptBatch(PendingSocket& first);
+
+  // Sets the accepted sockets' timeouts and busy poll time on the listening
+  // socket, for them to inherit; false where they don't
+  bool presetAcceptedOptions();
+
+  // Wakes up a thread blocked in accept()
+  void signalAccept();
+
+  // One connection for acceptImpl(), or none if handOff() took it
+  boost::shared_ptr<TTransport> acceptOne();
+
   int port_;
   std::string path_;
   THRIFT_SOCKET serverSocket_;
@@ -76,9 +182,31 @@ class TServerSocket : public TServerTransport {
   int retryDelay_;
   int tcpSendBuffer_;
   int tcpRecvBuffer_;
+  int tcpDeferAccept_;
+  int tcpFastOpen_;
+  bool tcpQuickAck_;
+  int busyPoll_;
+  int incomingCpu_;
 
+  // Wakeups for accept(): the same eventfd, or the two ends of a socketpair
   THRIFT_SOCKET intSock1_;
   THRIFT_SOCKET intSock2_;
+
+  // true while accepted sockets inherit the options from serverSocket_
+  bool optionsPreset_;
+
+  // set by setListenSocket() before listen()
+  THRIFT_SOCKET inheritedSocket_;
+  // true once another process holds serverSocket_ too
+  bool listenSocketPassed_;
+
+  // connections from addAcceptedSocket() or an earlier batch waiting for
+  // accept(), and interrupt() calls not yet seen by it
+  concurrency::Mutex acceptedMutex_;
+  std::deque<PendingSocket> acceptedSockets_;
+  // and from addAcceptedTransport()
+  std::deque<boost::shared_ptr<TTransport> > acceptedTransports_;
+  int pendingInterrupts_;
 };
 
 }}} // apache::thrift::transport
@@ -0,0 +1,80 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/transport/TShmServerTransport.h>
+#include <thrift/transport/TShmTransport.h>
+#include <thrift/transport/TSocket.h>
+
+#include <vector>
+#include <unistd.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+using boost::shared_ptr;
+
+TShmServerTransport::TShmServerTransport(std::string path) :
+  serverSocket_(path),
+  ringSize_(DEFAULT_RING_SIZE),
+  spinTimeUs_(TShmTransport::DEFAULT_SPIN_TIME_US) {
+}
+
+TShmServerTransport::~TShmServerTransport() {
+  close();
+}
+
+void TShmServerTransport::setRingSize(uint32_t ringSize) {
+  uint32_t size = 4096;
+  while (size < ringSize && size < (1U << 30)) {
+    size <<= 1;
+  }
+  ringSize_ = size;
+}
+
+void TShmServerTransport::listen() {
+  serverSocket_.listen();
+}
+
+void TShmServerTransport::close() {
+  serverSocket_.close();
+}
+
+void TShmServerTransport::interrupt() {
+  serverSocket_.interrupt();
+}
+
+shared_ptr<TTransport> TShmServerTransport::acceptImpl() {
+  shared_ptr<TSocket> control =
+    boost::dynamic_pointer_cast<TSocket>(serverSocket_.accept());
+
+  int memFd = TShmTransport::createSegment(ringSize_);
+  try {
+    control->sendDescriptors(std::vector<THRIFT_SOCKET>(1, memFd));
+  } catch (...) {
+    ::close(memFd);
+    throw;
+  }
+
+  shared_ptr<TShmTransport> transport(new TShmTransport(control, memFd));
+  transport->setSpinTimeUs(spinTimeUs_);
+  return transport;
+}
+
+}}} // apache::thrift::transport
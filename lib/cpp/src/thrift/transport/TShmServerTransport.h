@@ -0,0 +1,73 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TSHMSERVERTRANSPORT_H_
+#define _THRIFT_TRANSPORT_TSHMSERVERTRANSPORT_H_ 1
+
+#include <string>
+
+#include <thrift/transport/TServerTransport.h>
+#include <thrift/transport/TServerSocket.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Server transport handing out TShmTransport connections.  Clients find it
+ * on a Unix domain socket (a path starting with a NUL byte is an abstract
+ * name); each accepted connection gets its own shared memory rings, so it
+ * plugs into any of the threaded servers like TServerSocket does.
+ *
+ * Linux only.
+ */
+class TShmServerTransport : public TServerTransport {
+ public:
+  /// Default size of each direction's ring
+  static const uint32_t DEFAULT_RING_SIZE = 1024 * 1024;
+
+  TShmServerTransport(std::string path);
+  ~TShmServerTransport();
+
+  /**
+   * Size of each direction's ring for new connections, rounded up to a
+   * power of two.  A message larger than the ring still goes through, in
+   * pieces, but the writer then waits for the reader.  At least 4KB.
+   */
+  void setRingSize(uint32_t ringSize);
+
+  /// Spin time given to accepted connections; see TShmTransport
+  void setSpinTimeUs(uint32_t spinTimeUs) {
+    spinTimeUs_ = spinTimeUs;
+  }
+
+  void listen();
+  void close();
+  void interrupt();
+
+ protected:
+  boost::shared_ptr<TTransport> acceptImpl();
+
+ private:
+  TServerSocket serverSocket_;
+  uint32_t ringSize_;
+  uint32_t spinTimeUs_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TSHMSERVERTRANSPORT_H_
@@ -0,0 +1,457 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <thrift/transport/TShmTransport.h>
+#include <thrift/transport/TTransportException.h>
+#include <thrift/concurrency/Atomic.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+namespace apache { namespace thrift { namespace transport {
+
+using boost::shared_ptr;
+using namespace apache::thrift::concurrency;
+
+/**
+ * One direction of a connection.  The producer owns the first cache line
+ * and the consumer the second, so neither side's stores bounce the line the
+ * other one is polling.
+ */
+struct TShmRing {
+  // written by the producer
+  volatile uint64_t tail;
+  volatile uint32_t dataSeq;       // futex, bumped when data is published
+  volatile uint32_t spaceWaiting;  // producer is asleep waiting for space
+  volatile uint32_t writerClosed;
+  uint8_t pad1[64 - 20];
+
+  // written by the consumer
+  volatile uint64_t head;
+  volatile uint32_t spaceSeq;      // futex, bumped when space is freed
+  volatile uint32_t dataWaiting;   // consumer is asleep waiting for data
+  volatile uint32_t readerClosed;
+  uint8_t pad2[64 - 20];
+};
+
+/**
+ * Layout of the memory for one connection.  The data for rings[0]
+ * (client to server) and then rings[1] (server to client) follow the
+ * header.
+ */
+struct TShmSegment {
+  uint32_t magic;
+  uint32_t ringSize;
+  uint8_t pad[56];
+  TShmRing rings[2];
+};
+
+static const uint32_t SHM_MAGIC = 0x54534d31;  // "TSM1"
+
+// How often a sleeping side checks whether its peer died without closing
+static const int PEER_CHECK_INTERVAL_MS = 100;
+
+static inline int64_t monotonicUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// The segment is shared between processes, so no FUTEX_PRIVATE_FLAG
+static void futexWait(volatile uint32_t* word, uint32_t expected, int timeoutMs) {
+  struct timespec ts;
+  ts.tv_sec = timeoutMs / 1000;
+  ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+  syscall(SYS_futex, word, FUTEX_WAIT, expected, &ts, NULL, 0);
+}
+
+static void futexWake(volatile uint32_t* word) {
+  atomicAdd(word, 1);
+  syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// Wrap-around copies in and out of a ring's data
+static void copyIn(uint8_t* data, uint32_t mask, uint64_t pos, const uint8_t* buf, uint32_t len) {
+  uint32_t off = static_cast<uint32_t>(pos) & mask;
+  uint32_t first = std::min(len, mask + 1 - off);
+  std::memcpy(data + off, buf, first);
+  std::memcpy(data, buf + first, len - first);
+}
+
+static void copyOut(const uint8_t* data, uint32_t mask, uint64_t pos, uint8_t* buf, uint32_t len) {
+  uint32_t off = static_cast<uint32_t>(pos) & mask;
+  uint32_t first = std::min(len, mask + 1 - off);
+  std::memcpy(buf, data + off, first);
+  std::memcpy(buf + first, data, len - first);
+}
+
+TShmTransport::TShmTransport(std::string path) :
+  path_(path),
+  segment_(NULL),
+  segmentLen_(0),
+  in_(NULL),
+  out_(NULL),
+  inData_(NULL),
+  outData_(NULL),
+  ringMask_(0),
+  head_(0),
+  tail_(0),
+  peerDead_(false),
+  spinTimeUs_(DEFAULT_SPIN_TIME_US),
+  recvTimeout_(0),
+  sendTimeout_(0) {
+}
+
+TShmTransport::TShmTransport(shared_ptr<TSocket> control, int memFd) :
+  control_(control),
+  segment_(NULL),
+  segmentLen_(0),
+  in_(NULL),
+  out_(NULL),
+  inData_(NULL),
+  outData_(NULL),
+  ringMask_(0),
+  head_(0),
+  tail_(0),
+  peerDead_(false),
+  spinTimeUs_(DEFAULT_SPIN_TIME_US),
+  recvTimeout_(0),
+  sendTimeout_(0) {
+  attach(memFd, true);
+}
+
+TShmTransport::~TShmTransport() {
+  try {
+    close();
+  } catch (const TTransportException& ex) {
+    GlobalOutput.printf("TShmTransport::~TShmTransport() %s", ex.what());
+  }
+}
+
+int TShmTransport::createSegment(uint32_t ringSize) {
+  if (ringSize == 0 || (ringSize & (ringSize - 1)) != 0) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TShmTransport: ring size must be a power of two");
+  }
+
+  int fd = static_cast<int>(syscall(SYS_memfd_create, "thrift-shm", MFD_CLOEXEC));
+  if (fd < 0) {
+    int errno_copy = errno;
+    GlobalOutput.perror("TShmTransport::createSegment() memfd_create() ", errno_copy);
+    throw TTransportException(TTransportException::NOT_OPEN, "memfd_create() failed", errno_copy);
+  }
+
+  TShmSegment header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = SHM_MAGIC;
+  header.ringSize = ringSize;
+  off_t len = static_cast<off_t>(sizeof(TShmSegment)) + 2 * static_cast<off_t>(ringSize);
+  if (ftruncate(fd, len) != 0 ||
+      pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+    int errno_copy = errno;
+    GlobalOutput.perror("TShmTransport::createSegment() ", errno_copy);
+    ::close(fd);
+    throw TTransportException(TTransportException::NOT_OPEN, "Could not size shared memory", errno_copy);
+  }
+  return fd;
+}
+
+void TShmTransport::attach(int memFd, bool server) {
+  struct stat st;
+  if (fstat(memFd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(TShmSegment))) {
+    ::close(memFd);
+    throw TTransportException(TTransportException::NOT_OPEN, "TShmTransport: bad shared memory");
+  }
+
+  void* p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+  int errno_copy = errno;
+  ::close(memFd);
+  if (p == MAP_FAILED) {
+    GlobalOutput.perror("TShmTransport::attach() mmap() ", errno_copy);
+    throw TTransportException(TTransportException::NOT_OPEN, "mmap() failed", errno_copy);
+  }
+
+  TShmSegment* segment = static_cast<TShmSegment*>(p);
+  uint32_t ringSize = segment->ringSize;
+  if (segment->magic != SHM_MAGIC || ringSize == 0 || (ringSize & (ringSize - 1)) != 0 ||
+      static_cast<off_t>(sizeof(TShmSegment)) + 2 * static_cast<off_t>(ringSize) != st.st_size) {
+    munmap(p, st.st_size);
+    throw TTransportException(TTransportException::NOT_OPEN, "TShmTransport: bad shared memory");
+  }
+
+  segment_ = segment;
+  segmentLen_ = st.st_size;
+  ringMask_ = ringSize - 1;
+  uint8_t* data = reinterpret_cast<uint8_t*>(segment + 1);
+  int outRing = server ? 1 : 0;
+  out_ = &segment->rings[outRing];
+  in_ = &segment->rings[1 - outRing];
+  outData_ = data + outRing * ringSize;
+  inData_ = data + (1 - outRing) * ringSize;
+  head_ = atomicLoad<ATOMIC_ACQUIRE>(&in_->head);
+  tail_ = atomicLoad<ATOMIC_ACQUIRE>(&out_->tail);
+  peerDead_ = false;
+}
+
+bool TShmTransport::isOpen() {
+  return segment_ != NULL;
+}
+
+bool TShmTransport::peek() {
+  if (segment_ == NULL) {
+    return false;
+  }
+  return atomicLoad<ATOMIC_ACQUIRE>(&in_->tail) != head_ || (!atomicLoad<ATOMIC_ACQUIRE>(&in_->writerClosed) && !peerDead_);
+}
+
+void TShmTransport::open() {
+  if (isOpen()) {
+    return;
+  }
+  if (path_.empty()) {
+    throw TTransportException(TTransportException::NOT_OPEN, "TShmTransport: no path to connect to");
+  }
+
+  shared_ptr<TSocket> control(new TSocket(path_));
+  control->open();
+  std::vector<THRIFT_SOCKET> fds;
+  if (!control->receiveDescriptors(&fds)) {
+    throw TTransportException(TTransportException::NOT_OPEN, "TShmTransport: server closed the connection");
+  }
+  for (size_t i = 1; i < fds.size(); ++i) {
+    ::close(fds[i]);
+  }
+  attach(fds[0], false);
+  control_ = control;
+}
+
+void TShmTransport::close() {
+  if (segment_ != NULL) {
+    publish();
+
+    // Tell the peer, whichever way it is waiting
+    atomicStore<ATOMIC_RELEASE>(&out_->writerClosed, 1);
+    atomicStore<ATOMIC_RELEASE>(&in_->readerClosed, 1);
+    atomicFence();
+    futexWake(&out_->dataSeq);
+    futexWake(&in_->spaceSeq);
+
+    munmap(segment_, segmentLen_);
+    segment_ = NULL;
+    in_ = out_ = NULL;
+    inData_ = outData_ = NULL;
+  }
+  if (control_) {
+    control_->close();
+    control_.reset();
+  }
+}
+
+bool TShmTransport::ready(TShmRing* ring, WaitFor what) {
+  if (peerDead_) {
+    return true;
+  }
+  if (what == DATA) {
+    return atomicLoad<ATOMIC_ACQUIRE>(&ring->tail) != head_ || atomicLoad<ATOMIC_ACQUIRE>(&ring->writerClosed);
+  }
+  return tail_ - atomicLoad<ATOMIC_ACQUIRE>(&ring->head) <= ringMask_ || atomicLoad<ATOMIC_ACQUIRE>(&ring->readerClosed);
+}
+
+bool TShmTransport::peerGone() {
+  if (!control_) {
+    return false;
+  }
+  // The peer never sends anything after the setup, so readable means EOF
+  struct pollfd fds[1];
+  fds[0].fd = control_->getSocketFD();
+  fds[0].events = POLLIN;
+  fds[0].revents = 0;
+  return poll(fds, 1, 0) > 0;
+}
+
+bool TShmTransport::await(TShmRing* ring, WaitFor what, int timeoutMs) {
+  if (ready(ring, what)) {
+    return true;
+  }
+
+  if (spinTimeUs_ > 0) {
+    int64_t spinEnd = monotonicUs() + spinTimeUs_;
+    for (uint32_t i = 1; ; ++i) {
+      cpuRelax();
+      if (ready(ring, what)) {
+        return true;
+      }
+      if ((i & 63) == 0 && monotonicUs() >= spinEnd) {
+        break;
+      }
+    }
+  }
+
+  volatile uint32_t* seq = (what == DATA) ? &ring->dataSeq : &ring->spaceSeq;
+  volatile uint32_t* waiting = (what == DATA) ? &ring->dataWaiting : &ring->spaceWaiting;
+  int64_t deadline = (timeoutMs > 0) ? monotonicUs() + static_cast<int64_t>(timeoutMs) * 1000 : 0;
+
+  while (true) {
+    // Announce the wait before the last look, so that a peer publishing
+    // in between either sees the flag or is seen by that look
+    uint32_t snapshot = atomicLoad<ATOMIC_ACQUIRE>(seq);
+    atomicStore<ATOMIC_RELEASE>(waiting, 1);
+    atomicFence();
+    if (ready(ring, what)) {
+      atomicStore<ATOMIC_RELEASE>(waiting, 0);
+      return true;
+    }
+
+    int sliceMs = PEER_CHECK_INTERVAL_MS;
+    if (deadline) {
+      int64_t left = deadline - monotonicUs();
+      if (left <= 0) {
+        atomicStore<ATOMIC_RELEASE>(waiting, 0);
+        return false;
+      }
+      sliceMs = static_cast<int>(std::min<int64_t>(sliceMs, (left + 999) / 1000));
+    }
+    futexWait(seq, snapshot, sliceMs);
+
+    if (atomicLoad<ATOMIC_ACQUIRE>(seq) == snapshot && peerGone()) {
+      peerDead_ = true;
+    }
+  }
+}
+
+void TShmTransport::publish() {
+  if (tail_ == out_->tail) {
+    return;
+  }
+  atomicStore<ATOMIC_RELEASE>(&out_->tail, tail_);
+  atomicFence();
+  if (atomicLoad<ATOMIC_ACQUIRE>(&out_->dataWaiting)) {
+    atomicStore<ATOMIC_RELEASE>(&out_->dataWaiting, 0);
+    futexWake(&out_->dataSeq);
+  }
+}
+
+void TShmTransport::release() {
+  atomicStore<ATOMIC_RELEASE>(&in_->head, head_);
+  atomicFence();
+  if (atomicLoad<ATOMIC_ACQUIRE>(&in_->spaceWaiting)) {
+    atomicStore<ATOMIC_RELEASE>(&in_->spaceWaiting, 0);
+    futexWake(&in_->spaceSeq);
+  }
+}
+
+uint32_t TShmTransport::read(uint8_t* buf, uint32_t len) {
+  if (segment_ == NULL) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Called read on non-open TShmTransport");
+  }
+
+  uint64_t avail = atomicLoad<ATOMIC_ACQUIRE>(&in_->tail) - head_;
+  if (avail == 0) {
+    if (!await(in_, DATA, recvTimeout_)) {
+      throw TTransportException(TTransportException::TIMED_OUT, "TShmTransport::read() timed out");
+    }
+    avail = atomicLoad<ATOMIC_ACQUIRE>(&in_->tail) - head_;
+    if (avail == 0) {
+      // The peer closed or went away
+      return 0;
+    }
+  }
+
+  uint32_t n = static_cast<uint32_t>(std::min<uint64_t>(avail, len));
+  copyOut(inData_, ringMask_, head_, buf, n);
+  head_ += n;
+  release();
+  return n;
+}
+
+void TShmTransport::write(const uint8_t* buf, uint32_t len) {
+  if (segment_ == NULL) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Called write on non-open TShmTransport");
+  }
+
+  while (len > 0) {
+    if (atomicLoad<ATOMIC_ACQUIRE>(&out_->readerClosed) || peerDead_) {
+      throw TTransportException(TTransportException::NOT_OPEN, "TShmTransport: peer closed the connection");
+    }
+
+    uint64_t room = (static_cast<uint64_t>(ringMask_) + 1) - (tail_ - atomicLoad<ATOMIC_ACQUIRE>(&out_->head));
+    if (room == 0) {
+      // Let the peer drain what is there
+      publish();
+      if (!await(out_, SPACE, sendTimeout_)) {
+        throw TTransportException(TTransportException::TIMED_OUT, "TShmTransport::write() timed out");
+      }
+      continue;
+    }
+
+    uint32_t n = static_cast<uint32_t>(std::min<uint64_t>(room, len));
+    copyIn(outData_, ringMask_, tail_, buf, n);
+    tail_ += n;
+    buf += n;
+    len -= n;
+  }
+}
+
+void TShmTransport::flush() {
+  if (segment_ == NULL) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Called flush on non-open TShmTransport");
+  }
+  publish();
+}
+
+const uint8_t* TShmTransport::borrow(uint8_t* buf, uint32_t* len) {
+  (void) buf;
+  if (segment_ == NULL) {
+    return NULL;
+  }
+  uint64_t avail = atomicLoad<ATOMIC_ACQUIRE>(&in_->tail) - head_;
+  uint32_t off = static_cast<uint32_t>(head_) & ringMask_;
+  uint32_t contiguous = static_cast<uint32_t>(std::min<uint64_t>(avail, ringMask_ + 1 - off));
+  if (contiguous == 0 || contiguous < *len) {
+    return NULL;
+  }
+  *len = contiguous;
+  return inData_ + off;
+}
+
+void TShmTransport::consume(uint32_t len) {
+  if (segment_ == NULL || atomicLoad<ATOMIC_ACQUIRE>(&in_->tail) - head_ < len) {
+    throw TTransportException(TTransportException::BAD_ARGS, "consume did not follow a borrow.");
+  }
+  head_ += len;
+  release();
+}
+
+}}} // apache::thrift::transport
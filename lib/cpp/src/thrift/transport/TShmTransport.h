@@ -0,0 +1,151 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TSHMTRANSPORT_H_
+#define _THRIFT_TRANSPORT_TSHMTRANSPORT_H_ 1
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+#include <thrift/transport/TVirtualTransport.h>
+#include <thrift/transport/TSocket.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+struct TShmSegment;
+struct TShmRing;
+
+/**
+ * Transport between two processes on the same host over a pair of
+ * single-producer single-consumer rings in shared memory, one for each
+ * direction.
+ *
+ * The client connects to a TShmServerTransport's Unix domain socket and is
+ * handed the memory for the connection as a descriptor; after that the
+ * socket only serves to notice the peer going away.  Data is copied once
+ * into the ring by write() and once out of it by read(), and borrow()
+ * returns pointers straight into the ring.  The rings double as write
+ * buffers: the peer sees nothing until flush() (or a full ring) publishes
+ * it, so there is no point in layering TBufferedTransport on top.
+ *
+ * A side that finds its ring empty (or full) first spins for the spin time,
+ * then sleeps on a futex the peer wakes when it publishes; a peer that is
+ * busy reading or writing never has to make a system call.
+ *
+ * Linux only.
+ */
+class TShmTransport : public TVirtualTransport<TShmTransport> {
+ public:
+  /// Default time to busy-poll before sleeping, in microseconds
+  static const uint32_t DEFAULT_SPIN_TIME_US = 50;
+
+  /**
+   * Constructs a client for the TShmServerTransport listening on path.
+   * Note that this does NOT actually connect.
+   */
+  TShmTransport(std::string path);
+
+  /**
+   * Wraps the server end of a connection; used by TShmServerTransport.
+   * Takes ownership of memFd.
+   */
+  TShmTransport(boost::shared_ptr<TSocket> control, int memFd);
+
+  ~TShmTransport();
+
+  bool isOpen();
+  bool peek();
+  void open();
+  void close();
+
+  uint32_t read(uint8_t* buf, uint32_t len);
+  void write(const uint8_t* buf, uint32_t len);
+  void flush();
+
+  const uint8_t* borrow(uint8_t* buf, uint32_t* len);
+  void consume(uint32_t len);
+
+  /**
+   * How long an empty or full ring is busy-polled before going to sleep.
+   * 0 sleeps straight away.
+   */
+  void setSpinTimeUs(uint32_t spinTimeUs) {
+    spinTimeUs_ = spinTimeUs;
+  }
+  uint32_t getSpinTimeUs() {
+    return spinTimeUs_;
+  }
+
+  /// Limits on waiting for data or space, in milliseconds; 0 waits forever
+  void setRecvTimeout(int ms) {
+    recvTimeout_ = ms;
+  }
+  void setSendTimeout(int ms) {
+    sendTimeout_ = ms;
+  }
+
+  /**
+   * Creates the memory for one connection with rings of ringSize bytes,
+   * a power of two, and returns its descriptor.  Used by
+   * TShmServerTransport.
+   */
+  static int createSegment(uint32_t ringSize);
+
+ private:
+  enum WaitFor { DATA, SPACE };
+
+  void attach(int memFd, bool server);
+
+  // Blocks until ring has data (or space); false on timeout
+  bool await(TShmRing* ring, WaitFor what, int timeoutMs);
+  bool ready(TShmRing* ring, WaitFor what);
+  bool peerGone();
+
+  // Make everything written so far visible to the peer
+  void publish();
+
+  // Hand what has been read back to the peer
+  void release();
+
+  std::string path_;
+  boost::shared_ptr<TSocket> control_;
+
+  TShmSegment* segment_;
+  size_t segmentLen_;
+  TShmRing* in_;
+  TShmRing* out_;
+  uint8_t* inData_;
+  uint8_t* outData_;
+  uint32_t ringMask_;
+
+  // Reader's consumed position and writer's unpublished one
+  uint64_t head_;
+  uint64_t tail_;
+
+  // set once the control socket reports the peer gone without closing
+  bool peerDead_;
+
+  uint32_t spinTimeUs_;
+  int recvTimeout_;
+  int sendTimeout_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TSHMTRANSPORT_H_
@@ -19,8 +19,10 @@
 
 #include <thrift/thrift-config.h>
 
+#include <cstddef>
 #include <cstring>
 #include <sstream>
+#include <vector>
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif
@@ -39,8 +41,13 @@
 #include <unistd.h>
 #endif
 #include <fcntl.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 
 #include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/TProbe.h>
 #include <thrift/transport/TSocket.h>
 #include <thrift/transport/TTransportException.h>
 #include <thrift/transport/PlatformSocket.h>
@@ -67,9 +74,41 @@ namespace apache { namespace thrift { namespace transport {
 
 using namespace std;
 
+// Lets a blocking socket's recv() and send() return rather than wait, so
+// deadline_ can be waited for in poll()
+#ifdef MSG_DONTWAIT
+#define THRIFT_MSG_DONTWAIT MSG_DONTWAIT
+#else
+#define THRIFT_MSG_DONTWAIT 0
+#endif
+
+// Holds a partial segment back until more data, or an uncork, pushes it out
+#if defined(MSG_MORE) && defined(TCP_CORK)
+#define THRIFT_MSG_MORE MSG_MORE
+#else
+#define THRIFT_MSG_MORE 0
+#endif
+
 // Global var to track total socket sys calls
 uint32_t g_socket_syscalls = 0;
 
+// Number of buffers handed to each sendmsg() by TSocket::writev().
+// Comfortably below IOV_MAX on every platform we care about.
+static const uint32_t WRITEV_BATCH_SIZE = 64;
+
+// Turns on TCP Fast Open for a socket about to connect.  Failure only
+// costs the round trip it would have saved.
+static void enableFastOpenConnect(THRIFT_SOCKET fd) {
+#ifdef TCP_FASTOPEN_CONNECT
+  int one = 1;
+  if (-1 == setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, cast_sockopt(&one), sizeof(one))) {
+    GlobalOutput.perror("TSocket::open() setsockopt() TCP_FASTOPEN_CONNECT ", THRIFT_GET_SOCKET_ERROR);
+  }
+#else
+  (void) fd;
+#endif
+}
+
 /**
  * TSocket implementation.
  *
@@ -83,10 +122,19 @@ TSocket::TSocket(string host, int port) :
   connTimeout_(0),
   sendTimeout_(0),
   recvTimeout_(0),
+  deadline_(0),
   lingerOn_(1),
   lingerVal_(0),
   noDelay_(1),
-  maxRecvRetries_(5) {
+  maxRecvRetries_(5),
+  fastOpen_(false),
+  quickAck_(false),
+  cork_(false),
+  corked_(false),
+  busyPoll_(0),
+  incomingCpu_(-1),
+  happyEyeballs_(false),
+  connectionAttemptDelay_(250) {
   recvTimeval_.tv_sec = (int)(recvTimeout_/1000);
   recvTimeval_.tv_usec = (int)((recvTimeout_%1000)*1000);
 }
@@ -99,10 +147,19 @@ TSocket::TSocket(string path) :
   connTimeout_(0),
   sendTimeout_(0),
   recvTimeout_(0),
+  deadline_(0),
   lingerOn_(1),
   lingerVal_(0),
   noDelay_(1),
-  maxRecvRetries_(5) {
+  maxRecvRetries_(5),
+  fastOpen_(false),
+  quickAck_(false),
+  cork_(false),
+  corked_(false),
+  busyPoll_(0),
+  incomingCpu_(-1),
+  happyEyeballs_(false),
+  connectionAttemptDelay_(250) {
   recvTimeval_.tv_sec = (int)(recvTimeout_/1000);
   recvTimeval_.tv_usec = (int)((recvTimeout_%1000)*1000);
   cachedPeerAddr_.ipv4.sin_family = AF_UNSPEC;
@@ -116,10 +173,19 @@ TSocket::TSocket() :
   connTimeout_(0),
   sendTimeout_(0),
   recvTimeout_(0),
+  deadline_(0),
   lingerOn_(1),
   lingerVal_(0),
   noDelay_(1),
-  maxRecvRetries_(5) {
+  maxRecvRetries_(5),
+  fastOpen_(false),
+  quickAck_(false),
+  cork_(false),
+  corked_(false),
+  busyPoll_(0),
+  incomingCpu_(-1),
+  happyEyeballs_(false),
+  connectionAttemptDelay_(250) {
   recvTimeval_.tv_sec = (int)(recvTimeout_/1000);
   recvTimeval_.tv_usec = (int)((recvTimeout_%1000)*1000);
   cachedPeerAddr_.ipv4.sin_family = AF_UNSPEC;
@@ -133,10 +199,19 @@ TSocket::TSocket(THRIFT_SOCKET socket) :
   connTimeout_(0),
   sendTimeout_(0),
   recvTimeout_(0),
+  deadline_(0),
   lingerOn_(1),
   lingerVal_(0),
   noDelay_(1),
-  maxRecvRetries_(5) {
+  maxRecvRetries_(5),
+  fastOpen_(false),
+  quickAck_(false),
+  cork_(false),
+  corked_(false),
+  busyPoll_(0),
+  incomingCpu_(-1),
+  happyEyeballs_(false),
+  connectionAttemptDelay_(250) {
   recvTimeval_.tv_sec = (int)(recvTimeout_/1000);
   recvTimeval_.tv_usec = (int)((recvTimeout_%1000)*1000);
   cachedPeerAddr_.ipv4.sin_family = AF_UNSPEC;
@@ -193,30 +268,7 @@ void TSocket::openConnection(struct addrinfo *res) {
     throw TTransportException(TTransportException::NOT_OPEN, "socket()", errno_copy);
   }
 
-  // Send timeout
-  if (sendTimeout_ > 0) {
-    setSendTimeout(sendTimeout_);
-  }
-
-  // Recv timeout
-  if (recvTimeout_ > 0) {
-    setRecvTimeout(recvTimeout_);
-  }
-
-  // Linger
-  setLinger(lingerOn_, lingerVal_);
-
-  // No delay
-  setNoDelay(noDelay_);
-
-  // Uses a low min RTO if asked to.
-#ifdef TCP_LOW_MIN_RTO
-  if (getUseLowMinRto()) {
-    int one = 1;
-    setsockopt(socket_, IPPROTO_TCP, TCP_LOW_MIN_RTO, &one, sizeof(one));
-  }
-#endif
-
+  applySocketOptions();
 
   // Set the socket to be non blocking for connect if a timeout exists
   int flags = THRIFT_FCNTL(socket_, THRIFT_F_GETFL, 0);
@@ -249,9 +301,14 @@ void TSocket::openConnection(struct addrinfo *res) {
       throw TTransportException(TTransportException::NOT_OPEN, " Unix Domain socket path too long");
     }
 
+    std::memset(&address, 0, sizeof(address));
     address.sun_family = AF_UNIX;
-    THRIFT_SNPRINTF(address.sun_path, sizeof(address.sun_path), "%s", path_.c_str());
+    std::memcpy(address.sun_path, path_.data(), path_.length());
     len = sizeof(address);
+    if (path_[0] == '\0') {
+      // Abstract names are not NUL terminated; every byte counts
+      len = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path_.length());
+    }
     ret = connect(socket_, (struct sockaddr *) &address, len);
 
 #else
@@ -260,6 +317,9 @@ void TSocket::openConnection(struct addrinfo *res) {
 #endif
 
   } else {
+    if (fastOpen_) {
+      enableFastOpenConnect(socket_);
+    }
     ret = connect(socket_, res->ai_addr, static_cast<int>(res->ai_addrlen));
   }
 
@@ -319,6 +379,211 @@ void TSocket::openConnection(struct addrinfo *res) {
   }
 }
 
+void TSocket::applySocketOptions() {
+  // Send timeout
+  if (sendTimeout_ > 0) {
+    setSendTimeout(sendTimeout_);
+  }
+
+  // Recv timeout
+  if (recvTimeout_ > 0) {
+    setRecvTimeout(recvTimeout_);
+  }
+
+  // Linger
+  setLinger(lingerOn_, lingerVal_);
+
+  // No delay
+  setNoDelay(noDelay_);
+
+  if (quickAck_) {
+    setQuickAck(quickAck_);
+  }
+  if (busyPoll_ > 0) {
+    setBusyPoll(busyPoll_);
+  }
+  if (incomingCpu_ >= 0) {
+    setIncomingCpu(incomingCpu_);
+  }
+
+  // Uses a low min RTO if asked to.
+#ifdef TCP_LOW_MIN_RTO
+  if (getUseLowMinRto()) {
+    int one = 1;
+    setsockopt(socket_, IPPROTO_TCP, TCP_LOW_MIN_RTO, &one, sizeof(one));
+  }
+#endif
+}
+
+namespace {
+
+/** One connect() in flight */
+struct ConnectAttempt {
+  THRIFT_SOCKET fd;
+  size_t index;
+};
+
+/**
+ * Order addresses as RFC 8305 section 4 asks: alternate between address
+ * families, starting with the family getaddrinfo() put first.
+ */
+void interleaveFamilies(std::vector<TResolvedAddress>& addresses) {
+  if (addresses.empty()) {
+    return;
+  }
+  int firstFamily = addresses[0].family;
+  std::vector<TResolvedAddress> first, other;
+  for (size_t i = 0; i < addresses.size(); ++i) {
+    (addresses[i].family == firstFamily ? first : other).push_back(addresses[i]);
+  }
+  addresses.clear();
+  for (size_t i = 0; i < first.size() || i < other.size(); ++i) {
+    if (i < first.size()) {
+      addresses.push_back(first[i]);
+    }
+    if (i < other.size()) {
+      addresses.push_back(other[i]);
+    }
+  }
+}
+
+concurrency::Mutex defaultDNSCacheMutex;
+
+}
+
+void TSocket::raceConnections(std::vector<TResolvedAddress>& addresses) {
+  interleaveFamilies(addresses);
+
+  int64_t now = concurrency::Util::monotonicTime();
+  int64_t deadline = connTimeout_ > 0 ? now + connTimeout_ : 0;
+  int64_t nextStart = now;
+  size_t next = 0;
+  std::vector<ConnectAttempt> attempts;
+  THRIFT_SOCKET winner = THRIFT_INVALID_SOCKET;
+  size_t winnerIndex = 0;
+  int lastError = 0;
+
+  while (winner == THRIFT_INVALID_SOCKET) {
+    now = concurrency::Util::monotonicTime();
+
+    // Start the next attempt when its turn comes, or right away if nothing
+    // else is in flight
+    if (next < addresses.size() && (now >= nextStart || attempts.empty())) {
+      const TResolvedAddress& address = addresses[next];
+      THRIFT_SOCKET fd = socket(address.family, address.socktype, address.protocol);
+      if (fd == THRIFT_INVALID_SOCKET) {
+        lastError = THRIFT_GET_SOCKET_ERROR;
+        GlobalOutput.perror("TSocket::open() socket() " + getSocketInfo(), lastError);
+      } else {
+        int flags = THRIFT_FCNTL(fd, THRIFT_F_GETFL, 0);
+        THRIFT_FCNTL(fd, THRIFT_F_SETFL, flags | THRIFT_O_NONBLOCK);
+        if (fastOpen_) {
+          enableFastOpenConnect(fd);
+        }
+        int ret = connect(fd, (struct sockaddr*)&address.addr, address.addrlen);
+        if (ret == 0) {
+          winner = fd;
+          winnerIndex = next;
+        } else if ((THRIFT_GET_SOCKET_ERROR == THRIFT_EINPROGRESS) ||
+                   (THRIFT_GET_SOCKET_ERROR == THRIFT_EWOULDBLOCK)) {
+          ConnectAttempt attempt;
+          attempt.fd = fd;
+          attempt.index = next;
+          attempts.push_back(attempt);
+        } else {
+          lastError = THRIFT_GET_SOCKET_ERROR;
+          ::THRIFT_CLOSESOCKET(fd);
+        }
+      }
+      ++next;
+      nextStart = now + connectionAttemptDelay_;
+      continue;
+    }
+
+    if (attempts.empty()) {
+      // Every address failed
+      break;
+    }
+
+    int64_t wait = -1;
+    if (next < addresses.size()) {
+      wait = nextStart - now;
+    }
+    if (deadline > 0) {
+      if (now >= deadline) {
+        break;
+      }
+      if (wait < 0 || deadline - now < wait) {
+        wait = deadline - now;
+      }
+    }
+
+    std::vector<struct THRIFT_POLLFD> fds(attempts.size());
+    for (size_t i = 0; i < attempts.size(); ++i) {
+      std::memset(&fds[i], 0, sizeof(fds[i]));
+      fds[i].fd = attempts[i].fd;
+      fds[i].events = THRIFT_POLLOUT;
+    }
+    int ret = THRIFT_POLL(&fds[0], fds.size(), static_cast<int>(wait));
+    if (ret < 0) {
+      if (THRIFT_GET_SOCKET_ERROR == THRIFT_EINTR) {
+        continue;
+      }
+      lastError = THRIFT_GET_SOCKET_ERROR;
+      GlobalOutput.perror("TSocket::open() THRIFT_POLL() " + getSocketInfo(), lastError);
+      break;
+    }
+
+    // Check finished attempts, newest last so erasing keeps indexes valid
+    for (size_t i = attempts.size(); i-- > 0;) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      int val = 0;
+      socklen_t lon = sizeof(int);
+      if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, cast_sockopt(&val), &lon) == -1) {
+        val = THRIFT_GET_SOCKET_ERROR;
+      }
+      if (val == 0 && winner == THRIFT_INVALID_SOCKET) {
+        winner = attempts[i].fd;
+        winnerIndex = attempts[i].index;
+      } else {
+        lastError = val;
+        ::THRIFT_CLOSESOCKET(attempts[i].fd);
+      }
+      attempts.erase(attempts.begin() + i);
+    }
+
+    if (ret > 0 && winner == THRIFT_INVALID_SOCKET && next < addresses.size()) {
+      // A failure starts the next attempt right away
+      nextStart = concurrency::Util::monotonicTime();
+    }
+  }
+
+  // Losers are abandoned
+  for (size_t i = 0; i < attempts.size(); ++i) {
+    ::THRIFT_CLOSESOCKET(attempts[i].fd);
+  }
+
+  if (winner == THRIFT_INVALID_SOCKET) {
+    if (deadline > 0 && concurrency::Util::monotonicTime() >= deadline) {
+      string errStr = "TSocket::open() timed out " + getSocketInfo();
+      GlobalOutput(errStr.c_str());
+      throw TTransportException(TTransportException::NOT_OPEN, "open() timed out");
+    }
+    GlobalOutput.perror("TSocket::open() connect() " + getSocketInfo(), lastError);
+    throw TTransportException(TTransportException::NOT_OPEN, "connect() failed", lastError);
+  }
+
+  socket_ = winner;
+  int flags = THRIFT_FCNTL(socket_, THRIFT_F_GETFL, 0);
+  THRIFT_FCNTL(socket_, THRIFT_F_SETFL, flags & ~THRIFT_O_NONBLOCK);
+  applySocketOptions();
+
+  const TResolvedAddress& address = addresses[winnerIndex];
+  setCachedAddress((const sockaddr*)&address.addr, address.addrlen);
+}
+
 void TSocket::open() {
   if (isOpen()) {
     return;
@@ -352,6 +617,53 @@ void TSocket::local_open(){
     throw TTransportException(TTransportException::NOT_OPEN, "Specified port is invalid");
   }
 
+  boost::shared_ptr<TDNSCache> dnsCache = dnsCache_ ? dnsCache_ : getDefaultDNSCache();
+  if (happyEyeballs_ || dnsCache) {
+    std::vector<TResolvedAddress> addresses;
+    try {
+      if (dnsCache) {
+        dnsCache->resolve(host_, port_, addresses);
+      } else {
+        TDNSCache::lookup(host_, port_, addresses);
+      }
+    } catch (TTransportException&) {
+      close();
+      throw;
+    }
+
+    try {
+      if (happyEyeballs_) {
+        raceConnections(addresses);
+        return;
+      }
+      for (size_t i = 0; i < addresses.size(); ++i) {
+        struct addrinfo res;
+        std::memset(&res, 0, sizeof(res));
+        res.ai_family = addresses[i].family;
+        res.ai_socktype = addresses[i].socktype;
+        res.ai_protocol = addresses[i].protocol;
+        res.ai_addr = (struct sockaddr*)&addresses[i].addr;
+        res.ai_addrlen = addresses[i].addrlen;
+        try {
+          openConnection(&res);
+          return;
+        } catch (TTransportException&) {
+          close();
+          if (i + 1 == addresses.size()) {
+            throw;
+          }
+        }
+      }
+    } catch (TTransportException&) {
+      if (dnsCache) {
+        // The cached addresses may be stale
+        dnsCache->invalidate(host_, port_);
+      }
+      throw;
+    }
+    return;
+  }
+
   struct addrinfo hints, *res, *res0;
   res = NULL;
   res0 = NULL;
@@ -399,6 +711,7 @@ void TSocket::close() {
     ::THRIFT_CLOSESOCKET(socket_);
   }
   socket_ = THRIFT_INVALID_SOCKET;
+  corked_ = false;
 }
 
 void TSocket::setSocketFD(THRIFT_SOCKET socket) {
@@ -408,6 +721,163 @@ void TSocket::setSocketFD(THRIFT_SOCKET socket) {
   socket_ = socket;
 }
 
+void TSocket::detach() {
+  if (socket_ != THRIFT_INVALID_SOCKET) {
+    ::THRIFT_CLOSESOCKET(socket_);
+  }
+  socket_ = THRIFT_INVALID_SOCKET;
+}
+
+void TSocket::sendDescriptors(const std::vector<THRIFT_SOCKET>& fds) {
+  if (socket_ == THRIFT_INVALID_SOCKET) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Called sendDescriptors on non-open socket");
+  }
+  if (fds.empty() || fds.size() > MAX_PASSED_DESCRIPTORS) {
+    throw TTransportException(TTransportException::BAD_ARGS, "sendDescriptors(): bad descriptor count");
+  }
+
+#ifdef _WIN32
+  throw TTransportException(TTransportException::NOT_IMPLEMENTED, "Descriptor passing not supported");
+#else
+  // The count goes in band, so the receiver can tell a truncated batch apart
+  uint8_t count[4];
+  uint32_t n = static_cast<uint32_t>(fds.size());
+  count[0] = static_cast<uint8_t>(n >> 24);
+  count[1] = static_cast<uint8_t>(n >> 16);
+  count[2] = static_cast<uint8_t>(n >> 8);
+  count[3] = static_cast<uint8_t>(n);
+
+  struct iovec iov;
+  iov.iov_base = count;
+  iov.iov_len = sizeof(count);
+
+  std::vector<uint8_t> control(CMSG_SPACE(n * sizeof(int)));
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = &control[0];
+  msg.msg_controllen = control.size();
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+  for (uint32_t i = 0; i < n; ++i) {
+    int fd = fds[i];
+    std::memcpy(CMSG_DATA(cmsg) + i * sizeof(int), &fd, sizeof(int));
+  }
+
+  int flags = 0;
+#ifdef MSG_NOSIGNAL
+  flags |= MSG_NOSIGNAL;
+#endif // ifdef MSG_NOSIGNAL
+
+  THRIFT_SSIZET b;
+  do {
+    b = sendmsg(socket_, &msg, flags);
+  } while (b < 0 && THRIFT_GET_SOCKET_ERROR == THRIFT_EINTR);
+  ++g_socket_syscalls;
+
+  if (b < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    GlobalOutput.perror("TSocket::sendDescriptors() sendmsg() " + getSocketInfo(), errno_copy);
+    throw TTransportException(TTransportException::UNKNOWN, "sendDescriptors() sendmsg()", errno_copy);
+  }
+
+  // The descriptors went with the first byte; the rest is plain data
+  if (static_cast<uint32_t>(b) < sizeof(count)) {
+    write(count + b, static_cast<uint32_t>(sizeof(count) - b));
+  }
+#endif // _WIN32
+}
+
+bool TSocket::receiveDescriptors(std::vector<THRIFT_SOCKET>* fds) {
+  if (socket_ == THRIFT_INVALID_SOCKET) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Called receiveDescriptors on non-open socket");
+  }
+
+#ifdef _WIN32
+  throw TTransportException(TTransportException::NOT_IMPLEMENTED, "Descriptor passing not supported");
+#else
+  uint8_t count[4];
+  struct iovec iov;
+  iov.iov_base = count;
+  iov.iov_len = sizeof(count);
+
+  std::vector<uint8_t> control(CMSG_SPACE(MAX_PASSED_DESCRIPTORS * sizeof(int)));
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = &control[0];
+  msg.msg_controllen = control.size();
+
+  int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+  THRIFT_SSIZET b;
+  do {
+    b = recvmsg(socket_, &msg, flags);
+  } while (b < 0 && THRIFT_GET_SOCKET_ERROR == THRIFT_EINTR);
+  ++g_socket_syscalls;
+
+  if (b < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    if (errno_copy == THRIFT_EAGAIN) {
+      throw TTransportException(TTransportException::TIMED_OUT, "THRIFT_EAGAIN (timed out)");
+    }
+    GlobalOutput.perror("TSocket::receiveDescriptors() recvmsg() " + getSocketInfo(), errno_copy);
+    throw TTransportException(TTransportException::UNKNOWN, "receiveDescriptors() recvmsg()", errno_copy);
+  }
+
+  // Take ownership of whatever arrived before checking anything else, so
+  // nothing leaks if the batch turns out to be bad
+  std::vector<THRIFT_SOCKET> received;
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < n; ++i) {
+      int fd;
+      std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      received.push_back(fd);
+    }
+  }
+
+  try {
+    if (b == 0) {
+      if (received.empty()) {
+        return false;
+      }
+      throw TTransportException(TTransportException::END_OF_FILE, "receiveDescriptors(): connection closed");
+    }
+    if (static_cast<uint32_t>(b) < sizeof(count)) {
+      readAll(count + b, static_cast<uint32_t>(sizeof(count) - b));
+    }
+    uint32_t n = (static_cast<uint32_t>(count[0]) << 24) | (static_cast<uint32_t>(count[1]) << 16) |
+                 (static_cast<uint32_t>(count[2]) << 8) | static_cast<uint32_t>(count[3]);
+    if ((msg.msg_flags & MSG_CTRUNC) || n != received.size()) {
+      GlobalOutput.printf("TSocket::receiveDescriptors() expected %u descriptors, got %u",
+                          n, static_cast<uint32_t>(received.size()));
+      throw TTransportException(TTransportException::CORRUPTED_DATA,
+                                "receiveDescriptors(): descriptors truncated");
+    }
+  } catch (...) {
+    for (size_t i = 0; i < received.size(); ++i) {
+      ::THRIFT_CLOSESOCKET(received[i]);
+    }
+    throw;
+  }
+
+  fds->insert(fds->end(), received.begin(), received.end());
+  return true;
+#endif // _WIN32
+}
+
 uint32_t TSocket::read(uint8_t* buf, uint32_t len) {
   if (socket_ == THRIFT_INVALID_SOCKET) {
     throw TTransportException(TTransportException::NOT_OPEN, "Called read on non-open socket");
@@ -430,19 +900,33 @@ uint32_t TSocket::read(uint8_t* buf, uint32_t len) {
  try_again:
   // Read from the socket
   struct timeval begin;
-  if (recvTimeout_ > 0) {
+  int flags = 0;
+  if (deadline_ != 0) {
+    // Wait in poll() for what is left, only if there is nothing to read now
+    if (THRIFT_MSG_DONTWAIT == 0) {
+      waitForDeadline(THRIFT_POLLIN);
+    }
+    flags = THRIFT_MSG_DONTWAIT;
+    begin.tv_sec = begin.tv_usec = 0;
+  } else if (recvTimeout_ > 0) {
     THRIFT_GETTIMEOFDAY(&begin, NULL);
   } else {
     // if there is no read timeout we don't need the TOD to determine whether
     // an THRIFT_EAGAIN is due to a timeout or an out-of-resource condition.
     begin.tv_sec = begin.tv_usec = 0;
   }
-  int got = static_cast<int>(recv(socket_, cast_sockopt(buf), len, 0));
+  int got = static_cast<int>(recv(socket_, cast_sockopt(buf), len, flags));
   int errno_copy = THRIFT_GET_SOCKET_ERROR; //THRIFT_GETTIMEOFDAY can change THRIFT_GET_SOCKET_ERROR
   ++g_socket_syscalls;
 
   // Check for error on read
   if (got < 0) {
+    if (deadline_ != 0 && (errno_copy == THRIFT_EAGAIN || errno_copy == THRIFT_EWOULDBLOCK
+                           || errno_copy == THRIFT_EINTR)) {
+      waitForDeadline(THRIFT_POLLIN);
+      goto try_again;
+    }
+
     if (errno_copy == THRIFT_EAGAIN) {
       // if no timeout we can assume that resource exhaustion has occurred.
       if (recvTimeout_ == 0) {
@@ -521,15 +1005,121 @@ uint32_t TSocket::read(uint8_t* buf, uint32_t len) {
     return 0;
   }
 
+  rearmQuickAck();
+
   // Pack data into string
   return got;
 }
 
+int32_t TSocket::tryRead(uint8_t* buf, uint32_t len) {
+  if (socket_ == THRIFT_INVALID_SOCKET) {
+    return TRY_FAILED;
+  }
+
+  int got = static_cast<int>(recv(socket_, cast_sockopt(buf), len, 0));
+  ++g_socket_syscalls;
+
+  if (got < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    if (errno_copy == THRIFT_EAGAIN || errno_copy == THRIFT_EWOULDBLOCK
+        || errno_copy == THRIFT_EINTR) {
+      return TRY_LATER;
+    }
+    if (isDisconnect(errno_copy)) {
+      return 0;
+    }
+    return TRY_FAILED;
+  }
+
+  if (got > 0) {
+    rearmQuickAck();
+  }
+  return got;
+}
+
+void TSocket::waitForDeadline(short events) {
+  for (;;) {
+    int64_t left = deadline_ - concurrency::Util::monotonicTimeUsec();
+    if (left <= 0) {
+      throw TTransportException(TTransportException::TIMED_OUT, "deadline passed");
+    }
+
+    struct THRIFT_POLLFD fds[1];
+    std::memset(fds, 0, sizeof(fds));
+    fds[0].fd = socket_;
+    fds[0].events = events;
+    // Round up, so as not to wake just short of the deadline
+    int ret = THRIFT_POLL(fds, 1, static_cast<int>((left + 999) / 1000));
+    ++g_socket_syscalls;
+    if (ret > 0) {
+      return;
+    }
+    if (ret < 0) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy != THRIFT_EINTR) {
+        throw TTransportException(TTransportException::UNKNOWN, "poll()", errno_copy);
+      }
+    }
+  }
+}
+
+void TSocket::rearmQuickAck() {
+#ifdef TCP_QUICKACK
+  // The kernel clears it as soon as it goes back to delayed ACKs
+  if (quickAck_ && path_.empty()) {
+    int one = 1;
+    setsockopt(socket_, IPPROTO_TCP, TCP_QUICKACK, cast_sockopt(&one), sizeof(one));
+  }
+#endif
+}
+
+int TSocket::corkFlags() {
+  if (!cork_ || THRIFT_MSG_MORE == 0 || !path_.empty()) {
+    return 0;
+  }
+  corked_ = true;
+  return THRIFT_MSG_MORE;
+}
+
+void TSocket::flush() {
+  if (!corked_) {
+    return;
+  }
+  corked_ = false;
+  if (socket_ == THRIFT_INVALID_SOCKET) {
+    return;
+  }
+
+#ifdef TCP_CORK
+  // Clearing TCP_CORK pushes out what MSG_MORE held back, whether or not
+  // the option was ever set
+  int zero = 0;
+  int ret = setsockopt(socket_, IPPROTO_TCP, TCP_CORK, cast_sockopt(&zero), sizeof(zero));
+  ++g_socket_syscalls;
+  if (ret == -1) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    GlobalOutput.perror("TSocket::flush() setsockopt() " + getSocketInfo(), errno_copy);
+  }
+#endif
+}
+
+bool TSocket::isDisconnect(int errno_copy) {
+  return errno_copy == THRIFT_ECONNRESET || errno_copy == THRIFT_EPIPE
+      || errno_copy == THRIFT_ENOTCONN || errno_copy == THRIFT_ETIMEDOUT;
+}
+
 void TSocket::write(const uint8_t* buf, uint32_t len) {
   uint32_t sent = 0;
 
   while (sent < len) {
+    if (deadline_ != 0 && THRIFT_MSG_DONTWAIT == 0) {
+      waitForDeadline(THRIFT_POLLOUT);
+    }
     uint32_t b = write_partial(buf + sent, len - sent);
+    if (b == 0 && deadline_ != 0) {
+      waitForDeadline(THRIFT_POLLOUT);
+      continue;
+    }
     if (b == 0) {
       // This should only happen if the timeout set with SO_SNDTIMEO expired.
       // Raise an exception.
@@ -538,8 +1128,179 @@ void TSocket::write(const uint8_t* buf, uint32_t len) {
     }
     sent += b;
   }
+  THRIFT_PROBE2(socket_write, socket_, len);
+}
+
+void TSocket::writev(const TIOVec* iov, uint32_t iovcnt) {
+  // Bytes of iov[0] that have already been sent.
+  uint32_t skip = 0;
+
+  while (iovcnt > 0) {
+    // Don't bother the kernel with empty buffers.
+    if (iov[0].len == skip) {
+      ++iov;
+      --iovcnt;
+      skip = 0;
+      continue;
+    }
+
+    if (deadline_ != 0 && THRIFT_MSG_DONTWAIT == 0) {
+      waitForDeadline(THRIFT_POLLOUT);
+    }
+    uint32_t b = sendv(iov, iovcnt, skip);
+    if (b == 0 && deadline_ != 0) {
+      waitForDeadline(THRIFT_POLLOUT);
+      continue;
+    }
+    if (b == 0) {
+      // This should only happen if the timeout set with SO_SNDTIMEO expired.
+      // Raise an exception.
+      throw TTransportException(TTransportException::TIMED_OUT,
+                                "send timeout expired");
+    }
+
+    // Skip past whatever made it out, which may end part way into a buffer.
+    while (b > 0) {
+      uint32_t remaining = iov[0].len - skip;
+      if (b < remaining) {
+        skip += b;
+        break;
+      }
+      b -= remaining;
+      ++iov;
+      --iovcnt;
+      skip = 0;
+    }
+  }
+}
+
+void TSocket::transferFrom(int fd, off_t offset, uint32_t len) {
+  if (socket_ == THRIFT_INVALID_SOCKET) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Called write on non-open socket");
+  }
+
+#ifdef HAVE_SYS_SENDFILE_H
+  // sendfile() has no MSG_DONTWAIT, so deadlines are left to write().
+  while (len > 0 && deadline_ == 0) {
+    THRIFT_SSIZET b = ::sendfile(socket_, fd, &offset, len);
+    ++g_socket_syscalls;
+
+    if (b < 0) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy == THRIFT_EINTR) {
+        continue;
+      }
+      if (errno_copy == EINVAL || errno_copy == ENOSYS) {
+        // Not something sendfile() can read from, e.g. a pipe.
+        break;
+      }
+      if (errno_copy == THRIFT_EAGAIN || errno_copy == THRIFT_EWOULDBLOCK) {
+        // This should only happen if the timeout set with SO_SNDTIMEO expired.
+        throw TTransportException(TTransportException::TIMED_OUT,
+                                  "send timeout expired");
+      }
+      GlobalOutput.perror("TSocket::transferFrom() sendfile() " + getSocketInfo(), errno_copy);
+      if (isDisconnect(errno_copy)) {
+        close();
+        throw TTransportException(TTransportException::NOT_OPEN, "sendfile()", errno_copy);
+      }
+      throw TTransportException(TTransportException::UNKNOWN, "sendfile()", errno_copy);
+    }
+    if (b == 0) {
+      throw TTransportException(TTransportException::END_OF_FILE,
+                                "TSocket::transferFrom() file ended early");
+    }
+    len -= static_cast<uint32_t>(b);
+  }
+  if (len == 0) {
+    return;
+  }
+#endif // HAVE_SYS_SENDFILE_H
+
+  TTransport::transferFrom(fd, offset, len);
+}
+
+uint32_t TSocket::writev_partial(const TIOVec* iov, uint32_t iovcnt) {
+  return sendv(iov, iovcnt, 0);
+}
+
+uint32_t TSocket::sendv(const TIOVec* iov, uint32_t iovcnt, uint32_t skip) {
+  if (socket_ == THRIFT_INVALID_SOCKET) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Called write on non-open socket");
+  }
+
+#ifdef _WIN32
+  // No gather send here, just do the first buffer.
+  while (iovcnt > 0 && iov[0].len == skip) {
+    ++iov;
+    --iovcnt;
+    skip = 0;
+  }
+  if (iovcnt == 0) {
+    return 0;
+  }
+  return write_partial(iov[0].base + skip, iov[0].len - skip);
+#else
+  THRIFT_SSIZET b;
+  do {
+    b = sendmsgRaw(iov, iovcnt, skip, corkFlags());
+  } while (b < 0 && THRIFT_GET_SOCKET_ERROR == THRIFT_EINTR);
+
+  if (b < 0) {
+    if (THRIFT_GET_SOCKET_ERROR == THRIFT_EWOULDBLOCK || THRIFT_GET_SOCKET_ERROR == THRIFT_EAGAIN) {
+      return 0;
+    }
+    // Fail on a send error
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    GlobalOutput.perror("TSocket::writev_partial() sendmsg() " + getSocketInfo(), errno_copy);
+
+    if (errno_copy == THRIFT_EPIPE || errno_copy == THRIFT_ECONNRESET || errno_copy == THRIFT_ENOTCONN) {
+      close();
+      throw TTransportException(TTransportException::NOT_OPEN, "writev() sendmsg()", errno_copy);
+    }
+
+    throw TTransportException(TTransportException::UNKNOWN, "writev() sendmsg()", errno_copy);
+  }
+
+  // Fail on blocked send
+  if (b == 0 && iovcnt > 0) {
+    throw TTransportException(TTransportException::NOT_OPEN, "Socket sendmsg returned 0.");
+  }
+  return static_cast<uint32_t>(b);
+#endif // _WIN32
 }
 
+#ifndef _WIN32
+THRIFT_SSIZET TSocket::sendmsgRaw(const TIOVec* iov, uint32_t iovcnt, uint32_t skip, int flags) {
+#ifdef MSG_NOSIGNAL
+  flags |= MSG_NOSIGNAL;
+#endif // ifdef MSG_NOSIGNAL
+  if (deadline_ != 0) {
+    flags |= THRIFT_MSG_DONTWAIT;
+  }
+
+  struct iovec batch[WRITEV_BATCH_SIZE];
+  uint32_t n = 0;
+  for (; n < iovcnt && n < WRITEV_BATCH_SIZE; ++n) {
+    batch[n].iov_base = const_cast<uint8_t*>(iov[n].base);
+    batch[n].iov_len = iov[n].len;
+  }
+  if (n > 0) {
+    batch[0].iov_base = static_cast<uint8_t*>(batch[0].iov_base) + skip;
+    batch[0].iov_len -= skip;
+  }
+
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = batch;
+  msg.msg_iovlen = n;
+
+  THRIFT_SSIZET b = sendmsg(socket_, &msg, flags);
+  ++g_socket_syscalls;
+  return b;
+}
+#endif // _WIN32
+
 uint32_t TSocket::write_partial(const uint8_t* buf, uint32_t len) {
   if (socket_ == THRIFT_INVALID_SOCKET) {
     throw TTransportException(TTransportException::NOT_OPEN, "Called write on non-open socket");
@@ -553,6 +1314,10 @@ uint32_t TSocket::write_partial(const uint8_t* buf, uint32_t len) {
   // check for the THRIFT_EPIPE return condition and close the socket in that case
   flags |= MSG_NOSIGNAL;
 #endif // ifdef MSG_NOSIGNAL
+  if (deadline_ != 0) {
+    flags |= THRIFT_MSG_DONTWAIT;
+  }
+  flags |= corkFlags();
 
   int b = static_cast<int>(send(socket_, const_cast_sockopt(buf + sent), len - sent, flags));
   ++g_socket_syscalls;
@@ -580,6 +1345,57 @@ uint32_t TSocket::write_partial(const uint8_t* buf, uint32_t len) {
   return b;
 }
 
+int32_t TSocket::tryWrite(const uint8_t* buf, uint32_t len) {
+  if (socket_ == THRIFT_INVALID_SOCKET) {
+    return TRY_FAILED;
+  }
+
+  int flags = 0;
+#ifdef MSG_NOSIGNAL
+  flags |= MSG_NOSIGNAL;
+#endif // ifdef MSG_NOSIGNAL
+
+  int b = static_cast<int>(send(socket_, const_cast_sockopt(buf), len, flags));
+  ++g_socket_syscalls;
+
+  if (b < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    if (errno_copy == THRIFT_EWOULDBLOCK || errno_copy == THRIFT_EAGAIN) {
+      return 0;
+    }
+    return TRY_FAILED;
+  }
+  return b;
+}
+
+int32_t TSocket::tryWritev(const TIOVec* iov, uint32_t iovcnt) {
+#ifdef _WIN32
+  while (iovcnt > 0 && iov[0].len == 0) {
+    ++iov;
+    --iovcnt;
+  }
+  if (iovcnt == 0) {
+    return 0;
+  }
+  return tryWrite(iov[0].base, iov[0].len);
+#else
+  if (socket_ == THRIFT_INVALID_SOCKET) {
+    return TRY_FAILED;
+  }
+
+  THRIFT_SSIZET b = sendmsgRaw(iov, iovcnt, 0, 0);
+
+  if (b < 0) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;
+    if (errno_copy == THRIFT_EWOULDBLOCK || errno_copy == THRIFT_EAGAIN) {
+      return 0;
+    }
+    return TRY_FAILED;
+  }
+  return static_cast<int32_t>(b);
+#endif // _WIN32
+}
+
 std::string TSocket::getHost() {
   return host_;
 }
@@ -626,6 +1442,76 @@ void TSocket::setNoDelay(bool noDelay) {
   }
 }
 
+void TSocket::setFastOpen(bool on) {
+  fastOpen_ = on;
+}
+
+void TSocket::setQuickAck(bool on) {
+  quickAck_ = on;
+  if (socket_ == THRIFT_INVALID_SOCKET || !path_.empty()) {
+    return;
+  }
+
+#ifdef TCP_QUICKACK
+  int v = quickAck_ ? 1 : 0;
+  int ret = setsockopt(socket_, IPPROTO_TCP, TCP_QUICKACK, cast_sockopt(&v), sizeof(v));
+  if (ret == -1) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;  // Copy THRIFT_GET_SOCKET_ERROR because we're allocating memory.
+    GlobalOutput.perror("TSocket::setQuickAck() setsockopt() " + getSocketInfo(), errno_copy);
+  }
+#endif
+}
+
+void TSocket::setCork(bool on) {
+  cork_ = on;
+  if (!cork_) {
+    flush();
+  }
+}
+
+void TSocket::setBusyPoll(int usec) {
+  busyPoll_ = usec;
+  if (socket_ == THRIFT_INVALID_SOCKET) {
+    return;
+  }
+
+#ifdef SO_BUSY_POLL
+  int ret = setsockopt(socket_, SOL_SOCKET, SO_BUSY_POLL, cast_sockopt(&busyPoll_), sizeof(busyPoll_));
+  if (ret == -1) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;  // Copy THRIFT_GET_SOCKET_ERROR because we're allocating memory.
+    GlobalOutput.perror("TSocket::setBusyPoll() setsockopt() " + getSocketInfo(), errno_copy);
+  }
+#endif
+}
+
+void TSocket::setIncomingCpu(int cpu) {
+  incomingCpu_ = cpu;
+  if (socket_ == THRIFT_INVALID_SOCKET || incomingCpu_ < 0) {
+    return;
+  }
+
+#ifdef SO_INCOMING_CPU
+  int ret = setsockopt(socket_, SOL_SOCKET, SO_INCOMING_CPU, cast_sockopt(&incomingCpu_), sizeof(incomingCpu_));
+  if (ret == -1) {
+    int errno_copy = THRIFT_GET_SOCKET_ERROR;  // Copy THRIFT_GET_SOCKET_ERROR because we're allocating memory.
+    GlobalOutput.perror("TSocket::setIncomingCpu() setsockopt() " + getSocketInfo(), errno_copy);
+  }
+#endif
+}
+
+int TSocket::getIncomingCpu() {
+#ifdef SO_INCOMING_CPU
+  if (socket_ != THRIFT_INVALID_SOCKET) {
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if (0 == getsockopt(socket_, SOL_SOCKET, SO_INCOMING_CPU, cast_sockopt(&cpu), &len)) {
+      return cpu;
+    }
+  }
+#endif
+  return -1;
+}
+
 void TSocket::setConnTimeout(int ms) {
   connTimeout_ = ms;
 }
@@ -677,10 +1563,27 @@ void TSocket::setSendTimeout(int ms) {
   }
 }
 
+void TSocket::setInheritedOptions(int sendTimeout, int recvTimeout, int busyPoll) {
+  sendTimeout_ = sendTimeout;
+  recvTimeout_ = recvTimeout;
+  recvTimeval_.tv_sec = (int)(recvTimeout_/1000);
+  recvTimeval_.tv_usec = (int)((recvTimeout_%1000)*1000);
+  busyPoll_ = busyPoll;
+}
+
 void TSocket::setMaxRecvRetries(int maxRecvRetries) {
   maxRecvRetries_ = maxRecvRetries;
 }
 
+void TSocket::setHappyEyeballs(bool on, int attemptDelayMs) {
+  happyEyeballs_ = on;
+  connectionAttemptDelay_ = attemptDelayMs;
+}
+
+void TSocket::setDNSCache(boost::shared_ptr<TDNSCache> dnsCache) {
+  dnsCache_ = dnsCache;
+}
+
 string TSocket::getSocketInfo() {
   std::ostringstream oss;
   if (host_.empty() || port_ == 0) {
@@ -810,4 +1713,14 @@ bool TSocket::getUseLowMinRto() {
   return useLowMinRto_;
 }
 
+boost::shared_ptr<TDNSCache> TSocket::defaultDNSCache_;
+void TSocket::setDefaultDNSCache(boost::shared_ptr<TDNSCache> dnsCache) {
+  concurrency::Guard g(defaultDNSCacheMutex);
+  defaultDNSCache_ = dnsCache;
+}
+boost::shared_ptr<TDNSCache> TSocket::getDefaultDNSCache() {
+  concurrency::Guard g(defaultDNSCacheMutex);
+  return defaultDNSCache_;
+}
+
 }}} // apache::thrift::transport
@@ -21,11 +21,13 @@
 #define _THRIFT_TRANSPORT_TSOCKET_H_ 1
 
 #include <string>
+#include <vector>
 
 #include <thrift/transport/TTransport.h>
 #include <thrift/transport/TVirtualTransport.h>
 #include <thrift/transport/TServerSocket.h>
 #include <thrift/transport/PlatformSocket.h>
+#include <thrift/transport/TDNSCache.h>
 
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
@@ -65,6 +67,9 @@ class TSocket : public TVirtualTransport<TSocket> {
    * Constructs a new Unix domain socket.
    * Note that this does NOT actually connect the socket.
    *
+   * A path starting with a NUL byte, e.g. std::string("\0thrift", 7), names a
+   * socket in the Linux abstract namespace, which has no file to clean up.
+   *
    * @param path The Unix domain socket e.g. "/tmp/ThriftTest.binary.thrift"
    */
   TSocket(std::string path);
@@ -113,6 +118,58 @@ class TSocket : public TVirtualTransport<TSocket> {
    */
   uint32_t write_partial(const uint8_t* buf, uint32_t len);
 
+  /**
+   * Writes all of the buffers to the underlying socket, using a single
+   * sendmsg() per batch of buffers rather than one send() per buffer.
+   * Loops until done or fail.
+   */
+  virtual void writev(const TIOVec* iov, uint32_t iovcnt);
+
+  /**
+   * Writes as much of the buffers as a single sendmsg() accepts and returns
+   * the number of bytes sent, which may end part way through a buffer.
+   */
+  uint32_t writev_partial(const TIOVec* iov, uint32_t iovcnt);
+
+  /**
+   * Sends whatever setCork() has held back in the kernel.
+   */
+  virtual void flush();
+
+  /**
+   * Sends the file's bytes with sendfile() where there is one, so they go
+   * from the page cache to the socket without being copied in and out of
+   * user space.  Sockets with a deadline, and files sendfile() can't read,
+   * take the copying path.  Like write(), a peer that has gone away may
+   * raise SIGPIPE, which servers are expected to ignore.
+   */
+  virtual void transferFrom(int fd, off_t offset, uint32_t len);
+
+  /**
+   * A single recv() that reports rather than throws, for nonblocking
+   * servers where peers going away is routine.  A reset connection reads
+   * as end of stream, and a socket with nothing to read, or whose receive
+   * timeout expired, gives TRY_LATER.  Other errors give TRY_FAILED with
+   * the socket error left as the recv() set it.
+   */
+  virtual int32_t tryRead(uint8_t* buf, uint32_t len);
+
+  /**
+   * A single send() that reports rather than throws: the bytes sent, 0 if
+   * the socket would block, or TRY_FAILED with the socket error left as
+   * the send() set it.  The socket is left for the caller to close.
+   */
+  virtual int32_t tryWrite(const uint8_t* buf, uint32_t len);
+
+  /** writev_partial() as tryWrite() is write_partial(). */
+  int32_t tryWritev(const TIOVec* iov, uint32_t iovcnt);
+
+  /**
+   * Whether a socket error means the peer has gone, which servers expect
+   * and can handle by closing the connection.
+   */
+  static bool isDisconnect(int errno_copy);
+
   /**
    * Get the host that the socket is connected to
    *
@@ -157,6 +214,52 @@ class TSocket : public TVirtualTransport<TSocket> {
    */
   void setNoDelay(bool noDelay);
 
+  /**
+   * Whether open() uses TCP Fast Open (TCP_FASTOPEN_CONNECT), so that the
+   * first request rides on the SYN to a server that has handed out a
+   * cookie before.  connect() then returns at once and a refused
+   * connection only shows up on the first write or read.  Linux only;
+   * ignored elsewhere and for Unix domain sockets.
+   */
+  void setFastOpen(bool on);
+
+  /**
+   * Whether to ACK received data straight away rather than delaying the
+   * ACK (TCP_QUICKACK).  The kernel drops back to delayed ACKs on its own,
+   * so the option is set again after every read, at the cost of a system
+   * call per read.  Linux only.
+   */
+  void setQuickAck(bool on);
+
+  /**
+   * Whether writes pass MSG_MORE so the kernel holds partial segments back
+   * until flush(), which clears TCP_CORK to push them out.  A message
+   * written in several pieces then leaves in full segments ending at the
+   * message boundary, rather than one short segment per write.  Best with
+   * setNoDelay(true), so Nagle doesn't hold the tail back further.  Linux
+   * only; ignored elsewhere and for Unix domain sockets.
+   */
+  void setCork(bool on);
+
+  /**
+   * Busy-poll the device queue for up to usec microseconds on a blocking
+   * read that finds no data (SO_BUSY_POLL), trading CPU for wakeup
+   * latency.  0 turns it off.  Linux only.
+   */
+  void setBusyPoll(int usec);
+
+  /**
+   * Ask for the socket's packets to be handled on cpu (SO_INCOMING_CPU).
+   * -1 leaves it to the kernel.  Linux only.
+   */
+  void setIncomingCpu(int cpu);
+
+  /**
+   * Returns the CPU the kernel last handled this socket's packets on, or
+   * -1 if unknown.
+   */
+  int getIncomingCpu();
+
   /**
    * Set the connect timeout
    */
@@ -172,12 +275,50 @@ class TSocket : public TVirtualTransport<TSocket> {
    */
   void setSendTimeout(int ms);
 
+  /**
+   * Holds reads and writes to a deadline, such as now plus a call's
+   * timeout, so however many reads and writes the call takes it fails
+   * with TIMED_OUT when its time is up.  They wait in poll() for exactly
+   * the time left, taking the place of the send and receive timeouts,
+   * and nothing reads the clock unless the socket has to be waited on.
+   * Plain sockets only; TSSLSocket keeps to its timeouts.
+   *
+   * @param deadline microseconds on concurrency::Util::monotonicTimeUsec(),
+   *                 or 0, the default, for none
+   */
+  void setDeadline(int64_t deadline) {
+    deadline_ = deadline;
+  }
+
+  int64_t getDeadline() const {
+    return deadline_;
+  }
+
   /**
    * Set the max number of recv retries in case of an THRIFT_EAGAIN
    * error
    */
   void setMaxRecvRetries(int maxRecvRetries);
 
+  /**
+   * Race the resolved addresses instead of trying them one after another
+   * ("Happy Eyeballs", RFC 8305).  Address families are interleaved, a new
+   * attempt starts every attemptDelayMs (or as soon as one fails), and the
+   * first connection to complete wins.  The connect timeout then bounds
+   * the whole open() rather than each address.
+   *
+   * @param on             Whether to race addresses
+   * @param attemptDelayMs Delay between the start of two attempts
+   */
+  void setHappyEyeballs(bool on, int attemptDelayMs = 250);
+
+  /**
+   * Resolve the host through dnsCache, so reconnects skip the DNS lookup.
+   * Without one the default cache is used, if one is set.  The cached
+   * entry is dropped when none of its addresses can be reached.
+   */
+  void setDNSCache(boost::shared_ptr<TDNSCache> dnsCache);
+
   /**
    * Get socket information formated as a string <Host: x Port: x>
    */
@@ -214,6 +355,38 @@ class TSocket : public TVirtualTransport<TSocket> {
    */
   void setSocketFD(THRIFT_SOCKET fd);
 
+  /**
+   * Maximum number of descriptors sendDescriptors() passes in one call.
+   */
+  static const uint32_t MAX_PASSED_DESCRIPTORS = 253;
+
+  /**
+   * Passes copies of open descriptors (listening or connected sockets, or
+   * any other file) to the peer of a Unix domain socket using SCM_RIGHTS.
+   * The caller keeps ownership of fds.  This writes a small header in band,
+   * so it must not be interleaved with a buffered transport's writes.
+   *
+   * @throws TTransportException If the descriptors could not be sent
+   */
+  void sendDescriptors(const std::vector<THRIFT_SOCKET>& fds);
+
+  /**
+   * Receives one batch of descriptors sent by sendDescriptors() and appends
+   * them to fds; the caller owns them from then on.  Blocks for at most the
+   * receive timeout.
+   *
+   * @return false if the peer closed the connection instead
+   * @throws TTransportException If the batch was malformed or truncated
+   */
+  bool receiveDescriptors(std::vector<THRIFT_SOCKET>* fds);
+
+  /**
+   * Closes the descriptor without shutting the connection down, for a socket
+   * that has been passed to another process which carries on using it.
+   * close() would end the connection for both.
+   */
+  void detach();
+
   /*
    * Returns a cached copy of the peer address.
    */
@@ -229,6 +402,18 @@ class TSocket : public TVirtualTransport<TSocket> {
    */
   static bool getUseLowMinRto();
 
+  /**
+   * Sets the cache used by sockets that weren't given one with
+   * setDNSCache(), including the ones TSocketPool and THttpClient open.
+   * NULL (the default) resolves on every open().
+   */
+  static void setDefaultDNSCache(boost::shared_ptr<TDNSCache> dnsCache);
+
+  /**
+   * Gets the default DNS cache.
+   */
+  static boost::shared_ptr<TDNSCache> getDefaultDNSCache();
+
   /**
    * Constructor to create socket from raw UNIX handle.
    */
@@ -240,10 +425,46 @@ class TSocket : public TVirtualTransport<TSocket> {
    */
   void setCachedAddress(const sockaddr* addr, socklen_t len);
 
+  /**
+   * Records send and receive timeouts and a busy poll time that the socket
+   * already has, e.g. from the listening socket it was accepted on, without
+   * setting them again.
+   */
+  void setInheritedOptions(int sendTimeout, int recvTimeout, int busyPoll);
+
  protected:
   /** connect, called by open */
   void openConnection(struct addrinfo *res);
 
+  /** Happy Eyeballs connect, called by open */
+  void raceConnections(std::vector<TResolvedAddress>& addresses);
+
+  /** Apply the timeouts and other options to a new socket_ */
+  void applySocketOptions();
+
+  /**
+   * One gather send of iov, starting skip bytes into iov[0].  Returns 0 if
+   * the socket would block.
+   */
+  uint32_t sendv(const TIOVec* iov, uint32_t iovcnt, uint32_t skip);
+
+#ifndef _WIN32
+  /** The sendmsg() behind sendv(), leaving errors to the caller */
+  THRIFT_SSIZET sendmsgRaw(const TIOVec* iov, uint32_t iovcnt, uint32_t skip, int flags);
+#endif
+
+  /** Set TCP_QUICKACK again after a read, if asked for */
+  void rearmQuickAck();
+
+  /** MSG_MORE if setCork() asked for it, noting that flush() must uncork */
+  int corkFlags();
+
+  /**
+   * Waits in poll() for events on the socket, throwing TIMED_OUT if
+   * deadline_ passes first
+   */
+  void waitForDeadline(short events);
+
   /** Host to connect to */
   std::string host_;
 
@@ -274,6 +495,9 @@ class TSocket : public TVirtualTransport<TSocket> {
   /** Recv timeout in ms */
   int recvTimeout_;
 
+  /** Deadline for reads and writes, on Util::monotonicTimeUsec(), or 0 */
+  int64_t deadline_;
+
   /** Linger on */
   bool lingerOn_;
 
@@ -286,6 +510,33 @@ class TSocket : public TVirtualTransport<TSocket> {
   /** Recv EGAIN retries */
   int maxRecvRetries_;
 
+  /** TCP Fast Open on connect */
+  bool fastOpen_;
+
+  /** Quick ACK */
+  bool quickAck_;
+
+  /** Writes pass MSG_MORE until flush() */
+  bool cork_;
+
+  /** Data may be held back by MSG_MORE since the last flush() */
+  bool corked_;
+
+  /** Busy poll time in microseconds, 0 if off */
+  int busyPoll_;
+
+  /** CPU asked for with SO_INCOMING_CPU, or -1 */
+  int incomingCpu_;
+
+  /** Race addresses when connecting */
+  bool happyEyeballs_;
+
+  /** Delay between connection attempts in ms */
+  int connectionAttemptDelay_;
+
+  /** Resolver cache, or NULL to use the default one */
+  boost::shared_ptr<TDNSCache> dnsCache_;
+
   /** Recv timeout timeval */
   struct timeval recvTimeval_;
 
@@ -298,6 +549,9 @@ class TSocket : public TVirtualTransport<TSocket> {
   /** Whether to use low minimum TCP retransmission timeout */
   static bool useLowMinRto_;
 
+  /** Cache used by sockets without one of their own */
+  static boost::shared_ptr<TDNSCache> defaultDNSCache_;
+
  private:
   void unix_open();
   void local_open();
@@ -0,0 +1,514 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <thrift/thrift-config.h>
+
+#include <cstring>
+#ifdef HAVE_SYS_POLL_H
+#include <sys/poll.h>
+#endif
+
+#include <thrift/concurrency/Util.h>
+#include <thrift/transport/TSocketConnectionPool.h>
+#include <thrift/transport/TTransportException.h>
+#include <thrift/transport/PlatformSocket.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+using namespace std;
+
+using boost::shared_ptr;
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::ThreadFactory;
+using apache::thrift::concurrency::Util;
+
+/**
+ * Runs TSocketConnectionPool::checkHealth() until told to stop.
+ */
+class TSocketConnectionPool::HealthChecker : public Runnable {
+ public:
+  explicit HealthChecker(TSocketConnectionPool* pool) : pool_(pool) {}
+
+  void run() {
+    for (;;) {
+      {
+        Guard g(pool_->monitor_.mutex());
+        if (!pool_->healthCheckerStop_) {
+          pool_->monitor_.waitForTimeRelative(pool_->healthCheckIntervalMs_);
+        }
+        if (pool_->healthCheckerStop_) {
+          pool_->healthCheckerRunning_ = false;
+          pool_->monitor_.notifyAll();
+          return;
+        }
+      }
+      pool_->checkHealth();
+    }
+  }
+
+ private:
+  TSocketConnectionPool* pool_;
+};
+
+TSocketConnectionPool::TSocketConnectionPool(
+    const vector< shared_ptr<TSocketPoolServer> >& servers) :
+  released_(&monitor_),
+  releases_(0),
+  next_(0),
+  maxIdle_(8),
+  maxActive_(0),
+  acquireTimeout_(0),
+  maxIdleTime_(0),
+  retryInterval_(60),
+  maxConsecutiveFailures_(1),
+  connTimeout_(0),
+  sendTimeout_(0),
+  recvTimeout_(0),
+  healthCheckIntervalMs_(0),
+  healthCheckerRunning_(false),
+  healthCheckerStop_(false)
+{
+  for (size_t i = 0; i < servers.size(); ++i) {
+    HostPool host;
+    host.server = servers[i];
+    host.active = 0;
+    hosts_.push_back(host);
+  }
+}
+
+TSocketConnectionPool::TSocketConnectionPool(const vector<pair<string, int> >& servers) :
+  released_(&monitor_),
+  releases_(0),
+  next_(0),
+  maxIdle_(8),
+  maxActive_(0),
+  acquireTimeout_(0),
+  maxIdleTime_(0),
+  retryInterval_(60),
+  maxConsecutiveFailures_(1),
+  connTimeout_(0),
+  sendTimeout_(0),
+  recvTimeout_(0),
+  healthCheckIntervalMs_(0),
+  healthCheckerRunning_(false),
+  healthCheckerStop_(false)
+{
+  for (size_t i = 0; i < servers.size(); ++i) {
+    HostPool host;
+    host.server.reset(new TSocketPoolServer(servers[i].first, servers[i].second));
+    host.active = 0;
+    hosts_.push_back(host);
+  }
+}
+
+TSocketConnectionPool::~TSocketConnectionPool() {
+  stopHealthChecker();
+
+  for (size_t i = 0; i < hosts_.size(); ++i) {
+    deque<IdleSocket>& idle = hosts_[i].idle;
+    for (size_t j = 0; j < idle.size(); ++j) {
+      idle[j].socket->close();
+    }
+  }
+}
+
+void TSocketConnectionPool::setMaxIdle(size_t maxIdle) {
+  Guard g(monitor_.mutex());
+  maxIdle_ = maxIdle;
+}
+
+void TSocketConnectionPool::setMaxActive(size_t maxActive) {
+  Guard g(monitor_.mutex());
+  maxActive_ = maxActive;
+}
+
+void TSocketConnectionPool::setAcquireTimeout(int ms) {
+  Guard g(monitor_.mutex());
+  acquireTimeout_ = ms;
+}
+
+void TSocketConnectionPool::setMaxIdleTime(int maxIdleTime) {
+  Guard g(monitor_.mutex());
+  maxIdleTime_ = maxIdleTime;
+}
+
+void TSocketConnectionPool::setRetryInterval(int retryInterval) {
+  Guard g(monitor_.mutex());
+  retryInterval_ = retryInterval;
+}
+
+void TSocketConnectionPool::setMaxConsecutiveFailures(int maxConsecutiveFailures) {
+  Guard g(monitor_.mutex());
+  maxConsecutiveFailures_ = maxConsecutiveFailures;
+}
+
+void TSocketConnectionPool::setConnTimeout(int ms) {
+  Guard g(monitor_.mutex());
+  connTimeout_ = ms;
+}
+
+void TSocketConnectionPool::setSendTimeout(int ms) {
+  Guard g(monitor_.mutex());
+  sendTimeout_ = ms;
+}
+
+void TSocketConnectionPool::setRecvTimeout(int ms) {
+  Guard g(monitor_.mutex());
+  recvTimeout_ = ms;
+}
+
+shared_ptr<TSocket> TSocketConnectionPool::newSocket(const TSocketPoolServer& server) {
+  shared_ptr<TSocket> socket(new TSocket(server.host_, server.port_));
+  Guard g(monitor_.mutex());
+  socket->setConnTimeout(connTimeout_);
+  socket->setSendTimeout(sendTimeout_);
+  socket->setRecvTimeout(recvTimeout_);
+  return socket;
+}
+
+/**
+ * Opens a new socket without holding the lock.  Failures count against the
+ * server exactly like in TSocketPool::open().
+ */
+shared_ptr<TSocket> TSocketConnectionPool::connect(size_t index) {
+  shared_ptr<TSocketPoolServer> server = hosts_[index].server;
+  shared_ptr<TSocket> socket = newSocket(*server);
+
+  try {
+    socket->open();
+  } catch (TException& e) {
+    string errStr = "TSocketConnectionPool::connect failed " +
+      socket->getSocketInfo() + ": " + e.what();
+    GlobalOutput(errStr.c_str());
+
+    Guard g(monitor_.mutex());
+    ++server->consecutiveFailures_;
+    if (server->consecutiveFailures_ > maxConsecutiveFailures_) {
+      // Mark server as down
+      server->consecutiveFailures_ = 0;
+      server->lastFailTime_ = time(NULL);
+    }
+    return shared_ptr<TSocket>();
+  }
+
+  Guard g(monitor_.mutex());
+  server->consecutiveFailures_ = 0;
+  server->lastFailTime_ = 0;
+  return socket;
+}
+
+bool TSocketConnectionPool::isUp(const TSocketPoolServer& server, time_t now) const {
+  return server.lastFailTime_ == 0 || now - server.lastFailTime_ > retryInterval_;
+}
+
+bool TSocketConnectionPool::isIdleSocketUsable(TSocket& socket) {
+  if (!socket.isOpen()) {
+    return false;
+  }
+
+  // Nothing should arrive on an idle connection: readable means the peer
+  // closed it, or sent something we would take for the next reply.
+  struct THRIFT_POLLFD fds[1];
+  std::memset(fds, 0 , sizeof(fds));
+  fds[0].fd = socket.getSocketFD();
+  fds[0].events = THRIFT_POLLIN;
+  return THRIFT_POLL(fds, 1, 0) == 0;
+}
+
+size_t TSocketConnectionPool::warm(size_t perServer) {
+  size_t opened = 0;
+
+  for (size_t i = 0; i < hosts_.size(); ++i) {
+    for (;;) {
+      {
+        Guard g(monitor_.mutex());
+        HostPool& host = hosts_[i];
+        if (!isUp(*host.server, time(NULL)) ||
+            host.idle.size() >= perServer ||
+            host.idle.size() >= maxIdle_) {
+          break;
+        }
+      }
+
+      shared_ptr<TSocket> socket = connect(i);
+      if (!socket) {
+        break;
+      }
+
+      Guard g(monitor_.mutex());
+      IdleSocket idle;
+      idle.socket = socket;
+      idle.since = time(NULL);
+      hosts_[i].idle.push_back(idle);
+      ++opened;
+    }
+  }
+
+  return opened;
+}
+
+shared_ptr<TSocket> TSocketConnectionPool::acquire() {
+  int64_t deadline = 0;
+  for (;;) {
+    bool full;
+    uint64_t releases;
+    shared_ptr<TSocket> socket = tryAcquire(full, releases);
+    if (socket) {
+      return socket;
+    }
+
+    Guard g(monitor_.mutex());
+    if (!full || acquireTimeout_ <= 0) {
+      break;
+    }
+    int64_t now = Util::monotonicTime();
+    if (deadline == 0) {
+      deadline = now + acquireTimeout_;
+    }
+    if (now >= deadline) {
+      break;
+    }
+    // Unless one came back since the pass, wait for one
+    if (releases_ == releases) {
+      released_.waitForTimeRelative(deadline - now);
+    }
+  }
+
+  GlobalOutput("TSocketConnectionPool::acquire: all connections failed");
+  throw TTransportException(TTransportException::NOT_OPEN,
+                            "TSocketConnectionPool::acquire: no server available");
+}
+
+shared_ptr<TSocket> TSocketConnectionPool::tryAcquire(bool& full, uint64_t& releases) {
+  vector<size_t> candidates;
+  full = false;
+
+  {
+    Guard g(monitor_.mutex());
+    size_t numServers = hosts_.size();
+    time_t now = time(NULL);
+    releases = releases_;
+
+    // Reuse the most recently released socket of the first server that is
+    // up and has one
+    for (size_t n = 0; n < numServers; ++n) {
+      size_t i = (next_ + n) % numServers;
+      HostPool& host = hosts_[i];
+      if (!isUp(*host.server, now)) {
+        continue;
+      }
+      if (maxActive_ > 0 && host.active >= maxActive_) {
+        full = true;
+        continue;
+      }
+
+      while (!host.idle.empty()) {
+        shared_ptr<TSocket> socket = host.idle.back().socket;
+        host.idle.pop_back();
+        if (isIdleSocketUsable(*socket)) {
+          ++host.active;
+          owners_[socket.get()] = i;
+          next_ = (i + 1) % numServers;
+          return socket;
+        }
+        socket->close();
+      }
+      candidates.push_back(i);
+    }
+
+    // Servers marked down go last, so something is tried even if all are
+    for (size_t n = 0; n < numServers; ++n) {
+      size_t i = (next_ + n) % numServers;
+      if (!isUp(*hosts_[i].server, now)) {
+        candidates.push_back(i);
+      }
+    }
+
+    if (numServers > 0) {
+      next_ = (next_ + 1) % numServers;
+    }
+  }
+
+  for (size_t n = 0; n < candidates.size(); ++n) {
+    size_t i = candidates[n];
+    {
+      // Hold the slot while connecting
+      Guard g(monitor_.mutex());
+      if (maxActive_ > 0 && hosts_[i].active >= maxActive_) {
+        full = true;
+        continue;
+      }
+      ++hosts_[i].active;
+    }
+
+    shared_ptr<TSocket> socket = connect(i);
+
+    Guard g(monitor_.mutex());
+    if (socket) {
+      owners_[socket.get()] = i;
+      return socket;
+    }
+    --hosts_[i].active;
+    ++releases_;
+    released_.notify();
+  }
+
+  return shared_ptr<TSocket>();
+}
+
+void TSocketConnectionPool::release(shared_ptr<TSocket> socket, bool reusable) {
+  if (!socket) {
+    return;
+  }
+
+  Guard g(monitor_.mutex());
+  map<TSocket*, size_t>::iterator it = owners_.find(socket.get());
+  if (it == owners_.end()) {
+    GlobalOutput("TSocketConnectionPool::release: socket not from this pool");
+    return;
+  }
+
+  HostPool& host = hosts_[it->second];
+  owners_.erase(it);
+  --host.active;
+  ++releases_;
+  released_.notify();
+
+  if (reusable && socket->isOpen() && host.idle.size() < maxIdle_) {
+    IdleSocket idle;
+    idle.socket = socket;
+    idle.since = time(NULL);
+    host.idle.push_back(idle);
+  } else {
+    socket->close();
+  }
+}
+
+void TSocketConnectionPool::checkHealth() {
+  vector<size_t> probes;
+
+  {
+    Guard g(monitor_.mutex());
+    time_t now = time(NULL);
+
+    for (size_t i = 0; i < hosts_.size(); ++i) {
+      HostPool& host = hosts_[i];
+
+      size_t kept = 0;
+      for (size_t j = 0; j < host.idle.size(); ++j) {
+        IdleSocket& idle = host.idle[j];
+        bool expired = maxIdleTime_ > 0 && now - idle.since >= maxIdleTime_;
+        if (expired || !isIdleSocketUsable(*idle.socket)) {
+          idle.socket->close();
+        } else {
+          host.idle[kept++] = idle;
+        }
+      }
+      host.idle.resize(kept);
+
+      if (host.server->lastFailTime_ > 0 && isUp(*host.server, now)) {
+        probes.push_back(i);
+      }
+    }
+  }
+
+  // A server that answers is up again, and gets a warm socket for its trouble
+  for (size_t n = 0; n < probes.size(); ++n) {
+    size_t i = probes[n];
+    shared_ptr<TSocket> socket = connect(i);
+    if (!socket) {
+      continue;
+    }
+
+    Guard g(monitor_.mutex());
+    if (hosts_[i].idle.size() < maxIdle_) {
+      IdleSocket idle;
+      idle.socket = socket;
+      idle.since = time(NULL);
+      hosts_[i].idle.push_back(idle);
+    } else {
+      socket->close();
+    }
+  }
+}
+
+void TSocketConnectionPool::startHealthChecker(shared_ptr<ThreadFactory> threadFactory,
+                                               int64_t intervalMs) {
+  if (intervalMs <= 0) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TSocketConnectionPool: health check interval must be positive");
+  }
+
+  Guard g(monitor_.mutex());
+  if (healthCheckerRunning_) {
+    return;
+  }
+
+  healthThread_ = threadFactory->newThread(
+    shared_ptr<Runnable>(new HealthChecker(this)));
+  healthCheckIntervalMs_ = intervalMs;
+  healthCheckerStop_ = false;
+  healthCheckerRunning_ = true;
+  try {
+    healthThread_->start();
+  } catch (...) {
+    healthCheckerRunning_ = false;
+    healthThread_.reset();
+    throw;
+  }
+}
+
+void TSocketConnectionPool::stopHealthChecker() {
+  shared_ptr<Thread> thread;
+
+  {
+    Guard g(monitor_.mutex());
+    if (!healthCheckerRunning_) {
+      return;
+    }
+    healthCheckerStop_ = true;
+    monitor_.notifyAll();
+    while (healthCheckerRunning_) {
+      monitor_.waitForever();
+    }
+    thread.swap(healthThread_);
+  }
+
+  if (thread) {
+    thread->join();
+  }
+}
+
+size_t TSocketConnectionPool::getNumIdle() const {
+  Guard g(monitor_.mutex());
+  size_t numIdle = 0;
+  for (size_t i = 0; i < hosts_.size(); ++i) {
+    numIdle += hosts_[i].idle.size();
+  }
+  return numIdle;
+}
+
+size_t TSocketConnectionPool::getNumActive() const {
+  Guard g(monitor_.mutex());
+  return owners_.size();
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,245 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TSOCKETCONNECTIONPOOL_H_
+#define _THRIFT_TRANSPORT_TSOCKETCONNECTIONPOOL_H_ 1
+
+#include <deque>
+#include <map>
+#include <vector>
+#include <thrift/transport/TSocket.h>
+#include <thrift/transport/TSocketPool.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/Thread.h>
+
+namespace apache { namespace thrift { namespace transport {
+
+/**
+ * Client side pool of open sockets to a set of servers.
+ *
+ * acquire() hands out an idle socket if there is one and opens a new one
+ * otherwise; release() gives it back for reuse.  Each server keeps at most
+ * maxIdle idle and maxActive handed out sockets.  Servers are marked down
+ * using the TSocketPoolServer failure counters, the same way TSocketPool
+ * does, and are skipped until their retry interval has passed.
+ *
+ * checkHealth() drops idle sockets the peer has closed, closes the ones
+ * idle for longer than the idle timeout, and probes servers that are down.
+ * startHealthChecker() runs it periodically on a thread of its own.
+ *
+ * All methods are thread safe.
+ */
+class TSocketConnectionPool {
+ public:
+  /**
+   * Connection pool constructor
+   *
+   * @param servers list of TSocketPoolServers
+   */
+  TSocketConnectionPool(const std::vector< boost::shared_ptr<TSocketPoolServer> >& servers);
+
+  /**
+   * Connection pool constructor
+   *
+   * @param servers list of pairs of host name and port
+   */
+  TSocketConnectionPool(const std::vector<std::pair<std::string, int> >& servers);
+
+  /**
+   * Stops the health checker and closes the idle sockets.  Sockets still
+   * handed out stay open and belong to their users.
+   */
+  virtual ~TSocketConnectionPool();
+
+  /**
+   * Sets how many idle sockets to keep per server.
+   */
+  void setMaxIdle(size_t maxIdle);
+
+  /**
+   * Sets how many sockets to a server may be handed out at once, 0 for no
+   * limit.
+   */
+  void setMaxActive(size_t maxActive);
+
+  /**
+   * Sets how long acquire() waits, in ms, for a socket to be released when
+   * the servers that are up are all at maxActive.  0, the default, doesn't
+   * wait.
+   */
+  void setAcquireTimeout(int ms);
+
+  /**
+   * Sets how many seconds a socket may sit idle before it is closed,
+   * 0 to keep idle sockets forever.
+   */
+  void setMaxIdleTime(int maxIdleTime);
+
+  /**
+   * Sets how long to wait until retrying a host if it was marked down
+   */
+  void setRetryInterval(int retryInterval);
+
+  /**
+   * Sets how many times to keep retrying a host before marking it as down.
+   */
+  void setMaxConsecutiveFailures(int maxConsecutiveFailures);
+
+  /**
+   * Set the connect, send and receive timeouts of new sockets, in ms.
+   */
+  void setConnTimeout(int ms);
+  void setSendTimeout(int ms);
+  void setRecvTimeout(int ms);
+
+  /**
+   * Open sockets until every server that is up has at least perServer of
+   * them idle.  Meant to be called at startup, before the first acquire().
+   *
+   * @return the number of sockets opened.
+   */
+  size_t warm(size_t perServer);
+
+  /**
+   * Get an open socket, reusing an idle one when possible.  Servers are
+   * tried in turn, skipping the ones that are down or at maxActive.  If
+   * that leaves none, waits up to the acquire timeout for a release.
+   *
+   * @throws TTransportException NOT_OPEN if no server could be reached.
+   */
+  boost::shared_ptr<TSocket> acquire();
+
+  /**
+   * Give back a socket returned by acquire().
+   *
+   * @param socket the socket.
+   * @param reusable false if the connection is in an unknown state, for
+   *                 example after an exception; the socket is closed.
+   */
+  void release(boost::shared_ptr<TSocket> socket, bool reusable = true);
+
+  /**
+   * Drop dead and expired idle sockets and probe the servers that are
+   * down, reopening an idle socket for each that answers.
+   */
+  void checkHealth();
+
+  /**
+   * Run checkHealth() every intervalMs on a thread from threadFactory,
+   * until stopHealthChecker() is called or the pool is destroyed.
+   */
+  void startHealthChecker(boost::shared_ptr<concurrency::ThreadFactory> threadFactory,
+                          int64_t intervalMs);
+
+  /**
+   * Stop the health checker and wait for it to exit.
+   */
+  void stopHealthChecker();
+
+  /**
+   * Number of idle sockets, over all servers.
+   */
+  size_t getNumIdle() const;
+
+  /**
+   * Number of sockets handed out, over all servers.
+   */
+  size_t getNumActive() const;
+
+ protected:
+  /// A socket waiting in a HostPool
+  struct IdleSocket {
+    boost::shared_ptr<TSocket> socket;
+    time_t since;
+  };
+
+  /// Sockets of one server
+  struct HostPool {
+    boost::shared_ptr<TSocketPoolServer> server;
+    std::deque<IdleSocket> idle;
+    size_t active;
+  };
+
+  class HealthChecker;
+
+  /// Create (but don't open) a socket to the server
+  boost::shared_ptr<TSocket> newSocket(const TSocketPoolServer& server);
+
+  /// Open a socket to hosts_[index], updating its failure counters
+  boost::shared_ptr<TSocket> connect(size_t index);
+
+  /**
+   * One pass of acquire() over the servers.
+   *
+   * @param full set if a server that is up was skipped for being at
+   *             maxActive.
+   * @param releases set to releases_ as of the pass.
+   * @return the socket, or NULL if none could be had.
+   */
+  boost::shared_ptr<TSocket> tryAcquire(bool& full, uint64_t& releases);
+
+  /// Whether a server that was marked down may be tried again
+  bool isUp(const TSocketPoolServer& server, time_t now) const;
+
+  /// Whether an idle socket still looks usable
+  static bool isIdleSocketUsable(TSocket& socket);
+
+  /** Guards everything below, and is the health checker's monitor */
+  concurrency::Monitor monitor_;
+
+  /** On monitor_'s mutex, notified when a handed out socket comes back */
+  concurrency::Monitor released_;
+
+  /** Sockets handed back, or given up on connecting, so far */
+  uint64_t releases_;
+
+  std::vector<HostPool> hosts_;
+
+  /** Index of the handed out sockets' servers */
+  std::map<TSocket*, size_t> owners_;
+
+  /** Server to try first in the next acquire() */
+  size_t next_;
+
+  size_t maxIdle_;
+  size_t maxActive_;
+  int acquireTimeout_;
+  int maxIdleTime_;
+
+  /** Retry interval in seconds, how long to not try a host if it has been
+   * marked as down.
+   */
+  time_t retryInterval_;
+
+  /** Max consecutive failures before marking a host down. */
+  int maxConsecutiveFailures_;
+
+  int connTimeout_;
+  int sendTimeout_;
+  int recvTimeout_;
+
+  boost::shared_ptr<concurrency::Thread> healthThread_;
+  int64_t healthCheckIntervalMs_;
+  bool healthCheckerRunning_;
+  bool healthCheckerStop_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TSOCKETCONNECTIONPOOL_H_
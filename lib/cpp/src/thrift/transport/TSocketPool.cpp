@@ -20,9 +20,11 @@
 #include <thrift/thrift-config.h>
 
 #include <algorithm>
+#include <cstdlib>
 #include <iostream>
 
 #include <thrift/transport/TSocketPool.h>
+#include <thrift/concurrency/Util.h>
 
 namespace apache { namespace thrift { namespace transport {
 
@@ -39,7 +41,8 @@ TSocketPoolServer::TSocketPoolServer()
     port_(0),
     socket_(THRIFT_INVALID_SOCKET),
     lastFailTime_(0),
-    consecutiveFailures_(0) {}
+    consecutiveFailures_(0),
+    latencyMs_(0) {}
 
 /**
  * Constructor for TSocketPool server
@@ -49,7 +52,8 @@ TSocketPoolServer::TSocketPoolServer(const string &host, int port)
     port_(port),
     socket_(THRIFT_INVALID_SOCKET),
     lastFailTime_(0),
-    consecutiveFailures_(0) {}
+    consecutiveFailures_(0),
+    latencyMs_(0) {}
 
 /**
  * TSocketPool implementation.
@@ -61,7 +65,10 @@ TSocketPool::TSocketPool() : TSocket(),
   retryInterval_(60),
   maxConsecutiveFailures_(1),
   randomize_(true),
-  alwaysTryLast_(true) {
+  alwaysTryLast_(true),
+  latencyAware_(false),
+  latencyDecay_(0.3),
+  outlierLatencyFactor_(0) {
 }
 
 TSocketPool::TSocketPool(const vector<string> &hosts,
@@ -70,7 +77,10 @@ TSocketPool::TSocketPool(const vector<string> &hosts,
   retryInterval_(60),
   maxConsecutiveFailures_(1),
   randomize_(true),
-  alwaysTryLast_(true)
+  alwaysTryLast_(true),
+  latencyAware_(false),
+  latencyDecay_(0.3),
+  outlierLatencyFactor_(0)
 {
   if (hosts.size() != ports.size()) {
     GlobalOutput("TSocketPool::TSocketPool: hosts.size != ports.size");
@@ -87,7 +97,10 @@ TSocketPool::TSocketPool(const vector<pair<string, int> >& servers) : TSocket(),
   retryInterval_(60),
   maxConsecutiveFailures_(1),
   randomize_(true),
-  alwaysTryLast_(true)
+  alwaysTryLast_(true),
+  latencyAware_(false),
+  latencyDecay_(0.3),
+  outlierLatencyFactor_(0)
 {
   for (unsigned i = 0; i < servers.size(); ++i) {
     addServer(servers[i].first, servers[i].second);
@@ -100,7 +113,10 @@ TSocketPool::TSocketPool(const vector< shared_ptr<TSocketPoolServer> >& servers)
   retryInterval_(60),
   maxConsecutiveFailures_(1),
   randomize_(true),
-  alwaysTryLast_(true)
+  alwaysTryLast_(true),
+  latencyAware_(false),
+  latencyDecay_(0.3),
+  outlierLatencyFactor_(0)
 {
 }
 
@@ -109,7 +125,10 @@ TSocketPool::TSocketPool(const string& host, int port) : TSocket(),
   retryInterval_(60),
   maxConsecutiveFailures_(1),
   randomize_(true),
-  alwaysTryLast_(true)
+  alwaysTryLast_(true),
+  latencyAware_(false),
+  latencyDecay_(0.3),
+  outlierLatencyFactor_(0)
 {
   addServer(host, port);
 }
@@ -162,6 +181,97 @@ void TSocketPool::setAlwaysTryLast(bool alwaysTryLast) {
   alwaysTryLast_ = alwaysTryLast;
 }
 
+void TSocketPool::setLatencyAware(bool latencyAware) {
+  latencyAware_ = latencyAware;
+}
+
+void TSocketPool::setLatencyDecay(double latencyDecay) {
+  if (latencyDecay <= 0 || latencyDecay > 1) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TSocketPool::setLatencyDecay: must be in (0, 1]");
+  }
+  latencyDecay_ = latencyDecay;
+}
+
+void TSocketPool::setOutlierLatencyFactor(double outlierLatencyFactor) {
+  outlierLatencyFactor_ = outlierLatencyFactor;
+}
+
+void TSocketPool::recordLatency(double latencyMs) {
+  if (currentServer_) {
+    updateLatency(*currentServer_, latencyMs);
+  }
+}
+
+void TSocketPool::updateLatency(TSocketPoolServer& server, double latencyMs) {
+  if (server.latencyMs_ == 0) {
+    server.latencyMs_ = latencyMs;
+  } else {
+    server.latencyMs_ = latencyDecay_ * latencyMs +
+      (1 - latencyDecay_) * server.latencyMs_;
+  }
+}
+
+namespace {
+
+// What a consecutive failure costs a server without a connect timeout
+const double DEFAULT_FAILURE_PENALTY_MS = 1000;
+
+// Lower is better.  Failures add to the latency rather than scale it, so
+// a server that keeps failing ranks behind working ones even before it
+// has been measured.
+double latencyScore(const TSocketPoolServer& server, double failurePenaltyMs) {
+  return server.latencyMs_ + server.consecutiveFailures_ * failurePenaltyMs;
+}
+
+}
+
+void TSocketPool::orderByLatency() {
+  size_t numServers = servers_.size();
+  // A failure costs about as long as a connect may take
+  double penalty = connTimeout_ > 0 ? connTimeout_ : DEFAULT_FAILURE_PENALTY_MS;
+
+  // Power of two choices: fill each slot with the better of two random
+  // servers from the ones not placed yet
+  for (size_t i = 0; i + 1 < numServers; ++i) {
+    size_t remaining = numServers - i;
+    size_t a = i + rand() % remaining;
+    size_t b = i + rand() % remaining;
+    size_t best =
+      latencyScore(*servers_[b], penalty) < latencyScore(*servers_[a], penalty) ? b : a;
+    std::swap(servers_[i], servers_[best]);
+  }
+
+  if (outlierLatencyFactor_ <= 0) {
+    return;
+  }
+
+  vector<double> latencies;
+  for (size_t i = 0; i < numServers; ++i) {
+    if (servers_[i]->latencyMs_ > 0) {
+      latencies.push_back(servers_[i]->latencyMs_);
+    }
+  }
+  if (latencies.size() < 2) {
+    return;
+  }
+  nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2,
+              latencies.end());
+  double limit = outlierLatencyFactor_ * latencies[latencies.size() / 2];
+
+  // Move outliers to the back, keeping the order of the rest
+  vector< shared_ptr<TSocketPoolServer> > outliers;
+  size_t kept = 0;
+  for (size_t i = 0; i < numServers; ++i) {
+    if (latencyScore(*servers_[i], penalty) > limit) {
+      outliers.push_back(servers_[i]);
+    } else {
+      servers_[kept++] = servers_[i];
+    }
+  }
+  copy(outliers.begin(), outliers.end(), servers_.begin() + kept);
+}
+
 void TSocketPool::setCurrentServer(const shared_ptr<TSocketPoolServer> &server) {
   currentServer_ = server;
   host_ = server->host_;
@@ -186,7 +296,9 @@ void TSocketPool::open() {
     return;
   }
 
-  if (randomize_ && numServers > 1) {
+  if (latencyAware_ && numServers > 1) {
+    orderByLatency();
+  } else if (randomize_ && numServers > 1) {
     random_shuffle(servers_.begin(), servers_.end());
   }
 
@@ -214,6 +326,7 @@ void TSocketPool::open() {
 
     if (retryIntervalPassed || isLastServer) {
       for (int j = 0; j < numRetries_; ++j) {
+        int64_t start = concurrency::Util::monotonicTimeUsec();
         try {
           TSocket::open();
         } catch (TException e) {
@@ -227,6 +340,9 @@ void TSocketPool::open() {
         server->socket_ = socket_;
         // reset lastFailTime_ is required
         server->lastFailTime_ = 0;
+        server->consecutiveFailures_ = 0;
+        updateLatency(*server,
+                      (concurrency::Util::monotonicTimeUsec() - start) / 1000.0);
         // success
         return;
       }
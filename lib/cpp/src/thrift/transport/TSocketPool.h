@@ -56,6 +56,9 @@ class TSocketPoolServer {
 
   // Number of consecutive times connecting to this server failed
   int consecutiveFailures_;
+
+  // Smoothed latency in milliseconds, 0 until first measured
+  double latencyMs_;
 };
 
 /**
@@ -152,6 +155,37 @@ class TSocketPool : public TSocket {
     */
    void setAlwaysTryLast(bool alwaysTryLast);
 
+   /**
+    * Order servers by latency instead of randomly.  Each slot in the
+    * connect order goes to the better of two randomly picked servers
+    * ("power of two choices"), scored by their smoothed latency plus, for
+    * each consecutive failure, the connect timeout or a second without
+    * one.  Servers not yet measured that haven't failed count as fastest,
+    * so every server gets measured.  Overrides setRandomize().
+    */
+   void setLatencyAware(bool latencyAware);
+
+   /**
+    * Weight of a new sample in the smoothed latency, in (0, 1].
+    */
+   void setLatencyDecay(double latencyDecay);
+
+   /**
+    * Servers slower than this many times the median latency, counting
+    * failures as above, are tried last.
+    * 0 turns outlier ejection off.
+    */
+   void setOutlierLatencyFactor(double outlierLatencyFactor);
+
+   /**
+    * Feed a latency sample for the current server into its smoothed
+    * latency.  open() records connect times on its own; callers can add
+    * request times with this.
+    *
+    * @param latencyMs the observed latency.
+    */
+   void recordLatency(double latencyMs);
+
    /**
     * Creates and opens the UNIX socket.
     */
@@ -166,6 +200,12 @@ class TSocketPool : public TSocket {
 
   void setCurrentServer(const boost::shared_ptr<TSocketPoolServer> &server);
 
+  /** Reorder servers_ for a latency aware connect */
+  void orderByLatency();
+
+  /** Update a server's smoothed latency */
+  void updateLatency(TSocketPoolServer& server, double latencyMs);
+
    /** List of servers to connect to */
   std::vector< boost::shared_ptr<TSocketPoolServer> > servers_;
 
@@ -188,6 +228,15 @@ class TSocketPool : public TSocket {
 
    /** Always try last host, even if marked down? */
    bool alwaysTryLast_;
+
+   /** Order hosts by latency? */
+   bool latencyAware_;
+
+   /** Weight of a new latency sample */
+   double latencyDecay_;
+
+   /** Latency relative to the median past which a host is tried last */
+   double outlierLatencyFactor_;
 };
 
 }}} // apache::thrift::transport
@@ -48,6 +48,15 @@ uint32_t readAll(Transport_ &trans, uint8_t* buf, uint32_t len) {
 }
 
 
+/**
+ * One buffer of a gather write.  See TTransport::writev().
+ */
+struct TIOVec {
+  const uint8_t* base;
+  uint32_t len;
+};
+
+
 /**
  * Generic interface for a method of transporting data. A TTransport may be
  * capable of either reading or writing, but not necessarily both.
@@ -129,6 +138,43 @@ class TTransport {
     return apache::thrift::transport::readAll(*this, buf, len);
   }
 
+  /**
+   * What tryRead() and tryWrite() return in place of a byte count.
+   */
+  enum TryStatus {
+    /** Nothing can be read yet, or the read timed out; try again later */
+    TRY_LATER = -1,
+    /** The transport has failed and should be closed */
+    TRY_FAILED = -2
+  };
+
+  /**
+   * read() for callers that would rather not catch, such as event loops
+   * that see clients come and go all the time.  Never throws.
+   *
+   * The default catches what read() throws.  Transports that can tell
+   * these cases apart without an exception override it, and a transport
+   * wrapping another one should use the wrapped transport's tryRead().
+   *
+   * @param buf  Where to put the data
+   * @param len  How many bytes to read at most
+   * @return How many bytes were read, 0 at end of stream (including a
+   *         peer that reset the connection), TRY_LATER or TRY_FAILED
+   */
+  virtual int32_t tryRead(uint8_t* buf, uint32_t len) {
+    try {
+      return static_cast<int32_t>(read(buf, len));
+    } catch (const TTransportException& te) {
+      switch (te.getType()) {
+        case TTransportException::TIMED_OUT   : return TRY_LATER;
+        case TTransportException::END_OF_FILE : return 0;
+        default                               : return TRY_FAILED;
+      }
+    } catch (...) {
+      return TRY_FAILED;
+    }
+  }
+
   /**
    * Called when read is completed.
    * This can be over-ridden to perform a transport-specific action
@@ -162,6 +208,64 @@ class TTransport {
                               "Base TTransport cannot write.");
   }
 
+  /**
+   * write() for callers that would rather not catch.  Never throws.
+   *
+   * The default writes all of buf.  Transports that can write without
+   * blocking override it to take only what fits.
+   *
+   * @param buf  The data to write out
+   * @param len  How many bytes of it to write
+   * @return How many bytes were taken, 0 if the transport would block,
+   *         or TRY_FAILED
+   */
+  virtual int32_t tryWrite(const uint8_t* buf, uint32_t len) {
+    try {
+      write(buf, len);
+      return static_cast<int32_t>(len);
+    } catch (...) {
+      return TRY_FAILED;
+    }
+  }
+
+  /**
+   * Writes a sequence of buffers, exactly as if write() had been called on
+   * each of them in order.
+   *
+   * The default implementation does just that.  Transports that sit directly
+   * on a file descriptor override it to hand all of the buffers to the kernel
+   * in a single gather write, and buffering transports override it to push
+   * their pending data and the caller's buffers down together without copying
+   * the caller's data.
+   *
+   * @param iov     The buffers to write
+   * @param iovcnt  How many entries of iov to write
+   * @throws TTransportException if an error occurs
+   */
+  virtual void writev(const TIOVec* iov, uint32_t iovcnt) {
+    for (uint32_t i = 0; i < iovcnt; ++i) {
+      write(iov[i].base, iov[i].len);
+    }
+  }
+
+  /**
+   * Writes len bytes of the file open on fd, starting at offset, exactly as
+   * if they had been read into memory and passed to write().  The file
+   * position of fd is left alone.
+   *
+   * The default implementation does just that, through a bounce buffer.
+   * Transports that sit directly on a file descriptor override it to have
+   * the kernel move the bytes with sendfile(), so already serialized data
+   * on disk can be sent without passing through user space.
+   *
+   * @param fd      An open, readable file descriptor
+   * @param offset  Where in the file to start
+   * @param len     How many bytes to write
+   * @throws TTransportException if an error occurs, or END_OF_FILE if the
+   *         file ends before len bytes
+   */
+  virtual void transferFrom(int fd, off_t offset, uint32_t len);
+
   /**
    * Called when write is completed.
    * This can be over-ridden to perform a transport-specific action
@@ -237,6 +341,16 @@ class TTransport {
                               "Base TTransport cannot consume.");
   }
 
+  /**
+   * A handle that keeps the memory returned by borrow() valid after it
+   * has been consumed, so a protocol can hand out views into it rather
+   * than copies.  Empty, the default, when borrowed memory is only good
+   * until the next call on the transport.
+   */
+  virtual boost::shared_ptr<const void> getBorrowOwner() {
+    return boost::shared_ptr<const void>();
+  }
+
  protected:
   /**
    * Simple constructor.
@@ -263,6 +377,17 @@ class TTransportFactory {
     return trans;
   }
 
+  /**
+   * Takes back a transport that getTransport() made, once its connection
+   * is closed, so a later getTransport() can reuse it rather than make a
+   * new one.  Servers call this for every connection they end.  trans is
+   * left empty.  The default just lets it go; factories that recycle only
+   * keep a transport nothing else still holds.
+   */
+  virtual void recycle(boost::shared_ptr<TTransport>& trans) {
+    trans.reset();
+  }
+
 };
 
 }}} // apache::thrift::transport
@@ -51,25 +51,39 @@ class TTransportException : public apache::thrift::TException {
 
   TTransportException() :
     apache::thrift::TException(),
-    type_(UNKNOWN) {}
+    type_(UNKNOWN),
+    errno_(0),
+    described_(true) {}
 
   TTransportException(TTransportExceptionType type) :
     apache::thrift::TException(),
-    type_(type) {}
+    type_(type),
+    errno_(0),
+    described_(true) {}
 
   TTransportException(const std::string& message) :
     apache::thrift::TException(message),
-    type_(UNKNOWN) {}
+    type_(UNKNOWN),
+    errno_(0),
+    described_(true) {}
 
   TTransportException(TTransportExceptionType type, const std::string& message) :
     apache::thrift::TException(message),
-    type_(type) {}
+    type_(type),
+    errno_(0),
+    described_(true) {}
 
+  /**
+   * The errno's description is only looked up and appended to message when
+   * what() is first called, as most of these are caught and dropped.
+   */
   TTransportException(TTransportExceptionType type,
                       const std::string& message,
                       int errno_copy) :
-    apache::thrift::TException(message + ": " + TOutput::strerror_s(errno_copy)),
-    type_(type) {}
+    apache::thrift::TException(message),
+    type_(type),
+    errno_(errno_copy),
+    described_(false) {}
 
   virtual ~TTransportException() throw() {}
 
@@ -83,7 +97,22 @@ class TTransportException : public apache::thrift::TException {
     return type_;
   }
 
+  /**
+   * Returns the errno the exception was raised for, or 0 if there was none.
+   */
+  int getErrno() const throw() {
+    return errno_;
+  }
+
   virtual const char* what() const throw() {
+    if (!described_) {
+      described_ = true;
+      try {
+        const_cast<std::string&>(message_) += ": " + TOutput::strerror_s(errno_);
+      } catch (...) {
+        // Keep the message without the description
+      }
+    }
     if (message_.empty()) {
       switch (type_) {
         case UNKNOWN        : return "TTransportException: Unknown transport exception";
@@ -108,6 +137,12 @@ class TTransportException : public apache::thrift::TException {
   /** Error code */
   TTransportExceptionType type_;
 
+  /** errno the exception was raised for, 0 if none */
+  int errno_;
+
+  /** Whether errno_ has been described in message_ yet */
+  mutable bool described_;
+
 };
 
 }}} // apache::thrift::transport
@@ -17,12 +17,54 @@
  * under the License.
  */
 
+#include <thrift/thrift-config.h>
+
 #include <thrift/transport/TTransportUtils.h>
+#include <thrift/transport/PlatformSocket.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#endif
 
 using std::string;
 
 namespace apache { namespace thrift { namespace transport {
 
+void TTransport::transferFrom(int fd, off_t offset, uint32_t len) {
+  uint8_t buf[64 * 1024];
+  while (len > 0) {
+    uint32_t want = len < sizeof(buf) ? len : static_cast<uint32_t>(sizeof(buf));
+#ifdef _WIN32
+    // No pread() here, so this one does move the file position.
+    THRIFT_SSIZET got = -1;
+    if (::_lseeki64(fd, offset, SEEK_SET) >= 0) {
+      got = ::_read(fd, buf, want);
+    }
+#else
+    THRIFT_SSIZET got = ::pread(fd, buf, want, offset);
+#endif
+    if (got < 0) {
+      int errno_copy = THRIFT_GET_SOCKET_ERROR;
+      if (errno_copy == THRIFT_EINTR) {
+        continue;
+      }
+      throw TTransportException(TTransportException::UNKNOWN,
+                                "TTransport::transferFrom() read",
+                                errno_copy);
+    }
+    if (got == 0) {
+      throw TTransportException(TTransportException::END_OF_FILE,
+                                "TTransport::transferFrom() file ended early");
+    }
+    write(buf, static_cast<uint32_t>(got));
+    offset += got;
+    len -= static_cast<uint32_t>(got);
+  }
+}
+
 uint32_t TPipedTransport::read(uint8_t* buf, uint32_t len) {
   uint32_t need = len;
 
@@ -26,6 +26,71 @@ using std::string;
 
 namespace apache { namespace thrift { namespace transport {
 
+TZlibTransport::TZlibTransport(boost::shared_ptr<TTransport> transport,
+                               boost::shared_ptr<TZlibStreamPool> pool) :
+  transport_(transport),
+  urpos_(0),
+  uwpos_(0),
+  input_ended_(false),
+  output_finished_(false),
+  urbuf_size_(pool->urbufSize_),
+  crbuf_size_(pool->crbufSize_),
+  uwbuf_size_(pool->uwbufSize_),
+  cwbuf_size_(pool->cwbufSize_),
+  urbuf_(NULL),
+  crbuf_(NULL),
+  uwbuf_(NULL),
+  cwbuf_(NULL),
+  rstream_(NULL),
+  wstream_(NULL),
+  comp_level_(pool->compLevel_),
+  pool_(pool)
+{
+  if (uwbuf_size_ < MIN_DIRECT_DEFLATE_SIZE) {
+    // Have to copy this into a local because of a linking issue.
+    int minimum = MIN_DIRECT_DEFLATE_SIZE;
+    throw TTransportException(
+        TTransportException::BAD_ARGS,
+        "TZLibTransport: uncompressed write buffer must be at least"
+        + boost::lexical_cast<std::string>(minimum) + ".");
+  }
+
+  TZlibStreamPool::Streams streams;
+  if (pool_->acquire(&streams)) {
+    urbuf_ = streams.urbuf;
+    crbuf_ = streams.crbuf;
+    uwbuf_ = streams.uwbuf;
+    cwbuf_ = streams.cwbuf;
+    rstream_ = streams.rstream;
+    wstream_ = streams.wstream;
+
+    rstream_->next_in   = crbuf_;
+    wstream_->next_in   = uwbuf_;
+    rstream_->next_out  = urbuf_;
+    wstream_->next_out  = cwbuf_;
+    rstream_->avail_in  = 0;
+    wstream_->avail_in  = 0;
+    rstream_->avail_out = urbuf_size_;
+    wstream_->avail_out = cwbuf_size_;
+    return;
+  }
+
+  try {
+    urbuf_ = new uint8_t[urbuf_size_];
+    crbuf_ = new uint8_t[crbuf_size_];
+    uwbuf_ = new uint8_t[uwbuf_size_];
+    cwbuf_ = new uint8_t[cwbuf_size_];
+
+    initZlib();
+  } catch (...) {
+    delete[] urbuf_;
+    delete[] crbuf_;
+    delete[] uwbuf_;
+    delete[] cwbuf_;
+    throw;
+  }
+}
+
 // Don't call this outside of the constructor.
 void TZlibTransport::initZlib() {
   int rv;
@@ -86,6 +151,13 @@ inline void TZlibTransport::checkZlibRvNothrow(int status, const char* message)
 }
 
 TZlibTransport::~TZlibTransport() {
+  if (pool_) {
+    TZlibStreamPool::Streams streams =
+      { urbuf_, crbuf_, uwbuf_, cwbuf_, rstream_, wstream_ };
+    pool_->release(streams);
+    return;
+  }
+
   int rv;
   rv = inflateEnd(rstream_);
   checkZlibRvNothrow(rv, rstream_->msg);
@@ -395,5 +467,133 @@ void TZlibTransport::verifyChecksum() {
                             "zlib stream");
 }
 
+const size_t TZlibStreamPool::DEFAULT_MAX_IDLE;
+
+TZlibStreamPool::TZlibStreamPool(size_t max_idle,
+                                 int urbuf_size,
+                                 int crbuf_size,
+                                 int uwbuf_size,
+                                 int cwbuf_size,
+                                 int16_t comp_level) :
+  maxIdle_(max_idle),
+  urbufSize_(urbuf_size),
+  crbufSize_(crbuf_size),
+  uwbufSize_(uwbuf_size),
+  cwbufSize_(cwbuf_size),
+  compLevel_(comp_level) {
+}
+
+TZlibStreamPool::~TZlibStreamPool() {
+  for (std::vector<Streams>::iterator it = idle_.begin(); it != idle_.end(); ++it) {
+    destroy(*it);
+  }
+}
+
+size_t TZlibStreamPool::idle() {
+  concurrency::Guard g(mutex_);
+  return idle_.size();
+}
+
+bool TZlibStreamPool::acquire(Streams* streams) {
+  concurrency::Guard g(mutex_);
+  if (idle_.empty()) {
+    return false;
+  }
+  *streams = idle_.back();
+  idle_.pop_back();
+  return true;
+}
+
+void TZlibStreamPool::release(const Streams& streams) {
+  // Resetting drops whatever the transport didn't flush, as destroying it
+  // would have.
+  if (inflateReset(streams.rstream) == Z_OK &&
+      deflateReset(streams.wstream) == Z_OK) {
+    concurrency::Guard g(mutex_);
+    if (idle_.size() < maxIdle_) {
+      idle_.push_back(streams);
+      return;
+    }
+  }
+  destroy(streams);
+}
+
+void TZlibStreamPool::destroy(const Streams& streams) {
+  inflateEnd(streams.rstream);
+  deflateEnd(streams.wstream);
+  delete streams.rstream;
+  delete streams.wstream;
+  delete[] streams.urbuf;
+  delete[] streams.crbuf;
+  delete[] streams.uwbuf;
+  delete[] streams.cwbuf;
+}
+
+
+void THttpZlibContentCoding::encode(const uint8_t* in, uint32_t len,
+                                    TMemoryBuffer& out) {
+  // 16 more window bits asks for a gzip header and trailer in place of
+  // the zlib ones
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  int rv = deflateInit2(&stream, comp_level_, Z_DEFLATED,
+                        format_ == GZIP ? MAX_WBITS + 16 : MAX_WBITS,
+                        8, Z_DEFAULT_STRATEGY);
+  if (rv != Z_OK) {
+    throw TZlibTransportException(rv, stream.msg);
+  }
+
+  // Room for all of it, so one call finishes the stream
+  uint32_t bound = static_cast<uint32_t>(deflateBound(&stream, len));
+  stream.next_in = const_cast<Bytef*>(in);
+  stream.avail_in = len;
+  stream.next_out = out.getWritePtr(bound);
+  stream.avail_out = bound;
+  rv = deflate(&stream, Z_FINISH);
+  if (rv != Z_STREAM_END) {
+    string msg = stream.msg != NULL ? stream.msg : "";
+    deflateEnd(&stream);
+    throw TZlibTransportException(rv, msg.c_str());
+  }
+  out.wroteBytes(bound - stream.avail_out);
+  deflateEnd(&stream);
+}
+
+void THttpZlibContentCoding::decode(const uint8_t* in, uint32_t len,
+                                    TMemoryBuffer& out, uint32_t maxLen) {
+  // 32 more window bits takes either header, as senders of "deflate" are
+  // not all agreed on having one
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  int rv = inflateInit2(&stream, MAX_WBITS + 32);
+  if (rv != Z_OK) {
+    throw TZlibTransportException(rv, stream.msg);
+  }
+
+  stream.next_in = const_cast<Bytef*>(in);
+  stream.avail_in = len;
+  uint32_t total = 0;
+  do {
+    const uint32_t room = 64 * 1024;
+    stream.next_out = out.getWritePtr(room);
+    stream.avail_out = room;
+    rv = inflate(&stream, Z_NO_FLUSH);
+    out.wroteBytes(room - stream.avail_out);
+    total += room - stream.avail_out;
+
+    if (rv != Z_OK && rv != Z_STREAM_END) {
+      // Z_BUF_ERROR here means the input ran out before the stream did
+      string msg = stream.msg != NULL ? stream.msg : "truncated body";
+      inflateEnd(&stream);
+      throw TZlibTransportException(rv, msg.c_str());
+    }
+    if (total > maxLen) {
+      inflateEnd(&stream);
+      throw TTransportException(TTransportException::CORRUPTED_DATA,
+                                "Decoded body too large");
+    }
+  } while (rv != Z_STREAM_END);
+  inflateEnd(&stream);
+}
 
 }}} // apache::thrift::transport
@@ -20,7 +20,11 @@
 #ifndef _THRIFT_TRANSPORT_TZLIBTRANSPORT_H_
 #define _THRIFT_TRANSPORT_TZLIBTRANSPORT_H_ 1
 
+#include <vector>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/transport/THttpTransport.h>
 #include <thrift/transport/TTransport.h>
 #include <thrift/transport/TVirtualTransport.h>
 #include <zlib.h>
@@ -59,6 +63,8 @@ class TZlibTransportException : public TTransportException {
   std::string zlib_msg_;
 };
 
+class TZlibStreamPool;
+
 /**
  * This transport uses zlib to compress on write and decompress on read 
  *
@@ -128,6 +134,14 @@ class TZlibTransport : public TVirtualTransport<TZlibTransport> {
     }
   }
 
+  /**
+   * Take buffers and zlib state from pool rather than allocating them, and
+   * give them back on destruction.  The sizes and compression level are
+   * the pool's.
+   */
+  TZlibTransport(boost::shared_ptr<TTransport> transport,
+                 boost::shared_ptr<TZlibStreamPool> pool);
+
   // Don't call this outside of the constructor.
   void initZlib();
 
@@ -224,6 +238,76 @@ class TZlibTransport : public TVirtualTransport<TZlibTransport> {
   struct z_stream_s* wstream_;
 
   const int comp_level_;
+
+  /// Where the buffers and streams go back to, if they came from one
+  boost::shared_ptr<TZlibStreamPool> pool_;
+};
+
+/**
+ * Idle buffers and zlib streams for TZlibTransports to reuse.
+ *
+ * Setting up a TZlibTransport allocates its four buffers and initializes
+ * two zlib streams, which is about 256KB of state at the default level.
+ * For short connections that costs more than compressing their data.
+ * Transports made from a pool hand theirs back when destroyed, reset with
+ * inflateReset() and deflateReset(), and the next transport picks them up.
+ *
+ * Pools are thread safe and must outlive their transports, which hold a
+ * reference to them.
+ */
+class TZlibStreamPool {
+ public:
+  static const size_t DEFAULT_MAX_IDLE = 64;
+
+  /**
+   * @param max_idle     Most sets of state kept for reuse; the rest are freed.
+   * @param urbuf_size   Buffer sizes and compression level for transports
+   * @param crbuf_size   from this pool, as for TZlibTransport.
+   * @param uwbuf_size
+   * @param cwbuf_size
+   * @param comp_level
+   */
+  TZlibStreamPool(size_t max_idle = DEFAULT_MAX_IDLE,
+                  int urbuf_size = TZlibTransport::DEFAULT_URBUF_SIZE,
+                  int crbuf_size = TZlibTransport::DEFAULT_CRBUF_SIZE,
+                  int uwbuf_size = TZlibTransport::DEFAULT_UWBUF_SIZE,
+                  int cwbuf_size = TZlibTransport::DEFAULT_CWBUF_SIZE,
+                  int16_t comp_level = Z_DEFAULT_COMPRESSION);
+
+  ~TZlibStreamPool();
+
+  /// Sets of state waiting to be reused
+  size_t idle();
+
+ private:
+  friend class TZlibTransport;
+
+  struct Streams {
+    uint8_t* urbuf;
+    uint8_t* crbuf;
+    uint8_t* uwbuf;
+    uint8_t* cwbuf;
+    struct z_stream_s* rstream;
+    struct z_stream_s* wstream;
+  };
+
+  /// Takes an idle set, or returns false if there is none
+  bool acquire(Streams* streams);
+
+  /// Resets streams and keeps them, or frees them if the pool is full
+  void release(const Streams& streams);
+
+  static void destroy(const Streams& streams);
+
+  const size_t maxIdle_;
+  const uint32_t urbufSize_;
+  const uint32_t crbufSize_;
+  const uint32_t uwbufSize_;
+  const uint32_t cwbufSize_;
+  const int compLevel_;
+
+  std::vector<Streams> idle_;
+  concurrency::Mutex mutex_;
 };
 
 
@@ -235,15 +319,57 @@ class TZlibTransportFactory : public TTransportFactory {
  public:
   TZlibTransportFactory() {}
 
+  /**
+   * Make transports that reuse zlib state from pool.
+   */
+  explicit TZlibTransportFactory(boost::shared_ptr<TZlibStreamPool> pool) :
+    pool_(pool) {}
+
   virtual ~TZlibTransportFactory() {}
 
   virtual boost::shared_ptr<TTransport> getTransport(
                                          boost::shared_ptr<TTransport> trans) {
+    if (pool_) {
+      return boost::shared_ptr<TTransport>(new TZlibTransport(trans, pool_));
+    }
     return boost::shared_ptr<TTransport>(new TZlibTransport(trans));
   }
+
+ private:
+  boost::shared_ptr<TZlibStreamPool> pool_;
 };
 
 
+/**
+ * The gzip and deflate Content-Encodings, for THttpTransport.  Every call
+ * sets up a zlib stream of its own, so the object can be shared.
+ */
+class THttpZlibContentCoding : public THttpContentCoding {
+ public:
+  enum Format {
+    GZIP,
+    DEFLATE
+  };
+
+  explicit THttpZlibContentCoding(Format format = GZIP,
+                                  int comp_level = Z_DEFAULT_COMPRESSION) :
+    format_(format),
+    comp_level_(comp_level) {}
+
+  virtual const char* getName() const {
+    return format_ == GZIP ? "gzip" : "deflate";
+  }
+
+  virtual void encode(const uint8_t* in, uint32_t len, TMemoryBuffer& out);
+
+  virtual void decode(const uint8_t* in, uint32_t len, TMemoryBuffer& out,
+                      uint32_t maxLen);
+
+ private:
+  Format format_;
+  int comp_level_;
+};
+
 }}} // apache::thrift::transport
 
 #endif // #ifndef _THRIFT_TRANSPORT_TZLIBTRANSPORT_H_
@@ -0,0 +1,440 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <boost/lexical_cast.hpp>
+#include <zstd.h>
+#include <thrift/transport/TZstdTransport.h>
+
+using std::string;
+
+namespace apache { namespace thrift { namespace transport {
+
+string TZstdTransportException::errorMessage(size_t code, const char* where) {
+  string rv = "zstd error: ";
+  rv += ZSTD_getErrorName(code);
+  if (where) {
+    rv += " (in ";
+    rv += where;
+    rv += ")";
+  }
+  return rv;
+}
+
+TZstdTransport::TZstdTransport(boost::shared_ptr<TTransport> transport,
+                               int urbuf_size,
+                               int crbuf_size,
+                               int uwbuf_size,
+                               int cwbuf_size,
+                               int comp_level,
+                               boost::shared_ptr<TZstdDictionary> dictionary) :
+  transport_(transport),
+  dictionary_(dictionary),
+  urpos_(0),
+  urend_(0),
+  crpos_(0),
+  crend_(0),
+  uwpos_(0),
+  cwpos_(0),
+  input_ended_(false),
+  output_finished_(false),
+  output_pending_(false),
+  urbuf_size_(urbuf_size),
+  crbuf_size_(crbuf_size),
+  uwbuf_size_(uwbuf_size),
+  cwbuf_size_(cwbuf_size),
+  urbuf_(NULL),
+  crbuf_(NULL),
+  uwbuf_(NULL),
+  cwbuf_(NULL),
+  rstream_(NULL),
+  wstream_(NULL)
+{
+  if (uwbuf_size_ < MIN_DIRECT_COMPRESS_SIZE) {
+    // Have to copy this into a local because of a linking issue.
+    int minimum = MIN_DIRECT_COMPRESS_SIZE;
+    throw TTransportException(
+        TTransportException::BAD_ARGS,
+        "TZstdTransport: uncompressed write buffer must be at least "
+        + boost::lexical_cast<string>(minimum) + ".");
+  }
+  if (urbuf_size <= 0 || crbuf_size <= 0 || cwbuf_size <= 0) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TZstdTransport: buffer sizes must be positive.");
+  }
+
+  try {
+    urbuf_ = new uint8_t[urbuf_size];
+    crbuf_ = new uint8_t[crbuf_size];
+    uwbuf_ = new uint8_t[uwbuf_size];
+    cwbuf_ = new uint8_t[cwbuf_size];
+
+    rstream_ = ZSTD_createDCtx();
+    wstream_ = ZSTD_createCCtx();
+    if (rstream_ == NULL || wstream_ == NULL) {
+      throw std::bad_alloc();
+    }
+
+    if (dictionary_) {
+      checkZstdRv(ZSTD_CCtx_refCDict(wstream_, dictionary_->getCDict()),
+                  "ZSTD_CCtx_refCDict");
+      checkZstdRv(ZSTD_DCtx_refDDict(rstream_, dictionary_->getDDict()),
+                  "ZSTD_DCtx_refDDict");
+    } else {
+      checkZstdRv(ZSTD_CCtx_setParameter(wstream_, ZSTD_c_compressionLevel, comp_level),
+                  "ZSTD_CCtx_setParameter");
+    }
+    checkZstdRv(ZSTD_CCtx_setParameter(wstream_, ZSTD_c_checksumFlag, 1),
+                "ZSTD_CCtx_setParameter");
+  } catch (...) {
+    ZSTD_freeDCtx(rstream_);
+    ZSTD_freeCCtx(wstream_);
+    delete[] urbuf_;
+    delete[] crbuf_;
+    delete[] uwbuf_;
+    delete[] cwbuf_;
+    throw;
+  }
+}
+
+inline void TZstdTransport::checkZstdRv(size_t rv, const char* where) {
+  if (ZSTD_isError(rv)) {
+    throw TZstdTransportException(rv, where);
+  }
+}
+
+TZstdTransport::~TZstdTransport() {
+  // Anything written but not flushed is discarded along with the context,
+  // which is the defined TTransport behavior.
+  ZSTD_freeDCtx(rstream_);
+  ZSTD_freeCCtx(wstream_);
+
+  delete[] urbuf_;
+  delete[] crbuf_;
+  delete[] uwbuf_;
+  delete[] cwbuf_;
+}
+
+bool TZstdTransport::isOpen() {
+  return (readAvail() > 0) || (crpos_ < crend_) || output_pending_ ||
+    transport_->isOpen();
+}
+
+bool TZstdTransport::peek() {
+  return (readAvail() > 0) || (crpos_ < crend_) || output_pending_ ||
+    transport_->peek();
+}
+
+
+// READING STRATEGY
+//
+// The same as TZlibTransport's: copy out of urbuf_, and when it runs dry,
+// decompress from crbuf_ into it, refilling crbuf_ from the underlying
+// transport when that is empty too.
+//
+// zstd keeps decoded data of its own when urbuf_ is too small to take it
+// all.  output_pending_ records that, so we go back to zstd for it before
+// blocking on the underlying transport.
+
+inline int TZstdTransport::readAvail() {
+  return urend_ - urpos_;
+}
+
+uint32_t TZstdTransport::read(uint8_t* buf, uint32_t len) {
+  uint32_t need = len;
+
+  while (true) {
+    uint32_t give = std::min((uint32_t) readAvail(), need);
+    memcpy(buf, urbuf_ + urpos_, give);
+    need -= give;
+    buf += give;
+    urpos_ += give;
+
+    if (need == 0) {
+      return len;
+    }
+
+    // Return what we have rather than block in the underlying transport.
+    if (need < len && crpos_ == crend_ && !output_pending_) {
+      return len - need;
+    }
+
+    if (input_ended_) {
+      return len - need;
+    }
+
+    // The uncompressed read buffer is empty.
+    urpos_ = 0;
+    urend_ = 0;
+
+    if (!readFromZstd()) {
+      // no data available from underlying transport
+      return len - need;
+    }
+  }
+}
+
+bool TZstdTransport::readFromZstd() {
+  assert(!input_ended_);
+
+  if (crpos_ == crend_ && !output_pending_) {
+    uint32_t got = transport_->read(crbuf_, crbuf_size_);
+    if (got == 0) {
+      return false;
+    }
+    crpos_ = 0;
+    crend_ = got;
+  }
+
+  ZSTD_inBuffer in = { crbuf_, crend_, crpos_ };
+  ZSTD_outBuffer out = { urbuf_, urbuf_size_, urend_ };
+  size_t rv = ZSTD_decompressStream(rstream_, &out, &in);
+  checkZstdRv(rv, "ZSTD_decompressStream");
+
+  crpos_ = static_cast<uint32_t>(in.pos);
+  urend_ = static_cast<uint32_t>(out.pos);
+  output_pending_ = (out.pos == out.size);
+
+  // Zero means the frame is complete and its checksum matched.
+  if (rv == 0) {
+    input_ended_ = true;
+    output_pending_ = false;
+  }
+
+  return true;
+}
+
+
+// WRITING STRATEGY
+//
+// Small writes are buffered in uwbuf_ as in TZlibTransport; big ones go
+// straight to zstd.  zstd compresses into cwbuf_, which is written to the
+// underlying transport whenever it fills up.
+
+void TZstdTransport::write(const uint8_t* buf, uint32_t len) {
+  if (output_finished_) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "write() called after finish()");
+  }
+
+  if (len > MIN_DIRECT_COMPRESS_SIZE) {
+    flushToZstd(uwbuf_, uwpos_, ZSTD_e_continue);
+    uwpos_ = 0;
+    flushToZstd(buf, len, ZSTD_e_continue);
+  } else if (len > 0) {
+    if (uwbuf_size_ - uwpos_ < len) {
+      flushToZstd(uwbuf_, uwpos_, ZSTD_e_continue);
+      uwpos_ = 0;
+    }
+    memcpy(uwbuf_ + uwpos_, buf, len);
+    uwpos_ += len;
+  }
+}
+
+void TZstdTransport::flush()  {
+  if (output_finished_) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "flush() called after finish()");
+  }
+
+  flushToTransport(ZSTD_e_flush);
+}
+
+void TZstdTransport::finish()  {
+  if (output_finished_) {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "finish() called more than once");
+  }
+
+  flushToTransport(ZSTD_e_end);
+}
+
+void TZstdTransport::flushToTransport(int mode)  {
+  flushToZstd(uwbuf_, uwpos_, mode);
+  uwpos_ = 0;
+
+  transport_->write(cwbuf_, cwpos_);
+  cwpos_ = 0;
+
+  transport_->flush();
+}
+
+void TZstdTransport::flushToZstd(const uint8_t* buf, uint32_t len, int mode) {
+  ZSTD_inBuffer in = { buf, len, 0 };
+
+  while (true) {
+    if (mode == ZSTD_e_continue && in.pos == in.size) {
+      break;
+    }
+
+    // If our output buffer is full, flush to the underlying transport.
+    if (cwpos_ == cwbuf_size_) {
+      transport_->write(cwbuf_, cwbuf_size_);
+      cwpos_ = 0;
+    }
+
+    ZSTD_outBuffer out = { cwbuf_, cwbuf_size_, cwpos_ };
+    size_t rv = ZSTD_compressStream2(wstream_, &out, &in,
+                                     static_cast<ZSTD_EndDirective>(mode));
+    checkZstdRv(rv, "ZSTD_compressStream2");
+    cwpos_ = static_cast<uint32_t>(out.pos);
+
+    // For a flush or the end of the frame, zero means nothing is left over.
+    if (mode != ZSTD_e_continue && rv == 0) {
+      assert(in.pos == in.size);
+      if (mode == ZSTD_e_end) {
+        output_finished_ = true;
+      }
+      break;
+    }
+  }
+}
+
+const uint8_t* TZstdTransport::borrow(uint8_t* buf, uint32_t* len) {
+  (void) buf;
+  // Don't try to be clever with shifting buffers.
+  // If we have enough data, give a pointer to it,
+  // otherwise let the protcol use its slow path.
+  if (readAvail() >= (int)*len) {
+    *len = (uint32_t)readAvail();
+    return urbuf_ + urpos_;
+  }
+  return NULL;
+}
+
+void TZstdTransport::consume(uint32_t len) {
+  if (readAvail() >= (int)len) {
+    urpos_ += len;
+  } else {
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "consume did not follow a borrow.");
+  }
+}
+
+void TZstdTransport::verifyChecksum() {
+  // If zstd has already reported the end of the frame,
+  // it has verified the checksum.
+  if (input_ended_) {
+    return;
+  }
+
+  // This should only be called when reading is complete.
+  if (readAvail() > 0) {
+    throw TTransportException(
+        TTransportException::CORRUPTED_DATA,
+        "verifyChecksum() called before end of zstd frame");
+  }
+
+  urpos_ = 0;
+  urend_ = 0;
+
+  // This will throw an exception if the checksum is bad.  If the last read
+  // filled urbuf_, the first call may only find out nothing was held back.
+  bool performed_decompress = readFromZstd();
+  if (performed_decompress && !input_ended_ && readAvail() == 0) {
+    performed_decompress = readFromZstd();
+  }
+  if (!performed_decompress) {
+    // As with TZlibTransport, whether this blocks or fails depends on how
+    // the underlying transport reports that no data is available yet.
+    throw TTransportException(TTransportException::CORRUPTED_DATA,
+                              "checksum not available yet in "
+                              "verifyChecksum()");
+  }
+
+  if (input_ended_) {
+    return;
+  }
+
+  throw TTransportException(TTransportException::CORRUPTED_DATA,
+                            "verifyChecksum() called before end of "
+                            "zstd frame");
+}
+
+
+TZstdDictionary::TZstdDictionary(const string& data, int comp_level) :
+  cdict_(NULL),
+  ddict_(NULL) {
+  cdict_ = ZSTD_createCDict(data.data(), data.size(), comp_level);
+  ddict_ = ZSTD_createDDict(data.data(), data.size());
+  if (cdict_ == NULL || ddict_ == NULL) {
+    ZSTD_freeCDict(cdict_);
+    ZSTD_freeDDict(ddict_);
+    throw TTransportException(TTransportException::BAD_ARGS,
+                              "TZstdDictionary: invalid dictionary");
+  }
+}
+
+TZstdDictionary::~TZstdDictionary() {
+  ZSTD_freeCDict(cdict_);
+  ZSTD_freeDDict(ddict_);
+}
+
+
+void THttpZstdContentCoding::encode(const uint8_t* in, uint32_t len,
+                                    TMemoryBuffer& out) {
+  uint32_t bound = static_cast<uint32_t>(ZSTD_compressBound(len));
+  size_t rv = ZSTD_compress(out.getWritePtr(bound), bound, in, len,
+                            comp_level_);
+  if (ZSTD_isError(rv)) {
+    throw TZstdTransportException(rv, "ZSTD_compress");
+  }
+  out.wroteBytes(static_cast<uint32_t>(rv));
+}
+
+void THttpZstdContentCoding::decode(const uint8_t* in, uint32_t len,
+                                    TMemoryBuffer& out, uint32_t maxLen) {
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  if (dctx == NULL) {
+    throw std::bad_alloc();
+  }
+
+  ZSTD_inBuffer input = { in, len, 0 };
+  uint32_t total = 0;
+  size_t rv;
+  do {
+    const uint32_t room = 64 * 1024;
+    ZSTD_outBuffer output = { out.getWritePtr(room), room, 0 };
+    rv = ZSTD_decompressStream(dctx, &output, &input);
+    out.wroteBytes(static_cast<uint32_t>(output.pos));
+    total += static_cast<uint32_t>(output.pos);
+
+    if (ZSTD_isError(rv)) {
+      ZSTD_freeDCtx(dctx);
+      throw TZstdTransportException(rv, "ZSTD_decompressStream");
+    }
+    if (total > maxLen) {
+      ZSTD_freeDCtx(dctx);
+      throw TTransportException(TTransportException::CORRUPTED_DATA,
+                                "Decoded body too large");
+    }
+    if (rv != 0 && input.pos == input.size && output.pos < output.size) {
+      // Still inside a frame with nothing left to feed it
+      ZSTD_freeDCtx(dctx);
+      throw TTransportException(TTransportException::CORRUPTED_DATA,
+                                "Truncated zstd body");
+    }
+  } while (rv != 0 || input.pos < input.size);
+  ZSTD_freeDCtx(dctx);
+}
+
+}}} // apache::thrift::transport
@@ -0,0 +1,269 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TRANSPORT_TZSTDTRANSPORT_H_
+#define _THRIFT_TRANSPORT_TZSTDTRANSPORT_H_ 1
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <thrift/transport/THttpTransport.h>
+#include <thrift/transport/TTransport.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace apache { namespace thrift { namespace transport {
+
+class TZstdTransportException : public TTransportException {
+ public:
+  TZstdTransportException(size_t code, const char* where) :
+    TTransportException(TTransportException::INTERNAL_ERROR,
+                        errorMessage(code, where)),
+    zstd_code_(code) {}
+
+  virtual ~TZstdTransportException() throw() {}
+
+  size_t getZstdCode() { return zstd_code_; }
+
+  static std::string errorMessage(size_t code, const char* where);
+
+  size_t zstd_code_;
+};
+
+class TZstdDictionary;
+
+/**
+ * This transport uses Zstandard to compress on write and decompress on read.
+ *
+ * It behaves like TZlibTransport: flush() ends a block so the peer can
+ * decode everything written so far, and finish() ends the frame with a
+ * checksum of the content that verifyChecksum() checks on the other side.
+ *
+ * Zstandard compresses about as tightly as zlib at several times the speed.
+ * Short messages that share a lot of structure compress much better with a
+ * dictionary trained on samples of them; both ends must use the same one.
+ */
+class TZstdTransport : public TVirtualTransport<TZstdTransport> {
+ public:
+
+  /**
+   * @param transport    The transport to read compressed data from
+   *                     and write compressed data to.
+   * @param urbuf_size   Uncompressed buffer size for reading.
+   * @param crbuf_size   Compressed buffer size for reading.
+   * @param uwbuf_size   Uncompressed buffer size for writing.
+   * @param cwbuf_size   Compressed buffer size for writing.
+   * @param comp_level   Compression level (1=fast, 3=default, 19=max[slow]).
+   *                     Ignored if a dictionary is given; it has its own.
+   * @param dictionary   Dictionary to compress and decompress with, or NULL.
+   */
+  TZstdTransport(boost::shared_ptr<TTransport> transport,
+                 int urbuf_size = DEFAULT_URBUF_SIZE,
+                 int crbuf_size = DEFAULT_CRBUF_SIZE,
+                 int uwbuf_size = DEFAULT_UWBUF_SIZE,
+                 int cwbuf_size = DEFAULT_CWBUF_SIZE,
+                 int comp_level = DEFAULT_COMP_LEVEL,
+                 boost::shared_ptr<TZstdDictionary> dictionary =
+                   boost::shared_ptr<TZstdDictionary>());
+
+  /**
+   * TZstdTransport destructor.
+   *
+   * Warning: Destroying a TZstdTransport object may discard any written but
+   * unflushed data.  You must explicitly call flush() or finish() to ensure
+   * that data is actually written and flushed to the underlying transport.
+   */
+  ~TZstdTransport();
+
+  bool isOpen();
+  bool peek();
+
+  void open() {
+    transport_->open();
+  }
+
+  void close() {
+    transport_->close();
+  }
+
+  uint32_t read(uint8_t* buf, uint32_t len);
+
+  void write(const uint8_t* buf, uint32_t len);
+
+  void flush();
+
+  /**
+   * End the Zstandard frame.
+   *
+   * This writes any pending data followed by the end of the frame, including
+   * the checksum.  Once finish() has been called, no new data can be written
+   * to the stream.
+   */
+  void finish();
+
+  const uint8_t* borrow(uint8_t* buf, uint32_t* len);
+
+  void consume(uint32_t len);
+
+  /**
+   * Verify the checksum at the end of the Zstandard frame.
+   *
+   * This may only be called after all data has been read.
+   * It verifies the checksum that was written by the finish() call.
+   */
+  void verifyChecksum();
+
+  static const int DEFAULT_URBUF_SIZE = 128;
+  static const int DEFAULT_CRBUF_SIZE = 1024;
+  static const int DEFAULT_UWBUF_SIZE = 128;
+  static const int DEFAULT_CWBUF_SIZE = 1024;
+  static const int DEFAULT_COMP_LEVEL = 3;
+
+ protected:
+
+  inline void checkZstdRv(size_t rv, const char* where);
+  inline int readAvail();
+  void flushToTransport(int mode);
+  void flushToZstd(const uint8_t* buf, uint32_t len, int mode);
+  bool readFromZstd();
+
+ protected:
+  // Writes smaller than this are buffered up.
+  // Larger (or equal) writes are dumped straight to zstd.
+  static const uint32_t MIN_DIRECT_COMPRESS_SIZE = 32;
+
+  boost::shared_ptr<TTransport> transport_;
+  boost::shared_ptr<TZstdDictionary> dictionary_;
+
+  uint32_t urpos_;
+  uint32_t urend_;
+  uint32_t crpos_;
+  uint32_t crend_;
+  uint32_t uwpos_;
+  uint32_t cwpos_;
+
+  /// True iff zstd has reached the end of the frame.
+  bool input_ended_;
+  /// True iff we have finished the output stream.
+  bool output_finished_;
+  /// True iff zstd filled urbuf_ and may be holding more uncompressed data.
+  bool output_pending_;
+
+  uint32_t urbuf_size_;
+  uint32_t crbuf_size_;
+  uint32_t uwbuf_size_;
+  uint32_t cwbuf_size_;
+
+  uint8_t* urbuf_;
+  uint8_t* crbuf_;
+  uint8_t* uwbuf_;
+  uint8_t* cwbuf_;
+
+  struct ZSTD_DCtx_s* rstream_;
+  struct ZSTD_CCtx_s* wstream_;
+};
+
+/**
+ * A Zstandard dictionary, digested for compression and decompression.  It is
+ * immutable and can be shared by any number of transports.
+ *
+ * Dictionaries are trained by "zstd --train" on a set of sample messages.
+ */
+class TZstdDictionary {
+ public:
+  /**
+   * @param data         The dictionary produced by zstd --train.
+   * @param comp_level   Compression level to digest the dictionary for.
+   */
+  TZstdDictionary(const std::string& data,
+                  int comp_level = TZstdTransport::DEFAULT_COMP_LEVEL);
+
+  ~TZstdDictionary();
+
+  struct ZSTD_CDict_s* getCDict() const { return cdict_; }
+  struct ZSTD_DDict_s* getDDict() const { return ddict_; }
+
+ private:
+  TZstdDictionary(const TZstdDictionary&);
+  TZstdDictionary& operator=(const TZstdDictionary&);
+
+  struct ZSTD_CDict_s* cdict_;
+  struct ZSTD_DDict_s* ddict_;
+};
+
+/**
+ * Wraps a transport into a Zstandard compressed one.
+ *
+ */
+class TZstdTransportFactory : public TTransportFactory {
+ public:
+  TZstdTransportFactory(int comp_level = TZstdTransport::DEFAULT_COMP_LEVEL,
+                        boost::shared_ptr<TZstdDictionary> dictionary =
+                          boost::shared_ptr<TZstdDictionary>()) :
+    comp_level_(comp_level),
+    dictionary_(dictionary) {}
+
+  virtual ~TZstdTransportFactory() {}
+
+  virtual boost::shared_ptr<TTransport> getTransport(
+                                         boost::shared_ptr<TTransport> trans) {
+    return boost::shared_ptr<TTransport>(
+      new TZstdTransport(trans,
+                         TZstdTransport::DEFAULT_URBUF_SIZE,
+                         TZstdTransport::DEFAULT_CRBUF_SIZE,
+                         TZstdTransport::DEFAULT_UWBUF_SIZE,
+                         TZstdTransport::DEFAULT_CWBUF_SIZE,
+                         comp_level_,
+                         dictionary_));
+  }
+
+ private:
+  int comp_level_;
+  boost::shared_ptr<TZstdDictionary> dictionary_;
+};
+
+/**
+ * The zstd Content-Encoding, for THttpTransport.  Every call sets up a
+ * context of its own, so the object can be shared.
+ */
+class THttpZstdContentCoding : public THttpContentCoding {
+ public:
+  explicit THttpZstdContentCoding(
+      int comp_level = TZstdTransport::DEFAULT_COMP_LEVEL) :
+    comp_level_(comp_level) {}
+
+  virtual const char* getName() const {
+    return "zstd";
+  }
+
+  virtual void encode(const uint8_t* in, uint32_t len, TMemoryBuffer& out);
+
+  virtual void decode(const uint8_t* in, uint32_t len, TMemoryBuffer& out,
+                      uint32_t maxLen);
+
+ private:
+  int comp_level_;
+};
+
+}}} // apache::thrift::transport
+
+#endif // #ifndef _THRIFT_TRANSPORT_TZSTDTRANSPORT_H_
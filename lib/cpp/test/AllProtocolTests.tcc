@@ -21,6 +21,7 @@
 #define _THRIFT_TEST_GENERICPROTOCOLTEST_TCC_ 1
 
 #include <limits>
+#include <vector>
 
 #include <thrift/protocol/TBinaryProtocol.h>
 #include <thrift/transport/TBufferTransports.h>
@@ -126,6 +127,331 @@ void testMessage() {
   }
 }
 
+inline uint32_t writeRun(shared_ptr<TProtocol> p, const std::vector<int32_t>& v) {
+  return p->writeI32s(&v[0], static_cast<uint32_t>(v.size()));
+}
+inline uint32_t writeRun(shared_ptr<TProtocol> p, const std::vector<int64_t>& v) {
+  return p->writeI64s(&v[0], static_cast<uint32_t>(v.size()));
+}
+inline uint32_t writeRun(shared_ptr<TProtocol> p, const std::vector<double>& v) {
+  return p->writeDoubles(&v[0], static_cast<uint32_t>(v.size()));
+}
+inline uint32_t readRun(shared_ptr<TProtocol> p, std::vector<int32_t>& v) {
+  return p->readI32s(&v[0], static_cast<uint32_t>(v.size()));
+}
+inline uint32_t readRun(shared_ptr<TProtocol> p, std::vector<int64_t>& v) {
+  return p->readI64s(&v[0], static_cast<uint32_t>(v.size()));
+}
+inline uint32_t readRun(shared_ptr<TProtocol> p, std::vector<double>& v) {
+  return p->readDoubles(&v[0], static_cast<uint32_t>(v.size()));
+}
+
+/*
+ * A run written with one bulk call must read back one value at a time,
+ * and the other way round, both from a memory buffer (which lends its
+ * bytes) and through a small buffered transport (which mostly doesn't).
+ */
+template <typename TProto, typename Val>
+void testRun(const std::vector<Val>& vals) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  shared_ptr<TProtocol> protocol(new TProto(buffer));
+  uint32_t bulkSize = writeRun(protocol, vals);
+  std::string bulk = buffer->getBufferAsString();
+
+  uint32_t singleSize = 0;
+  for (size_t i = 0; i < vals.size(); i++) {
+    singleSize += GenericIO::write(protocol, vals[i]);
+  }
+  if (bulkSize != singleSize ||
+      buffer->getBufferAsString() != bulk + bulk) {
+    snprintf(errorMessage, ERR_LEN, "Invalid run written (type: %s)", ClassNames::getName<Val>());
+    throw TException(errorMessage);
+  }
+
+  std::vector<Val> out(vals.size());
+  for (size_t i = 0; i < out.size(); i++) {
+    GenericIO::read(protocol, out[i]);
+  }
+  std::vector<Val> out2(vals.size());
+  shared_ptr<TBufferedTransport> buffered(new TBufferedTransport(buffer, 29));
+  shared_ptr<TProtocol> bufferedProtocol(new TProto(buffered));
+  if (readRun(bufferedProtocol, out2) != bulkSize || out != vals || out2 != vals) {
+    snprintf(errorMessage, ERR_LEN, "Invalid run read (type: %s)", ClassNames::getName<Val>());
+    throw TException(errorMessage);
+  }
+}
+
+template <typename TProto>
+void testRuns() {
+  std::vector<int32_t> i32s;
+  std::vector<int64_t> i64s;
+  std::vector<double> doubles;
+  for (int i = 0; i < 1000; i++) {
+    i32s.push_back(i % 7 == 0 ? (i << 20) : i % 100 - 50);
+    i64s.push_back(i % 5 == 0 ? -(int64_t(i) << 40) : i);
+    doubles.push_back(i * 0.25 - 100);
+  }
+  i32s.push_back(std::numeric_limits<int32_t>::min());
+  i64s.push_back(std::numeric_limits<int64_t>::max());
+  doubles.push_back(std::numeric_limits<double>::infinity());
+
+  testRun<TProto>(i32s);
+  testRun<TProto>(i64s);
+  testRun<TProto>(doubles);
+}
+
+/**
+ * Writes a struct holding one of every kind of value, for skip() to step
+ * over.
+ */
+uint32_t writeSkipStruct(shared_ptr<TProtocol> protocol) {
+  uint32_t wsize = 0;
+  wsize += protocol->writeStructBegin("Skip");
+  wsize += protocol->writeFieldBegin("bool", T_BOOL, 1);
+  wsize += protocol->writeBool(true);
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("i16", T_I16, 2);
+  wsize += protocol->writeI16(-300);
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("i64", T_I64, 40);
+  wsize += protocol->writeI64(std::numeric_limits<int64_t>::min());
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("double", T_DOUBLE, 41);
+  wsize += protocol->writeDouble(1.5);
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("string", T_STRING, 42);
+  wsize += protocol->writeString(std::string(100, 's'));
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("i64s", T_LIST, 43);
+  wsize += protocol->writeListBegin(T_I64, 200);
+  for (int64_t i = 0; i < 200; i++) {
+    wsize += protocol->writeI64(i * i * i * (i % 2 ? -1 : 1));
+  }
+  wsize += protocol->writeListEnd();
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("doubles", T_LIST, 44);
+  wsize += protocol->writeListBegin(T_DOUBLE, 50);
+  for (int i = 0; i < 50; i++) {
+    wsize += protocol->writeDouble(i / 3.0);
+  }
+  wsize += protocol->writeListEnd();
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("strings", T_SET, 45);
+  wsize += protocol->writeSetBegin(T_STRING, 20);
+  for (int i = 0; i < 20; i++) {
+    wsize += protocol->writeString(std::string(i, 'x'));
+  }
+  wsize += protocol->writeSetEnd();
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("bools", T_MAP, 46);
+  wsize += protocol->writeMapBegin(T_BYTE, T_BOOL, 30);
+  for (int i = 0; i < 30; i++) {
+    wsize += protocol->writeByte((int8_t)i);
+    wsize += protocol->writeBool(i % 2 == 0);
+  }
+  wsize += protocol->writeMapEnd();
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("empty", T_MAP, 47);
+  wsize += protocol->writeMapBegin(T_STRING, T_I32, 0);
+  wsize += protocol->writeMapEnd();
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("nested", T_STRUCT, 48);
+  wsize += protocol->writeStructBegin("Nested");
+  wsize += protocol->writeFieldBegin("bool", T_BOOL, 1);
+  wsize += protocol->writeBool(false);
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldBegin("i32", T_I32, 2);
+  wsize += protocol->writeI32(-1);
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldStop();
+  wsize += protocol->writeStructEnd();
+  wsize += protocol->writeFieldEnd();
+  wsize += protocol->writeFieldStop();
+  wsize += protocol->writeStructEnd();
+  return wsize;
+}
+
+/**
+ * The protocol's own skip() must step over exactly what the generic one
+ * does, from a memory buffer and through a small buffered transport.
+ */
+template <typename TProto>
+void testSkip() {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  shared_ptr<TProtocol> protocol(new TProto(buffer));
+  uint32_t wsize = 0;
+  for (int i = 0; i < 3; i++) {
+    wsize = writeSkipStruct(protocol);
+    protocol->writeI32(12345);
+  }
+
+  uint32_t generic = ::apache::thrift::protocol::skip(*protocol, T_STRUCT);
+  int32_t sentinel = 0;
+  protocol->readI32(sentinel);
+  bool ok = generic == wsize && sentinel == 12345;
+
+  uint32_t own = protocol->skip(T_STRUCT);
+  sentinel = 0;
+  protocol->readI32(sentinel);
+  ok = ok && own == wsize && sentinel == 12345;
+
+  shared_ptr<TBufferedTransport> buffered(new TBufferedTransport(buffer, 29));
+  shared_ptr<TProtocol> bufferedProtocol(new TProto(buffered));
+  own = bufferedProtocol->skip(T_STRUCT);
+  sentinel = 0;
+  bufferedProtocol->readI32(sentinel);
+  ok = ok && own == wsize && sentinel == 12345;
+
+  if (!ok) {
+    throw TException("Invalid skip");
+  }
+}
+
+/**
+ * writeFieldHeader() must write what writeFieldBegin() does, whether the
+ * protocol is called directly, as generated templates do, or through
+ * TProtocol.
+ */
+template <typename TProto>
+void testFieldHeader() {
+  shared_ptr<TMemoryBuffer> expected(new TMemoryBuffer());
+  shared_ptr<TMemoryBuffer> direct(new TMemoryBuffer());
+  shared_ptr<TMemoryBuffer> virt(new TMemoryBuffer());
+  TProto expectedProtocol(expected);
+  TProto directProtocol(direct);
+  shared_ptr<TProtocol> virtProtocol(new TProto(virt));
+
+  expectedProtocol.writeStructBegin("Header");
+  expectedProtocol.writeFieldBegin("i32", T_I32, 15);
+  expectedProtocol.writeI32(7);
+  expectedProtocol.writeFieldBegin("list", T_LIST, 300);
+  expectedProtocol.writeListBegin(T_BYTE, 0);
+  expectedProtocol.writeListEnd();
+  expectedProtocol.writeFieldBegin("implicit", T_STRING, -1);
+  expectedProtocol.writeString(std::string("x"));
+  expectedProtocol.writeFieldStop();
+  expectedProtocol.writeStructEnd();
+
+  uint32_t directSize = 0;
+  directSize += directProtocol.writeStructBegin("Header");
+  directSize += directProtocol.writeFieldHeader("i32", T_I32, 15, "\x08\x00\x0f");
+  directSize += directProtocol.writeI32(7);
+  directSize += directProtocol.writeFieldHeader("list", T_LIST, 300, "\x0f\x01\x2c");
+  directSize += directProtocol.writeListBegin(T_BYTE, 0);
+  directSize += directProtocol.writeListEnd();
+  directSize += directProtocol.writeFieldHeader("implicit", T_STRING, -1, "\x0b\xff\xff");
+  directSize += directProtocol.writeString(std::string("x"));
+  directSize += directProtocol.writeFieldStop();
+  directSize += directProtocol.writeStructEnd();
+
+  virtProtocol->writeStructBegin("Header");
+  virtProtocol->writeFieldHeader("i32", T_I32, 15, "\x08\x00\x0f");
+  virtProtocol->writeI32(7);
+  virtProtocol->writeFieldHeader("list", T_LIST, 300, "\x0f\x01\x2c");
+  virtProtocol->writeListBegin(T_BYTE, 0);
+  virtProtocol->writeListEnd();
+  virtProtocol->writeFieldHeader("implicit", T_STRING, -1, "\x0b\xff\xff");
+  virtProtocol->writeString(std::string("x"));
+  virtProtocol->writeFieldStop();
+  virtProtocol->writeStructEnd();
+
+  std::string bytes = expected->getBufferAsString();
+  if (direct->getBufferAsString() != bytes || virt->getBufferAsString() != bytes ||
+      directSize != bytes.size()) {
+    throw TException("Invalid field header");
+  }
+}
+
+/**
+ * Writes a call whose argument struct holds a list nested depth deep,
+ * around a list of written i64s that claims count of them.
+ */
+template <typename TProto>
+void writeLimitsMessage(shared_ptr<TProtocol> protocol, int depth, uint32_t count,
+                        uint32_t written) {
+  protocol->writeMessageBegin("limits", T_CALL, 1);
+  protocol->writeStructBegin("args");
+  protocol->writeFieldBegin("nested", T_LIST, 1);
+  for (int i = 0; i < depth; i++) {
+    protocol->writeListBegin(T_LIST, 1);
+  }
+  protocol->writeListBegin(T_I64, count);
+  for (uint32_t i = 0; i < written; i++) {
+    protocol->writeI64(i);
+  }
+  for (int i = 0; i <= depth; i++) {
+    protocol->writeListEnd();
+  }
+  protocol->writeFieldEnd();
+  protocol->writeFieldStop();
+  protocol->writeStructEnd();
+  protocol->writeMessageEnd();
+}
+
+template <typename TProto>
+TProtocolException::TProtocolExceptionType readLimitsMessage(shared_ptr<TProtocol> protocol) {
+  std::string name;
+  TMessageType type;
+  int32_t seqid;
+  try {
+    protocol->readMessageBegin(name, type, seqid);
+    protocol->skip(T_STRUCT);
+    protocol->readMessageEnd();
+  } catch (TProtocolException& e) {
+    return e.getType();
+  }
+  return TProtocolException::UNKNOWN;
+}
+
+/**
+ * Nesting past the recursion limit, and sizes claiming more than the
+ * message size limit, are refused before the data behind them is read.
+ * Both limits start afresh with each message.
+ */
+template <typename TProto>
+void testLimits() {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  shared_ptr<TProtocol> protocol(new TProto(buffer));
+  bool ok = true;
+
+  protocol->setRecursionLimit(10);
+  for (int i = 0; i < 3; i++) {
+    writeLimitsMessage<TProto>(protocol, 7, 0, 0);
+  }
+  for (int i = 0; i < 3; i++) {
+    ok = ok && readLimitsMessage<TProto>(protocol) == TProtocolException::UNKNOWN;
+  }
+  writeLimitsMessage<TProto>(protocol, 9, 0, 0);
+  ok = ok && readLimitsMessage<TProto>(protocol) == TProtocolException::DEPTH_LIMIT;
+
+  buffer->resetBuffer();
+  protocol->setRecursionLimit(0);
+  protocol->setMessageSizeLimit(1000);
+  for (int i = 0; i < 3; i++) {
+    writeLimitsMessage<TProto>(protocol, 0, 100, 100);
+  }
+  for (int i = 0; i < 3; i++) {
+    ok = ok && readLimitsMessage<TProto>(protocol) == TProtocolException::UNKNOWN;
+  }
+  writeLimitsMessage<TProto>(protocol, 0, 1000000000, 0);
+  ok = ok && readLimitsMessage<TProto>(protocol) == TProtocolException::SIZE_LIMIT;
+
+  buffer->resetBuffer();
+  protocol->writeMessageBegin("limits", T_CALL, 1);
+  protocol->writeStructBegin("args");
+  protocol->writeFieldBegin("blob", T_STRING, 1);
+  protocol->writeString(std::string(2000, 'x'));
+  protocol->writeFieldEnd();
+  protocol->writeFieldStop();
+  protocol->writeStructEnd();
+  protocol->writeMessageEnd();
+  ok = ok && readLimitsMessage<TProto>(protocol) == TProtocolException::SIZE_LIMIT;
+
+  if (!ok) {
+    throw TException("Invalid limits");
+  }
+}
+
 template <typename TProto>
 void testProtocol(const char* protoname) {
   try {
@@ -217,6 +543,14 @@ void testProtocol(const char* protoname) {
 
     testMessage<TProto>();
 
+    testRuns<TProto>();
+
+    testSkip<TProto>();
+
+    testFieldHeader<TProto>();
+
+    testLimits<TProto>();
+
     printf("%s => OK\n", protoname);
   } catch (TException e) {
     snprintf(errorMessage, ERR_LEN, "%s => Test FAILED: %s", protoname, e.what());
@@ -0,0 +1,66 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <cstdlib>
+#include <thrift/TAllocTracking.h>
+
+#include "AllocInterposer.h"
+
+using apache::thrift::TAllocTracking;
+
+#ifdef __GLIBC__
+
+// glibc's own, which dlsym(RTLD_NEXT) would find too but, needing calloc
+// itself, not from inside calloc
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+  TAllocTracking::record(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  TAllocTracking::record(count * size);
+  return __libc_calloc(count, size);
+}
+
+// A realloc that grows a buffer is counted like any other allocation,
+// whether or not it had to copy
+void* realloc(void* ptr, size_t size) {
+  if (size != 0) {
+    TAllocTracking::record(size);
+  }
+  return __libc_realloc(ptr, size);
+}
+}
+
+bool allocInterposerInstalled() {
+  return true;
+}
+
+#else
+
+bool allocInterposerInstalled() {
+  return false;
+}
+
+#endif
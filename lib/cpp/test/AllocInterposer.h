@@ -0,0 +1,35 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TEST_ALLOCINTERPOSER_H_
+#define _THRIFT_TEST_ALLOCINTERPOSER_H_ 1
+
+/**
+ * Linked into a program, replaces malloc, calloc and realloc with ones
+ * that count every allocation in TAllocTracking before handing it to
+ * glibc's, as realloc_test in test/cpp/realloc does for realloc.  Every
+ * operator new goes through malloc, so all of them are counted.
+ *
+ * Call this once from main: it keeps the linker from leaving the
+ * replacements out, and says whether there are any, there being none
+ * but on glibc.
+ */
+bool allocInterposerInstalled();
+
+#endif // #ifndef _THRIFT_TEST_ALLOCINTERPOSER_H_
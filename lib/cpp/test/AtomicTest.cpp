@@ -0,0 +1,217 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Built into UnitTests on the compiler's own branch of Atomic.h, and into
+// AtomicInterlockedTest on the branch MSVC builds use
+
+#if defined(THRIFT_ATOMIC_INTERLOCKED) && !defined(_MSC_VER)
+#include "InterlockedShim.h"
+#endif
+
+#include <boost/test/auto_unit_test.hpp>
+#include <thrift/concurrency/Atomic.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/transport/PlatformSocket.h>
+
+BOOST_AUTO_TEST_SUITE( AtomicTest )
+
+using apache::thrift::concurrency::ATOMIC_ACQUIRE;
+using apache::thrift::concurrency::ATOMIC_RELAXED;
+using apache::thrift::concurrency::ATOMIC_RELEASE;
+using apache::thrift::concurrency::ATOMIC_SEQ_CST;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::atomicAdd;
+using apache::thrift::concurrency::atomicCompareAndSwap;
+using apache::thrift::concurrency::atomicExchange;
+using apache::thrift::concurrency::atomicFence;
+using apache::thrift::concurrency::atomicLoad;
+using apache::thrift::concurrency::atomicStore;
+using apache::thrift::concurrency::cpuRelax;
+using boost::shared_ptr;
+
+// Every operation on one type, from one thread, with values that need
+// all of its bits
+template <typename T>
+static void checkOperations(T small, T large) {
+  volatile T value = 0;
+  atomicStore<ATOMIC_RELAXED>(&value, large);
+  BOOST_CHECK(atomicLoad<ATOMIC_RELAXED>(&value) == large);
+  atomicStore<ATOMIC_RELEASE>(&value, small);
+  BOOST_CHECK(atomicLoad<ATOMIC_ACQUIRE>(&value) == small);
+  atomicStore<ATOMIC_SEQ_CST>(&value, large);
+  BOOST_CHECK(atomicLoad<ATOMIC_SEQ_CST>(&value) == large);
+
+  // Adding returns the sum, and wraps as the type does
+  BOOST_CHECK(atomicAdd(&value, small) == static_cast<T>(large + small));
+  BOOST_CHECK(atomicAdd(&value, static_cast<T>(-small)) == large);
+  atomicStore<ATOMIC_RELAXED>(&value, static_cast<T>(-1));
+  BOOST_CHECK(atomicAdd(&value, 1) == 0);
+
+  // Exchanging returns what was there
+  BOOST_CHECK(atomicExchange(&value, large) == 0);
+  BOOST_CHECK(atomicExchange(&value, small) == large);
+
+  BOOST_CHECK(!atomicCompareAndSwap(&value, large, 0));
+  BOOST_CHECK(atomicLoad<ATOMIC_RELAXED>(&value) == small);
+  BOOST_CHECK(atomicCompareAndSwap(&value, small, large));
+  BOOST_CHECK(atomicLoad<ATOMIC_RELAXED>(&value) == large);
+
+  atomicFence();
+  cpuRelax();
+}
+
+BOOST_AUTO_TEST_CASE( test_operations ) {
+  checkOperations<int32_t>(7, 0x7ffffff0);
+  checkOperations<uint32_t>(7, 0xfffffff0u);
+  checkOperations<int64_t>(7, 0x7ffffffffffffff0LL);
+  checkOperations<uint64_t>(7, 0xfffffffffffffff0ULL);
+}
+
+BOOST_AUTO_TEST_CASE( test_pointers ) {
+  int a = 0;
+  int b = 0;
+  void* volatile p = NULL;
+  atomicStore<ATOMIC_RELEASE>(&p, &a);
+  BOOST_CHECK(atomicLoad<ATOMIC_ACQUIRE>(&p) == &a);
+  BOOST_CHECK(atomicExchange(&p, &b) == &a);
+  BOOST_CHECK(!atomicCompareAndSwap(&p, &a, NULL));
+  BOOST_CHECK(atomicCompareAndSwap(&p, &b, NULL));
+  BOOST_CHECK(atomicLoad<ATOMIC_RELAXED>(&p) == NULL);
+}
+
+const int ITERATIONS = 20000;
+const int THREADS = 4;
+
+// Waits a little in a spin loop, giving up the processor now and then for
+// the thread being waited on, which may need it
+static void backOff(unsigned& spins) {
+  if (++spins % 64 != 0) {
+    cpuRelax();
+  } else {
+    THRIFT_SLEEP_USEC(1);
+  }
+}
+
+// Adds to the shared counts in each of the ways there are to
+class Adder : public Runnable {
+ public:
+  struct Counts {
+    volatile int64_t added;
+    volatile uint32_t swapped;
+    volatile int32_t lock;
+    // Only touched under lock
+    int64_t locked;
+  };
+
+  explicit Adder(Counts* counts) : counts_(counts) {}
+
+  void run() {
+    for (int i = 0; i < ITERATIONS; ++i) {
+      atomicAdd(&counts_->added, 1);
+
+      uint32_t seen = atomicLoad<ATOMIC_RELAXED>(&counts_->swapped);
+      while (!atomicCompareAndSwap(&counts_->swapped, seen, seen + 1)) {
+        seen = atomicLoad<ATOMIC_RELAXED>(&counts_->swapped);
+      }
+
+      unsigned spins = 0;
+      while (atomicExchange(&counts_->lock, 1) != 0) {
+        backOff(spins);
+      }
+      ++counts_->locked;
+      atomicStore<ATOMIC_RELEASE>(&counts_->lock, 0);
+    }
+  }
+
+ private:
+  Counts* counts_;
+};
+
+BOOST_AUTO_TEST_CASE( test_threads ) {
+  Adder::Counts counts = { 0, 0, 0, 0 };
+
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  shared_ptr<Thread> threads[THREADS];
+  for (int i = 0; i < THREADS; ++i) {
+    threads[i] = factory.newThread(shared_ptr<Runnable>(new Adder(&counts)));
+    threads[i]->start();
+  }
+  for (int i = 0; i < THREADS; ++i) {
+    threads[i]->join();
+  }
+
+  BOOST_CHECK_EQUAL(counts.added, THREADS * ITERATIONS);
+  BOOST_CHECK_EQUAL(counts.swapped, static_cast<uint32_t>(THREADS * ITERATIONS));
+  BOOST_CHECK_EQUAL(counts.locked, THREADS * ITERATIONS);
+}
+
+// A value handed from one thread to another through a flag, as the
+// work-stealing queues and the shared memory rings do
+class Handoff : public Runnable {
+ public:
+  Handoff() : ready_(0), value_(0), mismatches_(0) {}
+
+  void run() {
+    for (int64_t i = 1; i <= ITERATIONS; ++i) {
+      unsigned spins = 0;
+      while (atomicLoad<ATOMIC_ACQUIRE>(&ready_) != 0) {
+        backOff(spins);
+      }
+      value_ = i;
+      atomicStore<ATOMIC_RELEASE>(&ready_, i);
+    }
+  }
+
+  void consume() {
+    for (int64_t i = 1; i <= ITERATIONS; ++i) {
+      int64_t ready;
+      unsigned spins = 0;
+      while ((ready = atomicLoad<ATOMIC_ACQUIRE>(&ready_)) == 0) {
+        backOff(spins);
+      }
+      if (ready != i || value_ != i) {
+        ++mismatches_;
+      }
+      atomicStore<ATOMIC_RELEASE>(&ready_, 0);
+    }
+  }
+
+  int mismatches() const { return mismatches_; }
+
+ private:
+  volatile int64_t ready_;
+  int64_t value_;
+  int mismatches_;
+};
+
+BOOST_AUTO_TEST_CASE( test_handoff ) {
+  shared_ptr<Handoff> handoff(new Handoff);
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  shared_ptr<Thread> producer = factory.newThread(handoff);
+  producer->start();
+  handoff->consume();
+  producer->join();
+  BOOST_CHECK_EQUAL(handoff->mismatches(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
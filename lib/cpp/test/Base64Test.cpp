@@ -18,10 +18,16 @@
  */
 
 #include <boost/test/auto_unit_test.hpp>
+#include <cstdlib>
+#include <vector>
 #include <thrift/protocol/TBase64Utils.h>
 
 using apache::thrift::protocol::base64_encode;
 using apache::thrift::protocol::base64_decode;
+using apache::thrift::protocol::base64_encode_buffer;
+using apache::thrift::protocol::base64_decode_buffer;
+using apache::thrift::protocol::base64_encoded_size;
+using apache::thrift::protocol::base64_decoded_size;
 
 BOOST_AUTO_TEST_SUITE( Base64Test )
 
@@ -68,4 +74,78 @@ BOOST_AUTO_TEST_CASE( test_Base64_Encode_Decode ) {
   }
 }
 
+// What encoding or decoding a piece at a time gives
+std::vector<uint8_t> encodeByPieces(const std::vector<uint8_t>& in) {
+  std::vector<uint8_t> out;
+  for (size_t i = 0; i < in.size(); i += 3) {
+    uint32_t n = static_cast<uint32_t>(std::min<size_t>(3, in.size() - i));
+    uint8_t b[4];
+    base64_encode(&in[i], n, b);
+    out.insert(out.end(), b, b + n + 1);
+  }
+  return out;
+}
+
+std::vector<uint8_t> decodeByPieces(const std::vector<uint8_t>& in) {
+  std::vector<uint8_t> out;
+  for (size_t i = 0; i + 1 < in.size(); i += 4) {
+    uint32_t n = static_cast<uint32_t>(std::min<size_t>(4, in.size() - i));
+    uint8_t b[4];
+    memcpy(b, &in[i], n);
+    base64_decode(b, n);
+    out.insert(out.end(), b, b + n - 1);
+  }
+  return out;
+}
+
+BOOST_AUTO_TEST_CASE( test_Base64_Buffer ) {
+  std::srand(42);
+  // Every length around the block sizes, and one long run
+  std::vector<uint32_t> lengths;
+  for (uint32_t len = 0; len < 300; ++len) {
+    lengths.push_back(len);
+  }
+  lengths.push_back(100000);
+
+  for (size_t t = 0; t < lengths.size(); ++t) {
+    std::vector<uint8_t> data(lengths[t]);
+    for (size_t i = 0; i < data.size(); ++i) {
+      data[i] = static_cast<uint8_t>(std::rand());
+    }
+    std::vector<uint8_t> expected = encodeByPieces(data);
+    BOOST_REQUIRE_EQUAL(base64_encoded_size(lengths[t]), expected.size());
+    std::vector<uint8_t> encoded(expected.size() + 1);
+    base64_encode_buffer(data.empty() ? NULL : &data[0], lengths[t], &encoded[0]);
+    encoded.pop_back();
+    BOOST_REQUIRE(encoded == expected);
+
+    std::vector<uint8_t> decoded(base64_decoded_size(lengths[t] / 3 * 4 + 4) + 1);
+    uint32_t n = base64_decode_buffer(encoded.empty() ? NULL : &encoded[0],
+                                      static_cast<uint32_t>(encoded.size()), &decoded[0]);
+    BOOST_REQUIRE_EQUAL(n, lengths[t]);
+    decoded.resize(n);
+    BOOST_REQUIRE(decoded == data);
+  }
+
+  // Characters outside the alphabet come out the same as one piece at a time
+  std::vector<uint8_t> text(200);
+  for (size_t i = 0; i < text.size(); ++i) {
+    text[i] = static_cast<uint8_t>('A' + i % 26);
+  }
+  const uint8_t strays[] = { '=', '-', 0x80, 0xff, 0 };
+  for (size_t s = 0; s < sizeof(strays); ++s) {
+    for (size_t at = 0; at < text.size(); at += 37) {
+      std::vector<uint8_t> bad(text);
+      bad[at] = strays[s];
+      for (uint32_t len = 150; len <= bad.size(); len += 25) {
+        std::vector<uint8_t> in(bad.begin(), bad.begin() + len);
+        std::vector<uint8_t> expected = decodeByPieces(in);
+        std::vector<uint8_t> decoded(expected.size());
+        BOOST_REQUIRE_EQUAL(base64_decode_buffer(&in[0], len, &decoded[0]), expected.size());
+        BOOST_REQUIRE(decoded == expected);
+      }
+    }
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -17,47 +17,315 @@
  * under the License.
  */
 
+// Times writing and reading a few shapes of struct, each as the arguments
+// of a call, with every protocol over every transport:
+//
+//   Benchmark [--min-time=SECONDS] [--alloc-baseline=FILE] [FILTER]
+//
+// Each case runs for at least min-time seconds (0.2 by default), and only
+// the cases whose name, shape/protocol/transport/op, contains FILTER run.
+// Results are printed one JSON object a line, with the time, the bytes on
+// the wire and the allocations for each call, in all and by what made
+// them (see TAllocTracking).
+//
+// Given the output of an earlier run as a baseline, a case that makes more
+// allocations a call than it did is reported, and the exit status is 1.
+
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
-#include <iostream>
 #include <cmath>
-#include "thrift/transport/TBufferTransports.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include "thrift/TAllocTracking.h"
+#include "thrift/concurrency/Util.h"
 #include "thrift/protocol/TBinaryProtocol.h"
+#include "thrift/protocol/TCompactProtocol.h"
+#include "thrift/protocol/THeaderProtocol.h"
+#include "thrift/protocol/TJSONProtocol.h"
+#include "thrift/transport/TBufferTransports.h"
+#include "thrift/transport/THeaderTransport.h"
 #include "gen-cpp/DebugProtoTest_types.h"
-#include <time.h>
-#ifdef HAVE_SYS_TIME_H
-#include <sys/time.h>
+#ifdef ORDERED_READ
+#include "gen-cpp-ordered/ManyOptionals_types.h"
+#else
+#include "gen-cpp/ManyOptionals_types.h"
 #endif
+#include "AllocInterposer.h"
+
+using boost::shared_ptr;
+using apache::thrift::TAllocScope;
+using apache::thrift::TAllocTracking;
+using apache::thrift::concurrency::Util;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace thrift::test::debug;
+
+enum Protocol { BINARY, COMPACT, JSON };
+enum Transport { MEMORY, BUFFERED, FRAMED, HEADER };
+
+static const char* const protocolNames[] = { "binary", "compact", "json" };
+static const char* const transportNames[] = { "memory", "buffered", "framed", "header" };
+
+static const int64_t NS_PER_S = 1000000000LL;
+
+static double minTime = 0.2;
+static const char* filter = NULL;
+
+// Allocations a call made by each case in the baseline, and the cases that
+// make more now
+static std::map<std::string, double> baseline;
+static int regressions = 0;
+
+// A protocol over a transport, over a memory buffer at the bottom
+struct Stack {
+  shared_ptr<TMemoryBuffer> buffer;
+  shared_ptr<TProtocol> protocol;
+};
+
+static Stack makeStack(Protocol protocol, Transport transport) {
+  Stack stack;
+  stack.buffer.reset(new TMemoryBuffer());
+  if (transport == HEADER) {
+    static const uint16_t ids[] = {
+      THeaderTransport::T_BINARY_PROTOCOL,
+      THeaderTransport::T_COMPACT_PROTOCOL,
+      THeaderTransport::T_JSON_PROTOCOL
+    };
+    shared_ptr<THeaderTransport> header(new THeaderTransport(stack.buffer));
+    stack.protocol.reset(new THeaderProtocol(header, ids[protocol]));
+    return stack;
+  }
+
+  shared_ptr<TTransport> trans;
+  switch (transport) {
+  case BUFFERED:
+    trans.reset(new TBufferedTransport(stack.buffer));
+    break;
+  case FRAMED:
+    trans.reset(new TFramedTransport(stack.buffer));
+    break;
+  default:
+    trans = stack.buffer;
+    break;
+  }
+  switch (protocol) {
+  case COMPACT:
+    stack.protocol.reset(new TCompactProtocol(trans));
+    break;
+  case JSON:
+    stack.protocol.reset(new TJSONProtocol(trans));
+    break;
+  default:
+    stack.protocol.reset(new TBinaryProtocol(trans));
+    break;
+  }
+  return stack;
+}
+
+template <class Struct>
+static void writeCall(TProtocol& protocol, const Struct& args) {
+  protocol.writeMessageBegin("call", T_CALL, 1);
+  args.write(&protocol);
+  protocol.writeMessageEnd();
+  protocol.getTransport()->writeEnd();
+  protocol.getTransport()->flush();
+}
+
+template <class Struct>
+static void readCall(TProtocol& protocol, Struct& args) {
+  std::string name;
+  TMessageType type;
+  int32_t seqid;
+  protocol.readMessageBegin(name, type, seqid);
+  args.read(&protocol);
+  protocol.readMessageEnd();
+  protocol.getTransport()->readEnd();
+}
+
+static bool selected(const std::string& name) {
+  return filter == NULL || name.find(filter) != std::string::npos;
+}
+
+/**
+ * Runs op, doubling the count until a run takes minTime, and prints the
+ * last run's figures.
+ */
+template <class Op>
+static void measure(const std::string& name, Op& op, uint32_t bytes) {
+  op();
+  int64_t ticks = 0;
+  TAllocTracking::Counts before;
+  TAllocTracking::Counts after;
+  uint64_t count = 1;
+  for (;; count *= 2) {
+    TAllocTracking::getCounts(before);
+    int64_t start = Util::currentTimeTicks(NS_PER_S);
+    for (uint64_t i = 0; i < count; ++i) {
+      op();
+    }
+    ticks = Util::currentTimeTicks(NS_PER_S) - start;
+    TAllocTracking::getCounts(after);
+    if (ticks >= minTime * NS_PER_S || count >= (1ULL << 32)) {
+      break;
+    }
+  }
 
-class Timer {
-public:
-  timeval vStart;
+  std::string shape(name, 0, name.find('/'));
+  std::string rest(name, shape.size() + 1);
+  std::string protocol(rest, 0, rest.find('/'));
+  rest.erase(0, protocol.size() + 1);
+  std::string transport(rest, 0, rest.find('/'));
+  std::string what(rest, transport.size() + 1);
+  printf("{\"case\":\"%s\",\"shape\":\"%s\",\"protocol\":\"%s\",\"transport\":\"%s\","
+         "\"op\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.1f,\"bytes_per_op\":%u",
+         name.c_str(), shape.c_str(), protocol.c_str(), transport.c_str(), what.c_str(),
+         static_cast<unsigned long long>(count),
+         static_cast<double>(ticks) / count,
+         bytes);
+  if (TAllocTracking::active()) {
+    double allocs =
+      static_cast<double>(after.totalAllocations() - before.totalAllocations()) / count;
+    printf(",\"allocs_per_op\":%.2f,\"alloc_bytes_per_op\":%.1f", allocs,
+           static_cast<double>(after.totalBytes() - before.totalBytes()) / count);
+    for (int c = 0; c < TAllocTracking::NUM_CATEGORIES; ++c) {
+      printf(",\"allocs_%s\":%.2f",
+             TAllocTracking::name(static_cast<TAllocTracking::Category>(c)),
+             static_cast<double>(after.allocations[c] - before.allocations[c]) / count);
+    }
 
-  Timer() {
-    gettimeofday(&vStart, 0);
+    std::map<std::string, double>::const_iterator it = baseline.find(name);
+    if (it != baseline.end() && allocs > it->second + 0.005) {
+      std::cerr << name << ": " << allocs << " allocations a call, up from "
+                << it->second << std::endl;
+      ++regressions;
+    }
   }
-  void start() {
-    gettimeofday(&vStart, 0);
+  printf("}\n");
+  fflush(stdout);
+}
+
+template <class Struct>
+class WriteOp {
+ public:
+  WriteOp(const Stack& stack, const Struct& args) : stack_(stack), args_(args) {}
+
+  void operator()() {
+    stack_.buffer->resetBuffer();
+    writeCall(*stack_.protocol, args_);
   }
 
-  double frame() {
-    timeval vEnd;
-    gettimeofday(&vEnd, 0);
-    double dstart = vStart.tv_sec + ((double)vStart.tv_usec / 1000000.0);
-    double dend = vEnd.tv_sec + ((double)vEnd.tv_usec / 1000000.0);
-    return dend - dstart;
+ private:
+  Stack stack_;
+  const Struct& args_;
+};
+
+// Reads into a new struct each time, as a processor does
+template <class Struct>
+class ReadOp {
+ public:
+  ReadOp(const Stack& stack, const std::string& data) : stack_(stack), data_(data) {}
+
+  void operator()() {
+    stack_.buffer->resetBuffer(
+      reinterpret_cast<uint8_t*>(const_cast<char*>(data_.data())),
+      static_cast<uint32_t>(data_.size()));
+    TAllocScope scope(TAllocTracking::STRUCT);
+    Struct args;
+    readCall(*stack_.protocol, args);
   }
 
+ private:
+  Stack stack_;
+  const std::string& data_;
 };
 
-int main() {
-  using namespace std;
-  using namespace thrift::test::debug;
-  using namespace apache::thrift::transport;
-  using namespace apache::thrift::protocol;
-  using namespace boost;
+template <class Struct>
+static void benchmarkShape(const char* shape, const Struct& args) {
+  for (int p = BINARY; p <= JSON; ++p) {
+    for (int t = MEMORY; t <= HEADER; ++t) {
+      std::string prefix = std::string(shape) + "/" + protocolNames[p] + "/"
+        + transportNames[t] + "/";
+      if (!selected(prefix + "write") && !selected(prefix + "read")) {
+        continue;
+      }
 
+      Stack writer = makeStack(static_cast<Protocol>(p), static_cast<Transport>(t));
+      writeCall(*writer.protocol, args);
+      std::string data = writer.buffer->getBufferAsString();
+      uint32_t bytes = static_cast<uint32_t>(data.size());
+
+      if (selected(prefix + "write")) {
+        WriteOp<Struct> op(writer, args);
+        measure(prefix + "write", op, bytes);
+      }
+      if (selected(prefix + "read")) {
+        ReadOp<Struct> op(makeStack(static_cast<Protocol>(p), static_cast<Transport>(t)),
+                          data);
+        measure(prefix + "read", op, bytes);
+      }
+    }
+  }
+}
+
+// Writes Opt80 field by field, in id order or the reverse
+static void writeOpt80(TProtocol& prot, bool reversed) {
+  prot.writeStructBegin("Opt80");
+  for (int16_t i = 1; i <= 80; ++i) {
+    int16_t id = reversed ? 81 - i : i;
+    prot.writeFieldBegin("", T_I32, id);
+    prot.writeI32(id);
+    prot.writeFieldEnd();
+  }
+  prot.writeFieldStop();
+  prot.writeStructEnd();
+}
+
+// The struct alone, with TBinaryProtocolT<TBufferBase>, which calls the
+// memory buffer without going through virtual functions
+template <class Struct>
+class BufferBaseReadOp {
+ public:
+  BufferBaseReadOp(const std::string& data)
+    : buffer_(new TMemoryBuffer()), protocol_(buffer_), data_(data) {}
+
+  void operator()() {
+    buffer_->resetBuffer(reinterpret_cast<uint8_t*>(const_cast<char*>(data_.data())),
+                         static_cast<uint32_t>(data_.size()));
+    TAllocScope scope(TAllocTracking::STRUCT);
+    Struct args;
+    args.read(&protocol_);
+  }
+
+ private:
+  shared_ptr<TMemoryBuffer> buffer_;
+  TBinaryProtocolT<TBufferBase> protocol_;
+  const std::string& data_;
+};
+
+template <class Struct>
+class BufferBaseWriteOp {
+ public:
+  BufferBaseWriteOp(const Struct& args)
+    : buffer_(new TMemoryBuffer()), protocol_(buffer_), args_(args) {}
+
+  void operator()() {
+    buffer_->resetBuffer();
+    args_.write(&protocol_);
+  }
+
+ private:
+  shared_ptr<TMemoryBuffer> buffer_;
+  TBinaryProtocolT<TBufferBase> protocol_;
+  const Struct& args_;
+};
+
+static OneOfEach makeOneOfEach() {
   OneOfEach ooe;
   ooe.im_true   = true;
   ooe.im_false  = false;
@@ -69,43 +337,145 @@ int main() {
   ooe.some_characters  = "JSON THIS! \"\1";
   ooe.zomg_unicode     = "\xd7\n\a\t";
   ooe.base64 = "\1\2\3\255";
+  return ooe;
+}
 
-  boost::shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+// Reads the case and allocs_per_op of each line of an earlier run's output
+static bool readBaseline(const char* path) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t name = line.find("\"case\":\"");
+    size_t allocs = line.find("\"allocs_per_op\":");
+    if (name == std::string::npos || allocs == std::string::npos) {
+      continue;
+    }
+    name += 8;
+    baseline[line.substr(name, line.find('"', name) - name)] = atof(line.c_str() + allocs + 16);
+  }
+  return true;
+}
 
-  int num = 1000000;
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--min-time=", 11) == 0) {
+      minTime = atof(argv[i] + 11);
+    } else if (strncmp(argv[i], "--alloc-baseline=", 17) == 0) {
+      if (!readBaseline(argv[i] + 17)) {
+        std::cerr << "Can't read " << argv[i] + 17 << std::endl;
+        return 1;
+      }
+    } else if (argv[i][0] == '-') {
+      std::cerr << "usage: " << argv[0]
+                << " [--min-time=SECONDS] [--alloc-baseline=FILE] [FILTER]" << std::endl;
+      return 1;
+    } else {
+      filter = argv[i];
+    }
+  }
 
-  {
-    Timer timer;
+  if (!allocInterposerInstalled()) {
+    std::cerr << "Allocations are not counted on this platform" << std::endl;
+  }
 
-    for (int i = 0; i < num; i ++) {
-      buf->resetBuffer();
-      TBinaryProtocolT<TBufferBase> prot(buf);
-      ooe.write(&prot);
+  // A struct of scalars and short strings
+  OneOfEach ooe = makeOneOfEach();
+
+  // Lists, sets and maps of structs and strings
+  HolyMoley hm;
+  for (int i = 0; i < 8; ++i) {
+    hm.big.push_back(ooe);
+    hm.big.back().integer32 = i;
+  }
+  for (int i = 0; i < 4; ++i) {
+    std::vector<std::string> strings;
+    for (int j = 0; j <= i; ++j) {
+      strings.push_back(std::string("string ") + static_cast<char>('a' + j));
+    }
+    hm.contain.insert(strings);
+  }
+  for (int i = 0; i < 4; ++i) {
+    std::vector<Bonk>& bonks = hm.bonks[std::string("key ") + static_cast<char>('a' + i)];
+    for (int j = 0; j < 3; ++j) {
+      Bonk bonk;
+      bonk.type = j;
+      bonk.message = "a message of middling length";
+      bonks.push_back(bonk);
     }
-    cout << "Write: " << num / (1000 * timer.frame()) << " kHz" << endl;
   }
 
-  uint8_t* data;
-  uint32_t datasize;
+  // A long run of numbers
+  RandomStuff rs;
+  rs.a = 1;
+  rs.b = 2;
+  rs.c = 3;
+  rs.d = 4;
+  for (int32_t i = 0; i < 1000; ++i) {
+    rs.myintlist.push_back(i * 1000);
+  }
+  rs.bigint = 1LL << 40;
+  rs.triple = 3.5;
 
-  buf->getBuffer(&data, &datasize);
+  // One big binary blob
+  Base64 blob;
+  blob.a = 1;
+  blob.b1.assign(256 * 1024, '\xab');
 
+  // Eighty optional fields, all set
+  Opt80 opt;
+  std::string inOrder;
+  std::string reversed;
   {
+    shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+    TBinaryProtocol prot(buf);
+    writeOpt80(prot, true);
+    reversed = buf->getBufferAsString();
+    buf->resetBuffer();
+    writeOpt80(prot, false);
+    inOrder = buf->getBufferAsString();
+    opt.read(&prot);
+  }
 
-    Timer timer;
-
-    for (int i = 0; i < num; i ++) {
-      OneOfEach ooe2;
-      boost::shared_ptr<TMemoryBuffer> buf2(new TMemoryBuffer(data, datasize));
-      //buf2->resetBuffer(data, datasize);
-      TBinaryProtocolT<TBufferBase> prot(buf2);
-      ooe2.read(&prot);
+  benchmarkShape("scalars", ooe);
+  benchmarkShape("containers", hm);
+  benchmarkShape("int_list", rs);
+  benchmarkShape("large_binary", blob);
+  benchmarkShape("optionals", opt);
 
-      //cout << apache::thrift::ThriftDebugString(ooe2) << endl << endl;
-    }
-    cout << " Read: " << num / (1000 * timer.frame()) << " kHz" << endl;
+  // The fast path, and the wide struct's fields arriving in the order they
+  // are written and then backwards, which readers generated with
+  // ordered_read (the OrderedBenchmark build) handle through their
+  // fallback switch
+  std::string ooeData;
+  {
+    shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+    TBinaryProtocol prot(buf);
+    ooe.write(&prot);
+    ooeData = buf->getBufferAsString();
+  }
+  if (selected("scalars/binary_bufferbase/memory/write")) {
+    BufferBaseWriteOp<OneOfEach> op(ooe);
+    measure("scalars/binary_bufferbase/memory/write", op,
+            static_cast<uint32_t>(ooeData.size()));
+  }
+  if (selected("scalars/binary_bufferbase/memory/read")) {
+    BufferBaseReadOp<OneOfEach> op(ooeData);
+    measure("scalars/binary_bufferbase/memory/read", op,
+            static_cast<uint32_t>(ooeData.size()));
+  }
+  if (selected("optionals/binary_bufferbase/memory/read")) {
+    BufferBaseReadOp<Opt80> op(inOrder);
+    measure("optionals/binary_bufferbase/memory/read", op,
+            static_cast<uint32_t>(inOrder.size()));
+  }
+  if (selected("optionals_reversed/binary_bufferbase/memory/read")) {
+    BufferBaseReadOp<Opt80> op(reversed);
+    measure("optionals_reversed/binary_bufferbase/memory/read", op,
+            static_cast<uint32_t>(reversed.size()));
   }
 
-
-  return 0;
+  return regressions > 0 ? 1 : 0;
 }
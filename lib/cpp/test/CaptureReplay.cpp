@@ -0,0 +1,96 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Sends the calls a TCaptureProcessor logged to a framed server:
+//
+//   CaptureReplay <log> <host> <port> [speed] [connections] [binary|compact]
+//
+// speed is how many times faster than captured to go, 0 for flat out.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thrift/processor/TCaptureProcessor.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TFileTransport.h>
+#include <thrift/transport/TSocket.h>
+
+using boost::shared_ptr;
+using apache::thrift::TException;
+using apache::thrift::processor::TCaptureReplayer;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TCompactProtocolFactory;
+using apache::thrift::protocol::TProtocolFactory;
+using apache::thrift::transport::TFileTransport;
+using apache::thrift::transport::TFramedTransport;
+using apache::thrift::transport::TSocket;
+using apache::thrift::transport::TTransport;
+
+static std::string host;
+static int port;
+
+static shared_ptr<TTransport> openConnection() {
+  shared_ptr<TTransport> transport(new TFramedTransport(
+    shared_ptr<TTransport>(new TSocket(host, port))));
+  transport->open();
+  return transport;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    std::cerr << "usage: " << argv[0]
+              << " <log> <host> <port> [speed] [connections] [binary|compact]" << std::endl;
+    return 1;
+  }
+  host = argv[2];
+  port = atoi(argv[3]);
+  double speed = argc > 4 ? atof(argv[4]) : 1.0;
+  uint32_t connections = argc > 5 ? static_cast<uint32_t>(atoi(argv[5])) : 1;
+  shared_ptr<TProtocolFactory> protocolFactory;
+  if (argc > 6 && strcmp(argv[6], "compact") == 0) {
+    protocolFactory.reset(new TCompactProtocolFactory());
+  } else {
+    protocolFactory.reset(new TBinaryProtocolFactory());
+  }
+
+  try {
+    shared_ptr<TFileTransport> log(new TFileTransport(argv[1], true));
+    TCaptureReplayer replayer(log, openConnection, protocolFactory);
+    replayer.setSpeed(speed);
+    replayer.setConnections(connections);
+    TCaptureReplayer::Result result = replayer.replay();
+
+    printf("sent %llu, failed %llu, late %llu in %.3f s\n",
+           static_cast<unsigned long long>(result.sent),
+           static_cast<unsigned long long>(result.failed),
+           static_cast<unsigned long long>(result.late),
+           result.elapsedUsec / 1e6);
+    printf("latency us: p50 %lld, p99 %lld, max %lld\n",
+           static_cast<long long>(result.p50Usec),
+           static_cast<long long>(result.p99Usec),
+           static_cast<long long>(result.maxUsec));
+  } catch (const TException& e) {
+    std::cerr << "CaptureReplay: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Round trips ThriftTest and DebugProtoTest structs generated with the
+// options of the program this is built into; see Makefile.am.  The code
+// only uses what every option generates, so it compiles against each,
+// apart from the tests of an option's own additions, which the program
+// asks for with GEN_OPTIONS_CPP11 or GEN_OPTIONS_REUSE.
+
+#include <boost/test/auto_unit_test.hpp>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/protocol/TDebugProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "ThriftTest_types.h"
+#include "DebugProtoTest_types.h"
+#include "ThriftTest_constants.h"
+#include "DebugProtoTest_constants.h"
+
+namespace thrift { namespace test {
+
+bool Insanity::operator<(const Insanity& other) const {
+  using apache::thrift::ThriftDebugString;
+  return ThriftDebugString(*this) < ThriftDebugString(other);
+}
+
+namespace debug {
+
+bool Empty::operator<(const Empty&) const {
+  return false;
+}
+
+}}}
+
+BOOST_AUTO_TEST_SUITE( GenOptionsTest )
+
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+using thrift::test::Insanity;
+using thrift::test::Numberz;
+using thrift::test::Xtruct;
+using thrift::test::debug::Bonk;
+using thrift::test::debug::CompactProtoTestStruct;
+using thrift::test::debug::HolyMoley;
+using thrift::test::debug::OneOfEach;
+using thrift::test::debug::SomeEnum;
+using thrift::test::debug::g_DebugProtoTest_constants;
+using thrift::test::g_ThriftTest_constants;
+
+// Writes in and reads it back into out.  Strings read as views point
+// into buffer, so it has to outlive out.
+template <typename Protocol, typename T>
+static void roundTrip(const T& in, T& out, const shared_ptr<TMemoryBuffer>& buffer) {
+  Protocol protocol(buffer);
+  in.write(&protocol);
+  out.read(&protocol);
+  BOOST_CHECK_EQUAL(buffer->available_read(), 0u);
+}
+
+template <typename Set>
+static void insertList(Set& set, const char* a, const char* b) {
+  typename Set::value_type list;
+  list.push_back(a);
+  list.push_back(b);
+  set.insert(list);
+}
+
+static Xtruct makeXtruct(int i) {
+  Xtruct x;
+  x.__set_string_thing("thing");
+  x.__set_byte_thing(static_cast<int8_t>(i));
+  x.__set_i32_thing(i * 1000);
+  x.__set_i64_thing(i * 1000000000LL);
+  return x;
+}
+
+static Insanity makeInsanity(int xtructs) {
+  Insanity insanity;
+  insanity.userMap[Numberz::FIVE] = 5;
+  insanity.userMap[Numberz::EIGHT] = 8;
+  for (int i = 1; i <= xtructs; ++i) {
+    insanity.xtructs.push_back(makeXtruct(i));
+  }
+  return insanity;
+}
+
+// A HolyMoley with n of everything
+static HolyMoley makeHolyMoley(int n) {
+  OneOfEach ooe;
+  ooe.im_true = true;
+  ooe.im_false = false;
+  ooe.integer32 = 1 << 30;
+  ooe.double_precision = 3.25;
+  ooe.some_characters = "Debug THIS!";
+  ooe.zomg_unicode = "\xd7\n\a\t";
+  ooe.base64 = "binary\0data";
+  ooe.byte_list.clear();
+  ooe.i64_list.clear();
+  for (int i = 0; i < n; ++i) {
+    ooe.byte_list.push_back(static_cast<int8_t>(i));
+    ooe.i64_list.push_back(i * 1000000007LL);
+  }
+
+  HolyMoley holyMoley;
+  static const char* const words[] = { "and a one", "and a two", "then a one, two", "three!" };
+  for (int i = 0; i < n; ++i) {
+    holyMoley.big.push_back(i % 2 == 0 ? ooe : OneOfEach());
+    insertList(holyMoley.contain, words[i % 4], words[(i + 1) % 4]);
+    Bonk bonk;
+    bonk.type = i;
+    bonk.message = "Wait.";
+    holyMoley.bonks[words[i % 4]].push_back(bonk);
+  }
+  return holyMoley;
+}
+
+BOOST_AUTO_TEST_CASE( test_thrift_test ) {
+  Insanity in = makeInsanity(2);
+
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  Insanity out;
+  roundTrip<TBinaryProtocol>(in, out, buffer);
+  BOOST_CHECK(out == in);
+  BOOST_CHECK_EQUAL(out.userMap.size(), 2u);
+  BOOST_CHECK_EQUAL(out.xtructs[1].i64_thing, 2000000000LL);
+
+  // Assigning and copying whole structs, which the setters do too
+  Insanity copy(out);
+  copy = in;
+  BOOST_CHECK(copy == out);
+}
+
+BOOST_AUTO_TEST_CASE( test_debug_proto_test ) {
+  OneOfEach ooe;
+  ooe.im_true = true;
+  ooe.im_false = false;
+  ooe.integer32 = 1 << 30;
+  ooe.double_precision = 3.25;
+  ooe.some_characters = "Debug THIS!";
+  ooe.zomg_unicode = "\xd7\n\a\t";
+  ooe.base64 = "binary\0data";
+  ooe.byte_list.push_back(4);
+
+  HolyMoley in;
+  in.big.push_back(ooe);
+  in.big.push_back(OneOfEach());
+  insertList(in.contain, "and a one", "and a two");
+  insertList(in.contain, "then a one, two", "three!");
+  Bonk bonk;
+  bonk.type = 1;
+  bonk.message = "Wait.";
+  in.bonks["two"].push_back(bonk);
+  in.bonks["two"].push_back(bonk);
+  in.bonks["none"];
+
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  HolyMoley out;
+  roundTrip<TBinaryProtocol>(in, out, buffer);
+  BOOST_CHECK(out == in);
+  BOOST_CHECK_EQUAL(out.contain.size(), 2u);
+  BOOST_CHECK_EQUAL(out.bonks.size(), 2u);
+  BOOST_CHECK_EQUAL(out.big[0].byte_list.size(), 4u);
+}
+
+BOOST_AUTO_TEST_CASE( test_compact_protocol ) {
+  Insanity insanity = makeInsanity(3);
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  Insanity insanityOut;
+  roundTrip<TCompactProtocol>(insanity, insanityOut, buffer);
+  BOOST_CHECK(insanityOut == insanity);
+
+  HolyMoley holyMoley = makeHolyMoley(5);
+  shared_ptr<TMemoryBuffer> holyBuffer(new TMemoryBuffer);
+  HolyMoley holyOut;
+  roundTrip<TCompactProtocol>(holyMoley, holyOut, holyBuffer);
+  BOOST_CHECK(holyOut == holyMoley);
+}
+
+BOOST_AUTO_TEST_CASE( test_constants ) {
+  // Constants fill in maps and sets of whatever kind the options choose
+  BOOST_CHECK_EQUAL(g_ThriftTest_constants.myNumberz, Numberz::ONE);
+  BOOST_CHECK_EQUAL(g_DebugProtoTest_constants.MY_ENUM_MAP.size(), 1u);
+  BOOST_CHECK_EQUAL(g_DebugProtoTest_constants.MY_ENUM_MAP.find(SomeEnum::ONE)->second,
+                    SomeEnum::TWO);
+
+  const CompactProtoTestStruct& in = g_DebugProtoTest_constants.COMPACT_TEST;
+  BOOST_CHECK_EQUAL(in.i16_byte_map.size(), 3u);
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  CompactProtoTestStruct out;
+  roundTrip<TCompactProtocol>(in, out, buffer);
+  BOOST_CHECK(out == in);
+}
+
+BOOST_AUTO_TEST_CASE( test_large_containers ) {
+  // Enough elements that containers sized one at a time would grow many
+  // times
+  HolyMoley in = makeHolyMoley(2000);
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  HolyMoley out;
+  roundTrip<TBinaryProtocol>(in, out, buffer);
+  BOOST_CHECK(out == in);
+  BOOST_CHECK_EQUAL(out.big.size(), 2000u);
+  BOOST_CHECK_EQUAL(out.big[0].i64_list.size(), 2000u);
+  BOOST_CHECK_EQUAL(out.contain.size(), 4u);
+  BOOST_CHECK_EQUAL(out.bonks["three!"].size(), 500u);
+}
+
+BOOST_AUTO_TEST_CASE( test_read_again ) {
+  // Each read leaves just what it read, whether the reader clears a
+  // container first or reads over the elements already there
+  HolyMoley big = makeHolyMoley(7);
+  HolyMoley small = makeHolyMoley(2);
+  HolyMoley bigger = makeHolyMoley(9);
+  shared_ptr<TMemoryBuffer> buffers[3];
+  for (int i = 0; i < 3; ++i) {
+    buffers[i].reset(new TMemoryBuffer);
+  }
+
+  HolyMoley out;
+  roundTrip<TBinaryProtocol>(big, out, buffers[0]);
+  BOOST_CHECK(out == big);
+  roundTrip<TBinaryProtocol>(small, out, buffers[1]);
+  BOOST_CHECK(out == small);
+  roundTrip<TBinaryProtocol>(bigger, out, buffers[2]);
+  BOOST_CHECK(out == bigger);
+
+  Insanity insanity = makeInsanity(5);
+  Insanity fewer = makeInsanity(1);
+  fewer.userMap.erase(Numberz::EIGHT);
+  shared_ptr<TMemoryBuffer> insanityBuffers[2];
+  insanityBuffers[0].reset(new TMemoryBuffer);
+  insanityBuffers[1].reset(new TMemoryBuffer);
+  Insanity insanityOut;
+  roundTrip<TBinaryProtocol>(insanity, insanityOut, insanityBuffers[0]);
+  roundTrip<TBinaryProtocol>(fewer, insanityOut, insanityBuffers[1]);
+  BOOST_CHECK(insanityOut == fewer);
+}
+
+#ifdef GEN_OPTIONS_CPP11
+BOOST_AUTO_TEST_CASE( test_move ) {
+  HolyMoley in = makeHolyMoley(3);
+  HolyMoley copy(in);
+  HolyMoley moved(std::move(copy));
+  BOOST_CHECK(moved == in);
+  HolyMoley assigned;
+  assigned = std::move(moved);
+  BOOST_CHECK(assigned == in);
+
+  Xtruct x;
+  std::string thing(1000, 'x');
+  x.__set_string_thing(std::move(thing));
+  BOOST_CHECK_EQUAL(x.string_thing.size(), 1000u);
+}
+#endif
+
+#ifdef GEN_OPTIONS_REUSE
+BOOST_AUTO_TEST_CASE( test_clear ) {
+  HolyMoley in = makeHolyMoley(3);
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  HolyMoley out;
+  roundTrip<TBinaryProtocol>(in, out, buffer);
+  out.__clear();
+  BOOST_CHECK(out == HolyMoley());
+
+  // Fields the input leaves out are reset, not kept
+  OneOfEach ooe = in.big[0];
+  OneOfEach sparse;
+  sparse.some_characters = "sparse";
+  shared_ptr<TMemoryBuffer> sparseBuffer(new TMemoryBuffer);
+  TBinaryProtocol protocol(sparseBuffer);
+  protocol.writeStructBegin("OneOfEach");
+  protocol.writeFieldBegin("some_characters", apache::thrift::protocol::T_STRING, 8);
+  protocol.writeString(std::string("sparse"));
+  protocol.writeFieldEnd();
+  protocol.writeFieldStop();
+  protocol.writeStructEnd();
+  ooe.read(&protocol);
+  BOOST_CHECK(ooe == sparse);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
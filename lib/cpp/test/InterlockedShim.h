@@ -0,0 +1,67 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _THRIFT_TEST_INTERLOCKEDSHIM_H_
+#define _THRIFT_TEST_INTERLOCKEDSHIM_H_ 1
+
+// The parts of <windows.h> that the Interlocked branch of Atomic.h uses,
+// with the same signatures and semantics, so that GCC builds can run that
+// branch; see AtomicInterlockedTest in Makefile.am
+
+#include <stdint.h>
+
+typedef int32_t LONG;
+typedef int64_t LONGLONG;
+
+inline LONG InterlockedCompareExchange(volatile LONG* p, LONG exchange, LONG comparand) {
+  __atomic_compare_exchange_n(p, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return comparand;
+}
+
+inline LONG InterlockedExchange(volatile LONG* p, LONG value) {
+  return __atomic_exchange_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedExchangeAdd(volatile LONG* p, LONG value) {
+  return __atomic_fetch_add(p, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG* p,
+                                             LONGLONG exchange,
+                                             LONGLONG comparand) {
+  __atomic_compare_exchange_n(p, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return comparand;
+}
+
+inline LONGLONG InterlockedExchange64(volatile LONGLONG* p, LONGLONG value) {
+  return __atomic_exchange_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONGLONG InterlockedExchangeAdd64(volatile LONGLONG* p, LONGLONG value) {
+  return __atomic_fetch_add(p, value, __ATOMIC_SEQ_CST);
+}
+
+inline void MemoryBarrier() {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+inline void YieldProcessor() {
+}
+
+#endif // #ifndef _THRIFT_TEST_INTERLOCKEDSHIM_H_
@@ -0,0 +1,37 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// TLazyTest.cpp's structs: Inner has every kind of value the raw readers
+// have to find the end of
+
+namespace cpp apache.thrift.test.lazy
+
+struct Inner {
+  1: bool flag
+  2: i32 number
+  20: string name
+  21: list<i64> longs
+  22: list<bool> bools
+  23: map<i16, string> names
+}
+
+struct Outer {
+  1: i32 id
+  2: Inner inner (cpp.lazy = "")
+}
@@ -0,0 +1,143 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include <thrift/concurrency/ShardedCounters.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+
+BOOST_AUTO_TEST_SUITE( ShardedCountersTest )
+
+using apache::thrift::concurrency::ShardedCounters;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using boost::shared_ptr;
+
+BOOST_AUTO_TEST_CASE( test_single_thread ) {
+  ShardedCounters counters;
+  BOOST_CHECK_EQUAL(counters.get("a"), 0);
+  BOOST_CHECK_EQUAL(counters.increment("a"), 1);
+  BOOST_CHECK_EQUAL(counters.increment("a", 4), 5);
+  counters.increment("b", -2);
+  BOOST_CHECK_EQUAL(counters.get("a"), 5);
+  BOOST_CHECK_EQUAL(counters.get("b"), -2);
+
+  // Setting a counter makes up for what the threads have added
+  counters.set("a", 100);
+  BOOST_CHECK_EQUAL(counters.get("a"), 100);
+  counters.increment("a");
+  BOOST_CHECK_EQUAL(counters.get("a"), 101);
+  counters.set("c", 7);
+
+  std::map<std::string, int64_t> all;
+  counters.getAll(all);
+  BOOST_CHECK_EQUAL(all.size(), 3u);
+  BOOST_CHECK_EQUAL(all["a"], 101);
+  BOOST_CHECK_EQUAL(all["b"], -2);
+  BOOST_CHECK_EQUAL(all["c"], 7);
+}
+
+class Adder : public Runnable {
+ public:
+  Adder(ShardedCounters* counters) : counters_(counters) {}
+
+  void run() {
+    for (int i = 0; i < 10000; ++i) {
+      counters_->increment("calls");
+      counters_->increment(i % 2 ? "odd" : "even", i);
+    }
+  }
+
+ private:
+  ShardedCounters* counters_;
+};
+
+BOOST_AUTO_TEST_CASE( test_threads ) {
+  ShardedCounters counters;
+  counters.increment("calls");
+
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  shared_ptr<Thread> threads[4];
+  for (int i = 0; i < 4; ++i) {
+    threads[i] = factory.newThread(shared_ptr<Runnable>(new Adder(&counters)));
+    threads[i]->start();
+  }
+  for (int i = 0; i < 4; ++i) {
+    threads[i]->join();
+  }
+
+  BOOST_CHECK_EQUAL(counters.get("calls"), 40001);
+  BOOST_CHECK_EQUAL(counters.get("even"), 4 * 24995000);
+  BOOST_CHECK_EQUAL(counters.get("odd"), 4 * 25000000);
+}
+
+class RowAdder : public Runnable {
+ public:
+  RowAdder(ShardedCounters* counters) : counters_(counters) {}
+
+  void run() {
+    int64_t* row = counters_->slots("histogram", 20);
+    for (int i = 0; i < 10000; ++i) {
+      ShardedCounters::add(&row[i % 20], 1);
+      ShardedCounters::add(&row[19], i);
+    }
+  }
+
+ private:
+  ShardedCounters* counters_;
+};
+
+BOOST_AUTO_TEST_CASE( test_rows ) {
+  ShardedCounters counters;
+  int64_t* row = counters.slots("histogram", 20);
+  BOOST_CHECK(counters.slots("histogram", 20) == row);
+  ShardedCounters::add(&row[0], 3);
+  counters.increment("calls");
+
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  shared_ptr<Thread> threads[4];
+  for (int i = 0; i < 4; ++i) {
+    threads[i] = factory.newThread(shared_ptr<Runnable>(new RowAdder(&counters)));
+    threads[i]->start();
+  }
+  for (int i = 0; i < 4; ++i) {
+    threads[i]->join();
+  }
+
+  std::map<std::string, std::vector<int64_t> > rows;
+  counters.getRows(rows);
+  BOOST_REQUIRE_EQUAL(rows.size(), 2u);
+  BOOST_REQUIRE_EQUAL(rows["calls"].size(), 1u);
+  BOOST_CHECK_EQUAL(rows["calls"][0], 1);
+  const std::vector<int64_t>& histogram = rows["histogram"];
+  BOOST_REQUIRE_EQUAL(histogram.size(), 20u);
+  BOOST_CHECK_EQUAL(histogram[0], 3 + 4 * 500);
+  for (size_t i = 1; i < 19; ++i) {
+    BOOST_CHECK_EQUAL(histogram[i], 4 * 500);
+  }
+  BOOST_CHECK_EQUAL(histogram[19], 4 * (500 + 49995000));
+  BOOST_CHECK_EQUAL(counters.get("histogram"), 3 + 4 * 500);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,147 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thrift/transport/TAdaptiveFramedTransport.h>
+
+BOOST_AUTO_TEST_SUITE( TAdaptiveFramedTransportTest )
+
+using boost::shared_ptr;
+using apache::thrift::transport::TAdaptiveFramedTransport;
+using apache::thrift::transport::TFramedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
+
+static std::string compressibleData(uint32_t len) {
+  std::string data;
+  while (data.size() < len) {
+    data += "struct Work { 1: i32 num1, 2: i32 num2, 3: Operation op } ";
+  }
+  data.resize(len);
+  return data;
+}
+
+static std::string randomData(uint32_t len) {
+  std::string data(len, '\0');
+  srand(1);
+  for (uint32_t i = 0; i < len; ++i) {
+    data[i] = static_cast<char>(rand());
+  }
+  return data;
+}
+
+static void writeFrame(TFramedTransport& trans, const std::string& data) {
+  trans.write((const uint8_t*)data.data(), data.size());
+  trans.flush();
+}
+
+static std::string readFrame(TFramedTransport& trans, uint32_t len) {
+  std::string data(len, '\0');
+  trans.readAll((uint8_t*)&data[0], len);
+  return data;
+}
+
+static bool compressedOnWire(TMemoryBuffer& wire) {
+  uint8_t first = 0;
+  uint32_t len = 1;
+  const uint8_t* p = wire.borrow(&first, &len);
+  return p != NULL && (p[0] & 0x80) != 0;
+}
+
+BOOST_AUTO_TEST_CASE( test_small_frames_plain ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  TAdaptiveFramedTransport writer(wire);
+  TFramedTransport reader(wire);
+
+  std::string data = compressibleData(100);
+  writeFrame(writer, data);
+  BOOST_CHECK(!compressedOnWire(*wire));
+  BOOST_CHECK_EQUAL(wire->available_read(), data.size() + 4);
+  BOOST_CHECK_EQUAL(readFrame(reader, data.size()), data);
+}
+
+BOOST_AUTO_TEST_CASE( test_large_frames_compressed ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  TAdaptiveFramedTransport writer(wire);
+  TAdaptiveFramedTransport reader(wire);
+
+  std::string data = compressibleData(100000);
+  for (int i = 0; i < 3; ++i) {
+    writeFrame(writer, data);
+    BOOST_CHECK(compressedOnWire(*wire));
+    uint32_t wireSize = wire->available_read();
+    BOOST_CHECK_LT(wireSize, data.size() / 10);
+    BOOST_CHECK_EQUAL(readFrame(reader, data.size()), data);
+    BOOST_CHECK_EQUAL(reader.readEnd(), wireSize);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_incompressible_frames_plain ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  std::string data = randomData(100000);
+
+  // Skipped by the entropy estimate, or after deflate didn't help
+  for (int check = 0; check < 2; ++check) {
+    TAdaptiveFramedTransport writer(wire, 0, check != 0);
+    TFramedTransport reader(wire);
+    writeFrame(writer, data);
+    BOOST_CHECK(!compressedOnWire(*wire));
+    BOOST_CHECK_EQUAL(readFrame(reader, data.size()), data);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_interoperates_uncompressed ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  std::string data = compressibleData(100000);
+
+  TAdaptiveFramedTransport writer(wire, TAdaptiveFramedTransport::NEVER_COMPRESS);
+  TFramedTransport reader(wire);
+  writeFrame(writer, data);
+  BOOST_CHECK_EQUAL(readFrame(reader, data.size()), data);
+
+  TFramedTransport plainWriter(wire);
+  TAdaptiveFramedTransport adaptiveReader(wire);
+  writeFrame(plainWriter, data);
+  BOOST_CHECK_EQUAL(readFrame(adaptiveReader, data.size()), data);
+}
+
+BOOST_AUTO_TEST_CASE( test_corrupted_frame ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  TAdaptiveFramedTransport writer(wire);
+  writeFrame(writer, compressibleData(100000));
+
+  std::string frame = wire->getBufferAsString();
+  frame[frame.size() - 1]++;
+  wire->resetBuffer();
+  wire->write((const uint8_t*)frame.data(), frame.size());
+
+  TAdaptiveFramedTransport reader(wire);
+  uint8_t buf[16];
+  try {
+    reader.read(buf, sizeof(buf));
+    BOOST_ERROR("corrupted frame was read");
+  } catch (TTransportException& ex) {
+    BOOST_CHECK_EQUAL(ex.getType(), TTransportException::CORRUPTED_DATA);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
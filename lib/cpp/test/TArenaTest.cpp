@@ -0,0 +1,171 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <thrift/TArena.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TArenaTest )
+
+using apache::thrift::TArena;
+using apache::thrift::TArenaAllocator;
+using apache::thrift::TArenaScope;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+// The container types the arena option generates
+typedef std::vector<int32_t, TArenaAllocator<int32_t> > IntList;
+typedef std::set<std::string, std::less<std::string>, TArenaAllocator<std::string> > StringSet;
+typedef std::map<int32_t, IntList, std::less<int32_t>,
+                 TArenaAllocator<std::pair<const int32_t, IntList> > > ListMap;
+
+BOOST_AUTO_TEST_CASE( test_allocate ) {
+  TArena arena(4096);
+  char* a = static_cast<char*>(arena.allocate(1));
+  char* b = static_cast<char*>(arena.allocate(24));
+  BOOST_CHECK_EQUAL(reinterpret_cast<size_t>(a) % TArena::ALIGNMENT, 0u);
+  BOOST_CHECK_EQUAL(reinterpret_cast<size_t>(b) % TArena::ALIGNMENT, 0u);
+  BOOST_CHECK_EQUAL(b - a, static_cast<ptrdiff_t>(TArena::ALIGNMENT));
+  BOOST_CHECK_EQUAL(arena.getBytesUsed(), 48u);
+  BOOST_CHECK_EQUAL(arena.getBytesReserved(), 4096u);
+
+  // Big requests get their own block, and the current one keeps filling
+  arena.allocate(10000);
+  char* c = static_cast<char*>(arena.allocate(16));
+  BOOST_CHECK_EQUAL(c - b, 32);
+  BOOST_CHECK_EQUAL(arena.getBytesReserved(), 4096u + 10000u);
+
+  for (int i = 0; i < 1000; ++i) {
+    arena.allocate(100);
+  }
+  BOOST_CHECK(arena.getBytesReserved() > 100000u);
+
+  // Release keeps just the first block, and starts again at its beginning
+  arena.release();
+  BOOST_CHECK_EQUAL(arena.getBytesUsed(), 0u);
+  BOOST_CHECK_EQUAL(arena.getBytesReserved(), 4096u);
+  BOOST_CHECK(arena.allocate(8) == a);
+}
+
+BOOST_AUTO_TEST_CASE( test_scope ) {
+  BOOST_CHECK(TArena::current() == NULL);
+  TArena outer;
+  TArena inner;
+  {
+    TArenaScope outerScope(outer);
+    BOOST_CHECK(TArena::current() == &outer);
+    {
+      TArenaScope innerScope(inner);
+      BOOST_CHECK(TArena::current() == &inner);
+    }
+    BOOST_CHECK(TArena::current() == &outer);
+  }
+  BOOST_CHECK(TArena::current() == NULL);
+}
+
+BOOST_AUTO_TEST_CASE( test_containers ) {
+  TArena arena;
+  {
+    TArenaScope scope(arena);
+
+    ListMap map;
+    StringSet set;
+    for (int32_t i = 0; i < 100; ++i) {
+      map[i].push_back(i);
+      map[i].push_back(-i);
+      set.insert(std::string(100, static_cast<char>('a' + i % 26)));
+    }
+    BOOST_CHECK(map.get_allocator().arena() == &arena);
+    BOOST_CHECK(map[7].get_allocator().arena() == &arena);
+    BOOST_CHECK_EQUAL(map[7][1], -7);
+    BOOST_CHECK_EQUAL(set.size(), 26u);
+    BOOST_CHECK(arena.getBytesUsed() > 0);
+  }
+  BOOST_CHECK(TArena::current() == NULL);
+  arena.release();
+}
+
+BOOST_AUTO_TEST_CASE( test_copy_leaves_arena ) {
+  IntList list;
+#if __cplusplus >= 201103L
+  ListMap map;
+#endif
+  {
+    TArena arena;
+    IntList inArena((TArenaAllocator<int32_t>(&arena)));
+    inArena.push_back(42);
+    // Assignment keeps the destination's allocator
+    list = inArena;
+    BOOST_CHECK(list.get_allocator().arena() == NULL);
+#if __cplusplus >= 201103L
+    // And the copies it makes of nested containers take the current one
+    ListMap mapInArena((TArenaAllocator<std::pair<const int32_t, IntList> >(&arena)));
+    {
+      TArenaScope scope(arena);
+      mapInArena[1].push_back(42);
+    }
+    map = mapInArena;
+    BOOST_CHECK(map[1].get_allocator().arena() == NULL);
+#endif
+  }
+  // The arena is gone; the copies are not
+  BOOST_CHECK_EQUAL(list[0], 42);
+#if __cplusplus >= 201103L
+  BOOST_CHECK_EQUAL(map[1][0], 42);
+#endif
+}
+
+BOOST_AUTO_TEST_CASE( test_heap_without_arena ) {
+  IntList list;
+  BOOST_CHECK(list.get_allocator().arena() == NULL);
+  for (int32_t i = 0; i < 1000; ++i) {
+    list.push_back(i);
+  }
+  BOOST_CHECK_EQUAL(list[999], 999);
+}
+
+BOOST_AUTO_TEST_CASE( test_read_into_arena ) {
+  // Generated readers resize and fill the list in place, unchanged
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TBinaryProtocol proto(buf);
+  std::vector<int32_t> values;
+  for (int32_t i = 0; i < 500; ++i) {
+    values.push_back(i * 7);
+  }
+  proto.writeI32s(&values[0], static_cast<uint32_t>(values.size()));
+
+  TArena arena;
+  {
+    TArenaScope scope(arena);
+    IntList list;
+    list.resize(values.size());
+    proto.readI32s(&list[0], static_cast<uint32_t>(list.size()));
+    BOOST_CHECK(std::equal(list.begin(), list.end(), values.begin()));
+    BOOST_CHECK(arena.getBytesUsed() >= values.size() * sizeof(int32_t));
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
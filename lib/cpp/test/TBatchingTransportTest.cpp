@@ -0,0 +1,147 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBatchingTransport.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TBatchingTransportTest )
+
+using boost::shared_ptr;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::T_ONEWAY;
+using apache::thrift::transport::TBatchingTransport;
+using apache::thrift::transport::TFramedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+
+static void sendLog(TBinaryProtocol& protocol, int32_t seqid) {
+  protocol.writeMessageBegin("log", T_ONEWAY, seqid);
+  protocol.writeStructBegin("log_args");
+  protocol.writeFieldStop();
+  protocol.writeStructEnd();
+  protocol.writeMessageEnd();
+  protocol.getTransport()->writeEnd();
+  protocol.getTransport()->flush();
+}
+
+// The number of messages in each frame sent, reading them all
+static std::vector<int> readFrames(shared_ptr<TMemoryBuffer> wire) {
+  std::vector<int> frames;
+  while (wire->available_read() > 0) {
+    uint8_t size[4];
+    wire->read(size, 4);
+    uint32_t left = (size[0] << 24) | (size[1] << 16) | (size[2] << 8) | size[3];
+    std::string frame = wire->readAsString(left);
+    shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+    buffer->write(reinterpret_cast<const uint8_t*>(frame.data()), left);
+    TBinaryProtocol protocol(buffer);
+    int messages = 0;
+    while (buffer->available_read() > 0) {
+      std::string name;
+      TMessageType type;
+      int32_t seqid;
+      protocol.readMessageBegin(name, type, seqid);
+      protocol.skip(apache::thrift::protocol::T_STRUCT);
+      protocol.readMessageEnd();
+      ++messages;
+    }
+    frames.push_back(messages);
+  }
+  return frames;
+}
+
+BOOST_AUTO_TEST_CASE( test_max_messages ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  shared_ptr<TBatchingTransport> batching(
+    new TBatchingTransport(shared_ptr<TFramedTransport>(new TFramedTransport(wire)), 3, 0, 0));
+  TBinaryProtocol protocol(batching);
+
+  for (int32_t i = 0; i < 7; ++i) {
+    sendLog(protocol, i);
+  }
+  std::vector<int> frames = readFrames(wire);
+  BOOST_CHECK_EQUAL(frames.size(), 2u);
+  BOOST_CHECK_EQUAL(frames[0], 3);
+  BOOST_CHECK_EQUAL(frames[1], 3);
+
+  batching->flushBatch();
+  frames = readFrames(wire);
+  BOOST_CHECK_EQUAL(frames.size(), 1u);
+  BOOST_CHECK_EQUAL(frames[0], 1);
+  BOOST_CHECK_EQUAL(batching->getNumBatches(), 3u);
+  BOOST_CHECK_EQUAL(batching->getNumMessages(), 7u);
+}
+
+BOOST_AUTO_TEST_CASE( test_max_bytes ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  // A log call is 16 bytes
+  shared_ptr<TBatchingTransport> batching(
+    new TBatchingTransport(shared_ptr<TFramedTransport>(new TFramedTransport(wire)), 0, 40, 0));
+  TBinaryProtocol protocol(batching);
+
+  for (int32_t i = 0; i < 5; ++i) {
+    sendLog(protocol, i);
+  }
+  std::vector<int> frames = readFrames(wire);
+  BOOST_CHECK_EQUAL(frames.size(), 1u);
+  BOOST_CHECK_EQUAL(frames[0], 3);
+}
+
+BOOST_AUTO_TEST_CASE( test_max_delay ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  shared_ptr<TBatchingTransport> batching(
+    new TBatchingTransport(shared_ptr<TFramedTransport>(new TFramedTransport(wire)),
+                           100, 0, 5000));
+  TBinaryProtocol protocol(batching);
+
+  sendLog(protocol, 1);
+  sendLog(protocol, 2);
+  for (int i = 0; i < 1000 && batching->getNumBatches() == 0; ++i) {
+    usleep(1000);
+  }
+  BOOST_CHECK_EQUAL(batching->getNumBatches(), 1u);
+  std::vector<int> frames = readFrames(wire);
+  BOOST_CHECK_EQUAL(frames.size(), 1u);
+  BOOST_CHECK_EQUAL(frames[0], 2);
+}
+
+BOOST_AUTO_TEST_CASE( test_read_sends ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  shared_ptr<TBatchingTransport> batching(
+    new TBatchingTransport(shared_ptr<TFramedTransport>(new TFramedTransport(wire)), 100, 0, 0));
+  TBinaryProtocol protocol(batching);
+
+  sendLog(protocol, 1);
+  sendLog(protocol, 2);
+  BOOST_CHECK_EQUAL(wire->available_read(), 0u);
+
+  // Reading sends them first; here the wire reads back what was sent
+  uint8_t byte;
+  BOOST_CHECK_EQUAL(batching->read(&byte, 1), 1u);
+  BOOST_CHECK_EQUAL(byte, 0x80);
+  BOOST_CHECK_EQUAL(batching->getNumBatches(), 1u);
+  BOOST_CHECK_EQUAL(batching->getNumMessages(), 2u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
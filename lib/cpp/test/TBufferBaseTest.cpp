@@ -18,16 +18,29 @@
  */
 
 #include <algorithm>
+#include <deque>
 #include <boost/test/auto_unit_test.hpp>
+#include <thrift/protocol/TBinaryProtocol.h>
 #include <thrift/transport/TBufferTransports.h>
 #include <thrift/transport/TShortReadTransport.h>
+#include <thrift/transport/TVirtualTransport.h>
+#include <thrift/server/TBufferPool.h>
 
 using std::string;
 using boost::shared_ptr;
 using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TProtocol;
 using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::transport::TBufferedTransportFactory;
 using apache::thrift::transport::TFramedTransport;
+using apache::thrift::transport::TFramedTransportFactory;
+using apache::thrift::transport::TIOVec;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TTransportException;
+using apache::thrift::transport::TVirtualTransport;
 using apache::thrift::transport::test::TShortReadTransport;
+using apache::thrift::server::TConcurrentBufferPool;
 
 // Shamelessly copied from ZlibTransport.  TODO: refactor.
 unsigned int dist[][5000] = {
@@ -419,6 +432,51 @@ BOOST_AUTO_TEST_CASE( test_BufferedTransport_Write ) {
   }
 }
 
+BOOST_AUTO_TEST_CASE( test_BufferedTransport_Writev ) {
+  init_data();
+
+  int sizes[] = {
+    12, 15, 16, 17, 20,
+    501, 512, 523,
+    2000, 2048, 2096,
+    1<<14, 1<<17,
+  };
+
+  for (size_t i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+    int size = sizes[i];
+    for (int d1 = 0; d1 < 3; d1++) {
+      shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer(16));
+      TBufferedTransport trans(buffer, size);
+
+      int offset = 0;
+      int index = 0;
+      while (offset < 1<<15) {
+        // Mix plain writes in with gather writes of up to three chunks.
+        apache::thrift::transport::TIOVec iov[3];
+        uint32_t iovcnt = 0;
+        while (iovcnt < (uint32_t)(index % 4) && offset < 1<<15) {
+          iov[iovcnt].base = &data[offset];
+          iov[iovcnt].len = dist[d1][index];
+          offset += dist[d1][index];
+          index++;
+          iovcnt++;
+        }
+        if (iovcnt > 0) {
+          trans.writev(iov, iovcnt);
+        } else {
+          trans.write(&data[offset], dist[d1][index]);
+          offset += dist[d1][index];
+          index++;
+        }
+      }
+      trans.flush();
+
+      string output = buffer->getBufferAsString();
+      BOOST_CHECK_EQUAL(data_str, output);
+    }
+  }
+}
+
 BOOST_AUTO_TEST_CASE( test_BufferedTransport_Read_Full ) {
   init_data();
 
@@ -486,6 +544,93 @@ BOOST_AUTO_TEST_CASE( test_BufferedTransport_Read_Short ) {
   }
 }
 
+BOOST_AUTO_TEST_CASE( test_BufferedTransport_Release_When_Idle ) {
+  shared_ptr<TConcurrentBufferPool> pool(new TConcurrentBufferPool());
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TBufferedTransport trans(buffer, 4096);
+  trans.setBufferPool(pool);
+  trans.setReleaseWhenIdle(true);
+
+  // Nothing is allocated until it is needed
+  BOOST_CHECK_EQUAL(pool->getFreeBytes(), 0u);
+  trans.write((const uint8_t*)"hello", 5);
+  BOOST_CHECK(!trans.releaseBuffers());
+  trans.flush();
+  BOOST_CHECK_EQUAL(buffer->available_read(), 5u);
+
+  // The write buffer goes back before waiting, the read buffer is reused
+  BOOST_CHECK(trans.peek());
+  BOOST_CHECK_EQUAL(pool->getFreeBytes(), 0u);
+  uint8_t out[5];
+  trans.readAll(out, 5);
+  BOOST_CHECK(!memcmp(out, "hello", 5));
+
+  // Idle again, so everything is back in the pool
+  BOOST_CHECK(!trans.peek());
+  BOOST_CHECK_EQUAL(pool->getFreeBytes(), 4096u);
+
+  trans.write((const uint8_t*)"again", 5);
+  trans.flush();
+  BOOST_CHECK(trans.peek());
+  trans.readAll(out, 5);
+  BOOST_CHECK(!memcmp(out, "again", 5));
+}
+
+// Counts the reads that get through to it
+class TCountingReadTransport : public TVirtualTransport<TCountingReadTransport> {
+ public:
+  explicit TCountingReadTransport(shared_ptr<TTransport> transport)
+    : transport_(transport), reads_(0) {}
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    ++reads_;
+    return transport_->read(buf, len);
+  }
+
+  shared_ptr<TTransport> transport_;
+  int reads_;
+};
+
+BOOST_AUTO_TEST_CASE( test_BufferedTransport_Large_Read_Bypasses_Buffer ) {
+  init_data();
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer(data, sizeof(data)));
+  shared_ptr<TCountingReadTransport> counting(new TCountingReadTransport(buffer));
+  TBufferedTransport trans(counting, 512);
+  uint8_t out[1<<15];
+
+  trans.readAll(out, 10);
+  BOOST_CHECK_EQUAL(counting->reads_, 1);
+
+  // What is left of the buffer, then the rest in one read
+  trans.readAll(out + 10, sizeof(data) - 10);
+  BOOST_CHECK_EQUAL(counting->reads_, 2);
+  BOOST_CHECK(!memcmp(data, out, sizeof(data)));
+}
+
+BOOST_AUTO_TEST_CASE( test_BufferedTransport_Adaptive_Read_Buffer ) {
+  init_data();
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  buffer->write(data, sizeof(data));
+  TBufferedTransport trans(buffer, 512);
+  trans.setMaxReadBufferSize(2048);
+  uint8_t out[1<<15];
+
+  // Small reads of plenty of data grow the buffer as far as it may go
+  for (uint32_t i = 0; i < sizeof(data); i += 16) {
+    trans.readAll(out + i, 16);
+  }
+  BOOST_CHECK_EQUAL(trans.getReadBufferSize(), 2048u);
+  BOOST_CHECK(!memcmp(data, out, sizeof(data)));
+
+  // and a trickle shrinks it back down
+  for (int i = 0; i < 40; ++i) {
+    buffer->write(data, 8);
+    trans.readAll(out, 8);
+    BOOST_CHECK(!memcmp(data, out, 8));
+  }
+  BOOST_CHECK_EQUAL(trans.getReadBufferSize(), 512u);
+}
+
 BOOST_AUTO_TEST_CASE( test_FramedTransport_Write ) {
   init_data();
 
@@ -641,5 +786,184 @@ BOOST_AUTO_TEST_CASE( test_FramedTransport_Empty_Flush ) {
   BOOST_CHECK_EQUAL(buffer->getBufferAsString(), output2);
 }
 
+// Keeps what is written to it, counting the plain and the gather writes
+class TGatherWriteTransport : public TVirtualTransport<TGatherWriteTransport> {
+ public:
+  TGatherWriteTransport() : writes_(0), writevs_(0) {}
+
+  void write(const uint8_t* buf, uint32_t len) {
+    ++writes_;
+    output_.append(reinterpret_cast<const char*>(buf), len);
+  }
+
+  virtual void writev(const TIOVec* iov, uint32_t iovcnt) {
+    ++writevs_;
+    for (uint32_t i = 0; i < iovcnt; ++i) {
+      output_.append(reinterpret_cast<const char*>(iov[i].base), iov[i].len);
+    }
+  }
+
+  string output_;
+  int writes_;
+  int writevs_;
+};
+
+BOOST_AUTO_TEST_CASE( test_FramedTransport_Flush_With ) {
+  init_data();
+  shared_ptr<TGatherWriteTransport> gather(new TGatherWriteTransport);
+  TFramedTransport trans(gather);
+
+  // The size covers what was written and the buffers, all of which go
+  // down in one gather write
+  trans.write(data, 3);
+  TIOVec iov[2];
+  iov[0].base = data + 3;
+  iov[0].len = 1000;
+  iov[1].base = data + 1003;
+  iov[1].len = 1<<14;
+  trans.flushWith(iov, 2);
+  string frame1("\x00\x00\x43\xeb", 4);
+  frame1.append(reinterpret_cast<const char*>(data), 3 + 1000 + (1<<14));
+  BOOST_CHECK(gather->output_ == frame1);
+  BOOST_CHECK_EQUAL(gather->writevs_, 1);
+  BOOST_CHECK_EQUAL(gather->writes_, 0);
+
+  // The next write starts a new frame, and an empty one isn't sent
+  trans.flushWith(iov, 0);
+  trans.write(data, 2);
+  trans.flush();
+  string frame2("\x00\x00\x00\x02", 4);
+  frame2.append(reinterpret_cast<const char*>(data), 2);
+  BOOST_CHECK(gather->output_ == frame1 + frame2);
+}
+
+// Hands out its chunks one read at a time, timing out for an empty one
+class TrickleTransport : public TVirtualTransport<TrickleTransport> {
+ public:
+  void add(const string& chunk) {
+    chunks_.push_back(chunk);
+  }
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    if (chunks_.empty()) {
+      return 0;
+    }
+    string& chunk = chunks_.front();
+    if (chunk.empty()) {
+      chunks_.pop_front();
+      throw TTransportException(TTransportException::TIMED_OUT);
+    }
+    uint32_t give = std::min(len, static_cast<uint32_t>(chunk.size()));
+    memcpy(buf, chunk.data(), give);
+    chunk.erase(0, give);
+    if (chunk.empty()) {
+      chunks_.pop_front();
+    }
+    return give;
+  }
+
+ private:
+  std::deque<string> chunks_;
+};
+
+BOOST_AUTO_TEST_CASE( test_BufferedTransport_TryRead ) {
+  shared_ptr<TrickleTransport> trickle(new TrickleTransport());
+  trickle->add("ab");
+  trickle->add("");
+  trickle->add("cd");
+  TBufferedTransport trans(trickle);
+
+  uint8_t buf[16];
+  BOOST_CHECK_EQUAL(trans.tryRead(buf, 1), 1);
+  BOOST_CHECK_EQUAL(trans.tryRead(buf + 1, sizeof(buf)), 1);
+  BOOST_CHECK_EQUAL(trans.tryRead(buf, sizeof(buf)), TTransport::TRY_LATER);
+  BOOST_CHECK_EQUAL(trans.tryRead(buf + 2, sizeof(buf)), 2);
+  BOOST_CHECK_EQUAL(string(reinterpret_cast<char*>(buf), 4), "abcd");
+  BOOST_CHECK_EQUAL(trans.tryRead(buf, sizeof(buf)), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_FramedTransport_TryRead ) {
+  shared_ptr<TrickleTransport> trickle(new TrickleTransport());
+  trickle->add(string("\x00\x00", 2));
+  trickle->add("");
+  trickle->add(string("\x00\x05""he", 4));
+  trickle->add("");
+  trickle->add(string("llo\x00\x00\x00\x00\x00\x00\x00\x01""x", 12));
+  TFramedTransport trans(trickle);
+
+  // A frame arriving in pieces is only handed out once it is all there
+  uint8_t buf[16];
+  BOOST_CHECK_EQUAL(trans.tryRead(buf, sizeof(buf)), TTransport::TRY_LATER);
+  BOOST_CHECK_EQUAL(trans.tryRead(buf, sizeof(buf)), TTransport::TRY_LATER);
+  BOOST_CHECK_EQUAL(trans.tryRead(buf, sizeof(buf)), 5);
+  BOOST_CHECK_EQUAL(string(reinterpret_cast<char*>(buf), 5), "hello");
+
+  // An empty frame is stepped over
+  BOOST_CHECK_EQUAL(trans.tryRead(buf, sizeof(buf)), 1);
+  BOOST_CHECK_EQUAL(buf[0], 'x');
+  BOOST_CHECK_EQUAL(trans.tryRead(buf, sizeof(buf)), 0);
+
+  // The stream ending part way through a frame is an error
+  trickle->add(string("\x00\x00\x00\x09""abc", 7));
+  BOOST_CHECK_EQUAL(trans.tryRead(buf, sizeof(buf)), TTransport::TRY_FAILED);
+}
+
+BOOST_AUTO_TEST_CASE( test_Factory_Recycle ) {
+  TBufferedTransportFactory bufferedFactory;
+  TFramedTransportFactory framedFactory;
+  TBinaryProtocolFactory protocolFactory;
+  bufferedFactory.setRecycleLimit(1);
+  framedFactory.setRecycleLimit(1);
+  protocolFactory.setRecycleLimit(1);
+
+  shared_ptr<TMemoryBuffer> first(new TMemoryBuffer());
+  shared_ptr<TTransport> buffered = bufferedFactory.getTransport(first);
+  shared_ptr<TTransport> framed = framedFactory.getTransport(first);
+  shared_ptr<TProtocol> prot = protocolFactory.getProtocol(framed);
+
+  // Half written, which the next connection must not see
+  buffered->write((const uint8_t*)"stale", 5);
+  framed->write((const uint8_t*)"stale", 5);
+  TTransport* oldBuffered = buffered.get();
+  TTransport* oldFramed = framed.get();
+  TProtocol* oldProt = prot.get();
+
+  // Nothing is kept while someone still holds it
+  shared_ptr<TTransport> held = framed;
+  framedFactory.recycle(framed);
+  BOOST_CHECK(!framed);
+  BOOST_CHECK(framedFactory.getTransport(first).get() != oldFramed);
+  framed = held;
+  held.reset();
+
+  protocolFactory.recycle(prot);
+  bufferedFactory.recycle(buffered);
+  framedFactory.recycle(framed);
+  BOOST_CHECK(first.unique());
+
+  shared_ptr<TMemoryBuffer> second(new TMemoryBuffer());
+  buffered = bufferedFactory.getTransport(second);
+  framed = framedFactory.getTransport(second);
+  prot = protocolFactory.getProtocol(framed);
+  BOOST_CHECK(buffered.get() == oldBuffered);
+  BOOST_CHECK(framed.get() == oldFramed);
+  BOOST_CHECK(prot.get() == oldProt);
+  BOOST_CHECK(prot->getTransport() == framed);
+
+  buffered->write((const uint8_t*)"fresh", 5);
+  buffered->flush();
+  BOOST_CHECK_EQUAL(second->getBufferAsString(), "fresh");
+  second->resetBuffer();
+  prot->writeI32(7);
+  framed->flush();
+  BOOST_CHECK_EQUAL(second->getBufferAsString(), string("\x00\x00\x00\x04\x00\x00\x00\x07", 8));
+
+  // Only up to the limit
+  shared_ptr<TTransport> extra = bufferedFactory.getTransport(second);
+  bufferedFactory.recycle(buffered);
+  bufferedFactory.recycle(extra);
+  BOOST_CHECK(bufferedFactory.getTransport(second).get() == oldBuffered);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
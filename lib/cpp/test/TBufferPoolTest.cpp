@@ -0,0 +1,107 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <cstdlib>
+#include <thrift/server/TBufferPool.h>
+
+BOOST_AUTO_TEST_SUITE( TBufferPoolTest )
+
+using apache::thrift::server::TBufferPool;
+
+BOOST_AUTO_TEST_CASE( test_reuse ) {
+  TBufferPool pool(4096, 1024 * 1024);
+  uint32_t capacity = 0;
+
+  uint8_t* a = pool.borrow(1, &capacity);
+  BOOST_CHECK_EQUAL(capacity, TBufferPool::MIN_CLASS_SIZE);
+  memset(a, 'a', capacity);
+  pool.giveBack(a, capacity);
+  BOOST_CHECK_EQUAL(pool.getFreeBytes(), (size_t)TBufferPool::MIN_CLASS_SIZE);
+
+  // Same class comes straight back off the free list
+  uint8_t* b = pool.borrow(TBufferPool::MIN_CLASS_SIZE, &capacity);
+  BOOST_CHECK(a == b);
+  BOOST_CHECK_EQUAL(pool.getFreeBytes(), 0u);
+
+  // A different class doesn't
+  uint32_t capacity2 = 0;
+  uint8_t* c = pool.borrow(1000, &capacity2);
+  BOOST_CHECK_EQUAL(capacity2, 1024u);
+  BOOST_CHECK(c != b);
+
+  pool.giveBack(b, capacity);
+  pool.giveBack(c, capacity2);
+  BOOST_CHECK_EQUAL(pool.getFreeBytes(), (size_t)(capacity + capacity2));
+
+  pool.trim();
+  BOOST_CHECK_EQUAL(pool.getFreeBytes(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_limits ) {
+  TBufferPool pool(4096, 8192);
+  uint32_t capacity = 0;
+
+  // Past the largest class the exact size is allocated and never pooled
+  uint8_t* big = pool.borrow(5000, &capacity);
+  BOOST_CHECK_EQUAL(capacity, 5000u);
+  pool.giveBack(big, capacity);
+  BOOST_CHECK_EQUAL(pool.getFreeBytes(), 0u);
+
+  // Free memory is capped
+  uint8_t* bufs[3];
+  for (int i = 0; i < 3; ++i) {
+    bufs[i] = pool.borrow(4096, &capacity);
+  }
+  for (int i = 0; i < 3; ++i) {
+    pool.giveBack(bufs[i], capacity);
+  }
+  BOOST_CHECK_EQUAL(pool.getFreeBytes(), 8192u);
+
+  // Buffers are plain heap blocks
+  uint8_t* plain = pool.borrow(10, &capacity);
+  std::free(plain);
+
+  pool.giveBack(NULL, 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_prefill ) {
+  TBufferPool pool(4096, 8192);
+  uint32_t capacity = 0;
+
+  pool.prefill(1000, 4);
+  BOOST_CHECK_EQUAL(pool.getFreeBytes(), 4096u);
+
+  // Already holding them, nothing changes
+  pool.prefill(1000, 4);
+  BOOST_CHECK_EQUAL(pool.getFreeBytes(), 4096u);
+
+  // Capped like anything else handed back
+  pool.prefill(4096, 3);
+  BOOST_CHECK_EQUAL(pool.getFreeBytes(), 8192u);
+
+  uint8_t* a = pool.borrow(1000, &capacity);
+  uint8_t* b = pool.borrow(1000, &capacity);
+  BOOST_CHECK(a != b);
+  pool.giveBack(a, capacity);
+  pool.giveBack(b, capacity);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,255 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <vector>
+#include <thrift/TCached.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/protocol/TJSONProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TCachedTest )
+
+using apache::thrift::TCached;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::protocol::TJSONProtocol;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TType;
+using apache::thrift::protocol::T_I32;
+using apache::thrift::protocol::T_LIST;
+using apache::thrift::protocol::T_RAW_BINARY;
+using apache::thrift::protocol::T_RAW_COMPACT;
+using apache::thrift::protocol::T_STOP;
+using apache::thrift::protocol::T_STRING;
+using apache::thrift::protocol::T_STRUCT;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+static int entryWrites = 0;
+
+// Written out the way the generator would
+struct Entry {
+  Entry() : id(0) {}
+
+  int32_t id;
+  std::string title;
+  std::vector<std::string> tags;
+
+  bool operator==(const Entry& that) const {
+    return id == that.id && title == that.title && tags == that.tags;
+  }
+
+  bool operator<(const Entry& that) const { return id < that.id; }
+
+  uint32_t read(TProtocol* iprot) {
+    uint32_t xfer = 0;
+    std::string fname;
+    TType ftype;
+    int16_t fid;
+    xfer += iprot->readStructBegin(fname);
+    while (true) {
+      xfer += iprot->readFieldBegin(fname, ftype, fid);
+      if (ftype == T_STOP) {
+        break;
+      }
+      switch (fid) {
+      case 1:
+        xfer += iprot->readI32(id);
+        break;
+      case 2:
+        xfer += iprot->readString(title);
+        break;
+      case 3:
+        {
+          TType etype;
+          uint32_t size;
+          xfer += iprot->readListBegin(etype, size);
+          tags.resize(size);
+          for (uint32_t i = 0; i < size; ++i) {
+            xfer += iprot->readString(tags[i]);
+          }
+          xfer += iprot->readListEnd();
+        }
+        break;
+      default:
+        xfer += iprot->skip(ftype);
+        break;
+      }
+      xfer += iprot->readFieldEnd();
+    }
+    xfer += iprot->readStructEnd();
+    return xfer;
+  }
+
+  uint32_t write(TProtocol* oprot) const {
+    ++entryWrites;
+    uint32_t xfer = 0;
+    xfer += oprot->writeStructBegin("Entry");
+    xfer += oprot->writeFieldBegin("id", T_I32, 1);
+    xfer += oprot->writeI32(id);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("title", T_STRING, 2);
+    xfer += oprot->writeString(title);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("tags", T_LIST, 3);
+    xfer += oprot->writeListBegin(T_STRING, (uint32_t)tags.size());
+    for (size_t i = 0; i < tags.size(); ++i) {
+      xfer += oprot->writeString(tags[i]);
+    }
+    xfer += oprot->writeListEnd();
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldStop();
+    xfer += oprot->writeStructEnd();
+    return xfer;
+  }
+};
+
+typedef TCached<Entry> CachedEntry;
+
+// A service result holding the cached entry, as getEntry_result would
+struct Result {
+  CachedEntry success;
+
+  uint32_t read(TProtocol* iprot) {
+    uint32_t xfer = 0;
+    std::string fname;
+    TType ftype;
+    int16_t fid;
+    xfer += iprot->readStructBegin(fname);
+    while (true) {
+      xfer += iprot->readFieldBegin(fname, ftype, fid);
+      if (ftype == T_STOP) {
+        break;
+      }
+      if (fid == 0 && ftype == T_STRUCT) {
+        xfer += this->success.read(iprot);
+      } else {
+        xfer += iprot->skip(ftype);
+      }
+      xfer += iprot->readFieldEnd();
+    }
+    xfer += iprot->readStructEnd();
+    return xfer;
+  }
+
+  uint32_t write(TProtocol* oprot) const {
+    uint32_t xfer = 0;
+    xfer += oprot->writeStructBegin("Result");
+    xfer += oprot->writeFieldBegin("success", T_STRUCT, 0);
+    xfer += this->success.write(oprot);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldStop();
+    xfer += oprot->writeStructEnd();
+    return xfer;
+  }
+};
+
+static Entry sampleEntry() {
+  Entry entry;
+  entry.id = 42;
+  entry.title = "The catalog entry";
+  entry.tags.push_back("one");
+  entry.tags.push_back("two");
+  return entry;
+}
+
+template <class Protocol_>
+static std::string serialize(const Result& result) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  Protocol_ prot(buf);
+  uint32_t size = result.write(&prot);
+  BOOST_CHECK_EQUAL(size, buf->available_read());
+  return buf->getBufferAsString();
+}
+
+template <class Protocol_>
+static void checkCached() {
+  // The same bytes as the plain struct gives, walked only the first time
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  Protocol_ prot(buf);
+  prot.writeStructBegin("Result");
+  prot.writeFieldBegin("success", T_STRUCT, 0);
+  sampleEntry().write(&prot);
+  prot.writeFieldEnd();
+  prot.writeFieldStop();
+  prot.writeStructEnd();
+  std::string expected = buf->getBufferAsString();
+
+  CachedEntry shared(sampleEntry());
+  entryWrites = 0;
+  for (int i = 0; i < 5; ++i) {
+    // Each call's result takes a copy, as a handler filling _return does
+    Result result;
+    result.success = shared;
+    BOOST_CHECK(serialize<Protocol_>(result) == expected);
+  }
+  BOOST_CHECK_EQUAL(entryWrites, 1);
+
+  Result copy;
+  shared_ptr<TMemoryBuffer> in(
+    new TMemoryBuffer((uint8_t*)expected.data(), (uint32_t)expected.size()));
+  Protocol_ inProt(in);
+  copy.read(&inProt);
+  BOOST_CHECK(copy.success == shared);
+}
+
+BOOST_AUTO_TEST_CASE( test_binary ) {
+  checkCached<TBinaryProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_compact ) {
+  checkCached<TCompactProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_formats_kept_apart ) {
+  CachedEntry entry(sampleEntry());
+  Result result;
+  result.success = entry;
+  serialize<TBinaryProtocol>(result);
+  BOOST_CHECK(entry.isEncoded(T_RAW_BINARY));
+  BOOST_CHECK(!entry.isEncoded(T_RAW_COMPACT));
+
+  entryWrites = 0;
+  std::string compact = serialize<TCompactProtocol>(result);
+  BOOST_CHECK_EQUAL(entryWrites, 1);
+  BOOST_CHECK(entry.isEncoded(T_RAW_COMPACT));
+
+  // A new value starts afresh
+  Entry changed = sampleEntry();
+  changed.title = "Changed";
+  result.success = changed;
+  BOOST_CHECK(!result.success.isEncoded(T_RAW_COMPACT));
+  BOOST_CHECK(serialize<TCompactProtocol>(result) != compact);
+}
+
+BOOST_AUTO_TEST_CASE( test_without_raw_support ) {
+  // Other protocols walk the fields every time
+  Result result;
+  result.success = sampleEntry();
+  entryWrites = 0;
+  std::string first = serialize<TJSONProtocol>(result);
+  std::string second = serialize<TJSONProtocol>(result);
+  BOOST_CHECK(first == second);
+  BOOST_CHECK_EQUAL(entryWrites, 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,448 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <unistd.h>
+#include <thrift/TApplicationException.h>
+#include <thrift/TDeferredReply.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/processor/TCachingProcessor.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TCachingProcessorTest )
+
+using boost::shared_ptr;
+using apache::thrift::TApplicationException;
+using apache::thrift::TDeferredReply;
+using apache::thrift::TDeferredReplyScope;
+using apache::thrift::TProcessor;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::processor::TCachingProcessor;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TCompactProtocolFactory;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolFactory;
+using apache::thrift::protocol::T_CALL;
+using apache::thrift::protocol::T_EXCEPTION;
+using apache::thrift::protocol::T_I32;
+using apache::thrift::protocol::T_ONEWAY;
+using apache::thrift::protocol::T_REPLY;
+using apache::thrift::protocol::T_STOP;
+using apache::thrift::protocol::T_STRING;
+using apache::thrift::transport::TMemoryBuffer;
+
+// Answers get(key) with the key and the number of calls so far, and
+// fail() with a TApplicationException.  While closed, holds calls until
+// opened.
+class CountingProcessor : public TProcessor {
+ public:
+  CountingProcessor() : calls(0), closed_(false), held_(0) {}
+
+  void close() {
+    Synchronized s(monitor_);
+    closed_ = true;
+  }
+
+  void open() {
+    Synchronized s(monitor_);
+    closed_ = false;
+    monitor_.notifyAll();
+  }
+
+  void waitHeld(int held) {
+    Synchronized s(monitor_);
+    while (held_ < held) {
+      monitor_.wait();
+    }
+  }
+
+  bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out, void*) {
+    std::string name;
+    TMessageType type;
+    int32_t seqid;
+    in->readMessageBegin(name, type, seqid);
+    std::string key;
+    std::string fname;
+    apache::thrift::protocol::TType ftype;
+    int16_t fid;
+    in->readStructBegin(fname);
+    while (true) {
+      in->readFieldBegin(fname, ftype, fid);
+      if (ftype == T_STOP) {
+        break;
+      }
+      in->readString(key);
+      in->readFieldEnd();
+    }
+    in->readStructEnd();
+    in->readMessageEnd();
+    in->getTransport()->readEnd();
+    int32_t call;
+    {
+      Synchronized s(monitor_);
+      ++held_;
+      monitor_.notifyAll();
+      while (closed_) {
+        monitor_.wait();
+      }
+      --held_;
+      call = ++calls;
+    }
+    if (type == T_ONEWAY) {
+      return true;
+    }
+
+    if (name == "fail") {
+      TApplicationException x("failed");
+      out->writeMessageBegin(name, T_EXCEPTION, seqid);
+      x.write(out.get());
+    } else {
+      out->writeMessageBegin(name, T_REPLY, seqid);
+      out->writeStructBegin("result");
+      out->writeFieldBegin("key", T_STRING, 1);
+      out->writeString(key);
+      out->writeFieldEnd();
+      out->writeFieldBegin("calls", T_I32, 2);
+      out->writeI32(call);
+      out->writeFieldEnd();
+      out->writeFieldStop();
+      out->writeStructEnd();
+    }
+    out->writeMessageEnd();
+    out->getTransport()->writeEnd();
+    out->getTransport()->flush();
+    return true;
+  }
+
+  int calls;
+
+ private:
+  Monitor monitor_;
+  bool closed_;
+  int held_;
+};
+
+struct Reply {
+  std::string name;
+  TMessageType type;
+  int32_t seqid;
+  std::string key;
+  int32_t calls;
+};
+
+// Makes a call, and reads what it was answered with
+class Client {
+ public:
+  Client(TCachingProcessor& processor, shared_ptr<TProtocolFactory> factory)
+    : processor_(processor),
+      in_(new TMemoryBuffer()),
+      out_(new TMemoryBuffer()),
+      inProto_(factory->getProtocol(in_)),
+      outProto_(factory->getProtocol(out_)) {}
+
+  Reply call(const std::string& name, const std::string& key, int32_t seqid,
+             TMessageType type = T_CALL) {
+    send(name, key, seqid, type);
+    return receive();
+  }
+
+  void send(const std::string& name, const std::string& key, int32_t seqid,
+            TMessageType type = T_CALL) {
+    inProto_->writeMessageBegin(name, type, seqid);
+    inProto_->writeStructBegin("args");
+    inProto_->writeFieldBegin("key", T_STRING, 1);
+    inProto_->writeString(key);
+    inProto_->writeFieldEnd();
+    inProto_->writeFieldStop();
+    inProto_->writeStructEnd();
+    inProto_->writeMessageEnd();
+    BOOST_CHECK(processor_.process(inProto_, outProto_, NULL));
+    BOOST_CHECK_EQUAL(in_->available_read(), 0u);
+  }
+
+  Reply receive() {
+    Reply reply;
+    reply.calls = -1;
+    if (out_->available_read() == 0) {
+      reply.type = T_ONEWAY;
+      return reply;
+    }
+    outProto_->readMessageBegin(reply.name, reply.type, reply.seqid);
+    if (reply.type == T_EXCEPTION) {
+      TApplicationException x;
+      x.read(outProto_.get());
+    } else {
+      std::string fname;
+      apache::thrift::protocol::TType ftype;
+      int16_t fid;
+      outProto_->readStructBegin(fname);
+      outProto_->readFieldBegin(fname, ftype, fid);
+      outProto_->readString(reply.key);
+      outProto_->readFieldEnd();
+      outProto_->readFieldBegin(fname, ftype, fid);
+      outProto_->readI32(reply.calls);
+      outProto_->readFieldEnd();
+      outProto_->readFieldBegin(fname, ftype, fid);
+      outProto_->readStructEnd();
+    }
+    outProto_->readMessageEnd();
+    BOOST_CHECK_EQUAL(out_->available_read(), 0u);
+    return reply;
+  }
+
+ private:
+  TCachingProcessor& processor_;
+  shared_ptr<TMemoryBuffer> in_;
+  shared_ptr<TMemoryBuffer> out_;
+  shared_ptr<TProtocol> inProto_;
+  shared_ptr<TProtocol> outProto_;
+};
+
+// TCompactProtocol reads oneway calls back as calls, so they can't be told apart
+static void checkCaching(shared_ptr<TProtocolFactory> factory, bool oneway) {
+  shared_ptr<CountingProcessor> counting(new CountingProcessor());
+  TCachingProcessor caching(counting, factory);
+  caching.setCacheable("get", 60000);
+  Client client(caching, factory);
+
+  Reply reply = client.call("get", "a", 1);
+  BOOST_CHECK_EQUAL(reply.type, T_REPLY);
+  BOOST_CHECK_EQUAL(reply.calls, 1);
+
+  // The same arguments are answered from the cache, with their own seqid
+  reply = client.call("get", "a", 2);
+  BOOST_CHECK_EQUAL(reply.name, "get");
+  BOOST_CHECK_EQUAL(reply.type, T_REPLY);
+  BOOST_CHECK_EQUAL(reply.seqid, 2);
+  BOOST_CHECK_EQUAL(reply.key, "a");
+  BOOST_CHECK_EQUAL(reply.calls, 1);
+  BOOST_CHECK_EQUAL(counting->calls, 1);
+
+  // Others are not
+  reply = client.call("get", "b", 3);
+  BOOST_CHECK_EQUAL(reply.key, "b");
+  BOOST_CHECK_EQUAL(reply.calls, 2);
+  BOOST_CHECK_EQUAL(caching.getHits(), 1u);
+  BOOST_CHECK_EQUAL(caching.getMisses(), 2u);
+  BOOST_CHECK_EQUAL(caching.getNumEntries(), 2u);
+
+  // Methods not cacheable, oneway calls and exceptions all go through
+  reply = client.call("put", "a", 4);
+  BOOST_CHECK_EQUAL(reply.seqid, 4);
+  BOOST_CHECK_EQUAL(reply.calls, 3);
+  reply = client.call("put", "a", 5);
+  BOOST_CHECK_EQUAL(reply.calls, 4);
+  if (oneway) {
+    reply = client.call("get", "a", 6, T_ONEWAY);
+    BOOST_CHECK_EQUAL(reply.type, T_ONEWAY);
+  } else {
+    client.call("put", "a", 6);
+  }
+  BOOST_CHECK_EQUAL(counting->calls, 5);
+
+  caching.setCacheable("fail", 60000);
+  reply = client.call("fail", "a", 7);
+  BOOST_CHECK_EQUAL(reply.type, T_EXCEPTION);
+  reply = client.call("fail", "a", 8);
+  BOOST_CHECK_EQUAL(reply.type, T_EXCEPTION);
+  BOOST_CHECK_EQUAL(reply.seqid, 8);
+  BOOST_CHECK_EQUAL(counting->calls, 7);
+  BOOST_CHECK_EQUAL(caching.getNumEntries(), 2u);
+
+  caching.clear();
+  reply = client.call("get", "a", 9);
+  BOOST_CHECK_EQUAL(reply.calls, 8);
+}
+
+BOOST_AUTO_TEST_CASE( test_binary ) {
+  checkCaching(shared_ptr<TProtocolFactory>(new TBinaryProtocolFactory()), true);
+}
+
+BOOST_AUTO_TEST_CASE( test_compact ) {
+  checkCaching(shared_ptr<TProtocolFactory>(new TCompactProtocolFactory()), false);
+}
+
+BOOST_AUTO_TEST_CASE( test_ttl ) {
+  shared_ptr<TProtocolFactory> factory(new TBinaryProtocolFactory());
+  shared_ptr<CountingProcessor> counting(new CountingProcessor());
+  TCachingProcessor caching(counting, factory);
+  caching.setCacheable("get", 20);
+  Client client(caching, factory);
+
+  BOOST_CHECK_EQUAL(client.call("get", "a", 1).calls, 1);
+  BOOST_CHECK_EQUAL(client.call("get", "a", 2).calls, 1);
+  usleep(40 * 1000);
+  BOOST_CHECK_EQUAL(client.call("get", "a", 3).calls, 2);
+  BOOST_CHECK_EQUAL(caching.getNumEntries(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE( test_lru ) {
+  shared_ptr<TProtocolFactory> factory(new TBinaryProtocolFactory());
+  shared_ptr<CountingProcessor> counting(new CountingProcessor());
+  // Room for three calls with a kilobyte key, and their results
+  TCachingProcessor caching(counting, factory, 3 * 2300);
+  caching.setCacheable("get", 60000);
+  Client client(caching, factory);
+
+  std::string a(1000, 'a');
+  std::string b(1000, 'b');
+  std::string c(1000, 'c');
+  std::string d(1000, 'd');
+  client.call("get", a, 1);
+  client.call("get", b, 2);
+  client.call("get", c, 3);
+  BOOST_CHECK_EQUAL(caching.getNumEntries(), 3u);
+  // a is used again, so b is the one to go
+  BOOST_CHECK_EQUAL(client.call("get", a, 4).calls, 1);
+  client.call("get", d, 5);
+  BOOST_CHECK_EQUAL(caching.getNumEntries(), 3u);
+  BOOST_CHECK(caching.getBytes() <= 3 * 2300u);
+  BOOST_CHECK_EQUAL(client.call("get", a, 6).calls, 1);
+  BOOST_CHECK_EQUAL(client.call("get", c, 7).calls, 3);
+  BOOST_CHECK_EQUAL(client.call("get", b, 8).calls, 5);
+}
+
+// Makes a call on a thread of its own
+class Caller : public Runnable {
+ public:
+  Caller(TCachingProcessor& processor, shared_ptr<TProtocolFactory> factory,
+         const std::string& key, int32_t seqid)
+    : client_(processor, factory), key_(key), seqid_(seqid) {}
+
+  void run() { reply = client_.call("get", key_, seqid_); }
+
+  Reply reply;
+
+ private:
+  Client client_;
+  std::string key_;
+  int32_t seqid_;
+};
+
+static void countCompletion(int* completions) {
+  ++*completions;
+}
+
+BOOST_AUTO_TEST_CASE( test_deferral ) {
+  int completions = 0;
+  {
+    // No deferring outside of a scope, or twice within one
+    BOOST_CHECK(!TDeferredReply::defer());
+    TDeferredReplyScope scope(
+      apache::thrift::stdcxx::bind(countCompletion, &completions), NULL);
+    TDeferredReply::Completion complete = TDeferredReply::defer();
+    BOOST_CHECK(complete);
+    BOOST_CHECK(!TDeferredReply::defer());
+    // Completed before the server let go: the server finishes the call
+    complete();
+    BOOST_CHECK(!scope.release());
+  }
+  BOOST_CHECK_EQUAL(completions, 0);
+
+  {
+    TDeferredReplyScope scope(
+      apache::thrift::stdcxx::bind(countCompletion, &completions), NULL);
+    TDeferredReply::Completion complete = TDeferredReply::defer();
+    BOOST_CHECK(scope.release());
+    complete();
+  }
+  BOOST_CHECK_EQUAL(completions, 1);
+
+  // Not while there is more to read
+  shared_ptr<TMemoryBuffer> input(new TMemoryBuffer());
+  input->write(reinterpret_cast<const uint8_t*>("x"), 1);
+  TDeferredReplyScope scope(
+    apache::thrift::stdcxx::bind(countCompletion, &completions), input.get());
+  BOOST_CHECK(!TDeferredReply::defer());
+  BOOST_CHECK(!scope.release());
+}
+
+BOOST_AUTO_TEST_CASE( test_coalescing ) {
+  shared_ptr<TProtocolFactory> factory(new TBinaryProtocolFactory());
+  shared_ptr<CountingProcessor> counting(new CountingProcessor());
+  TCachingProcessor caching(counting, factory);
+  caching.setCoalesced("get");
+
+  PlatformThreadFactory threadFactory;
+  threadFactory.setDetached(false);
+  counting->close();
+  shared_ptr<Caller> first(new Caller(caching, factory, "a", 1));
+  shared_ptr<Thread> firstThread = threadFactory.newThread(first);
+  firstThread->start();
+  counting->waitHeld(1);
+
+  // A call the server can defer is answered, and completed, by the first
+  Client deferred(caching, factory);
+  int completions = 0;
+  {
+    TDeferredReplyScope scope(
+      apache::thrift::stdcxx::bind(countCompletion, &completions), NULL);
+    deferred.send("get", "a", 2);
+    BOOST_CHECK(scope.release());
+  }
+
+  // One it can't waits for the answer
+  shared_ptr<Caller> waiting(new Caller(caching, factory, "a", 3));
+  shared_ptr<Thread> waitingThread = threadFactory.newThread(waiting);
+  waitingThread->start();
+  while (caching.getCoalesced() < 2) {
+    usleep(1000);
+  }
+
+  // Others are served apart
+  shared_ptr<Caller> other(new Caller(caching, factory, "b", 4));
+  shared_ptr<Thread> otherThread = threadFactory.newThread(other);
+  otherThread->start();
+  counting->waitHeld(2);
+
+  BOOST_CHECK_EQUAL(completions, 0);
+  counting->open();
+  firstThread->join();
+  waitingThread->join();
+  otherThread->join();
+
+  BOOST_CHECK_EQUAL(counting->calls, 2);
+  BOOST_CHECK_EQUAL(completions, 1);
+  BOOST_CHECK_EQUAL(first->reply.seqid, 1);
+  int32_t calls = first->reply.calls;
+  Reply reply = deferred.receive();
+  BOOST_CHECK_EQUAL(reply.type, T_REPLY);
+  BOOST_CHECK_EQUAL(reply.seqid, 2);
+  BOOST_CHECK_EQUAL(reply.key, "a");
+  BOOST_CHECK_EQUAL(reply.calls, calls);
+  BOOST_CHECK_EQUAL(waiting->reply.seqid, 3);
+  BOOST_CHECK_EQUAL(waiting->reply.calls, calls);
+  BOOST_CHECK_EQUAL(other->reply.key, "b");
+  BOOST_CHECK_EQUAL(caching.getCoalesced(), 2u);
+
+  // Nothing is kept once the call lands
+  BOOST_CHECK_EQUAL(caching.getNumEntries(), 0u);
+  BOOST_CHECK_EQUAL(deferred.call("get", "a", 5).calls, 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
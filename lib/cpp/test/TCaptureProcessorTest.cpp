@@ -0,0 +1,152 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <vector>
+#include <thrift/processor/TCaptureProcessor.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TVirtualTransport.h>
+
+BOOST_AUTO_TEST_SUITE( TCaptureProcessorTest )
+
+using boost::shared_ptr;
+using apache::thrift::TProcessor;
+using apache::thrift::processor::TCaptureProcessor;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolFactory;
+using apache::thrift::protocol::T_CALL;
+using apache::thrift::protocol::T_ONEWAY;
+using apache::thrift::protocol::T_REPLY;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TVirtualTransport;
+
+// Reads a call, skipping its arguments, and answers it with an empty result
+class EchoProcessor : public TProcessor {
+ public:
+  EchoProcessor() : calls(0) {}
+
+  bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out, void*) {
+    std::string name;
+    TMessageType type;
+    int32_t seqid;
+    in->readMessageBegin(name, type, seqid);
+    in->skip(apache::thrift::protocol::T_STRUCT);
+    in->readMessageEnd();
+    in->getTransport()->readEnd();
+    ++calls;
+    if (type == T_CALL) {
+      out->writeMessageBegin(name, T_REPLY, seqid);
+      out->writeStructBegin("result");
+      out->writeFieldStop();
+      out->writeStructEnd();
+      out->writeMessageEnd();
+      out->getTransport()->writeEnd();
+      out->getTransport()->flush();
+    }
+    return true;
+  }
+
+  int calls;
+};
+
+// Keeps each write as an event, as TFileTransport does
+class EventLog : public TVirtualTransport<EventLog> {
+ public:
+  bool isOpen() { return true; }
+
+  void write(const uint8_t* buf, uint32_t len) {
+    events.push_back(std::string(reinterpret_cast<const char*>(buf), len));
+  }
+
+  std::vector<std::string> events;
+};
+
+static std::string makeCall(const std::string& name, TMessageType type, int32_t seqid) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TBinaryProtocol proto(buf);
+  proto.writeMessageBegin(name, type, seqid);
+  proto.writeStructBegin("args");
+  proto.writeFieldBegin("key", apache::thrift::protocol::T_STRING, 1);
+  proto.writeString(std::string("some key"));
+  proto.writeFieldEnd();
+  proto.writeFieldStop();
+  proto.writeStructEnd();
+  proto.writeMessageEnd();
+  return buf->getBufferAsString();
+}
+
+BOOST_AUTO_TEST_CASE( test_capture ) {
+  shared_ptr<EchoProcessor> echo(new EchoProcessor());
+  shared_ptr<EventLog> log(new EventLog());
+  shared_ptr<TProtocolFactory> factory(new TBinaryProtocolFactory());
+  TCaptureProcessor capture(echo, factory, log, 3);
+
+  shared_ptr<TMemoryBuffer> in(new TMemoryBuffer());
+  shared_ptr<TMemoryBuffer> out(new TMemoryBuffer());
+  shared_ptr<TProtocol> inProto(new TBinaryProtocol(in));
+  shared_ptr<TProtocol> outProto(new TBinaryProtocol(out));
+  std::vector<std::string> calls;
+  for (int32_t i = 0; i < 9; ++i) {
+    calls.push_back(makeCall("get", i == 8 ? T_ONEWAY : T_CALL, i));
+    in->write(reinterpret_cast<const uint8_t*>(calls.back().data()),
+              static_cast<uint32_t>(calls.back().size()));
+  }
+  for (int i = 0; i < 9; ++i) {
+    BOOST_CHECK(capture.process(inProto, outProto, NULL));
+  }
+
+  // Every call is served, and every third is written as it came
+  BOOST_CHECK_EQUAL(echo->calls, 9);
+  BOOST_CHECK_EQUAL(in->available_read(), 0u);
+  BOOST_REQUIRE_EQUAL(log->events.size(), 3u);
+  for (size_t i = 0; i < log->events.size(); ++i) {
+    const std::string& event = log->events[i];
+    TCaptureProcessor::Record record;
+    BOOST_REQUIRE(TCaptureProcessor::parseRecord(
+      reinterpret_cast<const uint8_t*>(event.data()), static_cast<uint32_t>(event.size()),
+      record));
+    std::string request(reinterpret_cast<const char*>(record.request), record.requestSize);
+    BOOST_CHECK(request == calls[i * 3 + 2]);
+    BOOST_CHECK_EQUAL(record.oneway, i == 2);
+    BOOST_CHECK(record.timestampUsec > 0);
+  }
+
+  // Turned off, nothing is written
+  capture.setSampleEvery(0);
+  in->write(reinterpret_cast<const uint8_t*>(calls[0].data()),
+            static_cast<uint32_t>(calls[0].size()));
+  capture.process(inProto, outProto, NULL);
+  BOOST_CHECK_EQUAL(log->events.size(), 3u);
+}
+
+BOOST_AUTO_TEST_CASE( test_bad_record ) {
+  TCaptureProcessor::Record record;
+  uint8_t shortRecord[4] = { TCaptureProcessor::RECORD_VERSION, 0, 0, 0 };
+  BOOST_CHECK(!TCaptureProcessor::parseRecord(shortRecord, sizeof(shortRecord), record));
+  uint8_t otherVersion[TCaptureProcessor::HEADER_SIZE] = { 99 };
+  BOOST_CHECK(!TCaptureProcessor::parseRecord(otherVersion, sizeof(otherVersion), record));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
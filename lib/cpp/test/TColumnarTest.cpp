@@ -0,0 +1,165 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <vector>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TColumnar.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp/ColumnarTest_types.h"
+
+BOOST_AUTO_TEST_SUITE( TColumnarTest )
+
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TColumnarReader;
+using apache::thrift::protocol::TColumnarWriter;
+using apache::thrift::protocol::TProtocolException;
+using apache::thrift::test::columnar::ListTable;
+using apache::thrift::test::columnar::Row;
+using apache::thrift::test::columnar::Table;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+namespace protocol = apache::thrift::protocol;
+
+// Row and the tables are generated from ColumnarTest.thrift, Table's rows
+// annotated cpp.columnar and ListTable's not
+
+static Table sampleTable() {
+  Table table;
+  for (int i = 0; i < 1000; ++i) {
+    Row row;
+    row.ts = 1400000000000LL + i * 15;
+    if (i % 4 == 0) {
+      row.__set_value(i * 0.5);
+    }
+    row.tag = i % 10 == 0 ? "" : "host" + std::string(1, (char)('a' + i % 7));
+    row.ok = i % 3 != 0;
+    table.rows.push_back(row);
+  }
+  return table;
+}
+
+template <typename T>
+static std::string serialize(const T& table) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TBinaryProtocol prot(buf);
+  table.write(&prot);
+  return buf->getBufferAsString();
+}
+
+// The table's rows as a plain list
+static std::string serializeAsList(const Table& table) {
+  ListTable list;
+  list.rows = table.rows;
+  return serialize(list);
+}
+
+static Table deserialize(const std::string& data) {
+  shared_ptr<TMemoryBuffer> buf(
+    new TMemoryBuffer((uint8_t*)data.data(), (uint32_t)data.size()));
+  TBinaryProtocol prot(buf);
+  Table table;
+  table.read(&prot);
+  return table;
+}
+
+BOOST_AUTO_TEST_CASE( test_round_trip ) {
+  Table table = sampleTable();
+  std::string columns = serialize(table);
+  Table copy = deserialize(columns);
+  BOOST_CHECK(copy.__isset.rows);
+  BOOST_CHECK(copy.rows == table.rows);
+  BOOST_CHECK(copy.rows[4].__isset.value);
+  BOOST_CHECK(!copy.rows[5].__isset.value);
+
+  // Timestamps a few apart and repeated tags shrink well as columns
+  BOOST_CHECK_LT(columns.size() * 3, serializeAsList(table).size());
+}
+
+BOOST_AUTO_TEST_CASE( test_empty ) {
+  Table copy = deserialize(serialize(Table()));
+  BOOST_CHECK(copy.__isset.rows);
+  BOOST_CHECK(copy.rows.empty());
+}
+
+BOOST_AUTO_TEST_CASE( test_reads_list ) {
+  Table table = sampleTable();
+  BOOST_CHECK(deserialize(serializeAsList(table)).rows == table.rows);
+}
+
+BOOST_AUTO_TEST_CASE( test_extreme_deltas ) {
+  std::vector<int64_t> values;
+  values.push_back(INT64_MIN);
+  values.push_back(INT64_MAX);
+  values.push_back(0);
+  values.push_back(INT64_MIN);
+  TColumnarWriter writer;
+  int64_t prev = 0;
+  for (size_t i = 0; i < values.size(); ++i) {
+    writer.writeDelta(values[i], prev);
+  }
+  TColumnarReader reader(writer.getBuffer());
+  prev = 0;
+  for (size_t i = 0; i < values.size(); ++i) {
+    BOOST_CHECK_EQUAL(reader.readDelta(prev), values[i]);
+  }
+  reader.finish();
+}
+
+// A Table whose rows field is the given column blob
+static std::string tableWithBlob(const std::string& blob) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TBinaryProtocol prot(buf);
+  prot.writeStructBegin("Table");
+  prot.writeFieldBegin("rows", protocol::T_STRING, 1);
+  prot.writeBinary(blob);
+  prot.writeFieldEnd();
+  prot.writeFieldStop();
+  prot.writeStructEnd();
+  return buf->getBufferAsString();
+}
+
+BOOST_AUTO_TEST_CASE( test_bad_data ) {
+  // The blob follows the field header and its length, before the stop
+  std::string data = serialize(sampleTable());
+  std::string blob = data.substr(7, data.size() - 8);
+  BOOST_CHECK(deserialize(tableWithBlob(blob)).rows == sampleTable().rows);
+  for (size_t len = 0; len < blob.size(); len += 97) {
+    BOOST_CHECK_THROW(deserialize(tableWithBlob(blob.substr(0, len))), TProtocolException);
+  }
+  BOOST_CHECK_THROW(deserialize(tableWithBlob(blob + '\0')), TProtocolException);
+
+  // A row count the data could not possibly hold
+  TColumnarWriter writer;
+  writer.writeCount(1000000);
+  writer.writeByte(0);
+  TColumnarReader reader(writer.getBuffer());
+  BOOST_CHECK_THROW(reader.readCount(), TProtocolException);
+
+  // Trailing bytes are an error
+  TColumnarWriter extra;
+  extra.writeCount(0);
+  extra.writeByte(0);
+  TColumnarReader leftover(extra.getBuffer());
+  leftover.readCount();
+  BOOST_CHECK_THROW(leftover.finish(), TProtocolException);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
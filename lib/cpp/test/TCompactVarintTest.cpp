@@ -0,0 +1,208 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/protocol/TCompactVarint.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TCompactVarintTest )
+
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::protocol::TCompactProtocolT;
+using apache::thrift::protocol::TProtocolException;
+using apache::thrift::transport::TBufferBase;
+using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+namespace compact = apache::thrift::protocol::detail::compact;
+
+// A mix of one-byte runs, every varint length and the extremes
+template <typename T>
+static std::vector<T> sampleValues() {
+  std::vector<T> values;
+  for (int i = 0; i < 40; ++i) {
+    values.push_back(static_cast<T>(i % 64 - 32));
+  }
+  for (int shift = 0; shift < static_cast<int>(sizeof(T) * 8) - 1; ++shift) {
+    values.push_back(static_cast<T>(T(1) << shift));
+    values.push_back(static_cast<T>(-(T(1) << shift)));
+    values.push_back(static_cast<T>(shift % 3));
+  }
+  values.push_back(std::numeric_limits<T>::max());
+  values.push_back(std::numeric_limits<T>::min());
+  for (int i = 0; i < 100; ++i) {
+    values.push_back(static_cast<T>(i * 37 % 100));
+  }
+  return values;
+}
+
+BOOST_AUTO_TEST_CASE( test_encode_varint ) {
+  const uint64_t values[] = { 0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 0x1fffff, 0x200000,
+                              0xfffffff, 0x10000000, 0xffffffffULL, 0x7ffffffffULL,
+                              0x800000000ULL, 0xffffffffffffffffULL };
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    // Against the byte at a time loop
+    uint8_t expected[10];
+    uint32_t expectedSize = 0;
+    uint64_t n = values[i];
+    while (n & ~0x7fULL) {
+      expected[expectedSize++] = static_cast<uint8_t>((n & 0x7f) | 0x80);
+      n >>= 7;
+    }
+    expected[expectedSize++] = static_cast<uint8_t>(n);
+
+    uint8_t buf[10];
+    uint32_t size = compact::encodeVarint64(values[i], buf);
+    BOOST_CHECK_EQUAL(size, expectedSize);
+    BOOST_CHECK_EQUAL(compact::varintSize64(values[i]), expectedSize);
+    BOOST_CHECK(std::equal(buf, buf + size, expected));
+
+    if (values[i] <= 0xffffffffULL) {
+      uint32_t v = static_cast<uint32_t>(values[i]);
+      size = compact::encodeVarint32(v, buf);
+      BOOST_CHECK_EQUAL(size, expectedSize);
+      BOOST_CHECK_EQUAL(compact::varintSize32(v), expectedSize);
+      BOOST_CHECK(std::equal(buf, buf + size, expected));
+    }
+  }
+}
+
+template <typename T>
+static void checkRoundTrip(uint32_t (TCompactProtocol::*writeOne)(const T),
+                           uint32_t (TCompactProtocol::*writeRun)(const T*, uint32_t),
+                           uint32_t (TCompactProtocol::*readRun)(T*, uint32_t)) {
+  std::vector<T> values = sampleValues<T>();
+  uint32_t n = static_cast<uint32_t>(values.size());
+
+  // The run is written exactly as one value at a time would be
+  shared_ptr<TMemoryBuffer> single(new TMemoryBuffer());
+  TCompactProtocol singleProto(single);
+  uint32_t singleSize = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    singleSize += (singleProto.*writeOne)(values[i]);
+  }
+  shared_ptr<TMemoryBuffer> run(new TMemoryBuffer());
+  TCompactProtocol runProto(run);
+  BOOST_CHECK_EQUAL((runProto.*writeRun)(&values[0], n), singleSize);
+  BOOST_CHECK_EQUAL(run->getBufferAsString(), single->getBufferAsString());
+
+  // Decoded in place from the memory buffer
+  std::vector<T> got(n);
+  BOOST_CHECK_EQUAL((runProto.*readRun)(&got[0], n), singleSize);
+  BOOST_CHECK(got == values);
+
+  // Through a small read buffer, so the borrowed bytes keep ending partway
+  // through a varint and the slow path has to pick it up
+  shared_ptr<TBufferedTransport> buffered(new TBufferedTransport(single, 37));
+  TCompactProtocol bufferedProto(buffered);
+  std::vector<T> got2(n);
+  BOOST_CHECK_EQUAL((bufferedProto.*readRun)(&got2[0], n), singleSize);
+  BOOST_CHECK(got2 == values);
+}
+
+BOOST_AUTO_TEST_CASE( test_round_trip ) {
+  BOOST_TEST_MESSAGE("varint decoder: " << compact::varintDecoderName());
+  checkRoundTrip<int32_t>(&TCompactProtocol::writeI32,
+                          &TCompactProtocol::writeI32s,
+                          &TCompactProtocol::readI32s);
+  checkRoundTrip<int64_t>(&TCompactProtocol::writeI64,
+                          &TCompactProtocol::writeI64s,
+                          &TCompactProtocol::readI64s);
+}
+
+BOOST_AUTO_TEST_CASE( test_buffered_in_place ) {
+  std::vector<int64_t> values = sampleValues<int64_t>();
+  shared_ptr<TMemoryBuffer> expected(new TMemoryBuffer());
+  TCompactProtocol expectedProto(expected);
+  for (size_t i = 0; i < values.size(); ++i) {
+    expectedProto.writeI64(values[i]);
+    expectedProto.writeI32(static_cast<int32_t>(values[i]));
+  }
+
+  // Encoded in place into a small write buffer, which keeps filling up
+  // partway through a varint, so the copying path is taken too
+  shared_ptr<TMemoryBuffer> out(new TMemoryBuffer());
+  shared_ptr<TBufferedTransport> writeBuffer(new TBufferedTransport(out, 64, 23));
+  TCompactProtocolT<TBufferBase> writeProto(writeBuffer);
+  for (size_t i = 0; i < values.size(); ++i) {
+    writeProto.writeI64(values[i]);
+    writeProto.writeI32(static_cast<int32_t>(values[i]));
+  }
+  writeBuffer->flush();
+  BOOST_CHECK(out->getBufferAsString() == expected->getBufferAsString());
+
+  // And read back through a small read buffer, one at a time
+  shared_ptr<TBufferedTransport> readBuffer(new TBufferedTransport(out, 23));
+  TCompactProtocolT<TBufferBase> readProto(readBuffer);
+  for (size_t i = 0; i < values.size(); ++i) {
+    int64_t i64;
+    int32_t i32;
+    readProto.readI64(i64);
+    readProto.readI32(i32);
+    BOOST_CHECK_EQUAL(i64, values[i]);
+    BOOST_CHECK_EQUAL(i32, static_cast<int32_t>(values[i]));
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_stops_at_truncated_varint ) {
+  std::vector<int32_t> values = sampleValues<int32_t>();
+  values.push_back(1 << 20);
+  std::vector<uint8_t> buf(values.size() * 5);
+  uint32_t len = compact::encodeZigzag32(&values[0],
+                                         static_cast<uint32_t>(values.size()),
+                                         &buf[0]);
+
+  // Drop the last byte of the final, four byte, value
+  std::vector<int32_t> got(values.size());
+  uint32_t consumed = 0;
+  uint32_t count = compact::decodeZigzag32(&buf[0], len - 1, &got[0],
+                                           static_cast<uint32_t>(got.size()),
+                                           &consumed);
+  BOOST_CHECK_EQUAL(count, values.size() - 1);
+  BOOST_CHECK_EQUAL(consumed, len - 4);
+  BOOST_CHECK(std::equal(got.begin(), got.begin() + count, values.begin()));
+}
+
+BOOST_AUTO_TEST_CASE( test_varint_too_long ) {
+  // Long enough for the block decoder, with an 11 byte varint in the middle
+  std::vector<uint8_t> buf(64, 0x02);
+  for (int i = 8; i < 19; ++i) {
+    buf[i] = 0x80;
+  }
+  std::vector<int64_t> out(64);
+  uint32_t consumed;
+  BOOST_CHECK_THROW(compact::decodeZigzag64(&buf[0], static_cast<uint32_t>(buf.size()),
+                                            &out[0], 64, &consumed),
+                    TProtocolException);
+  // And again where only the one at a time decoder sees it
+  BOOST_CHECK_THROW(compact::decodeZigzag64(&buf[8], 12, &out[0], 64, &consumed),
+                    TProtocolException);
+  // And when a single read finds it at the end of the buffer
+  shared_ptr<TMemoryBuffer> tail(new TMemoryBuffer(&buf[8], 12));
+  TCompactProtocolT<TMemoryBuffer> tailProto(tail);
+  int64_t i64;
+  BOOST_CHECK_THROW(tailProto.readI64(i64), TProtocolException);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,294 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thrift/server/TCompletionServer.h>
+#include <thrift/transport/PlatformSocket.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TCompletionServerTest )
+
+using apache::thrift::TProcessor;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::server::TCompletionServer;
+using apache::thrift::server::TServerEventHandler;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransport;
+using boost::shared_ptr;
+
+// Answers every frame with its own bytes, and throws for "throw"
+class EchoProcessor : public TProcessor {
+ public:
+  virtual bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out, void*) {
+    std::string frame;
+    uint8_t buf[256];
+    uint32_t got;
+    while ((got = in->getTransport()->read(buf, sizeof(buf))) > 0) {
+      frame.append(reinterpret_cast<const char*>(buf), got);
+    }
+    if (frame == "throw") {
+      throw std::runtime_error("asked to");
+    }
+    out->getTransport()->write(reinterpret_cast<const uint8_t*>(frame.data()),
+                               static_cast<uint32_t>(frame.size()));
+    return true;
+  }
+};
+
+// Counts the connection contexts made and freed
+class ContextCounter : public TServerEventHandler {
+ public:
+  ContextCounter() : created(0), deleted(0) {}
+
+  virtual void* createContext(shared_ptr<TProtocol>, shared_ptr<TProtocol>) {
+    ++created;
+    return NULL;
+  }
+
+  virtual void deleteContext(void*, shared_ptr<TProtocol>, shared_ptr<TProtocol>) {
+    ++deleted;
+  }
+
+  int created;
+  int deleted;
+};
+
+// A server whose operations never reach a kernel; the test completes them,
+// as the ring or the completion port would
+class FakeServer : public TCompletionServer {
+ public:
+  using TCompletionServer::Connection;
+
+  FakeServer() :
+    TCompletionServer(shared_ptr<TProcessor>(new EchoProcessor)),
+    recvs(0),
+    sends(0),
+    cancels(0) {
+    serverName_ = "FakeServer";
+  }
+
+  void serve() {}
+
+  Connection* connect() {
+    Connection* conn = new Connection();
+    conn->transport.reset(new TMemoryBuffer());
+    connections_.insert(conn);
+    startConnection(conn);
+    return conn;
+  }
+
+  // The receive queued on conn completes with data, or with the end of
+  // the stream if data is empty
+  void completeRecv(Connection* conn, const std::string& data) {
+    BOOST_REQUIRE(conn->recvArmed);
+    conn->recvArmed = false;
+    if (completed(conn)) {
+      if (data.empty()) {
+        closeConnection(conn);
+      } else {
+        received(conn, reinterpret_cast<const uint8_t*>(data.data()), data.size());
+      }
+    }
+  }
+
+  // The send queued on conn completes having sent bytes of what it was
+  // given, returning those bytes
+  std::string completeSend(Connection* conn, size_t bytes) {
+    BOOST_REQUIRE(conn->sending);
+    std::string data(reinterpret_cast<const char*>(&conn->out[conn->outPos]), bytes);
+    conn->sending = false;
+    if (completed(conn)) {
+      sent(conn, bytes);
+    }
+    return data;
+  }
+
+  // The whole of the send queued on conn completes
+  std::string completeSend(Connection* conn) {
+    BOOST_REQUIRE(conn->sending);
+    return completeSend(conn, conn->out.size() - conn->outPos);
+  }
+
+  // A receive queued along with a send, as TUringServer links one
+  void armRecv(Connection* conn) {
+    queueRecv(conn);
+  }
+
+  void close(Connection* conn) {
+    closeConnection(conn);
+  }
+
+  void closeAll() {
+    closeConnections();
+  }
+
+  size_t connectionCount() const {
+    return connections_.size();
+  }
+
+  int recvs;
+  int sends;
+  int cancels;
+
+ protected:
+  void queueRecv(Connection* conn) {
+    conn->recvArmed = true;
+    ++conn->inflight;
+    ++recvs;
+  }
+
+  void queueSend(Connection* conn) {
+    conn->sending = true;
+    ++conn->inflight;
+    ++sends;
+  }
+
+  void cancelConnection(Connection*) {
+    ++cancels;
+  }
+};
+
+static std::string frame(const std::string& payload) {
+  uint32_t size = htonl(static_cast<uint32_t>(payload.size()));
+  return std::string(reinterpret_cast<const char*>(&size), sizeof(size)) + payload;
+}
+
+BOOST_AUTO_TEST_CASE( test_split_frame ) {
+  FakeServer server;
+  FakeServer::Connection* conn = server.connect();
+  BOOST_CHECK_EQUAL(server.recvs, 1);
+
+  // A frame arriving a few bytes at a time is processed once it is whole,
+  // with another receive queued for each piece until then
+  std::string request = frame("hello");
+  server.completeRecv(conn, request.substr(0, 2));
+  server.completeRecv(conn, request.substr(2, 4));
+  BOOST_CHECK_EQUAL(server.sends, 0);
+  BOOST_CHECK_EQUAL(server.recvs, 3);
+  server.completeRecv(conn, request.substr(6));
+  BOOST_CHECK_EQUAL(server.sends, 1);
+
+  // A short send is followed by one of the rest, and then a receive
+  std::string response = server.completeSend(conn, 3);
+  BOOST_CHECK_EQUAL(server.sends, 2);
+  BOOST_CHECK(!conn->recvArmed);
+  response += server.completeSend(conn);
+  BOOST_CHECK_EQUAL(response, frame("hello"));
+  BOOST_CHECK(conn->recvArmed);
+  BOOST_CHECK(conn->out.empty());
+  BOOST_CHECK(conn->in.empty());
+
+  server.completeRecv(conn, "");
+  BOOST_CHECK_EQUAL(server.connectionCount(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_pipelined_frames ) {
+  FakeServer server;
+  FakeServer::Connection* conn = server.connect();
+
+  // Frames that arrive together go out together, and a partial frame
+  // behind them waits for the rest
+  std::string third = frame("three");
+  server.completeRecv(conn, frame("one") + frame("two") + third.substr(0, 5));
+  BOOST_CHECK_EQUAL(server.sends, 1);
+  BOOST_CHECK_EQUAL(conn->in.size(), 5u);
+
+  // Nothing more is processed until the send is done
+  server.armRecv(conn);
+  server.completeRecv(conn, third.substr(5));
+  BOOST_CHECK_EQUAL(server.sends, 1);
+  BOOST_CHECK_EQUAL(server.completeSend(conn), frame("one") + frame("two"));
+  BOOST_CHECK_EQUAL(server.completeSend(conn), frame("three"));
+
+  server.close(conn);
+  BOOST_CHECK_EQUAL(server.connectionCount(), 1u);
+  server.completeRecv(conn, "");
+  BOOST_CHECK_EQUAL(server.connectionCount(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_no_response ) {
+  FakeServer server;
+  FakeServer::Connection* conn = server.connect();
+
+  // A call that writes nothing, as a oneway one does, sends nothing
+  server.completeRecv(conn, frame(""));
+  BOOST_CHECK_EQUAL(server.sends, 0);
+  BOOST_CHECK(conn->recvArmed);
+  BOOST_CHECK_EQUAL(server.recvs, 2);
+
+  server.completeRecv(conn, "");
+}
+
+BOOST_AUTO_TEST_CASE( test_frame_too_large ) {
+  FakeServer server;
+  server.setMaxFrameSize(4);
+  FakeServer::Connection* conn = server.connect();
+
+  server.completeRecv(conn, frame("four"));
+  BOOST_CHECK_EQUAL(server.completeSend(conn), frame("four"));
+  server.completeRecv(conn, frame("five!"));
+  BOOST_CHECK_EQUAL(server.sends, 1);
+  BOOST_CHECK_EQUAL(server.cancels, 1);
+  BOOST_CHECK_EQUAL(server.connectionCount(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_processor_throws ) {
+  FakeServer server;
+  FakeServer::Connection* conn = server.connect();
+
+  server.completeRecv(conn, frame("throw"));
+  BOOST_CHECK_EQUAL(server.sends, 0);
+  BOOST_CHECK_EQUAL(server.connectionCount(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_close_in_flight ) {
+  shared_ptr<ContextCounter> counter(new ContextCounter);
+  FakeServer server;
+  server.setServerEventHandler(counter);
+
+  FakeServer::Connection* quiet = server.connect();
+  FakeServer::Connection* busy = server.connect();
+  BOOST_CHECK_EQUAL(counter->created, 2);
+
+  // A connection with a send and a receive queued is freed only once both
+  // have completed, and nothing is processed in the meantime
+  server.completeRecv(busy, frame("a"));
+  server.armRecv(busy);
+  server.close(busy);
+  server.close(busy);
+  BOOST_CHECK_EQUAL(server.cancels, 1);
+  server.completeRecv(busy, frame("b"));
+  BOOST_CHECK_EQUAL(server.connectionCount(), 2u);
+  BOOST_CHECK_EQUAL(counter->deleted, 0);
+  server.completeSend(busy);
+  BOOST_CHECK_EQUAL(server.connectionCount(), 1u);
+  BOOST_CHECK_EQUAL(counter->deleted, 1);
+  BOOST_CHECK_EQUAL(server.sends, 1);
+
+  // As serve() does when stopping
+  server.closeAll();
+  server.completeRecv(quiet, "");
+  BOOST_CHECK_EQUAL(server.connectionCount(), 0u);
+  BOOST_CHECK_EQUAL(counter->deleted, 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
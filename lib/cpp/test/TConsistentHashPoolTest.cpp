@@ -0,0 +1,202 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <thrift/transport/TConsistentHashPool.h>
+#include <thrift/transport/TTransportException.h>
+
+BOOST_AUTO_TEST_SUITE( TConsistentHashPoolTest )
+
+using apache::thrift::transport::TConsistentHashPool;
+using apache::thrift::transport::TSocket;
+using apache::thrift::transport::TSocketPoolServer;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+// Listens on an ephemeral loopback port; connections just queue up
+static int listenOnLoopback(int* port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  BOOST_REQUIRE(fd >= 0);
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  BOOST_REQUIRE(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+  BOOST_REQUIRE(listen(fd, 16) == 0);
+  socklen_t len = sizeof(addr);
+  BOOST_REQUIRE(getsockname(fd, (struct sockaddr*)&addr, &len) == 0);
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+static std::string keyName(int i) {
+  std::ostringstream key;
+  key << "user:" << i;
+  return key.str();
+}
+
+// The port of each key's server
+static std::map<std::string, int> owners(const TConsistentHashPool& pool, int keys) {
+  std::map<std::string, int> owners;
+  for (int i = 0; i < keys; ++i) {
+    owners[keyName(i)] = pool.getServer(keyName(i))->port_;
+  }
+  return owners;
+}
+
+BOOST_AUTO_TEST_CASE( test_spread ) {
+  std::vector<std::pair<std::string, int> > servers;
+  for (int port = 9001; port <= 9005; ++port) {
+    servers.push_back(std::make_pair(std::string("cache"), port));
+  }
+  TConsistentHashPool pool(servers);
+  BOOST_CHECK_EQUAL(pool.getNumServers(), 5u);
+
+  std::map<int, int> counts;
+  std::map<std::string, int> before = owners(pool, 10000);
+  for (std::map<std::string, int>::iterator it = before.begin(); it != before.end(); ++it) {
+    ++counts[it->second];
+  }
+  BOOST_CHECK_EQUAL(counts.size(), 5u);
+  for (std::map<int, int>::iterator it = counts.begin(); it != counts.end(); ++it) {
+    BOOST_CHECK(it->second > 1200 && it->second < 2800);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_rebalance ) {
+  std::vector<std::pair<std::string, int> > servers;
+  for (int port = 9001; port <= 9005; ++port) {
+    servers.push_back(std::make_pair(std::string("cache"), port));
+  }
+  TConsistentHashPool pool(servers);
+  std::map<std::string, int> before = owners(pool, 10000);
+
+  // Only keys the new server takes move
+  pool.addServer("cache", 9006);
+  std::map<std::string, int> after = owners(pool, 10000);
+  int moved = 0;
+  for (std::map<std::string, int>::iterator it = before.begin(); it != before.end(); ++it) {
+    if (after[it->first] != it->second) {
+      BOOST_CHECK_EQUAL(after[it->first], 9006);
+      ++moved;
+    }
+  }
+  BOOST_CHECK(moved > 1000 && moved < 2500);
+
+  // And go back when it goes
+  pool.removeServer("cache", 9006);
+  BOOST_CHECK(owners(pool, 10000) == before);
+
+  // Removing another only moves its own keys
+  pool.removeServer("cache", 9003);
+  after = owners(pool, 10000);
+  for (std::map<std::string, int>::iterator it = before.begin(); it != before.end(); ++it) {
+    if (it->second != 9003) {
+      BOOST_CHECK_EQUAL(after[it->first], it->second);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_bounded_load ) {
+  int ports[3];
+  int fds[3];
+  std::vector<std::pair<std::string, int> > servers;
+  for (int i = 0; i < 3; ++i) {
+    fds[i] = listenOnLoopback(&ports[i]);
+    servers.push_back(std::make_pair(std::string("127.0.0.1"), ports[i]));
+  }
+  TConsistentHashPool pool(servers);
+  int owner = pool.getServer("hot")->port_;
+
+  // Without a bound a hot key only ever goes to its owner
+  pool.setLoadFactor(0);
+  std::vector<shared_ptr<TSocket> > sockets;
+  for (int i = 0; i < 6; ++i) {
+    sockets.push_back(pool.acquire("hot"));
+    BOOST_CHECK_EQUAL(sockets.back()->getPort(), owner);
+  }
+  for (size_t i = 0; i < sockets.size(); ++i) {
+    pool.release(sockets[i]);
+  }
+  sockets.clear();
+  BOOST_CHECK_EQUAL(pool.getNumActive(), 0u);
+
+  // With one, no server takes more than its share
+  pool.setLoadFactor(1.0);
+  std::map<int, int> load;
+  for (int i = 0; i < 6; ++i) {
+    sockets.push_back(pool.acquire("hot"));
+    ++load[sockets.back()->getPort()];
+  }
+  BOOST_CHECK_EQUAL(load.size(), 3u);
+  BOOST_CHECK_EQUAL(load[owner], 2);
+  BOOST_CHECK_EQUAL(pool.getNumActive(), 6u);
+
+  // The owner gets the key back once it has room
+  pool.release(sockets[0]);
+  shared_ptr<TSocket> socket = pool.acquire("hot");
+  BOOST_CHECK_EQUAL(socket->getPort(), owner);
+  pool.release(socket);
+  for (size_t i = 1; i < sockets.size(); ++i) {
+    pool.release(sockets[i]);
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    close(fds[i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_down ) {
+  int ports[2];
+  int fds[2];
+  std::vector<shared_ptr<TSocketPoolServer> > servers;
+  for (int i = 0; i < 2; ++i) {
+    fds[i] = listenOnLoopback(&ports[i]);
+    servers.push_back(shared_ptr<TSocketPoolServer>(new TSocketPoolServer("127.0.0.1", ports[i])));
+  }
+  TConsistentHashPool pool(servers);
+  pool.setMaxConsecutiveFailures(0);
+
+  // A key whose server is down goes to the next one along the ring
+  std::string key;
+  for (int i = 0; key.empty(); ++i) {
+    if (pool.getServer(keyName(i))->port_ == ports[0]) {
+      key = keyName(i);
+    }
+  }
+  close(fds[0]);
+  shared_ptr<TSocket> socket = pool.acquire(key);
+  BOOST_CHECK_EQUAL(socket->getPort(), ports[1]);
+  BOOST_CHECK(servers[0]->lastFailTime_ > 0);
+  pool.release(socket, false);
+
+  close(fds[1]);
+  BOOST_CHECK_THROW(pool.acquire(key), TTransportException);
+  BOOST_CHECK_EQUAL(pool.getNumActive(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,232 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <deque>
+#include <stdexcept>
+#include <thrift/TApplicationException.h>
+#include <thrift/async/TAsyncProtocolProcessor.h>
+#include <thrift/async/TCoroutine.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "Calculator.h"
+
+BOOST_AUTO_TEST_SUITE( TCoroutineTest )
+
+using apache::thrift::TApplicationException;
+using apache::thrift::async::TAsyncChannel;
+using apache::thrift::async::TAsyncProtocolProcessor;
+using apache::thrift::async::TCoroutineFramePool;
+using apache::thrift::async::TTask;
+using apache::thrift::async::startTask;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::test::coro::CalculatorCobClient;
+using apache::thrift::test::coro::CalculatorAsyncProcessor;
+using apache::thrift::test::coro::CalculatorCoroSvAdapter;
+using apache::thrift::test::coro::CalculatorCoroSvIf;
+using apache::thrift::test::coro::Oops;
+using boost::shared_ptr;
+
+// Hands each request to an async processor in the same thread, and its
+// response back when the test runs the channel, as an event loop would
+class LoopbackChannel : public TAsyncChannel {
+ public:
+  explicit LoopbackChannel(const shared_ptr<TAsyncProtocolProcessor>& processor)
+    : processor_(processor) {}
+
+  virtual bool good() const { return true; }
+  virtual bool error() const { return false; }
+  virtual bool timedOut() const { return false; }
+
+  virtual void sendMessage(const VoidCallback& cob, TMemoryBuffer* message) {
+    (void)message;
+    ready_.push_back(cob);
+  }
+
+  virtual void recvMessage(const VoidCallback& cob, TMemoryBuffer* message) {
+    (void)cob;
+    (void)message;
+    throw TApplicationException("LoopbackChannel: recvMessage");
+  }
+
+  virtual void sendAndRecvMessage(const VoidCallback& cob,
+                                  TMemoryBuffer* sendBuf,
+                                  TMemoryBuffer* recvBuf) {
+    std::string request = sendBuf->getBufferAsString();
+    shared_ptr<TMemoryBuffer> ibuf(new TMemoryBuffer);
+    ibuf->write(reinterpret_cast<const uint8_t*>(request.data()),
+                static_cast<uint32_t>(request.size()));
+    shared_ptr<TMemoryBuffer> obuf(new TMemoryBuffer);
+    processor_->process(
+        [this, cob, obuf, recvBuf](bool healthy) {
+          BOOST_CHECK(healthy);
+          recvBuf->resetBuffer();
+          std::string response = obuf->getBufferAsString();
+          recvBuf->write(reinterpret_cast<const uint8_t*>(response.data()),
+                         static_cast<uint32_t>(response.size()));
+          ready_.push_back(cob);
+        },
+        ibuf,
+        obuf);
+  }
+
+  // Delivers the responses ready, returning how many
+  size_t run() {
+    size_t n = 0;
+    while (!ready_.empty()) {
+      VoidCallback cob = ready_.front();
+      ready_.pop_front();
+      cob();
+      ++n;
+    }
+    return n;
+  }
+
+ private:
+  shared_ptr<TAsyncProtocolProcessor> processor_;
+  std::deque<VoidCallback> ready_;
+};
+
+// Holds the coroutines awaiting it until opened
+class Gate {
+ public:
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> awaiting) { waiting_.push_back(awaiting); }
+  void await_resume() const noexcept {}
+
+  void open() {
+    std::deque<std::coroutine_handle<> > waiting;
+    waiting.swap(waiting_);
+    for (size_t i = 0; i < waiting.size(); ++i) {
+      waiting[i].resume();
+    }
+  }
+
+  size_t waiting() const { return waiting_.size(); }
+
+ private:
+  std::deque<std::coroutine_handle<> > waiting_;
+};
+
+class Handler : public CalculatorCoroSvIf {
+ public:
+  virtual TTask<int32_t> add(int32_t a, int32_t b) {
+    co_await gate;
+    co_return a + b;
+  }
+
+  virtual TTask<std::string> echo(std::string s) { co_return s; }
+
+  virtual TTask<void> fail(std::string why) {
+    if (why == "declared") {
+      Oops oops;
+      oops.why = why;
+      throw oops;
+    }
+    throw std::runtime_error(why);
+    co_return;
+  }
+
+  Gate gate;
+};
+
+// Lets the test see the client's frame pool
+class Client : public CalculatorCobClient {
+ public:
+  Client(const shared_ptr<TAsyncChannel>& channel, TBinaryProtocolFactory* protocolFactory)
+    : CalculatorCobClient(channel, protocolFactory) {}
+
+  const TCoroutineFramePool& getFramePool() const { return framePool_; }
+};
+
+struct Fixture {
+  Fixture()
+    : handler(new Handler),
+      channel(new LoopbackChannel(shared_ptr<TAsyncProtocolProcessor>(new TAsyncProtocolProcessor(
+          shared_ptr<CalculatorAsyncProcessor>(new CalculatorAsyncProcessor(
+              shared_ptr<CalculatorCoroSvAdapter>(new CalculatorCoroSvAdapter(handler)))),
+          shared_ptr<TBinaryProtocolFactory>(new TBinaryProtocolFactory))))) {}
+
+  shared_ptr<Handler> handler;
+  shared_ptr<LoopbackChannel> channel;
+  TBinaryProtocolFactory protocolFactory;
+};
+
+BOOST_FIXTURE_TEST_CASE( test_calls, Fixture ) {
+  Client adder(channel, &protocolFactory);
+  Client echoer(channel, &protocolFactory);
+
+  // A handler suspended in one call holds up no other
+  int32_t sum = 0;
+  std::string echoed;
+  startTask(adder.co_add(1, 2), [&sum](int32_t result) { sum = result; });
+  startTask(echoer.co_echo("hello"), [&echoed](const std::string& result) { echoed = result; });
+  BOOST_CHECK_EQUAL(handler->gate.waiting(), 1u);
+  BOOST_CHECK_EQUAL(channel->run(), 1u);
+  BOOST_CHECK_EQUAL(echoed, "hello");
+  BOOST_CHECK_EQUAL(sum, 0);
+
+  handler->gate.open();
+  BOOST_CHECK_EQUAL(channel->run(), 1u);
+  BOOST_CHECK_EQUAL(sum, 3);
+
+  // The client makes one call after another, its frames reused
+  size_t frames = adder.getFramePool().getNumFree();
+  BOOST_CHECK_GT(frames, 0u);
+  BOOST_CHECK_EQUAL(adder.getFramePool().getNumAllocated(), 0u);
+  startTask(adder.co_add(20, 22), [&sum](int32_t result) { sum = result; });
+  handler->gate.open();
+  channel->run();
+  BOOST_CHECK_EQUAL(sum, 42);
+  BOOST_CHECK_EQUAL(adder.getFramePool().getNumFree(), frames);
+
+  // The handlers' frames all went back to this thread's pool
+  BOOST_CHECK_EQUAL(TCoroutineFramePool::current()->getNumAllocated(), 0u);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_exceptions, Fixture ) {
+  Client client(channel, &protocolFactory);
+  std::string caught;
+  auto noResult = []() { BOOST_ERROR("no exception"); };
+
+  // A declared exception reaches the caller as itself...
+  startTask(client.co_fail("declared"), noResult, [&caught](std::exception_ptr error) {
+    try {
+      std::rethrow_exception(error);
+    } catch (const Oops& oops) {
+      caught = "Oops " + oops.why;
+    }
+  });
+  channel->run();
+  BOOST_CHECK_EQUAL(caught, "Oops declared");
+
+  // ...and any other as a TApplicationException
+  startTask(client.co_fail("undeclared"), noResult, [&caught](std::exception_ptr error) {
+    try {
+      std::rethrow_exception(error);
+    } catch (const TApplicationException& x) {
+      caught = x.what();
+    }
+  });
+  channel->run();
+  BOOST_CHECK_EQUAL(caught, "undeclared");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
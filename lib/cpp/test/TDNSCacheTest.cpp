@@ -0,0 +1,164 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/transport/TDNSCache.h>
+#include <thrift/transport/TTransportException.h>
+
+BOOST_AUTO_TEST_SUITE( TDNSCacheTest )
+
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Util;
+using apache::thrift::transport::TDNSCache;
+using apache::thrift::transport::TResolvedAddress;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+BOOST_AUTO_TEST_CASE( test_resolve ) {
+  TDNSCache cache(3600);
+  std::vector<TResolvedAddress> addresses;
+
+  cache.resolve("127.0.0.1", 9090, addresses);
+  BOOST_REQUIRE_EQUAL(addresses.size(), 1u);
+  BOOST_CHECK_EQUAL(addresses[0].family, AF_INET);
+  BOOST_CHECK_EQUAL(addresses[0].addrlen, sizeof(sockaddr_in));
+  BOOST_CHECK_EQUAL(ntohs(((sockaddr_in*)&addresses[0].addr)->sin_port), 9090);
+  BOOST_CHECK_EQUAL(cache.size(), 1u);
+
+  // Hits don't add entries; other ports do
+  cache.resolve("127.0.0.1", 9090, addresses);
+  BOOST_CHECK_EQUAL(cache.size(), 1u);
+  cache.resolve("127.0.0.1", 9091, addresses);
+  BOOST_CHECK_EQUAL(cache.size(), 2u);
+
+  cache.invalidate("127.0.0.1", 9090);
+  BOOST_CHECK_EQUAL(cache.size(), 1u);
+  cache.clear();
+  BOOST_CHECK_EQUAL(cache.size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_unresolvable ) {
+  TDNSCache cache;
+  std::vector<TResolvedAddress> addresses;
+  BOOST_CHECK_THROW(cache.resolve("no such host.invalid", 9090, addresses),
+                    TTransportException);
+  BOOST_CHECK_EQUAL(cache.size(), 0u);
+}
+
+// A cache whose entries can be planted, and looked at
+class SeededDNSCache : public TDNSCache {
+ public:
+  explicit SeededDNSCache(int ttlSeconds) : TDNSCache(ttlSeconds) {}
+
+  // Caches a single address for host and port, expiring at expires
+  void seed(const std::string& host, int port, uint16_t addressPort, time_t expires) {
+    TResolvedAddress address;
+    std::memset(&address, 0, sizeof(address));
+    sockaddr_in* sin = (sockaddr_in*)&address.addr;
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(addressPort);
+    sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.family = AF_INET;
+    address.socktype = SOCK_STREAM;
+    address.addrlen = sizeof(sockaddr_in);
+
+    Guard g(monitor_.mutex());
+    Entry& entry = entries_[makeKey(host, port)];
+    entry.host = host;
+    entry.port = port;
+    entry.addresses.assign(1, address);
+    entry.expires = expires;
+  }
+
+  // The port of the first cached address for host and port
+  int cachedPort(const std::string& host, int port) {
+    Guard g(monitor_.mutex());
+    std::map<std::string, Entry>::iterator it = entries_.find(makeKey(host, port));
+    if (it == entries_.end() || it->second.addresses.empty()) {
+      return -1;
+    }
+    return ntohs(((sockaddr_in*)&it->second.addresses[0].addr)->sin_port);
+  }
+};
+
+BOOST_AUTO_TEST_CASE( test_expiry ) {
+  SeededDNSCache cache(3600);
+  std::vector<TResolvedAddress> addresses;
+
+  // Until it expires the cached address is used, right or not...
+  cache.seed("127.0.0.1", 9090, 1, time(NULL) + 3600);
+  cache.resolve("127.0.0.1", 9090, addresses);
+  BOOST_REQUIRE_EQUAL(addresses.size(), 1u);
+  BOOST_CHECK_EQUAL(ntohs(((sockaddr_in*)&addresses[0].addr)->sin_port), 1);
+
+  // ...and then the name is resolved again
+  cache.seed("127.0.0.1", 9090, 1, time(NULL) - 1);
+  cache.resolve("127.0.0.1", 9090, addresses);
+  BOOST_REQUIRE_EQUAL(addresses.size(), 1u);
+  BOOST_CHECK_EQUAL(ntohs(((sockaddr_in*)&addresses[0].addr)->sin_port), 9090);
+  BOOST_CHECK_EQUAL(cache.cachedPort("127.0.0.1", 9090), 9090);
+}
+
+BOOST_AUTO_TEST_CASE( test_refresh ) {
+  SeededDNSCache cache(3600);
+
+  // Entries about to expire are resolved again, others are left alone
+  cache.seed("127.0.0.1", 9090, 1, time(NULL));
+  cache.seed("127.0.0.1", 9091, 1, time(NULL) + 3600);
+  cache.refresh();
+  BOOST_CHECK_EQUAL(cache.cachedPort("127.0.0.1", 9090), 9090);
+  BOOST_CHECK_EQUAL(cache.cachedPort("127.0.0.1", 9091), 1);
+
+  // A name that no longer resolves keeps what it had
+  cache.seed("no such host.invalid", 9090, 1, time(NULL));
+  cache.refresh();
+  BOOST_CHECK_EQUAL(cache.cachedPort("no such host.invalid", 9090), 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_refresher ) {
+  SeededDNSCache cache(3600);
+  shared_ptr<PlatformThreadFactory> factory(new PlatformThreadFactory);
+  factory->setDetached(false);
+  BOOST_CHECK_THROW(cache.startRefresher(factory, 0), TTransportException);
+
+  cache.seed("127.0.0.1", 9090, 1, time(NULL));
+  cache.startRefresher(factory, 10);
+  // Starting it again is harmless
+  cache.startRefresher(factory, 10);
+  int64_t deadline = Util::monotonicTime() + 5000;
+  while (cache.cachedPort("127.0.0.1", 9090) != 9090 && Util::monotonicTime() < deadline) {
+    THRIFT_SLEEP_USEC(1000);
+  }
+  BOOST_CHECK_EQUAL(cache.cachedPort("127.0.0.1", 9090), 9090);
+  cache.stopRefresher();
+  cache.stopRefresher();
+
+  // The cache stops a refresher still running when it goes
+  SeededDNSCache* running = new SeededDNSCache(3600);
+  running->startRefresher(factory, 10);
+  delete running;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
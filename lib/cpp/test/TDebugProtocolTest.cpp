@@ -0,0 +1,188 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <string>
+#include <thrift/protocol/TDebugProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TDebugProtocolTest )
+
+using apache::thrift::ThriftDebugString;
+using apache::thrift::protocol::TDebugProtocol;
+using apache::thrift::protocol::T_I32;
+using apache::thrift::protocol::T_LIST;
+using apache::thrift::protocol::T_STRING;
+using apache::thrift::protocol::T_STRUCT;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+// Written out the way generated code would
+struct Leaf {
+  int32_t x;
+
+  template <class Protocol_>
+  uint32_t write(Protocol_* oprot) const {
+    uint32_t xfer = 0;
+    xfer += oprot->writeStructBegin("Leaf");
+    xfer += oprot->writeFieldBegin("x", T_I32, 1);
+    xfer += oprot->writeI32(x);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldStop();
+    xfer += oprot->writeStructEnd();
+    return xfer;
+  }
+};
+
+struct Tree {
+  std::string name;
+  Leaf leaf;
+  int32_t n;
+
+  template <class Protocol_>
+  uint32_t write(Protocol_* oprot) const {
+    uint32_t xfer = 0;
+    xfer += oprot->writeStructBegin("Tree");
+    xfer += oprot->writeFieldBegin("name", T_STRING, 1);
+    xfer += oprot->writeString(name);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("leaf", T_STRUCT, 2);
+    xfer += leaf.write(oprot);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("leaves", T_LIST, 3);
+    xfer += oprot->writeListBegin(T_STRUCT, 2);
+    xfer += leaf.write(oprot);
+    xfer += leaf.write(oprot);
+    xfer += oprot->writeListEnd();
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("n", T_I32, 4);
+    xfer += oprot->writeI32(n);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldStop();
+    xfer += oprot->writeStructEnd();
+    return xfer;
+  }
+};
+
+static Tree makeTree() {
+  Tree t;
+  t.name = "a\"b\n";
+  t.leaf.x = -7;
+  t.n = 42;
+  return t;
+}
+
+BOOST_AUTO_TEST_CASE( test_sinks_agree ) {
+  Tree t = makeTree();
+
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TDebugProtocol transportProtocol(buffer);
+  t.write(&transportProtocol);
+
+  std::string str = ThriftDebugString(t);
+  BOOST_CHECK_EQUAL(str, buffer->getBufferAsString());
+  BOOST_CHECK_EQUAL(str,
+      "Tree {\n"
+      "  01: name (string) = \"a\\\"b\\n\",\n"
+      "  02: leaf (struct) = Leaf {\n"
+      "    01: x (i32) = -7,\n"
+      "  },\n"
+      "  03: leaves (list) = list<struct>[2] {\n"
+      "    [0] = Leaf {\n"
+      "      01: x (i32) = -7,\n"
+      "    },\n"
+      "    [1] = Leaf {\n"
+      "      01: x (i32) = -7,\n"
+      "    },\n"
+      "  },\n"
+      "  04: n (i32) = 42,\n"
+      "}");
+
+  char buf[1024];
+  uint32_t len = ThriftDebugString(t, buf, sizeof(buf));
+  BOOST_CHECK_EQUAL(len, str.size());
+  BOOST_CHECK_EQUAL(std::string(buf), str);
+}
+
+BOOST_AUTO_TEST_CASE( test_depth_limit ) {
+  Tree t = makeTree();
+  char buf[1024];
+  ThriftDebugString(t, buf, sizeof(buf), 1);
+  BOOST_CHECK_EQUAL(std::string(buf),
+      "Tree {\n"
+      "  01: name (string) = \"a\\\"b\\n\",\n"
+      "  02: leaf (struct) = Leaf {...},\n"
+      "  03: leaves (list) = list<struct>[2] {...},\n"
+      "  04: n (i32) = 42,\n"
+      "}");
+}
+
+BOOST_AUTO_TEST_CASE( test_length_limit ) {
+  Tree t = makeTree();
+  std::string full = ThriftDebugString(t);
+
+  char buf[21];
+  std::memset(buf, 'z', sizeof(buf));
+  uint32_t len = ThriftDebugString(t, buf, sizeof(buf));
+  BOOST_CHECK_EQUAL(len, 20u);
+  BOOST_CHECK_EQUAL(std::string(buf), full.substr(0, 17) + "...");
+
+  // Too small for the whole marker
+  len = ThriftDebugString(t, buf, 3);
+  BOOST_CHECK_EQUAL(len, 2u);
+  BOOST_CHECK_EQUAL(std::string(buf), "..");
+
+  len = ThriftDebugString(t, buf, 1);
+  BOOST_CHECK_EQUAL(len, 0u);
+  BOOST_CHECK_EQUAL(buf[0], '\0');
+
+  // The same limit applies when writing to a transport
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  TDebugProtocol protocol(buffer);
+  protocol.setLengthLimit(20);
+  t.write(&protocol);
+  BOOST_CHECK_EQUAL(protocol.getLength(), 23u);
+  BOOST_CHECK_EQUAL(buffer->getBufferAsString(), full.substr(0, 20) + "...");
+}
+
+BOOST_AUTO_TEST_CASE( test_long_strings ) {
+  // Long enough to flush the escape buffer several times
+  std::string s;
+  std::string escaped;
+  for (int i = 0; i < 200; ++i) {
+    s += "\x01q\t";
+    escaped += "\\x01q\\t";
+  }
+  // The first 16 characters
+  std::string prefix = escaped.substr(0, 5 * 7) + "\\x01";
+
+  std::string out;
+  TDebugProtocol protocol(&out);
+  protocol.setStringSizeLimit(1000);
+  protocol.writeString(s);
+  BOOST_CHECK_EQUAL(out, "\"" + escaped + "\"");
+
+  out.clear();
+  protocol.setStringSizeLimit(100);
+  protocol.writeString(s);
+  BOOST_CHECK_EQUAL(out, "\"" + prefix + "[...](600)\"");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,175 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <vector>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp/DeltaTest_types.h"
+
+BOOST_AUTO_TEST_SUITE( TDeltaTest )
+
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::test::delta::Player;
+using apache::thrift::test::delta::Position;
+using boost::shared_ptr;
+
+// Player and Position are generated from DeltaTest.thrift with the delta
+// option
+
+static std::string write(const Player& player) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  TBinaryProtocol protocol(buffer);
+  player.write(&protocol);
+  return buffer->getBufferAsString();
+}
+
+static std::string writeDelta(const Player& player) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  TBinaryProtocol protocol(buffer);
+  player.writeDelta(&protocol);
+  return buffer->getBufferAsString();
+}
+
+static void mergeDelta(Player& player, const std::string& delta) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer(
+      reinterpret_cast<uint8_t*>(const_cast<char*>(delta.data())),
+      static_cast<uint32_t>(delta.size())));
+  TBinaryProtocol protocol(buffer);
+  player.mergeDelta(&protocol);
+}
+
+static Player newPlayer() {
+  Player player;
+  player.__set_id(7);
+  player.__set_name("seven");
+  player.__set_score(100);
+  Position position;
+  position.x = 1;
+  position.y = 2;
+  player.__set_position(position);
+  std::vector<int32_t> items(50, 3);
+  player.__set_items(items);
+  return player;
+}
+
+BOOST_AUTO_TEST_CASE( test_delta ) {
+  // Everything a new struct's setters touched is in its first delta, which
+  // brings an empty replica level with it
+  Player source = newPlayer();
+  Player replica;
+  std::string delta = writeDelta(source);
+  BOOST_CHECK_EQUAL(delta, write(source));
+  mergeDelta(replica, delta);
+  BOOST_CHECK(replica == source);
+
+  // After clearDirty() only the fields set since are sent, and merged over
+  // the replica's others
+  source.clearDirty();
+  BOOST_CHECK_EQUAL(writeDelta(source).size(), 1u);
+  source.__set_score(250);
+  delta = writeDelta(source);
+  BOOST_CHECK_LT(delta.size(), write(source).size() / 10);
+  mergeDelta(replica, delta);
+  BOOST_CHECK_EQUAL(replica.score, 250);
+  BOOST_CHECK(replica == source);
+
+  // A field assigned directly is left out until marked by hand
+  source.clearDirty();
+  source.name = "eight";
+  BOOST_CHECK_EQUAL(writeDelta(source).size(), 1u);
+  source.__dirty.name = true;
+  mergeDelta(replica, writeDelta(source));
+  BOOST_CHECK_EQUAL(replica.name, "eight");
+
+  // A dirty nested struct is sent whole
+  source.clearDirty();
+  Position position = source.position;
+  position.y = 5;
+  source.__set_position(position);
+  mergeDelta(replica, writeDelta(source));
+  BOOST_CHECK_EQUAL(replica.position.x, 1);
+  BOOST_CHECK_EQUAL(replica.position.y, 5);
+  BOOST_CHECK(replica == source);
+
+  // Merging leaves the replica's own dirty flags alone
+  BOOST_CHECK(!replica.__dirty.score);
+  BOOST_CHECK(!replica.__dirty.position);
+}
+
+BOOST_AUTO_TEST_CASE( test_delta_required ) {
+  // A delta without the required id merges all the same, where read()
+  // refuses it
+  Player source = newPlayer();
+  source.clearDirty();
+  source.__set_name("renamed");
+  std::string delta = writeDelta(source);
+
+  Player replica = newPlayer();
+  mergeDelta(replica, delta);
+  BOOST_CHECK_EQUAL(replica.id, 7);
+  BOOST_CHECK_EQUAL(replica.name, "renamed");
+
+  Player whole;
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer(
+      reinterpret_cast<uint8_t*>(const_cast<char*>(delta.data())),
+      static_cast<uint32_t>(delta.size())));
+  TBinaryProtocol protocol(buffer);
+  BOOST_CHECK_THROW(whole.read(&protocol), apache::thrift::protocol::TProtocolException);
+}
+
+BOOST_AUTO_TEST_CASE( test_delta_optional ) {
+  Player source = newPlayer();
+  Player replica = newPlayer();
+  source.clearDirty();
+
+  // An optional field is sent once dirty and set...
+  source.__set_title("captain");
+  mergeDelta(replica, writeDelta(source));
+  BOOST_CHECK(replica.__isset.title);
+  BOOST_CHECK_EQUAL(replica.title, "captain");
+
+  // ...but a delta can't unset one
+  source.clearDirty();
+  source.__isset.title = false;
+  source.__dirty.title = true;
+  BOOST_CHECK_EQUAL(writeDelta(source).size(), 1u);
+  mergeDelta(replica, writeDelta(source));
+  BOOST_CHECK(replica.__isset.title);
+}
+
+BOOST_AUTO_TEST_CASE( test_delta_swap ) {
+  // The dirty flags go with the values swapped
+  Player a = newPlayer();
+  Player b = newPlayer();
+  b.clearDirty();
+  b.__set_score(1);
+  std::string aDelta = writeDelta(a);
+  std::string bDelta = writeDelta(b);
+  swap(a, b);
+  BOOST_CHECK_EQUAL(writeDelta(a), bDelta);
+  BOOST_CHECK_EQUAL(writeDelta(b), aDelta);
+  BOOST_CHECK(a.__dirty.score);
+  BOOST_CHECK(!a.__dirty.name);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
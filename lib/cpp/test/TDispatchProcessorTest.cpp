@@ -0,0 +1,260 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <vector>
+#include <thrift/TDispatchProcessor.h>
+#include <thrift/processor/TMultiplexedProcessor.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TProtocolDecorator.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TDispatchProcessorTest )
+
+using apache::thrift::TDispatchProcessorT;
+using apache::thrift::TMultiplexedProcessor;
+using apache::thrift::TProcessor;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TBinaryProtocolFactoryT;
+using apache::thrift::protocol::TBinaryProtocolT;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolDecoratorT;
+using apache::thrift::protocol::T_CALL;
+using apache::thrift::protocol::T_REPLY;
+using apache::thrift::transport::TBufferBase;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TSegmentedMemoryBuffer;
+using boost::shared_ptr;
+
+typedef TBinaryProtocolT<TBufferBase> BufferProtocol;
+
+// Replies to each call with its argument plus one, counting which path
+// the call came down
+class AddOneProcessor : public TDispatchProcessorT<BufferProtocol> {
+ public:
+  AddOneProcessor() : fast(0), slow(0) {}
+
+  int fast;
+  int slow;
+
+ protected:
+  bool dispatchCall(TProtocol* in, TProtocol* out, const std::string& fname,
+                    int32_t seqid, void*) {
+    ++slow;
+    return reply(in, out, fname, seqid);
+  }
+
+  bool dispatchCallTemplated(BufferProtocol* in, BufferProtocol* out,
+                             const std::string& fname, int32_t seqid, void*) {
+    ++fast;
+    return reply(in, out, fname, seqid);
+  }
+
+ private:
+  template <class Protocol_>
+  bool reply(Protocol_* in, Protocol_* out, const std::string& fname, int32_t seqid) {
+    int32_t value;
+    in->readI32(value);
+    in->readMessageEnd();
+    out->writeMessageBegin(fname, T_REPLY, seqid);
+    out->writeI32(value + 1);
+    out->writeMessageEnd();
+    return true;
+  }
+};
+
+static shared_ptr<TMemoryBuffer> call(const std::string& name, int32_t value) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TBinaryProtocol prot(buf);
+  prot.writeMessageBegin(name, T_CALL, 7);
+  prot.writeI32(value);
+  prot.writeMessageEnd();
+  return buf;
+}
+
+static void checkReply(const std::string& data, const std::string& name, int32_t value) {
+  shared_ptr<TMemoryBuffer> buf(
+    new TMemoryBuffer((uint8_t*)data.data(), (uint32_t)data.size()));
+  TBinaryProtocol prot(buf);
+  std::string fname;
+  TMessageType mtype;
+  int32_t seqid;
+  int32_t result;
+  prot.readMessageBegin(fname, mtype, seqid);
+  prot.readI32(result);
+  BOOST_CHECK_EQUAL(fname, name);
+  BOOST_CHECK_EQUAL(mtype, T_REPLY);
+  BOOST_CHECK_EQUAL(seqid, 7);
+  BOOST_CHECK_EQUAL(result, value);
+}
+
+BOOST_AUTO_TEST_CASE( test_mixed_buffers ) {
+  // A TMemoryBuffer in and a TSegmentedMemoryBuffer out, as under
+  // TNonblockingServer, share the TBufferBase path
+  TBinaryProtocolFactoryT<TBufferBase> factory;
+  shared_ptr<TSegmentedMemoryBuffer> obuf(new TSegmentedMemoryBuffer(64));
+  shared_ptr<TProtocol> in = factory.getProtocol(call("add", 41));
+  shared_ptr<TProtocol> out = factory.getProtocol(obuf);
+
+  AddOneProcessor processor;
+  BOOST_CHECK(processor.process(in, out, NULL));
+  BOOST_CHECK_EQUAL(processor.fast, 1);
+  BOOST_CHECK_EQUAL(processor.slow, 0);
+  checkReply(obuf->getBufferAsString(), "add", 42);
+}
+
+BOOST_AUTO_TEST_CASE( test_generic_protocol ) {
+  shared_ptr<TMemoryBuffer> obuf(new TMemoryBuffer());
+  shared_ptr<TProtocol> in(new TBinaryProtocol(call("add", 1)));
+  shared_ptr<TProtocol> out(new TBinaryProtocol(obuf));
+
+  AddOneProcessor processor;
+  BOOST_CHECK(processor.process(in, out, NULL));
+  BOOST_CHECK_EQUAL(processor.fast, 0);
+  BOOST_CHECK_EQUAL(processor.slow, 1);
+  checkReply(obuf->getBufferAsString(), "add", 2);
+}
+
+// Not the exact type, so only found by the dynamic_cast fallback
+class DerivedBufferProtocol : public BufferProtocol {
+ public:
+  explicit DerivedBufferProtocol(shared_ptr<TBufferBase> trans) : BufferProtocol(trans) {}
+};
+
+BOOST_AUTO_TEST_CASE( test_derived_protocol ) {
+  shared_ptr<TMemoryBuffer> obuf(new TMemoryBuffer());
+  shared_ptr<TProtocol> in(new DerivedBufferProtocol(call("add", 2)));
+  shared_ptr<TProtocol> out(new BufferProtocol(obuf));
+
+  AddOneProcessor processor;
+  BOOST_CHECK(processor.process(in, out, NULL));
+  BOOST_CHECK_EQUAL(processor.fast, 1);
+  BOOST_CHECK_EQUAL(processor.slow, 0);
+  checkReply(obuf->getBufferAsString(), "add", 3);
+}
+
+BOOST_AUTO_TEST_CASE( test_multiplexed ) {
+  // The service name is stripped without hiding the protocol's type
+  TBinaryProtocolFactoryT<TBufferBase> factory;
+  shared_ptr<TMemoryBuffer> obuf(new TMemoryBuffer());
+  shared_ptr<TProtocol> in = factory.getProtocol(call("Adder:add", 9));
+  shared_ptr<TProtocol> out = factory.getProtocol(obuf);
+
+  shared_ptr<AddOneProcessor> adder(new AddOneProcessor());
+  TMultiplexedProcessor processor;
+  processor.registerProcessor("Adder", adder);
+  BOOST_CHECK(processor.process(in, out, NULL));
+  BOOST_CHECK_EQUAL(adder->fast, 1);
+  BOOST_CHECK_EQUAL(adder->slow, 0);
+  checkReply(obuf->getBufferAsString(), "add", 10);
+}
+
+// A processor knowing nothing of processMessage() still gets the header
+class PlainProcessor : public TProcessor {
+ public:
+  bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out, void*) {
+    std::string fname;
+    TMessageType mtype;
+    int32_t seqid;
+    int32_t value;
+    in->readMessageBegin(fname, mtype, seqid);
+    in->readI32(value);
+    in->readMessageEnd();
+    out->writeMessageBegin(fname, T_REPLY, seqid);
+    out->writeI32(value * 2);
+    out->writeMessageEnd();
+    return true;
+  }
+};
+
+BOOST_AUTO_TEST_CASE( test_multiplexed_plain ) {
+  shared_ptr<TMemoryBuffer> obuf(new TMemoryBuffer());
+  shared_ptr<TProtocol> in(new TBinaryProtocol(call("Doubler:double", 5)));
+  shared_ptr<TProtocol> out(new TBinaryProtocol(obuf));
+
+  TMultiplexedProcessor processor;
+  processor.registerProcessor("Doubler", shared_ptr<TProcessor>(new PlainProcessor()));
+  BOOST_CHECK(processor.process(in, out, NULL));
+  checkReply(obuf->getBufferAsString(), "double", 10);
+}
+
+BOOST_AUTO_TEST_CASE( test_multiplexed_lookup ) {
+  TMultiplexedProcessor processor;
+  std::vector<shared_ptr<AddOneProcessor> > adders;
+  for (int i = 0; i < 20; ++i) {
+    adders.push_back(shared_ptr<AddOneProcessor>(new AddOneProcessor()));
+    processor.registerProcessor("Adder" + std::string(i, 'x'), adders.back());
+  }
+  // Registering a name again replaces its processor
+  shared_ptr<AddOneProcessor> replacement(new AddOneProcessor());
+  processor.registerProcessor("Adderxxx", replacement);
+
+  for (int i = 0; i < 20; ++i) {
+    shared_ptr<TMemoryBuffer> obuf(new TMemoryBuffer());
+    shared_ptr<TProtocol> in(new TBinaryProtocol(call("Adder" + std::string(i, 'x') + ":add", i)));
+    shared_ptr<TProtocol> out(new TBinaryProtocol(obuf));
+    BOOST_CHECK(processor.process(in, out, NULL));
+    checkReply(obuf->getBufferAsString(), "add", i + 1);
+  }
+  for (int i = 0; i < 20; ++i) {
+    BOOST_CHECK_EQUAL(adders[i]->slow, i == 3 ? 0 : 1);
+  }
+  BOOST_CHECK_EQUAL(replacement->slow, 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_multiplexed_bad_names ) {
+  shared_ptr<AddOneProcessor> adder(new AddOneProcessor());
+  TMultiplexedProcessor processor;
+  processor.registerProcessor("Adder", adder);
+
+  shared_ptr<TMemoryBuffer> obuf(new TMemoryBuffer());
+  shared_ptr<TProtocol> out(new TBinaryProtocol(obuf));
+  shared_ptr<TProtocol> in(new TBinaryProtocol(call("Add:add", 1)));
+  BOOST_CHECK_THROW(processor.process(in, out, NULL), apache::thrift::TException);
+
+  const char* malformed[] = { "add", ":add", "Adder:", "Adder:add:more" };
+  for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+    in.reset(new TBinaryProtocol(call(malformed[i], 1)));
+    BOOST_CHECK(!processor.process(in, out, NULL));
+  }
+  BOOST_CHECK_EQUAL(adder->slow + adder->fast, 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_typed_decorator ) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  shared_ptr<BufferProtocol> inner(new BufferProtocol(buf));
+  TProtocolDecoratorT<BufferProtocol> decorator(inner);
+  decorator.writeMessageBegin("add", T_CALL, 7);
+  decorator.writeI32(-3);
+  decorator.writeMessageEnd();
+  BOOST_CHECK(buf->getBufferAsString() == call("add", -3)->getBufferAsString());
+
+  std::string fname;
+  TMessageType mtype;
+  int32_t seqid;
+  int32_t value;
+  decorator.readMessageBegin(fname, mtype, seqid);
+  decorator.readI32(value);
+  BOOST_CHECK_EQUAL(fname, "add");
+  BOOST_CHECK_EQUAL(value, -3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,217 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TDynamic.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TDynamicTest )
+
+using apache::thrift::TException;
+using apache::thrift::protocol::TBinaryProtocolT;
+using apache::thrift::protocol::TDecodePlan;
+using apache::thrift::protocol::TDynamicValue;
+using apache::thrift::protocol::TSchema;
+using apache::thrift::protocol::TSchemaFunction;
+using apache::thrift::protocol::T_I32;
+using apache::thrift::protocol::T_I64;
+using apache::thrift::protocol::T_LIST;
+using apache::thrift::protocol::T_MAP;
+using apache::thrift::protocol::T_STRUCT;
+using apache::thrift::transport::TMemoryBuffer;
+
+// What --gen schema writes for
+//   enum Color { RED = 1, BLUE = 2 }
+//   struct Point { 1: i32 x, 2: i32 y }
+//   struct Route { 1: required i64 id, 2: string name, 3: optional Point at,
+//                  4: list<Point> path, 5: map<string, Point> marks,
+//                  7: Color color, 100: binary blob, 8: Route next }
+//   service Router { Route find(1: i64 id) }
+static const char* const SCHEMA =
+  "thrift-schema 1\n"
+  "enum t.Color\n"
+  "value RED 1\n"
+  "value BLUE 2\n"
+  "struct t.Point\n"
+  "field 1 def i32 x\n"
+  "field 2 def i32 y\n"
+  "struct t.Route\n"
+  "field 1 req i64 id\n"
+  "field 2 def string name\n"
+  "field 3 opt struct:t.Point at\n"
+  "field 4 def list<struct:t.Point> path\n"
+  "field 5 def map<string,struct:t.Point> marks\n"
+  "field 7 def enum:t.Color color\n"
+  "field 8 def struct:t.Route next\n"
+  "field 100 def binary blob\n"
+  "service t.Router\n"
+  "function find 0 t.Router_find_args t.Router_find_result\n"
+  "struct t.Router_find_args\n"
+  "field 1 def i64 id\n"
+  "struct t.Router_find_result\n"
+  "field 0 opt struct:t.Route success\n";
+
+typedef TBinaryProtocolT<TMemoryBuffer> Protocol;
+
+static void setPoint(TDynamicValue& point, int32_t x, int32_t y) {
+  point.setContainer(T_STRUCT);
+  point.setField(1).setI32(x);
+  point.setField(2).setI32(y);
+}
+
+static TDynamicValue makeRoute() {
+  TDynamicValue route;
+  route.setField(1).setI64(42);
+  route.setField(2).setString("north");
+  setPoint(route.setField(3), 5, 6);
+  TDynamicValue& path = route.setField(4);
+  path.setContainer(T_LIST);
+  for (int i = 0; i < 3; ++i) {
+    path.getItems().emplace_back();
+    setPoint(path.getItems().back(), i, 10 * i);
+  }
+  TDynamicValue& marks = route.setField(5);
+  marks.setContainer(T_MAP);
+  marks.getItems().resize(2);
+  marks.getItems()[0].setString("home");
+  setPoint(marks.getItems()[1], -1, -2);
+  route.setField(7).setI32(2);
+  route.setField(100).setString(std::string("\0\1", 2));
+  TDynamicValue& next = route.setField(8);
+  next.setField(1).setI64(43);
+  return route;
+}
+
+static std::string serialize(const TDecodePlan& plan, const TDynamicValue& value) {
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  Protocol protocol(buffer);
+  plan.write(&protocol, value);
+  return buffer->getBufferAsString();
+}
+
+static void deserialize(const TDecodePlan& plan, const std::string& data, TDynamicValue& value) {
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer(
+      reinterpret_cast<uint8_t*>(const_cast<char*>(data.data())),
+      static_cast<uint32_t>(data.size())));
+  Protocol protocol(buffer);
+  plan.read(&protocol, value);
+}
+
+BOOST_AUTO_TEST_CASE( test_schema ) {
+  TSchema schema(SCHEMA);
+  BOOST_CHECK_EQUAL(schema.getStructs().size(), 4u);
+  BOOST_CHECK_EQUAL(schema.getEnums()[0].values[1].second, 2);
+  const TSchemaFunction* find = schema.findFunction("t.Router", "find");
+  BOOST_REQUIRE(find != NULL);
+  BOOST_CHECK_EQUAL(schema.getStructs()[find->result].fields[0].name, "success");
+  BOOST_CHECK(schema.findFunction("t.Router", "lose") == NULL);
+
+  BOOST_CHECK_THROW(TSchema("thrift-schema 2\n"), TException);
+  BOOST_CHECK_THROW(TSchema("thrift-schema 1\nstruct a\nfield 1 def struct:b x\n"), TException);
+}
+
+BOOST_AUTO_TEST_CASE( test_round_trip ) {
+  TSchema schema(SCHEMA);
+  TDecodePlan plan(schema, "t.Route");
+  std::string data = serialize(plan, makeRoute());
+
+  TDynamicValue route;
+  deserialize(plan, data, route);
+  BOOST_CHECK_EQUAL(route.getField(1)->getInt(), 42);
+  BOOST_CHECK_EQUAL(route.getField(2)->getString(), "north");
+  BOOST_CHECK_EQUAL(route.getField(100)->getString(), std::string("\0\1", 2));
+  BOOST_CHECK_EQUAL(route.getField(7)->getInt(), 2);
+  const TDynamicValue* path = route.getField(4);
+  BOOST_REQUIRE_EQUAL(path->getItems().size(), 3u);
+  BOOST_CHECK_EQUAL(path->getItems()[2].getField(2)->getInt(), 20);
+  BOOST_CHECK_EQUAL(route.getField(5)->getItems()[0].getString(), "home");
+  BOOST_CHECK_EQUAL(route.find(plan.resolve("next.id"))->getInt(), 43);
+  BOOST_CHECK(route.find(plan.resolve("next.name")) == NULL);
+
+  // Written back the same, byte for byte
+  BOOST_CHECK(serialize(plan, route) == data);
+}
+
+BOOST_AUTO_TEST_CASE( test_limited ) {
+  TSchema schema(SCHEMA);
+  std::string data = serialize(TDecodePlan(schema, "t.Route"), makeRoute());
+
+  std::vector<std::string> paths;
+  paths.push_back("id");
+  paths.push_back("path.y");
+  paths.push_back("marks.x");
+  TDecodePlan plan(schema, "t.Route", paths);
+
+  TDynamicValue route;
+  deserialize(plan, data, route);
+  BOOST_CHECK_EQUAL(route.getItems().size(), 3u);
+  BOOST_CHECK_EQUAL(route.getField(1)->getInt(), 42);
+  BOOST_CHECK(route.getField(2) == NULL);
+  const TDynamicValue& point = route.getField(4)->getItems()[1];
+  BOOST_CHECK(point.getField(1) == NULL);
+  BOOST_CHECK_EQUAL(point.getField(2)->getInt(), 10);
+  BOOST_CHECK_EQUAL(route.getField(5)->getItems()[0].getString(), "home");
+  BOOST_CHECK_EQUAL(route.getField(5)->getItems()[1].getField(1)->getInt(), -1);
+
+  // Reading into the same value again starts it over
+  deserialize(plan, data, route);
+  BOOST_CHECK_EQUAL(route.getField(4)->getItems().size(), 3u);
+
+  paths.push_back("path.z");
+  BOOST_CHECK_THROW(TDecodePlan(schema, "t.Route", paths), TException);
+  BOOST_CHECK_THROW(TDecodePlan(schema, "t.Route", std::vector<std::string>(1, "id.x")),
+                    TException);
+  BOOST_CHECK_THROW(TDecodePlan(schema, "t.Nowhere"), TException);
+}
+
+BOOST_AUTO_TEST_CASE( test_mismatch ) {
+  TSchema schema(SCHEMA);
+  TDecodePlan plan(schema, "t.Route");
+
+  // A field that went from i64 to i32 is skipped, not misread
+  boost::shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  Protocol protocol(buffer);
+  protocol.writeStructBegin("Route");
+  protocol.writeFieldBegin("id", T_I32, 1);
+  protocol.writeI32(7);
+  protocol.writeFieldEnd();
+  protocol.writeFieldBegin("name", apache::thrift::protocol::T_STRING, 2);
+  protocol.writeString(std::string("x"));
+  protocol.writeFieldEnd();
+  protocol.writeFieldStop();
+  protocol.writeStructEnd();
+
+  TDynamicValue route;
+  plan.read(&protocol, route);
+  BOOST_CHECK(route.getField(1) == NULL);
+  BOOST_CHECK_EQUAL(route.getField(2)->getString(), "x");
+
+  // And a value of the wrong type is not written
+  route.setField(1).setI32(7);
+  BOOST_CHECK_THROW(serialize(plan, route), TException);
+  route.setField(1).setI64(7);
+  BOOST_CHECK_EQUAL(route.getField(1)->getType(), T_I64);
+  serialize(plan, route);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
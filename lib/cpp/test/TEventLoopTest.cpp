@@ -0,0 +1,176 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/server/TEventLoop.h>
+
+BOOST_AUTO_TEST_SUITE( TEventLoopTest )
+
+using apache::thrift::TException;
+using apache::thrift::concurrency::Util;
+using apache::thrift::server::TEventLoop;
+using boost::shared_ptr;
+
+// Notes the readiness it is called back for, breaking the loop if asked
+struct Recorder {
+  Recorder() : loop(NULL), calls(0), which(0), breakOnCall(true) {}
+
+  static void ready(THRIFT_SOCKET fd, short which, void* arg) {
+    (void)fd;
+    Recorder* self = static_cast<Recorder*>(arg);
+    ++self->calls;
+    self->which |= which;
+    if (self->breakOnCall) {
+      self->loop->breakLoop();
+    }
+  }
+
+  TEventLoop* loop;
+  int calls;
+  short which;
+  bool breakOnCall;
+};
+
+// Counts ticks, breaking the loop after stopAt of them
+struct Ticks {
+  Ticks(TEventLoop* loop, int stopAt) : loop(loop), count(0), stopAt(stopAt) {}
+
+  static void tick(void* arg) {
+    Ticks* self = static_cast<Ticks*>(arg);
+    if (++self->count >= self->stopAt) {
+      self->loop->breakLoop();
+    }
+  }
+
+  TEventLoop* loop;
+  int count;
+  int stopAt;
+};
+
+static void watch(TEventLoop::Event& ev, THRIFT_SOCKET fd, short flags, Recorder& recorder) {
+  ev.fd = fd;
+  ev.flags = flags;
+  ev.callback = &Recorder::ready;
+  ev.arg = &recorder;
+  BOOST_REQUIRE(recorder.loop->add(&ev));
+}
+
+static void checkBackend(TEventLoop::Backend backend) {
+  shared_ptr<TEventLoop> loop;
+  try {
+    loop = TEventLoop::create(backend);
+  } catch (const TException&) {
+    // Not on this platform
+    return;
+  }
+  BOOST_TEST_MESSAGE("backend " << loop->getMethod());
+  int fds[2];
+  BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  // Nothing to read: only the tick comes, about every interval
+  Recorder reader;
+  reader.loop = loop.get();
+  TEventLoop::Event readEvent;
+  watch(readEvent, fds[0], TEventLoop::READ, reader);
+  Ticks ticks(loop.get(), 5);
+  loop->setTick(20, &Ticks::tick, &ticks);
+  int64_t start = Util::monotonicTime();
+  loop->run();
+  int64_t elapsed = Util::monotonicTime() - start;
+  BOOST_CHECK_EQUAL(ticks.count, 5);
+  BOOST_CHECK_GE(elapsed, 90);
+  BOOST_CHECK_LT(elapsed, 2000);
+  BOOST_CHECK_EQUAL(reader.calls, 0);
+  loop->setTick(0, NULL, NULL);
+
+  // A byte arriving makes it readable
+  BOOST_REQUIRE_EQUAL(write(fds[1], "x", 1), 1);
+  loop->run();
+  BOOST_CHECK_EQUAL(reader.calls, 1);
+  BOOST_CHECK_EQUAL(reader.which, TEventLoop::READ);
+
+  // Added again for writing, it is called back for that instead
+  reader.which = 0;
+  readEvent.flags = TEventLoop::WRITE;
+  BOOST_REQUIRE(loop->add(&readEvent));
+  loop->run();
+  BOOST_CHECK_EQUAL(reader.which, TEventLoop::WRITE);
+
+  // Deleted, it isn't called back though still ready
+  BOOST_REQUIRE(loop->del(&readEvent));
+  BOOST_CHECK(!readEvent.added);
+  reader.calls = 0;
+  Ticks more(loop.get(), 3);
+  loop->setTick(10, &Ticks::tick, &more);
+  loop->run();
+  BOOST_CHECK_EQUAL(reader.calls, 0);
+  BOOST_CHECK_EQUAL(more.count, 3);
+
+  // Edge triggered, unread data is reported once rather than every turn,
+  // where the backend supports it
+  Recorder edge;
+  edge.loop = loop.get();
+  edge.breakOnCall = false;
+  TEventLoop::Event edgeEvent;
+  watch(edgeEvent, fds[0], TEventLoop::READ | TEventLoop::EDGE, edge);
+  Ticks edgeTicks(loop.get(), 3);
+  loop->setTick(10, &Ticks::tick, &edgeTicks);
+  loop->run();
+  if (loop->getEventBase() == NULL) {
+    BOOST_CHECK_EQUAL(edge.calls, 1);
+  } else {
+    BOOST_CHECK_GE(edge.calls, 1);
+  }
+  BOOST_CHECK_EQUAL(edge.which, TEventLoop::READ);
+
+  // A hangup is reported as readiness to read
+  BOOST_REQUIRE(loop->del(&edgeEvent));
+  char byte;
+  BOOST_REQUIRE_EQUAL(read(fds[0], &byte, 1), 1);
+  Recorder hangup;
+  hangup.loop = loop.get();
+  TEventLoop::Event hangupEvent;
+  watch(hangupEvent, fds[0], TEventLoop::READ, hangup);
+  loop->setTick(0, NULL, NULL);
+  close(fds[1]);
+  loop->run();
+  BOOST_CHECK_EQUAL(hangup.calls, 1);
+  BOOST_CHECK_EQUAL(hangup.which, TEventLoop::READ);
+  BOOST_CHECK_EQUAL(read(fds[0], &byte, 1), 0);
+
+  BOOST_REQUIRE(loop->del(&hangupEvent));
+  close(fds[0]);
+}
+
+BOOST_AUTO_TEST_CASE( test_libevent ) {
+  checkBackend(TEventLoop::BACKEND_LIBEVENT);
+}
+
+BOOST_AUTO_TEST_CASE( test_epoll ) {
+  checkBackend(TEventLoop::BACKEND_EPOLL);
+}
+
+BOOST_AUTO_TEST_CASE( test_kqueue ) {
+  checkBackend(TEventLoop::BACKEND_KQUEUE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,208 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <thrift/async/TAsyncBufferProcessor.h>
+#include <thrift/async/TEvhttpServer.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/THttpClient.h>
+#include <thrift/transport/TSocket.h>
+
+BOOST_AUTO_TEST_SUITE( TEvhttpServerTest )
+
+using apache::thrift::async::TAsyncBufferProcessor;
+using apache::thrift::async::TEvhttpServer;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::ThreadManager;
+using apache::thrift::transport::TBufferBase;
+using apache::thrift::transport::THttpClient;
+using apache::thrift::transport::TSocket;
+using boost::shared_ptr;
+
+static shared_ptr<PlatformThreadFactory> threadFactory() {
+  return shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+      PlatformThreadFactory::OTHER,
+      PlatformThreadFactory::NORMAL,
+      1,
+#endif
+      false));
+}
+
+// Echoes each request body, finishing every other one on a worker thread
+// rather than the base's, and noting the threads requests arrive on
+class EchoProcessor : public TAsyncBufferProcessor {
+ public:
+  explicit EchoProcessor(const shared_ptr<ThreadManager>& workers)
+    : workers_(workers), requests_(0) {}
+
+  virtual void process(apache::thrift::stdcxx::function<void(bool healthy)> _return,
+                       shared_ptr<TBufferBase> ibuf,
+                       shared_ptr<TBufferBase> obuf) {
+    bool elsewhere;
+    {
+      Synchronized s(monitor_);
+      threads_.insert(Thread::get_current());
+      elsewhere = (requests_++ % 2) == 1;
+    }
+    shared_ptr<Echo> echo(new Echo(_return, ibuf, obuf));
+    if (elsewhere) {
+      workers_->add(echo);
+    } else {
+      echo->run();
+    }
+  }
+
+  size_t threads() {
+    Synchronized s(monitor_);
+    return threads_.size();
+  }
+
+ private:
+  class Echo : public Runnable {
+   public:
+    Echo(apache::thrift::stdcxx::function<void(bool healthy)> _return,
+         shared_ptr<TBufferBase> ibuf,
+         shared_ptr<TBufferBase> obuf)
+      : return_(_return), ibuf_(ibuf), obuf_(obuf) {}
+
+    virtual void run() {
+      uint8_t buf[256];
+      uint32_t got;
+      while ((got = ibuf_->read(buf, sizeof(buf))) > 0) {
+        obuf_->write(buf, got);
+      }
+      return_(true);
+    }
+
+   private:
+    apache::thrift::stdcxx::function<void(bool healthy)> return_;
+    shared_ptr<TBufferBase> ibuf_;
+    shared_ptr<TBufferBase> obuf_;
+  };
+
+  shared_ptr<ThreadManager> workers_;
+  Monitor monitor_;
+  std::set<Thread::id_t> threads_;
+  int requests_;
+};
+
+class ServeRunner : public Runnable {
+ public:
+  explicit ServeRunner(TEvhttpServer* server) : server_(server) {}
+
+  virtual void run() { server_->serve(); }
+
+ private:
+  TEvhttpServer* server_;
+};
+
+// A port nothing listens on, as far as can be told
+static int freePort() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  bind(fd, reinterpret_cast<struct sockaddr*>(&addr), len);
+  getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+  close(fd);
+  return ntohs(addr.sin_port);
+}
+
+// Opens a client, retrying while the bases start listening
+static shared_ptr<THttpClient> connect(int port) {
+  for (int attempt = 0;; ++attempt) {
+    shared_ptr<TSocket> socket(new TSocket("127.0.0.1", port));
+    socket->setRecvTimeout(5000);
+    try {
+      socket->open();
+      return shared_ptr<THttpClient>(new THttpClient(socket, "localhost", "/"));
+    } catch (const apache::thrift::transport::TTransportException&) {
+      if (attempt == 100) {
+        throw;
+      }
+      usleep(10 * 1000);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_several_bases ) {
+  shared_ptr<ThreadManager> workers = ThreadManager::newSimpleThreadManager(2);
+  workers->threadFactory(threadFactory());
+  workers->start();
+  shared_ptr<EchoProcessor> processor(new EchoProcessor(workers));
+  int port = freePort();
+  TEvhttpServer server(processor, port, 4);
+  BOOST_CHECK_EQUAL(server.getNumBases(), 4u);
+  shared_ptr<Thread> thread = threadFactory()->newThread(
+      shared_ptr<Runnable>(new ServeRunner(&server)));
+  thread->start();
+
+  // Clients spread over the bases, and each of their requests is answered
+  // on its connection, whichever thread finished it
+  const int kClients = 16;
+  std::vector<shared_ptr<THttpClient> > clients;
+  for (int c = 0; c < kClients; ++c) {
+    clients.push_back(connect(port));
+  }
+  for (int round = 0; round < 5; ++round) {
+    for (int c = 0; c < kClients; ++c) {
+      char request[32];
+      int len = std::snprintf(request, sizeof(request), "request %d.%d", c, round);
+      clients[c]->write(reinterpret_cast<const uint8_t*>(request), len);
+      clients[c]->flush();
+    }
+    for (int c = 0; c < kClients; ++c) {
+      char request[32];
+      int len = std::snprintf(request, sizeof(request), "request %d.%d", c, round);
+      std::string reply(len, '\0');
+      clients[c]->readAll(reinterpret_cast<uint8_t*>(&reply[0]), len);
+      clients[c]->readEnd();
+      BOOST_CHECK_EQUAL(reply, request);
+    }
+  }
+  BOOST_CHECK_GT(processor->threads(), 1u);
+  BOOST_CHECK_LE(processor->threads(), 4u);
+
+  // stop() from another thread ends serve()
+  for (int c = 0; c < kClients; ++c) {
+    clients[c]->close();
+  }
+  server.stop();
+  thread->join();
+  workers->stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
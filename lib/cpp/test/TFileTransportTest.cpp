@@ -29,8 +29,15 @@
 #include <boost/test/unit_test.hpp>
 
 #include <thrift/transport/TFileTransport.h>
+#include <thrift/transport/TMappedFileTransport.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+
+#include <vector>
 
 using namespace apache::thrift::transport;
+using namespace apache::thrift::concurrency;
 
 /**************************************************************************
  * Global state
@@ -340,6 +347,519 @@ BOOST_AUTO_TEST_CASE(test_noop_flush) {
   }
 }
 
+/**
+ * Write num_events 16 byte events, each filled with its own index, using a
+ * small chunk size so that TFileTransport has to pad most chunks.
+ */
+static const uint32_t MAPPED_CHUNK_SIZE = 64;
+static const uint32_t MAPPED_EVENT_SIZE = 16;
+
+void write_indexed_events(const char* path, uint32_t num_events) {
+  TFileTransport transport(path);
+  transport.setChunkSize(MAPPED_CHUNK_SIZE);
+  for (uint32_t n = 0; n < num_events; ++n) {
+    uint8_t buf[MAPPED_EVENT_SIZE];
+    memset(buf, static_cast<int>(n), sizeof(buf));
+    transport.write(buf, sizeof(buf));
+  }
+  transport.flush();
+}
+
+/**
+ * Make sure TMappedFileTransport hands out the same events as TFileTransport,
+ * and that borrow() returns whole events without copying.
+ */
+BOOST_AUTO_TEST_CASE(test_mapped_read) {
+  TempFile f(tmp_dir, "thrift.TFileTransportTest.");
+  write_indexed_events(f.getPath(), 10);
+
+  TMappedFileTransport transport(f.getPath());
+  transport.setChunkSize(MAPPED_CHUNK_SIZE);
+
+  // three 20 byte records fit in each 64 byte chunk
+  BOOST_CHECK_EQUAL(transport.getNumChunks(), 4u);
+
+  for (uint32_t n = 0; n < 10; ++n) {
+    BOOST_REQUIRE(transport.peek());
+    BOOST_CHECK_EQUAL(transport.getCurChunk(), n / 3);
+
+    uint32_t len = 1;
+    const uint8_t* data = transport.borrow(NULL, &len);
+    BOOST_REQUIRE(data != NULL);
+    BOOST_REQUIRE_EQUAL(len, MAPPED_EVENT_SIZE);
+    for (uint32_t i = 0; i < len; ++i) {
+      BOOST_CHECK_EQUAL(data[i], n);
+    }
+
+    // reads never cross into the next event
+    uint8_t buf[2 * MAPPED_EVENT_SIZE];
+    transport.consume(4);
+    BOOST_CHECK_EQUAL(transport.read(buf, sizeof(buf)), MAPPED_EVENT_SIZE - 4);
+    BOOST_CHECK_EQUAL(buf[0], n);
+  }
+
+  BOOST_CHECK(!transport.peek());
+  uint32_t len = 1;
+  BOOST_CHECK(transport.borrow(NULL, &len) == NULL);
+}
+
+/**
+ * Make sure seekToChunk() and seekToEnd() land on the right events.
+ */
+BOOST_AUTO_TEST_CASE(test_mapped_seek) {
+  TempFile f(tmp_dir, "thrift.TFileTransportTest.");
+  write_indexed_events(f.getPath(), 10);
+
+  TMappedFileTransport transport(f.getPath());
+  transport.setChunkSize(MAPPED_CHUNK_SIZE);
+
+  uint8_t buf[MAPPED_EVENT_SIZE];
+  transport.seekToChunk(2);
+  transport.readAll(buf, sizeof(buf));
+  BOOST_CHECK_EQUAL(buf[0], 6);
+
+  // negative chunks count back from the end
+  transport.seekToChunk(-3);
+  transport.readAll(buf, sizeof(buf));
+  BOOST_CHECK_EQUAL(buf[0], 3);
+
+  transport.seekToEnd();
+  BOOST_CHECK(!transport.peek());
+
+  // a tailing reader picks up events appended after the seek
+  write_indexed_events(f.getPath(), 1);
+  BOOST_REQUIRE(transport.peek());
+  transport.readAll(buf, sizeof(buf));
+  BOOST_CHECK_EQUAL(buf[0], 0);
+}
+
+/**
+ * Make sure group commit produces the same log, padding included, and that
+ * SYNC_NONE keeps the writer thread from ever calling fsync().
+ */
+BOOST_AUTO_TEST_CASE(test_group_commit) {
+  TempFile f(tmp_dir, "thrift.TFileTransportTest.");
+
+  FsyncLog log;
+  fsync_log = &log;
+
+  TFileTransport* writer = new TFileTransport(f.getPath());
+  writer->setChunkSize(MAPPED_CHUNK_SIZE);
+  writer->setGroupCommit(true);
+  writer->setSyncPolicy(TFileTransport::SYNC_NONE);
+  writer->setPreallocateChunks(true);
+  for (uint32_t n = 0; n < 10; ++n) {
+    uint8_t buf[MAPPED_EVENT_SIZE];
+    memset(buf, static_cast<int>(n), sizeof(buf));
+    writer->write(buf, sizeof(buf));
+  }
+  writer->flush();
+  delete writer;
+
+  fsync_log = NULL;
+  BOOST_CHECK_EQUAL(log.getCalls()->size(),
+                    static_cast<FsyncLog::CallList::size_type>(0));
+
+  TMappedFileTransport reader(f.getPath());
+  reader.setChunkSize(MAPPED_CHUNK_SIZE);
+  BOOST_CHECK_EQUAL(reader.getNumChunks(), 4u);
+  for (uint32_t n = 0; n < 10; ++n) {
+    uint8_t buf[MAPPED_EVENT_SIZE];
+    reader.readAll(buf, sizeof(buf));
+    BOOST_CHECK_EQUAL(buf[0], n);
+    BOOST_CHECK_EQUAL(buf[MAPPED_EVENT_SIZE - 1], n);
+  }
+  BOOST_CHECK(!reader.peek());
+}
+
+/**
+ * Writes a numbered sequence of events tagged with its own id.
+ */
+class EventProducer : public Runnable {
+ public:
+  EventProducer(TFileTransport* transport, uint32_t id, uint32_t numEvents)
+    : transport_(transport), id_(id), numEvents_(numEvents) {}
+
+  void run() {
+    for (uint32_t n = 0; n < numEvents_; ++n) {
+      uint32_t event[2] = { id_, n };
+      transport_->write(reinterpret_cast<const uint8_t*>(event), sizeof(event));
+    }
+  }
+
+ private:
+  TFileTransport* transport_;
+  uint32_t id_;
+  uint32_t numEvents_;
+};
+
+/**
+ * Make sure concurrent writers through the lock-free ring lose no events,
+ * and that each writer's events are logged in the order it wrote them.
+ */
+BOOST_AUTO_TEST_CASE(test_lock_free_enqueue) {
+  TempFile f(tmp_dir, "thrift.TFileTransportTest.");
+
+  const uint32_t NUM_PRODUCERS = 8;
+  const uint32_t NUM_EVENTS = 2000;
+
+  TFileTransport* writer = new TFileTransport(f.getPath());
+  // a small ring makes the producers wait on the writer thread
+  writer->setEventBufferSize(64);
+  writer->setGroupCommit(true);
+  writer->enableLockFreeEnqueue();
+
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  std::vector<boost::shared_ptr<Thread> > threads;
+  for (uint32_t id = 0; id < NUM_PRODUCERS; ++id) {
+    threads.push_back(factory.newThread(boost::shared_ptr<Runnable>(
+      new EventProducer(writer, id, NUM_EVENTS))));
+    threads.back()->start();
+  }
+  for (uint32_t id = 0; id < NUM_PRODUCERS; ++id) {
+    threads[id]->join();
+  }
+  writer->flush();
+  delete writer;
+
+  TMappedFileTransport reader(f.getPath());
+  std::vector<uint32_t> next(NUM_PRODUCERS, 0);
+  uint32_t event[2];
+  while (reader.read(reinterpret_cast<uint8_t*>(event), sizeof(event)) == sizeof(event)) {
+    BOOST_REQUIRE_LT(event[0], NUM_PRODUCERS);
+    BOOST_CHECK_EQUAL(event[1], next[event[0]]);
+    next[event[0]] = event[1] + 1;
+  }
+  for (uint32_t id = 0; id < NUM_PRODUCERS; ++id) {
+    BOOST_CHECK_EQUAL(next[id], NUM_EVENTS);
+  }
+}
+
+/**
+ * Make sure reading ahead hands back every event in order, across read
+ * buffers that split events, and after a seek.
+ */
+BOOST_AUTO_TEST_CASE(test_read_ahead) {
+  TempFile f(tmp_dir, "thrift.TFileTransportTest.");
+  {
+    TFileTransport writer(f.getPath());
+    for (uint32_t n = 0; n < 1000; ++n) {
+      writer.write(reinterpret_cast<const uint8_t*>(&n), sizeof(n));
+    }
+    writer.flush();
+  }
+
+  TFileTransport reader(f.getPath(), true);
+  reader.setReadBuffSize(100);
+  reader.setReadAhead(true);
+  uint32_t event;
+  for (uint32_t n = 0; n < 1000; ++n) {
+    reader.readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+    BOOST_REQUIRE_EQUAL(event, n);
+  }
+  BOOST_CHECK(!reader.peek());
+
+  reader.seekToChunk(0);
+  reader.readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+  BOOST_CHECK_EQUAL(event, 0u);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/**
+ * Reads one event from a tailing transport.
+ */
+class EventTailer : public Runnable {
+ public:
+  EventTailer(TFileTransport* transport) : transport_(transport), event(0) {}
+
+  void run() {
+    transport_->readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+  }
+
+ private:
+  TFileTransport* transport_;
+
+ public:
+  uint32_t event;
+};
+
+/**
+ * Make sure a tailing reader wakes up when the file is written, well
+ * before its EOF sleep time is up.
+ */
+BOOST_AUTO_TEST_CASE(test_tail_wakeup) {
+  TempFile f(tmp_dir, "thrift.TFileTransportTest.");
+  TFileTransport writer(f.getPath());
+
+  TFileTransport reader(f.getPath(), true);
+  reader.setReadTimeout(TFileTransport::TAIL_READ_TIMEOUT);
+  reader.setEofSleepTimeUs(30 * 1000 * 1000);
+  boost::shared_ptr<EventTailer> tailer(new EventTailer(&reader));
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  boost::shared_ptr<Thread> thread = factory.newThread(tailer);
+  thread->start();
+
+  // let the reader hit the end of the file first
+  usleep(100 * 1000);
+  uint32_t n = 7;
+  writer.write(reinterpret_cast<const uint8_t*>(&n), sizeof(n));
+  writer.flush();
+
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  thread->join();
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  BOOST_CHECK_EQUAL(tailer->event, 7u);
+  BOOST_CHECK_LT(time_diff(&start, &end), 10 * 1000 * 1000);
+}
+#endif
+
+/**
+ * Write events numbered first .. first + count - 1 through an indexed
+ * TFileTransport.
+ */
+void write_numbered_events(const char* path, uint32_t first, uint32_t count) {
+  TFileTransport transport(path);
+  transport.setChunkSize(MAPPED_CHUNK_SIZE);
+  transport.setIndexInterval(10);
+  for (uint32_t n = first; n < first + count; ++n) {
+    transport.write(reinterpret_cast<const uint8_t*>(&n), sizeof(n));
+  }
+  transport.flush();
+}
+
+/**
+ * Make sure both readers seek by event number and time through the index,
+ * including across a writer restart that has to resume the numbering.
+ */
+BOOST_AUTO_TEST_CASE(test_index_seek) {
+  TempFile f(tmp_dir, "thrift.TFileTransportTest.");
+  std::string index_path = TFileTransportIndex::pathFor(f.getPath());
+  write_numbered_events(f.getPath(), 0, 95);
+  write_numbered_events(f.getPath(), 95, 10);
+
+  TFileTransportIndex index(index_path);
+  index.load();
+  BOOST_REQUIRE_EQUAL(index.getEntries().size(), 11u);
+  BOOST_CHECK_EQUAL(index.getEntries().back().eventNumber, 100u);
+
+  TMappedFileTransport mapped(f.getPath());
+  mapped.setChunkSize(MAPPED_CHUNK_SIZE);
+  TFileTransport file(f.getPath(), true);
+  file.setChunkSize(MAPPED_CHUNK_SIZE);
+
+  TFileReaderTransport* readers[] = { &mapped, &file };
+  for (size_t i = 0; i < sizeof(readers) / sizeof(readers[0]); ++i) {
+    uint32_t event;
+    readers[i]->seekToEvent(37);
+    readers[i]->readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+    BOOST_CHECK_EQUAL(event, 37u);
+
+    readers[i]->seekToEvent(102);
+    readers[i]->readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+    BOOST_CHECK_EQUAL(event, 102u);
+
+    readers[i]->seekToTime(0);
+    readers[i]->readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+    BOOST_CHECK_EQUAL(event, 0u);
+
+    readers[i]->seekToTime(index.getEntries().back().timestampUs);
+    readers[i]->readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+    BOOST_CHECK_EQUAL(event, 100u);
+  }
+
+  ::unlink(index_path.c_str());
+}
+
+/**
+ * Make sure events written in compressed blocks read back in order, and
+ * that seeking by event and chunk lands inside blocks.  The base
+ * TTransportFactory stands in for a codec that stores blocks as they are.
+ */
+BOOST_AUTO_TEST_CASE(test_compressed_blocks) {
+  TempFile f(tmp_dir, "thrift.TFileTransportTest.");
+  std::string index_path = TFileTransportIndex::pathFor(f.getPath());
+  boost::shared_ptr<TTransportFactory> codec(new TTransportFactory());
+  {
+    TFileTransport transport(f.getPath());
+    transport.setChunkSize(256);
+    transport.setIndexInterval(10);
+    transport.setBlockSize(64);
+    BOOST_CHECK_THROW(transport.setWriteBlockCodec(1), TTransportException);
+    transport.setBlockCodec(1, codec);
+    transport.setWriteBlockCodec(1);
+    for (uint32_t n = 0; n < 200; ++n) {
+      transport.write(reinterpret_cast<const uint8_t*>(&n), sizeof(n));
+    }
+    transport.flush();
+  }
+
+  TFileTransport file(f.getPath(), true);
+  file.setChunkSize(256);
+  file.setBlockCodec(1, codec);
+  uint32_t event;
+  for (uint32_t n = 0; n < 200; ++n) {
+    file.readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+    BOOST_REQUIRE_EQUAL(event, n);
+  }
+
+  file.seekToEvent(137);
+  file.readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+  BOOST_CHECK_EQUAL(event, 137u);
+  file.readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+  BOOST_CHECK_EQUAL(event, 138u);
+
+  file.seekToChunk(1);
+  uint32_t first;
+  file.readAll(reinterpret_cast<uint8_t*>(&first), sizeof(first));
+  BOOST_CHECK(first > 0 && first < 200);
+  file.readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+  BOOST_CHECK_EQUAL(event, first + 1);
+
+  // the raw format is refused rather than misread
+  TMappedFileTransport mapped(f.getPath());
+  mapped.setChunkSize(256);
+  BOOST_CHECK_THROW(mapped.readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event)),
+                    TTransportException);
+
+  ::unlink(index_path.c_str());
+}
+
+/**
+ * Processor that records the numbered events it is handed.
+ */
+class EventRecorder : public apache::thrift::TProcessor {
+ public:
+  bool process(boost::shared_ptr<apache::thrift::protocol::TProtocol> in,
+               boost::shared_ptr<apache::thrift::protocol::TProtocol> out,
+               void* connectionContext) {
+    (void) out;
+    (void) connectionContext;
+    uint32_t event;
+    in->getTransport()->readAll(reinterpret_cast<uint8_t*>(&event), sizeof(event));
+    events.push_back(event);
+    return true;
+  }
+
+  std::vector<uint32_t> events;
+};
+
+/**
+ * Make sure TFileProcessor::processChunks() replays exactly its chunks.
+ */
+BOOST_AUTO_TEST_CASE(test_process_chunks) {
+  TempFile f(tmp_dir, "thrift.TFileTransportTest.");
+  // 8 events of 8 bytes fill each 64 byte chunk
+  write_numbered_events(f.getPath(), 0, 50);
+  ::unlink(TFileTransportIndex::pathFor(f.getPath()).c_str());
+
+  boost::shared_ptr<TMappedFileTransport> reader(new TMappedFileTransport(f.getPath()));
+  reader->setChunkSize(MAPPED_CHUNK_SIZE);
+  boost::shared_ptr<EventRecorder> recorder(new EventRecorder());
+  TFileProcessor processor(recorder,
+    boost::shared_ptr<apache::thrift::protocol::TProtocolFactory>(
+      new apache::thrift::protocol::TBinaryProtocolFactory()),
+    reader);
+
+  processor.processChunks(1, 2);
+  BOOST_REQUIRE_EQUAL(recorder->events.size(), 16u);
+  BOOST_CHECK_EQUAL(recorder->events.front(), 8u);
+  BOOST_CHECK_EQUAL(recorder->events.back(), 23u);
+
+  recorder->events.clear();
+  processor.processChunks(6, 10);
+  BOOST_REQUIRE_EQUAL(recorder->events.size(), 2u);
+  BOOST_CHECK_EQUAL(recorder->events.back(), 49u);
+}
+
+/**
+ * Thread safe processor that checks events written by EventProducer arrive
+ * in order for each producer.
+ */
+class OrderChecker : public apache::thrift::TProcessor {
+ public:
+  OrderChecker(uint32_t numProducers)
+    : next(numProducers, 0), outOfOrder(0), processed(0) {}
+
+  bool process(boost::shared_ptr<apache::thrift::protocol::TProtocol> in,
+               boost::shared_ptr<apache::thrift::protocol::TProtocol> out,
+               void* connectionContext) {
+    (void) out;
+    (void) connectionContext;
+    uint32_t event[2];
+    in->getTransport()->readAll(reinterpret_cast<uint8_t*>(event), sizeof(event));
+
+    Guard g(mutex);
+    if (event[1] != next[event[0]]) {
+      ++outOfOrder;
+    }
+    next[event[0]] = event[1] + 1;
+    ++processed;
+    return true;
+  }
+
+  static uint64_t producerKey(const uint8_t* event, uint32_t len) {
+    (void) len;
+    uint32_t id;
+    memcpy(&id, event, sizeof(id));
+    return id;
+  }
+
+  Mutex mutex;
+  std::vector<uint32_t> next;
+  uint32_t outOfOrder;
+  uint32_t processed;
+};
+
+/**
+ * Make sure processParallel() processes every event, in order per key.
+ */
+BOOST_AUTO_TEST_CASE(test_process_parallel) {
+  TempFile f(tmp_dir, "thrift.TFileTransportTest.");
+
+  const uint32_t NUM_PRODUCERS = 6;
+  const uint32_t NUM_EVENTS = 3000;
+  {
+    TFileTransport writer(f.getPath());
+    for (uint32_t n = 0; n < NUM_EVENTS; ++n) {
+      for (uint32_t id = 0; id < NUM_PRODUCERS; ++id) {
+        uint32_t event[2] = { id, n };
+        writer.write(reinterpret_cast<const uint8_t*>(event), sizeof(event));
+      }
+    }
+    writer.flush();
+  }
+
+  boost::shared_ptr<ThreadManager> threadManager =
+    ThreadManager::newSimpleThreadManager(4);
+  threadManager->threadFactory(
+    boost::shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+  threadManager->start();
+
+  boost::shared_ptr<apache::thrift::protocol::TProtocolFactory> protocolFactory(
+    new apache::thrift::protocol::TBinaryProtocolFactory());
+
+  // keyed by producer, so each producer's events stay in order
+  boost::shared_ptr<OrderChecker> checker(new OrderChecker(NUM_PRODUCERS));
+  TFileProcessor keyed(checker, protocolFactory,
+    boost::shared_ptr<TMappedFileTransport>(new TMappedFileTransport(f.getPath())));
+  keyed.processParallel(threadManager, 0, &OrderChecker::producerKey);
+  BOOST_CHECK_EQUAL(checker->processed, NUM_PRODUCERS * NUM_EVENTS);
+  BOOST_CHECK_EQUAL(checker->outOfOrder, 0u);
+
+  // without a key, only completeness is guaranteed
+  checker.reset(new OrderChecker(NUM_PRODUCERS));
+  TFileProcessor unkeyed(checker, protocolFactory,
+    boost::shared_ptr<TFileTransport>(new TFileTransport(f.getPath(), true)));
+  unkeyed.processParallel(threadManager, 8);
+  BOOST_CHECK_EQUAL(checker->processed, NUM_PRODUCERS * NUM_EVENTS);
+
+  threadManager->stop();
+}
+
 /**************************************************************************
  * General Initialization
  **************************************************************************/
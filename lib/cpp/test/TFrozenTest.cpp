@@ -0,0 +1,275 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <thrift/protocol/TFrozen.h>
+
+BOOST_AUTO_TEST_SUITE( TFrozenTest )
+
+using apache::thrift::protocol::TFrozenFile;
+using apache::thrift::protocol::TFrozenList;
+using apache::thrift::protocol::TFrozenMap;
+using apache::thrift::protocol::TFrozenString;
+using apache::thrift::protocol::TFrozenStruct;
+using apache::thrift::protocol::TFrozenWriter;
+using apache::thrift::protocol::TProtocolException;
+using apache::thrift::protocol::frozenRoot;
+
+// Written out the way the generator's frozen option would for
+//   struct Point { 1: i32 x, 2: i32 y = -1 }
+//   struct Route { 1: i64 id, 2: string name, 3: optional Point at,
+//                  4: list<double> costs, 5: map<string, i32> weights,
+//                  6: list<Point> path }
+struct Point {
+  Point() : x(0), y(-1) {}
+
+  int32_t x;
+  int32_t y;
+
+  uint32_t writeFrozen(TFrozenWriter& writer) const {
+    uint32_t table = writer.beginStruct(2);
+    writer.setSlot(table, 0, writer.writeI32(this->x));
+    writer.setSlot(table, 1, writer.writeI32(this->y));
+    return table;
+  }
+};
+
+class Point_view : public TFrozenStruct {
+ public:
+  typedef TFrozenStruct Frozen_;
+
+  Point_view() {}
+  Point_view(const uint8_t* data, size_t size, uint32_t table)
+    : Frozen_(data, size, table) {}
+
+  int32_t x() const { return Frozen_::load<int32_t>(0, 0); }
+  bool has_x() const { return Frozen_::isSet(0); }
+
+  int32_t y() const { return Frozen_::load<int32_t>(1, -1); }
+  bool has_y() const { return Frozen_::isSet(1); }
+};
+
+struct Route {
+  Route() : id(0) { __isset.at = false; }
+
+  int64_t id;
+  std::string name;
+  Point at;
+  std::vector<double> costs;
+  std::map<std::string, int32_t> weights;
+  std::vector<Point> path;
+
+  struct {
+    bool at;
+  } __isset;
+
+  uint32_t writeFrozen(TFrozenWriter& writer) const {
+    uint32_t table = writer.beginStruct(6);
+    writer.setSlot(table, 0, writer.writeI64(this->id));
+    writer.setSlot(table, 1, writer.writeString(this->name.data(), this->name.size()));
+    if (this->__isset.at) {
+      writer.setSlot(table, 2, this->at.writeFrozen(writer));
+    }
+    {
+      uint32_t list = writer.beginList(static_cast<uint32_t>(this->costs.size()), 8);
+      uint32_t at = TFrozenWriter::elements(list);
+      if (!this->costs.empty()) {
+        writer.putDoubles(at, &this->costs[0], static_cast<uint32_t>(this->costs.size()));
+      }
+      writer.setSlot(table, 3, list);
+    }
+    {
+      uint32_t map = writer.beginMap(static_cast<uint32_t>(this->weights.size()), 4, 4, true);
+      uint32_t key = TFrozenWriter::elements(map);
+      uint32_t val = key + 4 * static_cast<uint32_t>(this->weights.size());
+      std::map<std::string, int32_t>::const_iterator iter;
+      for (iter = this->weights.begin(); iter != this->weights.end(); ++iter) {
+        writer.putOffset(key, writer.writeString(iter->first.data(), iter->first.size()));
+        writer.putI32(val, iter->second);
+        key += 4;
+        val += 4;
+      }
+      writer.setSlot(table, 4, map);
+    }
+    {
+      uint32_t list = writer.beginList(static_cast<uint32_t>(this->path.size()), 4);
+      uint32_t at = TFrozenWriter::elements(list);
+      std::vector<Point>::const_iterator iter;
+      for (iter = this->path.begin(); iter != this->path.end(); ++iter) {
+        writer.putOffset(at, (*iter).writeFrozen(writer));
+        at += 4;
+      }
+      writer.setSlot(table, 5, list);
+    }
+    return table;
+  }
+};
+
+class Route_view : public TFrozenStruct {
+ public:
+  typedef TFrozenStruct Frozen_;
+
+  Route_view() {}
+  Route_view(const uint8_t* data, size_t size, uint32_t table)
+    : Frozen_(data, size, table) {}
+
+  int64_t id() const { return Frozen_::load<int64_t>(0, 0); }
+  TFrozenString name() const { return Frozen_::loadView<TFrozenString>(1); }
+  Point_view at() const { return Frozen_::loadView<Point_view>(2); }
+  bool has_at() const { return Frozen_::isSet(2); }
+  TFrozenList<double> costs() const { return Frozen_::loadView<TFrozenList<double> >(3); }
+  TFrozenMap<TFrozenString, int32_t> weights() const {
+    return Frozen_::loadView<TFrozenMap<TFrozenString, int32_t> >(4);
+  }
+  TFrozenList<Point_view> path() const { return Frozen_::loadView<TFrozenList<Point_view> >(5); }
+
+  // A field added after the data was written
+  TFrozenString note() const {
+    return Frozen_::isSet(6) ? Frozen_::loadView<TFrozenString>(6) : TFrozenString("none");
+  }
+  bool has_note() const { return Frozen_::isSet(6); }
+};
+
+static Route makeRoute() {
+  Route route;
+  route.id = -(1LL << 40);
+  route.name = std::string("a\0b", 3);
+  route.costs.push_back(1.5);
+  route.costs.push_back(-2.25);
+  route.weights["north"] = 3;
+  route.weights["east"] = 1;
+  route.weights["west"] = -4;
+  for (int i = 0; i < 3; ++i) {
+    Point point;
+    point.x = i;
+    point.y = 10 * i;
+    route.path.push_back(point);
+  }
+  return route;
+}
+
+static std::string freeze(const Route& route) {
+  TFrozenWriter writer;
+  writer.finish(route.writeFrozen(writer));
+  return writer.getBuffer();
+}
+
+BOOST_AUTO_TEST_CASE( test_round_trip ) {
+  std::string buffer = freeze(makeRoute());
+  Route_view route = frozenRoot<Route_view>(buffer.data(), buffer.size());
+
+  BOOST_CHECK_EQUAL(route.id(), -(1LL << 40));
+  BOOST_CHECK_EQUAL(route.name().str(), std::string("a\0b", 3));
+  BOOST_CHECK(!route.has_at());
+  BOOST_CHECK(route.at().isNull());
+  BOOST_CHECK_EQUAL(route.at().y(), -1);
+
+  TFrozenList<double> costs = route.costs();
+  BOOST_CHECK_EQUAL(costs.size(), 2u);
+  BOOST_CHECK_EQUAL(costs[0], 1.5);
+  BOOST_CHECK_EQUAL(costs[1], -2.25);
+
+  TFrozenList<Point_view> path = route.path();
+  BOOST_REQUIRE_EQUAL(path.size(), 3u);
+  int sum = 0;
+  for (TFrozenList<Point_view>::const_iterator it = path.begin(); it != path.end(); ++it) {
+    sum += (*it).y();
+  }
+  BOOST_CHECK_EQUAL(sum, 30);
+  BOOST_CHECK_EQUAL(path[2].x(), 2);
+}
+
+BOOST_AUTO_TEST_CASE( test_map_lookup ) {
+  std::string buffer = freeze(makeRoute());
+  TFrozenMap<TFrozenString, int32_t> weights =
+    frozenRoot<Route_view>(buffer.data(), buffer.size()).weights();
+
+  BOOST_CHECK_EQUAL(weights.size(), 3u);
+  int32_t weight = 0;
+  BOOST_CHECK(weights.find(std::string("west"), weight));
+  BOOST_CHECK_EQUAL(weight, -4);
+  BOOST_CHECK(weights.find("east", weight));
+  BOOST_CHECK_EQUAL(weight, 1);
+  BOOST_CHECK(!weights.contains("south"));
+  BOOST_CHECK_EQUAL(weights.keyAt(0).str(), "east");
+}
+
+BOOST_AUTO_TEST_CASE( test_added_fields ) {
+  // Written before note was added, and with at set
+  Route route = makeRoute();
+  route.at.x = 7;
+  route.__isset.at = true;
+  std::string buffer = freeze(route);
+  Route_view view = frozenRoot<Route_view>(buffer.data(), buffer.size());
+
+  BOOST_CHECK(!view.has_note());
+  BOOST_CHECK_EQUAL(view.note().str(), "none");
+  BOOST_CHECK(view.has_at());
+  BOOST_CHECK_EQUAL(view.at().x(), 7);
+}
+
+BOOST_AUTO_TEST_CASE( test_damaged ) {
+  std::string buffer = freeze(makeRoute());
+
+  BOOST_CHECK_THROW(frozenRoot<Route_view>("TFZ0\0\0\0\0", 8), TProtocolException);
+
+  // Every truncation either reads or throws, never reads past the end
+  for (size_t len = 0; len < buffer.size(); ++len) {
+    std::vector<uint8_t> copy(buffer.begin(), buffer.begin() + len);
+    try {
+      Route_view route = frozenRoot<Route_view>(copy.empty() ? NULL : &copy[0], len);
+      route.name();
+      for (uint32_t i = 0; i < route.path().size(); ++i) {
+        route.path()[i].y();
+      }
+      for (uint32_t i = 0; i < route.weights().size(); ++i) {
+        route.weights().keyAt(i);
+      }
+      BOOST_FAIL("truncated buffer read");
+    } catch (const TProtocolException&) {
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_file ) {
+  char path[] = "/tmp/TFrozenTest.XXXXXX";
+  int fd = mkstemp(path);
+  BOOST_REQUIRE(fd >= 0);
+  close(fd);
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << freeze(makeRoute());
+  }
+
+  {
+    TFrozenFile file(path);
+    Route_view route = file.root<Route_view>();
+    BOOST_CHECK_EQUAL(route.path()[1].y(), 10);
+    BOOST_CHECK_EQUAL(route.costs()[0], 1.5);
+  }
+  unlink(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,202 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/THeaderProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/THeaderTransport.h>
+
+BOOST_AUTO_TEST_SUITE( THeaderTransportTest )
+
+using boost::shared_ptr;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::THeaderProtocol;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::T_CALL;
+using apache::thrift::protocol::T_REPLY;
+using apache::thrift::transport::TBufferedTransportFactory;
+using apache::thrift::transport::TFramedTransport;
+using apache::thrift::transport::THeaderTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
+using apache::thrift::transport::TTransportFactory;
+
+// Stands in for a real compressor: it only has to wrap the stream
+static const uint16_t BUFFERED_TRANSFORM = 100;
+
+static void writeMessage(TProtocol& proto, const std::string& name,
+                         TMessageType type, int32_t seqid) {
+  proto.writeMessageBegin(name, type, seqid);
+  proto.writeStructBegin("args");
+  proto.writeFieldBegin("value", apache::thrift::protocol::T_I32, 1);
+  proto.writeI32(seqid * 10);
+  proto.writeFieldEnd();
+  proto.writeFieldStop();
+  proto.writeStructEnd();
+  proto.writeMessageEnd();
+  proto.getTransport()->writeEnd();
+  proto.getTransport()->flush();
+}
+
+static void checkMessage(TProtocol& proto, const std::string& name,
+                         TMessageType type, int32_t seqid) {
+  std::string readName;
+  TMessageType readType;
+  int32_t readSeqid;
+  proto.readMessageBegin(readName, readType, readSeqid);
+  BOOST_CHECK_EQUAL(readName, name);
+  BOOST_CHECK_EQUAL(readType, type);
+  BOOST_CHECK_EQUAL(readSeqid, seqid);
+  proto.skip(apache::thrift::protocol::T_STRUCT);
+  proto.readMessageEnd();
+}
+
+BOOST_AUTO_TEST_CASE( test_header_round_trip ) {
+  shared_ptr<TMemoryBuffer> toServer(new TMemoryBuffer());
+  shared_ptr<TMemoryBuffer> toClient(new TMemoryBuffer());
+
+  shared_ptr<THeaderTransport> clientTrans(new THeaderTransport(toClient, toServer));
+  clientTrans->setTransform(BUFFERED_TRANSFORM,
+                            shared_ptr<TTransportFactory>(new TBufferedTransportFactory()));
+  clientTrans->addWriteTransform(BUFFERED_TRANSFORM);
+  clientTrans->setHeader("trace", "abc123");
+  clientTrans->setHeader(THeaderTransport::CLIENT_TIMEOUT_HEADER, "250");
+  THeaderProtocol client(clientTrans, THeaderTransport::T_COMPACT_PROTOCOL);
+  writeMessage(client, "ping", T_CALL, 7);
+
+  // The server learns protocol, transforms and headers from the frame
+  shared_ptr<THeaderTransport> serverTrans(new THeaderTransport(toServer, toClient));
+  serverTrans->setTransform(BUFFERED_TRANSFORM,
+                            shared_ptr<TTransportFactory>(new TBufferedTransportFactory()));
+  THeaderProtocol server(serverTrans);
+  checkMessage(server, "ping", T_CALL, 7);
+  BOOST_CHECK_EQUAL(serverTrans->getClientType(), THeaderTransport::HEADER_CLIENT_TYPE);
+  BOOST_CHECK_EQUAL(serverTrans->getProtocolId(), THeaderTransport::T_COMPACT_PROTOCOL);
+  BOOST_REQUIRE_EQUAL(serverTrans->getReadTransforms().size(), 1u);
+  BOOST_CHECK_EQUAL(serverTrans->getReadTransforms()[0], BUFFERED_TRANSFORM);
+  BOOST_CHECK_EQUAL(serverTrans->getReadHeaders().find("trace")->second, "abc123");
+
+  // and answers the same way
+  writeMessage(server, "ping", T_REPLY, 7);
+  checkMessage(client, "ping", T_REPLY, 7);
+  BOOST_CHECK_EQUAL(clientTrans->getProtocolId(), THeaderTransport::T_COMPACT_PROTOCOL);
+  BOOST_CHECK_EQUAL(clientTrans->getReadTransforms().size(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE( test_framed_client ) {
+  shared_ptr<TMemoryBuffer> toServer(new TMemoryBuffer());
+  shared_ptr<TMemoryBuffer> toClient(new TMemoryBuffer());
+
+  TBinaryProtocol client(shared_ptr<TFramedTransport>(new TFramedTransport(toServer)));
+  writeMessage(client, "add", T_CALL, 3);
+
+  shared_ptr<THeaderTransport> serverTrans(new THeaderTransport(toServer, toClient));
+  THeaderProtocol server(serverTrans, THeaderTransport::T_COMPACT_PROTOCOL);
+  checkMessage(server, "add", T_CALL, 3);
+  BOOST_CHECK_EQUAL(serverTrans->getClientType(), THeaderTransport::FRAMED_CLIENT_TYPE);
+  BOOST_CHECK_EQUAL(serverTrans->getProtocolId(), THeaderTransport::T_BINARY_PROTOCOL);
+
+  // A framed binary reply, which a plain framed client reads
+  writeMessage(server, "add", T_REPLY, 3);
+  TBinaryProtocol reader(shared_ptr<TFramedTransport>(new TFramedTransport(toClient)));
+  checkMessage(reader, "add", T_REPLY, 3);
+}
+
+BOOST_AUTO_TEST_CASE( test_unframed_client ) {
+  shared_ptr<TMemoryBuffer> toServer(new TMemoryBuffer());
+  shared_ptr<TMemoryBuffer> toClient(new TMemoryBuffer());
+
+  TBinaryProtocol client(toServer);
+  writeMessage(client, "add", T_CALL, 1);
+  writeMessage(client, "add", T_CALL, 2);
+
+  shared_ptr<THeaderTransport> serverTrans(new THeaderTransport(toServer, toClient));
+  THeaderProtocol server(serverTrans);
+  checkMessage(server, "add", T_CALL, 1);
+  BOOST_CHECK_EQUAL(serverTrans->getClientType(), THeaderTransport::UNFRAMED_CLIENT_TYPE);
+  checkMessage(server, "add", T_CALL, 2);
+
+  writeMessage(server, "add", T_REPLY, 2);
+  TBinaryProtocol reader(toClient);
+  checkMessage(reader, "add", T_REPLY, 2);
+}
+
+BOOST_AUTO_TEST_CASE( test_external_framing ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  shared_ptr<THeaderTransport> clientTrans(new THeaderTransport(wire));
+  clientTrans->setHeader("trace", "xyz");
+  THeaderProtocol client(clientTrans);
+  writeMessage(client, "ping", T_CALL, 5);
+
+  // Drop the frame size, as TNonblockingServer does before handing it on
+  std::string frame = wire->getBufferAsString().substr(4);
+  THeaderTransport::StringToStringMap headers;
+  BOOST_REQUIRE(THeaderTransport::readHeaders((const uint8_t*)frame.data(),
+                                              (uint32_t)frame.size(), headers));
+  BOOST_CHECK_EQUAL(headers["trace"], "xyz");
+
+  shared_ptr<TMemoryBuffer> input(new TMemoryBuffer((uint8_t*)&frame[0], (uint32_t)frame.size()));
+  shared_ptr<TMemoryBuffer> output(new TMemoryBuffer());
+  shared_ptr<THeaderTransport> serverTrans(new THeaderTransport(input, output));
+  serverTrans->setExternalFraming(true);
+  THeaderProtocol server(serverTrans);
+  checkMessage(server, "ping", T_CALL, 5);
+  BOOST_CHECK(!serverTrans->peek());
+
+  // The reply goes out without a size for the server to add
+  writeMessage(server, "ping", T_REPLY, 5);
+  std::string reply = output->getBufferAsString();
+  BOOST_REQUIRE_GE(reply.size(), 2u);
+  BOOST_CHECK_EQUAL((uint8_t)reply[0], 0x0f);
+  BOOST_CHECK_EQUAL((uint8_t)reply[1], 0xff);
+}
+
+BOOST_AUTO_TEST_CASE( test_rejected ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+
+  // A transform the server doesn't know
+  shared_ptr<THeaderTransport> clientTrans(new THeaderTransport(wire));
+  clientTrans->setTransform(BUFFERED_TRANSFORM,
+                            shared_ptr<TTransportFactory>(new TBufferedTransportFactory()));
+  clientTrans->addWriteTransform(BUFFERED_TRANSFORM);
+  THeaderProtocol client(clientTrans);
+  writeMessage(client, "ping", T_CALL, 1);
+  THeaderProtocol server(shared_ptr<THeaderTransport>(new THeaderTransport(wire)));
+  try {
+    checkMessage(server, "ping", T_CALL, 1);
+    BOOST_ERROR("unknown transform accepted");
+  } catch (TTransportException& ex) {
+    BOOST_CHECK_EQUAL(ex.getType(), TTransportException::CORRUPTED_DATA);
+  }
+
+  // A frame in no format we know
+  wire.reset(new TMemoryBuffer());
+  wire->write((const uint8_t*)"\x00\x00\x00\x04junk", 8);
+  THeaderProtocol confused(shared_ptr<THeaderTransport>(new THeaderTransport(wire)));
+  try {
+    checkMessage(confused, "ping", T_CALL, 1);
+    BOOST_ERROR("junk accepted");
+  } catch (TTransportException& ex) {
+    BOOST_CHECK_EQUAL(ex.getType(), TTransportException::CORRUPTED_DATA);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,344 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/auto_unit_test.hpp>
+#include <map>
+#include <string>
+#include <thrift/transport/THpack.h>
+#include <thrift/transport/THttp2Session.h>
+#include <thrift/transport/TTransportException.h>
+
+BOOST_AUTO_TEST_SUITE( THttp2SessionTest )
+
+using apache::thrift::transport::THpackDecoder;
+using apache::thrift::transport::THpackEncoder;
+using apache::thrift::transport::THpackHeader;
+using apache::thrift::transport::THpackHeaders;
+using apache::thrift::transport::THttp2Session;
+using apache::thrift::transport::TTransportException;
+
+namespace {
+
+std::string fromHex(const char* hex) {
+  std::string out;
+  for (const char* p = hex; p[0] && p[1]; p += 2) {
+    unsigned int b;
+    sscanf(p, "%2x", &b);
+    out.push_back(static_cast<char>(b));
+  }
+  return out;
+}
+
+THpackHeaders decode(THpackDecoder& decoder, const std::string& block) {
+  THpackHeaders headers;
+  decoder.decode(reinterpret_cast<const uint8_t*>(block.data()),
+                 static_cast<uint32_t>(block.size()), &headers);
+  return headers;
+}
+
+// The three requests of RFC 7541 appendix C.4
+void requestHeaders(int n, THpackHeaders* headers) {
+  headers->push_back(THpackHeader(":method", "GET"));
+  headers->push_back(THpackHeader(":scheme", n < 2 ? "http" : "https"));
+  headers->push_back(THpackHeader(":path", n < 2 ? "/" : "/index.html"));
+  headers->push_back(THpackHeader(":authority", "www.example.com"));
+  if (n == 1) {
+    headers->push_back(THpackHeader("cache-control", "no-cache"));
+  } else if (n == 2) {
+    headers->push_back(THpackHeader("custom-key", "custom-value"));
+  }
+}
+
+const char* RFC_REQUESTS[] = {
+  "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+  "828684be5886a8eb10649cbf",
+  "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"
+};
+
+// Collects what a session hands out
+struct Recorder {
+  std::map<uint32_t, std::string> bodies;
+  std::map<uint32_t, THpackHeaders> headers;
+  std::map<uint32_t, uint32_t> errors;
+
+  void message(uint32_t streamId, const THpackHeaders& h, const std::string& body) {
+    headers[streamId] = h;
+    bodies[streamId] = body;
+  }
+  void error(uint32_t streamId, uint32_t errorCode) {
+    errors[streamId] = errorCode;
+  }
+  void attach(THttp2Session& session) {
+    session.setMessageCallback(apache::thrift::stdcxx::bind(
+        &Recorder::message, this, apache::thrift::stdcxx::placeholders::_1,
+        apache::thrift::stdcxx::placeholders::_2, apache::thrift::stdcxx::placeholders::_3));
+    session.setStreamErrorCallback(apache::thrift::stdcxx::bind(
+        &Recorder::error, this, apache::thrift::stdcxx::placeholders::_1,
+        apache::thrift::stdcxx::placeholders::_2));
+  }
+};
+
+// Move bytes both ways until neither side has anything to say
+void pump(THttp2Session& a, THttp2Session& b) {
+  bool moved = true;
+  while (moved) {
+    moved = false;
+    uint32_t len;
+    const uint8_t* buf;
+    if ((buf = a.getOutput(&len)) != NULL) {
+      std::string copy(reinterpret_cast<const char*>(buf), len);
+      a.consumeOutput(len);
+      b.receive(reinterpret_cast<const uint8_t*>(copy.data()), len);
+      moved = true;
+    }
+    if ((buf = b.getOutput(&len)) != NULL) {
+      std::string copy(reinterpret_cast<const char*>(buf), len);
+      b.consumeOutput(len);
+      a.receive(reinterpret_cast<const uint8_t*>(copy.data()), len);
+      moved = true;
+    }
+  }
+}
+
+THpackHeaders postHeaders() {
+  THpackHeaders headers;
+  headers.push_back(THpackHeader(":method", "POST"));
+  headers.push_back(THpackHeader(":scheme", "http"));
+  headers.push_back(THpackHeader(":authority", "localhost"));
+  headers.push_back(THpackHeader(":path", "/"));
+  headers.push_back(THpackHeader("content-type", "application/x-thrift"));
+  return headers;
+}
+
+THpackHeaders okHeaders() {
+  THpackHeaders headers;
+  headers.push_back(THpackHeader(":status", "200"));
+  return headers;
+}
+
+uint32_t submit(THttp2Session& client, const std::string& body) {
+  return client.submitRequest(postHeaders(), reinterpret_cast<const uint8_t*>(body.data()),
+                              static_cast<uint32_t>(body.size()));
+}
+
+void respond(THttp2Session& server, uint32_t streamId, const std::string& body) {
+  server.submitResponse(streamId, okHeaders(), reinterpret_cast<const uint8_t*>(body.data()),
+                        static_cast<uint32_t>(body.size()));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_hpack_rfc_examples ) {
+  THpackEncoder encoder;
+  THpackDecoder decoder;
+  for (int n = 0; n < 3; ++n) {
+    THpackHeaders headers;
+    requestHeaders(n, &headers);
+
+    std::string block;
+    encoder.encode(headers, &block);
+    BOOST_CHECK_EQUAL(block, fromHex(RFC_REQUESTS[n]));
+    BOOST_CHECK(decode(decoder, block) == headers);
+  }
+
+  // Appendix C.3, the same requests without Huffman coding
+  THpackDecoder plain;
+  THpackHeaders headers;
+  requestHeaders(0, &headers);
+  BOOST_CHECK(decode(plain, fromHex("828684410f7777772e6578616d706c652e636f6d")) == headers);
+  headers.clear();
+  requestHeaders(1, &headers);
+  BOOST_CHECK(decode(plain, fromHex("828684be58086e6f2d6361636865")) == headers);
+}
+
+BOOST_AUTO_TEST_CASE( test_hpack_table_size ) {
+  THpackEncoder encoder;
+  THpackDecoder decoder;
+  THpackHeaders headers;
+  headers.push_back(THpackHeader("x-thrift-binary", std::string(100, '\xff')));
+
+  std::string block;
+  encoder.encode(headers, &block);
+  BOOST_CHECK(decode(decoder, block) == headers);
+  // Indexed the second time around
+  block.clear();
+  encoder.encode(headers, &block);
+  BOOST_CHECK_EQUAL(block.size(), 1u);
+  BOOST_CHECK(decode(decoder, block) == headers);
+
+  // A smaller table evicts the entry and is announced first
+  encoder.setMaxTableSize(64);
+  block.clear();
+  encoder.encode(headers, &block);
+  BOOST_CHECK_EQUAL(static_cast<uint8_t>(block[0]) & 0xe0, 0x20);
+  BOOST_CHECK(decode(decoder, block) == headers);
+
+  // Garbage is rejected rather than misread
+  BOOST_CHECK_THROW(decode(decoder, fromHex("ff")), TTransportException);
+  BOOST_CHECK_THROW(decode(decoder, fromHex("be")), TTransportException);
+  BOOST_CHECK_THROW(decode(decoder, fromHex("408200")), TTransportException);
+}
+
+BOOST_AUTO_TEST_CASE( test_multiplexed_calls ) {
+  THttp2Session client(THttp2Session::CLIENT);
+  THttp2Session server(THttp2Session::SERVER);
+  Recorder clientSeen;
+  Recorder serverSeen;
+  clientSeen.attach(client);
+  serverSeen.attach(server);
+  client.start();
+  server.start();
+
+  uint32_t a = submit(client, "first call");
+  uint32_t b = submit(client, "second call");
+  uint32_t c = submit(client, "");
+  BOOST_CHECK_EQUAL(client.getNumStreams(), 3u);
+  pump(client, server);
+  BOOST_REQUIRE_EQUAL(serverSeen.bodies.size(), 3u);
+  BOOST_CHECK_EQUAL(serverSeen.bodies[a], "first call");
+  BOOST_CHECK_EQUAL(serverSeen.bodies[b], "second call");
+  BOOST_CHECK_EQUAL(serverSeen.bodies[c], "");
+  BOOST_CHECK(serverSeen.headers[a] == postHeaders());
+
+  // Responses in any order
+  respond(server, b, "second reply");
+  pump(client, server);
+  BOOST_CHECK_EQUAL(clientSeen.bodies.size(), 1u);
+  BOOST_CHECK_EQUAL(clientSeen.bodies[b], "second reply");
+  respond(server, c, "");
+  respond(server, a, "first reply");
+  pump(client, server);
+  BOOST_CHECK_EQUAL(clientSeen.bodies[a], "first reply");
+  BOOST_CHECK_EQUAL(clientSeen.bodies[c], "");
+  BOOST_CHECK(clientSeen.headers[a] == okHeaders());
+  BOOST_CHECK(clientSeen.errors.empty());
+  BOOST_CHECK_EQUAL(client.getNumStreams(), 0u);
+  BOOST_CHECK_EQUAL(server.getNumStreams(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_flow_control_and_continuation ) {
+  THttp2Session client(THttp2Session::CLIENT);
+  THttp2Session server(THttp2Session::SERVER);
+  Recorder clientSeen;
+  Recorder serverSeen;
+  clientSeen.attach(client);
+  serverSeen.attach(server);
+  client.start();
+  server.start();
+  pump(client, server);
+
+  // Bigger than the default and our own windows, so it only gets through
+  // with WINDOW_UPDATEs, and headers that need CONTINUATION frames
+  std::string big(3 * 1024 * 1024, 'x');
+  for (size_t i = 0; i < big.size(); i += 4096) {
+    big[i] = static_cast<char>(i / 4096);
+  }
+  THpackHeaders headers = postHeaders();
+  headers.push_back(THpackHeader("x-large", std::string(40000, 'h')));
+  uint32_t id = client.submitRequest(headers, reinterpret_cast<const uint8_t*>(big.data()),
+                                     static_cast<uint32_t>(big.size()));
+  pump(client, server);
+  BOOST_REQUIRE_EQUAL(serverSeen.bodies.size(), 1u);
+  BOOST_CHECK(serverSeen.bodies[id] == big);
+  BOOST_CHECK(serverSeen.headers[id] == headers);
+
+  respond(server, id, big);
+  pump(client, server);
+  BOOST_CHECK(clientSeen.bodies[id] == big);
+}
+
+BOOST_AUTO_TEST_CASE( test_concurrency_limit_and_goaway ) {
+  THttp2Session client(THttp2Session::CLIENT);
+  THttp2Session server(THttp2Session::SERVER);
+  Recorder clientSeen;
+  Recorder serverSeen;
+  clientSeen.attach(client);
+  serverSeen.attach(server);
+  server.setMaxConcurrentStreams(2);
+  client.start();
+  server.start();
+  pump(client, server);
+
+  uint32_t a = submit(client, "a");
+  uint32_t b = submit(client, "b");
+  BOOST_CHECK(!client.canSubmitRequest());
+  pump(client, server);
+
+  respond(server, a, "A");
+  pump(client, server);
+  BOOST_CHECK(client.canSubmitRequest());
+  uint32_t c = submit(client, "c");
+  pump(client, server);
+
+  // Streams open when the server goes away are still answered
+  server.goAway(THttp2Session::H2_NO_ERROR);
+  pump(client, server);
+  BOOST_CHECK(client.isGoingAway());
+  BOOST_CHECK(!client.canSubmitRequest());
+  BOOST_CHECK_EQUAL(serverSeen.bodies.count(c), 1u);
+  respond(server, b, "B");
+  respond(server, c, "C");
+  pump(client, server);
+  BOOST_CHECK_EQUAL(clientSeen.bodies[b], "B");
+  BOOST_CHECK_EQUAL(clientSeen.bodies[c], "C");
+
+  THttp2Session late(THttp2Session::CLIENT);
+  Recorder lateSeen;
+  lateSeen.attach(late);
+  THttp2Session closing(THttp2Session::SERVER);
+  closing.start();
+  late.start();
+  // Streams the server hadn't seen when it went away are refused
+  uint32_t d = submit(late, "d");
+  closing.goAway(THttp2Session::H2_NO_ERROR);
+  uint32_t len;
+  const uint8_t* buf = closing.getOutput(&len);
+  late.receive(buf, len);
+  closing.consumeOutput(len);
+  BOOST_CHECK_EQUAL(lateSeen.errors[d], static_cast<uint32_t>(THttp2Session::H2_REFUSED_STREAM));
+}
+
+BOOST_AUTO_TEST_CASE( test_protocol_errors ) {
+  THttp2Session server(THttp2Session::SERVER);
+  server.start();
+  std::string junk("GET / HTTP/1.1\r\n\r\n");
+  BOOST_CHECK_THROW(server.receive(reinterpret_cast<const uint8_t*>(junk.data()),
+                                   static_cast<uint32_t>(junk.size())),
+                    TTransportException);
+  BOOST_CHECK(server.isGoingAway());
+
+  // A client reset shows up as a stream error, and the late response to it
+  // goes nowhere
+  THttp2Session client(THttp2Session::CLIENT);
+  THttp2Session server2(THttp2Session::SERVER);
+  Recorder serverSeen;
+  serverSeen.attach(server2);
+  client.start();
+  server2.start();
+  uint32_t id = submit(client, "x");
+  pump(client, server2);
+  client.resetStream(id, THttp2Session::H2_CANCEL);
+  pump(client, server2);
+  BOOST_CHECK_EQUAL(serverSeen.errors[id], static_cast<uint32_t>(THttp2Session::H2_CANCEL));
+  respond(server2, id, "too late");
+  BOOST_CHECK_EQUAL(server2.getNumStreams(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
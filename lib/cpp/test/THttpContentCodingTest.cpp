@@ -0,0 +1,199 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <boost/lexical_cast.hpp>
+#include <string>
+#include <thrift/transport/THttpClient.h>
+#include <thrift/transport/THttpServer.h>
+#include <thrift/transport/TZlibTransport.h>
+
+BOOST_AUTO_TEST_SUITE( THttpContentCodingTest )
+
+using boost::shared_ptr;
+using apache::thrift::transport::THttpClient;
+using apache::thrift::transport::THttpContentCoding;
+using apache::thrift::transport::THttpServer;
+using apache::thrift::transport::THttpTransport;
+using apache::thrift::transport::THttpZlibContentCoding;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
+
+static std::string compressibleData(uint32_t len) {
+  std::string data;
+  while (data.size() < len) {
+    data += "{\"num1\":1,\"num2\":2,\"op\":\"ADD\",\"comment\":\"none\"} ";
+  }
+  data.resize(len);
+  return data;
+}
+
+static void writeMessage(THttpTransport& trans, const std::string& data) {
+  trans.write((const uint8_t*)data.data(), static_cast<uint32_t>(data.size()));
+  trans.flush();
+}
+
+static std::string readMessage(THttpTransport& trans, uint32_t len) {
+  std::string data(len, '\0');
+  trans.readAll((uint8_t*)&data[0], len);
+  trans.readEnd();
+  return data;
+}
+
+static shared_ptr<THttpContentCoding> gzip() {
+  return shared_ptr<THttpContentCoding>(new THttpZlibContentCoding());
+}
+
+// Sends the raw request, reads it on server and has server answer with body
+static std::string respond(shared_ptr<TMemoryBuffer> wire,
+                           THttpServer& server,
+                           const std::string& request,
+                           const std::string& body) {
+  wire->write((const uint8_t*)request.data(), static_cast<uint32_t>(request.size()));
+  readMessage(server, 1);
+  writeMessage(server, body);
+  return wire->getBufferAsString();
+}
+
+BOOST_AUTO_TEST_CASE( test_client_decodes_response ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  THttpClient client(wire, "localhost", "/");
+  THttpServer server(wire);
+  client.addContentCoding(gzip());
+  server.addContentCoding(gzip());
+
+  writeMessage(client, "x");
+  BOOST_CHECK(wire->getBufferAsString().find("Accept-Encoding: gzip\r\n")
+              != std::string::npos);
+  BOOST_CHECK_EQUAL(readMessage(server, 1), "x");
+
+  std::string body = compressibleData(64 * 1024);
+  writeMessage(server, body);
+  std::string response = wire->getBufferAsString();
+  BOOST_CHECK(response.find("Content-Encoding: gzip\r\n") != std::string::npos);
+  BOOST_CHECK(response.size() < body.size() / 4);
+  BOOST_CHECK(readMessage(client, static_cast<uint32_t>(body.size())) == body);
+  BOOST_CHECK_EQUAL(wire->available_read(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_small_body_not_compressed ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  THttpClient client(wire, "localhost", "/");
+  THttpServer server(wire);
+  client.addContentCoding(gzip());
+  server.addContentCoding(gzip());
+
+  writeMessage(client, "x");
+  readMessage(server, 1);
+  std::string body = compressibleData(THttpTransport::DEFAULT_COMPRESS_THRESHOLD - 1);
+  writeMessage(server, body);
+  BOOST_CHECK(wire->getBufferAsString().find("Content-Encoding")
+              == std::string::npos);
+  BOOST_CHECK(readMessage(client, static_cast<uint32_t>(body.size())) == body);
+}
+
+BOOST_AUTO_TEST_CASE( test_server_follows_accept_encoding ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  THttpServer server(wire);
+  server.addContentCoding(shared_ptr<THttpContentCoding>(
+      new THttpZlibContentCoding(THttpZlibContentCoding::DEFLATE)));
+  server.addContentCoding(gzip());
+  std::string body = compressibleData(4096);
+
+  // Only the codings the client lists, in the server's order of preference
+  std::string response = respond(wire, server,
+      "POST / HTTP/1.1\r\nAccept-Encoding: br, gzip\r\nContent-Length: 1\r\n\r\nx",
+      body);
+  BOOST_CHECK(response.find("Content-Encoding: gzip\r\n") != std::string::npos);
+  BOOST_CHECK(response.find("Vary: Accept-Encoding\r\n") != std::string::npos);
+
+  wire->resetBuffer();
+  response = respond(wire, server,
+      "POST / HTTP/1.1\r\naccept-encoding: GZIP, Deflate\r\nContent-Length: 1\r\n\r\nx",
+      body);
+  BOOST_CHECK(response.find("Content-Encoding: deflate\r\n") != std::string::npos);
+
+  // q=0 refuses a coding, even when a wildcard would allow it
+  wire->resetBuffer();
+  response = respond(wire, server,
+      "POST / HTTP/1.1\r\nAccept-Encoding: deflate;q=0, *\r\nContent-Length: 1\r\n\r\nx",
+      body);
+  BOOST_CHECK(response.find("Content-Encoding: gzip\r\n") != std::string::npos);
+
+  wire->resetBuffer();
+  response = respond(wire, server,
+      "POST / HTTP/1.1\r\nAccept-Encoding: gzip; q=0, deflate;q=0.0\r\nContent-Length: 1\r\n\r\nx",
+      body);
+  BOOST_CHECK(response.find("Content-Encoding") == std::string::npos);
+
+  // No Accept-Encoding at all gets the body as it is
+  wire->resetBuffer();
+  response = respond(wire, server,
+      "POST / HTTP/1.1\r\nContent-Length: 1\r\n\r\nx", body);
+  BOOST_CHECK(response.find("Content-Encoding") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE( test_server_decodes_request ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  THttpServer server(wire);
+  server.addContentCoding(gzip());
+
+  std::string body = compressibleData(10000);
+  TMemoryBuffer encoded;
+  gzip()->encode((const uint8_t*)body.data(), static_cast<uint32_t>(body.size()),
+                 encoded);
+  std::string compressed = encoded.getBufferAsString();
+
+  std::string request =
+    "POST / HTTP/1.1\r\nContent-Encoding: gzip\r\nContent-Length: "
+    + boost::lexical_cast<std::string>(compressed.size()) + "\r\n\r\n"
+    + compressed;
+  wire->write((const uint8_t*)request.data(), static_cast<uint32_t>(request.size()));
+  BOOST_CHECK(readMessage(server, static_cast<uint32_t>(body.size())) == body);
+}
+
+BOOST_AUTO_TEST_CASE( test_unsupported_or_oversized_body ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  THttpServer server(wire);
+  server.addContentCoding(gzip());
+  uint8_t buf[1];
+
+  std::string request =
+    "POST / HTTP/1.1\r\nContent-Encoding: br\r\nContent-Length: 1\r\n\r\nx";
+  wire->write((const uint8_t*)request.data(), static_cast<uint32_t>(request.size()));
+  BOOST_CHECK_THROW(server.read(buf, 1), TTransportException);
+
+  std::string body = compressibleData(10000);
+  TMemoryBuffer encoded;
+  gzip()->encode((const uint8_t*)body.data(), static_cast<uint32_t>(body.size()),
+                 encoded);
+  std::string compressed = encoded.getBufferAsString();
+  request =
+    "POST / HTTP/1.1\r\nContent-Encoding: gzip\r\nContent-Length: "
+    + boost::lexical_cast<std::string>(compressed.size()) + "\r\n\r\n"
+    + compressed;
+  THttpServer limited(wire);
+  limited.addContentCoding(gzip());
+  limited.setMaxDecodedSize(1000);
+  wire->resetBuffer();
+  wire->write((const uint8_t*)request.data(), static_cast<uint32_t>(request.size()));
+  BOOST_CHECK_THROW(limited.read(buf, 1), TTransportException);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,162 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/THttpClient.h>
+#include <thrift/transport/THttpServer.h>
+
+BOOST_AUTO_TEST_SUITE( THttpTransportTest )
+
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::THttpClient;
+using apache::thrift::transport::THttpServer;
+using apache::thrift::transport::TVirtualTransport;
+using boost::shared_ptr;
+
+namespace {
+
+// Hands out one byte per read(), so that every line straddles refills
+class TrickleTransport : public TVirtualTransport<TrickleTransport> {
+ public:
+  TrickleTransport(shared_ptr<TMemoryBuffer> buffer) : buffer_(buffer) {}
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    return buffer_->read(buf, len > 0 ? 1 : 0);
+  }
+  void write(const uint8_t* buf, uint32_t len) {
+    buffer_->write(buf, len);
+  }
+
+ private:
+  shared_ptr<TMemoryBuffer> buffer_;
+};
+
+std::string readString(THttpServer& server, uint32_t len) {
+  std::string result(len, '\0');
+  server.readAll((uint8_t*)&result[0], len);
+  return result;
+}
+
+void writeString(THttpClient& client, const std::string& str) {
+  client.write((const uint8_t*)str.data(), static_cast<uint32_t>(str.size()));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_pipelined_requests ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  THttpClient client(wire, "localhost", "/");
+  THttpServer server(wire);
+
+  // Both requests are on the wire before the server looks at either
+  writeString(client, "hello");
+  client.flush();
+  writeString(client, "pipelined world");
+  client.flush();
+
+  // The server only reads part of the first body; readEnd() skips the rest
+  BOOST_CHECK_EQUAL(readString(server, 4), "hell");
+  server.readEnd();
+  BOOST_CHECK(server.peek());
+  BOOST_CHECK_EQUAL(readString(server, 15), "pipelined world");
+  server.readEnd();
+  BOOST_CHECK(!server.peek());
+
+  // Responses come back in order over the same connection
+  server.write((const uint8_t*)"one", 3);
+  server.flush();
+  server.write((const uint8_t*)"two", 3);
+  server.flush();
+
+  uint8_t buf[3];
+  client.readAll(buf, 3);
+  BOOST_CHECK_EQUAL(std::string((char*)buf, 3), "one");
+  client.readEnd();
+  client.readAll(buf, 3);
+  BOOST_CHECK_EQUAL(std::string((char*)buf, 3), "two");
+  client.readEnd();
+}
+
+BOOST_AUTO_TEST_CASE( test_chunked_streaming ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  THttpClient client(wire, "localhost", "/");
+  THttpServer server(wire);
+
+  client.setWriteChunkSize(8);
+  writeString(client, "0123");
+  BOOST_CHECK_EQUAL(wire->available_read(), 0u);
+  writeString(client, "456789");
+  // Headers and the first chunk are sent before flush()
+  std::string sent = wire->getBufferAsString();
+  BOOST_CHECK(sent.find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+  BOOST_CHECK(sent.find("Content-Length") == std::string::npos);
+  BOOST_CHECK(sent.find("\r\n\r\na\r\n0123456789\r\n") != std::string::npos);
+  writeString(client, "abc");
+  client.flush();
+
+  // The body reaches the server one chunk at a time
+  uint8_t buf[64];
+  BOOST_CHECK_EQUAL(server.read(buf, sizeof(buf)), 10u);
+  BOOST_CHECK_EQUAL(std::string((char*)buf, 10), "0123456789");
+  BOOST_CHECK_EQUAL(server.read(buf, sizeof(buf)), 3u);
+  BOOST_CHECK_EQUAL(std::string((char*)buf, 3), "abc");
+  server.readEnd();
+  BOOST_CHECK(!server.peek());
+
+  // A short response still goes out with Content-Length
+  server.setWriteChunkSize(8);
+  server.write((const uint8_t*)"ok", 2);
+  server.flush();
+  BOOST_CHECK(wire->getBufferAsString().find("Content-Length: 2\r\n") != std::string::npos);
+  client.readAll(buf, 2);
+  BOOST_CHECK_EQUAL(std::string((char*)buf, 2), "ok");
+  client.readEnd();
+}
+
+BOOST_AUTO_TEST_CASE( test_trickled_headers ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  shared_ptr<TrickleTransport> trickle(new TrickleTransport(wire));
+  THttpServer server(trickle);
+
+  std::string request =
+    "POST / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "content-length: 5\r\n"
+    "\r\n"
+    "hello"
+    "POST / HTTP/1.1\r\n"
+    "TRANSFER-ENCODING: chunked\r\n"
+    "\r\n"
+    "3;ext=1\r\nabc\r\n"
+    "0\r\n"
+    "X-Footer: yes\r\n"
+    "\r\n";
+  wire->write((const uint8_t*)request.data(), static_cast<uint32_t>(request.size()));
+
+  BOOST_CHECK_EQUAL(readString(server, 5), "hello");
+  server.readEnd();
+  BOOST_CHECK_EQUAL(readString(server, 3), "abc");
+  server.readEnd();
+  BOOST_CHECK_EQUAL(wire->available_read(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,183 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <thrift/protocol/TJSONProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TJSONProtocolTest )
+
+using apache::thrift::protocol::TJSONProtocol;
+using apache::thrift::protocol::TProtocolException;
+using apache::thrift::protocol::T_I32;
+using apache::thrift::protocol::T_STRING;
+using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransport;
+using boost::shared_ptr;
+
+// Numbers run until a character that is not part of one, so the JSON is
+// followed by a space
+static shared_ptr<TMemoryBuffer> bufferOf(const std::string& json) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  buf->write((const uint8_t*)json.data(), (uint32_t)json.size());
+  buf->write((const uint8_t*)" ", 1);
+  return buf;
+}
+
+static void endNumber(const shared_ptr<TMemoryBuffer>& buf) {
+  buf->write((const uint8_t*)" ", 1);
+}
+
+// A list of the given strings, written and read back through a transport
+// that hands out at most bufferSize bytes at a time
+static void checkStrings(const std::string* strs, size_t count, uint32_t bufferSize) {
+  shared_ptr<TMemoryBuffer> out(new TMemoryBuffer());
+  TJSONProtocol oprot(out);
+  uint32_t written = oprot.writeListBegin(T_STRING, (uint32_t)count);
+  for (size_t i = 0; i < count; ++i) {
+    written += oprot.writeString(strs[i]);
+  }
+  written += oprot.writeListEnd();
+  BOOST_CHECK_EQUAL(written, out->available_read());
+
+  shared_ptr<TTransport> in(new TBufferedTransport(out, bufferSize));
+  TJSONProtocol iprot(in);
+  apache::thrift::protocol::TType etype;
+  uint32_t size;
+  uint32_t read = iprot.readListBegin(etype, size);
+  BOOST_CHECK_EQUAL(size, count);
+  for (size_t i = 0; i < count; ++i) {
+    std::string str;
+    read += iprot.readString(str);
+    BOOST_CHECK(str == strs[i]);
+  }
+  read += iprot.readListEnd();
+  BOOST_CHECK_EQUAL(read, written);
+}
+
+BOOST_AUTO_TEST_CASE( test_strings ) {
+  std::string control;
+  for (int ch = 0; ch < 0x30; ++ch) {
+    control += (char)ch;
+  }
+  std::string strs[] = {
+    "",
+    "plain",
+    std::string(1000, 'x'),
+    std::string(100, 'y') + "\"quoted\"" + std::string(100, 'z'),
+    "back\\slash at the end\\",
+    control + "\x7f\xc3\xa9\\" + control,
+  };
+  size_t count = sizeof(strs) / sizeof(strs[0]);
+  checkStrings(strs, count, 4096);
+  checkStrings(strs, count, 7);
+  checkStrings(strs, count, 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_integers ) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TJSONProtocol prot(buf);
+  const int64_t values[] = {
+    0, 1, -1, 12345, -98765,
+    (std::numeric_limits<int64_t>::max)(),
+    (std::numeric_limits<int64_t>::min)(),
+  };
+  size_t count = sizeof(values) / sizeof(values[0]);
+  for (size_t i = 0; i < count; ++i) {
+    buf->resetBuffer();
+    prot.writeI64(values[i]);
+    endNumber(buf);
+    int64_t value;
+    prot.readI64(value);
+    BOOST_CHECK_EQUAL(value, values[i]);
+  }
+  buf->resetBuffer();
+  prot.writeI64((std::numeric_limits<int64_t>::min)());
+  BOOST_CHECK_EQUAL(buf->getBufferAsString(), "-9223372036854775808");
+
+  // Map keys are quoted
+  buf->resetBuffer();
+  prot.writeMapBegin(T_I32, T_I32, 1);
+  prot.writeI32(-7);
+  prot.writeI32(8);
+  prot.writeMapEnd();
+  BOOST_CHECK_EQUAL(buf->getBufferAsString(), "[\"i32\",\"i32\",1,{\"-7\":8}]");
+}
+
+BOOST_AUTO_TEST_CASE( test_bad_integers ) {
+  const char* inputs[] = {
+    "32768", "-32769", "1.5", "1e3", "-", "+", "--1", "99999999999999999999",
+  };
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+    TJSONProtocol prot(bufferOf(inputs[i]));
+    int16_t value;
+    BOOST_CHECK_THROW(prot.readI16(value), TProtocolException);
+  }
+
+  int16_t value;
+  TJSONProtocol low(bufferOf("-32768"));
+  low.readI16(value);
+  BOOST_CHECK_EQUAL(value, -32768);
+  TJSONProtocol high(bufferOf("+32767"));
+  high.readI16(value);
+  BOOST_CHECK_EQUAL(value, 32767);
+}
+
+BOOST_AUTO_TEST_CASE( test_doubles ) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TJSONProtocol prot(buf);
+  const double values[] = {
+    0.0, 1.0, -2.5, 0.1, 1e300, -1e-300, 3.141592653589793,
+    (std::numeric_limits<double>::max)(),
+  };
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    buf->resetBuffer();
+    prot.writeDouble(values[i]);
+    endNumber(buf);
+    double value;
+    prot.readDouble(value);
+    BOOST_CHECK_EQUAL(value, values[i]);
+  }
+
+  buf->resetBuffer();
+  prot.writeDouble(0.1);
+  BOOST_CHECK_EQUAL(buf->getBufferAsString(), "0.10000000000000001");
+
+  buf->resetBuffer();
+  prot.writeDouble(std::numeric_limits<double>::infinity());
+  BOOST_CHECK_EQUAL(buf->getBufferAsString(), "\"Infinity\"");
+  buf->resetBuffer();
+  prot.writeDouble(-std::numeric_limits<double>::infinity());
+  BOOST_CHECK_EQUAL(buf->getBufferAsString(), "\"-Infinity\"");
+  buf->resetBuffer();
+  prot.writeDouble(-std::numeric_limits<double>::quiet_NaN());
+  BOOST_CHECK_EQUAL(buf->getBufferAsString(), "\"NaN\"");
+  double value;
+  prot.readDouble(value);
+  BOOST_CHECK(value != value);
+
+  TJSONProtocol bad(bufferOf("1.2.3"));
+  BOOST_CHECK_THROW(bad.readDouble(value), TProtocolException);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
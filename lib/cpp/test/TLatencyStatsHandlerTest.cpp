@@ -0,0 +1,127 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thrift/processor/TLatencyStatsHandler.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+
+BOOST_AUTO_TEST_SUITE( TLatencyStatsHandlerTest )
+
+using apache::thrift::processor::TLatencyStatsHandler;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using boost::shared_ptr;
+
+// One call through the hooks, as a generated processor makes them
+static void call(TLatencyStatsHandler& handler, const char* fn,
+                 uint32_t in, uint32_t out, bool error = false) {
+  void* ctx = handler.getContext(fn, NULL);
+  handler.preRead(ctx, fn);
+  handler.postRead(ctx, fn, in);
+  if (error) {
+    handler.handlerError(ctx, fn);
+  } else {
+    handler.preWrite(ctx, fn);
+    handler.postWrite(ctx, fn, out);
+  }
+  handler.freeContext(ctx, fn);
+}
+
+BOOST_AUTO_TEST_CASE( test_buckets ) {
+  // Each bucket starts where the last ends, and is an eighth of its power
+  // of two wide
+  uint64_t floor = 0;
+  for (int b = 0; b < TLatencyStatsHandler::NUM_BUCKETS; ++b) {
+    uint64_t next = TLatencyStatsHandler::bucketFloor(b);
+    BOOST_CHECK(b == 0 || next > floor);
+    floor = next;
+    BOOST_CHECK_EQUAL(TLatencyStatsHandler::bucketOf(floor), b);
+    if (b > 0) {
+      BOOST_CHECK_EQUAL(TLatencyStatsHandler::bucketOf(floor - 1), b - 1);
+    }
+  }
+  BOOST_CHECK_EQUAL(TLatencyStatsHandler::bucketOf(~static_cast<uint64_t>(0)),
+                    TLatencyStatsHandler::NUM_BUCKETS - 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_percentiles ) {
+  TLatencyStatsHandler::MethodSnapshot s;
+  memset(&s, 0, sizeof(s));
+  for (uint64_t v = 1; v <= 1000; ++v) {
+    ++s.buckets[TLatencyStatsHandler::PHASE_HANDLER][TLatencyStatsHandler::bucketOf(v)];
+    ++s.samples[TLatencyStatsHandler::PHASE_HANDLER];
+  }
+  int64_t p50 = s.percentile(TLatencyStatsHandler::PHASE_HANDLER, 0.5);
+  int64_t p99 = s.percentile(TLatencyStatsHandler::PHASE_HANDLER, 0.99);
+  BOOST_CHECK(p50 >= 500 && p50 < 500 * 9 / 8 + 1);
+  BOOST_CHECK(p99 >= 990 && p99 < 990 * 9 / 8 + 1);
+  BOOST_CHECK_EQUAL(s.percentile(TLatencyStatsHandler::PHASE_READ, 0.5), 0);
+}
+
+class Caller : public Runnable {
+ public:
+  Caller(TLatencyStatsHandler* handler) : handler_(handler) {}
+
+  void run() {
+    for (int i = 0; i < 1000; ++i) {
+      call(*handler_, "Foo.get", 10, 100);
+    }
+  }
+
+ private:
+  TLatencyStatsHandler* handler_;
+};
+
+BOOST_AUTO_TEST_CASE( test_counters ) {
+  TLatencyStatsHandler handler("svc.");
+  call(handler, "Foo.get", 10, 100);
+  call(handler, "Foo.put", 50, 5, true);
+
+  // Calls on other threads are summed in
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  shared_ptr<Thread> threads[4];
+  for (int i = 0; i < 4; ++i) {
+    threads[i] = factory.newThread(shared_ptr<Runnable>(new Caller(&handler)));
+    threads[i]->start();
+  }
+  for (int i = 0; i < 4; ++i) {
+    threads[i]->join();
+  }
+
+  std::map<std::string, int64_t> counters;
+  handler.getCounters(counters);
+  BOOST_CHECK_EQUAL(counters["svc.Foo.get.calls"], 4001);
+  BOOST_CHECK_EQUAL(counters["svc.Foo.get.bytes_in"], 40010);
+  BOOST_CHECK_EQUAL(counters["svc.Foo.get.bytes_out"], 400100);
+  BOOST_CHECK_EQUAL(counters["svc.Foo.put.calls"], 0);
+  BOOST_CHECK_EQUAL(counters["svc.Foo.put.errors"], 1);
+  BOOST_CHECK(counters.count("svc.Foo.get.handler_us.p999") == 1);
+  BOOST_CHECK(counters.count("svc.Foo.put.read_us.p50") == 1);
+
+  std::string text = handler.getStatsText();
+  BOOST_CHECK(text.find("Foo.get") != std::string::npos);
+  BOOST_CHECK(text.find("Foo.put") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,144 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/protocol/TJSONProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp/LazyTest_types.h"
+
+BOOST_AUTO_TEST_SUITE( TLazyTest )
+
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::protocol::TJSONProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::test::lazy::Inner;
+using apache::thrift::test::lazy::Outer;
+using boost::shared_ptr;
+
+// Inner and Outer are generated from LazyTest.thrift, Outer holding its
+// Inner in a field annotated cpp.lazy
+
+static Inner sampleInner() {
+  Inner inner;
+  inner.flag = true;
+  inner.number = -123456;
+  inner.name = std::string(300, 'n');
+  for (int64_t i = 0; i < 40; ++i) {
+    inner.longs.push_back(i * 1000000007LL - 5);
+    inner.bools.push_back(i % 3 == 0);
+  }
+  inner.names[1] = "one";
+  inner.names[-300] = "minus three hundred";
+  return inner;
+}
+
+template <typename Proto>
+static std::string serialize(const Outer& outer) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  Proto prot(buf);
+  outer.write(&prot);
+  return buf->getBufferAsString();
+}
+
+template <typename Proto>
+static uint32_t deserialize(const std::string& data, Outer& outer) {
+  shared_ptr<TMemoryBuffer> buf(
+    new TMemoryBuffer((uint8_t*)data.data(), (uint32_t)data.size()));
+  Proto prot(buf);
+  return outer.read(&prot);
+}
+
+template <typename Proto, typename OtherProto>
+static void checkProtocol() {
+  Outer original;
+  original.id = 7;
+  original.inner = sampleInner();
+  std::string data = serialize<Proto>(original);
+
+  // Read without decoding the inner struct, which goes back out verbatim
+  Outer lazy;
+  BOOST_CHECK_EQUAL(deserialize<Proto>(data, lazy), data.size());
+  BOOST_CHECK_EQUAL(lazy.id, 7);
+  BOOST_CHECK(!lazy.inner.isDecoded());
+  BOOST_CHECK(serialize<Proto>(lazy) == data);
+  BOOST_CHECK(!lazy.inner.isDecoded());
+
+  // Looking at it decodes it, and still leaves the bytes to write
+  BOOST_CHECK(lazy.inner.get() == original.inner.get());
+  BOOST_CHECK(lazy.inner.isDecoded());
+  BOOST_CHECK(serialize<Proto>(lazy) == data);
+
+  // Changed, it is encoded afresh
+  lazy.inner.mutate().number = 99;
+  Outer changed;
+  changed.id = 7;
+  changed.inner = original.inner.get();
+  changed.inner.mutate().number = 99;
+  BOOST_CHECK(serialize<Proto>(lazy) == serialize<Proto>(changed));
+
+  // Written with another protocol, it is decoded and encoded as usual
+  Outer other;
+  deserialize<Proto>(data, other);
+  BOOST_CHECK(serialize<OtherProto>(other) == serialize<OtherProto>(original));
+}
+
+BOOST_AUTO_TEST_CASE( test_binary ) {
+  checkProtocol<TBinaryProtocol, TCompactProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_compact ) {
+  checkProtocol<TCompactProtocol, TBinaryProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_without_raw_support ) {
+  // Protocols with no raw values decode as they read
+  Outer original;
+  original.id = 3;
+  original.inner = sampleInner();
+  std::string data = serialize<TJSONProtocol>(original);
+
+  Outer copy;
+  BOOST_CHECK_EQUAL(deserialize<TJSONProtocol>(data, copy), data.size());
+  BOOST_CHECK(copy.inner.isDecoded());
+  BOOST_CHECK(copy.inner == original.inner);
+  BOOST_CHECK(serialize<TJSONProtocol>(copy) == data);
+}
+
+BOOST_AUTO_TEST_CASE( test_raw_through_small_reads ) {
+  // Raw values are copied however the transport hands out the bytes
+  Outer original;
+  original.inner = sampleInner();
+  std::string data = serialize<TCompactProtocol>(original);
+
+  shared_ptr<TMemoryBuffer> mem(new TMemoryBuffer());
+  mem->write((const uint8_t*)data.data(), (uint32_t)data.size());
+  shared_ptr<apache::thrift::transport::TBufferedTransport> buffered(
+    new apache::thrift::transport::TBufferedTransport(mem, 7));
+  TCompactProtocol prot(buffered);
+  Outer lazy;
+  lazy.read(&prot);
+  BOOST_CHECK(serialize<TCompactProtocol>(lazy) == data);
+  BOOST_CHECK(lazy.inner.get() == original.inner.get());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -21,6 +21,7 @@
 #include <iostream>
 #include <climits>
 #include <cassert>
+#include <vector>
 #include <thrift/transport/TBufferTransports.h>
 #include <thrift/protocol/TBinaryProtocol.h>
 #include "gen-cpp/ThriftTest_types.h"
@@ -104,5 +105,62 @@ BOOST_AUTO_TEST_CASE( test_exceptions )
     }
   }
 
+BOOST_AUTO_TEST_CASE( test_segmented )
+  {
+    using apache::thrift::transport::TSegmentedMemoryBuffer;
+    using apache::thrift::transport::TMemoryBuffer;
+    using apache::thrift::transport::TIOVec;
+    using std::string;
+    using std::vector;
+
+    string data;
+    for (int i = 0; i < 1000; ++i) {
+      data.push_back((char)('a' + i % 26));
+    }
+
+    // Small segments so the data spans several of them
+    TSegmentedMemoryBuffer buf(64);
+    buf.write((const uint8_t*)data.data(), 10);
+    buf.write((const uint8_t*)data.data() + 10, (uint32_t)data.length() - 10);
+    BOOST_CHECK_EQUAL(buf.available_read(), data.length());
+    BOOST_CHECK_EQUAL(buf.getBufferAsString(), data);
+    BOOST_CHECK(buf.getAllocatedSize() >= data.length());
+
+    vector<TIOVec> iov;
+    buf.getSegments(iov);
+    BOOST_CHECK(iov.size() > 1);
+    string gathered;
+    for (size_t i = 0; i < iov.size(); ++i) {
+      gathered.append((const char*)iov[i].base, iov[i].len);
+    }
+    BOOST_CHECK_EQUAL(gathered, data);
+
+    TMemoryBuffer out;
+    buf.writeTo(out);
+    BOOST_CHECK_EQUAL(out.getBufferAsString(), data);
+
+    // Read back in odd-sized pieces across segment boundaries
+    string readBack;
+    uint8_t tmp[37];
+    uint32_t got;
+    while ((got = buf.read(tmp, sizeof(tmp))) > 0) {
+      readBack.append((const char*)tmp, got);
+    }
+    BOOST_CHECK_EQUAL(readBack, data);
+    BOOST_CHECK_EQUAL(buf.available_read(), 0u);
+
+    // Reuse keeps the segments
+    uint32_t allocated = buf.getAllocatedSize();
+    buf.resetBuffer();
+    buf.write((const uint8_t*)data.data(), (uint32_t)data.length());
+    BOOST_CHECK_EQUAL(buf.getAllocatedSize(), allocated);
+    BOOST_CHECK_EQUAL(buf.getBufferAsString(), data);
+
+    // Resizing drops everything but a single new segment
+    buf.resetBuffer(128);
+    BOOST_CHECK_EQUAL(buf.getAllocatedSize(), 128u);
+    BOOST_CHECK_EQUAL(buf.getSegmentSize(), 128u);
+  }
+
 BOOST_AUTO_TEST_SUITE_END()
 
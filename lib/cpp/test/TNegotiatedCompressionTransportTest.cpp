@@ -0,0 +1,141 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TNegotiatedCompressionTransport.h>
+
+BOOST_AUTO_TEST_SUITE( TNegotiatedCompressionTransportTest )
+
+using boost::shared_ptr;
+using apache::thrift::transport::TBufferedTransportFactory;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TNegotiatedCompressionTransport;
+using apache::thrift::transport::TNegotiatedCompressionTransportFactory;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TTransportException;
+using apache::thrift::transport::TTransportFactory;
+
+typedef TNegotiatedCompressionTransport Negotiated;
+
+// Stands in for a real codec: it only has to wrap the stream
+static const uint8_t CODEC_BUFFERED = 100;
+
+static shared_ptr<TNegotiatedCompressionTransportFactory> serverFactory() {
+  shared_ptr<TNegotiatedCompressionTransportFactory> factory(
+    new TNegotiatedCompressionTransportFactory());
+  factory->addCodec(Negotiated::CODEC_NONE, shared_ptr<TTransportFactory>());
+  factory->addCodec(CODEC_BUFFERED,
+                    shared_ptr<TTransportFactory>(new TBufferedTransportFactory()));
+  return factory;
+}
+
+static void roundTrip(uint8_t codec, shared_ptr<TTransportFactory> codecFactory) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  Negotiated client(wire, codec, codecFactory);
+  BOOST_CHECK(client.negotiated());
+  client.write((const uint8_t*)"request", 7);
+  client.flush();
+
+  shared_ptr<TTransport> server = serverFactory()->getTransport(wire);
+  Negotiated* negotiated = static_cast<Negotiated*>(server.get());
+  BOOST_CHECK(!negotiated->negotiated());
+  uint8_t buf[7];
+  BOOST_REQUIRE_EQUAL(server->readAll(buf, 7), 7u);
+  BOOST_CHECK_EQUAL(memcmp(buf, "request", 7), 0);
+  BOOST_CHECK(negotiated->negotiated());
+  BOOST_CHECK_EQUAL(negotiated->getCodec(), codec);
+
+  // The reply comes back in the same codec without a header
+  server->write((const uint8_t*)"reply", 5);
+  server->flush();
+  BOOST_REQUIRE_EQUAL(client.readAll(buf, 5), 5u);
+  BOOST_CHECK_EQUAL(memcmp(buf, "reply", 5), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_no_compression ) {
+  roundTrip(Negotiated::CODEC_NONE, shared_ptr<TTransportFactory>());
+}
+
+BOOST_AUTO_TEST_CASE( test_codec ) {
+  roundTrip(CODEC_BUFFERED,
+            shared_ptr<TTransportFactory>(new TBufferedTransportFactory()));
+}
+
+BOOST_AUTO_TEST_CASE( test_header ) {
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  Negotiated client(wire, CODEC_BUFFERED,
+                    shared_ptr<TTransportFactory>(new TBufferedTransportFactory()));
+  client.flush();
+  std::string sent = wire->getBufferAsString();
+  BOOST_REQUIRE_EQUAL(sent.size(), Negotiated::HEADER_SIZE);
+  BOOST_CHECK_EQUAL((uint8_t)sent[0], Negotiated::HEADER_MAGIC);
+  BOOST_CHECK_EQUAL((uint8_t)sent[1], Negotiated::HEADER_VERSION);
+  BOOST_CHECK_EQUAL((uint8_t)sent[2], CODEC_BUFFERED);
+}
+
+BOOST_AUTO_TEST_CASE( test_rejected ) {
+  uint8_t buf[4];
+
+  // A codec the server doesn't take
+  shared_ptr<TMemoryBuffer> wire(new TMemoryBuffer());
+  Negotiated client(wire, Negotiated::CODEC_ZSTD, shared_ptr<TTransportFactory>());
+  client.write((const uint8_t*)"data", 4);
+  try {
+    serverFactory()->getTransport(wire)->read(buf, 4);
+    BOOST_ERROR("unknown codec accepted");
+  } catch (TTransportException& ex) {
+    BOOST_CHECK_EQUAL(ex.getType(), TTransportException::CORRUPTED_DATA);
+  }
+
+  // A client that doesn't negotiate
+  wire.reset(new TMemoryBuffer());
+  wire->write((const uint8_t*)"\x80\x01\x00\x01", 4);
+  try {
+    serverFactory()->getTransport(wire)->read(buf, 4);
+    BOOST_ERROR("bad header accepted");
+  } catch (TTransportException& ex) {
+    BOOST_CHECK_EQUAL(ex.getType(), TTransportException::CORRUPTED_DATA);
+  }
+
+  // A client that went away
+  wire.reset(new TMemoryBuffer());
+  shared_ptr<TTransport> server = serverFactory()->getTransport(wire);
+  BOOST_CHECK_EQUAL(server->read(buf, 4), 0u);
+  BOOST_CHECK_THROW(server->write(buf, 4), TTransportException);
+}
+
+BOOST_AUTO_TEST_CASE( test_factory_pairs ) {
+  shared_ptr<TNegotiatedCompressionTransportFactory> factory = serverFactory();
+  shared_ptr<TTransport> wire1(new TMemoryBuffer());
+  shared_ptr<TTransport> wire2(new TMemoryBuffer());
+
+  // Input and output for the same client are the same transport
+  shared_ptr<TTransport> in1 = factory->getTransport(wire1);
+  shared_ptr<TTransport> in2 = factory->getTransport(wire2);
+  BOOST_CHECK(in1 != in2);
+  BOOST_CHECK(factory->getTransport(wire1) == in1);
+  BOOST_CHECK(factory->getTransport(wire2) == in2);
+
+  // Once paired, the next connection gets a transport of its own
+  BOOST_CHECK(factory->getTransport(wire1) != in1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
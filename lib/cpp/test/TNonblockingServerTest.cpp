@@ -0,0 +1,2082 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <boost/make_shared.hpp>
+#include <event.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <set>
+#include <thrift/TDeadline.h>
+#include <thrift/TDeferredReply.h>
+#include <thrift/async/TFramedClientChannel.h>
+#include <thrift/async/TRoutingProxyProcessor.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/server/TNonblockingServer.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TDeadlineTransport.h>
+#include <thrift/transport/TSSLSocket.h>
+#include <thrift/transport/TSocket.h>
+
+BOOST_AUTO_TEST_SUITE( TNonblockingServerTest )
+
+// The top level test/keys, with the certificates for the TLS tests
+#ifndef THRIFT_TEST_KEYS
+#define THRIFT_TEST_KEYS "../../../test/keys"
+#endif
+
+using apache::thrift::TDeadline;
+using apache::thrift::TDeferredReply;
+using apache::thrift::TProcessor;
+using apache::thrift::async::TAsyncProcessor;
+using apache::thrift::async::TFramedClientChannel;
+using apache::thrift::async::TRoutingProxyProcessor;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::ThreadManager;
+using apache::thrift::concurrency::Util;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TCompactProtocolFactory;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolFactory;
+using apache::thrift::server::TAdmissionControl;
+using apache::thrift::server::TEventLoop;
+using apache::thrift::server::TIOThreadAssignmentPolicy;
+using apache::thrift::server::TIOThreadStats;
+using apache::thrift::server::TLeastConnectionsPolicy;
+using apache::thrift::server::TLeastPendingBytesPolicy;
+using apache::thrift::server::TNamedInlineCallPolicy;
+using apache::thrift::server::TNonblockingIOThread;
+using apache::thrift::server::TNonblockingServer;
+using apache::thrift::server::TServerEventHandler;
+using apache::thrift::transport::TDeadlineTransport;
+using apache::thrift::transport::TFramedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TSSLSocket;
+using apache::thrift::transport::TSSLSocketFactory;
+using apache::thrift::transport::TSocket;
+using boost::shared_ptr;
+
+// Holds the IO thread in process() until released, closing the connection
+class BlockingProcessor : public TProcessor {
+ public:
+  BlockingProcessor() : entered_(0), released_(false) {}
+
+  virtual bool process(shared_ptr<TProtocol>, shared_ptr<TProtocol>, void*) {
+    Synchronized s(monitor_);
+    ++entered_;
+    monitor_.notifyAll();
+    while (!released_) {
+      monitor_.wait();
+    }
+    return false;
+  }
+
+  bool waitForEntered(int n) {
+    Synchronized s(monitor_);
+    while (entered_ < n) {
+      if (monitor_.waitForTimeRelative(5000) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void release() {
+    Synchronized s(monitor_);
+    released_ = true;
+    monitor_.notifyAll();
+  }
+
+ private:
+  Monitor monitor_;
+  int entered_;
+  bool released_;
+};
+
+// Defers every reply, which answer() then gives: the request's own bytes
+class DeferringProcessor : public TProcessor {
+ public:
+  virtual bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out, void*) {
+    Pending pending;
+    pending.out = out;
+    uint8_t buf[256];
+    uint32_t got;
+    while ((got = in->getTransport()->read(buf, sizeof(buf))) > 0) {
+      pending.request.append(reinterpret_cast<const char*>(buf), got);
+    }
+    pending.complete = TDeferredReply::defer();
+    if (!pending.complete) {
+      out->getTransport()->write(reinterpret_cast<const uint8_t*>(pending.request.data()),
+                                 static_cast<uint32_t>(pending.request.size()));
+      return true;
+    }
+    Synchronized s(monitor_);
+    pending_.push_back(pending);
+    monitor_.notifyAll();
+    return true;
+  }
+
+  bool waitForPending(size_t n) {
+    Synchronized s(monitor_);
+    while (pending_.size() < n) {
+      if (monitor_.waitForTimeRelative(5000) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Answers the oldest deferred call
+  void answer() {
+    Pending pending;
+    {
+      Synchronized s(monitor_);
+      pending = pending_.front();
+      pending_.pop_front();
+    }
+    pending.out->getTransport()->write(
+        reinterpret_cast<const uint8_t*>(pending.request.data()),
+        static_cast<uint32_t>(pending.request.size()));
+    pending.complete();
+  }
+
+ private:
+  struct Pending {
+    shared_ptr<TProtocol> out;
+    std::string request;
+    TDeferredReply::Completion complete;
+  };
+
+  Monitor monitor_;
+  std::deque<Pending> pending_;
+};
+
+// Replies to each call after the delay set for its seqid, and only while
+// open and the seqid isn't held; notes each call's TDeadline::remaining()
+class ReplyingProcessor : public TProcessor {
+ public:
+  ReplyingProcessor() : open_(true), entered_(0) {}
+
+  virtual bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out, void*) {
+    std::string name;
+    TMessageType type;
+    int32_t seqid;
+    in->readMessageBegin(name, type, seqid);
+    in->skip(apache::thrift::protocol::T_STRUCT);
+    in->readMessageEnd();
+    int delayMs;
+    {
+      Synchronized s(monitor_);
+      ++entered_;
+      remaining_[seqid] = TDeadline::remaining();
+      threads_[seqid] = Thread::get_current();
+      monitor_.notifyAll();
+      while (!open_ || held_.count(seqid) != 0) {
+        monitor_.wait();
+      }
+      delayMs = delays_[seqid];
+    }
+    if (delayMs > 0) {
+      usleep(delayMs * 1000);
+    }
+    out->writeMessageBegin(name, apache::thrift::protocol::T_REPLY, seqid);
+    out->writeMessageEnd();
+    out->getTransport()->writeEnd();
+    out->getTransport()->flush();
+    return true;
+  }
+
+  void setDelay(int32_t seqid, int delayMs) {
+    Synchronized s(monitor_);
+    delays_[seqid] = delayMs;
+  }
+
+  void setOpen(bool open) {
+    Synchronized s(monitor_);
+    open_ = open;
+    monitor_.notifyAll();
+  }
+
+  void hold(int32_t seqid) {
+    Synchronized s(monitor_);
+    held_.insert(seqid);
+  }
+
+  void release(int32_t seqid) {
+    Synchronized s(monitor_);
+    held_.erase(seqid);
+    monitor_.notifyAll();
+  }
+
+  int entered() {
+    Synchronized s(monitor_);
+    return entered_;
+  }
+
+  /// The TDeadline::remaining() the call with seqid saw, -2 if not called
+  int64_t remaining(int32_t seqid) {
+    Synchronized s(monitor_);
+    std::map<int32_t, int64_t>::const_iterator it = remaining_.find(seqid);
+    return it == remaining_.end() ? -2 : it->second;
+  }
+
+  /// The thread the call with seqid ran on
+  Thread::id_t thread(int32_t seqid) {
+    Synchronized s(monitor_);
+    return threads_[seqid];
+  }
+
+  bool waitForEntered(int n) {
+    Synchronized s(monitor_);
+    while (entered_ < n) {
+      if (monitor_.waitForTimeRelative(5000) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  Monitor monitor_;
+  std::map<int32_t, int> delays_;
+  std::set<int32_t> held_;
+  std::map<int32_t, int64_t> remaining_;
+  std::map<int32_t, Thread::id_t> threads_;
+  bool open_;
+  int entered_;
+};
+
+// An async processor that holds every call until answer() replies to it,
+// from whichever thread calls that
+class HoldingAsyncProcessor : public TAsyncProcessor {
+ public:
+  virtual void process(apache::thrift::stdcxx::function<void(bool success)> _return,
+                       shared_ptr<TProtocol> in,
+                       shared_ptr<TProtocol> out) {
+    Pending pending;
+    TMessageType type;
+    in->readMessageBegin(pending.name, type, pending.seqid);
+    in->skip(apache::thrift::protocol::T_STRUCT);
+    in->readMessageEnd();
+    pending.out = out;
+    pending.cob = _return;
+    Synchronized s(monitor_);
+    pending_[pending.seqid] = pending;
+    monitor_.notifyAll();
+  }
+
+  bool waitForPending(size_t n) {
+    Synchronized s(monitor_);
+    while (pending_.size() < n) {
+      if (monitor_.waitForTimeRelative(5000) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Replies to the call with seqid, or fails it if not success
+  void answer(int32_t seqid, bool success = true) {
+    Pending pending;
+    {
+      Synchronized s(monitor_);
+      pending = pending_[seqid];
+      pending_.erase(seqid);
+    }
+    if (success) {
+      pending.out->writeMessageBegin(pending.name, apache::thrift::protocol::T_REPLY, seqid);
+      pending.out->writeMessageEnd();
+      pending.out->getTransport()->writeEnd();
+      pending.out->getTransport()->flush();
+    }
+    pending.cob(success);
+  }
+
+ private:
+  struct Pending {
+    std::string name;
+    int32_t seqid;
+    shared_ptr<TProtocol> out;
+    apache::thrift::stdcxx::function<void(bool success)> cob;
+  };
+
+  Monitor monitor_;
+  std::map<int32_t, Pending> pending_;
+};
+
+// Answers each frame with its own bytes
+class EchoProcessor : public TProcessor {
+ public:
+  virtual bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out, void*) {
+    std::string request;
+    uint8_t buf[4096];
+    uint32_t got;
+    while ((got = in->getTransport()->read(buf, sizeof(buf))) > 0) {
+      request.append(reinterpret_cast<const char*>(buf), got);
+    }
+    out->getTransport()->write(reinterpret_cast<const uint8_t*>(request.data()),
+                               static_cast<uint32_t>(request.size()));
+    return true;
+  }
+};
+
+// Round robin, remembering the IO threads for the test to reach
+class RecordingPolicy : public TIOThreadAssignmentPolicy {
+ public:
+  RecordingPolicy() : next_(0) {}
+
+  virtual size_t select(const std::vector<shared_ptr<TNonblockingIOThread> >& ioThreads) {
+    ioThreads_ = ioThreads;
+    return next_++ % ioThreads.size();
+  }
+
+  std::vector<shared_ptr<TNonblockingIOThread> > ioThreads_;
+
+ private:
+  size_t next_;
+};
+
+// Tells start() the server is serving; apart from the runner, so that the
+// connections that keep a copy don't keep the server alive
+class ServeSignal : public TServerEventHandler {
+ public:
+  ServeSignal() : serving_(false) {}
+
+  virtual void preServe() {
+    Synchronized s(monitor_);
+    serving_ = true;
+    monitor_.notifyAll();
+  }
+
+  void wait() {
+    Synchronized s(monitor_);
+    while (!serving_) {
+      monitor_.wait();
+    }
+  }
+
+ private:
+  Monitor monitor_;
+  bool serving_;
+};
+
+// Serves on a thread of its own from start(), on an ephemeral port unless
+// given one.  A server with an asynchronous processor has no listener
+// added, and is reached on the port it was made with, given here too.
+class ServerRunner : public Runnable {
+ public:
+  explicit ServerRunner(const shared_ptr<TNonblockingServer>& server, int port = 0)
+    : server_(server), signal_(new ServeSignal), port_(port), listener_(0), returned_(false) {}
+
+  // self is this runner, which the thread holds until stop().  With a
+  // predecessor, the server takes over the port from the server listening
+  // for a successor there.
+  void start(const shared_ptr<ServerRunner>& self, const std::string& predecessor = "") {
+    if (!server_->getAsyncProcessorFactory()) {
+      listener_ = server_->getNumListeners();
+      server_->addListener(port_,
+                           server_->getProcessorFactory(),
+                           server_->getInputTransportFactory(),
+                           server_->getInputProtocolFactory());
+    }
+    if (!predecessor.empty()) {
+      server_->takeOver(predecessor);
+    }
+    server_->setServerEventHandler(signal_);
+    PlatformThreadFactory factory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+        PlatformThreadFactory::OTHER,
+        PlatformThreadFactory::NORMAL,
+        1,
+#endif
+        false);
+    thread_ = factory.newThread(self);
+    thread_->start();
+    signal_->wait();
+  }
+
+  void stop() {
+    if (thread_) {
+      server_->stop();
+      thread_->join();
+      thread_.reset();
+    }
+  }
+
+  // Waits for serve() to return by itself, as it does once drained
+  bool waitForReturn() {
+    {
+      Synchronized s(monitor_);
+      while (!returned_) {
+        if (monitor_.waitForTimeRelative(5000) != 0) {
+          return false;
+        }
+      }
+    }
+    thread_->join();
+    thread_.reset();
+    return true;
+  }
+
+  virtual void run() {
+    server_->serve();
+    Synchronized s(monitor_);
+    returned_ = true;
+    monitor_.notifyAll();
+  }
+
+  int getPort() const {
+    return server_->getAsyncProcessorFactory() ? server_->getPort()
+                                               : server_->getListenerPort(listener_);
+  }
+
+  shared_ptr<TSocket> connect() const {
+    shared_ptr<TSocket> socket(new TSocket("127.0.0.1", getPort()));
+    socket->setRecvTimeout(5000);
+    socket->open();
+    return socket;
+  }
+
+ private:
+  shared_ptr<TNonblockingServer> server_;
+  shared_ptr<ServeSignal> signal_;
+  shared_ptr<Thread> thread_;
+  int port_;
+  size_t listener_;
+  Monitor monitor_;
+  bool returned_;
+};
+
+static shared_ptr<ServerRunner> startServer(const shared_ptr<TNonblockingServer>& server) {
+  shared_ptr<ServerRunner> runner(new ServerRunner(server));
+  runner->start(runner);
+  return runner;
+}
+
+// Sends payload as one frame
+static void sendFrame(TSocket& socket, const std::string& payload) {
+  uint32_t size = htonl(static_cast<uint32_t>(payload.size()));
+  socket.write(reinterpret_cast<const uint8_t*>(&size), sizeof(size));
+  socket.write(reinterpret_cast<const uint8_t*>(payload.data()),
+               static_cast<uint32_t>(payload.size()));
+}
+
+static std::string recvFrame(TSocket& socket) {
+  uint32_t size;
+  socket.readAll(reinterpret_cast<uint8_t*>(&size), sizeof(size));
+  std::string payload(ntohl(size), '\0');
+  if (!payload.empty()) {
+    socket.readAll(reinterpret_cast<uint8_t*>(&payload[0]),
+                   static_cast<uint32_t>(payload.size()));
+  }
+  return payload;
+}
+
+static TBinaryProtocolFactory binaryProtocolFactory;
+
+// A call framed, in the binary protocol unless given another, its
+// arguments padded with a string of padding bytes for a request of some
+// size
+static std::string callFrame(int32_t seqid,
+                             const std::string& name = "call",
+                             uint32_t padding = 0,
+                             TProtocolFactory& protocolFactory = binaryProtocolFactory) {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+  shared_ptr<TProtocol> protocol = protocolFactory.getProtocol(buffer);
+  protocol->writeMessageBegin(name, apache::thrift::protocol::T_CALL, seqid);
+  protocol->writeStructBegin("args");
+  if (padding > 0) {
+    protocol->writeFieldBegin("padding", apache::thrift::protocol::T_STRING, 1);
+    protocol->writeString(std::string(padding, 'p'));
+    protocol->writeFieldEnd();
+  }
+  protocol->writeFieldStop();
+  protocol->writeStructEnd();
+  protocol->writeMessageEnd();
+  std::string payload = buffer->getBufferAsString();
+  uint32_t size = htonl(static_cast<uint32_t>(payload.size()));
+  return std::string(reinterpret_cast<const char*>(&size), sizeof(size)) + payload;
+}
+
+static void sendBytes(TSocket& socket, const std::string& bytes) {
+  socket.write(reinterpret_cast<const uint8_t*>(bytes.data()),
+               static_cast<uint32_t>(bytes.size()));
+}
+
+// Sends calls with the given seqids in one write, so they arrive together
+static void sendCalls(TSocket& socket,
+                      const std::vector<int32_t>& seqids,
+                      const std::string& name = "call") {
+  std::string frames;
+  for (size_t i = 0; i < seqids.size(); ++i) {
+    frames += callFrame(seqids[i], name);
+  }
+  sendBytes(socket, frames);
+}
+
+// Reads a reply, returning its seqid
+static int32_t recvReply(TSocket& socket,
+                         TMessageType& type,
+                         TProtocolFactory& protocolFactory = binaryProtocolFactory) {
+  std::string payload = recvFrame(socket);
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer(
+      reinterpret_cast<uint8_t*>(&payload[0]), static_cast<uint32_t>(payload.size())));
+  shared_ptr<TProtocol> protocol = protocolFactory.getProtocol(buffer);
+  std::string name;
+  int32_t seqid;
+  protocol->readMessageBegin(name, type, seqid);
+  return seqid;
+}
+
+static shared_ptr<ThreadManager> startThreadManager(size_t workers) {
+  shared_ptr<ThreadManager> threadManager = ThreadManager::newSimpleThreadManager(workers);
+  threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+      PlatformThreadFactory::OTHER,
+      PlatformThreadFactory::NORMAL,
+      1,
+#endif
+      false)));
+  threadManager->start();
+  return threadManager;
+}
+
+// Makes the IO thread's notification channel refuse another wake
+static void fillNotificationChannel(TNonblockingIOThread* ioThread) {
+  int fd = ioThread->getNotificationSendFD();
+  if (fd == ioThread->getNotificationRecvFD()) {
+    // An eventfd counter at its maximum
+    uint64_t max = 0xfffffffffffffffeULL;
+    BOOST_REQUIRE(write(fd, &max, sizeof(max)) == sizeof(max));
+  } else {
+    const char wake = 0;
+    while (send(fd, &wake, 1, MSG_DONTWAIT) == 1) {
+    }
+  }
+}
+
+// Empties the IO thread's notification channel, returning the wakes in it
+static uint64_t takeWakes(TNonblockingIOThread* ioThread) {
+  int fd = ioThread->getNotificationRecvFD();
+  if (fd == ioThread->getNotificationSendFD()) {
+    uint64_t count = 0;
+    return read(fd, &count, sizeof(count)) == sizeof(count) ? count : 0;
+  }
+  uint64_t count = 0;
+  char buf[256];
+  ssize_t n;
+  while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+    count += n;
+  }
+  return count;
+}
+
+static void putWake(TNonblockingIOThread* ioThread) {
+  int fd = ioThread->getNotificationSendFD();
+  if (fd == ioThread->getNotificationRecvFD()) {
+    uint64_t one = 1;
+    BOOST_REQUIRE(write(fd, &one, sizeof(one)) == sizeof(one));
+  } else {
+    const char wake = 0;
+    BOOST_REQUIRE(send(fd, &wake, 1, 0) == 1);
+  }
+}
+
+static bool statsAnswered(TNonblockingIOThread* ioThread, uint64_t ticket) {
+  TIOThreadStats stats;
+  return ioThread->waitForStats(ticket, Util::monotonicTime() + 5000, stats);
+}
+
+BOOST_AUTO_TEST_CASE( test_notify_batch_and_failed_wake ) {
+  shared_ptr<BlockingProcessor> processor(new BlockingProcessor);
+  shared_ptr<TNonblockingServer> server(new TNonblockingServer(processor, 0));
+  shared_ptr<RecordingPolicy> policy(new RecordingPolicy);
+  server->setNumIOThreads(1);
+  server->setIOThreadAssignmentPolicy(policy);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // Park the IO thread in the processor so only the test touches its queue
+  shared_ptr<TSocket> client = runner->connect();
+  sendFrame(*client, "call");
+  BOOST_REQUIRE(processor->waitForEntered(1));
+  TNonblockingIOThread* ioThread = policy->ioThreads_[0].get();
+
+  // A notification whose wake fails is taken back and reported
+  fillNotificationChannel(ioThread);
+  BOOST_CHECK(!ioThread->notify(NULL));
+  takeWakes(ioThread);
+
+  // ...and doesn't leave the next one thinking a wake is on its way.  The
+  // notifications that follow share one wake.
+  ioThread->requestStats(false);
+  ioThread->resumeMemoryWaiters();
+  uint64_t ticket = ioThread->requestStats(false);
+  BOOST_CHECK_EQUAL(takeWakes(ioThread), 1u);
+  putWake(ioThread);
+
+  processor->release();
+  BOOST_CHECK(statsAnswered(ioThread, ticket));
+
+  // Had the failed stop notification stayed queued, the loop would be gone
+  BOOST_CHECK(statsAnswered(ioThread, ioThread->requestStats(false)));
+
+  runner->stop();
+}
+
+// A server whose connections pipeline up to depth calls, run by 4 workers
+static shared_ptr<TNonblockingServer> pipeliningServer(
+    const shared_ptr<ReplyingProcessor>& processor,
+    const shared_ptr<ThreadManager>& threadManager,
+    size_t depth) {
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory);
+  shared_ptr<TNonblockingServer> server(
+      new TNonblockingServer(processor, protocolFactory, 0, threadManager));
+  server->setNumIOThreads(1);
+  server->setPipelineDepth(depth);
+  return server;
+}
+
+BOOST_AUTO_TEST_CASE( test_pipeline_replies_in_order ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(4);
+  shared_ptr<ServerRunner> runner = startServer(pipeliningServer(processor, threadManager, 4));
+
+  // Later calls finish first, but are answered in turn
+  std::vector<int32_t> seqids;
+  for (int32_t i = 0; i < 4; ++i) {
+    processor->setDelay(i, (3 - i) * 20);
+    seqids.push_back(i);
+  }
+  shared_ptr<TSocket> client = runner->connect();
+  sendCalls(*client, seqids);
+  for (int32_t i = 0; i < 4; ++i) {
+    TMessageType type;
+    BOOST_CHECK_EQUAL(recvReply(*client, type), i);
+    BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  }
+
+  client->close();
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_pipeline_replies_out_of_order ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(4);
+  shared_ptr<TNonblockingServer> server = pipeliningServer(processor, threadManager, 4);
+  server->setPipelineOutOfOrder(true);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  std::vector<int32_t> seqids;
+  for (int32_t i = 0; i < 4; ++i) {
+    processor->setDelay(i, (3 - i) * 50);
+    seqids.push_back(i);
+  }
+  shared_ptr<TSocket> client = runner->connect();
+  sendCalls(*client, seqids);
+  std::vector<int32_t> answered;
+  for (int32_t i = 0; i < 4; ++i) {
+    TMessageType type;
+    answered.push_back(recvReply(*client, type));
+  }
+  BOOST_CHECK_EQUAL(answered.front(), 3);
+  BOOST_CHECK_EQUAL(answered.back(), 0);
+  std::sort(answered.begin(), answered.end());
+  BOOST_CHECK(answered == seqids);
+
+  client->close();
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_pipeline_clients_interleaved ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(4);
+  shared_ptr<ServerRunner> runner = startServer(pipeliningServer(processor, threadManager, 4));
+
+  // The calls of all clients run at once, and each gets its own answers,
+  // in turn
+  const int kClients = 8;
+  const int kCalls = 4;
+  std::vector<shared_ptr<TSocket> > clients;
+  for (int c = 0; c < kClients; ++c) {
+    clients.push_back(runner->connect());
+    std::vector<int32_t> seqids;
+    for (int i = 0; i < kCalls; ++i) {
+      int32_t seqid = c * 100 + i;
+      processor->setDelay(seqid, ((c + i) % kCalls) * 5);
+      seqids.push_back(seqid);
+    }
+    sendCalls(*clients[c], seqids);
+  }
+  for (int c = 0; c < kClients; ++c) {
+    for (int i = 0; i < kCalls; ++i) {
+      TMessageType type;
+      BOOST_CHECK_EQUAL(recvReply(*clients[c], type), c * 100 + i);
+    }
+    clients[c]->close();
+  }
+
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_pipeline_overload ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(4);
+  shared_ptr<TNonblockingServer> server = pipeliningServer(processor, threadManager, 4);
+  server->setPipelineOutOfOrder(true);
+  server->setMaxActiveProcessors(1);
+  server->setOverloadAction(apache::thrift::server::T_OVERLOAD_CLOSE_ON_ACCEPT);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // With one call running the server is full, so the calls pipelined
+  // behind it are refused, as a second connection would have been
+  processor->setOpen(false);
+  std::vector<int32_t> seqids;
+  for (int32_t i = 0; i < 3; ++i) {
+    seqids.push_back(i);
+  }
+  shared_ptr<TSocket> client = runner->connect();
+  sendCalls(*client, seqids);
+  BOOST_REQUIRE(processor->waitForEntered(1));
+  for (int32_t i = 1; i < 3; ++i) {
+    TMessageType type;
+    BOOST_CHECK_EQUAL(recvReply(*client, type), i);
+    BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_EXCEPTION);
+  }
+
+  processor->setOpen(true);
+  TMessageType type;
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 0);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+
+  client->close();
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_deferred_reply_after_client_closes ) {
+  shared_ptr<DeferringProcessor> processor(new DeferringProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(1);
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory);
+  shared_ptr<TNonblockingServer> server(
+      new TNonblockingServer(processor, protocolFactory, 0, threadManager));
+  server->setNumIOThreads(1);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // The client is gone by the time its reply is ready
+  shared_ptr<TSocket> gone = runner->connect();
+  sendFrame(*gone, "gone");
+  BOOST_REQUIRE(processor->waitForPending(1));
+  gone->close();
+  processor->answer();
+
+  // The connection, and maybe its task, go to the next client, which gets
+  // its own reply and nothing of the last one's
+  for (int i = 0; i < 3; ++i) {
+    shared_ptr<TSocket> client = runner->connect();
+    sendFrame(*client, "next");
+    BOOST_REQUIRE(processor->waitForPending(1));
+    processor->answer();
+    BOOST_CHECK_EQUAL(recvFrame(*client), "next");
+    client->close();
+  }
+
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_deferred_reply_after_server_closes ) {
+  shared_ptr<DeferringProcessor> processor(new DeferringProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(1);
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory);
+  shared_ptr<TNonblockingServer> server(
+      new TNonblockingServer(processor, protocolFactory, 0, threadManager));
+  server->setNumIOThreads(1);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  shared_ptr<TSocket> client = runner->connect();
+  sendFrame(*client, "late");
+  BOOST_REQUIRE(processor->waitForPending(1));
+
+  // Destroying the server closes the connection under the deferred call,
+  // whose completion must then leave both alone
+  runner->stop();
+  runner.reset();
+  BOOST_REQUIRE(server.unique());
+  server.reset();
+  processor->answer();
+
+  client->close();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_reused_task_carries_nothing_over ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(1);
+  shared_ptr<TNonblockingServer> server = pipeliningServer(processor, threadManager, 4);
+  shared_ptr<apache::thrift::server::TNamedTaskPriorityPolicy> policy(
+      new apache::thrift::server::TNamedTaskPriorityPolicy);
+  server->setTaskPriorityPolicy(policy);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // The policy has each task read its header on the IO thread.  A frame
+  // whose header can't be read is dropped, and the call after it, likely
+  // given the same task, is answered all the same, under its own seqid.
+  shared_ptr<TSocket> client = runner->connect();
+  for (int32_t i = 0; i < 4; ++i) {
+    sendFrame(*client, "x");
+    sendCalls(*client, std::vector<int32_t>(1, i));
+    TMessageType type;
+    BOOST_CHECK_EQUAL(recvReply(*client, type), i);
+    BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  }
+
+  // Pipelined calls reuse the tasks of the ones before them
+  for (int32_t round = 0; round < 4; ++round) {
+    std::vector<int32_t> seqids;
+    for (int32_t i = 0; i < 4; ++i) {
+      seqids.push_back(100 * (round + 1) + i);
+    }
+    sendCalls(*client, seqids);
+    for (int32_t i = 0; i < 4; ++i) {
+      TMessageType type;
+      BOOST_CHECK_EQUAL(recvReply(*client, type), seqids[i]);
+      BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+    }
+  }
+
+  client->close();
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_admission_control_codel ) {
+  // A 5ms target over 100ms intervals, the clock driven by hand
+  TAdmissionControl control(5, 100);
+
+  // A burst some calls wait long in, while others get through quickly,
+  // is absorbed
+  BOOST_CHECK(control.admit("a", 0));
+  BOOST_CHECK(control.admit("a", 0));
+  control.started("a", 50, 10);
+  control.started("a", 2, 20);
+  BOOST_CHECK(control.admit("a", 100));
+  BOOST_CHECK(!control.isOverloaded());
+
+  // An interval in which even the shortest wait is over target is a
+  // standing queue
+  control.started("a", 6, 150);
+  BOOST_CHECK(control.admit("a", 200));
+  BOOST_CHECK(control.isOverloaded());
+  BOOST_CHECK_EQUAL(control.getRefusedCount(), 0u);
+
+  // Now a client at its fair share of the queue is refused, and one with
+  // nothing queued let in: a has 1 of 1 queued
+  BOOST_CHECK(!control.admit("a", 201));
+  BOOST_CHECK(control.admit("b", 201));
+  // a and b have 1 of 2 each
+  BOOST_CHECK(!control.admit("a", 202));
+  BOOST_CHECK(!control.admit("b", 202));
+  BOOST_CHECK(control.admit("c", 202));
+  // a dropped its call, so has nothing queued
+  control.dropped("a");
+  BOOST_CHECK(control.admit("a", 203));
+  BOOST_CHECK_EQUAL(control.getRefusedCount(), 3u);
+
+  // Workers stuck for a whole interval keep the overload going
+  BOOST_CHECK(!control.admit("a", 300));
+  BOOST_CHECK(control.isOverloaded());
+
+  // One call getting through in time ends it
+  control.started("a", 1, 310);
+  control.started("b", 9, 320);
+  control.started("c", 9, 330);
+  BOOST_CHECK(control.admit("a", 400));
+  BOOST_CHECK(!control.isOverloaded());
+  BOOST_CHECK(control.admit("a", 401));
+  BOOST_CHECK_EQUAL(control.getRefusedCount(), 4u);
+}
+
+BOOST_AUTO_TEST_CASE( test_admission_control_empty_queue ) {
+  TAdmissionControl control(5, 100);
+  BOOST_CHECK(control.admit("a", 0));
+  control.started("a", 50, 10);
+  BOOST_CHECK(control.admit("a", 100));
+  BOOST_CHECK(control.isOverloaded());
+
+  // An interval with nothing started and nothing queued ends the overload
+  control.dropped("a");
+  BOOST_CHECK(control.admit("a", 200));
+  BOOST_CHECK(!control.isOverloaded());
+}
+
+// Admits and starts calls for clients of its own, as IO threads and
+// workers do at once
+class AdmissionRunner : public Runnable {
+ public:
+  AdmissionRunner(TAdmissionControl* control, int id)
+    : control_(control), id_(id) {}
+
+  void run() {
+    for (int i = 0; i < 2000; ++i) {
+      std::string client(1, static_cast<char>('a' + (id_ * 7 + i) % 26));
+      if (control_->admit(client, i)) {
+        if (i % 3 == 0) {
+          control_->dropped(client);
+        } else {
+          control_->started(client, 50, i);
+        }
+      }
+    }
+  }
+
+ private:
+  TAdmissionControl* control_;
+  int id_;
+};
+
+BOOST_AUTO_TEST_CASE( test_admission_control_threads ) {
+  TAdmissionControl control(5, 100);
+  PlatformThreadFactory factory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+      PlatformThreadFactory::OTHER,
+      PlatformThreadFactory::NORMAL,
+      1,
+#endif
+      false);
+  std::vector<shared_ptr<Thread> > threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.push_back(factory.newThread(
+        shared_ptr<Runnable>(new AdmissionRunner(&control, i))));
+    threads.back()->start();
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+
+  // With every call accounted for, an interval with nothing started and
+  // nothing queued ends the overload
+  BOOST_CHECK(control.admit("main", 2500));
+  control.started("main", 50, 2600);
+  BOOST_CHECK(control.admit("main", 3000));
+  BOOST_CHECK(control.isOverloaded());
+  control.dropped("main");
+  BOOST_CHECK(control.admit("main", 3100));
+  BOOST_CHECK(!control.isOverloaded());
+}
+
+// IO threads that are never started, for a policy to choose among
+static std::vector<shared_ptr<TNonblockingIOThread> > idleIOThreads(TNonblockingServer* server,
+                                                                   int n) {
+  std::vector<shared_ptr<TNonblockingIOThread> > ioThreads;
+  for (int i = 0; i < n; ++i) {
+    ioThreads.push_back(shared_ptr<TNonblockingIOThread>(
+        new TNonblockingIOThread(server, i, THRIFT_INVALID_SOCKET, false)));
+  }
+  return ioThreads;
+}
+
+BOOST_AUTO_TEST_CASE( test_least_connections_policy ) {
+  TNonblockingServer server(shared_ptr<TProcessor>(new BlockingProcessor), 0);
+  std::vector<shared_ptr<TNonblockingIOThread> > ioThreads = idleIOThreads(&server, 3);
+  TLeastConnectionsPolicy policy;
+
+  // Tied threads are taken in turn
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 0u);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 1u);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 2u);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 0u);
+
+  ioThreads[0]->addConnections(2);
+  ioThreads[1]->addConnections(1);
+  ioThreads[2]->addConnections(3);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 1u);
+
+  // Among the threads tied for fewest, the search starts after the last
+  // one chosen
+  ioThreads[1]->addConnections(1);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 0u);
+  ioThreads[0]->addConnections(1);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 1u);
+
+  // Closed connections count again at once
+  ioThreads[2]->addConnections(-3);
+  BOOST_CHECK_EQUAL(ioThreads[2]->getNumConnections(), 0u);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 2u);
+}
+
+BOOST_AUTO_TEST_CASE( test_least_pending_bytes_policy ) {
+  TNonblockingServer server(shared_ptr<TProcessor>(new BlockingProcessor), 0);
+  std::vector<shared_ptr<TNonblockingIOThread> > ioThreads = idleIOThreads(&server, 3);
+  TLeastPendingBytesPolicy policy;
+
+  ioThreads[0]->addPendingBytes(100);
+  ioThreads[1]->addPendingBytes(50);
+  ioThreads[2]->addPendingBytes(200);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 1u);
+
+  // Equal bytes fall back to connections...
+  ioThreads[0]->addPendingBytes(-50);
+  ioThreads[0]->addConnections(1);
+  ioThreads[1]->addConnections(2);
+  BOOST_CHECK_EQUAL(ioThreads[0]->getPendingBytes(), 50u);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 0u);
+
+  // ...and then turns
+  ioThreads[1]->addConnections(-1);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 1u);
+  BOOST_CHECK_EQUAL(policy.select(ioThreads), 0u);
+}
+
+// Adds to and takes from an IO thread's counts, as its connections and
+// the workers running their calls do at once
+class CountingRunner : public Runnable {
+ public:
+  explicit CountingRunner(TNonblockingIOThread* ioThread) : ioThread_(ioThread) {}
+
+  void run() {
+    for (int i = 0; i < 20000; ++i) {
+      ioThread_->addConnections(1);
+      ioThread_->addPendingBytes(i % 500);
+      ioThread_->addPendingBytes(-(i % 500));
+      ioThread_->addConnections(-1);
+      ioThread_->addPendingBytes(3);
+    }
+    ioThread_->addConnections(1);
+  }
+
+ private:
+  TNonblockingIOThread* ioThread_;
+};
+
+BOOST_AUTO_TEST_CASE( test_io_thread_counts_threads ) {
+  TNonblockingServer server(shared_ptr<TProcessor>(new BlockingProcessor), 0);
+  std::vector<shared_ptr<TNonblockingIOThread> > ioThreads = idleIOThreads(&server, 1);
+  PlatformThreadFactory factory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+      PlatformThreadFactory::OTHER,
+      PlatformThreadFactory::NORMAL,
+      1,
+#endif
+      false);
+  std::vector<shared_ptr<Thread> > threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.push_back(factory.newThread(
+        shared_ptr<Runnable>(new CountingRunner(ioThreads[0].get()))));
+    threads.back()->start();
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+
+  BOOST_CHECK_EQUAL(ioThreads[0]->getNumConnections(), 4u);
+  BOOST_CHECK_EQUAL(ioThreads[0]->getPendingBytes(), 4u * 20000u * 3u);
+}
+
+// Waits for the server's IO threads to hold total connections between them
+static bool waitForConnections(TNonblockingServer& server,
+                               size_t total,
+                               std::vector<TIOThreadStats>& stats) {
+  int64_t deadline = Util::monotonicTime() + 5000;
+  do {
+    server.getIOThreadStats(stats, false);
+    size_t sum = 0;
+    for (size_t i = 0; i < stats.size(); ++i) {
+      sum += stats[i].connections;
+    }
+    if (sum == total) {
+      return true;
+    }
+    THRIFT_SLEEP_USEC(1000);
+  } while (Util::monotonicTime() < deadline);
+  return false;
+}
+
+BOOST_AUTO_TEST_CASE( test_least_connections_policy_serving ) {
+  shared_ptr<TNonblockingServer> server(
+      new TNonblockingServer(shared_ptr<TProcessor>(new BlockingProcessor), 0));
+  server->setNumIOThreads(2);
+  server->setIOThreadAssignmentPolicy(
+      shared_ptr<TIOThreadAssignmentPolicy>(new TLeastConnectionsPolicy));
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // Each connection goes to the thread with fewer
+  std::vector<TIOThreadStats> stats;
+  std::vector<shared_ptr<TSocket> > clients;
+  for (size_t i = 1; i <= 4; ++i) {
+    clients.push_back(runner->connect());
+    BOOST_REQUIRE(waitForConnections(*server, i, stats));
+  }
+  BOOST_REQUIRE_EQUAL(stats.size(), 2u);
+  BOOST_CHECK_EQUAL(stats[0].connections, 2u);
+  BOOST_CHECK_EQUAL(stats[1].connections, 2u);
+
+  // ...and is counted off when it closes
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i]->close();
+  }
+  BOOST_CHECK(waitForConnections(*server, 0, stats));
+
+  runner->stop();
+}
+
+// Waits for the server to close socket, returning when it did, or -1 if
+// it didn't within the socket's receive timeout
+static int64_t waitForClose(TSocket& socket) {
+  uint8_t byte;
+  try {
+    if (socket.read(&byte, 1) != 0) {
+      return -1;
+    }
+  } catch (const apache::thrift::transport::TTransportException& x) {
+    if (x.getType() == apache::thrift::transport::TTransportException::TIMED_OUT) {
+      return -1;
+    }
+  }
+  return Util::monotonicTime();
+}
+
+static void checkStalledReadTimeouts(TEventLoop::Backend backend) {
+  shared_ptr<TNonblockingServer> server(
+      new TNonblockingServer(shared_ptr<TProcessor>(new ReplyingProcessor), 0));
+  server->setNumIOThreads(1);
+  server->setEventLoopBackend(backend);
+  server->setHeaderReadTimeout(150);
+  server->setBodyReadTimeout(600);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // One client stalls halfway through its frame size, the other halfway
+  // through the frame, and each is closed at its own deadline
+  shared_ptr<TSocket> header = runner->connect();
+  shared_ptr<TSocket> body = runner->connect();
+  std::vector<TIOThreadStats> stats;
+  BOOST_REQUIRE(waitForConnections(*server, 2, stats));
+  int64_t start = Util::monotonicTime();
+  const uint8_t half[2] = {0, 0};
+  header->write(half, sizeof(half));
+  std::string frame(4, '\0');
+  uint32_t size = htonl(100);
+  std::copy(reinterpret_cast<const char*>(&size),
+            reinterpret_cast<const char*>(&size) + sizeof(size),
+            frame.begin());
+  frame.append(10, 'x');
+  body->write(reinterpret_cast<const uint8_t*>(frame.data()),
+              static_cast<uint32_t>(frame.size()));
+
+  int64_t headerClosed = waitForClose(*header);
+  BOOST_REQUIRE(headerClosed >= 0);
+  BOOST_CHECK_GE(headerClosed - start, 140);
+  BOOST_CHECK_LT(headerClosed - start, 550);
+  int64_t bodyClosed = waitForClose(*body);
+  BOOST_REQUIRE(bodyClosed >= 0);
+  BOOST_CHECK_GE(bodyClosed - start, 590);
+  BOOST_CHECK_LT(bodyClosed - start, 2000);
+
+  // ...and goes back to the server's stack
+  BOOST_CHECK(waitForConnections(*server, 0, stats));
+  BOOST_CHECK_EQUAL(server->getNumIdleConnections(), 2u);
+
+  // A client that doesn't stall is still answered
+  shared_ptr<TSocket> client = runner->connect();
+  sendCalls(*client, std::vector<int32_t>(1, 7));
+  TMessageType type;
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 7);
+
+  client->close();
+  header->close();
+  body->close();
+  runner->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_stalled_read_timeouts ) {
+  checkStalledReadTimeouts(TEventLoop::BACKEND_LIBEVENT);
+#ifdef HAVE_SYS_EPOLL_H
+  checkStalledReadTimeouts(TEventLoop::BACKEND_EPOLL);
+#endif
+}
+
+// The read buffer size of the server's only connection
+static uint32_t readBufferSize(TNonblockingServer& server) {
+  std::vector<TIOThreadStats> stats;
+  server.getIOThreadStats(stats, true);
+  for (size_t i = 0; i < stats.size(); ++i) {
+    if (!stats[i].connectionStats.empty()) {
+      return stats[i].connectionStats[0].readBufferSize;
+    }
+  }
+  return 0;
+}
+
+BOOST_AUTO_TEST_CASE( test_connection_cache ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<TNonblockingServer> server(new TNonblockingServer(processor, 0));
+  server->setNumIOThreads(2);
+  server->setConnectionStackLimit(2);
+  server->setIdleReadBufferLimit(1024);
+  server->setBufferTrimAge(300);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // Each IO thread keeps its share of the idle connection objects...
+  std::vector<shared_ptr<TSocket> > clients;
+  for (int32_t i = 0; i < 6; ++i) {
+    clients.push_back(runner->connect());
+    sendCalls(*clients.back(), std::vector<int32_t>(1, i));
+    TMessageType type;
+    BOOST_CHECK_EQUAL(recvReply(*clients.back(), type), i);
+  }
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i]->close();
+  }
+  std::vector<TIOThreadStats> stats;
+  BOOST_REQUIRE(waitForConnections(*server, 0, stats));
+  int64_t closed = Util::monotonicTime();
+  BOOST_REQUIRE_EQUAL(stats.size(), 2u);
+  BOOST_CHECK_EQUAL(stats[0].cachedConnections, 1u);
+  BOOST_CHECK_EQUAL(stats[1].cachedConnections, 1u);
+
+  // ...and frees them once they have been idle for the trim age
+  while (server->getNumIdleConnections() > 0 && Util::monotonicTime() < closed + 5000) {
+    THRIFT_SLEEP_USEC(1000);
+  }
+  BOOST_CHECK_EQUAL(server->getNumIdleConnections(), 0u);
+  BOOST_CHECK_GE(Util::monotonicTime() - closed, 250);
+
+  // A big read buffer is kept while calls keep needing it, and trimmed
+  // once none has for the trim age
+  shared_ptr<TSocket> client = runner->connect();
+  TMessageType type;
+  for (int32_t i = 0; i < 3; ++i) {
+    sendBytes(*client, callFrame(i, "call", 256 * 1024));
+    BOOST_CHECK_EQUAL(recvReply(*client, type), i);
+    sendCalls(*client, std::vector<int32_t>(1, 10 + i));
+    BOOST_CHECK_EQUAL(recvReply(*client, type), 10 + i);
+    BOOST_CHECK_GT(readBufferSize(*server), 1024u);
+  }
+  THRIFT_SLEEP_USEC(400 * 1000);
+  sendCalls(*client, std::vector<int32_t>(1, 20));
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 20);
+  BOOST_CHECK_LE(readBufferSize(*server), 1024u);
+
+  client->close();
+  runner->stop();
+}
+
+// Sends a call through transport, a TDeadlineTransport over a framed one,
+// with a budget of budgetMs
+static void sendWithBudget(TDeadlineTransport& transport, int32_t seqid, uint32_t budgetMs) {
+  transport.setBudget(budgetMs);
+  // Without the frame size, which the framed transport writes
+  std::string payload = callFrame(seqid).substr(4);
+  transport.write(reinterpret_cast<const uint8_t*>(payload.data()),
+                  static_cast<uint32_t>(payload.size()));
+  transport.flush();
+}
+
+BOOST_AUTO_TEST_CASE( test_client_deadlines ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(1);
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory);
+  shared_ptr<TNonblockingServer> server(
+      new TNonblockingServer(processor, protocolFactory, 0, threadManager));
+  server->setNumIOThreads(1);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // The handler sees the budget the client sent, and no deadline without
+  shared_ptr<TSocket> socket = runner->connect();
+  TDeadlineTransport deadline(shared_ptr<TFramedTransport>(new TFramedTransport(socket)));
+  sendWithBudget(deadline, 1, 2000);
+  TMessageType type;
+  BOOST_CHECK_EQUAL(recvReply(*socket, type), 1);
+  BOOST_CHECK_GT(processor->remaining(1), 0);
+  BOOST_CHECK_LE(processor->remaining(1), 2000);
+  sendWithBudget(deadline, 2, 0);
+  BOOST_CHECK_EQUAL(recvReply(*socket, type), 2);
+  BOOST_CHECK_EQUAL(processor->remaining(2), -1);
+
+  // A call still queued when its deadline passes is dropped rather than
+  // run, and its connection closed
+  processor->hold(3);
+  shared_ptr<TSocket> blocker = runner->connect();
+  sendCalls(*blocker, std::vector<int32_t>(1, 3));
+  BOOST_REQUIRE(processor->waitForEntered(3));
+  sendWithBudget(deadline, 4, 50);
+  THRIFT_SLEEP_USEC(200 * 1000);
+  processor->release(3);
+  uint8_t byte;
+  try {
+    BOOST_CHECK_EQUAL(socket->read(&byte, 1), 0u);
+  } catch (const apache::thrift::transport::TTransportException& x) {
+    BOOST_CHECK(x.getType() != apache::thrift::transport::TTransportException::TIMED_OUT);
+  }
+  BOOST_CHECK_EQUAL(processor->remaining(4), -2);
+  BOOST_CHECK_EQUAL(recvReply(*blocker, type), 3);
+
+  blocker->close();
+  socket->close();
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_hot_restart ) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/thrift-test-restart-%d", (int)getpid());
+
+  shared_ptr<ReplyingProcessor> oldProcessor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> oldThreadManager = startThreadManager(1);
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory);
+  shared_ptr<TNonblockingServer> oldServer(
+      new TNonblockingServer(oldProcessor, protocolFactory, 0, oldThreadManager));
+  oldServer->setNumIOThreads(1);
+  oldServer->setHotRestartPath(path);
+  shared_ptr<ServerRunner> oldRunner = startServer(oldServer);
+
+  // One client idle between calls, the other with a call under way
+  TMessageType type;
+  shared_ptr<TSocket> idle = oldRunner->connect();
+  sendCalls(*idle, std::vector<int32_t>(1, 1));
+  BOOST_CHECK_EQUAL(recvReply(*idle, type), 1);
+  shared_ptr<TSocket> busy = oldRunner->connect();
+  oldProcessor->hold(2);
+  sendCalls(*busy, std::vector<int32_t>(1, 2));
+  BOOST_REQUIRE(oldProcessor->waitForEntered(2));
+
+  shared_ptr<ReplyingProcessor> newProcessor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> newThreadManager = startThreadManager(1);
+  shared_ptr<TNonblockingServer> newServer(
+      new TNonblockingServer(newProcessor, protocolFactory, 0, newThreadManager));
+  newServer->setNumIOThreads(1);
+  shared_ptr<ServerRunner> newRunner(new ServerRunner(newServer, oldRunner->getPort()));
+  newRunner->start(newRunner, path);
+
+  // The idle connection moves to the new server at once...
+  std::vector<TIOThreadStats> stats;
+  BOOST_REQUIRE(waitForConnections(*oldServer, 1, stats));
+  sendCalls(*idle, std::vector<int32_t>(1, 3));
+  BOOST_CHECK_EQUAL(recvReply(*idle, type), 3);
+  BOOST_CHECK_EQUAL(newProcessor->entered(), 1);
+
+  // ...and the busy one once its call is answered, after which the old
+  // server is done
+  oldProcessor->release(2);
+  BOOST_CHECK_EQUAL(recvReply(*busy, type), 2);
+  BOOST_CHECK(oldRunner->waitForReturn());
+  sendCalls(*busy, std::vector<int32_t>(1, 4));
+  BOOST_CHECK_EQUAL(recvReply(*busy, type), 4);
+  BOOST_CHECK_EQUAL(newProcessor->entered(), 2);
+  BOOST_CHECK_EQUAL(oldProcessor->entered(), 2);
+
+  // New clients reach the new server on the same port
+  shared_ptr<TSocket> fresh = newRunner->connect();
+  sendCalls(*fresh, std::vector<int32_t>(1, 5));
+  BOOST_CHECK_EQUAL(recvReply(*fresh, type), 5);
+  BOOST_CHECK_EQUAL(newProcessor->entered(), 3);
+
+  idle->close();
+  busy->close();
+  fresh->close();
+  newRunner->stop();
+  newThreadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_listeners ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ReplyingProcessor> otherProcessor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(1);
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory);
+  shared_ptr<TNonblockingServer> server(
+      new TNonblockingServer(processor, protocolFactory, 0, threadManager));
+  server->setNumIOThreads(1);
+  shared_ptr<TCompactProtocolFactory> compactProtocolFactory(new TCompactProtocolFactory);
+  server->addListener(0,
+                      otherProcessor,
+                      shared_ptr<apache::thrift::transport::TTransportFactory>(
+                        new apache::thrift::transport::TTransportFactory),
+                      compactProtocolFactory);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // The second port speaks its own protocol to its own processor, on the
+  // same IO thread as the first
+  shared_ptr<TSocket> other(new TSocket("127.0.0.1", server->getListenerPort(0)));
+  other->setRecvTimeout(5000);
+  other->open();
+  sendBytes(*other, callFrame(1, "call", 0, *compactProtocolFactory));
+  TMessageType type;
+  BOOST_CHECK_EQUAL(recvReply(*other, type, *compactProtocolFactory), 1);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  shared_ptr<TSocket> client = runner->connect();
+  sendCalls(*client, std::vector<int32_t>(1, 2));
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 2);
+  BOOST_CHECK_EQUAL(otherProcessor->entered(), 1);
+  BOOST_CHECK_EQUAL(processor->entered(), 1);
+  std::vector<TIOThreadStats> stats;
+  BOOST_REQUIRE(waitForConnections(*server, 2, stats));
+  BOOST_CHECK_EQUAL(stats.size(), 1u);
+
+  other->close();
+  client->close();
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_frames_per_read ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<TNonblockingServer> server(new TNonblockingServer(processor, 0));
+  server->setNumIOThreads(1);
+  shared_ptr<ServerRunner> runner = startServer(server);
+  shared_ptr<TSocket> client = runner->connect();
+  TMessageType type;
+
+  // Many small frames in one write, more than one receive takes, are each
+  // answered in turn
+  std::vector<int32_t> seqids;
+  for (int32_t i = 0; i < 4000; ++i) {
+    seqids.push_back(i);
+  }
+  sendCalls(*client, seqids);
+  for (int32_t i = 0; i < 4000; ++i) {
+    BOOST_REQUIRE_EQUAL(recvReply(*client, type), i);
+  }
+
+  // A frame size split over two writes, and frames bigger than the buffer
+  // arriving in pieces, with the start of the next frame after them
+  std::string frames = callFrame(5000) + callFrame(5001, "call", 200 * 1024) + callFrame(5002);
+  size_t cuts[] = {2, 7, 40 * 1024, 150 * 1024, frames.size() - 3, frames.size()};
+  size_t done = 0;
+  for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); ++i) {
+    sendBytes(*client, frames.substr(done, cuts[i] - done));
+    done = cuts[i];
+    THRIFT_SLEEP_USEC(20 * 1000);
+  }
+  for (int32_t i = 5000; i < 5003; ++i) {
+    BOOST_CHECK_EQUAL(recvReply(*client, type), i);
+  }
+
+  client->close();
+  runner->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_zero_copy_sends ) {
+  shared_ptr<EchoProcessor> processor(new EchoProcessor);
+  shared_ptr<TNonblockingServer> server(new TNonblockingServer(processor, 0));
+  server->setNumIOThreads(1);
+  server->setZeroCopyThreshold(64 * 1024);
+  server->setUseBufferPool(true);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // Large responses, sent without copying where the kernel can, or copied
+  // as over loopback, come back whole and each with its own bytes, small
+  // ones among them
+  shared_ptr<TSocket> client = runner->connect();
+  uint32_t sizes[] = {1024 * 1024, 1024 * 1024, 100, 2 * 1024 * 1024, 64 * 1024, 10};
+  for (int round = 0; round < 2; ++round) {
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+      std::string payload(sizes[i], static_cast<char>('a' + i + round));
+      payload[0] = static_cast<char>(i);
+      sendFrame(*client, payload);
+      BOOST_CHECK(recvFrame(*client) == payload);
+    }
+  }
+
+  client->close();
+  runner->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_connection_cold_state_reused ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(4);
+  shared_ptr<TNonblockingServer> server = pipeliningServer(processor, threadManager, 4);
+  server->setZeroCopyThreshold(1024);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // The pipelining state a connection makes when it first pipelines goes
+  // with it into the cache, and serves the client it is reused for
+  for (int32_t c = 0; c < 3; ++c) {
+    shared_ptr<TSocket> client = runner->connect();
+    TMessageType type;
+    int32_t base = c * 100;
+    sendCalls(*client, std::vector<int32_t>(1, base));
+    BOOST_CHECK_EQUAL(recvReply(*client, type), base);
+    std::vector<int32_t> seqids;
+    for (int32_t i = 1; i <= 4; ++i) {
+      processor->setDelay(base + i, (4 - i) * 10);
+      seqids.push_back(base + i);
+    }
+    sendCalls(*client, seqids);
+    for (int32_t i = 1; i <= 4; ++i) {
+      BOOST_CHECK_EQUAL(recvReply(*client, type), base + i);
+    }
+    sendCalls(*client, std::vector<int32_t>(1, base + 5));
+    BOOST_CHECK_EQUAL(recvReply(*client, type), base + 5);
+    client->close();
+    std::vector<TIOThreadStats> stats;
+    BOOST_REQUIRE(waitForConnections(*server, 0, stats));
+    BOOST_CHECK_EQUAL(server->getNumIdleConnections(), 1u);
+  }
+
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_service_thread_managers ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(1);
+  shared_ptr<ThreadManager> slowThreadManager = startThreadManager(1);
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory);
+  shared_ptr<TNonblockingServer> server(
+      new TNonblockingServer(processor, protocolFactory, 0, threadManager));
+  server->setNumIOThreads(1);
+  server->setServiceThreadManager("Slow", slowThreadManager);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // The slow service's calls tie up its one worker and queue behind it...
+  processor->hold(1);
+  processor->hold(2);
+  shared_ptr<TSocket> slow1 = runner->connect();
+  shared_ptr<TSocket> slow2 = runner->connect();
+  sendCalls(*slow1, std::vector<int32_t>(1, 1), "Slow:call");
+  sendCalls(*slow2, std::vector<int32_t>(1, 2), "Slow:call");
+  BOOST_REQUIRE(processor->waitForEntered(1));
+
+  // ...while the other services' calls keep running
+  TMessageType type;
+  shared_ptr<TSocket> fast = runner->connect();
+  sendCalls(*fast, std::vector<int32_t>(1, 3), "Fast:call");
+  BOOST_CHECK_EQUAL(recvReply(*fast, type), 3);
+  sendCalls(*fast, std::vector<int32_t>(1, 4));
+  BOOST_CHECK_EQUAL(recvReply(*fast, type), 4);
+  BOOST_CHECK_EQUAL(processor->entered(), 3);
+  BOOST_CHECK_EQUAL(slowThreadManager->pendingTaskCount(), 1u);
+
+  processor->release(1);
+  processor->release(2);
+  BOOST_CHECK_EQUAL(recvReply(*slow1, type), 1);
+  BOOST_CHECK_EQUAL(recvReply(*slow2, type), 2);
+
+  slow1->close();
+  slow2->close();
+  fast->close();
+  runner->stop();
+  threadManager->stop();
+  slowThreadManager->stop();
+}
+
+// Runs calls to the Cheap service inline on a server pipelining up to
+// depth calls per connection, checking each ran on the thread expected
+static void checkInlineCalls(size_t depth) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(1);
+  shared_ptr<TNonblockingServer> server = pipeliningServer(processor, threadManager, depth);
+  shared_ptr<RecordingPolicy> assignment(new RecordingPolicy);
+  server->setIOThreadAssignmentPolicy(assignment);
+  shared_ptr<TNamedInlineCallPolicy> policy(new TNamedInlineCallPolicy);
+  policy->setInline("Cheap");
+  policy->setInline("Cheap:slow", false);
+  server->setInlineCallPolicy(policy);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // The only worker is tied up...
+  processor->hold(1);
+  shared_ptr<TSocket> pooled = runner->connect();
+  sendCalls(*pooled, std::vector<int32_t>(1, 1), "Busy:call");
+  BOOST_REQUIRE(processor->waitForEntered(1));
+
+  // ...yet the cheap calls are answered, by the IO thread that read them
+  TMessageType type;
+  shared_ptr<TSocket> client = runner->connect();
+  std::vector<int32_t> seqids;
+  seqids.push_back(2);
+  seqids.push_back(3);
+  sendCalls(*client, seqids, "Cheap:call");
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 2);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 3);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  Thread::id_t ioThread = assignment->ioThreads_[0]->getThreadId();
+  BOOST_CHECK(processor->thread(2) == ioThread);
+  BOOST_CHECK(processor->thread(3) == ioThread);
+  BOOST_CHECK(processor->thread(1) != ioThread);
+  BOOST_CHECK_EQUAL(threadManager->pendingTaskCount(), 0u);
+
+  // A method kept off the table waits for the pool, and the inline call
+  // behind it on the connection is answered after it
+  sendCalls(*client, std::vector<int32_t>(1, 4), "Cheap:slow");
+  sendCalls(*client, std::vector<int32_t>(1, 5), "Cheap:call");
+  processor->release(1);
+  BOOST_CHECK_EQUAL(recvReply(*pooled, type), 1);
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 4);
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 5);
+  BOOST_CHECK(processor->thread(4) == processor->thread(1));
+  BOOST_CHECK(processor->thread(5) == ioThread);
+
+  pooled->close();
+  client->close();
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_inline_calls ) {
+  checkInlineCalls(1);
+}
+
+BOOST_AUTO_TEST_CASE( test_inline_calls_pipelined ) {
+  checkInlineCalls(4);
+}
+
+// The replies a TFramedClientChannel hands back, in the order it does
+struct ChannelReplies {
+  explicit ChannelReplies(struct event_base* eb) : eb(eb), awaited(0) {}
+
+  // Sends a call through channel, to be noted as reply i
+  void call(TFramedClientChannel& channel, size_t i, const std::string& name, int32_t seqid) {
+    shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer);
+    TBinaryProtocol protocol(buffer);
+    protocol.writeMessageBegin(name, apache::thrift::protocol::T_CALL, seqid);
+    protocol.writeStructBegin("args");
+    protocol.writeFieldStop();
+    protocol.writeStructEnd();
+    protocol.writeMessageEnd();
+    if (recvBufs.size() <= i) {
+      recvBufs.resize(i + 1);
+      names.resize(i + 1);
+      seqids.resize(i + 1);
+      errors.resize(i + 1);
+    }
+    recvBufs[i].reset(new TMemoryBuffer);
+    ++awaited;
+    channel.sendAndRecvMessage(
+        apache::thrift::stdcxx::bind(&ChannelReplies::received, this, i),
+        buffer.get(),
+        recvBufs[i].get());
+  }
+
+  void received(size_t i) {
+    order.push_back(i);
+    try {
+      TBinaryProtocol protocol(recvBufs[i]);
+      TMessageType type;
+      protocol.readMessageBegin(names[i], type, seqids[i]);
+      BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+    } catch (const apache::thrift::transport::TTransportException& x) {
+      errors[i] = x.what();
+    }
+    if (--awaited == 0) {
+      event_base_loopbreak(eb);
+    }
+  }
+
+  // Runs the loop until every call made is answered or fails
+  void wait() {
+    if (awaited > 0) {
+      event_base_dispatch(eb);
+    }
+  }
+
+  struct event_base* eb;
+  int awaited;
+  std::vector<shared_ptr<TMemoryBuffer> > recvBufs;
+  std::vector<std::string> names;
+  std::vector<int32_t> seqids;
+  std::vector<std::string> errors;
+  std::vector<size_t> order;
+};
+
+BOOST_AUTO_TEST_CASE( test_framed_client_channel ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(4);
+  shared_ptr<TNonblockingServer> server = pipeliningServer(processor, threadManager, 4);
+  server->setPipelineOutOfOrder(true);
+  shared_ptr<ServerRunner> runner = startServer(server);
+  struct event_base* eb = event_base_new();
+  shared_ptr<TFramedClientChannel> channel(
+      new TFramedClientChannel("127.0.0.1", runner->getPort(), eb));
+  ChannelReplies replies(eb);
+
+  // Calls all numbered 0 by their client share the connection; each reply
+  // comes back to its own call, with the client's id, as it is finished.
+  // The server sees the channel's ids, 1 on.
+  for (int32_t id = 1; id <= 4; ++id) {
+    processor->setDelay(id, (4 - id) * 50);
+  }
+  const char* names[] = {"first", "second", "third", "fourth"};
+  for (size_t i = 0; i < 4; ++i) {
+    replies.call(*channel, i, names[i], 0);
+  }
+  BOOST_CHECK_EQUAL(channel->getNumInFlight(), 4u);
+  replies.wait();
+  for (size_t i = 0; i < 4; ++i) {
+    BOOST_CHECK_EQUAL(replies.names[i], names[i]);
+    BOOST_CHECK_EQUAL(replies.seqids[i], 0);
+    BOOST_CHECK(replies.errors[i].empty());
+  }
+  BOOST_REQUIRE_EQUAL(replies.order.size(), 4u);
+  BOOST_CHECK_EQUAL(replies.order.front(), 3u);
+  BOOST_CHECK_EQUAL(replies.order.back(), 0u);
+  BOOST_CHECK_EQUAL(channel->getNumInFlight(), 0u);
+  BOOST_CHECK(channel->good());
+
+  // A call not answered in time fails, and its late reply is dropped
+  // rather than taken for the next call's
+  channel->setTimeout(100);
+  processor->hold(5);
+  replies.call(*channel, 4, "late", 41);
+  replies.wait();
+  BOOST_CHECK(!replies.errors[4].empty());
+  BOOST_CHECK(channel->timedOut());
+  processor->release(5);
+  BOOST_REQUIRE(processor->waitForEntered(5));
+  usleep(50 * 1000);
+  channel->setTimeout(0);
+  replies.call(*channel, 5, "after", 42);
+  replies.wait();
+  BOOST_CHECK_EQUAL(replies.names[5], "after");
+  BOOST_CHECK_EQUAL(replies.seqids[5], 42);
+  BOOST_CHECK_EQUAL(channel->getNumInFlight(), 0u);
+
+  channel.reset();
+  event_base_free(eb);
+  runner->stop();
+  threadManager->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_memory_budget ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<ThreadManager> threadManager = startThreadManager(2);
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory);
+  shared_ptr<TNonblockingServer> server(
+      new TNonblockingServer(processor, protocolFactory, 0, threadManager));
+  server->setNumIOThreads(1);
+  server->setMemoryBudget(64 * 1024);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // A request that doesn't fit beside the one being served isn't read...
+  processor->hold(1);
+  shared_ptr<TSocket> first = runner->connect();
+  sendBytes(*first, callFrame(1, "call", 40 * 1024));
+  BOOST_REQUIRE(processor->waitForEntered(1));
+  BOOST_CHECK_GE(server->getMemoryInUse(), 40u * 1024u);
+  shared_ptr<TSocket> second = runner->connect();
+  sendBytes(*second, callFrame(2, "call", 40 * 1024));
+  THRIFT_SLEEP_USEC(100 * 1000);
+  BOOST_CHECK_EQUAL(processor->entered(), 1);
+  BOOST_CHECK_LT(server->getMemoryInUse(), 64u * 1024u);
+
+  // ...until the memory is freed
+  processor->release(1);
+  TMessageType type;
+  BOOST_CHECK_EQUAL(recvReply(*first, type), 1);
+  BOOST_CHECK_EQUAL(recvReply(*second, type), 2);
+
+  // A request bigger than the whole budget is still served, alone
+  sendBytes(*first, callFrame(3, "call", 100 * 1024));
+  BOOST_CHECK_EQUAL(recvReply(*first, type), 3);
+  std::vector<TIOThreadStats> stats;
+  first->close();
+  second->close();
+  BOOST_REQUIRE(waitForConnections(*server, 0, stats));
+  BOOST_CHECK_EQUAL(server->getMemoryInUse(), 0u);
+
+  runner->stop();
+  threadManager->stop();
+}
+
+// Binds a socket to an ephemeral port without listening on it, so that
+// connections there are refused for as long as it stays open
+static int bindUnlistened(int& port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  bind(fd, reinterpret_cast<struct sockaddr*>(&addr), len);
+  getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+  port = ntohs(addr.sin_port);
+  return fd;
+}
+
+BOOST_AUTO_TEST_CASE( test_routing_proxy ) {
+  shared_ptr<ReplyingProcessor> calculator(new ReplyingProcessor);
+  shared_ptr<ReplyingProcessor> pinger(new ReplyingProcessor);
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory);
+  shared_ptr<ServerRunner> calculatorRunner = startServer(shared_ptr<TNonblockingServer>(
+      new TNonblockingServer(calculator, protocolFactory, 0)));
+  shared_ptr<ServerRunner> pingerRunner = startServer(shared_ptr<TNonblockingServer>(
+      new TNonblockingServer(pinger, protocolFactory, 0)));
+
+  shared_ptr<TRoutingProxyProcessor> proxy(new TRoutingProxyProcessor);
+  proxy->addRoute("Calculator", "127.0.0.1", calculatorRunner->getPort());
+  proxy->addRoute("ping", "127.0.0.1", pingerRunner->getPort());
+  int downPort;
+  int down = bindUnlistened(downPort);
+  proxy->addRoute("down", "127.0.0.1", downPort);
+  proxy->start();
+  int port;
+  close(bindUnlistened(port));
+  shared_ptr<ServerRunner> runner(new ServerRunner(
+      shared_ptr<TNonblockingServer>(new TNonblockingServer(proxy, protocolFactory, port)),
+      port));
+  runner->start(runner);
+
+  // By service, by method name, and not at all
+  shared_ptr<TSocket> client = runner->connect();
+  TMessageType type;
+  sendBytes(*client, callFrame(1, "Calculator:add"));
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 1);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  sendBytes(*client, callFrame(2, "ping"));
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 2);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  sendBytes(*client, callFrame(3, "nowhere"));
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 3);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_EXCEPTION);
+  BOOST_CHECK_EQUAL(calculator->entered(), 1);
+  BOOST_CHECK_EQUAL(pinger->entered(), 1);
+
+  // Clients sharing the backend connection each get their own seqid back,
+  // and a large request reaches the backend whole
+  shared_ptr<TSocket> other = runner->connect();
+  sendBytes(*client, callFrame(7, "Calculator:add"));
+  sendBytes(*other, callFrame(7, "Calculator:add", 256 * 1024));
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 7);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  BOOST_CHECK_EQUAL(recvReply(*other, type), 7);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  BOOST_CHECK_EQUAL(calculator->entered(), 3);
+
+  // A call the backend fails is answered with an exception
+  sendBytes(*client, callFrame(8, "down"));
+  BOOST_CHECK_EQUAL(recvReply(*client, type), 8);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_EXCEPTION);
+
+  client->close();
+  other->close();
+  runner->stop();
+  proxy->stop();
+  calculatorRunner->stop();
+  pingerRunner->stop();
+  close(down);
+}
+
+// Clients of a server on its port, with the connections open counted on
+// each IO thread
+static size_t connectAndCall(TNonblockingServer& server,
+                             std::vector<shared_ptr<TSocket> >& clients,
+                             std::vector<TIOThreadStats>& stats) {
+  TMessageType type;
+  for (int32_t i = 0; i < 32; ++i) {
+    clients.push_back(shared_ptr<TSocket>(new TSocket("127.0.0.1", server.getPort())));
+    clients.back()->setRecvTimeout(5000);
+    clients.back()->open();
+    sendCalls(*clients.back(), std::vector<int32_t>(1, i));
+    BOOST_CHECK_EQUAL(recvReply(*clients.back(), type), i);
+  }
+  BOOST_REQUIRE(waitForConnections(server, clients.size(), stats));
+  size_t busyThreads = 0;
+  for (size_t i = 0; i < stats.size(); ++i) {
+    if (stats[i].connections > 0) {
+      ++busyThreads;
+    }
+  }
+  return busyThreads;
+}
+
+BOOST_AUTO_TEST_CASE( test_reuse_port ) {
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<TNonblockingServer> server(new TNonblockingServer(processor, 0));
+  server->setNumIOThreads(4);
+  server->setUseReusePort(true);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // Every IO thread binds the port the first was given and accepts there,
+  // the kernel spreading the clients between them
+  BOOST_CHECK_NE(server->getPort(), 0);
+  std::vector<shared_ptr<TSocket> > clients;
+  std::vector<TIOThreadStats> stats;
+  size_t busyThreads = connectAndCall(*server, clients, stats);
+#ifdef SO_REUSEPORT
+  BOOST_CHECK(server->getUseReusePort());
+  BOOST_CHECK_GT(busyThreads, 1u);
+#else
+  BOOST_CHECK(!server->getUseReusePort());
+#endif
+  BOOST_CHECK_EQUAL(stats.size(), 4u);
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i]->close();
+  }
+  runner->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_reuse_port_fallback ) {
+  // A listen socket passed in can't be told to share its port, so thread
+  // #0 accepts on it alone and hands the clients round, as it does where
+  // SO_REUSEPORT isn't available
+  int port;
+  int fd = bindUnlistened(port);
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<TNonblockingServer> server(new TNonblockingServer(processor, port));
+  server->setNumIOThreads(4);
+  server->setUseReusePort(true);
+  server->listenSocket(fd);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  BOOST_CHECK(!server->getUseReusePort());
+  std::vector<shared_ptr<TSocket> > clients;
+  std::vector<TIOThreadStats> stats;
+  BOOST_CHECK_EQUAL(connectAndCall(*server, clients, stats), 4u);
+  for (size_t i = 0; i < stats.size(); ++i) {
+    BOOST_CHECK_EQUAL(stats[i].connections, 8u);
+  }
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i]->close();
+  }
+  runner->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_async_processor ) {
+  shared_ptr<HoldingAsyncProcessor> processor(new HoldingAsyncProcessor);
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory);
+  shared_ptr<TNonblockingServer> server(new TNonblockingServer(processor, protocolFactory, 0));
+  server->setNumIOThreads(1);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // One IO thread and no workers take every client's call at once...
+  const int32_t kClients = 16;
+  std::vector<shared_ptr<TSocket> > clients;
+  for (int32_t i = 0; i < kClients; ++i) {
+    clients.push_back(runner->connect());
+    sendCalls(*clients.back(), std::vector<int32_t>(1, i));
+  }
+  BOOST_REQUIRE(processor->waitForPending(kClients));
+
+  // ...and reply to each as its callback fires, here from the test's thread
+  TMessageType type;
+  for (int32_t i = kClients - 1; i >= 0; --i) {
+    processor->answer(i);
+    BOOST_CHECK_EQUAL(recvReply(*clients[i], type), i);
+    BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  }
+
+  // A connection goes back to reading once answered
+  sendCalls(*clients[0], std::vector<int32_t>(1, 100));
+  BOOST_REQUIRE(processor->waitForPending(1));
+  processor->answer(100);
+  BOOST_CHECK_EQUAL(recvReply(*clients[0], type), 100);
+
+  // A failed callback closes its connection
+  sendCalls(*clients[1], std::vector<int32_t>(1, 101));
+  BOOST_REQUIRE(processor->waitForPending(1));
+  processor->answer(101, false);
+  BOOST_CHECK_GE(waitForClose(*clients[1]), 0);
+
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i]->close();
+  }
+  runner->stop();
+}
+
+// Makes a call and reads the reply over a TLS client, returning its seqid
+static int32_t callOverTLS(const shared_ptr<TSSLSocket>& socket, int32_t seqid) {
+  shared_ptr<TFramedTransport> framed(new TFramedTransport(socket));
+  TBinaryProtocol protocol(framed);
+  protocol.writeMessageBegin("call", apache::thrift::protocol::T_CALL, seqid);
+  protocol.writeStructBegin("args");
+  protocol.writeFieldStop();
+  protocol.writeStructEnd();
+  protocol.writeMessageEnd();
+  framed->flush();
+  std::string name;
+  TMessageType type;
+  int32_t replySeqid;
+  protocol.readMessageBegin(name, type, replySeqid);
+  protocol.readMessageEnd();
+  framed->readEnd();
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  return replySeqid;
+}
+
+BOOST_AUTO_TEST_CASE( test_tls ) {
+  shared_ptr<TSSLSocketFactory> serverFactory(new TSSLSocketFactory);
+  serverFactory->server(true);
+  serverFactory->loadCertificate(THRIFT_TEST_KEYS "/server.crt");
+  serverFactory->loadPrivateKey(THRIFT_TEST_KEYS "/server.key");
+  shared_ptr<ReplyingProcessor> processor(new ReplyingProcessor);
+  shared_ptr<TNonblockingServer> server(new TNonblockingServer(processor, 0));
+  server->setNumIOThreads(2);
+  server->setSSLSocketFactory(serverFactory);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  // Clients that check the server's certificate handshake with the IO
+  // threads, all under way at once, and are answered over TLS
+  shared_ptr<TSSLSocketFactory> clientFactory(new TSSLSocketFactory);
+  clientFactory->loadTrustedCertificates(THRIFT_TEST_KEYS "/CA.pem");
+  clientFactory->authenticate(true);
+  std::vector<shared_ptr<TSSLSocket> > clients;
+  for (int32_t i = 0; i < 4; ++i) {
+    clients.push_back(clientFactory->createSocket("127.0.0.1", runner->getPort()));
+    clients.back()->setRecvTimeout(5000);
+    clients.back()->open();
+  }
+  for (int32_t i = 0; i < 4; ++i) {
+    BOOST_CHECK_EQUAL(callOverTLS(clients[i], i), i);
+  }
+  for (int32_t i = 0; i < 4; ++i) {
+    BOOST_CHECK_EQUAL(callOverTLS(clients[i], 10 + i), 10 + i);
+  }
+  BOOST_CHECK_EQUAL(processor->entered(), 8);
+
+  // A client speaking plain Thrift gets no answer, just a closed connection
+  shared_ptr<TSocket> plain = runner->connect();
+  sendCalls(*plain, std::vector<int32_t>(1, 20));
+  uint8_t byte;
+  try {
+    while (plain->read(&byte, 1) > 0) {
+    }
+  } catch (const apache::thrift::transport::TTransportException& x) {
+    BOOST_CHECK(x.getType() != apache::thrift::transport::TTransportException::TIMED_OUT);
+  }
+  BOOST_CHECK_EQUAL(processor->entered(), 8);
+
+  plain->close();
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i]->close();
+  }
+  runner->stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,152 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <thrift/Thrift.h>
+#include <thrift/TAsyncOutput.h>
+
+BOOST_AUTO_TEST_SUITE( TOutputTest )
+
+using apache::thrift::GlobalOutput;
+using apache::thrift::TAsyncOutput;
+using apache::thrift::TOutput;
+using apache::thrift::T_OUTPUT_DEBUG;
+using apache::thrift::T_OUTPUT_ERROR;
+using apache::thrift::T_OUTPUT_INFO;
+using apache::thrift::T_OUTPUT_WARNING;
+
+static std::vector<std::string> messages;
+
+static void record(const char* message) {
+  messages.push_back(message);
+}
+
+// A sink the drain thread waits in until released
+static volatile bool released;
+
+static void waitingRecord(const char* message) {
+  while (!released) {
+    usleep(1000);
+  }
+  messages.push_back(message);
+}
+
+BOOST_AUTO_TEST_CASE( test_levels ) {
+  messages.clear();
+  TOutput output;
+  output.setOutputFunction(&record);
+
+  output.printf(T_OUTPUT_DEBUG, "debug %d", 1);
+  BOOST_CHECK_EQUAL(messages.size(), 1u);
+
+  output.setLevel(T_OUTPUT_WARNING);
+  BOOST_CHECK(!output.enabled(T_OUTPUT_INFO));
+  output.printf(T_OUTPUT_INFO, "info %d", 2);
+  output.perror(T_OUTPUT_DEBUG, "debug ", ENOENT);
+  BOOST_CHECK_EQUAL(messages.size(), 1u);
+
+  // Messages without a level are errors
+  output.printf(T_OUTPUT_WARNING, "warning %d", 3);
+  output.printf("error %d", 4);
+  output("error");
+  BOOST_REQUIRE_EQUAL(messages.size(), 4u);
+  BOOST_CHECK_EQUAL(messages[1], "warning 3");
+  BOOST_CHECK_EQUAL(messages[2], "error 4");
+
+  output.setLevel(apache::thrift::T_OUTPUT_NONE);
+  output.printf(T_OUTPUT_ERROR, "error %d", 5);
+  BOOST_CHECK_EQUAL(messages.size(), 4u);
+}
+
+// One call site, letting five a second through
+static void fail(int i) {
+  T_OUTPUT_LIMITED(T_OUTPUT_WARNING, 5, "failed %d", i);
+}
+
+BOOST_AUTO_TEST_CASE( test_rate_limit ) {
+  messages.clear();
+  GlobalOutput.setOutputFunction(&record);
+
+  // Start early in a second, so that the calls fit in it
+  time_t start = time(NULL);
+  while (time(NULL) == start) {
+    usleep(1000);
+  }
+  for (int i = 0; i < 100; ++i) {
+    fail(i);
+  }
+  BOOST_REQUIRE_EQUAL(messages.size(), 5u);
+  BOOST_CHECK_EQUAL(messages[4], "failed 4");
+
+  // The next second lets more through, saying how many were not
+  start = time(NULL);
+  while (time(NULL) == start) {
+    usleep(1000);
+  }
+  for (int i = 0; i < 100; ++i) {
+    fail(i);
+  }
+  GlobalOutput.setOutputFunction(&TOutput::errorTimeWrapper);
+
+  BOOST_REQUIRE_EQUAL(messages.size(), 11u);
+  BOOST_CHECK_EQUAL(messages[5], "failed 0");
+  BOOST_CHECK_EQUAL(messages[6], "(95 messages like the last were suppressed)");
+}
+
+BOOST_AUTO_TEST_CASE( test_async ) {
+  messages.clear();
+  released = false;
+  {
+    TAsyncOutput async(4, &waitingRecord);
+    TOutput output;
+    output.setBackend(&async);
+
+    // The first is taken off the ring, and held in the sink
+    output.printf(T_OUTPUT_ERROR, "first");
+    usleep(50 * 1000);
+
+    // The ring takes four more
+    for (int i = 0; i < 6; ++i) {
+      output.printf(T_OUTPUT_ERROR, "more %d", i);
+    }
+    BOOST_CHECK_EQUAL(async.getNumDropped(), 2u);
+
+    released = true;
+    async.flush();
+    BOOST_CHECK_EQUAL(messages.size(), 6u);
+
+    // Long messages are cut short
+    output(std::string(2 * TAsyncOutput::MAX_MESSAGE, 'x').c_str());
+  }
+
+  BOOST_REQUIRE_EQUAL(messages.size(), 7u);
+  BOOST_CHECK_EQUAL(messages[0], "first");
+  BOOST_CHECK_EQUAL(messages[1], "more 0");
+  BOOST_CHECK_EQUAL(messages[2], "TAsyncOutput: 2 messages dropped");
+  BOOST_CHECK_EQUAL(messages[5], "more 3");
+  BOOST_CHECK_EQUAL(messages[6].size(), TAsyncOutput::MAX_MESSAGE - 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,310 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <thrift/protocol/TPackedEncoding.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TTransportException.h>
+
+BOOST_AUTO_TEST_SUITE( TPackedEncodingTest )
+
+using apache::thrift::protocol::TPackedReader;
+using apache::thrift::protocol::TPackedWriter;
+using apache::thrift::protocol::TProtocolException;
+using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+// Written out the way the generator's packed option would
+struct Inner {
+  Inner() : x(0), d(0) { __isset.d = false; }
+
+  int32_t x;
+  std::string s;
+  double d;  // optional
+
+  struct {
+    bool x;
+    bool s;
+    bool d;
+  } __isset;
+
+  bool operator==(const Inner& that) const {
+    return x == that.x && s == that.s && __isset.d == that.__isset.d &&
+           (!__isset.d || d == that.d);
+  }
+
+  bool operator<(const Inner& that) const { return x < that.x; }
+
+  uint32_t readPacked(TPackedReader& reader) {
+    uint32_t xfer = 0;
+    uint8_t present[1];
+    xfer += reader.readBitmap(present, 1);
+    xfer += reader.readI32(this->x);
+    this->__isset.x = true;
+    xfer += reader.readString(this->s);
+    this->__isset.s = true;
+    this->__isset.d = (present[0] & 1) != 0;
+    if (this->__isset.d) {
+      xfer += reader.readDouble(this->d);
+    }
+    return xfer;
+  }
+
+  uint32_t writePacked(TPackedWriter& writer) const {
+    uint32_t xfer = 0;
+    uint8_t present[1] = {0};
+    if (this->__isset.d) present[0] |= 1;
+    xfer += writer.writeBitmap(present, 1);
+    xfer += writer.writeI32(this->x);
+    xfer += writer.writeString(this->s);
+    if (this->__isset.d) {
+      xfer += writer.writeDouble(this->d);
+    }
+    return xfer;
+  }
+};
+
+struct Outer {
+  Outer() : id(0), small(0) {}
+
+  int64_t id;  // required
+  int16_t small;
+  std::vector<int32_t> nums;
+  std::vector<bool> flags;
+  std::map<std::string, Inner> byName;
+  std::set<int16_t> ids;
+  std::vector<std::vector<double> > grid;
+
+  struct {
+    bool small;
+    bool nums;
+    bool flags;
+    bool byName;
+    bool ids;
+    bool grid;
+  } __isset;
+
+  bool operator==(const Outer& that) const {
+    return id == that.id && small == that.small && nums == that.nums &&
+           flags == that.flags && byName == that.byName && ids == that.ids &&
+           grid == that.grid;
+  }
+
+  uint32_t readPacked(TPackedReader& reader) {
+    uint32_t xfer = 0;
+    xfer += reader.readI64(this->id);
+    xfer += reader.readI16(this->small);
+    this->__isset.small = true;
+    {
+      uint32_t _size0;
+      xfer += reader.readSize(_size0);
+      this->nums.clear();
+      this->nums.resize(_size0);
+      if (_size0 > 0) {
+        xfer += reader.readI32s(&this->nums[0], _size0);
+      }
+    }
+    this->__isset.nums = true;
+    {
+      uint32_t _size2;
+      xfer += reader.readSize(_size2);
+      this->flags.clear();
+      this->flags.resize(_size2);
+      for (uint32_t _i3 = 0; _i3 < _size2; ++_i3)
+      {
+        bool _elem4;
+        xfer += reader.readBool(_elem4);
+        this->flags[_i3] = _elem4;
+      }
+    }
+    this->__isset.flags = true;
+    {
+      uint32_t _size5;
+      xfer += reader.readSize(_size5);
+      this->byName.clear();
+      for (uint32_t _i6 = 0; _i6 < _size5; ++_i6)
+      {
+        std::string _key7;
+        xfer += reader.readString(_key7);
+        Inner& _val8 = this->byName[_key7];
+        xfer += _val8.readPacked(reader);
+      }
+    }
+    this->__isset.byName = true;
+    {
+      uint32_t _size9;
+      xfer += reader.readSize(_size9);
+      this->ids.clear();
+      for (uint32_t _i10 = 0; _i10 < _size9; ++_i10)
+      {
+        int16_t _elem11;
+        xfer += reader.readI16(_elem11);
+        this->ids.insert(_elem11);
+      }
+    }
+    this->__isset.ids = true;
+    {
+      uint32_t _size12;
+      xfer += reader.readSize(_size12);
+      this->grid.clear();
+      this->grid.resize(_size12);
+      for (uint32_t _i13 = 0; _i13 < _size12; ++_i13)
+      {
+        {
+          uint32_t _size14;
+          xfer += reader.readSize(_size14);
+          this->grid[_i13].clear();
+          this->grid[_i13].resize(_size14);
+          if (_size14 > 0) {
+            xfer += reader.readDoubles(&this->grid[_i13][0], _size14);
+          }
+        }
+      }
+    }
+    this->__isset.grid = true;
+    return xfer;
+  }
+
+  uint32_t writePacked(TPackedWriter& writer) const {
+    uint32_t xfer = 0;
+    xfer += writer.writeI64(this->id);
+    xfer += writer.writeI16(this->small);
+    xfer += writer.writeSize(static_cast<uint32_t>(this->nums.size()));
+    if (!this->nums.empty()) {
+      xfer += writer.writeI32s(&this->nums[0], static_cast<uint32_t>(this->nums.size()));
+    }
+    xfer += writer.writeSize(static_cast<uint32_t>(this->flags.size()));
+    std::vector<bool>::const_iterator _iter0;
+    for (_iter0 = this->flags.begin(); _iter0 != this->flags.end(); ++_iter0)
+    {
+      xfer += writer.writeBool((*_iter0));
+    }
+    xfer += writer.writeSize(static_cast<uint32_t>(this->byName.size()));
+    std::map<std::string, Inner>::const_iterator _iter1;
+    for (_iter1 = this->byName.begin(); _iter1 != this->byName.end(); ++_iter1)
+    {
+      xfer += writer.writeString(_iter1->first);
+      xfer += _iter1->second.writePacked(writer);
+    }
+    xfer += writer.writeSize(static_cast<uint32_t>(this->ids.size()));
+    std::set<int16_t>::const_iterator _iter2;
+    for (_iter2 = this->ids.begin(); _iter2 != this->ids.end(); ++_iter2)
+    {
+      xfer += writer.writeI16((*_iter2));
+    }
+    xfer += writer.writeSize(static_cast<uint32_t>(this->grid.size()));
+    std::vector<std::vector<double> >::const_iterator _iter3;
+    for (_iter3 = this->grid.begin(); _iter3 != this->grid.end(); ++_iter3)
+    {
+      xfer += writer.writeSize(static_cast<uint32_t>((*_iter3).size()));
+      if (!(*_iter3).empty()) {
+        xfer += writer.writeDoubles(&(*_iter3)[0], static_cast<uint32_t>((*_iter3).size()));
+      }
+    }
+    return xfer;
+  }
+};
+
+static Outer sampleOuter() {
+  Outer outer;
+  outer.id = -1234567890123LL;
+  outer.small = 300;
+  for (int32_t i = -500; i < 500; ++i) {
+    outer.nums.push_back(i * 65537);
+    outer.flags.push_back(i % 3 == 0);
+  }
+  Inner a;
+  a.x = 1;
+  a.s = "first";
+  Inner b;
+  b.x = 2;
+  b.s = std::string(100000, 'b');
+  b.d = 2.5;
+  b.__isset.d = true;
+  outer.byName["a"] = a;
+  outer.byName["b"] = b;
+  outer.ids.insert(-7);
+  outer.ids.insert(7);
+  outer.grid.resize(3);
+  outer.grid[1].push_back(1.5);
+  outer.grid[1].push_back(-0.25);
+  return outer;
+}
+
+BOOST_AUTO_TEST_CASE( test_round_trip ) {
+  Outer outer = sampleOuter();
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TPackedWriter writer(buf);
+  uint32_t written = outer.writePacked(writer);
+  BOOST_CHECK_EQUAL(written, buf->available_read());
+
+  Outer copy;
+  TPackedReader reader(buf);
+  BOOST_CHECK_EQUAL(copy.readPacked(reader), written);
+  BOOST_CHECK(copy == outer);
+  BOOST_CHECK(!copy.byName["a"].__isset.d);
+  BOOST_CHECK(copy.byName["b"].__isset.d);
+  BOOST_CHECK_EQUAL(buf->available_read(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_small_reads ) {
+  // Strings too long for the buffer are read a piece at a time
+  Outer outer = sampleOuter();
+  shared_ptr<TMemoryBuffer> mem(new TMemoryBuffer());
+  TPackedWriter writer(mem);
+  outer.writePacked(writer);
+
+  shared_ptr<TBufferedTransport> buffered(new TBufferedTransport(mem, 7));
+  TPackedReader reader(buffered);
+  Outer copy;
+  copy.readPacked(reader);
+  BOOST_CHECK(copy == outer);
+}
+
+BOOST_AUTO_TEST_CASE( test_truncated ) {
+  Outer outer = sampleOuter();
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TPackedWriter writer(buf);
+  outer.writePacked(writer);
+  std::string data = buf->getBufferAsString();
+  data.resize(data.size() - 1);
+
+  shared_ptr<TMemoryBuffer> cut(
+    new TMemoryBuffer((uint8_t*)data.data(), (uint32_t)data.size()));
+  TPackedReader reader(cut);
+  Outer copy;
+  BOOST_CHECK_THROW(copy.readPacked(reader), TTransportException);
+}
+
+BOOST_AUTO_TEST_CASE( test_negative_size ) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TPackedWriter writer(buf);
+  writer.writeI32(-1);
+  TPackedReader reader(buf);
+  std::string str;
+  BOOST_CHECK_THROW(reader.readString(str), TProtocolException);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,208 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <boost/test/auto_unit_test.hpp>
+#include <arpa/inet.h>
+#include <csignal>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/transport/TSSLServerSocket.h>
+#include <thrift/transport/TSSLSocket.h>
+
+#ifndef THRIFT_TEST_KEYS
+#define THRIFT_TEST_KEYS "../../../test/keys"
+#endif
+
+BOOST_AUTO_TEST_SUITE( TSSLServerSocketTest )
+
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::ThreadManager;
+using apache::thrift::transport::TSSLServerSocket;
+using apache::thrift::transport::TSSLSocket;
+using apache::thrift::transport::TSSLSocketFactory;
+using apache::thrift::transport::TSocket;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+static shared_ptr<PlatformThreadFactory> threadFactory() {
+  return shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+      PlatformThreadFactory::OTHER,
+      PlatformThreadFactory::NORMAL,
+      1,
+#endif
+      false));
+}
+
+static int64_t nowMs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return static_cast<int64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+// The port a listening server socket was given
+static int boundPort(TSSLServerSocket& server) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  getsockname(server.getSocketFD(), reinterpret_cast<struct sockaddr*>(&addr), &len);
+  return ntohs(addr.sin_port);
+}
+
+// Whether the server closed the connection, rather than leave it waiting
+static bool closedByServer(TSocket& socket) {
+  uint8_t byte;
+  try {
+    while (socket.read(&byte, 1) > 0) {
+    }
+    return true;
+  } catch (const TTransportException& x) {
+    return x.getType() != TTransportException::TIMED_OUT;
+  }
+}
+
+// Handshakes, sends a greeting and waits for it to be echoed, on a thread
+// of its own since the handshake needs the server's workers to progress.
+// Both ends close at once, each shutdown waiting on the other's
+class TLSClient : public Runnable {
+ public:
+  TLSClient(const shared_ptr<TSSLSocketFactory>& factory, int port, const std::string& greeting)
+    : factory_(factory), port_(port), greeting_(greeting), done_(false) {}
+
+  virtual void run() {
+    std::string echoed;
+    try {
+      shared_ptr<TSSLSocket> socket = factory_->createSocket("127.0.0.1", port_);
+      socket->setRecvTimeout(5000);
+      socket->open();
+      socket->write(reinterpret_cast<const uint8_t*>(greeting_.data()),
+                    static_cast<uint32_t>(greeting_.size()));
+      socket->flush();
+      echoed.resize(greeting_.size());
+      socket->readAll(reinterpret_cast<uint8_t*>(&echoed[0]),
+                      static_cast<uint32_t>(echoed.size()));
+      socket->close();
+    } catch (const TTransportException& x) {
+      echoed = x.what();
+    }
+    Synchronized s(monitor_);
+    echoed_ = echoed;
+    done_ = true;
+    monitor_.notifyAll();
+  }
+
+  std::string echoed() {
+    Synchronized s(monitor_);
+    while (!done_) {
+      monitor_.wait();
+    }
+    return echoed_;
+  }
+
+ private:
+  shared_ptr<TSSLSocketFactory> factory_;
+  int port_;
+  std::string greeting_;
+  Monitor monitor_;
+  std::string echoed_;
+  bool done_;
+};
+
+// Echoes the greeting an accepted connection sends
+static void echo(const shared_ptr<TTransport>& client, size_t len) {
+  std::string greeting(len, '\0');
+  client->readAll(reinterpret_cast<uint8_t*>(&greeting[0]), static_cast<uint32_t>(len));
+  client->write(reinterpret_cast<const uint8_t*>(greeting.data()), static_cast<uint32_t>(len));
+  client->flush();
+}
+
+BOOST_AUTO_TEST_CASE( test_handshake_thread_manager ) {
+  // OpenSSL writes to sockets itself, so as any TLS server must, this one
+  // ignores SIGPIPE
+  std::signal(SIGPIPE, SIG_IGN);
+  shared_ptr<TSSLSocketFactory> serverFactory(new TSSLSocketFactory);
+  serverFactory->loadCertificate(THRIFT_TEST_KEYS "/server.crt");
+  serverFactory->loadPrivateKey(THRIFT_TEST_KEYS "/server.key");
+  shared_ptr<ThreadManager> handshakes = ThreadManager::newSimpleThreadManager(2);
+  handshakes->threadFactory(threadFactory());
+  handshakes->start();
+  TSSLServerSocket server(0, 30000, 30000, serverFactory);
+  server.setHandshakeThreadManager(handshakes);
+  server.listen();
+  int port = boundPort(server);
+
+  shared_ptr<TSSLSocketFactory> clientFactory(new TSSLSocketFactory);
+  clientFactory->loadTrustedCertificates(THRIFT_TEST_KEYS "/CA.pem");
+  clientFactory->authenticate(true);
+
+  // A client that stops partway into its hello holds up its handshake,
+  // but not accept(), which returns the TLS client behind it
+  TSocket stalled("127.0.0.1", port);
+  stalled.setRecvTimeout(5000);
+  stalled.open();
+  const uint8_t hello[] = {0x16, 0x03, 0x01};
+  stalled.write(hello, sizeof(hello));
+  shared_ptr<TLSClient> first(new TLSClient(clientFactory, port, "first"));
+  shared_ptr<Thread> firstThread = threadFactory()->newThread(first);
+  firstThread->start();
+  shared_ptr<TTransport> accepted = server.accept();
+  BOOST_CHECK(boost::dynamic_pointer_cast<TSSLSocket>(accepted));
+  echo(accepted, 5);
+  accepted->close();
+  BOOST_CHECK_EQUAL(first->echoed(), "first");
+  firstThread->join();
+
+  // A client failing its handshake is closed and never returned; accept()
+  // hands it off and goes on to the next
+  TSocket plain("127.0.0.1", port);
+  plain.setRecvTimeout(5000);
+  plain.open();
+  const char request[] = "GET / HTTP/1.0\r\n\r\n";
+  plain.write(reinterpret_cast<const uint8_t*>(request), sizeof(request) - 1);
+  shared_ptr<TLSClient> second(new TLSClient(clientFactory, port, "second"));
+  shared_ptr<Thread> secondThread = threadFactory()->newThread(second);
+  secondThread->start();
+  accepted = server.accept();
+  echo(accepted, 6);
+  accepted->close();
+  BOOST_CHECK_EQUAL(second->echoed(), "second");
+  secondThread->join();
+  BOOST_CHECK(closedByServer(plain));
+
+  // close() aborts the stalled handshake rather than wait out its timeout
+  int64_t start = nowMs();
+  server.close();
+  BOOST_CHECK_LT(nowMs() - start, 5000);
+  BOOST_CHECK(closedByServer(stalled));
+
+  plain.close();
+  stalled.close();
+  handshakes->stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,177 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/protocol/TSerializedSize.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TSerializedSizeTest )
+
+using apache::thrift::protocol::serializedSize;
+using apache::thrift::protocol::TBinaryProtocolT;
+using apache::thrift::protocol::TCompactProtocolT;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::T_BOOL;
+using apache::thrift::protocol::T_DOUBLE;
+using apache::thrift::protocol::T_I32;
+using apache::thrift::protocol::T_I64;
+using apache::thrift::protocol::T_LIST;
+using apache::thrift::protocol::T_MAP;
+using apache::thrift::protocol::T_STRING;
+using apache::thrift::transport::TFramedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+// Written out the way the generator would
+struct Sample {
+  Sample() : flag(false), number(0), ratio(0.0) {}
+
+  bool flag;
+  int32_t number;
+  double ratio;
+  std::string name;
+  std::vector<int64_t> longs;
+  std::map<std::string, int32_t> counts;
+
+  uint32_t write(TProtocol* oprot) const {
+    uint32_t xfer = 0;
+    xfer += oprot->writeStructBegin("Sample");
+    xfer += oprot->writeFieldBegin("flag", T_BOOL, 1);
+    xfer += oprot->writeBool(flag);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("number", T_I32, 2);
+    xfer += oprot->writeI32(number);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("ratio", T_DOUBLE, 3);
+    xfer += oprot->writeDouble(ratio);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("name", T_STRING, 20);
+    xfer += oprot->writeString(name);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("longs", T_LIST, 21);
+    xfer += oprot->writeListBegin(T_I64, static_cast<uint32_t>(longs.size()));
+    for (size_t i = 0; i < longs.size(); ++i) {
+      xfer += oprot->writeI64(longs[i]);
+    }
+    xfer += oprot->writeListEnd();
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("counts", T_MAP, 22);
+    xfer += oprot->writeMapBegin(T_STRING, T_I32, static_cast<uint32_t>(counts.size()));
+    std::map<std::string, int32_t>::const_iterator it;
+    for (it = counts.begin(); it != counts.end(); ++it) {
+      xfer += oprot->writeString(it->first);
+      xfer += oprot->writeI32(it->second);
+    }
+    xfer += oprot->writeMapEnd();
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldStop();
+    xfer += oprot->writeStructEnd();
+    return xfer;
+  }
+
+  template <template <class> class Protocol_>
+  uint32_t serializedSize() const {
+    return ::apache::thrift::protocol::serializedSize<Protocol_>(*this);
+  }
+};
+
+static Sample sampleValue(int scale) {
+  Sample sample;
+  sample.flag = true;
+  sample.number = -70000 * scale;
+  sample.ratio = 0.25;
+  sample.name = std::string(100 * scale, 'x');
+  for (int i = 0; i < 50 * scale; ++i) {
+    sample.longs.push_back(static_cast<int64_t>(i) * 1000000007LL - 3);
+    sample.counts[std::string(i % 17 + 1, 'k') + char('a' + i % 26)] = i;
+  }
+  return sample;
+}
+
+template <template <class> class Protocol_>
+static uint32_t writtenSize(const Sample& sample) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  Protocol_<TMemoryBuffer> prot(buf);
+  sample.write(&prot);
+  return buf->available_read();
+}
+
+BOOST_AUTO_TEST_CASE( test_exact_size ) {
+  for (int scale = 0; scale < 4; ++scale) {
+    Sample sample = sampleValue(scale);
+    BOOST_CHECK_EQUAL(sample.serializedSize<TBinaryProtocolT>(),
+                      writtenSize<TBinaryProtocolT>(sample));
+    BOOST_CHECK_EQUAL(sample.serializedSize<TCompactProtocolT>(),
+                      writtenSize<TCompactProtocolT>(sample));
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_memory_buffer_reserve ) {
+  Sample sample = sampleValue(20);
+  uint32_t size = serializedSize<TCompactProtocolT>(sample);
+
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer(16));
+  buf->reserve(size);
+  BOOST_CHECK_EQUAL(buf->available_write(), size);
+  uint8_t* start = buf->getWritePtr(0);
+
+  // Written in place, with no room to spare
+  TCompactProtocolT<TMemoryBuffer> prot(buf);
+  sample.write(&prot);
+  BOOST_CHECK_EQUAL(buf->available_write(), 0u);
+  BOOST_CHECK_EQUAL(buf->available_read(), size);
+  uint8_t* data;
+  uint32_t len;
+  buf->getBuffer(&data, &len);
+  BOOST_CHECK(data == start);
+
+  // Reserving what is already there does nothing
+  buf->resetBuffer();
+  buf->reserve(size);
+  BOOST_CHECK(buf->getWritePtr(0) == start);
+
+  // A buffer it does not own cannot grow
+  uint8_t fixed[8];
+  TMemoryBuffer observer(fixed, sizeof(fixed));
+  BOOST_CHECK_THROW(observer.reserve(size),
+                    apache::thrift::transport::TTransportException);
+}
+
+BOOST_AUTO_TEST_CASE( test_framed_reserve ) {
+  Sample sample = sampleValue(20);
+  uint32_t size = serializedSize<TBinaryProtocolT>(sample);
+
+  shared_ptr<TMemoryBuffer> out(new TMemoryBuffer());
+  shared_ptr<TFramedTransport> framed(new TFramedTransport(out, 64));
+  framed->reserve(size);
+  TBinaryProtocolT<TFramedTransport> prot(framed);
+  sample.write(&prot);
+  framed->flush();
+  BOOST_CHECK_EQUAL(out->available_read(), size + 4);
+
+  BOOST_CHECK_THROW(framed->reserve(0x80000000u),
+                    apache::thrift::transport::TTransportException);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
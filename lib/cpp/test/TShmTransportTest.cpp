@@ -0,0 +1,210 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstdio>
+#include <unistd.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TShmServerTransport.h>
+#include <thrift/transport/TShmTransport.h>
+#include <thrift/transport/TTransportException.h>
+
+BOOST_AUTO_TEST_SUITE( TShmTransportTest )
+
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::transport::TShmServerTransport;
+using apache::thrift::transport::TShmTransport;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+static std::string abstractName(const char* tag) {
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), "thrift-shm-test-%s-%d", tag, (int)getpid());
+  return std::string(1, '\0') + buf;
+}
+
+// Accepts one connection and echoes strings back until the client goes
+class EchoServer : public Runnable {
+ public:
+  EchoServer(shared_ptr<TShmServerTransport> server) : server_(server), echoed_(0) {}
+
+  void run() {
+    shared_ptr<TTransport> transport = server_->accept();
+    TBinaryProtocol protocol(transport);
+    try {
+      while (true) {
+        std::string s;
+        protocol.readString(s);
+        protocol.writeString(s);
+        transport->flush();
+        ++echoed_;
+      }
+    } catch (const TTransportException& ex) {
+      BOOST_CHECK_EQUAL(ex.getType(), TTransportException::END_OF_FILE);
+    }
+    transport->close();
+  }
+
+  int echoed() {
+    return echoed_;
+  }
+
+ private:
+  shared_ptr<TShmServerTransport> server_;
+  int echoed_;
+};
+
+// Accepts one connection; the client's open() waits for it
+class Acceptor : public Runnable {
+ public:
+  Acceptor(shared_ptr<TShmServerTransport> server) : server_(server) {}
+
+  void run() {
+    accepted_ = server_->accept();
+  }
+
+  shared_ptr<TTransport> accepted() {
+    return accepted_;
+  }
+
+ private:
+  shared_ptr<TShmServerTransport> server_;
+  shared_ptr<TTransport> accepted_;
+};
+
+static shared_ptr<Thread> startThread(shared_ptr<Runnable> runnable) {
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  shared_ptr<Thread> thread = factory.newThread(runnable);
+  thread->start();
+  return thread;
+}
+
+BOOST_AUTO_TEST_CASE( test_protocol_round_trips ) {
+  std::string name = abstractName("roundtrip");
+  shared_ptr<TShmServerTransport> server(new TShmServerTransport(name));
+  server->listen();
+  shared_ptr<EchoServer> echo(new EchoServer(server));
+  shared_ptr<Thread> thread = startThread(echo);
+
+  shared_ptr<TShmTransport> client(new TShmTransport(name));
+  client->open();
+  BOOST_CHECK(client->isOpen());
+  TBinaryProtocol protocol(client);
+  for (int i = 0; i < 1000; ++i) {
+    std::string sent(i % 97, static_cast<char>('a' + i % 26));
+    protocol.writeString(sent);
+    client->flush();
+    std::string got;
+    protocol.readString(got);
+    BOOST_REQUIRE_EQUAL(got, sent);
+  }
+
+  client->close();
+  thread->join();
+  BOOST_CHECK_EQUAL(echo->echoed(), 1000);
+}
+
+BOOST_AUTO_TEST_CASE( test_messages_larger_than_ring ) {
+  std::string name = abstractName("large");
+  shared_ptr<TShmServerTransport> server(new TShmServerTransport(name));
+  server->setRingSize(4096);
+  server->setSpinTimeUs(0);
+  server->listen();
+  shared_ptr<EchoServer> echo(new EchoServer(server));
+  shared_ptr<Thread> thread = startThread(echo);
+
+  shared_ptr<TShmTransport> client(new TShmTransport(name));
+  client->setSpinTimeUs(0);
+  client->open();
+  TBinaryProtocol protocol(client);
+
+  // Sizes straddle the ring so both sides wrap and wait on each other
+  uint32_t sizes[] = {4095, 4096, 4097, 10000, 1 << 20};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    std::string sent(sizes[i], '\0');
+    for (uint32_t j = 0; j < sizes[i]; ++j) {
+      sent[j] = static_cast<char>(j * 7 + i);
+    }
+    protocol.writeString(sent);
+    client->flush();
+    std::string got;
+    protocol.readString(got);
+    BOOST_REQUIRE(got == sent);
+  }
+
+  client->close();
+  thread->join();
+}
+
+BOOST_AUTO_TEST_CASE( test_close_and_timeouts ) {
+  std::string name = abstractName("close");
+  shared_ptr<TShmServerTransport> server(new TShmServerTransport(name));
+  server->setRingSize(4096);
+  server->listen();
+
+  shared_ptr<TShmTransport> client(new TShmTransport(name));
+  BOOST_CHECK(!client->isOpen());
+  BOOST_CHECK_THROW(client->write(reinterpret_cast<const uint8_t*>("x"), 1),
+                    TTransportException);
+  shared_ptr<Acceptor> acceptor(new Acceptor(server));
+  shared_ptr<Thread> thread = startThread(acceptor);
+  client->open();
+  thread->join();
+  shared_ptr<TTransport> accepted = acceptor->accepted();
+  BOOST_REQUIRE(accepted);
+
+  // Nothing to read yet
+  client->setRecvTimeout(50);
+  uint8_t buf[8];
+  BOOST_CHECK_THROW(client->read(buf, sizeof(buf)), TTransportException);
+
+  // Unflushed data stays invisible; a full ring blocks the writer
+  client->write(reinterpret_cast<const uint8_t*>("hello"), 5);
+  uint32_t len = 5;
+  BOOST_CHECK(accepted->borrow(NULL, &len) == NULL);
+  client->flush();
+  const uint8_t* borrowed = accepted->borrow(NULL, &len);
+  BOOST_REQUIRE(borrowed != NULL);
+  BOOST_CHECK_EQUAL(std::string(reinterpret_cast<const char*>(borrowed), 5), "hello");
+  accepted->consume(5);
+
+  client->setSendTimeout(50);
+  std::string big(8192, 'z');
+  BOOST_CHECK_THROW(client->write(reinterpret_cast<const uint8_t*>(big.data()), big.size()),
+                    TTransportException);
+
+  // Closing drains what was published, then reads EOF
+  client->close();
+  uint32_t total = 0;
+  uint32_t got;
+  while ((got = accepted->read(buf, sizeof(buf))) > 0) {
+    total += got;
+  }
+  BOOST_CHECK_EQUAL(total, 4096u);
+  BOOST_CHECK(!accepted->peek());
+  BOOST_CHECK_THROW(accepted->write(buf, 1), TTransportException);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
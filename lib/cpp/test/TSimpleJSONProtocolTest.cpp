@@ -0,0 +1,395 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include <thrift/protocol/TSimpleJSONProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TSimpleJSONProtocolTest )
+
+using apache::thrift::protocol::TFieldSpec;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolException;
+using apache::thrift::protocol::TSimpleJSONProtocol;
+using apache::thrift::protocol::TStructSpec;
+using apache::thrift::protocol::TType;
+using apache::thrift::protocol::T_BOOL;
+using apache::thrift::protocol::T_CALL;
+using apache::thrift::protocol::T_DOUBLE;
+using apache::thrift::protocol::T_I32;
+using apache::thrift::protocol::T_LIST;
+using apache::thrift::protocol::T_MAP;
+using apache::thrift::protocol::T_STOP;
+using apache::thrift::protocol::T_STRING;
+using apache::thrift::protocol::T_STRUCT;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+// The perfect hash table the compiler would lay out for fields
+static TStructSpec makeSpec(const char* name, const TFieldSpec* fields, uint32_t n,
+                            std::vector<int16_t>& slots) {
+  uint32_t size = 1;
+  while (size < 2 * n) {
+    size *= 2;
+  }
+  for (uint32_t seed = 0; ; ++seed) {
+    slots.assign(size, -1);
+    bool clash = false;
+    for (uint32_t i = 0; i < n && !clash; ++i) {
+      uint32_t slot = TStructSpec::hashFieldName(fields[i].name, strlen(fields[i].name), seed)
+                      & (size - 1);
+      clash = slots[slot] >= 0;
+      slots[slot] = static_cast<int16_t>(i);
+    }
+    if (!clash) {
+      TStructSpec spec = { name, fields, n, &slots[0], size - 1, seed };
+      return spec;
+    }
+  }
+}
+
+// Written out the way the generator would with the simple_json option
+struct Inner {
+  Inner() : x(0) {}
+
+  int32_t x;
+  std::string s;
+
+  bool operator==(const Inner& that) const { return x == that.x && s == that.s; }
+
+  static const TStructSpec& structSpec() {
+    static const TFieldSpec fields[] = {
+      { "x", 1, T_I32 },
+      { "s", 2, T_STRING },
+    };
+    static std::vector<int16_t> slots;
+    static const TStructSpec spec = makeSpec("Inner", fields, 2, slots);
+    return spec;
+  }
+
+  uint32_t read(TProtocol* iprot) {
+    uint32_t xfer = 0;
+    std::string fname;
+    TType ftype;
+    int16_t fid;
+    xfer += iprot->readStructBeginSpec(fname, structSpec());
+    while (true) {
+      xfer += iprot->readFieldBegin(fname, ftype, fid);
+      if (ftype == T_STOP) {
+        break;
+      }
+      if (fid == 1 && ftype == T_I32) {
+        xfer += iprot->readI32(x);
+      } else if (fid == 2 && ftype == T_STRING) {
+        xfer += iprot->readString(s);
+      } else {
+        xfer += iprot->skip(ftype);
+      }
+      xfer += iprot->readFieldEnd();
+    }
+    xfer += iprot->readStructEnd();
+    return xfer;
+  }
+
+  uint32_t write(TProtocol* oprot) const {
+    uint32_t xfer = 0;
+    xfer += oprot->writeStructBegin("Inner");
+    xfer += oprot->writeFieldBegin("x", T_I32, 1);
+    xfer += oprot->writeI32(x);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("s", T_STRING, 2);
+    xfer += oprot->writeString(s);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldStop();
+    xfer += oprot->writeStructEnd();
+    return xfer;
+  }
+};
+
+struct Outer {
+  Outer() : id(0), ratio(0.0), flag(false) {}
+
+  int32_t id;
+  double ratio;
+  bool flag;
+  std::string data;
+  std::vector<int32_t> nums;
+  std::map<int32_t, std::string> names;
+  std::vector<Inner> inners;
+
+  bool operator==(const Outer& that) const {
+    return id == that.id && ratio == that.ratio && flag == that.flag && data == that.data &&
+           nums == that.nums && names == that.names && inners == that.inners;
+  }
+
+  static const TStructSpec& structSpec() {
+    static const TFieldSpec fields[] = {
+      { "id", 1, T_I32 },
+      { "ratio", 2, T_DOUBLE },
+      { "flag", 3, T_BOOL },
+      { "data", 4, T_STRING },
+      { "nums", 5, T_LIST },
+      { "names", 6, T_MAP },
+      { "inners", 7, T_LIST },
+    };
+    static std::vector<int16_t> slots;
+    static const TStructSpec spec = makeSpec("Outer", fields, 7, slots);
+    return spec;
+  }
+
+  uint32_t read(TProtocol* iprot) {
+    uint32_t xfer = 0;
+    std::string fname;
+    TType ftype;
+    int16_t fid;
+    xfer += iprot->readStructBeginSpec(fname, structSpec());
+    while (true) {
+      xfer += iprot->readFieldBegin(fname, ftype, fid);
+      if (ftype == T_STOP) {
+        break;
+      }
+      switch (fid) {
+      case 1:
+        xfer += iprot->readI32(id);
+        break;
+      case 2:
+        xfer += iprot->readDouble(ratio);
+        break;
+      case 3:
+        xfer += iprot->readBool(flag);
+        break;
+      case 4:
+        xfer += iprot->readBinary(data);
+        break;
+      case 5:
+        {
+          TType etype;
+          uint32_t size;
+          xfer += iprot->readListBegin(etype, size);
+          nums.resize(size);
+          xfer += iprot->readI32s(size ? &nums[0] : NULL, size);
+          xfer += iprot->readListEnd();
+        }
+        break;
+      case 6:
+        {
+          TType ktype, vtype;
+          uint32_t size;
+          xfer += iprot->readMapBegin(ktype, vtype, size);
+          for (uint32_t i = 0; i < size; ++i) {
+            int32_t key;
+            xfer += iprot->readI32(key);
+            xfer += iprot->readString(names[key]);
+          }
+          xfer += iprot->readMapEnd();
+        }
+        break;
+      case 7:
+        {
+          TType etype;
+          uint32_t size;
+          xfer += iprot->readListBegin(etype, size);
+          inners.resize(size);
+          for (uint32_t i = 0; i < size; ++i) {
+            xfer += inners[i].read(iprot);
+          }
+          xfer += iprot->readListEnd();
+        }
+        break;
+      default:
+        xfer += iprot->skip(ftype);
+        break;
+      }
+      xfer += iprot->readFieldEnd();
+    }
+    xfer += iprot->readStructEnd();
+    return xfer;
+  }
+
+  uint32_t write(TProtocol* oprot) const {
+    uint32_t xfer = 0;
+    xfer += oprot->writeStructBegin("Outer");
+    xfer += oprot->writeFieldBegin("id", T_I32, 1);
+    xfer += oprot->writeI32(id);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("ratio", T_DOUBLE, 2);
+    xfer += oprot->writeDouble(ratio);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("flag", T_BOOL, 3);
+    xfer += oprot->writeBool(flag);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("data", T_STRING, 4);
+    xfer += oprot->writeBinary(data);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("nums", T_LIST, 5);
+    xfer += oprot->writeListBegin(T_I32, static_cast<uint32_t>(nums.size()));
+    for (size_t i = 0; i < nums.size(); ++i) {
+      xfer += oprot->writeI32(nums[i]);
+    }
+    xfer += oprot->writeListEnd();
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("names", T_MAP, 6);
+    xfer += oprot->writeMapBegin(T_I32, T_STRING, static_cast<uint32_t>(names.size()));
+    std::map<int32_t, std::string>::const_iterator it;
+    for (it = names.begin(); it != names.end(); ++it) {
+      xfer += oprot->writeI32(it->first);
+      xfer += oprot->writeString(it->second);
+    }
+    xfer += oprot->writeMapEnd();
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldBegin("inners", T_LIST, 7);
+    xfer += oprot->writeListBegin(T_STRUCT, static_cast<uint32_t>(inners.size()));
+    for (size_t i = 0; i < inners.size(); ++i) {
+      xfer += inners[i].write(oprot);
+    }
+    xfer += oprot->writeListEnd();
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldStop();
+    xfer += oprot->writeStructEnd();
+    return xfer;
+  }
+};
+
+static Outer sampleOuter() {
+  Outer outer;
+  outer.id = -42;
+  outer.ratio = 0.5;
+  outer.flag = true;
+  outer.data = std::string("\0\1\2\xff binary", 12);
+  outer.nums.push_back(1);
+  outer.nums.push_back(-2);
+  outer.nums.push_back(3);
+  outer.names[7] = "seven";
+  outer.names[-1] = "quote \" backslash \\ newline \n tab \t";
+  Inner inner;
+  inner.x = 5;
+  inner.s = "caf\xc3\xa9 {[,:]}";
+  outer.inners.push_back(inner);
+  inner.x = 6;
+  inner.s = "";
+  outer.inners.push_back(inner);
+  return outer;
+}
+
+static std::string toJSON(const Outer& outer) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TSimpleJSONProtocol prot(buf);
+  uint32_t written = outer.write(&prot);
+  BOOST_CHECK_EQUAL(written, buf->available_read());
+  return buf->getBufferAsString();
+}
+
+static Outer fromJSON(const std::string& json, uint32_t bufferSize = 0) {
+  shared_ptr<TMemoryBuffer> mem(new TMemoryBuffer());
+  mem->write((const uint8_t*)json.data(), (uint32_t)json.size());
+  shared_ptr<apache::thrift::transport::TTransport> trans = mem;
+  if (bufferSize > 0) {
+    trans.reset(new TBufferedTransport(mem, bufferSize));
+  }
+  TSimpleJSONProtocol prot(trans);
+  Outer outer;
+  outer.read(&prot);
+  return outer;
+}
+
+BOOST_AUTO_TEST_CASE( test_write ) {
+  Outer outer;
+  outer.id = 3;
+  outer.ratio = 1.5;
+  outer.nums.push_back(4);
+  outer.names[9] = "nine";
+  outer.inners.resize(1);
+  BOOST_CHECK_EQUAL(toJSON(outer),
+                    "{\"id\":3,\"ratio\":1.5,\"flag\":false,\"data\":\"\","
+                    "\"nums\":[4],\"names\":{\"9\":\"nine\"},"
+                    "\"inners\":[{\"x\":0,\"s\":\"\"}]}");
+}
+
+BOOST_AUTO_TEST_CASE( test_round_trip ) {
+  Outer original = sampleOuter();
+  std::string json = toJSON(original);
+  BOOST_CHECK(fromJSON(json) == original);
+  BOOST_CHECK(fromJSON(json, 5) == original);
+  BOOST_CHECK(fromJSON(json, 1) == original);
+  BOOST_CHECK(fromJSON(toJSON(Outer())) == Outer());
+}
+
+BOOST_AUTO_TEST_CASE( test_foreign_json ) {
+  // Whitespace, unknown fields, nulls, escapes and fields in any order
+  std::string json =
+    " { \"unknown\" : {\"a\": [1, 2.5, \"x\", true, {\"b\": []}]},\n"
+    "   \"inners\" : [ { \"s\" : \"\\u00e9\\ud83d\\ude00\\/\" , \"x\" : 1 } ],\n"
+    "   \"id\" : null, \"ratio\": 2e3, \"flag\": false,\n"
+    "   \"names\" : { \"10\" : \"ten\" }, \"extra\": -1 } ";
+  Outer outer = fromJSON(json);
+  BOOST_CHECK_EQUAL(outer.id, 0);
+  BOOST_CHECK_EQUAL(outer.ratio, 2000.0);
+  BOOST_CHECK_EQUAL(outer.names[10], "ten");
+  BOOST_REQUIRE_EQUAL(outer.inners.size(), 1u);
+  BOOST_CHECK_EQUAL(outer.inners[0].x, 1);
+  BOOST_CHECK_EQUAL(outer.inners[0].s, "\xc3\xa9\xf0\x9f\x98\x80/");
+}
+
+BOOST_AUTO_TEST_CASE( test_message ) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TSimpleJSONProtocol prot(buf);
+  Inner args;
+  args.x = 11;
+  prot.writeMessageBegin("call", T_CALL, 9);
+  args.write(&prot);
+  prot.writeMessageEnd();
+  prot.writeMessageBegin("again", T_CALL, 10);
+  args.write(&prot);
+  prot.writeMessageEnd();
+  BOOST_CHECK_EQUAL(buf->getBufferAsString(),
+                    "[\"call\",1,9,{\"x\":11,\"s\":\"\"}]"
+                    "[\"again\",1,10,{\"x\":11,\"s\":\"\"}]");
+
+  // Back to back messages each read in turn
+  for (int32_t seqid = 9; seqid <= 10; ++seqid) {
+    std::string name;
+    TMessageType type;
+    int32_t id;
+    Inner copy;
+    prot.readMessageBegin(name, type, id);
+    copy.read(&prot);
+    prot.readMessageEnd();
+    BOOST_CHECK_EQUAL(type, T_CALL);
+    BOOST_CHECK_EQUAL(id, seqid);
+    BOOST_CHECK(copy == args);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_errors ) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TSimpleJSONProtocol prot(buf);
+  prot.writeMapBegin(T_LIST, T_I32, 1);
+  BOOST_CHECK_THROW(prot.writeListBegin(T_I32, 0), TProtocolException);
+
+  BOOST_CHECK_THROW(fromJSON("{\"id\":\"seven\"}"), TProtocolException);
+  BOOST_CHECK_THROW(fromJSON("{\"id\":1 \"ratio\":2}"), TProtocolException);
+  BOOST_CHECK_THROW(fromJSON("{\"inners\":[{\"s\":\"\\q\"}]}"), TProtocolException);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
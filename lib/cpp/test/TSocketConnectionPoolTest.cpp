@@ -0,0 +1,217 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/transport/TSocketConnectionPool.h>
+#include <thrift/transport/TTransportException.h>
+
+BOOST_AUTO_TEST_SUITE( TSocketConnectionPoolTest )
+
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::Util;
+using apache::thrift::transport::TSocket;
+using apache::thrift::transport::TSocketConnectionPool;
+using apache::thrift::transport::TSocketPoolServer;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+// Listens on an ephemeral loopback port; connections just queue up
+static int listenOnLoopback(int* port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  BOOST_REQUIRE(fd >= 0);
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  BOOST_REQUIRE(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+  BOOST_REQUIRE(listen(fd, 16) == 0);
+  socklen_t len = sizeof(addr);
+  BOOST_REQUIRE(getsockname(fd, (struct sockaddr*)&addr, &len) == 0);
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+// Releases a socket to the pool after a delay
+class DelayedRelease : public Runnable {
+ public:
+  DelayedRelease(TSocketConnectionPool& pool, const shared_ptr<TSocket>& socket, int delayMs)
+    : pool_(pool), socket_(socket), delayMs_(delayMs) {}
+
+  virtual void run() {
+    usleep(delayMs_ * 1000);
+    pool_.release(socket_);
+  }
+
+ private:
+  TSocketConnectionPool& pool_;
+  shared_ptr<TSocket> socket_;
+  int delayMs_;
+};
+
+static shared_ptr<Thread> releaseLater(TSocketConnectionPool& pool,
+                                       const shared_ptr<TSocket>& socket,
+                                       int delayMs) {
+  PlatformThreadFactory factory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+      PlatformThreadFactory::OTHER,
+      PlatformThreadFactory::NORMAL,
+      1,
+#endif
+      false);
+  shared_ptr<Thread> thread =
+    factory.newThread(shared_ptr<Runnable>(new DelayedRelease(pool, socket, delayMs)));
+  thread->start();
+  return thread;
+}
+
+BOOST_AUTO_TEST_CASE( test_reuse ) {
+  int port;
+  int listenFd = listenOnLoopback(&port);
+
+  std::vector<std::pair<std::string, int> > servers;
+  servers.push_back(std::make_pair(std::string("127.0.0.1"), port));
+  TSocketConnectionPool pool(servers);
+  pool.setMaxActive(2);
+
+  BOOST_CHECK_EQUAL(pool.warm(2), 2u);
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 2u);
+
+  shared_ptr<TSocket> a = pool.acquire();
+  BOOST_CHECK(a->isOpen());
+  BOOST_CHECK_EQUAL(pool.getNumActive(), 1u);
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 1u);
+
+  // The socket handed back is the next one handed out
+  pool.release(a);
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 2u);
+  shared_ptr<TSocket> b = pool.acquire();
+  BOOST_CHECK(a == b);
+
+  shared_ptr<TSocket> c = pool.acquire();
+  BOOST_CHECK(c != b);
+  BOOST_CHECK_THROW(pool.acquire(), TTransportException);
+
+  // Broken connections aren't kept
+  pool.release(c, false);
+  BOOST_CHECK(!c->isOpen());
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 0u);
+  pool.release(b);
+  BOOST_CHECK_EQUAL(pool.getNumActive(), 0u);
+
+  close(listenFd);
+}
+
+BOOST_AUTO_TEST_CASE( test_acquire_waits_for_release ) {
+  int port;
+  int listenFd = listenOnLoopback(&port);
+
+  std::vector<std::pair<std::string, int> > servers;
+  servers.push_back(std::make_pair(std::string("127.0.0.1"), port));
+  TSocketConnectionPool pool(servers);
+  pool.setMaxActive(1);
+  pool.setAcquireTimeout(5000);
+
+  // With the server at maxActive, acquire() waits for the socket out to
+  // come back, and hands out that one
+  shared_ptr<TSocket> a = pool.acquire();
+  shared_ptr<Thread> thread = releaseLater(pool, a, 50);
+  int64_t start = Util::monotonicTime();
+  shared_ptr<TSocket> b = pool.acquire();
+  BOOST_CHECK(a == b);
+  BOOST_CHECK_GE(Util::monotonicTime() - start, 40);
+  BOOST_CHECK_EQUAL(pool.getNumActive(), 1u);
+  thread->join();
+
+  pool.release(b);
+  close(listenFd);
+}
+
+BOOST_AUTO_TEST_CASE( test_acquire_timeout ) {
+  int port;
+  int listenFd = listenOnLoopback(&port);
+
+  std::vector<std::pair<std::string, int> > servers;
+  servers.push_back(std::make_pair(std::string("127.0.0.1"), port));
+  TSocketConnectionPool pool(servers);
+  pool.setMaxActive(1);
+  pool.setAcquireTimeout(100);
+
+  shared_ptr<TSocket> a = pool.acquire();
+  int64_t start = Util::monotonicTime();
+  BOOST_CHECK_THROW(pool.acquire(), TTransportException);
+  int64_t waited = Util::monotonicTime() - start;
+  BOOST_CHECK_GE(waited, 90);
+  BOOST_CHECK_LT(waited, 2000);
+
+  pool.release(a);
+  close(listenFd);
+}
+
+BOOST_AUTO_TEST_CASE( test_health ) {
+  int port;
+  int listenFd = listenOnLoopback(&port);
+
+  std::vector<std::pair<std::string, int> > servers;
+  servers.push_back(std::make_pair(std::string("127.0.0.1"), port));
+  TSocketConnectionPool pool(servers);
+  pool.setMaxIdleTime(3600);
+
+  BOOST_CHECK_EQUAL(pool.warm(3), 3u);
+  pool.checkHealth();
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 3u);
+
+  // The server closes one of them
+  int serverFd = accept(listenFd, NULL, NULL);
+  BOOST_REQUIRE(serverFd >= 0);
+  close(serverFd);
+  usleep(10000);
+
+  pool.checkHealth();
+  BOOST_CHECK_EQUAL(pool.getNumIdle(), 2u);
+
+  close(listenFd);
+}
+
+BOOST_AUTO_TEST_CASE( test_down ) {
+  // Find a port with nobody listening
+  int port;
+  close(listenOnLoopback(&port));
+
+  std::vector<shared_ptr<TSocketPoolServer> > servers;
+  servers.push_back(shared_ptr<TSocketPoolServer>(new TSocketPoolServer("127.0.0.1", port)));
+  TSocketConnectionPool pool(servers);
+  pool.setMaxConsecutiveFailures(0);
+
+  BOOST_CHECK_EQUAL(pool.warm(1), 0u);
+  BOOST_CHECK(servers[0]->lastFailTime_ > 0);
+  BOOST_CHECK_THROW(pool.acquire(), TTransportException);
+  BOOST_CHECK_EQUAL(pool.getNumActive(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
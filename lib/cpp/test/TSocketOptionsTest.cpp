@@ -0,0 +1,677 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/transport/TDNSCache.h>
+#include <thrift/transport/TServerSocket.h>
+#include <thrift/transport/TSocket.h>
+#include <thrift/transport/TTransportException.h>
+
+BOOST_AUTO_TEST_SUITE( TSocketOptionsTest )
+
+using apache::thrift::concurrency::Guard;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::Util;
+using apache::thrift::transport::TDNSCache;
+using apache::thrift::transport::TIOVec;
+using apache::thrift::transport::TResolvedAddress;
+using apache::thrift::transport::TServerSocket;
+using apache::thrift::transport::TSocket;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+// The port the kernel picked for a server socket listening on port 0
+static int boundPort(TServerSocket& server) {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  BOOST_REQUIRE(getsockname(server.getSocketFD(), (struct sockaddr*)&addr, &len) == 0);
+  if (addr.ss_family == AF_INET6) {
+    return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+  }
+  return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+}
+
+static void echo(shared_ptr<TTransport> from, shared_ptr<TTransport> to, const char* msg) {
+  uint32_t len = static_cast<uint32_t>(std::strlen(msg));
+  from->write(reinterpret_cast<const uint8_t*>(msg), len);
+  std::string got(len, '\0');
+  to->readAll(reinterpret_cast<uint8_t*>(&got[0]), len);
+  BOOST_CHECK_EQUAL(got, msg);
+}
+
+BOOST_AUTO_TEST_CASE( test_latency_options ) {
+  TServerSocket server(0);
+  server.setTcpDeferAccept(1);
+  server.setTcpFastOpen(16);
+  server.setTcpQuickAck(true);
+  server.setBusyPoll(50);
+  server.listen();
+  int port = boundPort(server);
+
+  // Twice, so the second connection can use the Fast Open cookie
+  for (int i = 0; i < 2; ++i) {
+    shared_ptr<TSocket> client(new TSocket("localhost", port));
+    client->setFastOpen(true);
+    client->setQuickAck(true);
+    client->setIncomingCpu(0);
+    client->open();
+
+    // With TCP_DEFER_ACCEPT the connection only turns up once it has data
+    const char* request = "request";
+    client->write(reinterpret_cast<const uint8_t*>(request), std::strlen(request));
+    shared_ptr<TTransport> accepted = server.accept();
+    std::string got(std::strlen(request), '\0');
+    accepted->readAll(reinterpret_cast<uint8_t*>(&got[0]), got.size());
+    BOOST_CHECK_EQUAL(got, request);
+
+    echo(accepted, client, "response");
+    echo(client, accepted, "again");
+    BOOST_CHECK(client->getIncomingCpu() >= -1);
+
+    client->close();
+  }
+
+  server.close();
+}
+
+BOOST_AUTO_TEST_CASE( test_options_off ) {
+  TServerSocket server(0);
+  server.setTcpDeferAccept(0);
+  server.listen();
+
+  shared_ptr<TSocket> client(new TSocket("localhost", boundPort(server)));
+  client->open();
+  // Without deferral the connection can be accepted before any data
+  shared_ptr<TTransport> accepted = server.accept();
+  echo(client, accepted, "ping");
+  echo(accepted, client, "pong");
+
+  client->close();
+  server.close();
+}
+
+BOOST_AUTO_TEST_CASE( test_cork ) {
+  TServerSocket server(0);
+  server.setTcpDeferAccept(0);
+  server.listen();
+
+  shared_ptr<TSocket> client(new TSocket("localhost", boundPort(server)));
+  client->setCork(true);
+  client->open();
+  shared_ptr<TTransport> accepted = server.accept();
+
+  // A message in pieces arrives whole once flushed
+  for (int i = 0; i < 2; ++i) {
+    client->write(reinterpret_cast<const uint8_t*>("hea"), 3);
+    TIOVec iov[2] = {
+      { reinterpret_cast<const uint8_t*>("der"), 3 },
+      { reinterpret_cast<const uint8_t*>("body"), 4 }
+    };
+    client->writev(iov, 2);
+    client->flush();
+    uint8_t buf[10];
+    accepted->readAll(buf, sizeof(buf));
+    BOOST_CHECK_EQUAL(std::string(reinterpret_cast<char*>(buf), sizeof(buf)), "headerbody");
+  }
+
+  // Turning it off sends anything still held back
+  client->write(reinterpret_cast<const uint8_t*>("tail"), 4);
+  client->setCork(false);
+  uint8_t tail[4];
+  accepted->readAll(tail, sizeof(tail));
+  BOOST_CHECK_EQUAL(std::string(reinterpret_cast<char*>(tail), sizeof(tail)), "tail");
+  echo(client, accepted, "uncorked");
+
+  client->close();
+  server.close();
+}
+
+BOOST_AUTO_TEST_CASE( test_accept_burst ) {
+  TServerSocket server(0, 0, 250);
+  server.setTcpDeferAccept(0);
+  server.listen();
+  int port = boundPort(server);
+
+  // More than one batch waiting in the backlog
+  const int count = TServerSocket::ACCEPT_BATCH_SIZE + 10;
+  std::vector<shared_ptr<TSocket> > clients;
+  for (int i = 0; i < count; ++i) {
+    clients.push_back(shared_ptr<TSocket>(new TSocket("localhost", port)));
+    clients.back()->open();
+  }
+  usleep(10 * 1000);
+
+  for (int i = 0; i < count; ++i) {
+    shared_ptr<TSocket> accepted
+      = boost::dynamic_pointer_cast<TSocket>(server.accept());
+    BOOST_REQUIRE(accepted);
+    int fd = accepted->getSocketFD();
+    BOOST_CHECK_EQUAL(fcntl(fd, F_GETFL) & O_NONBLOCK, 0);
+    struct timeval tv;
+    socklen_t len = sizeof(tv);
+    BOOST_REQUIRE(getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, &len) == 0);
+    // Inherited from the listening socket, give or take a kernel tick
+    long ms = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    BOOST_CHECK(ms >= 250 && ms < 300);
+    BOOST_CHECK(!accepted->getPeerAddress().empty());
+  }
+
+  // Each interrupt stops one accept(), even when sent together
+  server.interrupt();
+  server.interrupt();
+  for (int i = 0; i < 2; ++i) {
+    try {
+      server.accept();
+      BOOST_ERROR("accept() not interrupted");
+    } catch (const TTransportException& te) {
+      BOOST_CHECK_EQUAL(te.getType(), TTransportException::INTERRUPTED);
+    }
+  }
+
+  // Then it waits for connections again
+  clients[0]->close();
+  clients[0]->open();
+  BOOST_CHECK(server.accept());
+
+  server.close();
+}
+
+// Reads everything sent to a socket, after interrupting the writer if
+// asked to, while the test writes
+class Drainer : public Runnable {
+ public:
+  Drainer(shared_ptr<TTransport> from, size_t len, pthread_t interrupt)
+    : from_(from), len_(len), interrupt_(interrupt), interrupting_(true) {}
+
+  explicit Drainer(shared_ptr<TTransport> from, size_t len)
+    : from_(from), len_(len), interrupting_(false) {}
+
+  void run() {
+    if (interrupting_) {
+      // Let the writer block first, and interrupt it more than once
+      for (int i = 0; i < 3; ++i) {
+        usleep(50 * 1000);
+        pthread_kill(interrupt_, SIGUSR1);
+      }
+    }
+    got_.resize(len_);
+    try {
+      if (len_ > 0) {
+        from_->readAll(reinterpret_cast<uint8_t*>(&got_[0]), static_cast<uint32_t>(len_));
+      }
+    } catch (const TTransportException&) {
+      // The writer gave up and closed
+      got_.clear();
+    }
+  }
+
+  const std::string& got() const { return got_; }
+
+ private:
+  shared_ptr<TTransport> from_;
+  size_t len_;
+  pthread_t interrupt_;
+  bool interrupting_;
+  std::string got_;
+};
+
+static shared_ptr<Thread> startThread(shared_ptr<Runnable> runnable) {
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  shared_ptr<Thread> thread = factory.newThread(runnable);
+  thread->start();
+  return thread;
+}
+
+BOOST_AUTO_TEST_CASE( test_writev ) {
+  TServerSocket server(0);
+  server.setTcpDeferAccept(0);
+  server.listen();
+
+  shared_ptr<TSocket> client(new TSocket("localhost", boundPort(server)));
+  client->open();
+  shared_ptr<TTransport> accepted = server.accept();
+
+  // More buffers than one sendmsg() takes, empty ones among them, and
+  // more bytes than the socket buffers hold, so sends end part way into
+  // a buffer
+  std::vector<std::string> parts;
+  for (int i = 0; i < 200; ++i) {
+    parts.push_back(std::string(i % 7 == 0 ? 0 : (i * 997) % 3000 + 1, static_cast<char>('a' + i % 26)));
+  }
+  parts.push_back(std::string(4 * 1024 * 1024, 'z'));
+  std::vector<TIOVec> iov;
+  std::string expected;
+  for (size_t i = 0; i < parts.size(); ++i) {
+    TIOVec v = { reinterpret_cast<const uint8_t*>(parts[i].data()),
+                 static_cast<uint32_t>(parts[i].size()) };
+    iov.push_back(v);
+    expected += parts[i];
+  }
+
+  shared_ptr<Drainer> drainer(new Drainer(accepted, expected.size()));
+  shared_ptr<Thread> thread = startThread(drainer);
+  client->writev(&iov[0], static_cast<uint32_t>(iov.size()));
+  thread->join();
+  BOOST_CHECK(drainer->got() == expected);
+
+  // Nothing to send is fine
+  client->writev(&iov[0], 0);
+  TIOVec empty = { reinterpret_cast<const uint8_t*>(""), 0 };
+  client->writev(&empty, 1);
+  echo(client, accepted, "after");
+
+  // As is writing to a closed socket, which throws
+  client->close();
+  BOOST_CHECK_THROW(client->writev(&iov[1], 1), TTransportException);
+
+  server.close();
+}
+
+static void ignoreSignal(int) {}
+
+BOOST_AUTO_TEST_CASE( test_writev_interrupted ) {
+  // Interrupted system calls fail with EINTR rather than restarting
+  struct sigaction action, old;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = ignoreSignal;
+  sigemptyset(&action.sa_mask);
+  BOOST_REQUIRE(sigaction(SIGUSR1, &action, &old) == 0);
+
+  TServerSocket server(0);
+  server.setTcpDeferAccept(0);
+  server.listen();
+
+  shared_ptr<TSocket> client(new TSocket("localhost", boundPort(server)));
+  client->open();
+  shared_ptr<TTransport> accepted = server.accept();
+
+  // Fill the socket buffers, so the next send blocks before sending anything
+  int fd = client->getSocketFD();
+  int flags = fcntl(fd, F_GETFL);
+  BOOST_REQUIRE(fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+  std::string chunk(64 * 1024, 'f');
+  size_t filled = 0;
+  int32_t b;
+  while ((b = client->tryWrite(reinterpret_cast<const uint8_t*>(chunk.data()),
+                               static_cast<uint32_t>(chunk.size()))) > 0) {
+    filled += b;
+  }
+  BOOST_REQUIRE_EQUAL(b, 0);
+  BOOST_REQUIRE(fcntl(fd, F_SETFL, flags) == 0);
+
+  // The signals interrupt the blocked send, which carries on
+  std::string tail(256 * 1024, 't');
+  TIOVec iov[2] = {
+    { reinterpret_cast<const uint8_t*>(tail.data()), static_cast<uint32_t>(tail.size() / 2) },
+    { reinterpret_cast<const uint8_t*>(tail.data()) + tail.size() / 2,
+      static_cast<uint32_t>(tail.size() - tail.size() / 2) }
+  };
+  shared_ptr<Drainer> drainer(new Drainer(accepted, filled + tail.size(), pthread_self()));
+  shared_ptr<Thread> thread = startThread(drainer);
+  try {
+    client->writev(iov, 2);
+  } catch (const TTransportException& te) {
+    BOOST_ERROR(std::string("interrupted writev() failed: ") + te.what());
+    client->close();
+  }
+  thread->join();
+  BOOST_CHECK(drainer->got().size() == filled + tail.size() &&
+              drainer->got().substr(filled) == tail);
+
+  client->close();
+  server.close();
+  sigaction(SIGUSR1, &old, NULL);
+}
+
+BOOST_AUTO_TEST_CASE( test_try_read_write ) {
+  TServerSocket server(0);
+  server.setTcpDeferAccept(0);
+  server.listen();
+
+  shared_ptr<TSocket> client(new TSocket("localhost", boundPort(server)));
+  client->open();
+  shared_ptr<TSocket> accepted
+    = boost::dynamic_pointer_cast<TSocket>(server.accept());
+  BOOST_REQUIRE(accepted);
+  int fd = accepted->getSocketFD();
+  BOOST_REQUIRE(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0);
+
+  // Nothing yet is not an error
+  uint8_t buf[16];
+  BOOST_CHECK_EQUAL(accepted->tryRead(buf, sizeof(buf)), TTransport::TRY_LATER);
+
+  client->write(reinterpret_cast<const uint8_t*>("ping"), 4);
+  int32_t got = -1;
+  for (int i = 0; i < 100 && got < 0; ++i) {
+    got = accepted->tryRead(buf, sizeof(buf));
+    if (got < 0) {
+      usleep(1000);
+    }
+  }
+  BOOST_CHECK_EQUAL(got, 4);
+  BOOST_CHECK_EQUAL(accepted->tryWrite(reinterpret_cast<const uint8_t*>("pong"), 4), 4);
+
+  // A client that resets the connection is reported, not thrown
+  struct linger abort = { 1, 0 };
+  BOOST_REQUIRE(setsockopt(client->getSocketFD(), SOL_SOCKET, SO_LINGER,
+                           &abort, sizeof(abort)) == 0);
+  client->close();
+  got = -1;
+  for (int i = 0; i < 100 && got < 0; ++i) {
+    got = accepted->tryRead(buf, sizeof(buf));
+    if (got < 0) {
+      usleep(1000);
+    }
+  }
+  BOOST_CHECK_EQUAL(got, 0);
+  BOOST_CHECK_EQUAL(accepted->tryWrite(reinterpret_cast<const uint8_t*>("gone"), 4),
+                    TTransport::TRY_FAILED);
+
+  server.close();
+}
+
+BOOST_AUTO_TEST_CASE( test_deadline ) {
+  TServerSocket server(0);
+  server.setTcpDeferAccept(0);
+  server.listen();
+
+  shared_ptr<TSocket> client(new TSocket("localhost", boundPort(server)));
+  client->open();
+  shared_ptr<TTransport> accepted = server.accept();
+
+  // Nothing arrives: the read gives up at the deadline
+  uint8_t buf[16];
+  int64_t start = Util::monotonicTimeUsec();
+  client->setDeadline(start + 50 * 1000);
+  try {
+    client->read(buf, sizeof(buf));
+    BOOST_ERROR("read past the deadline");
+  } catch (const TTransportException& te) {
+    BOOST_CHECK_EQUAL(te.getType(), TTransportException::TIMED_OUT);
+  }
+  int64_t waited = Util::monotonicTimeUsec() - start;
+  BOOST_CHECK(waited >= 50 * 1000);
+  BOOST_CHECK(waited < 1000 * 1000);
+
+  // Whatever has arrived is read even past the deadline
+  accepted->write(reinterpret_cast<const uint8_t*>("late"), 4);
+  usleep(10 * 1000);
+  BOOST_CHECK_EQUAL(client->read(buf, sizeof(buf)), 4u);
+
+  // One deadline spans both directions of a call
+  client->setDeadline(Util::monotonicTimeUsec() + 1000 * 1000);
+  echo(client, accepted, "ping");
+  echo(accepted, client, "pong");
+  client->setDeadline(0);
+  BOOST_CHECK_EQUAL(client->getDeadline(), 0);
+
+  client->close();
+  server.close();
+}
+
+// A cache told what names resolve to, so a socket can be given addresses
+// that are dead in known ways
+class SeededDNSCache : public TDNSCache {
+ public:
+  void seed(const std::string& host, int port, const std::vector<TResolvedAddress>& addresses) {
+    Guard g(monitor_.mutex());
+    Entry& entry = entries_[makeKey(host, port)];
+    entry.host = host;
+    entry.port = port;
+    entry.addresses = addresses;
+    entry.expires = time(NULL) + 3600;
+  }
+};
+
+static TResolvedAddress loopbackAddress(int port) {
+  TResolvedAddress address;
+  std::memset(&address, 0, sizeof(address));
+  struct sockaddr_in* sin = reinterpret_cast<struct sockaddr_in*>(&address.addr);
+  sin->sin_family = AF_INET;
+  sin->sin_port = htons(static_cast<uint16_t>(port));
+  sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.family = AF_INET;
+  address.socktype = SOCK_STREAM;
+  address.protocol = IPPROTO_TCP;
+  address.addrlen = sizeof(struct sockaddr_in);
+  return address;
+}
+
+// A loopback port nothing listens on, so connecting is refused
+static int refusedPort() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  BOOST_REQUIRE(fd >= 0);
+  TResolvedAddress address = loopbackAddress(0);
+  BOOST_REQUIRE(bind(fd, (struct sockaddr*)&address.addr, address.addrlen) == 0);
+  socklen_t len = sizeof(address.addr);
+  BOOST_REQUIRE(getsockname(fd, (struct sockaddr*)&address.addr, &len) == 0);
+  ::close(fd);
+  return ntohs(reinterpret_cast<struct sockaddr_in*>(&address.addr)->sin_port);
+}
+
+// A loopback listener whose backlog is full, so that connecting to it hangs
+// as it does to a host that has gone away
+class StalledListener {
+ public:
+  StalledListener() : fd_(socket(AF_INET, SOCK_STREAM, 0)) {
+    BOOST_REQUIRE(fd_ >= 0);
+    TResolvedAddress address = loopbackAddress(0);
+    BOOST_REQUIRE(bind(fd_, (struct sockaddr*)&address.addr, address.addrlen) == 0);
+    BOOST_REQUIRE(::listen(fd_, 0) == 0);
+    socklen_t len = sizeof(address.addr);
+    BOOST_REQUIRE(getsockname(fd_, (struct sockaddr*)&address.addr, &len) == 0);
+    port_ = ntohs(reinterpret_cast<struct sockaddr_in*>(&address.addr)->sin_port);
+
+    // Fill the backlog, until a connect no longer completes
+    for (int i = 0; i < 8; ++i) {
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+      BOOST_REQUIRE(fd >= 0);
+      fillers_.push_back(fd);
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      address = loopbackAddress(port_);
+      if (connect(fd, (struct sockaddr*)&address.addr, address.addrlen) == 0) {
+        continue;
+      }
+      BOOST_REQUIRE_EQUAL(errno, EINPROGRESS);
+      struct pollfd pfd = { fd, POLLOUT, 0 };
+      if (poll(&pfd, 1, 100) == 0) {
+        return;
+      }
+    }
+    BOOST_FAIL("the listen backlog never filled");
+  }
+
+  ~StalledListener() {
+    for (size_t i = 0; i < fillers_.size(); ++i) {
+      ::close(fillers_[i]);
+    }
+    ::close(fd_);
+  }
+
+  int getPort() const { return port_; }
+
+ private:
+  int fd_;
+  int port_;
+  std::vector<int> fillers_;
+};
+
+BOOST_AUTO_TEST_CASE( test_happy_eyeballs_stalled_address ) {
+  StalledListener stalled;
+  TServerSocket server(0);
+  server.setTcpDeferAccept(0);
+  server.listen();
+
+  shared_ptr<SeededDNSCache> cache(new SeededDNSCache);
+  std::vector<TResolvedAddress> addresses;
+  addresses.push_back(loopbackAddress(stalled.getPort()));
+  addresses.push_back(loopbackAddress(boundPort(server)));
+  cache->seed("happy.invalid", 9090, addresses);
+
+  // One after another, the stalled address takes the whole connect timeout
+  shared_ptr<TSocket> client(new TSocket("happy.invalid", 9090));
+  client->setDNSCache(cache);
+  client->setConnTimeout(300);
+  int64_t start = Util::monotonicTime();
+  client->open();
+  BOOST_CHECK(Util::monotonicTime() - start >= 300);
+  echo(client, server.accept(), "sequential");
+  client->close();
+
+  // Racing, the next address starts after the attempt delay
+  client->setConnTimeout(5000);
+  client->setHappyEyeballs(true, 50);
+  start = Util::monotonicTime();
+  client->open();
+  int64_t took = Util::monotonicTime() - start;
+  BOOST_CHECK(took >= 50);
+  BOOST_CHECK(took < 1000);
+  echo(client, server.accept(), "raced");
+  client->close();
+
+  server.close();
+}
+
+BOOST_AUTO_TEST_CASE( test_happy_eyeballs_refused_address ) {
+  TServerSocket server(0);
+  server.setTcpDeferAccept(0);
+  server.listen();
+
+  shared_ptr<SeededDNSCache> cache(new SeededDNSCache);
+  std::vector<TResolvedAddress> addresses;
+  addresses.push_back(loopbackAddress(refusedPort()));
+  addresses.push_back(loopbackAddress(boundPort(server)));
+  cache->seed("happy.invalid", 9090, addresses);
+
+  // A refused attempt starts the next at once, well before the delay
+  shared_ptr<TSocket> client(new TSocket("happy.invalid", 9090));
+  client->setDNSCache(cache);
+  client->setHappyEyeballs(true, 2000);
+  int64_t start = Util::monotonicTime();
+  client->open();
+  BOOST_CHECK(Util::monotonicTime() - start < 1000);
+  echo(client, server.accept(), "raced");
+  client->close();
+
+  server.close();
+}
+
+BOOST_AUTO_TEST_CASE( test_happy_eyeballs_timeout ) {
+  StalledListener stalled;
+  shared_ptr<SeededDNSCache> cache(new SeededDNSCache);
+  std::vector<TResolvedAddress> addresses;
+  addresses.push_back(loopbackAddress(stalled.getPort()));
+  addresses.push_back(loopbackAddress(stalled.getPort()));
+  addresses.push_back(loopbackAddress(stalled.getPort()));
+  cache->seed("happy.invalid", 9090, addresses);
+
+  // The connect timeout bounds the whole open(), not each address
+  shared_ptr<TSocket> client(new TSocket("happy.invalid", 9090));
+  client->setDNSCache(cache);
+  client->setConnTimeout(300);
+  client->setHappyEyeballs(true, 50);
+  int64_t start = Util::monotonicTime();
+  try {
+    client->open();
+    BOOST_ERROR("open() connected to a stalled listener");
+  } catch (const TTransportException& te) {
+    BOOST_CHECK_EQUAL(te.getType(), TTransportException::NOT_OPEN);
+  }
+  int64_t took = Util::monotonicTime() - start;
+  BOOST_CHECK(took >= 300);
+  BOOST_CHECK(took < 800);
+  BOOST_CHECK(!client->isOpen());
+}
+
+BOOST_AUTO_TEST_CASE( test_dns_cache ) {
+  TServerSocket server(0);
+  server.setTcpDeferAccept(0);
+  server.listen();
+
+  // A name only the cache knows
+  shared_ptr<SeededDNSCache> cache(new SeededDNSCache);
+  std::vector<TResolvedAddress> addresses(1, loopbackAddress(boundPort(server)));
+  cache->seed("cached.invalid", 9090, addresses);
+  shared_ptr<TSocket> client(new TSocket("cached.invalid", 9090));
+  client->setDNSCache(cache);
+  client->open();
+  echo(client, server.accept(), "cached");
+  client->close();
+
+  // Sockets without a cache of their own use the default one
+  TSocket::setDefaultDNSCache(cache);
+  shared_ptr<TSocket> other(new TSocket("cached.invalid", 9090));
+  other->open();
+  echo(other, server.accept(), "default");
+  other->close();
+  TSocket::setDefaultDNSCache(shared_ptr<TDNSCache>());
+  BOOST_CHECK_THROW(other->open(), TTransportException);
+
+  // An entry none of whose addresses connect is dropped
+  addresses.assign(1, loopbackAddress(refusedPort()));
+  cache->seed("stale.invalid", 9090, addresses);
+  BOOST_CHECK_EQUAL(cache->size(), 2u);
+  shared_ptr<TSocket> stale(new TSocket("stale.invalid", 9090));
+  stale->setDNSCache(cache);
+  BOOST_CHECK_THROW(stale->open(), TTransportException);
+  BOOST_CHECK_EQUAL(cache->size(), 1u);
+
+  // ...by a racing open() as well
+  cache->seed("stale.invalid", 9090, addresses);
+  stale->setHappyEyeballs(true, 50);
+  BOOST_CHECK_THROW(stale->open(), TTransportException);
+  BOOST_CHECK_EQUAL(cache->size(), 1u);
+
+  server.close();
+}
+
+BOOST_AUTO_TEST_CASE( test_exception_errno ) {
+  TTransportException plain(TTransportException::NOT_OPEN, "closed");
+  BOOST_CHECK_EQUAL(plain.getErrno(), 0);
+  BOOST_CHECK_EQUAL(std::string(plain.what()), "closed");
+
+  // The description is added once, when first asked for
+  TTransportException te(TTransportException::UNKNOWN, "recv()", ECONNRESET);
+  BOOST_CHECK_EQUAL(te.getErrno(), ECONNRESET);
+  std::string what = te.what();
+  BOOST_CHECK_EQUAL(what.compare(0, 8, "recv(): "), 0);
+  BOOST_CHECK(what.size() > 8);
+  BOOST_CHECK_EQUAL(std::string(te.what()), what);
+  TTransportException copy(te);
+  BOOST_CHECK_EQUAL(std::string(copy.what()), what);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
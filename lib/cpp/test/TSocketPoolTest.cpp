@@ -0,0 +1,140 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstdlib>
+#include <thrift/transport/TSocketPool.h>
+
+BOOST_AUTO_TEST_SUITE( TSocketPoolTest )
+
+using apache::thrift::transport::TSocketPool;
+using apache::thrift::transport::TSocketPoolServer;
+using boost::shared_ptr;
+
+// Lets the tests order the servers without connecting to them
+class LatencyOrderedPool : public TSocketPool {
+ public:
+  LatencyOrderedPool() {
+    setLatencyAware(true);
+  }
+
+  shared_ptr<TSocketPoolServer> add(const std::string& name,
+                                    double latencyMs,
+                                    int consecutiveFailures) {
+    shared_ptr<TSocketPoolServer> server(new TSocketPoolServer(name, 1));
+    server->latencyMs_ = latencyMs;
+    server->consecutiveFailures_ = consecutiveFailures;
+    addServer(server);
+    return server;
+  }
+
+  void order() { orderByLatency(); }
+
+  const std::string& first() const { return servers_.front()->host_; }
+  const std::string& last() const { return servers_.back()->host_; }
+};
+
+BOOST_AUTO_TEST_CASE( test_failing_unmeasured_ranks_behind ) {
+  // A server that has only ever failed is never measured; it must still
+  // lose to a working one
+  LatencyOrderedPool pool;
+  pool.add("failing", 0, 3);
+  pool.add("working", 5, 0);
+
+  srand(1);
+  int workingFirst = 0;
+  const int kTrials = 1000;
+  for (int i = 0; i < kTrials; ++i) {
+    pool.order();
+    if (pool.first() == "working") {
+      ++workingFirst;
+    }
+  }
+  // Two random picks both land on the failing server a quarter of the time
+  BOOST_CHECK_GT(workingFirst, kTrials * 2 / 3);
+}
+
+BOOST_AUTO_TEST_CASE( test_unmeasured_ranks_first ) {
+  // One that hasn't failed is tried before measured ones, to measure it
+  LatencyOrderedPool pool;
+  pool.add("new", 0, 0);
+  pool.add("measured", 5, 0);
+
+  srand(1);
+  int newFirst = 0;
+  const int kTrials = 1000;
+  for (int i = 0; i < kTrials; ++i) {
+    pool.order();
+    if (pool.first() == "new") {
+      ++newFirst;
+    }
+  }
+  BOOST_CHECK_GT(newFirst, kTrials * 2 / 3);
+}
+
+BOOST_AUTO_TEST_CASE( test_failing_unmeasured_ejected ) {
+  LatencyOrderedPool pool;
+  pool.setOutlierLatencyFactor(2);
+  pool.add("failing", 0, 1);
+  pool.add("a", 5, 0);
+  pool.add("b", 6, 0);
+
+  srand(1);
+  for (int i = 0; i < 100; ++i) {
+    pool.order();
+    BOOST_REQUIRE_EQUAL(pool.last(), "failing");
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_slow_ejected ) {
+  LatencyOrderedPool pool;
+  pool.setOutlierLatencyFactor(2);
+  pool.add("slow", 50, 0);
+  pool.add("a", 5, 0);
+  pool.add("b", 6, 0);
+
+  srand(1);
+  for (int i = 0; i < 100; ++i) {
+    pool.order();
+    BOOST_REQUIRE_EQUAL(pool.last(), "slow");
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_failure_penalty_follows_connect_timeout ) {
+  // With a 1 ms connect timeout one failure costs 1 ms, which keeps a
+  // 4 ms server inside twice the 5 ms median
+  LatencyOrderedPool pool;
+  pool.setConnTimeout(1);
+  pool.setOutlierLatencyFactor(2);
+  pool.add("flaky", 4, 1);
+  pool.add("a", 5, 0);
+  pool.add("b", 6, 0);
+
+  srand(1);
+  int flakyLast = 0;
+  for (int i = 0; i < 100; ++i) {
+    pool.order();
+    if (pool.last() == "flaky") {
+      ++flakyLast;
+    }
+  }
+  BOOST_CHECK_LT(flakyLast, 100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
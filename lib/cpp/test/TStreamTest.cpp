@@ -0,0 +1,237 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <thrift/TStream.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TStreamTest )
+
+using apache::thrift::TStream;
+using apache::thrift::TStreamSink;
+using apache::thrift::TStreamSource;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TType;
+using apache::thrift::protocol::T_I32;
+using apache::thrift::protocol::T_STOP;
+using apache::thrift::transport::TFramedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+// Written out the way the generator would
+struct Row {
+  Row() : id(0) {}
+
+  int32_t id;
+
+  uint32_t read(TProtocol* iprot) {
+    uint32_t xfer = 0;
+    std::string fname;
+    TType ftype;
+    int16_t fid;
+    xfer += iprot->readStructBegin(fname);
+    while (true) {
+      xfer += iprot->readFieldBegin(fname, ftype, fid);
+      if (ftype == T_STOP) {
+        break;
+      }
+      if (fid == 1 && ftype == T_I32) {
+        xfer += iprot->readI32(id);
+      } else {
+        xfer += iprot->skip(ftype);
+      }
+      xfer += iprot->readFieldEnd();
+    }
+    xfer += iprot->readStructEnd();
+    return xfer;
+  }
+
+  uint32_t write(TProtocol* oprot) const {
+    uint32_t xfer = 0;
+    xfer += oprot->writeStructBegin("Row");
+    xfer += oprot->writeFieldBegin("id", T_I32, 1);
+    xfer += oprot->writeI32(id);
+    xfer += oprot->writeFieldEnd();
+    xfer += oprot->writeFieldStop();
+    xfer += oprot->writeStructEnd();
+    return xfer;
+  }
+};
+
+typedef TStream<Row> Rows;
+
+// Counts rows up to max
+class RowSource : public TStreamSource<Row> {
+ public:
+  explicit RowSource(int32_t max) : next_(0), max_(max), cancelled(false) {}
+
+  bool next(Row& row) {
+    if (next_ == max_) {
+      return false;
+    }
+    row.id = next_++;
+    return true;
+  }
+
+  void cancel() { cancelled = true; }
+
+ private:
+  int32_t next_;
+  int32_t max_;
+
+ public:
+  bool cancelled;
+};
+
+// Takes rows, checking they come in order, up to limit
+class RowSink : public TStreamSink<Row> {
+ public:
+  explicit RowSink(int32_t limit = -1) : count(0), limit_(limit) {}
+
+  bool write(const Row& row) {
+    BOOST_CHECK_EQUAL(row.id, count);
+    ++count;
+    return count != limit_;
+  }
+
+  int32_t count;
+
+ private:
+  int32_t limit_;
+};
+
+// A transport that fails once it has taken limit bytes
+class FailingTransport : public TMemoryBuffer {
+ public:
+  explicit FailingTransport(uint32_t limit) : limit_(limit) {}
+
+  void write_virt(const uint8_t* buf, uint32_t len) {
+    if (available_read() + len > limit_) {
+      throw TTransportException(TTransportException::NOT_OPEN, "peer went away");
+    }
+    TMemoryBuffer::write(buf, len);
+  }
+
+ private:
+  uint32_t limit_;
+};
+
+template <class Protocol_>
+static void checkRoundTrip() {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  Protocol_ prot(buf);
+
+  Rows out;
+  out.setSource(shared_ptr<TStreamSource<Row> >(new RowSource(1000)));
+  uint32_t size = out.write(&prot);
+  BOOST_CHECK_EQUAL(size, buf->available_read());
+  BOOST_CHECK_EQUAL(out.size(), 1000u);
+
+  // Into a sink, an item at a time
+  std::string wire = buf->getBufferAsString();
+  Rows in;
+  shared_ptr<RowSink> sink(new RowSink());
+  in.setSink(sink);
+  BOOST_CHECK_EQUAL(in.read(&prot), size);
+  BOOST_CHECK_EQUAL(sink->count, 1000);
+  BOOST_CHECK(in.getItems().empty());
+
+  // Without a sink, kept
+  buf->resetBuffer((uint8_t*)wire.data(), static_cast<uint32_t>(wire.size()));
+  Rows kept;
+  kept.read(&prot);
+  BOOST_CHECK_EQUAL(kept.getItems().size(), 1000u);
+  BOOST_CHECK_EQUAL(kept.getItems()[999].id, 999);
+
+  // And written again from the items
+  shared_ptr<TMemoryBuffer> again(new TMemoryBuffer());
+  Protocol_ againProt(again);
+  BOOST_CHECK_EQUAL(kept.write(&againProt), size);
+  BOOST_CHECK(again->getBufferAsString() == wire);
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_round_trip ) {
+  checkRoundTrip<TBinaryProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_compact_round_trip ) {
+  checkRoundTrip<TCompactProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_sink_stops_early ) {
+  // The rest of the stream is skipped, leaving the transport after it
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TBinaryProtocol prot(buf);
+  Rows out;
+  out.setSource(shared_ptr<TStreamSource<Row> >(new RowSource(50)));
+  out.write(&prot);
+  prot.writeI32(12345);
+
+  Rows in;
+  shared_ptr<RowSink> sink(new RowSink(10));
+  in.setSink(sink);
+  in.read(&prot);
+  BOOST_CHECK_EQUAL(sink->count, 10);
+  int32_t after;
+  prot.readI32(after);
+  BOOST_CHECK_EQUAL(after, 12345);
+}
+
+BOOST_AUTO_TEST_CASE( test_flush_items_frames ) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  shared_ptr<TFramedTransport> framed(new TFramedTransport(buf));
+  TBinaryProtocol prot(framed);
+
+  Rows out;
+  out.setFlushItems(100);
+  out.setSource(shared_ptr<TStreamSource<Row> >(new RowSource(250)));
+  out.write(&prot);
+  framed->flush();
+
+  int frames = 0;
+  std::string wire = buf->getBufferAsString();
+  for (size_t pos = 0; pos < wire.size(); ++frames) {
+    uint32_t len = ((uint8_t)wire[pos] << 24) | ((uint8_t)wire[pos + 1] << 16) |
+                   ((uint8_t)wire[pos + 2] << 8) | (uint8_t)wire[pos + 3];
+    pos += 4 + len;
+  }
+  BOOST_CHECK_EQUAL(frames, 3);
+
+  Rows in;
+  in.read(&prot);
+  BOOST_CHECK_EQUAL(in.getItems().size(), 250u);
+}
+
+BOOST_AUTO_TEST_CASE( test_cancel_on_failed_write ) {
+  shared_ptr<FailingTransport> buf(new FailingTransport(1000));
+  TBinaryProtocol prot(buf);
+  shared_ptr<RowSource> source(new RowSource(1000));
+  Rows out;
+  out.setSource(source);
+  BOOST_CHECK_THROW(out.write(&prot), TTransportException);
+  BOOST_CHECK(source->cancelled);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,200 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <thrift/TStreamedBinary.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TStreamedBinaryTest )
+
+using apache::thrift::TBinarySink;
+using apache::thrift::TBinarySource;
+using apache::thrift::TBinarySpool;
+using apache::thrift::TStreamedBinary;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::transport::TFramedTransport;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+// Hands out a string, at most limit bytes per read
+class StringSource : public TBinarySource {
+ public:
+  StringSource(const std::string& data, uint32_t limit = 0xffffffff)
+    : data_(data), pos_(0), limit_(limit) {}
+
+  uint32_t read(uint8_t* buf, uint32_t len) {
+    uint32_t n = (std::min)((std::min)(len, limit_),
+                            static_cast<uint32_t>(data_.size() - pos_));
+    memcpy(buf, data_.data() + pos_, n);
+    pos_ += n;
+    return n;
+  }
+
+ private:
+  std::string data_;
+  size_t pos_;
+  uint32_t limit_;
+};
+
+class StringSink : public TBinarySink {
+ public:
+  StringSink() : writes(0) {}
+
+  void write(const uint8_t* buf, uint32_t len) {
+    data.append((const char*)buf, len);
+    ++writes;
+  }
+
+  std::string data;
+  int writes;
+};
+
+static std::string sampleData(size_t size) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<char>(i * 7 + i / 251);
+  }
+  return data;
+}
+
+static std::string readAll(const shared_ptr<TBinarySource>& source) {
+  std::string data;
+  uint8_t buf[1000];
+  uint32_t got;
+  while ((got = source->read(buf, sizeof(buf))) > 0) {
+    data.append((const char*)buf, got);
+  }
+  return data;
+}
+
+template <class Protocol_>
+static void checkRoundTrip() {
+  std::string data = sampleData(10000);
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  Protocol_ prot(buf);
+
+  TStreamedBinary out;
+  out.setChunkSize(4096);
+  out.setSource(shared_ptr<TBinarySource>(new StringSource(data, 1500)));
+  uint32_t size = out.write(&prot);
+  BOOST_CHECK_EQUAL(size, buf->available_read());
+  BOOST_CHECK_EQUAL(out.size(), data.size());
+
+  // Into a sink, a chunk at a time
+  std::string wire = buf->getBufferAsString();
+  TStreamedBinary in;
+  shared_ptr<StringSink> sink(new StringSink());
+  in.setSink(sink);
+  BOOST_CHECK_EQUAL(in.read(&prot), size);
+  BOOST_CHECK(sink->data == data);
+  BOOST_CHECK_EQUAL(sink->writes, 7);
+  BOOST_CHECK_EQUAL(in.size(), data.size());
+  BOOST_CHECK(!in.getSource());
+
+  // Without a sink, into a spool to be read back
+  buf->resetBuffer((uint8_t*)wire.data(), static_cast<uint32_t>(wire.size()));
+  TStreamedBinary spooled;
+  spooled.read(&prot);
+  BOOST_CHECK(readAll(spooled.getSource()) == data);
+  BOOST_CHECK(readAll(spooled.getSource()) == data);
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_round_trip ) {
+  checkRoundTrip<TBinaryProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_compact_round_trip ) {
+  checkRoundTrip<TCompactProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_empty ) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  TBinaryProtocol prot(buf);
+  TStreamedBinary out;
+  out.write(&prot);
+
+  TStreamedBinary in;
+  in.read(&prot);
+  BOOST_CHECK_EQUAL(in.size(), 0u);
+  BOOST_CHECK(readAll(in.getSource()).empty());
+}
+
+BOOST_AUTO_TEST_CASE( test_spool_spills_to_file ) {
+  std::string data = sampleData(5000);
+  shared_ptr<TBinarySpool> spool(new TBinarySpool(1024));
+  for (size_t pos = 0; pos < data.size(); pos += 700) {
+    size_t n = (std::min)(data.size() - pos, (size_t)700);
+    spool->write((const uint8_t*)data.data() + pos, static_cast<uint32_t>(n));
+  }
+  BOOST_CHECK_EQUAL(spool->size(), data.size());
+
+  shared_ptr<TBinarySource> source = spool->getSource();
+  BOOST_CHECK(readAll(source) == data);
+  uint8_t byte;
+  BOOST_CHECK_EQUAL(source->read(&byte, 1), 0u);
+  BOOST_CHECK(readAll(spool->getSource()) == data);
+}
+
+BOOST_AUTO_TEST_CASE( test_flush_chunks_frames ) {
+  // Each chunk goes in a frame of its own, the last with the struct's end
+  std::string data = sampleData(3000);
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  shared_ptr<TFramedTransport> framed(new TFramedTransport(buf));
+  TBinaryProtocol prot(framed);
+
+  TStreamedBinary out;
+  out.setChunkSize(1000);
+  out.setFlushChunks(true);
+  out.setSource(shared_ptr<TBinarySource>(new StringSource(data)));
+  out.write(&prot);
+  framed->flush();
+
+  int frames = 0;
+  std::string wire = buf->getBufferAsString();
+  for (size_t pos = 0; pos < wire.size(); ++frames) {
+    uint32_t len = ((uint8_t)wire[pos] << 24) | ((uint8_t)wire[pos + 1] << 16) |
+                   ((uint8_t)wire[pos + 2] << 8) | (uint8_t)wire[pos + 3];
+    BOOST_CHECK(len <= 1000 + 16);
+    pos += 4 + len;
+  }
+  BOOST_CHECK_EQUAL(frames, 4);
+
+  TStreamedBinary in;
+  shared_ptr<StringSink> sink(new StringSink());
+  in.setSink(sink);
+  in.read(&prot);
+  BOOST_CHECK(sink->data == data);
+}
+
+BOOST_AUTO_TEST_CASE( test_copies_share ) {
+  TStreamedBinary a;
+  TStreamedBinary b(a);
+  TStreamedBinary c;
+  BOOST_CHECK(a == b);
+  BOOST_CHECK(a != c);
+  b.setSource(shared_ptr<TBinarySource>(new StringSource("shared")));
+  BOOST_CHECK(readAll(a.getSource()) == "shared");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
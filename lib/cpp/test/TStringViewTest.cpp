@@ -0,0 +1,122 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <thrift/TStringView.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/protocol/TDebugProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TStringViewTest )
+
+using apache::thrift::TStringView;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+static bool pointsInto(const TStringView& view, const std::string& buf) {
+  return view.data() >= buf.data() && view.data() + view.size() <= buf.data() + buf.size();
+}
+
+BOOST_AUTO_TEST_CASE( test_view_basics ) {
+  TStringView empty;
+  BOOST_CHECK(empty.empty());
+  BOOST_CHECK_EQUAL(empty.str(), "");
+
+  TStringView a("apple");
+  TStringView b(std::string("banana"));
+  BOOST_CHECK_EQUAL(a.size(), 5u);
+  BOOST_CHECK(a < b);
+  BOOST_CHECK(a != b);
+  BOOST_CHECK(a == TStringView("apple"));
+  BOOST_CHECK(TStringView("app") < a);
+
+  // A copy shares the bytes, and keeps them alive
+  TStringView c = b;
+  b.clear();
+  BOOST_CHECK_EQUAL(c.str(), "banana");
+}
+
+template <typename Proto>
+static void checkProtocol() {
+  // Written through the virtual interface
+  shared_ptr<TMemoryBuffer> out(new TMemoryBuffer());
+  shared_ptr<TProtocol> writer(new Proto(out));
+  writer->writeStringView(TStringView("first string"));
+  writer->writeBinaryView(TStringView(std::string("\0binary\xff", 8)));
+  writer->writeStringView(TStringView());
+  writer->writeString("plain");
+
+  shared_ptr<std::string> message(new std::string(out->getBufferAsString()));
+  TStringView first, binary, empty, plain;
+  {
+    // A buffer with an owner lends its bytes to the views
+    shared_ptr<TMemoryBuffer> in(
+      new TMemoryBuffer((uint8_t*)&(*message)[0], (uint32_t)message->size(), message));
+    shared_ptr<TProtocol> reader(new Proto(in));
+    reader->readStringView(first);
+    reader->readBinaryView(binary);
+    reader->readStringView(empty);
+    reader->readStringView(plain);
+  }
+  BOOST_CHECK_EQUAL(first.str(), "first string");
+  BOOST_CHECK_EQUAL(binary.str(), std::string("\0binary\xff", 8));
+  BOOST_CHECK(empty.empty());
+  BOOST_CHECK_EQUAL(plain.str(), "plain");
+  BOOST_CHECK(pointsInto(first, *message));
+  BOOST_CHECK(pointsInto(binary, *message));
+
+  // The views keep the message alive once everything else lets go of it
+  const std::string* raw = message.get();
+  message.reset();
+  BOOST_CHECK(first.owner().get() == raw);
+  BOOST_CHECK_EQUAL(first.str(), "first string");
+
+  // Without an owner each view gets its own copy
+  std::string copy = out->getBufferAsString();
+  shared_ptr<TMemoryBuffer> unowned(
+    new TMemoryBuffer((uint8_t*)&copy[0], (uint32_t)copy.size()));
+  Proto reader(unowned);
+  TStringView copied;
+  reader.readStringView(copied);
+  BOOST_CHECK_EQUAL(copied.str(), "first string");
+  BOOST_CHECK(!pointsInto(copied, copy));
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_protocol ) {
+  checkProtocol<TBinaryProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_compact_protocol ) {
+  checkProtocol<TCompactProtocol>();
+}
+
+BOOST_AUTO_TEST_CASE( test_default_copies ) {
+  // Protocols without their own view support go through a std::string
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  apache::thrift::protocol::TDebugProtocol debug(buf);
+  debug.writeStringView(TStringView("debug"));
+  BOOST_CHECK(buf->getBufferAsString().find("\"debug\"") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
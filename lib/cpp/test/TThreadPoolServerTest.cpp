@@ -0,0 +1,278 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstdio>
+#include <unistd.h>
+#include <thrift/TApplicationException.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/server/TThreadPoolServer.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TServerSocket.h>
+#include <thrift/transport/TSocket.h>
+
+BOOST_AUTO_TEST_SUITE( TThreadPoolServerTest )
+
+using apache::thrift::TApplicationException;
+using apache::thrift::TProcessor;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::concurrency::ThreadManager;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::server::TServerEventHandler;
+using apache::thrift::server::TThreadPoolServer;
+using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::transport::TBufferedTransportFactory;
+using apache::thrift::transport::TServerSocket;
+using apache::thrift::transport::TSocket;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+// Answers each call
+class ReplyingProcessor : public TProcessor {
+ public:
+  virtual bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out, void*) {
+    std::string name;
+    TMessageType type;
+    int32_t seqid;
+    in->readMessageBegin(name, type, seqid);
+    in->readMessageEnd();
+    out->writeMessageBegin(name, apache::thrift::protocol::T_REPLY, seqid);
+    out->writeMessageEnd();
+    out->getTransport()->writeEnd();
+    out->getTransport()->flush();
+    return true;
+  }
+};
+
+// Tells the test the server is serving
+class ServeSignal : public TServerEventHandler {
+ public:
+  ServeSignal() : serving_(false) {}
+
+  virtual void preServe() {
+    Synchronized s(monitor_);
+    serving_ = true;
+    monitor_.notifyAll();
+  }
+
+  void wait() {
+    Synchronized s(monitor_);
+    while (!serving_) {
+      monitor_.wait();
+    }
+  }
+
+ private:
+  Monitor monitor_;
+  bool serving_;
+};
+
+class ServerRunner : public Runnable {
+ public:
+  explicit ServerRunner(TThreadPoolServer* server) : server_(server) {}
+
+  virtual void run() { server_->serve(); }
+
+ private:
+  TThreadPoolServer* server_;
+};
+
+static shared_ptr<PlatformThreadFactory> threadFactory() {
+  return shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+      PlatformThreadFactory::OTHER,
+      PlatformThreadFactory::NORMAL,
+      1,
+#endif
+      false));
+}
+
+// A server with one worker and room for one connection to wait for it
+class PoolServer {
+ public:
+  explicit PoolServer(TThreadPoolServer::TAcceptPolicy policy) {
+    char path[64];
+    std::snprintf(path, sizeof(path), "thrift-test-pool-%d-%d", (int)getpid(), (int)policy);
+    name_ = std::string(1, '\0') + path;
+    threadManager_ = ThreadManager::newSimpleThreadManager(1, 1);
+    threadManager_->threadFactory(threadFactory());
+    threadManager_->start();
+    server_.reset(new TThreadPoolServer(
+        shared_ptr<TProcessor>(new ReplyingProcessor),
+        shared_ptr<TServerSocket>(new TServerSocket(name_)),
+        shared_ptr<TBufferedTransportFactory>(new TBufferedTransportFactory),
+        shared_ptr<TBinaryProtocolFactory>(new TBinaryProtocolFactory),
+        threadManager_));
+    server_->setAcceptPolicy(policy);
+    shared_ptr<ServeSignal> signal(new ServeSignal);
+    server_->setServerEventHandler(signal);
+    thread_ = threadFactory()->newThread(shared_ptr<Runnable>(new ServerRunner(server_.get())));
+    thread_->start();
+    signal->wait();
+  }
+
+  ~PoolServer() {
+    server_->stop();
+    thread_->join();
+    threadManager_->stop();
+  }
+
+  shared_ptr<TSocket> connect(int recvTimeoutMs = 5000) {
+    shared_ptr<TSocket> socket(new TSocket(name_));
+    socket->setRecvTimeout(recvTimeoutMs);
+    socket->open();
+    return socket;
+  }
+
+  TThreadPoolServer& server() { return *server_; }
+
+  ThreadManager& threadManager() { return *threadManager_; }
+
+ private:
+  std::string name_;
+  shared_ptr<ThreadManager> threadManager_;
+  shared_ptr<TThreadPoolServer> server_;
+  shared_ptr<Thread> thread_;
+};
+
+static void sendCall(const shared_ptr<TSocket>& socket, int32_t seqid) {
+  shared_ptr<TBufferedTransport> transport(new TBufferedTransport(socket));
+  TBinaryProtocol protocol(transport);
+  protocol.writeMessageBegin("call", apache::thrift::protocol::T_CALL, seqid);
+  protocol.writeMessageEnd();
+  transport->flush();
+}
+
+// Reads a reply, returning its seqid and setting type
+static int32_t recvReply(const shared_ptr<TSocket>& socket, TMessageType& type) {
+  TBinaryProtocol protocol(socket);
+  std::string name;
+  int32_t seqid;
+  protocol.readMessageBegin(name, type, seqid);
+  if (type == apache::thrift::protocol::T_EXCEPTION) {
+    TApplicationException x;
+    x.read(&protocol);
+    BOOST_CHECK_EQUAL(x.getType(), TApplicationException::INTERNAL_ERROR);
+  }
+  protocol.readMessageEnd();
+  return seqid;
+}
+
+// Whether the server closed the connection, rather than leave it waiting
+static bool closedByServer(const shared_ptr<TSocket>& socket) {
+  uint8_t byte;
+  try {
+    return socket->read(&byte, 1) == 0;
+  } catch (const TTransportException& x) {
+    return x.getType() != TTransportException::TIMED_OUT;
+  }
+}
+
+// Ties up the one worker with a connection that has been answered, and
+// queues a second behind it
+static void fillPool(PoolServer& pool,
+                     shared_ptr<TSocket>& running,
+                     shared_ptr<TSocket>& queued) {
+  TMessageType type;
+  running = pool.connect();
+  sendCall(running, 1);
+  BOOST_REQUIRE_EQUAL(recvReply(running, type), 1);
+  queued = pool.connect();
+  sendCall(queued, 2);
+  for (int i = 0; i < 500 && pool.threadManager().pendingTaskCount() == 0; ++i) {
+    usleep(1000);
+  }
+  BOOST_REQUIRE_EQUAL(pool.threadManager().pendingTaskCount(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE( test_accept_reject ) {
+  PoolServer pool(TThreadPoolServer::T_ACCEPT_REJECT);
+  shared_ptr<TSocket> running;
+  shared_ptr<TSocket> queued;
+  fillPool(pool, running, queued);
+
+  // A connection finding the queue full is answered at once and closed
+  TMessageType type;
+  shared_ptr<TSocket> rejected = pool.connect();
+  recvReply(rejected, type);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_EXCEPTION);
+  BOOST_CHECK(closedByServer(rejected));
+  BOOST_CHECK_EQUAL(pool.server().getQueueStats().rejected, 1u);
+
+  // The one queued is served once the worker is free, its wait counted
+  usleep(50 * 1000);
+  running->close();
+  BOOST_CHECK_EQUAL(recvReply(queued, type), 2);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  TThreadPoolServer::QueueStats stats = pool.server().getQueueStats();
+  BOOST_CHECK_EQUAL(stats.tasks, 2u);
+  BOOST_CHECK_GE(stats.maxWait, 40);
+  BOOST_CHECK_GE(stats.totalWait, stats.maxWait);
+  BOOST_CHECK_EQUAL(stats.deferred, 0u);
+
+  pool.server().resetQueueStats();
+  BOOST_CHECK_EQUAL(pool.server().getQueueStats().tasks, 0u);
+  BOOST_CHECK_EQUAL(pool.server().getQueueStats().rejected, 0u);
+  rejected->close();
+  queued->close();
+}
+
+BOOST_AUTO_TEST_CASE( test_accept_backlog ) {
+  PoolServer pool(TThreadPoolServer::T_ACCEPT_BACKLOG);
+  shared_ptr<TSocket> running;
+  shared_ptr<TSocket> queued;
+  fillPool(pool, running, queued);
+
+  // A connection coming while the queue is full waits, unaccepted...
+  shared_ptr<TSocket> waiting = pool.connect(200);
+  sendCall(waiting, 3);
+  TMessageType type;
+  try {
+    recvReply(waiting, type);
+    BOOST_ERROR("answered while the queue was full");
+  } catch (const TTransportException& x) {
+    BOOST_CHECK_EQUAL(x.getType(), TTransportException::TIMED_OUT);
+  }
+  BOOST_CHECK_EQUAL(pool.server().getQueueStats().deferred, 1u);
+  BOOST_CHECK_EQUAL(pool.threadManager().pendingTaskCount(), 1u);
+
+  // ...until there is room, and then is served in turn
+  running->close();
+  BOOST_CHECK_EQUAL(recvReply(queued, type), 2);
+  queued->close();
+  waiting->setRecvTimeout(5000);
+  BOOST_CHECK_EQUAL(recvReply(waiting, type), 3);
+  BOOST_CHECK_EQUAL(type, apache::thrift::protocol::T_REPLY);
+  TThreadPoolServer::QueueStats stats = pool.server().getQueueStats();
+  BOOST_CHECK_EQUAL(stats.tasks, 3u);
+  BOOST_CHECK_EQUAL(stats.rejected, 0u);
+  waiting->close();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
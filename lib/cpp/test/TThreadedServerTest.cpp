@@ -0,0 +1,205 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstdio>
+#include <set>
+#include <pthread.h>
+#include <unistd.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/server/TThreadedServer.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TServerSocket.h>
+#include <thrift/transport/TSocket.h>
+
+BOOST_AUTO_TEST_SUITE( TThreadedServerTest )
+
+using apache::thrift::TProcessor;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TBinaryProtocolFactory;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::server::TServerEventHandler;
+using apache::thrift::server::TThreadedServer;
+using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::transport::TBufferedTransportFactory;
+using apache::thrift::transport::TServerSocket;
+using apache::thrift::transport::TSocket;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+// Answers each call, noting the threads it was called on
+class ThreadNotingProcessor : public TProcessor {
+ public:
+  virtual bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out, void*) {
+    std::string name;
+    TMessageType type;
+    int32_t seqid;
+    in->readMessageBegin(name, type, seqid);
+    in->readMessageEnd();
+    {
+      Synchronized s(monitor_);
+      threads_.insert(pthread_self());
+    }
+    out->writeMessageBegin(name, apache::thrift::protocol::T_REPLY, seqid);
+    out->writeMessageEnd();
+    out->getTransport()->writeEnd();
+    out->getTransport()->flush();
+    return true;
+  }
+
+  size_t threads() {
+    Synchronized s(monitor_);
+    return threads_.size();
+  }
+
+ private:
+  Monitor monitor_;
+  std::set<pthread_t> threads_;
+};
+
+// Tells the test the server is serving
+class ServeSignal : public TServerEventHandler {
+ public:
+  ServeSignal() : serving_(false) {}
+
+  virtual void preServe() {
+    Synchronized s(monitor_);
+    serving_ = true;
+    monitor_.notifyAll();
+  }
+
+  void wait() {
+    Synchronized s(monitor_);
+    while (!serving_) {
+      monitor_.wait();
+    }
+  }
+
+ private:
+  Monitor monitor_;
+  bool serving_;
+};
+
+class ServerRunner : public Runnable {
+ public:
+  explicit ServerRunner(TThreadedServer* server) : server_(server) {}
+
+  virtual void run() { server_->serve(); }
+
+ private:
+  TThreadedServer* server_;
+};
+
+static shared_ptr<PlatformThreadFactory> threadFactory() {
+  return shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+      PlatformThreadFactory::OTHER,
+      PlatformThreadFactory::NORMAL,
+      1,
+#endif
+      false));
+}
+
+// Sends calls with the given seqids in one write, so they arrive together
+static void sendCalls(const shared_ptr<TSocket>& socket, int32_t first, int32_t count) {
+  shared_ptr<TBufferedTransport> transport(new TBufferedTransport(socket));
+  TBinaryProtocol protocol(transport);
+  for (int32_t seqid = first; seqid < first + count; ++seqid) {
+    protocol.writeMessageBegin("call", apache::thrift::protocol::T_CALL, seqid);
+    protocol.writeMessageEnd();
+  }
+  transport->flush();
+}
+
+static int32_t recvReply(const shared_ptr<TSocket>& socket) {
+  TBinaryProtocol protocol(socket);
+  std::string name;
+  TMessageType type;
+  int32_t seqid;
+  protocol.readMessageBegin(name, type, seqid);
+  protocol.readMessageEnd();
+  return seqid;
+}
+
+BOOST_AUTO_TEST_CASE( test_parked_connections ) {
+  char path[64];
+  std::snprintf(path, sizeof(path), "thrift-test-parked-%d", (int)getpid());
+  std::string name = std::string(1, '\0') + path;
+
+  shared_ptr<ThreadNotingProcessor> processor(new ThreadNotingProcessor);
+  TThreadedServer server(processor,
+                         shared_ptr<TServerSocket>(new TServerSocket(name)),
+                         shared_ptr<TBufferedTransportFactory>(new TBufferedTransportFactory),
+                         shared_ptr<TBinaryProtocolFactory>(new TBinaryProtocolFactory));
+  server.setParkIdleConnections(true);
+  shared_ptr<ServeSignal> signal(new ServeSignal);
+  server.setServerEventHandler(signal);
+  shared_ptr<Thread> thread = threadFactory()->newThread(
+      shared_ptr<Runnable>(new ServerRunner(&server)));
+  thread->start();
+  signal->wait();
+
+  // Clients that call one at a time, and are idle in between, share a few
+  // threads rather than hold one each
+  const int kClients = 32;
+  std::vector<shared_ptr<TSocket> > clients;
+  for (int c = 0; c < kClients; ++c) {
+    clients.push_back(shared_ptr<TSocket>(new TSocket(name)));
+    clients.back()->setRecvTimeout(5000);
+    clients.back()->open();
+  }
+  for (int round = 0; round < 3; ++round) {
+    for (int c = 0; c < kClients; ++c) {
+      int32_t seqid = round * 100 + c;
+      sendCalls(clients[c], seqid, 1);
+      BOOST_CHECK_EQUAL(recvReply(clients[c]), seqid);
+    }
+  }
+  BOOST_CHECK_LE(processor->threads(), 4u);
+
+  // Calls that arrive together are all answered, the later ones from what
+  // the transport above the socket buffered with the first
+  sendCalls(clients[0], 1000, 3);
+  for (int32_t seqid = 1000; seqid < 1003; ++seqid) {
+    BOOST_CHECK_EQUAL(recvReply(clients[0]), seqid);
+  }
+
+  // Stopping closes the parked connections
+  server.stop();
+  thread->join();
+  uint8_t byte;
+  for (int c = 0; c < kClients; ++c) {
+    try {
+      BOOST_CHECK_EQUAL(clients[c]->read(&byte, 1), 0u);
+    } catch (const TTransportException& x) {
+      BOOST_CHECK(x.getType() != TTransportException::TIMED_OUT);
+    }
+    clients[c]->close();
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
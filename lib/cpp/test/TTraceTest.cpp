@@ -0,0 +1,172 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <vector>
+#include <thrift/TTrace.h>
+#include <thrift/processor/TTraceEventHandler.h>
+#include <thrift/protocol/THeaderProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/THeaderTransport.h>
+
+BOOST_AUTO_TEST_SUITE( TTraceTest )
+
+using boost::shared_ptr;
+using apache::thrift::TTraceContext;
+using apache::thrift::TTraceScope;
+using apache::thrift::TTraceSink;
+using apache::thrift::TTraceSpan;
+using apache::thrift::processor::TTraceEventHandler;
+using apache::thrift::protocol::THeaderProtocol;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::protocol::T_CALL;
+using apache::thrift::transport::THeaderTransport;
+using apache::thrift::transport::TMemoryBuffer;
+
+class RecordingSink : public TTraceSink {
+ public:
+  void emit(const TTraceSpan& span) {
+    spans.push_back(span);
+  }
+
+  std::vector<TTraceSpan> spans;
+};
+
+// A call sent by a client, and read by a server, over header transports
+static void sendCall(THeaderProtocol& client, THeaderProtocol& server) {
+  client.writeMessageBegin("get", T_CALL, 1);
+  client.writeStructBegin("args");
+  client.writeFieldStop();
+  client.writeStructEnd();
+  client.writeMessageEnd();
+  client.getTransport()->writeEnd();
+  client.getTransport()->flush();
+
+  std::string name;
+  TMessageType type;
+  int32_t seqid;
+  server.readMessageBegin(name, type, seqid);
+  server.skip(apache::thrift::protocol::T_STRUCT);
+  server.readMessageEnd();
+}
+
+// Serves the call last read on this thread, as a processor would
+static TTraceContext serve(TTraceEventHandler& handler) {
+  void* ctx = handler.getContext("Foo.get", NULL);
+  handler.postRead(ctx, "Foo.get", 12);
+  TTraceContext during = TTraceContext::current();
+  handler.preWrite(ctx, "Foo.get");
+  handler.postWrite(ctx, "Foo.get", 34);
+  handler.freeContext(ctx, "Foo.get");
+  return during;
+}
+
+BOOST_AUTO_TEST_CASE( test_headers ) {
+  TTraceContext sent = TTraceScope::newTrace(true);
+  TTraceContext::HeaderMap headers;
+  sent.writeHeaders(headers);
+  BOOST_CHECK_EQUAL(headers.size(), 3u);
+
+  TTraceContext got;
+  BOOST_REQUIRE(got.readHeaders(headers));
+  BOOST_CHECK_EQUAL(got.traceId, sent.traceId);
+  BOOST_CHECK_EQUAL(got.parentSpanId, sent.spanId);
+  BOOST_CHECK_EQUAL(got.spanId, 0u);
+  BOOST_CHECK(got.sampled);
+
+  headers[TTraceContext::TRACE_ID_HEADER] = "not hex";
+  BOOST_CHECK(!got.readHeaders(headers));
+  BOOST_CHECK(!got.valid());
+}
+
+BOOST_AUTO_TEST_CASE( test_scope ) {
+  BOOST_CHECK(!TTraceContext::current().valid());
+  TTraceContext outer = TTraceScope::newTrace(false);
+  {
+    TTraceScope scope(outer);
+    BOOST_CHECK_EQUAL(TTraceContext::current().spanId, outer.spanId);
+    TTraceContext inner = TTraceScope::newTrace(false);
+    {
+      TTraceScope nested(inner);
+      BOOST_CHECK_EQUAL(TTraceContext::current().spanId, inner.spanId);
+    }
+    BOOST_CHECK_EQUAL(TTraceContext::current().spanId, outer.spanId);
+  }
+  BOOST_CHECK(!TTraceContext::current().valid());
+}
+
+BOOST_AUTO_TEST_CASE( test_propagation ) {
+  shared_ptr<TMemoryBuffer> toServer(new TMemoryBuffer());
+  shared_ptr<TMemoryBuffer> toClient(new TMemoryBuffer());
+  shared_ptr<THeaderTransport> clientTrans(new THeaderTransport(toClient, toServer));
+  shared_ptr<THeaderTransport> serverTrans(new THeaderTransport(toServer, toClient));
+  THeaderProtocol client(clientTrans);
+  THeaderProtocol server(serverTrans);
+
+  shared_ptr<RecordingSink> sink(new RecordingSink());
+  TTraceEventHandler handler(sink, 0.0);
+
+  // A call made inside a sampled trace joins it, though this end samples none
+  TTraceContext root = TTraceScope::newTrace(true);
+  {
+    TTraceScope scope(root);
+    sendCall(client, server);
+  }
+  TTraceContext during = serve(handler);
+  BOOST_CHECK_EQUAL(during.traceId, root.traceId);
+  BOOST_CHECK_EQUAL(during.parentSpanId, root.spanId);
+  BOOST_CHECK(during.spanId != root.spanId);
+  BOOST_CHECK(!TTraceContext::current().valid());
+
+  BOOST_REQUIRE_EQUAL(sink->spans.size(), 1u);
+  const TTraceSpan& span = sink->spans[0];
+  BOOST_CHECK_EQUAL(span.name, "Foo.get");
+  BOOST_CHECK_EQUAL(span.context.spanId, during.spanId);
+  BOOST_CHECK_EQUAL(span.bytesIn, 12u);
+  BOOST_CHECK_EQUAL(span.bytesOut, 34u);
+  BOOST_CHECK(span.durationUsec >= 0);
+  BOOST_CHECK(!span.error);
+
+  // A call outside any trace starts one, not sampled, and drops the headers
+  sendCall(client, server);
+  BOOST_CHECK(serverTrans->getReadHeaders().empty());
+  during = serve(handler);
+  BOOST_CHECK(during.valid());
+  BOOST_CHECK(during.traceId != root.traceId);
+  BOOST_CHECK_EQUAL(during.parentSpanId, 0u);
+  BOOST_CHECK_EQUAL(sink->spans.size(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE( test_sampling ) {
+  shared_ptr<RecordingSink> sink(new RecordingSink());
+  TTraceEventHandler all(sink, 1.0);
+  for (int i = 0; i < 100; ++i) {
+    serve(all);
+  }
+  BOOST_CHECK_EQUAL(sink->spans.size(), 100u);
+
+  sink->spans.clear();
+  TTraceEventHandler some(sink, 0.25);
+  for (int i = 0; i < 4000; ++i) {
+    serve(some);
+  }
+  BOOST_CHECK(sink->spans.size() > 800 && sink->spans.size() < 1200);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,265 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thrift/concurrency/PosixThreadFactory.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TSimpleFileTransport.h>
+#include <thrift/transport/TServerSocket.h>
+#include <thrift/transport/TSocket.h>
+#include <thrift/transport/TTransportException.h>
+
+BOOST_AUTO_TEST_SUITE( TUnixSocketTest )
+
+using apache::thrift::concurrency::PosixThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::transport::TBufferedTransport;
+using apache::thrift::transport::TSimpleFileTransport;
+using apache::thrift::transport::TServerSocket;
+using apache::thrift::transport::TSocket;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::TTransportException;
+using boost::shared_ptr;
+
+// A fresh name in the abstract namespace, so runs never collide
+static std::string abstractName(const char* tag) {
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), "thrift-test-%s-%d", tag, (int)getpid());
+  return std::string(1, '\0') + buf;
+}
+
+// Two TSockets joined by a socketpair, standing in for a control channel
+static void makeChannel(shared_ptr<TSocket>* a, shared_ptr<TSocket>* b) {
+  int sv[2];
+  BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  a->reset(new TSocket(sv[0]));
+  b->reset(new TSocket(sv[1]));
+}
+
+static void echo(shared_ptr<TTransport> from, shared_ptr<TTransport> to, const char* msg) {
+  uint32_t len = static_cast<uint32_t>(std::strlen(msg));
+  from->write(reinterpret_cast<const uint8_t*>(msg), len);
+  std::string got(len, '\0');
+  to->readAll(reinterpret_cast<uint8_t*>(&got[0]), len);
+  BOOST_CHECK_EQUAL(got, msg);
+}
+
+BOOST_AUTO_TEST_CASE( test_abstract_namespace ) {
+  std::string name = abstractName("abstract");
+  TServerSocket server(name);
+  server.listen();
+
+  shared_ptr<TSocket> client(new TSocket(name));
+  client->open();
+  shared_ptr<TTransport> accepted = server.accept();
+  echo(client, accepted, "ping");
+  echo(accepted, client, "pong");
+
+  // Nothing is left behind on the filesystem
+  BOOST_CHECK(access(name.c_str() + 1, F_OK) != 0);
+
+  client->close();
+  server.close();
+  shared_ptr<TSocket> late(new TSocket(name));
+  BOOST_CHECK_THROW(late->open(), TTransportException);
+}
+
+BOOST_AUTO_TEST_CASE( test_descriptor_passing ) {
+  shared_ptr<TSocket> sender;
+  shared_ptr<TSocket> receiver;
+  makeChannel(&sender, &receiver);
+
+  int pipeFds[2];
+  BOOST_REQUIRE(pipe(pipeFds) == 0);
+
+  // Ordinary data still flows on the channel either side of a batch
+  echo(sender, receiver, "before");
+  sender->sendDescriptors(std::vector<THRIFT_SOCKET>(pipeFds, pipeFds + 2));
+  sender->write(reinterpret_cast<const uint8_t*>("after"), 5);
+
+  std::vector<THRIFT_SOCKET> fds;
+  fds.push_back(-1);
+  BOOST_REQUIRE(receiver->receiveDescriptors(&fds));
+  uint8_t after[5];
+  receiver->readAll(after, sizeof(after));
+  BOOST_CHECK(std::memcmp(after, "after", 5) == 0);
+  BOOST_REQUIRE_EQUAL(fds.size(), 3u);
+  BOOST_CHECK(fds[1] != pipeFds[0] && fds[2] != pipeFds[1]);
+
+  // The copies refer to the same pipe
+  BOOST_REQUIRE(write(fds[2], "x", 1) == 1);
+  char c = 0;
+  BOOST_REQUIRE(read(pipeFds[0], &c, 1) == 1);
+  BOOST_CHECK_EQUAL(c, 'x');
+  ::close(fds[1]);
+  ::close(fds[2]);
+  ::close(pipeFds[0]);
+  ::close(pipeFds[1]);
+
+  BOOST_CHECK_THROW(sender->sendDescriptors(std::vector<THRIFT_SOCKET>()),
+                    TTransportException);
+
+  sender->close();
+  fds.clear();
+  BOOST_CHECK(!receiver->receiveDescriptors(&fds));
+  BOOST_CHECK(fds.empty());
+}
+
+BOOST_AUTO_TEST_CASE( test_missing_descriptors ) {
+  shared_ptr<TSocket> sender;
+  shared_ptr<TSocket> receiver;
+  makeChannel(&sender, &receiver);
+
+  // A header promising descriptors that never came
+  const uint8_t header[4] = {0, 0, 0, 2};
+  sender->write(header, sizeof(header));
+  std::vector<THRIFT_SOCKET> fds;
+  BOOST_CHECK_THROW(receiver->receiveDescriptors(&fds), TTransportException);
+  BOOST_CHECK(fds.empty());
+}
+
+BOOST_AUTO_TEST_CASE( test_listen_socket_handoff ) {
+  std::string name = abstractName("handoff");
+  shared_ptr<TSocket> oldSide;
+  shared_ptr<TSocket> newSide;
+  makeChannel(&oldSide, &newSide);
+
+  shared_ptr<TServerSocket> oldServer(new TServerSocket(name));
+  oldServer->listen();
+
+  // A connection the old server accepted, and one still in the backlog
+  shared_ptr<TSocket> inFlight(new TSocket(name));
+  inFlight->open();
+  shared_ptr<TSocket> accepted =
+    boost::dynamic_pointer_cast<TSocket>(oldServer->accept());
+  BOOST_REQUIRE(accepted);
+  shared_ptr<TSocket> queued(new TSocket(name));
+  queued->open();
+
+  oldServer->passListenSocket(oldSide);
+  oldSide->sendDescriptors(std::vector<THRIFT_SOCKET>(1, accepted->getSocketFD()));
+  accepted->detach();
+  oldServer->close();
+
+  std::vector<THRIFT_SOCKET> fds;
+  BOOST_REQUIRE(newSide->receiveDescriptors(&fds));
+  BOOST_REQUIRE(newSide->receiveDescriptors(&fds));
+  BOOST_REQUIRE_EQUAL(fds.size(), 2u);
+
+  TServerSocket newServer(name);
+  newServer.setListenSocket(fds[0]);
+  newServer.addAcceptedSocket(fds[1]);
+  newServer.listen();
+
+  // The handed over connection comes out of accept() first, still live
+  shared_ptr<TTransport> resumed = newServer.accept();
+  echo(inFlight, resumed, "resumed");
+  echo(resumed, inFlight, "ok");
+
+  // The backlog and new connections survived the old server's close()
+  shared_ptr<TTransport> fromBacklog = newServer.accept();
+  echo(queued, fromBacklog, "queued");
+  shared_ptr<TSocket> fresh(new TSocket(name));
+  fresh->open();
+  echo(fresh, newServer.accept(), "fresh");
+}
+
+class DelayedHandoff : public Runnable {
+ public:
+  DelayedHandoff(TServerSocket* server, THRIFT_SOCKET fd) : server_(server), fd_(fd) {}
+
+  void run() {
+    usleep(100 * 1000);
+    server_->addAcceptedSocket(fd_);
+  }
+
+ private:
+  TServerSocket* server_;
+  THRIFT_SOCKET fd_;
+};
+
+BOOST_AUTO_TEST_CASE( test_add_accepted_socket_wakes_accept ) {
+  TServerSocket server(abstractName("wake"));
+  server.setAcceptTimeout(10 * 1000);
+  server.listen();
+
+  int sv[2];
+  BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  shared_ptr<TSocket> peer(new TSocket(sv[0]));
+
+  PosixThreadFactory factory(PosixThreadFactory::ROUND_ROBIN, PosixThreadFactory::NORMAL, 1, false);
+  shared_ptr<Thread> thread =
+    factory.newThread(shared_ptr<Runnable>(new DelayedHandoff(&server, sv[1])));
+  thread->start();
+
+  shared_ptr<TTransport> accepted = server.accept();
+  thread->join();
+  echo(peer, accepted, "woken");
+
+  // interrupt() still interrupts
+  server.interrupt();
+  BOOST_CHECK_THROW(server.accept(), TTransportException);
+}
+
+BOOST_AUTO_TEST_CASE( test_transfer_from_file ) {
+  char path[] = "/tmp/thrift-transfer-XXXXXX";
+  int fd = mkstemp(path);
+  BOOST_REQUIRE(fd >= 0);
+  const std::string data = "0123456789abcdefghij";
+  BOOST_REQUIRE(write(fd, data.data(), data.size()) == (ssize_t)data.size());
+  ::close(fd);
+
+  shared_ptr<TSocket> sender;
+  shared_ptr<TSocket> receiver;
+  makeChannel(&sender, &receiver);
+  TSimpleFileTransport file(path);
+
+  // Straight onto the socket, leaving the file's own position alone
+  file.transferTo(*sender, 4, 10);
+  std::string got(10, '\0');
+  receiver->readAll(reinterpret_cast<uint8_t*>(&got[0]), 10);
+  BOOST_CHECK_EQUAL(got, data.substr(4, 10));
+  uint8_t first;
+  BOOST_CHECK_EQUAL(file.read(&first, 1), 1u);
+  BOOST_CHECK_EQUAL(first, '0');
+
+  // Buffered writes go out ahead of the file's bytes
+  TBufferedTransport buffered(sender);
+  buffered.write(reinterpret_cast<const uint8_t*>("hdr:"), 4);
+  file.transferTo(buffered, 15, 5);
+  got.assign(9, '\0');
+  receiver->readAll(reinterpret_cast<uint8_t*>(&got[0]), 9);
+  BOOST_CHECK_EQUAL(got, "hdr:" + data.substr(15));
+
+  // And through a bounce buffer for transports that can't do better
+  apache::thrift::transport::TMemoryBuffer memory;
+  file.transferTo(memory, 0, 3);
+  BOOST_CHECK_EQUAL(memory.getBufferAsString(), data.substr(0, 3));
+
+  BOOST_CHECK_THROW(file.transferTo(*sender, 18, 5), TTransportException);
+  BOOST_CHECK_THROW(file.transferTo(memory, 18, 5), TTransportException);
+  ::unlink(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,239 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstring>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/server/TUringServer.h>
+#include <thrift/transport/TSocket.h>
+
+BOOST_AUTO_TEST_SUITE( TUringServerTest )
+
+using apache::thrift::TProcessor;
+using apache::thrift::concurrency::Monitor;
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Synchronized;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::server::TServerEventHandler;
+using apache::thrift::server::TUringServer;
+using apache::thrift::transport::TSocket;
+using boost::shared_ptr;
+
+// Whether this kernel, or its seccomp policy, lets us set up a ring
+static bool uringAvailable() {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = static_cast<int>(syscall(__NR_io_uring_setup, 1, &p));
+  if (fd < 0) {
+    return false;
+  }
+  ::close(fd);
+  return true;
+}
+
+// Answers every frame with its own bytes
+class EchoProcessor : public TProcessor {
+ public:
+  virtual bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out, void*) {
+    uint8_t buf[256];
+    uint32_t got;
+    while ((got = in->getTransport()->read(buf, sizeof(buf))) > 0) {
+      out->getTransport()->write(buf, got);
+    }
+    return true;
+  }
+};
+
+// Serves on a thread of its own from start() until stop()
+class ServerRunner : public Runnable, public TServerEventHandler {
+ public:
+  explicit ServerRunner(const shared_ptr<TUringServer>& server)
+    : server_(server), serving_(false) {}
+
+  // self is this runner, which the server and thread hold until stop()
+  void start(const shared_ptr<ServerRunner>& self) {
+    server_->setServerEventHandler(self);
+    PlatformThreadFactory factory(
+#if !defined(USE_BOOST_THREAD) && !defined(USE_STD_THREAD)
+        PlatformThreadFactory::OTHER,
+        PlatformThreadFactory::NORMAL,
+        1,
+#endif
+        false);
+    thread_ = factory.newThread(self);
+    thread_->start();
+    Synchronized s(monitor_);
+    while (!serving_) {
+      monitor_.wait();
+    }
+  }
+
+  void stop() {
+    server_->stop();
+    thread_->join();
+    thread_.reset();
+    server_->setServerEventHandler(shared_ptr<TServerEventHandler>());
+  }
+
+  virtual void run() { server_->serve(); }
+
+  virtual void preServe() {
+    Synchronized s(monitor_);
+    serving_ = true;
+    monitor_.notifyAll();
+  }
+
+  shared_ptr<TSocket> connect() const {
+    shared_ptr<TSocket> socket(new TSocket("127.0.0.1", server_->getListenPort()));
+    socket->setRecvTimeout(5000);
+    socket->open();
+    return socket;
+  }
+
+ private:
+  shared_ptr<TUringServer> server_;
+  shared_ptr<Thread> thread_;
+  Monitor monitor_;
+  bool serving_;
+};
+
+static shared_ptr<ServerRunner> startServer(const shared_ptr<TUringServer>& server) {
+  shared_ptr<ServerRunner> runner(new ServerRunner(server));
+  runner->start(runner);
+  return runner;
+}
+
+static void sendFrame(TSocket& socket, const std::string& payload) {
+  uint32_t size = htonl(static_cast<uint32_t>(payload.size()));
+  socket.write(reinterpret_cast<const uint8_t*>(&size), sizeof(size));
+  socket.write(reinterpret_cast<const uint8_t*>(payload.data()),
+               static_cast<uint32_t>(payload.size()));
+}
+
+static std::string recvFrame(TSocket& socket) {
+  uint32_t size;
+  socket.readAll(reinterpret_cast<uint8_t*>(&size), sizeof(size));
+  std::string payload(ntohl(size), '\0');
+  if (!payload.empty()) {
+    socket.readAll(reinterpret_cast<uint8_t*>(&payload[0]),
+                   static_cast<uint32_t>(payload.size()));
+  }
+  return payload;
+}
+
+BOOST_AUTO_TEST_CASE( test_echo ) {
+  if (!uringAvailable()) {
+    BOOST_TEST_MESSAGE("io_uring unavailable, skipping");
+    return;
+  }
+
+  shared_ptr<TUringServer> server(
+      new TUringServer(shared_ptr<TProcessor>(new EchoProcessor), 0));
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  shared_ptr<TSocket> client = runner->connect();
+  sendFrame(*client, "hello");
+  BOOST_CHECK_EQUAL(recvFrame(*client), "hello");
+
+  // Two frames in one write are answered in order
+  sendFrame(*client, "one");
+  sendFrame(*client, "two");
+  BOOST_CHECK_EQUAL(recvFrame(*client), "one");
+  BOOST_CHECK_EQUAL(recvFrame(*client), "two");
+
+  client->close();
+  runner->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_frame_too_large ) {
+  if (!uringAvailable()) {
+    BOOST_TEST_MESSAGE("io_uring unavailable, skipping");
+    return;
+  }
+
+  shared_ptr<TUringServer> server(
+      new TUringServer(shared_ptr<TProcessor>(new EchoProcessor), 0));
+  server->setMaxFrameSize(8);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  shared_ptr<TSocket> client = runner->connect();
+  sendFrame(*client, "eight!!!");
+  BOOST_CHECK_EQUAL(recvFrame(*client), "eight!!!");
+
+  // The connection is closed rather than answered
+  sendFrame(*client, "nine!!!!!");
+  uint8_t byte;
+  BOOST_CHECK_EQUAL(client->read(&byte, 1), 0u);
+
+  // Others are still served
+  shared_ptr<TSocket> other = runner->connect();
+  sendFrame(*other, "ok");
+  BOOST_CHECK_EQUAL(recvFrame(*other), "ok");
+
+  other->close();
+  client->close();
+  runner->stop();
+}
+
+BOOST_AUTO_TEST_CASE( test_full_queues ) {
+  if (!uringAvailable()) {
+    BOOST_TEST_MESSAGE("io_uring unavailable, skipping");
+    return;
+  }
+
+  // A ring far smaller than the work in flight fills both of its queues
+  shared_ptr<TUringServer> server(
+      new TUringServer(shared_ptr<TProcessor>(new EchoProcessor), 0));
+  server->setRingEntries(2);
+  shared_ptr<ServerRunner> runner = startServer(server);
+
+  const int kClients = 32;
+  const int kFrames = 8;
+  std::vector<shared_ptr<TSocket> > clients;
+  for (int i = 0; i < kClients; ++i) {
+    clients.push_back(runner->connect());
+  }
+  for (int round = 0; round < 4; ++round) {
+    for (int i = 0; i < kClients; ++i) {
+      for (int j = 0; j < kFrames; ++j) {
+        sendFrame(*clients[i], std::string(1 + j, static_cast<char>('a' + j)));
+      }
+    }
+    for (int i = 0; i < kClients; ++i) {
+      for (int j = 0; j < kFrames; ++j) {
+        BOOST_REQUIRE_EQUAL(recvFrame(*clients[i]),
+                            std::string(1 + j, static_cast<char>('a' + j)));
+      }
+    }
+  }
+
+  for (int i = 0; i < kClients; ++i) {
+    clients[i]->close();
+  }
+  runner->stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,160 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <cstdlib>
+#include <string>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/protocol/TUtf8.h>
+#include <thrift/transport/TBufferTransports.h>
+
+BOOST_AUTO_TEST_SUITE( TUtf8Test )
+
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TProtocolException;
+using apache::thrift::protocol::validUtf8;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+static bool valid(const std::string& s) {
+  return validUtf8(reinterpret_cast<const uint8_t*>(s.data()),
+                   static_cast<uint32_t>(s.size()));
+}
+
+// Decodes each sequence in full, as a reference
+static bool decodes(const std::string& s) {
+  size_t i = 0;
+  while (i < s.size()) {
+    uint8_t c = static_cast<uint8_t>(s[i]);
+    size_t n;
+    uint32_t cp;
+    uint32_t min;
+    if (c < 0x80) {
+      ++i;
+      continue;
+    } else if ((c & 0xe0) == 0xc0) {
+      n = 1, cp = c & 0x1f, min = 0x80;
+    } else if ((c & 0xf0) == 0xe0) {
+      n = 2, cp = c & 0x0f, min = 0x800;
+    } else if ((c & 0xf8) == 0xf0) {
+      n = 3, cp = c & 0x07, min = 0x10000;
+    } else {
+      return false;
+    }
+    if (s.size() - i - 1 < n) {
+      return false;
+    }
+    for (size_t k = 1; k <= n; ++k) {
+      uint8_t cont = static_cast<uint8_t>(s[i + k]);
+      if ((cont & 0xc0) != 0x80) {
+        return false;
+      }
+      cp = (cp << 6) | (cont & 0x3f);
+    }
+    if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+      return false;
+    }
+    i += n + 1;
+  }
+  return true;
+}
+
+BOOST_AUTO_TEST_CASE( test_sequences ) {
+  BOOST_CHECK(valid(""));
+  BOOST_CHECK(valid("plain"));
+  BOOST_CHECK(valid("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80"));
+  BOOST_CHECK(valid("\xed\x9f\xbf\xee\x80\x80\xf4\x8f\xbf\xbf"));
+
+  BOOST_CHECK(!valid("\x80"));                   // stray continuation
+  BOOST_CHECK(!valid("\xc0\xaf"));               // overlong
+  BOOST_CHECK(!valid("\xe0\x9f\xbf"));           // overlong
+  BOOST_CHECK(!valid("\xf0\x8f\xbf\xbf"));       // overlong
+  BOOST_CHECK(!valid("\xed\xa0\x80"));           // surrogate
+  BOOST_CHECK(!valid("\xf4\x90\x80\x80"));       // past U+10FFFF
+  BOOST_CHECK(!valid("\xf8\x88\x80\x80\x80"));   // five bytes
+  BOOST_CHECK(!valid("\xe2\x82"));               // cut short
+  BOOST_CHECK(!valid("\xe2\x82x"));
+
+  // Cut short, or broken, right at the edges of a 32-byte block
+  for (size_t pad = 25; pad < 70; ++pad) {
+    std::string ascii(pad, 'a');
+    BOOST_CHECK(valid(ascii + "\xf0\x9f\x98\x80" + ascii));
+    BOOST_CHECK(!valid(ascii + "\xf0\x9f\x98"));
+    BOOST_CHECK(!valid(ascii + "\xf0\x9f\x98" + ascii));
+    BOOST_CHECK(!valid(ascii + "\xc3" + std::string(64, 'b')));
+    BOOST_CHECK(!valid(ascii + "\x80" + ascii));
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_random ) {
+  const char* pieces[] = { "a", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80",
+                           "\xed\x9f\xbf", "\xf4\x8f\xbf\xbf" };
+  std::srand(7);
+  for (int i = 0; i < 20000; ++i) {
+    std::string s;
+    size_t len = std::rand() % 120;
+    while (s.size() < len) {
+      s += pieces[std::rand() % 6];
+    }
+    for (int m = std::rand() % 3; m > 0 && !s.empty(); --m) {
+      s[std::rand() % s.size()] = static_cast<char>(std::rand());
+    }
+    BOOST_REQUIRE_EQUAL(valid(s), decodes(s));
+  }
+}
+
+template <typename Protocol>
+static void checkProtocol() {
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer());
+  Protocol protocol(buffer);
+  const std::string bad("ok\xff");
+  protocol.writeString(std::string("caf\xc3\xa9"));
+  protocol.writeString(bad);
+  protocol.writeBinary(bad);
+  protocol.writeString(bad);
+
+  std::string copy = buffer->getBufferAsString();
+  std::string str;
+  BOOST_CHECK(!protocol.getValidateUtf8());
+  protocol.setValidateUtf8(true);
+  protocol.readString(str);
+  BOOST_CHECK_EQUAL(str, "caf\xc3\xa9");
+  BOOST_CHECK_THROW(protocol.readString(str), TProtocolException);
+
+  buffer->resetBuffer(reinterpret_cast<uint8_t*>(&copy[0]), static_cast<uint32_t>(copy.size()));
+  protocol.setValidateUtf8(false);
+  protocol.readString(str);
+  protocol.readString(str);
+  BOOST_CHECK_EQUAL(str, bad);
+  protocol.setValidateUtf8(true);
+  protocol.readBinary(str);
+  BOOST_CHECK_EQUAL(str, bad);
+  apache::thrift::TStringView view;
+  BOOST_CHECK_THROW(protocol.readStringView(view), TProtocolException);
+}
+
+BOOST_AUTO_TEST_CASE( test_protocols ) {
+  checkProtocol<TBinaryProtocol>();
+  checkProtocol<TCompactProtocol>();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,174 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/static_assert.hpp>
+#include <boost/test/auto_unit_test.hpp>
+#include <string>
+#include <vector>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "gen-cpp/VisitTest_types.h"
+
+BOOST_AUTO_TEST_SUITE( TVisitTest )
+
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::test::visit::Color;
+using apache::thrift::test::visit::Point;
+using apache::thrift::test::visit::Shape;
+using boost::shared_ptr;
+namespace protocol = apache::thrift::protocol;
+
+// Point and Shape are generated from VisitTest.thrift with the visit option
+
+// The descriptors are constants, usable where the compiler needs one
+BOOST_STATIC_ASSERT(Shape::__fields::count == 6);
+BOOST_STATIC_ASSERT(Shape::__fields::type_field::id == 3);
+BOOST_STATIC_ASSERT(Shape::__fields::type_field::optional);
+BOOST_STATIC_ASSERT(Shape::__fields::origin_field::type == protocol::T_STRUCT);
+BOOST_STATIC_ASSERT(Point::__fields::count == 2);
+
+// Notes each field's descriptor, in the order visited
+struct Lister {
+  template <typename Field, typename T>
+  void operator()(Field, const T&) {
+    ids.push_back(Field::id);
+    names.push_back(Field::name());
+    types.push_back(Field::type);
+    optionals.push_back(Field::optional);
+  }
+
+  std::vector<int16_t> ids;
+  std::vector<std::string> names;
+  std::vector<protocol::TType> types;
+  std::vector<bool> optionals;
+};
+
+// Sets every i32 to its field's id, leaving the rest
+struct NumberByField {
+  template <typename Field, typename T>
+  void operator()(Field, T&) {}
+
+  template <typename Field>
+  void operator()(Field, int32_t& value) {
+    value = Field::id;
+  }
+};
+
+// A generic writer, knowing no struct but what visit_fields tells it
+struct Writer {
+  explicit Writer(protocol::TProtocol* out) : out(out) {}
+
+  template <typename Struct>
+  void writeStruct(const Struct& value, const char* name) {
+    out->writeStructBegin(name);
+    value.visit_fields(*this);
+    out->writeFieldStop();
+    out->writeStructEnd();
+  }
+
+  template <typename Field, typename T>
+  void operator()(Field, const T& value) {
+    out->writeFieldBegin(Field::name(), Field::type, Field::id);
+    writeValue(value);
+    out->writeFieldEnd();
+  }
+
+  void writeValue(int32_t value) { out->writeI32(value); }
+  void writeValue(Color::type value) { out->writeI32(value); }
+  void writeValue(double value) { out->writeDouble(value); }
+  void writeValue(const std::string& value) { out->writeString(value); }
+  void writeValue(const Point& value) { writeStruct(value, "Point"); }
+
+  template <typename T>
+  void writeValue(const std::vector<T>& value) {
+    out->writeListBegin(protocol::T_STRUCT, static_cast<uint32_t>(value.size()));
+    for (size_t i = 0; i < value.size(); ++i) {
+      writeValue(value[i]);
+    }
+    out->writeListEnd();
+  }
+
+  protocol::TProtocol* out;
+};
+
+static Shape sampleShape() {
+  Shape shape;
+  shape.id = 7;
+  shape.name = "triangle";
+  shape.__set_type(1.5);
+  for (int i = 0; i < 3; ++i) {
+    Point point;
+    point.x = i;
+    point.y = i * i;
+    shape.points.push_back(point);
+  }
+  shape.color = Color::GREEN;
+  shape.origin.x = -1;
+  shape.origin.y = -2;
+  return shape;
+}
+
+BOOST_AUTO_TEST_CASE( test_descriptors ) {
+  Lister lister;
+  const Shape shape;
+  shape.visit_fields(lister);
+  const int16_t ids[] = {1, 2, 3, 5, 7, 8};
+  const char* names[] = {"id", "name", "type", "points", "color", "origin"};
+  const protocol::TType types[] = {protocol::T_I32, protocol::T_STRING, protocol::T_DOUBLE,
+                                   protocol::T_LIST, protocol::T_I32, protocol::T_STRUCT};
+  BOOST_REQUIRE_EQUAL(lister.ids.size(), Shape::__fields::count);
+  for (size_t i = 0; i < Shape::__fields::count; ++i) {
+    BOOST_CHECK_EQUAL(lister.ids[i], ids[i]);
+    BOOST_CHECK_EQUAL(lister.names[i], names[i]);
+    BOOST_CHECK_EQUAL(lister.types[i], types[i]);
+    BOOST_CHECK_EQUAL(lister.optionals[i], i == 2);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_member_references ) {
+  Shape shape = sampleShape();
+  NumberByField numberer;
+  shape.visit_fields(numberer);
+  BOOST_CHECK_EQUAL(shape.id, 1);
+  BOOST_CHECK_EQUAL(shape.name, "triangle");
+  BOOST_CHECK_EQUAL(shape.points.size(), 3u);
+  shape.origin.visit_fields(numberer);
+  BOOST_CHECK_EQUAL(shape.origin.x, 1);
+  BOOST_CHECK_EQUAL(shape.origin.y, 2);
+}
+
+BOOST_AUTO_TEST_CASE( test_generic_writer ) {
+  // What a writer built on the descriptors alone writes is what the
+  // generated write() does
+  Shape shape = sampleShape();
+  shared_ptr<TMemoryBuffer> generated(new TMemoryBuffer);
+  TBinaryProtocol generatedProtocol(generated);
+  shape.write(&generatedProtocol);
+  shared_ptr<TMemoryBuffer> visited(new TMemoryBuffer);
+  TBinaryProtocol visitedProtocol(visited);
+  Writer(&visitedProtocol).writeStruct(shape, "Shape");
+  BOOST_CHECK(visited->getBufferAsString() == generated->getBufferAsString());
+
+  Shape back;
+  back.read(&visitedProtocol);
+  BOOST_CHECK(back == shape);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <boost/test/auto_unit_test.hpp>
+#include <stdio.h>
+#include <string>
+#include <thrift/Thrift.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#ifndef THRIFT_NO_VIRTUAL_PROFILING
+
+BOOST_AUTO_TEST_SUITE( VirtualProfilingTest )
+
+using apache::thrift::concurrency::PlatformThreadFactory;
+using apache::thrift::concurrency::Runnable;
+using apache::thrift::concurrency::Thread;
+using apache::thrift::protocol::TBinaryProtocol;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using boost::shared_ptr;
+
+// Writes through the generic TProtocol, so every call is a virtual one
+static void writeGeneric(int calls) {
+  shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+  shared_ptr<TProtocol> proto(new TBinaryProtocol(buf));
+  for (int i = 0; i < calls; ++i) {
+    proto->writeI32(i);
+  }
+}
+
+// The number of calls profile_print_info() reports
+static long long countPrinted() {
+  FILE* f = tmpfile();
+  BOOST_REQUIRE(f != NULL);
+  apache::thrift::profile_print_info(f);
+  rewind(f);
+
+  long long total = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    long long count;
+    if (sscanf(line, "T_VIRTUAL_CALL: %lld calls", &count) == 1) {
+      total += count;
+    }
+  }
+  fclose(f);
+  return total;
+}
+
+BOOST_AUTO_TEST_CASE( test_sampling ) {
+  apache::thrift::profile_reset();
+
+  // Off, nothing is recorded
+  writeGeneric(100);
+  BOOST_CHECK_EQUAL(countPrinted(), 0);
+
+  apache::thrift::profile_set_sample_rate(1);
+  writeGeneric(100);
+  long long everyCall = countPrinted();
+  BOOST_CHECK(everyCall >= 100);
+
+  // Sampling one in four keeps a quarter of them, each counting for four
+  apache::thrift::profile_reset();
+  apache::thrift::profile_set_sample_rate(4);
+  writeGeneric(100);
+  long long sampled = countPrinted();
+  BOOST_CHECK(sampled >= everyCall - 4 && sampled <= everyCall + 4);
+
+  apache::thrift::profile_set_sample_rate(0);
+  writeGeneric(100);
+  BOOST_CHECK_EQUAL(countPrinted(), sampled);
+
+  apache::thrift::profile_reset();
+  BOOST_CHECK_EQUAL(countPrinted(), 0);
+}
+
+class Writer : public Runnable {
+ public:
+  void run() { writeGeneric(100); }
+};
+
+BOOST_AUTO_TEST_CASE( test_threads ) {
+  apache::thrift::profile_reset();
+  apache::thrift::profile_set_sample_rate(1);
+  writeGeneric(100);
+  long long oneThread = countPrinted();
+
+  // Each thread records on its own, and printing sums them
+  PlatformThreadFactory factory;
+  factory.setDetached(false);
+  shared_ptr<Thread> threads[4];
+  for (int i = 0; i < 4; ++i) {
+    threads[i] = factory.newThread(shared_ptr<Runnable>(new Writer()));
+    threads[i]->start();
+  }
+  for (int i = 0; i < 4; ++i) {
+    threads[i]->join();
+  }
+  apache::thrift::profile_set_sample_rate(0);
+
+  BOOST_CHECK_EQUAL(countPrinted(), 5 * oneThread);
+  apache::thrift::profile_reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif
@@ -328,6 +328,48 @@ void test_no_write() {
   BOOST_CHECK_EQUAL(membuf->available_read(), (uint32_t) 0);
 }
 
+void test_pooled_streams() {
+  // Transports made from a pool reuse state that must come back clean,
+  // even from a transport destroyed with data left unflushed.
+  boost::shared_ptr<TZlibStreamPool> pool(new TZlibStreamPool(2));
+  TZlibTransportFactory factory(pool);
+  uint32_t buf_len = 1024*32;
+  boost::shared_array<uint8_t> buf(gen_compressible_buffer(buf_len));
+
+  boost::shared_ptr<TMemoryBuffer> membuf(new TMemoryBuffer());
+  {
+    boost::shared_ptr<TTransport> unflushed = factory.getTransport(membuf);
+    unflushed->write(buf.get(), buf_len / 2);
+  }
+  BOOST_CHECK_EQUAL(pool->idle(), (size_t) 1);
+  membuf->resetBuffer();
+
+  for (int i = 0; i < 3; ++i) {
+    boost::shared_ptr<TTransport> writer = factory.getTransport(membuf);
+    boost::shared_ptr<TTransport> reader = factory.getTransport(membuf);
+    BOOST_CHECK_EQUAL(pool->idle(), (size_t) 0);
+    writer->write(buf.get(), buf_len);
+    static_cast<TZlibTransport*>(writer.get())->finish();
+
+    boost::shared_array<uint8_t> mirror(new uint8_t[buf_len]);
+    uint32_t got = reader->readAll(mirror.get(), buf_len);
+    BOOST_REQUIRE_EQUAL(got, buf_len);
+    BOOST_CHECK_EQUAL(memcmp(mirror.get(), buf.get(), buf_len), 0);
+    static_cast<TZlibTransport*>(reader.get())->verifyChecksum();
+    writer.reset();
+    reader.reset();
+    BOOST_CHECK_EQUAL(pool->idle(), (size_t) 2);
+  }
+
+  // A full pool frees what it can't keep
+  {
+    boost::shared_ptr<TTransport> t1 = factory.getTransport(membuf);
+    boost::shared_ptr<TTransport> t2 = factory.getTransport(membuf);
+    boost::shared_ptr<TTransport> t3 = factory.getTransport(membuf);
+  }
+  BOOST_CHECK_EQUAL(pool->idle(), (size_t) 2);
+}
+
 /*
  * Initialization
  */
@@ -450,6 +492,7 @@ unit_test::test_suite* init_unit_test_suite(int argc, char* argv[]) {
   add_tests(suite, gen_random_buffer(buf_len), buf_len, "random");
 
   suite->add(BOOST_TEST_CASE(test_no_write));
+  suite->add(BOOST_TEST_CASE(test_pooled_streams));
 
   return NULL;
 }
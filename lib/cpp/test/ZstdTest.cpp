@@ -0,0 +1,233 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#define BOOST_TEST_MODULE ZstdTest
+#include <boost/test/unit_test.hpp>
+#include <boost/shared_array.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TZstdTransport.h>
+
+using boost::shared_ptr;
+using boost::shared_array;
+using apache::thrift::transport::TZstdDictionary;
+using apache::thrift::transport::TZstdTransport;
+using apache::thrift::transport::TZstdTransportException;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
+
+static const uint32_t BUF_LEN = 1024 * 256;
+
+/// Runs of slowly changing bytes, which compress a fair bit
+static shared_array<uint8_t> compressibleBuffer() {
+  shared_array<uint8_t> buf(new uint8_t[BUF_LEN]);
+  srand(1);
+  uint8_t byte = 0;
+  for (uint32_t i = 0; i < BUF_LEN; ++i) {
+    if (rand() % 32 == 0) {
+      byte = rand();
+    }
+    buf[i] = byte++;
+  }
+  return buf;
+}
+
+static shared_array<uint8_t> randomBuffer() {
+  shared_array<uint8_t> buf(new uint8_t[BUF_LEN]);
+  srand(2);
+  for (uint32_t i = 0; i < BUF_LEN; ++i) {
+    buf[i] = rand();
+  }
+  return buf;
+}
+
+/// Write buf in pieces of assorted sizes, then read it back the same way
+static void writeThenRead(const uint8_t* buf,
+                          shared_ptr<TZstdDictionary> dict = shared_ptr<TZstdDictionary>()) {
+  shared_ptr<TMemoryBuffer> membuf(new TMemoryBuffer());
+  TZstdTransport writer(membuf,
+                       TZstdTransport::DEFAULT_URBUF_SIZE,
+                       TZstdTransport::DEFAULT_CRBUF_SIZE,
+                       TZstdTransport::DEFAULT_UWBUF_SIZE,
+                       TZstdTransport::DEFAULT_CWBUF_SIZE,
+                       TZstdTransport::DEFAULT_COMP_LEVEL,
+                       dict);
+  uint32_t pos = 0;
+  for (uint32_t n = 1; pos < BUF_LEN; n = (n * 7) % 70001) {
+    uint32_t len = std::min(n, BUF_LEN - pos);
+    writer.write(buf + pos, len);
+    pos += len;
+  }
+  writer.finish();
+
+  TZstdTransport reader(membuf,
+                       TZstdTransport::DEFAULT_URBUF_SIZE,
+                       TZstdTransport::DEFAULT_CRBUF_SIZE,
+                       TZstdTransport::DEFAULT_UWBUF_SIZE,
+                       TZstdTransport::DEFAULT_CWBUF_SIZE,
+                       TZstdTransport::DEFAULT_COMP_LEVEL,
+                       dict);
+  shared_array<uint8_t> mirror(new uint8_t[BUF_LEN]);
+  pos = 0;
+  for (uint32_t n = 3; pos < BUF_LEN; n = (n * 5) % 50021) {
+    uint32_t got = reader.read(mirror.get() + pos, std::min(n, BUF_LEN - pos));
+    BOOST_REQUIRE_NE(got, 0u);
+    pos += got;
+  }
+  BOOST_CHECK_EQUAL(memcmp(mirror.get(), buf, BUF_LEN), 0);
+  reader.verifyChecksum();
+}
+
+static std::string compress(const uint8_t* buf, uint32_t len) {
+  shared_ptr<TMemoryBuffer> membuf(new TMemoryBuffer());
+  TZstdTransport trans(membuf);
+  trans.write(buf, len);
+  trans.finish();
+  return membuf->getBufferAsString();
+}
+
+BOOST_AUTO_TEST_SUITE( ZstdTest )
+
+BOOST_AUTO_TEST_CASE( test_write_then_read ) {
+  writeThenRead(compressibleBuffer().get());
+  writeThenRead(randomBuffer().get());
+}
+
+BOOST_AUTO_TEST_CASE( test_flush ) {
+  // Everything written before a flush can be read before the frame ends
+  shared_ptr<TMemoryBuffer> membuf(new TMemoryBuffer());
+  TZstdTransport writer(membuf);
+  TZstdTransport reader(membuf);
+  shared_array<uint8_t> buf = compressibleBuffer();
+  uint8_t mirror[1000];
+  for (int i = 0; i < 3; ++i) {
+    writer.write(buf.get(), sizeof(mirror));
+    writer.flush();
+    BOOST_REQUIRE_EQUAL(reader.readAll(mirror, sizeof(mirror)), sizeof(mirror));
+    BOOST_CHECK_EQUAL(memcmp(mirror, buf.get(), sizeof(mirror)), 0);
+    BOOST_CHECK_EQUAL(reader.read(mirror, sizeof(mirror)), 0u);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_separate_checksum ) {
+  // The last byte comes in a read of its own
+  shared_array<uint8_t> buf = compressibleBuffer();
+  std::string compressed = compress(buf.get(), BUF_LEN);
+  shared_ptr<TMemoryBuffer> membuf(new TMemoryBuffer());
+  membuf->write((const uint8_t*)compressed.data(), compressed.size());
+  TZstdTransport reader(membuf,
+                       TZstdTransport::DEFAULT_URBUF_SIZE,
+                       compressed.size() - 1);
+
+  shared_array<uint8_t> mirror(new uint8_t[BUF_LEN]);
+  BOOST_REQUIRE_EQUAL(reader.readAll(mirror.get(), BUF_LEN), BUF_LEN);
+  BOOST_CHECK_EQUAL(memcmp(mirror.get(), buf.get(), BUF_LEN), 0);
+  reader.verifyChecksum();
+}
+
+BOOST_AUTO_TEST_CASE( test_incomplete_checksum ) {
+  shared_array<uint8_t> buf = compressibleBuffer();
+  std::string compressed = compress(buf.get(), BUF_LEN);
+  compressed.erase(compressed.size() - 1);
+  shared_ptr<TMemoryBuffer> membuf(new TMemoryBuffer());
+  membuf->write((const uint8_t*)compressed.data(), compressed.size());
+  TZstdTransport reader(membuf);
+
+  shared_array<uint8_t> mirror(new uint8_t[BUF_LEN]);
+  BOOST_REQUIRE_EQUAL(reader.readAll(mirror.get(), BUF_LEN), BUF_LEN);
+  try {
+    reader.verifyChecksum();
+    BOOST_ERROR("verifyChecksum() did not report an error");
+  } catch (TTransportException& ex) {
+    BOOST_CHECK_EQUAL(ex.getType(), TTransportException::CORRUPTED_DATA);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_invalid_checksum ) {
+  shared_array<uint8_t> buf = compressibleBuffer();
+  std::string compressed = compress(buf.get(), BUF_LEN);
+  compressed[compressed.size() - 1]++;
+  shared_ptr<TMemoryBuffer> membuf(new TMemoryBuffer());
+  membuf->write((const uint8_t*)compressed.data(), compressed.size());
+  TZstdTransport reader(membuf);
+
+  shared_array<uint8_t> mirror(new uint8_t[BUF_LEN]);
+  try {
+    reader.readAll(mirror.get(), BUF_LEN);
+    reader.verifyChecksum();
+    BOOST_ERROR("verifyChecksum() did not report an error");
+  } catch (TZstdTransportException& ex) {
+    BOOST_CHECK_EQUAL(ex.getType(), TTransportException::INTERNAL_ERROR);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_write_after_finish ) {
+  shared_ptr<TMemoryBuffer> membuf(new TMemoryBuffer());
+  TZstdTransport trans(membuf);
+  uint8_t byte = 'a';
+  trans.write(&byte, 1);
+  trans.finish();
+
+  BOOST_CHECK_THROW(trans.write(&byte, 1), TTransportException);
+  BOOST_CHECK_THROW(trans.flush(), TTransportException);
+  BOOST_CHECK_THROW(trans.finish(), TTransportException);
+}
+
+BOOST_AUTO_TEST_CASE( test_no_write ) {
+  shared_ptr<TMemoryBuffer> membuf(new TMemoryBuffer());
+  {
+    TZstdTransport trans(membuf);
+  }
+  BOOST_CHECK_EQUAL(membuf->available_read(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( test_dictionary ) {
+  shared_array<uint8_t> buf = compressibleBuffer();
+  shared_ptr<TZstdDictionary> dict(
+    new TZstdDictionary(std::string((const char*)buf.get(), 16384)));
+  writeThenRead(buf.get(), dict);
+
+  // A message that is in the dictionary shrinks to almost nothing
+  shared_ptr<TMemoryBuffer> membuf(new TMemoryBuffer());
+  TZstdTransport writer(membuf,
+                       TZstdTransport::DEFAULT_URBUF_SIZE,
+                       TZstdTransport::DEFAULT_CRBUF_SIZE,
+                       TZstdTransport::DEFAULT_UWBUF_SIZE,
+                       TZstdTransport::DEFAULT_CWBUF_SIZE,
+                       TZstdTransport::DEFAULT_COMP_LEVEL,
+                       dict);
+  writer.write(buf.get() + 8192, 1024);
+  writer.finish();
+  BOOST_CHECK_LT(membuf->available_read(), compress(buf.get() + 8192, 1024).size() / 4);
+
+  // And can't be read without it
+  TZstdTransport reader(membuf);
+  uint8_t mirror[1024];
+  try {
+    reader.readAll(mirror, sizeof(mirror));
+    reader.verifyChecksum();
+    BOOST_ERROR("read without the dictionary did not fail");
+  } catch (TTransportException&) {
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
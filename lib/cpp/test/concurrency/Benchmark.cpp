@@ -0,0 +1,526 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Times the thread managers, timer managers and mutexes, where Tests.cpp
+// only checks that they work:
+//
+//   concurrency_benchmark [--min-time=SECONDS] [--timers=N] [FILTER]
+//
+//   thread-manager/KIND/latency    time from add() to the task starting
+//   thread-manager/KIND/throughput/workers=W/producers=P
+//                                  empty tasks a second, added by P threads
+//   timer-manager/KIND/insert      add() with N timers pending (1000000 by
+//   timer-manager/KIND/cancel      default), and remove() of each again
+//   mutex/KIND/threads=T           lock and unlock by T threads at once
+//
+// Each case runs for at least min-time seconds (0.2 by default), and only
+// the cases whose name contains FILTER run.  Results are printed one JSON
+// object a line.  Every thread comes from PlatformThreadFactory, which is
+// named in each result; configure with --enable-boostthreads, or build
+// with USE_STD_THREAD, to measure the others.
+
+#include <thrift/thrift-config.h>
+#include <thrift/concurrency/AdaptiveMutex.h>
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/Mutex.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ReadMostly.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/TimerManager.h>
+#include <thrift/concurrency/TimingWheelTimerManager.h>
+#include <thrift/concurrency/Util.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using boost::shared_ptr;
+using namespace apache::thrift::concurrency;
+
+#if USE_BOOST_THREAD
+static const char* const factoryName = "boost";
+#elif USE_STD_THREAD
+static const char* const factoryName = "std";
+#else
+static const char* const factoryName = "posix";
+#endif
+
+static const int64_t NS_PER_S = 1000000000LL;
+
+static double minTime = 0.2;
+static size_t timerCount = 1000000;
+static const char* filter = NULL;
+
+// Flags and counters shared between the threads of a case
+#if defined(__GNUC__)
+static inline uint64_t benchLoad(const uint64_t* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static inline void benchStore(uint64_t* p, uint64_t v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+static inline uint64_t benchIncrement(uint64_t* p) {
+  return __atomic_add_fetch(p, 1, __ATOMIC_ACQ_REL);
+}
+#else
+static Mutex benchMutex;
+static inline uint64_t benchLoad(const uint64_t* p) {
+  Guard g(benchMutex);
+  return *p;
+}
+static inline void benchStore(uint64_t* p, uint64_t v) {
+  Guard g(benchMutex);
+  *p = v;
+}
+static inline uint64_t benchIncrement(uint64_t* p) {
+  Guard g(benchMutex);
+  return ++*p;
+}
+#endif
+
+static int64_t nowNs() {
+  return Util::monotonicTimeTicks(NS_PER_S);
+}
+
+static bool selected(const std::string& name) {
+  return filter == NULL || name.find(filter) != std::string::npos;
+}
+
+static void sleepMs(int64_t ms) {
+  Monitor monitor;
+  Synchronized s(monitor);
+  try {
+    monitor.wait(ms);
+  } catch (TimedOutException&) {
+  }
+}
+
+// Joinable threads for the producers and lockers a case starts itself
+static shared_ptr<PlatformThreadFactory> joinableThreads() {
+  shared_ptr<PlatformThreadFactory> threads(new PlatformThreadFactory());
+  threads->setDetached(false);
+  return threads;
+}
+
+static void startAll(const std::vector<shared_ptr<Thread> >& threads) {
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->start();
+  }
+}
+
+static void joinAll(const std::vector<shared_ptr<Thread> >& threads) {
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+}
+
+//
+// Thread managers
+//
+
+typedef shared_ptr<ThreadManager> (*ThreadManagerFactory)(size_t count,
+                                                           size_t pendingTaskCountMax);
+
+static shared_ptr<ThreadManager> startThreadManager(ThreadManagerFactory factory,
+                                                    size_t workers) {
+  shared_ptr<ThreadManager> manager = factory(workers, 0);
+  manager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+  manager->start();
+  return manager;
+}
+
+// Notes when it starts, for the thread that added it
+class LatencyTask : public Runnable {
+ public:
+  LatencyTask() : added_(0), started_(0), done_(false) {}
+
+  void run() {
+    started_ = nowNs();
+    Synchronized s(monitor_);
+    done_ = true;
+    monitor_.notify();
+  }
+
+  // Adds this task to manager and returns how long it took to start
+  int64_t time(ThreadManager& manager, shared_ptr<Runnable> self) {
+    done_ = false;
+    added_ = nowNs();
+    manager.add(self);
+    Synchronized s(monitor_);
+    while (!done_) {
+      monitor_.wait();
+    }
+    return started_ - added_;
+  }
+
+ private:
+  Monitor monitor_;
+  int64_t added_;
+  int64_t started_;
+  bool done_;
+};
+
+static void benchmarkLatency(const char* kind, ThreadManagerFactory factory) {
+  std::string name = std::string("thread-manager/") + kind + "/latency";
+  if (!selected(name)) {
+    return;
+  }
+
+  const size_t workers = 4;
+  shared_ptr<ThreadManager> manager = startThreadManager(factory, workers);
+  shared_ptr<LatencyTask> task(new LatencyTask());
+  task->time(*manager, task);
+
+  std::vector<int64_t> samples;
+  int64_t end = nowNs() + static_cast<int64_t>(minTime * NS_PER_S);
+  while (samples.size() < 100 || (nowNs() < end && samples.size() < 1000000)) {
+    samples.push_back(task->time(*manager, task));
+  }
+  manager->stop();
+
+  std::sort(samples.begin(), samples.end());
+  double total = 0;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    total += static_cast<double>(samples[i]);
+  }
+  printf("{\"case\":\"%s\",\"factory\":\"%s\",\"workers\":%u,\"samples\":%u,"
+         "\"mean_us\":%.2f,\"p50_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}\n",
+         name.c_str(), factoryName, static_cast<unsigned>(workers),
+         static_cast<unsigned>(samples.size()),
+         total / samples.size() / 1000.0,
+         samples[samples.size() / 2] / 1000.0,
+         samples[samples.size() * 99 / 100] / 1000.0,
+         samples.back() / 1000.0);
+  fflush(stdout);
+}
+
+// Counts its runs, and tells the waiting thread when they reach target
+class CountTask : public Runnable {
+ public:
+  CountTask() : count_(0), target_(0) {}
+
+  void run() {
+    if (benchIncrement(&count_) == target_) {
+      Synchronized s(monitor_);
+      monitor_.notify();
+    }
+  }
+
+  void reset(uint64_t target) {
+    benchStore(&count_, 0);
+    target_ = target;
+  }
+
+  void wait() {
+    Synchronized s(monitor_);
+    while (benchLoad(&count_) < target_) {
+      monitor_.wait();
+    }
+  }
+
+ private:
+  Monitor monitor_;
+  uint64_t count_;
+  uint64_t target_;
+};
+
+// Adds the same task count times
+class Producer : public Runnable {
+ public:
+  Producer(shared_ptr<ThreadManager> manager, shared_ptr<Runnable> task, uint64_t count)
+    : manager_(manager), task_(task), count_(count) {}
+
+  void run() {
+    for (uint64_t i = 0; i < count_; ++i) {
+      manager_->add(task_);
+    }
+  }
+
+ private:
+  shared_ptr<ThreadManager> manager_;
+  shared_ptr<Runnable> task_;
+  uint64_t count_;
+};
+
+/**
+ * Has producers threads add empty tasks, doubling how many until a run
+ * takes minTime, and prints the last run's rate.
+ */
+static void benchmarkThroughput(const char* kind, ThreadManagerFactory factory,
+                                size_t workers, size_t producers) {
+  char name[128];
+  sprintf(name, "thread-manager/%s/throughput/workers=%u/producers=%u",
+          kind, static_cast<unsigned>(workers), static_cast<unsigned>(producers));
+  if (!selected(name)) {
+    return;
+  }
+
+  shared_ptr<ThreadManager> manager = startThreadManager(factory, workers);
+  shared_ptr<PlatformThreadFactory> threadFactory = joinableThreads();
+  shared_ptr<CountTask> task(new CountTask());
+  uint64_t perProducer = 1000;
+  int64_t ticks = 0;
+  for (;; perProducer *= 2) {
+    task->reset(perProducer * producers);
+    std::vector<shared_ptr<Thread> > threads;
+    for (size_t i = 0; i < producers; ++i) {
+      threads.push_back(threadFactory->newThread(
+          shared_ptr<Runnable>(new Producer(manager, task, perProducer))));
+    }
+    int64_t start = nowNs();
+    startAll(threads);
+    task->wait();
+    ticks = nowNs() - start;
+    joinAll(threads);
+    if (ticks >= minTime * NS_PER_S || perProducer >= (1ULL << 30)) {
+      break;
+    }
+  }
+  manager->stop();
+
+  uint64_t tasks = perProducer * producers;
+  printf("{\"case\":\"%s\",\"factory\":\"%s\",\"workers\":%u,\"producers\":%u,"
+         "\"tasks\":%llu,\"tasks_per_s\":%.0f,\"ns_per_task\":%.1f}\n",
+         name, factoryName, static_cast<unsigned>(workers),
+         static_cast<unsigned>(producers), static_cast<unsigned long long>(tasks),
+         static_cast<double>(tasks) * NS_PER_S / ticks,
+         static_cast<double>(ticks) / tasks);
+  fflush(stdout);
+}
+
+//
+// Timer managers
+//
+
+class NoopTask : public Runnable {
+ public:
+  void run() {}
+};
+
+static void printTimerCase(const std::string& name, size_t count, int64_t ticks) {
+  printf("{\"case\":\"%s\",\"factory\":\"%s\",\"timers\":%u,\"ns_per_op\":%.1f}\n",
+         name.c_str(), factoryName, static_cast<unsigned>(count),
+         static_cast<double>(ticks) / count);
+  fflush(stdout);
+}
+
+/**
+ * Adds timerCount timers, none of which fall due while the case runs, and
+ * then removes them again where the manager can.  TimerManager::remove()
+ * does not remove anything, so there is no point timing it.
+ */
+static void benchmarkTimers(const char* kind, shared_ptr<TimerManager> timers,
+                            bool cancels) {
+  std::string prefix = std::string("timer-manager/") + kind + "/";
+  bool insert = selected(prefix + "insert");
+  bool cancel = cancels && selected(prefix + "cancel");
+  if (!insert && !cancel) {
+    return;
+  }
+
+  // Made beforehand, so only the managers' own allocations are timed
+  std::vector<shared_ptr<Runnable> > tasks;
+  tasks.reserve(timerCount);
+  for (size_t i = 0; i < timerCount; ++i) {
+    tasks.push_back(shared_ptr<Runnable>(new NoopTask()));
+  }
+
+  timers->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+  timers->start();
+  const int64_t hour = 3600 * 1000LL;
+  int64_t start = nowNs();
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    // Spread over a minute, so they don't all share a slot
+    timers->add(tasks[i], hour + static_cast<int64_t>(i % 60000));
+  }
+  int64_t ticks = nowNs() - start;
+  if (insert) {
+    printTimerCase(prefix + "insert", tasks.size(), ticks);
+  }
+
+  if (cancel) {
+    start = nowNs();
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      timers->remove(tasks[i]);
+    }
+    printTimerCase(prefix + "cancel", tasks.size(), nowNs() - start);
+  }
+  timers->stop();
+}
+
+//
+// Mutexes
+//
+
+/**
+ * Takes a lock over and over, until told to stop, around a counter that
+ * every thread updates.  With a ReadWriteMutex, one lock in writeEvery is
+ * a write lock and the rest are read locks.
+ */
+class Locker : public Runnable {
+ public:
+  Locker(const Mutex* mutex, const ReadWriteMutex* rwMutex, uint64_t writeEvery,
+         uint64_t* shared, uint64_t* go, uint64_t* stop)
+    : mutex_(mutex), rwMutex_(rwMutex), writeEvery_(writeEvery), shared_(shared),
+      go_(go), stop_(stop), ops_(0), sink_(0) {}
+
+  void run() {
+    while (!benchLoad(go_)) {
+    }
+    uint64_t ops = 0;
+    while (!benchLoad(stop_)) {
+      // A batch between looks at the flag, so that isn't what's timed
+      for (int i = 0; i < 64; ++i, ++ops) {
+        if (mutex_ != NULL) {
+          mutex_->lock();
+          ++*shared_;
+          mutex_->unlock();
+        } else if (ops % writeEvery_ == 0) {
+          rwMutex_->acquireWrite();
+          ++*shared_;
+          rwMutex_->release();
+        } else {
+          rwMutex_->acquireRead();
+          sink_ += *shared_;
+          rwMutex_->release();
+        }
+      }
+    }
+    ops_ = ops;
+  }
+
+  uint64_t ops() const { return ops_; }
+
+ private:
+  const Mutex* mutex_;
+  const ReadWriteMutex* rwMutex_;
+  uint64_t writeEvery_;
+  uint64_t* shared_;
+  uint64_t* go_;
+  uint64_t* stop_;
+  uint64_t ops_;
+  uint64_t sink_;
+};
+
+static void benchmarkLock(const char* kind, const Mutex* mutex,
+                          const ReadWriteMutex* rwMutex, uint64_t writeEvery,
+                          size_t threadCount) {
+  char name[128];
+  sprintf(name, "mutex/%s/threads=%u", kind, static_cast<unsigned>(threadCount));
+  if (!selected(name)) {
+    return;
+  }
+
+  shared_ptr<PlatformThreadFactory> threadFactory = joinableThreads();
+  uint64_t shared = 0;
+  uint64_t go = 0;
+  uint64_t stop = 0;
+  std::vector<shared_ptr<Locker> > lockers;
+  std::vector<shared_ptr<Thread> > threads;
+  for (size_t i = 0; i < threadCount; ++i) {
+    lockers.push_back(shared_ptr<Locker>(
+        new Locker(mutex, rwMutex, writeEvery, &shared, &go, &stop)));
+    threads.push_back(threadFactory->newThread(lockers.back()));
+  }
+  startAll(threads);
+
+  int64_t start = nowNs();
+  benchStore(&go, 1);
+  sleepMs(static_cast<int64_t>(minTime * 1000));
+  benchStore(&stop, 1);
+  int64_t ticks = nowNs() - start;
+  joinAll(threads);
+
+  uint64_t ops = 0;
+  for (size_t i = 0; i < lockers.size(); ++i) {
+    ops += lockers[i]->ops();
+  }
+  printf("{\"case\":\"%s\",\"factory\":\"%s\",\"threads\":%u,\"ops\":%llu,"
+         "\"ops_per_s\":%.0f,\"ns_per_op\":%.1f}\n",
+         name, factoryName, static_cast<unsigned>(threadCount),
+         static_cast<unsigned long long>(ops),
+         static_cast<double>(ops) * NS_PER_S / ticks,
+         static_cast<double>(ticks) / ops);
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--min-time=", 11) == 0) {
+      minTime = atof(argv[i] + 11);
+    } else if (strncmp(argv[i], "--timers=", 9) == 0) {
+      timerCount = static_cast<size_t>(atol(argv[i] + 9));
+    } else if (argv[i][0] == '-') {
+      timerCount = 0;
+      break;
+    } else {
+      filter = argv[i];
+    }
+  }
+  if (timerCount == 0) {
+    std::cerr << "usage: " << argv[0]
+              << " [--min-time=SECONDS] [--timers=N] [FILTER]" << std::endl;
+    return 1;
+  }
+
+  static const struct {
+    const char* kind;
+    ThreadManagerFactory factory;
+  } managers[] = {
+    { "simple", ThreadManager::newSimpleThreadManager },
+    { "work-stealing", ThreadManager::newWorkStealingThreadManager }
+  };
+  static const size_t workerCounts[] = { 1, 2, 4, 8 };
+  static const size_t producerCounts[] = { 1, 4 };
+  for (size_t m = 0; m < sizeof(managers) / sizeof(managers[0]); ++m) {
+    benchmarkLatency(managers[m].kind, managers[m].factory);
+    for (size_t p = 0; p < sizeof(producerCounts) / sizeof(producerCounts[0]); ++p) {
+      for (size_t w = 0; w < sizeof(workerCounts) / sizeof(workerCounts[0]); ++w) {
+        benchmarkThroughput(managers[m].kind, managers[m].factory,
+                            workerCounts[w], producerCounts[p]);
+      }
+    }
+  }
+
+  benchmarkTimers("map", shared_ptr<TimerManager>(new TimerManager()), false);
+  benchmarkTimers("timing-wheel",
+                  shared_ptr<TimerManager>(new TimingWheelTimerManager()), true);
+
+  Mutex mutex;
+  AdaptiveMutex adaptive;
+  ReadWriteMutex rwMutex;
+  NoStarveReadWriteMutex noStarve;
+  ReadMostlyMutex readMostly;
+  static const size_t threadCounts[] = { 1, 2, 4, 8 };
+  for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t) {
+    size_t threads = threadCounts[t];
+    benchmarkLock("mutex", &mutex, NULL, 0, threads);
+    benchmarkLock("adaptive", &adaptive, NULL, 0, threads);
+    benchmarkLock("rw-write", NULL, &rwMutex, 1, threads);
+    benchmarkLock("rw-read90", NULL, &rwMutex, 10, threads);
+    benchmarkLock("no-starve-read90", NULL, &noStarve, 10, threads);
+    benchmarkLock("read-mostly-read90", NULL, &readMostly, 10, threads);
+  }
+  return 0;
+}
@@ -64,6 +64,24 @@ int main(int argc, char** argv) {
     std::cout << "\t\tThreadFactory monitor timeout test" << std::endl;
 
     assert(threadFactoryTests.monitorTimeoutTest());
+
+    std::cout << "\t\tThreadFactory placement test" << std::endl;
+
+    assert(threadFactoryTests.placementTest());
+
+    std::cout << "\t\tThreadFactory adaptive mutex test" << std::endl;
+
+    assert(threadFactoryTests.adaptiveMutexTest());
+
+    std::cout << "\t\tThreadFactory read-mostly mutex test" << std::endl;
+
+    assert(threadFactoryTests.readMostlyTest());
+
+#if !USE_BOOST_THREAD && !USE_STD_THREAD && !defined(THRIFT_NO_CONTENTION_PROFILING)
+    std::cout << "\t\tThreadFactory mutex contention profile test" << std::endl;
+
+    assert(threadFactoryTests.mutexContentionTest());
+#endif
   }
 
   if (runAll || args[0].compare("util") == 0) {
@@ -87,6 +105,35 @@ int main(int argc, char** argv) {
     }
 
     std::cout << "\t\t\tscall per ms: " << count / (time01 - time00) << std::endl;
+
+    std::cout << "\t\tUtil monotonic clocks" << std::endl;
+
+    time00 = Util::monotonicTime();
+    time01 = time00;
+    count = 0;
+
+    while (time01 < time00 + 10) {
+      count++;
+      time01 = Util::monotonicTime();
+    }
+
+    std::cout << "\t\t\tmonotonic calls per ms: " << count / (time01 - time00) << std::endl;
+
+    time00 = Util::monotonicTime();
+    time01 = time00;
+    count = 0;
+
+    while (time01 < time00 + 10) {
+      count++;
+      if (Util::coarseMonotonicTime() > Util::monotonicTime()) {
+        std::cerr << "\t\t\tcoarse clock ahead of the monotonic one" << std::endl;
+        return 1;
+      }
+      time01 = Util::monotonicTime();
+    }
+
+    std::cout << "\t\t\tcoarse lag: " << Util::monotonicTime() - Util::coarseMonotonicTime()
+              << "ms" << std::endl;
   }
 
 
@@ -99,6 +146,10 @@ int main(int argc, char** argv) {
     TimerManagerTests timerManagerTests;
 
     assert(timerManagerTests.test00());
+
+    std::cout << "\t\tTimerManager test01" << std::endl;
+
+    assert(timerManagerTests.test01());
   }
 
   if (runAll || args[0].compare("thread-manager") == 0) {
@@ -123,6 +174,58 @@ int main(int argc, char** argv) {
 
       assert(threadManagerTests.blockTest(delay, workerCount));
 
+      std::cout << "\t\tThreadManager priority test" << std::endl;
+
+      assert(threadManagerTests.priorityTest());
+
+      std::cout << "\t\tThreadManager adaptive test" << std::endl;
+
+      assert(threadManagerTests.adaptiveTest());
+
+      std::cout << "\t\tThreadManager batch test" << std::endl;
+
+      assert(threadManagerTests.batchTest());
+
+      std::cout << "\t\tThreadManager spin test" << std::endl;
+
+      assert(threadManagerTests.spinTest());
+
+      std::cout << "\t\tThreadManager reuse test" << std::endl;
+
+      assert(threadManagerTests.reuseTest());
+
+    }
+  }
+
+  if (runAll || args[0].compare("work-stealing-thread-manager") == 0) {
+
+    std::cout << "WorkStealingThreadManager tests..." << std::endl;
+
+    {
+
+      size_t workerCount = 100;
+
+      size_t taskCount = 100000;
+
+      int64_t delay = 10LL;
+
+      std::cout << "\t\tWorkStealingThreadManager load test: worker count: " << workerCount << " task count: " << taskCount << " delay: " << delay << std::endl;
+
+      ThreadManagerTests threadManagerTests(ThreadManager::newWorkStealingThreadManager);
+
+      assert(threadManagerTests.loadTest(taskCount, delay, workerCount));
+
+      std::cout << "\t\tWorkStealingThreadManager block test: worker count: " << workerCount << " delay: " << delay << std::endl;
+
+      assert(threadManagerTests.blockTest(delay, workerCount));
+
+      std::cout << "\t\tWorkStealingThreadManager spawn test: worker count: " << workerCount << std::endl;
+
+      assert(threadManagerTests.spawnTest(1000, 6, workerCount));
+
+      std::cout << "\t\tWorkStealingThreadManager batch test" << std::endl;
+
+      assert(threadManagerTests.batchTest());
     }
   }
 
@@ -20,13 +20,23 @@
 #include <thrift/thrift-config.h>
 #include <thrift/concurrency/Thread.h>
 #include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/ThreadPlacement.h>
 #include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/AdaptiveMutex.h>
+#include <thrift/concurrency/ReadMostly.h>
+#include <thrift/concurrency/MutexProfiler.h>
 #include <thrift/concurrency/Util.h>
 
 #include <assert.h>
+#include <stdio.h>
+#ifdef __GLIBC__
+#include <pthread.h>
+#endif
 #include <unistd.h>
 #include <iostream>
 #include <set>
+#include <string>
+#include <vector>
 
 namespace apache { namespace thrift { namespace concurrency { namespace test {
 
@@ -307,6 +317,302 @@ public:
     const size_t _id;
   };
 
+  /**
+   * Placement test: a thread made by a factory with a placement runs, and
+   * where names are supported, runs under the placement's name
+   */
+  class PlacementTask : public Runnable {
+
+   public:
+
+    PlacementTask(Monitor& monitor) :
+      _monitor(monitor),
+      _done(false) {}
+
+    void run() {
+      Synchronized s(_monitor);
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 12))
+      char name[16];
+      if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0) {
+        _name = name;
+      }
+#endif
+
+      _done = true;
+
+      _monitor.notify();
+    }
+
+    Monitor& _monitor;
+
+    bool _done;
+
+    std::string _name;
+  };
+
+  bool placementTest() {
+
+    PlatformThreadFactory threadFactory = PlatformThreadFactory();
+
+    ThreadPlacement placement;
+
+    placement.cpus.push_back(0);
+
+    placement.name = "thrift-placed";
+
+    threadFactory.setPlacement(placement);
+
+    assert(threadFactory.getPlacement().name == placement.name);
+
+    Monitor monitor;
+
+    shared_ptr<PlacementTask> task(new PlacementTask(monitor));
+
+    shared_ptr<Thread> thread = threadFactory.newThread(task);
+
+    {
+      Synchronized s(monitor);
+
+      thread->start();
+
+      while (!task->_done) {
+        monitor.wait();
+      }
+    }
+
+    thread->join();
+
+    bool success = task->_name.empty() || task->_name == placement.name;
+
+    std::cout << "			" << (success ? "Success" : "Failure") << "! thread name: \"" << task->_name << "\"" << std::endl;
+
+    return success;
+  }
+
+  /**
+   * Adaptive mutex test: threads adding to a counter under an AdaptiveMutex
+   * lose no updates
+   */
+  class CountTask : public Runnable {
+
+   public:
+
+    CountTask(const Mutex& mutex, int64_t& counter, size_t count) :
+      _mutex(mutex),
+      _counter(counter),
+      _count(count) {}
+
+    void run() {
+      for (size_t ix = 0; ix < _count; ix++) {
+        Guard g(_mutex);
+
+        _counter++;
+      }
+    }
+
+    const Mutex& _mutex;
+
+    int64_t& _counter;
+
+    size_t _count;
+  };
+
+  bool adaptiveMutexTest(size_t threadCount=8, size_t count=100000) {
+
+    AdaptiveMutex mutex;
+
+    int64_t counter = 0;
+
+    PlatformThreadFactory threadFactory = PlatformThreadFactory();
+
+    threadFactory.setDetached(false);
+
+    std::vector<shared_ptr<Thread> > threads;
+
+    for (size_t ix = 0; ix < threadCount; ix++) {
+      threads.push_back(threadFactory.newThread(shared_ptr<CountTask>(new CountTask(mutex, counter, count))));
+    }
+
+    for (size_t ix = 0; ix < threadCount; ix++) {
+      threads[ix]->start();
+    }
+
+    for (size_t ix = 0; ix < threadCount; ix++) {
+      threads[ix]->join();
+    }
+
+    bool success = counter == (int64_t)(threadCount * count);
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << "! counter: " << counter << std::endl;
+
+    return success;
+  }
+
+  /**
+   * Read-mostly test: readers never see a pair of values a writer is half
+   * way through changing
+   */
+  class PairTask : public Runnable {
+
+   public:
+
+    PairTask(const ReadMostlyMutex& mutex, int64_t* pair, bool writer, size_t count, bool& torn) :
+      _mutex(mutex),
+      _pair(pair),
+      _writer(writer),
+      _count(count),
+      _torn(torn) {}
+
+    void run() {
+      for (size_t ix = 0; ix < _count; ix++) {
+        RWGuard g(_mutex, _writer ? RW_WRITE : RW_READ);
+
+        if (_writer) {
+          _pair[0]++;
+
+          _pair[1]++;
+        } else if (_pair[0] != _pair[1]) {
+          _torn = true;
+        }
+      }
+    }
+
+    const ReadMostlyMutex& _mutex;
+
+    int64_t* _pair;
+
+    bool _writer;
+
+    size_t _count;
+
+    bool& _torn;
+  };
+
+  bool readMostlyTest(size_t readerCount=8, size_t count=100000) {
+
+    ReadMostlyMutex mutex;
+
+    int64_t pair[2] = {0, 0};
+
+    bool torn = false;
+
+    PlatformThreadFactory threadFactory = PlatformThreadFactory();
+
+    threadFactory.setDetached(false);
+
+    std::vector<shared_ptr<Thread> > threads;
+
+    threads.push_back(threadFactory.newThread(shared_ptr<PairTask>(new PairTask(mutex, pair, true, count / 100, torn))));
+
+    for (size_t ix = 0; ix < readerCount; ix++) {
+      threads.push_back(threadFactory.newThread(shared_ptr<PairTask>(new PairTask(mutex, pair, false, count, torn))));
+    }
+
+    for (size_t ix = 0; ix < threads.size(); ix++) {
+      threads[ix]->start();
+    }
+
+    for (size_t ix = 0; ix < threads.size(); ix++) {
+      threads[ix]->join();
+    }
+
+    ReadMostly<std::string> value(shared_ptr<const std::string>(new std::string("before")));
+
+    shared_ptr<const std::string> before = value.get();
+
+    value.set(shared_ptr<const std::string>(new std::string("after")));
+
+    bool success = !torn && pair[0] == (int64_t)(count / 100) && *before == "before" && *value.get() == "after";
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << "! writes: " << pair[0] << std::endl;
+
+    return success;
+  }
+
+#if !USE_BOOST_THREAD && !USE_STD_THREAD && !defined(THRIFT_NO_CONTENTION_PROFILING)
+  /**
+   * Mutex contention test: a lock held while another thread waits for it
+   * shows up in the contention profile
+   */
+  class HoldTask : public Runnable {
+
+   public:
+
+    HoldTask(Mutex& mutex, Monitor& monitor) :
+      _mutex(mutex),
+      _monitor(monitor),
+      _holding(false) {}
+
+    void run() {
+      Guard g(_mutex);
+
+      {
+        Synchronized s(_monitor);
+
+        _holding = true;
+
+        _monitor.notify();
+      }
+
+      usleep(20000);
+    }
+
+    Mutex& _mutex;
+
+    Monitor& _monitor;
+
+    bool _holding;
+  };
+
+  bool mutexContentionTest() {
+
+    resetMutexContentionProfile();
+
+    enableMutexContentionProfiling(1);
+
+    Mutex mutex;
+
+    Monitor monitor;
+
+    shared_ptr<HoldTask> task(new HoldTask(mutex, monitor));
+
+    PlatformThreadFactory threadFactory = PlatformThreadFactory();
+
+    shared_ptr<Thread> thread = threadFactory.newThread(task);
+
+    {
+      Synchronized s(monitor);
+
+      thread->start();
+
+      while (!task->_holding) {
+        monitor.wait();
+      }
+    }
+
+    {
+      Guard g(mutex);
+    }
+
+    thread->join();
+
+    enableMutexContentionProfiling(0);
+
+    FILE* f = tmpfile();
+
+    printMutexContentionProfile(f);
+
+    bool success = ftell(f) > 0;
+
+    fclose(f);
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << "!" << std::endl;
+
+    return success;
+  }
+#endif
+
   void foo(PlatformThreadFactory *tf) {
     (void) tf;
   }
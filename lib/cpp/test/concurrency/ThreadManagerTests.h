@@ -19,14 +19,20 @@
 
 #include <thrift/thrift-config.h>
 #include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/Future.h>
 #include <thrift/concurrency/PlatformThreadFactory.h>
 #include <thrift/concurrency/Monitor.h>
 #include <thrift/concurrency/Util.h>
 
+#include <boost/weak_ptr.hpp>
+
+#include <algorithm>
 #include <assert.h>
 #include <set>
 #include <iostream>
 #include <set>
+#include <stdexcept>
+#include <vector>
 #include <stdint.h>
 
 namespace apache { namespace thrift { namespace concurrency { namespace test {
@@ -44,6 +50,11 @@ public:
 
   static const double ERROR;
 
+  typedef shared_ptr<ThreadManager> (*Factory)(size_t count, size_t pendingTaskCountMax);
+
+  ThreadManagerTests(Factory factory=ThreadManager::newSimpleThreadManager) :
+    _factory(factory) {}
+
   class Task: public Runnable {
 
   public:
@@ -108,7 +119,7 @@ public:
 
     size_t activeCount = count;
 
-    shared_ptr<ThreadManager> threadManager = ThreadManager::newSimpleThreadManager(workerCount);
+    shared_ptr<ThreadManager> threadManager = _factory(workerCount, 0);
 
     shared_ptr<PlatformThreadFactory> threadFactory = shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory());
 
@@ -248,7 +259,7 @@ public:
 
       size_t activeCounts[] = {workerCount, pendingTaskMaxCount, 1};
 
-      shared_ptr<ThreadManager> threadManager = ThreadManager::newSimpleThreadManager(workerCount, pendingTaskMaxCount);
+      shared_ptr<ThreadManager> threadManager = _factory(workerCount, pendingTaskMaxCount);
 
       shared_ptr<PlatformThreadFactory> threadFactory = shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory());
 
@@ -371,6 +382,569 @@ public:
     std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
     return success;
  }
+
+  class SpawnTask: public Runnable {
+
+  public:
+
+    SpawnTask(ThreadManager& threadManager, Monitor& monitor, size_t& count, size_t depth) :
+      _threadManager(threadManager),
+      _monitor(monitor),
+      _count(count),
+      _depth(depth) {}
+
+    void run() {
+      if (_depth > 0) {
+        for (int ix = 0; ix < 2; ix++) {
+          _threadManager.add(shared_ptr<Runnable>(new SpawnTask(_threadManager, _monitor, _count, _depth - 1)));
+        }
+      }
+
+      {
+        Synchronized s(_monitor);
+
+        _count--;
+
+        if (_count == 0) {
+
+          _monitor.notify();
+        }
+      }
+    }
+
+    ThreadManager& _threadManager;
+    Monitor& _monitor;
+    size_t& _count;
+    size_t _depth;
+  };
+
+  /**
+   * Spawn test.  Add count tasks, each of which adds two more from its worker
+   * thread, to depth levels.  Verify that every task runs and that the thread
+   * manager cleans up properly on delete. */
+
+  bool spawnTest(size_t count=100, size_t depth=6, size_t workerCount=4) {
+
+    Monitor monitor;
+
+    size_t activeCount = count * ((2 << depth) - 1);
+
+    shared_ptr<ThreadManager> threadManager = _factory(workerCount, 0);
+
+    threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+    threadManager->start();
+
+    for (size_t ix = 0; ix < count; ix++) {
+      threadManager->add(shared_ptr<Runnable>(new SpawnTask(*threadManager, monitor, activeCount, depth)));
+    }
+
+    {
+      Synchronized s(monitor);
+
+      while(activeCount > 0) {
+
+        monitor.wait();
+      }
+    }
+
+    threadManager->join();
+
+    bool success = threadManager->totalTaskCount() == 0;
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
+
+    return success;
+  }
+
+  class GateTask: public Runnable {
+
+  public:
+
+    GateTask(Monitor& monitor, bool& started, bool& open) :
+      _monitor(monitor),
+      _started(started),
+      _open(open) {}
+
+    void run() {
+      Synchronized s(_monitor);
+
+      _started = true;
+
+      _monitor.notifyAll();
+
+      while (!_open) {
+        _monitor.wait();
+      }
+    }
+
+    Monitor& _monitor;
+    bool& _started;
+    bool& _open;
+  };
+
+  class OrderTask: public Runnable {
+
+  public:
+
+    OrderTask(Monitor& monitor, std::vector<int>& order, int id) :
+      _monitor(monitor),
+      _order(order),
+      _id(id) {}
+
+    void run() {
+      Synchronized s(_monitor);
+
+      _order.push_back(_id);
+
+      _monitor.notifyAll();
+    }
+
+    Monitor& _monitor;
+    std::vector<int>& _order;
+    int _id;
+  };
+
+  /**
+   * Priority test.  With the only worker held up, add tasks in several
+   * priority classes, some with expirations.  Verify that they run by class,
+   * then earliest expiration, then in the order added, and that a task that
+   * expires while waiting is dropped. */
+
+  bool priorityTest() {
+
+    Monitor monitor;
+
+    bool started = false;
+
+    bool open = false;
+
+    std::vector<int> order;
+
+    shared_ptr<ThreadManager> threadManager = _factory(1, 0);
+
+    threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+    threadManager->start();
+
+    threadManager->add(shared_ptr<Runnable>(new GateTask(monitor, started, open)));
+
+    {
+      Synchronized s(monitor);
+
+      while (!started) {
+        monitor.wait();
+      }
+    }
+
+    struct {
+      int priority;
+      int64_t expiration;
+    } adds[] = {{0, 0LL}, {0, 10000LL}, {1, 0LL}, {0, 5000LL}, {1, 0LL}, {-1, 0LL}, {1, 1LL}};
+
+    size_t addCount = sizeof(adds) / sizeof(adds[0]);
+
+    for (size_t ix = 0; ix < addCount; ix++) {
+      threadManager->addWithPriority(shared_ptr<Runnable>(new OrderTask(monitor, order, static_cast<int>(ix))),
+                                     adds[ix].priority, 0LL, adds[ix].expiration);
+    }
+
+    // Let the last task expire before the worker gets to it
+
+    {
+      Monitor sleep;
+
+      Synchronized s(sleep);
+
+      sleep.waitForTimeRelative(20);
+    }
+
+    {
+      Synchronized s(monitor);
+
+      open = true;
+
+      monitor.notifyAll();
+
+      while (order.size() < addCount - 1) {
+        monitor.wait();
+      }
+    }
+
+    threadManager->join();
+
+    int expected[] = {2, 4, 3, 1, 0, 5};
+
+    bool success = order.size() == addCount - 1 &&
+                   std::equal(order.begin(), order.end(), expected) &&
+                   threadManager->expiredTaskCount() == 1;
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
+
+    return success;
+  }
+
+  /**
+   * Adaptive test.  Hold up every task added to a pool of one that may grow
+   * to maxCount, adding them slowly enough that each has waited long enough
+   * for another worker.  Verify the pool grows to maxCount and no further,
+   * then shrinks back to one once its workers go idle. */
+
+  bool adaptiveTest(size_t maxCount=4) {
+
+    Monitor monitor;
+
+    Monitor bmonitor;
+
+    size_t activeCount = maxCount + 1;
+
+    shared_ptr<ThreadManager> threadManager = ThreadManager::newAdaptiveThreadManager(1, maxCount, 0, 10LL, 100LL);
+
+    threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+    threadManager->start();
+
+    Monitor sleep;
+
+    for (size_t ix = 0; ix < maxCount + 1; ix++) {
+
+      threadManager->add(shared_ptr<Runnable>(new BlockTask(monitor, bmonitor, activeCount)));
+
+      Synchronized s(sleep);
+
+      sleep.waitForTimeRelative(30);
+    }
+
+    bool grown = threadManager->workerCount() == maxCount;
+
+    // Release the tasks until all have run
+
+    {
+      Synchronized s(monitor);
+
+      while (activeCount > 0) {
+        {
+          Synchronized b(bmonitor);
+
+          bmonitor.notifyAll();
+        }
+
+        monitor.waitForTimeRelative(10);
+      }
+    }
+
+    {
+      Synchronized s(sleep);
+
+      sleep.waitForTimeRelative(500);
+    }
+
+    bool shrunk = threadManager->workerCount() == 1;
+
+    threadManager->join();
+
+    bool success = grown && shrunk;
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
+
+    return success;
+  }
+
+  class CountTask: public Runnable {
+
+  public:
+
+    CountTask(Monitor& monitor, size_t& count, bool fail=false) :
+      _monitor(monitor),
+      _count(count),
+      _fail(fail) {}
+
+    void run() {
+      if (_fail) {
+        throw std::runtime_error("failed");
+      }
+
+      Synchronized s(_monitor);
+
+      _count++;
+    }
+
+    // As a continuation
+    void operator()() {
+      Synchronized s(_monitor);
+
+      _count++;
+    }
+
+    Monitor& _monitor;
+    size_t& _count;
+    bool _fail;
+  };
+
+  /**
+   * Batch test.  Submit a batch of tasks, one of which throws, to a pool
+   * whose pending task limit is less than the batch, with a continuation on
+   * each.  Verify every task runs, only the one that threw fails, and every
+   * continuation runs, including one added once its task is done. */
+
+  bool batchTest(size_t count=64, size_t workerCount=4) {
+
+    Monitor monitor;
+
+    size_t runCount = 0;
+
+    size_t continuationCount = 0;
+
+    shared_ptr<ThreadManager> threadManager = _factory(workerCount, count / 8);
+
+    threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+    threadManager->start();
+
+    std::vector<shared_ptr<Runnable> > tasks;
+
+    for (size_t ix = 0; ix < count; ix++) {
+      tasks.push_back(shared_ptr<Runnable>(new CountTask(monitor, runCount, ix == count / 2)));
+    }
+
+    std::vector<shared_ptr<Future> > futures;
+
+    threadManager->submitBatch(tasks, futures);
+
+    for (size_t ix = 0; ix < futures.size(); ix++) {
+      futures[ix]->then(CountTask(monitor, continuationCount));
+    }
+
+    size_t failedCount = 0;
+
+    for (size_t ix = 0; ix < futures.size(); ix++) {
+      futures[ix]->wait();
+
+      if (futures[ix]->failed()) {
+        failedCount++;
+      }
+    }
+
+    shared_ptr<Future> future = threadManager->submit(tasks[0]);
+
+    bool done = future->wait(10000LL) && !future->failed();
+
+    future->then(CountTask(monitor, continuationCount));
+
+    threadManager->join();
+
+    bool success = done &&
+                   futures.size() == count &&
+                   failedCount == 1 &&
+                   futures[count / 2]->error() == "failed" &&
+                   runCount == count &&
+                   continuationCount == count + 1;
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
+
+    return success;
+  }
+
+  /**
+   * Spin test.  Let two of the idle workers spin, and add tasks one at a
+   * time, waiting for each to run, so that each finds a worker spinning or
+   * asleep.  Verify every task runs, and the manager stops though workers
+   * are spinning. */
+
+  bool spinTest(size_t count=1000, size_t workerCount=4) {
+
+    Monitor monitor;
+
+    size_t runCount = 0;
+
+    shared_ptr<ThreadManager> threadManager = _factory(workerCount, 0);
+
+    threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+    threadManager->idleSpin(2, 1000LL);
+
+    threadManager->start();
+
+    for (size_t ix = 0; ix < count; ix++) {
+      threadManager->add(shared_ptr<Runnable>(new CountTask(monitor, runCount)));
+
+      Synchronized s(monitor);
+
+      while (runCount <= ix) {
+        monitor.waitForTimeRelative(1);
+      }
+    }
+
+    int64_t start = Util::currentTime();
+
+    threadManager->join();
+
+    bool success = runCount == count && Util::currentTime() - start < 1000LL;
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
+
+    return success;
+  }
+
+  /**
+   * Reuse test.  With a single worker, run tasks that expire, so that the
+   * manager keeps their wrappers for reuse, then hold the worker up and add
+   * tasks that don't.  Verify that they all run in the order added, none
+   * expiring as the reused wrappers would have, and that each runnable is
+   * released once it has run.  Then the reverse: a task reusing a wrapper
+   * that had no expiration is dropped when its own expires. */
+
+  bool reuseTest() {
+
+    // Every wait is bounded, as a task that wrongly expires never runs
+
+    Monitor monitor;
+
+    bool started = false;
+
+    bool open = false;
+
+    std::vector<int> order;
+
+    shared_ptr<ThreadManager> threadManager = _factory(1, 0);
+
+    threadManager->threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+    threadManager->start();
+
+    // Tasks that would expire soon, each run before the next is added
+
+    std::vector<boost::weak_ptr<Runnable> > ran;
+
+    for (int ix = 0; ix < 3; ix++) {
+      shared_ptr<Runnable> task(new OrderTask(monitor, order, ix));
+
+      ran.push_back(task);
+
+      threadManager->add(task, 0LL, 30LL);
+
+      task.reset();
+
+      Synchronized s(monitor);
+
+      while (order.size() <= static_cast<size_t>(ix) && monitor.waitForTimeRelative(5000) == 0) {
+      }
+    }
+
+    // Hold the worker up while tasks without expirations outlive those
+
+    threadManager->add(shared_ptr<Runnable>(new GateTask(monitor, started, open)));
+
+    {
+      Synchronized s(monitor);
+
+      while (!started && monitor.waitForTimeRelative(5000) == 0) {
+      }
+    }
+
+    for (int ix = 3; ix < 8; ix++) {
+      threadManager->add(shared_ptr<Runnable>(new OrderTask(monitor, order, ix)));
+    }
+
+    {
+      Monitor sleep;
+
+      Synchronized s(sleep);
+
+      sleep.waitForTimeRelative(60);
+    }
+
+    {
+      Synchronized s(monitor);
+
+      open = true;
+
+      monitor.notifyAll();
+
+      while (order.size() < 8 && monitor.waitForTimeRelative(5000) == 0) {
+      }
+    }
+
+    bool noneExpired = threadManager->expiredTaskCount() == 0;
+
+    // The worker lets go of a runnable just after running it
+
+    bool released = false;
+
+    for (int wait = 0; wait < 1000 && !released; wait++) {
+      released = true;
+
+      for (size_t ix = 0; ix < ran.size(); ix++) {
+        if (!ran[ix].expired()) {
+          released = false;
+        }
+      }
+
+      if (!released) {
+        Monitor sleep;
+
+        Synchronized s(sleep);
+
+        sleep.waitForTimeRelative(1);
+      }
+    }
+
+    // Now a task that should expire reuses one that had no expiration
+
+    started = false;
+
+    open = false;
+
+    threadManager->add(shared_ptr<Runnable>(new GateTask(monitor, started, open)));
+
+    {
+      Synchronized s(monitor);
+
+      while (!started && monitor.waitForTimeRelative(5000) == 0) {
+      }
+    }
+
+    threadManager->add(shared_ptr<Runnable>(new OrderTask(monitor, order, 8)), 0LL, 1LL);
+
+    threadManager->add(shared_ptr<Runnable>(new OrderTask(monitor, order, 9)));
+
+    {
+      Monitor sleep;
+
+      Synchronized s(sleep);
+
+      sleep.waitForTimeRelative(20);
+    }
+
+    {
+      Synchronized s(monitor);
+
+      open = true;
+
+      monitor.notifyAll();
+
+      while (order.size() < 9 && monitor.waitForTimeRelative(5000) == 0) {
+      }
+    }
+
+    threadManager->join();
+
+    int expected[] = {0, 1, 2, 3, 4, 5, 6, 7, 9};
+
+    bool success = noneExpired &&
+                   released &&
+                   order.size() == 9 &&
+                   std::equal(order.begin(), order.end(), expected) &&
+                   threadManager->expiredTaskCount() == 1;
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << std::endl;
+
+    return success;
+  }
+
+private:
+
+  Factory _factory;
 };
 
 const double ThreadManagerTests::ERROR = .20;
@@ -18,12 +18,14 @@
  */
 
 #include <thrift/concurrency/TimerManager.h>
+#include <thrift/concurrency/TimingWheelTimerManager.h>
 #include <thrift/concurrency/PlatformThreadFactory.h>
 #include <thrift/concurrency/Monitor.h>
 #include <thrift/concurrency/Util.h>
 
 #include <assert.h>
 #include <iostream>
+#include <vector>
 
 namespace apache { namespace thrift { namespace concurrency { namespace test {
 
@@ -45,7 +47,7 @@ class TimerManagerTests {
 
     Task(Monitor& monitor, int64_t timeout) :
       _timeout(timeout),
-      _startTime(Util::currentTime()),
+      _startTime(Util::monotonicTime()),
       _monitor(monitor),
       _success(false),
       _done(false) {}
@@ -54,7 +56,7 @@ class TimerManagerTests {
 
     void run() {
 
-      _endTime = Util::currentTime();
+      _endTime = Util::monotonicTime();
 
       // Figure out error percentage
 
@@ -144,6 +146,93 @@ class TimerManagerTests {
     return true;
   }
 
+  class CountTask: public Runnable {
+   public:
+
+    CountTask(Monitor& monitor, size_t& count, int64_t timeout) :
+      _monitor(monitor),
+      _count(count),
+      _due(Util::monotonicTime() + timeout),
+      _early(false),
+      _done(false) {}
+
+    void run() {
+      Synchronized s(_monitor);
+
+      _early = Util::monotonicTime() < _due;
+
+      _done = true;
+
+      if (--_count == 0) {
+        _monitor.notifyAll();
+      }
+    }
+
+    Monitor& _monitor;
+    size_t& _count;
+    int64_t _due;
+    bool _early;
+    bool _done;
+  };
+
+  /**
+   * This test adds many tasks to a TimingWheelTimerManager, with timeouts
+   * spread over more than a turn of its wheel, and removes every other one.
+   * It verifies that the rest run, none early, that the removed ones never
+   * do, and that a task that has run can no longer be removed.
+   */
+  bool test01(size_t count=2000) {
+
+    TimingWheelTimerManager timerManager(1LL, 64, 4);
+
+    timerManager.threadFactory(shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+
+    timerManager.start();
+
+    assert(timerManager.state() == TimerManager::STARTED);
+
+    Monitor monitor;
+
+    size_t remaining = count / 2;
+
+    std::vector<shared_ptr<CountTask> > tasks;
+
+    for (size_t ix = 0; ix < count; ix++) {
+      tasks.push_back(shared_ptr<CountTask>(new CountTask(monitor, remaining, 100 + ix % 200)));
+      timerManager.add(tasks.back(), 100 + ix % 200);
+    }
+
+    assert(timerManager.taskCount() == count);
+
+    for (size_t ix = 1; ix < count; ix += 2) {
+      timerManager.remove(tasks[ix]);
+    }
+
+    {
+      Synchronized s(monitor);
+
+      while (remaining > 0) {
+        monitor.wait();
+      }
+    }
+
+    bool success = timerManager.taskCount() == 0;
+
+    for (size_t ix = 0; ix < count; ix++) {
+      success = success && tasks[ix]->_done == (ix % 2 == 0) && !tasks[ix]->_early;
+    }
+
+    try {
+      timerManager.remove(tasks[0]);
+      success = false;
+    } catch (NoSuchTaskException&) {
+    }
+
+    std::cout << "\t\t\t" << (success ? "Success" : "Failure") << "!" << std::endl;
+
+    return success;
+  }
+
   friend class TestTask;
 
   Monitor _monitor;
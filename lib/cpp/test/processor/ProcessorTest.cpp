@@ -32,6 +32,7 @@
 #include <thrift/server/TThreadedServer.h>
 #include <thrift/server/TThreadPoolServer.h>
 #include <thrift/server/TNonblockingServer.h>
+#include <thrift/server/TServerIntrospection.h>
 #include <thrift/server/TSimpleServer.h>
 #include <thrift/transport/TSocket.h>
 
@@ -272,6 +273,10 @@ class ServiceState : public ServerState {
     return handler_;
   }
 
+  const shared_ptr<Processor>& getProcessor() const {
+    return processor_;
+  }
+
   shared_ptr<Client> createClient() {
     typedef typename ServiceTraits_::Protocol Protocol;
 
@@ -873,6 +878,125 @@ void testUnexpectedError() {
 }
 
 
+/**
+ * A TNonblockingServer ParentService that keeps the server it creates
+ */
+class IntrospectionState
+  : public ServiceState< TNonblockingServerTraits,
+                         ParentServiceTraits<UntemplatedTraits> > {
+ public:
+  shared_ptr<TServer> createServer(uint16_t port) {
+    shared_ptr<TServer> server =
+      ServiceState< TNonblockingServerTraits,
+                    ParentServiceTraits<UntemplatedTraits> >::createServer(port);
+    server_ = dynamic_pointer_cast<TNonblockingServer>(server);
+    return server;
+  }
+
+  shared_ptr<TNonblockingServer> server_;
+};
+
+BOOST_AUTO_TEST_CASE(TNonblockingServer_introspection) {
+  shared_ptr<IntrospectionState> state(new IntrospectionState);
+  ServerThread serverThread(state, true);
+
+  shared_ptr<IntrospectionState::Client> client = state->createClient();
+  client->incrementGeneration();
+  client->getGeneration();
+
+  // The IO thread reports the connection, and the requests it has read
+  vector<TIOThreadStats> ioThreads;
+  state->server_->getIOThreadStats(ioThreads, true);
+  BOOST_REQUIRE_EQUAL(ioThreads.size(), 1u);
+  BOOST_CHECK(ioThreads[0].complete);
+  BOOST_CHECK_EQUAL(ioThreads[0].connections, 1u);
+  BOOST_REQUIRE_EQUAL(ioThreads[0].connectionStats.size(), 1u);
+  const TConnectionStats& conn = ioThreads[0].connectionStats[0];
+  BOOST_CHECK_EQUAL(conn.requests, 2u);
+  BOOST_CHECK(conn.clientAddress.find("127.0.0.1") != string::npos);
+  BOOST_CHECK(conn.readBufferSize > 0);
+
+  TServerIntrospection introspection;
+  introspection.setServer(state->server_);
+  map<string, int64_t> counters;
+  introspection.getCounters(counters);
+  BOOST_CHECK_EQUAL(counters["thrift.server.connections"], 1);
+  BOOST_CHECK_EQUAL(counters["thrift.server.io_thread.0.connections"], 1);
+  BOOST_CHECK_EQUAL(counters.count("thrift.thread_manager.server.pending_tasks"), 1u);
+  BOOST_CHECK_EQUAL(counters["thrift.thread_manager.server.workers"], 8);
+
+  string text = introspection.getStatsText();
+  BOOST_CHECK(text.find("127.0.0.1") != string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(TNonblockingServer_connectionQuota) {
+  shared_ptr<IntrospectionState> state(new IntrospectionState);
+  ServerThread serverThread(state, true);
+
+  // Two calls a second, and no saving up for more
+  shared_ptr<TConnectionQuota> quota(new TConnectionQuota(2.0, 0.0, 1.0));
+  state->server_->setConnectionQuota(quota);
+
+  shared_ptr<IntrospectionState::Client> client = state->createClient();
+  client->incrementGeneration();
+  client->getGeneration();
+  try {
+    client->getGeneration();
+    BOOST_FAIL("expected the third call to be throttled");
+  } catch (TApplicationException& e) {
+    BOOST_CHECK_EQUAL(e.getType(), TApplicationException::INTERNAL_ERROR);
+    BOOST_CHECK(std::string(e.what()).find("over quota") != std::string::npos);
+  }
+  BOOST_CHECK_EQUAL(quota->getThrottledCount(), 1u);
+
+  // The connection stays open, and lifting the limit lets calls through
+  quota->setLimits(0.0, 0.0);
+  client->getGeneration();
+  BOOST_CHECK_EQUAL(quota->getThrottledCount(), 1u);
+}
+
+/**
+ * A ParentService processor on TNonblockingBinaryProtocol that counts the
+ * calls that missed the specialized path
+ */
+class GenericCountingProcessor : public ParentServiceProcessorT<TNonblockingBinaryProtocol> {
+ public:
+  explicit GenericCountingProcessor(shared_ptr<ParentServiceIf> iface)
+    : ParentServiceProcessorT<TNonblockingBinaryProtocol>(iface), generic(0) {}
+
+  int generic;
+
+ protected:
+  bool dispatchCall(TProtocol* in, TProtocol* out, const string& fname,
+                    int32_t seqid, void* callContext) {
+    ++generic;
+    return ParentServiceProcessorT<TNonblockingBinaryProtocol>::dispatchCall(
+      in, out, fname, seqid, callContext);
+  }
+};
+
+class SpecializedTraits {
+ public:
+  typedef TNonblockingBinaryProtocolFactory ProtocolFactory;
+  typedef TNonblockingBinaryProtocol Protocol;
+
+  typedef GenericCountingProcessor ParentProcessor;
+  typedef ParentServiceClientT<Protocol> ParentClient;
+};
+
+typedef ServiceState< TNonblockingServerTraits,
+                      ParentServiceTraits<SpecializedTraits> > SpecializedState;
+
+BOOST_AUTO_TEST_CASE(TNonblockingServer_specialized) {
+  shared_ptr<SpecializedState> state(new SpecializedState);
+  ServerThread serverThread(state, true);
+
+  shared_ptr<SpecializedState::Client> client = state->createClient();
+  client->incrementGeneration();
+  BOOST_CHECK_EQUAL(client->getGeneration(), 1);
+  BOOST_CHECK_EQUAL(state->getProcessor()->generic, 0);
+}
+
 // Macro to define simple tests that can be used with all server types
 #define DEFINE_SIMPLE_TESTS(Server, Template) \
   BOOST_AUTO_TEST_CASE(Server##_##Template##_basicService) { \
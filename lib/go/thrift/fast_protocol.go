@@ -0,0 +1,875 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+package thrift
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"math"
+	"sync"
+)
+
+// A struct that can be read from and written to a TProtocol. All generated
+// structs are.
+type TStruct interface {
+	Read(iprot TProtocol) error
+	Write(oprot TProtocol) error
+}
+
+// A struct generated with the go:fast option. Besides the TProtocol methods
+// it encodes itself straight into, and decodes itself straight out of, a
+// byte slice in the binary and compact formats, with no interface calls or
+// transport writes per field.
+//
+// The generated Read and Write use this through FastRead and FastWrite
+// whenever the protocol and transport allow it, and go through the
+// TProtocol otherwise.
+type TFastStruct interface {
+	TStruct
+	FastWriteBinary(w *TFastBinaryWriter)
+	FastWriteCompact(w *TFastCompactWriter)
+	FastReadBinary(r *TFastBinaryReader)
+	FastReadCompact(r *TFastCompactReader)
+}
+
+// Buffers grown past this are dropped instead of going back to the pool, so
+// that one huge struct doesn't pin its memory for good.
+const maxPooledFastBuffer = 64 * 1024
+
+var errFastShort = errors.New("fast reader ran past the end of the buffer")
+
+// Writes s to oprot through the fast path if oprot is a binary or compact
+// protocol: s is encoded into a pooled buffer which is then handed to the
+// transport in one write. Returns false, having written nothing, if the
+// protocol is any other.
+func FastWrite(oprot TProtocol, s TFastStruct) (bool, error) {
+	switch p := oprot.(type) {
+	case *TBinaryProtocol:
+		w := fastBinaryWriters.Get().(*TFastBinaryWriter)
+		s.FastWriteBinary(w)
+		err := w.err
+		if err == nil {
+			_, err = p.trans.Write(w.Buf)
+		}
+		w.reset()
+		fastBinaryWriters.Put(w)
+		return true, NewTProtocolException(err)
+	case *TCompactProtocol:
+		if p.booleanField != nil {
+			return false, nil
+		}
+		w := fastCompactWriters.Get().(*TFastCompactWriter)
+		s.FastWriteCompact(w)
+		err := w.err
+		if err == nil {
+			_, err = p.trans.Write(w.Buf)
+		}
+		w.reset()
+		fastCompactWriters.Put(w)
+		return true, NewTProtocolException(err)
+	}
+	return false, nil
+}
+
+// Transports that hold the bytes still to be read in memory, and so can hand
+// them to a fast reader to decode in place.
+type tFastReadBuffer interface {
+	fastBytes() []byte
+	fastConsume(n int)
+}
+
+func (p *TMemoryBuffer) fastBytes() []byte { return p.Bytes() }
+func (p *TMemoryBuffer) fastConsume(n int) { p.Next(n) }
+
+func (p *TFramedTransport) fastBytes() []byte { return p.readBuffer.Bytes() }
+func (p *TFramedTransport) fastConsume(n int) { p.readBuffer.Next(n) }
+
+// Reads s from iprot through the fast path if iprot is a binary or compact
+// protocol over a transport that already holds the whole struct in memory,
+// such as a TMemoryBuffer or a TFramedTransport once the frame is in.
+// Bytes are consumed from the transport only if the struct decodes.
+// Returns false, having consumed nothing, when the fast path can't be taken;
+// the caller then reads s through the TProtocol.
+func FastRead(iprot TProtocol, s TFastStruct) (bool, error) {
+	var n int
+	var err error
+	switch p := iprot.(type) {
+	case *TBinaryProtocol:
+		b, ok := p.trans.(tFastReadBuffer)
+		if !ok {
+			return false, nil
+		}
+		r := fastBinaryReaders.Get().(*TFastBinaryReader)
+		r.Buf = b.fastBytes()
+		s.FastReadBinary(r)
+		n, err = r.pos, r.err
+		r.reset()
+		fastBinaryReaders.Put(r)
+		if err == nil {
+			b.fastConsume(n)
+		}
+	case *TCompactProtocol:
+		b, ok := p.trans.(tFastReadBuffer)
+		if !ok || p.boolValueIsNotNull {
+			return false, nil
+		}
+		r := fastCompactReaders.Get().(*TFastCompactReader)
+		r.Buf = b.fastBytes()
+		s.FastReadCompact(r)
+		n, err = r.pos, r.err
+		r.reset()
+		fastCompactReaders.Put(r)
+		if err == nil {
+			b.fastConsume(n)
+		}
+	default:
+		return false, nil
+	}
+	if err == errFastShort {
+		return false, nil
+	}
+	return true, NewTProtocolException(err)
+}
+
+var (
+	fastBinaryWriters  = sync.Pool{New: func() interface{} { return &TFastBinaryWriter{Buf: make([]byte, 0, 1024)} }}
+	fastCompactWriters = sync.Pool{New: func() interface{} { return &TFastCompactWriter{Buf: make([]byte, 0, 1024)} }}
+	fastBinaryReaders  = sync.Pool{New: func() interface{} { return &TFastBinaryReader{} }}
+	fastCompactReaders = sync.Pool{New: func() interface{} { return &TFastCompactReader{} }}
+)
+
+func resetFastBuffer(buf []byte) []byte {
+	if cap(buf) > maxPooledFastBuffer {
+		return make([]byte, 0, 1024)
+	}
+	return buf[:0]
+}
+
+//
+// Binary
+//
+
+// Appends the binary protocol encoding of a struct to Buf. Errors are
+// sticky: once one is hit the rest of the writes are dropped, and Err
+// reports it.
+type TFastBinaryWriter struct {
+	Buf []byte
+	err error
+}
+
+func (w *TFastBinaryWriter) Err() error { return w.err }
+
+func (w *TFastBinaryWriter) reset() {
+	w.Buf = resetFastBuffer(w.Buf)
+	w.err = nil
+}
+
+func (w *TFastBinaryWriter) WriteStructBegin() {}
+func (w *TFastBinaryWriter) WriteStructEnd()   {}
+
+func (w *TFastBinaryWriter) WriteFieldBegin(typeId TType, id int16) {
+	w.Buf = append(w.Buf, byte(typeId), byte(id>>8), byte(id))
+}
+
+func (w *TFastBinaryWriter) WriteFieldStop() {
+	w.Buf = append(w.Buf, STOP)
+}
+
+func (w *TFastBinaryWriter) WriteMapBegin(keyType TType, valueType TType, size int) {
+	w.Buf = append(w.Buf, byte(keyType), byte(valueType))
+	w.WriteI32(int32(size))
+}
+
+func (w *TFastBinaryWriter) WriteListBegin(elemType TType, size int) {
+	w.Buf = append(w.Buf, byte(elemType))
+	w.WriteI32(int32(size))
+}
+
+func (w *TFastBinaryWriter) WriteSetBegin(elemType TType, size int) {
+	w.WriteListBegin(elemType, size)
+}
+
+func (w *TFastBinaryWriter) WriteBool(value bool) {
+	if value {
+		w.Buf = append(w.Buf, 1)
+	} else {
+		w.Buf = append(w.Buf, 0)
+	}
+}
+
+func (w *TFastBinaryWriter) WriteByte(value byte) {
+	w.Buf = append(w.Buf, value)
+}
+
+func (w *TFastBinaryWriter) WriteI16(value int16) {
+	w.Buf = append(w.Buf, byte(value>>8), byte(value))
+}
+
+func (w *TFastBinaryWriter) WriteI32(value int32) {
+	w.Buf = append(w.Buf, byte(value>>24), byte(value>>16), byte(value>>8), byte(value))
+}
+
+func (w *TFastBinaryWriter) WriteI64(value int64) {
+	w.Buf = append(w.Buf, byte(value>>56), byte(value>>48), byte(value>>40), byte(value>>32),
+		byte(value>>24), byte(value>>16), byte(value>>8), byte(value))
+}
+
+func (w *TFastBinaryWriter) WriteDouble(value float64) {
+	w.WriteI64(int64(math.Float64bits(value)))
+}
+
+func (w *TFastBinaryWriter) WriteString(value string) {
+	w.WriteI32(int32(len(value)))
+	w.Buf = append(w.Buf, value...)
+}
+
+func (w *TFastBinaryWriter) WriteBinary(value []byte) {
+	w.WriteI32(int32(len(value)))
+	w.Buf = append(w.Buf, value...)
+}
+
+// Writes a struct that may not have been generated with go:fast, going
+// through a TBinaryProtocol over Buf if it wasn't.
+func (w *TFastBinaryWriter) WriteStruct(s TStruct) {
+	if f, ok := s.(TFastStruct); ok {
+		f.FastWriteBinary(w)
+		return
+	}
+	buf := &TMemoryBuffer{Buffer: bytes.NewBuffer(w.Buf)}
+	if err := s.Write(NewTBinaryProtocolTransport(buf)); err != nil && w.err == nil {
+		w.err = err
+	}
+	w.Buf = buf.Bytes()
+}
+
+// Decodes the binary protocol encoding of a struct from Buf. Errors are
+// sticky: once one is hit every read returns the zero value, and field
+// headers read as STOP, so a generated reader runs straight out.
+type TFastBinaryReader struct {
+	Buf []byte
+	pos int
+	err error
+}
+
+func (r *TFastBinaryReader) Err() error { return r.err }
+
+func (r *TFastBinaryReader) reset() {
+	r.Buf = nil
+	r.pos = 0
+	r.err = nil
+}
+
+func (r *TFastBinaryReader) fail(err error) {
+	if r.err == nil {
+		r.err = err
+	}
+	r.pos = len(r.Buf)
+}
+
+// Returns the next n bytes, or nil having failed the reader if there aren't
+// that many.
+func (r *TFastBinaryReader) next(n int) []byte {
+	if n > len(r.Buf)-r.pos {
+		r.fail(errFastShort)
+		return nil
+	}
+	b := r.Buf[r.pos : r.pos+n]
+	r.pos += n
+	return b
+}
+
+// Reads a size, failing the reader if it is negative or more than the bytes
+// left could hold.
+func (r *TFastBinaryReader) readSize() int {
+	size := int(r.ReadI32())
+	if size < 0 {
+		r.fail(NewTProtocolExceptionWithType(NEGATIVE_SIZE, fmt.Errorf("negative size %d", size)))
+		return 0
+	}
+	if size > len(r.Buf)-r.pos {
+		r.fail(errFastShort)
+		return 0
+	}
+	return size
+}
+
+func (r *TFastBinaryReader) ReadStructBegin() {}
+func (r *TFastBinaryReader) ReadStructEnd()   {}
+
+func (r *TFastBinaryReader) ReadFieldBegin() (TType, int16) {
+	t := TType(r.ReadByte())
+	if t == STOP || r.err != nil {
+		return STOP, 0
+	}
+	return t, r.ReadI16()
+}
+
+func (r *TFastBinaryReader) ReadMapBegin() (TType, TType, int) {
+	k := TType(r.ReadByte())
+	v := TType(r.ReadByte())
+	return k, v, r.readSize()
+}
+
+func (r *TFastBinaryReader) ReadListBegin() (TType, int) {
+	e := TType(r.ReadByte())
+	return e, r.readSize()
+}
+
+func (r *TFastBinaryReader) ReadSetBegin() (TType, int) {
+	return r.ReadListBegin()
+}
+
+func (r *TFastBinaryReader) ReadBool() bool {
+	return r.ReadByte() == 1
+}
+
+func (r *TFastBinaryReader) ReadByte() byte {
+	if r.pos >= len(r.Buf) {
+		r.fail(errFastShort)
+		return 0
+	}
+	b := r.Buf[r.pos]
+	r.pos++
+	return b
+}
+
+func (r *TFastBinaryReader) ReadI16() int16 {
+	if b := r.next(2); b != nil {
+		return int16(binary.BigEndian.Uint16(b))
+	}
+	return 0
+}
+
+func (r *TFastBinaryReader) ReadI32() int32 {
+	if b := r.next(4); b != nil {
+		return int32(binary.BigEndian.Uint32(b))
+	}
+	return 0
+}
+
+func (r *TFastBinaryReader) ReadI64() int64 {
+	if b := r.next(8); b != nil {
+		return int64(binary.BigEndian.Uint64(b))
+	}
+	return 0
+}
+
+func (r *TFastBinaryReader) ReadDouble() float64 {
+	return math.Float64frombits(uint64(r.ReadI64()))
+}
+
+func (r *TFastBinaryReader) ReadString() string {
+	return string(r.next(r.readSize()))
+}
+
+// The bytes returned are a copy; Buf belongs to the transport.
+func (r *TFastBinaryReader) ReadBinary() []byte {
+	b := r.next(r.readSize())
+	if b == nil {
+		return nil
+	}
+	return append([]byte{}, b...)
+}
+
+// Reads a struct that may not have been generated with go:fast, going
+// through a TBinaryProtocol over the rest of Buf if it wasn't.
+func (r *TFastBinaryReader) ReadStruct(s TStruct) {
+	if f, ok := s.(TFastStruct); ok {
+		f.FastReadBinary(r)
+		return
+	}
+	if r.err != nil {
+		return
+	}
+	buf := &TMemoryBuffer{Buffer: bytes.NewBuffer(r.Buf[r.pos:])}
+	if err := s.Read(NewTBinaryProtocolTransport(buf)); err != nil {
+		r.fail(err)
+		return
+	}
+	r.pos = len(r.Buf) - buf.Len()
+}
+
+func (r *TFastBinaryReader) Skip(fieldType TType) {
+	r.skip(fieldType, MaxSkipDepth)
+}
+
+func (r *TFastBinaryReader) skip(fieldType TType, maxDepth int) {
+	if maxDepth <= 0 {
+		r.fail(NewTProtocolExceptionWithType(INVALID_DATA, errors.New("depth limit exceeded")))
+		return
+	}
+	switch fieldType {
+	case BOOL, BYTE:
+		r.next(1)
+	case I16:
+		r.next(2)
+	case I32:
+		r.next(4)
+	case I64, DOUBLE:
+		r.next(8)
+	case STRING:
+		r.next(r.readSize())
+	case STRUCT:
+		for {
+			t, _ := r.ReadFieldBegin()
+			if t == STOP {
+				break
+			}
+			r.skip(t, maxDepth-1)
+		}
+	case MAP:
+		k, v, size := r.ReadMapBegin()
+		for i := 0; i < size && r.err == nil; i++ {
+			r.skip(k, maxDepth-1)
+			r.skip(v, maxDepth-1)
+		}
+	case SET, LIST:
+		e, size := r.ReadListBegin()
+		for i := 0; i < size && r.err == nil; i++ {
+			r.skip(e, maxDepth-1)
+		}
+	default:
+		r.fail(NewTProtocolExceptionWithType(INVALID_DATA, fmt.Errorf("unknown type %d", fieldType)))
+	}
+}
+
+//
+// Compact
+//
+
+// Appends the compact protocol encoding of a struct to Buf, with the same
+// sticky errors as TFastBinaryWriter.
+type TFastCompactWriter struct {
+	Buf []byte
+	err error
+
+	// The last field id written in the current struct, and those of the
+	// structs it is nested in, for the field id deltas.
+	lastField   []int16
+	lastFieldId int16
+
+	// Bool fields are written whole by WriteBool, the value going in the
+	// field header.
+	boolFieldId int16
+	boolField   bool
+}
+
+func (w *TFastCompactWriter) Err() error { return w.err }
+
+func (w *TFastCompactWriter) reset() {
+	w.Buf = resetFastBuffer(w.Buf)
+	w.err = nil
+	w.lastField = w.lastField[:0]
+	w.lastFieldId = 0
+	w.boolField = false
+}
+
+func (w *TFastCompactWriter) WriteStructBegin() {
+	w.lastField = append(w.lastField, w.lastFieldId)
+	w.lastFieldId = 0
+}
+
+func (w *TFastCompactWriter) WriteStructEnd() {
+	w.lastFieldId = w.lastField[len(w.lastField)-1]
+	w.lastField = w.lastField[:len(w.lastField)-1]
+}
+
+func (w *TFastCompactWriter) writeFieldHeader(compactType byte, id int16) {
+	if id > w.lastFieldId && id-w.lastFieldId <= 15 {
+		w.Buf = append(w.Buf, byte(id-w.lastFieldId)<<4|compactType)
+	} else {
+		w.Buf = append(w.Buf, compactType)
+		w.WriteI16(id)
+	}
+	w.lastFieldId = id
+}
+
+func (w *TFastCompactWriter) WriteFieldBegin(typeId TType, id int16) {
+	if typeId == BOOL {
+		w.boolFieldId = id
+		w.boolField = true
+		return
+	}
+	w.writeFieldHeader(byte(ttypeToCompactType[typeId]), id)
+}
+
+func (w *TFastCompactWriter) WriteFieldStop() {
+	w.Buf = append(w.Buf, STOP)
+}
+
+func (w *TFastCompactWriter) WriteMapBegin(keyType TType, valueType TType, size int) {
+	if size == 0 {
+		w.Buf = append(w.Buf, 0)
+		return
+	}
+	w.writeVarint(uint64(uint32(size)))
+	w.Buf = append(w.Buf, byte(ttypeToCompactType[keyType])<<4|byte(ttypeToCompactType[valueType]))
+}
+
+func (w *TFastCompactWriter) WriteListBegin(elemType TType, size int) {
+	if size <= 14 {
+		w.Buf = append(w.Buf, byte(size<<4)|byte(ttypeToCompactType[elemType]))
+		return
+	}
+	w.Buf = append(w.Buf, 0xf0|byte(ttypeToCompactType[elemType]))
+	w.writeVarint(uint64(uint32(size)))
+}
+
+func (w *TFastCompactWriter) WriteSetBegin(elemType TType, size int) {
+	w.WriteListBegin(elemType, size)
+}
+
+func (w *TFastCompactWriter) WriteBool(value bool) {
+	v := byte(COMPACT_BOOLEAN_FALSE)
+	if value {
+		v = COMPACT_BOOLEAN_TRUE
+	}
+	if w.boolField {
+		w.boolField = false
+		w.writeFieldHeader(v, w.boolFieldId)
+		return
+	}
+	w.Buf = append(w.Buf, v)
+}
+
+func (w *TFastCompactWriter) WriteByte(value byte) {
+	w.Buf = append(w.Buf, value)
+}
+
+func (w *TFastCompactWriter) WriteI16(value int16) {
+	w.WriteI32(int32(value))
+}
+
+func (w *TFastCompactWriter) WriteI32(value int32) {
+	w.writeVarint(uint64(uint32((value << 1) ^ (value >> 31))))
+}
+
+func (w *TFastCompactWriter) WriteI64(value int64) {
+	w.writeVarint(uint64((value << 1) ^ (value >> 63)))
+}
+
+func (w *TFastCompactWriter) WriteDouble(value float64) {
+	bits := math.Float64bits(value)
+	w.Buf = append(w.Buf, byte(bits), byte(bits>>8), byte(bits>>16), byte(bits>>24),
+		byte(bits>>32), byte(bits>>40), byte(bits>>48), byte(bits>>56))
+}
+
+func (w *TFastCompactWriter) WriteString(value string) {
+	w.writeVarint(uint64(uint32(len(value))))
+	w.Buf = append(w.Buf, value...)
+}
+
+func (w *TFastCompactWriter) WriteBinary(value []byte) {
+	w.writeVarint(uint64(uint32(len(value))))
+	w.Buf = append(w.Buf, value...)
+}
+
+func (w *TFastCompactWriter) writeVarint(n uint64) {
+	for n >= 0x80 {
+		w.Buf = append(w.Buf, byte(n)|0x80)
+		n >>= 7
+	}
+	w.Buf = append(w.Buf, byte(n))
+}
+
+// Writes a struct that may not have been generated with go:fast, going
+// through a TCompactProtocol over Buf if it wasn't.
+func (w *TFastCompactWriter) WriteStruct(s TStruct) {
+	if f, ok := s.(TFastStruct); ok {
+		f.FastWriteCompact(w)
+		return
+	}
+	buf := &TMemoryBuffer{Buffer: bytes.NewBuffer(w.Buf)}
+	if err := s.Write(NewTCompactProtocol(buf)); err != nil && w.err == nil {
+		w.err = err
+	}
+	w.Buf = buf.Bytes()
+}
+
+// Decodes the compact protocol encoding of a struct from Buf, with the same
+// sticky errors as TFastBinaryReader.
+type TFastCompactReader struct {
+	Buf []byte
+	pos int
+	err error
+
+	lastField   []int16
+	lastFieldId int16
+
+	// The value of a bool field, read with its header.
+	boolValue      bool
+	boolValueIsSet bool
+}
+
+func (r *TFastCompactReader) Err() error { return r.err }
+
+func (r *TFastCompactReader) reset() {
+	r.Buf = nil
+	r.pos = 0
+	r.err = nil
+	r.lastField = r.lastField[:0]
+	r.lastFieldId = 0
+	r.boolValueIsSet = false
+}
+
+func (r *TFastCompactReader) fail(err error) {
+	if r.err == nil {
+		r.err = err
+	}
+	r.pos = len(r.Buf)
+}
+
+func (r *TFastCompactReader) next(n int) []byte {
+	if n > len(r.Buf)-r.pos {
+		r.fail(errFastShort)
+		return nil
+	}
+	b := r.Buf[r.pos : r.pos+n]
+	r.pos += n
+	return b
+}
+
+func (r *TFastCompactReader) readVarint() uint64 {
+	var result uint64
+	for shift := uint(0); shift < 64; shift += 7 {
+		b := r.ReadByte()
+		result |= uint64(b&0x7f) << shift
+		if b&0x80 == 0 {
+			return result
+		}
+	}
+	r.fail(NewTProtocolExceptionWithType(INVALID_DATA, errors.New("varint too long")))
+	return 0
+}
+
+func (r *TFastCompactReader) readSize() int {
+	size := int(int32(r.readVarint()))
+	if size < 0 {
+		r.fail(NewTProtocolExceptionWithType(NEGATIVE_SIZE, fmt.Errorf("negative size %d", size)))
+		return 0
+	}
+	if size > len(r.Buf)-r.pos {
+		r.fail(errFastShort)
+		return 0
+	}
+	return size
+}
+
+func (r *TFastCompactReader) ttype(t byte) TType {
+	switch t & 0x0f {
+	case COMPACT_BOOLEAN_TRUE, COMPACT_BOOLEAN_FALSE:
+		return BOOL
+	case COMPACT_BYTE:
+		return BYTE
+	case COMPACT_I16:
+		return I16
+	case COMPACT_I32:
+		return I32
+	case COMPACT_I64:
+		return I64
+	case COMPACT_DOUBLE:
+		return DOUBLE
+	case COMPACT_BINARY:
+		return STRING
+	case COMPACT_LIST:
+		return LIST
+	case COMPACT_SET:
+		return SET
+	case COMPACT_MAP:
+		return MAP
+	case COMPACT_STRUCT:
+		return STRUCT
+	}
+	r.fail(NewTProtocolExceptionWithType(INVALID_DATA, fmt.Errorf("unknown compact type %d", t&0x0f)))
+	return STOP
+}
+
+func (r *TFastCompactReader) ReadStructBegin() {
+	r.lastField = append(r.lastField, r.lastFieldId)
+	r.lastFieldId = 0
+}
+
+func (r *TFastCompactReader) ReadStructEnd() {
+	r.lastFieldId = r.lastField[len(r.lastField)-1]
+	r.lastField = r.lastField[:len(r.lastField)-1]
+}
+
+func (r *TFastCompactReader) ReadFieldBegin() (TType, int16) {
+	t := r.ReadByte()
+	if t&0x0f == STOP || r.err != nil {
+		return STOP, 0
+	}
+	var id int16
+	if delta := int16(t >> 4); delta != 0 {
+		id = r.lastFieldId + delta
+	} else {
+		id = r.ReadI16()
+	}
+	typeId := r.ttype(t)
+	if typeId == BOOL {
+		r.boolValue = t&0x0f == COMPACT_BOOLEAN_TRUE
+		r.boolValueIsSet = true
+	}
+	r.lastFieldId = id
+	return typeId, id
+}
+
+func (r *TFastCompactReader) ReadMapBegin() (TType, TType, int) {
+	size := r.readSize()
+	if size == 0 {
+		return STOP, STOP, 0
+	}
+	kv := r.ReadByte()
+	return r.ttype(kv >> 4), r.ttype(kv), size
+}
+
+func (r *TFastCompactReader) ReadListBegin() (TType, int) {
+	t := r.ReadByte()
+	size := int(t >> 4)
+	if size == 15 {
+		size = r.readSize()
+	} else if size > len(r.Buf)-r.pos {
+		r.fail(errFastShort)
+		size = 0
+	}
+	return r.ttype(t), size
+}
+
+func (r *TFastCompactReader) ReadSetBegin() (TType, int) {
+	return r.ReadListBegin()
+}
+
+func (r *TFastCompactReader) ReadBool() bool {
+	if r.boolValueIsSet {
+		r.boolValueIsSet = false
+		return r.boolValue
+	}
+	return r.ReadByte() == COMPACT_BOOLEAN_TRUE
+}
+
+func (r *TFastCompactReader) ReadByte() byte {
+	if r.pos >= len(r.Buf) {
+		r.fail(errFastShort)
+		return 0
+	}
+	b := r.Buf[r.pos]
+	r.pos++
+	return b
+}
+
+func (r *TFastCompactReader) ReadI16() int16 {
+	return int16(r.ReadI32())
+}
+
+func (r *TFastCompactReader) ReadI32() int32 {
+	n := uint32(r.readVarint())
+	return int32(n>>1) ^ -int32(n&1)
+}
+
+func (r *TFastCompactReader) ReadI64() int64 {
+	n := r.readVarint()
+	return int64(n>>1) ^ -int64(n&1)
+}
+
+func (r *TFastCompactReader) ReadDouble() float64 {
+	if b := r.next(8); b != nil {
+		return math.Float64frombits(binary.LittleEndian.Uint64(b))
+	}
+	return 0
+}
+
+func (r *TFastCompactReader) ReadString() string {
+	return string(r.next(r.readSize()))
+}
+
+// The bytes returned are a copy; Buf belongs to the transport.
+func (r *TFastCompactReader) ReadBinary() []byte {
+	b := r.next(r.readSize())
+	if b == nil {
+		return nil
+	}
+	return append([]byte{}, b...)
+}
+
+// Reads a struct that may not have been generated with go:fast, going
+// through a TCompactProtocol over the rest of Buf if it wasn't.
+func (r *TFastCompactReader) ReadStruct(s TStruct) {
+	if f, ok := s.(TFastStruct); ok {
+		f.FastReadCompact(r)
+		return
+	}
+	if r.err != nil {
+		return
+	}
+	buf := &TMemoryBuffer{Buffer: bytes.NewBuffer(r.Buf[r.pos:])}
+	if err := s.Read(NewTCompactProtocol(buf)); err != nil {
+		r.fail(err)
+		return
+	}
+	r.pos = len(r.Buf) - buf.Len()
+}
+
+func (r *TFastCompactReader) Skip(fieldType TType) {
+	r.skip(fieldType, MaxSkipDepth)
+}
+
+func (r *TFastCompactReader) skip(fieldType TType, maxDepth int) {
+	if maxDepth <= 0 {
+		r.fail(NewTProtocolExceptionWithType(INVALID_DATA, errors.New("depth limit exceeded")))
+		return
+	}
+	switch fieldType {
+	case BOOL:
+		r.ReadBool()
+	case BYTE:
+		r.next(1)
+	case I16, I32, I64:
+		r.readVarint()
+	case DOUBLE:
+		r.next(8)
+	case STRING:
+		r.next(r.readSize())
+	case STRUCT:
+		r.ReadStructBegin()
+		for {
+			t, _ := r.ReadFieldBegin()
+			if t == STOP {
+				break
+			}
+			r.skip(t, maxDepth-1)
+		}
+		r.ReadStructEnd()
+	case MAP:
+		k, v, size := r.ReadMapBegin()
+		for i := 0; i < size && r.err == nil; i++ {
+			r.skip(k, maxDepth-1)
+			r.skip(v, maxDepth-1)
+		}
+	case SET, LIST:
+		e, size := r.ReadListBegin()
+		for i := 0; i < size && r.err == nil; i++ {
+			r.skip(e, maxDepth-1)
+		}
+	default:
+		r.fail(NewTProtocolExceptionWithType(INVALID_DATA, fmt.Errorf("unknown type %d", fieldType)))
+	}
+}
@@ -0,0 +1,408 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+package thrift
+
+import (
+	"bytes"
+	"reflect"
+	"strings"
+	"testing"
+)
+
+// What the go:fast generator emits, written out by hand: Write goes through
+// the TProtocol only, so that the two paths can be compared.
+type fastTestStruct struct {
+	On     bool
+	Off    bool
+	B      int8
+	Short  int16
+	Int    int32
+	Long   int64
+	D      float64
+	S      string
+	Bin    []byte
+	Ints   []int32
+	Counts map[string]int64
+	Child  *fastTestStruct
+}
+
+func (p *fastTestStruct) Write(oprot TProtocol) error {
+	oprot.WriteStructBegin("fastTestStruct")
+	oprot.WriteFieldBegin("On", BOOL, 1)
+	oprot.WriteBool(p.On)
+	oprot.WriteFieldBegin("Off", BOOL, 2)
+	oprot.WriteBool(p.Off)
+	oprot.WriteFieldBegin("B", BYTE, 3)
+	oprot.WriteByte(byte(p.B))
+	oprot.WriteFieldBegin("Short", I16, 4)
+	oprot.WriteI16(p.Short)
+	oprot.WriteFieldBegin("Int", I32, 20)
+	oprot.WriteI32(p.Int)
+	oprot.WriteFieldBegin("Long", I64, 21)
+	oprot.WriteI64(p.Long)
+	oprot.WriteFieldBegin("D", DOUBLE, 22)
+	oprot.WriteDouble(p.D)
+	oprot.WriteFieldBegin("S", STRING, 23)
+	oprot.WriteString(p.S)
+	oprot.WriteFieldBegin("Bin", STRING, 24)
+	oprot.WriteBinary(p.Bin)
+	oprot.WriteFieldBegin("Ints", LIST, 25)
+	oprot.WriteListBegin(I32, len(p.Ints))
+	for _, v := range p.Ints {
+		oprot.WriteI32(v)
+	}
+	oprot.WriteFieldBegin("Counts", MAP, 26)
+	oprot.WriteMapBegin(STRING, I64, len(p.Counts))
+	for k, v := range p.Counts {
+		oprot.WriteString(k)
+		oprot.WriteI64(v)
+	}
+	if p.Child != nil {
+		oprot.WriteFieldBegin("Child", STRUCT, 27)
+		p.Child.Write(oprot)
+	}
+	oprot.WriteFieldStop()
+	return oprot.WriteStructEnd()
+}
+
+func (p *fastTestStruct) Read(iprot TProtocol) error {
+	if ok, err := FastRead(iprot, p); ok {
+		return err
+	}
+	return NewTProtocolExceptionWithType(NOT_IMPLEMENTED, nil)
+}
+
+func (p *fastTestStruct) FastWriteBinary(w *TFastBinaryWriter) {
+	w.WriteStructBegin()
+	w.WriteFieldBegin(BOOL, 1)
+	w.WriteBool(p.On)
+	w.WriteFieldBegin(BOOL, 2)
+	w.WriteBool(p.Off)
+	w.WriteFieldBegin(BYTE, 3)
+	w.WriteByte(byte(p.B))
+	w.WriteFieldBegin(I16, 4)
+	w.WriteI16(p.Short)
+	w.WriteFieldBegin(I32, 20)
+	w.WriteI32(p.Int)
+	w.WriteFieldBegin(I64, 21)
+	w.WriteI64(p.Long)
+	w.WriteFieldBegin(DOUBLE, 22)
+	w.WriteDouble(p.D)
+	w.WriteFieldBegin(STRING, 23)
+	w.WriteString(p.S)
+	w.WriteFieldBegin(STRING, 24)
+	w.WriteBinary(p.Bin)
+	w.WriteFieldBegin(LIST, 25)
+	w.WriteListBegin(I32, len(p.Ints))
+	for _, v := range p.Ints {
+		w.WriteI32(v)
+	}
+	w.WriteFieldBegin(MAP, 26)
+	w.WriteMapBegin(STRING, I64, len(p.Counts))
+	for k, v := range p.Counts {
+		w.WriteString(k)
+		w.WriteI64(v)
+	}
+	if p.Child != nil {
+		w.WriteFieldBegin(STRUCT, 27)
+		p.Child.FastWriteBinary(w)
+	}
+	w.WriteFieldStop()
+	w.WriteStructEnd()
+}
+
+func (p *fastTestStruct) FastWriteCompact(w *TFastCompactWriter) {
+	w.WriteStructBegin()
+	w.WriteFieldBegin(BOOL, 1)
+	w.WriteBool(p.On)
+	w.WriteFieldBegin(BOOL, 2)
+	w.WriteBool(p.Off)
+	w.WriteFieldBegin(BYTE, 3)
+	w.WriteByte(byte(p.B))
+	w.WriteFieldBegin(I16, 4)
+	w.WriteI16(p.Short)
+	w.WriteFieldBegin(I32, 20)
+	w.WriteI32(p.Int)
+	w.WriteFieldBegin(I64, 21)
+	w.WriteI64(p.Long)
+	w.WriteFieldBegin(DOUBLE, 22)
+	w.WriteDouble(p.D)
+	w.WriteFieldBegin(STRING, 23)
+	w.WriteString(p.S)
+	w.WriteFieldBegin(STRING, 24)
+	w.WriteBinary(p.Bin)
+	w.WriteFieldBegin(LIST, 25)
+	w.WriteListBegin(I32, len(p.Ints))
+	for _, v := range p.Ints {
+		w.WriteI32(v)
+	}
+	w.WriteFieldBegin(MAP, 26)
+	w.WriteMapBegin(STRING, I64, len(p.Counts))
+	for k, v := range p.Counts {
+		w.WriteString(k)
+		w.WriteI64(v)
+	}
+	if p.Child != nil {
+		w.WriteFieldBegin(STRUCT, 27)
+		p.Child.FastWriteCompact(w)
+	}
+	w.WriteFieldStop()
+	w.WriteStructEnd()
+}
+
+func (p *fastTestStruct) FastReadBinary(r *TFastBinaryReader) {
+	r.ReadStructBegin()
+	for {
+		fieldTypeId, fieldId := r.ReadFieldBegin()
+		if fieldTypeId == STOP {
+			break
+		}
+		switch fieldId {
+		case 1:
+			p.On = r.ReadBool()
+		case 2:
+			p.Off = r.ReadBool()
+		case 3:
+			p.B = int8(r.ReadByte())
+		case 4:
+			p.Short = r.ReadI16()
+		case 20:
+			p.Int = r.ReadI32()
+		case 21:
+			p.Long = r.ReadI64()
+		case 22:
+			p.D = r.ReadDouble()
+		case 23:
+			p.S = r.ReadString()
+		case 24:
+			p.Bin = r.ReadBinary()
+		case 25:
+			_, size := r.ReadListBegin()
+			p.Ints = make([]int32, 0, size)
+			for i := 0; i < size; i++ {
+				p.Ints = append(p.Ints, r.ReadI32())
+			}
+		case 26:
+			_, _, size := r.ReadMapBegin()
+			p.Counts = make(map[string]int64, size)
+			for i := 0; i < size; i++ {
+				k := r.ReadString()
+				p.Counts[k] = r.ReadI64()
+			}
+		case 27:
+			p.Child = &fastTestStruct{}
+			p.Child.FastReadBinary(r)
+		default:
+			r.Skip(fieldTypeId)
+		}
+	}
+	r.ReadStructEnd()
+}
+
+func (p *fastTestStruct) FastReadCompact(r *TFastCompactReader) {
+	r.ReadStructBegin()
+	for {
+		fieldTypeId, fieldId := r.ReadFieldBegin()
+		if fieldTypeId == STOP {
+			break
+		}
+		switch fieldId {
+		case 1:
+			p.On = r.ReadBool()
+		case 2:
+			p.Off = r.ReadBool()
+		case 3:
+			p.B = int8(r.ReadByte())
+		case 4:
+			p.Short = r.ReadI16()
+		case 20:
+			p.Int = r.ReadI32()
+		case 21:
+			p.Long = r.ReadI64()
+		case 22:
+			p.D = r.ReadDouble()
+		case 23:
+			p.S = r.ReadString()
+		case 24:
+			p.Bin = r.ReadBinary()
+		case 25:
+			_, size := r.ReadListBegin()
+			p.Ints = make([]int32, 0, size)
+			for i := 0; i < size; i++ {
+				p.Ints = append(p.Ints, r.ReadI32())
+			}
+		case 26:
+			_, _, size := r.ReadMapBegin()
+			p.Counts = make(map[string]int64, size)
+			for i := 0; i < size; i++ {
+				k := r.ReadString()
+				p.Counts[k] = r.ReadI64()
+			}
+		case 27:
+			p.Child = &fastTestStruct{}
+			p.Child.FastReadCompact(r)
+		default:
+			r.Skip(fieldTypeId)
+		}
+	}
+	r.ReadStructEnd()
+}
+
+// Holds only the nested struct field of fastTestStruct, so that reading a
+// fastTestStruct into it skips everything else.
+type fastTestChildOnly struct {
+	Child *fastTestStruct
+}
+
+func (p *fastTestChildOnly) Write(oprot TProtocol) error { return nil }
+func (p *fastTestChildOnly) Read(iprot TProtocol) error  { return nil }
+
+func (p *fastTestChildOnly) FastWriteBinary(w *TFastBinaryWriter)   {}
+func (p *fastTestChildOnly) FastWriteCompact(w *TFastCompactWriter) {}
+
+func (p *fastTestChildOnly) FastReadBinary(r *TFastBinaryReader) {
+	for {
+		fieldTypeId, fieldId := r.ReadFieldBegin()
+		if fieldTypeId == STOP {
+			break
+		}
+		if fieldId == 27 {
+			p.Child = &fastTestStruct{}
+			p.Child.FastReadBinary(r)
+		} else {
+			r.Skip(fieldTypeId)
+		}
+	}
+}
+
+func (p *fastTestChildOnly) FastReadCompact(r *TFastCompactReader) {
+	r.ReadStructBegin()
+	for {
+		fieldTypeId, fieldId := r.ReadFieldBegin()
+		if fieldTypeId == STOP {
+			break
+		}
+		if fieldId == 27 {
+			p.Child = &fastTestStruct{}
+			p.Child.FastReadCompact(r)
+		} else {
+			r.Skip(fieldTypeId)
+		}
+	}
+	r.ReadStructEnd()
+}
+
+func newFastTestStruct() *fastTestStruct {
+	return &fastTestStruct{
+		On:     true,
+		B:      -3,
+		Short:  -1234,
+		Int:    1 << 30,
+		Long:   -1 << 40,
+		D:      3.25,
+		S:      "hello",
+		Bin:    []byte{0, 1, 2, 0xff},
+		Ints:   []int32{1, -1, 300, 0, 1 << 20, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16},
+		Counts: map[string]int64{"a": 1},
+		Child: &fastTestStruct{
+			Off:    true,
+			S:      strings.Repeat("x", 200),
+			Bin:    []byte{},
+			Ints:   []int32{},
+			Counts: map[string]int64{},
+		},
+	}
+}
+
+func TestFastProtocolMatchesTProtocol(t *testing.T) {
+	protocols := map[string]func(TTransport) TProtocol{
+		"binary":  func(trans TTransport) TProtocol { return NewTBinaryProtocolTransport(trans) },
+		"compact": func(trans TTransport) TProtocol { return NewTCompactProtocol(trans) },
+	}
+	for name, newProtocol := range protocols {
+		s := newFastTestStruct()
+
+		slow := NewTMemoryBuffer()
+		if err := s.Write(newProtocol(slow)); err != nil {
+			t.Fatalf("%s: TProtocol write failed: %s", name, err)
+		}
+		fast := NewTMemoryBuffer()
+		if ok, err := FastWrite(newProtocol(fast), s); !ok || err != nil {
+			t.Fatalf("%s: FastWrite returned %v, %v", name, ok, err)
+		}
+		if !bytes.Equal(slow.Bytes(), fast.Bytes()) {
+			t.Fatalf("%s: fast encoding differs:\n%v\n%v", name, slow.Bytes(), fast.Bytes())
+		}
+
+		// Followed by a byte of something else, which must be left unread
+		fast.WriteByte(0x7f)
+		var got fastTestStruct
+		if err := got.Read(newProtocol(fast)); err != nil {
+			t.Fatalf("%s: fast read failed: %s", name, err)
+		}
+		if !reflect.DeepEqual(*s, got) {
+			t.Fatalf("%s: read back %+v, wrote %+v", name, got, *s)
+		}
+		if fast.Len() != 1 {
+			t.Fatalf("%s: %d bytes left after the struct, expected 1", name, fast.Len())
+		}
+
+		// Skipping everything but the nested struct
+		slow.Reset()
+		s.Write(newProtocol(slow))
+		var child fastTestChildOnly
+		if ok, err := FastRead(newProtocol(slow), &child); !ok || err != nil {
+			t.Fatalf("%s: FastRead returned %v, %v", name, ok, err)
+		}
+		if !reflect.DeepEqual(s.Child, child.Child) || slow.Len() != 0 {
+			t.Fatalf("%s: skipping fields read %+v", name, child.Child)
+		}
+	}
+}
+
+func TestFastReadFallsBack(t *testing.T) {
+	s := newFastTestStruct()
+	trans := NewTMemoryBuffer()
+	FastWrite(NewTBinaryProtocolTransport(trans), s)
+
+	// A struct cut short is left to the TProtocol, untouched
+	short := NewTMemoryBuffer()
+	short.Write(trans.Bytes()[:trans.Len()-5])
+	var got fastTestStruct
+	if ok, _ := FastRead(NewTBinaryProtocolTransport(short), &got); ok {
+		t.Fatal("FastRead decoded a truncated struct")
+	}
+	if short.Len() != trans.Len()-5 {
+		t.Fatal("FastRead consumed bytes of a truncated struct")
+	}
+
+	// As is one on a transport that doesn't buffer it
+	buffered := NewTBufferedTransport(trans, 1024)
+	if ok, _ := FastRead(NewTBinaryProtocolTransport(buffered), &got); ok {
+		t.Fatal("FastRead read from a transport it can't see into")
+	}
+
+	// A negative size is an error, not a fallback
+	bad := NewTMemoryBuffer()
+	bad.Write([]byte{STRING, 0, 23, 0xff, 0xff, 0xff, 0xff, STOP})
+	if ok, err := FastRead(NewTBinaryProtocolTransport(bad), &got); !ok || err == nil {
+		t.Fatalf("FastRead of a negative size returned %v, %v", ok, err)
+	}
+}
@@ -149,6 +149,10 @@ public class TCompactProtocol extends TProtocol {
     this(transport, -1);
   }
 
+  long getMaxNetworkBytes() {
+    return maxNetworkBytes_;
+  }
+
   @Override
   public void reset() {
     lastField_.clear();
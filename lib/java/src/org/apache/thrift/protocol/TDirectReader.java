@@ -0,0 +1,643 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+package org.apache.thrift.protocol;
+
+import java.io.UnsupportedEncodingException;
+import java.nio.ByteBuffer;
+
+import org.apache.thrift.TBase;
+import org.apache.thrift.TException;
+import org.apache.thrift.transport.TMemoryInputTransport;
+import org.apache.thrift.transport.TTransport;
+import org.apache.thrift.transport.TTransportException;
+
+/**
+ * Reads TDirectStructs straight out of the read buffer of a transport such
+ * as TFramedTransport or TMemoryInputTransport, in the binary or the compact
+ * format. Every value is decoded from the array in place, so the only
+ * objects allocated are the ones the struct itself is made of.
+ *
+ * Generated structs call read() first thing in their read(TProtocol), and
+ * go through the protocol as usual when it returns false.
+ */
+public abstract class TDirectReader {
+
+  /**
+   * Thrown when a struct runs past the end of the buffer. It is only ever
+   * caught by read(), so it is preallocated and has no stack trace.
+   */
+  private static final class Underflow extends TException {
+    private static final long serialVersionUID = 1L;
+
+    @Override
+    public synchronized Throwable fillInStackTrace() {
+      return this;
+    }
+  }
+
+  private static final Underflow UNDERFLOW = new Underflow();
+
+  private static final ThreadLocal<TDirectReader> binaryReader = new ThreadLocal<TDirectReader>() {
+    @Override
+    protected TDirectReader initialValue() {
+      return new Binary();
+    }
+  };
+
+  private static final ThreadLocal<TDirectReader> compactReader = new ThreadLocal<TDirectReader>() {
+    @Override
+    protected TDirectReader initialValue() {
+      return new Compact();
+    }
+  };
+
+  /**
+   * Reads struct from the transport buffer of iprot, provided iprot is a
+   * plain TBinaryProtocol or TCompactProtocol and the buffer holds all of
+   * the struct. Returns false otherwise, having consumed nothing, and the
+   * struct should then be read through iprot.
+   */
+  public static boolean read(TProtocol iprot, TDirectStruct struct) throws TException {
+    TDirectReader reader;
+    long maxNetworkBytes = -1;
+    Class<?> cls = iprot.getClass();
+    if (cls == TBinaryProtocol.class) {
+      reader = binaryReader.get();
+    } else if (cls == TCompactProtocol.class) {
+      reader = compactReader.get();
+      maxNetworkBytes = ((TCompactProtocol)iprot).getMaxNetworkBytes();
+    } else {
+      return false;
+    }
+
+    TTransport trans = iprot.getTransport();
+    int remaining = trans.getBytesRemainingInBuffer();
+    if (remaining <= 0) {
+      return false;
+    }
+
+    // A struct that isn't direct can still hold one that is
+    if (reader.busy_) {
+      reader = reader.create();
+    }
+
+    int start = trans.getBufferPosition();
+    reader.reset(trans.getBuffer(), start, start + remaining, maxNetworkBytes);
+    reader.busy_ = true;
+    try {
+      struct.directRead(reader);
+    } catch (Underflow e) {
+      return false;
+    } finally {
+      reader.busy_ = false;
+      reader.buf_ = null;
+    }
+    trans.consumeBuffer(reader.pos_ - start);
+    return true;
+  }
+
+  protected byte[] buf_;
+  protected int pos_;
+  protected int limit_;
+  protected long maxNetworkBytes_;
+
+  protected short fieldId_;
+  protected byte keyType_;
+  protected byte valueType_;
+  protected byte elemType_;
+
+  private boolean busy_ = false;
+
+  protected void reset(byte[] buf, int pos, int limit, long maxNetworkBytes) {
+    buf_ = buf;
+    pos_ = pos;
+    limit_ = limit;
+    maxNetworkBytes_ = maxNetworkBytes;
+  }
+
+  /**
+   * Returns a new reader for the same format.
+   */
+  protected abstract TDirectReader create();
+
+  /**
+   * Returns a protocol for the same format, for structs that can't be read
+   * directly.
+   */
+  protected abstract TProtocol newProtocol(TTransport trans);
+
+  public abstract void readStructBegin() throws TException;
+  public abstract void readStructEnd() throws TException;
+
+  /**
+   * Reads a field header and returns its type, with the field id left for
+   * fieldId().
+   */
+  public abstract byte readFieldBegin() throws TException;
+
+  public void readFieldEnd() throws TException {}
+
+  public short fieldId() {
+    return fieldId_;
+  }
+
+  /**
+   * Container headers return their size. The element types are only kept
+   * for skip().
+   */
+  public abstract int readMapBegin() throws TException;
+  public abstract int readListBegin() throws TException;
+
+  public int readSetBegin() throws TException {
+    return readListBegin();
+  }
+
+  public void readMapEnd() throws TException {}
+  public void readListEnd() throws TException {}
+  public void readSetEnd() throws TException {}
+
+  public abstract boolean readBool() throws TException;
+
+  public byte readByte() throws TException {
+    require(1);
+    return buf_[pos_++];
+  }
+
+  public abstract short readI16() throws TException;
+  public abstract int readI32() throws TException;
+  public abstract long readI64() throws TException;
+  public abstract double readDouble() throws TException;
+
+  public String readString() throws TException {
+    int size = checkSize(readBinaryLength());
+    try {
+      String str = new String(buf_, pos_, size, "UTF-8");
+      pos_ += size;
+      return str;
+    } catch (UnsupportedEncodingException e) {
+      throw new TException("UTF-8 not supported!");
+    }
+  }
+
+  public abstract ByteBuffer readBinary() throws TException;
+
+  protected abstract int readBinaryLength() throws TException;
+
+  /**
+   * Reads a nested struct, through a protocol over the rest of the buffer
+   * if it isn't a TDirectStruct.
+   */
+  public void readStruct(TBase<?, ?> struct) throws TException {
+    if (struct instanceof TDirectStruct) {
+      ((TDirectStruct)struct).directRead(this);
+      return;
+    }
+    TMemoryInputTransport trans = new TMemoryInputTransport(buf_, pos_, limit_ - pos_);
+    try {
+      struct.read(newProtocol(trans));
+    } catch (TTransportException e) {
+      throw UNDERFLOW;
+    }
+    pos_ = trans.getBufferPosition();
+  }
+
+  /**
+   * Skips over a value of the given type, like TProtocolUtil.skip.
+   */
+  public void skip(byte type) throws TException {
+    skip(type, TProtocolUtil.getMaxSkipDepth());
+  }
+
+  private void skip(byte type, int maxDepth) throws TException {
+    if (maxDepth <= 0) {
+      throw new TException("Maximum skip depth exceeded");
+    }
+    switch (type) {
+      case TType.BOOL:
+        readBool();
+        break;
+
+      case TType.BYTE:
+        readByte();
+        break;
+
+      case TType.I16:
+        readI16();
+        break;
+
+      case TType.I32:
+        readI32();
+        break;
+
+      case TType.I64:
+        readI64();
+        break;
+
+      case TType.DOUBLE:
+        readDouble();
+        break;
+
+      case TType.STRING:
+        pos_ += checkSize(readBinaryLength());
+        break;
+
+      case TType.STRUCT:
+        readStructBegin();
+        while (true) {
+          byte fieldType = readFieldBegin();
+          if (fieldType == TType.STOP) {
+            break;
+          }
+          skip(fieldType, maxDepth - 1);
+        }
+        readStructEnd();
+        break;
+
+      case TType.MAP: {
+        int size = readMapBegin();
+        byte keyType = keyType_;
+        byte valueType = valueType_;
+        for (int i = 0; i < size; i++) {
+          skip(keyType, maxDepth - 1);
+          skip(valueType, maxDepth - 1);
+        }
+        break;
+      }
+
+      case TType.SET:
+      case TType.LIST: {
+        int size = readListBegin();
+        byte elemType = elemType_;
+        for (int i = 0; i < size; i++) {
+          skip(elemType, maxDepth - 1);
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  protected final void require(int n) throws TException {
+    if (limit_ - pos_ < n) {
+      throw UNDERFLOW;
+    }
+  }
+
+  /**
+   * Checks a string or container size read off the wire. Every element
+   * takes at least one byte, so a size larger than what is left of the
+   * buffer can't be read from it.
+   */
+  protected final int checkSize(int size) throws TException {
+    if (size < 0) {
+      throw new TProtocolException(TProtocolException.NEGATIVE_SIZE, "Negative length: " + size);
+    }
+    if (size > limit_ - pos_) {
+      throw UNDERFLOW;
+    }
+    return size;
+  }
+
+  private static final class Binary extends TDirectReader {
+
+    @Override
+    protected TDirectReader create() {
+      return new Binary();
+    }
+
+    @Override
+    protected TProtocol newProtocol(TTransport trans) {
+      return new TBinaryProtocol(trans);
+    }
+
+    @Override
+    public void readStructBegin() {}
+
+    @Override
+    public void readStructEnd() {}
+
+    @Override
+    public byte readFieldBegin() throws TException {
+      byte type = readByte();
+      if (type != TType.STOP) {
+        fieldId_ = readI16();
+      }
+      return type;
+    }
+
+    @Override
+    public int readMapBegin() throws TException {
+      require(2);
+      keyType_ = buf_[pos_++];
+      valueType_ = buf_[pos_++];
+      return checkSize(readI32());
+    }
+
+    @Override
+    public int readListBegin() throws TException {
+      elemType_ = readByte();
+      return checkSize(readI32());
+    }
+
+    @Override
+    public boolean readBool() throws TException {
+      return readByte() == 1;
+    }
+
+    @Override
+    public short readI16() throws TException {
+      require(2);
+      byte[] buf = buf_;
+      int off = pos_;
+      pos_ += 2;
+      return (short)(((buf[off] & 0xff) << 8) | (buf[off+1] & 0xff));
+    }
+
+    @Override
+    public int readI32() throws TException {
+      require(4);
+      byte[] buf = buf_;
+      int off = pos_;
+      pos_ += 4;
+      return ((buf[off] & 0xff) << 24) |
+        ((buf[off+1] & 0xff) << 16) |
+        ((buf[off+2] & 0xff) <<  8) |
+        ((buf[off+3] & 0xff));
+    }
+
+    @Override
+    public long readI64() throws TException {
+      require(8);
+      byte[] buf = buf_;
+      int off = pos_;
+      pos_ += 8;
+      return ((long)(buf[off] & 0xff) << 56) |
+        ((long)(buf[off+1] & 0xff) << 48) |
+        ((long)(buf[off+2] & 0xff) << 40) |
+        ((long)(buf[off+3] & 0xff) << 32) |
+        ((long)(buf[off+4] & 0xff) << 24) |
+        ((long)(buf[off+5] & 0xff) << 16) |
+        ((long)(buf[off+6] & 0xff) <<  8) |
+        ((long)(buf[off+7] & 0xff));
+    }
+
+    @Override
+    public double readDouble() throws TException {
+      return Double.longBitsToDouble(readI64());
+    }
+
+    /**
+     * Like TBinaryProtocol, hands back a view of the buffer rather than a
+     * copy.
+     */
+    @Override
+    public ByteBuffer readBinary() throws TException {
+      int size = checkSize(readI32());
+      ByteBuffer bb = ByteBuffer.wrap(buf_, pos_, size);
+      pos_ += size;
+      return bb;
+    }
+
+    @Override
+    protected int readBinaryLength() throws TException {
+      return readI32();
+    }
+  }
+
+  private static final class Compact extends TDirectReader {
+
+    private static final byte[] compactTypeToTType = new byte[] {
+      TType.STOP,
+      TType.BOOL,   // BOOLEAN_TRUE
+      TType.BOOL,   // BOOLEAN_FALSE
+      TType.BYTE,
+      TType.I16,
+      TType.I32,
+      TType.I64,
+      TType.DOUBLE,
+      TType.STRING, // BINARY
+      TType.LIST,
+      TType.SET,
+      TType.MAP,
+      TType.STRUCT
+    };
+
+    private static final byte BOOLEAN_TRUE = 0x01;
+    private static final byte BOOLEAN_FALSE = 0x02;
+
+    private short lastFieldId_ = 0;
+    private short[] lastFieldStack_ = new short[16];
+    private int lastFieldDepth_ = 0;
+
+    // The value of a boolean field, carried in its header: 1, 0, or -1 when
+    // the last header wasn't a boolean field
+    private int boolValue_ = -1;
+
+    @Override
+    protected void reset(byte[] buf, int pos, int limit, long maxNetworkBytes) {
+      super.reset(buf, pos, limit, maxNetworkBytes);
+      lastFieldId_ = 0;
+      lastFieldDepth_ = 0;
+      boolValue_ = -1;
+    }
+
+    @Override
+    protected TDirectReader create() {
+      return new Compact();
+    }
+
+    @Override
+    protected TProtocol newProtocol(TTransport trans) {
+      return new TCompactProtocol(trans, maxNetworkBytes_);
+    }
+
+    @Override
+    public void readStructBegin() {
+      if (lastFieldDepth_ == lastFieldStack_.length) {
+        short[] stack = new short[lastFieldStack_.length * 2];
+        System.arraycopy(lastFieldStack_, 0, stack, 0, lastFieldDepth_);
+        lastFieldStack_ = stack;
+      }
+      lastFieldStack_[lastFieldDepth_++] = lastFieldId_;
+      lastFieldId_ = 0;
+    }
+
+    @Override
+    public void readStructEnd() {
+      lastFieldId_ = lastFieldStack_[--lastFieldDepth_];
+    }
+
+    @Override
+    public byte readFieldBegin() throws TException {
+      byte header = readByte();
+      if (header == TType.STOP) {
+        return TType.STOP;
+      }
+
+      // the 4 MSB of the header hold the field id delta, if there is one
+      int modifier = (header & 0xf0) >> 4;
+      if (modifier == 0) {
+        fieldId_ = readI16();
+      } else {
+        fieldId_ = (short)(lastFieldId_ + modifier);
+      }
+      lastFieldId_ = fieldId_;
+
+      byte compactType = (byte)(header & 0x0f);
+      if (compactType == BOOLEAN_TRUE) {
+        boolValue_ = 1;
+      } else if (compactType == BOOLEAN_FALSE) {
+        boolValue_ = 0;
+      }
+      return getTType(compactType);
+    }
+
+    @Override
+    public int readMapBegin() throws TException {
+      int size = readVarint32();
+      if (size == 0) {
+        keyType_ = TType.STOP;
+        valueType_ = TType.STOP;
+        return 0;
+      }
+      byte keyAndValueType = readByte();
+      keyType_ = getTType((byte)((keyAndValueType >> 4) & 0x0f));
+      valueType_ = getTType((byte)(keyAndValueType & 0x0f));
+      return checkSize(size);
+    }
+
+    @Override
+    public int readListBegin() throws TException {
+      byte sizeAndType = readByte();
+      int size = (sizeAndType >> 4) & 0x0f;
+      if (size == 15) {
+        size = readVarint32();
+      }
+      elemType_ = getTType((byte)(sizeAndType & 0x0f));
+      return checkSize(size);
+    }
+
+    @Override
+    public boolean readBool() throws TException {
+      if (boolValue_ != -1) {
+        boolean result = boolValue_ == 1;
+        boolValue_ = -1;
+        return result;
+      }
+      return readByte() == BOOLEAN_TRUE;
+    }
+
+    @Override
+    public short readI16() throws TException {
+      return (short)zigzagToInt(readVarint32());
+    }
+
+    @Override
+    public int readI32() throws TException {
+      return zigzagToInt(readVarint32());
+    }
+
+    @Override
+    public long readI64() throws TException {
+      long n = readVarint64();
+      return (n >>> 1) ^ -(n & 1);
+    }
+
+    @Override
+    public double readDouble() throws TException {
+      require(8);
+      byte[] buf = buf_;
+      int off = pos_;
+      pos_ += 8;
+      return Double.longBitsToDouble(
+        ((long)(buf[off+7] & 0xff) << 56) |
+        ((long)(buf[off+6] & 0xff) << 48) |
+        ((long)(buf[off+5] & 0xff) << 40) |
+        ((long)(buf[off+4] & 0xff) << 32) |
+        ((long)(buf[off+3] & 0xff) << 24) |
+        ((long)(buf[off+2] & 0xff) << 16) |
+        ((long)(buf[off+1] & 0xff) <<  8) |
+        ((long)(buf[off] & 0xff)));
+    }
+
+    /**
+     * Like TCompactProtocol, hands back a copy of the bytes.
+     */
+    @Override
+    public ByteBuffer readBinary() throws TException {
+      int size = checkSize(readBinaryLength());
+      byte[] bytes = new byte[size];
+      System.arraycopy(buf_, pos_, bytes, 0, size);
+      pos_ += size;
+      return ByteBuffer.wrap(bytes);
+    }
+
+    @Override
+    protected int readBinaryLength() throws TException {
+      int length = readVarint32();
+      if (length < 0) {
+        throw new TProtocolException("Negative length: " + length);
+      }
+      if (maxNetworkBytes_ != -1 && length > maxNetworkBytes_) {
+        throw new TProtocolException("Length exceeded max allowed: " + length);
+      }
+      return length;
+    }
+
+    private int readVarint32() throws TException {
+      int result = 0;
+      int shift = 0;
+      while (true) {
+        byte b = readByte();
+        result |= (int)(b & 0x7f) << shift;
+        if ((b & 0x80) != 0x80) {
+          return result;
+        }
+        shift += 7;
+      }
+    }
+
+    private long readVarint64() throws TException {
+      long result = 0;
+      int shift = 0;
+      while (true) {
+        byte b = readByte();
+        result |= (long)(b & 0x7f) << shift;
+        if ((b & 0x80) != 0x80) {
+          return result;
+        }
+        shift += 7;
+      }
+    }
+
+    private static int zigzagToInt(int n) {
+      return (n >>> 1) ^ -(n & 1);
+    }
+
+    private static byte getTType(byte compactType) throws TProtocolException {
+      if (compactType < 0 || compactType >= compactTypeToTType.length) {
+        throw new TProtocolException("don't know what type: " + compactType);
+      }
+      return compactTypeToTType[compactType];
+    }
+  }
+}
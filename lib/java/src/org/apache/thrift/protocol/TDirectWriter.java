@@ -0,0 +1,525 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+package org.apache.thrift.protocol;
+
+import java.nio.ByteBuffer;
+
+import org.apache.thrift.TBase;
+import org.apache.thrift.TException;
+import org.apache.thrift.transport.TTransport;
+
+/**
+ * Writes TDirectStructs into a byte array in the binary or the compact
+ * format, then hands the whole struct to the transport in a single write.
+ * Strings are encoded straight into the array, so nothing is allocated
+ * once the array has grown to fit.
+ *
+ * Generated structs call write() first thing in their write(TProtocol), and
+ * go through the protocol as usual when it returns false.
+ */
+public abstract class TDirectWriter {
+
+  private static final int INITIAL_BUFFER_SIZE = 1024;
+
+  /**
+   * Buffers that grew past this for an unusually large struct are dropped
+   * afterwards rather than held on to by the thread.
+   */
+  private static final int MAX_RETAINED_BUFFER_SIZE = 64 * 1024;
+
+  private static final ThreadLocal<TDirectWriter> binaryWriter = new ThreadLocal<TDirectWriter>() {
+    @Override
+    protected TDirectWriter initialValue() {
+      return new Binary();
+    }
+  };
+
+  private static final ThreadLocal<TDirectWriter> compactWriter = new ThreadLocal<TDirectWriter>() {
+    @Override
+    protected TDirectWriter initialValue() {
+      return new Compact();
+    }
+  };
+
+  /**
+   * Writes struct to the transport of oprot, provided oprot is a plain
+   * TBinaryProtocol or TCompactProtocol. Returns false otherwise, and the
+   * struct should then be written through oprot.
+   */
+  public static boolean write(TProtocol oprot, TDirectStruct struct) throws TException {
+    TDirectWriter writer;
+    Class<?> cls = oprot.getClass();
+    if (cls == TBinaryProtocol.class) {
+      writer = binaryWriter.get();
+    } else if (cls == TCompactProtocol.class) {
+      writer = compactWriter.get();
+    } else {
+      return false;
+    }
+
+    // A struct that isn't direct can still hold one that is
+    if (writer.busy_) {
+      writer = writer.create();
+    }
+
+    writer.reset();
+    writer.busy_ = true;
+    try {
+      struct.directWrite(writer);
+      oprot.getTransport().write(writer.buf_, 0, writer.len_);
+    } finally {
+      writer.busy_ = false;
+      if (writer.buf_.length > MAX_RETAINED_BUFFER_SIZE) {
+        writer.buf_ = new byte[INITIAL_BUFFER_SIZE];
+      }
+    }
+    return true;
+  }
+
+  protected byte[] buf_ = new byte[INITIAL_BUFFER_SIZE];
+  protected int len_ = 0;
+
+  private boolean busy_ = false;
+  private Sink sink_ = null;
+
+  protected void reset() {
+    len_ = 0;
+  }
+
+  /**
+   * Returns a new writer for the same format.
+   */
+  protected abstract TDirectWriter create();
+
+  /**
+   * Returns a protocol for the same format, for structs that can't be
+   * written directly.
+   */
+  protected abstract TProtocol newProtocol(TTransport trans);
+
+  public abstract void writeStructBegin(TStruct struct) throws TException;
+  public abstract void writeStructEnd() throws TException;
+  public abstract void writeFieldBegin(TField field) throws TException;
+
+  public void writeFieldEnd() throws TException {}
+
+  public void writeFieldStop() throws TException {
+    writeByte(TType.STOP);
+  }
+
+  public abstract void writeMapBegin(byte keyType, byte valueType, int size) throws TException;
+  public abstract void writeListBegin(byte elemType, int size) throws TException;
+
+  public void writeSetBegin(byte elemType, int size) throws TException {
+    writeListBegin(elemType, size);
+  }
+
+  public void writeMapEnd() throws TException {}
+  public void writeListEnd() throws TException {}
+  public void writeSetEnd() throws TException {}
+
+  public abstract void writeBool(boolean b) throws TException;
+
+  public void writeByte(byte b) throws TException {
+    ensure(1);
+    buf_[len_++] = b;
+  }
+
+  public abstract void writeI16(short i16) throws TException;
+  public abstract void writeI32(int i32) throws TException;
+  public abstract void writeI64(long i64) throws TException;
+  public abstract void writeDouble(double dub) throws TException;
+
+  /**
+   * Writes str as UTF-8, encoding it the way String.getBytes("UTF-8")
+   * would, unpaired surrogates included.
+   */
+  public void writeString(String str) throws TException {
+    int n = str.length();
+    int size = n;
+    for (int i = 0; i < n; i++) {
+      char c = str.charAt(i);
+      if (c < 0x80) {
+        continue;
+      } else if (c < 0x800) {
+        size += 1;
+      } else if (Character.isHighSurrogate(c) && i + 1 < n && Character.isLowSurrogate(str.charAt(i + 1))) {
+        size += 2;
+        i++;
+      } else if (c < Character.MIN_SURROGATE || c > Character.MAX_SURROGATE) {
+        size += 2;
+      }
+    }
+
+    writeBinaryLength(size);
+    ensure(size);
+    byte[] buf = buf_;
+    int off = len_;
+    for (int i = 0; i < n; i++) {
+      char c = str.charAt(i);
+      if (c < 0x80) {
+        buf[off++] = (byte)c;
+      } else if (c < 0x800) {
+        buf[off++] = (byte)(0xc0 | (c >> 6));
+        buf[off++] = (byte)(0x80 | (c & 0x3f));
+      } else if (Character.isHighSurrogate(c) && i + 1 < n && Character.isLowSurrogate(str.charAt(i + 1))) {
+        int cp = Character.toCodePoint(c, str.charAt(++i));
+        buf[off++] = (byte)(0xf0 | (cp >> 18));
+        buf[off++] = (byte)(0x80 | ((cp >> 12) & 0x3f));
+        buf[off++] = (byte)(0x80 | ((cp >> 6) & 0x3f));
+        buf[off++] = (byte)(0x80 | (cp & 0x3f));
+      } else if (c < Character.MIN_SURROGATE || c > Character.MAX_SURROGATE) {
+        buf[off++] = (byte)(0xe0 | (c >> 12));
+        buf[off++] = (byte)(0x80 | ((c >> 6) & 0x3f));
+        buf[off++] = (byte)(0x80 | (c & 0x3f));
+      } else {
+        buf[off++] = (byte)'?';
+      }
+    }
+    len_ = off;
+  }
+
+  public void writeBinary(ByteBuffer bin) throws TException {
+    int length = bin.limit() - bin.position();
+    writeBinaryLength(length);
+    ensure(length);
+    System.arraycopy(bin.array(), bin.position() + bin.arrayOffset(), buf_, len_, length);
+    len_ += length;
+  }
+
+  protected abstract void writeBinaryLength(int length) throws TException;
+
+  /**
+   * Writes a nested struct, through a protocol over the buffer if it isn't
+   * a TDirectStruct.
+   */
+  public void writeStruct(TBase<?, ?> struct) throws TException {
+    if (struct instanceof TDirectStruct) {
+      ((TDirectStruct)struct).directWrite(this);
+      return;
+    }
+    if (sink_ == null) {
+      sink_ = new Sink();
+    }
+    struct.write(newProtocol(sink_));
+  }
+
+  protected final void ensure(int n) {
+    if (len_ + n > buf_.length) {
+      byte[] buf = new byte[Math.max(buf_.length * 2, len_ + n)];
+      System.arraycopy(buf_, 0, buf, 0, len_);
+      buf_ = buf;
+    }
+  }
+
+  /**
+   * Appends whatever is written to it to the buffer.
+   */
+  private final class Sink extends TTransport {
+    @Override
+    public boolean isOpen() {
+      return true;
+    }
+
+    @Override
+    public void open() {}
+
+    @Override
+    public void close() {}
+
+    @Override
+    public int read(byte[] buf, int off, int len) {
+      throw new UnsupportedOperationException("No reading allowed!");
+    }
+
+    @Override
+    public void write(byte[] buf, int off, int len) {
+      ensure(len);
+      System.arraycopy(buf, off, buf_, len_, len);
+      len_ += len;
+    }
+  }
+
+  private static final class Binary extends TDirectWriter {
+
+    @Override
+    protected TDirectWriter create() {
+      return new Binary();
+    }
+
+    @Override
+    protected TProtocol newProtocol(TTransport trans) {
+      return new TBinaryProtocol(trans);
+    }
+
+    @Override
+    public void writeStructBegin(TStruct struct) {}
+
+    @Override
+    public void writeStructEnd() {}
+
+    @Override
+    public void writeFieldBegin(TField field) throws TException {
+      writeByte(field.type);
+      writeI16(field.id);
+    }
+
+    @Override
+    public void writeMapBegin(byte keyType, byte valueType, int size) throws TException {
+      writeByte(keyType);
+      writeByte(valueType);
+      writeI32(size);
+    }
+
+    @Override
+    public void writeListBegin(byte elemType, int size) throws TException {
+      writeByte(elemType);
+      writeI32(size);
+    }
+
+    @Override
+    public void writeBool(boolean b) throws TException {
+      writeByte(b ? (byte)1 : (byte)0);
+    }
+
+    @Override
+    public void writeI16(short i16) {
+      ensure(2);
+      byte[] buf = buf_;
+      int off = len_;
+      buf[off] = (byte)(0xff & (i16 >> 8));
+      buf[off+1] = (byte)(0xff & (i16));
+      len_ += 2;
+    }
+
+    @Override
+    public void writeI32(int i32) {
+      ensure(4);
+      byte[] buf = buf_;
+      int off = len_;
+      buf[off] = (byte)(0xff & (i32 >> 24));
+      buf[off+1] = (byte)(0xff & (i32 >> 16));
+      buf[off+2] = (byte)(0xff & (i32 >> 8));
+      buf[off+3] = (byte)(0xff & (i32));
+      len_ += 4;
+    }
+
+    @Override
+    public void writeI64(long i64) {
+      ensure(8);
+      byte[] buf = buf_;
+      int off = len_;
+      buf[off] = (byte)(0xff & (i64 >> 56));
+      buf[off+1] = (byte)(0xff & (i64 >> 48));
+      buf[off+2] = (byte)(0xff & (i64 >> 40));
+      buf[off+3] = (byte)(0xff & (i64 >> 32));
+      buf[off+4] = (byte)(0xff & (i64 >> 24));
+      buf[off+5] = (byte)(0xff & (i64 >> 16));
+      buf[off+6] = (byte)(0xff & (i64 >> 8));
+      buf[off+7] = (byte)(0xff & (i64));
+      len_ += 8;
+    }
+
+    @Override
+    public void writeDouble(double dub) {
+      writeI64(Double.doubleToLongBits(dub));
+    }
+
+    @Override
+    protected void writeBinaryLength(int length) {
+      writeI32(length);
+    }
+  }
+
+  private static final class Compact extends TDirectWriter {
+
+    private static final byte[] ttypeToCompactType = new byte[16];
+
+    static {
+      ttypeToCompactType[TType.STOP] = TType.STOP;
+      ttypeToCompactType[TType.BOOL] = 0x01;
+      ttypeToCompactType[TType.BYTE] = 0x03;
+      ttypeToCompactType[TType.I16] = 0x04;
+      ttypeToCompactType[TType.I32] = 0x05;
+      ttypeToCompactType[TType.I64] = 0x06;
+      ttypeToCompactType[TType.DOUBLE] = 0x07;
+      ttypeToCompactType[TType.STRING] = 0x08;
+      ttypeToCompactType[TType.LIST] = 0x09;
+      ttypeToCompactType[TType.SET] = 0x0A;
+      ttypeToCompactType[TType.MAP] = 0x0B;
+      ttypeToCompactType[TType.STRUCT] = 0x0C;
+    }
+
+    private static final byte BOOLEAN_TRUE = 0x01;
+    private static final byte BOOLEAN_FALSE = 0x02;
+
+    private short lastFieldId_ = 0;
+    private short[] lastFieldStack_ = new short[16];
+    private int lastFieldDepth_ = 0;
+
+    // A boolean field's header also carries its value, so it is held back
+    // until writeBool
+    private boolean boolFieldPending_ = false;
+    private short boolFieldId_ = 0;
+
+    @Override
+    protected void reset() {
+      super.reset();
+      lastFieldId_ = 0;
+      lastFieldDepth_ = 0;
+      boolFieldPending_ = false;
+    }
+
+    @Override
+    protected TDirectWriter create() {
+      return new Compact();
+    }
+
+    @Override
+    protected TProtocol newProtocol(TTransport trans) {
+      return new TCompactProtocol(trans);
+    }
+
+    @Override
+    public void writeStructBegin(TStruct struct) {
+      if (lastFieldDepth_ == lastFieldStack_.length) {
+        short[] stack = new short[lastFieldStack_.length * 2];
+        System.arraycopy(lastFieldStack_, 0, stack, 0, lastFieldDepth_);
+        lastFieldStack_ = stack;
+      }
+      lastFieldStack_[lastFieldDepth_++] = lastFieldId_;
+      lastFieldId_ = 0;
+    }
+
+    @Override
+    public void writeStructEnd() {
+      lastFieldId_ = lastFieldStack_[--lastFieldDepth_];
+    }
+
+    @Override
+    public void writeFieldBegin(TField field) throws TException {
+      if (field.type == TType.BOOL) {
+        boolFieldPending_ = true;
+        boolFieldId_ = field.id;
+      } else {
+        writeFieldHeader(ttypeToCompactType[field.type], field.id);
+      }
+    }
+
+    private void writeFieldHeader(byte compactType, short id) throws TException {
+      if (id > lastFieldId_ && id - lastFieldId_ <= 15) {
+        writeByte((byte)((id - lastFieldId_) << 4 | compactType));
+      } else {
+        writeByte(compactType);
+        writeI16(id);
+      }
+      lastFieldId_ = id;
+    }
+
+    @Override
+    public void writeMapBegin(byte keyType, byte valueType, int size) throws TException {
+      if (size == 0) {
+        writeByte((byte)0);
+      } else {
+        writeVarint32(size);
+        writeByte((byte)(ttypeToCompactType[keyType] << 4 | ttypeToCompactType[valueType]));
+      }
+    }
+
+    @Override
+    public void writeListBegin(byte elemType, int size) throws TException {
+      if (size <= 14) {
+        writeByte((byte)(size << 4 | ttypeToCompactType[elemType]));
+      } else {
+        writeByte((byte)(0xf0 | ttypeToCompactType[elemType]));
+        writeVarint32(size);
+      }
+    }
+
+    @Override
+    public void writeBool(boolean b) throws TException {
+      byte value = b ? BOOLEAN_TRUE : BOOLEAN_FALSE;
+      if (boolFieldPending_) {
+        boolFieldPending_ = false;
+        writeFieldHeader(value, boolFieldId_);
+      } else {
+        writeByte(value);
+      }
+    }
+
+    @Override
+    public void writeI16(short i16) {
+      writeVarint32((i16 << 1) ^ (i16 >> 31));
+    }
+
+    @Override
+    public void writeI32(int i32) {
+      writeVarint32((i32 << 1) ^ (i32 >> 31));
+    }
+
+    @Override
+    public void writeI64(long i64) {
+      long n = (i64 << 1) ^ (i64 >> 63);
+      ensure(10);
+      byte[] buf = buf_;
+      int off = len_;
+      while ((n & ~0x7FL) != 0) {
+        buf[off++] = (byte)((n & 0x7f) | 0x80);
+        n >>>= 7;
+      }
+      buf[off++] = (byte)n;
+      len_ = off;
+    }
+
+    @Override
+    public void writeDouble(double dub) {
+      long n = Double.doubleToLongBits(dub);
+      ensure(8);
+      byte[] buf = buf_;
+      int off = len_;
+      buf[off] = (byte)(n & 0xff);
+      buf[off+1] = (byte)((n >> 8) & 0xff);
+      buf[off+2] = (byte)((n >> 16) & 0xff);
+      buf[off+3] = (byte)((n >> 24) & 0xff);
+      buf[off+4] = (byte)((n >> 32) & 0xff);
+      buf[off+5] = (byte)((n >> 40) & 0xff);
+      buf[off+6] = (byte)((n >> 48) & 0xff);
+      buf[off+7] = (byte)((n >> 56) & 0xff);
+      len_ += 8;
+    }
+
+    @Override
+    protected void writeBinaryLength(int length) {
+      writeVarint32(length);
+    }
+
+    private void writeVarint32(int n) {
+      ensure(5);
+      byte[] buf = buf_;
+      int off = len_;
+      while ((n & ~0x7F) != 0) {
+        buf[off++] = (byte)((n & 0x7f) | 0x80);
+        n >>>= 7;
+      }
+      buf[off++] = (byte)n;
+      len_ = off;
+    }
+  }
+}
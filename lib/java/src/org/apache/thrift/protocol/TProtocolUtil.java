@@ -60,6 +60,10 @@ public class TProtocolUtil {
     skip(prot, type, maxSkipDepth);
   }
 
+  static int getMaxSkipDepth() {
+    return maxSkipDepth;
+  }
+
   /**
    * Skips over the next data element from the provided input TProtocol object.
    *
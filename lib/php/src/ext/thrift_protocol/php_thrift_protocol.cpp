@@ -34,7 +34,11 @@ typedef unsigned long long   uint64_t;
 #else
 #include <arpa/inet.h> 
 #endif
+#include <algorithm>
+#include <map>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 #ifndef bswap_64
 #define	bswap_64(x)     (((uint64_t)(x) << 56) | \
@@ -50,9 +54,13 @@ typedef unsigned long long   uint64_t;
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 #define htonll(x) bswap_64(x)
 #define ntohll(x) bswap_64(x)
+#define htolell(x) x
+#define letohll(x) x
 #elif __BYTE_ORDER == __BIG_ENDIAN
 #define htonll(x) x
 #define ntohll(x) x
+#define htolell(x) bswap_64(x)
+#define letohll(x) bswap_64(x)
 #else
 #error Unknown __BYTE_ORDER
 #endif
@@ -82,8 +90,29 @@ enum TType {
   T_UTF16      = 17
 };
 
+// Stolen out of TCompactProtocol.tcc, as TType is out of TProtocol.h
+enum CType {
+  CT_STOP           = 0x00,
+  CT_BOOLEAN_TRUE   = 0x01,
+  CT_BOOLEAN_FALSE  = 0x02,
+  CT_BYTE           = 0x03,
+  CT_I16            = 0x04,
+  CT_I32            = 0x05,
+  CT_I64            = 0x06,
+  CT_DOUBLE         = 0x07,
+  CT_BINARY         = 0x08,
+  CT_LIST           = 0x09,
+  CT_SET            = 0x0A,
+  CT_MAP            = 0x0B,
+  CT_STRUCT         = 0x0C
+};
+
 const int32_t VERSION_MASK = 0xffff0000;
 const int32_t VERSION_1 = 0x80010000;
+const uint8_t COMPACT_PROTOCOL_ID = 0x82;
+const uint8_t COMPACT_VERSION = 1;
+const uint8_t COMPACT_VERSION_MASK = 0x1f;
+const int COMPACT_TYPE_SHIFT_AMOUNT = 5;
 const int8_t T_CALL = 1;
 const int8_t T_REPLY = 2;
 const int8_t T_EXCEPTION = 3;
@@ -99,6 +128,8 @@ const int BAD_VERSION = 4;
 static zend_function_entry thrift_protocol_functions[] = {
   PHP_FE(thrift_protocol_write_binary, NULL)
   PHP_FE(thrift_protocol_read_binary, NULL)
+  PHP_FE(thrift_protocol_write_compact, NULL)
+  PHP_FE(thrift_protocol_read_compact, NULL)
   {NULL, NULL, NULL}
 } ;
 
@@ -132,10 +163,50 @@ protected:
   char _what[40];
 } ;
 
+// One field of a struct's _TSPEC, with the "var" and "type" lookups done.
+struct FieldSpec {
+  int16_t fieldno;
+  int8_t ttype;
+  char* varname;
+  size_t varname_len;
+  HashTable* spec;
+};
+
+// A struct's _TSPEC flattened into its fields, in _TSPEC order.
+struct StructSpec {
+  zend_class_entry* ce;
+  std::vector<FieldSpec> fields;
+  std::vector<std::pair<int16_t, size_t> > by_fieldno; // sorted
+
+  const FieldSpec* find(int16_t fieldno) const {
+    std::vector<std::pair<int16_t, size_t> >::const_iterator it =
+      std::lower_bound(by_fieldno.begin(), by_fieldno.end(), std::make_pair(fieldno, (size_t)0));
+    if (it == by_fieldno.end() || it->first != fieldno) {
+      return NULL;
+    }
+    return &fields[it->second];
+  }
+};
+
+// Class entries and struct specs resolved during one extension call, so
+// that a list of thousands of structs looks each up once instead of once
+// per element. Nothing is kept across calls.
+class SpecCache {
+public:
+  // The class named by a field spec's "class" entry, NULL if it doesn't exist
+  zend_class_entry* classOf(HashTable* fieldspec);
+  // The flattened _TSPEC of a class, NULL if it doesn't have one
+  const StructSpec* specOf(zend_class_entry* ce);
+private:
+  std::map<HashTable*, zend_class_entry*> classes;
+  std::map<zend_class_entry*, StructSpec> specs;
+};
+
 class PHPTransport {
 public:
   zval* protocol() { return p; }
   zval* transport() { return t; }
+  SpecCache specs;
 protected:
   PHPTransport() {}
 
@@ -169,6 +240,8 @@ protected:
 };
 
 
+// Holds a whole message, growing as needed, and hands it to the
+// transport's write() in one call on flush().
 class PHPOutputTransport : public PHPTransport {
 public:
   PHPOutputTransport(zval* _p, size_t _buffer_size = 8192) {
@@ -181,15 +254,11 @@ public:
 
   void write(const char* data, size_t len) {
     if ((len + buffer_used) > buffer_size) {
-      internalFlush();
-    }
-    if (len > buffer_size) {
-      directWrite(data, len);
-    } else {
-      memcpy(buffer_ptr, data, len);
-      buffer_used += len;
-      buffer_ptr += len;
+      grow(len + buffer_used);
     }
+    memcpy(buffer_ptr, data, len);
+    buffer_used += len;
+    buffer_ptr += len;
   }
 
   void writeI64(int64_t i) {
@@ -221,12 +290,32 @@ public:
     write(str, len);
   }
 
+  void writeVarint(uint64_t n) {
+    char buf[10];
+    size_t len = 0;
+    while (n & ~(uint64_t)0x7f) {
+      buf[len++] = (char)((n & 0x7f) | 0x80);
+      n >>= 7;
+    }
+    buf[len++] = (char)n;
+    write(buf, len);
+  }
+
   void flush() {
     internalFlush();
     directFlush();
   }
 
 protected:
+  void grow(size_t needed) {
+    size_t new_size = buffer_size * 2;
+    if (new_size < needed) {
+      new_size = needed;
+    }
+    buffer = reinterpret_cast<char*>(erealloc(buffer, new_size));
+    buffer_ptr = buffer + buffer_used;
+    buffer_size = new_size;
+  }
   void internalFlush() {
      if (buffer_used) {
       directWrite(buffer, buffer_used);
@@ -353,6 +442,19 @@ public:
     return (int32_t)ntohl(c);
   }
 
+  uint64_t readVarint() {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte;
+      readBytes(&byte, 1);
+      result |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return result;
+      }
+    }
+    throw std::runtime_error("Variable-length int over 10 bytes");
+  }
+
 protected:
   void refill() {
     assert(buffer_used == 0);
@@ -387,28 +489,43 @@ protected:
 
 };
 
-void binary_deserialize_spec(zval* zthis, PHPInputTransport& transport, HashTable* spec);
-void binary_serialize_spec(zval* zthis, PHPOutputTransport& transport, HashTable* spec);
+void binary_deserialize_spec(zval* zthis, PHPInputTransport& transport, const StructSpec& spec);
+void binary_serialize_spec(zval* zthis, PHPOutputTransport& transport, const StructSpec& spec);
 void binary_serialize(int8_t thrift_typeID, PHPOutputTransport& transport, zval** value, HashTable* fieldspec);
 void skip_element(long thrift_typeID, PHPInputTransport& transport);
-void protocol_writeMessageBegin(zval *transport, const char* method_name, int32_t msgtype, int32_t seqID);
+void compact_deserialize_spec(zval* zthis, PHPInputTransport& transport, const StructSpec& spec);
+void compact_serialize_spec(zval* zthis, PHPOutputTransport& transport, const StructSpec& spec);
+void compact_serialize(int8_t thrift_typeID, PHPOutputTransport& transport, zval** value, HashTable* fieldspec);
+void compact_skip_element(long thrift_typeID, PHPInputTransport& transport);
 
 
-// Create a PHP object given a typename and call the ctor, optionally passing up to 2 arguments
-void createObject(char* obj_typename, zval* return_value, int nargs = 0, zval* arg1 = NULL, zval* arg2 = NULL) {
+// Create a PHP object of a class and call the ctor, optionally passing up to 2 arguments
+void createObject(zend_class_entry* ce, zval* return_value, int nargs = 0, zval* arg1 = NULL, zval* arg2 = NULL) {
+  TSRMLS_FETCH();
+  object_and_properties_init(return_value, ce, NULL);
+  zend_function* constructor = zend_std_get_constructor(return_value TSRMLS_CC);
+  zval* ctor_rv = NULL;
+  zend_call_method(&return_value, ce, &constructor, NULL, 0, &ctor_rv, nargs, arg1, arg2 TSRMLS_CC);
+  zval_ptr_dtor(&ctor_rv);
+}
+
+zend_class_entry* fetchClass(char* obj_typename) {
   TSRMLS_FETCH();
   size_t obj_typename_len = strlen(obj_typename);
   zend_class_entry* ce = zend_fetch_class(obj_typename, obj_typename_len, ZEND_FETCH_CLASS_DEFAULT TSRMLS_CC);
   if (! ce) {
     php_error_docref(NULL TSRMLS_CC, E_ERROR, "Class %s does not exist", obj_typename);
-    RETURN_NULL();
   }
+  return ce;
+}
 
-  object_and_properties_init(return_value, ce, NULL);
-  zend_function* constructor = zend_std_get_constructor(return_value TSRMLS_CC);
-  zval* ctor_rv = NULL;
-  zend_call_method(&return_value, ce, &constructor, NULL, 0, &ctor_rv, nargs, arg1, arg2 TSRMLS_CC);
-  zval_ptr_dtor(&ctor_rv);
+// Create a PHP object given a typename and call the ctor, optionally passing up to 2 arguments
+void createObject(char* obj_typename, zval* return_value, int nargs = 0, zval* arg1 = NULL, zval* arg2 = NULL) {
+  zend_class_entry* ce = fetchClass(obj_typename);
+  if (! ce) {
+    RETURN_NULL();
+  }
+  createObject(ce, return_value, nargs, arg1, arg2);
 }
 
 void throw_tprotocolexception(char* what, long errorcode) {
@@ -434,6 +551,70 @@ void throw_zend_exception_from_std_exception(const std::exception& ex TSRMLS_DC)
   zend_throw_exception(zend_exception_get_default(TSRMLS_C), const_cast<char*>(ex.what()), 0 TSRMLS_CC);
 }
 
+zend_class_entry* SpecCache::classOf(HashTable* fieldspec) {
+  std::map<HashTable*, zend_class_entry*>::iterator it = classes.find(fieldspec);
+  if (it != classes.end()) {
+    return it->second;
+  }
+  zval** val_ptr;
+  if (zend_hash_find(fieldspec, "class", 6, (void**)&val_ptr) != SUCCESS) {
+    throw_tprotocolexception("no class type in spec", INVALID_DATA);
+  }
+  zend_class_entry* ce = fetchClass(Z_STRVAL_PP(val_ptr));
+  if (ce) {
+    classes[fieldspec] = ce;
+  }
+  return ce;
+}
+
+const StructSpec* SpecCache::specOf(zend_class_entry* ce) {
+  std::map<zend_class_entry*, StructSpec>::iterator it = specs.find(ce);
+  if (it != specs.end()) {
+    return &it->second;
+  }
+
+  TSRMLS_FETCH();
+  zval* tspec = zend_read_static_property(ce, "_TSPEC", 6, false TSRMLS_CC);
+  if (Z_TYPE_P(tspec) != IS_ARRAY) {
+    return NULL;
+  }
+  HashTable* spec = Z_ARRVAL_P(tspec);
+
+  StructSpec result;
+  result.ce = ce;
+  HashPosition key_ptr;
+  zval** val_ptr;
+  for (zend_hash_internal_pointer_reset_ex(spec, &key_ptr); zend_hash_get_current_data_ex(spec, (void**)&val_ptr, &key_ptr) == SUCCESS; zend_hash_move_forward_ex(spec, &key_ptr)) {
+    ulong fieldno;
+    if (zend_hash_get_current_key_ex(spec, NULL, NULL, &fieldno, 0, &key_ptr) != HASH_KEY_IS_LONG) {
+      throw_tprotocolexception("Bad keytype in TSPEC (expected 'long')", INVALID_DATA);
+    }
+    FieldSpec field;
+    field.fieldno = fieldno;
+    field.spec = Z_ARRVAL_PP(val_ptr);
+
+    // field name
+    zend_hash_find(field.spec, "var", 4, (void**)&val_ptr);
+    field.varname = Z_STRVAL_PP(val_ptr);
+    field.varname_len = Z_STRLEN_PP(val_ptr);
+
+    // thrift type
+    zend_hash_find(field.spec, "type", 5, (void**)&val_ptr);
+    if (Z_TYPE_PP(val_ptr) != IS_LONG) convert_to_long(*val_ptr);
+    field.ttype = Z_LVAL_PP(val_ptr);
+
+    result.by_fieldno.push_back(std::make_pair(field.fieldno, result.fields.size()));
+    result.fields.push_back(field);
+  }
+  std::sort(result.by_fieldno.begin(), result.by_fieldno.end());
+
+  StructSpec& cached = specs[ce];
+  cached.ce = ce;
+  cached.fields.swap(result.fields);
+  cached.by_fieldno.swap(result.by_fieldno);
+  return &cached;
+}
+
 
 void binary_deserialize(int8_t thrift_typeID, PHPInputTransport& transport, zval* return_value, HashTable* fieldspec) {
   zval** val_ptr;
@@ -445,27 +626,21 @@ void binary_deserialize(int8_t thrift_typeID, PHPInputTransport& transport, zval
       RETURN_NULL();
       return;
     case T_STRUCT: {
-      if (zend_hash_find(fieldspec, "class", 6, (void**)&val_ptr) != SUCCESS) {
-        throw_tprotocolexception("no class type in spec", INVALID_DATA);
-        skip_element(T_STRUCT, transport);
-        RETURN_NULL();
-      }
-      char* structType = Z_STRVAL_PP(val_ptr);
-      createObject(structType, return_value);
-      if (Z_TYPE_P(return_value) == IS_NULL) {
+      zend_class_entry* ce = transport.specs.classOf(fieldspec);
+      if (! ce) {
         // unable to create class entry
         skip_element(T_STRUCT, transport);
         RETURN_NULL();
       }
-      TSRMLS_FETCH();
-      zval* spec = zend_read_static_property(zend_get_class_entry(return_value TSRMLS_CC), "_TSPEC", 6, false TSRMLS_CC);
-      if (Z_TYPE_P(spec) != IS_ARRAY) {
+      const StructSpec* spec = transport.specs.specOf(ce);
+      if (! spec) {
         char errbuf[128];
-        snprintf(errbuf, 128, "spec for %s is wrong type: %d\n", structType, Z_TYPE_P(spec));
+        snprintf(errbuf, 128, "spec for %s is not an array\n", ce->name);
         throw_tprotocolexception(errbuf, INVALID_DATA);
         RETURN_NULL();
       }
-      binary_deserialize_spec(return_value, transport, Z_ARRVAL_P(spec));
+      createObject(ce, return_value);
+      binary_deserialize_spec(return_value, transport, *spec);
       return;
     } break;
     case T_BOOL: {
@@ -662,31 +837,16 @@ void skip_element(long thrift_typeID, PHPInputTransport& transport) {
   throw_tprotocolexception(errbuf, INVALID_DATA);
 }
 
-void protocol_writeMessageBegin(zval* transport, const char* method_name, int32_t msgtype, int32_t seqID) {
-  TSRMLS_FETCH();
-  zval *args[3];
-
-  MAKE_STD_ZVAL(args[0]);
-  ZVAL_STRINGL(args[0], (char*)method_name, strlen(method_name), 1);
-
-  MAKE_STD_ZVAL(args[1]);
-  ZVAL_LONG(args[1], msgtype);
-
-  MAKE_STD_ZVAL(args[2]);
-  ZVAL_LONG(args[2], seqID);
-
-  zval ret;
-  ZVAL_NULL(&ret);
-
-  zval writeMessagefn;
-  ZVAL_STRING(&writeMessagefn, "writeMessageBegin", 0);
-
-  call_user_function(EG(function_table), &transport, &writeMessagefn, &ret, 3, args TSRMLS_CC);
-
-  zval_ptr_dtor(&args[0]);
-  zval_ptr_dtor(&args[1]);
-  zval_ptr_dtor(&args[2]);
-  zval_dtor(&ret);
+void binary_writeMessageBegin(PHPOutputTransport& transport, const char* method_name, size_t method_name_len, int32_t msgtype, int32_t seqID, bool strictWrite) {
+  if (strictWrite) {
+    transport.writeI32(VERSION_1 | msgtype);
+    transport.writeString(method_name, method_name_len);
+    transport.writeI32(seqID);
+  } else {
+    transport.writeString(method_name, method_name_len);
+    transport.writeI8(msgtype);
+    transport.writeI32(seqID);
+  }
 }
 
 void binary_serialize_hashtable_key(int8_t keytype, PHPOutputTransport& transport, HashTable* ht, HashPosition& ht_pos) {
@@ -729,38 +889,21 @@ inline bool ttypes_are_compatible(int8_t t1, int8_t t2) {
   return ((t1 == t2) || (ttype_is_int(t1) && ttype_is_int(t2)));
 }
 
-void binary_deserialize_spec(zval* zthis, PHPInputTransport& transport, HashTable* spec) {
+void binary_deserialize_spec(zval* zthis, PHPInputTransport& transport, const StructSpec& spec) {
   // SET and LIST have 'elem' => array('type', [optional] 'class')
   // MAP has 'val' => array('type', [optiona] 'class')
   TSRMLS_FETCH();
-  zend_class_entry* ce = zend_get_class_entry(zthis TSRMLS_CC);
   while (true) {
-    zval** val_ptr = NULL;
-
     int8_t ttype = transport.readI8();
     if (ttype == T_STOP) return;
     int16_t fieldno = transport.readI16();
-    if (zend_hash_index_find(spec, fieldno, (void**)&val_ptr) == SUCCESS) {
-      HashTable* fieldspec = Z_ARRVAL_PP(val_ptr);
-      // pull the field name
-      // zend hash tables use the null at the end in the length... so strlen(hash key) + 1.
-      zend_hash_find(fieldspec, "var", 4, (void**)&val_ptr);
-      char* varname = Z_STRVAL_PP(val_ptr);
-
-      // and the type
-      zend_hash_find(fieldspec, "type", 5, (void**)&val_ptr);
-      if (Z_TYPE_PP(val_ptr) != IS_LONG) convert_to_long(*val_ptr);
-      int8_t expected_ttype = Z_LVAL_PP(val_ptr);
-
-      if (ttypes_are_compatible(ttype, expected_ttype)) {
-        zval* rv = NULL;
-        MAKE_STD_ZVAL(rv);
-        binary_deserialize(ttype, transport, rv, fieldspec);
-        zend_update_property(ce, zthis, varname, strlen(varname), rv TSRMLS_CC);
-        zval_ptr_dtor(&rv);
-      } else {
-        skip_element(ttype, transport);
-      }
+    const FieldSpec* field = spec.find(fieldno);
+    if (field && ttypes_are_compatible(ttype, field->ttype)) {
+      zval* rv = NULL;
+      MAKE_STD_ZVAL(rv);
+      binary_deserialize(ttype, transport, rv, field->spec);
+      zend_update_property(spec.ce, zthis, field->varname, field->varname_len, rv TSRMLS_CC);
+      zval_ptr_dtor(&rv);
     } else {
       skip_element(ttype, transport);
     }
@@ -779,11 +922,11 @@ void binary_serialize(int8_t thrift_typeID, PHPOutputTransport& transport, zval*
       if (Z_TYPE_PP(value) != IS_OBJECT) {
         throw_tprotocolexception("Attempt to send non-object type as a T_STRUCT", INVALID_DATA);
       }
-      zval* spec = zend_read_static_property(zend_get_class_entry(*value TSRMLS_CC), "_TSPEC", 6, false TSRMLS_CC);
-      if (Z_TYPE_P(spec) != IS_ARRAY) {
+      const StructSpec* spec = transport.specs.specOf(zend_get_class_entry(*value TSRMLS_CC));
+      if (! spec) {
         throw_tprotocolexception("Attempt to send non-Thrift object as a T_STRUCT", INVALID_DATA);
       }
-      binary_serialize_spec(*value, transport, Z_ARRVAL_P(spec));
+      binary_serialize_spec(*value, transport, *spec);
     } return;
     case T_BOOL:
       if (Z_TYPE_PP(value) != IS_BOOL) {
@@ -951,165 +1094,857 @@ void binary_serialize(int8_t thrift_typeID, PHPOutputTransport& transport, zval*
 }
 
 
-void binary_serialize_spec(zval* zthis, PHPOutputTransport& transport, HashTable* spec) {
-  HashPosition key_ptr;
-  zval** val_ptr;
-
+void binary_serialize_spec(zval* zthis, PHPOutputTransport& transport, const StructSpec& spec) {
   TSRMLS_FETCH();
-  zend_class_entry* ce = zend_get_class_entry(zthis TSRMLS_CC);
-
-  for (zend_hash_internal_pointer_reset_ex(spec, &key_ptr); zend_hash_get_current_data_ex(spec, (void**)&val_ptr, &key_ptr) == SUCCESS; zend_hash_move_forward_ex(spec, &key_ptr)) {
-    ulong fieldno;
-    if (zend_hash_get_current_key_ex(spec, NULL, NULL, &fieldno, 0, &key_ptr) != HASH_KEY_IS_LONG) {
-      throw_tprotocolexception("Bad keytype in TSPEC (expected 'long')", INVALID_DATA);
-      return;
-    }
-    HashTable* fieldspec = Z_ARRVAL_PP(val_ptr);
-
-    // field name
-    zend_hash_find(fieldspec, "var", 4, (void**)&val_ptr);
-    char* varname = Z_STRVAL_PP(val_ptr);
-
-    // thrift type
-    zend_hash_find(fieldspec, "type", 5, (void**)&val_ptr);
-    if (Z_TYPE_PP(val_ptr) != IS_LONG) convert_to_long(*val_ptr);
-    int8_t ttype = Z_LVAL_PP(val_ptr);
 
-    zval* prop = zend_read_property(ce, zthis, varname, strlen(varname), false TSRMLS_CC);
+  for (std::vector<FieldSpec>::const_iterator field = spec.fields.begin(); field != spec.fields.end(); ++field) {
+    zval* prop = zend_read_property(spec.ce, zthis, field->varname, field->varname_len, false TSRMLS_CC);
     if (Z_TYPE_P(prop) != IS_NULL) {
-      transport.writeI8(ttype);
-      transport.writeI16(fieldno);
-      binary_serialize(ttype, transport, &prop, fieldspec);
+      transport.writeI8(field->ttype);
+      transport.writeI16(field->fieldno);
+      binary_serialize(field->ttype, transport, &prop, field->spec);
     }
   }
   transport.writeI8(T_STOP); // struct end
 }
 
-// 6 params: $transport $method_name $ttype $request_struct $seqID $strict_write
-PHP_FUNCTION(thrift_protocol_write_binary) {
-  int argc = ZEND_NUM_ARGS();
-  if (argc < 6) {
-    WRONG_PARAM_COUNT;
-  }
-
-  zval ***args = (zval***) emalloc(argc * sizeof(zval**));
-  zend_get_parameters_array_ex(argc, args);
+inline int8_t compact_ctype(int8_t ttype) {
+  switch (ttype) {
+    case T_STOP: return CT_STOP;
+    case T_BOOL: return CT_BOOLEAN_TRUE; // collections only, fields fold the value in
+    case T_BYTE: return CT_BYTE;
+    case T_I16: return CT_I16;
+    case T_I32: return CT_I32;
+    case T_U64:
+    case T_I64: return CT_I64;
+    case T_DOUBLE: return CT_DOUBLE;
+    case T_UTF8:
+    case T_UTF16:
+    case T_STRING: return CT_BINARY;
+    case T_LIST: return CT_LIST;
+    case T_SET: return CT_SET;
+    case T_MAP: return CT_MAP;
+    case T_STRUCT: return CT_STRUCT;
+  };
 
-  if (Z_TYPE_PP(args[0]) != IS_OBJECT) {
-    php_error_docref(NULL TSRMLS_CC, E_ERROR, "1st parameter is not an object (transport)");
-    efree(args);
-    RETURN_NULL();
-  }
+  char errbuf[128];
+  sprintf(errbuf, "Unknown thrift typeID %d", ttype);
+  throw_tprotocolexception(errbuf, INVALID_DATA);
+  return CT_STOP;
+}
 
-  if (Z_TYPE_PP(args[1]) != IS_STRING) {
-    php_error_docref(NULL TSRMLS_CC, E_ERROR, "2nd parameter is not a string (method name)");
-    efree(args);
-    RETURN_NULL();
-  }
+inline int8_t compact_ttype(uint8_t ctype) {
+  switch (ctype) {
+    case CT_STOP: return T_STOP;
+    case CT_BOOLEAN_TRUE:
+    case CT_BOOLEAN_FALSE: return T_BOOL;
+    case CT_BYTE: return T_BYTE;
+    case CT_I16: return T_I16;
+    case CT_I32: return T_I32;
+    case CT_I64: return T_I64;
+    case CT_DOUBLE: return T_DOUBLE;
+    case CT_BINARY: return T_STRING;
+    case CT_LIST: return T_LIST;
+    case CT_SET: return T_SET;
+    case CT_MAP: return T_MAP;
+    case CT_STRUCT: return T_STRUCT;
+  };
 
-  if (Z_TYPE_PP(args[3]) != IS_OBJECT) {
-    php_error_docref(NULL TSRMLS_CC, E_ERROR, "4th parameter is not an object (request struct)");
-    efree(args);
-    RETURN_NULL();
-  }
+  char errbuf[128];
+  sprintf(errbuf, "Unknown compact type %d", ctype);
+  throw_tprotocolexception(errbuf, INVALID_DATA);
+  return T_STOP;
+}
 
+inline uint64_t i64ToZigzag(int64_t n) {
+  return ((uint64_t)n << 1) ^ (uint64_t)(n >> 63);
+}
 
-  try {
-    PHPOutputTransport transport(*args[0]);
-    zval *protocol = *args[0];
-    const char* method_name = Z_STRVAL_PP(args[1]);
-    convert_to_long(*args[2]);
-    int32_t msgtype = Z_LVAL_PP(args[2]);
-    zval* request_struct = *args[3];
-    convert_to_long(*args[4]);
-    int32_t seqID = Z_LVAL_PP(args[4]);
-    convert_to_boolean(*args[5]);
-    bool strictWrite = Z_BVAL_PP(args[5]);
-    efree(args);
-    args = NULL;
-    protocol_writeMessageBegin(protocol, method_name, msgtype, seqID);
-    zval* spec = zend_read_static_property(zend_get_class_entry(request_struct TSRMLS_CC), "_TSPEC", 6, false TSRMLS_CC);
-    if (Z_TYPE_P(spec) != IS_ARRAY) {
-        throw_tprotocolexception("Attempt to send non-Thrift object", INVALID_DATA);
-    }
-    binary_serialize_spec(request_struct, transport, Z_ARRVAL_P(spec));
-    transport.flush();
-  } catch (const PHPExceptionWrapper& ex) {
-    zend_throw_exception_object(ex TSRMLS_CC);
-    RETURN_NULL();
-  } catch (const std::exception& ex) {
-    throw_zend_exception_from_std_exception(ex TSRMLS_CC);
-    RETURN_NULL();
-  }
+inline int64_t zigzagToI64(uint64_t n) {
+  return (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
 }
 
-// 3 params: $transport $response_Typename $strict_read
-PHP_FUNCTION(thrift_protocol_read_binary) {
-  int argc = ZEND_NUM_ARGS();
+void compact_writeMessageBegin(PHPOutputTransport& transport, const char* method_name, size_t method_name_len, int32_t msgtype, int32_t seqID) {
+  transport.writeI8(COMPACT_PROTOCOL_ID);
+  transport.writeI8(COMPACT_VERSION | (msgtype << COMPACT_TYPE_SHIFT_AMOUNT));
+  transport.writeVarint((uint32_t)seqID);
+  transport.writeVarint(method_name_len);
+  transport.write(method_name, method_name_len);
+}
 
-  if (argc < 3) {
-    WRONG_PARAM_COUNT;
+void compact_writeFieldHeader(PHPOutputTransport& transport, int8_t ctype, int16_t fieldno, int16_t& last_fieldno) {
+  int delta = fieldno - last_fieldno;
+  if (delta > 0 && delta <= 15) {
+    transport.writeI8((delta << 4) | ctype);
+  } else {
+    transport.writeI8(ctype);
+    transport.writeVarint(i64ToZigzag(fieldno));
   }
+  last_fieldno = fieldno;
+}
 
-  zval ***args = (zval***) emalloc(argc * sizeof(zval**));
-  zend_get_parameters_array_ex(argc, args);
-
-  if (Z_TYPE_PP(args[0]) != IS_OBJECT) {
-    php_error_docref(NULL TSRMLS_CC, E_ERROR, "1st parameter is not an object (transport)");
-    efree(args);
-    RETURN_NULL();
+void compact_writeCollectionBegin(PHPOutputTransport& transport, int8_t elemtype, uint32_t size) {
+  if (size <= 14) {
+    transport.writeI8((size << 4) | compact_ctype(elemtype));
+  } else {
+    transport.writeI8(0xf0 | compact_ctype(elemtype));
+    transport.writeVarint(size);
   }
+}
 
-  if (Z_TYPE_PP(args[1]) != IS_STRING) {
-    php_error_docref(NULL TSRMLS_CC, E_ERROR, "2nd parameter is not a string (typename of expected response struct)");
-    efree(args);
-    RETURN_NULL();
+void compact_readCollectionBegin(PHPInputTransport& transport, int8_t& elemtype, uint32_t& size) {
+  uint8_t header;
+  transport.readBytes(&header, 1);
+  elemtype = compact_ttype(header & 0x0f);
+  size = header >> 4;
+  if (size == 15) {
+    size = (uint32_t)transport.readVarint();
   }
+}
 
-  try {
-    PHPInputTransport transport(*args[0]);
-    char* obj_typename = Z_STRVAL_PP(args[1]);
-    convert_to_boolean(*args[2]);
-    bool strict_read = Z_BVAL_PP(args[2]);
-    efree(args);
-    args = NULL;
+void compact_readMapBegin(PHPInputTransport& transport, int8_t& keytype, int8_t& valtype, uint32_t& size) {
+  size = (uint32_t)transport.readVarint();
+  keytype = valtype = T_STOP;
+  if (size) {
+    uint8_t types;
+    transport.readBytes(&types, 1);
+    keytype = compact_ttype(types >> 4);
+    valtype = compact_ttype(types & 0x0f);
+  }
+}
 
-    int8_t messageType = 0;
-    int32_t sz = transport.readI32();
+void compact_deserialize(int8_t thrift_typeID, PHPInputTransport& transport, zval* return_value, HashTable* fieldspec) {
+  zval** val_ptr;
+  Z_TYPE_P(return_value) = IS_NULL; // just in case
 
-    if (sz < 0) {
-      // Check for correct version number
-      int32_t version = sz & VERSION_MASK;
-      if (version != VERSION_1) {
-        throw_tprotocolexception("Bad version identifier", BAD_VERSION);
+  switch (thrift_typeID) {
+    case T_STOP:
+    case T_VOID:
+      RETURN_NULL();
+      return;
+    case T_STRUCT: {
+      zend_class_entry* ce = transport.specs.classOf(fieldspec);
+      if (! ce) {
+        // unable to create class entry
+        compact_skip_element(T_STRUCT, transport);
+        RETURN_NULL();
       }
-      messageType = (sz & 0x000000ff);
-      int32_t namelen = transport.readI32();
-      // skip the name string and the sequence ID, we don't care about those
-      transport.skip(namelen + 4);
-    } else {
-      if (strict_read) {
-        throw_tprotocolexception("No version identifier... old protocol client in strict mode?", BAD_VERSION);
-      } else {
-        // Handle pre-versioned input
-        transport.skip(sz); // skip string body
-        messageType = transport.readI8();
-        transport.skip(4); // skip sequence number
+      const StructSpec* spec = transport.specs.specOf(ce);
+      if (! spec) {
+        char errbuf[128];
+        snprintf(errbuf, 128, "spec for %s is not an array\n", ce->name);
+        throw_tprotocolexception(errbuf, INVALID_DATA);
+        RETURN_NULL();
       }
+      createObject(ce, return_value);
+      compact_deserialize_spec(return_value, transport, *spec);
+      return;
+    } break;
+    case T_BOOL: {
+      uint8_t c;
+      transport.readBytes(&c, 1);
+      RETURN_BOOL(c == CT_BOOLEAN_TRUE);
     }
-
-    if (messageType == T_EXCEPTION) {
-      zval* ex;
-      MAKE_STD_ZVAL(ex);
-      createObject("\\Thrift\\Exception\\TApplicationException", ex);
-      zval* spec = zend_read_static_property(zend_get_class_entry(ex TSRMLS_CC), "_TSPEC", 6, false TSRMLS_CC);
-      binary_deserialize_spec(ex, transport, Z_ARRVAL_P(spec));
-      throw PHPExceptionWrapper(ex);
+  //case T_I08: // same numeric value as T_BYTE
+    case T_BYTE: {
+      uint8_t c;
+      transport.readBytes(&c, 1);
+      RETURN_LONG((int8_t)c);
     }
-
-    createObject(obj_typename, return_value);
-    zval* spec = zend_read_static_property(zend_get_class_entry(return_value TSRMLS_CC), "_TSPEC", 6, false TSRMLS_CC);
-    binary_deserialize_spec(return_value, transport, Z_ARRVAL_P(spec));
+    case T_I16:
+    case T_I32:
+    case T_U64:
+    case T_I64:
+      RETURN_LONG(zigzagToI64(transport.readVarint()));
+    case T_DOUBLE: {
+      union {
+        uint64_t c;
+        double d;
+      } a;
+      transport.readBytes(&(a.c), 8);
+      a.c = letohll(a.c);
+      RETURN_DOUBLE(a.d);
+    }
+    //case T_UTF7: // aliases T_STRING
+    case T_UTF8:
+    case T_UTF16:
+    case T_STRING: {
+      uint32_t size = (uint32_t)transport.readVarint();
+      if (size) {
+        char* strbuf = (char*) emalloc(size + 1);
+        transport.readBytes(strbuf, size);
+        strbuf[size] = '\0';
+        ZVAL_STRINGL(return_value, strbuf, size, 0);
+      } else {
+        ZVAL_EMPTY_STRING(return_value);
+      }
+      return;
+    }
+    case T_MAP: { // array of key -> value
+      int8_t keytype, valtype;
+      uint32_t size;
+      compact_readMapBegin(transport, keytype, valtype, size);
+      array_init(return_value);
+
+      zend_hash_find(fieldspec, "key", 4, (void**)&val_ptr);
+      HashTable* keyspec = Z_ARRVAL_PP(val_ptr);
+      zend_hash_find(fieldspec, "val", 4, (void**)&val_ptr);
+      HashTable* valspec = Z_ARRVAL_PP(val_ptr);
+
+      for (uint32_t s = 0; s < size; ++s) {
+        zval *value;
+        MAKE_STD_ZVAL(value);
+
+        zval* key;
+        MAKE_STD_ZVAL(key);
+
+        compact_deserialize(keytype, transport, key, keyspec);
+        compact_deserialize(valtype, transport, value, valspec);
+        if (Z_TYPE_P(key) == IS_LONG) {
+          zend_hash_index_update(return_value->value.ht, Z_LVAL_P(key), &value, sizeof(zval *), NULL);
+        }
+        else {
+          if (Z_TYPE_P(key) != IS_STRING) convert_to_string(key);
+          zend_hash_update(return_value->value.ht, Z_STRVAL_P(key), Z_STRLEN_P(key) + 1, &value, sizeof(zval *), NULL);
+        }
+        zval_ptr_dtor(&key);
+      }
+      return; // return_value already populated
+    }
+    case T_LIST: { // array with autogenerated numeric keys
+      int8_t type;
+      uint32_t size;
+      compact_readCollectionBegin(transport, type, size);
+      zend_hash_find(fieldspec, "elem", 5, (void**)&val_ptr);
+      HashTable* elemspec = Z_ARRVAL_PP(val_ptr);
+
+      array_init(return_value);
+      for (uint32_t s = 0; s < size; ++s) {
+        zval *value;
+        MAKE_STD_ZVAL(value);
+        compact_deserialize(type, transport, value, elemspec);
+        zend_hash_next_index_insert(return_value->value.ht, &value, sizeof(zval *), NULL);
+      }
+      return;
+    }
+    case T_SET: { // array of key -> TRUE
+      int8_t type;
+      uint32_t size;
+      compact_readCollectionBegin(transport, type, size);
+      zend_hash_find(fieldspec, "elem", 5, (void**)&val_ptr);
+      HashTable* elemspec = Z_ARRVAL_PP(val_ptr);
+
+      array_init(return_value);
+
+      for (uint32_t s = 0; s < size; ++s) {
+        zval* key;
+        zval* value;
+        MAKE_STD_ZVAL(key);
+        MAKE_STD_ZVAL(value);
+        ZVAL_TRUE(value);
+
+        compact_deserialize(type, transport, key, elemspec);
+
+        if (Z_TYPE_P(key) == IS_LONG) {
+          zend_hash_index_update(return_value->value.ht, Z_LVAL_P(key), &value, sizeof(zval *), NULL);
+        }
+        else {
+          if (Z_TYPE_P(key) != IS_STRING) convert_to_string(key);
+          zend_hash_update(return_value->value.ht, Z_STRVAL_P(key), Z_STRLEN_P(key) + 1, &value, sizeof(zval *), NULL);
+        }
+        zval_ptr_dtor(&key);
+      }
+      return;
+    }
+  };
+
+  char errbuf[128];
+  sprintf(errbuf, "Unknown thrift typeID %d", thrift_typeID);
+  throw_tprotocolexception(errbuf, INVALID_DATA);
+}
+
+void compact_skip_element(long thrift_typeID, PHPInputTransport& transport) {
+  switch (thrift_typeID) {
+    case T_STOP:
+    case T_VOID:
+      return;
+    case T_STRUCT: {
+      while (true) {
+        uint8_t header;
+        transport.readBytes(&header, 1);
+        int8_t ttype = compact_ttype(header & 0x0f);
+        if (ttype == T_STOP) break;
+        if (!(header >> 4)) {
+          transport.readVarint(); // skip field number
+        }
+        if (ttype != T_BOOL) { // bool fields are all header
+          compact_skip_element(ttype, transport);
+        }
+      }
+    } return;
+    case T_BOOL:
+    case T_BYTE:
+      transport.skip(1);
+      return;
+    case T_I16:
+    case T_I32:
+    case T_U64:
+    case T_I64:
+      transport.readVarint();
+      return;
+    case T_DOUBLE:
+      transport.skip(8);
+      return;
+    //case T_UTF7: // aliases T_STRING
+    case T_UTF8:
+    case T_UTF16:
+    case T_STRING: {
+      uint32_t len = (uint32_t)transport.readVarint();
+      transport.skip(len);
+      } return;
+    case T_MAP: {
+      int8_t keytype, valtype;
+      uint32_t size;
+      compact_readMapBegin(transport, keytype, valtype, size);
+      for (uint32_t i = 0; i < size; ++i) {
+        compact_skip_element(keytype, transport);
+        compact_skip_element(valtype, transport);
+      }
+    } return;
+    case T_LIST:
+    case T_SET: {
+      int8_t valtype;
+      uint32_t size;
+      compact_readCollectionBegin(transport, valtype, size);
+      for (uint32_t i = 0; i < size; ++i) {
+        compact_skip_element(valtype, transport);
+      }
+    } return;
+  };
+
+  char errbuf[128];
+  sprintf(errbuf, "Unknown thrift typeID %ld", thrift_typeID);
+  throw_tprotocolexception(errbuf, INVALID_DATA);
+}
+
+void compact_serialize_hashtable_key(int8_t keytype, PHPOutputTransport& transport, HashTable* ht, HashPosition& ht_pos) {
+  bool keytype_is_numeric = (!((keytype == T_STRING) || (keytype == T_UTF8) || (keytype == T_UTF16)));
+
+  char* key;
+  uint key_len;
+  long index = 0;
+
+  zval* z;
+  MAKE_STD_ZVAL(z);
+
+  int res = zend_hash_get_current_key_ex(ht, &key, &key_len, (ulong*)&index, 0, &ht_pos);
+  if (keytype_is_numeric) {
+    if (res == HASH_KEY_IS_STRING) {
+      index = strtol(key, NULL, 10);
+    }
+    ZVAL_LONG(z, index);
+  } else {
+    char buf[64];
+    if (res == HASH_KEY_IS_STRING) {
+      key_len -= 1; // skip the null terminator
+    } else {
+      sprintf(buf, "%ld", index);
+      key = buf; key_len = strlen(buf);
+    }
+    ZVAL_STRINGL(z, key, key_len, 1);
+  }
+  compact_serialize(keytype, transport, &z, NULL);
+  zval_ptr_dtor(&z);
+}
+
+void compact_deserialize_spec(zval* zthis, PHPInputTransport& transport, const StructSpec& spec) {
+  TSRMLS_FETCH();
+  int16_t last_fieldno = 0;
+  while (true) {
+    uint8_t header;
+    transport.readBytes(&header, 1);
+    int8_t ttype = compact_ttype(header & 0x0f);
+    if (ttype == T_STOP) return;
+    int16_t fieldno;
+    if (header >> 4) {
+      fieldno = last_fieldno + (header >> 4);
+    } else {
+      fieldno = (int16_t)zigzagToI64(transport.readVarint());
+    }
+    last_fieldno = fieldno;
+
+    const FieldSpec* field = spec.find(fieldno);
+    if (field && ttypes_are_compatible(ttype, field->ttype)) {
+      zval* rv = NULL;
+      MAKE_STD_ZVAL(rv);
+      if (ttype == T_BOOL) {
+        ZVAL_BOOL(rv, (header & 0x0f) == CT_BOOLEAN_TRUE);
+      } else {
+        compact_deserialize(ttype, transport, rv, field->spec);
+      }
+      zend_update_property(spec.ce, zthis, field->varname, field->varname_len, rv TSRMLS_CC);
+      zval_ptr_dtor(&rv);
+    } else if (ttype != T_BOOL) {
+      compact_skip_element(ttype, transport);
+    }
+  }
+}
+
+void compact_serialize(int8_t thrift_typeID, PHPOutputTransport& transport, zval** value, HashTable* fieldspec) {
+  Z_ADDREF_P(*value);
+  // At this point the field header (if applicable) should've already been written to the output so all we need to do is write the payload.
+  switch (thrift_typeID) {
+    case T_STOP:
+    case T_VOID:
+      zval_ptr_dtor(value);
+      return;
+    case T_STRUCT: {
+      TSRMLS_FETCH();
+      if (Z_TYPE_PP(value) != IS_OBJECT) {
+        zval_ptr_dtor(value);
+        throw_tprotocolexception("Attempt to send non-object type as a T_STRUCT", INVALID_DATA);
+      }
+      const StructSpec* spec = transport.specs.specOf(zend_get_class_entry(*value TSRMLS_CC));
+      if (! spec) {
+        zval_ptr_dtor(value);
+        throw_tprotocolexception("Attempt to send non-Thrift object as a T_STRUCT", INVALID_DATA);
+      }
+      compact_serialize_spec(*value, transport, *spec);
+      zval_ptr_dtor(value);
+    } return;
+    case T_BOOL:
+      if (Z_TYPE_PP(value) != IS_BOOL) {
+        SEPARATE_ZVAL(value);
+        convert_to_boolean(*value);
+      }
+      transport.writeI8(Z_BVAL_PP(value) ? CT_BOOLEAN_TRUE : CT_BOOLEAN_FALSE);
+      zval_ptr_dtor(value);
+      return;
+    case T_BYTE:
+      if (Z_TYPE_PP(value) != IS_LONG) {
+        SEPARATE_ZVAL(value);
+        convert_to_long(*value);
+      }
+      transport.writeI8(Z_LVAL_PP(value));
+      zval_ptr_dtor(value);
+      return;
+    case T_I16:
+    case T_I32:
+      if (Z_TYPE_PP(value) != IS_LONG) {
+        SEPARATE_ZVAL(value);
+        convert_to_long(*value);
+      }
+      transport.writeVarint(i64ToZigzag((int32_t)Z_LVAL_PP(value)));
+      zval_ptr_dtor(value);
+      return;
+    case T_I64:
+    case T_U64: {
+      int64_t l_data;
+#if defined(_LP64) || defined(_WIN64)
+      if (Z_TYPE_PP(value) != IS_LONG) {
+        SEPARATE_ZVAL(value);
+        convert_to_long(*value);
+      }
+      l_data = Z_LVAL_PP(value);
+#else
+      if (Z_TYPE_PP(value) != IS_DOUBLE) {
+        SEPARATE_ZVAL(value);
+        convert_to_double(*value);
+      }
+      l_data = (int64_t)Z_DVAL_PP(value);
+#endif
+      transport.writeVarint(i64ToZigzag(l_data));
+      zval_ptr_dtor(value);
+    } return;
+    case T_DOUBLE: {
+      union {
+        uint64_t c;
+        double d;
+      } a;
+      if (Z_TYPE_PP(value) != IS_DOUBLE) {
+        SEPARATE_ZVAL(value);
+        convert_to_double(*value);
+      }
+      a.d = Z_DVAL_PP(value);
+      a.c = htolell(a.c);
+      transport.write((const char*)&a.c, 8);
+      zval_ptr_dtor(value);
+    } return;
+    //case T_UTF7:
+    case T_UTF8:
+    case T_UTF16:
+    case T_STRING:
+      if (Z_TYPE_PP(value) != IS_STRING) {
+        SEPARATE_ZVAL(value);
+        convert_to_string(*value);
+      }
+      transport.writeVarint(Z_STRLEN_PP(value));
+      transport.write(Z_STRVAL_PP(value), Z_STRLEN_PP(value));
+      zval_ptr_dtor(value);
+      return;
+    case T_MAP: {
+      if (Z_TYPE_PP(value) != IS_ARRAY) {
+        SEPARATE_ZVAL(value);
+        convert_to_array(*value);
+      }
+      if (Z_TYPE_PP(value) != IS_ARRAY) {
+        zval_ptr_dtor(value);
+        throw_tprotocolexception("Attempt to send an incompatible type as an array (T_MAP)", INVALID_DATA);
+      }
+      HashTable* ht = Z_ARRVAL_PP(value);
+      zval** val_ptr;
+
+      zend_hash_find(fieldspec, "ktype", 6, (void**)&val_ptr);
+      if (Z_TYPE_PP(val_ptr) != IS_LONG) convert_to_long(*val_ptr);
+      uint8_t keytype = Z_LVAL_PP(val_ptr);
+      zend_hash_find(fieldspec, "vtype", 6, (void**)&val_ptr);
+      if (Z_TYPE_PP(val_ptr) != IS_LONG) convert_to_long(*val_ptr);
+      uint8_t valtype = Z_LVAL_PP(val_ptr);
+
+      zend_hash_find(fieldspec, "val", 4, (void**)&val_ptr);
+      HashTable* valspec = Z_ARRVAL_PP(val_ptr);
+
+      uint32_t size = zend_hash_num_elements(ht);
+      transport.writeVarint(size);
+      if (size) {
+        transport.writeI8((compact_ctype(keytype) << 4) | compact_ctype(valtype));
+      }
+      HashPosition key_ptr;
+      for (zend_hash_internal_pointer_reset_ex(ht, &key_ptr); zend_hash_get_current_data_ex(ht, (void**)&val_ptr, &key_ptr) == SUCCESS; zend_hash_move_forward_ex(ht, &key_ptr)) {
+        compact_serialize_hashtable_key(keytype, transport, ht, key_ptr);
+        compact_serialize(valtype, transport, val_ptr, valspec);
+      }
+      zval_ptr_dtor(value);
+    } return;
+    case T_LIST: {
+      if (Z_TYPE_PP(value) != IS_ARRAY) {
+        SEPARATE_ZVAL(value);
+        convert_to_array(*value);
+      }
+      if (Z_TYPE_PP(value) != IS_ARRAY) {
+        zval_ptr_dtor(value);
+        throw_tprotocolexception("Attempt to send an incompatible type as an array (T_LIST)", INVALID_DATA);
+      }
+      HashTable* ht = Z_ARRVAL_PP(value);
+      zval** val_ptr;
+
+      zend_hash_find(fieldspec, "etype", 6, (void**)&val_ptr);
+      if (Z_TYPE_PP(val_ptr) != IS_LONG) convert_to_long(*val_ptr);
+      uint8_t valtype = Z_LVAL_PP(val_ptr);
+
+      zend_hash_find(fieldspec, "elem", 5, (void**)&val_ptr);
+      HashTable* valspec = Z_ARRVAL_PP(val_ptr);
+
+      compact_writeCollectionBegin(transport, valtype, zend_hash_num_elements(ht));
+      HashPosition key_ptr;
+      for (zend_hash_internal_pointer_reset_ex(ht, &key_ptr); zend_hash_get_current_data_ex(ht, (void**)&val_ptr, &key_ptr) == SUCCESS; zend_hash_move_forward_ex(ht, &key_ptr)) {
+        compact_serialize(valtype, transport, val_ptr, valspec);
+      }
+      zval_ptr_dtor(value);
+    } return;
+    case T_SET: {
+      if (Z_TYPE_PP(value) != IS_ARRAY) {
+        SEPARATE_ZVAL(value);
+        convert_to_array(*value);
+      }
+      if (Z_TYPE_PP(value) != IS_ARRAY) {
+        zval_ptr_dtor(value);
+        throw_tprotocolexception("Attempt to send an incompatible type as an array (T_SET)", INVALID_DATA);
+      }
+      HashTable* ht = Z_ARRVAL_PP(value);
+      zval** val_ptr;
+
+      zend_hash_find(fieldspec, "etype", 6, (void**)&val_ptr);
+      if (Z_TYPE_PP(val_ptr) != IS_LONG) convert_to_long(*val_ptr);
+      uint8_t keytype = Z_LVAL_PP(val_ptr);
+
+      compact_writeCollectionBegin(transport, keytype, zend_hash_num_elements(ht));
+      HashPosition key_ptr;
+      for (zend_hash_internal_pointer_reset_ex(ht, &key_ptr); zend_hash_get_current_data_ex(ht, (void**)&val_ptr, &key_ptr) == SUCCESS; zend_hash_move_forward_ex(ht, &key_ptr)) {
+        compact_serialize_hashtable_key(keytype, transport, ht, key_ptr);
+      }
+      zval_ptr_dtor(value);
+    } return;
+  };
+
+  zval_ptr_dtor(value);
+  char errbuf[128];
+  sprintf(errbuf, "Unknown thrift typeID %d", thrift_typeID);
+  throw_tprotocolexception(errbuf, INVALID_DATA);
+}
+
+void compact_serialize_spec(zval* zthis, PHPOutputTransport& transport, const StructSpec& spec) {
+  int16_t last_fieldno = 0;
+
+  TSRMLS_FETCH();
+
+  for (std::vector<FieldSpec>::const_iterator field = spec.fields.begin(); field != spec.fields.end(); ++field) {
+    zval* prop = zend_read_property(spec.ce, zthis, field->varname, field->varname_len, false TSRMLS_CC);
+    if (Z_TYPE_P(prop) != IS_NULL) {
+      if (field->ttype == T_BOOL) {
+        // the value rides in the field header
+        int8_t ctype = zend_is_true(prop) ? CT_BOOLEAN_TRUE : CT_BOOLEAN_FALSE;
+        compact_writeFieldHeader(transport, ctype, field->fieldno, last_fieldno);
+      } else {
+        compact_writeFieldHeader(transport, compact_ctype(field->ttype), field->fieldno, last_fieldno);
+        compact_serialize(field->ttype, transport, &prop, field->spec);
+      }
+    }
+  }
+  transport.writeI8(CT_STOP); // struct end
+}
+
+// 6 params: $transport $method_name $ttype $request_struct $seqID $strict_write
+PHP_FUNCTION(thrift_protocol_write_binary) {
+  int argc = ZEND_NUM_ARGS();
+  if (argc < 6) {
+    WRONG_PARAM_COUNT;
+  }
+
+  zval ***args = (zval***) emalloc(argc * sizeof(zval**));
+  zend_get_parameters_array_ex(argc, args);
+
+  if (Z_TYPE_PP(args[0]) != IS_OBJECT) {
+    php_error_docref(NULL TSRMLS_CC, E_ERROR, "1st parameter is not an object (transport)");
+    efree(args);
+    RETURN_NULL();
+  }
+
+  if (Z_TYPE_PP(args[1]) != IS_STRING) {
+    php_error_docref(NULL TSRMLS_CC, E_ERROR, "2nd parameter is not a string (method name)");
+    efree(args);
+    RETURN_NULL();
+  }
+
+  if (Z_TYPE_PP(args[3]) != IS_OBJECT) {
+    php_error_docref(NULL TSRMLS_CC, E_ERROR, "4th parameter is not an object (request struct)");
+    efree(args);
+    RETURN_NULL();
+  }
+
+
+  try {
+    PHPOutputTransport transport(*args[0]);
+    const char* method_name = Z_STRVAL_PP(args[1]);
+    size_t method_name_len = Z_STRLEN_PP(args[1]);
+    convert_to_long(*args[2]);
+    int32_t msgtype = Z_LVAL_PP(args[2]);
+    zval* request_struct = *args[3];
+    convert_to_long(*args[4]);
+    int32_t seqID = Z_LVAL_PP(args[4]);
+    convert_to_boolean(*args[5]);
+    bool strictWrite = Z_BVAL_PP(args[5]);
+    efree(args);
+    args = NULL;
+    // Header and body go to the transport in a single write()
+    binary_writeMessageBegin(transport, method_name, method_name_len, msgtype, seqID, strictWrite);
+    const StructSpec* spec = transport.specs.specOf(zend_get_class_entry(request_struct TSRMLS_CC));
+    if (! spec) {
+        throw_tprotocolexception("Attempt to send non-Thrift object", INVALID_DATA);
+    }
+    binary_serialize_spec(request_struct, transport, *spec);
+    transport.flush();
+  } catch (const PHPExceptionWrapper& ex) {
+    zend_throw_exception_object(ex TSRMLS_CC);
+    RETURN_NULL();
+  } catch (const std::exception& ex) {
+    throw_zend_exception_from_std_exception(ex TSRMLS_CC);
+    RETURN_NULL();
+  }
+}
+
+// 3 params: $transport $response_Typename $strict_read
+PHP_FUNCTION(thrift_protocol_read_binary) {
+  int argc = ZEND_NUM_ARGS();
+
+  if (argc < 3) {
+    WRONG_PARAM_COUNT;
+  }
+
+  zval ***args = (zval***) emalloc(argc * sizeof(zval**));
+  zend_get_parameters_array_ex(argc, args);
+
+  if (Z_TYPE_PP(args[0]) != IS_OBJECT) {
+    php_error_docref(NULL TSRMLS_CC, E_ERROR, "1st parameter is not an object (transport)");
+    efree(args);
+    RETURN_NULL();
+  }
+
+  if (Z_TYPE_PP(args[1]) != IS_STRING) {
+    php_error_docref(NULL TSRMLS_CC, E_ERROR, "2nd parameter is not a string (typename of expected response struct)");
+    efree(args);
+    RETURN_NULL();
+  }
+
+  try {
+    PHPInputTransport transport(*args[0]);
+    char* obj_typename = Z_STRVAL_PP(args[1]);
+    convert_to_boolean(*args[2]);
+    bool strict_read = Z_BVAL_PP(args[2]);
+    efree(args);
+    args = NULL;
+
+    int8_t messageType = 0;
+    int32_t sz = transport.readI32();
+
+    if (sz < 0) {
+      // Check for correct version number
+      int32_t version = sz & VERSION_MASK;
+      if (version != VERSION_1) {
+        throw_tprotocolexception("Bad version identifier", BAD_VERSION);
+      }
+      messageType = (sz & 0x000000ff);
+      int32_t namelen = transport.readI32();
+      // skip the name string and the sequence ID, we don't care about those
+      transport.skip(namelen + 4);
+    } else {
+      if (strict_read) {
+        throw_tprotocolexception("No version identifier... old protocol client in strict mode?", BAD_VERSION);
+      } else {
+        // Handle pre-versioned input
+        transport.skip(sz); // skip string body
+        messageType = transport.readI8();
+        transport.skip(4); // skip sequence number
+      }
+    }
+
+    if (messageType == T_EXCEPTION) {
+      zval* ex;
+      MAKE_STD_ZVAL(ex);
+      createObject("\\Thrift\\Exception\\TApplicationException", ex);
+      binary_deserialize_spec(ex, transport, *transport.specs.specOf(zend_get_class_entry(ex TSRMLS_CC)));
+      throw PHPExceptionWrapper(ex);
+    }
+
+    createObject(obj_typename, return_value);
+    const StructSpec* spec = transport.specs.specOf(zend_get_class_entry(return_value TSRMLS_CC));
+    if (! spec) {
+      throw_tprotocolexception("Attempt to read non-Thrift object", INVALID_DATA);
+    }
+    binary_deserialize_spec(return_value, transport, *spec);
+  } catch (const PHPExceptionWrapper& ex) {
+    zend_throw_exception_object(ex TSRMLS_CC);
+    RETURN_NULL();
+  } catch (const std::exception& ex) {
+    throw_zend_exception_from_std_exception(ex TSRMLS_CC);
+    RETURN_NULL();
+  }
+}
+
+// 5 params: $transport $method_name $ttype $request_struct $seqID
+PHP_FUNCTION(thrift_protocol_write_compact) {
+  int argc = ZEND_NUM_ARGS();
+  if (argc < 5) {
+    WRONG_PARAM_COUNT;
+  }
+
+  zval ***args = (zval***) emalloc(argc * sizeof(zval**));
+  zend_get_parameters_array_ex(argc, args);
+
+  if (Z_TYPE_PP(args[0]) != IS_OBJECT) {
+    php_error_docref(NULL TSRMLS_CC, E_ERROR, "1st parameter is not an object (transport)");
+    efree(args);
+    RETURN_NULL();
+  }
+
+  if (Z_TYPE_PP(args[1]) != IS_STRING) {
+    php_error_docref(NULL TSRMLS_CC, E_ERROR, "2nd parameter is not a string (method name)");
+    efree(args);
+    RETURN_NULL();
+  }
+
+  if (Z_TYPE_PP(args[3]) != IS_OBJECT) {
+    php_error_docref(NULL TSRMLS_CC, E_ERROR, "4th parameter is not an object (request struct)");
+    efree(args);
+    RETURN_NULL();
+  }
+
+
+  try {
+    PHPOutputTransport transport(*args[0]);
+    const char* method_name = Z_STRVAL_PP(args[1]);
+    size_t method_name_len = Z_STRLEN_PP(args[1]);
+    convert_to_long(*args[2]);
+    int32_t msgtype = Z_LVAL_PP(args[2]);
+    zval* request_struct = *args[3];
+    convert_to_long(*args[4]);
+    int32_t seqID = Z_LVAL_PP(args[4]);
+    efree(args);
+    args = NULL;
+    compact_writeMessageBegin(transport, method_name, method_name_len, msgtype, seqID);
+    const StructSpec* spec = transport.specs.specOf(zend_get_class_entry(request_struct TSRMLS_CC));
+    if (! spec) {
+        throw_tprotocolexception("Attempt to send non-Thrift object", INVALID_DATA);
+    }
+    compact_serialize_spec(request_struct, transport, *spec);
+    transport.flush();
+  } catch (const PHPExceptionWrapper& ex) {
+    zend_throw_exception_object(ex TSRMLS_CC);
+    RETURN_NULL();
+  } catch (const std::exception& ex) {
+    throw_zend_exception_from_std_exception(ex TSRMLS_CC);
+    RETURN_NULL();
+  }
+}
+
+// 2 params: $transport $response_Typename
+PHP_FUNCTION(thrift_protocol_read_compact) {
+  int argc = ZEND_NUM_ARGS();
+
+  if (argc < 2) {
+    WRONG_PARAM_COUNT;
+  }
+
+  zval ***args = (zval***) emalloc(argc * sizeof(zval**));
+  zend_get_parameters_array_ex(argc, args);
+
+  if (Z_TYPE_PP(args[0]) != IS_OBJECT) {
+    php_error_docref(NULL TSRMLS_CC, E_ERROR, "1st parameter is not an object (transport)");
+    efree(args);
+    RETURN_NULL();
+  }
+
+  if (Z_TYPE_PP(args[1]) != IS_STRING) {
+    php_error_docref(NULL TSRMLS_CC, E_ERROR, "2nd parameter is not a string (typename of expected response struct)");
+    efree(args);
+    RETURN_NULL();
+  }
+
+  try {
+    PHPInputTransport transport(*args[0]);
+    char* obj_typename = Z_STRVAL_PP(args[1]);
+    efree(args);
+    args = NULL;
+
+    uint8_t protocolId;
+    transport.readBytes(&protocolId, 1);
+    if (protocolId != COMPACT_PROTOCOL_ID) {
+      throw_tprotocolexception("Bad protocol identifier", BAD_VERSION);
+    }
+    uint8_t versionAndType;
+    transport.readBytes(&versionAndType, 1);
+    if ((versionAndType & COMPACT_VERSION_MASK) != COMPACT_VERSION) {
+      throw_tprotocolexception("Bad version identifier", BAD_VERSION);
+    }
+    int8_t messageType = (versionAndType >> COMPACT_TYPE_SHIFT_AMOUNT) & 0x07;
+    // skip the sequence ID and the name string, we don't care about those
+    transport.readVarint();
+    transport.skip((uint32_t)transport.readVarint());
+
+    if (messageType == T_EXCEPTION) {
+      zval* ex;
+      MAKE_STD_ZVAL(ex);
+      createObject("\\Thrift\\Exception\\TApplicationException", ex);
+      compact_deserialize_spec(ex, transport, *transport.specs.specOf(zend_get_class_entry(ex TSRMLS_CC)));
+      throw PHPExceptionWrapper(ex);
+    }
+
+    createObject(obj_typename, return_value);
+    const StructSpec* spec = transport.specs.specOf(zend_get_class_entry(return_value TSRMLS_CC));
+    if (! spec) {
+      throw_tprotocolexception("Attempt to read non-Thrift object", INVALID_DATA);
+    }
+    compact_deserialize_spec(return_value, transport, *spec);
   } catch (const PHPExceptionWrapper& ex) {
     zend_throw_exception_object(ex TSRMLS_CC);
     RETURN_NULL();
@@ -21,6 +21,8 @@
 
 PHP_FUNCTION(thrift_protocol_write_binary);
 PHP_FUNCTION(thrift_protocol_read_binary);
+PHP_FUNCTION(thrift_protocol_write_compact);
+PHP_FUNCTION(thrift_protocol_read_compact);
 
 extern zend_module_entry thrift_protocol_module_entry;
 #define phpext_thrift_protocol_ptr &thrift_protocol_module_entry
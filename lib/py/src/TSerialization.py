@@ -17,9 +17,14 @@
 # under the License.
 #
 
-from protocol import TBinaryProtocol
+from protocol import TBinaryProtocol, TCompactProtocol
 from transport import TTransport
 
+try:
+  from protocol import fastbinary
+except:
+  fastbinary = None
+
 
 def serialize(thrift_object,
               protocol_factory=TBinaryProtocol.TBinaryProtocolFactory()):
@@ -32,6 +37,18 @@ def serialize(thrift_object,
 def deserialize(base,
                 buf,
                 protocol_factory=TBinaryProtocol.TBinaryProtocolFactory()):
+    spec = getattr(base, 'thrift_spec', None)
+    if fastbinary is not None and spec is not None:
+        # The accelerated protocols can decode straight out of buf, or
+        # anything else exposing the buffer protocol, without copying it
+        if isinstance(protocol_factory,
+                      TBinaryProtocol.TBinaryProtocolAcceleratedFactory):
+            fastbinary.decode_binary(base, buf, (base.__class__, spec))
+            return base
+        if isinstance(protocol_factory,
+                      TCompactProtocol.TCompactProtocolAcceleratedFactory):
+            fastbinary.decode_compact(base, buf, (base.__class__, spec))
+            return base
     transport = TTransport.TMemoryBuffer(buf)
     protocol = protocol_factory.getProtocol(transport)
     base.read(protocol)
@@ -19,6 +19,7 @@
 
 from thrift.Thrift import *
 from thrift.protocol import TBinaryProtocol
+from thrift.protocol import TCompactProtocol
 from thrift.transport import TTransport
 
 try:
@@ -57,6 +58,14 @@ class TBase(object):
                                iprot.trans,
                                (self.__class__, self.thrift_spec))
       return
+    if (iprot.__class__ == TCompactProtocol.TCompactProtocolAccelerated and
+        isinstance(iprot.trans, TTransport.CReadableTransport) and
+        self.thrift_spec is not None and
+        fastbinary is not None):
+      fastbinary.decode_compact(self,
+                                iprot.trans,
+                                (self.__class__, self.thrift_spec))
+      return
     iprot.readStruct(self, self.thrift_spec)
 
   def write(self, oprot):
@@ -66,6 +75,12 @@ class TBase(object):
       oprot.trans.write(
         fastbinary.encode_binary(self, (self.__class__, self.thrift_spec)))
       return
+    if (oprot.__class__ == TCompactProtocol.TCompactProtocolAccelerated and
+        self.thrift_spec is not None and
+        fastbinary is not None):
+      oprot.trans.write(
+        fastbinary.encode_compact(self, (self.__class__, self.thrift_spec)))
+      return
     oprot.writeStruct(self, self.thrift_spec)
 
 
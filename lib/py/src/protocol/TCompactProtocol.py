@@ -20,7 +20,8 @@
 from TProtocol import *
 from struct import pack, unpack
 
-__all__ = ['TCompactProtocol', 'TCompactProtocolFactory']
+__all__ = ['TCompactProtocol', 'TCompactProtocolFactory',
+           'TCompactProtocolAccelerated', 'TCompactProtocolAcceleratedFactory']
 
 CLEAR = 0
 FIELD_WRITE = 1
@@ -250,7 +251,8 @@ class TCompactProtocol(TProtocolBase):
 
   @writer
   def writeDouble(self, dub):
-    self.trans.write(pack('!d', dub))
+    # Doubles go little-endian, as the C++ and Java implementations send them
+    self.trans.write(pack('<d', dub))
 
   def __writeString(self, s):
     self.__writeSize(len(s))
@@ -383,7 +385,7 @@ class TCompactProtocol(TProtocolBase):
   @reader
   def readDouble(self):
     buff = self.trans.readAll(8)
-    val, = unpack('!d', buff)
+    val, = unpack('<d', buff)
     return val
 
   def __readString(self):
@@ -401,3 +403,18 @@ class TCompactProtocolFactory:
 
   def getProtocol(self, trans):
     return TCompactProtocol(trans)
+
+
+class TCompactProtocolAccelerated(TCompactProtocol):
+  """C-Accelerated version of TCompactProtocol.
+
+  Like TBinaryProtocolAccelerated, this only marks the protocol for the
+  generated code, which hands whole structs to the fastbinary module and
+  falls back to TCompactProtocol if that module is not available.
+  """
+  pass
+
+
+class TCompactProtocolAcceleratedFactory:
+  def getProtocol(self, trans):
+    return TCompactProtocolAccelerated(trans)
@@ -62,7 +62,6 @@
 //               permanently in the object.  (Malloc and orphan.)
 // TODO(dreiss): Why do we need cStringIO for reading, why not just char*?
 //               Can cStringIO let us work with a BufferedTransport?
-// TODO(dreiss): Don't ignore the rv from cwrite (maybe).
 
 /* ====== BEGIN UTILITIES ====== */
 
@@ -171,12 +170,29 @@ typedef struct {
 } StructItemSpec;
 
 /**
- * A cache of the two key attributes of a CReadableTransport,
- * so we don't have to keep calling PyObject_GetAttr.
+ * Where encoding writes to: a string object sized from an estimate,
+ * grown by doubling and trimmed to length at the end, so the result is
+ * handed back without another copy. buf is NULL once an allocation
+ * has failed, and writes after that are dropped.
+ */
+typedef struct {
+  PyObject* buf;
+  Py_ssize_t len;
+} EncodeBuffer;
+
+/**
+ * What decoding reads from. Either the two key attributes of a
+ * CReadableTransport, cached so we don't have to keep calling
+ * PyObject_GetAttr, or, when stringiobuf is NULL, the bytes of an
+ * object exposing the buffer protocol, read in place.
  */
 typedef struct {
   PyObject* stringiobuf;
   PyObject* refill_callable;
+  Py_buffer view;
+  const char* data;
+  Py_ssize_t len;
+  Py_ssize_t pos;
 } DecodeBuffer;
 
 /** Pointer to interned string to speed up attribute lookup. */
@@ -301,27 +317,72 @@ parse_struct_item_spec(StructItemSpec* dest, PyObject* spec_tuple) {
 
 /* --- LOW-LEVEL WRITING FUNCTIONS --- */
 
-static void writeByte(PyObject* outbuf, int8_t val) {
+static bool
+init_encodebuf(EncodeBuffer* dest, Py_ssize_t size_hint) {
+  dest->len = 0;
+  dest->buf = PyString_FromStringAndSize(NULL, size_hint > 0 ? size_hint : INIT_OUTBUF_SIZE);
+  return dest->buf != NULL;
+}
+
+static void writeBuf(EncodeBuffer* outbuf, const char* data, Py_ssize_t len) {
+  Py_ssize_t cap;
+  if (outbuf->buf == NULL) {
+    return;
+  }
+  cap = PyString_GET_SIZE(outbuf->buf);
+  if (outbuf->len + len > cap) {
+    cap *= 2;
+    if (cap < outbuf->len + len) {
+      cap = outbuf->len + len;
+    }
+    // Frees the string and NULLs buf on failure
+    if (_PyString_Resize(&outbuf->buf, cap) == -1) {
+      return;
+    }
+  }
+  memcpy(PyString_AS_STRING(outbuf->buf) + outbuf->len, data, len);
+  outbuf->len += len;
+}
+
+// Returns a new reference to the encoded string, or NULL.
+static PyObject*
+finish_encodebuf(EncodeBuffer* outbuf, bool ok) {
+  PyObject* ret = outbuf->buf;
+  outbuf->buf = NULL;
+  if (ret == NULL) {
+    return NULL;
+  }
+  if (!ok) {
+    Py_DECREF(ret);
+    return NULL;
+  }
+  if (_PyString_Resize(&ret, outbuf->len) == -1) {
+    return NULL;
+  }
+  return ret;
+}
+
+static void writeByte(EncodeBuffer* outbuf, int8_t val) {
   int8_t net = val;
-  PycStringIO->cwrite(outbuf, (char*)&net, sizeof(int8_t));
+  writeBuf(outbuf, (char*)&net, sizeof(int8_t));
 }
 
-static void writeI16(PyObject* outbuf, int16_t val) {
+static void writeI16(EncodeBuffer* outbuf, int16_t val) {
   int16_t net = (int16_t)htons(val);
-  PycStringIO->cwrite(outbuf, (char*)&net, sizeof(int16_t));
+  writeBuf(outbuf, (char*)&net, sizeof(int16_t));
 }
 
-static void writeI32(PyObject* outbuf, int32_t val) {
+static void writeI32(EncodeBuffer* outbuf, int32_t val) {
   int32_t net = (int32_t)htonl(val);
-  PycStringIO->cwrite(outbuf, (char*)&net, sizeof(int32_t));
+  writeBuf(outbuf, (char*)&net, sizeof(int32_t));
 }
 
-static void writeI64(PyObject* outbuf, int64_t val) {
+static void writeI64(EncodeBuffer* outbuf, int64_t val) {
   int64_t net = (int64_t)htonll(val);
-  PycStringIO->cwrite(outbuf, (char*)&net, sizeof(int64_t));
+  writeBuf(outbuf, (char*)&net, sizeof(int64_t));
 }
 
-static void writeDouble(PyObject* outbuf, double dub) {
+static void writeDouble(EncodeBuffer* outbuf, double dub) {
   // Unfortunately, bitwise_cast doesn't work in C.  Bad C!
   union {
     double f;
@@ -335,7 +396,7 @@ static void writeDouble(PyObject* outbuf, double dub) {
 /* --- MAIN RECURSIVE OUTPUT FUCNTION -- */
 
 static int
-output_val(PyObject* output, PyObject* value, TType type, PyObject* typeargs) {
+output_val(EncodeBuffer* output, PyObject* value, TType type, PyObject* typeargs) {
   /*
    * Refcounting Strategy:
    *
@@ -421,7 +482,7 @@ output_val(PyObject* output, PyObject* value, TType type, PyObject* typeargs) {
     }
 
     writeI32(output, (int32_t) len);
-    PycStringIO->cwrite(output, PyString_AsString(value), (int32_t) len);
+    writeBuf(output, PyString_AsString(value), (int32_t) len);
     break;
   }
 
@@ -585,267 +646,1254 @@ static PyObject *
 encode_binary(PyObject *self, PyObject *args) {
   PyObject* enc_obj;
   PyObject* type_args;
-  PyObject* buf;
-  PyObject* ret = NULL;
+  Py_ssize_t size_hint = 0;
+  EncodeBuffer buf;
+  bool ok;
 
-  if (!PyArg_ParseTuple(args, "OO", &enc_obj, &type_args)) {
+  if (!PyArg_ParseTuple(args, "OO|n", &enc_obj, &type_args, &size_hint)) {
     return NULL;
   }
 
-  buf = PycStringIO->NewOutput(INIT_OUTBUF_SIZE);
-  if (output_val(buf, enc_obj, T_STRUCT, type_args)) {
-    ret = PycStringIO->cgetvalue(buf);
+  if (!init_encodebuf(&buf, size_hint)) {
+    return NULL;
   }
-
-  Py_DECREF(buf);
-  return ret;
-}
-
-/* ====== END WRITING FUNCTIONS ====== */
-
-
-/* ====== BEGIN READING FUNCTIONS ====== */
-
-/* --- LOW-LEVEL READING FUNCTIONS --- */
-
-static void
-free_decodebuf(DecodeBuffer* d) {
-  Py_XDECREF(d->stringiobuf);
-  Py_XDECREF(d->refill_callable);
+  ok = output_val(&buf, enc_obj, T_STRUCT, type_args);
+  return finish_encodebuf(&buf, ok);
 }
 
-static bool
-decode_buffer_from_obj(DecodeBuffer* dest, PyObject* obj) {
-  dest->stringiobuf = PyObject_GetAttr(obj, INTERN_STRING(cstringio_buf));
-  if (!dest->stringiobuf) {
-    return false;
+/* --- COMPACT PROTOCOL OUTPUT --- */
+
+// Stolen out of TCompactProtocol.tcc, with the same apology as TType.
+typedef enum CType {
+  CT_STOP           = 0x00,
+  CT_BOOLEAN_TRUE   = 0x01,
+  CT_BOOLEAN_FALSE  = 0x02,
+  CT_BYTE           = 0x03,
+  CT_I16            = 0x04,
+  CT_I32            = 0x05,
+  CT_I64            = 0x06,
+  CT_DOUBLE         = 0x07,
+  CT_BINARY         = 0x08,
+  CT_LIST           = 0x09,
+  CT_SET            = 0x0A,
+  CT_MAP            = 0x0B,
+  CT_STRUCT         = 0x0C
+} CType;
+
+static int8_t
+getCompactType(TType type) {
+  switch (type) {
+  case T_STOP: return CT_STOP;
+  case T_BOOL: return CT_BOOLEAN_TRUE;
+  case T_I08: return CT_BYTE;
+  case T_I16: return CT_I16;
+  case T_I32: return CT_I32;
+  case T_I64: return CT_I64;
+  case T_DOUBLE: return CT_DOUBLE;
+  case T_STRING: return CT_BINARY;
+  case T_LIST: return CT_LIST;
+  case T_SET: return CT_SET;
+  case T_MAP: return CT_MAP;
+  case T_STRUCT: return CT_STRUCT;
+  default: return -1;
   }
+}
 
-  if (!PycStringIO_InputCheck(dest->stringiobuf)) {
-    free_decodebuf(dest);
-    PyErr_SetString(PyExc_TypeError, "expecting stringio input");
-    return false;
+static void writeVarint(EncodeBuffer* outbuf, uint64_t n) {
+  char buf[10];
+  int len = 0;
+  while (n & ~(uint64_t)0x7f) {
+    buf[len++] = (char)((n & 0x7f) | 0x80);
+    n >>= 7;
   }
+  buf[len++] = (char)n;
+  writeBuf(outbuf, buf, len);
+}
 
-  dest->refill_callable = PyObject_GetAttr(obj, INTERN_STRING(cstringio_refill));
+static void writeZigZag(EncodeBuffer* outbuf, int64_t val) {
+  writeVarint(outbuf, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
 
-  if(!dest->refill_callable) {
-    free_decodebuf(dest);
-    return false;
+static void writeCompactDouble(EncodeBuffer* outbuf, double dub) {
+  union {
+    double f;
+    uint64_t t;
+  } transfer;
+  char buf[8];
+  int i;
+  transfer.f = dub;
+  // Little-endian, unlike everything else
+  for (i = 0; i < 8; i++) {
+    buf[i] = (char)(transfer.t >> (8 * i));
   }
+  writeBuf(outbuf, buf, 8);
+}
 
-  if (!PyCallable_Check(dest->refill_callable)) {
-    free_decodebuf(dest);
-    PyErr_SetString(PyExc_TypeError, "expecting callable");
-    return false;
+static void
+writeCompactFieldHeader(EncodeBuffer* outbuf, int8_t ctype, int tag, int* last_tag) {
+  int delta = tag - *last_tag;
+  if (delta > 0 && delta <= 15) {
+    writeByte(outbuf, (int8_t)((delta << 4) | ctype));
+  } else {
+    writeByte(outbuf, ctype);
+    writeZigZag(outbuf, (int16_t)tag);
   }
-
-  return true;
+  *last_tag = tag;
 }
 
-static bool readBytes(DecodeBuffer* input, char** output, int len) {
-  int read;
-
-  // TODO(dreiss): Don't fear the malloc.  Think about taking a copy of
-  //               the partial read instead of forcing the transport
-  //               to prepend it to its buffer.
-
-  read = PycStringIO->cread(input->stringiobuf, output, len);
+static int
+output_val_compact(EncodeBuffer* output, PyObject* value, TType type, PyObject* typeargs) {
+  // Same refcounting strategy as output_val.
 
-  if (read == len) {
-    return true;
-  } else if (read == -1) {
-    return false;
-  } else {
-    PyObject* newiobuf;
+  switch (type) {
 
-    // using building functions as this is a rare codepath
-    newiobuf = PyObject_CallFunction(
-        input->refill_callable, "s#i", *output, read, len, NULL);
-    if (newiobuf == NULL) {
+  case T_BOOL: {
+    // Fields put bools in their header; this is for bools in containers
+    int v = PyObject_IsTrue(value);
+    if (v == -1) {
       return false;
     }
 
-    // must do this *AFTER* the call so that we don't deref the io buffer
-    Py_CLEAR(input->stringiobuf);
-    input->stringiobuf = newiobuf;
-
-    read = PycStringIO->cread(input->stringiobuf, output, len);
+    writeByte(output, v ? CT_BOOLEAN_TRUE : CT_BOOLEAN_FALSE);
+    break;
+  }
+  case T_I08: {
+    int32_t val;
 
-    if (read == len) {
-      return true;
-    } else if (read == -1) {
-      return false;
-    } else {
-      // TODO(dreiss): This could be a valid code path for big binary blobs.
-      PyErr_SetString(PyExc_TypeError,
-          "refill claimed to have refilled the buffer, but didn't!!");
+    if (!parse_pyint(value, &val, INT8_MIN, INT8_MAX)) {
       return false;
     }
-  }
-}
-
-static int8_t readByte(DecodeBuffer* input) {
-  char* buf;
-  if (!readBytes(input, &buf, sizeof(int8_t))) {
-    return -1;
-  }
 
-  return *(int8_t*) buf;
-}
-
-static int16_t readI16(DecodeBuffer* input) {
-  char* buf;
-  if (!readBytes(input, &buf, sizeof(int16_t))) {
-    return -1;
+    writeByte(output, (int8_t) val);
+    break;
   }
+  case T_I16: {
+    int32_t val;
 
-  return (int16_t) ntohs(*(int16_t*) buf);
-}
+    if (!parse_pyint(value, &val, INT16_MIN, INT16_MAX)) {
+      return false;
+    }
 
-static int32_t readI32(DecodeBuffer* input) {
-  char* buf;
-  if (!readBytes(input, &buf, sizeof(int32_t))) {
-    return -1;
+    writeZigZag(output, val);
+    break;
   }
-  return (int32_t) ntohl(*(int32_t*) buf);
-}
+  case T_I32: {
+    int32_t val;
 
+    if (!parse_pyint(value, &val, INT32_MIN, INT32_MAX)) {
+      return false;
+    }
 
-static int64_t readI64(DecodeBuffer* input) {
-  char* buf;
-  if (!readBytes(input, &buf, sizeof(int64_t))) {
-    return -1;
+    writeZigZag(output, val);
+    break;
   }
+  case T_I64: {
+    int64_t nval = PyLong_AsLongLong(value);
 
-  return (int64_t) ntohll(*(int64_t*) buf);
-}
-
-static double readDouble(DecodeBuffer* input) {
-  union {
-    int64_t f;
-    double t;
-  } transfer;
+    if (INT_CONV_ERROR_OCCURRED(nval)) {
+      return false;
+    }
 
-  transfer.f = readI64(input);
-  if (transfer.f == -1) {
-    return -1;
+    writeZigZag(output, nval);
+    break;
   }
-  return transfer.t;
-}
 
-static bool
-checkTypeByte(DecodeBuffer* input, TType expected) {
-  TType got = readByte(input);
-  if (INT_CONV_ERROR_OCCURRED(got)) {
-    return false;
-  }
+  case T_DOUBLE: {
+    double nval = PyFloat_AsDouble(value);
+    if (nval == -1.0 && PyErr_Occurred()) {
+      return false;
+    }
 
-  if (expected != got) {
-    PyErr_SetString(PyExc_TypeError, "got wrong ttype while reading field");
-    return false;
+    writeCompactDouble(output, nval);
+    break;
   }
-  return true;
-}
-
-static bool
-skip(DecodeBuffer* input, TType type) {
-#define SKIPBYTES(n) \
-  do { \
-    if (!readBytes(input, &dummy_buf, (n))) { \
-      return false; \
-    } \
-  } while(0)
-
-  char* dummy_buf;
-
-  switch (type) {
-
-  case T_BOOL:
-  case T_I08: SKIPBYTES(1); break;
-  case T_I16: SKIPBYTES(2); break;
-  case T_I32: SKIPBYTES(4); break;
-  case T_I64:
-  case T_DOUBLE: SKIPBYTES(8); break;
 
   case T_STRING: {
-    // TODO(dreiss): Find out if these check_ssize_t32s are really necessary.
-    int len = readI32(input);
+    Py_ssize_t len = PyString_Size(value);
+
     if (!check_ssize_t_32(len)) {
       return false;
     }
-    SKIPBYTES(len);
+
+    writeVarint(output, (uint64_t) len);
+    writeBuf(output, PyString_AsString(value), (int32_t) len);
     break;
   }
 
   case T_LIST:
   case T_SET: {
-    TType etype;
-    int len, i;
+    Py_ssize_t len;
+    SetListTypeArgs parsedargs;
+    PyObject *item;
+    PyObject *iterator;
+    int8_t ctype;
 
-    etype = readByte(input);
-    if (etype == -1) {
+    if (!parse_set_list_args(&parsedargs, typeargs)) {
       return false;
     }
 
-    len = readI32(input);
-    if (!check_ssize_t_32(len)) {
+    ctype = getCompactType(parsedargs.element_type);
+    if (ctype == -1) {
+      PyErr_SetString(PyExc_TypeError, "Unexpected TType");
       return false;
     }
 
-    for (i = 0; i < len; i++) {
-      if (!skip(input, etype)) {
-        return false;
-      }
-    }
-    break;
-  }
-
-  case T_MAP: {
-    TType ktype, vtype;
-    int len, i;
+    len = PyObject_Length(value);
 
-    ktype = readByte(input);
-    if (ktype == -1) {
+    if (!check_ssize_t_32(len)) {
       return false;
     }
 
-    vtype = readByte(input);
-    if (vtype == -1) {
-      return false;
+    if (len <= 14) {
+      writeByte(output, (int8_t)((len << 4) | ctype));
+    } else {
+      writeByte(output, (int8_t)(0xf0 | ctype));
+      writeVarint(output, (uint64_t) len);
     }
 
-    len = readI32(input);
-    if (!check_ssize_t_32(len)) {
+    iterator =  PyObject_GetIter(value);
+    if (iterator == NULL) {
       return false;
     }
 
-    for (i = 0; i < len; i++) {
-      if (!(skip(input, ktype) && skip(input, vtype))) {
+    while ((item = PyIter_Next(iterator))) {
+      if (!output_val_compact(output, item, parsedargs.element_type, parsedargs.typeargs)) {
+        Py_DECREF(item);
+        Py_DECREF(iterator);
         return false;
       }
+      Py_DECREF(item);
     }
-    break;
+
+    Py_DECREF(iterator);
+
+    if (PyErr_Occurred()) {
+      return false;
+    }
+
+    break;
+  }
+
+  case T_MAP: {
+    PyObject *k, *v;
+    Py_ssize_t pos = 0;
+    Py_ssize_t len;
+    int8_t kctype, vctype;
+
+    MapTypeArgs parsedargs;
+
+    len = PyDict_Size(value);
+    if (!check_ssize_t_32(len)) {
+      return false;
+    }
+
+    if (!parse_map_args(&parsedargs, typeargs)) {
+      return false;
+    }
+
+    kctype = getCompactType(parsedargs.ktag);
+    vctype = getCompactType(parsedargs.vtag);
+    if (kctype == -1 || vctype == -1) {
+      PyErr_SetString(PyExc_TypeError, "Unexpected TType");
+      return false;
+    }
+
+    if (len == 0) {
+      writeByte(output, 0);
+      break;
+    }
+    writeVarint(output, (uint64_t) len);
+    writeByte(output, (int8_t)((kctype << 4) | vctype));
+
+    while (PyDict_Next(value, &pos, &k, &v)) {
+      Py_INCREF(k);
+      Py_INCREF(v);
+
+      if (!output_val_compact(output, k, parsedargs.ktag, parsedargs.ktypeargs)
+          || !output_val_compact(output, v, parsedargs.vtag, parsedargs.vtypeargs)) {
+        Py_DECREF(k);
+        Py_DECREF(v);
+        return false;
+      }
+      Py_DECREF(k);
+      Py_DECREF(v);
+    }
+    break;
+  }
+
+  case T_STRUCT: {
+    StructTypeArgs parsedargs;
+    Py_ssize_t nspec;
+    Py_ssize_t i;
+    int last_tag = 0;
+
+    if (!parse_struct_args(&parsedargs, typeargs)) {
+      return false;
+    }
+
+    nspec = PyTuple_Size(parsedargs.spec);
+
+    if (nspec == -1) {
+      return false;
+    }
+
+    for (i = 0; i < nspec; i++) {
+      StructItemSpec parsedspec;
+      PyObject* spec_tuple;
+      PyObject* instval = NULL;
+      int8_t ctype;
+
+      spec_tuple = PyTuple_GET_ITEM(parsedargs.spec, i);
+      if (spec_tuple == Py_None) {
+        continue;
+      }
+
+      if (!parse_struct_item_spec (&parsedspec, spec_tuple)) {
+        return false;
+      }
+
+      instval = PyObject_GetAttr(value, parsedspec.attrname);
+
+      if (!instval) {
+        return false;
+      }
+
+      if (instval == Py_None) {
+        Py_DECREF(instval);
+        continue;
+      }
+
+      if (parsedspec.type == T_BOOL) {
+        int v = PyObject_IsTrue(instval);
+        Py_DECREF(instval);
+        if (v == -1) {
+          return false;
+        }
+        writeCompactFieldHeader(output, v ? CT_BOOLEAN_TRUE : CT_BOOLEAN_FALSE,
+                                parsedspec.tag, &last_tag);
+        continue;
+      }
+
+      ctype = getCompactType(parsedspec.type);
+      if (ctype == -1) {
+        Py_DECREF(instval);
+        PyErr_SetString(PyExc_TypeError, "Unexpected TType");
+        return false;
+      }
+      writeCompactFieldHeader(output, ctype, parsedspec.tag, &last_tag);
+
+      if (!output_val_compact(output, instval, parsedspec.type, parsedspec.typeargs)) {
+        Py_DECREF(instval);
+        return false;
+      }
+
+      Py_DECREF(instval);
+    }
+
+    writeByte(output, CT_STOP);
+    break;
+  }
+
+  case T_STOP:
+  case T_VOID:
+  case T_UTF16:
+  case T_UTF8:
+  case T_U64:
+  default:
+    PyErr_SetString(PyExc_TypeError, "Unexpected TType");
+    return false;
+
+  }
+
+  return true;
+}
+
+static PyObject *
+encode_compact(PyObject *self, PyObject *args) {
+  PyObject* enc_obj;
+  PyObject* type_args;
+  Py_ssize_t size_hint = 0;
+  EncodeBuffer buf;
+  bool ok;
+
+  if (!PyArg_ParseTuple(args, "OO|n", &enc_obj, &type_args, &size_hint)) {
+    return NULL;
+  }
+
+  if (!init_encodebuf(&buf, size_hint)) {
+    return NULL;
+  }
+  ok = output_val_compact(&buf, enc_obj, T_STRUCT, type_args);
+  return finish_encodebuf(&buf, ok);
+}
+
+/* ====== END WRITING FUNCTIONS ====== */
+
+
+/* ====== BEGIN READING FUNCTIONS ====== */
+
+/* --- LOW-LEVEL READING FUNCTIONS --- */
+
+static void
+free_decodebuf(DecodeBuffer* d) {
+  Py_XDECREF(d->stringiobuf);
+  Py_XDECREF(d->refill_callable);
+  if (d->view.obj != NULL) {
+    PyBuffer_Release(&d->view);
+  }
+}
+
+/**
+ * Sets up reading straight out of obj's memory: str, bytearray and
+ * memoryview through the new buffer protocol, mmap and buffer through
+ * the old one. obj must outlive the DecodeBuffer.
+ */
+static bool
+decode_buffer_from_bytes(DecodeBuffer* dest, PyObject* obj) {
+  if (PyObject_CheckBuffer(obj)) {
+    if (PyObject_GetBuffer(obj, &dest->view, PyBUF_SIMPLE) == -1) {
+      return false;
+    }
+    dest->data = (const char*) dest->view.buf;
+    dest->len = dest->view.len;
+  } else {
+    const void* data;
+    Py_ssize_t len;
+    if (PyObject_AsReadBuffer(obj, &data, &len) == -1) {
+      return false;
+    }
+    dest->data = (const char*) data;
+    dest->len = len;
+  }
+  dest->pos = 0;
+  return true;
+}
+
+static bool
+decode_buffer_from_obj(DecodeBuffer* dest, PyObject* obj) {
+  memset(dest, 0, sizeof(*dest));
+
+  if (!PyObject_HasAttr(obj, INTERN_STRING(cstringio_buf))) {
+    return decode_buffer_from_bytes(dest, obj);
+  }
+
+  dest->stringiobuf = PyObject_GetAttr(obj, INTERN_STRING(cstringio_buf));
+  if (!dest->stringiobuf) {
+    return false;
+  }
+
+  if (!PycStringIO_InputCheck(dest->stringiobuf)) {
+    free_decodebuf(dest);
+    PyErr_SetString(PyExc_TypeError, "expecting stringio input");
+    return false;
+  }
+
+  dest->refill_callable = PyObject_GetAttr(obj, INTERN_STRING(cstringio_refill));
+
+  if(!dest->refill_callable) {
+    free_decodebuf(dest);
+    return false;
+  }
+
+  if (!PyCallable_Check(dest->refill_callable)) {
+    free_decodebuf(dest);
+    PyErr_SetString(PyExc_TypeError, "expecting callable");
+    return false;
+  }
+
+  return true;
+}
+
+static bool readBytes(DecodeBuffer* input, char** output, int len) {
+  int read;
+
+  if (input->stringiobuf == NULL) {
+    if (len < 0 || len > input->len - input->pos) {
+      PyErr_SetString(PyExc_EOFError, "ran out of bytes to decode");
+      return false;
+    }
+    *output = (char*) input->data + input->pos;
+    input->pos += len;
+    return true;
+  }
+
+  // TODO(dreiss): Don't fear the malloc.  Think about taking a copy of
+  //               the partial read instead of forcing the transport
+  //               to prepend it to its buffer.
+
+  read = PycStringIO->cread(input->stringiobuf, output, len);
+
+  if (read == len) {
+    return true;
+  } else if (read == -1) {
+    return false;
+  } else {
+    PyObject* newiobuf;
+
+    // using building functions as this is a rare codepath
+    newiobuf = PyObject_CallFunction(
+        input->refill_callable, "s#i", *output, read, len, NULL);
+    if (newiobuf == NULL) {
+      return false;
+    }
+
+    // must do this *AFTER* the call so that we don't deref the io buffer
+    Py_CLEAR(input->stringiobuf);
+    input->stringiobuf = newiobuf;
+
+    read = PycStringIO->cread(input->stringiobuf, output, len);
+
+    if (read == len) {
+      return true;
+    } else if (read == -1) {
+      return false;
+    } else {
+      // TODO(dreiss): This could be a valid code path for big binary blobs.
+      PyErr_SetString(PyExc_TypeError,
+          "refill claimed to have refilled the buffer, but didn't!!");
+      return false;
+    }
+  }
+}
+
+static int8_t readByte(DecodeBuffer* input) {
+  char* buf;
+  if (!readBytes(input, &buf, sizeof(int8_t))) {
+    return -1;
+  }
+
+  return *(int8_t*) buf;
+}
+
+static int16_t readI16(DecodeBuffer* input) {
+  char* buf;
+  if (!readBytes(input, &buf, sizeof(int16_t))) {
+    return -1;
+  }
+
+  return (int16_t) ntohs(*(int16_t*) buf);
+}
+
+static int32_t readI32(DecodeBuffer* input) {
+  char* buf;
+  if (!readBytes(input, &buf, sizeof(int32_t))) {
+    return -1;
+  }
+  return (int32_t) ntohl(*(int32_t*) buf);
+}
+
+
+static int64_t readI64(DecodeBuffer* input) {
+  char* buf;
+  if (!readBytes(input, &buf, sizeof(int64_t))) {
+    return -1;
+  }
+
+  return (int64_t) ntohll(*(int64_t*) buf);
+}
+
+static double readDouble(DecodeBuffer* input) {
+  union {
+    int64_t f;
+    double t;
+  } transfer;
+
+  transfer.f = readI64(input);
+  if (transfer.f == -1) {
+    return -1;
+  }
+  return transfer.t;
+}
+
+static bool
+checkTypeByte(DecodeBuffer* input, TType expected) {
+  TType got = readByte(input);
+  if (INT_CONV_ERROR_OCCURRED(got)) {
+    return false;
+  }
+
+  if (expected != got) {
+    PyErr_SetString(PyExc_TypeError, "got wrong ttype while reading field");
+    return false;
+  }
+  return true;
+}
+
+static bool
+skip(DecodeBuffer* input, TType type) {
+#define SKIPBYTES(n) \
+  do { \
+    if (!readBytes(input, &dummy_buf, (n))) { \
+      return false; \
+    } \
+  } while(0)
+
+  char* dummy_buf;
+
+  switch (type) {
+
+  case T_BOOL:
+  case T_I08: SKIPBYTES(1); break;
+  case T_I16: SKIPBYTES(2); break;
+  case T_I32: SKIPBYTES(4); break;
+  case T_I64:
+  case T_DOUBLE: SKIPBYTES(8); break;
+
+  case T_STRING: {
+    // TODO(dreiss): Find out if these check_ssize_t32s are really necessary.
+    int len = readI32(input);
+    if (!check_ssize_t_32(len)) {
+      return false;
+    }
+    SKIPBYTES(len);
+    break;
+  }
+
+  case T_LIST:
+  case T_SET: {
+    TType etype;
+    int len, i;
+
+    etype = readByte(input);
+    if (etype == -1) {
+      return false;
+    }
+
+    len = readI32(input);
+    if (!check_ssize_t_32(len)) {
+      return false;
+    }
+
+    for (i = 0; i < len; i++) {
+      if (!skip(input, etype)) {
+        return false;
+      }
+    }
+    break;
+  }
+
+  case T_MAP: {
+    TType ktype, vtype;
+    int len, i;
+
+    ktype = readByte(input);
+    if (ktype == -1) {
+      return false;
+    }
+
+    vtype = readByte(input);
+    if (vtype == -1) {
+      return false;
+    }
+
+    len = readI32(input);
+    if (!check_ssize_t_32(len)) {
+      return false;
+    }
+
+    for (i = 0; i < len; i++) {
+      if (!(skip(input, ktype) && skip(input, vtype))) {
+        return false;
+      }
+    }
+    break;
+  }
+
+  case T_STRUCT: {
+    while (true) {
+      TType type;
+
+      type = readByte(input);
+      if (type == -1) {
+        return false;
+      }
+
+      if (type == T_STOP)
+        break;
+
+      SKIPBYTES(2); // tag
+      if (!skip(input, type)) {
+        return false;
+      }
+    }
+    break;
+  }
+
+  case T_STOP:
+  case T_VOID:
+  case T_UTF16:
+  case T_UTF8:
+  case T_U64:
+  default:
+    PyErr_SetString(PyExc_TypeError, "Unexpected TType");
+    return false;
+
+  }
+
+  return true;
+
+#undef SKIPBYTES
+}
+
+
+/* --- HELPER FUNCTION FOR DECODE_VAL --- */
+
+static PyObject*
+decode_val(DecodeBuffer* input, TType type, PyObject* typeargs);
+
+static bool
+decode_struct(DecodeBuffer* input, PyObject* output, PyObject* spec_seq) {
+  int spec_seq_len = PyTuple_Size(spec_seq);
+  if (spec_seq_len == -1) {
+    return false;
+  }
+
+  while (true) {
+    TType type;
+    int16_t tag;
+    PyObject* item_spec;
+    PyObject* fieldval = NULL;
+    StructItemSpec parsedspec;
+
+    type = readByte(input);
+    if (type == -1) {
+      return false;
+    }
+    if (type == T_STOP) {
+      break;
+    }
+    tag = readI16(input);
+    if (INT_CONV_ERROR_OCCURRED(tag)) {
+      return false;
+    }
+    if (tag >= 0 && tag < spec_seq_len) {
+      item_spec = PyTuple_GET_ITEM(spec_seq, tag);
+    } else {
+      item_spec = Py_None;
+    }
+
+    if (item_spec == Py_None) {
+      if (!skip(input, type)) {
+        return false;
+      } else {
+        continue;
+      }
+    }
+
+    if (!parse_struct_item_spec(&parsedspec, item_spec)) {
+      return false;
+    }
+    if (parsedspec.type != type) {
+      if (!skip(input, type)) {
+        PyErr_SetString(PyExc_TypeError, "struct field had wrong type while reading and can't be skipped");
+        return false;
+      } else {
+        continue;
+      }
+    }
+
+    fieldval = decode_val(input, parsedspec.type, parsedspec.typeargs);
+    if (fieldval == NULL) {
+      return false;
+    }
+
+    if (PyObject_SetAttr(output, parsedspec.attrname, fieldval) == -1) {
+      Py_DECREF(fieldval);
+      return false;
+    }
+    Py_DECREF(fieldval);
+  }
+  return true;
+}
+
+
+/* --- MAIN RECURSIVE INPUT FUCNTION --- */
+
+// Returns a new reference.
+static PyObject*
+decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
+  switch (type) {
+
+  case T_BOOL: {
+    int8_t v = readByte(input);
+    if (INT_CONV_ERROR_OCCURRED(v)) {
+      return NULL;
+    }
+
+    switch (v) {
+    case 0: Py_RETURN_FALSE;
+    case 1: Py_RETURN_TRUE;
+    // Don't laugh.  This is a potentially serious issue.
+    default: PyErr_SetString(PyExc_TypeError, "boolean out of range"); return NULL;
+    }
+    break;
+  }
+  case T_I08: {
+    int8_t v = readByte(input);
+    if (INT_CONV_ERROR_OCCURRED(v)) {
+      return NULL;
+    }
+
+    return PyInt_FromLong(v);
+  }
+  case T_I16: {
+    int16_t v = readI16(input);
+    if (INT_CONV_ERROR_OCCURRED(v)) {
+      return NULL;
+    }
+    return PyInt_FromLong(v);
+  }
+  case T_I32: {
+    int32_t v = readI32(input);
+    if (INT_CONV_ERROR_OCCURRED(v)) {
+      return NULL;
+    }
+    return PyInt_FromLong(v);
+  }
+
+  case T_I64: {
+    int64_t v = readI64(input);
+    if (INT_CONV_ERROR_OCCURRED(v)) {
+      return NULL;
+    }
+    // TODO(dreiss): Find out if we can take this fastpath always when
+    //               sizeof(long) == sizeof(long long).
+    if (CHECK_RANGE(v, LONG_MIN, LONG_MAX)) {
+      return PyInt_FromLong((long) v);
+    }
+
+    return PyLong_FromLongLong(v);
+  }
+
+  case T_DOUBLE: {
+    double v = readDouble(input);
+    if (v == -1.0 && PyErr_Occurred()) {
+      return false;
+    }
+    return PyFloat_FromDouble(v);
+  }
+
+  case T_STRING: {
+    Py_ssize_t len = readI32(input);
+    char* buf;
+    if (!readBytes(input, &buf, len)) {
+      return NULL;
+    }
+
+    return PyString_FromStringAndSize(buf, len);
+  }
+
+  case T_LIST:
+  case T_SET: {
+    SetListTypeArgs parsedargs;
+    int32_t len;
+    PyObject* ret = NULL;
+    int i;
+
+    if (!parse_set_list_args(&parsedargs, typeargs)) {
+      return NULL;
+    }
+
+    if (!checkTypeByte(input, parsedargs.element_type)) {
+      return NULL;
+    }
+
+    len = readI32(input);
+    if (!check_ssize_t_32(len)) {
+      return NULL;
+    }
+
+    ret = PyList_New(len);
+    if (!ret) {
+      return NULL;
+    }
+
+    for (i = 0; i < len; i++) {
+      PyObject* item = decode_val(input, parsedargs.element_type, parsedargs.typeargs);
+      if (!item) {
+        Py_DECREF(ret);
+        return NULL;
+      }
+      PyList_SET_ITEM(ret, i, item);
+    }
+
+    // TODO(dreiss): Consider biting the bullet and making two separate cases
+    //               for list and set, avoiding this post facto conversion.
+    if (type == T_SET) {
+      PyObject* setret;
+#if (PY_VERSION_HEX < 0x02050000)
+      // hack needed for older versions
+      setret = PyObject_CallFunctionObjArgs((PyObject*)&PySet_Type, ret, NULL);
+#else
+      // official version
+      setret = PySet_New(ret);
+#endif
+      Py_DECREF(ret);
+      return setret;
+    }
+    return ret;
+  }
+
+  case T_MAP: {
+    int32_t len;
+    int i;
+    MapTypeArgs parsedargs;
+    PyObject* ret = NULL;
+
+    if (!parse_map_args(&parsedargs, typeargs)) {
+      return NULL;
+    }
+
+    if (!checkTypeByte(input, parsedargs.ktag)) {
+      return NULL;
+    }
+    if (!checkTypeByte(input, parsedargs.vtag)) {
+      return NULL;
+    }
+
+    len = readI32(input);
+    if (!check_ssize_t_32(len)) {
+      return false;
+    }
+
+    ret = PyDict_New();
+    if (!ret) {
+      goto error;
+    }
+
+    for (i = 0; i < len; i++) {
+      PyObject* k = NULL;
+      PyObject* v = NULL;
+      k = decode_val(input, parsedargs.ktag, parsedargs.ktypeargs);
+      if (k == NULL) {
+        goto loop_error;
+      }
+      v = decode_val(input, parsedargs.vtag, parsedargs.vtypeargs);
+      if (v == NULL) {
+        goto loop_error;
+      }
+      if (PyDict_SetItem(ret, k, v) == -1) {
+        goto loop_error;
+      }
+
+      Py_DECREF(k);
+      Py_DECREF(v);
+      continue;
+
+      // Yuck!  Destructors, anyone?
+      loop_error:
+      Py_XDECREF(k);
+      Py_XDECREF(v);
+      goto error;
+    }
+
+    return ret;
+
+    error:
+    Py_XDECREF(ret);
+    return NULL;
+  }
+
+  case T_STRUCT: {
+    StructTypeArgs parsedargs;
+	PyObject* ret;
+    if (!parse_struct_args(&parsedargs, typeargs)) {
+      return NULL;
+    }
+
+    ret = PyObject_CallObject(parsedargs.klass, NULL);
+    if (!ret) {
+      return NULL;
+    }
+
+    if (!decode_struct(input, ret, parsedargs.spec)) {
+      Py_DECREF(ret);
+      return NULL;
+    }
+
+    return ret;
+  }
+
+  case T_STOP:
+  case T_VOID:
+  case T_UTF16:
+  case T_UTF8:
+  case T_U64:
+  default:
+    PyErr_SetString(PyExc_TypeError, "Unexpected TType");
+    return NULL;
+  }
+}
+
+
+/* --- TOP-LEVEL WRAPPER FOR INPUT -- */
+
+static PyObject*
+decode_binary(PyObject *self, PyObject *args) {
+  PyObject* output_obj = NULL;
+  PyObject* transport = NULL;
+  PyObject* typeargs = NULL;
+  StructTypeArgs parsedargs;
+  DecodeBuffer input;
+  
+  if (!PyArg_ParseTuple(args, "OOO", &output_obj, &transport, &typeargs)) {
+    return NULL;
+  }
+
+  if (!parse_struct_args(&parsedargs, typeargs)) {
+    return NULL;
+  }
+
+  if (!decode_buffer_from_obj(&input, transport)) {
+    return NULL;
+  }
+
+  if (!decode_struct(&input, output_obj, parsedargs.spec)) {
+    free_decodebuf(&input);
+    return NULL;
+  }
+
+  free_decodebuf(&input);
+
+  // Say how much was consumed, so callers can walk concatenated blobs
+  if (input.stringiobuf == NULL) {
+    return PyInt_FromSsize_t(input.pos);
   }
+  Py_RETURN_NONE;
+}
 
-  case T_STRUCT: {
-    while (true) {
-      TType type;
+/* --- COMPACT PROTOCOL INPUT --- */
 
-      type = readByte(input);
-      if (type == -1) {
+static bool readUByte(DecodeBuffer* input, uint8_t* val) {
+  char* buf;
+  if (!readBytes(input, &buf, 1)) {
+    return false;
+  }
+  *val = *(uint8_t*) buf;
+  return true;
+}
+
+static bool readVarint(DecodeBuffer* input, uint64_t* val) {
+  uint64_t result = 0;
+  int shift = 0;
+  uint8_t byte;
+  while (true) {
+    if (!readUByte(input, &byte)) {
+      return false;
+    }
+    result |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *val = result;
+      return true;
+    }
+    shift += 7;
+    if (shift >= 64) {
+      PyErr_SetString(PyExc_TypeError, "variable-length int over 10 bytes");
+      return false;
+    }
+  }
+}
+
+static bool readZigZag(DecodeBuffer* input, int64_t* val) {
+  uint64_t n;
+  if (!readVarint(input, &n)) {
+    return false;
+  }
+  *val = (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+  return true;
+}
+
+static bool readCompactSize(DecodeBuffer* input, int32_t* size) {
+  uint64_t n;
+  if (!readVarint(input, &n)) {
+    return false;
+  }
+  if (n > INT32_MAX) {
+    PyErr_SetString(PyExc_OverflowError, "size out of range");
+    return false;
+  }
+  *size = (int32_t) n;
+  return true;
+}
+
+static bool readCompactDouble(DecodeBuffer* input, double* dub) {
+  union {
+    uint64_t f;
+    double t;
+  } transfer;
+  char* buf;
+  int i;
+  if (!readBytes(input, &buf, 8)) {
+    return false;
+  }
+  transfer.f = 0;
+  for (i = 0; i < 8; i++) {
+    transfer.f |= (uint64_t)(uint8_t)buf[i] << (8 * i);
+  }
+  *dub = transfer.t;
+  return true;
+}
+
+static TType
+getTType(uint8_t ctype) {
+  switch (ctype) {
+  case CT_STOP: return T_STOP;
+  case CT_BOOLEAN_TRUE:
+  case CT_BOOLEAN_FALSE: return T_BOOL;
+  case CT_BYTE: return T_I08;
+  case CT_I16: return T_I16;
+  case CT_I32: return T_I32;
+  case CT_I64: return T_I64;
+  case CT_DOUBLE: return T_DOUBLE;
+  case CT_BINARY: return T_STRING;
+  case CT_LIST: return T_LIST;
+  case CT_SET: return T_SET;
+  case CT_MAP: return T_MAP;
+  case CT_STRUCT: return T_STRUCT;
+  default:
+    PyErr_SetString(PyExc_TypeError, "Unexpected compact type");
+    return -1;
+  }
+}
+
+static bool
+readCompactFieldHeader(DecodeBuffer* input, TType* type, uint8_t* ctype,
+                       int16_t* tag, int16_t* last_tag) {
+  uint8_t byte;
+  int delta;
+  if (!readUByte(input, &byte)) {
+    return false;
+  }
+  *ctype = byte & 0x0f;
+  if (*ctype == CT_STOP) {
+    *type = T_STOP;
+    return true;
+  }
+  delta = byte >> 4;
+  if (delta == 0) {
+    int64_t val;
+    if (!readZigZag(input, &val)) {
+      return false;
+    }
+    *tag = (int16_t) val;
+  } else {
+    *tag = (int16_t)(*last_tag + delta);
+  }
+  *last_tag = *tag;
+  *type = getTType(*ctype);
+  return *type != (TType) -1;
+}
+
+static bool
+readCollectionHeader(DecodeBuffer* input, TType* etype, int32_t* len) {
+  uint8_t byte;
+  if (!readUByte(input, &byte)) {
+    return false;
+  }
+  *etype = getTType(byte & 0x0f);
+  if (*etype == (TType) -1) {
+    return false;
+  }
+  *len = byte >> 4;
+  if (*len == 15) {
+    return readCompactSize(input, len);
+  }
+  return true;
+}
+
+static bool
+readMapHeader(DecodeBuffer* input, TType* ktype, TType* vtype, int32_t* len) {
+  uint8_t types = 0;
+  if (!readCompactSize(input, len)) {
+    return false;
+  }
+  if (*len == 0) {
+    *ktype = *vtype = T_STOP;
+    return true;
+  }
+  if (!readUByte(input, &types)) {
+    return false;
+  }
+  *ktype = getTType(types >> 4);
+  *vtype = getTType(types & 0x0f);
+  return *ktype != (TType) -1 && *vtype != (TType) -1;
+}
+
+static bool
+skip_compact(DecodeBuffer* input, TType type) {
+  char* dummy_buf;
+
+  switch (type) {
+
+  case T_BOOL:
+  case T_I08:
+    return readBytes(input, &dummy_buf, 1);
+  case T_I16:
+  case T_I32:
+  case T_I64: {
+    uint64_t dummy;
+    return readVarint(input, &dummy);
+  }
+  case T_DOUBLE:
+    return readBytes(input, &dummy_buf, 8);
+
+  case T_STRING: {
+    int32_t len;
+    if (!readCompactSize(input, &len)) {
+      return false;
+    }
+    return readBytes(input, &dummy_buf, len);
+  }
+
+  case T_LIST:
+  case T_SET: {
+    TType etype;
+    int32_t len, i;
+
+    if (!readCollectionHeader(input, &etype, &len)) {
+      return false;
+    }
+    for (i = 0; i < len; i++) {
+      if (!skip_compact(input, etype)) {
         return false;
       }
+    }
+    return true;
+  }
 
-      if (type == T_STOP)
-        break;
+  case T_MAP: {
+    TType ktype, vtype;
+    int32_t len, i;
 
-      SKIPBYTES(2); // tag
-      if (!skip(input, type)) {
+    if (!readMapHeader(input, &ktype, &vtype, &len)) {
+      return false;
+    }
+    for (i = 0; i < len; i++) {
+      if (!(skip_compact(input, ktype) && skip_compact(input, vtype))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  case T_STRUCT: {
+    int16_t last_tag = 0;
+    while (true) {
+      TType ftype;
+      uint8_t ctype;
+      int16_t tag;
+
+      if (!readCompactFieldHeader(input, &ftype, &ctype, &tag, &last_tag)) {
+        return false;
+      }
+      if (ftype == T_STOP) {
+        return true;
+      }
+      // A bool field is all header
+      if (ftype != T_BOOL && !skip_compact(input, ftype)) {
         return false;
       }
     }
-    break;
   }
 
   case T_STOP:
@@ -858,20 +1906,14 @@ skip(DecodeBuffer* input, TType type) {
     return false;
 
   }
-
-  return true;
-
-#undef SKIPBYTES
 }
 
-
-/* --- HELPER FUNCTION FOR DECODE_VAL --- */
-
 static PyObject*
-decode_val(DecodeBuffer* input, TType type, PyObject* typeargs);
+decode_val_compact(DecodeBuffer* input, TType type, PyObject* typeargs);
 
 static bool
-decode_struct(DecodeBuffer* input, PyObject* output, PyObject* spec_seq) {
+decode_struct_compact(DecodeBuffer* input, PyObject* output, PyObject* spec_seq) {
+  int16_t last_tag = 0;
   int spec_seq_len = PyTuple_Size(spec_seq);
   if (spec_seq_len == -1) {
     return false;
@@ -879,49 +1921,39 @@ decode_struct(DecodeBuffer* input, PyObject* output, PyObject* spec_seq) {
 
   while (true) {
     TType type;
+    uint8_t ctype;
     int16_t tag;
     PyObject* item_spec;
     PyObject* fieldval = NULL;
     StructItemSpec parsedspec;
 
-    type = readByte(input);
-    if (type == -1) {
+    if (!readCompactFieldHeader(input, &type, &ctype, &tag, &last_tag)) {
       return false;
     }
     if (type == T_STOP) {
       break;
     }
-    tag = readI16(input);
-    if (INT_CONV_ERROR_OCCURRED(tag)) {
-      return false;
-    }
     if (tag >= 0 && tag < spec_seq_len) {
       item_spec = PyTuple_GET_ITEM(spec_seq, tag);
     } else {
       item_spec = Py_None;
     }
 
-    if (item_spec == Py_None) {
-      if (!skip(input, type)) {
-        return false;
-      } else {
-        continue;
-      }
-    }
-
-    if (!parse_struct_item_spec(&parsedspec, item_spec)) {
+    if (item_spec != Py_None && !parse_struct_item_spec(&parsedspec, item_spec)) {
       return false;
     }
-    if (parsedspec.type != type) {
-      if (!skip(input, type)) {
-        PyErr_SetString(PyExc_TypeError, "struct field had wrong type while reading and can't be skipped");
+    if (item_spec == Py_None || parsedspec.type != type) {
+      if (type != T_BOOL && !skip_compact(input, type)) {
         return false;
-      } else {
-        continue;
       }
+      continue;
     }
 
-    fieldval = decode_val(input, parsedspec.type, parsedspec.typeargs);
+    if (type == T_BOOL) {
+      fieldval = PyBool_FromLong(ctype == CT_BOOLEAN_TRUE);
+    } else {
+      fieldval = decode_val_compact(input, parsedspec.type, parsedspec.typeargs);
+    }
     if (fieldval == NULL) {
       return false;
     }
@@ -935,58 +1967,44 @@ decode_struct(DecodeBuffer* input, PyObject* output, PyObject* spec_seq) {
   return true;
 }
 
-
-/* --- MAIN RECURSIVE INPUT FUCNTION --- */
-
 // Returns a new reference.
 static PyObject*
-decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
+decode_val_compact(DecodeBuffer* input, TType type, PyObject* typeargs) {
   switch (type) {
 
   case T_BOOL: {
-    int8_t v = readByte(input);
-    if (INT_CONV_ERROR_OCCURRED(v)) {
+    uint8_t v;
+    if (!readUByte(input, &v)) {
       return NULL;
     }
-
-    switch (v) {
-    case 0: Py_RETURN_FALSE;
-    case 1: Py_RETURN_TRUE;
-    // Don't laugh.  This is a potentially serious issue.
-    default: PyErr_SetString(PyExc_TypeError, "boolean out of range"); return NULL;
-    }
-    break;
+    return PyBool_FromLong(v == CT_BOOLEAN_TRUE);
   }
   case T_I08: {
-    int8_t v = readByte(input);
-    if (INT_CONV_ERROR_OCCURRED(v)) {
+    uint8_t v;
+    if (!readUByte(input, &v)) {
       return NULL;
     }
-
-    return PyInt_FromLong(v);
+    return PyInt_FromLong((int8_t) v);
   }
-  case T_I16: {
-    int16_t v = readI16(input);
-    if (INT_CONV_ERROR_OCCURRED(v)) {
+  case T_I16:
+  case T_I32: {
+    int64_t v;
+    if (!readZigZag(input, &v)) {
       return NULL;
     }
-    return PyInt_FromLong(v);
-  }
-  case T_I32: {
-    int32_t v = readI32(input);
-    if (INT_CONV_ERROR_OCCURRED(v)) {
+    if (!CHECK_RANGE(v, type == T_I16 ? INT16_MIN : INT32_MIN,
+                     type == T_I16 ? INT16_MAX : INT32_MAX)) {
+      PyErr_SetString(PyExc_OverflowError, "int out of range");
       return NULL;
     }
-    return PyInt_FromLong(v);
+    return PyInt_FromLong((long) v);
   }
 
   case T_I64: {
-    int64_t v = readI64(input);
-    if (INT_CONV_ERROR_OCCURRED(v)) {
+    int64_t v;
+    if (!readZigZag(input, &v)) {
       return NULL;
     }
-    // TODO(dreiss): Find out if we can take this fastpath always when
-    //               sizeof(long) == sizeof(long long).
     if (CHECK_RANGE(v, LONG_MIN, LONG_MAX)) {
       return PyInt_FromLong((long) v);
     }
@@ -995,16 +2013,19 @@ decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
   }
 
   case T_DOUBLE: {
-    double v = readDouble(input);
-    if (v == -1.0 && PyErr_Occurred()) {
-      return false;
+    double v;
+    if (!readCompactDouble(input, &v)) {
+      return NULL;
     }
     return PyFloat_FromDouble(v);
   }
 
   case T_STRING: {
-    Py_ssize_t len = readI32(input);
+    int32_t len;
     char* buf;
+    if (!readCompactSize(input, &len)) {
+      return NULL;
+    }
     if (!readBytes(input, &buf, len)) {
       return NULL;
     }
@@ -1015,6 +2036,7 @@ decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
   case T_LIST:
   case T_SET: {
     SetListTypeArgs parsedargs;
+    TType etype;
     int32_t len;
     PyObject* ret = NULL;
     int i;
@@ -1023,12 +2045,11 @@ decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
       return NULL;
     }
 
-    if (!checkTypeByte(input, parsedargs.element_type)) {
+    if (!readCollectionHeader(input, &etype, &len)) {
       return NULL;
     }
-
-    len = readI32(input);
-    if (!check_ssize_t_32(len)) {
+    if (etype != parsedargs.element_type) {
+      PyErr_SetString(PyExc_TypeError, "got wrong ttype while reading field");
       return NULL;
     }
 
@@ -1038,7 +2059,7 @@ decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
     }
 
     for (i = 0; i < len; i++) {
-      PyObject* item = decode_val(input, parsedargs.element_type, parsedargs.typeargs);
+      PyObject* item = decode_val_compact(input, parsedargs.element_type, parsedargs.typeargs);
       if (!item) {
         Py_DECREF(ret);
         return NULL;
@@ -1046,15 +2067,11 @@ decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
       PyList_SET_ITEM(ret, i, item);
     }
 
-    // TODO(dreiss): Consider biting the bullet and making two separate cases
-    //               for list and set, avoiding this post facto conversion.
     if (type == T_SET) {
       PyObject* setret;
 #if (PY_VERSION_HEX < 0x02050000)
-      // hack needed for older versions
       setret = PyObject_CallFunctionObjArgs((PyObject*)&PySet_Type, ret, NULL);
 #else
-      // official version
       setret = PySet_New(ret);
 #endif
       Py_DECREF(ret);
@@ -1064,6 +2081,7 @@ decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
   }
 
   case T_MAP: {
+    TType ktype, vtype;
     int32_t len;
     int i;
     MapTypeArgs parsedargs;
@@ -1073,59 +2091,42 @@ decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
       return NULL;
     }
 
-    if (!checkTypeByte(input, parsedargs.ktag)) {
+    if (!readMapHeader(input, &ktype, &vtype, &len)) {
       return NULL;
     }
-    if (!checkTypeByte(input, parsedargs.vtag)) {
+    if (len > 0 && (ktype != parsedargs.ktag || vtype != parsedargs.vtag)) {
+      PyErr_SetString(PyExc_TypeError, "got wrong ttype while reading field");
       return NULL;
     }
 
-    len = readI32(input);
-    if (!check_ssize_t_32(len)) {
-      return false;
-    }
-
     ret = PyDict_New();
     if (!ret) {
-      goto error;
+      return NULL;
     }
 
     for (i = 0; i < len; i++) {
       PyObject* k = NULL;
       PyObject* v = NULL;
-      k = decode_val(input, parsedargs.ktag, parsedargs.ktypeargs);
-      if (k == NULL) {
-        goto loop_error;
-      }
-      v = decode_val(input, parsedargs.vtag, parsedargs.vtypeargs);
-      if (v == NULL) {
-        goto loop_error;
+      k = decode_val_compact(input, parsedargs.ktag, parsedargs.ktypeargs);
+      if (k != NULL) {
+        v = decode_val_compact(input, parsedargs.vtag, parsedargs.vtypeargs);
       }
-      if (PyDict_SetItem(ret, k, v) == -1) {
-        goto loop_error;
+      if (k == NULL || v == NULL || PyDict_SetItem(ret, k, v) == -1) {
+        Py_XDECREF(k);
+        Py_XDECREF(v);
+        Py_DECREF(ret);
+        return NULL;
       }
-
       Py_DECREF(k);
       Py_DECREF(v);
-      continue;
-
-      // Yuck!  Destructors, anyone?
-      loop_error:
-      Py_XDECREF(k);
-      Py_XDECREF(v);
-      goto error;
     }
 
     return ret;
-
-    error:
-    Py_XDECREF(ret);
-    return NULL;
   }
 
   case T_STRUCT: {
     StructTypeArgs parsedargs;
-	PyObject* ret;
+    PyObject* ret;
     if (!parse_struct_args(&parsedargs, typeargs)) {
       return NULL;
     }
@@ -1135,7 +2136,7 @@ decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
       return NULL;
     }
 
-    if (!decode_struct(input, ret, parsedargs.spec)) {
+    if (!decode_struct_compact(input, ret, parsedargs.spec)) {
       Py_DECREF(ret);
       return NULL;
     }
@@ -1154,17 +2155,14 @@ decode_val(DecodeBuffer* input, TType type, PyObject* typeargs) {
   }
 }
 
-
-/* --- TOP-LEVEL WRAPPER FOR INPUT -- */
-
 static PyObject*
-decode_binary(PyObject *self, PyObject *args) {
+decode_compact(PyObject *self, PyObject *args) {
   PyObject* output_obj = NULL;
   PyObject* transport = NULL;
   PyObject* typeargs = NULL;
   StructTypeArgs parsedargs;
-  DecodeBuffer input = {0, 0};
-  
+  DecodeBuffer input;
+
   if (!PyArg_ParseTuple(args, "OOO", &output_obj, &transport, &typeargs)) {
     return NULL;
   }
@@ -1177,13 +2175,17 @@ decode_binary(PyObject *self, PyObject *args) {
     return NULL;
   }
 
-  if (!decode_struct(&input, output_obj, parsedargs.spec)) {
+  if (!decode_struct_compact(&input, output_obj, parsedargs.spec)) {
     free_decodebuf(&input);
     return NULL;
   }
 
   free_decodebuf(&input);
 
+  // Say how much was consumed, so callers can walk concatenated blobs
+  if (input.stringiobuf == NULL) {
+    return PyInt_FromSsize_t(input.pos);
+  }
   Py_RETURN_NONE;
 }
 
@@ -1196,6 +2198,8 @@ static PyMethodDef ThriftFastBinaryMethods[] = {
 
   {"encode_binary",  encode_binary, METH_VARARGS, ""},
   {"decode_binary",  decode_binary, METH_VARARGS, ""},
+  {"encode_compact",  encode_compact, METH_VARARGS, ""},
+  {"decode_compact",  decode_compact, METH_VARARGS, ""},
 
   {NULL, NULL, 0, NULL}        /* Sentinel */
 };
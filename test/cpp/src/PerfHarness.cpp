@@ -0,0 +1,591 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Measures what one RPC costs in hardware terms, for each server type and
+ * protocol the ThriftTest server comes in.  Client and server run in this
+ * process, over a loopback TCP connection or a socketpair, and
+ * perf_event_open() counts cycles, instructions, cache misses and context
+ * switches across all of their threads while the client makes its calls.
+ *
+ * Results are written as JSON, one object per combination, so that runs on
+ * successive revisions can be compared to find the change that made a path
+ * slower.  Counters the kernel won't give (see
+ * /proc/sys/kernel/perf_event_paranoid, or a VM without a PMU) come out as
+ * null; wall time is always there.
+ */
+
+#include <inttypes.h>
+#include <errno.h>
+#include <string.h>
+
+#include <thrift/concurrency/Monitor.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#include <thrift/concurrency/Util.h>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/protocol/TJSONProtocol.h>
+#include <thrift/server/TSimpleServer.h>
+#include <thrift/server/TThreadedServer.h>
+#include <thrift/server/TThreadPoolServer.h>
+#include <thrift/server/TNonblockingServer.h>
+#include <thrift/transport/TServerSocket.h>
+#include <thrift/transport/TSocket.h>
+#include <thrift/transport/TBufferTransports.h>
+#include "ThriftTest.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <signal.h>
+
+using namespace std;
+using namespace boost;
+
+using namespace apache::thrift;
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace apache::thrift::server;
+
+using namespace thrift::test;
+
+/**
+ * Answers the calls the harness makes without printing, so that what is
+ * measured is the server rather than the terminal.
+ */
+class QuietHandler : public ThriftTestNull {
+ public:
+  void testString(string& out, const string& thing) {
+    out = thing;
+  }
+
+  int32_t testI32(const int32_t thing) {
+    return thing;
+  }
+
+  void testStruct(Xtruct& out, const Xtruct& thing) {
+    out = thing;
+  }
+};
+
+/**
+ * Hardware and software counters for every thread of the process.
+ *
+ * The counters are opened with inherit set, so they follow the threads the
+ * process starts afterwards: everything a server and its client need has
+ * to be created after the counters are.  Reading one sums the threads
+ * still running with those that have exited.
+ */
+class PerfCounters {
+ public:
+  static const int NUM_COUNTERS = 4;
+
+  static const char* name(int i) {
+    static const char* names[NUM_COUNTERS] = {
+      "cycles", "instructions", "cache_misses", "context_switches"
+    };
+    return names[i];
+  }
+
+  PerfCounters() {
+#ifdef __linux__
+    static const uint32_t types[NUM_COUNTERS] = {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+      PERF_TYPE_SOFTWARE
+    };
+    static const uint64_t configs[NUM_COUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES
+    };
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+      fds_[i] = open(types[i], configs[i], false);
+      if (fds_[i] < 0 && errno == EACCES) {
+        // Unprivileged users may only count user space
+        fds_[i] = open(types[i], configs[i], true);
+      }
+    }
+#else
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+      fds_[i] = -1;
+    }
+#endif
+  }
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+      if (fds_[i] >= 0) {
+        ::close(fds_[i]);
+      }
+    }
+#endif
+  }
+
+  void start() {
+#ifdef __linux__
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+      if (fds_[i] >= 0) {
+        ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  void stop() {
+#ifdef __linux__
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+      if (fds_[i] >= 0) {
+        ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+#endif
+  }
+
+  /**
+   * The count since start(), scaled up for any time the kernel had it off
+   * the PMU to share it.  False if the counter isn't available.
+   */
+  bool read(int i, double& value) {
+#ifdef __linux__
+    uint64_t data[3];
+    if (fds_[i] < 0 || ::read(fds_[i], data, sizeof(data)) != sizeof(data)) {
+      return false;
+    }
+    if (data[2] == 0) {
+      // Never got onto the PMU
+      return false;
+    }
+    value = static_cast<double>(data[0]) * data[1] / data[2];
+    return true;
+#else
+    (void)i;
+    (void)value;
+    return false;
+#endif
+  }
+
+ private:
+#ifdef __linux__
+  static int open(uint32_t type, uint64_t config, bool userOnly) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    attr.exclude_kernel = userOnly ? 1 : 0;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+#endif
+
+  int fds_[NUM_COUNTERS];
+};
+
+/**
+ * Hands out one end of a socketpair as the one connection, then waits
+ * until interrupted as a listening socket would with no clients coming.
+ */
+class TSocketPairServerTransport : public TServerTransport {
+ public:
+  TSocketPairServerTransport(THRIFT_SOCKET socket) :
+    socket_(socket),
+    accepted_(false),
+    interrupted_(false) {}
+
+  void interrupt() {
+    Synchronized s(monitor_);
+    interrupted_ = true;
+    monitor_.notifyAll();
+  }
+
+  void close() {
+    interrupt();
+  }
+
+ protected:
+  boost::shared_ptr<TTransport> acceptImpl() {
+    Synchronized s(monitor_);
+    while (accepted_ && !interrupted_) {
+      monitor_.waitForever();
+    }
+    if (interrupted_) {
+      throw TTransportException(TTransportException::INTERRUPTED);
+    }
+    accepted_ = true;
+    return boost::shared_ptr<TTransport>(new TSocket(socket_));
+  }
+
+ private:
+  THRIFT_SOCKET socket_;
+  bool accepted_;
+  bool interrupted_;
+  Monitor monitor_;
+};
+
+/**
+ * Lets the harness wait for the server to be serving.
+ */
+class ReadyHandler : public TServerEventHandler {
+ public:
+  ReadyHandler() : ready_(false) {}
+
+  void preServe() {
+    Synchronized s(monitor_);
+    ready_ = true;
+    monitor_.notifyAll();
+  }
+
+  void waitUntilReady() {
+    Synchronized s(monitor_);
+    while (!ready_) {
+      monitor_.waitForever();
+    }
+  }
+
+ private:
+  bool ready_;
+  Monitor monitor_;
+};
+
+class ServeTask : public Runnable {
+ public:
+  ServeTask(boost::shared_ptr<TServer> server) : server_(server) {}
+
+  void run() {
+    try {
+      server_->serve();
+    } catch (const TException& tx) {
+      cerr << "serve(): " << tx.what() << endl;
+    }
+  }
+
+ private:
+  boost::shared_ptr<TServer> server_;
+};
+
+static const int64_t NS_PER_S = 1000000000LL;
+
+struct Options {
+  int port;
+  int calls;
+  int warmup;
+  string call;
+  uint32_t size;
+  size_t workers;
+};
+
+struct Result {
+  string server;
+  string protocol;
+  string link;
+  int calls;
+  double wallNs;
+  bool have[PerfCounters::NUM_COUNTERS];
+  double counts[PerfCounters::NUM_COUNTERS];
+};
+
+static boost::shared_ptr<TProtocolFactory> protocolFactory(const string& type) {
+  if (type == "binary") {
+    return boost::shared_ptr<TProtocolFactory>(new TBinaryProtocolFactory());
+  } else if (type == "compact") {
+    return boost::shared_ptr<TProtocolFactory>(new TCompactProtocolFactory());
+  } else if (type == "json") {
+    return boost::shared_ptr<TProtocolFactory>(new TJSONProtocolFactory());
+  }
+  throw invalid_argument("Unknown protocol type " + type);
+}
+
+static void makeCalls(ThriftTestClient& client, const Options& options,
+                      int calls) {
+  string payload(options.size, 'x');
+  Xtruct thing;
+  thing.string_thing = payload;
+  thing.byte_thing = 1;
+  thing.i32_thing = -3;
+  thing.i64_thing = -5;
+
+  string s;
+  Xtruct x;
+  for (int i = 0; i < calls; ++i) {
+    if (options.call == "void") {
+      client.testVoid();
+    } else if (options.call == "i32") {
+      client.testI32(i);
+    } else if (options.call == "string") {
+      client.testString(s, payload);
+    } else {
+      client.testStruct(x, thing);
+    }
+  }
+}
+
+/**
+ * Serves and calls one combination, counting over the measured calls.
+ */
+static Result measure(const Options& options,
+                      const string& serverType,
+                      const string& protocolType,
+                      const string& link) {
+  // Before any thread of the run exists, so that all of them are counted
+  PerfCounters counters;
+
+  boost::shared_ptr<TProtocolFactory> protocols = protocolFactory(protocolType);
+  boost::shared_ptr<QuietHandler> handler(new QuietHandler());
+  boost::shared_ptr<TProcessor> processor(new ThriftTestProcessor(handler));
+  boost::shared_ptr<TTransportFactory> framed(new TFramedTransportFactory());
+
+  THRIFT_SOCKET pair[2] = { THRIFT_INVALID_SOCKET, THRIFT_INVALID_SOCKET };
+  boost::shared_ptr<TServerTransport> serverTransport;
+  if (link == "socketpair") {
+    if (THRIFT_SOCKETPAIR(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+      throw TTransportException(TTransportException::UNKNOWN, "socketpair()",
+                                THRIFT_GET_SOCKET_ERROR);
+    }
+    serverTransport.reset(new TSocketPairServerTransport(pair[0]));
+  } else {
+    serverTransport.reset(new TServerSocket(options.port));
+  }
+
+  boost::shared_ptr<ThreadManager> threadManager;
+  boost::shared_ptr<TServer> server;
+  if (serverType == "simple") {
+    server.reset(new TSimpleServer(processor, serverTransport, framed,
+                                   protocols));
+  } else if (serverType == "threaded") {
+    server.reset(new TThreadedServer(processor, serverTransport, framed,
+                                     protocols));
+  } else if (serverType == "thread-pool") {
+    threadManager = ThreadManager::newSimpleThreadManager(options.workers);
+    threadManager->threadFactory(
+      boost::shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory()));
+    threadManager->start();
+    server.reset(new TThreadPoolServer(processor, serverTransport, framed,
+                                       protocols, threadManager));
+  } else if (serverType == "nonblocking") {
+    server.reset(new TNonblockingServer(processor, protocols, options.port));
+  } else {
+    throw invalid_argument("Unknown server type " + serverType);
+  }
+
+  boost::shared_ptr<ReadyHandler> ready(new ReadyHandler());
+  server->setServerEventHandler(ready);
+  PlatformThreadFactory threadFactory;
+  threadFactory.setDetached(false);
+  boost::shared_ptr<Thread> serveThread =
+    threadFactory.newThread(boost::shared_ptr<Runnable>(new ServeTask(server)));
+  serveThread->start();
+  ready->waitUntilReady();
+
+  boost::shared_ptr<TSocket> socket;
+  if (link == "socketpair") {
+    socket.reset(new TSocket(pair[1]));
+  } else {
+    socket.reset(new TSocket("127.0.0.1", options.port));
+  }
+  boost::shared_ptr<TTransport> transport(new TFramedTransport(socket));
+  ThriftTestClient client(protocols->getProtocol(transport));
+  if (!transport->isOpen()) {
+    transport->open();
+  }
+
+  makeCalls(client, options, options.warmup);
+
+  Result result;
+  result.server = serverType;
+  result.protocol = protocolType;
+  result.link = link;
+  result.calls = options.calls;
+
+  int64_t startNs = Util::monotonicTimeTicks(NS_PER_S);
+  counters.start();
+  makeCalls(client, options, options.calls);
+  counters.stop();
+  result.wallNs = static_cast<double>(Util::monotonicTimeTicks(NS_PER_S) - startNs);
+  for (int i = 0; i < PerfCounters::NUM_COUNTERS; ++i) {
+    result.have[i] = counters.read(i, result.counts[i]);
+  }
+
+  transport->close();
+  server->stop();
+  serveThread->join();
+  if (threadManager) {
+    threadManager->stop();
+  }
+  return result;
+}
+
+static void writeJson(ostream& out, const Options& options,
+                      const vector<Result>& results) {
+  out << "{\n"
+      << "  \"call\": \"" << options.call << "\",\n"
+      << "  \"size\": " << options.size << ",\n"
+      << "  \"results\": [";
+  for (size_t r = 0; r < results.size(); ++r) {
+    const Result& result = results[r];
+    out << (r > 0 ? "," : "") << "\n    {"
+        << "\"server\": \"" << result.server << "\", "
+        << "\"protocol\": \"" << result.protocol << "\", "
+        << "\"link\": \"" << result.link << "\", "
+        << "\"calls\": " << result.calls << ", "
+        << "\"wall_ns_per_call\": " << result.wallNs / result.calls;
+    for (int i = 0; i < PerfCounters::NUM_COUNTERS; ++i) {
+      out << ", \"" << PerfCounters::name(i) << "_per_call\": ";
+      if (result.have[i]) {
+        out << result.counts[i] / result.calls;
+      } else {
+        out << "null";
+      }
+    }
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+static vector<string> choices(const string& value, const char* all) {
+  vector<string> result;
+  istringstream in(value == "all" ? string(all) : value);
+  string item;
+  while (getline(in, item, ',')) {
+    if (!item.empty()) {
+      result.push_back(item);
+    }
+  }
+  return result;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  options.port = 9090;
+  options.calls = 10000;
+  options.warmup = 1000;
+  options.call = "struct";
+  options.size = 64;
+  options.workers = 4;
+  string servers = "all";
+  string protocols = "all";
+  string links = "all";
+  string output;
+
+  program_options::options_description desc("Allowed options");
+  desc.add_options()
+      ("help,h", "produce help message")
+      ("port", program_options::value<int>(&options.port)->default_value(options.port),
+        "Port for loopback runs")
+      ("server-type", program_options::value<string>(&servers)->default_value(servers),
+        "Comma separated server types: simple, thread-pool, threaded, nonblocking, or all")
+      ("protocol", program_options::value<string>(&protocols)->default_value(protocols),
+        "Comma separated protocols: binary, compact, json, or all")
+      ("link", program_options::value<string>(&links)->default_value(links),
+        "Comma separated links: tcp (loopback), socketpair, or all")
+      ("call", program_options::value<string>(&options.call)->default_value(options.call),
+        "Call to make: void, i32, string or struct")
+      ("size", program_options::value<uint32_t>(&options.size)->default_value(options.size),
+        "Bytes of string in each string or struct call")
+      ("calls,n", program_options::value<int>(&options.calls)->default_value(options.calls),
+        "Calls measured for each combination")
+      ("warmup", program_options::value<int>(&options.warmup)->default_value(options.warmup),
+        "Calls made before measuring")
+      ("workers", program_options::value<size_t>(&options.workers)->default_value(options.workers),
+        "Workers of the thread-pool server")
+      ("output,o", program_options::value<string>(&output),
+        "File to write the JSON results to, rather than standard output")
+  ;
+
+  program_options::variables_map vm;
+  program_options::store(program_options::parse_command_line(argc, argv, desc), vm);
+  program_options::notify(vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 1;
+  }
+  if (options.calls <= 0) {
+    cerr << "calls must be positive" << endl;
+    return 1;
+  }
+
+#ifndef _WIN32
+  signal(SIGPIPE, SIG_IGN);
+#endif
+
+  vector<Result> results;
+  vector<string> serverTypes = choices(servers, "simple,thread-pool,threaded,nonblocking");
+  vector<string> protocolTypes = choices(protocols, "binary,compact,json");
+  vector<string> linkTypes = choices(links, "tcp,socketpair");
+  for (size_t s = 0; s < serverTypes.size(); ++s) {
+    for (size_t p = 0; p < protocolTypes.size(); ++p) {
+      for (size_t l = 0; l < linkTypes.size(); ++l) {
+        if (linkTypes[l] == "socketpair" && serverTypes[s] == "nonblocking") {
+          // It only serves sockets it accepts itself
+          continue;
+        }
+        try {
+          Result result = measure(options, serverTypes[s], protocolTypes[p],
+                                  linkTypes[l]);
+          cerr << result.server << "/" << result.protocol << "/" << result.link
+               << ": " << result.wallNs / result.calls << " ns";
+          for (int i = 0; i < PerfCounters::NUM_COUNTERS; ++i) {
+            if (result.have[i]) {
+              cerr << ", " << result.counts[i] / result.calls << " "
+                   << PerfCounters::name(i);
+            }
+          }
+          cerr << " per call" << endl;
+          results.push_back(result);
+        } catch (const std::exception& e) {
+          cerr << serverTypes[s] << "/" << protocolTypes[p] << "/"
+               << linkTypes[l] << ": " << e.what() << endl;
+          return 1;
+        }
+      }
+    }
+  }
+
+  if (output.empty()) {
+    writeJson(cout, options, results);
+  } else {
+    ofstream out(output.c_str());
+    writeJson(out, options, results);
+    if (!out) {
+      cerr << "Could not write " << output << endl;
+      return 1;
+    }
+  }
+  return 0;
+}
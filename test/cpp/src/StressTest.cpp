@@ -22,18 +22,27 @@
 #include <thrift/concurrency/Monitor.h>
 #include <thrift/concurrency/Util.h>
 #include <thrift/concurrency/Mutex.h>
+#include <thrift/TAllocTracking.h>
+#include <thrift/processor/TLatencyStatsHandler.h>
 #include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/server/TNonblockingServer.h>
 #include <thrift/server/TSimpleServer.h>
 #include <thrift/server/TThreadPoolServer.h>
 #include <thrift/server/TThreadedServer.h>
+#include <thrift/transport/PlatformSocket.h>
 #include <thrift/transport/TServerSocket.h>
 #include <thrift/transport/TSocket.h>
 #include <thrift/transport/TTransportUtils.h>
 #include <thrift/transport/TFileTransport.h>
 #include <thrift/TLogging.h>
 
+#include "AllocInterposer.h"
 #include "Service.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <set>
 #include <stdexcept>
@@ -49,6 +58,9 @@ using namespace apache::thrift::transport;
 using namespace apache::thrift::server;
 using namespace apache::thrift::concurrency;
 
+using apache::thrift::TAllocTracking;
+using apache::thrift::processor::TLatencyStatsHandler;
+
 using namespace test::stress;
 
 struct eqstr {
@@ -106,16 +118,177 @@ private:
 
 };
 
+/**
+ * Latencies in microseconds, in TLatencyStatsHandler's log-linear buckets,
+ * which are good to within 12.5%.  Histograms written with write() by load
+ * generators on other machines can be read back and merged.
+ */
+class Histogram {
+public:
+  Histogram() : _count(0), _sum(0), _max(0) {
+    memset(_buckets, 0, sizeof(_buckets));
+  }
+
+  void record(int64_t usec) {
+    uint64_t value = usec > 0 ? static_cast<uint64_t>(usec) : 0;
+    _buckets[TLatencyStatsHandler::bucketOf(value)]++;
+    _count++;
+    _sum += value;
+    if (value > _max) {
+      _max = value;
+    }
+  }
+
+  void merge(const Histogram& other) {
+    for (int ix = 0; ix < TLatencyStatsHandler::NUM_BUCKETS; ix++) {
+      _buckets[ix] += other._buckets[ix];
+    }
+    _count += other._count;
+    _sum += other._sum;
+    if (other._max > _max) {
+      _max = other._max;
+    }
+  }
+
+  uint64_t count() const { return _count; }
+
+  // The most a sample in a bucket can be
+  static uint64_t bucketTop(int bucket) {
+    return bucket + 1 < TLatencyStatsHandler::NUM_BUCKETS
+      ? TLatencyStatsHandler::bucketFloor(bucket + 1) - 1
+      : TLatencyStatsHandler::bucketFloor(bucket);
+  }
+
+  uint64_t percentile(double q) const {
+    if (_count == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * _count + 0.5);
+    if (rank == 0) {
+      rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int ix = 0; ix < TLatencyStatsHandler::NUM_BUCKETS; ix++) {
+      seen += _buckets[ix];
+      if (seen >= rank) {
+        return std::min(bucketTop(ix), _max);
+      }
+    }
+    return _max;
+  }
+
+  void printSummary(ostream& out) const {
+    out << "latency us : p50 " << percentile(0.5) << ", p90 " << percentile(0.9)
+        << ", p99 " << percentile(0.99) << ", p999 " << percentile(0.999)
+        << ", max " << _max << ", mean " << (_count ? _sum / _count : 0) << endl;
+  }
+
+  /**
+   * The percentile distribution in the HdrHistogram text format, which its
+   * plotters read, in microseconds: a line for every bucket with samples.
+   */
+  void printHdr(ostream& out) const {
+    char line[128];
+    snprintf(line, sizeof(line), "%12s %14s %10s %14s\n\n",
+             "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    out << line;
+    uint64_t seen = 0;
+    for (int ix = 0; ix < TLatencyStatsHandler::NUM_BUCKETS; ix++) {
+      if (_buckets[ix] == 0) {
+        continue;
+      }
+      seen += _buckets[ix];
+      double q = static_cast<double>(seen) / _count;
+      if (q < 1.0) {
+        snprintf(line, sizeof(line), "%12.3f %14.12f %10llu %14.2f\n",
+                 static_cast<double>(std::min(bucketTop(ix), _max)), q,
+                 static_cast<unsigned long long>(seen), 1.0 / (1.0 - q));
+      } else {
+        snprintf(line, sizeof(line), "%12.3f %14.12f %10llu\n",
+                 static_cast<double>(_max), q, static_cast<unsigned long long>(seen));
+      }
+      out << line;
+    }
+    snprintf(line, sizeof(line), "#[Mean    = %12.3f, Max            = %12.3f]\n",
+             _count ? static_cast<double>(_sum) / _count : 0.0, static_cast<double>(_max));
+    out << line;
+    snprintf(line, sizeof(line), "#[Total count    = %12llu]\n",
+             static_cast<unsigned long long>(_count));
+    out << line;
+  }
+
+  // "sum max" on the first line, then "bucket count" for the buckets used
+  void write(ostream& out) const {
+    out << _sum << " " << _max << endl;
+    for (int ix = 0; ix < TLatencyStatsHandler::NUM_BUCKETS; ix++) {
+      if (_buckets[ix] != 0) {
+        out << ix << " " << _buckets[ix] << endl;
+      }
+    }
+  }
+
+  bool read(istream& in) {
+    uint64_t sum;
+    uint64_t max;
+    if (!(in >> sum >> max)) {
+      return false;
+    }
+    Histogram other;
+    other._sum = sum;
+    other._max = max;
+    int bucket;
+    uint64_t count;
+    while (in >> bucket >> count) {
+      if (bucket < 0 || bucket >= TLatencyStatsHandler::NUM_BUCKETS) {
+        return false;
+      }
+      other._buckets[bucket] += count;
+      other._count += count;
+    }
+    merge(other);
+    return true;
+  }
+
+private:
+  uint64_t _buckets[TLatencyStatsHandler::NUM_BUCKETS];
+  uint64_t _count;
+  uint64_t _sum;
+  uint64_t _max;
+};
+
+/**
+ * When the clients start, and how they pace their calls.  With a rate, each
+ * client sends its share of it open loop: calls go out on a schedule, at
+ * even intervals or as a Poisson process, whether or not the last has been
+ * answered, and a call's latency is timed from when it was due to be sent.
+ * A server that falls behind then shows in the latencies rather than in a
+ * lower rate.  Without one, each client sends its calls back to back.
+ */
+struct Schedule {
+  double rate;
+  bool poisson;
+  int64_t start;
+  // Calls due before this are warmup, and are not recorded
+  int64_t measureFrom;
+  // Open loop calls are sent until this
+  int64_t end;
+};
+
 class ClientThread: public Runnable {
 public:
 
-  ClientThread(boost::shared_ptr<TTransport>transport, boost::shared_ptr<ServiceClient> client, Monitor& monitor, size_t& workerCount, size_t loopCount, TType loopType) :
+  ClientThread(boost::shared_ptr<TTransport>transport, boost::shared_ptr<ServiceClient> client, Monitor& monitor, size_t& workerCount, size_t loopCount, TType loopType, const Schedule& schedule, uint64_t seed) :
     _transport(transport),
     _client(client),
     _monitor(monitor),
     _workerCount(workerCount),
     _loopCount(loopCount),
-    _loopType(loopType)
+    _loopType(loopType),
+    _schedule(schedule),
+    _random(seed | 1),
+    _sent(0),
+    _calls(0),
+    _errors(0)
   {}
 
   void run() {
@@ -128,17 +301,20 @@ public:
       }
     }
 
+    sleepUntil(_schedule.start);
+
     _startTime = Util::currentTime();
 
-    _transport->open();
+    try {
+      _transport->open();
 
-    switch(_loopType) {
-    case T_VOID: loopEchoVoid(); break;
-    case T_BYTE: loopEchoByte(); break;
-    case T_I32: loopEchoI32(); break;
-    case T_I64: loopEchoI64(); break;
-    case T_STRING: loopEchoString(); break;
-    default: cerr << "Unexpected loop type" << _loopType << endl; break;
+      if (_schedule.rate > 0) {
+        loopOpen();
+      } else {
+        loopClosed();
+      }
+    } catch (TException& e) {
+      cerr << "Client failed: " << e.what() << endl;
     }
 
     _endTime = Util::currentTime();
@@ -158,67 +334,120 @@ public:
     }
   }
 
-  void loopEchoVoid() {
+  void loopClosed() {
     for (size_t ix = 0; ix < _loopCount; ix++) {
-      _client->echoVoid();
+      int64_t sent = Util::currentTimeUsec();
+      if (call()) {
+        record(sent, Util::currentTimeUsec() - sent);
+      }
     }
   }
 
-  void loopEchoByte() {
-    for (size_t ix = 0; ix < _loopCount; ix++) {
-      int8_t arg = 1;
-      int8_t result;
-      result =_client->echoByte(arg);
-      assert(result == arg);
+  void loopOpen() {
+    double interval = 1000000.0 / _schedule.rate;
+    // Start at a random point in the first interval, so clients don't send together
+    double due = _schedule.start + interval * nextUniform();
+    while (due < _schedule.end) {
+      int64_t dueUsec = static_cast<int64_t>(due);
+      sleepUntil(dueUsec);
+      if (call()) {
+        record(dueUsec, Util::currentTimeUsec() - dueUsec);
+      }
+      if (_schedule.poisson) {
+        due += -log(1.0 - nextUniform()) * interval;
+      } else {
+        due += interval;
+      }
     }
   }
 
-  void loopEchoI32() {
-    for (size_t ix = 0; ix < _loopCount; ix++) {
-      int32_t arg = 1;
-      int32_t result;
-      result =_client->echoI32(arg);
-      assert(result == arg);
+  // Makes one call, making the connection again if it fails
+  bool call() {
+    _sent++;
+    try {
+      switch(_loopType) {
+      case T_VOID: _client->echoVoid(); break;
+      case T_BYTE: checkResult(_client->echoByte(1) == 1); break;
+      case T_I32: checkResult(_client->echoI32(1) == 1); break;
+      case T_I64: checkResult(_client->echoI64(1) == 1); break;
+      case T_STRING: {
+        string result;
+        _client->echoString(result, "hello");
+        checkResult(result == "hello");
+        break;
+      }
+      default: cerr << "Unexpected loop type" << _loopType << endl; break;
+      }
+      return true;
+    } catch (TException&) {
+      _errors++;
+      _transport->close();
+      try {
+        _transport->open();
+      } catch (TException&) {
+        THRIFT_SLEEP_USEC(10000);
+      }
+      return false;
     }
   }
 
-  void loopEchoI64() {
-    for (size_t ix = 0; ix < _loopCount; ix++) {
-      int64_t arg = 1;
-      int64_t result;
-      result =_client->echoI64(arg);
-      assert(result == arg);
+  void checkResult(bool ok) {
+    assert(ok);
+    (void)ok;
+  }
+
+  void record(int64_t sent, int64_t usec) {
+    if (sent >= _schedule.measureFrom) {
+      _calls++;
+      _latency.record(usec);
     }
   }
 
-  void loopEchoString() {
-    for (size_t ix = 0; ix < _loopCount; ix++) {
-      string arg = "hello";
-      string result;
-      _client->echoString(result, arg);
-      assert(result == arg);
+  static void sleepUntil(int64_t usec) {
+    // A little at a time, as usleep() may not take a second or more
+    for (int64_t now = Util::currentTimeUsec(); usec > now; now = Util::currentTimeUsec()) {
+      THRIFT_SLEEP_USEC(static_cast<unsigned int>(std::min<int64_t>(usec - now, 100000)));
     }
   }
 
+  // Uniform in [0, 1), from a xorshift generator of the thread's own
+  double nextUniform() {
+    _random ^= _random << 13;
+    _random ^= _random >> 7;
+    _random ^= _random << 17;
+    return static_cast<double>(_random >> 11) / 9007199254740992.0;
+  }
+
   boost::shared_ptr<TTransport> _transport;
   boost::shared_ptr<ServiceClient> _client;
   Monitor& _monitor;
   size_t& _workerCount;
   size_t _loopCount;
   TType _loopType;
+  const Schedule& _schedule;
+  uint64_t _random;
   int64_t _startTime;
   int64_t _endTime;
   bool _done;
   Monitor _sleep;
+  // Calls made, including the warmup's and those that failed
+  uint64_t _sent;
+  // Calls answered, after the warmup
+  uint64_t _calls;
+  uint64_t _errors;
+  Histogram _latency;
 };
 
 
 int main(int argc, char **argv) {
 
   int port = 9091;
+  string host = "127.0.0.1";
   string serverType = "thread-pool";
   string protocolType = "binary";
+  string transportType = "buffered";
   size_t workerCount = 4;
+  size_t ioThreadCount = 1;
   size_t clientCount = 20;
   size_t loopCount = 50000;
   TType loopType  = T_VOID;
@@ -227,22 +456,41 @@ int main(int argc, char **argv) {
   bool logRequests = false;
   string requestLogPath = "./requestlog.tlog";
   bool replayRequests = false;
+  double rate = 0;
+  string arrivals = "constant";
+  double duration = 10;
+  double warmup = 0;
+  int64_t startAt = 0;
+  string hdrPath;
+  string histogramPath;
+  string mergePaths;
 
   ostringstream usage;
 
   usage <<
-    argv[0] << " [--port=<port number>] [--server] [--server-type=<server-type>] [--protocol-type=<protocol-type>] [--workers=<worker-count>] [--clients=<client-count>] [--loop=<loop-count>]" << endl <<
+    argv[0] << " [--port=<port number>] [--host=<host>] [--server] [--server-type=<server-type>] [--protocol-type=<protocol-type>] [--transport=<transport>] [--workers=<worker-count>] [--io-threads=<io-thread-count>] [--clients=<client-count>] [--loop=<loop-count>] [--rate=<calls-per-second>] [--arrivals=<arrivals>] [--duration=<seconds>] [--warmup=<seconds>] [--start-at=<epoch-seconds>] [--hdr-output=<file>] [--histogram-output=<file>] [--merge=<file,file,...>]" << endl <<
     "\tclients        Number of client threads to create - 0 implies no clients, i.e. server only.  Default is " << clientCount << endl <<
     "\thelp           Prints this help text." << endl <<
     "\tcall           Service method to call.  Default is " << callName << endl <<
-    "\tloop           The number of remote thrift calls each client makes.  Default is " << loopCount << endl <<
+    "\tloop           The number of remote thrift calls each client makes, without a rate.  Default is " << loopCount << endl <<
+    "\trate           Calls per second, over all clients, sent open loop for duration seconds - 0 sends loop calls per client back to back.  Default is " << rate << endl <<
+    "\tarrivals       How open loop calls are spaced, \"constant\" or \"poisson\".  Default is " << arrivals << endl <<
+    "\tduration       Seconds to send open loop calls for, after the warmup.  Default is " << duration << endl <<
+    "\twarmup         Seconds of calls, at the start, that are not counted.  Default is " << warmup << endl <<
+    "\tstart-at       Unix time the clients start at, so load generators on several machines run together.  Default is now" << endl <<
+    "\thdr-output     Write the latency percentiles, in microseconds, in the HdrHistogram text format to this file." << endl <<
+    "\thistogram-output Write the latency histogram to this file, for --merge." << endl <<
+    "\tmerge          Print the percentiles of histograms written by --histogram-output, and exit." << endl <<
+    "\thost           The host the clients connect to.  Default is " << host << endl <<
     "\tport           The port the server and clients should bind to for thrift network connections.  Default is " << port << endl <<
     "\tserver         Run the Thrift server in this process.  Default is " << runServer << endl <<
-    "\tserver-type    Type of server, \"simple\" or \"thread-pool\".  Default is " << serverType << endl <<
+    "\tserver-type    Type of server, \"simple\", \"threaded\", \"thread-pool\" or \"nonblocking\".  Default is " << serverType << endl <<
     "\tprotocol-type  Type of protocol, \"binary\", \"ascii\", or \"xml\".  Default is " << protocolType << endl <<
+    "\ttransport      Type of transport, \"buffered\" or \"framed\"; nonblocking servers need framed.  Default is " << transportType << endl <<
     "\tlog-request    Log all request to ./requestlog.tlog. Default is " << logRequests << endl <<
     "\treplay-request Replay requests from log file (./requestlog.tlog) Default is " << replayRequests << endl <<
-    "\tworkers        Number of thread pools workers.  Only valid for thread-pool server type.  Default is " << workerCount << endl;
+    "\tworkers        Number of thread pools workers.  Only valid for thread-pool and nonblocking server types.  Default is " << workerCount << endl <<
+    "\tio-threads     Number of IO threads.  Only valid for the nonblocking server type.  Default is " << ioThreadCount << endl;
 
 
   map<string, string>  args;
@@ -286,6 +534,10 @@ int main(int argc, char **argv) {
       callName = args["call"];
     }
 
+    if (!args["host"].empty()) {
+      host = args["host"];
+    }
+
     if (!args["port"].empty()) {
       port = atoi(args["port"].c_str());
     }
@@ -311,19 +563,84 @@ int main(int argc, char **argv) {
 
       } else if (serverType == "threaded") {
 
+      } else if (serverType == "nonblocking") {
+
+        transportType = "framed";
+
       } else {
 
         throw invalid_argument("Unknown server type "+serverType);
       }
     }
 
+    if (!args["transport"].empty()) {
+      transportType = args["transport"];
+
+      if (transportType != "buffered" && transportType != "framed") {
+        throw invalid_argument("Unknown transport "+transportType);
+      }
+    }
+
     if (!args["workers"].empty()) {
       workerCount = atoi(args["workers"].c_str());
     }
 
+    if (!args["io-threads"].empty()) {
+      ioThreadCount = atoi(args["io-threads"].c_str());
+    }
+
+    if (!args["rate"].empty()) {
+      rate = atof(args["rate"].c_str());
+    }
+
+    if (!args["arrivals"].empty()) {
+      arrivals = args["arrivals"];
+
+      if (arrivals != "constant" && arrivals != "poisson") {
+        throw invalid_argument("Unknown arrivals "+arrivals);
+      }
+    }
+
+    if (!args["duration"].empty()) {
+      duration = atof(args["duration"].c_str());
+    }
+
+    if (!args["warmup"].empty()) {
+      warmup = atof(args["warmup"].c_str());
+    }
+
+    if (!args["start-at"].empty()) {
+      startAt = atoll(args["start-at"].c_str());
+    }
+
+    hdrPath = args["hdr-output"];
+    histogramPath = args["histogram-output"];
+    mergePaths = args["merge"];
+
   } catch(std::exception& e) {
     cerr << e.what() << endl;
-    cerr << usage;
+    cerr << usage.str();
+    return 1;
+  }
+
+  if (!mergePaths.empty()) {
+    Histogram merged;
+    istringstream paths(mergePaths);
+    string path;
+    while (getline(paths, path, ',')) {
+      ifstream in(path.c_str());
+      if (!merged.read(in)) {
+        cerr << "Can't read a histogram from " << path << endl;
+        return 1;
+      }
+    }
+    cout << "calls : " << merged.count() << endl;
+    merged.printSummary(cout);
+    if (!hdrPath.empty()) {
+      ofstream out(hdrPath.c_str());
+      merged.printHdr(out);
+    }
+    return 0;
   }
 
   boost::shared_ptr<PlatformThreadFactory> threadFactory = boost::shared_ptr<PlatformThreadFactory>(new PlatformThreadFactory());
@@ -361,7 +678,12 @@ int main(int argc, char **argv) {
     boost::shared_ptr<TServerSocket> serverSocket(new TServerSocket(port));
 
     // Transport Factory
-    boost::shared_ptr<TTransportFactory> transportFactory(new TBufferedTransportFactory());
+    boost::shared_ptr<TTransportFactory> transportFactory;
+    if (transportType == "framed") {
+      transportFactory.reset(new TFramedTransportFactory());
+    } else {
+      transportFactory.reset(new TBufferedTransportFactory());
+    }
 
     // Protocol Factory
     boost::shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
@@ -393,6 +715,19 @@ int main(int argc, char **argv) {
       threadManager->threadFactory(threadFactory);
       threadManager->start();
       serverThread = threadFactory->newThread(boost::shared_ptr<TServer>(new TThreadPoolServer(serviceProcessor, serverSocket, transportFactory, protocolFactory, threadManager)));
+
+    } else if (serverType == "nonblocking") {
+
+      // Without workers, calls are served on the IO threads
+      boost::shared_ptr<ThreadManager> threadManager;
+      if (workerCount > 0) {
+        threadManager = ThreadManager::newSimpleThreadManager(workerCount);
+        threadManager->threadFactory(threadFactory);
+        threadManager->start();
+      }
+      boost::shared_ptr<TNonblockingServer> server(new TNonblockingServer(serviceProcessor, protocolFactory, port, threadManager));
+      server->setNumIOThreads(ioThreadCount);
+      serverThread = threadFactory->newThread(server);
     }
 
     cerr << "Starting the server on port " << port << endl;
@@ -414,6 +749,10 @@ int main(int argc, char **argv) {
 
     set<boost::shared_ptr<Thread> > clientThreads;
 
+    Schedule schedule;
+    schedule.rate = rate / clientCount;
+    schedule.poisson = arrivals == "poisson";
+
     if (callName == "echoVoid") { loopType = T_VOID;}
     else if (callName == "echoByte") { loopType = T_BYTE;}
     else if (callName == "echoI32") { loopType = T_I32;}
@@ -423,24 +762,39 @@ int main(int argc, char **argv) {
 
     for (size_t ix = 0; ix < clientCount; ix++) {
 
-      boost::shared_ptr<TSocket> socket(new TSocket("127.0.0.1", port));
-      boost::shared_ptr<TBufferedTransport> bufferedSocket(new TBufferedTransport(socket, 2048));
-      boost::shared_ptr<TProtocol> protocol(new TBinaryProtocol(bufferedSocket));
+      boost::shared_ptr<TSocket> socket(new TSocket(host, port));
+      boost::shared_ptr<TTransport> transport;
+      if (transportType == "framed") {
+        transport.reset(new TFramedTransport(socket));
+      } else {
+        transport.reset(new TBufferedTransport(socket, 2048));
+      }
+      boost::shared_ptr<TProtocol> protocol(new TBinaryProtocol(transport));
       boost::shared_ptr<ServiceClient> serviceClient(new ServiceClient(protocol));
 
-      clientThreads.insert(threadFactory->newThread(boost::shared_ptr<ClientThread>(new ClientThread(socket, serviceClient, monitor, threadCount, loopCount, loopType))));
+      uint64_t seed = static_cast<uint64_t>(Util::currentTimeUsec()) * (ix + 1) + ix;
+      clientThreads.insert(threadFactory->newThread(boost::shared_ptr<ClientThread>(new ClientThread(transport, serviceClient, monitor, threadCount, loopCount, loopType, schedule, seed))));
     }
 
     for (std::set<boost::shared_ptr<Thread> >::const_iterator thread = clientThreads.begin(); thread != clientThreads.end(); thread++) {
       (*thread)->start();
     }
 
+    bool countAllocs = allocInterposerInstalled();
+    TAllocTracking::Counts allocsBefore;
+    TAllocTracking::getCounts(allocsBefore);
+
     int64_t time00;
     int64_t time01;
 
     {Synchronized s(monitor);
       threadCount = clientCount;
 
+      // Give the server a moment to listen, unless told when to start
+      schedule.start = startAt > 0 ? startAt * 1000000 : Util::currentTimeUsec() + 100000;
+      schedule.measureFrom = schedule.start + static_cast<int64_t>(warmup * 1000000);
+      schedule.end = schedule.measureFrom + static_cast<int64_t>(duration * 1000000);
+
       cerr << "Launch "<< clientCount << " client threads" << endl;
 
       time00 =  Util::currentTime();
@@ -461,6 +815,14 @@ int main(int argc, char **argv) {
     int64_t minTime = 9223372036854775807LL;
     int64_t maxTime = 0;
 
+    TAllocTracking::Counts allocsAfter;
+    TAllocTracking::getCounts(allocsAfter);
+
+    uint64_t sent = 0;
+    uint64_t calls = 0;
+    uint64_t errors = 0;
+    Histogram latency;
+
     for (set<boost::shared_ptr<Thread> >::iterator ix = clientThreads.begin(); ix != clientThreads.end(); ix++) {
 
       boost::shared_ptr<ClientThread> client = dynamic_pointer_cast<ClientThread>((*ix)->runnable());
@@ -486,17 +848,48 @@ int main(int argc, char **argv) {
       }
 
       averageTime+= delta;
+
+      sent += client->_sent;
+      calls += client->_calls;
+      errors += client->_errors;
+      latency.merge(client->_latency);
     }
 
     averageTime /= clientCount;
 
+    if (rate > 0) {
+      cout << "workers :" << workerCount << ", client : " << clientCount << ", target rate : " << rate << ", arrivals : " << arrivals << ", rate : " << calls / duration << ", errors : " << errors << endl;
+    } else {
+      cout <<  "workers :" << workerCount << ", client : " << clientCount << ", loops : " << loopCount << ", rate : " << (clientCount * loopCount * 1000) / ((double)(time01 - time00)) << ", errors : " << errors << endl;
+    }
+    latency.printSummary(cout);
+
+    // Over every call made, by the clients and, if it runs here, the server
+    if (countAllocs && sent > 0) {
+      cout << "allocs/call : " << static_cast<double>(allocsAfter.totalAllocations() - allocsBefore.totalAllocations()) / sent
+           << " (" << (allocsAfter.totalBytes() - allocsBefore.totalBytes()) / sent << " bytes)";
+      for (int category = 0; category < TAllocTracking::NUM_CATEGORIES; category++) {
+        cout << ", " << TAllocTracking::name(static_cast<TAllocTracking::Category>(category)) << " "
+             << static_cast<double>(allocsAfter.allocations[category] - allocsBefore.allocations[category]) / sent;
+      }
+      cout << endl;
+    }
 
-    cout <<  "workers :" << workerCount << ", client : " << clientCount << ", loops : " << loopCount << ", rate : " << (clientCount * loopCount * 1000) / ((double)(time01 - time00)) << endl;
+    if (!hdrPath.empty()) {
+      ofstream out(hdrPath.c_str());
+      latency.printHdr(out);
+    }
+    if (!histogramPath.empty()) {
+      ofstream out(histogramPath.c_str());
+      latency.write(out);
+    }
 
-    count_map count = serviceHandler->getCount();
-    count_map::iterator iter;
-    for (iter = count.begin(); iter != count.end(); ++iter) {
-      printf("%s => %d\n", iter->first, iter->second);
+    if (runServer) {
+      count_map count = serviceHandler->getCount();
+      count_map::iterator iter;
+      for (iter = count.begin(); iter != count.end(); ++iter) {
+        printf("%s => %d\n", iter->first, iter->second);
+      }
     }
     cerr << "done." << endl;
   }
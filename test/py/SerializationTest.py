@@ -276,6 +276,9 @@ class AcceleratedBinaryTest(AbstractTest):
 class CompactProtocolTest(AbstractTest):
   protocol_factory = TCompactProtocol.TCompactProtocolFactory()
 
+class AcceleratedCompactTest(AbstractTest):
+  protocol_factory = TCompactProtocol.TCompactProtocolAcceleratedFactory()
+
 class JSONProtocolTest(AbstractTest):
   protocol_factory = TJSONProtocol.TJSONProtocolFactory()
 
@@ -343,6 +346,18 @@ class SerializersTest(unittest.TestCase):
       objcopy = Bonk()
       deserialize(objcopy, serialize(obj))
       self.assertEquals(obj, objcopy)
+
+  def testDeserializeFromBuffers(self):
+    obj = Xtruct2(i32_thing=1,
+                  struct_thing=Xtruct(string_thing="foo"))
+    for protocol_factory in (TBinaryProtocol.TBinaryProtocolAcceleratedFactory(),
+                             TCompactProtocol.TCompactProtocolAcceleratedFactory()):
+      s = serialize(obj, protocol_factory)
+      for buf in (s, bytearray(s), memoryview(s), buffer(s)):
+        objcopy = Xtruct2()
+        deserialize(objcopy, buf, protocol_factory)
+        self.assertEquals(obj, objcopy)
+      self.assertRaises(EOFError, deserialize, Xtruct2(), s[:-1], protocol_factory)
   
 
 def suite():
@@ -352,6 +367,7 @@ def suite():
   suite.addTest(loader.loadTestsFromTestCase(NormalBinaryTest))
   suite.addTest(loader.loadTestsFromTestCase(AcceleratedBinaryTest))
   suite.addTest(loader.loadTestsFromTestCase(CompactProtocolTest))
+  suite.addTest(loader.loadTestsFromTestCase(AcceleratedCompactTest))
   suite.addTest(loader.loadTestsFromTestCase(JSONProtocolTest))
   suite.addTest(loader.loadTestsFromTestCase(AcceleratedFramedTest))
   suite.addTest(loader.loadTestsFromTestCase(SerializersTest))
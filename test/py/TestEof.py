@@ -126,6 +126,11 @@ class TestEof(unittest.TestCase):
     self.eofTestHelper(TCompactProtocol.TCompactProtocolFactory())
     self.eofTestHelperStress(TCompactProtocol.TCompactProtocolFactory())
 
+  def testCompactProtocolAcceleratedEof(self):
+    """Test that TCompactProtocolAccelerated throws an EOFError when it reaches the end of the stream"""
+    self.eofTestHelper(TCompactProtocol.TCompactProtocolAcceleratedFactory())
+    self.eofTestHelperStress(TCompactProtocol.TCompactProtocolAcceleratedFactory())
+
 def suite():
   suite = unittest.TestSuite()
   loader = unittest.TestLoader()